@@ -0,0 +1,321 @@
+#include <core/asset_package.h>
+#include <core/mapped_file.h>
+#include <graphics/mesh_cache.h>
+#include <graphics/obj_importer.h>
+#include <graphics/renderer.h>
+#include <graphics/texture_cook.h>
+#include <jobs/scheduler.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const char* const usage = "usage: cooker DIRECTORY [--force] [--package FILE [--compress]]";
+
+// Next to the sources, which is where the cooked assets go as well
+const char* const manifest_name = "cooked.manifest";
+
+const char* const texture_extensions[] = { ".jpg", ".jpeg", ".png", ".tga", ".bmp" };
+
+// What the renderer loads besides models and textures, or their cooked versions, and so what goes
+// into a package
+const char* const packaged_extensions[] = { ".spv", ".meshcache", ".ktx2" };
+
+enum class asset_kind
+{
+    mesh,
+    texture,
+};
+
+enum class cook_result
+{
+    up_to_date,
+    cooked,
+    skipped,  // left for the renderer to load from the source
+    failed,
+};
+
+struct asset
+{
+    std::string path;
+    std::string name;  // relative to the directory, which is what the manifest has
+    asset_kind  kind;
+
+    uint64_t    hash   = 0;
+    cook_result result = cook_result::failed;
+};
+
+uint64_t
+contentHash(const std::string& path)
+{
+    shiny::core::mapped_file file;
+    if (!file.open(path)) {
+        return 0;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char* p = file.begin(); p < file.end(); ++p) {
+        hash ^= (unsigned char)*p;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+std::string
+lowerExtension(const std::filesystem::path& path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](char c) { return (char)std::tolower((unsigned char)c); });
+    return extension;
+}
+
+// Every asset the renderer can load, in a stable order so that the output is too
+std::vector<asset>
+findAssets(const std::filesystem::path& directory)
+{
+    std::vector<asset> assets;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+
+        const std::string extension = lowerExtension(entry.path());
+
+        asset found;
+        found.path = entry.path().string();
+        found.name = entry.path().lexically_relative(directory).generic_string();
+
+        if (extension == ".obj") {
+            found.kind = asset_kind::mesh;
+        } else if (std::find(std::begin(texture_extensions), std::end(texture_extensions),
+                             extension)
+                   != std::end(texture_extensions)) {
+            found.kind = asset_kind::texture;
+        } else {
+            continue;
+        }
+        assets.push_back(std::move(found));
+    }
+
+    std::sort(assets.begin(), assets.end(),
+              [](const asset& a, const asset& b) { return a.name < b.name; });
+    return assets;
+}
+
+// Lines of a hash in hex and the name of the asset it was cooked from
+std::unordered_map<std::string, uint64_t>
+readManifest(const std::filesystem::path& path)
+{
+    std::unordered_map<std::string, uint64_t> hashes;
+
+    std::ifstream file(path);
+    std::string   line;
+    while (std::getline(file, line)) {
+        const size_t space = line.find(' ');
+        if (space == std::string::npos) {
+            continue;
+        }
+        hashes[line.substr(space + 1)] = std::strtoull(line.substr(0, space).c_str(), nullptr, 16);
+    }
+    return hashes;
+}
+
+void
+writeManifest(const std::filesystem::path& path, const std::vector<asset>& assets)
+{
+    std::ofstream file(path, std::ios::trunc);
+    for (const asset& a : assets) {
+        if (a.result == cook_result::up_to_date || a.result == cook_result::cooked) {
+            char hash[17];
+            std::snprintf(hash, sizeof(hash), "%016" PRIx64, a.hash);
+            file << hash << ' ' << a.name << '\n';
+        }
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path.string());
+    }
+}
+
+/*
+An asset whose contents hash the same as when it was last cooked, and whose cooked version is still
+there, is left alone. A mesh cache is checked against the source's stamp rather than its contents
+when it is read, so a source that was only touched gets the cache restamped instead of recooked.
+*/
+cook_result
+cookAsset(const asset& a, bool changed, shiny::jobs::scheduler& jobs)
+{
+    if (a.kind == asset_kind::mesh) {
+        const std::string cachepath = shiny::graphics::meshCachePath(a.path);
+        const uint64_t    stamp     = shiny::graphics::meshSourceHash(a.path);
+        if (!changed && shiny::graphics::restampMeshCache(cachepath, stamp)) {
+            return cook_result::up_to_date;
+        }
+
+        // cookObj would take a cache that is still stamped as current
+        std::error_code error;
+        std::filesystem::remove(cachepath, error);
+
+        shiny::graphics::Mesh mesh;
+        return shiny::graphics::cookObj(a.path, jobs, mesh) ? cook_result::cooked
+                                                             : cook_result::failed;
+    }
+
+    if (!changed && std::filesystem::exists(shiny::graphics::cookedTexturePath(a.path))) {
+        return cook_result::up_to_date;
+    }
+    return shiny::graphics::cookTexture(a.path, jobs) ? cook_result::cooked
+                                                      : cook_result::skipped;
+}
+
+/*
+The cooked assets, and the sources of those that couldn't be cooked, plus the shaders. Sources that
+were cooked stay out, the renderer only reads their cooked versions.
+*/
+std::vector<shiny::core::package_source>
+packageSources(const std::filesystem::path& directory, const std::vector<asset>& assets)
+{
+    std::vector<shiny::core::package_source> sources;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+        const std::string extension = lowerExtension(entry.path());
+        if (entry.is_regular_file()
+            && std::find(std::begin(packaged_extensions), std::end(packaged_extensions),
+                         extension)
+                 != std::end(packaged_extensions)) {
+            sources.push_back({ entry.path().string(),
+                                entry.path().lexically_relative(directory).generic_string() });
+        }
+    }
+    for (const asset& a : assets) {
+        if (a.result == cook_result::skipped) {
+            sources.push_back({ a.path, a.name });
+        }
+    }
+
+    std::sort(sources.begin(), sources.end(),
+              [](const shiny::core::package_source& a, const shiny::core::package_source& b) {
+                  return a.name < b.name;
+              });
+    return sources;
+}
+
+const char*
+resultName(cook_result result)
+{
+    switch (result) {
+        case cook_result::up_to_date:
+            return "up to date";
+        case cook_result::cooked:
+            return "cooked";
+        case cook_result::skipped:
+            return "skipped";
+        case cook_result::failed:
+            break;
+    }
+    return "FAILED";
+}
+
+}  // namespace
+
+/*
+Cooks every model and texture under a directory ahead of time: models go through the whole OBJ
+import into their mesh caches, and textures get their mip chains compressed to BC1 KTX2 files. The
+renderer looks for both next to the sources and only falls back to importing them itself when they
+aren't there. With --package the results, and the shaders, are put into one package for the
+renderer to mount, named relative to the directory.
+
+Assets are cooked in parallel, each on a job of its own that splits its own work up further on the
+same scheduler.
+*/
+int
+main(int argc, char** argv)
+{
+    try {
+        std::string directory;
+        std::string package;
+        bool        force    = false;
+        bool        compress = false;
+
+        for (int i = 1; i < argc; ++i) {
+            const std::string option = argv[i];
+            if (option == "--force") {
+                force = true;
+            } else if (option == "--package" && i + 1 < argc) {
+                package = argv[++i];
+            } else if (option == "--compress") {
+                compress = true;
+            } else if (directory.empty() && option.compare(0, 2, "--") != 0) {
+                directory = option;
+            } else {
+                throw std::runtime_error("Unknown option " + option + "\n" + usage);
+            }
+        }
+        if (directory.empty()) {
+            throw std::runtime_error(usage);
+        }
+
+        const std::filesystem::path manifest = std::filesystem::path(directory) / manifest_name;
+        const auto                  cooked   = readManifest(manifest);
+        std::vector<asset>          assets   = findAssets(directory);
+
+        shiny::jobs::scheduler jobs;
+        jobs.init();
+
+        jobs.parallelFor(0, (uint32_t)assets.size(), 1, [&](uint32_t first, uint32_t last) {
+            for (uint32_t i = first; i < last; ++i) {
+                asset& a = assets[i];
+
+                // Jobs must not throw
+                try {
+                    a.hash = contentHash(a.path);
+
+                    const auto found   = cooked.find(a.name);
+                    const bool changed = force || found == cooked.end() || found->second != a.hash;
+                    a.result = a.hash == 0 ? cook_result::failed : cookAsset(a, changed, jobs);
+                } catch (const std::exception&) {
+                    a.result = cook_result::failed;
+                }
+            }
+        });
+
+        writeManifest(manifest, assets);
+
+        size_t failed = 0;
+        for (const asset& a : assets) {
+            std::cout << a.name << ": " << resultName(a.result) << std::endl;
+            failed += a.result == cook_result::failed ? 1 : 0;
+        }
+        if (failed > 0) {
+            throw std::runtime_error(std::to_string(failed) + " of " + std::to_string(assets.size())
+                                     + " assets failed to cook");
+        }
+
+        if (!package.empty()) {
+            const std::vector<shiny::core::package_source> sources =
+              packageSources(directory, assets);
+            if (!shiny::core::writePackage(package, sources, compress, &jobs)) {
+                throw std::runtime_error("Failed to write package " + package);
+            }
+            std::cout << "Packaged " << sources.size() << " files into " << package << std::endl;
+        }
+
+        jobs.shutdown();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,622 @@
+#include <core/transform_math.h>
+#include <graphics/descriptor_allocator.h>
+#include <graphics/frustum_culling.h>
+#include <graphics/host_allocator.h>
+#include <graphics/memory_allocator.h>
+#include <graphics/mesh_cache.h>
+#include <graphics/mesh_codec.h>
+#include <graphics/obj_importer.h>
+#include <graphics/renderer.h>
+#include <graphics/staging_arena.h>
+#include <graphics/upload_service.h>
+#include <jobs/scheduler.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const char* const usage =
+  "usage: microbench [--filter TEXT] [--min-time SECONDS] [--repetitions N] [--csv FILE]\n"
+  "                  [--model OBJ] [--no-gpu] [--list]";
+
+// What the OBJ benchmarks read when no --model is given, a grid of this many quads a side
+const uint32_t generated_grid_size = 400;
+
+const uint32_t dedup_corners      = 1 << 20;
+const uint32_t culled_spheres     = 1 << 16;
+const uint32_t transform_count    = 1 << 14;
+const uint32_t suballocations     = 1024;
+const uint32_t descriptor_sets    = 1024;
+const uint32_t upload_chunk_size  = 1 << 20;
+const uint32_t upload_chunks      = 64;  // per submission
+const uint32_t staging_arena_size = 2 * upload_chunk_size * upload_chunks;
+const uint32_t upload_target_size = upload_chunk_size * upload_chunks;
+
+/*
+One benchmark: `run` is a single iteration, which the runner repeats until it has taken long
+enough to time, and `bytes` what an iteration processes, for a throughput on top of the time
+*/
+struct benchmark
+{
+    std::string           name;
+    std::function<void()> run;
+    uint64_t              bytes = 0;
+};
+
+struct measurement
+{
+    std::string name;
+    uint64_t    iterations  = 0;
+    double      nanoseconds = 0.;  // per iteration, the median of the repetitions
+    double      megabytes   = 0.;  // per second, if the benchmark has bytes
+};
+
+// Keeps the compiler from optimizing away what a benchmark computes
+volatile uint64_t sink = 0;
+
+void
+keep(uint64_t value)
+{
+    sink = sink + value;
+}
+
+/*
+Like Google Benchmark, the iteration count grows until a run takes at least `min_time`, and that
+count is then run `repetitions` times, of which the median is reported. One iteration goes first
+so that nothing is measured cold.
+*/
+measurement
+measure(const benchmark& b, double min_time, uint32_t repetitions)
+{
+    b.run();
+
+    uint64_t iterations = 1;
+    double   elapsed    = 0.;
+    for (;;) {
+        const int64_t start = shiny::core::profileNow();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            b.run();
+        }
+        elapsed = (double)(shiny::core::profileNow() - start) * 1e-9;
+        if (elapsed >= min_time) {
+            break;
+        }
+
+        // Aim a little past it, at most ten times as many at once
+        const double factor = elapsed > 0. ? std::min(min_time * 1.4 / elapsed, 10.) : 10.;
+        iterations          = std::max(iterations + 1, (uint64_t)((double)iterations * factor));
+    }
+
+    std::vector<double> times = { elapsed };
+    for (uint32_t r = 1; r < repetitions; ++r) {
+        const int64_t start = shiny::core::profileNow();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            b.run();
+        }
+        times.push_back((double)(shiny::core::profileNow() - start) * 1e-9);
+    }
+    std::sort(times.begin(), times.end());
+    const double median = times[times.size() / 2];
+
+    measurement m;
+    m.name        = b.name;
+    m.iterations  = iterations;
+    m.nanoseconds = median * 1e9 / (double)iterations;
+    m.megabytes   = b.bytes ? (double)b.bytes * (double)iterations / median / (1024. * 1024.) : 0.;
+    return m;
+}
+
+std::string
+formatTime(double nanoseconds)
+{
+    char text[32];
+    if (nanoseconds >= 1e6) {
+        std::snprintf(text, sizeof(text), "%.2f ms", nanoseconds * 1e-6);
+    } else if (nanoseconds >= 1e3) {
+        std::snprintf(text, sizeof(text), "%.2f us", nanoseconds * 1e-3);
+    } else {
+        std::snprintf(text, sizeof(text), "%.1f ns", nanoseconds);
+    }
+    return text;
+}
+
+// A grid of quads with texture coordinates, every inner corner shared by four of them
+std::string
+writeGridObj(uint32_t size)
+{
+    const std::string path =
+      (std::filesystem::temp_directory_path() / "shiny_microbench.obj").string();
+
+    std::ofstream file(path);
+    for (uint32_t y = 0; y <= size; ++y) {
+        for (uint32_t x = 0; x <= size; ++x) {
+            file << "v " << x << " 0 " << y << "\n";
+            file << "vt " << (float)x / size << " " << (float)y / size << "\n";
+        }
+    }
+    for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+            const uint32_t a = y * (size + 1) + x + 1;
+            const uint32_t b = a + 1;
+            const uint32_t c = a + size + 2;
+            const uint32_t d = a + size + 1;
+            file << "f " << a << "/" << a << " " << b << "/" << b << " " << c << "/" << c << " "
+                 << d << "/" << d << "\n";
+        }
+    }
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+    return path;
+}
+
+uint64_t
+fileSize(const std::string& path)
+{
+    std::error_code error;
+    const uintmax_t size = std::filesystem::file_size(path, error);
+    return error ? 0 : (uint64_t)size;
+}
+
+void
+addMeshBenchmarks(std::vector<benchmark>& benchmarks,
+                  const std::string&      model,
+                  shiny::jobs::scheduler& jobs)
+{
+    using namespace shiny::graphics;
+
+    const std::string objpath = model.empty() ? writeGridObj(generated_grid_size) : model;
+
+    benchmarks.push_back({ "obj/import",
+                           [objpath, &jobs]() {
+                               Mesh mesh;
+                               if (!importObj(objpath, jobs, mesh)) {
+                                   throw std::runtime_error("Failed to import " + objpath);
+                               }
+                               keep(mesh.vertices.size());
+                           },
+                           fileSize(objpath) });
+
+    // The binary mesh loader, reading what the import wrote
+    Mesh mesh;
+    if (!importObj(objpath, jobs, mesh)) {
+        throw std::runtime_error("Failed to import " + objpath);
+    }
+    const std::string cachepath =
+      (std::filesystem::temp_directory_path() / "shiny_microbench.meshcache").string();
+    if (!writeMeshCache(cachepath, 1, mesh)) {
+        throw std::runtime_error("Failed to write " + cachepath);
+    }
+    benchmarks.push_back({ "mesh_cache/read",
+                           [cachepath, &jobs]() {
+                               Mesh cached;
+                               if (!readMeshCache(cachepath, 1, cached, &jobs)) {
+                                   throw std::runtime_error("Failed to read " + cachepath);
+                               }
+                               keep(cached.vertices.size());
+                           },
+                           fileSize(cachepath) });
+
+    // The vertex codec on one thread, by the bytes it decodes to
+    auto encoded = std::make_shared<std::vector<char>>();
+    encodeVertices(mesh.vertices.data(), (uint32_t)mesh.vertices.size(), sizeof(Vertex), *encoded);
+    benchmarks.push_back({ "mesh_codec/vertices",
+                           [encoded, count = (uint32_t)mesh.vertices.size()]() {
+                               std::vector<Vertex> vertices(count);
+                               if (!decodeVertices(encoded->data(), encoded->size(), count,
+                                                   sizeof(Vertex), vertices.data(), nullptr)) {
+                                   throw std::runtime_error("Failed to decode vertices");
+                               }
+                               keep(vertices.size());
+                           },
+                           mesh.vertices.size() * sizeof(Vertex) });
+
+    // importObj's vertex numbering: corners keyed by position, texture coordinate and material,
+    // a quarter of them distinct like on a closed mesh
+    auto         corners = std::make_shared<std::vector<glm::uvec3>>();
+    std::mt19937 random(1);
+    for (uint32_t c = 0; c < dedup_corners; ++c) {
+        const uint32_t vertex = random() % (dedup_corners / 4);
+        corners->push_back(glm::uvec3(vertex, vertex + 1, 0));
+    }
+    benchmarks.push_back({ "vertex_dedup/uvec3",
+                           [corners]() {
+                               std::unordered_map<glm::uvec3, uint32_t> numbers;
+                               numbers.reserve(corners->size() / 4);
+                               for (const glm::uvec3& key : *corners) {
+                                   numbers.try_emplace(key, (uint32_t)numbers.size());
+                               }
+                               keep(numbers.size());
+                           },
+                           corners->size() * sizeof(glm::uvec3) });
+}
+
+void
+addCullingBenchmarks(std::vector<benchmark>& benchmarks)
+{
+    using namespace shiny::graphics;
+
+    // Spread around the camera, so about a fifth of them are in view
+    auto                                  spheres = std::make_shared<sphere_list>();
+    std::mt19937                          random(2);
+    std::uniform_real_distribution<float> position(-100.f, 100.f);
+    std::uniform_real_distribution<float> radius(0.5f, 4.f);
+    for (uint32_t i = 0; i < culled_spheres; ++i) {
+        spheres->push(glm::vec3(position(random), position(random), position(random)),
+                      radius(random));
+    }
+
+    const glm::mat4 projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 200.f);
+    const glm::mat4 view =
+      glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+    const frustum   planes = extractFrustum(projection * view);
+
+    auto visible = std::make_shared<std::vector<uint8_t>>();
+    benchmarks.push_back({ "culling/spheres",
+                           [spheres, planes, visible]() {
+                               spheres->cull(planes, *visible);
+                               keep((*visible)[0]);
+                           },
+                           (uint64_t)culled_spheres * sizeof(glm::vec4) });
+}
+
+// Every kernel at every instruction set this CPU has
+void
+addTransformBenchmarks(std::vector<benchmark>& benchmarks)
+{
+    using namespace shiny::core;
+
+    struct transform_data
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<glm::quat> rotations;
+        std::vector<glm::vec3> scales;
+        std::vector<glm::mat4> parents;
+        std::vector<uint32_t>  parent_indices;
+        std::vector<glm::mat4> transforms;
+        std::vector<glm::vec4> planes;
+    };
+
+    auto         data = std::make_shared<transform_data>();
+    std::mt19937 random(3);
+    for (uint32_t i = 0; i < transform_count; ++i) {
+        const float angle = (float)(random() % 360);
+        data->positions.push_back(glm::vec3((float)(random() % 100), 0.f, (float)i));
+        data->rotations.push_back(glm::angleAxis(glm::radians(angle), glm::vec3(0.f, 1.f, 0.f)));
+        data->scales.push_back(glm::vec3(1.f + (float)(random() % 4)));
+        data->parents.push_back(glm::translate(glm::mat4(1.f), data->positions.back()));
+        data->parent_indices.push_back(i % 8 == 0 ? no_transform_parent : random() % (i + 1));
+    }
+    data->transforms.resize(transform_count);
+    data->planes.resize(transform_count * 6);
+
+    const uint64_t matrices = (uint64_t)transform_count * sizeof(glm::mat4);
+
+    for (simd_level level :
+         { simd_level::scalar, simd_level::sse2, simd_level::avx2, simd_level::neon }) {
+        if (setTransformSimd(level) != level) {
+            continue;
+        }
+
+        const std::string suffix = std::string("/") + simdName(level);
+        auto select              = [level]() { setTransformSimd(level); };
+
+        benchmarks.push_back({ "transforms/compose" + suffix,
+                               [data, select]() {
+                                   select();
+                                   composeTransforms(data->positions.data(),
+                                                     data->rotations.data(), data->scales.data(),
+                                                     data->transforms.data(), transform_count);
+                               },
+                               matrices });
+        benchmarks.push_back({ "transforms/parents" + suffix,
+                               [data, select]() {
+                                   select();
+                                   applyParents(data->parents.data(), data->parent_indices.data(),
+                                                data->transforms.data(), transform_count);
+                               },
+                               matrices });
+        benchmarks.push_back({ "transforms/planes" + suffix,
+                               [data, select]() {
+                                   select();
+                                   extractPlanes(data->transforms.data(), data->planes.data(),
+                                                 transform_count);
+                               },
+                               matrices });
+    }
+
+    setTransformSimd(transformSimd());
+}
+
+/*
+A device without a window or a surface, on the first physical device with a graphics queue, for
+what needs one: the sub-allocator, descriptor allocation and the staging path
+*/
+struct gpu_context
+{
+    vk::Instance       instance;
+    vk::PhysicalDevice physical_device;
+    vk::Device         device;
+    uint32_t           family = 0;
+    vk::Queue          queue;
+
+    shiny::graphics::memory_allocator allocator;
+    shiny::graphics::staging_arena    staging;
+    shiny::graphics::upload_service   uploads;
+
+    vk::Buffer                  target;  // what the uploads copy into
+    shiny::graphics::allocation target_memory;
+
+    vk::DescriptorSetLayout               set_layout;
+    shiny::graphics::descriptor_allocator descriptors;
+
+    bool create();
+    void destroy();
+};
+
+bool
+gpu_context::create()
+{
+    using namespace shiny::graphics;
+
+    auto appinfo = vk::ApplicationInfo()
+                     .setPApplicationName("microbench")
+                     .setPEngineName("shiny")
+                     .setApiVersion(VK_API_VERSION_1_0);
+    instance = vk::createInstance(vk::InstanceCreateInfo().setPApplicationInfo(&appinfo),
+                                  hostAllocator());
+
+    for (vk::PhysicalDevice candidate : instance.enumeratePhysicalDevices()) {
+        const auto families = candidate.getQueueFamilyProperties();
+        for (uint32_t f = 0; f < (uint32_t)families.size(); ++f) {
+            if (!physical_device && (families[f].queueFlags & vk::QueueFlagBits::eGraphics)) {
+                physical_device = candidate;
+                family          = f;
+            }
+        }
+    }
+    if (!physical_device) {
+        instance.destroy(hostAllocator());
+        instance = nullptr;
+        return false;
+    }
+
+    const float priority  = 1.f;
+    auto        queueinfo = vk::DeviceQueueCreateInfo()
+                              .setQueueFamilyIndex(family)
+                              .setQueueCount(1)
+                              .setPQueuePriorities(&priority);
+    device = physical_device.createDevice(
+      vk::DeviceCreateInfo().setQueueCreateInfoCount(1).setPQueueCreateInfos(&queueinfo),
+      hostAllocator());
+    queue = device.getQueue(family, 0);
+
+    allocator.init(physical_device, device);
+    staging.init(device, allocator, staging_arena_size);
+    uploads.init(physical_device, device, staging, family, queue, family, queue, false);
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(upload_target_size)
+                        .setUsage(vk::BufferUsageFlagBits::eTransferDst
+                                  | vk::BufferUsageFlagBits::eVertexBuffer)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+    target        = device.createBuffer(bufferinfo, hostAllocator());
+    target_memory = allocator.allocate(device.getBufferMemoryRequirements(target),
+                                       vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                       memory_allocator::resource_kind::linear,
+                                       memory_category::vertex);
+    device.bindBufferMemory(target, target_memory.memory, target_memory.offset);
+
+    // Shaped like a material's set: a uniform buffer and a texture
+    const std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+        vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eUniformBuffer, 1,
+                                       vk::ShaderStageFlagBits::eVertex),
+        vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eCombinedImageSampler, 1,
+                                       vk::ShaderStageFlagBits::eFragment),
+    };
+    set_layout = device.createDescriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo().setBindingCount(2).setPBindings(bindings.data()),
+      hostAllocator());
+    descriptors.init(device,
+                     { vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, 1),
+                       vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 1) },
+                     256);
+    return true;
+}
+
+void
+gpu_context::destroy()
+{
+    using namespace shiny::graphics;
+
+    if (!device) {
+        return;
+    }
+
+    device.waitIdle();
+    descriptors.destroy();
+    device.destroyDescriptorSetLayout(set_layout, hostAllocator());
+    device.destroyBuffer(target, hostAllocator());
+    allocator.free(target_memory);
+    uploads.destroy();
+    staging.destroy();
+    allocator.destroy();
+    device.destroy(hostAllocator());
+    instance.destroy(hostAllocator());
+    device   = nullptr;
+    instance = nullptr;
+}
+
+void
+addGpuBenchmarks(std::vector<benchmark>& benchmarks, gpu_context& gpu)
+{
+    using namespace shiny::graphics;
+
+    // Sizes like buffers and textures have, which the allocator rounds into its size classes
+    auto         sizes = std::make_shared<std::vector<vk::MemoryRequirements>>();
+    std::mt19937 random(4);
+    for (uint32_t i = 0; i < suballocations; ++i) {
+        sizes->push_back(vk::MemoryRequirements((vk::DeviceSize)(256 << (random() % 12)), 256,
+                                                ~0u));
+    }
+    auto allocations = std::make_shared<std::vector<allocation>>(suballocations);
+    benchmarks.push_back({ "memory_allocator/allocate_free",
+                           [&gpu, sizes, allocations]() {
+                               for (uint32_t i = 0; i < suballocations; ++i) {
+                                   (*allocations)[i] = gpu.allocator.allocate(
+                                     (*sizes)[i], vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                     memory_allocator::resource_kind::linear,
+                                     memory_category::other);
+                               }
+                               for (allocation& alloc : *allocations) {
+                                   gpu.allocator.free(alloc);
+                               }
+                           } });
+
+    benchmarks.push_back({ "descriptor_allocator/allocate_reset",
+                           [&gpu]() {
+                               for (uint32_t i = 0; i < descriptor_sets; ++i) {
+                                   keep((uint64_t)static_cast<VkDescriptorSet>(
+                                     gpu.descriptors.allocate(gpu.set_layout)));
+                               }
+                               gpu.descriptors.reset();
+                           } });
+
+    // Written into staging memory, copied and waited for, the whole path a mesh upload takes
+    auto source = std::make_shared<std::vector<char>>(upload_chunk_size, 'x');
+    benchmarks.push_back({ "uploads/staged_copy",
+                           [&gpu, source]() {
+                               upload_batch batch = gpu.uploads.begin();
+                               for (uint32_t c = 0; c < upload_chunks; ++c) {
+                                   staging_region region = gpu.staging.allocate(upload_chunk_size);
+                                   if (!region) {
+                                       throw std::runtime_error("Staging arena ran full");
+                                   }
+                                   std::memcpy(region.data, source->data(), upload_chunk_size);
+                                   batch.copyBuffer(region, gpu.target,
+                                                    (vk::DeviceSize)c * upload_chunk_size,
+                                                    vk::AccessFlagBits::eVertexAttributeRead,
+                                                    vk::PipelineStageFlagBits::eVertexInput);
+                               }
+                               gpu.uploads.wait(batch.submit());
+                           },
+                           (uint64_t)upload_chunk_size * upload_chunks });
+}
+
+}  // namespace
+
+/*
+Times the engine's hot paths one by one, so that a regression in any of them shows up on its own
+rather than only in the frame time: OBJ import and the mesh cache, the vertex numbering hash, the
+culling and transform kernels, and with a device, the sub-allocator, descriptor allocation and
+uploads through the staging arena. Benchmarks are named component/case, and --filter picks those
+whose name contains the text. --csv writes the results for comparing runs.
+*/
+int
+main(int argc, char** argv)
+{
+    gpu_context gpu;
+
+    try {
+        std::string filter;
+        std::string csv;
+        std::string model;
+        double      min_time    = 0.5;
+        uint32_t    repetitions = 3;
+        bool        use_gpu     = true;
+        bool        list        = false;
+
+        for (int i = 1; i < argc; ++i) {
+            const std::string option = argv[i];
+            if (option == "--filter" && i + 1 < argc) {
+                filter = argv[++i];
+            } else if (option == "--min-time" && i + 1 < argc) {
+                min_time = std::atof(argv[++i]);
+            } else if (option == "--repetitions" && i + 1 < argc) {
+                repetitions = std::max(1, std::atoi(argv[++i]));
+            } else if (option == "--csv" && i + 1 < argc) {
+                csv = argv[++i];
+            } else if (option == "--model" && i + 1 < argc) {
+                model = argv[++i];
+            } else if (option == "--no-gpu") {
+                use_gpu = false;
+            } else if (option == "--list") {
+                list = true;
+            } else {
+                throw std::runtime_error("Unknown option " + option + "\n" + usage);
+            }
+        }
+
+        shiny::jobs::scheduler jobs;
+        jobs.init();
+
+        std::vector<benchmark> benchmarks;
+        addMeshBenchmarks(benchmarks, model, jobs);
+        addCullingBenchmarks(benchmarks);
+        addTransformBenchmarks(benchmarks);
+        if (use_gpu && gpu.create()) {
+            addGpuBenchmarks(benchmarks, gpu);
+        } else if (use_gpu) {
+            std::cerr << "No Vulkan device, skipping the GPU benchmarks" << std::endl;
+        }
+
+        std::vector<measurement> results;
+        for (const benchmark& b : benchmarks) {
+            if (!filter.empty() && b.name.find(filter) == std::string::npos) {
+                continue;
+            }
+            if (list) {
+                std::cout << b.name << std::endl;
+                continue;
+            }
+
+            const measurement m = measure(b, min_time, repetitions);
+            std::printf("%-40s %12" PRIu64 " %14s", m.name.c_str(), m.iterations,
+                        formatTime(m.nanoseconds).c_str());
+            if (m.megabytes > 0.) {
+                std::printf(" %12.1f MB/s", m.megabytes);
+            }
+            std::printf("\n");
+            std::fflush(stdout);
+            results.push_back(m);
+        }
+
+        if (!csv.empty()) {
+            std::ofstream file(csv);
+            file << "name,iterations,ns_per_iteration,mb_per_second\n";
+            for (const measurement& m : results) {
+                file << m.name << "," << m.iterations << "," << m.nanoseconds << ","
+                     << m.megabytes << "\n";
+            }
+            if (!file) {
+                throw std::runtime_error("Failed to write " + csv);
+            }
+        }
+
+        gpu.destroy();
+        jobs.shutdown();
+    } catch (const std::exception& e) {
+        gpu.destroy();
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
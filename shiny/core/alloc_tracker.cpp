@@ -0,0 +1,363 @@
+#include "core/alloc_tracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace {
+
+using shiny::core::alloc_counts;
+
+// Slot 0 is for allocations outside of any zone, and whichever don't fit anymore
+const uint32_t max_subsystems = 64;
+
+struct subsystem_slot
+{
+    std::atomic<const char*> name{ nullptr };
+    std::atomic<uint64_t>    allocations{ 0 };
+    std::atomic<uint64_t>    bytes{ 0 };
+};
+
+// All of it is constant initialized, so it's there before any static constructor allocates
+subsystem_slot        g_slots[max_subsystems];
+std::atomic<uint32_t> g_slot_count{ 1 };  // claimed, which can run past max_subsystems
+std::atomic<bool>     g_enabled{ false };
+
+std::atomic<uint64_t>    g_violations{ 0 };
+std::atomic<const char*> g_violation_subsystem{ nullptr };
+std::atomic<size_t>      g_violation_bytes{ 0 };
+
+thread_local const char*     t_subsystem   = nullptr;
+thread_local bool            t_forbidden   = false;
+thread_local const char*     t_cached_name = nullptr;  // the last subsystem looked up
+thread_local subsystem_slot* t_cached_slot = nullptr;
+
+/*
+Subsystems are told apart by their names' addresses, which is what makes a lookup cheap enough to
+do for every allocation. Two threads claiming a slot for the same name at once both get one, and
+so does the same name at two addresses, both of which allocSubsystems() merges again.
+*/
+subsystem_slot&
+slotOf(const char* name)
+{
+    if (!name) {
+        return g_slots[0];
+    }
+    if (name == t_cached_name) {
+        return *t_cached_slot;
+    }
+
+    subsystem_slot* slot = nullptr;
+
+    const uint32_t claimed = g_slot_count.load(std::memory_order_acquire);
+    const uint32_t count   = claimed < max_subsystems ? claimed : max_subsystems;
+    for (uint32_t i = 1; i < count && !slot; ++i) {
+        if (g_slots[i].name.load(std::memory_order_acquire) == name) {
+            slot = &g_slots[i];
+        }
+    }
+
+    if (!slot) {
+        const uint32_t index = g_slot_count.fetch_add(1, std::memory_order_acq_rel);
+        if (index < max_subsystems) {
+            g_slots[index].name.store(name, std::memory_order_release);
+            slot = &g_slots[index];
+        } else {
+            slot = &g_slots[0];
+        }
+    }
+
+    t_cached_name = name;
+    t_cached_slot = slot;
+    return *slot;
+}
+
+}  // namespace
+
+namespace shiny::core {
+
+void
+enableAllocTracking(bool enabled)
+{
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool
+allocTracking()
+{
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void
+recordAllocation(size_t bytes)
+{
+    recordAllocation(bytes, t_subsystem);
+}
+
+void
+recordAllocation(size_t bytes, const char* subsystem)
+{
+    if (!g_enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    subsystem_slot& slot = slotOf(subsystem);
+    slot.allocations.fetch_add(1, std::memory_order_relaxed);
+    slot.bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    // Only the first violation is described, the rest are only counted
+    if (t_forbidden && g_violations.fetch_add(1, std::memory_order_relaxed) == 0) {
+        g_violation_subsystem.store(subsystem, std::memory_order_relaxed);
+        g_violation_bytes.store(bytes, std::memory_order_relaxed);
+    }
+}
+
+alloc_counts
+allocTotals()
+{
+    alloc_counts totals;
+    for (const subsystem_slot& slot : g_slots) {
+        totals.allocations += slot.allocations.load(std::memory_order_relaxed);
+        totals.bytes += slot.bytes.load(std::memory_order_relaxed);
+    }
+    return totals;
+}
+
+void
+allocSubsystems(std::vector<alloc_subsystem>& subsystems)
+{
+    const size_t start = subsystems.size();
+    for (const subsystem_slot& slot : g_slots) {
+        alloc_subsystem subsystem;
+        subsystem.name               = slot.name.load(std::memory_order_acquire);
+        subsystem.counts.allocations = slot.allocations.load(std::memory_order_relaxed);
+        subsystem.counts.bytes       = slot.bytes.load(std::memory_order_relaxed);
+        if (subsystem.counts.allocations == 0) {
+            continue;
+        }
+
+        bool merged = false;
+        for (size_t i = start; i < subsystems.size() && !merged; ++i) {
+            alloc_subsystem& other = subsystems[i];
+            if (other.name == subsystem.name
+                || (other.name && subsystem.name && std::strcmp(other.name, subsystem.name) == 0)) {
+                other.counts.allocations += subsystem.counts.allocations;
+                other.counts.bytes += subsystem.counts.bytes;
+                merged = true;
+            }
+        }
+        if (!merged) {
+            subsystems.push_back(subsystem);
+        }
+    }
+}
+
+const char*
+swapAllocSubsystem(const char* name)
+{
+    const char* outer = t_subsystem;
+    t_subsystem       = name;
+    return outer;
+}
+
+alloc_violation
+takeAllocViolations()
+{
+    alloc_violation violation;
+    violation.subsystem = g_violation_subsystem.load(std::memory_order_relaxed);
+    violation.bytes     = g_violation_bytes.load(std::memory_order_relaxed);
+    violation.count     = g_violations.exchange(0, std::memory_order_relaxed);
+    return violation;
+}
+
+alloc_forbidden_scope::alloc_forbidden_scope(bool forbidden)
+  : m_outer(t_forbidden)
+{
+    t_forbidden = t_forbidden || forbidden;
+}
+
+alloc_forbidden_scope::~alloc_forbidden_scope()
+{
+    t_forbidden = m_outer;
+}
+
+}  // namespace shiny::core
+
+#if !defined(SHINY_DISABLE_ALLOC_TRACKING)
+
+/*
+The replaced global allocation functions, which are the ones every container and make_unique ends
+up in. They forward to malloc, in whatever alignment was asked for, and ignore new_handler.
+*/
+namespace {
+
+void*
+tryAllocate(size_t bytes, size_t alignment)
+{
+    shiny::core::recordAllocation(bytes);
+    bytes = bytes > 0 ? bytes : 1;
+    if (alignment <= alignof(std::max_align_t)) {
+        return std::malloc(bytes);
+    }
+#if defined(_WIN32)
+    return _aligned_malloc(bytes, alignment);
+#else
+    // Which only takes sizes that are a multiple of the alignment
+    return std::aligned_alloc(alignment, (bytes + alignment - 1) / alignment * alignment);
+#endif
+}
+
+void*
+allocate(size_t bytes, size_t alignment)
+{
+    void* memory = tryAllocate(bytes, alignment);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void
+release(void* memory, size_t alignment)
+{
+#if defined(_WIN32)
+    if (alignment > alignof(std::max_align_t)) {
+        _aligned_free(memory);
+        return;
+    }
+#else
+    (void)alignment;
+#endif
+    std::free(memory);
+}
+
+const size_t default_alignment = alignof(std::max_align_t);
+
+}  // namespace
+
+void*
+operator new(size_t bytes)
+{
+    return allocate(bytes, default_alignment);
+}
+
+void*
+operator new[](size_t bytes)
+{
+    return allocate(bytes, default_alignment);
+}
+
+void*
+operator new(size_t bytes, const std::nothrow_t&) noexcept
+{
+    return tryAllocate(bytes, default_alignment);
+}
+
+void*
+operator new[](size_t bytes, const std::nothrow_t&) noexcept
+{
+    return tryAllocate(bytes, default_alignment);
+}
+
+void*
+operator new(size_t bytes, std::align_val_t alignment)
+{
+    return allocate(bytes, (size_t)alignment);
+}
+
+void*
+operator new[](size_t bytes, std::align_val_t alignment)
+{
+    return allocate(bytes, (size_t)alignment);
+}
+
+void*
+operator new(size_t bytes, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return tryAllocate(bytes, (size_t)alignment);
+}
+
+void*
+operator new[](size_t bytes, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return tryAllocate(bytes, (size_t)alignment);
+}
+
+void
+operator delete(void* memory) noexcept
+{
+    release(memory, default_alignment);
+}
+
+void
+operator delete[](void* memory) noexcept
+{
+    release(memory, default_alignment);
+}
+
+void
+operator delete(void* memory, size_t) noexcept
+{
+    release(memory, default_alignment);
+}
+
+void
+operator delete[](void* memory, size_t) noexcept
+{
+    release(memory, default_alignment);
+}
+
+void
+operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+    release(memory, default_alignment);
+}
+
+void
+operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+    release(memory, default_alignment);
+}
+
+void
+operator delete(void* memory, std::align_val_t alignment) noexcept
+{
+    release(memory, (size_t)alignment);
+}
+
+void
+operator delete[](void* memory, std::align_val_t alignment) noexcept
+{
+    release(memory, (size_t)alignment);
+}
+
+void
+operator delete(void* memory, size_t, std::align_val_t alignment) noexcept
+{
+    release(memory, (size_t)alignment);
+}
+
+void
+operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept
+{
+    release(memory, (size_t)alignment);
+}
+
+void
+operator delete(void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    release(memory, (size_t)alignment);
+}
+
+void
+operator delete[](void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    release(memory, (size_t)alignment);
+}
+
+#endif
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace shiny::core {
+
+/*
+Counts the heap allocations of the whole program: every global operator new, which this replaces,
+and whatever else reports through recordAllocation(), like the Vulkan allocation callbacks. Every
+allocation is counted for the subsystem that is current on its thread, which is the innermost
+profile zone, so the counts break down the same way the profiler's zones do.
+
+Counting is off until enableAllocTracking(), and then costs a couple of relaxed atomic increments
+an allocation. Defining SHINY_DISABLE_ALLOC_TRACKING leaves operator new alone altogether.
+*/
+struct alloc_counts
+{
+    uint64_t allocations = 0;
+    uint64_t bytes       = 0;
+
+    alloc_counts operator-(const alloc_counts& other) const
+    {
+        return { allocations - other.allocations, bytes - other.bytes };
+    }
+};
+
+struct alloc_subsystem
+{
+    const char*  name = nullptr;  // null for allocations outside of any zone
+    alloc_counts counts;
+};
+
+void enableAllocTracking(bool enabled);
+bool allocTracking();
+
+// Counts an allocation of `bytes` for the calling thread's subsystem, or for `subsystem`
+void recordAllocation(size_t bytes);
+void recordAllocation(size_t bytes, const char* subsystem);
+
+// Everything counted since tracking was first enabled
+alloc_counts allocTotals();
+
+// Appends the counts of every subsystem that has allocated. Up to a fixed number of subsystems are
+// told apart, any after that are counted as allocations outside of a zone.
+void allocSubsystems(std::vector<alloc_subsystem>& subsystems);
+
+// Makes `name` the calling thread's subsystem, returning the one it was. Names aren't copied, the
+// same as zone names.
+const char* swapAllocSubsystem(const char* name);
+
+// The first of the allocations made where they were forbidden, and how many of them there were
+struct alloc_violation
+{
+    uint64_t    count     = 0;
+    const char* subsystem = nullptr;
+    size_t      bytes     = 0;
+};
+
+// The violations since the last call, forgetting them
+alloc_violation takeAllocViolations();
+
+/*
+Forbids the calling thread to allocate for the lifetime of the object, if `forbidden`. Allocating
+anyway still works, it's only counted as a violation for takeAllocViolations() to report, since
+operator new has no good way to fail. Only allocations while tracking is enabled are seen.
+*/
+class alloc_forbidden_scope
+{
+public:
+    explicit alloc_forbidden_scope(bool forbidden);
+    ~alloc_forbidden_scope();
+
+    alloc_forbidden_scope(const alloc_forbidden_scope&) = delete;
+    alloc_forbidden_scope& operator=(const alloc_forbidden_scope&) = delete;
+
+private:
+    bool m_outer = false;
+};
+
+}  // namespace shiny::core
@@ -0,0 +1,430 @@
+#include "core/asset_package.h"
+
+#include "core/lz4.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+namespace {
+
+using namespace shiny::core;
+
+const uint32_t package_magic   = 0x4b505348;  // "SHPK"
+const uint32_t package_version = 2;  // 1 had no lz4_blocks
+
+std::vector<std::unique_ptr<asset_package>> mounted_packages;
+shiny::jobs::scheduler*                     package_jobs = nullptr;
+
+uint32_t
+read32(const char* p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// What comes before a block compressed entry's blocks
+uint64_t
+blockTableSize(uint64_t blockcount)
+{
+    return sizeof(package_blocks) + blockcount * sizeof(uint32_t);
+}
+
+// Backslashes become slashes and a leading "./" goes, so that however a path is spelled it finds
+// the entry the cooker named
+std::string
+normalizeName(const std::string& path)
+{
+    std::string name = path;
+    for (char& c : name) {
+        c = c == '\\' ? '/' : c;
+    }
+    while (name.compare(0, 2, "./") == 0) {
+        name.erase(0, 2);
+    }
+    return name;
+}
+
+// Never 0, which marks empty slots
+uint64_t
+nameHash(const std::string& name)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char c : name) {
+        hash ^= (unsigned char)c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/*
+Replaces `out` with `data` compressed into blocks of package_block_size, as package_blocks
+describes. Returns false if that doesn't save at least an eighth of the size.
+*/
+bool
+compressBlocks(const char* data, size_t size, std::vector<char>& out, shiny::jobs::scheduler* jobs)
+{
+    package_blocks blocks;
+    blocks.block_size  = package_block_size;
+    blocks.block_count = (uint32_t)((size + package_block_size - 1) / package_block_size);
+
+    std::vector<std::vector<char>> compressed(blocks.block_count);
+    auto compress = [&](uint32_t first, uint32_t last) {
+        for (uint32_t i = first; i < last; ++i) {
+            const size_t begin = (size_t)i * package_block_size;
+            const size_t count = std::min<size_t>(package_block_size, size - begin);
+            if (!lz4Compress(data + begin, count, compressed[i]) || compressed[i].size() >= count) {
+                compressed[i].assign(data + begin, data + begin + count);
+            }
+        }
+    };
+    if (jobs) {
+        jobs->parallelFor(0, blocks.block_count, 1, compress);
+    } else {
+        compress(0, blocks.block_count);
+    }
+
+    uint64_t total = blockTableSize(blocks.block_count);
+    for (const std::vector<char>& block : compressed) {
+        total += block.size();
+    }
+    if (total >= size - size / 8) {
+        return false;
+    }
+
+    out.resize((size_t)total);
+    std::memcpy(out.data(), &blocks, sizeof(blocks));
+
+    uint32_t end    = 0;
+    char*    ends   = out.data() + sizeof(blocks);
+    char*    stored = out.data() + blockTableSize(blocks.block_count);
+    for (uint32_t i = 0; i < blocks.block_count; ++i) {
+        std::memcpy(stored + end, compressed[i].data(), compressed[i].size());
+        end += (uint32_t)compressed[i].size();
+        std::memcpy(ends + i * sizeof(uint32_t), &end, sizeof(end));
+    }
+    return true;
+}
+
+void
+pad(std::ofstream& file, uint64_t& position, size_t alignment)
+{
+    static const char zeros[package_alignment] = {};
+
+    const uint64_t padding = (alignment - position % alignment) % alignment;
+    file.write(zeros, (std::streamsize)padding);
+    position += padding;
+}
+
+}  // namespace
+
+namespace shiny::core {
+
+bool
+asset_package::open(const std::string& path)
+{
+    mapped_file file;
+    if (!file.openLoose(path) || file.size() < sizeof(package_header)) {
+        return false;
+    }
+
+    package_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    const uint64_t size = file.size();
+    if (header.magic != package_magic || header.version == 0 || header.version > package_version
+        || header.slot_count == 0 || (header.slot_count & (header.slot_count - 1)) != 0
+        || header.table_offset % package_alignment != 0 || header.table_offset > size
+        || (size - header.table_offset) / sizeof(package_entry) < header.slot_count
+        || header.names_offset > size || header.names_size > size - header.names_offset) {
+        return false;
+    }
+
+    // Checked once here, so lookups don't have to
+    const package_entry* slots =
+      reinterpret_cast<const package_entry*>(file.data() + header.table_offset);
+    for (uint32_t i = 0; i < header.slot_count; ++i) {
+        const package_entry& entry = slots[i];
+        if (entry.hash != 0
+            && (entry.offset > size || entry.stored_size > size - entry.offset
+                || entry.name_offset > header.names_size
+                || entry.name_length > header.names_size - entry.name_offset
+                || entry.compression > package_compression::lz4_blocks
+                || (entry.compression == package_compression::none
+                    && entry.size != entry.stored_size))) {
+            return false;
+        }
+
+        // The block ends are checked as they are used
+        if (entry.hash != 0 && entry.compression == package_compression::lz4_blocks) {
+            package_blocks blocks;
+            if (entry.stored_size < sizeof(blocks)) {
+                return false;
+            }
+            std::memcpy(&blocks, file.data() + entry.offset, sizeof(blocks));
+
+            if (blocks.block_size == 0
+                || blocks.block_count != (entry.size + blocks.block_size - 1) / blocks.block_size
+                || blockTableSize(blocks.block_count) > entry.stored_size) {
+                return false;
+            }
+        }
+    }
+
+    m_file       = std::move(file);
+    m_slots      = reinterpret_cast<const package_entry*>(m_file.data() + header.table_offset);
+    m_slot_count = header.slot_count;
+    m_names      = m_file.data() + header.names_offset;
+
+    return true;
+}
+
+const package_entry*
+asset_package::find(const std::string& name) const
+{
+    const std::string normalized = normalizeName(name);
+    const uint64_t    hash       = nameHash(normalized);
+    const uint32_t    mask       = m_slot_count - 1;
+
+    for (uint32_t i = 0; i < m_slot_count; ++i) {
+        const package_entry& entry = m_slots[(hash + i) & mask];
+        if (entry.hash == 0) {
+            break;
+        }
+        if (entry.hash == hash && entry.name_length == normalized.size()
+            && std::memcmp(m_names + entry.name_offset, normalized.data(), normalized.size())
+                 == 0) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool
+asset_package::read(const package_entry& entry,
+                    size_t               offset,
+                    size_t               size,
+                    char*                out,
+                    jobs::scheduler*     jobs) const
+{
+    if (offset > entry.size || size > entry.size - offset) {
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+
+    const char* stored = data(entry);
+
+    if (entry.compression == package_compression::none) {
+        std::memcpy(out, stored + offset, size);
+        return true;
+    }
+
+    // Only ever decompresses as a whole
+    if (entry.compression == package_compression::lz4) {
+        if (offset == 0 && size == entry.size) {
+            return lz4Decompress(stored, (size_t)entry.stored_size, out, size);
+        }
+
+        std::vector<char> whole((size_t)entry.size);
+        if (!lz4Decompress(stored, (size_t)entry.stored_size, whole.data(), whole.size())) {
+            return false;
+        }
+        std::memcpy(out, whole.data() + offset, size);
+        return true;
+    }
+
+    package_blocks blocks;
+    std::memcpy(&blocks, stored, sizeof(blocks));
+
+    const char*    ends      = stored + sizeof(blocks);
+    const char*    blockdata = stored + blockTableSize(blocks.block_count);
+    const uint64_t available = entry.stored_size - blockTableSize(blocks.block_count);
+    const size_t   blocksize = blocks.block_size;
+
+    std::atomic<bool> ok{ true };
+    auto decompress = [&](uint32_t first, uint32_t last) {
+        std::vector<char> partial;
+
+        for (uint32_t i = first; i < last; ++i) {
+            const uint32_t start = i > 0 ? read32(ends + (i - 1) * sizeof(uint32_t)) : 0;
+            const uint32_t end   = read32(ends + i * sizeof(uint32_t));
+            if (end < start || end > available) {
+                ok = false;
+                continue;
+            }
+
+            const size_t begin = (size_t)i * blocksize;
+            const size_t count = std::min<size_t>(blocksize, (size_t)entry.size - begin);
+
+            // Only the first and the last block can stick out of the range, and only those go
+            // through memory of their own
+            const bool inside = begin >= offset && begin + count <= offset + size;
+            char*      target = out + (inside ? begin - offset : 0);
+            if (!inside) {
+                partial.resize(count);
+                target = partial.data();
+            }
+
+            if (end - start == count) {
+                std::memcpy(target, blockdata + start, count);
+            } else if (!lz4Decompress(blockdata + start, end - start, target, count)) {
+                ok = false;
+                continue;
+            }
+
+            if (!inside) {
+                const size_t from = std::max(offset, begin);
+                const size_t to   = std::min(offset + size, begin + count);
+                std::memcpy(out + (from - offset), partial.data() + (from - begin), to - from);
+            }
+        }
+    };
+
+    const uint32_t first = (uint32_t)(offset / blocksize);
+    const uint32_t last  = (uint32_t)((offset + size - 1) / blocksize) + 1;
+    if (jobs && last - first > 1) {
+        jobs->parallelFor(first, last, 1, decompress);
+    } else {
+        decompress(first, last);
+    }
+
+    return ok;
+}
+
+bool
+mountPackage(const std::string& path)
+{
+    auto package = std::make_unique<asset_package>();
+    if (!package->open(path)) {
+        return false;
+    }
+    mounted_packages.push_back(std::move(package));
+    return true;
+}
+
+const package_entry*
+findPackaged(const std::string& path, const asset_package*& package)
+{
+    for (const std::unique_ptr<asset_package>& mounted : mounted_packages) {
+        if (const package_entry* entry = mounted->find(path)) {
+            package = mounted.get();
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+void
+setPackageJobs(jobs::scheduler* jobs)
+{
+    package_jobs = jobs;
+}
+
+jobs::scheduler*
+packageJobs()
+{
+    return package_jobs;
+}
+
+/*
+The entries are written as they are read, one file mapped at a time, and the header goes in last
+once the offsets are known.
+*/
+bool
+writePackage(const std::string&                 path,
+             const std::vector<package_source>& sources,
+             bool                               compress,
+             jobs::scheduler*                   jobs)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    package_header header;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t position = sizeof(header);
+
+    std::vector<package_entry> entries;
+    std::string                names;
+    std::vector<char>          compressed;
+
+    for (const package_source& source : sources) {
+        mapped_file contents;
+        if (!contents.openLoose(source.path)) {
+            return false;
+        }
+
+        const std::string name = normalizeName(source.name);
+
+        package_entry entry;
+        entry.hash        = nameHash(name);
+        entry.size        = contents.size();
+        entry.stored_size = contents.size();
+        entry.name_offset = (uint32_t)names.size();
+        entry.name_length = (uint32_t)name.size();
+        names += name;
+
+        const char* data = contents.data();
+        if (compress && compressBlocks(contents.data(), contents.size(), compressed, jobs)) {
+            entry.compression = package_compression::lz4_blocks;
+            entry.stored_size = compressed.size();
+            data              = compressed.data();
+        }
+
+        pad(file, position, package_alignment);
+        entry.offset = position;
+        file.write(data, (std::streamsize)entry.stored_size);
+        position += entry.stored_size;
+
+        entries.push_back(entry);
+    }
+
+    header.names_offset = position;
+    header.names_size   = names.size();
+    file.write(names.data(), (std::streamsize)names.size());
+    position += names.size();
+
+    // At most half full, so probes stay short
+    uint32_t slotcount = 1;
+    while (slotcount < entries.size() * 2) {
+        slotcount *= 2;
+    }
+
+    std::vector<package_entry> slots(slotcount);
+    for (const package_entry& entry : entries) {
+        uint32_t slot = (uint32_t)(entry.hash & (slotcount - 1));
+        while (slots[slot].hash != 0) {
+            // The same name twice would leave the second one unreachable
+            if (slots[slot].hash == entry.hash && slots[slot].name_length == entry.name_length
+                && names.compare(slots[slot].name_offset, entry.name_length, names,
+                                 entry.name_offset, entry.name_length)
+                     == 0) {
+                return false;
+            }
+            slot = (slot + 1) & (slotcount - 1);
+        }
+        slots[slot] = entry;
+    }
+
+    pad(file, position, package_alignment);
+    header.magic        = package_magic;
+    header.version      = package_version;
+    header.entry_count  = (uint32_t)entries.size();
+    header.slot_count   = slotcount;
+    header.table_offset = position;
+    file.write(reinterpret_cast<const char*>(slots.data()),
+               (std::streamsize)(slots.size() * sizeof(package_entry)));
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    return (bool)file;
+}
+
+}  // namespace shiny::core
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "core/mapped_file.h"
+#include "jobs/scheduler.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::core {
+
+/*
+A package is one file holding many assets, so that loading them opens and maps a single file
+instead of one per asset, which is slow on Windows and even more so on network shares.
+
+The file is a package_header, then the entries' bytes, each starting at a multiple of
+package_alignment, then their names, and last a hash table of `slot_count` package_entry slots,
+a power of two, looked up by the FNV-1a hash of the name with linear probing. Slots whose hash is 0
+are empty. Entries are either stored as they are, and read straight out of the mapping, or LZ4
+compressed.
+
+Compressed entries are split into blocks of `block_size` bytes that are compressed on their own, so
+they can be decompressed in parallel, and any range of the entry without the blocks before it. The
+entry's stored bytes start with a package_blocks, followed by the end of every block's compressed
+bytes (uint32_t, counted from just after the ends) and then the blocks. A block whose compressed
+size is its full size didn't compress and is stored as it is.
+*/
+struct package_header
+{
+    uint32_t magic        = 0;
+    uint32_t version      = 0;
+    uint32_t entry_count  = 0;
+    uint32_t slot_count   = 0;
+    uint64_t table_offset = 0;
+    uint64_t names_offset = 0;
+    uint64_t names_size   = 0;
+};
+
+enum class package_compression : uint32_t
+{
+    none,
+    lz4,         // the whole entry as one LZ4 block, which nothing writes anymore
+    lz4_blocks,  // see package_blocks
+};
+
+struct package_blocks
+{
+    uint32_t block_size  = 0;
+    uint32_t block_count = 0;
+};
+
+struct package_entry
+{
+    uint64_t            hash        = 0;
+    uint64_t            offset      = 0;
+    uint64_t            size        = 0;  // once decompressed
+    uint64_t            stored_size = 0;
+    uint32_t            name_offset = 0;  // into the names
+    uint32_t            name_length = 0;
+    package_compression compression = package_compression::none;
+    uint32_t            padding     = 0;
+};
+
+const size_t package_alignment = 16;
+
+// Large enough for LZ4 to find most of its matches within a block, small enough for a texture's mip
+// level to be spread over many workers
+const uint32_t package_block_size = 128 * 1024;
+
+/*
+A mapped package. Names are paths relative to the working directory with forward slashes, the
+way the renderer refers to its assets, e.g. "shaders/vert.spv".
+*/
+class asset_package
+{
+public:
+    // Returns false if the file is missing or isn't a package of this version
+    bool open(const std::string& path);
+
+    // The entry named `name`, or nullptr if there isn't one
+    const package_entry* find(const std::string& name) const;
+
+    const char* data(const package_entry& entry) const { return m_file.data() + entry.offset; }
+
+    /*
+    Writes `size` bytes of the entry, from `offset` on, to `out`, decompressing only the blocks
+    they are in. Blocks that lie entirely within the range are decompressed straight into `out`,
+    in parallel on `jobs` if there is one. Returns false if the range is outside the entry or the
+    blocks are damaged.
+    */
+    bool read(const package_entry& entry,
+              size_t               offset,
+              size_t               size,
+              char*                out,
+              jobs::scheduler*     jobs = nullptr) const;
+
+private:
+    mapped_file          m_file;
+    const package_entry* m_slots      = nullptr;
+    uint32_t             m_slot_count = 0;
+    const char*          m_names      = nullptr;
+};
+
+/*
+Mounted packages are looked in by every mapped_file::open before the loose files, in the order they
+were mounted, so whatever is in them doesn't have to exist on disk. Mounting isn't thread safe, so
+packages are mounted at startup before anything is loaded.
+*/
+bool mountPackage(const std::string& path);
+
+// The mounted entry for `path`, and the package it's in, or nullptr
+const package_entry* findPackaged(const std::string& path, const asset_package*& package);
+
+// Once set, mapped_file::open decompresses the blocks of packaged files on `jobs`. It has to be
+// cleared again before the scheduler shuts down.
+void             setPackageJobs(jobs::scheduler* jobs);
+jobs::scheduler* packageJobs();
+
+// One file to go into a package: where it is now and the name it has inside
+struct package_source
+{
+    std::string path;
+    std::string name;
+};
+
+/*
+Writes the files into a package, compressing those that `compress` allows whenever LZ4 saves at
+least an eighth of their size, with the blocks compressed in parallel on `jobs` if there is one.
+The files are read loose, never out of mounted packages. Returns false if any of them can't be
+read or the package can't be written.
+*/
+bool writePackage(const std::string&                 path,
+                  const std::vector<package_source>& sources,
+                  bool                               compress,
+                  jobs::scheduler*                   jobs = nullptr);
+
+}  // namespace shiny::core
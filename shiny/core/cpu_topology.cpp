@@ -0,0 +1,254 @@
+#include "core/cpu_topology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace shiny::core {
+
+namespace {
+
+// A core with less than this share of the largest capacity is an efficiency core
+const double efficiency_capacity = 0.5;
+
+// More than any machine has, only so a bogus list can't take forever
+const unsigned long max_cpus = 4096;
+
+// How much lower a background thread's nice value is on Linux
+const int background_niceness = 5;
+
+std::mutex   g_topology_mutex;
+bool         g_topology_known = false;
+cpu_topology g_topology;
+
+#if defined(_WIN32)
+
+/*
+Every logical processor has an efficiency class, and higher ones are faster. Only the processors of
+the first group are looked at, since affinity masks only cover one group.
+*/
+cpu_topology
+detect()
+{
+    ULONG length = 0;
+    GetSystemCpuSetInformation(nullptr, 0, &length, GetCurrentProcess(), 0);
+
+    std::vector<char> buffer(length);
+    auto*             sets = reinterpret_cast<SYSTEM_CPU_SET_INFORMATION*>(buffer.data());
+    if (length == 0 || !GetSystemCpuSetInformation(sets, length, &length, GetCurrentProcess(), 0)) {
+        return {};
+    }
+
+    struct processor
+    {
+        uint32_t index;
+        BYTE     efficiency;
+    };
+
+    std::vector<processor> processors;
+    BYTE                   fastest = 0;
+    for (ULONG offset = 0; offset < length;) {
+        const auto* set =
+          reinterpret_cast<const SYSTEM_CPU_SET_INFORMATION*>(buffer.data() + offset);
+        if (set->Type == CpuSetInformation && set->CpuSet.Group == 0) {
+            const BYTE efficiency = set->CpuSet.EfficiencyClass;
+            processors.push_back({ set->CpuSet.LogicalProcessorIndex, efficiency });
+            fastest = std::max(fastest, efficiency);
+        }
+        offset += set->Size;
+    }
+
+    cpu_topology topology;
+    for (const processor& p : processors) {
+        (p.efficiency == fastest ? topology.performance : topology.efficiency).push_back(p.index);
+    }
+    return topology;
+}
+
+#elif defined(__linux__)
+
+bool
+readCpuList(const std::string& path, std::vector<uint32_t>& cpus)
+{
+    std::ifstream file(path);
+    std::string   list;
+    return std::getline(file, list) && parseCpuList(list, cpus);
+}
+
+cpu_topology
+detect()
+{
+    cpu_topology topology;
+
+    // Intel's hybrid CPUs have a perf PMU for either kind of core, listing their processors
+    if (readCpuList("/sys/devices/cpu_core/cpus", topology.performance)
+        && readCpuList("/sys/devices/cpu_atom/cpus", topology.efficiency)) {
+        return topology;
+    }
+    topology = cpu_topology();
+
+    std::vector<uint32_t> online;
+    if (!readCpuList("/sys/devices/system/cpu/online", online)) {
+        return topology;
+    }
+
+    // ARM's scale every core's capacity to the fastest one's, which is 1024
+    std::vector<uint64_t> capacities;
+    for (uint32_t cpu : online) {
+        std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpu_capacity");
+        uint64_t      capacity = 0;
+        if (!(file >> capacity)) {
+            topology.performance = online;
+            return topology;
+        }
+        capacities.push_back(capacity);
+    }
+
+    const uint64_t largest = *std::max_element(capacities.begin(), capacities.end());
+    for (size_t i = 0; i < online.size(); ++i) {
+        const bool efficient = (double)capacities[i] < (double)largest * efficiency_capacity;
+        (efficient ? topology.efficiency : topology.performance).push_back(online[i]);
+    }
+    return topology;
+}
+
+#else
+
+cpu_topology
+detect()
+{
+    return {};
+}
+
+#endif
+
+void
+pin(const std::vector<uint32_t>& cpus)
+{
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (uint32_t cpu : cpus) {
+        if (cpu < sizeof(mask) * 8) {
+            mask |= (DWORD_PTR)1 << cpu;
+        }
+    }
+    if (mask) {
+        SetThreadAffinityMask(GetCurrentThread(), mask);
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (CPU_COUNT(&set) > 0) {
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)cpus;
+#endif
+}
+
+/*
+On Windows 11 EcoQoS on top lets the scheduler run the thread at a lower clock, which is about all
+it does on a CPU whose cores are all alike. Linux takes the nice value of a thread by its id.
+*/
+void
+lowerPriority()
+{
+#if defined(_WIN32)
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#if defined(THREAD_POWER_THROTTLING_CURRENT_VERSION)
+    THREAD_POWER_THROTTLING_STATE throttling = {};
+    throttling.Version                       = THREAD_POWER_THROTTLING_CURRENT_VERSION;
+    throttling.ControlMask                   = THREAD_POWER_THROTTLING_EXECUTION_SPEED;
+    throttling.StateMask                     = THREAD_POWER_THROTTLING_EXECUTION_SPEED;
+    SetThreadInformation(GetCurrentThread(), ThreadPowerThrottling, &throttling,
+                         sizeof(throttling));
+#endif
+#elif defined(__linux__)
+    const id_t thread = (id_t)syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, thread, getpriority(PRIO_PROCESS, thread) + background_niceness);
+#endif
+}
+
+}  // namespace
+
+const cpu_topology&
+cpuTopology()
+{
+    std::lock_guard<std::mutex> lock(g_topology_mutex);
+    if (!g_topology_known) {
+        g_topology       = detect();
+        g_topology_known = true;
+    }
+    return g_topology;
+}
+
+void
+setCpuTopology(cpu_topology topology)
+{
+    std::lock_guard<std::mutex> lock(g_topology_mutex);
+    g_topology       = std::move(topology);
+    g_topology_known = true;
+}
+
+bool
+parseCpuList(const std::string& list, std::vector<uint32_t>& cpus)
+{
+    cpus.clear();
+
+    std::stringstream ranges(list);
+    std::string       range;
+    while (std::getline(ranges, range, ',')) {
+        const size_t dash = range.find('-');
+        if (range.find_first_not_of("0123456789-") != std::string::npos || dash == 0
+            || dash + 1 == range.size() || range.find('-', dash + 1) != std::string::npos) {
+            return false;
+        }
+
+        const unsigned long first = std::stoul(range.substr(0, dash));
+        const unsigned long last =
+          dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+        if (last < first || last >= max_cpus) {
+            return false;
+        }
+        for (uint32_t cpu = (uint32_t)first; cpu <= (uint32_t)last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return !cpus.empty();
+}
+
+void
+applyThreadClass(thread_class kind)
+{
+    const cpu_topology& topology = cpuTopology();
+    if (!topology.hybrid()) {
+        return;
+    }
+
+    if (kind == thread_class::render) {
+        pin(topology.performance);
+    } else {
+        pin(topology.efficiency);
+        lowerPriority();
+    }
+}
+
+}  // namespace shiny::core
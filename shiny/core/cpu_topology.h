@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::core {
+
+// What a thread does, which decides the cores it runs on and how it is prioritized
+enum class thread_class : uint8_t
+{
+    render,      // the main, render and present threads, and the jobs they wait on every frame
+    background,  // I/O, streaming and decoding, and whatever else can take a few frames
+};
+
+const uint32_t thread_class_count = 2;
+
+/*
+The logical processors of each kind. On hybrid CPUs, Intel's P-cores and E-cores or ARM's
+big.LITTLE, the efficiency cores can be less than half as fast, so a render job that lands on one
+holds up the frame. There, render threads are kept on the performance cores and background threads
+on the efficiency cores, which also leaves the performance cores free of them.
+
+On Windows the cores are told apart by their efficiency class, on Linux by the perf PMUs of Intel's
+hybrid CPUs or otherwise by the kernel's capacity of every core. A CPU whose cores are all alike
+has no efficiency cores, and then every thread runs wherever, as before.
+*/
+struct cpu_topology
+{
+    std::vector<uint32_t> performance;
+    std::vector<uint32_t> efficiency;
+
+    bool hybrid() const { return !performance.empty() && !efficiency.empty(); }
+};
+
+// Detected the first time it's called, unless set before
+const cpu_topology& cpuTopology();
+
+// Overrides what was detected, e.g. from the command line, before any thread is started that
+// applies its class. Without efficiency cores every thread runs wherever.
+void setCpuTopology(cpu_topology topology);
+
+// Parses a list of logical processors the way Linux writes them, e.g. "0-7,16,18"
+bool parseCpuList(const std::string& list, std::vector<uint32_t>& cpus);
+
+// Keeps the calling thread to the cores of its class, and gives background threads a lower
+// priority. Does nothing unless the topology is hybrid.
+void applyThreadClass(thread_class kind);
+
+}  // namespace shiny::core
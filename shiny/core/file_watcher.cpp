@@ -0,0 +1,137 @@
+#include "core/file_watcher.h"
+
+#include "core/cpu_topology.h"
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <system_error>
+#include <utility>
+
+namespace {
+
+// A missing file has no time, which `exists` tells apart from any real one
+bool
+modificationTime(const std::string& path, std::filesystem::file_time_type& time)
+{
+    std::error_code error;
+    time = std::filesystem::last_write_time(path, error);
+    return !error;
+}
+
+}  // namespace
+
+namespace shiny::core {
+
+void
+file_watcher::start(std::chrono::milliseconds interval)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) {
+        return;
+    }
+
+    m_interval = interval;
+    m_running  = true;
+    m_thread   = std::thread([this]() {
+        nameThread("file watcher");
+        applyThreadClass(thread_class::background);
+        pollLoop();
+    });
+}
+
+void
+file_watcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+void
+file_watcher::watch(const std::string& path)
+{
+    watched w;
+    w.exists = modificationTime(path, w.time);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_files.emplace(path, w);
+}
+
+std::vector<std::string>
+file_watcher::changed()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<std::string> changed;
+    changed.swap(m_changed);
+    return changed;
+}
+
+/*
+The times are read without the mutex held, so that watch() and changed() never wait on the disk.
+Files watched meanwhile are only looked at from the next poll on.
+*/
+void
+file_watcher::pollLoop()
+{
+    std::vector<std::string>                                      paths;
+    std::vector<std::pair<std::filesystem::file_time_type, bool>> times;  // and whether it exists
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        m_wake.wait_for(lock, m_interval, [this]() { return !m_running; });
+        if (!m_running) {
+            break;
+        }
+
+        paths.clear();
+        for (const auto& [path, w] : m_files) {
+            paths.push_back(path);
+        }
+
+        lock.unlock();
+        times.resize(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            times[i].second = modificationTime(paths[i], times[i].first);
+        }
+        lock.lock();
+
+        for (size_t i = 0; i < paths.size(); ++i) {
+            watched&                              w      = m_files[paths[i]];
+            const std::filesystem::file_time_type time   = times[i].first;
+            const bool                            exists = times[i].second;
+
+            if (!w.changing) {
+                if (exists != w.exists || (exists && time != w.time)) {
+                    w.changing    = true;
+                    w.seen_time   = time;
+                    w.seen_exists = exists;
+                }
+                continue;
+            }
+
+            // Still being written
+            if (exists != w.seen_exists || (exists && time != w.seen_time)) {
+                w.seen_time   = time;
+                w.seen_exists = exists;
+                continue;
+            }
+
+            w.changing = false;
+            w.time     = time;
+            w.exists   = exists;
+            if (exists
+                && std::find(m_changed.begin(), m_changed.end(), paths[i]) == m_changed.end()) {
+                m_changed.push_back(paths[i]);
+            }
+        }
+    }
+}
+
+}  // namespace shiny::core
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace shiny::core {
+
+/*
+Tells which of a set of files have changed on disk, for reloading assets while the renderer runs.
+
+A thread of its own compares every file's modification time every `interval`, so the thread asking
+for the changes never touches the disk. A file is only reported once its time has stopped changing
+for a whole interval, so that one an editor is still writing isn't read halfway, and a file that is
+deleted and written again, as many editors save, is reported once it's back.
+*/
+class file_watcher
+{
+public:
+    file_watcher() = default;
+    file_watcher(const file_watcher&) = delete;
+    file_watcher& operator=(const file_watcher&) = delete;
+    ~file_watcher() { stop(); }
+
+    void start(std::chrono::milliseconds interval = std::chrono::milliseconds(250));
+    void stop();
+
+    // Any time, from any thread, and more than once for the same file
+    void watch(const std::string& path);
+
+    // Every file that changed since the last call, once each
+    std::vector<std::string> changed();
+
+private:
+    struct watched
+    {
+        std::filesystem::file_time_type time;
+        bool                            exists = false;
+
+        // What the last poll saw, while it differs from the above
+        std::filesystem::file_time_type seen_time;
+        bool                            seen_exists = false;
+        bool                            changing    = false;
+    };
+
+    void pollLoop();
+
+    std::mutex                               m_mutex;
+    std::condition_variable                  m_wake;  // stopping
+    std::unordered_map<std::string, watched> m_files;
+    std::vector<std::string>                 m_changed;
+    std::thread                              m_thread;
+    std::chrono::milliseconds                m_interval{ 250 };
+    bool                                     m_running = false;
+};
+
+}  // namespace shiny::core
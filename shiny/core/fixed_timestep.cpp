@@ -0,0 +1,30 @@
+#include "core/fixed_timestep.h"
+
+namespace shiny::core {
+
+fixed_timestep::fixed_timestep(double step, uint32_t max_steps)
+  : m_step(step)
+  , m_max_steps(max_steps)
+{}
+
+uint32_t
+fixed_timestep::advance(double elapsed)
+{
+    m_accumulator += elapsed > 0.0 ? elapsed : 0.0;
+
+    uint32_t steps = 0;
+    while (m_accumulator >= m_step && steps < m_max_steps) {
+        m_accumulator -= m_step;
+        ++steps;
+    }
+
+    // Whatever couldn't be caught up with is dropped
+    if (m_accumulator >= m_step) {
+        m_accumulator = 0.0;
+    }
+
+    m_steps += steps;
+    return steps;
+}
+
+}  // namespace shiny::core
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+namespace shiny::core {
+
+/*
+Steps a simulation at a fixed rate, whatever rate it's drawn at. The real time that passes goes into
+an accumulator, and every whole step in it is one step of the simulation, so its results only
+depend on how many steps it ran and never on how long the frames took. What is left over says how
+far the present is between the last two states, which is what the renderer interpolates by.
+
+At most `max_steps` are run for one advance(). A stall longer than that, loading or a breakpoint,
+is dropped rather than caught up with, so a slow simulation can't fall further and further behind by
+trying to catch up.
+*/
+class fixed_timestep
+{
+public:
+    explicit fixed_timestep(double step = 1.0 / 60.0, uint32_t max_steps = 4);
+
+    // Adds `elapsed` seconds of real time, and returns how many steps to run for them
+    uint32_t advance(double elapsed);
+
+    double   step() const { return m_step; }
+    uint64_t steps() const { return m_steps; }  // ever run
+    double   time() const { return (double)m_steps * m_step; }  // of the latest state
+
+    // From 0 at the state before the latest to 1 at the latest, where the present is
+    float alpha() const { return (float)(m_accumulator / m_step); }
+
+    // The time of the present, between the last two states
+    double interpolatedTime() const { return m_steps > 0 ? time() - m_step + m_accumulator : 0.0; }
+
+private:
+    double   m_step        = 1.0 / 60.0;
+    uint32_t m_max_steps   = 4;
+    double   m_accumulator = 0.0;  // seconds, less than a step after advance()
+    uint64_t m_steps       = 0;
+};
+
+}  // namespace shiny::core
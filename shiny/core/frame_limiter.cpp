@@ -0,0 +1,98 @@
+#include "core/frame_limiter.h"
+
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+// Windows 10 1803 and later, which older SDKs don't know about yet
+#if !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+namespace shiny::core {
+
+namespace {
+
+// How much every sleep weighs in the averages of their lateness
+const double lateness_weight = 0.125;
+
+}  // namespace
+
+frame_limiter::frame_limiter()
+{
+#if defined(_WIN32)
+    m_timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                     TIMER_ALL_ACCESS);
+    if (!m_timer) {
+        m_timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+    }
+#endif
+}
+
+frame_limiter::~frame_limiter()
+{
+#if defined(_WIN32)
+    if (m_timer) {
+        CloseHandle(m_timer);
+    }
+#endif
+}
+
+void
+frame_limiter::wait(float fps)
+{
+    const int64_t now = profileNow();
+    if (fps <= 0.f) {
+        m_due = now;
+        return;
+    }
+
+    const int64_t interval = (int64_t)(1e9 / fps);
+    const int64_t due      = m_due + interval;
+    if (m_due == 0 || now >= due + interval) {
+        m_due = now;
+        return;
+    }
+
+    const int64_t margin = (int64_t)(m_lateness + 2.0 * m_deviation);
+    if (due - now > margin) {
+        const int64_t requested = due - now - margin;
+        sleep(requested);
+
+        const double lateness = std::max(0.0, (double)(profileNow() - now - requested));
+        m_deviation += (std::abs(lateness - m_lateness) - m_deviation) * lateness_weight;
+        m_lateness += (lateness - m_lateness) * lateness_weight;
+    }
+
+    while (profileNow() < due) {
+        std::this_thread::yield();
+    }
+    m_due = due;
+}
+
+void
+frame_limiter::sleep(int64_t nanoseconds)
+{
+#if defined(_WIN32)
+    // Relative times are negative, in 100 ns units
+    LARGE_INTEGER duetime;
+    duetime.QuadPart = -(nanoseconds / 100);
+    if (m_timer && SetWaitableTimer(m_timer, &duetime, 0, nullptr, nullptr, FALSE)) {
+        WaitForSingleObject(m_timer, INFINITE);
+        return;
+    }
+#endif
+
+    std::this_thread::sleep_for(std::chrono::nanoseconds(nanoseconds));
+}
+
+}  // namespace shiny::core
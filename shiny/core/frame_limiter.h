@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+namespace shiny::core {
+
+/*
+Holds a loop to a frame rate without spinning through every frame. It sleeps until shortly before
+the next frame is due and only spins, yielding, for the rest. How long before is learned from how
+late the sleeps so far have woken up: their average lateness, plus twice its average deviation so
+that a sleep rarely ends after the frame was due. On Windows the sleeps are on a high resolution
+waitable timer where there is one, since a plain sleep there can be a whole 15.6 ms tick late.
+*/
+class frame_limiter
+{
+public:
+    frame_limiter();
+    ~frame_limiter();
+
+    frame_limiter(const frame_limiter&) = delete;
+    frame_limiter& operator=(const frame_limiter&) = delete;
+
+    // Returns once the next frame at `fps` frames a second is due, counting from when the last
+    // one was, and at once for 0. A frame that is already late by a whole interval starts the
+    // schedule over, rather than the frames after it being rushed to catch up.
+    void wait(float fps);
+
+private:
+    void sleep(int64_t nanoseconds);
+
+    int64_t m_due       = 0;          // profileNow() of the last frame's
+    double  m_lateness  = 1'000'000;  // of the sleeps, in nanoseconds, on average
+    double  m_deviation = 500'000;    // of their lateness from that, on average
+
+#if defined(_WIN32)
+    void* m_timer = nullptr;
+#endif
+};
+
+}  // namespace shiny::core
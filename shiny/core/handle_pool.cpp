@@ -0,0 +1,42 @@
+#include "core/handle_pool.h"
+
+#include <cassert>
+#include <stdexcept>
+
+namespace shiny::core {
+
+/*
+The last slot is never handed out, so that no handle, whatever its generation, is invalid_handle.
+*/
+handle_pool::handle
+handle_pool::allocate()
+{
+    uint32_t slot;
+    if (!m_free.empty()) {
+        slot = m_free.back();
+        m_free.pop_back();
+    } else {
+        if (m_generations.size() >= index_mask) {
+            throw std::runtime_error("Out of handles!");
+        }
+        slot = (uint32_t)m_generations.size();
+        m_generations.push_back(0);
+        m_live.push_back(0);
+    }
+
+    m_live[slot] = 1;
+    return ((handle)m_generations[slot] << index_bits) | slot;
+}
+
+void
+handle_pool::free(handle h)
+{
+    assert(alive(h) && "freeing a stale handle!");
+
+    const uint32_t slot = index(h);
+    m_live[slot]        = 0;
+    ++m_generations[slot];
+    m_free.push_back(slot);
+}
+
+}  // namespace shiny::core
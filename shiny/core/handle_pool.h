@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace shiny::core {
+
+/*
+Hands out 32 bit handles to the slots of dense arrays that live elsewhere, typically one array per
+field of whatever the handles are for, so that a pass over one field doesn't drag the others
+through the cache. The low index_bits of a handle are its slot and the rest the slot's generation,
+which goes up every time the slot is freed. A handle that outlived its slot therefore no longer
+matches, and alive() tells it apart with one lookup, instead of it silently referring to whatever
+took the slot next. Generations wrap around after 256 reuses of a slot, so this catches stale
+handles rather than proving there are none.
+
+Freed slots are reused last in first out, so the arrays only grow once every slot is taken.
+*/
+class handle_pool
+{
+public:
+    using handle = uint32_t;
+
+    static const handle   invalid_handle = std::numeric_limits<handle>::max();
+    static const uint32_t index_bits     = 24;
+    static const uint32_t index_mask     = (1u << index_bits) - 1;
+
+    // A free slot, or a new one at capacity() - 1, which the arrays then have to grow to
+    handle allocate();
+
+    // The slot may be handed out again right away, under a new generation
+    void free(handle h);
+
+    bool alive(handle h) const
+    {
+        const uint32_t slot = index(h);
+        return h != invalid_handle && slot < m_generations.size() && m_live[slot]
+               && m_generations[slot] == h >> index_bits;
+    }
+
+    static uint32_t index(handle h) { return h & index_mask; }
+
+    // Slots handed out so far, live or not, which is the size the arrays need
+    uint32_t capacity() const { return (uint32_t)m_generations.size(); }
+    uint32_t live() const { return capacity() - (uint32_t)m_free.size(); }
+
+    // Calls `visit(handle)` for every live handle, in the order of their slots
+    template<typename Visit>
+    void forEach(Visit visit) const
+    {
+        for (uint32_t slot = 0; slot < capacity(); ++slot) {
+            if (m_live[slot]) {
+                visit(((handle)m_generations[slot] << index_bits) | slot);
+            }
+        }
+    }
+
+private:
+    std::vector<uint8_t>  m_generations;
+    std::vector<uint8_t>  m_live;
+    std::vector<uint32_t> m_free;  // slots
+};
+
+}  // namespace shiny::core
@@ -0,0 +1,202 @@
+#include "core/io_queue.h"
+
+#include "core/cpu_topology.h"
+#include "core/profiler.h"
+
+#include <cassert>
+#include <utility>
+
+namespace shiny::core {
+
+void
+io_queue::init(uint32_t threads)
+{
+    assert(m_threads.empty() && "I/O queue is already running!");
+
+    m_running = true;
+
+    m_threads.reserve(threads);
+    for (uint32_t i = 0; i < threads; ++i) {
+        m_threads.emplace_back([this, i]() {
+            nameThread("io " + std::to_string(i));
+            applyThreadClass(thread_class::background);
+            threadLoop();
+        });
+    }
+}
+
+void
+io_queue::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+
+        for (std::deque<request>& queue : m_queues) {
+            queue.clear();
+        }
+    }
+    m_wake.notify_all();
+
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+}
+
+io_queue::ticket
+io_queue::read(std::vector<std::string> paths, io_priority priority, callback done)
+{
+    request r;
+    r.paths = std::move(paths);
+    r.done  = std::move(done);
+
+    return push(std::move(r), priority);
+}
+
+io_queue::ticket
+io_queue::read(std::string path,
+               uint64_t    offset,
+               size_t      size,
+               io_priority priority,
+               callback    done)
+{
+    request r;
+    r.paths.push_back(std::move(path));
+    r.done   = std::move(done);
+    r.offset = offset;
+    r.size   = size;
+
+    return push(std::move(r), priority);
+}
+
+io_queue::ticket
+io_queue::push(request r, io_priority priority)
+{
+    ticket id = invalid_ticket;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(m_running && "I/O queue isn't running!");
+
+        id   = m_next++;
+        r.id = id;
+        m_queues[(uint32_t)priority].push_back(std::move(r));
+    }
+    m_wake.notify_one();
+
+    return id;
+}
+
+bool
+io_queue::setPriority(ticket id, io_priority priority)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    request r;
+    if (!take(id, r)) {
+        return false;
+    }
+
+    // Behind whatever was already waiting at its new priority, which is fair enough
+    m_queues[(uint32_t)priority].push_back(std::move(r));
+    return true;
+}
+
+bool
+io_queue::cancel(ticket id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    request r;
+    return take(id, r);
+}
+
+// The coroutine may be resumed before read() has even returned, so the awaiter is done with by then
+void
+io_queue::read_awaiter::await_suspend(std::coroutine_handle<> coroutine)
+{
+    m_io.read(std::move(m_paths), m_priority, [this, coroutine](mapped_file&& file, size_t which) {
+        m_result.file  = std::move(file);
+        m_result.which = which;
+        coroutine.resume();
+    });
+}
+
+size_t
+io_queue::pending() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t count = 0;
+    for (const std::deque<request>& queue : m_queues) {
+        count += queue.size();
+    }
+    return count;
+}
+
+// There are rarely more than a few hundred requests waiting, so looking through them is fine
+bool
+io_queue::take(ticket id, request& out)
+{
+    for (std::deque<request>& queue : m_queues) {
+        for (auto it = queue.begin(); it != queue.end(); ++it) {
+            if (it->id == id) {
+                out = std::move(*it);
+                queue.erase(it);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void
+io_queue::threadLoop()
+{
+    while (true) {
+        request r;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() {
+                if (!m_running) {
+                    return true;
+                }
+                for (const std::deque<request>& queue : m_queues) {
+                    if (!queue.empty()) {
+                        return true;
+                    }
+                }
+                return false;
+            });
+            if (!m_running) {
+                return;
+            }
+
+            for (std::deque<request>& queue : m_queues) {
+                if (!queue.empty()) {
+                    r = std::move(queue.front());
+                    queue.pop_front();
+                    break;
+                }
+            }
+        }
+
+        SHINY_PROFILE_ZONE("read");
+
+        mapped_file file;
+        size_t      which = 0;
+        for (; which < r.paths.size(); ++which) {
+            if (r.size > 0 ? file.read(r.paths[which], r.offset, r.size)
+                           : file.read(r.paths[which])) {
+                break;
+            }
+        }
+
+        r.done(std::move(file), which);
+    }
+}
+
+}  // namespace shiny::core
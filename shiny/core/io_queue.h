@@ -0,0 +1,139 @@
+#pragma once
+
+#include "core/mapped_file.h"
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace shiny::core {
+
+enum class io_priority : uint32_t
+{
+    high,    // needed for what is on screen right now
+    normal,  // needed soon
+    low,     // prefetching
+};
+
+const uint32_t io_priority_count = 3;
+
+/*
+Reads whole files on threads of its own, so that nothing that has to keep going, like the render
+thread or the job scheduler's workers, ever waits on the disk: a mapped file would fault its pages
+in on whichever thread touches them first, while here they are read onto the heap up front with
+mapped_file::read. Files in a mounted package are already in memory and come back as they are.
+
+Several threads read at once, so the disk always has more than one request queued, which is what
+SSDs need to get anywhere near their bandwidth. Requests are served highest priority first and in
+the order they were made within a priority; one that hasn't started yet can still be moved to
+another priority or cancelled.
+
+The callback runs on the I/O thread once the file is read, so it should do no more than hand the
+file on, e.g. to a job that decodes it, and must not throw.
+*/
+class io_queue
+{
+public:
+    using ticket = uint64_t;
+
+    // The file that was read and its index in the request's paths, or a closed file and the
+    // number of paths if none of them could be read
+    using callback = std::function<void(mapped_file&& file, size_t which)>;
+
+    static const ticket invalid_ticket = 0;
+
+    io_queue() = default;
+    io_queue(const io_queue&) = delete;
+    io_queue& operator=(const io_queue&) = delete;
+    ~io_queue() { shutdown(); }
+
+    void init(uint32_t threads = 4);
+
+    // Requests that haven't started are dropped without their callbacks running, the ones being
+    // read are finished first
+    void shutdown();
+
+    // Reads the first of `paths` that can be read, with the ones after it as fallbacks
+    ticket read(std::vector<std::string> paths, io_priority priority, callback done);
+
+    // Reads `size` bytes at `offset` of a single file, see mapped_file::read
+    ticket read(std::string path,
+                uint64_t    offset,
+                size_t      size,
+                io_priority priority,
+                callback    done);
+
+    // Both return false if the request has already started, in which case its callback runs anyway
+    bool setPriority(ticket request, io_priority priority);
+    bool cancel(ticket request);
+
+    // Requests that haven't started yet
+    size_t pending() const;
+
+    // What co_await reading() returns, the same as the callback is given
+    struct read_result
+    {
+        mapped_file file;
+        size_t      which = 0;
+    };
+
+    class read_awaiter
+    {
+    public:
+        bool        await_ready() const noexcept { return false; }
+        void        await_suspend(std::coroutine_handle<> coroutine);
+        read_result await_resume() { return std::move(m_result); }
+
+    private:
+        friend class io_queue;
+
+        read_awaiter(io_queue& io, std::vector<std::string> paths, io_priority priority)
+          : m_io(io)
+          , m_paths(std::move(paths))
+          , m_priority(priority)
+        {}
+
+        io_queue&                m_io;
+        std::vector<std::string> m_paths;
+        io_priority              m_priority;
+        read_result              m_result;
+    };
+
+    // read() for coroutines, see jobs::task, resuming them on the I/O thread once the file is
+    // read. The same goes as for the callback, so they should move on to a worker right away, and
+    // one whose request is dropped at shutdown is never resumed.
+    read_awaiter reading(std::vector<std::string> paths, io_priority priority)
+    {
+        return read_awaiter(*this, std::move(paths), priority);
+    }
+
+private:
+    struct request
+    {
+        ticket                   id = invalid_ticket;
+        std::vector<std::string> paths;
+        callback                 done;
+        uint64_t                 offset = 0;
+        size_t                   size   = 0;  // of the range to read, 0 for whole files
+    };
+
+    ticket push(request r, io_priority priority);
+    bool   take(ticket id, request& out);  // with the mutex held
+    void threadLoop();
+
+    std::deque<request> m_queues[io_priority_count];  // by priority
+
+    mutable std::mutex       m_mutex;
+    std::condition_variable  m_wake;
+    std::vector<std::thread> m_threads;
+    ticket                   m_next    = 1;
+    bool                     m_running = false;
+};
+
+}  // namespace shiny::core
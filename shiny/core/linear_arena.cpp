@@ -0,0 +1,65 @@
+#include "core/linear_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace shiny::core {
+
+linear_arena::linear_arena(size_t block_size)
+  : m_block_size(block_size)
+{}
+
+size_t
+linear_arena::capacity() const
+{
+    size_t total = 0;
+    for (const block& b : m_blocks) {
+        total += b.size;
+    }
+    return total;
+}
+
+void
+linear_arena::addBlock(size_t size)
+{
+    block b;
+    b.memory = std::make_unique<std::byte[]>(size);
+    b.size   = size;
+    m_blocks.push_back(std::move(b));
+    m_offset = 0;
+}
+
+void
+linear_arena::reset()
+{
+    if (m_blocks.size() > 1) {
+        const size_t total = capacity();
+        m_blocks.clear();
+        addBlock(total);
+    }
+
+    m_offset = 0;
+    m_used   = 0;
+}
+
+// Anything larger than a block gets one of its own size
+void*
+linear_arena::do_allocate(size_t bytes, size_t alignment)
+{
+    if (!m_blocks.empty()) {
+        const block&    last    = m_blocks.back();
+        const uintptr_t base    = (uintptr_t)last.memory.get();
+        const uintptr_t aligned = (base + m_offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (aligned + bytes <= base + last.size) {
+            m_offset = aligned + bytes - base;
+            m_used += bytes;
+            return (void*)aligned;
+        }
+    }
+
+    // With room for the alignment as well, so that it fits in the new block
+    addBlock(std::max(m_block_size, bytes + alignment));
+    return do_allocate(bytes, alignment);
+}
+
+}  // namespace shiny::core
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace shiny::core {
+
+/*
+A bump allocator for data that only lives as long as a frame: allocating moves an offset along a
+block, deallocating does nothing, and reset() frees everything at once. It's a memory_resource, so
+the std::pmr containers allocate from it with frame_vector and the like.
+
+When a block runs out another one is added. reset() replaces all of them with a single block as
+large as they were together, so after the largest frame so far nothing is allocated at all. Not
+thread safe, each thread (or frame in flight) has its own.
+*/
+class linear_arena : public std::pmr::memory_resource
+{
+public:
+    explicit linear_arena(size_t block_size = 64 * 1024);
+
+    linear_arena(const linear_arena&) = delete;
+    linear_arena& operator=(const linear_arena&) = delete;
+
+    // Once nothing allocated since the last reset is used anymore
+    void reset();
+
+    size_t used() const { return m_used; }  // since the last reset
+    size_t capacity() const;
+
+private:
+    struct block
+    {
+        std::unique_ptr<std::byte[]> memory;
+        size_t                       size = 0;
+    };
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void  do_deallocate(void*, size_t, size_t) override {}
+    bool  do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    void addBlock(size_t size);
+
+    size_t             m_block_size = 0;
+    std::vector<block> m_blocks;
+    size_t             m_offset = 0;  // into the last block
+    size_t             m_used   = 0;
+};
+
+// Containers whose memory comes from a linear_arena, or any other memory_resource
+template<typename T>
+using frame_vector = std::pmr::vector<T>;
+
+}  // namespace shiny::core
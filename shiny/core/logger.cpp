@@ -0,0 +1,322 @@
+#include "core/logger.h"
+
+#include "core/cpu_topology.h"
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using shiny::core::log_level;
+using shiny::core::log_message_capacity;
+
+// How often the logging thread looks at the rings, and how often a repeated message is summed up
+const std::chrono::milliseconds log_interval(5);
+const int64_t                   log_repeat_interval_ns = 1'000'000'000;
+
+struct log_entry
+{
+    int64_t   time   = 0;
+    uint64_t  id     = 0;
+    log_level level  = log_level::info;
+    uint32_t  length = 0;
+    char      text[log_message_capacity];
+};
+
+/*
+A thread's messages, which only that thread writes and only the logging thread reads: the writer
+only ever fills the entry at `head` once `tail` has moved past the one `capacity` before it, and
+the reader only reads the entries between `tail` and `head`.
+*/
+struct log_ring
+{
+    static const uint32_t capacity = 256;
+
+    std::vector<log_entry> entries = std::vector<log_entry>(capacity);
+    std::atomic<uint64_t>  head{ 0 };
+    std::atomic<uint64_t>  tail{ 0 };
+    std::atomic<uint64_t>  dropped{ 0 };  // since the logging thread last looked
+};
+
+// How often a message id has come up, and what was left out since it was last written
+struct log_repeat
+{
+    uint64_t    count      = 0;
+    uint64_t    suppressed = 0;
+    int64_t     written    = 0;
+    log_level   level      = log_level::info;
+    std::string text;  // of the first one left out
+};
+
+// The rings are never destroyed, like the threads' profile tracks. The mutex guards the list of
+// rings, the repeats and the output; nothing that merely logs takes it once the thread is running.
+struct log_state
+{
+    std::mutex                               mutex;
+    std::condition_variable                  wake;  // stopping
+    std::vector<std::unique_ptr<log_ring>>   rings;
+    std::unordered_map<uint64_t, log_repeat> repeats;
+    std::vector<log_entry>                   batch;  // the logging thread's, reused
+    std::thread                              thread;
+    bool                                     stopping = false;
+    std::atomic<bool>                        running{ false };
+    std::atomic<log_level>                   minimum{ log_level::info };
+
+    // For a program that never got to stopLogging(), e.g. because something threw
+    ~log_state()
+    {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            thread.join();
+        }
+    }
+};
+
+log_state&
+state()
+{
+    static log_state s;
+    return s;
+}
+
+thread_local log_ring* t_ring = nullptr;
+
+log_ring*
+threadRing()
+{
+    if (!t_ring) {
+        log_state&                  s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.rings.push_back(std::make_unique<log_ring>());
+        t_ring = s.rings.back().get();
+    }
+    return t_ring;
+}
+
+uint64_t
+fnv1a(const char* text, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)text[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+void
+writeLine(log_level level, const char* text, size_t length, const char* suffix = "")
+{
+    std::FILE* out = level >= log_level::warning ? stderr : stdout;
+    std::fwrite(text, 1, length, out);
+    std::fputs(suffix, out);
+    std::fputc('\n', out);
+}
+
+// The repeats' side of it, with the mutex held
+void
+emit(log_state& s, log_level level, uint64_t id, int64_t time, const char* text, size_t length)
+{
+    log_repeat& r = s.repeats[id];
+    ++r.count;
+
+    if (r.count <= shiny::core::log_repeat_limit) {
+        writeLine(level, text, length,
+                  r.count == shiny::core::log_repeat_limit ? " (repeats are summed up from here on)"
+                                                           : "");
+        r.written = time;
+        return;
+    }
+
+    if (time - r.written < log_repeat_interval_ns) {
+        if (r.suppressed++ == 0) {
+            r.level = level;
+            r.text.assign(text, length);
+        }
+        return;
+    }
+
+    char suffix[64] = "";
+    if (r.suppressed > 0) {
+        std::snprintf(suffix, sizeof(suffix), " (and %llu more like it)",
+                      (unsigned long long)r.suppressed);
+    }
+    writeLine(level, text, length, suffix);
+    r.suppressed = 0;
+    r.written    = time;
+}
+
+// Whatever was left out and hasn't been summed up yet, when there will be nothing more to do it
+void
+flushRepeats(log_state& s)
+{
+    for (auto& [id, r] : s.repeats) {
+        if (r.suppressed > 0) {
+            char suffix[64];
+            std::snprintf(suffix, sizeof(suffix), " (%llu more like it)",
+                          (unsigned long long)r.suppressed);
+            writeLine(r.level, r.text.data(), r.text.size(), suffix);
+            r.suppressed = 0;
+        }
+    }
+    std::fflush(stdout);
+}
+
+// Everything in the rings, in the order it was logged in across them, with the mutex held
+void
+drain(log_state& s)
+{
+    s.batch.clear();
+    for (const auto& ring : s.rings) {
+        const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (uint64_t i = tail; i < head; ++i) {
+            s.batch.push_back(ring->entries[i % log_ring::capacity]);
+        }
+        ring->tail.store(head, std::memory_order_release);
+
+        const uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            log_entry& e = s.batch.emplace_back();
+            e.time       = shiny::core::profileNow();
+            e.id         = 0;
+            e.level      = log_level::warning;
+            e.length     = (uint32_t)std::snprintf(e.text, sizeof(e.text),
+                                                   "(%llu messages dropped, the log was full)",
+                                                   (unsigned long long)dropped);
+        }
+    }
+
+    std::stable_sort(s.batch.begin(), s.batch.end(),
+                     [](const log_entry& a, const log_entry& b) { return a.time < b.time; });
+    for (const log_entry& e : s.batch) {
+        if (e.id == 0) {
+            writeLine(e.level, e.text, e.length);
+        } else {
+            emit(s, e.level, e.id, e.time, e.text, e.length);
+        }
+    }
+    if (!s.batch.empty()) {
+        std::fflush(stdout);
+    }
+}
+
+void
+loggingLoop(log_state& s)
+{
+    std::unique_lock<std::mutex> lock(s.mutex);
+    while (!s.stopping) {
+        s.wake.wait_for(lock, log_interval, [&]() { return s.stopping; });
+        drain(s);
+    }
+}
+
+}  // namespace
+
+namespace shiny::core {
+
+void
+startLogging()
+{
+    log_state&                  s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.running.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    s.stopping = false;
+    s.thread   = std::thread([&s]() {
+        nameThread("logger");
+        applyThreadClass(thread_class::background);
+        loggingLoop(s);
+    });
+    s.running.store(true, std::memory_order_release);
+}
+
+/*
+Messages that were being logged right as it stopped may still be in their ring afterwards, which
+the next start writes out.
+*/
+void
+stopLogging()
+{
+    log_state& s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (!s.running.load(std::memory_order_relaxed)) {
+            return;
+        }
+        s.running.store(false, std::memory_order_release);
+        s.stopping = true;
+    }
+    s.wake.notify_all();
+    s.thread.join();
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+    drain(s);
+    flushRepeats(s);
+}
+
+void
+setLogLevel(log_level minimum)
+{
+    state().minimum.store(minimum, std::memory_order_relaxed);
+}
+
+log_level
+logLevel()
+{
+    return state().minimum.load(std::memory_order_relaxed);
+}
+
+void
+logMessage(log_level level, const char* text, size_t length, uint64_t id)
+{
+    if (!logEnabled(level)) {
+        return;
+    }
+
+    length = std::min(length, log_message_capacity);
+    id     = id != 0 ? id : fnv1a(text, length);
+
+    const int64_t now = profileNow();
+
+    log_state& s = state();
+    if (!s.running.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        emit(s, level, id, now, text, length);
+        std::fflush(level >= log_level::warning ? stderr : stdout);
+        return;
+    }
+
+    log_ring*      ring = threadRing();
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= log_ring::capacity) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    log_entry& e = ring->entries[head % log_ring::capacity];
+    e.time       = now;
+    e.id         = id;
+    e.level      = level;
+    e.length     = (uint32_t)length;
+    std::memcpy(e.text, text, length);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+}  // namespace shiny::core
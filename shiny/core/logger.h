@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+namespace shiny::core {
+
+enum class log_level : uint8_t
+{
+    debug,
+    info,
+    warning,  // warnings and errors go to stderr, the rest to stdout
+    error,
+};
+
+/*
+The engine's log. Every thread logs into a ring of its own, which only it writes and only the
+logging thread reads, so logging is a copy into the ring and an atomic store, and never waits for
+the console or for another thread. The logging thread takes what is in the rings every few
+milliseconds and writes it out in the order it was logged in. A thread whose ring is full drops its
+messages until there is room again, and how many it dropped is written once there is.
+
+Messages are deduplicated by an id, the hash of their text if they don't have one: the first
+log_repeat_limit messages with an id are written, and after that one a second at most, saying how
+many more there were in between. Validation layers repeat the same complaint every frame, which is
+where this matters.
+
+Until startLogging() and after stopLogging() messages are written on the calling thread instead,
+still deduplicated, so nothing it logs before or after the engine runs is lost.
+*/
+
+// The longest message text, anything further is cut off
+const size_t log_message_capacity = 1000;
+
+// Messages of an id that are written in full, before they are only summed up a second at a time
+const uint32_t log_repeat_limit = 3;
+
+void startLogging();
+// Writes out whatever is still in the rings first
+void stopLogging();
+
+// Messages below `minimum` are dropped right away, by default only debug ones
+void      setLogLevel(log_level minimum);
+log_level logLevel();
+
+inline bool
+logEnabled(log_level level)
+{
+    return level >= logLevel();
+}
+
+// Any thread. `id` 0 is the hash of the text.
+void logMessage(log_level level, const char* text, size_t length, uint64_t id = 0);
+
+inline void
+logMessage(log_level level, const std::string& text, uint64_t id = 0)
+{
+    logMessage(level, text.data(), text.size(), id);
+}
+
+// Puts a message together with <<, and logs it at the end of the statement. Nothing is formatted
+// at all for a level that is filtered out.
+class log_stream
+{
+public:
+    explicit log_stream(log_level level, uint64_t id = 0)
+      : m_level(level)
+      , m_id(id)
+      , m_enabled(logEnabled(level))
+    {}
+    ~log_stream()
+    {
+        if (m_enabled) {
+            logMessage(m_level, m_text.str(), m_id);
+        }
+    }
+
+    log_stream(const log_stream&) = delete;
+    log_stream& operator=(const log_stream&) = delete;
+
+    template<typename T>
+    log_stream& operator<<(const T& value)
+    {
+        if (m_enabled) {
+            m_text << value;
+        }
+        return *this;
+    }
+
+private:
+    log_level          m_level;
+    uint64_t           m_id;
+    bool               m_enabled;
+    std::ostringstream m_text;
+};
+
+inline log_stream
+logDebug()
+{
+    return log_stream(log_level::debug);
+}
+
+inline log_stream
+logInfo()
+{
+    return log_stream(log_level::info);
+}
+
+inline log_stream
+logWarning()
+{
+    return log_stream(log_level::warning);
+}
+
+inline log_stream
+logError()
+{
+    return log_stream(log_level::error);
+}
+
+}  // namespace shiny::core
@@ -0,0 +1,176 @@
+#include "core/lz4.h"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+const uint32_t min_match  = 4;
+const uint32_t hash_bits  = 16;
+const size_t   max_offset = 65535;
+
+// The last 5 bytes are always literals, and the last match starts at least 12 bytes from the end
+const size_t last_literals    = 5;
+const size_t match_safe_limit = 12;
+
+uint32_t
+read32(const char* p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t
+hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - hash_bits);
+}
+
+// Lengths of 15 or more go on in extra bytes of 255 until one that is less
+void
+writeLength(std::vector<char>& out, size_t length)
+{
+    for (length -= 15; length >= 255; length -= 255) {
+        out.push_back((char)255);
+    }
+    out.push_back((char)length);
+}
+
+bool
+readLength(const unsigned char*& p, const unsigned char* end, size_t& length)
+{
+    unsigned char next = 255;
+    while (next == 255) {
+        if (p == end) {
+            return false;
+        }
+        next = *p++;
+        length += next;
+    }
+    return true;
+}
+
+void
+writeSequence(std::vector<char>& out, const char* literals, size_t literalcount, size_t offset,
+              size_t matchlength)
+{
+    const size_t extra = matchlength - min_match;
+
+    out.push_back((char)((literalcount < 15 ? literalcount : 15) << 4 | (extra < 15 ? extra : 15)));
+    if (literalcount >= 15) {
+        writeLength(out, literalcount);
+    }
+    out.insert(out.end(), literals, literals + literalcount);
+
+    out.push_back((char)(offset & 0xff));
+    out.push_back((char)(offset >> 8));
+    if (extra >= 15) {
+        writeLength(out, extra);
+    }
+}
+
+}  // namespace
+
+namespace shiny::core {
+
+bool
+lz4Compress(const char* data, size_t size, std::vector<char>& out)
+{
+    out.clear();
+    if (size >= std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+    out.reserve(size / 2);
+
+    // Positions plus one, so that 0 is none
+    std::vector<uint32_t> table((size_t)1 << hash_bits, 0);
+
+    size_t anchor = 0;
+    size_t p      = 0;
+    while (size > match_safe_limit && p < size - match_safe_limit) {
+        const uint32_t sequence = read32(data + p);
+        const uint32_t h        = hash(sequence);
+        const size_t   previous = table[h];
+        table[h]                = (uint32_t)p + 1;
+
+        if (previous == 0 || p - (previous - 1) > max_offset
+            || read32(data + previous - 1) != sequence) {
+            ++p;
+            continue;
+        }
+
+        const size_t match  = previous - 1;
+        size_t       length = min_match;
+        while (p + length < size - last_literals && data[match + length] == data[p + length]) {
+            ++length;
+        }
+
+        writeSequence(out, data + anchor, p - anchor, p - match, length);
+        p += length;
+        anchor = p;
+    }
+
+    const size_t literalcount = size - anchor;
+    out.push_back((char)((literalcount < 15 ? literalcount : 15) << 4));
+    if (literalcount >= 15) {
+        writeLength(out, literalcount);
+    }
+    out.insert(out.end(), data + anchor, data + size);
+
+    return true;
+}
+
+bool
+lz4Decompress(const char* data, size_t size, char* out, size_t outsize)
+{
+    const unsigned char* p   = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    size_t               o   = 0;
+
+    while (p < end) {
+        const unsigned char token = *p++;
+
+        size_t literalcount = token >> 4;
+        if (literalcount == 15 && !readLength(p, end, literalcount)) {
+            return false;
+        }
+        if (literalcount > (size_t)(end - p) || literalcount > outsize - o) {
+            return false;
+        }
+        std::memcpy(out + o, p, literalcount);
+        p += literalcount;
+        o += literalcount;
+
+        // The last sequence has no match
+        if (p == end) {
+            break;
+        }
+
+        if (end - p < 2) {
+            return false;
+        }
+        const size_t offset = (size_t)p[0] | (size_t)p[1] << 8;
+        p += 2;
+
+        size_t length = token & 15;
+        if (length == 15 && !readLength(p, end, length)) {
+            return false;
+        }
+        length += min_match;
+
+        if (offset == 0 || offset > o || length > outsize - o) {
+            return false;
+        }
+
+        // Matches may overlap what they write, which is how runs repeat
+        for (size_t i = 0; i < length; ++i, ++o) {
+            out[o] = out[o - offset];
+        }
+    }
+
+    return o == outsize;
+}
+
+}  // namespace shiny::core
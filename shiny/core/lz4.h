@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace shiny::core {
+
+/*
+The LZ4 block format: runs of literal bytes and back references of at least 4 bytes into the last
+64 KiB, which decompresses at several gigabytes a second with nothing but copies. The compressor is
+a plain greedy one with a single hash table, which gets most of what the format can do for the
+assets packages hold.
+
+https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+*/
+
+// Replaces `out` with the compressed bytes. Returns false, leaving `out` empty, for inputs of 4 GiB
+// or more, whose positions don't fit the hash table.
+bool lz4Compress(const char* data, size_t size, std::vector<char>& out);
+
+// Returns false unless `data` decompresses to exactly `outsize` bytes, without reading or writing
+// past either buffer, for whatever data it is given
+bool lz4Decompress(const char* data, size_t size, char* out, size_t outsize);
+
+}  // namespace shiny::core
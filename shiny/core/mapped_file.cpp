@@ -0,0 +1,435 @@
+#include "core/mapped_file.h"
+
+#include "core/asset_package.h"
+#include "core/startup_report.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace shiny::core {
+
+mapped_file::mapped_file(const std::string& path)
+{
+    if (!open(path)) {
+        throw std::runtime_error("Failed to map file " + path + " for reading!");
+    }
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+mapped_file::mapped_file(mapped_file&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+mapped_file&
+mapped_file::operator=(mapped_file&& other) noexcept
+{
+    if (this != &other) {
+        close();
+
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_open, other.m_open);
+        std::swap(m_unmapped, other.m_unmapped);
+        std::swap(m_heap, other.m_heap);
+#if defined(_WIN32)
+        std::swap(m_file, other.m_file);
+        std::swap(m_mapping, other.m_mapping);
+#endif
+    }
+    return *this;
+}
+
+bool
+mapped_file::open(const std::string& path)
+{
+    return (openPackaged(path, true) || mapLoose(path)) && counted();
+}
+
+bool
+mapped_file::openLoose(const std::string& path)
+{
+    return mapLoose(path) && counted();
+}
+
+bool
+mapped_file::counted()
+{
+    threadIo().read += m_size;
+    return true;
+}
+
+// Compressed entries are decompressed in parallel on the package jobs, unless the caller is one of
+// the I/O queue's threads, which don't take part in jobs
+bool
+mapped_file::openPackaged(const std::string& path, bool parallel)
+{
+    close();
+
+    const asset_package* package = nullptr;
+    const package_entry* entry   = findPackaged(path, package);
+    if (!entry) {
+        return false;
+    }
+
+    if (entry->compression != package_compression::none) {
+        m_heap.resize((size_t)entry->size);
+        if (!package->read(*entry, 0, m_heap.size(), m_heap.data(),
+                           parallel ? packageJobs() : nullptr)) {
+            std::vector<char>().swap(m_heap);
+            return false;
+        }
+        m_data = m_heap.data();
+    } else {
+        m_data = package->data(*entry);
+    }
+
+    m_size     = (size_t)entry->size;
+    m_open     = true;
+    m_unmapped = true;
+    return true;
+}
+
+bool
+mapped_file::read(const std::string& path)
+{
+    return (openPackaged(path, false) || readLoose(path)) && counted();
+}
+
+bool
+mapped_file::read(const std::string& path, uint64_t offset, size_t size)
+{
+    return (readPackaged(path, offset, size) || readLoose(path, offset, size)) && counted();
+}
+
+// Only the blocks the range is in are decompressed, on the calling thread like read()'s
+bool
+mapped_file::readPackaged(const std::string& path, uint64_t offset, size_t size)
+{
+    close();
+
+    const asset_package* package = nullptr;
+    const package_entry* entry   = findPackaged(path, package);
+    if (!entry) {
+        return false;
+    }
+
+    m_heap.resize(size);
+    if (!package->read(*entry, (size_t)offset, size, m_heap.data())) {
+        std::vector<char>().swap(m_heap);
+        return false;
+    }
+
+    m_data     = m_heap.data();
+    m_size     = m_heap.size();
+    m_open     = true;
+    m_unmapped = true;
+    return true;
+}
+
+#if defined(_WIN32)
+
+bool
+mapped_file::mapLoose(const std::string& path)
+{
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    m_file = file;
+    m_size = (size_t)size.QuadPart;
+    m_open = true;
+
+    // Empty files can't be mapped, but they are still perfectly valid files
+    if (m_size == 0) {
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        close();
+        return false;
+    }
+    m_mapping = mapping;
+
+    m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+The reads are positional, through an OVERLAPPED offset on a handle that isn't opened for overlapped
+I/O, so they are synchronous but never share a file pointer. ReadFile takes at most 4 GB at once.
+*/
+bool
+mapped_file::readLoose(const std::string& path)
+{
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    m_heap.resize((size_t)size.QuadPart);
+
+    size_t done = 0;
+    while (done < m_heap.size()) {
+        const DWORD chunk = (DWORD)std::min<size_t>(m_heap.size() - done, 1u << 30);
+
+        OVERLAPPED offset = {};
+        offset.Offset     = (DWORD)((uint64_t)done & 0xffffffff);
+        offset.OffsetHigh = (DWORD)((uint64_t)done >> 32);
+
+        DWORD read = 0;
+        if (!ReadFile(file, m_heap.data() + done, chunk, &read, &offset) || read == 0) {
+            CloseHandle(file);
+            std::vector<char>().swap(m_heap);
+            return false;
+        }
+        done += read;
+    }
+    CloseHandle(file);
+
+    m_data     = m_heap.data();
+    m_size     = m_heap.size();
+    m_open     = true;
+    m_unmapped = true;
+    return true;
+}
+
+bool
+mapped_file::readLoose(const std::string& path, uint64_t offset, size_t size)
+{
+    close();
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    m_heap.resize(size);
+
+    size_t done = 0;
+    while (done < m_heap.size()) {
+        const DWORD chunk = (DWORD)std::min<size_t>(m_heap.size() - done, 1u << 30);
+
+        OVERLAPPED at = {};
+        at.Offset     = (DWORD)((offset + done) & 0xffffffff);
+        at.OffsetHigh = (DWORD)((offset + done) >> 32);
+
+        DWORD read = 0;
+        if (!ReadFile(file, m_heap.data() + done, chunk, &read, &at) || read == 0) {
+            CloseHandle(file);
+            std::vector<char>().swap(m_heap);
+            return false;
+        }
+        done += read;
+    }
+    CloseHandle(file);
+
+    m_data     = m_heap.data();
+    m_size     = m_heap.size();
+    m_open     = true;
+    m_unmapped = true;
+    return true;
+}
+
+void
+mapped_file::close()
+{
+    if (m_data && !m_unmapped) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file) {
+        CloseHandle(m_file);
+    }
+
+    m_data    = nullptr;
+    m_size    = 0;
+    m_open    = false;
+    m_file    = nullptr;
+    m_mapping = nullptr;
+
+    m_unmapped = false;
+    std::vector<char>().swap(m_heap);
+}
+
+#else
+
+bool
+mapped_file::mapLoose(const std::string& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    m_size = (size_t)info.st_size;
+    m_open = true;
+
+    if (m_size > 0) {
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            m_size = 0;
+            m_open = false;
+            return false;
+        }
+        m_data = static_cast<const char*>(data);
+    }
+
+    // The mapping keeps its own reference to the file
+    ::close(fd);
+    return true;
+}
+
+// pread may return less than asked for, e.g. when interrupted by a signal
+bool
+mapped_file::readLoose(const std::string& path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    m_heap.resize((size_t)info.st_size);
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    size_t done = 0;
+    while (done < m_heap.size()) {
+        const ssize_t read = pread(fd, m_heap.data() + done, m_heap.size() - done, (off_t)done);
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            ::close(fd);
+            std::vector<char>().swap(m_heap);
+            return false;
+        }
+        done += (size_t)read;
+    }
+    ::close(fd);
+
+    m_data     = m_heap.data();
+    m_size     = m_heap.size();
+    m_open     = true;
+    m_unmapped = true;
+    return true;
+}
+
+// A read that returns nothing is the end of the file, which is too early here
+bool
+mapped_file::readLoose(const std::string& path, uint64_t offset, size_t size)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    m_heap.resize(size);
+
+    size_t done = 0;
+    while (done < m_heap.size()) {
+        const ssize_t read =
+          pread(fd, m_heap.data() + done, m_heap.size() - done, (off_t)(offset + done));
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            ::close(fd);
+            std::vector<char>().swap(m_heap);
+            return false;
+        }
+        done += (size_t)read;
+    }
+    ::close(fd);
+
+    m_data     = m_heap.data();
+    m_size     = m_heap.size();
+    m_open     = true;
+    m_unmapped = true;
+    return true;
+}
+
+void
+mapped_file::close()
+{
+    if (m_data && !m_unmapped) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+
+    m_unmapped = false;
+    std::vector<char>().swap(m_heap);
+}
+
+#endif
+
+}  // namespace shiny::core
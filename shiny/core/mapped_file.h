@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::core {
+
+/*
+A read-only view of a whole file, mapped into memory with MapViewOfFile or mmap. The pages are
+only read from disk when they are touched, and nothing is copied onto the heap, so the contents can
+go from the page cache straight to wherever they are needed (e.g. a staging buffer).
+
+Whatever is opened counts towards the calling thread's io_counters (see startup_report.h), all of
+it, whether its pages are touched or not.
+
+Files in a mounted package (see asset_package.h) are opened out of the package instead: stored ones
+are a view of the package's own mapping, compressed ones are decompressed onto the heap. Either
+way the view starts at a page boundary or at least a 16 byte one, so the data is suitably aligned
+for anything, including the uint32_t words of SPIR-V.
+*/
+class mapped_file
+{
+public:
+    mapped_file() = default;
+    explicit mapped_file(const std::string& path);  // throws if the file can't be mapped
+    ~mapped_file();
+
+    mapped_file(mapped_file&& other) noexcept;
+    mapped_file& operator=(mapped_file&& other) noexcept;
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // Returns false instead of throwing, for files that are allowed to be missing
+    bool open(const std::string& path);
+    void close();
+
+    // Only ever the file on disk, never a packaged one
+    bool openLoose(const std::string& path);
+
+    // Like open, but a file on disk is read onto the heap in one go instead of mapped, so nothing
+    // that touches it later waits for the disk. For the I/O queue's threads, which are there to
+    // do the waiting.
+    bool read(const std::string& path);
+
+    // Only `size` bytes of it from `offset` on, the same way, for pieces of files too large to
+    // read whole. Fails if the file ends before they do.
+    bool read(const std::string& path, uint64_t offset, size_t size);
+
+    const char* data() const { return m_data; }
+    size_t      size() const { return m_size; }
+    bool        empty() const { return m_size == 0; }
+
+    const char* begin() const { return m_data; }
+    const char* end() const { return m_data + m_size; }
+
+    bool isOpen() const { return m_open; }
+
+private:
+    const char* m_data = nullptr;
+    size_t      m_size = 0;
+    bool        m_open = false;
+
+    // Packaged and read files map nothing of their own
+    bool              m_unmapped = false;
+    std::vector<char> m_heap;  // decompressed or read
+
+    bool counted();  // true, having counted the file
+    bool mapLoose(const std::string& path);
+    bool openPackaged(const std::string& path, bool parallel);
+    bool readLoose(const std::string& path);
+    bool readPackaged(const std::string& path, uint64_t offset, size_t size);
+    bool readLoose(const std::string& path, uint64_t offset, size_t size);
+
+#if defined(_WIN32)
+    void* m_file    = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
+
+}  // namespace shiny::core
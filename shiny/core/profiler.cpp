@@ -0,0 +1,245 @@
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
+
+namespace {
+
+using shiny::core::profile_track;
+
+// Every track there has been, which are never destroyed
+struct track_registry
+{
+    std::mutex                                  mutex;
+    std::vector<std::unique_ptr<profile_track>> tracks;
+    std::set<std::string>                       names;
+};
+
+track_registry&
+registry()
+{
+    static track_registry r;
+    return r;
+}
+
+thread_local profile_track* t_track = nullptr;
+
+profile_track*
+createTrack(std::string name)
+{
+    track_registry&             r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    const uint32_t id = (uint32_t)r.tracks.size() + 1;
+    if (name.empty()) {
+        name = "thread " + std::to_string(id);
+    }
+    r.tracks.push_back(std::make_unique<profile_track>(std::move(name), id));
+    return r.tracks.back().get();
+}
+
+// Names can be paths, which on Windows are full of backslashes
+void
+writeEscaped(std::ofstream& out, const char* text)
+{
+    for (const char* c = text; *c; ++c) {
+        switch (*c) {
+        case '"':
+            out << "\\\"";
+            break;
+        case '\\':
+            out << "\\\\";
+            break;
+        default:
+            if ((unsigned char)*c < 0x20) {
+                out << ' ';
+            } else {
+                out << *c;
+            }
+        }
+    }
+}
+
+// The format's timestamps are in microseconds, so the nanoseconds go out with three decimals
+void
+writeMicroseconds(std::ofstream& out, int64_t nanoseconds)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%lld.%03lld", (long long)(nanoseconds / 1000),
+                  (long long)(nanoseconds % 1000));
+    out << text;
+}
+
+}  // namespace
+
+namespace shiny::core {
+
+profile_track::profile_track(std::string name, uint32_t id)
+  : m_name(std::move(name))
+  , m_id(id)
+  , m_zones(capacity)
+{}
+
+/*
+The writer only ever overwrites the slot of the zone `capacity` before its head, so whatever was
+copied is intact unless the head has come within reach of it by the time the copy is done.
+*/
+void
+profile_track::snapshot(std::vector<zone>& zones, uint32_t count) const
+{
+    const uint64_t head   = m_head.load(std::memory_order_acquire);
+    const uint64_t recent = count < capacity ? count : capacity;
+    snapshotSince(head > recent ? head - recent : 0, zones);
+}
+
+// Of the zones since `from`, those more than `capacity` before the head are gone already
+uint64_t
+profile_track::snapshotSince(uint64_t from, std::vector<zone>& zones) const
+{
+    const uint64_t head  = m_head.load(std::memory_order_acquire);
+    const uint64_t first = std::min(std::max(from, head > capacity ? head - capacity : 0), head);
+
+    const size_t start = zones.size();
+    for (uint64_t i = first; i < head; ++i) {
+        zones.push_back(m_zones[i % capacity]);
+    }
+
+    const uint64_t after = m_head.load(std::memory_order_acquire);
+    if (after + 1 > first + capacity) {
+        const uint64_t overwritten = std::min(after + 1 - capacity - first, head - first);
+        zones.erase(zones.begin() + start, zones.begin() + start + (size_t)overwritten);
+    }
+    return head;
+}
+
+profile_track*
+threadTrack()
+{
+    if (!t_track) {
+        t_track = createTrack("");
+    }
+    return t_track;
+}
+
+void
+nameThread(std::string name)
+{
+    profile_track* track = threadTrack();
+
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    track->rename(std::move(name));
+}
+
+profile_track*
+namedTrack(const std::string& name)
+{
+    {
+        track_registry&             r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (const auto& track : r.tracks) {
+            if (track->name() == name) {
+                return track.get();
+            }
+        }
+    }
+    return createTrack(name);
+}
+
+const char*
+internName(const std::string& name)
+{
+    track_registry&             r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.names.insert(name).first->c_str();
+}
+
+std::vector<track_name>
+profileTracks()
+{
+    track_registry&             r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    std::vector<track_name> tracks;
+    for (const auto& track : r.tracks) {
+        tracks.push_back({ track.get(), track->name() });
+    }
+    return tracks;
+}
+
+bool
+exportChromeTrace(const std::string& path)
+{
+    std::vector<trace_track> tracks;
+    {
+        track_registry&             r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (const auto& track : r.tracks) {
+            tracks.push_back({ track->name(), track->id(), {} });
+            track->snapshot(tracks.back().zones);
+        }
+    }
+    return writeChromeTrace(path, tracks);
+}
+
+/*
+Times are relative to the earliest zone or sample, since the steady clock's epoch is arbitrary and
+big numbers lose the precision of the decimals in viewers that parse them as doubles.
+*/
+bool
+writeChromeTrace(const std::string&               path,
+                 const std::vector<trace_track>&  tracks,
+                 const std::vector<trace_sample>& samples)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    int64_t origin = std::numeric_limits<int64_t>::max();
+    for (const trace_track& track : tracks) {
+        for (const profile_track::zone& zone : track.zones) {
+            origin = std::min(origin, zone.begin);
+        }
+    }
+    for (const trace_sample& sample : samples) {
+        origin = std::min(origin, sample.time);
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const trace_track& track : tracks) {
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << track.id << ",\"args\":{\"name\":\"";
+        writeEscaped(out, track.name.c_str());
+        out << "\"}}";
+        first = false;
+
+        for (const profile_track::zone& zone : track.zones) {
+            out << ",\n{\"name\":\"";
+            writeEscaped(out, zone.name);
+            out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << track.id << ",\"ts\":";
+            writeMicroseconds(out, zone.begin - origin);
+            out << ",\"dur\":";
+            writeMicroseconds(out, std::max<int64_t>(zone.end - zone.begin, 0));
+            out << "}";
+        }
+    }
+    for (const trace_sample& sample : samples) {
+        out << (first ? "" : ",") << "\n{\"name\":\"";
+        writeEscaped(out, sample.name);
+        out << "\",\"ph\":\"C\",\"pid\":1,\"ts\":";
+        writeMicroseconds(out, sample.time - origin);
+        out << ",\"args\":{\"value\":" << sample.value << "}}";
+        first = false;
+    }
+    out << "\n]}\n";
+
+    return (bool)out;
+}
+
+}  // namespace shiny::core
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "core/alloc_tracker.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::core {
+
+// Nanoseconds on the steady clock, which is what every zone's times are in
+inline int64_t
+profileNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/*
+The zones recorded on one timeline, usually a thread's, in a ring that keeps the last `capacity` of
+them. Recording is a store and an atomic increment, and only one thread may record into a track at
+a time, which for a thread's own track is a given.
+
+Zone names aren't copied, so they have to outlive the track: string literals, __func__, or
+whatever internName() returned.
+*/
+class profile_track
+{
+public:
+    struct zone
+    {
+        const char* name  = nullptr;
+        int64_t     begin = 0;
+        int64_t     end   = 0;
+    };
+
+    static const uint32_t capacity = 1 << 16;
+
+    explicit profile_track(std::string name, uint32_t id);
+
+    void record(const char* name, int64_t begin, int64_t end)
+    {
+        const uint64_t head      = m_head.load(std::memory_order_relaxed);
+        m_zones[head % capacity] = { name, begin, end };
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    // Appends the zones that are in the ring, or only the last `count` of them, oldest first,
+    // leaving out any that were being overwritten while they were copied
+    void snapshot(std::vector<zone>& zones, uint32_t count = capacity) const;
+
+    // Appends the zones recorded since the one numbered `from`, the same way, and returns the
+    // number of the next one, to pass in the next time. Starting at head() skips what is there.
+    uint64_t snapshotSince(uint64_t from, std::vector<zone>& zones) const;
+
+    uint64_t head() const { return m_head.load(std::memory_order_acquire); }
+
+    const std::string& name() const { return m_name; }
+    uint32_t           id() const { return m_id; }
+    void               rename(std::string name) { m_name = std::move(name); }
+
+private:
+    std::string           m_name;
+    uint32_t              m_id = 0;
+    std::vector<zone>     m_zones;
+    std::atomic<uint64_t> m_head{ 0 };
+};
+
+// The calling thread's track, created the first time it records anything. Tracks stay around
+// after their thread has exited, so its zones still make it into the trace.
+profile_track* threadTrack();
+
+// Names the calling thread's track in the trace, which defaults to a number
+void nameThread(std::string name);
+
+// A track that isn't a thread's, e.g. for the GPU's timeline, created the first time it's asked for
+profile_track* namedTrack(const std::string& name);
+
+// A copy of `name` that lives as long as the program, for zone names that aren't literals
+const char* internName(const std::string& name);
+
+// Every track there is so far, with the name it has now, for reading zones as they are recorded
+struct track_name
+{
+    profile_track* track = nullptr;
+    std::string    name;
+};
+std::vector<track_name> profileTracks();
+
+/*
+Writes every track's zones to `path` in the Trace Event JSON format, which chrome://tracing and
+Perfetto open, one complete event per zone and one thread per track. Returns false if the file
+couldn't be written.
+*/
+bool exportChromeTrace(const std::string& path);
+
+// The zones of a track as they go into a trace
+struct trace_track
+{
+    std::string                      name;
+    uint32_t                         id = 0;
+    std::vector<profile_track::zone> zones;
+};
+
+// A value at a time, which traces show as a graph of each name's values
+struct trace_sample
+{
+    const char* name  = nullptr;
+    int64_t     time  = 0;
+    double      value = 0.;
+};
+
+// The same for zones and samples from elsewhere, e.g. a telemetry stream
+bool writeChromeTrace(const std::string&               path,
+                      const std::vector<trace_track>&  tracks,
+                      const std::vector<trace_sample>& samples = {});
+
+// Records the lifetime of the object as a zone of the calling thread, which is also the subsystem
+// its allocations are counted for
+class profile_zone
+{
+public:
+    explicit profile_zone(const char* name)
+      : m_name(name)
+      , m_begin(profileNow())
+      , m_outer_subsystem(swapAllocSubsystem(name))
+    {}
+    ~profile_zone()
+    {
+        swapAllocSubsystem(m_outer_subsystem);
+        threadTrack()->record(m_name, m_begin, profileNow());
+    }
+
+    profile_zone(const profile_zone&) = delete;
+    profile_zone& operator=(const profile_zone&) = delete;
+
+private:
+    const char* m_name;
+    int64_t     m_begin;
+    const char* m_outer_subsystem;
+};
+
+}  // namespace shiny::core
+
+// Defining SHINY_DISABLE_PROFILER compiles every zone out
+#if !defined(SHINY_DISABLE_PROFILER)
+#define SHINY_PROFILE_CONCAT_(a, b) a##b
+#define SHINY_PROFILE_CONCAT(a, b) SHINY_PROFILE_CONCAT_(a, b)
+#define SHINY_PROFILE_ZONE(name)                                                                   \
+    const shiny::core::profile_zone SHINY_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#else
+#define SHINY_PROFILE_ZONE(name) ((void)0)
+#endif
+
+// A zone named after the enclosing function, for the rest of it
+#define SHINY_PROFILE_FUNCTION() SHINY_PROFILE_ZONE(__func__)
@@ -0,0 +1,185 @@
+#include "core/startup_report.h"
+
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+namespace {
+
+thread_local shiny::core::io_counters t_io;
+
+// Stages never contain each other, so only theirs add up to the totals, the assets' are in them
+bool
+isStage(const shiny::core::startup_report::entry& e)
+{
+    return std::strcmp(e.kind, "stage") == 0;
+}
+
+double
+milliseconds(int64_t nanoseconds)
+{
+    return (double)nanoseconds / 1e6;
+}
+
+double
+kilobytes(uint64_t bytes)
+{
+    return (double)bytes / 1024.;
+}
+
+}  // namespace
+
+namespace shiny::core {
+
+io_counters&
+threadIo()
+{
+    return t_io;
+}
+
+void
+startup_report::begin(int64_t start)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_start     = start;
+    m_recording = true;
+}
+
+void
+startup_report::record(entry e)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_recording) {
+        m_entries.push_back(std::move(e));
+    }
+}
+
+bool
+startup_report::recording() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_recording;
+}
+
+/*
+The trace has a track of its own with the whole time to first frame on it, which starts it at the
+same point as the summary, and a track per thread of the entries that ran on it, named after the
+thread. The bytes are graphs of the stages' running totals, stepping up as each one ends.
+*/
+bool
+startup_report::write(int64_t present, const std::string& text_path, const std::string& trace_path)
+{
+    std::vector<entry> entries;
+    int64_t            start = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_recording) {
+            return true;
+        }
+        m_recording = false;
+        entries.swap(m_entries);
+        start = m_start;
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const entry& a, const entry& b) { return a.begin < b.begin; });
+
+    uint64_t read     = 0;
+    uint64_t uploaded = 0;
+    for (const entry& e : entries) {
+        if (isStage(e)) {
+            read += e.read;
+            uploaded += e.uploaded;
+        }
+    }
+
+    bool written = false;
+    {
+        std::ofstream out(text_path, std::ios::trunc);
+        char          line[512];
+        std::snprintf(line, sizeof(line),
+                      "Time to first frame %.2f ms, %.0f KB read, %.0f KB uploaded\n\n",
+                      milliseconds(present - start), kilobytes(read), kilobytes(uploaded));
+        out << line;
+        std::snprintf(line, sizeof(line), "%9s %9s  %-16s %10s %12s  %-5s  %s\n", "start ms",
+                      "time ms", "thread", "read KB", "uploaded KB", "kind", "name");
+        out << line;
+        for (const entry& e : entries) {
+            std::snprintf(line, sizeof(line), "%9.2f %9.2f  %-16.16s %10.0f %12.0f  %-5s  %s\n",
+                          milliseconds(e.begin - start), milliseconds(e.end - e.begin),
+                          e.thread.c_str(), kilobytes(e.read), kilobytes(e.uploaded), e.kind,
+                          e.name.c_str());
+            out << line;
+        }
+        written = (bool)out;
+    }
+
+    std::vector<trace_track> tracks(1);
+    tracks[0].name = "startup";
+    tracks[0].id   = 1;
+    tracks[0].zones.push_back({ "time to first frame", start, present });
+
+    std::vector<trace_sample> samples = { { "read KB", start, 0. }, { "uploaded KB", start, 0. } };
+    std::vector<const entry*> stages;
+
+    for (const entry& e : entries) {
+        auto track = std::find_if(tracks.begin(), tracks.end(),
+                                  [&](const trace_track& t) { return t.name == e.thread; });
+        if (track == tracks.end()) {
+            tracks.push_back({ e.thread, (uint32_t)tracks.size() + 1, {} });
+            track = tracks.end() - 1;
+        }
+        track->zones.push_back({ internName(e.name), e.begin, e.end });
+        if (isStage(e)) {
+            stages.push_back(&e);
+        }
+    }
+
+    std::stable_sort(stages.begin(), stages.end(),
+                     [](const entry* a, const entry* b) { return a->end < b->end; });
+    read     = 0;
+    uploaded = 0;
+    for (const entry* e : stages) {
+        read += e->read;
+        uploaded += e->uploaded;
+        samples.push_back({ "read KB", e->end, kilobytes(read) });
+        samples.push_back({ "uploaded KB", e->end, kilobytes(uploaded) });
+    }
+
+    return writeChromeTrace(trace_path, tracks, samples) && written;
+}
+
+startup_scope::startup_scope(startup_report* report, const char* kind, std::string name)
+  : m_report(report && report->recording() ? report : nullptr)
+{
+    if (!m_report) {
+        return;
+    }
+    const io_counters& io = threadIo();
+
+    m_entry.kind     = kind;
+    m_entry.name     = std::move(name);
+    m_entry.read     = io.read;
+    m_entry.uploaded = io.uploaded;
+    m_entry.begin    = profileNow();
+}
+
+startup_scope::~startup_scope()
+{
+    if (!m_report) {
+        return;
+    }
+    const io_counters& io = threadIo();
+
+    m_entry.end      = profileNow();
+    m_entry.read     = io.read - m_entry.read;
+    m_entry.uploaded = io.uploaded - m_entry.uploaded;
+    m_entry.thread   = threadTrack()->name();
+    m_report->record(std::move(m_entry));
+}
+
+}  // namespace shiny::core
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace shiny::core {
+
+// What the calling thread has read from files and copied into staging memory so far, counted by
+// mapped_file and the staging arena
+struct io_counters
+{
+    uint64_t read     = 0;  // bytes
+    uint64_t uploaded = 0;
+};
+io_counters& threadIo();
+
+/*
+Where the time from starting up to the first frame went: every step of initialization and every
+asset loaded on the way, with the thread it ran on and the bytes it read and staged, written once
+as a text summary and as a Chrome trace for comparing one build's startup with another's.
+
+Bytes are those of the step's own thread. What it leaves to other threads, such as packaged files
+decompressed on the jobs or textures read on the I/O queue, is counted where that runs instead, and
+steps that contain others, like the uploads their asset loads, count those loads' bytes as well.
+*/
+class startup_report
+{
+public:
+    struct entry
+    {
+        const char* kind = "";  // "stage" or "asset"
+        std::string name;
+        std::string thread;
+        int64_t     begin    = 0;  // profileNow()
+        int64_t     end      = 0;
+        uint64_t    read     = 0;
+        uint64_t    uploaded = 0;
+    };
+
+    // Starts recording, with time to first frame counted from `start`
+    void begin(int64_t start);
+
+    // From any thread. Ignored unless it's recording.
+    void record(entry e);
+    bool recording() const;
+
+    /*
+    Writes the summary to `text_path` and the trace to `trace_path`, with the first frame presented
+    at `present`, and stops recording. Only the first call writes anything, and returns false if
+    either file couldn't be written.
+    */
+    bool write(int64_t present, const std::string& text_path, const std::string& trace_path);
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<entry> m_entries;
+    int64_t            m_start     = 0;
+    bool               m_recording = false;
+};
+
+// Records the lifetime of the object into `report` as one entry, if there is a report and it's
+// recording
+class startup_scope
+{
+public:
+    startup_scope(startup_report* report, const char* kind, std::string name);
+    ~startup_scope();
+
+    startup_scope(const startup_scope&) = delete;
+    startup_scope& operator=(const startup_scope&) = delete;
+
+private:
+    startup_report*       m_report = nullptr;
+    startup_report::entry m_entry;
+};
+
+}  // namespace shiny::core
@@ -0,0 +1,611 @@
+#include "core/telemetry.h"
+
+#include "core/cpu_topology.h"
+#include "core/logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using shiny::core::profile_track;
+using shiny::core::trace_sample;
+using shiny::core::trace_track;
+
+#if defined(_WIN32)
+using socket_handle = SOCKET;
+
+const socket_handle no_socket = INVALID_SOCKET;
+#else
+using socket_handle = int;
+
+const socket_handle no_socket = -1;
+#endif
+
+// A client that has gone away fails the send, rather than raising a signal
+#if defined(MSG_NOSIGNAL)
+const int send_flags = MSG_NOSIGNAL;
+#else
+const int send_flags = 0;
+#endif
+
+const uint8_t telemetry_version = 1;
+
+enum message : uint8_t
+{
+    name_message    = 1,
+    track_message   = 2,
+    zones_message   = 3,
+    samples_message = 4,
+};
+
+// Winsock has to be started by everyone who uses it, as often as it is stopped
+bool
+startSockets()
+{
+#if defined(_WIN32)
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    return true;
+#endif
+}
+
+void
+stopSockets()
+{
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+}
+
+void
+closeSocket(socket_handle s)
+{
+#if defined(_WIN32)
+    closesocket(s);
+#else
+    close(s);
+#endif
+}
+
+// Sends and receives give up after `milliseconds`, so that neither end hangs on the other
+void
+setTimeouts(socket_handle s, uint32_t milliseconds)
+{
+#if defined(_WIN32)
+    const DWORD timeout = milliseconds;
+#else
+    timeval timeout;
+    timeout.tv_sec  = milliseconds / 1000;
+    timeout.tv_usec = (milliseconds % 1000) * 1000;
+#endif
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout),
+               sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout),
+               sizeof(timeout));
+}
+
+// Whether `s` has something to accept or read within `milliseconds`
+bool
+readable(socket_handle s, uint32_t milliseconds)
+{
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(s, &set);
+
+    timeval timeout;
+    timeout.tv_sec  = (long)(milliseconds / 1000);
+    timeout.tv_usec = (long)((milliseconds % 1000) * 1000);
+    return select((int)s + 1, &set, nullptr, nullptr, &timeout) > 0;
+}
+
+bool
+sendAll(socket_handle s, const std::vector<uint8_t>& bytes)
+{
+    size_t sent = 0;
+    while (sent < bytes.size()) {
+        const int n = send(s, reinterpret_cast<const char*>(bytes.data() + sent),
+                           (int)std::min<size_t>(bytes.size() - sent, 1 << 20), send_flags);
+        if (n <= 0) {
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+void
+putVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+void
+putSigned(std::vector<uint8_t>& out, int64_t value)
+{
+    putVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void
+putString(std::vector<uint8_t>& out, const std::string& text)
+{
+    putVarint(out, text.size());
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+void
+putDouble(std::vector<uint8_t>& out, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (uint32_t i = 0; i < 8; ++i) {
+        out.push_back((uint8_t)(bits >> (i * 8)));
+    }
+}
+
+// Reads what the put functions wrote, failing on anything past the end
+struct reader
+{
+    const uint8_t* p;
+    const uint8_t* end;
+
+    bool varint(uint64_t& value)
+    {
+        value = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7) {
+            if (p == end) {
+                return false;
+            }
+            const uint8_t byte = *p++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool signedVarint(int64_t& value)
+    {
+        uint64_t z;
+        if (!varint(z)) {
+            return false;
+        }
+        value = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+        return true;
+    }
+
+    bool string(std::string& text)
+    {
+        uint64_t length;
+        if (!varint(length) || length > (uint64_t)(end - p)) {
+            return false;
+        }
+        text.assign(reinterpret_cast<const char*>(p), (size_t)length);
+        p += length;
+        return true;
+    }
+
+    bool number(double& value)
+    {
+        if (end - p < 8) {
+            return false;
+        }
+        uint64_t bits = 0;
+        for (uint32_t i = 0; i < 8; ++i) {
+            bits |= (uint64_t)*p++ << (i * 8);
+        }
+        std::memcpy(&value, &bits, sizeof(value));
+        return true;
+    }
+};
+
+// What the ids of a stream's names and tracks stand for so far
+struct stream_state
+{
+    std::deque<std::string>         names;  // never moved, since zones and samples point at them
+    std::map<uint64_t, const char*> byid;
+    std::map<uint64_t, size_t>      tracks;  // index in the trace's
+};
+
+// Adds what the message at `r.p` has to the trace, or nothing if it's cut off or broken
+bool
+decodeMessage(reader&                    r,
+              stream_state&              state,
+              std::vector<trace_track>&  tracks,
+              std::vector<trace_sample>& samples)
+{
+    const uint8_t type = *r.p++;
+    uint64_t      id;
+    if (!r.varint(id)) {
+        return false;
+    }
+
+    if (type == name_message || type == track_message) {
+        std::string text;
+        if (!r.string(text)) {
+            return false;
+        }
+        if (type == name_message) {
+            state.names.push_back(std::move(text));
+            state.byid[id] = state.names.back().c_str();
+        } else if (state.tracks.count(id)) {
+            tracks[state.tracks[id]].name = std::move(text);
+        } else {
+            state.tracks[id] = tracks.size();
+            tracks.push_back({ std::move(text), (uint32_t)id, {} });
+        }
+        return true;
+    }
+
+    if (type == zones_message) {
+        uint64_t count;
+        if (!state.tracks.count(id) || !r.varint(count)) {
+            return false;
+        }
+        trace_track& track = tracks[state.tracks[id]];
+        const size_t before = track.zones.size();
+
+        int64_t begin = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t name, duration;
+            int64_t  delta;
+            if (!r.varint(name) || !r.signedVarint(delta) || !r.varint(duration)
+                || !state.byid.count(name)) {
+                track.zones.resize(before);
+                return false;
+            }
+            begin += delta;
+            track.zones.push_back({ state.byid[name], begin, begin + (int64_t)duration });
+        }
+        return true;
+    }
+
+    if (type == samples_message) {
+        // What was read as the id is the count
+        const size_t before = samples.size();
+        for (uint64_t i = 0; i < id; ++i) {
+            uint64_t name;
+            int64_t  time;
+            double   value;
+            if (!r.varint(name) || !r.signedVarint(time) || !r.number(value)
+                || !state.byid.count(name)) {
+                samples.resize(before);
+                return false;
+            }
+            samples.push_back({ state.byid[name], time, value });
+        }
+        return true;
+    }
+
+    return false;
+}
+
+/*
+Turns a stream into the tracks and samples of a trace, up to the first message that is cut off or
+broken, which a recording that was stopped in the middle of one ends with. False unless it starts
+like a stream does.
+*/
+bool
+decodeStream(const std::vector<uint8_t>& stream,
+             stream_state&               state,
+             std::vector<trace_track>&   tracks,
+             std::vector<trace_sample>&  samples)
+{
+    if (stream.size() < 5 || std::memcmp(stream.data(), "SHTL", 4) != 0
+        || stream[4] != telemetry_version) {
+        return false;
+    }
+
+    reader r{ stream.data() + 5, stream.data() + stream.size() };
+    while (r.p != r.end && decodeMessage(r, state, tracks, samples)) {
+    }
+    return true;
+}
+
+}  // namespace
+
+namespace shiny::core {
+
+bool
+telemetry_server::start(uint16_t port, std::chrono::milliseconds interval)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) {
+        return true;
+    }
+    if (!startSockets()) {
+        return false;
+    }
+
+    sockaddr_in address {};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    const socket_handle listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    const int           reuse    = 1;
+    if (listener == no_socket) {
+        stopSockets();
+        return false;
+    }
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse),
+               sizeof(reuse));
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, 1) != 0) {
+        closeSocket(listener);
+        stopSockets();
+        return false;
+    }
+
+    m_listener = (intptr_t)listener;
+    m_interval = interval;
+    m_running  = true;
+    m_thread   = std::thread([this]() {
+        nameThread("telemetry");
+        applyThreadClass(thread_class::background);
+        serveLoop();
+    });
+    return true;
+}
+
+void
+telemetry_server::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+
+    closeSocket((socket_handle)m_listener);
+    m_listener = -1;
+    stopSockets();
+}
+
+void
+telemetry_server::publish(const char* name, double value, int64_t time)
+{
+    if (!connected()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_samples.push_back({ name, time, value });
+}
+
+/*
+Waits for a client for an interval at a time, so that stop() is seen, and then sends to it until
+a send fails, which is also how a client that has gone away or stopped reading is noticed. Its
+zones start with those recorded after it connected.
+*/
+void
+telemetry_server::serveLoop()
+{
+    const socket_handle listener = (socket_handle)m_listener;
+    const uint32_t      interval = (uint32_t)m_interval.count();
+
+    socket_handle        client = no_socket;
+    std::vector<uint8_t> out;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        if (client == no_socket) {
+            lock.unlock();
+            if (readable(listener, interval)) {
+                client = accept(listener, nullptr, nullptr);
+            }
+            if (client != no_socket) {
+                const int nodelay = 1;
+                setsockopt(client, IPPROTO_TCP, TCP_NODELAY,
+                           reinterpret_cast<const char*>(&nodelay), sizeof(nodelay));
+                setTimeouts(client, 1000);
+
+                m_tracks.clear();
+                m_names.clear();
+                m_origin = profileNow();
+                for (const track_name& track : profileTracks()) {
+                    m_tracks.push_back({ track.track, "", track.track->head() });
+                }
+
+                out.assign({ 'S', 'H', 'T', 'L', telemetry_version });
+                if (sendAll(client, out)) {
+                    logInfo() << "Telemetry client connected";
+                } else {
+                    closeSocket(client);
+                    client = no_socket;
+                }
+            }
+            lock.lock();
+            m_connected = client != no_socket;
+            continue;
+        }
+
+        m_wake.wait_for(lock, m_interval, [this]() { return !m_running; });
+        m_sending.clear();
+        m_sending.swap(m_samples);
+        lock.unlock();
+
+        out.clear();
+        encodeUpdate(out);
+        const bool sent = out.empty() || sendAll(client, out);
+
+        lock.lock();
+        if (!sent) {
+            closeSocket(client);
+            client      = no_socket;
+            m_connected = false;
+            m_samples.clear();
+            logInfo() << "Telemetry client disconnected";
+        }
+    }
+    m_connected = false;
+
+    if (client != no_socket) {
+        closeSocket(client);
+    }
+}
+
+uint32_t
+telemetry_server::nameId(const char* name, std::vector<uint8_t>& out)
+{
+    auto it = m_names.find(name);
+    if (it != m_names.end()) {
+        return it->second;
+    }
+
+    const uint32_t id = (uint32_t)m_names.size();
+    m_names.emplace(name, id);
+    out.push_back(name_message);
+    putVarint(out, id);
+    putString(out, name);
+    return id;
+}
+
+// Tracks created since the last update start with their first zone
+void
+telemetry_server::encodeUpdate(std::vector<uint8_t>& out)
+{
+    for (const track_name& track : profileTracks()) {
+        auto state = std::find_if(m_tracks.begin(), m_tracks.end(),
+                                  [&](const track_state& s) { return s.track == track.track; });
+        if (state == m_tracks.end()) {
+            m_tracks.push_back({ track.track, "", 0 });
+            state = m_tracks.end() - 1;
+        }
+
+        m_zones.clear();
+        state->next = track.track->snapshotSince(state->next, m_zones);
+        if (m_zones.empty()) {
+            continue;
+        }
+
+        if (state->name != track.name) {
+            state->name = track.name;
+            out.push_back(track_message);
+            putVarint(out, track.track->id());
+            putString(out, track.name);
+        }
+
+        // The names go in front of the message their zones are in
+        std::vector<uint32_t> ids(m_zones.size());
+        for (size_t i = 0; i < m_zones.size(); ++i) {
+            ids[i] = nameId(m_zones[i].name, out);
+        }
+
+        out.push_back(zones_message);
+        putVarint(out, track.track->id());
+        putVarint(out, m_zones.size());
+        int64_t previous = m_origin;
+        for (size_t i = 0; i < m_zones.size(); ++i) {
+            const profile_track::zone& zone = m_zones[i];
+            putVarint(out, ids[i]);
+            putSigned(out, zone.begin - previous);
+            putVarint(out, (uint64_t)std::max<int64_t>(zone.end - zone.begin, 0));
+            previous = zone.begin;
+        }
+    }
+
+    if (!m_sending.empty()) {
+        std::vector<uint32_t> ids(m_sending.size());
+        for (size_t i = 0; i < m_sending.size(); ++i) {
+            ids[i] = nameId(m_sending[i].name, out);
+        }
+
+        out.push_back(samples_message);
+        putVarint(out, m_sending.size());
+        for (size_t i = 0; i < m_sending.size(); ++i) {
+            putVarint(out, ids[i]);
+            putSigned(out, m_sending[i].time - m_origin);
+            putDouble(out, m_sending[i].value);
+        }
+    }
+}
+
+/*
+Everything received is kept as it came and only decoded at the end, which takes a few bytes a zone
+and so fits minutes of a busy frame loop.
+*/
+bool
+recordTelemetry(const std::string& host, uint16_t port, const std::string& path, double seconds)
+{
+    if (!startSockets()) {
+        return false;
+    }
+
+    addrinfo hints {};
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+        stopSockets();
+        return false;
+    }
+
+    socket_handle s = no_socket;
+    for (addrinfo* a = addresses; a && s == no_socket; a = a->ai_next) {
+        s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (s != no_socket && connect(s, a->ai_addr, (int)a->ai_addrlen) != 0) {
+            closeSocket(s);
+            s = no_socket;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (s == no_socket) {
+        stopSockets();
+        return false;
+    }
+
+    const int64_t        deadline = profileNow() + (int64_t)(seconds * 1e9);
+    std::vector<uint8_t> stream;
+    uint8_t              buffer[64 * 1024];
+    while (seconds <= 0. || profileNow() < deadline) {
+        if (!readable(s, 100)) {
+            continue;
+        }
+        const int n = recv(s, reinterpret_cast<char*>(buffer), (int)sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        stream.insert(stream.end(), buffer, buffer + n);
+    }
+    closeSocket(s);
+    stopSockets();
+
+    stream_state              state;
+    std::vector<trace_track>  tracks;
+    std::vector<trace_sample> samples;
+    if (!decodeStream(stream, state, tracks, samples)) {
+        return false;
+    }
+    return writeChromeTrace(path, tracks, samples);
+}
+
+}  // namespace shiny::core
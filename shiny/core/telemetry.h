@@ -0,0 +1,99 @@
+#pragma once
+
+#include "core/profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace shiny::core {
+
+/*
+Streams the profiler's zones to a client over TCP while the engine runs, for machines a desktop
+profiler can't be attached to: every thread's CPU zones, the GPU's passes on the "GPU" track, and
+whatever values are published with it, e.g. frame times and memory use.
+
+A thread of its own waits for a client, one at a time, and then sends it what was recorded since
+the last send every `interval`. Recording zones is what it always is, the thread takes them from
+the tracks' rings as any snapshot does, so with a client connected the engine's threads only pay
+for the values they publish, and without one for an atomic load. Zones that were overwritten in a
+ring before they were sent are lost, which at 10 sends a second takes more than 650000 zones a
+second on one thread.
+
+Everything is little endian, and numbers are LEB128 varints, signed ones zigzagged. The stream
+starts with "SHTL" and a version byte, and then has messages of a type byte each:
+
+ 1 name:    id, length, bytes; the names of zones and values are sent once, and then go by id
+ 2 track:   id, length, bytes; sent when a track first has zones, and when it's renamed
+ 3 zones:   track id, count, and a name id, begin and duration of every zone, in nanoseconds; each
+            begin is the difference to the one before it, the first one to the connection's start
+ 4 samples: count, and a name id, time and 8 byte double of every sample, the time as above
+
+recordTelemetry() is the client, writing what it receives to a Chrome trace.
+*/
+class telemetry_server
+{
+public:
+    telemetry_server() = default;
+    telemetry_server(const telemetry_server&) = delete;
+    telemetry_server& operator=(const telemetry_server&) = delete;
+    ~telemetry_server() { stop(); }
+
+    // Listens on `port` of every interface. False if it can't.
+    bool start(uint16_t port, std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+    void stop();
+
+    // Whether a client is connected, for not publishing anything to nobody
+    bool connected() const { return m_connected.load(std::memory_order_relaxed); }
+
+    // A value at `time` on the profiler's clock, from any thread. The name isn't copied, so it has
+    // to outlive the server like a zone name does.
+    void publish(const char* name, double value, int64_t time = profileNow());
+
+private:
+    struct track_state
+    {
+        profile_track* track = nullptr;
+        std::string    name;
+        uint64_t       next = 0;  // zone
+    };
+
+    void     serveLoop();
+    void     encodeUpdate(std::vector<uint8_t>& out);
+    uint32_t nameId(const char* name, std::vector<uint8_t>& out);
+
+    std::mutex                m_mutex;
+    std::condition_variable   m_wake;     // stopping
+    std::vector<trace_sample> m_samples;  // published since the last send
+    std::thread               m_thread;
+    std::chrono::milliseconds m_interval{ 100 };
+    bool                      m_running = false;
+    std::atomic<bool>         m_connected{ false };
+    intptr_t                  m_listener = -1;  // the platform's socket
+
+    // Only the thread's, for the connected client
+    std::vector<track_state>                  m_tracks;
+    std::unordered_map<const char*, uint32_t> m_names;  // sent already
+    std::vector<trace_sample>                 m_sending;
+    std::vector<profile_track::zone>          m_zones;
+    int64_t                                   m_origin = 0;
+};
+
+/*
+Connects to a telemetry_server at `host` and `port`, and writes what it streams to `path` as a
+Chrome trace, once `seconds` have passed or the server closed the connection, whichever is first.
+With `seconds` at 0 only the latter. False if it couldn't connect, the stream is broken, or the
+trace couldn't be written.
+*/
+bool recordTelemetry(const std::string& host,
+                     uint16_t           port,
+                     const std::string& path,
+                     double             seconds);
+
+}  // namespace shiny::core
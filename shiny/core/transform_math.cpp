@@ -0,0 +1,826 @@
+#include "core/transform_math.h"
+
+#include <glm/simd/matrix.h>
+
+#include <cmath>
+
+// SSE2 is what every x64 CPU has, so it's compiled in whenever glm's kernels are. AVX2 is compiled
+// in as well, for just the functions that use it, and only ever called where the CPU has it.
+#if (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))             \
+  && (GLM_ARCH & GLM_ARCH_SSE2_BIT)
+#include <immintrin.h>
+#define SHINY_SIMD_SSE2
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SHINY_TARGET_AVX2
+#else
+#define SHINY_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SHINY_SIMD_NEON
+#endif
+
+namespace {
+
+using shiny::core::no_transform_parent;
+using shiny::core::simd_level;
+
+static_assert(sizeof(glm::quat) == 4 * sizeof(float), "quaternions have to be x, y, z, w");
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "vectors have to be tightly packed");
+static_assert(sizeof(glm::mat4) == 16 * sizeof(float), "matrices have to be tightly packed");
+
+struct transform_kernels
+{
+    void (*compose)(const glm::vec3*, const glm::quat*, const glm::vec3*, glm::mat4*, uint32_t);
+    void (*parents)(const glm::mat4*, const uint32_t*, glm::mat4*, uint32_t);
+    void (*multiply)(const glm::mat4&, const glm::mat4*, glm::mat4*, uint32_t);
+    void (*planes)(const glm::mat4*, glm::vec4*, uint32_t);
+    void (*blend)(const glm::quat*, const glm::quat*, const float*, glm::quat*, uint32_t);
+};
+
+glm::mat4
+composeOne(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+    const glm::mat3 r = glm::mat3_cast(rotation);
+
+    glm::mat4 m;
+    m[0] = glm::vec4(r[0] * scale.x, 0.f);
+    m[1] = glm::vec4(r[1] * scale.y, 0.f);
+    m[2] = glm::vec4(r[2] * scale.z, 0.f);
+    m[3] = glm::vec4(position, 1.f);
+    return m;
+}
+
+/*
+The vectorized composes work out the nine entries of the rotations' upper 3x3, scaled, for a whole
+register of transforms at a time, column entry after column entry, which this writes out as
+matrices. The translations are only copied.
+*/
+const uint32_t max_lanes = 8;
+
+void
+writeComposed(const float (*entries)[max_lanes],
+              const glm::vec3* positions,
+              uint32_t         lanes,
+              glm::mat4*       out)
+{
+    for (uint32_t lane = 0; lane < lanes; ++lane) {
+        glm::mat4& m = out[lane];
+        m[0]         = glm::vec4(entries[0][lane], entries[1][lane], entries[2][lane], 0.f);
+        m[1]         = glm::vec4(entries[3][lane], entries[4][lane], entries[5][lane], 0.f);
+        m[2]         = glm::vec4(entries[6][lane], entries[7][lane], entries[8][lane], 0.f);
+        m[3]         = glm::vec4(positions[lane], 1.f);
+    }
+}
+
+void
+composeScalar(const glm::vec3* positions,
+              const glm::quat* rotations,
+              const glm::vec3* scales,
+              glm::mat4*       out,
+              uint32_t         count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        out[i] = composeOne(positions[i], rotations[i], scales[i]);
+    }
+}
+
+void
+parentsScalar(const glm::mat4* parents,
+              const uint32_t*  parent_indices,
+              glm::mat4*       transforms,
+              uint32_t         count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        if (parent_indices[i] != no_transform_parent) {
+            transforms[i] = parents[parent_indices[i]] * transforms[i];
+        }
+    }
+}
+
+void
+multiplyScalar(const glm::mat4& left, const glm::mat4* right, glm::mat4* out, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        out[i] = left * right[i];
+    }
+}
+
+/*
+Each plane is a sum or difference of the matrix's rows (Gribb and Hartmann). The near plane is
+just the third row, since depth starts at 0 rather than -1. With reverse-Z the third row is the far
+plane and the last one the near plane instead, which only swaps their names. A plane without a
+normal, like the far plane of a projection that has none, is left as one nothing is outside of.
+*/
+void
+planesScalar(const glm::mat4* matrices, glm::vec4* planes, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        const glm::mat4 rows = glm::transpose(matrices[i]);
+
+        glm::vec4* p = planes + 6 * i;
+        p[0]         = rows[3] + rows[0];  // left
+        p[1]         = rows[3] - rows[0];  // right
+        p[2]         = rows[3] + rows[1];  // bottom
+        p[3]         = rows[3] - rows[1];  // top
+        p[4]         = rows[2];            // near
+        p[5]         = rows[3] - rows[2];  // far
+
+        for (uint32_t k = 0; k < 6; ++k) {
+            const float length = glm::length(glm::vec3(p[k]));
+            p[k] = length > 0.f ? p[k] / length : glm::vec4(0.f, 0.f, 0.f, 1.f);
+        }
+    }
+}
+
+void
+blendScalar(const glm::quat* from,
+            const glm::quat* to,
+            const float*     weights,
+            glm::quat*       out,
+            uint32_t         count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        const glm::vec4 a(from[i].x, from[i].y, from[i].z, from[i].w);
+        const glm::vec4 b(to[i].x, to[i].y, to[i].z, to[i].w);
+        const float     weight = weights[i];
+        const float     toward = glm::dot(a, b) < 0.f ? -weight : weight;
+        const glm::vec4 r      = glm::normalize(a * (1.f - weight) + b * toward);
+        out[i]                 = glm::quat(r.w, r.x, r.y, r.z);
+    }
+}
+
+const transform_kernels scalar_kernels = { composeScalar, parentsScalar, multiplyScalar,
+                                           planesScalar, blendScalar };
+
+#if defined(SHINY_SIMD_SSE2)
+void
+composeSse2(const glm::vec3* positions,
+            const glm::quat* rotations,
+            const glm::vec3* scales,
+            glm::mat4*       out,
+            uint32_t         count)
+{
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 two = _mm_set1_ps(2.f);
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const glm::quat* q = rotations + i;
+        const glm::vec3* s = scales + i;
+
+        const __m128 x  = _mm_setr_ps(q[0].x, q[1].x, q[2].x, q[3].x);
+        const __m128 y  = _mm_setr_ps(q[0].y, q[1].y, q[2].y, q[3].y);
+        const __m128 z  = _mm_setr_ps(q[0].z, q[1].z, q[2].z, q[3].z);
+        const __m128 w  = _mm_setr_ps(q[0].w, q[1].w, q[2].w, q[3].w);
+        const __m128 sx = _mm_setr_ps(s[0].x, s[1].x, s[2].x, s[3].x);
+        const __m128 sy = _mm_setr_ps(s[0].y, s[1].y, s[2].y, s[3].y);
+        const __m128 sz = _mm_setr_ps(s[0].z, s[1].z, s[2].z, s[3].z);
+
+        const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        const __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+        const __m128 entries[9] = {
+            _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+            _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+            _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx),
+            _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+            _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+            _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy),
+            _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+            _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+            _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz),
+        };
+
+        alignas(16) float stored[9][max_lanes];
+        for (uint32_t k = 0; k < 9; ++k) {
+            _mm_store_ps(stored[k], entries[k]);
+        }
+        writeComposed(stored, positions + i, 4, out + i);
+    }
+
+    composeScalar(positions + i, rotations + i, scales + i, out + i, count - i);
+}
+
+// glm's own kernel, on matrices that may not be aligned, where out may be right
+void
+multiplySse2(const glm_vec4 left[4], const glm::mat4& right, glm::mat4& out)
+{
+    glm_vec4 columns[4];
+    glm_vec4 product[4];
+    for (uint32_t k = 0; k < 4; ++k) {
+        columns[k] = _mm_loadu_ps(&right[k][0]);
+    }
+    glm_mat4_mul(left, columns, product);
+    for (uint32_t k = 0; k < 4; ++k) {
+        _mm_storeu_ps(&out[k][0], product[k]);
+    }
+}
+
+void
+loadSse2(const glm::mat4& matrix, glm_vec4 columns[4])
+{
+    for (uint32_t k = 0; k < 4; ++k) {
+        columns[k] = _mm_loadu_ps(&matrix[k][0]);
+    }
+}
+
+void
+parentsSse2(const glm::mat4* parents,
+            const uint32_t*  parent_indices,
+            glm::mat4*       transforms,
+            uint32_t         count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        if (parent_indices[i] != no_transform_parent) {
+            glm_vec4 parent[4];
+            loadSse2(parents[parent_indices[i]], parent);
+            multiplySse2(parent, transforms[i], transforms[i]);
+        }
+    }
+}
+
+void
+multiplyTransformsSse2(const glm::mat4& left, const glm::mat4* right, glm::mat4* out,
+                       uint32_t count)
+{
+    glm_vec4 columns[4];
+    loadSse2(left, columns);
+    for (uint32_t i = 0; i < count; ++i) {
+        multiplySse2(columns, right[i], out[i]);
+    }
+}
+
+// The normal's length is summed up in the lowest lane only, and then divides all four, unless it's
+// 0, see planesScalar
+__m128
+normalizePlaneSse2(__m128 plane)
+{
+    const __m128 squared = _mm_mul_ps(plane, plane);
+
+    __m128 length = _mm_add_ss(squared, _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(1, 1, 1, 1)));
+    length        = _mm_add_ss(length, _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(2, 2, 2, 2)));
+    length        = _mm_sqrt_ss(length);
+    length        = _mm_shuffle_ps(length, length, _MM_SHUFFLE(0, 0, 0, 0));
+
+    const __m128 none = _mm_cmpeq_ps(length, _mm_setzero_ps());
+    return _mm_or_ps(_mm_andnot_ps(none, _mm_div_ps(plane, length)),
+                     _mm_and_ps(none, _mm_set_ps(1.f, 0.f, 0.f, 0.f)));
+}
+
+void
+planesSse2(const glm::mat4* matrices, glm::vec4* planes, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        glm_vec4 columns[4];
+        glm_vec4 rows[4];
+        loadSse2(matrices[i], columns);
+        glm_mat4_transpose(columns, rows);
+
+        const __m128 p[6] = { _mm_add_ps(rows[3], rows[0]), _mm_sub_ps(rows[3], rows[0]),
+                              _mm_add_ps(rows[3], rows[1]), _mm_sub_ps(rows[3], rows[1]),
+                              rows[2],                      _mm_sub_ps(rows[3], rows[2]) };
+        for (uint32_t k = 0; k < 6; ++k) {
+            _mm_storeu_ps(&planes[6 * i + k][0], normalizePlaneSse2(p[k]));
+        }
+    }
+}
+
+// Four rotations at a time, transposed into a register of each component and back
+void
+blendSse2(const glm::quat* from,
+          const glm::quat* to,
+          const float*     weights,
+          glm::quat*       out,
+          uint32_t         count)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one  = _mm_set1_ps(1.f);
+    const __m128 sign = _mm_set1_ps(-0.f);
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 ax = _mm_loadu_ps(&from[i].x), ay = _mm_loadu_ps(&from[i + 1].x);
+        __m128 az = _mm_loadu_ps(&from[i + 2].x), aw = _mm_loadu_ps(&from[i + 3].x);
+        __m128 bx = _mm_loadu_ps(&to[i].x), by = _mm_loadu_ps(&to[i + 1].x);
+        __m128 bz = _mm_loadu_ps(&to[i + 2].x), bw = _mm_loadu_ps(&to[i + 3].x);
+        _MM_TRANSPOSE4_PS(ax, ay, az, aw);
+        _MM_TRANSPOSE4_PS(bx, by, bz, bw);
+
+        __m128 dot = _mm_mul_ps(ax, bx);
+        dot        = _mm_add_ps(dot, _mm_mul_ps(ay, by));
+        dot        = _mm_add_ps(dot, _mm_mul_ps(az, bz));
+        dot        = _mm_add_ps(dot, _mm_mul_ps(aw, bw));
+
+        const __m128 weight = _mm_loadu_ps(weights + i);
+        const __m128 keep   = _mm_sub_ps(one, weight);
+        const __m128 toward = _mm_xor_ps(weight, _mm_and_ps(_mm_cmplt_ps(dot, zero), sign));
+
+        __m128 x = _mm_add_ps(_mm_mul_ps(ax, keep), _mm_mul_ps(bx, toward));
+        __m128 y = _mm_add_ps(_mm_mul_ps(ay, keep), _mm_mul_ps(by, toward));
+        __m128 z = _mm_add_ps(_mm_mul_ps(az, keep), _mm_mul_ps(bz, toward));
+        __m128 w = _mm_add_ps(_mm_mul_ps(aw, keep), _mm_mul_ps(bw, toward));
+
+        __m128 length = _mm_mul_ps(x, x);
+        length        = _mm_add_ps(length, _mm_mul_ps(y, y));
+        length        = _mm_add_ps(length, _mm_mul_ps(z, z));
+        length        = _mm_add_ps(length, _mm_mul_ps(w, w));
+        const __m128 scale = _mm_div_ps(one, _mm_sqrt_ps(length));
+
+        x = _mm_mul_ps(x, scale);
+        y = _mm_mul_ps(y, scale);
+        z = _mm_mul_ps(z, scale);
+        w = _mm_mul_ps(w, scale);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_storeu_ps(&out[i].x, x);
+        _mm_storeu_ps(&out[i + 1].x, y);
+        _mm_storeu_ps(&out[i + 2].x, z);
+        _mm_storeu_ps(&out[i + 3].x, w);
+    }
+
+    blendScalar(from + i, to + i, weights + i, out + i, count - i);
+}
+
+const transform_kernels sse2_kernels = { composeSse2, parentsSse2, multiplyTransformsSse2,
+                                         planesSse2, blendSse2 };
+
+/*
+Eight transforms at a time for the composes, with their components gathered out of the arrays,
+and two at a time for the products, one in each half of the register: every column of a product is
+the left side's columns, scaled by the entries of the right side's column, which _mm256_permute_ps
+spreads over each half on its own.
+*/
+SHINY_TARGET_AVX2 void
+composeAvx2(const glm::vec3* positions,
+            const glm::quat* rotations,
+            const glm::vec3* scales,
+            glm::mat4*       out,
+            uint32_t         count)
+{
+    const __m256  one       = _mm256_set1_ps(1.f);
+    const __m256  two       = _mm256_set1_ps(2.f);
+    const __m256i quatlanes = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    const __m256i vec3lanes = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const glm::quat& q = rotations[i];
+        const glm::vec3& s = scales[i];
+
+        const __m256 x  = _mm256_i32gather_ps(&q.x, quatlanes, 4);
+        const __m256 y  = _mm256_i32gather_ps(&q.y, quatlanes, 4);
+        const __m256 z  = _mm256_i32gather_ps(&q.z, quatlanes, 4);
+        const __m256 w  = _mm256_i32gather_ps(&q.w, quatlanes, 4);
+        const __m256 sx = _mm256_i32gather_ps(&s.x, vec3lanes, 4);
+        const __m256 sy = _mm256_i32gather_ps(&s.y, vec3lanes, 4);
+        const __m256 sz = _mm256_i32gather_ps(&s.z, vec3lanes, 4);
+
+        const __m256 xx = _mm256_mul_ps(x, x), yy = _mm256_mul_ps(y, y), zz = _mm256_mul_ps(z, z);
+        const __m256 xy = _mm256_mul_ps(x, y), xz = _mm256_mul_ps(x, z), yz = _mm256_mul_ps(y, z);
+        const __m256 wx = _mm256_mul_ps(w, x), wy = _mm256_mul_ps(w, y), wz = _mm256_mul_ps(w, z);
+
+        const __m256 entries[9] = {
+            _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one), sx),
+            _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx),
+            _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx),
+            _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy),
+            _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one), sy),
+            _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy),
+            _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz),
+            _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz),
+            _mm256_mul_ps(_mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one), sz),
+        };
+
+        alignas(32) float stored[9][max_lanes];
+        for (uint32_t k = 0; k < 9; ++k) {
+            _mm256_store_ps(stored[k], entries[k]);
+        }
+        writeComposed(stored, positions + i, 8, out + i);
+    }
+
+    composeSse2(positions + i, rotations + i, scales + i, out + i, count - i);
+}
+
+SHINY_TARGET_AVX2 inline __m256
+loadPair(const float* low, const float* high)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+}
+
+// Both right sides are read before anything is written, so the outputs may be them
+SHINY_TARGET_AVX2 inline void
+multiplyPairAvx2(const __m256    left[4],
+                 const glm::mat4& righta,
+                 const glm::mat4& rightb,
+                 glm::mat4&       outa,
+                 glm::mat4&       outb)
+{
+    __m256 right[4];
+    for (uint32_t j = 0; j < 4; ++j) {
+        right[j] = loadPair(&righta[j][0], &rightb[j][0]);
+    }
+
+    for (uint32_t j = 0; j < 4; ++j) {
+        __m256 column = _mm256_mul_ps(left[0], _mm256_permute_ps(right[j], 0x00));
+        column        = _mm256_fmadd_ps(left[1], _mm256_permute_ps(right[j], 0x55), column);
+        column        = _mm256_fmadd_ps(left[2], _mm256_permute_ps(right[j], 0xaa), column);
+        column        = _mm256_fmadd_ps(left[3], _mm256_permute_ps(right[j], 0xff), column);
+        _mm_storeu_ps(&outa[j][0], _mm256_castps256_ps128(column));
+        _mm_storeu_ps(&outb[j][0], _mm256_extractf128_ps(column, 1));
+    }
+}
+
+// Those with parents are paired up as they come, and one left over at the end goes on its own
+SHINY_TARGET_AVX2 void
+parentsAvx2(const glm::mat4* parents,
+            const uint32_t*  parent_indices,
+            glm::mat4*       transforms,
+            uint32_t         count)
+{
+    uint32_t waiting = no_transform_parent;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (parent_indices[i] == no_transform_parent) {
+            continue;
+        }
+        if (waiting == no_transform_parent) {
+            waiting = i;
+            continue;
+        }
+
+        const glm::mat4& parenta = parents[parent_indices[waiting]];
+        const glm::mat4& parentb = parents[parent_indices[i]];
+
+        __m256 left[4];
+        for (uint32_t k = 0; k < 4; ++k) {
+            left[k] = loadPair(&parenta[k][0], &parentb[k][0]);
+        }
+        multiplyPairAvx2(left, transforms[waiting], transforms[i], transforms[waiting],
+                         transforms[i]);
+        waiting = no_transform_parent;
+    }
+
+    if (waiting != no_transform_parent) {
+        parentsSse2(parents, parent_indices + waiting, transforms + waiting, 1);
+    }
+}
+
+SHINY_TARGET_AVX2 void
+multiplyTransformsAvx2(const glm::mat4& left, const glm::mat4* right, glm::mat4* out,
+                       uint32_t count)
+{
+    __m256 columns[4];
+    for (uint32_t k = 0; k < 4; ++k) {
+        columns[k] = loadPair(&left[k][0], &left[k][0]);
+    }
+
+    uint32_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        multiplyPairAvx2(columns, right[i], right[i + 1], out[i], out[i + 1]);
+    }
+
+    multiplyTransformsSse2(left, right + i, out + i, count - i);
+}
+
+// A handful of frusta a frame don't fill wider registers, so the planes are SSE2's, and neither
+// do a skeleton's joints, so the blends are too
+const transform_kernels avx2_kernels = { composeAvx2, parentsAvx2, multiplyTransformsAvx2,
+                                         planesSse2, blendSse2 };
+
+bool
+cpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    // AVX2 and FMA, and an OS that saves the upper halves of the registers
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+
+    __cpuid(info, 1);
+    const bool fma     = (info[2] & (1 << 12)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx     = (info[2] & (1 << 28)) != 0;
+    if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    // Which also checks that the OS saves the registers
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+#if defined(SHINY_SIMD_NEON)
+/*
+Four transforms at a time for the composes, whose components the structure loads take apart, and
+one at a time for the products, with a lane of the right side's column multiplying each of the
+left side's.
+*/
+void
+composeNeon(const glm::vec3* positions,
+            const glm::quat* rotations,
+            const glm::vec3* scales,
+            glm::mat4*       out,
+            uint32_t         count)
+{
+    const float32x4_t one = vdupq_n_f32(1.f);
+    const float32x4_t two = vdupq_n_f32(2.f);
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float32x4x4_t q = vld4q_f32(&rotations[i].x);
+        const float32x4x3_t s = vld3q_f32(&scales[i].x);
+
+        const float32x4_t x = q.val[0], y = q.val[1], z = q.val[2], w = q.val[3];
+
+        const float32x4_t xx = vmulq_f32(x, x), yy = vmulq_f32(y, y), zz = vmulq_f32(z, z);
+        const float32x4_t xy = vmulq_f32(x, y), xz = vmulq_f32(x, z), yz = vmulq_f32(y, z);
+        const float32x4_t wx = vmulq_f32(w, x), wy = vmulq_f32(w, y), wz = vmulq_f32(w, z);
+
+        const float32x4_t entries[9] = {
+            vmulq_f32(vmlsq_f32(one, two, vaddq_f32(yy, zz)), s.val[0]),
+            vmulq_f32(vmulq_f32(two, vaddq_f32(xy, wz)), s.val[0]),
+            vmulq_f32(vmulq_f32(two, vsubq_f32(xz, wy)), s.val[0]),
+            vmulq_f32(vmulq_f32(two, vsubq_f32(xy, wz)), s.val[1]),
+            vmulq_f32(vmlsq_f32(one, two, vaddq_f32(xx, zz)), s.val[1]),
+            vmulq_f32(vmulq_f32(two, vaddq_f32(yz, wx)), s.val[1]),
+            vmulq_f32(vmulq_f32(two, vaddq_f32(xz, wy)), s.val[2]),
+            vmulq_f32(vmulq_f32(two, vsubq_f32(yz, wx)), s.val[2]),
+            vmulq_f32(vmlsq_f32(one, two, vaddq_f32(xx, yy)), s.val[2]),
+        };
+
+        float stored[9][max_lanes];
+        for (uint32_t k = 0; k < 9; ++k) {
+            vst1q_f32(stored[k], entries[k]);
+        }
+        writeComposed(stored, positions + i, 4, out + i);
+    }
+
+    composeScalar(positions + i, rotations + i, scales + i, out + i, count - i);
+}
+
+// Where out may be right
+void
+multiplyNeon(const float32x4_t left[4], const glm::mat4& right, glm::mat4& out)
+{
+    float32x4_t columns[4];
+    for (uint32_t j = 0; j < 4; ++j) {
+        columns[j] = vld1q_f32(&right[j][0]);
+    }
+
+    for (uint32_t j = 0; j < 4; ++j) {
+        float32x4_t column = vmulq_laneq_f32(left[0], columns[j], 0);
+        column             = vfmaq_laneq_f32(column, left[1], columns[j], 1);
+        column             = vfmaq_laneq_f32(column, left[2], columns[j], 2);
+        column             = vfmaq_laneq_f32(column, left[3], columns[j], 3);
+        vst1q_f32(&out[j][0], column);
+    }
+}
+
+void
+loadNeon(const glm::mat4& matrix, float32x4_t columns[4])
+{
+    for (uint32_t k = 0; k < 4; ++k) {
+        columns[k] = vld1q_f32(&matrix[k][0]);
+    }
+}
+
+void
+parentsNeon(const glm::mat4* parents,
+            const uint32_t*  parent_indices,
+            glm::mat4*       transforms,
+            uint32_t         count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        if (parent_indices[i] != no_transform_parent) {
+            float32x4_t parent[4];
+            loadNeon(parents[parent_indices[i]], parent);
+            multiplyNeon(parent, transforms[i], transforms[i]);
+        }
+    }
+}
+
+void
+multiplyTransformsNeon(const glm::mat4& left, const glm::mat4* right, glm::mat4* out,
+                       uint32_t count)
+{
+    float32x4_t columns[4];
+    loadNeon(left, columns);
+    for (uint32_t i = 0; i < count; ++i) {
+        multiplyNeon(columns, right[i], out[i]);
+    }
+}
+
+// Loading the matrix four ways apart takes its rows out of its columns
+void
+planesNeon(const glm::mat4* matrices, glm::vec4* planes, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        const float32x4x4_t rows = vld4q_f32(&matrices[i][0][0]);
+
+        const float32x4_t p[6] = { vaddq_f32(rows.val[3], rows.val[0]),
+                                   vsubq_f32(rows.val[3], rows.val[0]),
+                                   vaddq_f32(rows.val[3], rows.val[1]),
+                                   vsubq_f32(rows.val[3], rows.val[1]),
+                                   rows.val[2],
+                                   vsubq_f32(rows.val[3], rows.val[2]) };
+        for (uint32_t k = 0; k < 6; ++k) {
+            const float32x4_t squared = vsetq_lane_f32(0.f, vmulq_f32(p[k], p[k]), 3);
+            const float       length  = std::sqrt(vaddvq_f32(squared));
+            if (length > 0.f) {
+                vst1q_f32(&planes[6 * i + k][0], vdivq_f32(p[k], vdupq_n_f32(length)));
+            } else {
+                planes[6 * i + k] = glm::vec4(0.f, 0.f, 0.f, 1.f);
+            }
+        }
+    }
+}
+
+// Four rotations at a time, which the structure loads and stores take apart and put together
+void
+blendNeon(const glm::quat* from,
+          const glm::quat* to,
+          const float*     weights,
+          glm::quat*       out,
+          uint32_t         count)
+{
+    const float32x4_t one  = vdupq_n_f32(1.f);
+    const uint32x4_t  sign = vdupq_n_u32(0x80000000u);
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float32x4x4_t a = vld4q_f32(&from[i].x);
+        const float32x4x4_t b = vld4q_f32(&to[i].x);
+
+        float32x4_t dot = vmulq_f32(a.val[0], b.val[0]);
+        dot             = vmlaq_f32(dot, a.val[1], b.val[1]);
+        dot             = vmlaq_f32(dot, a.val[2], b.val[2]);
+        dot             = vmlaq_f32(dot, a.val[3], b.val[3]);
+
+        const float32x4_t weight  = vld1q_f32(weights + i);
+        const float32x4_t keep    = vsubq_f32(one, weight);
+        const uint32x4_t  flipped = vandq_u32(vcltq_f32(dot, vdupq_n_f32(0.f)), sign);
+        const float32x4_t toward =
+          vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(weight), flipped));
+
+        float32x4x4_t r;
+        for (uint32_t k = 0; k < 4; ++k) {
+            r.val[k] = vmlaq_f32(vmulq_f32(a.val[k], keep), b.val[k], toward);
+        }
+        float32x4_t length = vmulq_f32(r.val[0], r.val[0]);
+        for (uint32_t k = 1; k < 4; ++k) {
+            length = vmlaq_f32(length, r.val[k], r.val[k]);
+        }
+        const float32x4_t scale = vdivq_f32(one, vsqrtq_f32(length));
+        for (uint32_t k = 0; k < 4; ++k) {
+            r.val[k] = vmulq_f32(r.val[k], scale);
+        }
+        vst4q_f32(&out[i].x, r);
+    }
+
+    blendScalar(from + i, to + i, weights + i, out + i, count - i);
+}
+
+const transform_kernels neon_kernels = { composeNeon, parentsNeon, multiplyTransformsNeon,
+                                         planesNeon, blendNeon };
+#endif
+
+simd_level
+bestLevel()
+{
+#if defined(SHINY_SIMD_SSE2)
+    return cpuHasAvx2() ? simd_level::avx2 : simd_level::sse2;
+#elif defined(SHINY_SIMD_NEON)
+    return simd_level::neon;
+#else
+    return simd_level::scalar;
+#endif
+}
+
+bool
+available(simd_level level)
+{
+    switch (level) {
+        case simd_level::scalar:
+            return true;
+#if defined(SHINY_SIMD_SSE2)
+        case simd_level::sse2:
+            return true;
+        case simd_level::avx2:
+            return cpuHasAvx2();
+#elif defined(SHINY_SIMD_NEON)
+        case simd_level::neon:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+// Picked the first time, on whichever thread that is
+simd_level&
+currentLevel()
+{
+    static simd_level level = bestLevel();
+    return level;
+}
+
+const transform_kernels&
+kernels()
+{
+    switch (currentLevel()) {
+#if defined(SHINY_SIMD_SSE2)
+        case simd_level::sse2:
+            return sse2_kernels;
+        case simd_level::avx2:
+            return avx2_kernels;
+#elif defined(SHINY_SIMD_NEON)
+        case simd_level::neon:
+            return neon_kernels;
+#endif
+        default:
+            return scalar_kernels;
+    }
+}
+
+}  // namespace
+
+namespace shiny::core {
+
+const char*
+simdName(simd_level level)
+{
+    switch (level) {
+        case simd_level::sse2:
+            return "sse2";
+        case simd_level::avx2:
+            return "avx2";
+        case simd_level::neon:
+            return "neon";
+        default:
+            return "scalar";
+    }
+}
+
+simd_level
+transformSimd()
+{
+    return currentLevel();
+}
+
+simd_level
+setTransformSimd(simd_level level)
+{
+    currentLevel() = available(level) ? level : bestLevel();
+    return currentLevel();
+}
+
+void
+composeTransforms(const glm::vec3* positions,
+                  const glm::quat* rotations,
+                  const glm::vec3* scales,
+                  glm::mat4*       out,
+                  uint32_t         count)
+{
+    kernels().compose(positions, rotations, scales, out, count);
+}
+
+void
+applyParents(const glm::mat4* parents,
+             const uint32_t*  parent_indices,
+             glm::mat4*       transforms,
+             uint32_t         count)
+{
+    kernels().parents(parents, parent_indices, transforms, count);
+}
+
+void
+multiplyTransforms(const glm::mat4& left, const glm::mat4* right, glm::mat4* out, uint32_t count)
+{
+    kernels().multiply(left, right, out, count);
+}
+
+void
+extractPlanes(const glm::mat4* matrices, glm::vec4* planes, uint32_t count)
+{
+    kernels().planes(matrices, planes, count);
+}
+
+void
+blendRotations(const glm::quat* from,
+               const glm::quat* to,
+               const float*     weights,
+               glm::quat*       out,
+               uint32_t         count)
+{
+    kernels().blend(from, to, weights, out, count);
+}
+
+}  // namespace shiny::core
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <limits>
+
+namespace shiny::core {
+
+// The instruction sets the batched transform math comes in
+enum class simd_level : uint8_t
+{
+    scalar,
+    sse2,
+    avx2,  // with FMA
+    neon,
+};
+
+const char* simdName(simd_level level);
+
+/*
+What the kernels below run with, which is the best the CPU has, picked out the first time it's
+asked for. setTransformSimd() picks another one for comparing them, falling back to the best there
+is if the CPU doesn't have it, and returns what it picked. It mustn't be called while any of the
+kernels run.
+*/
+simd_level transformSimd();
+simd_level setTransformSimd(simd_level level);
+
+// What applyParents() leaves a transform without a parent as
+const uint32_t no_transform_parent = std::numeric_limits<uint32_t>::max();
+
+/*
+Batched matrix math over arrays of transforms, for the transform hierarchy and whatever else
+transforms many things in one go. Every kernel does the same as the glm expression it stands for,
+give or take rounding, several matrices at a time where the CPU has the registers for it.
+*/
+
+// out[i] = translate(positions[i]) * mat4_cast(rotations[i]) * scale(scales[i]), from arrays of
+// each, which are read several at a time
+void composeTransforms(const glm::vec3* positions,
+                       const glm::quat* rotations,
+                       const glm::vec3* scales,
+                       glm::mat4*       out,
+                       uint32_t         count);
+
+// transforms[i] = parents[parent_indices[i]] * transforms[i], except where the index is
+// no_transform_parent. None of the parents may be among the transforms.
+void applyParents(const glm::mat4* parents,
+                  const uint32_t*  parent_indices,
+                  glm::mat4*       transforms,
+                  uint32_t         count);
+
+// out[i] = left * right[i], where out may be right
+void multiplyTransforms(const glm::mat4& left,
+                        const glm::mat4* right,
+                        glm::mat4*       out,
+                        uint32_t         count);
+
+// Six frustum planes per matrix, as graphics::extractFrustum() has them
+void extractPlanes(const glm::mat4* matrices, glm::vec4* planes, uint32_t count);
+
+// out[i] = normalize(mix(from[i], to[i], weights[i])), the shorter way around, where out may be
+// either. As good as a slerp for the small steps between keyframes, and for blending poses.
+void blendRotations(const glm::quat* from,
+                    const glm::quat* to,
+                    const float*     weights,
+                    glm::quat*       out,
+                    uint32_t         count);
+
+}  // namespace shiny::core
@@ -0,0 +1,650 @@
+#include "graphics/acceleration_structures.h"
+
+#include "core/logger.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+
+namespace shiny::graphics {
+
+#if defined(VK_KHR_acceleration_structure)
+
+namespace {
+
+// Bottom levels built a frame at most, and the scratch memory they may take between them, which
+// every frame has of its own
+const uint32_t       max_bottom_builds     = 16;
+const vk::DeviceSize bottom_scratch_budget = 32 * 1024 * 1024;
+
+// A top level is rebuilt after being refit this many times in a row
+const uint32_t max_top_refits = 8;
+
+const vk::BuildAccelerationStructureFlagsKHR bottom_flags =
+  vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace
+  | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction;
+
+// Rebuilt or refit every frame, so fast building matters more than a little faster tracing
+const vk::BuildAccelerationStructureFlagsKHR top_flags =
+  vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastBuild
+  | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+vk::DeviceSize
+indexSize(vk::IndexType type)
+{
+    return type == vk::IndexType::eUint16 ? 2 : 4;
+}
+
+}  // namespace
+
+bool
+acceleration_structures::buildsFrom(vk::PhysicalDevice physical_device, vk::Format format)
+{
+    const vk::FormatProperties properties = physical_device.getFormatProperties(format);
+    return static_cast<bool>(properties.bufferFeatures
+                             & vk::FormatFeatureFlagBits::eAccelerationStructureVertexBufferKHR);
+}
+
+void
+acceleration_structures::init(vk::PhysicalDevice physical_device,
+                              vk::Device         device,
+                              memory_allocator&  allocator,
+                              vk::Buffer         positions,
+                              vk::Buffer         indices,
+                              uint32_t           frames,
+                              uint32_t           max_instances)
+{
+    m_device        = device;
+    m_allocator     = &allocator;
+    m_max_instances = max_instances;
+
+    // Extension commands aren't exported by the loader
+    m_create = (PFN_vkCreateAccelerationStructureKHR)m_device.getProcAddr(
+      "vkCreateAccelerationStructureKHR");
+    m_destroy = (PFN_vkDestroyAccelerationStructureKHR)m_device.getProcAddr(
+      "vkDestroyAccelerationStructureKHR");
+    m_build_sizes = (PFN_vkGetAccelerationStructureBuildSizesKHR)m_device.getProcAddr(
+      "vkGetAccelerationStructureBuildSizesKHR");
+    m_address = (PFN_vkGetAccelerationStructureDeviceAddressKHR)m_device.getProcAddr(
+      "vkGetAccelerationStructureDeviceAddressKHR");
+    m_build = (PFN_vkCmdBuildAccelerationStructuresKHR)m_device.getProcAddr(
+      "vkCmdBuildAccelerationStructuresKHR");
+    m_copy = (PFN_vkCmdCopyAccelerationStructureKHR)m_device.getProcAddr(
+      "vkCmdCopyAccelerationStructureKHR");
+    m_write_properties = (PFN_vkCmdWriteAccelerationStructuresPropertiesKHR)m_device.getProcAddr(
+      "vkCmdWriteAccelerationStructuresPropertiesKHR");
+    m_buffer_address =
+      (PFN_vkGetBufferDeviceAddressKHR)m_device.getProcAddr("vkGetBufferDeviceAddressKHR");
+
+    vk::PhysicalDeviceAccelerationStructurePropertiesKHR limits;
+    vk::PhysicalDeviceProperties2                        properties;
+    properties.pNext = &limits;
+    physical_device.getProperties2(&properties);
+    m_scratch_align = limits.minAccelerationStructureScratchOffsetAlignment;
+
+    m_positions = bufferAddress(positions);
+    m_indices   = bufferAddress(indices);
+
+    // Every build and refit of a top level fits in what the most instances take
+    auto instancegeometry = vk::AccelerationStructureGeometryKHR()
+                              .setGeometryType(vk::GeometryTypeKHR::eInstances)
+                              .setGeometry(vk::AccelerationStructureGeometryInstancesDataKHR());
+    auto buildinfo = vk::AccelerationStructureBuildGeometryInfoKHR()
+                       .setType(vk::AccelerationStructureTypeKHR::eTopLevel)
+                       .setFlags(top_flags)
+                       .setMode(vk::BuildAccelerationStructureModeKHR::eBuild)
+                       .setGeometryCount(1)
+                       .setPGeometries(&instancegeometry);
+    vk::AccelerationStructureBuildSizesInfoKHR sizes;
+    m_build_sizes(static_cast<VkDevice>(m_device), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+                  reinterpret_cast<const VkAccelerationStructureBuildGeometryInfoKHR*>(&buildinfo),
+                  &m_max_instances,
+                  reinterpret_cast<VkAccelerationStructureBuildSizesInfoKHR*>(&sizes));
+    m_top_size     = sizes.accelerationStructureSize;
+    m_scratch_size = std::max({ sizes.buildScratchSize, sizes.updateScratchSize,
+                                bottom_scratch_budget });
+
+    m_frames.resize(frames);
+    for (frame_data& frame : m_frames) {
+        frame.top = createStorage(m_top_size, vk::AccelerationStructureTypeKHR::eTopLevel);
+
+        // Written by the host every frame, like the draw buffer's instances
+        frame.instances = m_device.createBuffer(
+          vk::BufferCreateInfo()
+            .setSize(sizeof(VkAccelerationStructureInstanceKHR) * m_max_instances)
+            .setUsage(vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR
+                      | vk::BufferUsageFlagBits::eShaderDeviceAddressKHR)
+            .setSharingMode(vk::SharingMode::eExclusive),
+          hostAllocator());
+        frame.instances_memory = m_allocator->allocate(
+          m_device.getBufferMemoryRequirements(frame.instances),
+          vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+          memory_allocator::resource_kind::linear, memory_category::other,
+          m_allocator->dynamicPreference());
+        m_device.bindBufferMemory(frame.instances, frame.instances_memory.memory,
+                                  frame.instances_memory.offset);
+        frame.instances_address = bufferAddress(frame.instances);
+
+        // Its address has to be aligned like the offsets into it
+        frame.scratch = m_device.createBuffer(
+          vk::BufferCreateInfo()
+            .setSize(m_scratch_size)
+            .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                      | vk::BufferUsageFlagBits::eShaderDeviceAddressKHR)
+            .setSharingMode(vk::SharingMode::eExclusive),
+          hostAllocator());
+        vk::MemoryRequirements requirements = m_device.getBufferMemoryRequirements(frame.scratch);
+        requirements.alignment = std::max(requirements.alignment, m_scratch_align);
+        frame.scratch_memory   = m_allocator->allocate(requirements,
+                                                       vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                                       memory_allocator::resource_kind::linear,
+                                                       memory_category::other);
+        m_device.bindBufferMemory(frame.scratch, frame.scratch_memory.memory,
+                                  frame.scratch_memory.offset);
+        frame.scratch_address = bufferAddress(frame.scratch);
+
+        frame.sizes = m_device.createQueryPool(
+          vk::QueryPoolCreateInfo()
+            .setQueryType(vk::QueryType::eAccelerationStructureCompactedSizeKHR)
+            .setQueryCount(max_bottom_builds),
+          hostAllocator());
+    }
+}
+
+void
+acceleration_structures::destroy()
+{
+    auto destroystorage = [this](structure_storage& storage) {
+        if (storage.structure) {
+            m_destroy(static_cast<VkDevice>(m_device), storage.structure, nullptr);
+            m_device.destroyBuffer(storage.buffer, hostAllocator());
+            m_allocator->free(storage.memory);
+        }
+        storage = structure_storage();
+    };
+
+    for (bottom_level& bottom : m_bottom) {
+        destroystorage(bottom.storage);
+    }
+    for (structure_storage& storage : m_forgotten) {
+        destroystorage(storage);
+    }
+    for (frame_data& frame : m_frames) {
+        destroystorage(frame.top);
+        m_device.destroyBuffer(frame.instances, hostAllocator());
+        m_allocator->free(frame.instances_memory);
+        m_device.destroyBuffer(frame.scratch, hostAllocator());
+        m_allocator->free(frame.scratch_memory);
+        m_device.destroyQueryPool(frame.sizes, hostAllocator());
+    }
+
+    m_bottom.clear();
+    m_free_bottom.clear();
+    m_lookup.clear();
+    m_unbuilt.clear();
+    m_forgotten.clear();
+    m_frames.clear();
+    m_instances.clear();
+    m_bottom_bytes = 0;
+}
+
+/*
+The frame's fence has signalled, so the sizes of what it built are there to read. A size that
+somehow isn't leaves its structure as it was built.
+*/
+void
+acceleration_structures::beginFrame(uint32_t frame)
+{
+    m_frame = frame;
+    m_instances.clear();
+
+    frame_data& data = m_frames[frame];
+    if (data.queried.empty()) {
+        return;
+    }
+
+    std::vector<uint64_t> sizes(data.queried.size());
+    const vk::Result      result = m_device.getQueryPoolResults(
+      data.sizes, 0, (uint32_t)sizes.size(), sizes.size() * sizeof(uint64_t), sizes.data(),
+      sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+
+    for (size_t i = 0; i < data.queried.size(); ++i) {
+        // Forgotten since
+        if (data.queried[i] == ~0u) {
+            continue;
+        }
+        bottom_level& bottom = m_bottom[data.queried[i]];
+        if (result == vk::Result::eSuccess && sizes[i] != 0 && sizes[i] < bottom.storage.size) {
+            bottom.compacted = sizes[i];
+            bottom.state     = bottom_state::compacting;
+        } else {
+            bottom.state = bottom_state::compacted;
+        }
+    }
+    data.queried.clear();
+}
+
+uint32_t
+acceleration_structures::geometry(const ray_geometry& geometry)
+{
+    const geometry_key wanted = key(geometry);
+    const auto         found  = m_lookup.find(wanted);
+    if (found != m_lookup.end()) {
+        return m_bottom[found->second].state == bottom_state::unbuilt ? ~0u : found->second;
+    }
+
+    uint32_t slot = (uint32_t)m_bottom.size();
+    if (!m_free_bottom.empty()) {
+        slot = m_free_bottom.back();
+        m_free_bottom.pop_back();
+    } else {
+        m_bottom.emplace_back();
+    }
+
+    bottom_level& bottom = m_bottom[slot];
+    bottom               = bottom_level();
+    bottom.geometry      = geometry;
+    bottom.used          = true;
+    m_lookup.emplace(wanted, slot);
+    m_unbuilt.push_back(slot);
+    return ~0u;
+}
+
+void
+acceleration_structures::push(uint32_t geometry, const glm::mat4& transform)
+{
+    if (m_instances.size() < m_max_instances) {
+        m_instances.push_back({ geometry, transform });
+    }
+}
+
+/*
+Whatever was forgotten is retired first, so that no slot is reused by geometry() before the frame
+that pushed instances of it has skipped them.
+*/
+void
+acceleration_structures::record(vk::CommandBuffer command_buffer,
+                                deletion_queue&   deletions,
+                                uint64_t          frame_number)
+{
+    for (structure_storage& storage : m_forgotten) {
+        m_bottom_bytes -= storage.size;
+        retire(storage, deletions, frame_number);
+    }
+    m_forgotten.clear();
+
+    frame_data& frame = m_frames[m_frame];
+    command_buffer.resetQueryPool(frame.sizes, 0, max_bottom_builds);
+
+    const size_t compactions = std::count_if(
+      m_bottom.begin(), m_bottom.end(),
+      [](const bottom_level& bottom) { return bottom.state == bottom_state::compacting; });
+    if (compactions > 0) {
+        recordCompaction(command_buffer, deletions, frame_number);
+    }
+    recordBottomBuilds(command_buffer);
+
+    // The top level reads the bottom levels, and the scratch memory is the bottom levels' builds'
+    // as well. The sizes can only be written once the builds are done.
+    if (compactions > 0 || !frame.queried.empty()) {
+        const auto built =
+          vk::MemoryBarrier()
+            .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+            .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR
+                              | vk::AccessFlagBits::eAccelerationStructureWriteKHR);
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                                       vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                                       {}, built, nullptr, nullptr);
+    }
+    if (!frame.queried.empty()) {
+        std::vector<VkAccelerationStructureKHR> structures;
+        for (uint32_t slot : frame.queried) {
+            structures.push_back(m_bottom[slot].storage.structure);
+        }
+        m_write_properties(static_cast<VkCommandBuffer>(command_buffer),
+                           (uint32_t)structures.size(), structures.data(),
+                           VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                           static_cast<VkQueryPool>(frame.sizes), 0);
+    }
+
+    recordTopBuild(command_buffer);
+
+    const auto visible = vk::MemoryBarrier()
+                           .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+                           .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                                   vk::PipelineStageFlagBits::eFragmentShader, {}, visible,
+                                   nullptr, nullptr);
+}
+
+void
+acceleration_structures::forget(vk::DeviceSize vertex_bytes)
+{
+    auto it = m_lookup.lower_bound(geometry_key(vertex_bytes, 0));
+    while (it != m_lookup.end() && it->first.first == vertex_bytes) {
+        const uint32_t slot   = it->second;
+        bottom_level&  bottom = m_bottom[slot];
+        if (bottom.storage.structure) {
+            m_forgotten.push_back(bottom.storage);
+        }
+        bottom = bottom_level();
+        m_free_bottom.push_back(slot);
+
+        // Whichever frame is to read its size back, the slot may be someone else's by then
+        m_unbuilt.erase(std::remove(m_unbuilt.begin(), m_unbuilt.end(), slot), m_unbuilt.end());
+        for (frame_data& frame : m_frames) {
+            std::replace(frame.queried.begin(), frame.queried.end(), slot, ~0u);
+        }
+        it = m_lookup.erase(it);
+    }
+}
+
+acceleration_structures::geometry_key
+acceleration_structures::key(const ray_geometry& geometry)
+{
+    const vk::DeviceSize vertexbytes = (vk::DeviceSize)geometry.vertex_offset
+                                       * geometry.vertex_stride;
+    return geometry_key(vertexbytes, ((uint64_t)geometry.first_index << 32) | geometry.index_count);
+}
+
+acceleration_structures::structure_storage
+acceleration_structures::createStorage(vk::DeviceSize size, vk::AccelerationStructureTypeKHR type)
+{
+    structure_storage storage;
+    storage.size   = size;
+    storage.buffer = m_device.createBuffer(
+      vk::BufferCreateInfo()
+        .setSize(size)
+        .setUsage(vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR
+                  | vk::BufferUsageFlagBits::eShaderDeviceAddressKHR)
+        .setSharingMode(vk::SharingMode::eExclusive),
+      hostAllocator());
+    storage.memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(storage.buffer),
+                                           vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                           memory_allocator::resource_kind::linear,
+                                           memory_category::other);
+    m_device.bindBufferMemory(storage.buffer, storage.memory.memory, storage.memory.offset);
+
+    auto createinfo = vk::AccelerationStructureCreateInfoKHR()
+                        .setBuffer(storage.buffer)
+                        .setSize(size)
+                        .setType(type);
+    m_create(static_cast<VkDevice>(m_device),
+             reinterpret_cast<const VkAccelerationStructureCreateInfoKHR*>(&createinfo), nullptr,
+             &storage.structure);
+
+    auto addressinfo = vk::AccelerationStructureDeviceAddressInfoKHR().setAccelerationStructure(
+      vk::AccelerationStructureKHR(storage.structure));
+    storage.address = m_address(
+      static_cast<VkDevice>(m_device),
+      reinterpret_cast<const VkAccelerationStructureDeviceAddressInfoKHR*>(&addressinfo));
+    return storage;
+}
+
+vk::DeviceAddress
+acceleration_structures::bufferAddress(vk::Buffer buffer) const
+{
+    auto addressinfo = vk::BufferDeviceAddressInfoKHR().setBuffer(buffer);
+    return m_buffer_address(static_cast<VkDevice>(m_device),
+                            reinterpret_cast<const VkBufferDeviceAddressInfo*>(&addressinfo));
+}
+
+void
+acceleration_structures::retire(structure_storage& storage,
+                                deletion_queue&    deletions,
+                                uint64_t           frame)
+{
+    const VkDevice                              device    = static_cast<VkDevice>(m_device);
+    const VkAccelerationStructureKHR            structure = storage.structure;
+    const PFN_vkDestroyAccelerationStructureKHR destroy   = m_destroy;
+    deletions.pushAction(frame, [device, structure, destroy]() {
+        destroy(device, structure, nullptr);
+    });
+    deletions.push(frame, storage.buffer);
+    deletions.push(frame, storage.memory);
+    storage = structure_storage();
+}
+
+/*
+Every structure whose compacted size came back is copied into one of that size, which the top level
+is built over from now on. The frames still tracing the old one finish before it is destroyed.
+*/
+void
+acceleration_structures::recordCompaction(vk::CommandBuffer command_buffer,
+                                          deletion_queue&   deletions,
+                                          uint64_t          frame_number)
+{
+    for (bottom_level& bottom : m_bottom) {
+        if (bottom.state != bottom_state::compacting) {
+            continue;
+        }
+
+        structure_storage compacted =
+          createStorage(bottom.compacted, vk::AccelerationStructureTypeKHR::eBottomLevel);
+        auto copy = vk::CopyAccelerationStructureInfoKHR()
+                      .setSrc(vk::AccelerationStructureKHR(bottom.storage.structure))
+                      .setDst(vk::AccelerationStructureKHR(compacted.structure))
+                      .setMode(vk::CopyAccelerationStructureModeKHR::eCompact);
+        m_copy(static_cast<VkCommandBuffer>(command_buffer),
+               reinterpret_cast<const VkCopyAccelerationStructureInfoKHR*>(&copy));
+
+        m_bottom_bytes += compacted.size;
+        m_bottom_bytes -= bottom.storage.size;
+        retire(bottom.storage, deletions, frame_number);
+        bottom.storage = compacted;
+        bottom.state   = bottom_state::compacted;
+    }
+}
+
+/*
+As many of the unbuilt bottom levels as fit in the frame's builds and scratch memory, all in one
+vkCmdBuildAccelerationStructuresKHR, each with a scratch range of its own. One that needs more
+scratch memory than there is never gets built, and its instances are never traced.
+*/
+void
+acceleration_structures::recordBottomBuilds(vk::CommandBuffer command_buffer)
+{
+    frame_data& frame = m_frames[m_frame];
+
+    // The build infos point at the geometries, so neither may reallocate
+    std::vector<vk::AccelerationStructureGeometryKHR>          geometries;
+    std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> infos;
+    std::vector<vk::AccelerationStructureBuildRangeInfoKHR>    ranges;
+    geometries.reserve(max_bottom_builds);
+    infos.reserve(max_bottom_builds);
+    ranges.reserve(max_bottom_builds);
+
+    vk::DeviceSize scratch = 0;
+    size_t         taken   = 0;
+    for (; taken < m_unbuilt.size() && infos.size() < max_bottom_builds; ++taken) {
+        bottom_level&       bottom = m_bottom[m_unbuilt[taken]];
+        const ray_geometry& g      = bottom.geometry;
+
+        auto triangles =
+          vk::AccelerationStructureGeometryTrianglesDataKHR()
+            .setVertexFormat(g.vertex_format)
+            .setVertexData(m_positions + (vk::DeviceSize)g.vertex_offset * g.vertex_stride)
+            .setVertexStride(g.vertex_stride)
+            .setMaxVertex(g.vertex_count - 1)
+            .setIndexType(g.index_type)
+            .setIndexData(m_indices + g.first_index * indexSize(g.index_type));
+        geometries.push_back(vk::AccelerationStructureGeometryKHR()
+                               .setGeometryType(vk::GeometryTypeKHR::eTriangles)
+                               .setGeometry(triangles)
+                               .setFlags(vk::GeometryFlagBitsKHR::eOpaque));
+
+        auto info = vk::AccelerationStructureBuildGeometryInfoKHR()
+                      .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
+                      .setFlags(bottom_flags)
+                      .setMode(vk::BuildAccelerationStructureModeKHR::eBuild)
+                      .setGeometryCount(1)
+                      .setPGeometries(&geometries.back());
+
+        const uint32_t                             trianglecount = g.index_count / 3;
+        vk::AccelerationStructureBuildSizesInfoKHR sizes;
+        m_build_sizes(static_cast<VkDevice>(m_device),
+                      VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+                      reinterpret_cast<const VkAccelerationStructureBuildGeometryInfoKHR*>(&info),
+                      &trianglecount,
+                      reinterpret_cast<VkAccelerationStructureBuildSizesInfoKHR*>(&sizes));
+
+        const vk::DeviceSize offset = alignUp(scratch, m_scratch_align);
+        if (sizes.buildScratchSize > m_scratch_size) {
+            core::logWarning() << "A mesh of " << trianglecount
+                               << " triangles is too large for an acceleration structure";
+            geometries.pop_back();
+            continue;
+        }
+        if (offset + sizes.buildScratchSize > m_scratch_size) {
+            geometries.pop_back();
+            break;
+        }
+        scratch = offset + sizes.buildScratchSize;
+
+        bottom.storage =
+          createStorage(sizes.accelerationStructureSize,
+                        vk::AccelerationStructureTypeKHR::eBottomLevel);
+        bottom.state = bottom_state::built;
+        m_bottom_bytes += bottom.storage.size;
+
+        info.setDstAccelerationStructure(vk::AccelerationStructureKHR(bottom.storage.structure))
+          .setScratchData(frame.scratch_address + offset);
+        infos.push_back(info);
+        ranges.push_back(vk::AccelerationStructureBuildRangeInfoKHR().setPrimitiveCount(
+          trianglecount));
+        frame.queried.push_back(m_unbuilt[taken]);
+    }
+    m_unbuilt.erase(m_unbuilt.begin(), m_unbuilt.begin() + (ptrdiff_t)taken);
+
+    if (infos.empty()) {
+        return;
+    }
+
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangepointers;
+    for (const vk::AccelerationStructureBuildRangeInfoKHR& range : ranges) {
+        rangepointers.push_back(reinterpret_cast<const VkAccelerationStructureBuildRangeInfoKHR*>(
+          &range));
+    }
+    m_build(static_cast<VkCommandBuffer>(command_buffer), (uint32_t)infos.size(),
+            reinterpret_cast<const VkAccelerationStructureBuildGeometryInfoKHR*>(infos.data()),
+            rangepointers.data());
+}
+
+/*
+The instances go straight into the frame's mapped buffer, their transforms as the rows of a 3x4
+matrix where glm's are columns. Triangles are traced from either side, the shadows of a mesh's
+back faces are as much its shadows as its front faces'.
+*/
+void
+acceleration_structures::recordTopBuild(vk::CommandBuffer command_buffer)
+{
+    frame_data& frame = m_frames[m_frame];
+    auto* const out =
+      static_cast<VkAccelerationStructureInstanceKHR*>(frame.instances_memory.mapped);
+
+    std::vector<vk::DeviceAddress> over;
+    over.reserve(m_instances.size());
+    for (const instance& in : m_instances) {
+        const bottom_level& bottom = m_bottom[in.geometry];
+        if (!bottom.used || !bottom.storage.structure) {
+            continue;
+        }
+
+        VkAccelerationStructureInstanceKHR& written = out[over.size()];
+        for (uint32_t row = 0; row < 3; ++row) {
+            for (uint32_t column = 0; column < 4; ++column) {
+                written.transform.matrix[row][column] = in.transform[column][row];
+            }
+        }
+        written.instanceCustomIndex                    = 0;
+        written.mask                                   = 0xff;
+        written.instanceShaderBindingTableRecordOffset = 0;
+        written.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+        written.accelerationStructureReference = bottom.storage.address;
+        over.push_back(bottom.storage.address);
+    }
+
+    const bool refit = frame.built && over == frame.built_over && frame.refits < max_top_refits;
+    frame.refits     = refit ? frame.refits + 1 : 0;
+    frame.built      = true;
+    frame.built_over.swap(over);
+    m_recorded = (uint32_t)frame.built_over.size();
+
+    auto instancegeometry =
+      vk::AccelerationStructureGeometryKHR()
+        .setGeometryType(vk::GeometryTypeKHR::eInstances)
+        .setGeometry(vk::AccelerationStructureGeometryInstancesDataKHR().setData(
+          frame.instances_address))
+        .setFlags(vk::GeometryFlagBitsKHR::eOpaque);
+    const vk::AccelerationStructureKHR top(frame.top.structure);
+    auto info = vk::AccelerationStructureBuildGeometryInfoKHR()
+                  .setType(vk::AccelerationStructureTypeKHR::eTopLevel)
+                  .setFlags(top_flags)
+                  .setMode(refit ? vk::BuildAccelerationStructureModeKHR::eUpdate
+                                 : vk::BuildAccelerationStructureModeKHR::eBuild)
+                  .setSrcAccelerationStructure(refit ? top : vk::AccelerationStructureKHR())
+                  .setDstAccelerationStructure(top)
+                  .setGeometryCount(1)
+                  .setPGeometries(&instancegeometry)
+                  .setScratchData(frame.scratch_address);
+
+    VkAccelerationStructureBuildRangeInfoKHR        range  = {};
+    range.primitiveCount                                   = m_recorded;
+    const VkAccelerationStructureBuildRangeInfoKHR* ranges = &range;
+    m_build(static_cast<VkCommandBuffer>(command_buffer), 1,
+            reinterpret_cast<const VkAccelerationStructureBuildGeometryInfoKHR*>(&info), &ranges);
+}
+
+#else
+
+bool
+acceleration_structures::buildsFrom(vk::PhysicalDevice, vk::Format)
+{
+    return false;
+}
+
+// Without the headers knowing the extension, the renderer never turns ray queries on
+void
+acceleration_structures::init(vk::PhysicalDevice,
+                              vk::Device,
+                              memory_allocator&,
+                              vk::Buffer,
+                              vk::Buffer,
+                              uint32_t,
+                              uint32_t)
+{}
+
+void
+acceleration_structures::destroy()
+{}
+
+void
+acceleration_structures::beginFrame(uint32_t)
+{}
+
+uint32_t
+acceleration_structures::geometry(const ray_geometry&)
+{
+    return ~0u;
+}
+
+void
+acceleration_structures::push(uint32_t, const glm::mat4&)
+{}
+
+void
+acceleration_structures::record(vk::CommandBuffer, deletion_queue&, uint64_t)
+{}
+
+void
+acceleration_structures::forget(vk::DeviceSize)
+{}
+
+#endif
+
+}  // namespace shiny::graphics
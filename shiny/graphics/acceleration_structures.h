@@ -0,0 +1,199 @@
+#pragma once
+
+#include "graphics/deletion_queue.h"
+#include "graphics/memory_allocator.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Triangles of one mesh in the geometry pool, by where a draw of them starts, in the mesh's own
+vertices and indices, see geometry_range. A bottom level structure is built over each different one.
+*/
+struct ray_geometry
+{
+    int32_t        vertex_offset = 0;
+    uint32_t       vertex_count  = 0;  // of the mesh, which its indices stay below
+    uint32_t       first_index   = 0;
+    uint32_t       index_count   = 0;
+    vk::IndexType  index_type    = vk::IndexType::eUint32;
+    vk::Format     vertex_format = vk::Format::eR32G32B32Sfloat;
+    vk::DeviceSize vertex_stride = 12;
+};
+
+/*
+The scene as acceleration structures for hardware ray queries, built from the geometry pool's
+positions and indices through their device addresses, so no geometry is copied for them.
+
+Every mesh's triangles get a bottom level structure of their own the first time an instance of them
+is pushed, built with compaction allowed, and a few of them a frame so that a scene coming in at
+once doesn't stall a frame. Once the frame that built one comes around again its compacted size has
+been read back, and it is copied into a structure of that size, which is usually half as large or
+less. Instances of geometry whose structure isn't built yet are left out of the frame.
+
+Every frame in flight has a top level structure of its own, holding the frame's instances, so a
+frame's descriptor always points at the same one. It is refit in place when the frame pushed the
+same geometry in the same order as the last time it was built, which keeps moving instances cheap,
+and rebuilt otherwise, and after a few refits, which make it slower to trace. Top levels can't be
+compacted and refit both, so only the bottom levels are.
+
+beginFrame() and record() may only be called for a frame once its fence has signalled. record()
+ends in a barrier that makes the top level visible to the fragment shaders' ray queries.
+*/
+class acceleration_structures
+{
+public:
+    // Whether the structures can be built from vertices of `format`
+    static bool buildsFrom(vk::PhysicalDevice physical_device, vk::Format format);
+
+    // `positions` and `indices` have to have been created with build input and device address
+    // usage, see geometry_pool::init
+    void init(vk::PhysicalDevice physical_device,
+              vk::Device         device,
+              memory_allocator&  allocator,
+              vk::Buffer         positions,
+              vk::Buffer         indices,
+              uint32_t           frames,
+              uint32_t           max_instances);
+
+    // Destroys everything right away, only safe once the device is idle
+    void destroy();
+
+    // Reads back the sizes of the bottom levels the frame built the last time around, and starts
+    // its instances over
+    void beginFrame(uint32_t frame);
+
+    // The bottom level of the geometry, or ~0u if there isn't one to trace yet, for push()
+    uint32_t geometry(const ray_geometry& geometry);
+
+    // An instance of a geometry() in the frame, with its model to world transform. Those past the
+    // capacity given to init() are left out.
+    void push(uint32_t geometry, const glm::mat4& transform);
+
+    // Compacts, builds and then the top level, retiring whatever is replaced with `frame_number`
+    void record(vk::CommandBuffer command_buffer, deletion_queue& deletions, uint64_t frame_number);
+
+    // Drops the bottom levels over the vertices starting `vertex_bytes` into the position buffer,
+    // which are about to be reused by another mesh
+    void forget(vk::DeviceSize vertex_bytes);
+
+#if defined(VK_KHR_acceleration_structure)
+    VkAccelerationStructureKHR topLevel(uint32_t frame) const { return m_frames[frame].top; }
+#endif
+
+    // Of the last recorded frame
+    uint32_t instances() const { return m_recorded; }
+
+    // The bytes the bottom levels take up, compacted or not
+    vk::DeviceSize bottomSize() const { return m_bottom_bytes; }
+
+private:
+    // A buffer with a structure at its start
+    struct structure_storage
+    {
+        vk::Buffer buffer;
+        allocation memory;
+#if defined(VK_KHR_acceleration_structure)
+        VkAccelerationStructureKHR structure = VK_NULL_HANDLE;
+#endif
+        vk::DeviceAddress address = 0;  // the structure's
+        vk::DeviceSize    size    = 0;
+    };
+
+    enum class bottom_state : uint8_t
+    {
+        unbuilt,
+        built,       // its compacted size is queried by the frame that built it
+        compacting,  // the compacted size has been read back
+        compacted,
+    };
+
+    struct bottom_level
+    {
+        ray_geometry      geometry;
+        structure_storage storage;
+        bottom_state      state     = bottom_state::unbuilt;
+        vk::DeviceSize    compacted = 0;
+        bool              used      = false;  // as opposed to a free slot
+    };
+
+    struct instance
+    {
+        uint32_t  geometry = 0;
+        glm::mat4 transform;
+    };
+
+    struct frame_data
+    {
+        structure_storage top;
+        vk::Buffer        instances;  // host visible, of max_instances
+        allocation        instances_memory;
+        vk::DeviceAddress instances_address = 0;
+        vk::Buffer        scratch;
+        allocation        scratch_memory;
+        vk::DeviceAddress scratch_address = 0;
+        vk::QueryPool     sizes;  // the compacted sizes of the bottom levels built with the frame
+
+        std::vector<uint32_t>          queried;     // which bottom levels, by query
+        std::vector<vk::DeviceAddress> built_over;  // the bottom levels of the last build
+        uint32_t                       refits = 0;  // since
+        bool                           built  = false;
+    };
+
+    using geometry_key = std::pair<vk::DeviceSize, uint64_t>;
+
+    static geometry_key key(const ray_geometry& geometry);
+
+#if defined(VK_KHR_acceleration_structure)
+    structure_storage createStorage(vk::DeviceSize size, vk::AccelerationStructureTypeKHR type);
+#endif
+    vk::DeviceAddress bufferAddress(vk::Buffer buffer) const;
+    void              retire(structure_storage& storage, deletion_queue& deletions, uint64_t frame);
+
+    void recordCompaction(vk::CommandBuffer command_buffer,
+                          deletion_queue&   deletions,
+                          uint64_t          frame_number);
+    void recordBottomBuilds(vk::CommandBuffer command_buffer);
+    void recordTopBuild(vk::CommandBuffer command_buffer);
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::DeviceAddress m_positions     = 0;
+    vk::DeviceAddress m_indices       = 0;
+    uint32_t          m_max_instances = 0;
+    vk::DeviceSize    m_scratch_size  = 0;
+    vk::DeviceSize    m_scratch_align = 0;
+    vk::DeviceSize    m_top_size      = 0;
+
+    std::vector<bottom_level>        m_bottom;
+    std::vector<uint32_t>            m_free_bottom;
+    std::map<geometry_key, uint32_t> m_lookup;
+    std::vector<uint32_t>            m_unbuilt;
+    std::vector<structure_storage>   m_forgotten;  // retired with the next record()
+    vk::DeviceSize                   m_bottom_bytes = 0;
+
+    std::vector<frame_data> m_frames;
+    std::vector<instance>   m_instances;
+    uint32_t                m_frame    = 0;
+    uint32_t                m_recorded = 0;
+
+#if defined(VK_KHR_acceleration_structure)
+    PFN_vkCreateAccelerationStructureKHR              m_create           = nullptr;
+    PFN_vkDestroyAccelerationStructureKHR             m_destroy          = nullptr;
+    PFN_vkGetAccelerationStructureBuildSizesKHR       m_build_sizes      = nullptr;
+    PFN_vkGetAccelerationStructureDeviceAddressKHR    m_address          = nullptr;
+    PFN_vkCmdBuildAccelerationStructuresKHR           m_build            = nullptr;
+    PFN_vkCmdCopyAccelerationStructureKHR             m_copy             = nullptr;
+    PFN_vkCmdWriteAccelerationStructuresPropertiesKHR m_write_properties = nullptr;
+    PFN_vkGetBufferDeviceAddressKHR                   m_buffer_address   = nullptr;
+#endif
+};
+
+}  // namespace shiny::graphics
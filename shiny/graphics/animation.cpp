@@ -0,0 +1,406 @@
+#include "graphics/animation.h"
+
+#include "core/transform_math.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+using shiny::graphics::animation_clip;
+using shiny::graphics::clip_track;
+using shiny::graphics::compressed_clip;
+using shiny::graphics::joint_pose;
+
+enum channel : uint32_t
+{
+    rotation_channel,
+    translation_channel,
+    scale_channel,
+    channel_count,
+};
+
+uint32_t
+components(uint32_t channel)
+{
+    return channel == rotation_channel ? 4 : 3;
+}
+
+/*
+A channel of a joint at every frame, and at the first again once more at the end. Rotations are
+kept on the same side as the frame before them, so that interpolating between any two of them goes
+the shorter way.
+*/
+std::vector<glm::vec4>
+channelValues(const animation_clip& clip, uint32_t joints, uint32_t joint, uint32_t channel)
+{
+    std::vector<glm::vec4> values;
+    values.reserve(clip.frame_count + 1);
+    for (uint32_t frame = 0; frame <= clip.frame_count; ++frame) {
+        const joint_pose& pose = clip.poses[(frame % clip.frame_count) * joints + joint];
+
+        glm::vec4 value;
+        if (channel == rotation_channel) {
+            const glm::quat rotation = glm::normalize(pose.rotation);
+            value = glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w);
+            if (!values.empty() && glm::dot(value, values.back()) < 0.f) {
+                value = -value;
+            }
+        } else {
+            value = glm::vec4(channel == translation_channel ? pose.translation : pose.scale, 0.f);
+        }
+        values.push_back(value);
+    }
+    return values;
+}
+
+glm::vec4
+interpolate(uint32_t channel, const glm::vec4& a, const glm::vec4& b, float weight)
+{
+    const glm::vec4 value = glm::mix(a, b, weight);
+    return channel == rotation_channel ? glm::normalize(value) : value;
+}
+
+bool
+within(const glm::vec4& a, const glm::vec4& b, float tolerance)
+{
+    const glm::vec4 difference = glm::abs(a - b);
+    return std::max(std::max(difference.x, difference.y), std::max(difference.z, difference.w))
+           <= tolerance;
+}
+
+/*
+The frames whose values are kept, greedily: every key reaches as far ahead as interpolating to it
+stays within `tolerance` of every frame it passes over, and the frame it fails at starts the next
+one. One key for a channel that stays within tolerance of its first frame throughout.
+*/
+std::vector<uint32_t>
+fitKeys(uint32_t channel, const std::vector<glm::vec4>& values, float tolerance)
+{
+    const uint32_t last = (uint32_t)values.size() - 1;
+
+    bool still = true;
+    for (uint32_t frame = 1; frame <= last && still; ++frame) {
+        still = within(values[frame], values[0], tolerance);
+    }
+    if (still) {
+        return { 0 };
+    }
+
+    std::vector<uint32_t> keys  = { 0 };
+    uint32_t              start = 0;
+    for (uint32_t end = start + 2; end <= last; ++end) {
+        bool fits = true;
+        for (uint32_t frame = start + 1; frame < end && fits; ++frame) {
+            const float weight = (float)(frame - start) / (float)(end - start);
+            fits = within(interpolate(channel, values[start], values[end], weight), values[frame],
+                        tolerance);
+        }
+        if (!fits) {
+            start = end - 1;
+            keys.push_back(start);
+        }
+    }
+    keys.push_back(last);
+    return keys;
+}
+
+uint16_t
+quantizeSigned(float value)
+{
+    return (uint16_t)(int16_t)std::lround(std::clamp(value, -1.f, 1.f) * 32767.f);
+}
+
+uint16_t
+quantizeRange(float value, float minimum, float extent)
+{
+    return extent > 0.f ? (uint16_t)std::lround(std::clamp((value - minimum) / extent, 0.f, 1.f)
+                                                * 65535.f)
+                        : 0;
+}
+
+glm::quat
+decodeRotation(const compressed_clip& clip, const clip_track& track, uint32_t key)
+{
+    const uint16_t* v = &clip.values[track.first_value + 4 * key];
+    return glm::quat((float)(int16_t)v[3] / 32767.f, (float)(int16_t)v[0] / 32767.f,
+                     (float)(int16_t)v[1] / 32767.f, (float)(int16_t)v[2] / 32767.f);
+}
+
+glm::vec3
+decodeVector(const compressed_clip& clip, const clip_track& track, uint32_t key)
+{
+    const uint16_t* v = &clip.values[track.first_value + 3 * key];
+    return track.minimum + glm::vec3(v[0], v[1], v[2]) / 65535.f * track.extent;
+}
+
+// The keys of `track` around `position`, in frames, by their place in the track, and how far it is
+// from the first to the second
+void
+keysAround(const compressed_clip& clip,
+           const clip_track&      track,
+           float                  position,
+           uint32_t&              first,
+           uint32_t&              second,
+           float&                 weight)
+{
+    if (track.key_count == 1) {
+        first  = 0;
+        second = 0;
+        weight = 0.f;
+        return;
+    }
+
+    // The keys start at frame 0 and end at frame_count, which position stays below
+    const uint16_t* begin = clip.frames.data() + track.first_key;
+    const uint16_t* end   = begin + track.key_count;
+    const uint16_t* after =
+      std::upper_bound(begin + 1, end - 1, position,
+                       [](float position, uint16_t frame) { return position < (float)frame; });
+
+    first  = (uint32_t)(after - begin) - 1;
+    second = first + 1;
+    weight = (position - (float)after[-1]) / (float)(after[0] - after[-1]);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+size_t
+compressed_clip::bytes() const
+{
+    return sizeof(*this) + tracks.size() * sizeof(clip_track) + frames.size() * sizeof(uint16_t)
+           + values.size() * sizeof(uint16_t);
+}
+
+compressed_clip
+compressClip(const animation_clip& clip, uint32_t joints, const clip_tolerance& tolerance)
+{
+    if (clip.frame_count == 0 || clip.poses.size() < (size_t)clip.frame_count * joints) {
+        throw std::runtime_error("Animation clip doesn't fit the skeleton!");
+    }
+    if (clip.frame_count > 0xffff) {
+        throw std::runtime_error("Animation clip has too many frames to compress!");
+    }
+
+    compressed_clip compressed;
+    compressed.duration    = clip.duration;
+    compressed.frame_count = clip.frame_count;
+    compressed.joints      = joints;
+
+    const float tolerances[channel_count] = { tolerance.rotation, tolerance.translation,
+                                              tolerance.scale };
+
+    for (uint32_t joint = 0; joint < joints; ++joint) {
+        for (uint32_t channel = 0; channel < channel_count; ++channel) {
+            const std::vector<glm::vec4> values = channelValues(clip, joints, joint, channel);
+            const std::vector<uint32_t>  keys   = fitKeys(channel, values, tolerances[channel]);
+            const uint32_t               size   = components(channel);
+
+            clip_track track;
+            track.first_key   = (uint32_t)compressed.frames.size();
+            track.first_value = (uint32_t)compressed.values.size();
+            track.key_count   = (uint32_t)keys.size();
+            if (channel != rotation_channel) {
+                glm::vec3 maximum = glm::vec3(values[keys[0]]);
+                track.minimum     = maximum;
+                for (uint32_t key : keys) {
+                    track.minimum = glm::min(track.minimum, glm::vec3(values[key]));
+                    maximum       = glm::max(maximum, glm::vec3(values[key]));
+                }
+                track.extent = maximum - track.minimum;
+            }
+
+            for (uint32_t key : keys) {
+                compressed.frames.push_back((uint16_t)key);
+                for (uint32_t c = 0; c < size; ++c) {
+                    compressed.values.push_back(
+                      channel == rotation_channel
+                        ? quantizeSigned(values[key][c])
+                        : quantizeRange(values[key][c], track.minimum[c], track.extent[c]));
+                }
+            }
+            compressed.tracks.push_back(track);
+        }
+    }
+    return compressed;
+}
+
+void
+skeleton_pose::resize(uint32_t joints)
+{
+    translations.resize(joints, glm::vec3(0.f));
+    rotations.resize(joints, glm::quat(1.f, 0.f, 0.f, 0.f));
+    scales.resize(joints, glm::vec3(1.f));
+}
+
+/*
+Every track's two keys around the time are decoded, the rotations into arrays that they are then
+blended over in one go, four or more joints at a time, and the translations and scales straight
+into the pose
+*/
+void
+sampleClip(const compressed_clip& clip, float time, skeleton_pose& pose)
+{
+    // Looped, negative times included
+    float looped = std::fmod(time, clip.duration);
+    if (looped < 0.f) {
+        looped += clip.duration;
+    }
+    const float position =
+      std::min(looped / clip.duration * (float)clip.frame_count, (float)clip.frame_count - 1e-3f);
+
+    thread_local std::vector<glm::quat> from;
+    thread_local std::vector<glm::quat> to;
+    thread_local std::vector<float>     weights;
+    from.resize(clip.joints);
+    to.resize(clip.joints);
+    weights.resize(clip.joints);
+
+    uint32_t first  = 0;
+    uint32_t second = 0;
+    float    weight = 0.f;
+    for (uint32_t j = 0; j < clip.joints; ++j) {
+        const clip_track* tracks = &clip.tracks[channel_count * j];
+
+        keysAround(clip, tracks[rotation_channel], position, first, second, weights[j]);
+        from[j] = decodeRotation(clip, tracks[rotation_channel], first);
+        to[j]   = decodeRotation(clip, tracks[rotation_channel], second);
+
+        keysAround(clip, tracks[translation_channel], position, first, second, weight);
+        pose.translations[j] =
+          glm::mix(decodeVector(clip, tracks[translation_channel], first),
+                   decodeVector(clip, tracks[translation_channel], second), weight);
+
+        keysAround(clip, tracks[scale_channel], position, first, second, weight);
+        pose.scales[j] = glm::mix(decodeVector(clip, tracks[scale_channel], first),
+                                  decodeVector(clip, tracks[scale_channel], second), weight);
+    }
+
+    core::blendRotations(from.data(), to.data(), weights.data(), pose.rotations.data(),
+                         clip.joints);
+}
+
+void
+blendPoses(const skeleton_pose& from, const skeleton_pose& to, float weight, skeleton_pose& out)
+{
+    const uint32_t joints = from.size();
+
+    thread_local std::vector<float> weights;
+    weights.assign(joints, weight);
+
+    for (uint32_t j = 0; j < joints; ++j) {
+        out.translations[j] = glm::mix(from.translations[j], to.translations[j], weight);
+        out.scales[j]       = glm::mix(from.scales[j], to.scales[j], weight);
+    }
+    core::blendRotations(from.rotations.data(), to.rotations.data(), weights.data(),
+                         out.rotations.data(), joints);
+}
+
+// The local transforms are composed in one go too, and only then resolved front to back
+void
+writePalette(const skeleton& skeleton, const skeleton_pose& pose, glm::mat4* palette)
+{
+    const uint32_t joints = skeleton.size();
+
+    thread_local std::vector<glm::mat4> globals;
+    globals.resize(joints);
+    core::composeTransforms(pose.translations.data(), pose.rotations.data(), pose.scales.data(),
+                            globals.data(), joints);
+
+    for (uint32_t j = 0; j < joints; ++j) {
+        const uint32_t parent = skeleton.parents[j];
+        if (parent < j) {
+            globals[j] = globals[parent] * globals[j];
+        }
+        palette[j] = globals[j] * skeleton.inverse_bind[j];
+    }
+}
+
+void
+animator::init(const skeleton& skeleton, const animation_lods& lods)
+{
+    m_skeleton = &skeleton;
+    m_lods     = lods;
+    m_clips.clear();
+    m_characters.clear();
+    m_due.clear();
+}
+
+uint32_t
+animator::addClip(compressed_clip clip)
+{
+    if (clip.joints != m_skeleton->size()) {
+        throw std::runtime_error("Animation clip doesn't fit the skeleton!");
+    }
+    m_clips.push_back(std::move(clip));
+    return (uint32_t)m_clips.size() - 1;
+}
+
+uint32_t
+animator::add(const animated_character& character)
+{
+    character_state state;
+    state.settings = character;
+    m_characters.push_back(state);
+    return (uint32_t)m_characters.size() - 1;
+}
+
+// Staggered by index, so that every frame animates about as many of those further away
+const std::vector<uint32_t>&
+animator::schedule(uint64_t frame, const glm::vec3& eye)
+{
+    m_due.clear();
+    for (uint32_t i = 0; i < (uint32_t)m_characters.size(); ++i) {
+        character_state& character = m_characters[i];
+
+        const float    distance = glm::distance(character.settings.position, eye);
+        const uint32_t interval = distance > m_lods.distances[1]   ? 4
+                                  : distance > m_lods.distances[0] ? 2
+                                                                   : 1;
+        if (!character.animated || (frame + i) % interval == 0) {
+            m_due.push_back(i);
+            character.animated = true;
+        }
+    }
+    return m_due;
+}
+
+void
+animator::sample(jobs::scheduler& jobs, float time, glm::mat4* palettes)
+{
+    const uint32_t joints = m_skeleton->size();
+    jobs.parallelFor(0, (uint32_t)m_due.size(), animation_batch, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            sampleCharacter(m_characters[m_due[i]].settings, time, palettes + i * joints);
+        }
+    });
+}
+
+// The blended clip is sampled as far into its own duration as the first is into its
+void
+animator::sampleCharacter(const animated_character& character,
+                          float                     time,
+                          glm::mat4*                palette) const
+{
+    thread_local skeleton_pose pose;
+    thread_local skeleton_pose blended;
+
+    const uint32_t         joints  = m_skeleton->size();
+    const compressed_clip& clip    = m_clips[character.clip];
+    const float            seconds = character.offset + time * character.speed;
+
+    pose.resize(joints);
+    sampleClip(clip, seconds, pose);
+    if (character.weight > 0.f) {
+        const compressed_clip& other = m_clips[character.blend];
+        blended.resize(joints);
+        sampleClip(other, seconds / clip.duration * other.duration, blended);
+        blendPoses(pose, blended, character.weight, pose);
+    }
+    writePalette(*m_skeleton, pose, palette);
+}
+
+}  // namespace shiny::graphics
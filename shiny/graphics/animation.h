@@ -0,0 +1,158 @@
+#pragma once
+
+#include "graphics/gpu_skinning.h"
+#include "jobs/scheduler.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+// How far a keyframe may be from the line between its neighbours and still be left out of a
+// compressed_clip, in each of a channel's components
+struct clip_tolerance
+{
+    float rotation    = 0.0005f;  // about a twentieth of a degree
+    float translation = 0.0001f;  // in the skeleton's units
+    float scale       = 0.0001f;
+};
+
+// The keys of one channel of one joint, a range of compressed_clip's arrays
+struct clip_track
+{
+    uint32_t  first_key   = 0;  // into frames
+    uint32_t  first_value = 0;  // into values, 4 components a rotation key, 3 otherwise
+    uint32_t  key_count   = 0;  // 1 for a channel that doesn't move
+    glm::vec3 minimum     = glm::vec3(0.f);  // what translations and scales are quantized over
+    glm::vec3 extent      = glm::vec3(0.f);
+};
+
+/*
+An animation_clip with the keyframes that linear interpolation between the others recovers left
+out, channel by channel, and the rest quantized to 16 bits a component: rotations over -1 to 1,
+translations and scales over the range their track covers. A channel that doesn't move at all
+keeps a single key, which is most of the scales and many translations, and the rest usually only
+keep a key where they turn. Every moving track also keeps the first frame, and the first again at
+frame_count, for looping back to.
+*/
+struct compressed_clip
+{
+    float    duration    = 1.f;  // in seconds
+    uint32_t frame_count = 0;
+    uint32_t joints      = 0;
+
+    // Rotation, translation and scale of the first joint, then those of the next one
+    std::vector<clip_track> tracks;
+    std::vector<uint16_t>   frames;  // of every track's keys, in order
+    std::vector<uint16_t>   values;
+
+    size_t bytes() const;
+};
+
+compressed_clip compressClip(const animation_clip& clip,
+                             uint32_t              joints,
+                             const clip_tolerance& tolerance = clip_tolerance());
+
+/*
+A skeleton's joints relative to their parents, component by component rather than a joint_pose
+each, so that blending and composing run over arrays of the same kind.
+*/
+struct skeleton_pose
+{
+    std::vector<glm::vec3> translations;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+
+    void     resize(uint32_t joints);
+    uint32_t size() const { return (uint32_t)rotations.size(); }
+};
+
+// The pose `clip` is in at `time`, looped. `pose` has to be of the clip's joints.
+void sampleClip(const compressed_clip& clip, float time, skeleton_pose& pose);
+
+// `out` = from blended into to by `weight`, where out may be either
+void blendPoses(const skeleton_pose& from,
+                const skeleton_pose& to,
+                float                weight,
+                skeleton_pose&       out);
+
+// The skinning matrices of `pose`, a joint each. Only ever writes to `palette`, which may be
+// write-combined memory.
+void writePalette(const skeleton& skeleton, const skeleton_pose& pose, glm::mat4* palette);
+
+// One character for an animator to play
+struct animated_character
+{
+    uint32_t  clip     = 0;  // from animator::addClip
+    uint32_t  blend    = 0;  // another clip, phase matched to the first, for a weight above 0
+    float     weight   = 0.f;
+    float     offset   = 0.f;  // in seconds into the clip at time 0
+    float     speed    = 1.f;
+    glm::vec3 position = glm::vec3(0.f);  // in world space, for its level of detail
+};
+
+// Characters an animator's job samples
+const uint32_t animation_batch = 8;
+
+// How often characters further away are animated: every frame, every second frame, every fourth
+struct animation_lods
+{
+    std::array<float, 2> distances = { 8.f, 20.f };
+};
+
+/*
+Plays looping compressed clips on characters of one skeleton, and samples their poses into
+gpu_skinning's palettes on the job scheduler, a batch of characters per job. Every job samples
+its characters' clips, blends them where they have two, and resolves the palettes, into scratch
+poses of its own thread, so nothing is shared between them but the clips.
+
+Characters further from the camera than the lods' distances are only animated every second or
+fourth frame, in turns, so that as many of them are animated every frame. A character that isn't
+due keeps its last palette's skinned vertices, since gpu_skinning writes those to a range of its
+own, so it needs neither a palette nor a skinning job that frame. Characters are always animated
+the first time.
+*/
+class animator
+{
+public:
+    void init(const skeleton& skeleton, const animation_lods& lods = animation_lods());
+
+    uint32_t addClip(compressed_clip clip);
+    uint32_t add(const animated_character& character);
+
+    animated_character&       character(uint32_t index) { return m_characters[index].settings; }
+    const animated_character& character(uint32_t index) const
+    {
+        return m_characters[index].settings;
+    }
+    uint32_t characters() const { return (uint32_t)m_characters.size(); }
+
+    // Picks the characters due in `frame` for a camera at `eye`, in the order sample() writes
+    // their palettes in
+    const std::vector<uint32_t>& schedule(uint64_t frame, const glm::vec3& eye);
+
+    // The scheduled characters' palettes at `time`, skeleton::size() matrices each, one after the
+    // other, which are only ever written to
+    void sample(jobs::scheduler& jobs, float time, glm::mat4* palettes);
+
+private:
+    struct character_state
+    {
+        animated_character settings;
+        bool               animated = false;  // at least once
+    };
+
+    void sampleCharacter(const animated_character& character, float time, glm::mat4* palette) const;
+
+    const skeleton*              m_skeleton = nullptr;
+    animation_lods               m_lods;
+    std::vector<compressed_clip> m_clips;
+    std::vector<character_state> m_characters;
+    std::vector<uint32_t>        m_due;
+};
+
+}  // namespace shiny::graphics
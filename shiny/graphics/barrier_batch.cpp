@@ -0,0 +1,147 @@
+#include "graphics/barrier_batch.h"
+
+#include <stdexcept>
+
+namespace shiny::graphics {
+
+access_scope
+layoutScope(vk::ImageLayout layout, vk::PipelineStageFlags shader_stages)
+{
+    using stage  = vk::PipelineStageFlagBits;
+    using access = vk::AccessFlagBits;
+
+    const vk::PipelineStageFlags depthtests =
+      stage::eEarlyFragmentTests | stage::eLateFragmentTests;
+
+    switch (layout) {
+    case vk::ImageLayout::eUndefined:
+    case vk::ImageLayout::ePresentSrcKHR:
+        return { vk::PipelineStageFlags(), vk::AccessFlags(), layout };
+    case vk::ImageLayout::ePreinitialized:
+        return { stage::eHost, access::eHostWrite, layout };
+    case vk::ImageLayout::eGeneral:
+        return { shader_stages, access::eShaderRead | access::eShaderWrite, layout };
+    case vk::ImageLayout::eTransferSrcOptimal:
+        return { stage::eTransfer, access::eTransferRead, layout };
+    case vk::ImageLayout::eTransferDstOptimal:
+        return { stage::eTransfer, access::eTransferWrite, layout };
+    case vk::ImageLayout::eShaderReadOnlyOptimal:
+        return { shader_stages, access::eShaderRead, layout };
+    case vk::ImageLayout::eColorAttachmentOptimal:
+        return { stage::eColorAttachmentOutput,
+                 access::eColorAttachmentRead | access::eColorAttachmentWrite, layout };
+    case vk::ImageLayout::eDepthStencilAttachmentOptimal:
+        return { depthtests,
+                 access::eDepthStencilAttachmentRead | access::eDepthStencilAttachmentWrite,
+                 layout };
+    case vk::ImageLayout::eDepthStencilReadOnlyOptimal:
+        return { depthtests | shader_stages,
+                 access::eDepthStencilAttachmentRead | access::eShaderRead, layout };
+    default:
+        throw std::invalid_argument("Unsupported layout transition!");
+    }
+}
+
+void
+barrier_batch::memory(const access_scope& src, const access_scope& dst)
+{
+    m_src_stages |= src.stages;
+    m_dst_stages |= dst.stages;
+
+    // Reads after reads only wait, without making anything available
+    if (src.access) {
+        m_memory.srcAccessMask |= src.access;
+        m_memory.dstAccessMask |= dst.access;
+    }
+}
+
+void
+barrier_batch::image(vk::Image                        image,
+                     const vk::ImageSubresourceRange& range,
+                     const access_scope&              src,
+                     const access_scope&              dst,
+                     uint32_t                         src_family,
+                     uint32_t                         dst_family)
+{
+    m_src_stages |= src.stages;
+    m_dst_stages |= dst.stages;
+
+    m_images.push_back(vk::ImageMemoryBarrier()
+                         .setSrcAccessMask(src.access)
+                         .setDstAccessMask(dst.access)
+                         .setOldLayout(src.layout)
+                         .setNewLayout(dst.layout)
+                         .setSrcQueueFamilyIndex(src_family)
+                         .setDstQueueFamilyIndex(dst_family)
+                         .setImage(image)
+                         .setSubresourceRange(range));
+}
+
+void
+barrier_batch::transition(vk::Image                        image,
+                          const vk::ImageSubresourceRange& range,
+                          vk::ImageLayout                  oldlayout,
+                          vk::ImageLayout                  newlayout)
+{
+    this->image(image, range, layoutScope(oldlayout), layoutScope(newlayout));
+}
+
+void
+barrier_batch::buffer(vk::Buffer          buffer,
+                      const access_scope& src,
+                      const access_scope& dst,
+                      uint32_t            src_family,
+                      uint32_t            dst_family,
+                      vk::DeviceSize      offset,
+                      vk::DeviceSize      size)
+{
+    m_src_stages |= src.stages;
+    m_dst_stages |= dst.stages;
+
+    m_buffers.push_back(vk::BufferMemoryBarrier()
+                          .setSrcAccessMask(src.access)
+                          .setDstAccessMask(dst.access)
+                          .setSrcQueueFamilyIndex(src_family)
+                          .setDstQueueFamilyIndex(dst_family)
+                          .setBuffer(buffer)
+                          .setOffset(offset)
+                          .setSize(size));
+}
+
+/*
+Nothing before the barrier has to finish for transitions out of undefined, and nothing after it
+waits for releases to another queue, but a barrier needs stages on both sides all the same.
+*/
+void
+barrier_batch::record(vk::CommandBuffer command_buffer) const
+{
+    if (empty()) {
+        return;
+    }
+
+    vk::PipelineStageFlags src = m_src_stages;
+    vk::PipelineStageFlags dst = m_dst_stages;
+    if (!src) {
+        src = vk::PipelineStageFlagBits::eTopOfPipe;
+    }
+    if (!dst) {
+        dst = vk::PipelineStageFlagBits::eBottomOfPipe;
+    }
+    const bool memory = (bool)m_memory.srcAccessMask;
+
+    command_buffer.pipelineBarrier(src, dst, vk::DependencyFlags(), memory ? 1 : 0, &m_memory,
+                                   (uint32_t)m_buffers.size(), m_buffers.data(),
+                                   (uint32_t)m_images.size(), m_images.data());
+}
+
+void
+barrier_batch::clear()
+{
+    m_src_stages = vk::PipelineStageFlags();
+    m_dst_stages = vk::PipelineStageFlags();
+    m_memory     = vk::MemoryBarrier();
+    m_buffers.clear();
+    m_images.clear();
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,104 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+One side of a barrier: the stages that have to finish or wait, what they access, and for images
+the layout on that side. Empty stages mean nothing, the batch fills in top or bottom of pipe.
+*/
+struct access_scope
+{
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags        access;
+    vk::ImageLayout        layout = vk::ImageLayout::eUndefined;
+};
+
+// The stages that read sampled and storage images, unless a transition says which ones do
+const vk::PipelineStageFlags image_shader_stages = vk::PipelineStageFlagBits::eVertexShader
+                                                   | vk::PipelineStageFlagBits::eFragmentShader
+                                                   | vk::PipelineStageFlagBits::eComputeShader;
+
+/*
+How an image in `layout` is usually accessed, and by which stages, for either side of a barrier:
+a transition has to wait for the accesses of the old layout and make their writes available, and
+has to happen before the accesses of the new one. Layouts that are only ever synchronized by
+semaphores or the host, like undefined and present, have no stages.
+
+Depth tests read in the early fragment test stage and write in the late one, so depth attachments
+cover both. Throws std::invalid_argument for layouts nothing in here uses.
+*/
+access_scope
+layoutScope(vk::ImageLayout layout, vk::PipelineStageFlags shader_stages = image_shader_stages);
+
+/*
+Barriers that can all happen at the same point in a command buffer, accumulated and recorded as a
+single vkCmdPipelineBarrier. Its stage masks are the union of those of the barriers, which is no
+more than separate calls would wait for in total, and drivers handle one call with many barriers
+much better than many calls.
+
+Dependencies without a layout transition or an ownership transfer go into one global memory
+barrier, which costs drivers the same as buffer and image barriers. One that makes nothing
+available only waits, without any memory barrier at all.
+
+This is the core Vulkan 1.0 barrier, not VK_KHR_synchronization2: with per barrier stage masks the
+batch would be more precise still, but the headers and drivers we target don't all have it.
+
+https://www.khronos.org/registry/vulkan/specs/1.1-extensions/man/html/vkCmdPipelineBarrier.html
+*/
+class barrier_batch
+{
+public:
+    // Makes the writes in `src` available and visible to `dst`, their layouts aside
+    void memory(const access_scope& src, const access_scope& dst);
+
+    // Moves `range` of `image` from the layout of `src` to that of `dst`, or between queues
+    void image(vk::Image                        image,
+               const vk::ImageSubresourceRange& range,
+               const access_scope&              src,
+               const access_scope&              dst,
+               uint32_t                         src_family = VK_QUEUE_FAMILY_IGNORED,
+               uint32_t                         dst_family = VK_QUEUE_FAMILY_IGNORED);
+
+    // `image()` between the usual scopes of the two layouts
+    void transition(vk::Image                        image,
+                    const vk::ImageSubresourceRange& range,
+                    vk::ImageLayout                  oldlayout,
+                    vk::ImageLayout                  newlayout);
+
+    // Only needed to transfer the ownership of a buffer, `memory()` covers everything else
+    void buffer(vk::Buffer          buffer,
+                const access_scope& src,
+                const access_scope& dst,
+                uint32_t            src_family = VK_QUEUE_FAMILY_IGNORED,
+                uint32_t            dst_family = VK_QUEUE_FAMILY_IGNORED,
+                vk::DeviceSize      offset     = 0,
+                vk::DeviceSize      size       = VK_WHOLE_SIZE);
+
+    bool empty() const
+    {
+        return !m_src_stages && !m_dst_stages && m_buffers.empty() && m_images.empty();
+    }
+
+    // Records nothing when the batch is empty
+    void record(vk::CommandBuffer command_buffer) const;
+
+    // Keeps the memory of the barriers around for the next batch
+    void clear();
+
+private:
+    vk::PipelineStageFlags               m_src_stages;
+    vk::PipelineStageFlags               m_dst_stages;
+    vk::MemoryBarrier                    m_memory;
+    std::vector<vk::BufferMemoryBarrier> m_buffers;
+    std::vector<vk::ImageMemoryBarrier>  m_images;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,370 @@
+#include "graphics/bvh.h"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+
+// Leaves are made no larger than this, however little splitting them would gain
+const uint32_t max_leaf_objects = 8;
+
+// The surface area heuristic splits a node where the cost of traversing it and then testing the
+// objects on either side, weighted by the chance of hitting that side, is lowest. This is how much
+// a traversal costs next to testing one object.
+const float traversal_cost = 1.f;
+
+// Candidate splits along each axis are bounded by this many equally sized bins
+const uint32_t sah_bins = 12;
+
+// Below this depth nodes are split in half by count instead, which bounds how deep the tree can get
+// however the objects are laid out (the queries' stacks are 64 entries)
+const uint32_t max_sah_depth = 24;
+
+// Refitting stops and the tree is rebuilt once it has become this much more expensive than it was
+// when it was built
+const float max_refit_cost_growth = 1.5f;
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+aabb::grow(const glm::vec3& point)
+{
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void
+aabb::grow(const aabb& box)
+{
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+}
+
+float
+aabb::area() const
+{
+    if (empty()) {
+        return 0.f;
+    }
+
+    const glm::vec3 size = max - min;
+    return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+bvh::handle
+bvh::insert(const aabb& bounds)
+{
+    m_rebuild = true;
+
+    if (!m_free.empty()) {
+        const handle object = m_free.back();
+        m_free.pop_back();
+
+        m_bounds[object] = bounds;
+        m_alive[object]  = 1;
+        return object;
+    }
+
+    m_bounds.push_back(bounds);
+    m_alive.push_back(1);
+    return (handle)(m_bounds.size() - 1);
+}
+
+// The object stays in the leaf it is in until the next rebuild, where queries skip it
+void
+bvh::remove(handle object)
+{
+    m_bounds[object] = aabb();
+    m_alive[object]  = 0;
+    m_free.push_back(object);
+    m_rebuild = true;
+}
+
+void
+bvh::move(handle object, const aabb& bounds)
+{
+    m_bounds[object] = bounds;
+    m_refit          = true;
+}
+
+void
+bvh::update()
+{
+    if (m_rebuild) {
+        build();
+    } else if (m_refit) {
+        refit();
+        if (cost() > m_built_cost * max_refit_cost_growth) {
+            build();
+        }
+    }
+}
+
+void
+bvh::build()
+{
+    m_nodes.clear();
+    m_order.clear();
+    m_centroids.resize(m_bounds.size());
+
+    for (handle object = 0; object < (handle)m_bounds.size(); ++object) {
+        if (m_alive[object]) {
+            m_order.push_back(object);
+            m_centroids[object] = m_bounds[object].center();
+        }
+    }
+
+    m_rebuild = false;
+    m_refit   = false;
+
+    if (m_order.empty()) {
+        m_built_cost = 0.f;
+        return;
+    }
+
+    // A binary tree with at least one object per leaf never has more nodes than this
+    m_nodes.reserve(2 * m_order.size() - 1);
+    m_nodes.emplace_back();
+    subdivide(0, 0, (uint32_t)m_order.size(), 0);
+
+    m_built_cost = cost();
+}
+
+/*
+Children always come after their parent, so going through the nodes backwards has both children's
+boxes ready by the time their parent is reached.
+*/
+void
+bvh::refit()
+{
+    for (size_t i = m_nodes.size(); i-- > 0;) {
+        node& n = m_nodes[i];
+
+        aabb box;
+        if (n.count > 0) {
+            for (uint32_t j = n.first; j < n.first + n.count; ++j) {
+                box.grow(m_bounds[m_order[j]]);
+            }
+        } else {
+            const node& left  = m_nodes[i + 1];
+            const node& right = m_nodes[n.first];
+            box.min           = glm::min(left.min, right.min);
+            box.max           = glm::max(left.max, right.max);
+        }
+
+        n.min = box.min;
+        n.max = box.max;
+    }
+
+    m_refit = false;
+}
+
+/*
+Binned SAH: the objects' centroids are sorted into bins along each axis, and only the boundaries
+between bins are considered for the split, which is nearly as good as considering every object's
+and takes a pass over them per axis instead of a sort.
+*/
+void
+bvh::subdivide(uint32_t index, uint32_t first, uint32_t count, uint32_t depth)
+{
+    aabb box;
+    aabb centroids;
+    for (uint32_t i = first; i < first + count; ++i) {
+        box.grow(m_bounds[m_order[i]]);
+        centroids.grow(m_centroids[m_order[i]]);
+    }
+
+    m_nodes[index].min = box.min;
+    m_nodes[index].max = box.max;
+
+    auto leaf = [&]() {
+        m_nodes[index].first = first;
+        m_nodes[index].count = count;
+    };
+
+    if (count <= 2) {
+        leaf();
+        return;
+    }
+
+    const glm::vec3 extent = centroids.max - centroids.min;
+
+    int   bestaxis = -1;
+    int   bestbin  = 0;
+    float bestcost = std::numeric_limits<float>::max();
+
+    for (int axis = 0; axis < 3 && depth < max_sah_depth; ++axis) {
+        if (extent[axis] <= 0.f) {
+            continue;
+        }
+
+        struct bin
+        {
+            aabb     box;
+            uint32_t count = 0;
+        };
+
+        std::array<bin, sah_bins> bins;
+        const float               scale = sah_bins / extent[axis];
+
+        for (uint32_t i = first; i < first + count; ++i) {
+            const handle object = m_order[i];
+            const int    b      = std::min(
+              (int)((m_centroids[object][axis] - centroids.min[axis]) * scale), (int)sah_bins - 1);
+
+            bins[b].box.grow(m_bounds[object]);
+            ++bins[b].count;
+        }
+
+        // Sweeping from the right first leaves the costs of everything right of every boundary
+        std::array<float, sah_bins> rightcosts;
+        aabb                        right;
+        uint32_t                    rightcount = 0;
+        for (int b = sah_bins - 1; b > 0; --b) {
+            right.grow(bins[b].box);
+            rightcount += bins[b].count;
+            rightcosts[b] = right.area() * rightcount;
+        }
+
+        aabb     left;
+        uint32_t leftcount = 0;
+        for (int b = 1; b < (int)sah_bins; ++b) {
+            left.grow(bins[b - 1].box);
+            leftcount += bins[b - 1].count;
+
+            const float cost = left.area() * leftcount + rightcosts[b];
+            if (leftcount > 0 && leftcount < count && cost < bestcost) {
+                bestaxis = axis;
+                bestbin  = b;
+                bestcost = cost;
+            }
+        }
+    }
+
+    uint32_t middle = first;
+
+    if (bestaxis >= 0) {
+        const float splitcost = traversal_cost + bestcost / box.area();
+        if (splitcost >= (float)count && count <= max_leaf_objects) {
+            leaf();
+            return;
+        }
+
+        const float scale = sah_bins / extent[bestaxis];
+        const float split = centroids.min[bestaxis] + bestbin / scale;
+
+        middle = (uint32_t)(std::partition(m_order.begin() + first,
+                                           m_order.begin() + first + count,
+                                           [&](handle object) {
+                                               return m_centroids[object][bestaxis] < split;
+                                           })
+                            - m_order.begin());
+    }
+
+    // Too deep, all the centroids in one place, or rounding put everything on one side
+    if (middle == first || middle == first + count) {
+        if (count <= max_leaf_objects) {
+            leaf();
+            return;
+        }
+
+        int axis = 0;
+        if (extent.y > extent[axis]) {
+            axis = 1;
+        }
+        if (extent.z > extent[axis]) {
+            axis = 2;
+        }
+
+        middle = first + count / 2;
+        std::nth_element(m_order.begin() + first, m_order.begin() + middle,
+                         m_order.begin() + first + count, [&](handle a, handle b) {
+                             return m_centroids[a][axis] < m_centroids[b][axis];
+                         });
+    }
+
+    const uint32_t left = (uint32_t)m_nodes.size();
+    m_nodes.emplace_back();
+    subdivide(left, first, middle - first, depth + 1);
+
+    const uint32_t right = (uint32_t)m_nodes.size();
+    m_nodes.emplace_back();
+    subdivide(right, middle, first + count - middle, depth + 1);
+
+    m_nodes[index].first = right;
+    m_nodes[index].count = 0;
+}
+
+// The surface area heuristic's cost of the whole tree, relative to testing the root's box once
+float
+bvh::cost() const
+{
+    if (m_nodes.empty()) {
+        return 0.f;
+    }
+
+    float total = 0.f;
+    for (const node& n : m_nodes) {
+        aabb box;
+        box.min = n.min;
+        box.max = n.max;
+
+        total += box.area() * (n.count > 0 ? (float)n.count : traversal_cost);
+    }
+
+    aabb root;
+    root.min = m_nodes[0].min;
+    root.max = m_nodes[0].max;
+
+    const float area = root.area();
+    return area > 0.f ? total / area : total;
+}
+
+/*
+A box is outside when it is entirely behind one of the planes, which only has to be checked for
+its corner furthest along the plane's normal. When even the corner least along every normal is in
+front of its plane, the whole box is inside.
+*/
+bool
+bvh::outside(const glm::vec3& min, const glm::vec3& max, const frustum& frustum, bool& inside)
+{
+    inside = true;
+
+    for (const glm::vec4& plane : frustum.planes) {
+        const glm::vec3 normal(plane);
+        const glm::vec3 farthest(normal.x >= 0.f ? max.x : min.x,
+                                 normal.y >= 0.f ? max.y : min.y,
+                                 normal.z >= 0.f ? max.z : min.z);
+        const glm::vec3 nearest(normal.x >= 0.f ? min.x : max.x,
+                                normal.y >= 0.f ? min.y : max.y,
+                                normal.z >= 0.f ? min.z : max.z);
+
+        if (glm::dot(normal, farthest) + plane.w < 0.f) {
+            return true;
+        }
+        if (glm::dot(normal, nearest) + plane.w < 0.f) {
+            inside = false;
+        }
+    }
+    return false;
+}
+
+// Slab test: where along the ray it enters the box, or -1 if it misses it within `distance`
+float
+bvh::hit(const node& n, const glm::vec3& origin, const glm::vec3& inverse, float distance)
+{
+    const glm::vec3 t0 = (n.min - origin) * inverse;
+    const glm::vec3 t1 = (n.max - origin) * inverse;
+
+    const glm::vec3 entries = glm::min(t0, t1);
+    const glm::vec3 exits   = glm::max(t0, t1);
+
+    const float enter = std::max({ entries.x, entries.y, entries.z, 0.f });
+    const float exit  = std::min({ exits.x, exits.y, exits.z, distance });
+
+    return enter <= exit ? enter : -1.f;
+}
+
+}  // namespace shiny::graphics
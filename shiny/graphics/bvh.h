@@ -0,0 +1,219 @@
+#pragma once
+
+#include "graphics/frustum_culling.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace shiny::graphics {
+
+// Axis aligned bounding box. The default one is empty, and stays empty under growing it by nothing.
+struct aabb
+{
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    void grow(const glm::vec3& point);
+    void grow(const aabb& box);
+
+    bool      empty() const { return min.x > max.x; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    float     area() const;  // surface area, 0 when empty
+};
+
+/*
+Bounding volume hierarchy over objects' boxes, for finding what is inside a frustum or along a ray
+without looking at every object.
+
+Objects are added, moved and removed through their handles at any time, but the tree only catches
+up in `update()`: adding or removing objects rebuilds it, with the surface area heuristic, and
+moving them only refits the boxes of the nodes above them. Refitting keeps the tree correct but
+makes it worse the further things move, so it is rebuilt again once its cost has grown too much.
+
+The nodes are in one array, depth first, so the left child of a node is always the next one and
+walking down the tree mostly moves forwards through memory.
+*/
+class bvh
+{
+public:
+    using handle = uint32_t;
+
+    static const handle invalid_handle = std::numeric_limits<handle>::max();
+
+    handle insert(const aabb& bounds);
+    void   remove(handle object);
+    void   move(handle object, const aabb& bounds);
+
+    const aabb& bounds(handle object) const { return m_bounds[object]; }
+    uint32_t    size() const { return (uint32_t)(m_bounds.size() - m_free.size()); }
+
+    // Brings the tree up to date with the changes since the last update
+    void update();
+    void build();
+    void refit();
+
+    // Calls `visit(object)` for every object whose box is at least partly inside the frustum
+    template<typename Visit>
+    void query(const frustum& frustum, Visit visit) const;
+
+    // Finds the nearest object along the ray within `distance`, for which `intersect(object,
+    // distance)` decides whether the ray really hits it, and if it hits closer than `distance`
+    // sets that to where it does and returns true. Objects are only tried where the ray hits their
+    // box, roughly in the order it does. Returns the object, or invalid_handle if there was none.
+    template<typename Intersect>
+    handle raycast(const glm::vec3& origin,
+                   const glm::vec3& direction,
+                   float&           distance,
+                   Intersect        intersect) const;
+
+private:
+    // Leaves have objects m_order[first, first + count), other nodes have count 0 and `first` is
+    // their right child
+    struct node
+    {
+        glm::vec3 min;
+        uint32_t  first = 0;
+        glm::vec3 max;
+        uint32_t  count = 0;
+    };
+
+    static_assert(sizeof(node) == 32, "Two nodes should share a cache line");
+
+    void  subdivide(uint32_t index, uint32_t first, uint32_t count, uint32_t depth);
+    float cost() const;
+
+    static bool  outside(const glm::vec3& min,
+                         const glm::vec3& max,
+                         const frustum&   frustum,
+                         bool&            inside);
+    static float hit(const node&      n,
+                     const glm::vec3& origin,
+                     const glm::vec3& inverse,
+                     float            distance);
+
+    std::vector<aabb>      m_bounds;
+    std::vector<uint8_t>   m_alive;
+    std::vector<handle>    m_free;
+    std::vector<node>      m_nodes;
+    std::vector<handle>    m_order;      // objects in the order the leaves refer to them
+    std::vector<glm::vec3> m_centroids;  // of every object's box, while building
+    float                  m_built_cost = 0.f;
+    bool                   m_rebuild    = false;  // objects were added or removed
+    bool                   m_refit      = false;  // objects were moved
+};
+
+/*
+A node that is entirely inside the frustum has every object below it inside as well, so the planes
+aren't tested again under it.
+*/
+template<typename Visit>
+void
+bvh::query(const frustum& frustum, Visit visit) const
+{
+    if (m_nodes.empty()) {
+        return;
+    }
+
+    struct entry
+    {
+        uint32_t node;
+        bool     inside;
+    };
+
+    entry    stack[64];
+    uint32_t top = 0;
+
+    stack[top++] = { 0, false };
+
+    while (top > 0) {
+        const entry e = stack[--top];
+        const node& n = m_nodes[e.node];
+
+        bool inside = e.inside;
+        if (!inside && outside(n.min, n.max, frustum, inside)) {
+            continue;
+        }
+
+        if (n.count > 0) {
+            for (uint32_t i = n.first; i < n.first + n.count; ++i) {
+                const handle object = m_order[i];
+
+                bool contained;
+                if (m_alive[object]
+                    && (inside
+                        || !outside(m_bounds[object].min, m_bounds[object].max, frustum,
+                                    contained))) {
+                    visit(object);
+                }
+            }
+            continue;
+        }
+
+        stack[top++] = { n.first, inside };
+        stack[top++] = { e.node + 1, inside };
+    }
+}
+
+template<typename Intersect>
+bvh::handle
+bvh::raycast(const glm::vec3& origin,
+             const glm::vec3& direction,
+             float&           distance,
+             Intersect        intersect) const
+{
+    if (m_nodes.empty()) {
+        return invalid_handle;
+    }
+
+    // Zero components become infinities, which the slab test copes with
+    const glm::vec3 inverse = 1.f / direction;
+
+    handle   nearest = invalid_handle;
+    uint32_t stack[64];
+    uint32_t top = 0;
+
+    if (hit(m_nodes[0], origin, inverse, distance) >= 0.f) {
+        stack[top++] = 0;
+    }
+
+    while (top > 0) {
+        const node& n = m_nodes[stack[--top]];
+
+        if (n.count > 0) {
+            for (uint32_t i = n.first; i < n.first + n.count; ++i) {
+                const handle object = m_order[i];
+                if (m_alive[object] && intersect(object, distance)) {
+                    nearest = object;
+                }
+            }
+            continue;
+        }
+
+        // The nearer child goes on top, so it's tried first and may shorten the ray for the other
+        const uint32_t left     = (uint32_t)(&n - m_nodes.data()) + 1;
+        const uint32_t right    = n.first;
+        const float    lefthit  = hit(m_nodes[left], origin, inverse, distance);
+        const float    righthit = hit(m_nodes[right], origin, inverse, distance);
+
+        if (lefthit >= 0.f && righthit >= 0.f) {
+            if (lefthit < righthit) {
+                stack[top++] = right;
+                stack[top++] = left;
+            } else {
+                stack[top++] = left;
+                stack[top++] = right;
+            }
+        } else if (lefthit >= 0.f) {
+            stack[top++] = left;
+        } else if (righthit >= 0.f) {
+            stack[top++] = right;
+        }
+    }
+
+    return nearest;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,147 @@
+#include "graphics/calibration.h"
+
+#include "core/mapped_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+
+namespace {
+
+// Of the budget, which the predicted frame times have to fit in
+const float calibration_headroom = 0.85f;
+
+// Of every frame's budget, which streaming may spend uploading
+const float upload_share = 0.125f;
+
+// Streaming never uploads less than this a frame, however slow the uploads were, and never more
+// than the staging arena holds
+const uint64_t min_upload_bytes = 1024 * 1024;
+const uint64_t max_upload_bytes = 64 * 1024 * 1024;
+
+// The text after `"key": `, or npos
+size_t
+findValue(const std::string& text, const char* key)
+{
+    const std::string pattern = std::string("\"") + key + "\": ";
+    const size_t      start   = text.find(pattern);
+    return start == std::string::npos ? start : start + pattern.size();
+}
+
+bool
+readNumber(const std::string& text, const char* key, double& value)
+{
+    const size_t start = findValue(text, key);
+    if (start == std::string::npos) {
+        return false;
+    }
+    char* end = nullptr;
+    value     = std::strtod(text.c_str() + start, &end);
+    return end != text.c_str() + start;
+}
+
+bool
+readString(const std::string& text, const char* key, std::string& value)
+{
+    const size_t start = findValue(text, key);
+    if (start == std::string::npos || text[start] != '"') {
+        return false;
+    }
+    const size_t end = text.find('"', start + 1);
+    if (end == std::string::npos) {
+        return false;
+    }
+    value = text.substr(start + 1, end - start - 1);
+    return true;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+chooseCalibratedSettings(calibration_result& result, float budget_ms)
+{
+    const float target   = budget_ms * calibration_headroom;
+    const float minscale = qualitySettings(quality_tier::low).render_scale;
+
+    // The rest of the frame stays whatever the scale, and the pixels' share goes with its square
+    float scale = 1.f;
+    if (result.pixel_ms > 0.f && result.frame_ms > target) {
+        const float fixed = result.frame_ms - result.pixel_ms;
+        scale             = std::sqrt(std::max(target - fixed, 0.f) / result.pixel_ms);
+    }
+    result.render_scale = std::clamp(scale, minscale, 1.f);
+
+    const float scaled =
+      result.frame_ms - result.pixel_ms * (1.f - result.render_scale * result.render_scale);
+    result.tier = recommendQualityTier(quality_tier::high, scaled, budget_ms);
+
+    // Without scaling measured the tier's own scale is as good a guess as any
+    if (result.pixel_ms <= 0.f) {
+        result.render_scale = qualitySettings(result.tier).render_scale;
+    }
+
+    const double bytes  = result.upload_rate * (double)(budget_ms * upload_share) * 1e-3;
+    result.upload_bytes = std::clamp((uint64_t)bytes, min_upload_bytes, max_upload_bytes);
+}
+
+quality_settings
+calibratedQuality(const calibration_result& result)
+{
+    quality_settings settings = qualitySettings(result.tier);
+    settings.render_scale     = result.render_scale;
+    return settings;
+}
+
+bool
+readCalibration(const std::string& path, calibration_result& result)
+{
+    core::mapped_file file;
+    if (!file.openLoose(path)) {
+        return false;
+    }
+    const std::string text(file.begin(), file.end());
+
+    std::string tier;
+    double      framems = 0., pixelms = 0., scale = 0., uploadbytes = 0.;
+    if (!readString(text, "device", result.device) || !readString(text, "quality", tier)
+        || !parseQualityTier(tier, result.tier) || !readNumber(text, "fill_rate", result.fill_rate)
+        || !readNumber(text, "vertex_rate", result.vertex_rate)
+        || !readNumber(text, "upload_rate", result.upload_rate)
+        || !readNumber(text, "frame_ms", framems) || !readNumber(text, "pixel_ms", pixelms)
+        || !readNumber(text, "render_scale", scale)
+        || !readNumber(text, "upload_bytes", uploadbytes)) {
+        return false;
+    }
+    result.frame_ms     = (float)framems;
+    result.pixel_ms     = (float)pixelms;
+    result.render_scale = (float)scale;
+    result.upload_bytes = (uint64_t)uploadbytes;
+    return true;
+}
+
+bool
+writeCalibration(const std::string& path, const calibration_result& result)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    out << "{\n";
+    out << "  \"device\": \"" << result.device << "\",\n";
+    out << "  \"fill_rate\": " << result.fill_rate << ",\n";
+    out << "  \"vertex_rate\": " << result.vertex_rate << ",\n";
+    out << "  \"upload_rate\": " << result.upload_rate << ",\n";
+    out << "  \"frame_ms\": " << result.frame_ms << ",\n";
+    out << "  \"pixel_ms\": " << result.pixel_ms << ",\n";
+    out << "  \"quality\": \"" << qualityTierName(result.tier) << "\",\n";
+    out << "  \"render_scale\": " << result.render_scale << ",\n";
+    out << "  \"upload_bytes\": " << result.upload_bytes << "\n";
+    out << "}\n";
+    return (bool)out;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "graphics/quality_tier.h"
+
+#include <cstdint>
+#include <string>
+
+namespace shiny::graphics {
+
+/*
+What a calibration measured of a GPU, see renderer::setCalibration, and the defaults it picked from
+that. The rates are what the stress scene got out of the GPU, not what it could do at best: the
+main pass both transforms and shades, so its time is split between the two by how much of it goes
+with the render scale, and without scaling all of it counts for both.
+*/
+struct calibration_result
+{
+    std::string device;  // see pipeline_cache::deviceKey, which GPU and driver this is for
+
+    double fill_rate   = 0.;   // fragments shaded a second
+    double vertex_rate = 0.;   // triangles a second
+    double upload_rate = 0.;   // bytes copied to the GPU a second
+    float  frame_ms    = 0.f;  // median GPU time of a frame at the high tier and full scale
+    float  pixel_ms    = 0.f;  // of which goes with the render scale, 0 if it couldn't be told
+
+    quality_tier tier         = quality_tier::high;
+    float        render_scale = 1.f;
+    uint64_t     upload_bytes = 0;  // streaming_budget::upload_bytes
+};
+
+/*
+Picks the defaults from what was measured, for frames of at most `budget_ms` of GPU time: first the
+render scale that takes the pixels' share of the time down to fit, within the tiers' range of
+scales, and then the best tier for what is left over, see recommendQualityTier. Streaming may
+upload for a fixed share of every frame.
+*/
+void chooseCalibratedSettings(calibration_result& result, float budget_ms);
+
+// The tier's settings with the calibrated render scale
+quality_settings calibratedQuality(const calibration_result& result);
+
+// False if the file can't be read or misses any of the fields
+bool readCalibration(const std::string& path, calibration_result& result);
+bool writeCalibration(const std::string& path, const calibration_result& result);
+
+}  // namespace shiny::graphics
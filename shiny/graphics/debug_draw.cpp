@@ -0,0 +1,223 @@
+#include "graphics/debug_draw.h"
+
+#include "graphics/host_allocator.h"
+
+#include <cmath>
+#include <cstddef>
+
+namespace {
+
+// Segments of each of a sphere's outlines
+const uint32_t sphere_segments = 24;
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+debug_draw::init(vk::Device        device,
+                 memory_allocator& allocator,
+                 layout_cache&     layouts,
+                 uint32_t          max_vertices,
+                 uint32_t          frames)
+{
+    m_device       = device;
+    m_allocator    = &allocator;
+    m_max_vertices = max_vertices;
+    m_frames       = frames;
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(sizeof(debug_vertex) * max_vertices * frames)
+                        .setUsage(vk::BufferUsageFlagBits::eVertexBuffer)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    // Rewritten every frame, so straight into VRAM where the host can map all of it
+    m_buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+    m_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_buffer),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::vertex,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_buffer, m_memory.memory, m_memory.offset);
+
+    // No sets, just the camera
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eVertex)
+                       .setOffset(0)
+                       .setSize(sizeof(glm::mat4));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    beginFrame(0);
+}
+
+void
+debug_draw::destroy()
+{
+    m_device.destroyBuffer(m_buffer, hostAllocator());
+    m_allocator->free(m_memory);
+    m_buffer   = nullptr;
+    m_vertices = nullptr;
+}
+
+void
+debug_draw::beginFrame(uint32_t frame)
+{
+    m_frame     = frame % m_frames;
+    m_vertices  = static_cast<debug_vertex*>(m_memory.mapped) + m_frame * m_max_vertices;
+    m_lines     = 0;
+    m_triangles = 0;
+    m_dropped   = 0;
+}
+
+debug_vertex*
+debug_draw::reserveLines(uint32_t count)
+{
+    if (count > m_max_vertices - m_lines - m_triangles) {
+        m_dropped += count;
+        return nullptr;
+    }
+
+    debug_vertex* vertices = m_vertices + m_lines;
+    m_lines += count;
+    return vertices;
+}
+
+debug_vertex*
+debug_draw::reserveTriangles(uint32_t count)
+{
+    if (count > m_max_vertices - m_lines - m_triangles) {
+        m_dropped += count;
+        return nullptr;
+    }
+
+    m_triangles += count;
+    return m_vertices + m_max_vertices - m_triangles;
+}
+
+void
+debug_draw::line(const glm::vec3& a, const glm::vec3& b, uint32_t color)
+{
+    if (debug_vertex* vertices = reserveLines(2)) {
+        vertices[0] = { a, color };
+        vertices[1] = { b, color };
+    }
+}
+
+void
+debug_draw::triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, uint32_t color)
+{
+    if (debug_vertex* vertices = reserveTriangles(3)) {
+        vertices[0] = { a, color };
+        vertices[1] = { b, color };
+        vertices[2] = { c, color };
+    }
+}
+
+// Corner i has the maximum along the axes of its set bits: x for 1, y for 2, z for 4
+void
+debug_draw::box(const glm::vec3& min,
+                const glm::vec3& max,
+                const glm::mat4& transform,
+                uint32_t         color)
+{
+    debug_vertex* vertices = reserveLines(24);
+    if (!vertices) {
+        return;
+    }
+
+    std::array<glm::vec3, 8> corners;
+    for (uint32_t i = 0; i < 8; ++i) {
+        const glm::vec3 corner(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z);
+        corners[i] = glm::vec3(transform * glm::vec4(corner, 1.f));
+    }
+
+    // Every edge runs from a corner to the one with a bit more set
+    uint32_t edge = 0;
+    for (uint32_t i = 0; i < 8; ++i) {
+        for (uint32_t bit = 1; bit < 8; bit <<= 1) {
+            if (!(i & bit)) {
+                vertices[edge++] = { corners[i], color };
+                vertices[edge++] = { corners[i | bit], color };
+            }
+        }
+    }
+}
+
+// The corners of the clip space box, with depths from zero to one, back in world space
+void
+debug_draw::frustum(const glm::mat4& view_projection, uint32_t color)
+{
+    const glm::mat4 inverse = glm::inverse(view_projection);
+
+    std::array<glm::vec3, 8> corners;
+    for (uint32_t i = 0; i < 8; ++i) {
+        const glm::vec4 corner =
+          inverse * glm::vec4(i & 1 ? 1.f : -1.f, i & 2 ? 1.f : -1.f, i & 4 ? 1.f : 0.f, 1.f);
+        corners[i] = glm::vec3(corner) / corner.w;
+    }
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        for (uint32_t bit = 1; bit < 8; bit <<= 1) {
+            if (!(i & bit)) {
+                line(corners[i], corners[i | bit], color);
+            }
+        }
+    }
+}
+
+void
+debug_draw::sphere(const glm::vec3& center, float radius, uint32_t color)
+{
+    debug_vertex* vertices = reserveLines(3 * 2 * sphere_segments);
+    if (!vertices) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < sphere_segments; ++i) {
+        const float from = 6.2831853f * (float)i / (float)sphere_segments;
+        const float to   = 6.2831853f * (float)(i + 1) / (float)sphere_segments;
+        const float c0   = std::cos(from) * radius;
+        const float s0   = std::sin(from) * radius;
+        const float c1   = std::cos(to) * radius;
+        const float s1   = std::sin(to) * radius;
+
+        *vertices++ = { center + glm::vec3(c0, s0, 0.f), color };
+        *vertices++ = { center + glm::vec3(c1, s1, 0.f), color };
+        *vertices++ = { center + glm::vec3(0.f, c0, s0), color };
+        *vertices++ = { center + glm::vec3(0.f, c1, s1), color };
+        *vertices++ = { center + glm::vec3(s0, 0.f, c0), color };
+        *vertices++ = { center + glm::vec3(s1, 0.f, c1), color };
+    }
+}
+
+void
+debug_draw::draw(vk::CommandBuffer command_buffer,
+                 vk::Pipeline      lines,
+                 vk::Pipeline      triangles,
+                 const glm::mat4&  view_projection) const
+{
+    if (empty()) {
+        return;
+    }
+
+    const vk::DeviceSize region = sizeof(debug_vertex) * m_max_vertices * m_frame;
+    command_buffer.bindVertexBuffers(0, m_buffer, region);
+    command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eVertex, 0,
+                                 sizeof(view_projection), &view_projection);
+
+    if (m_triangles > 0) {
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, triangles);
+        command_buffer.draw(m_triangles, 1, m_max_vertices - m_triangles, 0);
+    }
+    if (m_lines > 0) {
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, lines);
+        command_buffer.draw(m_lines, 1, 0, 0);
+    }
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/vertex_layout.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+
+namespace shiny::graphics {
+
+// RGBA of 8 bits each, red in the lowest byte, which the vertex input reads as unorm
+inline uint32_t
+debugColor(float red, float green, float blue, float alpha = 1.f)
+{
+    auto channel = [](float value) {
+        return (uint32_t)(glm::clamp(value, 0.f, 1.f) * 255.f + 0.5f);
+    };
+    return channel(red) | channel(green) << 8 | channel(blue) << 16 | channel(alpha) << 24;
+}
+
+struct debug_vertex
+{
+    glm::vec3 position;  // in world space
+    uint32_t  color = 0;  // see debugColor
+
+    static constexpr vk::VertexInputBindingDescription getBindingDescription();
+    static constexpr auto                              getAttributeDescription();
+};
+
+template<>
+constexpr auto vertex_fields<debug_vertex> = std::array {
+    SHINY_VERTEX_FIELD(debug_vertex, position, 0),
+    SHINY_VERTEX_FIELD_AS(debug_vertex, color, 1, vk::Format::eR8G8B8A8Unorm),
+};
+
+constexpr vk::VertexInputBindingDescription
+debug_vertex::getBindingDescription()
+{
+    return vertex_streams<debug_vertex>::bindings()[0];
+}
+
+constexpr auto
+debug_vertex::getAttributeDescription()
+{
+    return vertex_streams<debug_vertex>::attributes();
+}
+
+static_assert(sizeof(debug_vertex) == 16, "debug_vertex has to match its vertex layout");
+
+/*
+Lines and triangles for looking at what the renderer is doing, bounds, frustums and the like, drawn
+over the scene in at most two draws a frame however many there are. They're written straight into
+the frame's region of a persistently mapped vertex buffer, one per frame in flight like the
+uniform_ring's, so adding one is a few stores and never allocates: the lines from the region's
+start and the triangles from its end, each kind contiguous for its own draw. Whatever doesn't fit
+anymore is dropped and counted.
+
+Everything added only lasts the frame, beginFrame() starts over. Only ever on the render thread.
+*/
+class debug_draw
+{
+public:
+    // Room for `max_vertices` of lines and triangles together, each frame
+    void init(vk::Device        device,
+              memory_allocator& allocator,
+              layout_cache&     layouts,
+              uint32_t          max_vertices,
+              uint32_t          frames);
+    void destroy();
+
+    // Starts over in `frame`'s region, once the GPU is done with it
+    void beginFrame(uint32_t frame);
+
+    void line(const glm::vec3& a, const glm::vec3& b, uint32_t color);
+    void triangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, uint32_t color);
+
+    // The edges of a box that is axis aligned in the space `transform` takes to world space
+    void box(const glm::vec3& min,
+             const glm::vec3& max,
+             const glm::mat4& transform,
+             uint32_t         color);
+
+    // The edges of what `view_projection` sees, from the near to the far plane
+    void frustum(const glm::mat4& view_projection, uint32_t color);
+
+    // Its outlines around each axis
+    void sphere(const glm::vec3& center, float radius, uint32_t color);
+
+    // Draws the frame's lines and triangles, with pipelines made with layout() and the vertex
+    // layout of debug_vertex, in line and triangle lists. Inside a render pass.
+    void draw(vk::CommandBuffer command_buffer,
+              vk::Pipeline      lines,
+              vk::Pipeline      triangles,
+              const glm::mat4&  view_projection) const;
+
+    vk::PipelineLayout layout() const { return m_layout; }
+
+    bool     empty() const { return m_lines == 0 && m_triangles == 0; }
+    uint32_t dropped() const { return m_dropped; }  // vertices, this frame
+
+private:
+    // Room for `count` more vertices, or null
+    debug_vertex* reserveLines(uint32_t count);
+    debug_vertex* reserveTriangles(uint32_t count);
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::Buffer         m_buffer;  // host visible, every frame's region
+    allocation         m_memory;
+    uint32_t           m_max_vertices = 0;  // a frame
+    uint32_t           m_frames       = 0;
+    vk::PipelineLayout m_layout;  // owned by the layout_cache
+
+    uint32_t      m_frame     = 0;
+    debug_vertex* m_vertices  = nullptr;  // the frame's region
+    uint32_t      m_lines     = 0;        // vertices from the region's start
+    uint32_t      m_triangles = 0;        // and from its end
+    uint32_t      m_dropped   = 0;
+};
+
+}  // namespace shiny::graphics
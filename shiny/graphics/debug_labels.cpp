@@ -0,0 +1,33 @@
+#include "graphics/debug_labels.h"
+
+namespace shiny::graphics {
+
+const char*
+debug_labels::extension()
+{
+#if !defined(SHINY_DISABLE_DEBUG_LABELS) && defined(VK_EXT_debug_utils)
+    return VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+#else
+    return nullptr;
+#endif
+}
+
+void
+debug_labels::init(vk::Instance instance)
+{
+#if !defined(SHINY_DISABLE_DEBUG_LABELS) && defined(VK_EXT_debug_utils)
+    // Extension commands aren't exported by the loader, same as the debug report callbacks. Both or
+    // neither, so that every begin has its end.
+    m_begin =
+      (PFN_vkCmdBeginDebugUtilsLabelEXT)instance.getProcAddr("vkCmdBeginDebugUtilsLabelEXT");
+    m_end = (PFN_vkCmdEndDebugUtilsLabelEXT)instance.getProcAddr("vkCmdEndDebugUtilsLabelEXT");
+    if (!m_begin || !m_end) {
+        m_begin = nullptr;
+        m_end   = nullptr;
+    }
+#else
+    (void)instance;
+#endif
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,70 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+namespace shiny::graphics {
+
+/*
+VK_EXT_debug_utils labels around regions of command buffers, which RenderDoc, Nsight and the like
+show the captured commands under. Each label is a single call the driver barely looks at unless a
+tool is attached, so they stay in optimized builds that are profiled.
+
+Builds with SHINY_DISABLE_DEBUG_LABELS defined compile them out, and without the extension on the
+instance every label is a no-op.
+*/
+class debug_labels
+{
+public:
+    // The name of the instance extension, or nullptr when labels are compiled out
+    static const char* extension();
+
+    // `instance` has to have been created with extension(), where the loader has it
+    void init(vk::Instance instance);
+
+    bool enabled() const
+    {
+#if !defined(SHINY_DISABLE_DEBUG_LABELS) && defined(VK_EXT_debug_utils)
+        return m_begin != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    // `name` is copied by the driver, it can go right after
+    void begin(vk::CommandBuffer command_buffer, const char* name) const
+    {
+#if !defined(SHINY_DISABLE_DEBUG_LABELS) && defined(VK_EXT_debug_utils)
+        if (m_begin) {
+            VkDebugUtilsLabelEXT label = {};
+            label.sType                = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
+            label.pLabelName           = name;
+            m_begin(static_cast<VkCommandBuffer>(command_buffer), &label);
+        }
+#else
+        (void)command_buffer;
+        (void)name;
+#endif
+    }
+
+    void end(vk::CommandBuffer command_buffer) const
+    {
+#if !defined(SHINY_DISABLE_DEBUG_LABELS) && defined(VK_EXT_debug_utils)
+        if (m_end) {
+            m_end(static_cast<VkCommandBuffer>(command_buffer));
+        }
+#else
+        (void)command_buffer;
+#endif
+    }
+
+private:
+#if !defined(SHINY_DISABLE_DEBUG_LABELS) && defined(VK_EXT_debug_utils)
+    PFN_vkCmdBeginDebugUtilsLabelEXT m_begin = nullptr;
+    PFN_vkCmdEndDebugUtilsLabelEXT   m_end   = nullptr;
+#endif
+};
+
+}  // namespace shiny::graphics
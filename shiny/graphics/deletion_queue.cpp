@@ -0,0 +1,49 @@
+#include "graphics/deletion_queue.h"
+
+#include <cassert>
+
+namespace shiny::graphics {
+
+void
+deletion_queue::init(vk::Device device, memory_allocator& allocator)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+}
+
+void
+deletion_queue::destroy()
+{
+    for (auto& pending : m_entries) {
+        pending.action();
+    }
+    m_entries.clear();
+}
+
+void
+deletion_queue::push(uint64_t frame, allocation memory)
+{
+    if (memory) {
+        memory_allocator* allocator = m_allocator;
+        pushAction(frame, [allocator, memory]() mutable { allocator->free(memory); });
+    }
+}
+
+void
+deletion_queue::pushAction(uint64_t frame, std::function<void()> action)
+{
+    assert((m_entries.empty() || m_entries.back().frame <= frame)
+           && "deletion_queue entries must be pushed in frame order!");
+    m_entries.push_back({ frame, std::move(action) });
+}
+
+void
+deletion_queue::collect(uint64_t completed_frames)
+{
+    while (!m_entries.empty() && m_entries.front().frame < completed_frames) {
+        m_entries.front().action();
+        m_entries.pop_front();
+    }
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "graphics/host_allocator.h"
+#include "graphics/memory_allocator.h"
+
+#include <deque>
+#include <functional>
+
+namespace shiny::graphics {
+
+/*
+Vulkan objects can't be destroyed while a submitted command buffer still refers to them, and the
+only way to be sure of that without tracking anything is to wait for the device to go idle. Instead,
+anything that is no longer needed is pushed here along with the number of the frame that last used
+it, and is destroyed once that frame's fence has signalled.
+
+Frame numbers are the renderer's monotonically increasing count of submitted frames, not the index
+of the frame in flight, so entries can be pushed with a non-decreasing frame number and complete in
+order. `collect()` is given the number of frames known to have finished.
+*/
+class deletion_queue
+{
+public:
+    void init(vk::Device device, memory_allocator& allocator);
+
+    // Destroys everything that is still queued. Only safe once the device is idle.
+    void destroy();
+
+    // Any handle that vk::Device has a destroy() overload for, e.g. vk::Buffer or vk::Pipeline
+    template<typename Handle>
+    void push(uint64_t frame, Handle handle)
+    {
+        if (handle) {
+            vk::Device device = m_device;
+            pushAction(frame, [device, handle]() { device.destroy(handle, hostAllocator()); });
+        }
+    }
+
+    void push(uint64_t frame, allocation memory);
+    void pushAction(uint64_t frame, std::function<void()> action);
+
+    // Destroys everything pushed with a frame number below `completed_frames`
+    void collect(uint64_t completed_frames);
+
+    bool empty() const { return m_entries.empty(); }
+
+private:
+    struct entry
+    {
+        uint64_t              frame = 0;
+        std::function<void()> action;
+    };
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    std::deque<entry> m_entries;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,115 @@
+#include "graphics/descriptor_allocator.h"
+
+#include "graphics/host_allocator.h"
+
+#include <stdexcept>
+
+namespace shiny::graphics {
+
+void
+descriptor_allocator::init(vk::Device                                 device,
+                           const std::vector<vk::DescriptorPoolSize>& sizes_per_set,
+                           uint32_t                                   sets_per_pool,
+                           vk::DescriptorPoolCreateFlags              flags)
+{
+    m_device        = device;
+    m_sets_per_pool = sets_per_pool;
+    m_flags         = flags;
+
+    m_sizes = sizes_per_set;
+    for (vk::DescriptorPoolSize& size : m_sizes) {
+        size.descriptorCount *= sets_per_pool;
+    }
+}
+
+void
+descriptor_allocator::destroy()
+{
+    for (vk::DescriptorPool pool : m_used) {
+        m_device.destroyDescriptorPool(pool, hostAllocator());
+    }
+    for (vk::DescriptorPool pool : m_free) {
+        m_device.destroyDescriptorPool(pool, hostAllocator());
+    }
+
+    m_used.clear();
+    m_free.clear();
+    m_current = nullptr;
+}
+
+/*
+The allocation is tried on the current pool first. Running out of space shows up as
+VK_ERROR_OUT_OF_POOL_MEMORY (or, before VK_KHR_maintenance1, as VK_ERROR_FRAGMENTED_POOL or any other
+error really), so any failure moves on to a fresh pool, and only failing on that one is an error.
+*/
+vk::DescriptorSet
+descriptor_allocator::allocate(vk::DescriptorSetLayout layout, const void* pnext)
+{
+    if (!m_current) {
+        m_current = nextPool();
+    }
+
+    auto allocinfo = vk::DescriptorSetAllocateInfo()
+                       .setPNext(pnext)
+                       .setDescriptorPool(m_current)
+                       .setDescriptorSetCount(1)
+                       .setPSetLayouts(&layout);
+
+    vk::DescriptorSet set;
+    if (m_device.allocateDescriptorSets(&allocinfo, &set) == vk::Result::eSuccess) {
+        return set;
+    }
+
+    m_current = nextPool();
+    allocinfo.setDescriptorPool(m_current);
+
+    if (m_device.allocateDescriptorSets(&allocinfo, &set) != vk::Result::eSuccess) {
+        throw std::runtime_error("failed to allocate descriptor set!");
+    }
+    return set;
+}
+
+void
+descriptor_allocator::reset()
+{
+    for (vk::DescriptorPool pool : m_used) {
+        m_device.resetDescriptorPool(pool);
+        m_free.push_back(pool);
+    }
+
+    m_used.clear();
+    m_current = nullptr;
+}
+
+vk::DescriptorPool
+descriptor_allocator::createPool()
+{
+    auto poolinfo = vk::DescriptorPoolCreateInfo()
+                      .setFlags(m_flags)
+                      .setPoolSizeCount((uint32_t)m_sizes.size())
+                      .setPPoolSizes(m_sizes.data())
+                      .setMaxSets(m_sets_per_pool);
+
+    vk::DescriptorPool pool;
+    if (!(pool = m_device.createDescriptorPool(poolinfo, hostAllocator()))) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+    return pool;
+}
+
+vk::DescriptorPool
+descriptor_allocator::nextPool()
+{
+    vk::DescriptorPool pool;
+    if (!m_free.empty()) {
+        pool = m_free.back();
+        m_free.pop_back();
+    } else {
+        pool = createPool();
+    }
+
+    m_used.push_back(pool);
+    return pool;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,53 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Hands out descriptor sets from as many pools as it takes. A pool is sized for `sets_per_pool` sets,
+each with up to the given number of descriptors of every type, and when it runs out (or is too
+fragmented) the next one is started instead of the allocation failing.
+
+`reset()` gives every set back at once by resetting the pools, which is how transient sets are
+meant to be used: one allocator per frame in flight, reset once that frame's fence has signalled.
+Sets can't be freed one by one.
+
+Descriptor pools have to be externally synchronized, and so does the allocator. It's cheap enough
+to have one per thread that needs sets, the same way there is one per frame in flight.
+*/
+class descriptor_allocator
+{
+public:
+    void init(vk::Device                                 device,
+              const std::vector<vk::DescriptorPoolSize>& sizes_per_set,
+              uint32_t                                   sets_per_pool,
+              vk::DescriptorPoolCreateFlags              flags = vk::DescriptorPoolCreateFlags());
+    void destroy();
+
+    // `pnext` is chained into the vk::DescriptorSetAllocateInfo, e.g. for variable counts
+    vk::DescriptorSet allocate(vk::DescriptorSetLayout layout, const void* pnext = nullptr);
+
+    // Every set allocated so far becomes invalid, the pools are kept for reuse
+    void reset();
+
+private:
+    vk::DescriptorPool createPool();
+    vk::DescriptorPool nextPool();
+
+    vk::Device                          m_device;
+    std::vector<vk::DescriptorPoolSize> m_sizes;  // for a whole pool
+    uint32_t                            m_sets_per_pool = 0;
+    vk::DescriptorPoolCreateFlags       m_flags;
+
+    vk::DescriptorPool              m_current;
+    std::vector<vk::DescriptorPool> m_used;  // full ones, m_current included
+    std::vector<vk::DescriptorPool> m_free;  // reset ones
+};
+
+}  // namespace shiny::graphics
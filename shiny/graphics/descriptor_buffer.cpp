@@ -0,0 +1,272 @@
+#include "graphics/descriptor_buffer.h"
+
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace {
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+#if defined(VK_EXT_descriptor_buffer)
+bool
+descriptor_buffer::init(vk::Device                                             device,
+                        memory_allocator&                                      allocator,
+                        const vk::PhysicalDeviceDescriptorBufferPropertiesEXT& properties,
+                        const std::vector<vk::DescriptorSetLayout>&            layouts,
+                        uint32_t                                               frames)
+{
+    m_device     = device;
+    m_allocator  = &allocator;
+    m_properties = properties;
+    m_layouts    = layouts;
+    m_frames     = frames;
+
+    // Extension commands aren't exported by the loader
+    auto layoutsize = (PFN_vkGetDescriptorSetLayoutSizeEXT)m_device.getProcAddr(
+      "vkGetDescriptorSetLayoutSizeEXT");
+    m_binding_offset = (PFN_vkGetDescriptorSetLayoutBindingOffsetEXT)m_device.getProcAddr(
+      "vkGetDescriptorSetLayoutBindingOffsetEXT");
+    m_get_descriptor = (PFN_vkGetDescriptorEXT)m_device.getProcAddr("vkGetDescriptorEXT");
+    m_bind_buffers =
+      (PFN_vkCmdBindDescriptorBuffersEXT)m_device.getProcAddr("vkCmdBindDescriptorBuffersEXT");
+    m_set_buffer_offsets = (PFN_vkCmdSetDescriptorBufferOffsetsEXT)m_device.getProcAddr(
+      "vkCmdSetDescriptorBufferOffsetsEXT");
+    m_buffer_address =
+      (PFN_vkGetBufferDeviceAddressKHR)m_device.getProcAddr("vkGetBufferDeviceAddressKHR");
+
+    // Every copy starts at an aligned offset, and so does every frame's region
+    const vk::DeviceSize alignment = m_properties.descriptorBufferOffsetAlignment;
+    m_set_offsets.clear();
+    m_frame_size = 0;
+    for (vk::DescriptorSetLayout layout : m_layouts) {
+        vk::DeviceSize size = 0;
+        layoutsize(static_cast<VkDevice>(m_device), static_cast<VkDescriptorSetLayout>(layout),
+                   &size);
+        m_set_offsets.push_back(m_frame_size);
+        m_frame_size = alignUp(m_frame_size + size, alignment);
+    }
+
+    // The offsets that sets are bound at count from the start of the buffer, and the buffer holds
+    // sampler descriptors as well as resource ones
+    const vk::DeviceSize range = std::min(m_properties.maxResourceDescriptorBufferRange,
+                                          m_properties.maxSamplerDescriptorBufferRange);
+    if (m_frame_size == 0 || size() > range) {
+        return false;
+    }
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(size())
+                        .setUsage(vk::BufferUsageFlagBits::eResourceDescriptorBufferEXT
+                                  | vk::BufferUsageFlagBits::eSamplerDescriptorBufferEXT
+                                  | vk::BufferUsageFlagBits::eShaderDeviceAddressKHR)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    // Written by the host whenever a frame's descriptors change, and read by the GPU like a uniform
+    // buffer, so where the uniform ring goes as well. Its address has to be aligned like the
+    // offsets.
+    m_buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+
+    vk::MemoryRequirements requirements = m_device.getBufferMemoryRequirements(m_buffer);
+    requirements.alignment              = std::max(requirements.alignment, alignment);
+
+    m_memory = m_allocator->allocate(
+      requirements,
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::uniform,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_buffer, m_memory.memory, m_memory.offset);
+
+    auto addressinfo = vk::BufferDeviceAddressInfoKHR().setBuffer(m_buffer);
+    m_address        = m_buffer_address(
+      static_cast<VkDevice>(m_device),
+      reinterpret_cast<const VkBufferDeviceAddressInfo*>(&addressinfo));
+    return true;
+}
+#endif
+
+void
+descriptor_buffer::destroy()
+{
+    if (m_buffer) {
+        m_device.destroyBuffer(m_buffer, hostAllocator());
+        m_allocator->free(m_memory);
+        m_buffer = nullptr;
+    }
+    m_layouts.clear();
+    m_set_offsets.clear();
+    m_address = 0;
+}
+
+void
+descriptor_buffer::update(uint32_t                   frame,
+                          uint32_t                   set,
+                          const descriptor_template& layout,
+                          const descriptor_data*     data) const
+{
+    for (const descriptor_template::entry& e : layout.entries()) {
+        for (uint32_t i = 0; i < e.count; ++i) {
+            write(frame, set, e.binding, i, e.type, data[e.slot + i]);
+        }
+    }
+}
+
+void
+descriptor_buffer::writeImage(uint32_t                       frame,
+                              uint32_t                       set,
+                              uint32_t                       binding,
+                              uint32_t                       element,
+                              const vk::DescriptorImageInfo& image) const
+{
+    descriptor_data data;
+    data.image = image;
+    write(frame, set, binding, element, vk::DescriptorType::eCombinedImageSampler, data);
+}
+
+/*
+Both commands are recorded for every bind: binding descriptor sets the regular way in between, as
+the passes that don't use the buffer do, undoes the buffer's binding.
+*/
+void
+descriptor_buffer::bind(vk::CommandBuffer     command_buffer,
+                        vk::PipelineBindPoint bind_point,
+                        vk::PipelineLayout    layout,
+                        uint32_t              frame,
+                        uint32_t              count) const
+{
+#if defined(VK_EXT_descriptor_buffer)
+    auto bindinginfo =
+      vk::DescriptorBufferBindingInfoEXT().setAddress(m_address).setUsage(
+        vk::BufferUsageFlagBits::eResourceDescriptorBufferEXT
+        | vk::BufferUsageFlagBits::eSamplerDescriptorBufferEXT);
+    m_bind_buffers(static_cast<VkCommandBuffer>(command_buffer), 1,
+                   reinterpret_cast<const VkDescriptorBufferBindingInfoEXT*>(&bindinginfo));
+
+    const vk::DeviceSize base = (frame % m_frames) * m_frame_size;
+
+    // All of them in the one buffer
+    std::array<uint32_t, 4>       indices = {};
+    std::array<vk::DeviceSize, 4> offsets = {};
+    count = std::min({ count, (uint32_t)offsets.size(), (uint32_t)m_set_offsets.size() });
+    for (uint32_t set = 0; set < count; ++set) {
+        offsets[set] = base + m_set_offsets[set];
+    }
+    m_set_buffer_offsets(static_cast<VkCommandBuffer>(command_buffer),
+                         static_cast<VkPipelineBindPoint>(bind_point),
+                         static_cast<VkPipelineLayout>(layout), 0, count, indices.data(),
+                         offsets.data());
+#else
+    (void)command_buffer;
+    (void)bind_point;
+    (void)layout;
+    (void)frame;
+    (void)count;
+#endif
+}
+
+vk::DeviceSize
+descriptor_buffer::descriptorSize(vk::DescriptorType type) const
+{
+#if defined(VK_EXT_descriptor_buffer)
+    switch (type) {
+        case vk::DescriptorType::eSampler:
+            return m_properties.samplerDescriptorSize;
+        case vk::DescriptorType::eCombinedImageSampler:
+            return m_properties.combinedImageSamplerDescriptorSize;
+        case vk::DescriptorType::eSampledImage:
+            return m_properties.sampledImageDescriptorSize;
+        case vk::DescriptorType::eStorageImage:
+            return m_properties.storageImageDescriptorSize;
+        case vk::DescriptorType::eInputAttachment:
+            return m_properties.inputAttachmentDescriptorSize;
+        case vk::DescriptorType::eUniformBuffer:
+            return m_properties.uniformBufferDescriptorSize;
+        case vk::DescriptorType::eStorageBuffer:
+            return m_properties.storageBufferDescriptorSize;
+        default:
+            break;
+    }
+#endif
+    (void)type;
+    throw std::runtime_error("Descriptor buffers have no such descriptors!");
+}
+
+/*
+Buffers are described by their address rather than their handle, and their range can't be
+VK_WHOLE_SIZE. Images are described as they would be written to a set.
+*/
+void
+descriptor_buffer::write(uint32_t               frame,
+                         uint32_t               set,
+                         uint32_t               binding,
+                         uint32_t               element,
+                         vk::DescriptorType     type,
+                         const descriptor_data& data) const
+{
+#if defined(VK_EXT_descriptor_buffer)
+    vk::DeviceSize offset = 0;
+    m_binding_offset(static_cast<VkDevice>(m_device),
+                     static_cast<VkDescriptorSetLayout>(m_layouts[set]), binding, &offset);
+    offset += (frame % m_frames) * m_frame_size + m_set_offsets[set]
+              + element * descriptorSize(type);
+
+    vk::DescriptorAddressInfoEXT address;
+    auto                         getinfo = vk::DescriptorGetInfoEXT().setType(type);
+    switch (type) {
+        case vk::DescriptorType::eUniformBuffer:
+        case vk::DescriptorType::eStorageBuffer: {
+            auto addressinfo = vk::BufferDeviceAddressInfoKHR().setBuffer(data.buffer.buffer);
+            const vk::DeviceAddress start = m_buffer_address(
+              static_cast<VkDevice>(m_device),
+              reinterpret_cast<const VkBufferDeviceAddressInfo*>(&addressinfo));
+            address.setAddress(start + data.buffer.offset).setRange(data.buffer.range);
+            if (type == vk::DescriptorType::eUniformBuffer) {
+                getinfo.data.pUniformBuffer = &address;
+            } else {
+                getinfo.data.pStorageBuffer = &address;
+            }
+            break;
+        }
+        case vk::DescriptorType::eSampler:
+            getinfo.data.pSampler = &data.image.sampler;
+            break;
+        case vk::DescriptorType::eCombinedImageSampler:
+            getinfo.data.pCombinedImageSampler = &data.image;
+            break;
+        case vk::DescriptorType::eSampledImage:
+            getinfo.data.pSampledImage = &data.image;
+            break;
+        case vk::DescriptorType::eStorageImage:
+            getinfo.data.pStorageImage = &data.image;
+            break;
+        case vk::DescriptorType::eInputAttachment:
+            getinfo.data.pInputAttachmentImage = &data.image;
+            break;
+        default:
+            throw std::runtime_error("Descriptor buffers have no such descriptors!");
+    }
+
+    m_get_descriptor(static_cast<VkDevice>(m_device),
+                     reinterpret_cast<const VkDescriptorGetInfoEXT*>(&getinfo),
+                     (size_t)descriptorSize(type), static_cast<char*>(m_memory.mapped) + offset);
+#else
+    (void)frame;
+    (void)set;
+    (void)binding;
+    (void)element;
+    (void)type;
+    (void)data;
+#endif
+}
+
+}  // namespace shiny::graphics
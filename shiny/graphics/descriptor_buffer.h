@@ -0,0 +1,96 @@
+#pragma once
+
+#include "graphics/descriptor_template.h"
+#include "graphics/memory_allocator.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Descriptors written by the host straight into a mapped buffer with VK_EXT_descriptor_buffer,
+instead of into sets allocated from pools. Writing one is a vkGetDescriptorEXT into the buffer at
+its binding's offset, and binding a set is pointing the command buffer at an offset into the
+buffer, so neither goes through a driver object the way updating and binding a set does.
+
+Every frame in flight has a region of its own, holding a copy of each of the layouts given to
+init() one after the other, at offsets aligned as the device asks. Like a frame's sets, a frame's
+region may only be written once that frame's fence has signalled. Copy `i` is bound as set `i`.
+
+The layouts have to be created with eDescriptorBufferEXT and without dynamic descriptors, which
+descriptor buffers don't have: the buffers are written at the frame's own offsets instead. Arrays
+of combined image samplers are written as arrays of single descriptors, which needs
+combinedImageSamplerDescriptorSingleArray, see device_capabilities.
+*/
+class descriptor_buffer
+{
+public:
+    // Returns false, with nothing to destroy, where the regions of every frame would be out of the
+    // range a binding can reach, or the headers don't know the extension
+#if defined(VK_EXT_descriptor_buffer)
+    bool init(vk::Device                                             device,
+              memory_allocator&                                      allocator,
+              const vk::PhysicalDeviceDescriptorBufferPropertiesEXT& properties,
+              const std::vector<vk::DescriptorSetLayout>&            layouts,
+              uint32_t                                               frames);
+#endif
+    void destroy();
+
+    explicit operator bool() const { return static_cast<bool>(m_buffer); }
+
+    // Writes every descriptor of `frame`'s copy of layout `set`, from `data` laid out by `layout`
+    void update(uint32_t                   frame,
+                uint32_t                   set,
+                const descriptor_template& layout,
+                const descriptor_data*     data) const;
+
+    // Writes element `element` of a combined image sampler binding of `frame`'s copy of `set`
+    void writeImage(uint32_t                       frame,
+                    uint32_t                       set,
+                    uint32_t                       binding,
+                    uint32_t                       element,
+                    const vk::DescriptorImageInfo& image) const;
+
+    // Binds `frame`'s copies of the first `count` layouts as sets 0 to `count` - 1 of `layout`
+    void bind(vk::CommandBuffer     command_buffer,
+              vk::PipelineBindPoint bind_point,
+              vk::PipelineLayout    layout,
+              uint32_t              frame,
+              uint32_t              count) const;
+
+    vk::DeviceSize size() const { return m_frame_size * m_frames; }
+
+private:
+    vk::DeviceSize descriptorSize(vk::DescriptorType type) const;
+    void           write(uint32_t               frame,
+                         uint32_t               set,
+                         uint32_t               binding,
+                         uint32_t               element,
+                         vk::DescriptorType     type,
+                         const descriptor_data& data) const;
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::Buffer        m_buffer;
+    allocation        m_memory;
+    vk::DeviceAddress m_address = 0;
+
+    std::vector<vk::DescriptorSetLayout> m_layouts;
+    std::vector<vk::DeviceSize>          m_set_offsets;  // of each copy within a frame's region
+    vk::DeviceSize                       m_frame_size = 0;
+    uint32_t                             m_frames     = 0;
+
+#if defined(VK_EXT_descriptor_buffer)
+    vk::PhysicalDeviceDescriptorBufferPropertiesEXT m_properties;
+
+    PFN_vkGetDescriptorSetLayoutBindingOffsetEXT m_binding_offset     = nullptr;
+    PFN_vkGetDescriptorEXT                       m_get_descriptor     = nullptr;
+    PFN_vkCmdBindDescriptorBuffersEXT            m_bind_buffers       = nullptr;
+    PFN_vkCmdSetDescriptorBufferOffsetsEXT       m_set_buffer_offsets = nullptr;
+    PFN_vkGetBufferDeviceAddressKHR              m_buffer_address     = nullptr;
+#endif
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,166 @@
+#include "graphics/descriptor_template.h"
+
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace shiny::graphics {
+
+void
+descriptor_template::init(vk::Device                            device,
+                          vk::DescriptorSetLayout               layout,
+                          const vk::DescriptorSetLayoutBinding* bindings,
+                          uint32_t                              count,
+                          bool                                  templates)
+{
+    m_device = device;
+    m_size   = 0;
+    m_entries.clear();
+
+    for (uint32_t i = 0; i < count; ++i) {
+        entry e;
+        e.binding = bindings[i].binding;
+        e.count   = bindings[i].descriptorCount;
+        e.type    = bindings[i].descriptorType;
+        m_entries.push_back(e);
+    }
+    std::sort(m_entries.begin(), m_entries.end(),
+              [](const entry& a, const entry& b) { return a.binding < b.binding; });
+    for (entry& e : m_entries) {
+        e.slot = m_size;
+        m_size += e.count;
+    }
+
+#if defined(VK_KHR_descriptor_update_template)
+    if (!templates) {
+        return;
+    }
+
+    std::vector<vk::DescriptorUpdateTemplateEntryKHR> entries;
+    for (const entry& e : m_entries) {
+        entries.push_back(vk::DescriptorUpdateTemplateEntryKHR()
+                            .setDstBinding(e.binding)
+                            .setDstArrayElement(0)
+                            .setDescriptorCount(e.count)
+                            .setDescriptorType(e.type)
+                            .setOffset(e.slot * sizeof(descriptor_data))
+                            .setStride(sizeof(descriptor_data)));
+    }
+
+    auto createinfo = vk::DescriptorUpdateTemplateCreateInfoKHR()
+                        .setDescriptorUpdateEntryCount((uint32_t)entries.size())
+                        .setPDescriptorUpdateEntries(entries.data())
+                        .setTemplateType(vk::DescriptorUpdateTemplateType::eDescriptorSet)
+                        .setDescriptorSetLayout(layout);
+
+    // Extension commands aren't exported by the loader
+    auto create = (PFN_vkCreateDescriptorUpdateTemplateKHR)m_device.getProcAddr(
+      "vkCreateDescriptorUpdateTemplateKHR");
+    m_update = (PFN_vkUpdateDescriptorSetWithTemplateKHR)m_device.getProcAddr(
+      "vkUpdateDescriptorSetWithTemplateKHR");
+    m_destroy = (PFN_vkDestroyDescriptorUpdateTemplateKHR)m_device.getProcAddr(
+      "vkDestroyDescriptorUpdateTemplateKHR");
+
+    if (create(static_cast<VkDevice>(m_device),
+               reinterpret_cast<const VkDescriptorUpdateTemplateCreateInfoKHR*>(&createinfo),
+               hostAllocatorC(), &m_template)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor update template!");
+    }
+#else
+    (void)layout;
+    (void)templates;
+#endif
+}
+
+void
+descriptor_template::destroy()
+{
+#if defined(VK_KHR_descriptor_update_template)
+    if (m_template) {
+        m_destroy(static_cast<VkDevice>(m_device), m_template, hostAllocatorC());
+        m_template = VK_NULL_HANDLE;
+    }
+#endif
+    m_entries.clear();
+    m_size = 0;
+}
+
+uint32_t
+descriptor_template::slot(uint32_t binding) const
+{
+    for (const entry& e : m_entries) {
+        if (e.binding == binding) {
+            return e.slot;
+        }
+    }
+    throw std::runtime_error("Descriptor set layout has no such binding!");
+}
+
+/*
+The writes point at the elements one by one, since the image and buffer infos in a write's arrays
+are packed tightly, and texel buffer views are smaller than a descriptor_data. Acceleration
+structures go in a struct chained to their write instead, which has to stay put until the update.
+*/
+void
+descriptor_template::update(vk::DescriptorSet set, const descriptor_data* data) const
+{
+#if defined(VK_KHR_descriptor_update_template)
+    if (m_template) {
+        m_update(static_cast<VkDevice>(m_device), static_cast<VkDescriptorSet>(set), m_template,
+                 data);
+        return;
+    }
+#endif
+
+    std::vector<vk::WriteDescriptorSet> writes;
+    writes.reserve(m_size);
+#if defined(VK_KHR_acceleration_structure)
+    std::vector<vk::WriteDescriptorSetAccelerationStructureKHR> structures;
+    structures.reserve(m_size);
+#endif
+    for (const entry& e : m_entries) {
+        for (uint32_t i = 0; i < e.count; ++i) {
+            const descriptor_data& d = data[e.slot + i];
+
+            auto write = vk::WriteDescriptorSet()
+                           .setDstSet(set)
+                           .setDstBinding(e.binding)
+                           .setDstArrayElement(i)
+                           .setDescriptorCount(1)
+                           .setDescriptorType(e.type);
+            switch (e.type) {
+                case vk::DescriptorType::eSampler:
+                case vk::DescriptorType::eCombinedImageSampler:
+                case vk::DescriptorType::eSampledImage:
+                case vk::DescriptorType::eStorageImage:
+                case vk::DescriptorType::eInputAttachment:
+                    write.setPImageInfo(&d.image);
+                    break;
+                case vk::DescriptorType::eUniformTexelBuffer:
+                case vk::DescriptorType::eStorageTexelBuffer:
+                    write.setPTexelBufferView(&d.texel_buffer);
+                    break;
+#if defined(VK_KHR_acceleration_structure)
+                case vk::DescriptorType::eAccelerationStructureKHR:
+                    structures.emplace_back();
+                    structures.back().accelerationStructureCount = 1;
+                    structures.back().pAccelerationStructures =
+                      reinterpret_cast<const vk::AccelerationStructureKHR*>(
+                        &d.acceleration_structure);
+                    write.setPNext(&structures.back());
+                    break;
+#endif
+                default:
+                    write.setPBufferInfo(&d.buffer);
+                    break;
+            }
+            writes.push_back(write);
+        }
+    }
+
+    m_device.updateDescriptorSets(writes, nullptr);
+}
+
+}  // namespace shiny::graphics
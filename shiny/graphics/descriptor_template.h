@@ -0,0 +1,82 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+One descriptor of whichever type, so that everything written to a set is a single array of these,
+one per descriptor, that a descriptor_template reads at a fixed stride.
+*/
+union descriptor_data
+{
+    vk::DescriptorImageInfo  image;
+    vk::DescriptorBufferInfo buffer;
+    vk::BufferView           texel_buffer;
+#if defined(VK_KHR_acceleration_structure)
+    VkAccelerationStructureKHR acceleration_structure;
+#endif
+
+    descriptor_data()
+      : buffer()
+    {}
+};
+
+/*
+Writes every descriptor of a set of one layout in one call, from a descriptor_data array laid out
+by the layout's bindings, instead of a vk::WriteDescriptorSet per binding built up every time. With
+VK_KHR_descriptor_update_template that's a vkUpdateDescriptorSetWithTemplateKHR, which the driver
+can turn straight into copies, without looking at a write struct at all.
+
+Without the extension the writes are made from the same entries, so callers don't care which it is.
+Arrays take one slot per element; a large, sparsely written array like the bindless textures is
+better off with writes of its own.
+*/
+class descriptor_template
+{
+public:
+    struct entry
+    {
+        uint32_t           binding = 0;
+        uint32_t           slot    = 0;
+        uint32_t           count   = 0;
+        vk::DescriptorType type    = vk::DescriptorType::eSampler;
+    };
+
+    // `bindings` as `layout` was created with, `templates` with the extension enabled
+    void init(vk::Device                            device,
+              vk::DescriptorSetLayout               layout,
+              const vk::DescriptorSetLayoutBinding* bindings,
+              uint32_t                              count,
+              bool                                  templates);
+    void destroy();
+
+    // Where the elements of `binding` start in the data
+    uint32_t slot(uint32_t binding) const;
+    uint32_t size() const { return m_size; }
+
+    // `data` holds size() descriptors, and `set` mustn't be in use by the GPU
+    void update(vk::DescriptorSet set, const descriptor_data* data) const;
+
+    // By binding, for writing the data somewhere other than a set, see descriptor_buffer
+    const std::vector<entry>& entries() const { return m_entries; }
+
+private:
+    vk::Device         m_device;
+    std::vector<entry> m_entries;  // by binding
+    uint32_t           m_size = 0;
+
+#if defined(VK_KHR_descriptor_update_template)
+    VkDescriptorUpdateTemplateKHR            m_template = VK_NULL_HANDLE;
+    PFN_vkUpdateDescriptorSetWithTemplateKHR m_update   = nullptr;
+    PFN_vkDestroyDescriptorUpdateTemplateKHR m_destroy  = nullptr;
+#endif
+};
+
+}  // namespace shiny::graphics
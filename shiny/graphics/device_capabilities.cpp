@@ -0,0 +1,530 @@
+#include "graphics/device_capabilities.h"
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <utility>
+
+namespace shiny::graphics {
+
+/*
+All of the feature structs go into one vkGetPhysicalDeviceFeatures2KHR call, chained only for the
+extensions the device has, since drivers may not know the structs of the others.
+*/
+device_capabilities
+queryCapabilities(vk::Instance instance, vk::PhysicalDevice device, uint32_t instance_version)
+{
+    device_capabilities caps;
+
+    caps.core                = device.getFeatures();
+    caps.sampler_anisotropy  = caps.core.samplerAnisotropy;
+    caps.multi_draw_indirect = caps.core.multiDrawIndirect && caps.core.drawIndirectFirstInstance;
+    caps.fill_mode_non_solid = caps.core.fillModeNonSolid;
+    caps.pipeline_statistics = caps.core.pipelineStatisticsQuery;
+    caps.inherited_queries   = caps.pipeline_statistics && caps.core.inheritedQueries;
+    caps.fragment_stores     = caps.core.fragmentStoresAndAtomics;
+    caps.storage_no_format   = caps.core.shaderStorageImageWriteWithoutFormat;
+    caps.depth_bounds        = caps.core.depthBounds;
+
+    // Only there when the instance enabled VK_KHR_get_physical_device_properties2
+    auto getfeatures = (PFN_vkGetPhysicalDeviceFeatures2KHR)instance.getProcAddr(
+      "vkGetPhysicalDeviceFeatures2KHR");
+    auto getproperties = (PFN_vkGetPhysicalDeviceProperties2KHR)instance.getProcAddr(
+      "vkGetPhysicalDeviceProperties2KHR");
+    caps.features2 = getfeatures && getproperties;
+    if (!caps.features2) {
+        return caps;
+    }
+
+    std::set<std::string> extensions;
+    for (const vk::ExtensionProperties& extension : device.enumerateDeviceExtensionProperties()) {
+        extensions.insert(extension.extensionName);
+    }
+    auto has = [&](const char* name) { return extensions.count(name) != 0; };
+
+    // Every feature struct goes in front of the chain of the ones before it
+    void* chain = nullptr;
+    auto  push  = [&](auto& feature) {
+        feature.pNext = chain;
+        chain         = &feature;
+    };
+
+#if defined(VK_KHR_draw_indirect_count)
+    caps.draw_indirect_count = caps.multi_draw_indirect
+                               && has(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+#endif
+
+#if defined(VK_EXT_descriptor_indexing)
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexing;
+    const bool hasindexing = has(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)
+                             && has(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+    if (hasindexing) {
+        push(indexing);
+    }
+#endif
+#if defined(VK_KHR_timeline_semaphore)
+    vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR timeline;
+    if (has(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+        push(timeline);
+    }
+#endif
+#if defined(VK_KHR_present_wait)
+    vk::PhysicalDevicePresentIdFeaturesKHR   presentid;
+    vk::PhysicalDevicePresentWaitFeaturesKHR presentwait;
+    const bool haspresentwait =
+      has(VK_KHR_PRESENT_ID_EXTENSION_NAME) && has(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    if (haspresentwait) {
+        push(presentid);
+        push(presentwait);
+    }
+#endif
+#if defined(VK_KHR_buffer_device_address) && defined(VK_KHR_device_group)
+    // On Vulkan 1.0 it needs VK_KHR_device_group, and that VK_KHR_device_group_creation on the
+    // instance
+    vk::PhysicalDeviceBufferDeviceAddressFeaturesKHR address;
+    const bool hasaddress = has(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME)
+                            && has(VK_KHR_DEVICE_GROUP_EXTENSION_NAME)
+                            && instance.getProcAddr("vkEnumeratePhysicalDeviceGroupsKHR");
+    if (hasaddress) {
+        push(address);
+    }
+#endif
+#if defined(VK_EXT_descriptor_buffer) && defined(VK_KHR_synchronization2)
+    // On Vulkan 1.0 it needs VK_KHR_synchronization2 as well as device addresses and indexing
+    vk::PhysicalDeviceDescriptorBufferFeaturesEXT descriptorbuffer;
+    const bool hasdescriptorbuffer = has(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME)
+                                     && has(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+    if (hasdescriptorbuffer) {
+        push(descriptorbuffer);
+    }
+#endif
+#if defined(VK_KHR_16bit_storage)
+    vk::PhysicalDevice16BitStorageFeaturesKHR storage16;
+    const bool hasstorage16 = has(VK_KHR_16BIT_STORAGE_EXTENSION_NAME)
+                              && has(VK_KHR_STORAGE_BUFFER_STORAGE_CLASS_EXTENSION_NAME);
+    if (hasstorage16) {
+        push(storage16);
+    }
+#endif
+#if defined(VK_KHR_shader_float16_int8)
+    vk::PhysicalDeviceShaderFloat16Int8FeaturesKHR float16;
+    const bool hasfloat16 = has(VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME);
+    if (hasfloat16) {
+        push(float16);
+    }
+#endif
+#if defined(VK_EXT_image_compression_control)
+    vk::PhysicalDeviceImageCompressionControlFeaturesEXT compression;
+    const bool hascompression = has(VK_EXT_IMAGE_COMPRESSION_CONTROL_EXTENSION_NAME);
+    if (hascompression) {
+        push(compression);
+    }
+#endif
+#if defined(VK_EXT_image_compression_control_swapchain)
+    vk::PhysicalDeviceImageCompressionControlSwapchainFeaturesEXT swapchaincompression;
+    const bool hasswapchaincompression =
+      has(VK_EXT_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN_EXTENSION_NAME);
+    if (hasswapchaincompression) {
+        push(swapchaincompression);
+    }
+#endif
+#if defined(VK_EXT_graphics_pipeline_library)
+    vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT pipelinelibrary;
+    const bool haspipelinelibrary = has(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME)
+                                    && has(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+    if (haspipelinelibrary) {
+        push(pipelinelibrary);
+    }
+#endif
+#if defined(VK_KHR_dynamic_rendering)
+    // On Vulkan 1.0 it needs VK_KHR_depth_stencil_resolve, which needs the other three
+    vk::PhysicalDeviceDynamicRenderingFeaturesKHR dynamicrendering;
+    const bool hasdynamicrendering = has(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)
+                                     && has(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME)
+                                     && has(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME)
+                                     && has(VK_KHR_MULTIVIEW_EXTENSION_NAME)
+                                     && has(VK_KHR_MAINTENANCE2_EXTENSION_NAME);
+    if (hasdynamicrendering) {
+        push(dynamicrendering);
+    }
+#endif
+#if defined(VK_KHR_multiview)
+    vk::PhysicalDeviceMultiviewFeaturesKHR multiview;
+    if (has(VK_KHR_MULTIVIEW_EXTENSION_NAME)) {
+        push(multiview);
+    }
+#endif
+#if defined(VK_KHR_fragment_shading_rate)
+    // On Vulkan 1.0 it needs VK_KHR_create_renderpass2, and that the other two
+    vk::PhysicalDeviceFragmentShadingRateFeaturesKHR shadingrate;
+    const bool hasshadingrate = has(VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME)
+                                && has(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME)
+                                && has(VK_KHR_MULTIVIEW_EXTENSION_NAME)
+                                && has(VK_KHR_MAINTENANCE2_EXTENSION_NAME);
+    if (hasshadingrate) {
+        push(shadingrate);
+    }
+#endif
+#if defined(VK_EXT_conditional_rendering)
+    vk::PhysicalDeviceConditionalRenderingFeaturesEXT conditionalrendering;
+    if (has(VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME)) {
+        push(conditionalrendering);
+    }
+#endif
+#if defined(VK_KHR_performance_query) && defined(VK_EXT_host_query_reset)
+    vk::PhysicalDevicePerformanceQueryFeaturesKHR performancequery;
+    vk::PhysicalDeviceHostQueryResetFeaturesEXT   hostqueryreset;
+    const bool hasperformancequery = has(VK_KHR_PERFORMANCE_QUERY_EXTENSION_NAME)
+                                     && has(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME);
+    if (hasperformancequery) {
+        push(performancequery);
+        push(hostqueryreset);
+    }
+#endif
+#if defined(VK_KHR_acceleration_structure) && defined(VK_KHR_ray_query)
+    // SPIR-V 1.4, which ray query shaders are, only goes with Vulkan 1.1
+    vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelerationstructure;
+    vk::PhysicalDeviceRayQueryFeaturesKHR              rayquery;
+    const bool hasrayquery = instance_version >= VK_API_VERSION_1_1
+                             && device.getProperties().apiVersion >= VK_API_VERSION_1_1
+                             && has(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME)
+                             && has(VK_KHR_RAY_QUERY_EXTENSION_NAME)
+                             && has(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME)
+                             && has(VK_KHR_SPIRV_1_4_EXTENSION_NAME)
+                             && has(VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME);
+    if (hasrayquery) {
+        push(accelerationstructure);
+        push(rayquery);
+    }
+#else
+    (void)instance_version;
+#endif
+
+    vk::PhysicalDeviceFeatures2 features;
+    features.pNext = chain;
+    getfeatures(static_cast<VkPhysicalDevice>(device),
+                reinterpret_cast<VkPhysicalDeviceFeatures2*>(&features));
+
+#if defined(VK_EXT_descriptor_indexing)
+    if (hasindexing) {
+        caps.descriptor_indexing = indexing.shaderSampledImageArrayNonUniformIndexing
+                                   && indexing.descriptorBindingSampledImageUpdateAfterBind
+                                   && indexing.descriptorBindingPartiallyBound
+                                   && indexing.runtimeDescriptorArray;
+    }
+
+    if (caps.descriptor_indexing) {
+        vk::PhysicalDeviceDescriptorIndexingPropertiesEXT limits;
+        vk::PhysicalDeviceProperties2                     properties;
+        properties.pNext = &limits;
+        getproperties(static_cast<VkPhysicalDevice>(device),
+                      reinterpret_cast<VkPhysicalDeviceProperties2*>(&properties));
+
+        caps.update_after_bind_textures =
+          std::min({ limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+                     limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                     limits.maxDescriptorSetUpdateAfterBindSamplers,
+                     limits.maxDescriptorSetUpdateAfterBindSampledImages });
+    }
+#endif
+#if defined(VK_KHR_timeline_semaphore)
+    caps.timeline_semaphores = has(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)
+                               && timeline.timelineSemaphore;
+#endif
+#if defined(VK_KHR_present_wait)
+    caps.present_wait = haspresentwait && presentid.presentId && presentwait.presentWait;
+#endif
+#if defined(VK_EXT_memory_budget)
+    caps.memory_budget = has(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+#endif
+#if defined(VK_KHR_descriptor_update_template)
+    caps.descriptor_update_template = has(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+#endif
+#if defined(VK_KHR_device_group)
+    caps.device_group = has(VK_KHR_DEVICE_GROUP_EXTENSION_NAME)
+                        && instance.getProcAddr("vkEnumeratePhysicalDeviceGroupsKHR");
+#endif
+#if defined(VK_KHR_buffer_device_address) && defined(VK_KHR_device_group)
+    caps.buffer_device_address = hasaddress && address.bufferDeviceAddress;
+#endif
+#if defined(VK_EXT_descriptor_buffer) && defined(VK_KHR_synchronization2)
+    if (hasdescriptorbuffer && descriptorbuffer.descriptorBuffer && caps.buffer_device_address
+        && caps.descriptor_indexing) {
+        vk::PhysicalDeviceProperties2 properties;
+        properties.pNext = &caps.descriptor_buffer_properties;
+        getproperties(static_cast<VkPhysicalDevice>(device),
+                      reinterpret_cast<VkPhysicalDeviceProperties2*>(&properties));
+        caps.descriptor_buffer_properties.pNext = nullptr;
+
+        // Otherwise every array of them is split into its images and its samplers
+        caps.descriptor_buffer =
+          caps.descriptor_buffer_properties.combinedImageSamplerDescriptorSingleArray;
+    }
+#endif
+#if defined(VK_KHR_16bit_storage)
+    caps.storage_16bit = hasstorage16 && storage16.storageBuffer16BitAccess;
+#endif
+#if defined(VK_KHR_shader_float16_int8)
+    caps.shader_float16 = hasfloat16 && float16.shaderFloat16;
+#endif
+#if defined(VK_EXT_image_compression_control)
+    caps.image_compression_control = hascompression && compression.imageCompressionControl;
+#endif
+#if defined(VK_EXT_image_compression_control_swapchain)
+    caps.swapchain_compression_control =
+      caps.image_compression_control && hasswapchaincompression
+      && swapchaincompression.imageCompressionControlSwapchain;
+#endif
+#if defined(VK_EXT_graphics_pipeline_library)
+    // Without fast linking a variant takes as long to link as it would to compile whole
+    if (haspipelinelibrary && pipelinelibrary.graphicsPipelineLibrary) {
+        vk::PhysicalDeviceGraphicsPipelineLibraryPropertiesEXT library;
+        vk::PhysicalDeviceProperties2                          properties;
+        properties.pNext = &library;
+        getproperties(static_cast<VkPhysicalDevice>(device),
+                      reinterpret_cast<VkPhysicalDeviceProperties2*>(&properties));
+
+        caps.graphics_pipeline_library = library.graphicsPipelineLibraryFastLinking;
+    }
+#endif
+#if defined(VK_KHR_dynamic_rendering)
+    caps.dynamic_rendering = hasdynamicrendering && dynamicrendering.dynamicRendering;
+#endif
+#if defined(VK_KHR_multiview)
+    caps.multiview = has(VK_KHR_MULTIVIEW_EXTENSION_NAME) && multiview.multiview;
+#endif
+#if defined(VK_KHR_fragment_shading_rate)
+    caps.fragment_shading_rate = hasshadingrate && shadingrate.pipelineFragmentShadingRate;
+    caps.attachment_shading_rate =
+      caps.fragment_shading_rate && shadingrate.attachmentFragmentShadingRate;
+
+    if (caps.fragment_shading_rate) {
+        vk::PhysicalDeviceFragmentShadingRatePropertiesKHR rates;
+        vk::PhysicalDeviceProperties2                      properties;
+        properties.pNext = &rates;
+        getproperties(static_cast<VkPhysicalDevice>(device),
+                      reinterpret_cast<VkPhysicalDeviceProperties2*>(&properties));
+
+        caps.shading_rate_combiners = rates.fragmentShadingRateNonTrivialCombinerOps;
+        caps.max_fragment_size      = rates.maxFragmentSize;
+        caps.min_shading_rate_texel = rates.minFragmentShadingRateAttachmentTexelSize;
+        caps.max_shading_rate_texel = rates.maxFragmentShadingRateAttachmentTexelSize;
+    }
+#endif
+#if defined(VK_EXT_conditional_rendering)
+    caps.conditional_rendering = has(VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME)
+                                 && conditionalrendering.conditionalRendering;
+#endif
+#if defined(VK_KHR_performance_query) && defined(VK_EXT_host_query_reset)
+    caps.performance_query = hasperformancequery && performancequery.performanceCounterQueryPools
+                             && hostqueryreset.hostQueryReset;
+#endif
+#if defined(VK_KHR_acceleration_structure) && defined(VK_KHR_ray_query)
+    caps.ray_query = hasrayquery && accelerationstructure.accelerationStructure
+                     && rayquery.rayQuery && caps.buffer_device_address
+                     && caps.descriptor_indexing;
+#endif
+
+    return caps;
+}
+
+device_feature_chain::device_feature_chain(const device_capabilities& enabled,
+                                           std::vector<const char*>   extensions)
+  : m_extensions(std::move(extensions))
+{
+    // Block compressed formats may only be used with their feature enabled, so whichever families
+    // the device has are all turned on
+    m_features.setSamplerAnisotropy(enabled.sampler_anisotropy)
+      .setMultiDrawIndirect(enabled.multi_draw_indirect)
+      .setDrawIndirectFirstInstance(enabled.multi_draw_indirect)
+      .setFillModeNonSolid(enabled.fill_mode_non_solid)
+      .setPipelineStatisticsQuery(enabled.pipeline_statistics)
+      .setInheritedQueries(enabled.inherited_queries)
+      .setFragmentStoresAndAtomics(enabled.fragment_stores)
+      .setShaderStorageImageWriteWithoutFormat(enabled.storage_no_format)
+      .setDepthBounds(enabled.depth_bounds)
+      .setTextureCompressionBC(enabled.core.textureCompressionBC)
+      .setTextureCompressionETC2(enabled.core.textureCompressionETC2)
+      .setTextureCompressionASTC_LDR(enabled.core.textureCompressionASTC_LDR);
+
+#if defined(VK_KHR_draw_indirect_count)
+    if (enabled.draw_indirect_count) {
+        m_extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
+#endif
+#if defined(VK_EXT_descriptor_indexing)
+    if (enabled.descriptor_indexing) {
+        m_extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        m_extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+        m_indexing.setShaderSampledImageArrayNonUniformIndexing(true)
+          .setDescriptorBindingSampledImageUpdateAfterBind(true)
+          .setDescriptorBindingPartiallyBound(true)
+          .setRuntimeDescriptorArray(true);
+        push(m_indexing);
+    }
+#endif
+#if defined(VK_KHR_timeline_semaphore)
+    if (enabled.timeline_semaphores) {
+        m_extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+
+        m_timeline.setTimelineSemaphore(true);
+        push(m_timeline);
+    }
+#endif
+#if defined(VK_KHR_present_wait)
+    if (enabled.present_wait) {
+        m_extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+
+        m_present_id.setPresentId(true);
+        m_present_wait.setPresentWait(true);
+        push(m_present_wait);
+        push(m_present_id);
+    }
+#endif
+#if defined(VK_EXT_memory_budget)
+    if (enabled.memory_budget) {
+        m_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+#endif
+#if defined(VK_KHR_descriptor_update_template)
+    if (enabled.descriptor_update_template) {
+        m_extensions.push_back(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME);
+    }
+#endif
+#if defined(VK_KHR_device_group)
+    // Which buffer device addresses need as well
+    if (enabled.device_group || enabled.buffer_device_address) {
+        m_extensions.push_back(VK_KHR_DEVICE_GROUP_EXTENSION_NAME);
+    }
+#endif
+#if defined(VK_KHR_buffer_device_address) && defined(VK_KHR_device_group)
+    if (enabled.buffer_device_address) {
+        m_extensions.push_back(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+
+        m_device_address.setBufferDeviceAddress(true);
+        push(m_device_address);
+    }
+#endif
+#if defined(VK_EXT_descriptor_buffer) && defined(VK_KHR_synchronization2)
+    if (enabled.descriptor_buffer) {
+        m_extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+        m_extensions.push_back(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+
+        m_descriptor_buffer.setDescriptorBuffer(true);
+        push(m_descriptor_buffer);
+    }
+#endif
+#if defined(VK_KHR_16bit_storage)
+    if (enabled.storage_16bit) {
+        m_extensions.push_back(VK_KHR_STORAGE_BUFFER_STORAGE_CLASS_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_16BIT_STORAGE_EXTENSION_NAME);
+
+        m_storage_16bit.setStorageBuffer16BitAccess(true);
+        push(m_storage_16bit);
+    }
+#endif
+#if defined(VK_KHR_shader_float16_int8)
+    if (enabled.shader_float16) {
+        m_extensions.push_back(VK_KHR_SHADER_FLOAT16_INT8_EXTENSION_NAME);
+
+        m_float16.setShaderFloat16(true);
+        push(m_float16);
+    }
+#endif
+#if defined(VK_EXT_image_compression_control)
+    if (enabled.image_compression_control) {
+        m_extensions.push_back(VK_EXT_IMAGE_COMPRESSION_CONTROL_EXTENSION_NAME);
+
+        m_compression.setImageCompressionControl(true);
+        push(m_compression);
+    }
+#endif
+#if defined(VK_EXT_image_compression_control_swapchain)
+    if (enabled.swapchain_compression_control) {
+        m_extensions.push_back(VK_EXT_IMAGE_COMPRESSION_CONTROL_SWAPCHAIN_EXTENSION_NAME);
+
+        m_swapchain_compression.setImageCompressionControlSwapchain(true);
+        push(m_swapchain_compression);
+    }
+#endif
+#if defined(VK_EXT_graphics_pipeline_library)
+    if (enabled.graphics_pipeline_library) {
+        m_extensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+        m_extensions.push_back(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+
+        m_pipeline_library.setGraphicsPipelineLibrary(true);
+        push(m_pipeline_library);
+    }
+#endif
+#if defined(VK_KHR_dynamic_rendering)
+    if (enabled.dynamic_rendering) {
+        m_extensions.push_back(VK_KHR_MAINTENANCE2_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+
+        m_dynamic_rendering.setDynamicRendering(true);
+        push(m_dynamic_rendering);
+    }
+#endif
+#if defined(VK_KHR_fragment_shading_rate)
+    if (enabled.fragment_shading_rate) {
+        if (!enabled.dynamic_rendering) {
+            m_extensions.push_back(VK_KHR_MAINTENANCE2_EXTENSION_NAME);
+            m_extensions.push_back(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+        }
+        m_extensions.push_back(VK_KHR_FRAGMENT_SHADING_RATE_EXTENSION_NAME);
+
+        m_shading_rate.setPipelineFragmentShadingRate(true).setAttachmentFragmentShadingRate(
+          enabled.attachment_shading_rate);
+        push(m_shading_rate);
+    }
+#endif
+#if defined(VK_EXT_conditional_rendering)
+    if (enabled.conditional_rendering) {
+        m_extensions.push_back(VK_EXT_CONDITIONAL_RENDERING_EXTENSION_NAME);
+
+        m_conditional_rendering.setConditionalRendering(true);
+        push(m_conditional_rendering);
+    }
+#endif
+#if defined(VK_KHR_performance_query) && defined(VK_EXT_host_query_reset)
+    if (enabled.performance_query) {
+        m_extensions.push_back(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_PERFORMANCE_QUERY_EXTENSION_NAME);
+
+        m_performance_query.setPerformanceCounterQueryPools(true);
+        m_host_query_reset.setHostQueryReset(true);
+        push(m_host_query_reset);
+        push(m_performance_query);
+    }
+#endif
+#if defined(VK_KHR_multiview)
+    // Which dynamic rendering and fragment shading rates need as well
+    if (enabled.multiview || enabled.dynamic_rendering || enabled.fragment_shading_rate) {
+        m_extensions.push_back(VK_KHR_MULTIVIEW_EXTENSION_NAME);
+    }
+    if (enabled.multiview) {
+        m_multiview.setMultiview(true);
+        push(m_multiview);
+    }
+#endif
+#if defined(VK_KHR_acceleration_structure) && defined(VK_KHR_ray_query)
+    if (enabled.ray_query) {
+        m_extensions.push_back(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_SPIRV_1_4_EXTENSION_NAME);
+        m_extensions.push_back(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+
+        m_acceleration_structure.setAccelerationStructure(true);
+        m_ray_query.setRayQuery(true);
+        push(m_acceleration_structure);
+        push(m_ray_query);
+    }
+#endif
+}
+
+}  // namespace shiny::graphics
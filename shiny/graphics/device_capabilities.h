@@ -0,0 +1,201 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+The optional features and extensions the renderer has a faster path for, rather than needs. Queried
+once for the picked device, then whatever the renderer doesn't want is turned off and the rest gets
+enabled by a device_feature_chain, so that after device creation it says what is actually enabled
+and subsystems decide by it.
+
+The instance is Vulkan 1.0, or 1.1 where the loader has it, and everything past the core features
+is queried through VK_KHR_get_physical_device_properties2 either way, and without it none of the
+extensions are used. Only ray queries need 1.1. Every extension is only looked for where the
+headers know about it.
+*/
+struct device_capabilities
+{
+    vk::PhysicalDeviceFeatures core;  // as supported, for the texture compression families
+
+    bool sampler_anisotropy  = false;  // required
+    bool multi_draw_indirect = false;  // and drawIndirectFirstInstance
+    bool fill_mode_non_solid = false;
+    bool pipeline_statistics = false;
+    bool inherited_queries   = false;  // with pipeline_statistics
+    bool fragment_stores     = false;  // storage buffer writes and atomics in fragment shaders
+    bool storage_no_format   = false;  // shaderStorageImageWriteWithoutFormat
+    bool depth_bounds        = false;
+
+    bool features2 = false;  // VK_KHR_get_physical_device_properties2 on the instance
+
+    bool draw_indirect_count = false;
+
+    // Partially bound, non-uniformly indexed sampled image arrays that are updated after binding,
+    // and as many of them per stage and set as the update-after-bind limits allow
+    bool     descriptor_indexing        = false;
+    uint32_t update_after_bind_textures = 0;
+
+    bool timeline_semaphores = false;
+    bool present_wait        = false;  // VK_KHR_present_id and VK_KHR_present_wait
+    bool memory_budget       = false;
+
+    // bufferDeviceAddress, for buffers that shaders reach through pointers
+    bool buffer_device_address = false;
+
+    // VK_EXT_descriptor_buffer, descriptors written into buffers by the host and bound by offset,
+    // along with buffer_device_address and descriptor_indexing, which it needs. Only where arrays
+    // of combined image samplers are laid out like any other array, see descriptor_buffer.
+    bool descriptor_buffer = false;
+#if defined(VK_EXT_descriptor_buffer)
+    vk::PhysicalDeviceDescriptorBufferPropertiesEXT descriptor_buffer_properties;  // no pNext
+#endif
+
+    // storageBuffer16BitAccess, for storage buffers of halves and shorts
+    bool storage_16bit = false;
+
+    // VK_KHR_shader_float16_int8's shaderFloat16, for half precision arithmetic in the shaders
+    bool shader_float16 = false;
+
+    // VK_EXT_image_compression_control, for asking images for fixed-rate compression and finding
+    // out what compression they would get, and VK_EXT_image_compression_control_swapchain, for
+    // the swap chain's images too
+    bool image_compression_control     = false;
+    bool swapchain_compression_control = false;
+
+    // VK_EXT_graphics_pipeline_library, only where linking without optimizing is fast too
+    bool graphics_pipeline_library = false;
+
+    // VK_KHR_dynamic_rendering, drawing without render pass and framebuffer objects
+    bool dynamic_rendering = false;
+
+    // VK_KHR_multiview, rendering into several layers at once with the view index in the shaders
+    bool multiview = false;
+
+    // VK_KHR_fragment_shading_rate: pipelineFragmentShadingRate, for a rate set with every draw,
+    // and attachmentFragmentShadingRate, for rates read from an image over the framebuffer. The
+    // rest is only queried along with them.
+    bool         fragment_shading_rate   = false;
+    bool         attachment_shading_rate = false;
+    bool         shading_rate_combiners  = false;  // fragmentShadingRateNonTrivialCombinerOps
+    vk::Extent2D max_fragment_size;                // the coarsest rate, in pixels
+    vk::Extent2D min_shading_rate_texel;           // the pixels a texel of the image may cover
+    vk::Extent2D max_shading_rate_texel;
+
+    // VK_EXT_conditional_rendering, for draws the GPU skips by a value in a buffer
+    bool conditional_rendering = false;
+
+    // VK_KHR_descriptor_update_template, for writing a whole set in one call
+    bool descriptor_update_template = false;
+
+    // VK_KHR_device_group, for driving the GPUs of a device group as one device. Enabling it takes
+    // the group's devices being chained into the device's creation as well, see renderer.
+    bool device_group = false;
+
+    // VK_KHR_performance_query's performanceCounterQueryPools, for the GPU's hardware counters,
+    // with VK_EXT_host_query_reset's hostQueryReset, since performance queries can't be reset in
+    // the command buffer that uses them
+    bool performance_query = false;
+
+    // VK_KHR_acceleration_structure and VK_KHR_ray_query, for tracing rays from any shader, with
+    // the extensions they need. Only on a Vulkan 1.1 instance and device, and along with
+    // buffer_device_address and descriptor_indexing, which the structures are built through.
+    bool ray_query = false;
+};
+
+// `instance_version` is the API version the instance was created with
+device_capabilities queryCapabilities(vk::Instance       instance,
+                                      vk::PhysicalDevice device,
+                                      uint32_t           instance_version);
+
+/*
+The extensions and feature structs that enable `enabled` when creating a device, on top of
+`extensions`, which the caller needs anyway. What `enabled` asks for has to be supported. Points
+into itself, so it stays where it was constructed until the device is created.
+*/
+class device_feature_chain
+{
+public:
+    device_feature_chain(const device_capabilities& enabled, std::vector<const char*> extensions);
+
+    device_feature_chain(const device_feature_chain&) = delete;
+    device_feature_chain& operator=(const device_feature_chain&) = delete;
+
+    const vk::PhysicalDeviceFeatures* features() const { return &m_features; }
+    const std::vector<const char*>&   extensions() const { return m_extensions; }
+    const void*                       next() const { return m_next; }
+
+private:
+    // Every optional feature struct goes in front of the chain of the ones before it
+    template<typename feature>
+    void push(feature& f)
+    {
+        f.pNext = m_next;
+        m_next  = &f;
+    }
+
+    vk::PhysicalDeviceFeatures m_features;
+    std::vector<const char*>   m_extensions;
+    void*                      m_next = nullptr;
+
+#if defined(VK_EXT_descriptor_indexing)
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT m_indexing;
+#endif
+#if defined(VK_KHR_timeline_semaphore)
+    vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR m_timeline;
+#endif
+#if defined(VK_KHR_present_wait)
+    vk::PhysicalDevicePresentIdFeaturesKHR   m_present_id;
+    vk::PhysicalDevicePresentWaitFeaturesKHR m_present_wait;
+#endif
+#if defined(VK_KHR_buffer_device_address)
+    vk::PhysicalDeviceBufferDeviceAddressFeaturesKHR m_device_address;
+#endif
+#if defined(VK_EXT_descriptor_buffer)
+    vk::PhysicalDeviceDescriptorBufferFeaturesEXT m_descriptor_buffer;
+#endif
+#if defined(VK_KHR_16bit_storage)
+    vk::PhysicalDevice16BitStorageFeaturesKHR m_storage_16bit;
+#endif
+#if defined(VK_KHR_shader_float16_int8)
+    vk::PhysicalDeviceShaderFloat16Int8FeaturesKHR m_float16;
+#endif
+#if defined(VK_EXT_image_compression_control)
+    vk::PhysicalDeviceImageCompressionControlFeaturesEXT m_compression;
+#endif
+#if defined(VK_EXT_image_compression_control_swapchain)
+    vk::PhysicalDeviceImageCompressionControlSwapchainFeaturesEXT m_swapchain_compression;
+#endif
+#if defined(VK_EXT_graphics_pipeline_library)
+    vk::PhysicalDeviceGraphicsPipelineLibraryFeaturesEXT m_pipeline_library;
+#endif
+#if defined(VK_KHR_dynamic_rendering)
+    vk::PhysicalDeviceDynamicRenderingFeaturesKHR m_dynamic_rendering;
+#endif
+#if defined(VK_KHR_multiview)
+    vk::PhysicalDeviceMultiviewFeaturesKHR m_multiview;
+#endif
+#if defined(VK_KHR_fragment_shading_rate)
+    vk::PhysicalDeviceFragmentShadingRateFeaturesKHR m_shading_rate;
+#endif
+#if defined(VK_EXT_conditional_rendering)
+    vk::PhysicalDeviceConditionalRenderingFeaturesEXT m_conditional_rendering;
+#endif
+#if defined(VK_KHR_performance_query) && defined(VK_EXT_host_query_reset)
+    vk::PhysicalDevicePerformanceQueryFeaturesKHR m_performance_query;
+    vk::PhysicalDeviceHostQueryResetFeaturesEXT   m_host_query_reset;
+#endif
+#if defined(VK_KHR_acceleration_structure) && defined(VK_KHR_ray_query)
+    vk::PhysicalDeviceAccelerationStructureFeaturesKHR m_acceleration_structure;
+    vk::PhysicalDeviceRayQueryFeaturesKHR              m_ray_query;
+#endif
+};
+
+}  // namespace shiny::graphics
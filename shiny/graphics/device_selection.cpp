@@ -0,0 +1,185 @@
+#include "graphics/device_selection.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+namespace {
+
+// By name rather than by their macros, so that headers without them still count them
+const char* const optional_extensions[] = {
+    "VK_EXT_descriptor_indexing", "VK_KHR_timeline_semaphore", "VK_KHR_draw_indirect_count",
+    "VK_EXT_mesh_shader",         "VK_NV_mesh_shader",
+};
+
+uint64_t
+typeRank(vk::PhysicalDeviceType type)
+{
+    switch (type) {
+    case vk::PhysicalDeviceType::eDiscreteGpu:
+        return 4;
+    case vk::PhysicalDeviceType::eIntegratedGpu:
+        return 3;
+    case vk::PhysicalDeviceType::eVirtualGpu:
+        return 2;
+    case vk::PhysicalDeviceType::eCpu:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+std::string
+lowercase(std::string text)
+{
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    return text;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+bool
+device_preference::matches(const vk::PhysicalDeviceProperties& properties, uint32_t position) const
+{
+    if (index >= 0 && (uint32_t)index != position) {
+        return false;
+    }
+    if (vendor_id != 0 && properties.vendorID != vendor_id) {
+        return false;
+    }
+    return name.empty()
+           || lowercase(properties.deviceName).find(lowercase(name)) != std::string::npos;
+}
+
+device_preference
+parseDevicePreference(const std::string& value)
+{
+    device_preference preference;
+    if (value.empty()) {
+        return preference;
+    }
+
+    if (value[0] == '#') {
+        char*               end      = nullptr;
+        const unsigned long position = std::strtoul(value.c_str() + 1, &end, 10);
+        if (end != value.c_str() + 1 && *end == '\0') {
+            preference.index = (int32_t)position;
+            return preference;
+        }
+    }
+
+    // Anything that isn't entirely a number is a name, "0x" for hexadecimal
+    char*               end = nullptr;
+    const unsigned long id  = std::strtoul(value.c_str(), &end, 0);
+    if (*end == '\0' && id != 0) {
+        preference.vendor_id = (uint32_t)id;
+    } else {
+        preference.name = value;
+    }
+    return preference;
+}
+
+device_preference
+environmentDevicePreference()
+{
+    const char* value = std::getenv("SHINY_DEVICE");
+    return parseDevicePreference(value ? value : "");
+}
+
+device_score
+scoreDevice(vk::PhysicalDevice device)
+{
+    device_score score;
+    score.properties = device.getProperties();
+
+    std::set<std::string> extensions;
+    for (const vk::ExtensionProperties& extension : device.enumerateDeviceExtensionProperties()) {
+        extensions.insert(extension.extensionName);
+    }
+    for (const char* extension : optional_extensions) {
+        score.features += extensions.count(extension) ? 1 : 0;
+    }
+
+    const vk::PhysicalDeviceFeatures features = device.getFeatures();
+    score.features += features.multiDrawIndirect && features.drawIndirectFirstInstance ? 1 : 0;
+
+    // Integrated GPUs call some of system memory device local, and have nothing else
+    const vk::PhysicalDeviceMemoryProperties memory = device.getMemoryProperties();
+    for (uint32_t i = 0; i < memory.memoryHeapCount; ++i) {
+        if (memory.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+            score.local_heap = std::max(score.local_heap, memory.memoryHeaps[i].size);
+        }
+    }
+
+    // Kind in the top 8 bits, features in the next 8, heap MiB in the next 32 and the largest
+    // image in the last 16
+    const uint64_t heapmib = std::min<uint64_t>(score.local_heap >> 20, 0xffffffff);
+    const uint64_t image =
+      std::min<uint64_t>(score.properties.limits.maxImageDimension2D, 0xffff);
+
+    score.total = typeRank(score.properties.deviceType) << 56 | (uint64_t)score.features << 48
+                  | heapmib << 16 | image;
+    return score;
+}
+
+const char*
+deviceTypeName(vk::PhysicalDeviceType type)
+{
+    switch (type) {
+    case vk::PhysicalDeviceType::eDiscreteGpu:
+        return "discrete";
+    case vk::PhysicalDeviceType::eIntegratedGpu:
+        return "integrated";
+    case vk::PhysicalDeviceType::eVirtualGpu:
+        return "virtual";
+    case vk::PhysicalDeviceType::eCpu:
+        return "cpu";
+    default:
+        return "other";
+    }
+}
+
+std::vector<vk::PhysicalDevice>
+deviceGroup(vk::Instance instance, vk::PhysicalDevice device)
+{
+    std::vector<vk::PhysicalDevice> group = { device };
+
+#if defined(VK_KHR_device_group_creation)
+    // Only there when the instance enabled VK_KHR_device_group_creation
+    auto enumerate = (PFN_vkEnumeratePhysicalDeviceGroupsKHR)instance.getProcAddr(
+      "vkEnumeratePhysicalDeviceGroupsKHR");
+    if (!enumerate) {
+        return group;
+    }
+
+    uint32_t count = 0;
+    if (enumerate(static_cast<VkInstance>(instance), &count, nullptr) != VK_SUCCESS) {
+        return group;
+    }
+
+    VkPhysicalDeviceGroupPropertiesKHR properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES_KHR;
+    std::vector<VkPhysicalDeviceGroupPropertiesKHR> groups(count, properties);
+    if (enumerate(static_cast<VkInstance>(instance), &count, groups.data()) != VK_SUCCESS) {
+        return group;
+    }
+
+    for (const VkPhysicalDeviceGroupPropertiesKHR& g : groups) {
+        const VkPhysicalDevice* first = g.physicalDevices;
+        const VkPhysicalDevice* last  = first + g.physicalDeviceCount;
+        if (std::find(first, last, static_cast<VkPhysicalDevice>(device)) != last) {
+            group.assign(first, last);
+            break;
+        }
+    }
+#endif
+
+    return group;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,66 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Which GPU to use regardless of the scores, from the SHINY_DEVICE environment variable or the
+command line: either a vendor ID ("0x10de", "4318"), part of the device's name ("radeon"),
+ignoring case, or "#" and its position in the order the devices are enumerated in ("#1" for the
+second), which tells identical GPUs apart. Empty leaves it to the scores.
+*/
+struct device_preference
+{
+    std::string name;
+    uint32_t    vendor_id = 0;
+    int32_t     index     = -1;
+
+    bool empty() const { return name.empty() && vendor_id == 0 && index < 0; }
+    bool matches(const vk::PhysicalDeviceProperties& properties, uint32_t position) const;
+};
+
+device_preference parseDevicePreference(const std::string& value);
+
+// SHINY_DEVICE, or nothing when it isn't set
+device_preference environmentDevicePreference();
+
+/*
+How well a device suits the renderer, for picking one out of several. On laptops with both an
+integrated and a discrete GPU the integrated one is usually enumerated first, and taking the first
+suitable device would leave the faster one idle.
+
+The kind of device dominates: a discrete GPU beats an integrated one, which beats a virtual one and
+then a CPU implementation. Between devices of the same kind the optional features the renderer
+makes use of count next (descriptor indexing, timeline semaphores, indirect count, multi draw
+indirect, mesh shaders), then the size of the largest device local heap, then the largest 2D image.
+Each is packed into its own bits of `total`, so comparing totals compares them in that order.
+*/
+struct device_score
+{
+    vk::PhysicalDeviceProperties properties;
+    uint32_t                     features   = 0;  // of the optional ones above
+    vk::DeviceSize               local_heap = 0;  // bytes
+    uint64_t                     total      = 0;
+};
+
+device_score scoreDevice(vk::PhysicalDevice device);
+
+// "discrete", "integrated" and so on
+const char* deviceTypeName(vk::PhysicalDeviceType type);
+
+/*
+The GPUs of the device group `device` is in, in the order of their device index, which are linked
+GPUs of the same kind that one logical device can drive together. Only `device` if it isn't in a
+group with others, or the instance doesn't have VK_KHR_device_group_creation.
+*/
+std::vector<vk::PhysicalDevice> deviceGroup(vk::Instance instance, vk::PhysicalDevice device);
+
+}  // namespace shiny::graphics
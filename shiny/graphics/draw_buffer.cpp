@@ -0,0 +1,134 @@
+#include "graphics/draw_buffer.h"
+
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+draw_buffer::init(vk::PhysicalDevice           physical_device,
+                  vk::Device                   device,
+                  memory_allocator&            allocator,
+                  uint32_t                     max_draws,
+                  uint32_t                     max_instances,
+                  uint32_t                     frames,
+                  const std::vector<uint32_t>& queue_families)
+{
+    m_device        = device;
+    m_allocator     = &allocator;
+    m_max_draws     = max_draws;
+    m_max_instances = max_instances;
+    m_frames        = frames;
+
+    // The instances come first in every region since they are bound with a dynamic storage buffer
+    // offset, which has to be aligned
+    vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+
+    m_commands_offset = alignUp(max_instances * sizeof(draw_instance), 16);
+    m_count_offset    = m_commands_offset + max_draws * sizeof(vk::DrawIndexedIndirectCommand);
+    m_frame_size      = alignUp(m_count_offset + sizeof(uint32_t), alignment);
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(m_frame_size * frames)
+                        .setUsage(vk::BufferUsageFlagBits::eIndirectBuffer
+                                  | vk::BufferUsageFlagBits::eStorageBuffer
+                                  | allocator.addressUsage())
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    if (queue_families.size() > 1) {
+        bufferinfo.setSharingMode(vk::SharingMode::eConcurrent)
+          .setQueueFamilyIndexCount((uint32_t)queue_families.size())
+          .setPQueueFamilyIndices(queue_families.data());
+    }
+
+    // Rewritten every frame and only ever written by the host, so in VRAM where it can be mapped
+    m_buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+    m_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_buffer),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_buffer, m_memory.memory, m_memory.offset);
+}
+
+void
+draw_buffer::destroy()
+{
+    m_device.destroyBuffer(m_buffer, hostAllocator());
+    m_allocator->free(m_memory);
+    m_buffer = nullptr;
+}
+
+void
+draw_buffer::beginFrame(uint32_t frame)
+{
+    m_frame          = frame % m_frames;
+    m_count          = 0;
+    m_instance_count = 0;
+}
+
+uint32_t
+draw_buffer::push(vk::DrawIndexedIndirectCommand command,
+                  const glm::mat4*               transforms,
+                  uint32_t                       texture,
+                  uint32_t                       vertex_format)
+{
+    if (m_count == m_max_draws || command.instanceCount > m_max_instances - m_instance_count) {
+        throw std::runtime_error("Draw buffer is out of space for this frame!");
+    }
+
+    const uint32_t index = m_count++;
+
+    command.setFirstInstance(m_instance_count);
+
+    char* data      = frameData();
+    auto  instances = reinterpret_cast<draw_instance*>(data) + m_instance_count;
+
+    // The region is write-combined, so every instance is written in one go and never read back
+    for (uint32_t i = 0; i < command.instanceCount; ++i) {
+        draw_instance instance;
+        instance.transform = transforms[i];
+        instance.texture       = texture;
+        instance.vertex_format = vertex_format;
+        std::memcpy(&instances[i], &instance, sizeof(instance));
+    }
+
+    std::memcpy(data + m_commands_offset + index * sizeof(command), &command, sizeof(command));
+
+    m_instance_count += command.instanceCount;
+    return index;
+}
+
+uint32_t
+draw_buffer::reserveInstances(uint32_t count)
+{
+    if (count > m_max_instances - m_instance_count) {
+        throw std::runtime_error("Draw buffer is out of space for this frame!");
+    }
+
+    const uint32_t first = m_instance_count;
+    m_instance_count += count;
+    return first;
+}
+
+void
+draw_buffer::finish()
+{
+    std::memcpy(frameData() + m_count_offset, &m_count, sizeof(m_count));
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "graphics/memory_allocator.h"
+
+#include <glm/glm.hpp>
+
+namespace shiny::graphics {
+
+/*
+What the vertex shader reads per instance, laid out like its std430 Instance struct: the struct is
+aligned to 16 bytes because of the matrix, hence the padding.
+*/
+struct draw_instance
+{
+    glm::mat4 transform;
+    uint32_t  texture       = 0;  // index into the bindless texture array
+    uint32_t  vertex_format = 0;  // for pull.vert, which reads the vertices itself
+    uint32_t  padding[2]    = {};
+};
+
+static_assert(sizeof(draw_instance) == 80, "draw_instance has to match the shader's layout");
+
+/*
+The per-draw parameters of a frame, written into a persistently mapped buffer instead of being
+recorded into the command buffer one draw at a time. Every frame in flight has its own region
+holding
+
+ - one VkDrawIndexedIndirectCommand per draw, for vkCmdDrawIndexedIndirect(Count),
+ - a draw count, for vkCmdDrawIndexedIndirectCountKHR, and
+ - one draw_instance per instance, read by the vertex shader from a storage buffer.
+
+The shader finds an instance's data through gl_InstanceIndex, which starts at the command's
+firstInstance, so `push()` writes the draw's instanceCount instances back to back and points
+firstInstance at the first of them. That works for direct draws too, which is how devices without
+multiDrawIndirect are handled.
+
+Like the uniform ring, a frame's region may only be rewritten once that frame's fence has been
+waited on. The buffer is shared concurrently between all `queue_families` given to `init()`.
+*/
+class draw_buffer
+{
+public:
+    void init(vk::PhysicalDevice           physical_device,
+              vk::Device                   device,
+              memory_allocator&            allocator,
+              uint32_t                     max_draws,
+              uint32_t                     max_instances,
+              uint32_t                     frames,
+              const std::vector<uint32_t>& queue_families);
+    void destroy();
+
+    void beginFrame(uint32_t frame);
+
+    // Writes the draw with one transform per instance, all of them sampling `texture`, returning
+    // its index. The command's firstInstance is overwritten with the position of the first one.
+    // `vertex_format` is a graphics::vertex_format, which only shaders pulling vertices look at.
+    uint32_t push(vk::DrawIndexedIndirectCommand command,
+                  const glm::mat4*               transforms,
+                  uint32_t                       texture,
+                  uint32_t                       vertex_format = 0);
+
+    // Sets aside `count` instances of the current frame for something else to write, like a
+    // compute shader, returning the index of the first
+    uint32_t reserveInstances(uint32_t count);
+
+    // Writes the draw count of the current frame
+    void finish();
+
+    vk::Buffer buffer() const { return m_buffer; }
+    uint32_t   count() const { return m_count; }
+    uint32_t   instanceCount() const { return m_instance_count; }
+    uint32_t   capacity() const { return m_max_draws; }
+
+    // Dynamic offset of the current frame's instances
+    uint32_t       instanceOffset() const { return (uint32_t)frameBase(); }
+    vk::DeviceSize instanceRange() const { return m_max_instances * sizeof(draw_instance); }
+
+    // `frame`'s instances as they are, for binding without a dynamic offset
+    vk::DescriptorBufferInfo instances(uint32_t frame) const
+    {
+        return vk::DescriptorBufferInfo(m_buffer, (frame % m_frames) * m_frame_size,
+                                        instanceRange());
+    }
+
+    vk::DeviceSize commandOffset(uint32_t index) const
+    {
+        return frameBase() + m_commands_offset + index * sizeof(vk::DrawIndexedIndirectCommand);
+    }
+    vk::DeviceSize countOffset() const { return frameBase() + m_count_offset; }
+
+private:
+    vk::DeviceSize frameBase() const { return m_frame * m_frame_size; }
+    char*          frameData() const { return static_cast<char*>(m_memory.mapped) + frameBase(); }
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::Buffer     m_buffer;
+    allocation     m_memory;
+    vk::DeviceSize m_commands_offset = 0;
+    vk::DeviceSize m_count_offset    = 0;
+    vk::DeviceSize m_frame_size      = 0;
+    uint32_t       m_max_draws       = 0;
+    uint32_t       m_max_instances   = 0;
+    uint32_t       m_frames          = 0;
+
+    uint32_t m_frame          = 0;
+    uint32_t m_count          = 0;
+    uint32_t m_instance_count = 0;
+};
+
+}  // namespace shiny::graphics
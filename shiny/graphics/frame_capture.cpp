@@ -0,0 +1,260 @@
+#include "graphics/frame_capture.h"
+
+#include "core/profiler.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+using shiny::graphics::captured_draw;
+
+const uint32_t capture_magic   = 0x43464853;  // "SHFC"
+const uint32_t capture_version = 1;
+
+template<typename T>
+void
+append(std::vector<char>& buffer, const T& value)
+{
+    const size_t at = buffer.size();
+    buffer.resize(at + sizeof(T));
+    std::memcpy(&buffer[at], &value, sizeof(T));
+}
+
+void
+appendString(std::vector<char>& buffer, const std::string& string)
+{
+    append(buffer, (uint32_t)string.size());
+    buffer.insert(buffer.end(), string.begin(), string.end());
+}
+
+void
+appendDraw(std::vector<char>& buffer, const captured_draw& draw)
+{
+    append(buffer, draw.mesh);
+    append(buffer, draw.texture);
+    for (int column = 0; column < 4; ++column) {
+        append(buffer, glm::vec3(draw.transform[column]));
+    }
+}
+
+// Reads a frame's fields in turn, throwing rather than reading past its end
+struct frame_cursor
+{
+    const char* p;
+    const char* end;
+
+    template<typename T>
+    T take()
+    {
+        if ((size_t)(end - p) < sizeof(T)) {
+            throw std::runtime_error("capture frame is cut short!");
+        }
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+    std::string takeString()
+    {
+        const uint32_t length = take<uint32_t>();
+        if ((size_t)(end - p) < length) {
+            throw std::runtime_error("capture frame is cut short!");
+        }
+        std::string string(p, length);
+        p += length;
+        return string;
+    }
+
+    captured_draw takeDraw()
+    {
+        captured_draw draw;
+        draw.mesh    = take<uint32_t>();
+        draw.texture = take<uint32_t>();
+        for (int column = 0; column < 4; ++column) {
+            draw.transform[column] = glm::vec4(take<glm::vec3>(), column == 3 ? 1.f : 0.f);
+        }
+        return draw;
+    }
+
+    // A count of elements at least `size` bytes each, which can't be more than there's room for
+    uint32_t takeCount(size_t size)
+    {
+        const uint32_t count = take<uint32_t>();
+        if ((size_t)(end - p) / size < count) {
+            throw std::runtime_error("capture frame is cut short!");
+        }
+        return count;
+    }
+};
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+capture_writer::open(const std::string& path)
+{
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        throw std::runtime_error("failed to open " + path + " for the capture!");
+    }
+    m_file.write(reinterpret_cast<const char*>(&capture_magic), sizeof(capture_magic));
+    m_file.write(reinterpret_cast<const char*>(&capture_version), sizeof(capture_version));
+    m_previous.clear();
+}
+
+void
+capture_writer::close()
+{
+    if (m_file.is_open()) {
+        m_file.close();
+    }
+}
+
+void
+capture_writer::write(const captured_frame& frame)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_buffer.clear();
+    append(m_buffer, (uint32_t)0);  // the size, once it's known
+    append(m_buffer, frame.time);
+    append(m_buffer, frame.camera_position);
+    append(m_buffer, frame.camera_target);
+    append(m_buffer, (uint8_t)frame.hud);
+
+    for (const std::vector<captured_name>* names : { &frame.meshes, &frame.textures }) {
+        append(m_buffer, (uint32_t)names->size());
+        for (const captured_name& name : *names) {
+            append(m_buffer, name.id);
+            appendString(m_buffer, name.name);
+        }
+    }
+
+    const uint32_t drawcount = (uint32_t)frame.draws.size();
+    append(m_buffer, drawcount);
+    const size_t mask = m_buffer.size();
+    m_buffer.resize(mask + (drawcount + 7) / 8, 0);
+    for (uint32_t i = 0; i < drawcount; ++i) {
+        if (i < m_previous.size() && m_previous[i] == frame.draws[i]) {
+            continue;
+        }
+        m_buffer[mask + i / 8] |= (char)(1 << (i % 8));
+        appendDraw(m_buffer, frame.draws[i]);
+    }
+    m_previous.assign(frame.draws.begin(), frame.draws.end());
+
+    append(m_buffer, (uint32_t)frame.changes.size());
+    for (const captured_change& change : frame.changes) {
+        append(m_buffer, change.slot);
+        append(m_buffer, (uint8_t)change.live);
+        if (change.live) {
+            appendDraw(m_buffer, change.draw);
+        }
+    }
+
+    append(m_buffer, (uint32_t)frame.lights.size());
+    const size_t lights = m_buffer.size();
+    m_buffer.resize(lights + frame.lights.size() * sizeof(light));
+    std::memcpy(m_buffer.data() + lights, frame.lights.data(),
+                frame.lights.size() * sizeof(light));
+
+    const uint32_t size = (uint32_t)(m_buffer.size() - sizeof(uint32_t));
+    std::memcpy(m_buffer.data(), &size, sizeof(size));
+    m_file.write(m_buffer.data(), (std::streamsize)m_buffer.size());
+}
+
+void
+capture_reader::open(const std::string& path)
+{
+    if (!m_file.open(path)) {
+        throw std::runtime_error("failed to open the capture " + path + "!");
+    }
+
+    uint32_t header[2] = {};
+    if (m_file.size() < sizeof(header)) {
+        throw std::runtime_error(path + " isn't a capture!");
+    }
+    std::memcpy(header, m_file.data(), sizeof(header));
+    if (header[0] != capture_magic || header[1] != capture_version) {
+        throw std::runtime_error(path + " isn't a capture of this version!");
+    }
+
+    m_next = m_file.data() + sizeof(header);
+    m_previous.clear();
+}
+
+void
+capture_reader::close()
+{
+    m_file.close();
+    m_next = nullptr;
+}
+
+bool
+capture_reader::read(captured_frame& frame)
+{
+    if (!m_next || m_next == m_file.end()) {
+        return false;
+    }
+
+    frame_cursor   sized{ m_next, m_file.end() };
+    const uint32_t size = sized.take<uint32_t>();
+    if ((size_t)(m_file.end() - sized.p) < size) {
+        throw std::runtime_error("capture frame is cut short!");
+    }
+
+    frame_cursor cursor{ sized.p, sized.p + size };
+    m_next = cursor.end;
+
+    frame.time            = cursor.take<float>();
+    frame.camera_position = cursor.take<glm::vec3>();
+    frame.camera_target   = cursor.take<glm::vec3>();
+    frame.hud             = cursor.take<uint8_t>() != 0;
+
+    for (std::vector<captured_name>* names : { &frame.meshes, &frame.textures }) {
+        names->resize(cursor.takeCount(2 * sizeof(uint32_t)));
+        for (captured_name& name : *names) {
+            name.id   = cursor.take<uint32_t>();
+            name.name = cursor.takeString();
+        }
+    }
+
+    // The draws that didn't change are the ones at the same index in the frame before
+    const uint32_t drawcount = cursor.take<uint32_t>();
+    const size_t   maskbytes = ((size_t)drawcount + 7) / 8;
+    if ((size_t)(cursor.end - cursor.p) < maskbytes) {
+        throw std::runtime_error("capture frame is cut short!");
+    }
+    const char* mask = cursor.p;
+    cursor.p += maskbytes;
+
+    frame.draws.resize(drawcount);
+    for (uint32_t i = 0; i < drawcount; ++i) {
+        if (mask[i / 8] & (1 << (i % 8))) {
+            frame.draws[i] = cursor.takeDraw();
+        } else if (i < m_previous.size()) {
+            frame.draws[i] = m_previous[i];
+        } else {
+            throw std::runtime_error("capture frame repeats a draw it never had!");
+        }
+    }
+    m_previous.assign(frame.draws.begin(), frame.draws.end());
+
+    frame.changes.resize(cursor.takeCount(sizeof(uint32_t) + sizeof(uint8_t)));
+    for (captured_change& change : frame.changes) {
+        change.slot = cursor.take<uint32_t>();
+        change.live = cursor.take<uint8_t>() != 0;
+        change.draw = change.live ? cursor.takeDraw() : captured_draw();
+    }
+
+    frame.lights.resize(cursor.takeCount(sizeof(light)));
+    for (light& l : frame.lights) {
+        l = cursor.take<light>();
+    }
+    return true;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "core/mapped_file.h"
+#include "graphics/light_culling.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+// A mesh or texture id that stands for none
+const uint32_t capture_none = std::numeric_limits<uint32_t>::max();
+
+// A draw of a frame packet, with the mesh and the texture by their capture ids
+struct captured_draw
+{
+    uint32_t  mesh      = capture_none;
+    uint32_t  texture   = capture_none;
+    glm::mat4 transform = glm::mat4(1.f);  // affine, the bottom row isn't kept
+
+    bool operator==(const captured_draw& other) const
+    {
+        return mesh == other.mesh && texture == other.texture && transform == other.transform;
+    }
+};
+
+struct captured_change
+{
+    uint32_t      slot = 0;
+    bool          live = false;
+    captured_draw draw;  // only if it is live
+};
+
+// What an id stands for, from the frame it is named in on: a mesh by the renderer's name for it,
+// a texture by the path it was loaded from
+struct captured_name
+{
+    uint32_t    id = capture_none;
+    std::string name;
+};
+
+// A frame packet as it goes into a capture, which is everything drawFrame() takes from one
+struct captured_frame
+{
+    float                        time            = 0.f;
+    glm::vec3                    camera_position = glm::vec3(0.f);
+    glm::vec3                    camera_target   = glm::vec3(0.f);
+    bool                         hud             = false;
+    std::vector<captured_name>   meshes;    // named for the first time
+    std::vector<captured_name>   textures;  // drawn for the first time, so loaded by now
+    std::vector<captured_draw>   draws;
+    std::vector<captured_change> changes;
+    std::vector<light>           lights;
+};
+
+/*
+Writes a session's frames to a file that capture_reader plays back. A capture is a header and then
+the frames, each of them its size in bytes followed by the clock, the camera, the names, the draws,
+the scene changes and the lights, with every list a uint32_t count and its elements. A draw's
+transform is the top three rows of its matrix, and draws are only written if they differ from the
+one at their index in the frame before, which a bit per draw ahead of them tells, so a scene that
+mostly stands still costs a few bytes a frame for it.
+
+Frames are put together in a buffer that keeps its size, so writing them doesn't allocate once the
+largest has been.
+*/
+class capture_writer
+{
+public:
+    // Throws if the file can't be written
+    void open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return m_file.is_open(); }
+
+    void write(const captured_frame& frame);
+
+private:
+    std::ofstream              m_file;
+    std::vector<char>          m_buffer;
+    std::vector<captured_draw> m_previous;  // the last frame's draws
+};
+
+// Reads back what capture_writer wrote, a frame at a time
+class capture_reader
+{
+public:
+    // Throws if the file isn't a capture of this version
+    void open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return m_file.isOpen(); }
+
+    // The next frame, or false after the last. Throws on a frame that is cut short.
+    bool read(captured_frame& frame);
+
+private:
+    core::mapped_file          m_file;
+    const char*                m_next = nullptr;
+    std::vector<captured_draw> m_previous;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,214 @@
+#include "graphics/frame_readback.h"
+
+#include "core/profiler.h"
+#include "graphics/host_allocator.h"
+
+#include <FreeImage.h>
+
+#include <algorithm>
+
+namespace shiny::graphics {
+
+bool
+readbackSupported(vk::Format format)
+{
+    switch (format) {
+        case vk::Format::eR8G8B8A8Unorm:
+        case vk::Format::eR8G8B8A8Srgb:
+        case vk::Format::eB8G8R8A8Unorm:
+        case vk::Format::eB8G8R8A8Srgb:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool
+writeImageFile(const std::string& path, const offscreen_frame& frame)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const FREE_IMAGE_FORMAT fif = FreeImage_GetFIFFromFilename(path.c_str());
+    if (fif == FIF_UNKNOWN) {
+        return false;
+    }
+
+    const bool bgra =
+      frame.format == vk::Format::eB8G8R8A8Unorm || frame.format == vk::Format::eB8G8R8A8Srgb;
+    const int red  = bgra ? 2 : 0;
+    const int blue = bgra ? 0 : 2;
+
+    // JPEG has no alpha, so it only gets the color
+    const bool alpha  = FreeImage_FIFSupportsExportBPP(fif, 32);
+    const int  stride = alpha ? 4 : 3;
+
+    FIBITMAP* bitmap = FreeImage_Allocate(frame.width, frame.height, alpha ? 32 : 24);
+    if (!bitmap) {
+        return false;
+    }
+
+    // FreeImage's rows go bottom to top, and its pixels are BGRA on little endian machines
+    for (uint32_t y = 0; y < frame.height; ++y) {
+        const uint8_t* src = frame.pixels + (size_t)y * frame.width * 4;
+        BYTE*          dst = FreeImage_GetScanLine(bitmap, (int)(frame.height - 1 - y));
+        for (uint32_t x = 0; x < frame.width; ++x) {
+            dst[x * stride + FI_RGBA_RED]   = src[x * 4 + red];
+            dst[x * stride + FI_RGBA_GREEN] = src[x * 4 + 1];
+            dst[x * stride + FI_RGBA_BLUE]  = src[x * 4 + blue];
+            if (alpha) {
+                dst[x * stride + FI_RGBA_ALPHA] = src[x * 4 + 3];
+            }
+        }
+    }
+
+    const bool saved = FreeImage_Save(fif, bitmap, path.c_str());
+    FreeImage_Unload(bitmap);
+    return saved;
+}
+
+void
+frame_readback::init(vk::Device device, memory_allocator& allocator, uint32_t frames)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_readbacks.resize(frames);
+}
+
+void
+frame_readback::destroy()
+{
+    for (readback& r : m_readbacks) {
+        if (r.buffer) {
+            m_device.destroyBuffer(r.buffer, hostAllocator());
+            m_allocator->free(r.memory);
+        }
+    }
+    m_readbacks.clear();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requests.clear();
+}
+
+void
+frame_readback::request(offscreen_callback deliver)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requests.push_back(std::move(deliver));
+}
+
+bool
+frame_readback::requested()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_requests.empty();
+}
+
+/*
+The frame's last readback has been collected by the time its command buffer is recorded again, so
+its buffer can be replaced if it is too small. Like offscreen_target's, the barrier makes the copy
+visible to the host once the fence signals.
+*/
+void
+frame_readback::record(vk::CommandBuffer command_buffer,
+                       uint32_t          frame,
+                       vk::Image         image,
+                       vk::Extent2D      extent,
+                       vk::Format        format,
+                       uint64_t          number)
+{
+    readback& r = m_readbacks[frame];
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_requests.empty()) {
+            return;
+        }
+        std::swap(r.deliver, m_requests);
+    }
+
+    SHINY_PROFILE_ZONE("frame readback");
+
+    const vk::DeviceSize size = (vk::DeviceSize)extent.width * extent.height * 4;
+    if (r.size < size) {
+        if (r.buffer) {
+            m_device.destroyBuffer(r.buffer, hostAllocator());
+            m_allocator->free(r.memory);
+        }
+
+        auto bufferinfo = vk::BufferCreateInfo()
+                            .setSize(size)
+                            .setUsage(vk::BufferUsageFlagBits::eTransferDst)
+                            .setSharingMode(vk::SharingMode::eExclusive);
+        r.buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+
+        const vk::MemoryRequirements requirements = m_device.getBufferMemoryRequirements(r.buffer);
+
+        r.memory = m_allocator->allocate(requirements,
+                                         vk::MemoryPropertyFlagBits::eHostVisible
+                                           | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                         memory_allocator::resource_kind::linear,
+                                         memory_category::staging,
+                                         vk::MemoryPropertyFlagBits::eHostCached);
+        m_device.bindBufferMemory(r.buffer, r.memory.memory, r.memory.offset);
+        r.size = size;
+    }
+
+    auto region = vk::BufferImageCopy()
+                    .setBufferOffset(0)
+                    .setBufferRowLength(0)
+                    .setBufferImageHeight(0)
+                    .setImageSubresource(
+                      vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+                    .setImageOffset({ 0, 0, 0 })
+                    .setImageExtent({ extent.width, extent.height, 1 });
+
+    command_buffer.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, r.buffer,
+                                     region);
+
+    auto barrier = vk::BufferMemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                                           vk::AccessFlagBits::eHostRead, VK_QUEUE_FAMILY_IGNORED,
+                                           VK_QUEUE_FAMILY_IGNORED, r.buffer, 0, VK_WHOLE_SIZE);
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(),
+                                   nullptr, barrier, nullptr);
+
+    r.pixels.width  = extent.width;
+    r.pixels.height = extent.height;
+    r.pixels.format = format;
+    r.pixels.number = number;
+}
+
+void
+frame_readback::collect(uint32_t frame)
+{
+    readback& r = m_readbacks[frame];
+    if (r.deliver.empty()) {
+        return;
+    }
+
+    SHINY_PROFILE_ZONE("frame readback collect");
+
+    offscreen_frame pixels = r.pixels;
+    pixels.pixels          = static_cast<const uint8_t*>(r.memory.mapped);
+    for (const offscreen_callback& deliver : r.deliver) {
+        deliver(pixels);
+    }
+    r.deliver.clear();
+}
+
+void
+frame_readback::collectAll()
+{
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < m_readbacks.size(); ++i) {
+        order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return m_readbacks[a].pixels.number < m_readbacks[b].pixels.number;
+    });
+
+    for (uint32_t frame : order) {
+        collect(frame);
+    }
+}
+
+}  // namespace shiny::graphics
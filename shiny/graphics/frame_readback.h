@@ -0,0 +1,77 @@
+#pragma once
+
+#include "graphics/memory_allocator.h"
+#include "graphics/offscreen_target.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+// Whether frame_readback can copy images of `format`, 4 bytes a pixel of 8 bit RGBA or BGRA
+bool readbackSupported(vk::Format format);
+
+// Writes the pixels to `path` in whichever format FreeImage takes its extension to mean, e.g. PNG
+// or JPEG. Returns false if it couldn't.
+bool writeImageFile(const std::string& path, const offscreen_frame& frame);
+
+/*
+Screenshots, without waiting for the GPU. A request is taken by the next frame that is recorded,
+whose command buffer copies the presented image into a host visible buffer of that frame in flight
+right after rendering it, and the pixels are handed over once the frame's fence has been waited on
+anyway, before its buffer is used again. So a screenshot costs the GPU a copy and the CPU nothing
+until the callback, which is where anything slow, like encoding, should be handed to another
+thread.
+
+Every frame in flight has a buffer of its own, created the first time it's needed and again when
+the image has become larger. Requests can come from any thread; the rest is the render thread's.
+*/
+class frame_readback
+{
+public:
+    void init(vk::Device device, memory_allocator& allocator, uint32_t frames);
+    void destroy();
+
+    // Any thread. `deliver` is called on the render thread, frames in flight later.
+    void request(offscreen_callback deliver);
+
+    // Whether the next record() has anything to do, which is only a hint off the render thread
+    bool requested();
+
+    // Copies `image`, in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, into `frame`'s buffer if anything
+    // asked for it
+    void record(vk::CommandBuffer command_buffer,
+                uint32_t          frame,
+                vk::Image         image,
+                vk::Extent2D      extent,
+                vk::Format        format,
+                uint64_t          number);
+
+    // Hands over what `frame`'s buffer was last copied into, whose fence has to have been waited
+    // on, unless it was handed over already
+    void collect(uint32_t frame);
+
+    // The same for every frame, oldest first, once the device is idle
+    void collectAll();
+
+private:
+    struct readback
+    {
+        vk::Buffer                      buffer;
+        allocation                      memory;
+        vk::DeviceSize                  size = 0;
+        offscreen_frame                 pixels;  // but for pixels.pixels, until it's collected
+        std::vector<offscreen_callback> deliver;
+    };
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    std::vector<readback> m_readbacks;  // one per frame in flight
+
+    std::mutex                      m_mutex;
+    std::vector<offscreen_callback> m_requests;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,122 @@
+#include "graphics/frustum_culling.h"
+
+#include "core/transform_math.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SHINY_CULL_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SHINY_CULL_SSE
+#endif
+
+namespace {
+
+bool
+sphereVisible(const shiny::graphics::frustum& frustum, float x, float y, float z, float radius)
+{
+    for (const glm::vec4& plane : frustum.planes) {
+        if (plane.x * x + plane.y * y + plane.z * z + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+// Each plane is a sum or difference of the matrix's rows, see core::extractPlanes
+frustum
+extractFrustum(const glm::mat4& viewprojection)
+{
+    frustum f;
+    core::extractPlanes(&viewprojection, f.planes, 1);
+    return f;
+}
+
+void
+sphere_list::clear()
+{
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+    m_radius.clear();
+}
+
+void
+sphere_list::push(const glm::vec3& center, float radius)
+{
+    m_x.push_back(center.x);
+    m_y.push_back(center.y);
+    m_z.push_back(center.z);
+    m_radius.push_back(radius);
+}
+
+/*
+Every plane is tested against a whole register of spheres, and a sphere stays visible as long as
+no plane has it entirely outside. The spheres that don't fill a register are tested one by one.
+*/
+void
+sphere_list::cull(const frustum& frustum, std::vector<uint8_t>& visible) const
+{
+    const uint32_t count = size();
+    visible.resize(count);
+
+    uint32_t i = 0;
+
+#if defined(SHINY_CULL_AVX)
+    for (; i + 8 <= count; i += 8) {
+        const __m256 x      = _mm256_loadu_ps(m_x.data() + i);
+        const __m256 y      = _mm256_loadu_ps(m_y.data() + i);
+        const __m256 z      = _mm256_loadu_ps(m_z.data() + i);
+        const __m256 radius = _mm256_loadu_ps(m_radius.data() + i);
+        const __m256 minus  = _mm256_sub_ps(_mm256_setzero_ps(), radius);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const glm::vec4& plane : frustum.planes) {
+            __m256 distance = _mm256_mul_ps(x, _mm256_set1_ps(plane.x));
+            distance        = _mm256_add_ps(distance, _mm256_mul_ps(y, _mm256_set1_ps(plane.y)));
+            distance        = _mm256_add_ps(distance, _mm256_mul_ps(z, _mm256_set1_ps(plane.z)));
+            distance        = _mm256_add_ps(distance, _mm256_set1_ps(plane.w));
+
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, minus, _CMP_GE_OQ));
+        }
+
+        const int mask = _mm256_movemask_ps(inside);
+        for (uint32_t lane = 0; lane < 8; ++lane) {
+            visible[i + lane] = (uint8_t)((mask >> lane) & 1);
+        }
+    }
+#elif defined(SHINY_CULL_SSE)
+    for (; i + 4 <= count; i += 4) {
+        const __m128 x      = _mm_loadu_ps(m_x.data() + i);
+        const __m128 y      = _mm_loadu_ps(m_y.data() + i);
+        const __m128 z      = _mm_loadu_ps(m_z.data() + i);
+        const __m128 radius = _mm_loadu_ps(m_radius.data() + i);
+        const __m128 minus  = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const glm::vec4& plane : frustum.planes) {
+            __m128 distance = _mm_mul_ps(x, _mm_set1_ps(plane.x));
+            distance        = _mm_add_ps(distance, _mm_mul_ps(y, _mm_set1_ps(plane.y)));
+            distance        = _mm_add_ps(distance, _mm_mul_ps(z, _mm_set1_ps(plane.z)));
+            distance        = _mm_add_ps(distance, _mm_set1_ps(plane.w));
+
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, minus));
+        }
+
+        const int mask = _mm_movemask_ps(inside);
+        for (uint32_t lane = 0; lane < 4; ++lane) {
+            visible[i + lane] = (uint8_t)((mask >> lane) & 1);
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        visible[i] = sphereVisible(frustum, m_x[i], m_y[i], m_z[i], m_radius[i]) ? 1 : 0;
+    }
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+The six planes of a view-projection's frustum, as (normal, distance) with unit normals pointing
+inwards, so a point p is inside a plane when dot(normal, p) + distance >= 0. Assumes clip space
+depth goes from 0 to 1, as it does in Vulkan.
+*/
+struct frustum
+{
+    glm::vec4 planes[6];
+};
+
+frustum extractFrustum(const glm::mat4& viewprojection);
+
+/*
+Bounding spheres in structure-of-arrays form, so culling them can test several at once with SSE,
+or AVX where the build enables it, instead of one sphere at a time.
+*/
+class sphere_list
+{
+public:
+    void clear();
+    void push(const glm::vec3& center, float radius);
+
+    uint32_t size() const { return (uint32_t)m_radius.size(); }
+
+    // Center and radius
+    glm::vec4 sphere(uint32_t i) const { return glm::vec4(m_x[i], m_y[i], m_z[i], m_radius[i]); }
+
+    // visible[i] becomes 1 for every sphere that is at least partly inside the frustum, 0 otherwise
+    void cull(const frustum& frustum, std::vector<uint8_t>& visible) const;
+
+private:
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_z;
+    std::vector<float> m_radius;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,389 @@
+#include "graphics/geometry_pool.h"
+
+#include "graphics/host_allocator.h"
+
+#include <cassert>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace shiny::graphics {
+
+void
+geometry_pool::init(vk::Device                   device,
+                    memory_allocator&            allocator,
+                    const std::vector<uint32_t>& queue_families,
+                    vk::DeviceSize               position_stride,
+                    vk::DeviceSize               attribute_stride,
+                    uint32_t                     max_vertices,
+                    uint32_t                     max_indices,
+                    bool                         build_inputs)
+{
+    m_device           = device;
+    m_allocator        = &allocator;
+    m_position_stride  = position_stride;
+    m_attribute_stride = attribute_stride;
+    m_max_vertices     = max_vertices;
+    m_concurrent       = queue_families.size() > 1;
+    m_build_access     = vk::AccessFlags();
+    m_build_stages     = vk::PipelineStageFlags();
+
+    vk::BufferUsageFlags buildusage;
+#if defined(VK_KHR_acceleration_structure)
+    if (build_inputs) {
+        buildusage = vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR
+                     | allocator.addressUsage();
+        m_build_access = vk::AccessFlagBits::eShaderRead;
+        m_build_stages = vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR;
+    }
+#else
+    (void)build_inputs;
+#endif
+
+    // Host visible on top of device local only where that is all of VRAM, not the small window
+    const vk::MemoryPropertyFlags mappable =
+      m_allocator->resizableBar()
+        ? vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+        : vk::MemoryPropertyFlags();
+
+    auto create = [&](vk::DeviceSize       size,
+                      vk::BufferUsageFlags usage,
+                      memory_category      category,
+                      allocation&          memory) {
+        auto bufferinfo = vk::BufferCreateInfo()
+                            .setSize(size)
+                            .setUsage(usage | vk::BufferUsageFlagBits::eTransferDst
+                                      | vk::BufferUsageFlagBits::eTransferSrc)
+                            .setSharingMode(vk::SharingMode::eExclusive);
+
+        if (m_concurrent) {
+            bufferinfo.setSharingMode(vk::SharingMode::eConcurrent)
+              .setQueueFamilyIndexCount((uint32_t)queue_families.size())
+              .setPQueueFamilyIndices(queue_families.data());
+        }
+
+        vk::Buffer buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+        memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(buffer),
+                                       vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                       memory_allocator::resource_kind::linear, category,
+                                       mappable);
+        m_device.bindBufferMemory(buffer, memory.memory, memory.offset);
+        return buffer;
+    };
+
+    // Also storage buffers, for vertex shaders that read the vertices by index, see
+    // renderer::setVertexPulling
+    const vk::BufferUsageFlags vertexusage = vk::BufferUsageFlagBits::eVertexBuffer
+                                             | vk::BufferUsageFlagBits::eStorageBuffer
+                                             | allocator.addressUsage();
+
+    m_position_buffer  = create(position_stride * max_vertices, vertexusage | buildusage,
+                                memory_category::vertex, m_position_memory);
+    m_attribute_buffer = create(attribute_stride * max_vertices, vertexusage,
+                                memory_category::vertex, m_attribute_memory);
+    m_index_buffer     = create(sizeof(uint16_t) * max_indices,
+                                vk::BufferUsageFlagBits::eIndexBuffer | buildusage,
+                                memory_category::index, m_index_memory);
+
+    m_free_vertices.reset(max_vertices);
+    m_free_indices.reset(max_indices);
+}
+
+void
+geometry_pool::destroy()
+{
+    m_device.destroyBuffer(m_position_buffer, hostAllocator());
+    m_allocator->free(m_position_memory);
+    m_device.destroyBuffer(m_attribute_buffer, hostAllocator());
+    m_allocator->free(m_attribute_memory);
+    m_device.destroyBuffer(m_index_buffer, hostAllocator());
+    m_allocator->free(m_index_memory);
+
+    m_position_buffer  = nullptr;
+    m_attribute_buffer = nullptr;
+    m_index_buffer     = nullptr;
+}
+
+geometry_range
+geometry_pool::allocate(uint32_t       vertex_count,
+                        uint32_t       index_count,
+                        vk::DeviceSize position_stride,
+                        vk::DeviceSize attribute_stride,
+                        vk::IndexType  index_type)
+{
+    if (position_stride == 0) {
+        position_stride = m_position_stride;
+    }
+    if (attribute_stride == 0) {
+        attribute_stride = m_attribute_stride;
+    }
+
+    if (position_stride % m_position_stride != 0 || attribute_stride % m_attribute_stride != 0) {
+        throw std::runtime_error("Vertex stride is not a multiple of the geometry pool's!");
+    }
+    if (position_stride / m_position_stride != attribute_stride / m_attribute_stride) {
+        throw std::runtime_error("Vertex streams take different units of the geometry pool!");
+    }
+
+    geometry_range range;
+    range.vertex_units = (uint32_t)(position_stride / m_position_stride);
+    range.index_units  = index_type == vk::IndexType::eUint16 ? 1 : 2;
+    range.index_type   = index_type;
+
+    const uint32_t vertexunits = vertex_count * range.vertex_units;
+    const uint32_t indexunits  = index_count * range.index_units;
+
+    uint32_t vertexoffset = 0;
+    uint32_t indexoffset  = 0;
+
+    if (vertex_count == 0
+        || !m_free_vertices.allocate(vertexunits, range.vertex_units, vertexoffset)) {
+        return geometry_range();
+    }
+
+    if (index_count > 0 && !m_free_indices.allocate(indexunits, range.index_units, indexoffset)) {
+        m_free_vertices.release(vertexoffset, vertexunits);
+        return geometry_range();
+    }
+
+    range.vertex_offset = vertexoffset / range.vertex_units;
+    range.vertex_count  = vertex_count;
+    range.first_index   = indexoffset / range.index_units;
+    range.index_count   = index_count;
+    return range;
+}
+
+void
+geometry_pool::free(const geometry_range& range)
+{
+    if (!range) {
+        return;
+    }
+
+    m_free_vertices.release(range.vertex_offset * range.vertex_units,
+                            range.vertex_count * range.vertex_units);
+    if (range.index_count > 0) {
+        m_free_indices.release(range.first_index * range.index_units,
+                               range.index_count * range.index_units);
+    }
+}
+
+/*
+First fit hands out the lowest free range that is large enough, so a mesh only moves if there is
+one below where it is now. A stream that would move up instead gets its old range back.
+*/
+geometry_range
+geometry_pool::relocate(const geometry_range& range)
+{
+    if (!range) {
+        return geometry_range();
+    }
+
+    geometry_range result = range;
+
+    const uint32_t vertexunits  = range.vertex_count * range.vertex_units;
+    uint32_t       vertexoffset = 0;
+    if (m_free_vertices.allocate(vertexunits, range.vertex_units, vertexoffset)) {
+        if (vertexoffset < range.vertex_offset * range.vertex_units) {
+            result.vertex_offset = vertexoffset / range.vertex_units;
+        } else {
+            m_free_vertices.release(vertexoffset, vertexunits);
+        }
+    }
+
+    const uint32_t indexunits  = range.index_count * range.index_units;
+    uint32_t       indexoffset = 0;
+    if (range.index_count > 0
+        && m_free_indices.allocate(indexunits, range.index_units, indexoffset)) {
+        if (indexoffset < range.first_index * range.index_units) {
+            result.first_index = indexoffset / range.index_units;
+        } else {
+            m_free_indices.release(indexoffset, indexunits);
+        }
+    }
+
+    if (result.vertex_offset == range.vertex_offset && result.first_index == range.first_index) {
+        return geometry_range();
+    }
+    return result;
+}
+
+void
+geometry_pool::move(upload_batch&         uploads,
+                    const geometry_range& from,
+                    const geometry_range& to) const
+{
+    // Also read as storage buffers, see the comment in init()
+    const vk::AccessFlags vertexread =
+      vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eShaderRead;
+    const vk::PipelineStageFlags vertexstages =
+      vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader;
+
+    if (to.vertex_offset != from.vertex_offset) {
+        const vk::DeviceSize src   = from.vertex_offset * from.vertex_units;
+        const vk::DeviceSize dst   = to.vertex_offset * to.vertex_units;
+        const vk::DeviceSize units = from.vertex_count * from.vertex_units;
+
+        uploads.moveBuffer(m_position_buffer, src * m_position_stride, dst * m_position_stride,
+                           units * m_position_stride, vertexread | m_build_access,
+                           vertexstages | m_build_stages, m_concurrent);
+        uploads.moveBuffer(m_attribute_buffer, src * m_attribute_stride, dst * m_attribute_stride,
+                           units * m_attribute_stride, vertexread, vertexstages, m_concurrent);
+    }
+
+    if (to.first_index != from.first_index) {
+        const vk::DeviceSize unit = sizeof(uint16_t);
+        uploads.moveBuffer(m_index_buffer, from.first_index * from.index_units * unit,
+                           to.first_index * to.index_units * unit,
+                           from.index_count * from.index_units * unit,
+                           vk::AccessFlagBits::eIndexRead | m_build_access,
+                           vk::PipelineStageFlagBits::eVertexInput | m_build_stages, m_concurrent);
+    }
+}
+
+void
+geometry_pool::freeMoved(const geometry_range& from, const geometry_range& to)
+{
+    if (to.vertex_offset != from.vertex_offset) {
+        m_free_vertices.release(from.vertex_offset * from.vertex_units,
+                                from.vertex_count * from.vertex_units);
+    }
+    if (from.index_count > 0 && to.first_index != from.first_index) {
+        m_free_indices.release(from.first_index * from.index_units,
+                               from.index_count * from.index_units);
+    }
+}
+
+vk::DeviceSize
+geometry_pool::bytes(const geometry_range& range) const
+{
+    return range.vertex_count * range.vertex_units * (m_position_stride + m_attribute_stride)
+           + range.index_count * range.index_units * sizeof(uint16_t);
+}
+
+void
+geometry_pool::upload(upload_batch&         uploads,
+                      const geometry_range& range,
+                      const staging_region& positions,
+                      const staging_region& attributes,
+                      const staging_region& indices) const
+{
+    const vk::DeviceSize firstunit = range.vertex_offset * range.vertex_units;
+
+    if (positions) {
+        uploads.copyBuffer(positions, m_position_buffer, firstunit * m_position_stride,
+                           vk::AccessFlagBits::eVertexAttributeRead | m_build_access,
+                           vk::PipelineStageFlagBits::eVertexInput | m_build_stages,
+                           m_concurrent);
+    }
+
+    if (attributes) {
+        uploads.copyBuffer(attributes, m_attribute_buffer, firstunit * m_attribute_stride,
+                           vk::AccessFlagBits::eVertexAttributeRead,
+                           vk::PipelineStageFlagBits::eVertexInput, m_concurrent);
+    }
+
+    if (indices) {
+        uploads.copyBuffer(indices, m_index_buffer,
+                           range.first_index * range.index_units * sizeof(uint16_t),
+                           vk::AccessFlagBits::eIndexRead | m_build_access,
+                           vk::PipelineStageFlagBits::eVertexInput | m_build_stages,
+                           m_concurrent);
+    }
+}
+
+void
+geometry_pool::write(const geometry_range& range,
+                     const void*           positions,
+                     vk::DeviceSize        position_bytes,
+                     const void*           attributes,
+                     vk::DeviceSize        attribute_bytes,
+                     const void*           indices,
+                     vk::DeviceSize        index_bytes) const
+{
+    assert(direct() && "the geometry pool isn't host visible!");
+
+    const vk::DeviceSize firstunit = range.vertex_offset * range.vertex_units;
+
+    // Coherent, and the submit after this makes the writes visible to the device
+    if (position_bytes > 0) {
+        std::memcpy(static_cast<char*>(m_position_memory.mapped) + firstunit * m_position_stride,
+                    positions, (size_t)position_bytes);
+    }
+    if (attribute_bytes > 0) {
+        std::memcpy(static_cast<char*>(m_attribute_memory.mapped) + firstunit * m_attribute_stride,
+                    attributes, (size_t)attribute_bytes);
+    }
+    if (index_bytes > 0) {
+        std::memcpy(static_cast<char*>(m_index_memory.mapped)
+                      + range.first_index * range.index_units * sizeof(uint16_t),
+                    indices, (size_t)index_bytes);
+    }
+}
+
+void
+geometry_pool::free_list::reset(uint32_t capacity)
+{
+    m_free.clear();
+    if (capacity > 0) {
+        m_free[0] = capacity;
+    }
+}
+
+/*
+An aligned range may not start where its free range does, in which case what is skipped stays free
+in front of it.
+*/
+bool
+geometry_pool::free_list::allocate(uint32_t count, uint32_t alignment, uint32_t& offset)
+{
+    for (auto it = m_free.begin(); it != m_free.end(); ++it) {
+        const uint32_t start   = it->first;
+        const uint32_t end     = it->first + it->second;
+        const uint32_t aligned = (start + alignment - 1) / alignment * alignment;
+
+        if (aligned > end || end - aligned < count) {
+            continue;
+        }
+
+        offset = aligned;
+
+        if (aligned > start) {
+            it->second = aligned - start;
+        } else {
+            m_free.erase(it);
+        }
+
+        if (end > aligned + count) {
+            m_free[aligned + count] = end - aligned - count;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void
+geometry_pool::free_list::release(uint32_t offset, uint32_t count)
+{
+    auto next = m_free.lower_bound(offset);
+
+    // Merge with the free range right after this one
+    if (next != m_free.end() && next->first == offset + count) {
+        count += next->second;
+        next = m_free.erase(next);
+    }
+
+    // And with the one right before it
+    if (next != m_free.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += count;
+            return;
+        }
+    }
+
+    m_free.emplace_hint(next, offset, count);
+}
+
+}  // namespace shiny::graphics
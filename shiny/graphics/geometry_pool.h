@@ -0,0 +1,171 @@
+#pragma once
+
+#include "graphics/memory_allocator.h"
+#include "graphics/upload_service.h"
+
+#include <map>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Where a mesh lives inside the geometry pool. Indices stay relative to the mesh's first vertex, so
+`vertex_offset` and `first_index` go straight into the vertexOffset and firstIndex of a draw.
+Offsets and counts are in the mesh's own vertices and indices, whatever their size.
+*/
+struct geometry_range
+{
+    uint32_t      vertex_offset = 0;
+    uint32_t      vertex_count  = 0;
+    uint32_t      first_index   = 0;
+    uint32_t      index_count   = 0;
+    uint32_t      vertex_units  = 1;  // of either of the pool's strides per vertex
+    uint32_t      index_units   = 2;  // of 16 bits per index
+    vk::IndexType index_type    = vk::IndexType::eUint32;
+
+    explicit operator bool() const { return vertex_count != 0; }
+};
+
+/*
+Two large device local vertex buffers and one index buffer shared by every mesh. Meshes get a
+range of each instead of buffers of their own, so every draw binds the same buffers, which is what
+lets the draw list go out as a handful of indirect multi-draws, and loading a mesh costs no
+allocation.
+
+The vertices are split into two streams: their positions in one buffer and every other attribute
+in the other, so that the passes which only need the positions, like the shadow maps', fetch a
+fraction of the bytes. Both streams are indexed by the same vertexOffset, so a range covers the
+same units of either, and a vertex format's attributes have to take as many units of the attribute
+stride as its positions take of the position stride, padded if need be.
+
+The buffers are sub-allocated first fit from a free list, in units of whole vertices and 16 bit
+indices. Meshes may use different vertex layouts, as long as their strides are multiples of the
+pool's: a vertex then takes several units, and its range starts at a multiple of its stride so
+that the draw's vertexOffset still counts whole vertices. 32 bit indices take two units the same
+way, so that binding the index buffer at offset 0 with either index type lets firstIndex reach
+every range of that type. A freed range may still be read by frames in
+flight, so hand it to `free()` through the deletion queue.
+
+New meshes are copied in while the graphics queue keeps reading the others. The buffers are
+therefore shared concurrently between all `queue_families` given to `init()`, since an ownership
+transfer would have to cover the whole buffer.
+
+Where all of VRAM can be mapped, see memory_allocator::resizableBar(), the buffers are host visible
+as well and meshes are written straight into them, which saves both the staging memory and the
+copy. Only ranges no frame is reading can be allocated, so that needs no synchronization beyond
+the next submit.
+
+Meshes coming and going leave holes behind that a larger mesh may not fit into, so the pool can be
+compacted: relocate() finds a range further towards the start of the buffers for a mesh, move()
+copies it there on the GPU, and once nothing reads the old range any more freeMoved() gives back
+what the mesh moved away from. Whoever keeps the mesh's range has to switch to the new one
+themselves.
+
+With `build_inputs`, acceleration structures are built from the positions and indices as well,
+through their device addresses, which the allocator has to hand out then, and the copies into them
+are made visible to the builds too.
+*/
+class geometry_pool
+{
+public:
+    void init(vk::Device                   device,
+              memory_allocator&            allocator,
+              const std::vector<uint32_t>& queue_families,
+              vk::DeviceSize               position_stride,
+              vk::DeviceSize               attribute_stride,
+              uint32_t                     max_vertices,
+              uint32_t                     max_indices,
+              bool                         build_inputs = false);
+    void destroy();
+
+    // Returns an empty range when either buffer has no large enough free range left. Strides of 0
+    // are the pool's own. `max_indices` given to init() are 16 bit ones.
+    geometry_range allocate(uint32_t       vertex_count,
+                            uint32_t       index_count,
+                            vk::DeviceSize position_stride  = 0,
+                            vk::DeviceSize attribute_stride = 0,
+                            vk::IndexType  index_type       = vk::IndexType::eUint32);
+    void           free(const geometry_range& range);
+
+    // A range for the same mesh whose vertices, indices or both start further towards the start of
+    // the buffers, with whichever of them can't staying where they are. Empty if neither can.
+    geometry_range relocate(const geometry_range& range);
+
+    // Records the GPU copies of the streams that `to` has moved, see relocate()
+    void move(upload_batch&         uploads,
+              const geometry_range& from,
+              const geometry_range& to) const;
+
+    // Frees what `from` doesn't share with `to` any more, once no frame reads it
+    void freeMoved(const geometry_range& from, const geometry_range& to);
+
+    // The bytes a range takes up in all three buffers
+    vk::DeviceSize bytes(const geometry_range& range) const;
+
+    // Records the copies of a mesh's staged vertex streams and indices into `range`
+    void upload(upload_batch&         uploads,
+                const geometry_range& range,
+                const staging_region& positions,
+                const staging_region& attributes,
+                const staging_region& indices) const;
+
+    // Whether the buffers are mapped, and write() can be used instead of upload()
+    bool direct() const
+    {
+        return m_position_memory.mapped && m_attribute_memory.mapped && m_index_memory.mapped;
+    }
+
+    // Copies a mesh's vertex streams and indices into `range` from the host, only if direct()
+    void write(const geometry_range& range,
+               const void*           positions,
+               vk::DeviceSize        position_bytes,
+               const void*           attributes,
+               vk::DeviceSize        attribute_bytes,
+               const void*           indices,
+               vk::DeviceSize        index_bytes) const;
+
+    vk::Buffer positionBuffer() const { return m_position_buffer; }
+    vk::Buffer attributeBuffer() const { return m_attribute_buffer; }
+
+    // The whole of either vertex stream, for descriptors that can't take VK_WHOLE_SIZE
+    vk::DeviceSize positionBytes() const { return m_position_stride * m_max_vertices; }
+    vk::DeviceSize attributeBytes() const { return m_attribute_stride * m_max_vertices; }
+    vk::Buffer indexBuffer() const { return m_index_buffer; }
+
+private:
+    class free_list
+    {
+    public:
+        void reset(uint32_t capacity);
+        bool allocate(uint32_t count, uint32_t alignment, uint32_t& offset);
+        void release(uint32_t offset, uint32_t count);
+
+    private:
+        std::map<uint32_t, uint32_t> m_free;  // offset -> count, neighbours are always merged
+    };
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::DeviceSize m_position_stride  = 0;
+    vk::DeviceSize m_attribute_stride = 0;
+    uint32_t       m_max_vertices     = 0;
+    bool           m_concurrent       = false;
+
+    // Who reads the positions and indices besides the vertex input, see `build_inputs`
+    vk::AccessFlags        m_build_access;
+    vk::PipelineStageFlags m_build_stages;
+
+    // Either stream's range of a mesh starts at the same unit, so they share the free list
+    vk::Buffer m_position_buffer;
+    allocation m_position_memory;
+    vk::Buffer m_attribute_buffer;
+    allocation m_attribute_memory;
+    free_list  m_free_vertices;
+
+    vk::Buffer m_index_buffer;
+    allocation m_index_memory;
+    free_list  m_free_indices;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,336 @@
+#include "graphics/gpu_culling.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Has to match local_size_x in cull.comp
+const uint32_t cull_group_size = 64;
+
+// The shader's push constants. The count fills the camera's vec3 out to 16 bytes, as in std430.
+struct cull_constants
+{
+    glm::vec4 planes[6];
+    glm::vec3 camera;
+    uint32_t  instance_count = 0;
+};
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+gpu_culling::init(vk::PhysicalDevice physical_device,
+                  vk::Device         device,
+                  memory_allocator&  allocator,
+                  layout_cache&      layouts,
+                  pipeline_cache&    pipelines,
+                  uint32_t           max_instances,
+                  uint32_t           frames,
+                  bool               occlusion,
+                  uint32_t           compute_family,
+                  uint32_t           graphics_family,
+                  bool               update_templates)
+{
+    m_device          = device;
+    m_allocator       = &allocator;
+    m_max_instances   = max_instances;
+    m_frames          = frames;
+    m_occlusion       = occlusion;
+    m_compute_family  = compute_family;
+    m_graphics_family = graphics_family;
+
+    // Every frame's regions are bound at their own offset, which has to be aligned
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+
+    // The cull_view goes first, bound separately, so the instances start at the next alignment
+    m_instances_offset     = occlusion ? alignUp(sizeof(cull_view), alignment) : 0;
+    m_instances_frame_size =
+      alignUp(m_instances_offset + max_instances * sizeof(cull_instance), alignment);
+    m_output_frame_size    = alignUp(
+      commands_offset + max_instances * sizeof(vk::DrawIndexedIndirectCommand), alignment);
+
+    auto instancesinfo = vk::BufferCreateInfo()
+                           .setSize(m_instances_frame_size * frames)
+                           .setUsage(vk::BufferUsageFlagBits::eStorageBuffer)
+                           .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_instances        = m_device.createBuffer(instancesinfo, hostAllocator());
+    m_instances_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_instances),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_instances, m_instances_memory.memory, m_instances_memory.offset);
+
+    // Only ever touched by the GPU: the count is cleared with a fill, then the shader writes both
+    auto outputinfo = vk::BufferCreateInfo()
+                        .setSize(m_output_frame_size * frames)
+                        .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                  | vk::BufferUsageFlagBits::eIndirectBuffer
+                                  | vk::BufferUsageFlagBits::eTransferDst)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_output        = m_device.createBuffer(outputinfo, hostAllocator());
+    m_output_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_output),
+                                            vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                            memory_allocator::resource_kind::linear,
+                                            memory_category::other);
+    m_device.bindBufferMemory(m_output, m_output_memory.memory, m_output_memory.offset);
+
+    // 0: this frame's cull_instances, 1: the draw buffer's commands, 2: the output, and for
+    // occlusion culling 3: this frame's cull_view, 4: the pyramid
+    std::array<vk::DescriptorSetLayoutBinding, 5> bindings;
+    for (uint32_t i = 0; i < (uint32_t)bindings.size(); ++i) {
+        bindings[i] = vk::DescriptorSetLayoutBinding()
+                        .setBinding(i)
+                        .setDescriptorCount(1)
+                        .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                        .setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    }
+    bindings[4].setDescriptorType(vk::DescriptorType::eCombinedImageSampler);
+
+    auto setlayoutinfo = vk::DescriptorSetLayoutCreateInfo()
+                           .setBindingCount(occlusion ? 5 : 3)
+                           .setPBindings(bindings.data());
+
+    vk::DescriptorSetLayout setlayout = layouts.descriptorSetLayout(setlayoutinfo);
+    m_writes.init(m_device, setlayout, bindings.data(), setlayoutinfo.bindingCount,
+                  update_templates);
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                       .setOffset(0)
+                       .setSize(sizeof(cull_constants));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setSetLayoutCount(1)
+                        .setPSetLayouts(&setlayout)
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    if (occlusion) {
+        m_descriptors.init(m_device,
+                           { { vk::DescriptorType::eStorageBuffer, 4 },
+                             { vk::DescriptorType::eCombinedImageSampler, 1 } },
+                           frames);
+    } else {
+        m_descriptors.init(m_device, { { vk::DescriptorType::eStorageBuffer, 3 } }, frames);
+    }
+    for (uint32_t i = 0; i < frames; ++i) {
+        m_sets.push_back(m_descriptors.allocate(setlayout));
+    }
+
+    // The same shader, compiled with OCCLUSION_CULLING defined
+    core::mapped_file code(occlusion ? "shaders/cull_occlusion_comp.spv" : "shaders/cull_comp.spv");
+
+    auto shaderinfo = vk::ShaderModuleCreateInfo()
+                        .setCodeSize(code.size())
+                        .setPCode((const uint32_t*)code.data());
+
+    m_shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+    auto pipelineinfo =
+      vk::ComputePipelineCreateInfo()
+        .setStage(vk::PipelineShaderStageCreateInfo()
+                    .setStage(vk::ShaderStageFlagBits::eCompute)
+                    .setModule(m_shader)
+                    .setPName("main"))
+        .setLayout(m_layout);
+
+    m_pipeline = m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+}
+
+void
+gpu_culling::destroy()
+{
+    m_device.destroyPipeline(m_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_shader, hostAllocator());
+    m_descriptors.destroy();
+    m_sets.clear();
+    m_writes.destroy();
+
+    m_device.destroyBuffer(m_instances, hostAllocator());
+    m_allocator->free(m_instances_memory);
+    m_device.destroyBuffer(m_output, hostAllocator());
+    m_allocator->free(m_output_memory);
+
+    m_instances = nullptr;
+    m_output    = nullptr;
+}
+
+void
+gpu_culling::beginFrame(uint32_t frame)
+{
+    m_frame = frame % m_frames;
+    m_count = 0;
+}
+
+void
+gpu_culling::push(const cull_instance& instance)
+{
+    if (m_count == m_max_instances) {
+        throw std::runtime_error("Culling buffer is out of space for this frame!");
+    }
+
+    // Write-combined like the draw buffer, so it's written in one go and never read back
+    char* data = static_cast<char*>(m_instances_memory.mapped) + m_frame * m_instances_frame_size
+                 + m_instances_offset;
+    std::memcpy(data + m_count * sizeof(instance), &instance, sizeof(instance));
+
+    ++m_count;
+}
+
+uint32_t
+gpu_culling::reserve(uint32_t count)
+{
+    if (count > m_max_instances - m_count) {
+        throw std::runtime_error("Culling buffer is out of space for this frame!");
+    }
+
+    const uint32_t first = m_count;
+    m_count += count;
+    return first;
+}
+
+/*
+The count has to be back at zero before the shader starts adding to it, and the shader's writes
+have to be done before the draws read them as parameters, hence the two barriers.
+
+Until the pyramid is valid the shader is told to skip the occlusion test, though the binding still
+has to point at something, which is whatever image the pyramid has been created with.
+*/
+void
+gpu_culling::record(vk::CommandBuffer  command_buffer,
+                    const frustum&     frustum,
+                    const glm::vec3&   camera,
+                    const draw_buffer& draws,
+                    const hiz_pyramid* occluders,
+                    const glm::mat4&   occluderviewprojection)
+{
+    const vk::DeviceSize instances = m_frame * m_instances_frame_size;
+
+    // The draw buffer's commands may be at a different offset every frame, so all of them are
+    // written again. The set was last used by this frame the previous time around, which is done.
+    // By binding, the last two only with occlusion culling
+    std::array<descriptor_data, 5> data;
+    data[0].buffer = vk::DescriptorBufferInfo(m_instances, instances + m_instances_offset,
+                                              m_instances_frame_size - m_instances_offset);
+    data[1].buffer =
+      vk::DescriptorBufferInfo(draws.buffer(), draws.commandOffset(0),
+                               draws.capacity() * sizeof(vk::DrawIndexedIndirectCommand));
+    data[2].buffer = vk::DescriptorBufferInfo(m_output, countOffset(), m_output_frame_size);
+    data[3].buffer = vk::DescriptorBufferInfo(m_instances, instances, sizeof(cull_view));
+
+    if (m_occlusion) {
+        if (!occluders) {
+            throw std::runtime_error("Occlusion culling needs a pyramid to cull against!");
+        }
+
+        cull_view view;
+        if (occluders->valid()) {
+            view.view_projection = occluderviewprojection;
+            view.pyramid_size =
+              glm::vec2((float)occluders->extent().width, (float)occluders->extent().height);
+            view.pyramid_levels = (float)occluders->levels();
+            view.enabled        = 1;
+        }
+        std::memcpy(static_cast<char*>(m_instances_memory.mapped) + instances, &view, sizeof(view));
+
+        data[4].image = vk::DescriptorImageInfo(occluders->sampler(), occluders->view(),
+                                                vk::ImageLayout::eGeneral);
+    }
+
+    m_writes.update(m_sets[m_frame], data.data());
+
+    command_buffer.fillBuffer(m_output, countOffset(), sizeof(uint32_t), 0);
+
+    auto cleared = vk::BufferMemoryBarrier()
+                     .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                     .setDstAccessMask(vk::AccessFlagBits::eShaderRead
+                                       | vk::AccessFlagBits::eShaderWrite)
+                     .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                     .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                     .setBuffer(m_output)
+                     .setOffset(countOffset())
+                     .setSize(sizeof(uint32_t));
+
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::DependencyFlags(), nullptr, cleared, nullptr);
+
+    cull_constants constants;
+    for (uint32_t i = 0; i < 6; ++i) {
+        constants.planes[i] = frustum.planes[i];
+    }
+    constants.camera         = camera;
+    constants.instance_count = m_count;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, 0,
+                                      m_sets[m_frame], nullptr);
+    command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof(constants), &constants);
+    command_buffer.dispatch((m_count + cull_group_size - 1) / cull_group_size, 1, 1);
+
+    // On the same family, the draws are synchronized with this by the render graph
+    if (m_compute_family == m_graphics_family) {
+        return;
+    }
+
+    // The release half of the ownership transfer, whose destination access doesn't matter
+    auto released = vk::BufferMemoryBarrier()
+                      .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                      .setSrcQueueFamilyIndex(m_compute_family)
+                      .setDstQueueFamilyIndex(m_graphics_family)
+                      .setBuffer(m_output)
+                      .setOffset(countOffset())
+                      .setSize(m_output_frame_size);
+
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eBottomOfPipe,
+                                   vk::DependencyFlags(), nullptr, released, nullptr);
+}
+
+/*
+The acquire half matches the release in `record()`, except for its source access, which doesn't
+matter. Whatever the release made available is visible to the indirect reads after this, once the
+semaphore the submission waits on has been signalled by the compute queue.
+*/
+void
+gpu_culling::acquire(vk::CommandBuffer command_buffer) const
+{
+    if (m_compute_family == m_graphics_family) {
+        return;
+    }
+
+    auto acquired = vk::BufferMemoryBarrier()
+                      .setSrcAccessMask(vk::AccessFlags())
+                      .setDstAccessMask(vk::AccessFlagBits::eIndirectCommandRead)
+                      .setSrcQueueFamilyIndex(m_compute_family)
+                      .setDstQueueFamilyIndex(m_graphics_family)
+                      .setBuffer(m_output)
+                      .setOffset(countOffset())
+                      .setSize(m_output_frame_size);
+
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe,
+                                   vk::PipelineStageFlagBits::eDrawIndirect,
+                                   vk::DependencyFlags(), nullptr, acquired, nullptr);
+}
+
+}  // namespace shiny::graphics
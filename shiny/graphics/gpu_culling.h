@@ -0,0 +1,155 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/descriptor_template.h"
+#include "graphics/draw_buffer.h"
+#include "graphics/frustum_culling.h"
+#include "graphics/hiz_pyramid.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+
+#include <glm/glm.hpp>
+
+namespace shiny::graphics {
+
+/*
+What the culling shader reads per instance, laid out like its std430 CullInstance struct. A
+meshlet of an instance is culled on its own with an entry of its own, which also carries the
+meshlet's back face cone, see meshlet.h, and replaces the command's index range with the meshlet's.
+*/
+struct cull_instance
+{
+    glm::vec4 sphere;                                // world space center and radius
+    glm::vec4 cone = glm::vec4(0.f, 0.f, 0.f, 1.f);  // world space axis and cutoff
+
+    uint32_t draw        = 0;  // index of the instance's command in the draw buffer
+    uint32_t instance    = 0;  // index of the instance in the draw buffer
+    uint32_t first_index = 0;  // the meshlet's
+    uint32_t index_count = 0;  // the meshlet's, or 0 for the whole command
+};
+
+static_assert(sizeof(cull_instance) == 48, "cull_instance has to match the shader's layout");
+
+/*
+What the occlusion culling shader reads once per frame, laid out like its std430 CullView block
+*/
+struct cull_view
+{
+    glm::mat4 view_projection;       // the one the pyramid's depth was drawn with
+    glm::vec2 pyramid_size;          // of level 0
+    float     pyramid_levels = 0.f;
+    uint32_t  enabled        = 0;
+};
+
+static_assert(sizeof(cull_view) == 80, "cull_view has to match the shader's layout");
+
+/*
+Frustum culling on the GPU. Every instance in the draw buffer gets a bounding sphere here, or one
+per meshlet, and a compute shader tests them all against the frustum, and meshlets against their
+back face cones as well. Everything that passes gets a VkDrawIndexedIndirectCommand of its own in
+the output buffer, a copy of its draw's with instanceCount 1, firstInstance pointing back at the
+instance and, for a meshlet, the meshlet's indices, and bumps the count that
+vkCmdDrawIndexedIndirectCountKHR then reads.
+
+Nothing is read back by the CPU, so the whole frame's culling and drawing costs one dispatch and one
+draw call to record, however many instances there are. The draws come out in no particular order.
+
+With occlusion culling the instances are also tested against a hiz_pyramid of the previous frame's
+depth buffer, projected with the previous frame's view-projection. That is a frame late: whatever
+comes out from behind something shows up one frame after it should.
+
+Like the draw buffer, every frame in flight has regions of its own, which may only be rewritten once
+that frame's fence has been waited on.
+
+The culling may be recorded for a compute queue of another family than the graphics queue drawing
+its output, in which case the output region is released by `record()` and has to be acquired with
+`acquire()` on the graphics queue before the draws. Its previous contents are never needed, so it
+goes back to the compute family without a transfer.
+*/
+class gpu_culling
+{
+public:
+    void init(vk::PhysicalDevice physical_device,
+              vk::Device         device,
+              memory_allocator&  allocator,
+              layout_cache&      layouts,
+              pipeline_cache&    pipelines,
+              uint32_t           max_instances,  // entries, meshlets included
+              uint32_t           frames,
+              bool               occlusion,
+              uint32_t           compute_family,
+              uint32_t           graphics_family,
+              bool               update_templates = false);
+    void destroy();
+
+    void beginFrame(uint32_t frame);
+    void push(const cull_instance& instance);
+
+    // Sets aside `count` entries of this frame for something else to write on the GPU before
+    // `record()`, returning the index of the first
+    uint32_t reserve(uint32_t count);
+
+    // Records the culling of this frame's instances against `frustum`, and their meshlets' cones
+    // against `camera`, outside of a render pass. The output has to be made visible to the indirect
+    // draws after it, by the render graph or `acquire()`. With occlusion culling, the instances are
+    // culled against `occluders` as well once it is valid, which was drawn with
+    // `occluderviewprojection`. It has to be given, valid or not.
+    void record(vk::CommandBuffer  command_buffer,
+                const frustum&     frustum,
+                const glm::vec3&   camera,
+                const draw_buffer& draws,
+                const hiz_pyramid* occluders              = nullptr,
+                const glm::mat4&   occluderviewprojection = glm::mat4(1.f));
+
+    // Makes the output of `record()` on the compute family ready for indirect draws recorded after
+    // it on the graphics family. Nothing to do when they're the same family.
+    void acquire(vk::CommandBuffer command_buffer) const;
+
+    vk::Buffer     buffer() const { return m_output; }
+    vk::DeviceSize commandOffset() const { return m_frame * m_output_frame_size + commands_offset; }
+    vk::DeviceSize countOffset() const { return m_frame * m_output_frame_size; }
+
+    // The current frame's cull_instances, for whatever writes the reserved ones
+    vk::Buffer     instanceBuffer() const { return m_instances; }
+    vk::DeviceSize instanceOffset() const
+    {
+        return m_frame * m_instances_frame_size + m_instances_offset;
+    }
+    vk::DeviceSize instanceRange() const { return m_instances_frame_size - m_instances_offset; }
+
+    // As many commands as the output may get this frame
+    uint32_t count() const { return m_count; }
+
+private:
+    // The count comes first in every output region, padded so the commands start 16 bytes in
+    static const vk::DeviceSize commands_offset = 16;
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::Buffer     m_instances;  // host visible, cull_view and cull_instances of every frame
+    allocation     m_instances_memory;
+    vk::Buffer     m_output;     // device local, count and commands of every frame
+    allocation     m_output_memory;
+    vk::DeviceSize m_instances_frame_size = 0;
+    vk::DeviceSize m_instances_offset     = 0;  // past the cull_view, in every frame's region
+    vk::DeviceSize m_output_frame_size    = 0;
+    uint32_t       m_max_instances        = 0;
+    uint32_t       m_frames               = 0;
+    bool           m_occlusion            = false;
+    uint32_t       m_compute_family       = 0;
+    uint32_t       m_graphics_family      = 0;
+
+    descriptor_allocator           m_descriptors;
+    std::vector<vk::DescriptorSet> m_sets;    // one per frame
+    descriptor_template            m_writes;  // all of a set, rewritten every frame
+    vk::PipelineLayout             m_layout;  // owned by the layout_cache
+    vk::ShaderModule               m_shader;
+    vk::Pipeline                   m_pipeline;
+
+    uint32_t m_frame = 0;
+    uint32_t m_count = 0;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,593 @@
+#include "graphics/gpu_profiler.h"
+
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+#if defined(VK_KHR_performance_query) && defined(VK_EXT_host_query_reset)
+const char*
+unitName(vk::PerformanceCounterUnitKHR unit)
+{
+    switch (unit) {
+    case vk::PerformanceCounterUnitKHR::ePercentage:
+        return "%";
+    case vk::PerformanceCounterUnitKHR::eNanoseconds:
+        return "ns";
+    case vk::PerformanceCounterUnitKHR::eBytes:
+        return "bytes";
+    case vk::PerformanceCounterUnitKHR::eBytesPerSecond:
+        return "bytes/s";
+    case vk::PerformanceCounterUnitKHR::eKelvin:
+        return "K";
+    case vk::PerformanceCounterUnitKHR::eWatts:
+        return "W";
+    case vk::PerformanceCounterUnitKHR::eVolts:
+        return "V";
+    case vk::PerformanceCounterUnitKHR::eAmps:
+        return "A";
+    case vk::PerformanceCounterUnitKHR::eHertz:
+        return "Hz";
+    case vk::PerformanceCounterUnitKHR::eCycles:
+        return "cycles";
+    default:
+        return "";
+    }
+}
+
+double
+counterValue(const vk::PerformanceCounterResultKHR& result, uint32_t storage)
+{
+    switch ((vk::PerformanceCounterStorageKHR)storage) {
+    case vk::PerformanceCounterStorageKHR::eInt32:
+        return (double)result.int32;
+    case vk::PerformanceCounterStorageKHR::eInt64:
+        return (double)result.int64;
+    case vk::PerformanceCounterStorageKHR::eUint32:
+        return (double)result.uint32;
+    case vk::PerformanceCounterStorageKHR::eUint64:
+        return (double)result.uint64;
+    case vk::PerformanceCounterStorageKHR::eFloat32:
+        return (double)result.float32;
+    default:
+        return result.float64;
+    }
+}
+
+std::string
+lowercase(std::string text)
+{
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    return text;
+}
+#endif
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+gpu_profiler::init(vk::PhysicalDevice physical_device,
+                   vk::Device         device,
+                   uint32_t           graphics_family,
+                   uint32_t           frames,
+                   bool               statistics,
+                   uint32_t           max_scopes)
+{
+    m_device     = device;
+    m_max_scopes = max_scopes;
+    m_frames     = frames;
+    m_period     = physical_device.getProperties().limits.timestampPeriod;
+
+    if (statistics) {
+        auto statisticsinfo = vk::QueryPoolCreateInfo()
+                                .setQueryType(vk::QueryType::ePipelineStatistics)
+                                .setQueryCount(max_statistics_scopes)
+                                .setPipelineStatistics(statisticsFlags());
+
+        for (uint32_t i = 0; i < frames; ++i) {
+            m_statistics_pools.push_back(m_device.createQueryPool(statisticsinfo, hostAllocator()));
+        }
+        m_statistics_names.resize(frames);
+    }
+
+    const uint32_t validbits =
+      physical_device.getQueueFamilyProperties()[graphics_family].timestampValidBits;
+    if (validbits == 0) {
+        return;
+    }
+    m_mask = validbits >= 64 ? ~0ull : (1ull << validbits) - 1;
+
+    auto poolinfo = vk::QueryPoolCreateInfo()
+                      .setQueryType(vk::QueryType::eTimestamp)
+                      .setQueryCount(max_scopes * 2);
+
+    for (uint32_t i = 0; i < frames; ++i) {
+        m_pools.push_back(m_device.createQueryPool(poolinfo, hostAllocator()));
+    }
+    m_names.resize(frames);
+    m_submit_times.resize(frames, 0);
+    m_results.resize(max_scopes * 2);
+    m_track = core::namedTrack("GPU");
+}
+
+void
+gpu_profiler::destroy()
+{
+    for (vk::QueryPool pool : m_pools) {
+        m_device.destroyQueryPool(pool, hostAllocator());
+    }
+    for (vk::QueryPool pool : m_statistics_pools) {
+        m_device.destroyQueryPool(pool, hostAllocator());
+    }
+    for (counter_group& group : m_counter_groups) {
+        for (vk::QueryPool pool : group.pools) {
+            m_device.destroyQueryPool(pool, hostAllocator());
+        }
+    }
+    if (countersSupported()) {
+        m_release_profiling_lock(static_cast<VkDevice>(m_device));
+    }
+    m_pools.clear();
+    m_names.clear();
+    m_statistics_pools.clear();
+    m_statistics_names.clear();
+    m_counter_groups.clear();
+    m_counter_names.clear();
+}
+
+/*
+The counters are taken in the order the driver enumerates them, each into the last group if that
+still takes a single pass with it, or else into a group of its own. Those that take more than one
+pass on their own are left out, and so are those of command buffer scope, whose queries would have
+to be all there is in a command buffer.
+*/
+bool
+gpu_profiler::enableCounters(vk::Instance                    instance,
+                             vk::PhysicalDevice              physical_device,
+                             uint32_t                        family,
+                             const std::vector<std::string>& selection)
+{
+#if defined(VK_KHR_performance_query) && defined(VK_EXT_host_query_reset)
+    // Extension commands aren't exported by the loader
+    auto enumerate = (PFN_vkEnumeratePhysicalDeviceQueueFamilyPerformanceQueryCountersKHR)
+      instance.getProcAddr("vkEnumeratePhysicalDeviceQueueFamilyPerformanceQueryCountersKHR");
+    auto passes = (PFN_vkGetPhysicalDeviceQueueFamilyPerformanceQueryPassesKHR)instance.getProcAddr(
+      "vkGetPhysicalDeviceQueueFamilyPerformanceQueryPassesKHR");
+    auto acquire =
+      (PFN_vkAcquireProfilingLockKHR)m_device.getProcAddr("vkAcquireProfilingLockKHR");
+    m_release_profiling_lock =
+      (PFN_vkReleaseProfilingLockKHR)m_device.getProcAddr("vkReleaseProfilingLockKHR");
+    m_reset_query_pool = (PFN_vkResetQueryPoolEXT)m_device.getProcAddr("vkResetQueryPoolEXT");
+    if (!enumerate || !passes || !acquire || !m_release_profiling_lock || !m_reset_query_pool) {
+        return false;
+    }
+
+    const VkPhysicalDevice physical = static_cast<VkPhysicalDevice>(physical_device);
+
+    uint32_t count = 0;
+    enumerate(physical, family, &count, nullptr, nullptr);
+    std::vector<vk::PerformanceCounterKHR>            counters(count);
+    std::vector<vk::PerformanceCounterDescriptionKHR> descriptions(count);
+    if (enumerate(physical, family, &count,
+                  reinterpret_cast<VkPerformanceCounterKHR*>(counters.data()),
+                  reinterpret_cast<VkPerformanceCounterDescriptionKHR*>(descriptions.data()))
+        != VK_SUCCESS) {
+        return false;
+    }
+
+    std::vector<std::string> terms;
+    for (const std::string& term : selection) {
+        terms.push_back(lowercase(term));
+    }
+    auto selected = [&](const std::string& name, const std::string& category) {
+        const std::string n = lowercase(name);
+        const std::string c = lowercase(category);
+        for (const std::string& term : terms) {
+            if (!term.empty()
+                && (n.find(term) != std::string::npos || c.find(term) != std::string::npos)) {
+                return true;
+            }
+        }
+        return false;
+    };
+    auto onepass = [&](const std::vector<uint32_t>& indices) {
+        auto performanceinfo =
+          vk::QueryPoolPerformanceCreateInfoKHR().setQueueFamilyIndex(family).setCounterIndices(
+            indices);
+        uint32_t needed = 0;
+        passes(physical,
+               reinterpret_cast<const VkQueryPoolPerformanceCreateInfoKHR*>(&performanceinfo),
+               &needed);
+        return needed == 1;
+    };
+
+    for (uint32_t i = 0; i < count && m_hardware_counters.size() < max_counters; ++i) {
+        const std::string name     = descriptions[i].name.data();
+        const std::string category = descriptions[i].category.data();
+        if (counters[i].scope == vk::PerformanceCounterScopeKHR::eCommandBuffer
+            || !selected(name, category)) {
+            continue;
+        }
+
+        std::vector<uint32_t> indices;
+        if (!m_counter_groups.empty()) {
+            indices = m_counter_groups.back().indices;
+        }
+        indices.push_back(i);
+        if (m_counter_groups.empty() || !onepass(indices)) {
+            if (!onepass({ i })) {
+                continue;
+            }
+            m_counter_groups.emplace_back();
+        }
+
+        counter_group& group = m_counter_groups.back();
+        group.indices.push_back(i);
+        group.counters.push_back((uint32_t)m_hardware_counters.size());
+        m_hardware_counters.push_back({ name, category, unitName(counters[i].unit) });
+        m_counter_storage.push_back((uint32_t)counters[i].storage);
+    }
+
+    // Waiting for as long as whoever else holds it does
+    auto lockinfo = vk::AcquireProfilingLockInfoKHR().setTimeout(UINT64_MAX);
+    if (m_counter_groups.empty()
+        || acquire(static_cast<VkDevice>(m_device),
+                   reinterpret_cast<const VkAcquireProfilingLockInfoKHR*>(&lockinfo))
+             != VK_SUCCESS) {
+        m_counter_groups.clear();
+        m_hardware_counters.clear();
+        m_counter_storage.clear();
+        return false;
+    }
+
+    for (counter_group& group : m_counter_groups) {
+        auto performanceinfo = vk::QueryPoolPerformanceCreateInfoKHR()
+                                 .setQueueFamilyIndex(family)
+                                 .setCounterIndices(group.indices);
+        auto poolinfo = vk::QueryPoolCreateInfo()
+                          .setPNext(&performanceinfo)
+                          .setQueryType(vk::QueryType::ePerformanceQueryKHR)
+                          .setQueryCount(max_counter_scopes);
+
+        for (uint32_t i = 0; i < m_frames; ++i) {
+            group.pools.push_back(m_device.createQueryPool(poolinfo, hostAllocator()));
+            m_reset_query_pool(static_cast<VkDevice>(m_device),
+                               static_cast<VkQueryPool>(group.pools.back()), 0, max_counter_scopes);
+        }
+    }
+    m_counter_names.resize(m_frames);
+    m_counter_group.resize(m_frames, 0);
+    return true;
+#else
+    (void)instance;
+    (void)physical_device;
+    (void)family;
+    (void)selection;
+    return false;
+#endif
+}
+
+vk::QueryPipelineStatisticFlags
+gpu_profiler::statisticsFlags() const
+{
+    // In the order of the gpu_statistics fields, which is the order of the bits and so of the
+    // results as well
+    return vk::QueryPipelineStatisticFlagBits::eInputAssemblyVertices
+           | vk::QueryPipelineStatisticFlagBits::eInputAssemblyPrimitives
+           | vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations
+           | vk::QueryPipelineStatisticFlagBits::eClippingInvocations
+           | vk::QueryPipelineStatisticFlagBits::eClippingPrimitives
+           | vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations
+           | vk::QueryPipelineStatisticFlagBits::eComputeShaderInvocations;
+}
+
+/*
+The pools start out unreset, and so with no results, but then their frame hasn't got any names yet
+either. Results that are somehow not available are skipped rather than waited for.
+*/
+void
+gpu_profiler::beginFrame(vk::CommandBuffer command_buffer, uint32_t frame)
+{
+    m_frame = frame;
+
+    if (countersSupported()) {
+        readCounters(frame);
+    }
+
+    if (statisticsSupported()) {
+        std::vector<std::string>& names = m_statistics_names[frame];
+        if (!names.empty()) {
+            std::vector<gpu_statistics> results(names.size());
+            static_assert(sizeof(gpu_statistics) == 7 * sizeof(uint64_t),
+                          "The results are read straight into gpu_statistics");
+
+            const vk::Result result = m_device.getQueryPoolResults(
+              m_statistics_pools[frame], 0, (uint32_t)names.size(),
+              results.size() * sizeof(gpu_statistics), results.data(), sizeof(gpu_statistics),
+              vk::QueryResultFlagBits::e64);
+
+            if (result == vk::Result::eSuccess) {
+                for (size_t i = 0; i < names.size(); ++i) {
+                    m_statistics[names[i]] = results[i];
+                }
+            }
+            names.clear();
+        }
+        command_buffer.resetQueryPool(m_statistics_pools[frame], 0, max_statistics_scopes);
+    }
+
+    if (!supported()) {
+        return;
+    }
+
+    std::vector<std::string>& names = m_names[frame];
+    if (!names.empty()) {
+        const uint32_t   count  = (uint32_t)names.size() * 2;
+        const vk::Result result = m_device.getQueryPoolResults(
+          m_pools[frame], 0, count, count * sizeof(uint64_t), m_results.data(), sizeof(uint64_t),
+          vk::QueryResultFlagBits::e64);
+
+        if (result == vk::Result::eSuccess) {
+            const uint64_t framebegin = m_results[0] & m_mask;
+
+            for (uint32_t i = 0; i < names.size(); ++i) {
+                const uint64_t begin = m_results[i * 2] & m_mask;
+                const uint64_t end   = m_results[i * 2 + 1] & m_mask;
+
+                // Wrapped around in between, as far as the valid bits go
+                const uint64_t ticks = (end - begin) & m_mask;
+                addSample(names[i], (float)((double)ticks * m_period * 1e-6));
+
+                const int64_t offset =
+                  (int64_t)((double)((begin - framebegin) & m_mask) * m_period);
+                const int64_t start = m_submit_times[frame] + offset;
+                m_track->record(core::internName(names[i]), start,
+                                start + (int64_t)((double)ticks * m_period));
+            }
+        }
+        names.clear();
+    }
+
+    command_buffer.resetQueryPool(m_pools[frame], 0, m_max_scopes * 2);
+}
+
+/*
+Performance queries are reset on the host, which is safe once the frame's fence has been waited on,
+and every pool is reset right after its results are read, so that whichever group is sampled next
+finds its pool reset.
+*/
+void
+gpu_profiler::readCounters(uint32_t frame)
+{
+#if defined(VK_KHR_performance_query) && defined(VK_EXT_host_query_reset)
+    std::vector<std::string>& names = m_counter_names[frame];
+    const counter_group&      group = m_counter_groups[m_counter_group[frame]];
+
+    if (!names.empty()) {
+        const size_t groupsize = group.indices.size();
+        std::vector<vk::PerformanceCounterResultKHR> results(names.size() * groupsize);
+
+        const vk::Result result = m_device.getQueryPoolResults(
+          group.pools[frame], 0, (uint32_t)names.size(),
+          results.size() * sizeof(vk::PerformanceCounterResultKHR), results.data(),
+          groupsize * sizeof(vk::PerformanceCounterResultKHR), vk::QueryResultFlags());
+
+        if (result == vk::Result::eSuccess) {
+            const double unsampled = std::numeric_limits<double>::quiet_NaN();
+            for (size_t i = 0; i < names.size(); ++i) {
+                std::vector<double>& values = m_counter_values[names[i]];
+                values.resize(m_hardware_counters.size(), unsampled);
+
+                for (size_t j = 0; j < groupsize; ++j) {
+                    const uint32_t c = group.counters[j];
+                    values[c] = counterValue(results[i * groupsize + j], m_counter_storage[c]);
+                }
+            }
+        }
+        names.clear();
+    }
+    m_reset_query_pool(static_cast<VkDevice>(m_device),
+                       static_cast<VkQueryPool>(group.pools[frame]), 0, max_counter_scopes);
+
+    m_counter_group[frame] = m_next_group;
+    m_next_group           = (m_next_group + 1) % (uint32_t)m_counter_groups.size();
+#else
+    (void)frame;
+#endif
+}
+
+void
+gpu_profiler::submitted(uint32_t frame)
+{
+    if (supported()) {
+        m_submit_times[frame] = core::profileNow();
+    }
+}
+
+uint32_t
+gpu_profiler::begin(vk::CommandBuffer command_buffer, const std::string& name)
+{
+    if (!supported() || m_names[m_frame].size() >= m_max_scopes) {
+        return m_max_scopes;
+    }
+
+    std::vector<std::string>& names = m_names[m_frame];
+    const uint32_t            scope = (uint32_t)names.size();
+    names.push_back(name);
+
+    command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, m_pools[m_frame],
+                                  scope * 2);
+    return scope;
+}
+
+void
+gpu_profiler::end(vk::CommandBuffer command_buffer, uint32_t scope)
+{
+    if (scope >= m_max_scopes) {
+        return;
+    }
+    command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_pools[m_frame],
+                                  scope * 2 + 1);
+}
+
+uint32_t
+gpu_profiler::beginStatistics(vk::CommandBuffer command_buffer, const std::string& name)
+{
+    if (!statisticsSupported() || m_statistics_names[m_frame].size() >= max_statistics_scopes) {
+        return max_statistics_scopes;
+    }
+
+    std::vector<std::string>& names = m_statistics_names[m_frame];
+    const uint32_t            scope = (uint32_t)names.size();
+    names.push_back(name);
+
+    command_buffer.beginQuery(m_statistics_pools[m_frame], scope, vk::QueryControlFlags());
+    return scope;
+}
+
+void
+gpu_profiler::endStatistics(vk::CommandBuffer command_buffer, uint32_t scope)
+{
+    if (scope >= max_statistics_scopes) {
+        return;
+    }
+    command_buffer.endQuery(m_statistics_pools[m_frame], scope);
+}
+
+uint32_t
+gpu_profiler::beginCounters(vk::CommandBuffer command_buffer, const std::string& name)
+{
+    if (!countersSupported() || m_counter_names[m_frame].size() >= max_counter_scopes) {
+        return max_counter_scopes;
+    }
+
+    std::vector<std::string>& names = m_counter_names[m_frame];
+    const uint32_t            scope = (uint32_t)names.size();
+    names.push_back(name);
+
+    command_buffer.beginQuery(m_counter_groups[m_counter_group[m_frame]].pools[m_frame], scope,
+                              vk::QueryControlFlags());
+    return scope;
+}
+
+void
+gpu_profiler::endCounters(vk::CommandBuffer command_buffer, uint32_t scope)
+{
+    if (scope >= max_counter_scopes) {
+        return;
+    }
+    command_buffer.endQuery(m_counter_groups[m_counter_group[m_frame]].pools[m_frame], scope);
+}
+
+void
+gpu_profiler::addSample(const std::string& name, float milliseconds)
+{
+    history& h = m_histories[name];
+    if (h.samples.size() < history_size) {
+        h.samples.push_back(milliseconds);
+    } else {
+        h.samples[h.next] = milliseconds;
+    }
+    h.next = (h.next + 1) % history_size;
+    ++h.total;
+}
+
+/*
+Nearest rank percentiles of a sorted copy; with a few hundred samples at most that's cheap enough
+for whoever asks every frame.
+*/
+bool
+gpu_profiler::timing(const std::string& name, gpu_timing& timing) const
+{
+    auto it = m_histories.find(name);
+    if (it == m_histories.end() || it->second.samples.empty()) {
+        return false;
+    }
+
+    std::vector<float> sorted = it->second.samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    const uint32_t count = (uint32_t)sorted.size();
+    auto percentile = [&](float p) {
+        const uint32_t rank = (uint32_t)(p * (float)(count - 1) + 0.5f);
+        return sorted[std::min(rank, count - 1)];
+    };
+
+    float total = 0.f;
+    for (float sample : sorted) {
+        total += sample;
+    }
+
+    timing.average_ms = total / (float)count;
+    timing.median_ms  = percentile(0.5f);
+    timing.p95_ms     = percentile(0.95f);
+    timing.p99_ms     = percentile(0.99f);
+    timing.max_ms     = sorted.back();
+    timing.samples    = count;
+    return true;
+}
+
+bool
+gpu_profiler::latest(const std::string& name, float& milliseconds, uint64_t& count) const
+{
+    auto it = m_histories.find(name);
+    if (it == m_histories.end() || it->second.samples.empty()) {
+        return false;
+    }
+
+    const history& h = it->second;
+    milliseconds     = h.samples[(h.next + h.samples.size() - 1) % h.samples.size()];
+    count            = h.total;
+    return true;
+}
+
+bool
+gpu_profiler::statistics(const std::string& name, gpu_statistics& statistics) const
+{
+    auto it = m_statistics.find(name);
+    if (it == m_statistics.end()) {
+        return false;
+    }
+    statistics = it->second;
+    return true;
+}
+
+bool
+gpu_profiler::counter(const std::string& name, uint32_t index, double& value) const
+{
+    auto it = m_counter_values.find(name);
+    if (it == m_counter_values.end() || index >= it->second.size()
+        || std::isnan(it->second[index])) {
+        return false;
+    }
+    value = it->second[index];
+    return true;
+}
+
+std::vector<std::string>
+gpu_profiler::counterPasses() const
+{
+    std::vector<std::string> names;
+    for (const auto& [name, values] : m_counter_values) {
+        names.push_back(name);
+    }
+    return names;
+}
+
+std::vector<std::string>
+gpu_profiler::passes() const
+{
+    std::vector<std::string> names;
+    for (const auto& [name, h] : m_histories) {
+        names.push_back(name);
+    }
+    return names;
+}
+
+}  // namespace shiny::graphics
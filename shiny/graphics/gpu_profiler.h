@@ -0,0 +1,240 @@
+#pragma once
+
+#include "core/profiler.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+// Rolling statistics of one pass's GPU time, over the samples that are still in its history
+struct gpu_timing
+{
+    float    average_ms = 0.f;
+    float    median_ms  = 0.f;
+    float    p95_ms     = 0.f;
+    float    p99_ms     = 0.f;
+    float    max_ms     = 0.f;
+    uint32_t samples    = 0;
+};
+
+// What the pipeline did during one pass of the last frame it was measured in
+struct gpu_statistics
+{
+    uint64_t input_vertices       = 0;
+    uint64_t input_primitives     = 0;
+    uint64_t vertex_invocations   = 0;
+    uint64_t clipping_invocations = 0;  // primitives that reached clipping
+    uint64_t clipping_primitives  = 0;  // what came out of it
+    uint64_t fragment_invocations = 0;
+    uint64_t compute_invocations  = 0;
+};
+
+// One of the GPU's hardware counters, as the driver describes it
+struct gpu_counter
+{
+    std::string name;
+    std::string category;
+    std::string unit;
+};
+
+/*
+GPU time per pass, measured with timestamp queries written around the pass in the command buffer.
+Every frame in flight has a query pool of its own, and a frame's results are only read back right
+before that frame's queries are recorded again, which is after its fence has been waited on. By
+then they are all available, so reading them back never stalls anything, and the timings are just
+as old as the frames in flight.
+
+Samples go into a history per pass name, from which the statistics are computed when they are asked
+for. Timings measured some other way, e.g. those of the upload service's own submissions, can be
+added with addSample(). Without timestamp support on the graphics queue every scope is a no-op.
+
+The scopes also go on a "GPU" track of the CPU profiler, so they show up in its trace. The GPU's
+clock isn't the CPU's, so every frame is placed as if it started when it was submitted, which is
+as early as it can have started.
+
+With pipelineStatisticsQuery enabled on the device, passes can also count what the pipeline did in
+them, e.g. how many fragments were shaded, which is what culling, levels of detail and overdraw
+are about. Unlike timestamps those queries can't be nested, so statistics scopes are separate.
+
+With VK_KHR_performance_query, counter scopes sample hardware counters as well, e.g. cache hit
+rates, ALU utilization, memory bandwidth and occupancy, which say why a pass takes as long as it
+does. A GPU can only count so many of them at once, so the selected counters are split into groups
+that each take one pass of the commands, and every frame samples the next group. Sampling every
+counter takes as many frames as there are groups, which a benchmark runs anyway, rather than
+submitting every frame once per group. The profiling lock is held from enableCounters() until
+destroy(), during which nothing else can sample the counters.
+*/
+class gpu_profiler
+{
+public:
+    void init(vk::PhysicalDevice physical_device,
+              vk::Device         device,
+              uint32_t           graphics_family,
+              uint32_t           frames,
+              bool               statistics,
+              uint32_t           max_scopes = 32);
+    void destroy();
+
+    bool supported() const { return !m_pools.empty(); }
+
+    // Picks up the results of the frame that last used `frame`'s queries, whose fence has to have
+    // been waited on, and resets them in `command_buffer`, before any scope of the frame and
+    // outside of a render pass
+    void beginFrame(vk::CommandBuffer command_buffer, uint32_t frame);
+
+    // Right after the frame's command buffer was submitted
+    void submitted(uint32_t frame);
+
+    // Times whatever `record` records into `command_buffer`, from when the GPU starts on it to when
+    // everything before the end has finished. Scopes of a frame beyond max_scopes aren't timed.
+    template<typename Func>
+    void scope(vk::CommandBuffer command_buffer, const std::string& name, Func record);
+
+    // The same for scopes that don't fit in a function: end() takes what begin() returned
+    uint32_t begin(vk::CommandBuffer command_buffer, const std::string& name);
+    void     end(vk::CommandBuffer command_buffer, uint32_t scope);
+
+    // Counts what the pipeline does for the commands `record` records, if pipeline statistics are
+    // supported. Statistics scopes can't be inside one another, and secondary command buffers
+    // executed in one need inheritedQueries and statisticsFlags() in their inheritance info.
+    template<typename Func>
+    void statistics(vk::CommandBuffer command_buffer, const std::string& name, Func record);
+
+    bool statisticsSupported() const { return !m_statistics_pools.empty(); }
+
+    // Samples the hardware counters of `family`'s queues whose name or category contains one of
+    // `selection`, ignoring case, if `device` was created with performance_query enabled. False if
+    // none of them could be, in which case counter scopes are no-ops. After init().
+    bool enableCounters(vk::Instance                    instance,
+                        vk::PhysicalDevice              physical_device,
+                        uint32_t                        family,
+                        const std::vector<std::string>& selection);
+
+    // Samples this frame's group of counters for the commands `record` records, which have to be
+    // outside of a render pass and in `command_buffer` itself rather than a secondary one. Counter
+    // scopes can't be inside one another.
+    template<typename Func>
+    void counters(vk::CommandBuffer command_buffer, const std::string& name, Func record);
+
+    bool countersSupported() const { return !m_counter_groups.empty(); }
+
+    // Every counter being sampled, which the values of counter() are indexed by
+    const std::vector<gpu_counter>& hardwareCounters() const { return m_hardware_counters; }
+
+    // False for a counter that hasn't been sampled in the pass yet
+    bool counter(const std::string& name, uint32_t index, double& value) const;
+
+    // Every pass that has had counters sampled, in name order
+    std::vector<std::string> counterPasses() const;
+
+    // What statistics scopes count
+    vk::QueryPipelineStatisticFlags statisticsFlags() const;
+
+    void addSample(const std::string& name, float milliseconds);
+
+    // False for a pass that hasn't been sampled yet
+    bool timing(const std::string& name, gpu_timing& timing) const;
+
+    // The pass's most recent sample, and how many it has had so far, so that whoever polls this
+    // can tell whether there's a new one. False for a pass that hasn't been sampled yet.
+    bool latest(const std::string& name, float& milliseconds, uint64_t& count) const;
+
+    // Every pass that has been sampled, in name order
+    std::vector<std::string> passes() const;
+
+    // False for a pass whose statistics haven't been read back yet
+    bool statistics(const std::string& name, gpu_statistics& statistics) const;
+
+private:
+    // The last history_size samples, oldest overwritten first
+    struct history
+    {
+        std::vector<float> samples;
+        uint32_t           next  = 0;
+        uint64_t           total = 0;  // samples ever added
+    };
+
+    static const uint32_t history_size          = 240;
+    static const uint32_t max_statistics_scopes = 8;
+    static const uint32_t max_counter_scopes    = 32;
+    static const uint32_t max_counters          = 16;
+
+    // Counters that are sampled together, by their index in m_hardware_counters and in the
+    // enumeration of the queue family's counters
+    struct counter_group
+    {
+        std::vector<uint32_t>      counters;
+        std::vector<uint32_t>      indices;
+        std::vector<vk::QueryPool> pools;  // one per frame, one query per scope
+    };
+
+    uint32_t beginStatistics(vk::CommandBuffer command_buffer, const std::string& name);
+    void     endStatistics(vk::CommandBuffer command_buffer, uint32_t scope);
+    uint32_t beginCounters(vk::CommandBuffer command_buffer, const std::string& name);
+    void     endCounters(vk::CommandBuffer command_buffer, uint32_t scope);
+    void     readCounters(uint32_t frame);
+
+    vk::Device m_device;
+    float      m_period = 1.f;  // nanoseconds per tick
+    uint64_t   m_mask   = 0;    // of the bits the timestamps are valid in
+
+    std::vector<vk::QueryPool>            m_pools;         // one per frame, two queries per scope
+    std::vector<std::vector<std::string>> m_names;         // of every frame's scopes, by query
+    std::vector<int64_t>                  m_submit_times;  // of every frame, on the CPU's clock
+    uint32_t                              m_max_scopes = 0;
+    uint32_t                              m_frame      = 0;
+    core::profile_track*                  m_track      = nullptr;
+
+    std::map<std::string, history> m_histories;
+    std::vector<uint64_t>          m_results;  // readback scratch
+
+    std::vector<vk::QueryPool>            m_statistics_pools;  // one query per scope
+    std::vector<std::vector<std::string>> m_statistics_names;
+    std::map<std::string, gpu_statistics> m_statistics;
+
+    std::vector<gpu_counter>                   m_hardware_counters;
+    std::vector<uint32_t>                      m_counter_storage;  // VkPerformanceCounterStorageKHR
+    std::vector<counter_group>                 m_counter_groups;
+    std::vector<std::vector<std::string>>      m_counter_names;    // of every frame's scopes
+    std::vector<uint32_t>                      m_counter_group;    // every frame sampled
+    std::map<std::string, std::vector<double>> m_counter_values;   // NaN until sampled
+    uint32_t                                   m_next_group = 0;
+    uint32_t                                   m_frames     = 0;
+
+    PFN_vkResetQueryPoolEXT       m_reset_query_pool       = nullptr;
+    PFN_vkReleaseProfilingLockKHR m_release_profiling_lock = nullptr;
+};
+
+template<typename Func>
+void
+gpu_profiler::scope(vk::CommandBuffer command_buffer, const std::string& name, Func record)
+{
+    const uint32_t scope = begin(command_buffer, name);
+    record();
+    end(command_buffer, scope);
+}
+
+template<typename Func>
+void
+gpu_profiler::statistics(vk::CommandBuffer command_buffer, const std::string& name, Func record)
+{
+    const uint32_t scope = beginStatistics(command_buffer, name);
+    record();
+    endStatistics(command_buffer, scope);
+}
+
+template<typename Func>
+void
+gpu_profiler::counters(vk::CommandBuffer command_buffer, const std::string& name, Func record)
+{
+    const uint32_t scope = beginCounters(command_buffer, name);
+    record();
+    endCounters(command_buffer, scope);
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,282 @@
+#include "graphics/gpu_skinning.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// Has to match local_size_x in skin.comp
+const uint32_t skin_group_size = 64;
+
+// The shader's push constants, a skinning_job
+static_assert(sizeof(shiny::graphics::skinning_job) == 16, "skinning_job is pushed as it is");
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+/*
+Keyframes are blended linearly, the rotations along the shorter arc. Each joint's transform is its
+parent's times its own, which is only ever read back from the scratch matrices, since the palette
+may be uncached.
+*/
+void
+samplePalette(const skeleton& skeleton, const animation_clip& clip, float time, glm::mat4* palette)
+{
+    const uint32_t joints = skeleton.size();
+    if (clip.frame_count == 0 || clip.poses.size() < (size_t)clip.frame_count * joints) {
+        throw std::runtime_error("Animation clip doesn't fit the skeleton!");
+    }
+
+    // Looped, negative times included
+    float looped = std::fmod(time, clip.duration);
+    if (looped < 0.f) {
+        looped += clip.duration;
+    }
+
+    const float    position = looped / clip.duration * (float)clip.frame_count;
+    const uint32_t first    = std::min((uint32_t)position, clip.frame_count - 1);
+    const uint32_t second   = (first + 1) % clip.frame_count;
+    const float    blend    = position - (float)first;
+
+    thread_local std::vector<glm::mat4> globals;
+    globals.resize(joints);
+
+    for (uint32_t j = 0; j < joints; ++j) {
+        const joint_pose& a = clip.poses[first * joints + j];
+        const joint_pose& b = clip.poses[second * joints + j];
+
+        const glm::vec3 translation = glm::mix(a.translation, b.translation, blend);
+        const glm::quat rotation    = glm::slerp(a.rotation, b.rotation, blend);
+        const glm::vec3 scale       = glm::mix(a.scale, b.scale, blend);
+
+        glm::mat4 local = glm::mat4_cast(rotation);
+        local[0] *= scale.x;
+        local[1] *= scale.y;
+        local[2] *= scale.z;
+        local[3] = glm::vec4(translation, 1.f);
+
+        const uint32_t parent = skeleton.parents[j];
+        globals[j]            = parent < j ? globals[parent] * local : local;
+        palette[j]            = globals[j] * skeleton.inverse_bind[j];
+    }
+}
+
+void
+gpu_skinning::init(vk::PhysicalDevice           physical_device,
+                   vk::Device                   device,
+                   memory_allocator&            allocator,
+                   layout_cache&                layouts,
+                   pipeline_cache&              pipelines,
+                   vk::Buffer                   positions,
+                   uint32_t                     max_vertices,
+                   uint32_t                     max_joints,
+                   uint32_t                     frames,
+                   const std::vector<uint32_t>& queue_families,
+                   bool                         update_templates)
+{
+    m_device        = device;
+    m_allocator     = &allocator;
+    m_concurrent    = queue_families.size() > 1;
+    m_max_vertices  = max_vertices;
+    m_used_vertices = 0;
+    m_max_joints    = max_joints;
+    m_frames        = frames;
+
+    // Every frame's region is bound at its own offset, which has to be aligned
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+
+    m_palettes_frame_size = alignUp(max_joints * sizeof(glm::mat4), alignment);
+
+    // Copied in like the geometry pool's vertices, so shared the same way
+    auto sourcesinfo = vk::BufferCreateInfo()
+                         .setSize(max_vertices * sizeof(skinned_source))
+                         .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                   | vk::BufferUsageFlagBits::eTransferDst)
+                         .setSharingMode(vk::SharingMode::eExclusive);
+    if (m_concurrent) {
+        sourcesinfo.setSharingMode(vk::SharingMode::eConcurrent)
+          .setQueueFamilyIndexCount((uint32_t)queue_families.size())
+          .setPQueueFamilyIndices(queue_families.data());
+    }
+
+    m_sources        = m_device.createBuffer(sourcesinfo, hostAllocator());
+    m_sources_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_sources),
+                                             vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                             memory_allocator::resource_kind::linear,
+                                             memory_category::vertex);
+    m_device.bindBufferMemory(m_sources, m_sources_memory.memory, m_sources_memory.offset);
+
+    auto palettesinfo = vk::BufferCreateInfo()
+                          .setSize(m_palettes_frame_size * frames)
+                          .setUsage(vk::BufferUsageFlagBits::eStorageBuffer)
+                          .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_palettes        = m_device.createBuffer(palettesinfo, hostAllocator());
+    m_palettes_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_palettes),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_palettes, m_palettes_memory.memory, m_palettes_memory.offset);
+
+    // 0: the sources, 1: this frame's palettes, 2: the position stream
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings;
+    for (uint32_t i = 0; i < (uint32_t)bindings.size(); ++i) {
+        bindings[i] = vk::DescriptorSetLayoutBinding()
+                        .setBinding(i)
+                        .setDescriptorCount(1)
+                        .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                        .setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    }
+
+    auto setlayoutinfo = vk::DescriptorSetLayoutCreateInfo()
+                           .setBindingCount((uint32_t)bindings.size())
+                           .setPBindings(bindings.data());
+
+    vk::DescriptorSetLayout setlayout = layouts.descriptorSetLayout(setlayoutinfo);
+    m_writes.init(m_device, setlayout, bindings.data(), (uint32_t)bindings.size(),
+                  update_templates);
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                       .setOffset(0)
+                       .setSize(sizeof(skinning_job));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setSetLayoutCount(1)
+                        .setPSetLayouts(&setlayout)
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    // The regions never move, so every frame's set is written once here
+    m_descriptors.init(m_device, { { vk::DescriptorType::eStorageBuffer, 3 } }, frames);
+    for (uint32_t i = 0; i < frames; ++i) {
+        m_sets.push_back(m_descriptors.allocate(setlayout));
+
+        std::array<descriptor_data, 3> data;
+        data[0].buffer = vk::DescriptorBufferInfo(m_sources, 0, VK_WHOLE_SIZE);
+        data[1].buffer =
+          vk::DescriptorBufferInfo(m_palettes, i * m_palettes_frame_size, m_palettes_frame_size);
+        data[2].buffer = vk::DescriptorBufferInfo(positions, 0, VK_WHOLE_SIZE);
+        m_writes.update(m_sets.back(), data.data());
+    }
+
+    core::mapped_file code("shaders/skin_comp.spv");
+
+    auto shaderinfo = vk::ShaderModuleCreateInfo()
+                        .setCodeSize(code.size())
+                        .setPCode((const uint32_t*)code.data());
+
+    m_shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+    auto pipelineinfo =
+      vk::ComputePipelineCreateInfo()
+        .setStage(vk::PipelineShaderStageCreateInfo()
+                    .setStage(vk::ShaderStageFlagBits::eCompute)
+                    .setModule(m_shader)
+                    .setPName("main"))
+        .setLayout(m_layout);
+
+    m_pipeline = m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+}
+
+void
+gpu_skinning::destroy()
+{
+    m_device.destroyPipeline(m_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_shader, hostAllocator());
+    m_descriptors.destroy();
+    m_sets.clear();
+    m_writes.destroy();
+
+    m_device.destroyBuffer(m_sources, hostAllocator());
+    m_allocator->free(m_sources_memory);
+    m_device.destroyBuffer(m_palettes, hostAllocator());
+    m_allocator->free(m_palettes_memory);
+
+    m_sources  = nullptr;
+    m_palettes = nullptr;
+}
+
+uint32_t
+gpu_skinning::allocate(uint32_t count)
+{
+    if (count > m_max_vertices - m_used_vertices) {
+        throw std::runtime_error("Skinning buffer is out of space!");
+    }
+
+    const uint32_t source = m_used_vertices;
+    m_used_vertices += count;
+    return source;
+}
+
+void
+gpu_skinning::upload(upload_batch& uploads, uint32_t source, const staging_region& vertices) const
+{
+    uploads.copyBuffer(vertices, m_sources, source * sizeof(skinned_source),
+                       vk::AccessFlagBits::eShaderRead, vk::PipelineStageFlagBits::eComputeShader,
+                       m_concurrent);
+}
+
+void
+gpu_skinning::beginFrame(uint32_t frame)
+{
+    m_frame       = frame % m_frames;
+    m_used_joints = 0;
+    m_jobs.clear();
+}
+
+glm::mat4*
+gpu_skinning::palettes(uint32_t count, uint32_t& first)
+{
+    if (count > m_max_joints - m_used_joints) {
+        throw std::runtime_error("Joint palettes are out of space for this frame!");
+    }
+
+    first = m_used_joints;
+    m_used_joints += count;
+
+    char* data = static_cast<char*>(m_palettes_memory.mapped) + m_frame * m_palettes_frame_size;
+    return reinterpret_cast<glm::mat4*>(data) + first;
+}
+
+void
+gpu_skinning::push(const skinning_job& job)
+{
+    m_jobs.push_back(job);
+}
+
+// One invocation skins one vertex, with the job's offsets pushed as they are
+void
+gpu_skinning::record(vk::CommandBuffer command_buffer) const
+{
+    if (m_jobs.empty()) {
+        return;
+    }
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, 0,
+                                      m_sets[m_frame], nullptr);
+    for (const skinning_job& job : m_jobs) {
+        command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(job),
+                                     &job);
+        command_buffer.dispatch((job.vertex_count + skin_group_size - 1) / skin_group_size, 1, 1);
+    }
+}
+
+}  // namespace shiny::graphics
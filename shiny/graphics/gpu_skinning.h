@@ -0,0 +1,153 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/descriptor_template.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/upload_service.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+
+namespace shiny::graphics {
+
+// The joints moving a vertex, up to four with weights that add up to 255
+struct skin_vertex
+{
+    uint8_t joints[4]  = {};
+    uint8_t weights[4] = {};
+};
+
+// What skinning reads of a vertex, laid out like the std430 SkinVertex struct of skin.comp
+struct skinned_source
+{
+    glm::vec3   position;  // in the bind pose
+    skin_vertex skin;
+};
+
+static_assert(sizeof(skinned_source) == 20, "skinned_source has to match the shader's layout");
+
+// A joint's transform relative to its parent
+struct joint_pose
+{
+    glm::vec3 translation = glm::vec3(0.f);
+    glm::quat rotation    = glm::quat(1.f, 0.f, 0.f, 0.f);
+    glm::vec3 scale       = glm::vec3(1.f);
+};
+
+// Parents come before their children, so a pose can be resolved front to back
+struct skeleton
+{
+    std::vector<uint32_t>  parents;       // ~0u for a root
+    std::vector<glm::mat4> inverse_bind;  // model space to each joint's, in the bind pose
+
+    uint32_t size() const { return (uint32_t)parents.size(); }
+};
+
+// Poses of every joint at evenly spaced keyframes, looping back to the first after the last
+struct animation_clip
+{
+    float                   duration    = 1.f;  // in seconds
+    uint32_t                frame_count = 0;
+    std::vector<joint_pose> poses;  // the first keyframe's for every joint, then the next one's
+};
+
+// The skinning matrices of `skeleton` at `time` into `clip`, a joint each. Only ever writes to
+// `palette`, which may be write-combined memory.
+void samplePalette(const skeleton&       skeleton,
+                   const animation_clip& clip,
+                   float                 time,
+                   glm::mat4*            palette);
+
+// One instance to skin this frame, see gpu_skinning::push
+struct skinning_job
+{
+    uint32_t source       = 0;  // the first of its source vertices, from allocate()
+    uint32_t vertex_count = 0;
+    uint32_t palette      = 0;  // its first matrix, from palettes()
+    uint32_t output       = 0;  // the first vertex it writes of the position stream
+};
+
+/*
+Skins meshes on the GPU, linear blend skinning with up to four joints a vertex. Every skinned
+instance has a range of the geometry pool of its own, whose attributes and indices are uploaded
+like any other mesh's, while its positions are written every frame by a compute shader: from the
+bind pose positions and the joints and weights of the source vertices, which instances of the same
+mesh share, and the instance's palette of skinning matrices. The draws read the skinned positions
+like any others, so whatever passes draw the instance share the same result, the shadow maps too,
+and nothing about the pipelines changes.
+
+The palettes are sampled on the CPU, straight into the frame's region of a host visible buffer,
+one per frame in flight like the light_culling's. An instance has only the one range of skinned
+positions though, so the skinning has to be ordered after the previous frame's draws by the render
+graph. Only full vertices' positions can be written, which are 32 bit floats.
+
+The source vertices are never freed, they are meant to be the meshes' that are loaded for good.
+*/
+class gpu_skinning
+{
+public:
+    // `positions` is the geometry pool's position stream, which the skinning writes to.
+    // `queue_families` are those copying the sources in and reading them.
+    void init(vk::PhysicalDevice           physical_device,
+              vk::Device                   device,
+              memory_allocator&            allocator,
+              layout_cache&                layouts,
+              pipeline_cache&              pipelines,
+              vk::Buffer                   positions,
+              uint32_t                     max_vertices,
+              uint32_t                     max_joints,
+              uint32_t                     frames,
+              const std::vector<uint32_t>& queue_families,
+              bool                         update_templates = false);
+    void destroy();
+
+    // Room for `count` source vertices, where upload() copies them to
+    uint32_t allocate(uint32_t count);
+    void     upload(upload_batch& uploads, uint32_t source, const staging_region& vertices) const;
+
+    // Drops the last jobs, and starts handing out the palettes of `frame`'s region
+    void beginFrame(uint32_t frame);
+
+    // `count` matrices of this frame's region, starting at `first`, to be written only
+    glm::mat4* palettes(uint32_t count, uint32_t& first);
+    void       push(const skinning_job& job);
+
+    // Records the frame's jobs, outside of a render pass. The positions have to be made visible to
+    // the vertex input by the render graph.
+    void record(vk::CommandBuffer command_buffer) const;
+
+    uint32_t jobs() const { return (uint32_t)m_jobs.size(); }
+
+private:
+    vk::Device        m_device;
+    memory_allocator* m_allocator  = nullptr;
+    bool              m_concurrent = false;
+
+    vk::Buffer m_sources;  // device local, skinned_source of every mesh
+    allocation m_sources_memory;
+    uint32_t   m_max_vertices  = 0;
+    uint32_t   m_used_vertices = 0;
+
+    vk::Buffer     m_palettes;  // host visible, skinning matrices of every frame
+    allocation     m_palettes_memory;
+    vk::DeviceSize m_palettes_frame_size = 0;
+    uint32_t       m_max_joints          = 0;
+    uint32_t       m_frames              = 0;
+
+    descriptor_allocator           m_descriptors;
+    std::vector<vk::DescriptorSet> m_sets;  // one per frame, written once
+    descriptor_template            m_writes;
+    vk::PipelineLayout             m_layout;  // owned by the layout_cache
+    vk::ShaderModule               m_shader;
+    vk::Pipeline                   m_pipeline;
+
+    uint32_t                  m_frame       = 0;
+    uint32_t                  m_used_joints = 0;  // of the frame's region
+    std::vector<skinning_job> m_jobs;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,331 @@
+#include "graphics/hiz_pyramid.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+
+// Has to match local_size_x and local_size_y in hiz.comp
+const uint32_t hiz_group_size = 8;
+
+// The shader's push constants
+struct hiz_constants
+{
+    int32_t source_width  = 0;
+    int32_t source_height = 0;
+    int32_t width         = 0;
+    int32_t height        = 0;
+};
+
+vk::Extent2D
+halve(vk::Extent2D extent)
+{
+    return vk::Extent2D(std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u));
+}
+
+vk::ImageSubresourceRange
+levelRange(uint32_t level, uint32_t count = 1)
+{
+    return vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, count, 0, 1);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+hiz_pyramid::init(vk::Device                   device,
+                  memory_allocator&            allocator,
+                  layout_cache&                layouts,
+                  view_cache&                  views,
+                  pipeline_cache&              pipelines,
+                  const std::vector<uint32_t>& queue_families,
+                  vk::SampleCountFlagBits      depth_samples)
+{
+    m_device         = device;
+    m_allocator      = &allocator;
+    m_queue_families = queue_families;
+
+    // 0: the level before, or the depth buffer, 1: the level being built
+    std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(0)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(1)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eStorageImage)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+    };
+
+    auto setlayoutinfo = vk::DescriptorSetLayoutCreateInfo()
+                           .setBindingCount((uint32_t)bindings.size())
+                           .setPBindings(bindings.data());
+
+    m_set_layout = layouts.descriptorSetLayout(setlayoutinfo);
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                       .setOffset(0)
+                       .setSize(sizeof(hiz_constants));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setSetLayoutCount(1)
+                        .setPSetLayouts(&m_set_layout)
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    auto createPipeline = [&](const char* path, vk::ShaderModule& shader) {
+        core::mapped_file code(path);
+
+        auto shaderinfo = vk::ShaderModuleCreateInfo()
+                            .setCodeSize(code.size())
+                            .setPCode((const uint32_t*)code.data());
+
+        shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+        auto pipelineinfo =
+          vk::ComputePipelineCreateInfo()
+            .setStage(vk::PipelineShaderStageCreateInfo()
+                        .setStage(vk::ShaderStageFlagBits::eCompute)
+                        .setModule(shader)
+                        .setPName("main"))
+            .setLayout(m_layout);
+
+        return m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+    };
+
+    m_pipeline = createPipeline("shaders/hiz_comp.spv", m_shader);
+
+    // Level 0 takes the farthest of every depth texel's samples instead, with the same layout
+    if (depth_samples != vk::SampleCountFlagBits::e1) {
+        m_depth_pipeline = createPipeline("shaders/hiz_ms_comp.spv", m_depth_shader);
+    }
+
+    // Texels are only ever fetched or sampled exactly, at the level that covers the bounds
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(vk::Filter::eNearest)
+                         .setMinFilter(vk::Filter::eNearest)
+                         .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                         .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setMinLod(0.f)
+                         .setMaxLod(VK_LOD_CLAMP_NONE);
+
+    m_sampler = views.sampler(samplerinfo);
+}
+
+void
+hiz_pyramid::destroy()
+{
+    for (vk::ImageView view : m_level_views) {
+        m_device.destroyImageView(view, hostAllocator());
+    }
+    m_level_views.clear();
+    m_sets.clear();
+
+    m_device.destroyImageView(m_view, hostAllocator());
+    m_device.destroyImage(m_image, hostAllocator());
+    m_allocator->free(m_memory);
+    m_descriptors.destroy();
+
+    m_device.destroyPipeline(m_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_shader, hostAllocator());
+    if (m_depth_pipeline) {
+        m_device.destroyPipeline(m_depth_pipeline, hostAllocator());
+        m_device.destroyShaderModule(m_depth_shader, hostAllocator());
+        m_depth_pipeline = nullptr;
+        m_depth_shader   = nullptr;
+    }
+
+    m_view  = nullptr;
+    m_image = nullptr;
+}
+
+/*
+Level 0 is half the depth buffer's size, rounded down. Where a size is odd the last texel of the
+next level covers the extra row or column as well, so nothing is left out of the farthest depth.
+*/
+void
+hiz_pyramid::create(upload_batch&   uploads,
+                    vk::Extent2D    extent,
+                    vk::ImageView   depth,
+                    deletion_queue& deletions,
+                    uint64_t        frame)
+{
+    retire(deletions, frame);
+
+    m_depth_extent = extent;
+    m_extent       = halve(extent);
+    m_valid        = false;
+
+    uint32_t levels = 1;
+    while ((std::max(m_extent.width, m_extent.height) >> levels) > 0) {
+        ++levels;
+    }
+
+    auto imageinfo = vk::ImageCreateInfo()
+                       .setImageType(vk::ImageType::e2D)
+                       .setExtent(vk::Extent3D(m_extent.width, m_extent.height, 1))
+                       .setMipLevels(levels)
+                       .setArrayLayers(1)
+                       .setFormat(vk::Format::eR32Sfloat)
+                       .setTiling(vk::ImageTiling::eOptimal)
+                       .setInitialLayout(vk::ImageLayout::eUndefined)
+                       .setUsage(vk::ImageUsageFlagBits::eStorage
+                                 | vk::ImageUsageFlagBits::eSampled)
+                       .setSamples(vk::SampleCountFlagBits::e1)
+                       .setSharingMode(vk::SharingMode::eExclusive);
+
+    if (m_queue_families.size() > 1) {
+        imageinfo.setSharingMode(vk::SharingMode::eConcurrent)
+          .setQueueFamilyIndexCount((uint32_t)m_queue_families.size())
+          .setPQueueFamilyIndices(m_queue_families.data());
+    }
+
+    m_image  = m_device.createImage(imageinfo, hostAllocator());
+    m_memory = m_allocator->allocate(m_device.getImageMemoryRequirements(m_image),
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                     memory_allocator::resource_kind::optimal,
+                                     memory_category::render_target);
+    m_device.bindImageMemory(m_image, m_memory.memory, m_memory.offset);
+
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(m_image)
+                      .setViewType(vk::ImageViewType::e2D)
+                      .setFormat(vk::Format::eR32Sfloat)
+                      .setSubresourceRange(levelRange(0, levels));
+
+    m_view = m_device.createImageView(viewinfo, hostAllocator());
+
+    for (uint32_t level = 0; level < levels; ++level) {
+        viewinfo.setSubresourceRange(levelRange(level));
+        m_level_views.push_back(m_device.createImageView(viewinfo, hostAllocator()));
+    }
+
+    m_descriptors.init(m_device,
+                       { { vk::DescriptorType::eCombinedImageSampler, 1 },
+                         { vk::DescriptorType::eStorageImage, 1 } },
+                       levels);
+
+    for (uint32_t level = 0; level < levels; ++level) {
+        m_sets.push_back(m_descriptors.allocate(m_set_layout));
+
+        auto source =
+          level == 0
+            ? vk::DescriptorImageInfo(m_sampler, depth, vk::ImageLayout::eShaderReadOnlyOptimal)
+            : vk::DescriptorImageInfo(m_sampler, m_level_views[level - 1],
+                                      vk::ImageLayout::eGeneral);
+        auto destination =
+          vk::DescriptorImageInfo(nullptr, m_level_views[level], vk::ImageLayout::eGeneral);
+
+        std::array<vk::WriteDescriptorSet, 2> writes = {
+            vk::WriteDescriptorSet()
+              .setDstSet(m_sets[level])
+              .setDstBinding(0)
+              .setDescriptorCount(1)
+              .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+              .setPImageInfo(&source),
+            vk::WriteDescriptorSet()
+              .setDstSet(m_sets[level])
+              .setDstBinding(1)
+              .setDescriptorCount(1)
+              .setDescriptorType(vk::DescriptorType::eStorageImage)
+              .setPImageInfo(&destination),
+        };
+        m_device.updateDescriptorSets(writes, nullptr);
+    }
+
+    // The pyramid stays in the general layout from here on, for both building and sampling it
+    uploads.transitionImageLayout(m_image, vk::ImageAspectFlagBits::eColor,
+                                  vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, levels);
+}
+
+/*
+The barriers between the levels only cover the build itself. Everything else, the next frame's
+culling reading the pyramid included, is up to the render graph.
+*/
+void
+hiz_pyramid::record(vk::CommandBuffer command_buffer)
+{
+    vk::Extent2D source = m_depth_extent;
+    vk::Extent2D size   = m_extent;
+
+    for (uint32_t level = 0; level < levels(); ++level) {
+        if (level == 0) {
+            command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                        m_depth_pipeline ? m_depth_pipeline : m_pipeline);
+        } else if (level == 1 && m_depth_pipeline) {
+            command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+        }
+
+        hiz_constants constants;
+        constants.source_width  = (int32_t)source.width;
+        constants.source_height = (int32_t)source.height;
+        constants.width         = (int32_t)size.width;
+        constants.height        = (int32_t)size.height;
+
+        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, 0,
+                                          m_sets[level], nullptr);
+        command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                     sizeof(constants), &constants);
+        command_buffer.dispatch((size.width + hiz_group_size - 1) / hiz_group_size,
+                                (size.height + hiz_group_size - 1) / hiz_group_size, 1);
+
+        // The next level reads this one
+        auto built = vk::ImageMemoryBarrier()
+                       .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                       .setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+                       .setOldLayout(vk::ImageLayout::eGeneral)
+                       .setNewLayout(vk::ImageLayout::eGeneral)
+                       .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                       .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                       .setImage(m_image)
+                       .setSubresourceRange(levelRange(level));
+
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                       vk::PipelineStageFlagBits::eComputeShader,
+                                       vk::DependencyFlags(), nullptr, nullptr, built);
+
+        source = size;
+        size   = halve(size);
+    }
+
+    m_valid = true;
+}
+
+// The previous frames may still be culling against the old pyramid
+void
+hiz_pyramid::retire(deletion_queue& deletions, uint64_t frame)
+{
+    if (!m_image) {
+        return;
+    }
+
+    for (vk::ImageView view : m_level_views) {
+        deletions.push(frame, view);
+    }
+    deletions.push(frame, m_view);
+    deletions.push(frame, m_image);
+    deletions.push(frame, m_memory);
+
+    descriptor_allocator old = m_descriptors;
+    deletions.pushAction(frame, [old]() mutable { old.destroy(); });
+
+    m_level_views.clear();
+    m_sets.clear();
+    m_descriptors = descriptor_allocator();
+    m_view        = nullptr;
+    m_image       = nullptr;
+    m_memory      = allocation();
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "graphics/deletion_queue.h"
+#include "graphics/descriptor_allocator.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/upload_service.h"
+#include "graphics/view_cache.h"
+
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+A hierarchical-Z pyramid: the depth buffer reduced to half its size, then to half of that and so on
+down to 1x1, where every texel holds the farthest depth of the texels it covers. Anything that is
+behind a texel's depth over the whole area it covers is hidden by whatever was drawn there, which
+gpu_culling uses to cull instances that the previous frame's depth buffer says are occluded.
+
+Every level is built from the one before it by a compute shader, recorded after the render pass
+that wrote the depth buffer. The depth buffer has to be created with sampled usage and be stored by
+that render pass. The pyramid is shared concurrently between all `queue_families` given to
+`init()`, for culling on a queue of another family. A multisampled depth buffer is reduced to the
+farthest of its samples, which takes a shader of its own for level 0.
+*/
+class hiz_pyramid
+{
+public:
+    void init(vk::Device                   device,
+              memory_allocator&            allocator,
+              layout_cache&                layouts,
+              view_cache&                  views,
+              pipeline_cache&              pipelines,
+              const std::vector<uint32_t>& queue_families,
+              vk::SampleCountFlagBits      depth_samples = vk::SampleCountFlagBits::e1);
+    void destroy();
+
+    // Creates the pyramid for a depth buffer of the given size, retiring the old one with `frame`.
+    // `depth` is the depth buffer's view, with only the depth aspect.
+    void create(upload_batch&   uploads,
+                vk::Extent2D    extent,
+                vk::ImageView   depth,
+                deletion_queue& deletions,
+                uint64_t        frame);
+
+    // Records the build. The depth image has to be in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and
+    // its writes visible to compute shaders, as does whatever read the pyramid before have to be
+    // done, see render_graph.
+    void record(vk::CommandBuffer command_buffer);
+
+    // Whether the pyramid has been built since it was created, i.e. holds anything to cull against
+    bool valid() const { return m_valid; }
+
+    // All levels, in VK_IMAGE_LAYOUT_GENERAL
+    vk::Image     image() const { return m_image; }
+    vk::ImageView view() const { return m_view; }
+    vk::Sampler   sampler() const { return m_sampler; }
+    vk::Extent2D  extent() const { return m_extent; }  // of level 0
+    uint32_t      levels() const { return (uint32_t)m_level_views.size(); }
+
+private:
+    void retire(deletion_queue& deletions, uint64_t frame);
+
+    vk::Device            m_device;
+    memory_allocator*     m_allocator = nullptr;
+    std::vector<uint32_t> m_queue_families;
+
+    vk::DescriptorSetLayout m_set_layout;  // owned by the layout_cache
+    vk::PipelineLayout      m_layout;
+    vk::ShaderModule        m_shader;
+    vk::Pipeline            m_pipeline;
+    vk::ShaderModule        m_depth_shader;  // for a multisampled depth buffer
+    vk::Pipeline            m_depth_pipeline;
+    vk::Sampler             m_sampler;  // owned by the view_cache
+
+    vk::Image                      m_image;
+    allocation                     m_memory;
+    vk::ImageView                  m_view;
+    std::vector<vk::ImageView>     m_level_views;
+    descriptor_allocator           m_descriptors;  // a new one with every pyramid
+    std::vector<vk::DescriptorSet> m_sets;         // one per level, reading the level before it
+    vk::Extent2D                   m_extent;
+    vk::Extent2D                   m_depth_extent;
+    bool                           m_valid = false;
+};
+
+}  // namespace shiny::graphics
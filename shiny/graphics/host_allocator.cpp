@@ -0,0 +1,308 @@
+#include "graphics/host_allocator.h"
+
+#include "core/alloc_tracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+namespace {
+
+// As VkSystemAllocationScope numbers them
+const uint32_t    scope_count                  = 5;
+const char* const scope_names[scope_count]     = { "command", "object", "cache", "device",
+                                                   "instance" };
+const char* const subsystem_names[scope_count] = { "vulkan command", "vulkan object",
+                                                   "vulkan cache", "vulkan device",
+                                                   "vulkan instance" };
+
+struct scope_counters
+{
+    std::atomic<uint64_t> allocations{ 0 };
+    std::atomic<uint64_t> live{ 0 };
+    std::atomic<uint64_t> peak{ 0 };
+};
+
+scope_counters g_scopes[scope_count];
+
+// Where an allocation came from, and so where it goes back to
+const uint32_t source_heap    = 0;
+const uint32_t source_command = 1;
+const uint32_t source_pool    = 2;  // plus the size class
+
+// In front of every allocation, as far in front as its alignment puts it
+struct allocation_header
+{
+    void*    owner;   // the malloc'd block, the pool's slot or the command arena
+    size_t   size;    // as asked for
+    uint32_t source;  // one of the above
+    uint32_t scope;
+};
+
+allocation_header*
+headerOf(void* memory)
+{
+    return (allocation_header*)memory - 1;
+}
+
+// How much an allocation takes up with its header, wherever its alignment puts it
+size_t
+footprint(size_t size, size_t alignment)
+{
+    return sizeof(allocation_header) + alignment - 1 + size;
+}
+
+// Puts the allocation at the first address after `start` that leaves room for the header
+void*
+place(void* start, void* owner, size_t size, size_t alignment, uint32_t source, uint32_t scope)
+{
+    const uintptr_t first  = (uintptr_t)start + sizeof(allocation_header);
+    void*           memory = (void*)((first + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    *headerOf(memory)      = { owner, size, source, scope };
+    return memory;
+}
+
+/*
+Size classes from 64 bytes to 4 KiB, which is where nearly all of what drivers allocate for objects
+falls, with a free list each. Slots are carved out of chunks that are kept for the rest of the
+program, the same as the driver would keep its own heap's.
+*/
+const uint32_t size_class_count    = 7;
+const size_t   smallest_size_class = 64;
+const size_t   pool_chunk_size     = 64 * 1024;
+
+struct size_class_pool
+{
+    std::mutex mutex;
+    void*      free = nullptr;  // the first free slot, which holds the next
+};
+
+size_class_pool g_pools[size_class_count];
+
+uint32_t
+sizeClassOf(size_t bytes)
+{
+    uint32_t sizeclass = 0;
+    while ((smallest_size_class << sizeclass) < bytes) {
+        ++sizeclass;
+    }
+    return sizeclass;
+}
+
+void*
+takeSlot(uint32_t sizeclass)
+{
+    size_class_pool&            pool = g_pools[sizeclass];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    if (!pool.free) {
+        const size_t slotsize = smallest_size_class << sizeclass;
+        std::byte*   chunk    = (std::byte*)std::malloc(pool_chunk_size);
+        if (!chunk) {
+            return nullptr;
+        }
+        for (size_t offset = 0; offset + slotsize <= pool_chunk_size; offset += slotsize) {
+            *(void**)(chunk + offset) = pool.free;
+            pool.free                 = chunk + offset;
+        }
+    }
+
+    void* slot = pool.free;
+    pool.free  = *(void**)slot;
+    return slot;
+}
+
+void
+returnSlot(uint32_t sizeclass, void* slot)
+{
+    size_class_pool&            pool = g_pools[sizeclass];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    *(void**)slot = pool.free;
+    pool.free     = slot;
+}
+
+/*
+Command scope allocations only last as long as the command that made them, so a thread's arena is
+empty again by the time its next command starts, and simply starts over. Whatever doesn't fit while
+it's still in use comes from the pools instead, and an allocation larger than the whole arena
+replaces it with a larger one once it's empty.
+*/
+const size_t command_arena_size = 64 * 1024;
+
+struct command_arena
+{
+    std::byte*            memory = nullptr;
+    size_t                size   = 0;
+    size_t                offset = 0;
+    std::atomic<uint32_t> live{ 0 };
+
+    ~command_arena() { std::free(memory); }
+};
+
+thread_local command_arena t_command_arena;
+
+void*
+allocateCommand(size_t size, size_t alignment)
+{
+    command_arena& arena = t_command_arena;
+    if (arena.live.load(std::memory_order_acquire) > 0) {
+        if (arena.offset + footprint(size, alignment) > arena.size) {
+            return nullptr;
+        }
+    } else {
+        arena.offset = 0;
+        if (footprint(size, alignment) > arena.size) {
+            const size_t grown = footprint(size, alignment) * 2;
+            std::free(arena.memory);
+            arena.size   = grown > command_arena_size ? grown : command_arena_size;
+            arena.memory = (std::byte*)std::malloc(arena.size);
+            if (!arena.memory) {
+                arena.size = 0;
+                return nullptr;
+            }
+        }
+    }
+
+    void* memory = place(arena.memory + arena.offset, &arena, size, alignment, source_command,
+                         VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+    arena.offset = (size_t)((std::byte*)memory + size - arena.memory);
+    arena.live.fetch_add(1, std::memory_order_acq_rel);
+    return memory;
+}
+
+void*
+allocateGeneral(size_t size, size_t alignment, uint32_t scope)
+{
+    const size_t needed = footprint(size, alignment);
+    if (needed <= smallest_size_class << (size_class_count - 1)) {
+        const uint32_t sizeclass = sizeClassOf(needed);
+        void*          slot      = takeSlot(sizeclass);
+        return slot ? place(slot, slot, size, alignment, source_pool + sizeclass, scope) : nullptr;
+    }
+
+    void* block = std::malloc(needed);
+    return block ? place(block, block, size, alignment, source_heap, scope) : nullptr;
+}
+
+void
+count(uint32_t scope, int64_t bytes)
+{
+    scope_counters& counters = g_scopes[scope];
+    if (bytes < 0) {
+        counters.live.fetch_sub((uint64_t)-bytes, std::memory_order_relaxed);
+        return;
+    }
+
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t live = counters.live.fetch_add((uint64_t)bytes, std::memory_order_relaxed);
+    uint64_t       peak = counters.peak.load(std::memory_order_relaxed);
+    while (live + (uint64_t)bytes > peak
+           && !counters.peak.compare_exchange_weak(peak, live + (uint64_t)bytes,
+                                                   std::memory_order_relaxed)) {
+    }
+}
+
+void* VKAPI_PTR
+allocate(void*, size_t size, size_t alignment, VkSystemAllocationScope vkscope)
+{
+    const uint32_t scope = (uint32_t)vkscope < scope_count ? (uint32_t)vkscope : 1;
+    if (alignment < alignof(allocation_header)) {
+        alignment = alignof(allocation_header);
+    }
+
+    void* memory = nullptr;
+    if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+        memory = allocateCommand(size, alignment);
+    }
+    if (!memory) {
+        memory = allocateGeneral(size, alignment, scope);
+    }
+
+    if (memory) {
+        shiny::core::recordAllocation(size, subsystem_names[scope]);
+        count(scope, (int64_t)size);
+    }
+    return memory;
+}
+
+void VKAPI_PTR
+release(void*, void* memory)
+{
+    if (!memory) {
+        return;
+    }
+
+    const allocation_header header = *headerOf(memory);
+    count(header.scope, -(int64_t)header.size);
+
+    if (header.source == source_command) {
+        ((command_arena*)header.owner)->live.fetch_sub(1, std::memory_order_acq_rel);
+    } else if (header.source >= source_pool) {
+        returnSlot(header.source - source_pool, header.owner);
+    } else {
+        std::free(header.owner);
+    }
+}
+
+// The spec's realloc: null reallocates nothing, a size of 0 frees, and the contents are kept up to
+// the smaller of the two sizes
+void* VKAPI_PTR
+reallocate(void* user, void* original, size_t size, size_t alignment,
+           VkSystemAllocationScope scope)
+{
+    if (!original) {
+        return allocate(user, size, alignment, scope);
+    }
+    if (size == 0) {
+        release(user, original);
+        return nullptr;
+    }
+
+    void* memory = allocate(user, size, alignment, scope);
+    if (memory) {
+        const size_t before = headerOf(original)->size;
+        std::memcpy(memory, original, before < size ? before : size);
+        release(user, original);
+    }
+    return memory;
+}
+
+std::atomic<const vk::AllocationCallbacks*> g_installed{ nullptr };
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+installHostAllocator()
+{
+    static const vk::AllocationCallbacks callbacks = vk::AllocationCallbacks()
+                                                       .setPfnAllocation(allocate)
+                                                       .setPfnReallocation(reallocate)
+                                                       .setPfnFree(release);
+    g_installed.store(&callbacks, std::memory_order_release);
+}
+
+const vk::AllocationCallbacks*
+hostAllocator()
+{
+    return g_installed.load(std::memory_order_acquire);
+}
+
+std::vector<host_scope_report>
+hostAllocatorReport()
+{
+    std::vector<host_scope_report> reports;
+    for (uint32_t scope = 0; scope < scope_count; ++scope) {
+        host_scope_report report;
+        report.scope       = scope_names[scope];
+        report.allocations = g_scopes[scope].allocations.load(std::memory_order_relaxed);
+        report.live_bytes  = g_scopes[scope].live.load(std::memory_order_relaxed);
+        report.peak_bytes  = g_scopes[scope].peak.load(std::memory_order_relaxed);
+        reports.push_back(report);
+    }
+    return reports;
+}
+
+}  // namespace shiny::graphics
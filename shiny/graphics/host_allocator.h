@@ -0,0 +1,52 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+The driver's host allocations, which otherwise all go to the C runtime's heap unaccounted for.
+Every create and destroy passes hostAllocator(), so once it's installed they come from here
+instead, sorted by the scope the driver asks for:
+
+- command scope, which is freed before the command that allocated it returns, comes from a bump
+  arena of the calling thread's that starts over whenever nothing in it is allocated anymore
+- everything else, object, cache, device and instance scope, comes from size classes with free
+  lists up to a few kilobytes, and from malloc beyond that
+
+Every allocation is also counted with core::recordAllocation(), for a subsystem per scope
+("vulkan command", "vulkan object" and so on), and hostAllocatorReport() says what each scope has
+allocated and still holds.
+*/
+
+// From here on hostAllocator() returns the callbacks. Only before the instance is created, and
+// never undone, since whatever was created with the callbacks has to be destroyed with them.
+void installHostAllocator();
+
+// What every create and destroy passes, null until installHostAllocator()
+const vk::AllocationCallbacks* hostAllocator();
+
+// The same, for the C functions of extensions that the loader doesn't export
+inline const VkAllocationCallbacks*
+hostAllocatorC()
+{
+    return reinterpret_cast<const VkAllocationCallbacks*>(hostAllocator());
+}
+
+struct host_scope_report
+{
+    const char* scope       = nullptr;  // "command", "object", "cache", "device" or "instance"
+    uint64_t    allocations = 0;        // ever made
+    uint64_t    live_bytes  = 0;        // not freed yet
+    uint64_t    peak_bytes  = 0;        // the most that were live at once
+};
+
+std::vector<host_scope_report> hostAllocatorReport();
+
+}  // namespace shiny::graphics
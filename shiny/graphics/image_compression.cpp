@@ -0,0 +1,112 @@
+#include "graphics/image_compression.h"
+
+namespace shiny::graphics {
+
+void
+image_compression::init(vk::Instance               instance,
+                        vk::PhysicalDevice         physical_device,
+                        const device_capabilities& enabled,
+                        framebuffer_compression    mode)
+{
+    m_physical_device = physical_device;
+    m_mode            = mode;
+    m_control         = enabled.image_compression_control;
+    m_swapchain       = enabled.swapchain_compression_control;
+
+#if defined(VK_EXT_image_compression_control)
+    m_format_properties = (PFN_vkGetPhysicalDeviceImageFormatProperties2KHR)instance.getProcAddr(
+      "vkGetPhysicalDeviceImageFormatProperties2KHR");
+    m_control = m_control && m_format_properties;
+#else
+    (void)instance;
+#endif
+}
+
+bool
+image_compression::compressed(vk::Format format, vk::ImageUsageFlags usage) const
+{
+#if defined(VK_EXT_image_compression_control)
+    vk::ImageCompressionPropertiesEXT result;
+    if (m_control && properties(format, usage, vk::ImageCompressionFlagBitsEXT::eDefault, result)) {
+        return !(result.imageCompressionFlags & vk::ImageCompressionFlagBitsEXT::eDisabled);
+    }
+#else
+    (void)format;
+    (void)usage;
+#endif
+    return true;
+}
+
+bool
+image_compression::keepsCompression(vk::Format          format,
+                                    vk::ImageUsageFlags usage,
+                                    vk::ImageUsageFlags extra) const
+{
+    return !compressed(format, usage) || compressed(format, usage | extra);
+}
+
+#if defined(VK_EXT_image_compression_control)
+void
+image_compression::request(vk::ImageCreateInfo& info, vk::ImageCompressionControlEXT& control) const
+{
+    if (m_mode != framebuffer_compression::fixed_rate || !fixedRate(info.format, info.usage)) {
+        return;
+    }
+    control = vk::ImageCompressionControlEXT().setFlags(
+      vk::ImageCompressionFlagBitsEXT::eFixedRateDefault);
+    control.pNext = info.pNext;
+    info.pNext    = &control;
+}
+
+// The swap chain's images can't be asked about, so they go by a plain image of the same format and
+// usage, which the driver is free to compress differently
+void
+image_compression::request(vk::SwapchainCreateInfoKHR&     info,
+                           vk::Format                      format,
+                           vk::ImageCompressionControlEXT& control) const
+{
+    if (m_mode != framebuffer_compression::fixed_rate || !m_swapchain
+        || !fixedRate(format, info.imageUsage)) {
+        return;
+    }
+    control = vk::ImageCompressionControlEXT().setFlags(
+      vk::ImageCompressionFlagBitsEXT::eFixedRateDefault);
+    control.pNext = info.pNext;
+    info.pNext    = &control;
+}
+
+bool
+image_compression::properties(vk::Format                         format,
+                              vk::ImageUsageFlags                usage,
+                              vk::ImageCompressionFlagsEXT       flags,
+                              vk::ImageCompressionPropertiesEXT& result) const
+{
+    auto control = vk::ImageCompressionControlEXT().setFlags(flags);
+    auto info    = vk::PhysicalDeviceImageFormatInfo2()
+                  .setFormat(format)
+                  .setType(vk::ImageType::e2D)
+                  .setTiling(vk::ImageTiling::eOptimal)
+                  .setUsage(usage)
+                  .setPNext(&control);
+
+    vk::ImageFormatProperties2 formatproperties;
+    formatproperties.pNext = &result;
+
+    const VkResult found = m_format_properties(
+      static_cast<VkPhysicalDevice>(m_physical_device),
+      reinterpret_cast<const VkPhysicalDeviceImageFormatInfo2*>(&info),
+      reinterpret_cast<VkImageFormatProperties2*>(&formatproperties));
+    return found == VK_SUCCESS;
+}
+
+bool
+image_compression::fixedRate(vk::Format format, vk::ImageUsageFlags usage) const
+{
+    vk::ImageCompressionPropertiesEXT result;
+    return m_control
+           && properties(format, usage, vk::ImageCompressionFlagBitsEXT::eFixedRateDefault, result)
+           && result.imageCompressionFixedRateFlags;
+}
+#endif
+
+}  // namespace shiny::graphics
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "graphics/device_capabilities.h"
+
+#include <cstdint>
+
+namespace shiny::graphics {
+
+// How render targets and the swap chain are compressed, see renderer::setFramebufferCompression
+enum class framebuffer_compression : uint8_t
+{
+    lossless,    // as the driver does by default, which never loses anything
+    fixed_rate,  // in a fixed-rate format of the driver's choosing, lossy but never larger
+};
+
+/*
+What the driver compresses images with, through VK_EXT_image_compression_control. GPUs that
+compress attachments at all do it losslessly by default, as long as nothing about the image keeps
+them from it: storage usage does on many tiled GPUs, and mutable formats on most. keepsCompression()
+asks the device whether some usage would, so that what the renderer only adds for a faster path can
+be left off where it would cost an image its compression.
+
+With fixed_rate, render targets ask for a fixed-rate format of the driver's choosing where their
+format has any, and the swap chain does too with VK_EXT_image_compression_control_swapchain. That
+takes a half or more off their bandwidth, for a loss that is hard to see. Without the extension
+everything is left to the driver, and keepsCompression() always says yes, having nothing to go by.
+*/
+class image_compression
+{
+public:
+    void init(vk::Instance               instance,
+              vk::PhysicalDevice         physical_device,
+              const device_capabilities& enabled,
+              framebuffer_compression    mode);
+
+    // Whether an optimal 2D image of `format` with `usage` is compressed in any way, as far as the
+    // device says
+    bool compressed(vk::Format format, vk::ImageUsageFlags usage) const;
+
+    // Whether an image of `format` with `usage` and `extra` too is as compressed as without them
+    bool keepsCompression(vk::Format          format,
+                          vk::ImageUsageFlags usage,
+                          vk::ImageUsageFlags extra) const;
+
+#if defined(VK_EXT_image_compression_control)
+    // Chains what a render target or the swap chain asks for onto `info`. `control` has to stay
+    // where it is until the image or swap chain is created.
+    void request(vk::ImageCreateInfo& info, vk::ImageCompressionControlEXT& control) const;
+    void request(vk::SwapchainCreateInfoKHR&     info,
+                 vk::Format                      format,
+                 vk::ImageCompressionControlEXT& control) const;
+#endif
+
+    framebuffer_compression mode() const { return m_mode; }
+
+private:
+#if defined(VK_EXT_image_compression_control)
+    // What an image of `format` and `usage` would get if it asked for `flags`, or nothing if the
+    // device can't make one
+    bool properties(vk::Format                         format,
+                    vk::ImageUsageFlags                usage,
+                    vk::ImageCompressionFlagsEXT       flags,
+                    vk::ImageCompressionPropertiesEXT& result) const;
+    bool fixedRate(vk::Format format, vk::ImageUsageFlags usage) const;
+#endif
+
+    vk::PhysicalDevice      m_physical_device;
+    framebuffer_compression m_mode      = framebuffer_compression::lossless;
+    bool                    m_control   = false;  // the extension is enabled
+    bool                    m_swapchain = false;  // and the swap chain's
+
+#if defined(VK_EXT_image_compression_control)
+    PFN_vkGetPhysicalDeviceImageFormatProperties2KHR m_format_properties = nullptr;
+#endif
+};
+
+}  // namespace shiny::graphics
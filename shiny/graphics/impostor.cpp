@@ -0,0 +1,416 @@
+#include "graphics/impostor.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+using shiny::graphics::impostor_views;
+
+// Instances a frame, beyond which the rest are drawn as meshes after all
+const uint32_t max_impostor_instances = 32768;
+
+// impostor.vert's push constants
+struct impostor_constants
+{
+    glm::mat4 view_projection;
+    glm::vec4 eye;    // the camera's position, and views across a layer
+    glm::vec4 atlas;  // layers across and down the atlas, and texels across a view
+};
+
+// Has to match impostor.vert, which looks straight up or down along y instead of z
+glm::vec3
+viewUp(const glm::vec3& direction)
+{
+    return std::abs(direction.z) > 0.999f ? glm::vec3(0.f, 1.f, 0.f) : glm::vec3(0.f, 0.f, 1.f);
+}
+
+bool
+visible(const shiny::graphics::frustum& view, const glm::vec3& center, float radius)
+{
+    for (const glm::vec4& plane : view.planes) {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The size in bytes of the atlas's levels from 0 up to `levels`
+size_t
+levelsSize(vk::Extent2D extent, uint32_t levels)
+{
+    size_t size = 0;
+    for (uint32_t l = 0; l < levels; ++l) {
+        size += (size_t)(extent.width >> l) * (extent.height >> l) * 4;
+    }
+    return size;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+uint32_t
+impostorLayersAcross(uint32_t layers)
+{
+    uint32_t across = 1;
+    while (across * across < layers) {
+        ++across;
+    }
+    return across;
+}
+
+vk::Extent2D
+impostorAtlasExtent(uint32_t layers)
+{
+    const uint32_t across = impostorLayersAcross(layers);
+    const uint32_t down   = std::max((layers + across - 1) / across, 1u);
+    return vk::Extent2D(across * impostor_layer_size, down * impostor_layer_size);
+}
+
+// The octahedron's lower half is folded out over the square's corners
+glm::vec3
+impostorDirection(uint32_t view)
+{
+    const glm::vec2 p =
+      glm::vec2((float)(view % impostor_views), (float)(view / impostor_views))
+        / (float)(impostor_views - 1) * 2.f
+      - 1.f;
+
+    glm::vec3 direction(p, 1.f - std::abs(p.x) - std::abs(p.y));
+    if (direction.z < 0.f) {
+        direction.x = (1.f - std::abs(p.y)) * (p.x >= 0.f ? 1.f : -1.f);
+        direction.y = (1.f - std::abs(p.x)) * (p.y >= 0.f ? 1.f : -1.f);
+    }
+    return glm::normalize(direction);
+}
+
+glm::mat4
+impostorView(uint32_t view, float radius)
+{
+    const glm::vec3 direction = impostorDirection(view);
+    return glm::lookAt(direction * (2.f * radius), glm::vec3(0.f), viewUp(direction));
+}
+
+// Right handed and looking down -z, to Vulkan's depth range of 0 to 1 reversed, 1 at the near
+// side of the sphere, with y flipped like the renderer's perspective projection
+glm::mat4
+impostorProjection(float radius)
+{
+    glm::mat4 result(1.f);
+    result[0][0] = 1.f / radius;
+    result[1][1] = -1.f / radius;
+    result[2][2] = 1.f / (2.f * radius);
+    result[3][2] = 1.5f;
+    return result;
+}
+
+bool
+writeImpostorAtlas(const std::string& path, uint32_t layers, const std::vector<uint8_t>& pixels)
+{
+    impostor_header header;
+    header.layers = layers;
+
+    const vk::Extent2D extent = impostorAtlasExtent(layers);
+    if (layers == 0 || layers > max_impostor_layers
+        || pixels.size() != (size_t)extent.width * extent.height * 4) {
+        return false;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(pixels.data()), (std::streamsize)pixels.size());
+
+    std::vector<uint8_t> level = pixels;
+    std::vector<uint8_t> next;
+    for (uint32_t l = 1; l < impostor_levels; ++l) {
+        const uint32_t width  = extent.width >> l;
+        const uint32_t height = extent.height >> l;
+        const size_t   row    = (size_t)width * 8;  // of the level before
+
+        next.resize((size_t)width * height * 4);
+        for (uint32_t y = 0; y < height; ++y) {
+            for (uint32_t x = 0; x < width; ++x) {
+                for (uint32_t c = 0; c < 4; ++c) {
+                    const size_t   a   = 2 * y * row + 8 * x + c;
+                    const uint32_t sum = level[a] + level[a + 4] + level[a + row]
+                                         + level[a + row + 4];
+                    next[((size_t)y * width + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+                }
+            }
+        }
+        file.write(reinterpret_cast<const char*>(next.data()), (std::streamsize)next.size());
+        level.swap(next);
+    }
+    return (bool)file;
+}
+
+void
+impostor_billboards::init(vk::Device         device,
+                          memory_allocator&  allocator,
+                          layout_cache&      layouts,
+                          view_cache&        views,
+                          const std::string& path,
+                          uint32_t           frames)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+
+    core::mapped_file file;
+    if (!file.open(path) || file.size() < sizeof(impostor_header)) {
+        throw std::runtime_error("Failed to read " + path + "!");
+    }
+    std::memcpy(&m_header, file.data(), sizeof(m_header));
+    m_extent = impostorAtlasExtent(m_header.layers);
+
+    const size_t size  = levelsSize(m_extent, impostor_levels);
+    const bool   valid = std::memcmp(m_header.magic, impostor_header().magic, 4) == 0
+                       && m_header.views == impostor_views
+                       && m_header.view_size == impostor_view_size && m_header.layers > 0
+                       && m_header.layers <= max_impostor_layers
+                       && m_header.levels == impostor_levels
+                       && file.size() == sizeof(impostor_header) + size;
+    if (!valid) {
+        throw std::runtime_error(path + " isn't an impostor atlas!");
+    }
+    const auto texels = static_cast<const uint8_t*>(file.data()) + sizeof(impostor_header);
+    m_texels.assign(texels, texels + size);
+
+    auto imageinfo = vk::ImageCreateInfo()
+                       .setImageType(vk::ImageType::e2D)
+                       .setExtent(vk::Extent3D(m_extent.width, m_extent.height, 1))
+                       .setMipLevels(impostor_levels)
+                       .setArrayLayers(1)
+                       .setFormat(vk::Format::eR8G8B8A8Unorm)
+                       .setTiling(vk::ImageTiling::eOptimal)
+                       .setInitialLayout(vk::ImageLayout::eUndefined)
+                       .setUsage(vk::ImageUsageFlagBits::eSampled
+                                 | vk::ImageUsageFlagBits::eTransferDst)
+                       .setSamples(vk::SampleCountFlagBits::e1)
+                       .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_atlas        = m_device.createImage(imageinfo, hostAllocator());
+    m_atlas_memory = m_allocator->allocate(m_device.getImageMemoryRequirements(m_atlas),
+                                           vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                           memory_allocator::resource_kind::optimal,
+                                           memory_category::texture);
+    m_device.bindImageMemory(m_atlas, m_atlas_memory.memory, m_atlas_memory.offset);
+
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(m_atlas)
+                      .setViewType(vk::ImageViewType::e2D)
+                      .setFormat(vk::Format::eR8G8B8A8Unorm)
+                      .setSubresourceRange(vk::ImageSubresourceRange(
+                        vk::ImageAspectFlagBits::eColor, 0, impostor_levels, 0, 1));
+
+    m_atlas_view = m_device.createImageView(viewinfo, hostAllocator());
+
+    // The quads stop half a texel short of their view's edges, see impostor.vert, so only the
+    // coarser levels blend in a little of the views next to them
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(vk::Filter::eLinear)
+                         .setMinFilter(vk::Filter::eLinear)
+                         .setMipmapMode(vk::SamplerMipmapMode::eLinear)
+                         .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setMinLod(0.f)
+                         .setMaxLod((float)(impostor_levels - 1));
+
+    m_sampler = views.sampler(samplerinfo);
+
+    auto binding = vk::DescriptorSetLayoutBinding()
+                     .setBinding(0)
+                     .setDescriptorCount(1)
+                     .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                     .setStageFlags(vk::ShaderStageFlagBits::eFragment);
+
+    vk::DescriptorSetLayout setlayout = layouts.descriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo().setBindingCount(1).setPBindings(&binding));
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eVertex)
+                       .setOffset(0)
+                       .setSize(sizeof(impostor_constants));
+
+    m_layout = layouts.pipelineLayout(vk::PipelineLayoutCreateInfo()
+                                        .setSetLayoutCount(1)
+                                        .setPSetLayouts(&setlayout)
+                                        .setPushConstantRangeCount(1)
+                                        .setPPushConstantRanges(&constants));
+
+    // The atlas never changes, so the set is written once here
+    m_descriptors.init(m_device, { { vk::DescriptorType::eCombinedImageSampler, 1 } }, 1);
+    m_set = m_descriptors.allocate(setlayout);
+
+    const vk::DescriptorImageInfo atlas(m_sampler, m_atlas_view,
+                                        vk::ImageLayout::eShaderReadOnlyOptimal);
+    m_device.updateDescriptorSets(vk::WriteDescriptorSet()
+                                    .setDstSet(m_set)
+                                    .setDstBinding(0)
+                                    .setDescriptorCount(1)
+                                    .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                                    .setPImageInfo(&atlas),
+                                  nullptr);
+
+    // Written every frame, and read once by the vertex input
+    m_instances_frame_size = max_impostor_instances * sizeof(instance);
+
+    auto instanceinfo = vk::BufferCreateInfo()
+                          .setSize(m_instances_frame_size * frames)
+                          .setUsage(vk::BufferUsageFlagBits::eVertexBuffer)
+                          .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_instances        = m_device.createBuffer(instanceinfo, hostAllocator());
+    m_instances_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_instances),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_instances, m_instances_memory.memory, m_instances_memory.offset);
+}
+
+void
+impostor_billboards::destroy()
+{
+    std::vector<uint8_t>().swap(m_texels);
+    m_descriptors.destroy();
+
+    m_device.destroyImageView(m_atlas_view, hostAllocator());
+    m_device.destroyImage(m_atlas, hostAllocator());
+    m_allocator->free(m_atlas_memory);
+    m_device.destroyBuffer(m_instances, hostAllocator());
+    m_allocator->free(m_instances_memory);
+
+    m_atlas     = nullptr;
+    m_instances = nullptr;
+    m_count     = 0;
+}
+
+void
+impostor_billboards::upload(upload_batch& uploads, const staging_region& texels)
+{
+    uploads.transitionImageLayout(m_atlas, vk::ImageAspectFlagBits::eColor,
+                                  vk::ImageLayout::eUndefined,
+                                  vk::ImageLayout::eTransferDstOptimal, impostor_levels);
+
+    vk::DeviceSize offset = 0;
+    for (uint32_t l = 0; l < impostor_levels; ++l) {
+        const uint32_t width  = m_extent.width >> l;
+        const uint32_t height = m_extent.height >> l;
+
+        staging_region region = texels;
+        region.offset         = texels.offset + offset;
+        region.size           = (vk::DeviceSize)width * height * 4;
+        region.data           = static_cast<char*>(texels.data) + offset;
+        uploads.copyBufferToImage(region, m_atlas, width, height, l);
+
+        offset += region.size;
+    }
+
+    uploads.transitionImageLayout(m_atlas, vk::ImageAspectFlagBits::eColor,
+                                  vk::ImageLayout::eTransferDstOptimal,
+                                  vk::ImageLayout::eShaderReadOnlyOptimal, impostor_levels);
+
+    std::vector<uint8_t>().swap(m_texels);
+}
+
+std::array<vk::VertexInputBindingDescription, 1>
+impostor_billboards::bindings() const
+{
+    return { vk::VertexInputBindingDescription(0, sizeof(instance),
+                                               vk::VertexInputRate::eInstance) };
+}
+
+std::array<vk::VertexInputAttributeDescription, 6>
+impostor_billboards::attributes() const
+{
+    const uint32_t column = sizeof(glm::vec4);
+    return { vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32B32A32Sfloat, 0),
+             vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32A32Sfloat, column),
+             vk::VertexInputAttributeDescription(2, 0, vk::Format::eR32G32B32A32Sfloat,
+                                                 2 * column),
+             vk::VertexInputAttributeDescription(3, 0, vk::Format::eR32G32B32A32Sfloat,
+                                                 3 * column),
+             vk::VertexInputAttributeDescription(4, 0, vk::Format::eR32Sfloat,
+                                                 offsetof(instance, radius)),
+             vk::VertexInputAttributeDescription(5, 0, vk::Format::eR32Uint,
+                                                 offsetof(instance, layer)) };
+}
+
+void
+impostor_billboards::beginFrame(uint32_t frame, const frustum& view)
+{
+    m_frame = frame;
+    m_view  = view;
+    m_count = 0;
+}
+
+bool
+impostor_billboards::add(const glm::mat4& transform, float radius, uint32_t layer)
+{
+    const float scale = std::max({ glm::length(glm::vec3(transform[0])),
+                                   glm::length(glm::vec3(transform[1])),
+                                   glm::length(glm::vec3(transform[2])) });
+    if (!visible(m_view, glm::vec3(transform[3]), radius * scale)) {
+        return true;
+    }
+    if (m_count == max_impostor_instances) {
+        return false;
+    }
+
+    instance placed;
+    placed.transform = transform;
+    placed.radius    = radius;
+    placed.layer     = layer;
+
+    auto instances = reinterpret_cast<instance*>(static_cast<char*>(m_instances_memory.mapped)
+                                                 + m_frame * m_instances_frame_size);
+    instances[m_count++] = placed;
+    return true;
+}
+
+void
+impostor_billboards::draw(vk::CommandBuffer command_buffer,
+                          vk::Pipeline      pipeline,
+                          const glm::mat4&  view_projection,
+                          const glm::vec3&  eye) const
+{
+    if (m_count == 0) {
+        return;
+    }
+
+    const uint32_t across = impostorLayersAcross(m_header.layers);
+
+    impostor_constants constants;
+    constants.view_projection = view_projection;
+    constants.eye             = glm::vec4(eye, (float)impostor_views);
+    constants.atlas =
+      glm::vec4((float)across, (float)(m_extent.height / impostor_layer_size),
+                (float)impostor_view_size, 0.f);
+
+    const vk::DeviceSize offset = m_frame * m_instances_frame_size;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_layout, 0, m_set,
+                                      nullptr);
+    command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(constants),
+                                 &constants);
+    command_buffer.bindVertexBuffers(0, 1, &m_instances, &offset);
+    command_buffer.draw(6, m_count, 0, 0);
+}
+
+}  // namespace shiny::graphics
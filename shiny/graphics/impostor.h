@@ -0,0 +1,156 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/frustum_culling.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/staging_arena.h"
+#include "graphics/upload_service.h"
+#include "graphics/view_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+// Views across either side of a mesh's layer of an impostor atlas, and texels across each view
+const uint32_t impostor_views      = 8;
+const uint32_t impostor_view_size  = 64;
+const uint32_t impostor_layer_size = impostor_views * impostor_view_size;
+
+// Mip levels of an atlas, down to views of 8 texels, and the most meshes one can have layers for
+const uint32_t impostor_levels     = 4;
+const uint32_t max_impostor_layers = 64;
+
+/*
+The header of an impostor atlas file, as writeImpostorAtlas writes them. Every mip level of the
+atlas follows it, RGBA8 rows top to bottom. A mesh's layer is a square of its views in the atlas,
+the layers row by row, impostorLayersAcross() of them a row.
+*/
+struct impostor_header
+{
+    char     magic[4]  = { 'S', 'I', 'M', '1' };
+    uint32_t views     = impostor_views;
+    uint32_t view_size = impostor_view_size;
+    uint32_t layers    = 0;
+    uint32_t levels    = impostor_levels;
+};
+
+// Layers along a row of an atlas with `layers` of them, and its size in texels at level 0
+uint32_t     impostorLayersAcross(uint32_t layers);
+vk::Extent2D impostorAtlasExtent(uint32_t layers);
+
+/*
+The direction view x, y of a layer (numbered y * impostor_views + x) is seen from, out of the
+mesh's center: an octahedral map of the sphere, with the views' directions on a grid that reaches
+the edges, so that one of them looks straight up and one straight down. Has to match impostor.vert.
+*/
+glm::vec3 impostorDirection(uint32_t view);
+
+// The camera of a view: orthographic, looking at the origin from outside of a sphere around it,
+// which its image just holds, with the same up as impostor.vert gives the view's quad
+glm::mat4 impostorView(uint32_t view, float radius);
+glm::mat4 impostorProjection(float radius);
+
+/*
+Builds the atlas's mip levels from `pixels`, level 0 as impostorAtlasExtent(layers) gives it, each
+texel the average of the four under it, and writes them to `path`. Views are powers of two across,
+so no texel ever averages two of them. Returns false if the file can't be written.
+*/
+bool writeImpostorAtlas(const std::string&          path,
+                        uint32_t                    layers,
+                        const std::vector<uint8_t>& pixels);
+
+/*
+Meshes drawn as impostors: a quad for each instance, square to the one of the atlas's views whose
+direction is nearest to the camera's from the instance, across its bounding sphere and showing that
+view, so that a mesh too small on screen to be worth its triangles costs two of them. The quads are
+alpha tested, write depth like the opaque materials and all go out as a single instanced draw,
+whatever their meshes, since each picks its layer out of the one atlas.
+
+The instances are culled against the view as they are added, and written straight into the frame's
+part of a host visible buffer, which the vertex input reads.
+*/
+class impostor_billboards
+{
+public:
+    // Reads the atlas at `path`, which is uploaded by upload(). Throws if it isn't one.
+    void init(vk::Device         device,
+              memory_allocator&  allocator,
+              layout_cache&      layouts,
+              view_cache&        views,
+              const std::string& path,
+              uint32_t           frames);
+    void destroy();
+
+    uint32_t layers() const { return m_header.layers; }
+
+    // Every level of the atlas, for upload(), which leaves it ready to be sampled. The texels are
+    // freed once it has been.
+    const void*    texelData() const { return m_texels.data(); }
+    vk::DeviceSize texelSize() const { return m_texels.size(); }
+    void           upload(upload_batch& uploads, const staging_region& texels);
+
+    // The draw's pipeline layout and vertex input: where each instance goes in binding 0
+    std::array<vk::VertexInputBindingDescription, 1>   bindings() const;
+    std::array<vk::VertexInputAttributeDescription, 6> attributes() const;
+    vk::PipelineLayout                                 layout() const { return m_layout; }
+
+    // Once the frame's fence has been waited on, before add()
+    void beginFrame(uint32_t frame, const frustum& view);
+
+    // An instance of the mesh with atlas layer `layer`, at `transform`, whose bounding sphere
+    // around the origin has `radius` in model space. False if the frame has no room left for
+    // it, when it is better drawn as a mesh; an instance outside of the view takes none.
+    bool add(const glm::mat4& transform, float radius, uint32_t layer);
+
+    uint32_t count() const { return m_count; }
+
+    // Draws the frame's instances with `pipeline`, made with layout() and the vertex input above,
+    // inside the main pass. `eye` is the camera's position the quads face.
+    void draw(vk::CommandBuffer command_buffer,
+              vk::Pipeline      pipeline,
+              const glm::mat4&  view_projection,
+              const glm::vec3&  eye) const;
+
+private:
+    // Laid out like impostor.vert's instance attributes
+    struct instance
+    {
+        glm::mat4 transform;
+        float     radius     = 0.f;
+        uint32_t  layer      = 0;
+        float     padding[2] = {};
+    };
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    impostor_header      m_header;
+    vk::Extent2D         m_extent;
+    std::vector<uint8_t> m_texels;  // until upload()
+
+    descriptor_allocator m_descriptors;
+    vk::DescriptorSet    m_set;     // written once, the atlas for the fragment shader
+    vk::PipelineLayout   m_layout;  // owned by the layout_cache
+
+    vk::Image     m_atlas;
+    allocation    m_atlas_memory;
+    vk::ImageView m_atlas_view;
+    vk::Sampler   m_sampler;  // owned by the view_cache
+
+    // Host visible, every frame's instances
+    vk::Buffer     m_instances;
+    allocation     m_instances_memory;
+    vk::DeviceSize m_instances_frame_size = 0;
+
+    frustum  m_view  = {};
+    uint32_t m_frame = 0;
+    uint32_t m_count = 0;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,104 @@
+#include "graphics/impostor_cook.h"
+
+#include "core/logger.h"
+#include "graphics/impostor.h"
+#include "graphics/renderer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// Frames rendered before the first view, at least, and at most while the scene is still loading
+const uint32_t min_impostor_warmup = 8;
+const uint32_t max_impostor_warmup = 600;
+
+const uint32_t no_view = ~0u;
+
+}  // namespace
+
+namespace shiny::graphics {
+
+/*
+Frames are handed to prepare() and delivered in the same order, so the view a frame is of is found
+by its number, as in renderBatch. The warm-up frames draw the first view as well, and are thrown
+away.
+*/
+void
+cookImpostors(renderer& r, const std::string& path)
+{
+    const uint32_t layerviews = impostor_views * impostor_views;
+
+    uint32_t              layers = 0;
+    vk::Extent2D          extent;
+    std::vector<uint8_t>  atlas;
+    std::vector<uint32_t> views;  // by frame number, layer * layerviews + view, or no_view
+    uint32_t              next = 0;
+
+    r.setImpostorBaking(true);
+
+    offscreen_settings offscreen;
+    offscreen.width   = impostor_view_size;
+    offscreen.height  = impostor_view_size;
+    offscreen.frames  = std::numeric_limits<uint32_t>::max();
+    offscreen.prepare = [&](uint64_t frame) {
+        if (frame == 0) {
+            layers = std::min(r.impostorMeshes(), max_impostor_layers);
+            if (layers < r.impostorMeshes()) {
+                core::logWarning() << "Only the first " << layers << " of "
+                                   << r.impostorMeshes() << " meshes get impostors";
+            }
+            extent = impostorAtlasExtent(layers);
+            atlas.assign((size_t)extent.width * extent.height * 4, 0);
+        }
+        if (layers == 0 || next == layers * layerviews) {
+            return false;
+        }
+
+        const bool warming = next == 0 && (frame < min_impostor_warmup
+                                           || (frame < max_impostor_warmup && r.loading()));
+        if (warming) {
+            r.latchImpostorView(0, 0);
+            views.push_back(no_view);
+            return true;
+        }
+
+        r.latchImpostorView(next / layerviews, next % layerviews);
+        views.push_back(next++);
+        return true;
+    };
+    offscreen.deliver = [&](const offscreen_frame& frame) {
+        const uint32_t view = views[frame.number];
+        if (view == no_view) {
+            return;
+        }
+
+        const uint32_t across = impostorLayersAcross(layers);
+        const uint32_t layer  = view / layerviews;
+        const uint32_t cell   = view % layerviews;
+        const uint32_t x =
+          (layer % across * impostor_views + cell % impostor_views) * impostor_view_size;
+        const uint32_t y =
+          (layer / across * impostor_views + cell / impostor_views) * impostor_view_size;
+
+        for (uint32_t row = 0; row < impostor_view_size; ++row) {
+            std::memcpy(atlas.data() + ((size_t)(y + row) * extent.width + x) * 4,
+                        frame.pixels + (size_t)row * frame.width * 4, impostor_view_size * 4);
+        }
+    };
+
+    r.renderOffscreen(offscreen);
+    r.setImpostorBaking(false);
+
+    if (layers == 0) {
+        throw std::runtime_error("The scene has no meshes for impostors!");
+    }
+    if (!writeImpostorAtlas(path, layers, atlas)) {
+        throw std::runtime_error("Failed to save " + path + "!");
+    }
+}
+
+}  // namespace shiny::graphics
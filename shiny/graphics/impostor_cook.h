@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+namespace shiny::graphics {
+
+class renderer;
+
+/*
+Cooks the impostor atlas of the scene `r` is set up for into `path`, for renderer::setImpostors.
+Every view of every mesh the renderer has impostors for is rendered offscreen with
+setImpostorBaking, a frame apiece at impostor_view_size texels square, and copied into its place in
+the atlas as it is read back. The views only start once what the scene loads at startup is in, so
+they have its textures at the resolution they are drawn at. Throws if the scene has no meshes for
+impostors or the atlas can't be written.
+*/
+void cookImpostors(renderer& r, const std::string& path);
+
+}  // namespace shiny::graphics
@@ -0,0 +1,228 @@
+#include "graphics/ktx2_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+namespace {
+
+// "\xABKTX 20\xBB\r\n\x1A\n"
+const unsigned char ktx2_identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32,
+                                            0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+// The identifier, the header and the index of the data format descriptor, key/value data and
+// supercompression global data. The level index follows right after.
+const size_t ktx2_header_size = 80;
+const size_t ktx2_level_size  = 24;
+
+template<typename T>
+T
+read(const char* data, size_t offset)
+{
+    T value;
+    std::memcpy(&value, data + offset, sizeof(T));
+    return value;
+}
+
+template<typename T>
+void
+write(std::vector<char>& data, size_t offset, T value)
+{
+    std::memcpy(data.data() + offset, &value, sizeof(T));
+}
+
+/*
+The basic data format descriptor of BC1 without alpha: its total size, the block's header and one
+sample covering all 64 bits of the block. Every value is little endian.
+*/
+const uint32_t bc1_dfd[] = {
+    44,                        // dfdTotalSize
+    0,                         // vendorId and descriptorType, Khronos' basic one
+    40u << 16 | 2,             // descriptorBlockSize and versionNumber (1.3)
+    1u << 16 | 1u << 8 | 128,  // flags, transferFunction (linear), colorPrimaries (BT.709) and
+                               // colorModel (BC1A)
+    3u << 8 | 3,               // texelBlockDimension0-3, the block is 4x4
+    8,                         // bytesPlane0-3
+    0,                         // bytesPlane4-7
+    63u << 16,                 // channelType (color), bitLength (64 - 1) and bitOffset
+    0,                         // samplePosition0-3
+    0,                         // sampleLower
+    0xffffffff,                // sampleUpper
+};
+
+// Levels are aligned to the block size; for BC1 that is a multiple of 4 already
+const size_t bc1_level_alignment = 8;
+
+/*
+Reads the header and level index out of the first `available` bytes of a KTX2 file `size` bytes
+long, which have to hold all of them, into everything of `texture` but its file.
+*/
+bool
+parseKtx2(const char* data, size_t available, size_t size, shiny::graphics::ktx2_texture& texture)
+{
+    if (available < ktx2_header_size
+        || std::memcmp(data, ktx2_identifier, sizeof(ktx2_identifier)) != 0) {
+        return false;
+    }
+
+    uint32_t format      = read<uint32_t>(data, 12);
+    uint32_t width       = read<uint32_t>(data, 20);
+    uint32_t height      = read<uint32_t>(data, 24);
+    uint32_t depth       = read<uint32_t>(data, 28);
+    uint32_t layers      = read<uint32_t>(data, 32);
+    uint32_t faces       = read<uint32_t>(data, 36);
+    uint32_t levelcount  = read<uint32_t>(data, 40);
+    uint32_t compression = read<uint32_t>(data, 44);  // supercompressionScheme
+
+    // A format of VK_FORMAT_UNDEFINED means the texels are Basis Universal and still need
+    // transcoding, which is not supported
+    if (format == VK_FORMAT_UNDEFINED || width == 0 || height == 0 || depth > 1 || layers > 1
+        || faces != 1 || compression != 0) {
+        return false;
+    }
+
+    // 0 asks for the mip chain to be generated at load time, but the file only has the base level
+    levelcount = std::max(levelcount, 1u);
+
+    if ((available - ktx2_header_size) / ktx2_level_size < levelcount) {
+        return false;
+    }
+
+    std::vector<shiny::graphics::ktx2_level> levels(levelcount);
+    for (uint32_t i = 0; i < levelcount; ++i) {
+        size_t   entry  = ktx2_header_size + i * ktx2_level_size;
+        uint64_t offset = read<uint64_t>(data, entry);
+        uint64_t length = read<uint64_t>(data, entry + 8);
+
+        if (length == 0 || offset > size || length > size - offset) {
+            return false;
+        }
+
+        levels[i].offset = (size_t)offset;
+        levels[i].size   = (size_t)length;
+        levels[i].width  = std::max(width >> i, 1u);
+        levels[i].height = std::max(height >> i, 1u);
+    }
+
+    texture.format = static_cast<vk::Format>(format);
+    texture.width  = width;
+    texture.height = height;
+    texture.levels = std::move(levels);
+
+    return true;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+bool
+readKtx2(const std::string& path, ktx2_texture& texture)
+{
+    core::mapped_file file;
+    return file.open(path) && readKtx2(std::move(file), texture);
+}
+
+bool
+readKtx2(core::mapped_file file, ktx2_texture& texture)
+{
+    if (!parseKtx2(file.data(), file.size(), file.size(), texture)) {
+        return false;
+    }
+
+    texture.file = std::move(file);
+    return true;
+}
+
+/*
+The header and the level index come first, so unless there are thousands of levels they are all
+within the entry's first block, which is the only one decompressed.
+*/
+bool
+readKtx2Header(const std::string& path, ktx2_texture& texture)
+{
+    const core::asset_package* package = nullptr;
+    const core::package_entry* entry   = core::findPackaged(path, package);
+    if (!entry || entry->compression != core::package_compression::lz4_blocks) {
+        return readKtx2(path, texture);
+    }
+
+    std::vector<char> header(std::min<size_t>((size_t)entry->size, core::package_block_size));
+    if (!package->read(*entry, 0, header.size(), header.data())
+        || !parseKtx2(header.data(), header.size(), (size_t)entry->size, texture)) {
+        return false;
+    }
+
+    texture.package = package;
+    texture.entry   = entry;
+    return true;
+}
+
+bool
+ktx2_texture::copyLevel(size_t level, char* out, jobs::scheduler* jobs) const
+{
+    if (!package) {
+        std::memcpy(out, levelData(level), levels[level].size);
+        return true;
+    }
+    return package->read(*entry, levels[level].offset, levels[level].size, out, jobs);
+}
+
+/*
+KTX2 stores the smallest level first, so the data goes in backwards while the level index stays in
+order from level 0.
+*/
+bool
+writeKtx2(const std::string&                       path,
+          vk::Format                               format,
+          uint32_t                                 width,
+          uint32_t                                 height,
+          const std::vector<std::vector<uint8_t>>& levels)
+{
+    if (format != vk::Format::eBc1RgbUnormBlock || levels.empty()) {
+        return false;
+    }
+
+    const size_t levelcount = levels.size();
+    const size_t dfdoffset  = ktx2_header_size + levelcount * ktx2_level_size;
+
+    size_t size = dfdoffset + sizeof(bc1_dfd);
+    std::vector<size_t> offsets(levelcount);
+    for (size_t i = levelcount; i-- > 0;) {
+        size       = (size + bc1_level_alignment - 1) / bc1_level_alignment * bc1_level_alignment;
+        offsets[i] = size;
+        size += levels[i].size();
+    }
+
+    std::vector<char> data(size, 0);
+    std::memcpy(data.data(), ktx2_identifier, sizeof(ktx2_identifier));
+    write<uint32_t>(data, 12, (uint32_t)format);
+    write<uint32_t>(data, 16, 1);  // typeSize, 1 for block compressed formats
+    write<uint32_t>(data, 20, width);
+    write<uint32_t>(data, 24, height);
+    write<uint32_t>(data, 28, 0);  // depth
+    write<uint32_t>(data, 32, 0);  // layers
+    write<uint32_t>(data, 36, 1);  // faces
+    write<uint32_t>(data, 40, (uint32_t)levelcount);
+    write<uint32_t>(data, 44, 0);  // no supercompression
+    write<uint32_t>(data, 48, (uint32_t)dfdoffset);
+    write<uint32_t>(data, 52, (uint32_t)sizeof(bc1_dfd));
+
+    // No key/value or supercompression global data, whose offsets and sizes stay 0
+    std::memcpy(data.data() + dfdoffset, bc1_dfd, sizeof(bc1_dfd));
+
+    for (size_t i = 0; i < levelcount; ++i) {
+        const size_t entry = ktx2_header_size + i * ktx2_level_size;
+        write<uint64_t>(data, entry, offsets[i]);
+        write<uint64_t>(data, entry + 8, levels[i].size());
+        write<uint64_t>(data, entry + 16, levels[i].size());
+        std::memcpy(data.data() + offsets[i], levels[i].data(), levels[i].size());
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), (std::streamsize)data.size());
+    return (bool)file;
+}
+
+}  // namespace shiny::graphics
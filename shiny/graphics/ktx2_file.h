@@ -0,0 +1,81 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include "core/asset_package.h"
+#include "core/mapped_file.h"
+#include "jobs/scheduler.h"
+
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Where one mip level's texels are inside the file. They are tightly packed, just like
+vkCmdCopyBufferToImage expects them, so a level is staged with a single memcpy.
+*/
+struct ktx2_level
+{
+    size_t   offset = 0;
+    size_t   size   = 0;
+    uint32_t width  = 0;
+    uint32_t height = 0;
+};
+
+/*
+A KTX2 texture, mapped rather than read. KTX2 stores the VkFormat of its texels directly, so block
+compressed formats (BCn, ETC2, ASTC) go to the GPU as they are, mip levels included, without any
+decoding on the CPU.
+
+Only plain 2D textures are read: one layer, one face and no supercompression. Anything else is
+rejected so that the caller can fall back to another file.
+
+A texture opened with readKtx2Header out of a compressed package has no file. Its levels stay
+compressed in the package until copyLevel decompresses them straight to where they go.
+
+http://github.khronos.org/KTX-Specification/
+*/
+struct ktx2_texture
+{
+    core::mapped_file       file;
+    vk::Format              format = vk::Format::eUndefined;
+    uint32_t                width  = 0;
+    uint32_t                height = 0;
+    std::vector<ktx2_level> levels;  // level 0 is the full size image
+
+    const core::asset_package* package = nullptr;  // only while the levels are still in it
+    const core::package_entry* entry   = nullptr;
+
+    // Not for a texture whose levels are still in a package
+    const char* levelData(size_t level) const { return file.data() + levels[level].offset; }
+
+    // Writes the level's texels to `out`, decompressing them on `jobs` if they are in a package
+    bool copyLevel(size_t level, char* out, jobs::scheduler* jobs = nullptr) const;
+};
+
+// Returns false if the file is missing or isn't a KTX2 file we can upload
+bool readKtx2(const std::string& path, ktx2_texture& texture);
+
+// The same for a file that is already open, e.g. one read by the I/O queue
+bool readKtx2(core::mapped_file file, ktx2_texture& texture);
+
+// readKtx2 without decompressing the levels of a texture in a compressed package, for copying
+// them with copyLevel when they are staged
+bool readKtx2Header(const std::string& path, ktx2_texture& texture);
+
+/*
+Writes a plain 2D texture with the given mip levels, level 0 first, for the cooker. Only the
+formats it has a data format descriptor for can be written, which for now is just BC1 without
+alpha; for anything else it returns false without writing a file.
+*/
+bool writeKtx2(const std::string&                       path,
+               vk::Format                               format,
+               uint32_t                                 width,
+               uint32_t                                 height,
+               const std::vector<std::vector<uint8_t>>& levels);
+
+}  // namespace shiny::graphics
@@ -0,0 +1,156 @@
+#include "graphics/layout_cache.h"
+
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+
+namespace shiny::graphics {
+
+void
+layout_cache::init(vk::Device device)
+{
+    m_device = device;
+}
+
+void
+layout_cache::destroy()
+{
+    // Pipeline layouts refer to set layouts, so they go first
+    for (auto& [description, layout] : m_pipeline_layouts) {
+        m_device.destroyPipelineLayout(layout, hostAllocator());
+    }
+    for (auto& [description, layout] : m_set_layouts) {
+        m_device.destroyDescriptorSetLayout(layout, hostAllocator());
+    }
+
+    m_pipeline_layouts.clear();
+    m_set_layouts.clear();
+}
+
+/*
+The bindings are sorted by binding number before they go into the key, together with their binding
+flags if there are any, so the order they were listed in doesn't matter. Immutable samplers are
+compared by handle.
+*/
+vk::DescriptorSetLayout
+layout_cache::descriptorSetLayout(const vk::DescriptorSetLayoutCreateInfo& info)
+{
+    const vk::DescriptorBindingFlagsEXT* bindingflags = nullptr;
+
+#if defined(VK_EXT_descriptor_indexing)
+    auto next = static_cast<const vk::BaseInStructure*>(info.pNext);
+    while (next) {
+        if (next->sType == vk::StructureType::eDescriptorSetLayoutBindingFlagsCreateInfoEXT) {
+            auto flags =
+              reinterpret_cast<const vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT*>(next);
+            if (flags->bindingCount) {
+                bindingflags = flags->pBindingFlags;
+            }
+        }
+        next = next->pNext;
+    }
+#endif
+
+    std::vector<uint32_t> order(info.bindingCount);
+    for (uint32_t i = 0; i < info.bindingCount; ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return info.pBindings[a].binding < info.pBindings[b].binding;
+    });
+
+    key description;
+    description.words.push_back((uint64_t)(uint32_t)info.flags);
+    description.words.push_back(info.bindingCount);
+
+    for (uint32_t i : order) {
+        const vk::DescriptorSetLayoutBinding& binding = info.pBindings[i];
+
+        description.words.push_back(binding.binding);
+        description.words.push_back((uint64_t)binding.descriptorType);
+        description.words.push_back(binding.descriptorCount);
+        description.words.push_back((uint64_t)(uint32_t)binding.stageFlags);
+        description.words.push_back(bindingflags ? (uint64_t)(uint32_t)bindingflags[i] : 0);
+
+        const bool immutable = binding.pImmutableSamplers != nullptr;
+        description.words.push_back(immutable);
+        for (uint32_t s = 0; immutable && s < binding.descriptorCount; ++s) {
+            description.words.push_back(
+              (uint64_t)static_cast<VkSampler>(binding.pImmutableSamplers[s]));
+        }
+    }
+
+    auto found = m_set_layouts.find(description);
+    if (found != m_set_layouts.end()) {
+        return found->second;
+    }
+
+    vk::DescriptorSetLayout layout;
+    if (!(layout = m_device.createDescriptorSetLayout(info, hostAllocator()))) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+
+    m_set_layouts.emplace(std::move(description), layout);
+    return layout;
+}
+
+/*
+Set layouts are compared by handle, which is enough as long as they come from this cache too.
+Unlike the bindings above their order is significant, it's what decides the set numbers. Push
+constant ranges are sorted.
+*/
+vk::PipelineLayout
+layout_cache::pipelineLayout(const vk::PipelineLayoutCreateInfo& info)
+{
+    std::vector<vk::PushConstantRange> ranges(info.pPushConstantRanges,
+                                              info.pPushConstantRanges
+                                                + info.pushConstantRangeCount);
+    std::sort(ranges.begin(), ranges.end(),
+              [](const vk::PushConstantRange& a, const vk::PushConstantRange& b) {
+                  return std::make_tuple(a.offset, a.size, (uint32_t)a.stageFlags)
+                         < std::make_tuple(b.offset, b.size, (uint32_t)b.stageFlags);
+              });
+
+    key description;
+    description.words.push_back((uint64_t)(uint32_t)info.flags);
+    description.words.push_back(info.setLayoutCount);
+
+    for (uint32_t i = 0; i < info.setLayoutCount; ++i) {
+        description.words.push_back(
+          (uint64_t)static_cast<VkDescriptorSetLayout>(info.pSetLayouts[i]));
+    }
+    for (const vk::PushConstantRange& range : ranges) {
+        description.words.push_back((uint64_t)(uint32_t)range.stageFlags);
+        description.words.push_back(range.offset);
+        description.words.push_back(range.size);
+    }
+
+    auto found = m_pipeline_layouts.find(description);
+    if (found != m_pipeline_layouts.end()) {
+        return found->second;
+    }
+
+    vk::PipelineLayout layout;
+    if (!(layout = m_device.createPipelineLayout(info, hostAllocator()))) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    m_pipeline_layouts.emplace(std::move(description), layout);
+    return layout;
+}
+
+// FNV-1a over the words
+size_t
+layout_cache::key_hash::operator()(const key& k) const
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint64_t word : k.words) {
+        hash ^= word;
+        hash *= 0x100000001b3ull;
+    }
+    return (size_t)hash;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,54 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Descriptor set layouts and pipeline layouts, created once per distinct description. Two create
+infos that describe the same layout get the same handle back, however their bindings or push
+constant ranges are ordered, so pipelines that share an interface also share the driver objects.
+
+The cache owns everything it hands out: the handles stay valid until destroy(), and callers never
+destroy them themselves. Pipeline layouts only depend on their set layouts and push constants, not
+on the swapchain, so they outlive swapchain rebuilds.
+
+Descriptor set layout create infos may chain a vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT,
+which is part of the key. Anything else in their pNext chains is passed on, but not compared.
+*/
+class layout_cache
+{
+public:
+    void init(vk::Device device);
+    void destroy();
+
+    vk::DescriptorSetLayout descriptorSetLayout(const vk::DescriptorSetLayoutCreateInfo& info);
+    vk::PipelineLayout      pipelineLayout(const vk::PipelineLayoutCreateInfo& info);
+
+private:
+    // A flattened description, compared word by word
+    struct key
+    {
+        std::vector<uint64_t> words;
+
+        bool operator==(const key& other) const { return words == other.words; }
+    };
+
+    struct key_hash
+    {
+        size_t operator()(const key& k) const;
+    };
+
+    vk::Device                                                 m_device;
+    std::unordered_map<key, vk::DescriptorSetLayout, key_hash> m_set_layouts;
+    std::unordered_map<key, vk::PipelineLayout, key_hash>      m_pipeline_layouts;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,277 @@
+#include "graphics/light_culling.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Has to match local_size_x in lights.comp
+const uint32_t light_group_size = 64;
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+light_culling::init(vk::PhysicalDevice physical_device,
+                    vk::Device         device,
+                    memory_allocator&  allocator,
+                    layout_cache&      layouts,
+                    pipeline_cache&    pipelines,
+                    uint32_t           max_lights,
+                    uint32_t           frames,
+                    bool               update_templates)
+{
+    m_device     = device;
+    m_allocator  = &allocator;
+    m_max_lights = max_lights;
+    m_frames     = frames;
+
+    // Every frame's regions are bound at their own offset, which has to be aligned
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+
+    m_lights_frame_size   = alignUp(sizeof(light_view) + max_lights * sizeof(light), alignment);
+    m_clusters_frame_size = alignUp(
+      (light_cluster_count + light_cluster_count * max_lights_per_cluster) * sizeof(uint32_t),
+      alignment);
+
+    auto lightsinfo = vk::BufferCreateInfo()
+                        .setSize(m_lights_frame_size * frames)
+                        .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                  | allocator.addressUsage())
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_lights        = m_device.createBuffer(lightsinfo, hostAllocator());
+    m_lights_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_lights),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_lights, m_lights_memory.memory, m_lights_memory.offset);
+
+    // Only ever touched by the GPU. Every cluster's count is written every time, so nothing needs
+    // clearing.
+    auto clustersinfo = vk::BufferCreateInfo()
+                          .setSize(m_clusters_frame_size * frames)
+                          .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                    | allocator.addressUsage())
+                          .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_clusters        = m_device.createBuffer(clustersinfo, hostAllocator());
+    m_clusters_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_clusters),
+                                              vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                              memory_allocator::resource_kind::linear,
+                                              memory_category::other);
+    m_device.bindBufferMemory(m_clusters, m_clusters_memory.memory, m_clusters_memory.offset);
+
+    // 0: this frame's light_view and lights, 1: its clusters
+    std::array<vk::DescriptorSetLayoutBinding, 2> bindings;
+    for (uint32_t i = 0; i < (uint32_t)bindings.size(); ++i) {
+        bindings[i] = vk::DescriptorSetLayoutBinding()
+                        .setBinding(i)
+                        .setDescriptorCount(1)
+                        .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                        .setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    }
+
+    auto setlayoutinfo = vk::DescriptorSetLayoutCreateInfo()
+                           .setBindingCount((uint32_t)bindings.size())
+                           .setPBindings(bindings.data());
+
+    vk::DescriptorSetLayout setlayout = layouts.descriptorSetLayout(setlayoutinfo);
+    m_writes.init(m_device, setlayout, bindings.data(), (uint32_t)bindings.size(),
+                  update_templates);
+
+    auto layoutinfo =
+      vk::PipelineLayoutCreateInfo().setSetLayoutCount(1).setPSetLayouts(&setlayout);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    // The regions never move, so every frame's set is written once here
+    m_descriptors.init(m_device, { { vk::DescriptorType::eStorageBuffer, 2 } }, frames);
+    for (uint32_t i = 0; i < frames; ++i) {
+        m_sets.push_back(m_descriptors.allocate(setlayout));
+
+        std::array<descriptor_data, 2> data;
+        data[0].buffer = lights(i);
+        data[1].buffer = clusters(i);
+        m_writes.update(m_sets.back(), data.data());
+    }
+
+    core::mapped_file code("shaders/lights_comp.spv");
+
+    auto shaderinfo = vk::ShaderModuleCreateInfo()
+                        .setCodeSize(code.size())
+                        .setPCode((const uint32_t*)code.data());
+
+    m_shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+    auto pipelineinfo =
+      vk::ComputePipelineCreateInfo()
+        .setStage(vk::PipelineShaderStageCreateInfo()
+                    .setStage(vk::ShaderStageFlagBits::eCompute)
+                    .setModule(m_shader)
+                    .setPName("main"))
+        .setLayout(m_layout);
+
+    m_pipeline = m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+}
+
+void
+light_culling::destroy()
+{
+    m_device.destroyPipeline(m_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_shader, hostAllocator());
+    m_descriptors.destroy();
+    m_sets.clear();
+    m_writes.destroy();
+
+    m_device.destroyBuffer(m_lights, hostAllocator());
+    m_allocator->free(m_lights_memory);
+    m_device.destroyBuffer(m_clusters, hostAllocator());
+    m_allocator->free(m_clusters_memory);
+
+    m_lights   = nullptr;
+    m_clusters = nullptr;
+}
+
+void
+light_culling::beginFrame(uint32_t         frame,
+                          const glm::mat4& view,
+                          const glm::mat4& projection,
+                          vk::Extent2D     extent,
+                          float            nearplane,
+                          float            farplane)
+{
+    m_frame      = frame % m_frames;
+    m_count      = 0;
+    m_view       = view;
+    m_projection = projection;
+    m_extent     = extent;
+    m_volumes.clear();
+
+    m_light_view.inverse_projection = glm::inverse(projection);
+    m_light_view.extent             = glm::vec2((float)extent.width, (float)extent.height);
+    m_light_view.near_plane         = nearplane;
+    m_light_view.far_plane          = farplane;
+}
+
+void
+light_culling::push(const light& source)
+{
+    if (m_count == m_max_lights) {
+        throw std::runtime_error("Light buffer is out of space for this frame!");
+    }
+
+    light viewspace     = source;
+    viewspace.position  = glm::vec3(m_view * glm::vec4(source.position, 1.f));
+    viewspace.direction = glm::normalize(glm::mat3(m_view) * source.direction);
+
+    // Write-combined like the draw buffer, so it's written in one go and never read back
+    char* data = static_cast<char*>(m_lights_memory.mapped) + m_frame * m_lights_frame_size
+                 + sizeof(light_view);
+    std::memcpy(data + m_count * sizeof(viewspace), &viewspace, sizeof(viewspace));
+
+    if (m_volumes_enabled) {
+        m_volumes.push_back(volume(viewspace.position, viewspace.range));
+    }
+
+    ++m_count;
+}
+
+/*
+The screen rectangle around the corners of the view space box around the sphere, projected, and the
+depths of its far and near sides, which with reverse-Z are the least and the most. A sphere that
+reaches past the near plane may be anywhere on the screen, and as near as the depth buffer goes.
+The rectangle grows by a pixel, for the jitter of temporal antialiasing.
+*/
+light_volume
+light_culling::volume(const glm::vec3& center, float radius) const
+{
+    light_volume result;
+    result.scissor = vk::Rect2D({ 0, 0 }, m_extent);
+
+    auto depth = [this](float z) {
+        const glm::vec4 clip = m_projection * glm::vec4(0.f, 0.f, z, 1.f);
+        return glm::clamp(clip.z / clip.w, 0.f, 1.f);
+    };
+    result.min_depth = depth(center.z - radius);
+
+    const float nearz = -m_light_view.near_plane;
+    if (center.z + radius > nearz) {
+        result.max_depth = 1.f;
+        return result;
+    }
+    result.max_depth = depth(center.z + radius);
+
+    glm::vec2 low(1.f);
+    glm::vec2 high(-1.f);
+    for (uint32_t corner = 0; corner < 8; ++corner) {
+        const glm::vec3 offset((corner & 1) ? radius : -radius, (corner & 2) ? radius : -radius,
+                               (corner & 4) ? radius : -radius);
+        const glm::vec4 clip = m_projection * glm::vec4(center + offset, 1.f);
+        const glm::vec2 ndc  = glm::vec2(clip) / clip.w;
+        low                  = glm::min(low, ndc);
+        high                 = glm::max(high, ndc);
+    }
+    low  = glm::clamp(low, -1.f, 1.f);
+    high = glm::clamp(high, -1.f, 1.f);
+
+    const glm::vec2 extent((float)m_extent.width, (float)m_extent.height);
+    const glm::vec2 first = glm::max((low * 0.5f + 0.5f) * extent - 1.f, glm::vec2(0.f));
+    const glm::vec2 last  = glm::min((high * 0.5f + 0.5f) * extent + 1.f, extent);
+    if (last.x <= first.x || last.y <= first.y) {
+        result.scissor.extent = vk::Extent2D(0, 0);
+        return result;
+    }
+    result.scissor.offset = vk::Offset2D((int32_t)first.x, (int32_t)first.y);
+    result.scissor.extent = vk::Extent2D((uint32_t)std::ceil(last.x) - (uint32_t)first.x,
+                                         (uint32_t)std::ceil(last.y) - (uint32_t)first.y);
+    return result;
+}
+
+/*
+The light_view goes in last, once the count is known. One invocation bins the lights for one
+cluster, so the dispatch covers all of them however many lights there are.
+*/
+void
+light_culling::record(vk::CommandBuffer command_buffer) const
+{
+    light_view view = m_light_view;
+    view.count      = m_count;
+    std::memcpy(static_cast<char*>(m_lights_memory.mapped) + m_frame * m_lights_frame_size, &view,
+                sizeof(view));
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, 0,
+                                      m_sets[m_frame], nullptr);
+    command_buffer.dispatch((light_cluster_count + light_group_size - 1) / light_group_size, 1, 1);
+}
+
+vk::DescriptorBufferInfo
+light_culling::lights(uint32_t frame) const
+{
+    return vk::DescriptorBufferInfo(m_lights, frame * m_lights_frame_size, m_lights_frame_size);
+}
+
+vk::DescriptorBufferInfo
+light_culling::clusters(uint32_t frame) const
+{
+    return vk::DescriptorBufferInfo(m_clusters, frame * m_clusters_frame_size,
+                                    m_clusters_frame_size);
+}
+
+}  // namespace shiny::graphics
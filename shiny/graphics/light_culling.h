@@ -0,0 +1,149 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/descriptor_template.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+A point light, or a spot light when it has a cone, laid out like the shaders' std430 Light struct.
+It fades out smoothly towards `range`, and is culled beyond it.
+*/
+struct light
+{
+    glm::vec3 position;
+    float     range      = 1.f;
+    glm::vec3 color      = glm::vec3(1.f);  // already scaled by the intensity
+    float     spot_outer = -1.f;  // cosine of the cone's half angle, -1 for a point light
+    glm::vec3 direction  = glm::vec3(0.f, 0.f, -1.f);  // the cone's axis
+    float     spot_inner = -1.f;  // cosine of the half angle it's fully lit within
+};
+
+static_assert(sizeof(light) == 48, "light has to match the shaders' layout");
+
+/*
+What the light culling and fragment shaders read once per frame, ahead of the lights themselves,
+laid out like the start of their std430 Lights block. The lights start 16 byte aligned after it.
+*/
+struct light_view
+{
+    glm::mat4 inverse_projection;
+    glm::vec2 extent;  // of the image rendered to, which the tiles divide up
+    float     near_plane = 0.f;
+    float     far_plane  = 0.f;
+    uint32_t  count      = 0;
+    uint32_t  padding[3] = {};
+};
+
+static_assert(sizeof(light_view) == 96, "light_view has to match the shaders' layout");
+
+// Where a light's sphere can reach on the screen, and in the depth buffer, see enableVolumes()
+struct light_volume
+{
+    vk::Rect2D scissor;
+    float      min_depth = 0.f;
+    float      max_depth = 1.f;
+};
+
+// The clusters the view frustum is divided into, which lights.comp and lighting.glsl have to match
+const uint32_t light_cluster_tiles_x  = 16;
+const uint32_t light_cluster_tiles_y  = 9;
+const uint32_t light_cluster_slices   = 24;
+const uint32_t light_cluster_count    = light_cluster_tiles_x * light_cluster_tiles_y
+                                        * light_cluster_slices;
+const uint32_t max_lights_per_cluster = 128;
+
+/*
+Clustered forward lighting. The view frustum is divided into tiles across the image and slices in
+depth, spaced exponentially so that clusters far away are about as deep as they are wide. A compute
+shader finds the lights whose spheres touch each cluster, and the fragment shader then only loops
+over the lights of the cluster it's in, which for thousands of small lights is a handful.
+
+Lights are given in world space and moved into view space as they're pushed, which is where both
+shaders work. A cluster holds at most max_lights_per_cluster lights, and drops any more that touch
+it. Spot lights are culled by their spheres as well, which is loose but never wrong.
+
+The lights and clusters of every frame in flight are in regions of their own, like the draw
+buffer's: a frame's lights may only be pushed once its fence has been waited on, and the fragment
+shaders have to read the region of the frame `record()` was last called for.
+*/
+class light_culling
+{
+public:
+    void init(vk::PhysicalDevice physical_device,
+              vk::Device         device,
+              memory_allocator&  allocator,
+              layout_cache&      layouts,
+              pipeline_cache&    pipelines,
+              uint32_t           max_lights,
+              uint32_t           frames,
+              bool               update_templates = false);
+    void destroy();
+
+    // With the frame's view and projection, which its lights are culled against. `extent` is that
+    // of the image rendered to.
+    void beginFrame(uint32_t         frame,
+                    const glm::mat4& view,
+                    const glm::mat4& projection,
+                    vk::Extent2D     extent,
+                    float            nearplane,
+                    float            farplane);
+    void push(const light& source);
+
+    // Records the binning of this frame's lights, outside of a render pass. The clusters have to be
+    // made visible to the fragment shaders after it by the render graph.
+    void record(vk::CommandBuffer command_buffer) const;
+
+    // For the fragment shaders' descriptors
+    vk::DescriptorBufferInfo lights(uint32_t frame) const;
+    vk::DescriptorBufferInfo clusters(uint32_t frame) const;
+
+    vk::Buffer clusterBuffer() const { return m_clusters; }
+    uint32_t   count() const { return m_count; }
+
+    // Has push() find every light's light_volume as well, in the order they were pushed, for
+    // lighting them one at a time, scissored and depth bounded to their spheres
+    void                             enableVolumes() { m_volumes_enabled = true; }
+    const std::vector<light_volume>& volumes() const { return m_volumes; }
+
+private:
+    light_volume volume(const glm::vec3& center, float radius) const;
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::Buffer     m_lights;    // host visible, light_view and lights of every frame
+    allocation     m_lights_memory;
+    vk::Buffer     m_clusters;  // device local, counts and light indices of every frame
+    allocation     m_clusters_memory;
+    vk::DeviceSize m_lights_frame_size   = 0;
+    vk::DeviceSize m_clusters_frame_size = 0;
+    uint32_t       m_max_lights          = 0;
+    uint32_t       m_frames              = 0;
+
+    descriptor_allocator           m_descriptors;
+    std::vector<vk::DescriptorSet> m_sets;  // one per frame, written once
+    descriptor_template            m_writes;
+    vk::PipelineLayout             m_layout;  // owned by the layout_cache
+    vk::ShaderModule               m_shader;
+    vk::Pipeline                   m_pipeline;
+
+    glm::mat4    m_view       = glm::mat4(1.f);
+    glm::mat4    m_projection = glm::mat4(1.f);
+    vk::Extent2D m_extent;
+    light_view   m_light_view;
+    uint32_t     m_frame = 0;
+    uint32_t     m_count = 0;
+
+    bool                      m_volumes_enabled = false;
+    std::vector<light_volume> m_volumes;  // this frame's
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,583 @@
+#include "graphics/memory_allocator.h"
+
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <bitset>
+#include <stdexcept>
+
+namespace {
+
+const vk::DeviceSize default_block_size = 64 * 1024 * 1024;
+const vk::DeviceSize minimum_block_size = 4 * 1024 * 1024;
+
+// Without VK_EXT_memory_budget, leave room for everything else that lives in VRAM (the swap chain,
+// other applications, the compositor) by only counting on this much of each heap
+const float fallback_budget_share = 0.8f;
+
+// The host visible window into VRAM that devices have without resizable BAR
+const vk::DeviceSize bar_window_size = 256 * 1024 * 1024;
+
+size_t
+flagCount(vk::MemoryPropertyFlags flags)
+{
+    return std::bitset<32>(static_cast<VkMemoryPropertyFlags>(flags)).count();
+}
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+const char*
+memoryCategoryName(memory_category category)
+{
+    switch (category) {
+        case memory_category::vertex:
+            return "vertex";
+        case memory_category::index:
+            return "index";
+        case memory_category::uniform:
+            return "uniform";
+        case memory_category::staging:
+            return "staging";
+        case memory_category::texture:
+            return "texture";
+        case memory_category::render_target:
+            return "render_target";
+        default:
+            return "other";
+    }
+}
+
+void
+memory_allocator::init(vk::PhysicalDevice physical_device, vk::Device device, uint32_t device_count)
+{
+    m_physical_device = physical_device;
+    m_device          = device;
+    m_device_count    = std::max(device_count, 1u);
+    m_properties      = physical_device.getMemoryProperties();
+    m_heap_usage.assign(m_properties.memoryHeapCount, 0);
+    m_used.assign(m_properties.memoryHeapCount, {});
+    m_allocations.assign(m_properties.memoryHeapCount, {});
+
+    const vk::MemoryPropertyFlags bar =
+      vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible
+      | vk::MemoryPropertyFlagBits::eHostCoherent;
+    m_resizable_bar = false;
+    for (uint32_t i = 0; i < m_properties.memoryTypeCount; ++i) {
+        const vk::MemoryType& type = m_properties.memoryTypes[i];
+        m_resizable_bar |= (type.propertyFlags & bar) == bar
+                           && m_properties.memoryHeaps[type.heapIndex].size > bar_window_size;
+    }
+
+    // Per-frame buffers in one GPU's VRAM would have to be read from there by the others
+    m_multi_instance_types = 0;
+    m_device_addresses     = false;
+    if (m_device_count > 1) {
+        m_resizable_bar = false;
+        for (uint32_t i = 0; i < m_properties.memoryTypeCount; ++i) {
+            const vk::MemoryType& type = m_properties.memoryTypes[i];
+            if ((type.propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+                && (m_properties.memoryHeaps[type.heapIndex].flags
+                    & vk::MemoryHeapFlagBits::eMultiInstance)) {
+                m_multi_instance_types |= 1u << i;
+            }
+        }
+    }
+}
+
+void
+memory_allocator::destroy()
+{
+    for (auto& p : m_pools) {
+        for (auto& b : p.blocks) {
+            if (!b) {
+                continue;
+            }
+            // freeing memory implicitly unmaps it
+            m_device.freeMemory(b->memory, hostAllocator());
+        }
+    }
+    m_pools.clear();
+    m_evacuating = 0;
+    m_heap_usage.assign(m_properties.memoryHeapCount, 0);
+    m_used.assign(m_properties.memoryHeapCount, {});
+    m_allocations.assign(m_properties.memoryHeapCount, {});
+}
+
+memory_budget
+memory_allocator::deviceLocalBudget() const
+{
+    memory_budget result;
+    for (const memory_heap_report& heap : report()) {
+        if (heap.device_local) {
+            result.budget += heap.budget;
+            result.usage += heap.usage;
+        }
+    }
+    return result;
+}
+
+std::vector<memory_heap_report>
+memory_allocator::report() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<memory_heap_report> heaps(m_properties.memoryHeapCount);
+
+    for (uint32_t i = 0; i < m_properties.memoryHeapCount; ++i) {
+        const vk::MemoryHeap& properties = m_properties.memoryHeaps[i];
+        memory_heap_report&   heap       = heaps[i];
+
+        heap.size         = properties.size;
+        heap.budget       = (vk::DeviceSize)(properties.size * fallback_budget_share);
+        heap.usage        = m_heap_usage[i];
+        heap.allocated    = m_heap_usage[i];
+        heap.device_local = bool(properties.flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+        heap.used         = m_used[i];
+        heap.allocations  = m_allocations[i];
+    }
+
+#if defined(VK_EXT_memory_budget)
+    if (m_budget_query) {
+        vk::PhysicalDeviceMemoryBudgetPropertiesEXT budgets;
+        vk::PhysicalDeviceMemoryProperties2         properties;
+        properties.pNext = &budgets;
+
+        m_budget_query(static_cast<VkPhysicalDevice>(m_physical_device),
+                       reinterpret_cast<VkPhysicalDeviceMemoryProperties2*>(&properties));
+
+        for (uint32_t i = 0; i < m_properties.memoryHeapCount; ++i) {
+            heaps[i].budget = budgets.heapBudget[i];
+            heaps[i].usage  = budgets.heapUsage[i];
+        }
+    }
+#endif
+
+    return heaps;
+}
+
+/*
+Graphics cards can offer different types of memory to allocate from. Each type of memory varies in
+terms of allowed operations and performance characteristics. We need to combine the requirements of
+the buffer and our own application requirements to find the right type of memory to use.
+
+A memory type is only acceptable if it has every one of the required property bits. Of those the
+one with the most of the preferred bits wins, then the one with the fewest bits nobody asked for,
+and then the one that lives in the largest heap. Unasked for bits are never free: device local on a
+staging buffer takes VRAM away from textures, host visible on an image is the small BAR window on
+discrete cards rather than the rest of VRAM, and uncached or protected memory is slower. With a
+device group, host visible types in VRAM are only used if nothing else will do.
+*/
+MemoryTypeIndex
+memory_allocator::findMemoryType(uint32_t                typefilter,
+                                 vk::MemoryPropertyFlags required,
+                                 vk::MemoryPropertyFlags preferred) const
+{
+    bool            found     = false;
+    MemoryTypeIndex best      = 0;
+    size_t          bestmatch = 0;
+    size_t          bestextra = 0;
+    vk::DeviceSize  bestheap  = 0;
+
+    if (hasMemoryType(typefilter & ~m_multi_instance_types, required)) {
+        typefilter &= ~m_multi_instance_types;
+    }
+
+    for (uint32_t i = 0; i < m_properties.memoryTypeCount; ++i) {
+        const auto& type = m_properties.memoryTypes[i];
+
+        if (!(typefilter & (1 << i)) || (type.propertyFlags & required) != required) {
+            continue;
+        }
+
+        const size_t         match    = flagCount(type.propertyFlags & preferred);
+        const size_t         extra    = flagCount(type.propertyFlags & ~(required | preferred));
+        const vk::DeviceSize heapsize = m_properties.memoryHeaps[type.heapIndex].size;
+
+        const bool better = !found || match > bestmatch
+                            || (match == bestmatch
+                                && (extra < bestextra
+                                    || (extra == bestextra && heapsize > bestheap)));
+        if (better) {
+            found     = true;
+            best      = i;
+            bestmatch = match;
+            bestextra = extra;
+            bestheap  = heapsize;
+        }
+    }
+
+    if (!found) {
+        throw std::runtime_error("Unable to find a suitable Memory Type!");
+    }
+
+    return best;
+}
+
+bool
+memory_allocator::hasMemoryType(uint32_t typefilter, vk::MemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < m_properties.memoryTypeCount; ++i) {
+        if ((typefilter & (1 << i))
+            && (m_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return true;
+        }
+    }
+    return false;
+}
+
+allocation
+memory_allocator::allocate(const vk::MemoryRequirements& requirements,
+                           vk::MemoryPropertyFlags       required,
+                           resource_kind                 kind,
+                           memory_category               category,
+                           vk::MemoryPropertyFlags       preferred)
+{
+    MemoryTypeIndex type      = findMemoryType(requirements.memoryTypeBits, required, preferred);
+    vk::DeviceSize  blocksize = preferredBlockSize(type);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    allocation result;
+    result.memory_type = type;
+    result.size        = requirements.size;
+    result.category    = category;
+
+    // Anything bigger than half a block would waste most of a block on its own, so it gets its own
+    // vk::DeviceMemory instead, and so does lazily allocated memory.
+    if (requirements.size > blocksize / 2
+        || (m_properties.memoryTypes[type].propertyFlags
+            & vk::MemoryPropertyFlagBits::eLazilyAllocated)) {
+        result.memory    = allocateMemory(requirements.size, type);
+        result.mapped    = mapIfHostVisible(result.memory, type);
+        result.dedicated = true;
+        track(type, requirements.size, true);
+        account(result, true);
+        return result;
+    }
+
+    pool& p       = getPool(type, kind);
+    result.pool   = (uint32_t)(&p - m_pools.data());
+    block* target = nullptr;
+
+    // First fit over every block of the pool. Blocks are large and few, so this stays cheap.
+    auto tryblock = [&](block& b) -> bool {
+        for (auto it = b.free_ranges.begin(); it != b.free_ranges.end(); ++it) {
+            vk::DeviceSize start = alignUp(it->first, requirements.alignment);
+            vk::DeviceSize end   = it->first + it->second;
+
+            if (start + requirements.size > end) {
+                continue;
+            }
+
+            vk::DeviceSize rangestart = it->first;
+            b.free_ranges.erase(it);
+
+            if (start > rangestart) {
+                b.free_ranges[rangestart] = start - rangestart;
+            }
+            if (start + requirements.size < end) {
+                b.free_ranges[start + requirements.size] = end - (start + requirements.size);
+            }
+
+            result.offset = start;
+            return true;
+        }
+        return false;
+    };
+
+    for (size_t i = 0; i < p.blocks.size() && !target; ++i) {
+        if (p.blocks[i] && !p.blocks[i]->evacuating && tryblock(*p.blocks[i])) {
+            target       = p.blocks[i].get();
+            result.block = (uint32_t)i;
+        }
+    }
+
+    if (!target) {
+        target = createBlock(p, blocksize);
+        for (size_t i = 0; i < p.blocks.size(); ++i) {
+            if (p.blocks[i].get() == target) {
+                result.block = (uint32_t)i;
+            }
+        }
+        if (!tryblock(*target)) {
+            throw std::runtime_error("Failed to sub-allocate from a fresh memory block!");
+        }
+    }
+
+    result.memory = target->memory;
+    result.mapped = target->mapped ? static_cast<char*>(target->mapped) + result.offset : nullptr;
+    target->used += result.size;
+    ++target->categories[(size_t)category];
+    account(result, true);
+
+    return result;
+}
+
+void
+memory_allocator::free(allocation& alloc)
+{
+    if (!alloc) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    account(alloc, false);
+
+    if (alloc.dedicated) {
+        m_device.freeMemory(alloc.memory, hostAllocator());
+        track(alloc.memory_type, alloc.size, false);
+        alloc = allocation();
+        return;
+    }
+
+    block& b = *m_pools[alloc.pool].blocks[alloc.block];
+    b.used -= std::min(b.used, alloc.size);
+    --b.categories[(size_t)alloc.category];
+
+    vk::DeviceSize start = alloc.offset;
+    vk::DeviceSize size  = alloc.size;
+
+    // Coalesce with the free range right after us...
+    auto next = b.free_ranges.find(start + size);
+    if (next != b.free_ranges.end()) {
+        size += next->second;
+        b.free_ranges.erase(next);
+    }
+
+    // ...and with the one right before us. Alignment padding in front of an allocation stays in
+    // the free list, so the previous range may end exactly at our offset.
+    auto it = b.free_ranges.lower_bound(start);
+    if (it != b.free_ranges.begin()) {
+        auto prev = std::prev(it);
+        if (prev->first + prev->second == start) {
+            start = prev->first;
+            size += prev->second;
+            b.free_ranges.erase(prev);
+        }
+    }
+
+    b.free_ranges[start] = size;
+
+    // Give completely empty blocks back to the driver, but always keep one around per pool so a
+    // load/unload cycle doesn't thrash vkAllocateMemory.
+    if (start == 0 && size == b.size) {
+        auto& blocks   = m_pools[alloc.pool].blocks;
+        auto  occupied = std::count_if(blocks.begin(), blocks.end(),
+                                      [](const std::unique_ptr<block>& slot) { return bool(slot); });
+        if (occupied > 1) {
+            m_device.freeMemory(b.memory, hostAllocator());
+            track(alloc.memory_type, b.size, false);
+            blocks[alloc.block].reset();
+        }
+    }
+
+    alloc = allocation();
+}
+
+/*
+Moving a block's contents only pays off if they fit into the free space of the blocks that stay,
+which loses the free space of every block that is picked. The sparsest blocks go first, since they
+free the most memory for the fewest bytes copied. Fragmentation within the other blocks can still
+mean a move needs a new block, which is no worse than before once the evacuated one is freed.
+*/
+uint32_t
+memory_allocator::beginDefragmentation(resource_kind   kind,
+                                       memory_category category,
+                                       float           max_usage)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stopEvacuating();
+
+    std::vector<block*> candidates;
+    for (pool& p : m_pools) {
+        if (p.kind != kind) {
+            continue;
+        }
+
+        vk::DeviceSize room = 0;  // free in the blocks that stay
+        candidates.clear();
+        for (auto& b : p.blocks) {
+            if (!b) {
+                continue;
+            }
+            room += b->size - b->used;
+
+            uint32_t others = 0;
+            for (size_t i = 0; i < memory_category_count; ++i) {
+                others += i == (size_t)category ? 0 : b->categories[i];
+            }
+            if (b->used > 0 && others == 0 && b->used <= (vk::DeviceSize)(b->size * max_usage)) {
+                candidates.push_back(b.get());
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const block* a, const block* b) { return a->used < b->used; });
+
+        vk::DeviceSize moving = 0;
+        for (block* b : candidates) {
+            const vk::DeviceSize left = room - (b->size - b->used);
+            if (left < moving + b->used) {
+                break;
+            }
+            room = left;
+            moving += b->used;
+            b->evacuating = true;
+            ++m_evacuating;
+        }
+    }
+
+    return m_evacuating;
+}
+
+void
+memory_allocator::endDefragmentation()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stopEvacuating();
+}
+
+void
+memory_allocator::stopEvacuating()
+{
+    for (pool& p : m_pools) {
+        for (auto& b : p.blocks) {
+            if (b) {
+                b->evacuating = false;
+            }
+        }
+    }
+    m_evacuating = 0;
+}
+
+bool
+memory_allocator::evacuating(const allocation& alloc) const
+{
+    if (!alloc || alloc.dedicated || m_evacuating.load() == 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto& slot = m_pools[alloc.pool].blocks[alloc.block];
+    return slot && slot->evacuating;
+}
+
+memory_allocator::pool&
+memory_allocator::getPool(MemoryTypeIndex type, resource_kind kind)
+{
+    for (auto& p : m_pools) {
+        if (p.memory_type == type && p.kind == kind) {
+            return p;
+        }
+    }
+
+    pool p;
+    p.memory_type = type;
+    p.kind        = kind;
+    m_pools.push_back(std::move(p));
+    return m_pools.back();
+}
+
+/*
+Small heaps (e.g. the 256MB host-visible device-local window on discrete cards) would be exhausted
+by a handful of 64MB blocks, so we scale the block size down with the heap.
+*/
+vk::DeviceSize
+memory_allocator::preferredBlockSize(MemoryTypeIndex type) const
+{
+    vk::DeviceSize heapsize = m_properties.memoryHeaps[m_properties.memoryTypes[type].heapIndex].size;
+
+    return std::max(minimum_block_size, std::min(default_block_size, heapsize / 8));
+}
+
+memory_allocator::block*
+memory_allocator::createBlock(pool& p, vk::DeviceSize size)
+{
+    auto b         = std::make_unique<block>();
+    b->memory      = allocateMemory(size, p.memory_type);
+    b->size        = size;
+    b->mapped      = mapIfHostVisible(b->memory, p.memory_type);
+    b->free_ranges = { { 0, size } };
+    track(p.memory_type, size, true);
+
+    // reuse the slot of a block that was handed back earlier so indices stay stable
+    for (auto& slot : p.blocks) {
+        if (!slot) {
+            slot = std::move(b);
+            return slot.get();
+        }
+    }
+
+    p.blocks.push_back(std::move(b));
+    return p.blocks.back().get();
+}
+
+vk::DeviceMemory
+memory_allocator::allocateMemory(vk::DeviceSize size, MemoryTypeIndex type) const
+{
+    auto allocinfo = vk::MemoryAllocateInfo().setAllocationSize(size).setMemoryTypeIndex(type);
+
+#if defined(VK_KHR_device_group)
+    // One instance, on the first GPU, so that it can be mapped
+    auto flags = vk::MemoryAllocateFlagsInfoKHR();
+    if (m_multi_instance_types & (1u << type)) {
+        flags.flags |= vk::MemoryAllocateFlagBits::eDeviceMask;
+        flags.setDeviceMask(1);
+    }
+#if defined(VK_KHR_buffer_device_address)
+    // Any buffer bound to the block may have its address taken
+    if (m_device_addresses) {
+        flags.flags |= vk::MemoryAllocateFlagBits::eDeviceAddressKHR;
+    }
+#endif
+    if (flags.flags) {
+        allocinfo.setPNext(&flags);
+    }
+#endif
+
+    return m_device.allocateMemory(allocinfo, hostAllocator());
+}
+
+/*
+Host visible blocks stay mapped for their whole lifetime. Mapping is not free and a block can only
+be mapped once, so handing out pointers into one persistent mapping is both faster and the only way
+several sub-allocations can be written at the same time.
+*/
+void*
+memory_allocator::mapIfHostVisible(vk::DeviceMemory memory, MemoryTypeIndex type) const
+{
+    if (!(m_properties.memoryTypes[type].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)) {
+        return nullptr;
+    }
+
+    return m_device.mapMemory(memory, 0, VK_WHOLE_SIZE);
+}
+
+void
+memory_allocator::track(MemoryTypeIndex type, vk::DeviceSize size, bool allocated)
+{
+    vk::DeviceSize& usage = m_heap_usage[m_properties.memoryTypes[type].heapIndex];
+    usage                 = allocated ? usage + size : usage - std::min(usage, size);
+}
+
+void
+memory_allocator::account(const allocation& alloc, bool allocated)
+{
+    const uint32_t  heap     = m_properties.memoryTypes[alloc.memory_type].heapIndex;
+    const size_t    category = (size_t)alloc.category;
+    vk::DeviceSize& used     = m_used[heap][category];
+    uint32_t&       count    = m_allocations[heap][category];
+
+    used  = allocated ? used + alloc.size : used - std::min(used, alloc.size);
+    count = allocated ? count + 1 : count - std::min(count, 1u);
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,258 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace shiny::graphics {
+
+using MemoryTypeIndex = uint32_t;
+
+// What an allocation is for, which is only used to account for the memory
+enum class memory_category : uint8_t
+{
+    vertex,
+    index,
+    uniform,
+    staging,        // uploads and readbacks
+    texture,
+    render_target,  // attachments and images written by the GPU
+    other,          // storage buffers of the GPU passes, indirect draws
+    count
+};
+
+const size_t memory_category_count = (size_t)memory_category::count;
+
+const char* memoryCategoryName(memory_category category);
+
+/*
+An allocation is a range inside a larger vk::DeviceMemory block that the allocator owns. Buffers and
+images are bound at `offset` into `memory` instead of always at offset 0. Host visible blocks are
+mapped once when they are created, so `mapped` already points at the start of this range.
+*/
+struct allocation
+{
+    vk::DeviceMemory memory;
+    vk::DeviceSize   offset      = 0;
+    vk::DeviceSize   size        = 0;
+    void*            mapped      = nullptr;
+    MemoryTypeIndex  memory_type = 0;
+    uint32_t         pool        = 0;
+    uint32_t         block       = 0;
+    bool             dedicated   = false;
+    memory_category  category    = memory_category::other;
+
+    explicit operator bool() const { return static_cast<bool>(memory); }
+};
+
+/*
+How much of the device local heaps the process may use before the driver starts paging or failing
+allocations, and how much of it is used already. Both are summed over every device local heap.
+*/
+struct memory_budget
+{
+    vk::DeviceSize budget = 0;
+    vk::DeviceSize usage  = 0;
+
+    vk::DeviceSize available() const { return budget > usage ? budget - usage : 0; }
+};
+
+/*
+One heap's memory. `allocated` is the vk::DeviceMemory the allocator holds in the heap, and `used`
+is how much of it the resources of every category have bound, the rest being free ranges and
+alignment. `budget` and `usage` are the driver's with VK_EXT_memory_budget, as for
+memory_budget, and otherwise a share of the heap and `allocated`.
+*/
+struct memory_heap_report
+{
+    vk::DeviceSize size         = 0;
+    vk::DeviceSize budget       = 0;
+    vk::DeviceSize usage        = 0;
+    vk::DeviceSize allocated    = 0;
+    bool           device_local = false;
+
+    std::array<vk::DeviceSize, memory_category_count> used        = {};
+    std::array<uint32_t, memory_category_count>       allocations = {};  // live ones
+};
+
+/*
+Every vkAllocateMemory is expensive and drivers only guarantee maxMemoryAllocationCount (which can
+be as low as 4096) live allocations at once. Instead of one allocation per resource we allocate
+large blocks per memory type and hand out sub-ranges from a free list inside each block.
+
+Buffers and optimally tiled images are kept in separate blocks so we never have to worry about
+bufferImageGranularity between neighbouring resources. Lazily allocated memory, which tiled GPUs
+only back with physical memory if an attachment ever has to leave the tile, is always allocated on
+its own, since a block of it would be backed as soon as any of its images was.
+
+Blocks fragment as resources come and go, streamed textures above all, and a block that is mostly
+free still takes up all of its memory. beginDefragmentation() therefore picks the sparsest blocks
+whose contents would fit into the rest of their pool and marks them as being evacuated: nothing new
+is allocated from them, and the owners of the allocations in them, which evacuating() tells apart,
+move their resources by creating them anew and copying them over. A block is given back to the
+driver as soon as its last allocation has been freed.
+
+Every call takes the allocator's mutex, so resources can be created and destroyed on any thread,
+e.g. by loading jobs. Neither vkCreateBuffer nor vkCreateImage nor binding memory has to be
+synchronized with anything else, so together with the allocator that makes creating a resource
+thread safe; recording its upload isn't, see renderer.
+*/
+class memory_allocator
+{
+public:
+    enum class resource_kind
+    {
+        linear,    // buffers and linear images
+        optimal,   // optimally tiled images
+    };
+
+    // `device_count` is how many GPUs of a device group `device` drives. Memory in their
+    // multi-instance heaps, VRAM, then has an instance on every one of them and can't be mapped, so
+    // host visible memory comes from the other heaps, which every GPU reads alike. A mapping that
+    // only fits VRAM gets a single instance, on the first GPU.
+    void init(vk::PhysicalDevice physical_device, vk::Device device, uint32_t device_count = 1);
+    void destroy();
+
+    uint32_t deviceCount() const { return m_device_count; }
+
+    // The memory has every one of `required` and as many of `preferred` as there is a type for,
+    // see findMemoryType
+    allocation allocate(const vk::MemoryRequirements& requirements,
+                        vk::MemoryPropertyFlags       required,
+                        resource_kind                 kind,
+                        memory_category               category,
+                        vk::MemoryPropertyFlags       preferred = {});
+    void       free(allocation& alloc);
+
+    MemoryTypeIndex findMemoryType(uint32_t                typefilter,
+                                   vk::MemoryPropertyFlags required,
+                                   vk::MemoryPropertyFlags preferred = {}) const;
+    bool            hasMemoryType(uint32_t typefilter, vk::MemoryPropertyFlags properties) const;
+
+    // Marks the blocks of every pool of `kind` that are no more than `max_usage` used, only hold
+    // allocations of `category` and fit into the pool's other blocks as being evacuated, the
+    // sparsest first. Returns how many were marked, and until endDefragmentation() allocations
+    // only come from other blocks, new ones if need be.
+    uint32_t beginDefragmentation(resource_kind kind, memory_category category, float max_usage);
+    void     endDefragmentation();
+    bool     defragmenting() const { return m_evacuating.load() > 0; }
+
+    // Whether the allocation is in a block being evacuated, and is worth moving
+    bool evacuating(const allocation& alloc) const;
+
+    // Whether all of the device's VRAM can be mapped, as with resizable BAR or on integrated GPUs
+    // whose memory is all shared with the host, rather than the 256 MiB window into it there is
+    // without
+    bool resizableBar() const { return m_resizable_bar; }
+
+    // What buffers the host rewrites every frame prefer on top of being host visible and coherent.
+    // With resizable BAR that is VRAM, which the GPU reads them from faster than over the bus. The
+    // small window there is otherwise is left alone, since drivers use it themselves.
+    vk::MemoryPropertyFlags dynamicPreference() const
+    {
+        return m_resizable_bar ? vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eDeviceLocal)
+                               : vk::MemoryPropertyFlags();
+    }
+
+    const vk::PhysicalDeviceMemoryProperties& memoryProperties() const { return m_properties; }
+
+    // With VK_EXT_memory_budget the driver's numbers are used, which include other processes and
+    // the driver's own allocations. Without it the budget is a fixed share of the heaps and the
+    // usage is only what this allocator has allocated.
+    memory_budget deviceLocalBudget() const;
+
+    // Every heap's budget and what is allocated and used in it, by category
+    std::vector<memory_heap_report> report() const;
+
+#if defined(VK_KHR_buffer_device_address) && defined(VK_KHR_device_group)
+    // Only to be called if bufferDeviceAddress was enabled on the device, before anything is
+    // allocated. Every block can then hold buffers whose address is taken, which the usage from
+    // addressUsage() asks for.
+    void enableDeviceAddresses() { m_device_addresses = true; }
+#endif
+
+    // What buffers that descriptors are made from by their address add to their usage, nothing
+    // without device addresses
+    vk::BufferUsageFlags addressUsage() const
+    {
+#if defined(VK_KHR_buffer_device_address) && defined(VK_KHR_device_group)
+        if (m_device_addresses) {
+            return vk::BufferUsageFlagBits::eShaderDeviceAddressKHR;
+        }
+#endif
+        return {};
+    }
+
+#if defined(VK_EXT_memory_budget)
+    // Only to be called if VK_EXT_memory_budget was enabled on the device
+    void enableBudgetQueries(PFN_vkGetPhysicalDeviceMemoryProperties2KHR query)
+    {
+        m_budget_query = query;
+    }
+#endif
+
+private:
+    struct block
+    {
+        vk::DeviceMemory memory;
+        vk::DeviceSize   size   = 0;
+        void*            mapped = nullptr;
+        // offset -> size of every free range, kept coalesced
+        std::map<vk::DeviceSize, vk::DeviceSize> free_ranges;
+
+        vk::DeviceSize                              used       = 0;
+        std::array<uint32_t, memory_category_count> categories = {};  // live allocations of each
+        bool                                        evacuating = false;
+    };
+
+    struct pool
+    {
+        MemoryTypeIndex                     memory_type = 0;
+        resource_kind                       kind        = resource_kind::linear;
+        std::vector<std::unique_ptr<block>> blocks;
+    };
+
+    pool&            getPool(MemoryTypeIndex type, resource_kind kind);
+    vk::DeviceSize   preferredBlockSize(MemoryTypeIndex type) const;
+    block*           createBlock(pool& p, vk::DeviceSize size);
+    vk::DeviceMemory allocateMemory(vk::DeviceSize size, MemoryTypeIndex type) const;
+    void*            mapIfHostVisible(vk::DeviceMemory memory, MemoryTypeIndex type) const;
+    void             track(MemoryTypeIndex type, vk::DeviceSize size, bool allocated);
+    void             account(const allocation& alloc, bool allocated);
+    void             stopEvacuating();
+
+    // Held by every public call that reads or changes the pools or the usage
+    mutable std::mutex m_mutex;
+
+    vk::PhysicalDevice                 m_physical_device;
+    vk::Device                         m_device;
+    vk::PhysicalDeviceMemoryProperties m_properties;
+    std::vector<pool>                  m_pools;
+    std::vector<vk::DeviceSize>        m_heap_usage;  // bytes of vk::DeviceMemory per heap
+    bool                               m_resizable_bar = false;
+    uint32_t                           m_device_count  = 1;
+    std::atomic<uint32_t>              m_evacuating{ 0 };  // blocks marked, freed ones too
+
+    // The host visible types in multi-instance heaps, with a device group
+    uint32_t m_multi_instance_types = 0;
+
+    bool m_device_addresses = false;
+
+    // Bytes and allocations handed out per heap and category
+    std::vector<std::array<vk::DeviceSize, memory_category_count>> m_used;
+    std::vector<std::array<uint32_t, memory_category_count>>       m_allocations;
+
+#if defined(VK_EXT_memory_budget)
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR m_budget_query = nullptr;
+#endif
+};
+
+}  // namespace shiny::graphics
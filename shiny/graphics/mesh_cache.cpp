@@ -0,0 +1,251 @@
+#include "graphics/mesh_cache.h"
+
+#include "core/mapped_file.h"
+#include "core/profiler.h"
+#include "graphics/mesh_codec.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+const uint32_t mesh_cache_magic   = 0x434d4853;  // "SHMC"
+const uint32_t mesh_cache_version = 7;
+
+uint64_t
+fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// A uint32_t length and that many bytes, moving `p` past them unless they go past `end`
+bool
+readString(const char*& p, const char* end, std::string& out)
+{
+    uint32_t length = 0;
+    if ((size_t)(end - p) < sizeof(length)) {
+        return false;
+    }
+    std::memcpy(&length, p, sizeof(length));
+    p += sizeof(length);
+
+    if ((size_t)(end - p) < length) {
+        return false;
+    }
+    out.assign(p, length);
+    p += length;
+    return true;
+}
+
+void
+writeString(std::ofstream& file, const std::string& string)
+{
+    const uint32_t length = (uint32_t)string.size();
+    file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    file.write(string.data(), (std::streamsize)length);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+std::string
+meshCachePath(const std::string& sourcepath)
+{
+    return sourcepath + ".meshcache";
+}
+
+uint64_t
+meshSourceHash(const std::string& sourcepath)
+{
+    std::error_code error;
+
+    uint64_t size  = std::filesystem::file_size(sourcepath, error);
+    int64_t  mtime = std::filesystem::last_write_time(sourcepath, error).time_since_epoch().count();
+
+    if (error) {
+        return 0;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash          = fnv1a(hash, sourcepath.data(), sourcepath.size());
+    hash          = fnv1a(hash, &size, sizeof(size));
+    hash          = fnv1a(hash, &mtime, sizeof(mtime));
+    return hash;
+}
+
+/*
+The cache is mapped instead of read, so the arrays are copied exactly once, from the page cache into
+the mesh, and the vertices and indices are decoded straight into it.
+*/
+bool
+readMeshCache(const std::string& cachepath,
+              uint64_t           sourcehash,
+              Mesh&              mesh,
+              jobs::scheduler*   jobs)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    core::mapped_file file;
+
+    if (!file.open(cachepath) || file.size() < sizeof(mesh_cache_header)) {
+        return false;
+    }
+
+    mesh_cache_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (header.magic != mesh_cache_magic || header.version != mesh_cache_version
+        || header.vertex_size != sizeof(Vertex)
+        || (sourcehash != 0 && header.source_hash != sourcehash)
+        || header.format >= (uint32_t)vertex_format::count) {
+        return false;
+    }
+
+    size_t vertexbytes  = header.vertex_bytes;
+    size_t indexbytes   = header.index_bytes;
+    size_t lodbytes     = (size_t)header.lod_count * sizeof(mesh_lod);
+    size_t meshletbytes = (size_t)header.meshlet_count * sizeof(meshlet);
+    size_t submeshbytes = (size_t)header.submesh_count * sizeof(submesh);
+
+    if (file.size()
+        < sizeof(header) + vertexbytes + indexbytes + lodbytes + meshletbytes + submeshbytes) {
+        return false;
+    }
+
+    const char* vertices  = file.data() + sizeof(header);
+    const char* indices   = vertices + vertexbytes;
+    const char* lods      = indices + indexbytes;
+    const char* meshlets  = lods + lodbytes;
+    const char* submeshes = meshlets + meshletbytes;
+
+    // The materials have strings in them, so the file is only known to be long enough once they
+    // are read
+    std::vector<mesh_material> materials(header.material_count);
+    const char*                p = submeshes + submeshbytes;
+    for (mesh_material& material : materials) {
+        if ((size_t)(file.end() - p) < sizeof(material.diffuse)) {
+            return false;
+        }
+        std::memcpy(&material.diffuse, p, sizeof(material.diffuse));
+        p += sizeof(material.diffuse);
+
+        if (!readString(p, file.end(), material.name)
+            || !readString(p, file.end(), material.diffuse_texture)) {
+            return false;
+        }
+    }
+
+    std::vector<submesh> parts(header.submesh_count);
+    std::memcpy(parts.data(), submeshes, submeshbytes);
+    for (const submesh& part : parts) {
+        if (part.material >= header.material_count || part.first_lod > header.lod_count
+            || part.lod_count > header.lod_count - part.first_lod) {
+            return false;
+        }
+    }
+
+    mesh.vertices.resize(header.vertex_count);
+    mesh.indices.resize(header.index_count);
+    if (!decodeVertices(vertices, vertexbytes, header.vertex_count, sizeof(Vertex),
+                        mesh.vertices.data(), jobs)
+        || !decodeIndices(indices, indexbytes, header.index_count, mesh.indices.data(), jobs)) {
+        mesh.vertices.clear();
+        mesh.indices.clear();
+        return false;
+    }
+
+    mesh.lods.resize(header.lod_count);
+    mesh.meshlets.resize(header.meshlet_count);
+    std::memcpy(mesh.lods.data(), lods, lodbytes);
+    std::memcpy(mesh.meshlets.data(), meshlets, meshletbytes);
+    mesh.submeshes = std::move(parts);
+    mesh.materials = std::move(materials);
+    mesh.format = (vertex_format)header.format;
+
+    return true;
+}
+
+bool
+writeMeshCache(const std::string& cachepath, uint64_t sourcehash, const Mesh& mesh)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    if (sourcehash == 0) {
+        return false;
+    }
+
+    std::ofstream file(cachepath, std::ios::binary | std::ios::trunc);
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::vector<char> vertices;
+    std::vector<char> indices;
+    encodeVertices(mesh.vertices.data(), (uint32_t)mesh.vertices.size(), sizeof(Vertex), vertices);
+    encodeIndices(mesh.indices.data(), (uint32_t)mesh.indices.size(), indices);
+
+    mesh_cache_header header;
+    header.magic          = mesh_cache_magic;
+    header.version        = mesh_cache_version;
+    header.source_hash    = sourcehash;
+    header.vertex_size    = sizeof(Vertex);
+    header.vertex_count   = (uint32_t)mesh.vertices.size();
+    header.index_count    = (uint32_t)mesh.indices.size();
+    header.lod_count      = (uint32_t)mesh.lods.size();
+    header.format         = (uint32_t)mesh.format;
+    header.meshlet_count  = (uint32_t)mesh.meshlets.size();
+    header.submesh_count  = (uint32_t)mesh.submeshes.size();
+    header.material_count = (uint32_t)mesh.materials.size();
+    header.vertex_bytes   = (uint32_t)vertices.size();
+    header.index_bytes    = (uint32_t)indices.size();
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(vertices.data(), (std::streamsize)vertices.size());
+    file.write(indices.data(), (std::streamsize)indices.size());
+    file.write(reinterpret_cast<const char*>(mesh.lods.data()),
+               (std::streamsize)(mesh.lods.size() * sizeof(mesh_lod)));
+    file.write(reinterpret_cast<const char*>(mesh.meshlets.data()),
+               (std::streamsize)(mesh.meshlets.size() * sizeof(meshlet)));
+    file.write(reinterpret_cast<const char*>(mesh.submeshes.data()),
+               (std::streamsize)(mesh.submeshes.size() * sizeof(submesh)));
+    for (const mesh_material& material : mesh.materials) {
+        file.write(reinterpret_cast<const char*>(&material.diffuse), sizeof(material.diffuse));
+        writeString(file, material.name);
+        writeString(file, material.diffuse_texture);
+    }
+
+    return (bool)file;
+}
+
+bool
+restampMeshCache(const std::string& cachepath, uint64_t sourcehash)
+{
+    if (sourcehash == 0) {
+        return false;
+    }
+
+    std::fstream file(cachepath, std::ios::binary | std::ios::in | std::ios::out);
+
+    mesh_cache_header header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || header.magic != mesh_cache_magic || header.version != mesh_cache_version
+        || header.vertex_size != sizeof(Vertex)) {
+        return false;
+    }
+
+    header.source_hash = sourcehash;
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    return (bool)file;
+}
+
+}  // namespace shiny::graphics
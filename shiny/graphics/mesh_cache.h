@@ -0,0 +1,61 @@
+#pragma once
+
+#include "graphics/renderer.h"
+#include "jobs/scheduler.h"
+
+#include <string>
+
+namespace shiny::graphics {
+
+/*
+A compact binary copy of a parsed mesh, so that model files only go through the OBJ importer once.
+The file is a mesh_cache_header followed by `vertex_count` Vertex structs and `index_count`
+uint32_t indices, encoded by mesh_codec into `vertex_bytes` and `index_bytes`, which decode to
+exactly what ends up in the vertex and index buffers, and then
+`lod_count` mesh_lods and `meshlet_count` meshlets, so the simplification and clustering are only
+done once as well, and `submesh_count` submeshes. Last come `material_count` materials, each a
+diffuse color followed by its name and its diffuse texture as a uint32_t length and that many bytes.
+`format` is the vertex_format the mesh is uploaded in, which is chosen at import too, but the cached
+vertices are always full ones.
+
+A cache is only used when its version, vertex layout and source stamp all match; anything else just
+makes the caller parse the source again and overwrite the cache. A model that isn't on disk has no
+stamp to compare against, which is how cooked caches ship in packages, so its cache is used as is.
+*/
+struct mesh_cache_header
+{
+    uint32_t magic          = 0;
+    uint32_t version        = 0;
+    uint64_t source_hash    = 0;
+    uint32_t vertex_size    = 0;
+    uint32_t vertex_count   = 0;
+    uint32_t index_count    = 0;
+    uint32_t lod_count      = 0;
+    uint32_t format         = 0;
+    uint32_t meshlet_count  = 0;
+    uint32_t submesh_count  = 0;
+    uint32_t material_count = 0;
+    uint32_t vertex_bytes   = 0;
+    uint32_t index_bytes    = 0;
+};
+
+// Where the cache for `sourcepath` lives
+std::string meshCachePath(const std::string& sourcepath);
+
+// Hash of the source's path, size and modification time, 0 if it isn't on disk. Hashing the contents
+// would mean reading the whole source file on every start, which is most of what the cache is
+// trying to avoid.
+uint64_t meshSourceHash(const std::string& sourcepath);
+
+// Decodes the vertices and indices on `jobs`, unless it's null
+bool readMeshCache(const std::string& cachepath,
+                   uint64_t           sourcehash,
+                   Mesh&              mesh,
+                   jobs::scheduler*   jobs = nullptr);
+bool writeMeshCache(const std::string& cachepath, uint64_t sourcehash, const Mesh& mesh);
+
+// Points a cache of the current version at a new source stamp, for when the cooker finds a source
+// whose stamp changed but whose contents didn't. Returns false if there is no such cache.
+bool restampMeshCache(const std::string& cachepath, uint64_t sourcehash);
+
+}  // namespace shiny::graphics
@@ -0,0 +1,339 @@
+#include "graphics/mesh_codec.h"
+
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+
+// SSE2 is what every x64 CPU has, and NEON every 64 bit ARM one
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SHINY_SIMD_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SHINY_SIMD_NEON
+#endif
+
+namespace {
+
+// Vertices and indices in a chunk, which is what a worker decodes at a time
+const uint32_t vertex_chunk = 8192;
+const uint32_t index_chunk  = 3 * 16384;
+
+// Bytes of a plane whose differences are packed to the same width
+const uint32_t group_size = 16;
+
+// Of a group, by the 2 bits in its header
+const uint32_t group_bits[4] = { 0, 2, 4, 8 };
+
+uint8_t
+zigzag(uint8_t delta)
+{
+    return (uint8_t)((delta << 1) ^ (uint8_t)((int8_t)delta >> 7));
+}
+
+/*
+Turns a group's 16 zigzagged differences back into the bytes they are of, the one before the first
+being `previous`: each difference is unzigzagged, and then added up with all those before it in 4
+steps, each adding in the sums of twice as many bytes as the step before.
+*/
+void
+undelta(uint8_t* values, uint8_t previous)
+{
+#if defined(SHINY_SIMD_SSE2)
+    const __m128i z    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+    const __m128i half = _mm_and_si128(_mm_srli_epi16(z, 1), _mm_set1_epi8(0x7f));
+    const __m128i sign = _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(z, _mm_set1_epi8(1)));
+
+    __m128i sum = _mm_xor_si128(half, sign);
+    sum         = _mm_add_epi8(sum, _mm_slli_si128(sum, 1));
+    sum         = _mm_add_epi8(sum, _mm_slli_si128(sum, 2));
+    sum         = _mm_add_epi8(sum, _mm_slli_si128(sum, 4));
+    sum         = _mm_add_epi8(sum, _mm_slli_si128(sum, 8));
+    sum         = _mm_add_epi8(sum, _mm_set1_epi8((char)previous));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values), sum);
+#elif defined(SHINY_SIMD_NEON)
+    const uint8x16_t z    = vld1q_u8(values);
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t sign =
+      vreinterpretq_u8_s8(vnegq_s8(vreinterpretq_s8_u8(vandq_u8(z, vdupq_n_u8(1)))));
+
+    // vextq_u8 with zeros in front shifts the sums up by 16 minus its last argument
+    uint8x16_t sum = veorq_u8(vshrq_n_u8(z, 1), sign);
+    sum            = vaddq_u8(sum, vextq_u8(zero, sum, 15));
+    sum            = vaddq_u8(sum, vextq_u8(zero, sum, 14));
+    sum            = vaddq_u8(sum, vextq_u8(zero, sum, 12));
+    sum            = vaddq_u8(sum, vextq_u8(zero, sum, 8));
+    sum            = vaddq_u8(sum, vdupq_n_u8(previous));
+    vst1q_u8(values, sum);
+#else
+    for (uint32_t i = 0; i < group_size; ++i) {
+        const uint8_t z = values[i];
+        previous        = (uint8_t)(previous + ((z >> 1) ^ (uint8_t)(0u - (z & 1))));
+        values[i]       = previous;
+    }
+#endif
+}
+
+/*
+Every byte plane of the chunk in turn: the header bytes with the widths of its groups, 4 to a byte
+from the lowest bits up, each group's differences packed from the lowest bits up after them.
+*/
+void
+encodeVertexChunk(const uint8_t* vertices, uint32_t count, uint32_t stride, std::vector<char>& out)
+{
+    const uint32_t groups = (count + group_size - 1) / group_size;
+
+    for (uint32_t k = 0; k < stride; ++k) {
+        const size_t header = out.size();
+        out.resize(header + (groups + 3) / 4, 0);
+
+        uint8_t previous = 0;
+        for (uint32_t g = 0; g < groups; ++g) {
+            uint8_t values[group_size] = {};
+            uint8_t largest            = 0;
+
+            // The last group is padded with differences of 0, which take no bits
+            for (uint32_t i = 0; i < group_size && g * group_size + i < count; ++i) {
+                const uint8_t byte = vertices[(size_t)(g * group_size + i) * stride + k];
+                values[i]          = zigzag((uint8_t)(byte - previous));
+                largest            = std::max(largest, values[i]);
+                previous           = byte;
+            }
+
+            const uint32_t width = largest == 0 ? 0 : largest < 4 ? 1 : largest < 16 ? 2 : 3;
+            const uint32_t bits  = group_bits[width];
+            out[header + g / 4] |= (char)(width << (g % 4 * 2));
+
+            for (uint32_t byte = 0; byte < group_size * bits / 8; ++byte) {
+                const uint32_t perbyte = 8 / bits;
+
+                uint8_t packed = 0;
+                for (uint32_t j = 0; j < perbyte; ++j) {
+                    packed |= (uint8_t)(values[byte * perbyte + j] << (j * bits));
+                }
+                out.push_back((char)packed);
+            }
+        }
+    }
+}
+
+bool
+decodeVertexChunk(const char* p,
+                  const char* end,
+                  uint32_t    count,
+                  uint32_t    stride,
+                  uint8_t*    vertices)
+{
+    const uint32_t groups      = (count + group_size - 1) / group_size;
+    const size_t   headerbytes = (groups + 3) / 4;
+
+    for (uint32_t k = 0; k < stride; ++k) {
+        if ((size_t)(end - p) < headerbytes) {
+            return false;
+        }
+        const uint8_t* header = reinterpret_cast<const uint8_t*>(p);
+        p += headerbytes;
+
+        uint8_t previous = 0;
+        for (uint32_t g = 0; g < groups; ++g) {
+            const uint32_t bits  = group_bits[(header[g / 4] >> (g % 4 * 2)) & 3];
+            const size_t   bytes = group_size * bits / 8;
+            if ((size_t)(end - p) < bytes) {
+                return false;
+            }
+
+            uint8_t values[group_size];
+            if (bits == 0) {
+                std::memset(values, 0, sizeof(values));
+            } else if (bits == 8) {
+                std::memcpy(values, p, sizeof(values));
+            } else {
+                const uint32_t perbyte = 8 / bits;
+                const uint8_t  mask    = (uint8_t)((1u << bits) - 1);
+                for (uint32_t i = 0; i < group_size; ++i) {
+                    const uint8_t packed = (uint8_t)p[i / perbyte];
+                    values[i]            = (uint8_t)((packed >> (i % perbyte * bits)) & mask);
+                }
+            }
+            p += bytes;
+
+            undelta(values, previous);
+            previous = values[group_size - 1];
+
+            const uint32_t first = g * group_size;
+            const uint32_t n     = std::min(group_size, count - first);
+            for (uint32_t i = 0; i < n; ++i) {
+                vertices[(size_t)(first + i) * stride + k] = values[i];
+            }
+        }
+    }
+
+    return p == end;
+}
+
+void
+encodeIndexChunk(const uint32_t* indices, uint32_t count, std::vector<char>& out)
+{
+    uint32_t previous = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint32_t delta = indices[i] - previous;
+        previous             = indices[i];
+
+        uint32_t z = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+        while (z >= 0x80) {
+            out.push_back((char)(z | 0x80));
+            z >>= 7;
+        }
+        out.push_back((char)z);
+    }
+}
+
+bool
+decodeIndexChunk(const char* p, const char* end, uint32_t count, uint32_t* indices)
+{
+    uint32_t previous = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        // At most 5 bytes of 7 bits for 32 of them
+        uint32_t z = 0;
+        for (uint32_t shift = 0;; shift += 7) {
+            if (p == end || shift > 28) {
+                return false;
+            }
+            const uint8_t byte = (uint8_t)*p++;
+            z |= (uint32_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+
+        previous += (z >> 1) ^ (0u - (z & 1));
+        indices[i] = previous;
+    }
+
+    return p == end;
+}
+
+// The table of where every chunk starts, after it, and then each chunk as `encode` appends it
+template<typename Encode>
+void
+encodeChunks(uint32_t count, uint32_t chunk, std::vector<char>& out, Encode&& encode)
+{
+    const uint32_t chunks = (count + chunk - 1) / chunk;
+    const size_t   table  = out.size();
+    out.resize(table + (size_t)chunks * sizeof(uint32_t));
+
+    const size_t first = out.size();
+    for (uint32_t c = 0; c < chunks; ++c) {
+        const uint32_t offset = (uint32_t)(out.size() - first);
+        std::memcpy(out.data() + table + c * sizeof(uint32_t), &offset, sizeof(offset));
+        encode(c * chunk, std::min(chunk, count - c * chunk));
+    }
+}
+
+// Every chunk has to end where the next one starts, or the chunks decode to the wrong elements
+template<typename Decode>
+bool
+decodeChunks(const char*             data,
+             size_t                  size,
+             uint32_t                count,
+             uint32_t                chunk,
+             shiny::jobs::scheduler* jobs,
+             Decode&&                decode)
+{
+    const uint32_t chunks     = (count + chunk - 1) / chunk;
+    const size_t   tablebytes = (size_t)chunks * sizeof(uint32_t);
+    if (size < tablebytes || size - tablebytes > std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+
+    std::vector<uint32_t> offsets(chunks + 1);
+    std::memcpy(offsets.data(), data, tablebytes);
+    offsets[chunks] = (uint32_t)(size - tablebytes);
+    for (uint32_t c = 0; c < chunks; ++c) {
+        if (offsets[c] > offsets[c + 1]) {
+            return false;
+        }
+    }
+
+    const char*       base = data + tablebytes;
+    std::atomic<bool> ok { true };
+
+    auto range = [&](uint32_t first, uint32_t last) {
+        for (uint32_t c = first; c < last; ++c) {
+            if (!decode(base + offsets[c], base + offsets[c + 1], c * chunk,
+                        std::min(chunk, count - c * chunk))) {
+                ok = false;
+            }
+        }
+    };
+
+    if (jobs && chunks > 1) {
+        jobs->parallelFor(0, chunks, 1, range);
+    } else {
+        range(0, chunks);
+    }
+    return ok && (chunks > 0 || size == 0);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+encodeVertices(const void* vertices, uint32_t count, uint32_t stride, std::vector<char>& out)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(vertices);
+    encodeChunks(count, vertex_chunk, out, [&](uint32_t first, uint32_t n) {
+        encodeVertexChunk(bytes + (size_t)first * stride, n, stride, out);
+    });
+}
+
+bool
+decodeVertices(const char*      data,
+               size_t           size,
+               uint32_t         count,
+               uint32_t         stride,
+               void*            vertices,
+               jobs::scheduler* jobs)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    uint8_t* bytes = static_cast<uint8_t*>(vertices);
+    return decodeChunks(data, size, count, vertex_chunk, jobs,
+                        [&](const char* p, const char* end, uint32_t first, uint32_t n) {
+                            return decodeVertexChunk(p, end, n, stride,
+                                                     bytes + (size_t)first * stride);
+                        });
+}
+
+void
+encodeIndices(const uint32_t* indices, uint32_t count, std::vector<char>& out)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    encodeChunks(count, index_chunk, out, [&](uint32_t first, uint32_t n) {
+        encodeIndexChunk(indices + first, n, out);
+    });
+}
+
+bool
+decodeIndices(const char*      data,
+              size_t           size,
+              uint32_t         count,
+              uint32_t*        indices,
+              jobs::scheduler* jobs)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    return decodeChunks(data, size, count, index_chunk, jobs,
+                        [&](const char* p, const char* end, uint32_t first, uint32_t n) {
+                            return decodeIndexChunk(p, end, n, indices + first);
+                        });
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "jobs/scheduler.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Lossless codecs for the vertex and index arrays of mesh caches, after meshoptimizer's, which get
+them 2 to 4 times smaller and decode much faster than a disk reads them.
+
+Vertices are split into byte planes, byte k of every vertex, and each byte is stored as its
+difference to the same byte of the vertex before. optimizeMesh has put neighbouring vertices next
+to each other, whose colors are mostly the same and whose floats mostly differ in their low bytes,
+so the differences are small. They are zigzagged and go in groups of 16, packed into 0, 2, 4 or 8
+bits each, the fewest that hold all 16, with the widths of 4 groups in a byte in front of them.
+Decoding a group turns its 16 differences back into bytes with a SIMD prefix sum.
+
+Indices are stored as their zigzagged difference to the index before, in as many bytes of 7 bits
+as that takes. Reordered triangles mostly reuse recent vertices, and bring in new ones in order, so
+most indices take a byte.
+
+Both are cut into chunks that are encoded on their own, with a table of where each of them starts
+in front, so the workers decode them in parallel, straight into the mesh's arrays.
+*/
+
+// Appends the encoding of `count` vertices of `stride` bytes each to `out`
+void encodeVertices(const void* vertices, uint32_t count, uint32_t stride, std::vector<char>& out);
+
+// Returns false unless the `size` bytes at `data` decode into exactly `count` vertices, without
+// reading past them, for whatever data it is given. Decodes on `jobs` unless it's null.
+bool decodeVertices(const char*      data,
+                    size_t           size,
+                    uint32_t         count,
+                    uint32_t         stride,
+                    void*            vertices,
+                    jobs::scheduler* jobs);
+
+// The same for indices
+void encodeIndices(const uint32_t* indices, uint32_t count, std::vector<char>& out);
+bool decodeIndices(const char*      data,
+                   size_t           size,
+                   uint32_t         count,
+                   uint32_t*        indices,
+                   jobs::scheduler* jobs);
+
+}  // namespace shiny::graphics
@@ -0,0 +1,430 @@
+#include "graphics/mesh_lod.h"
+
+#include "core/profiler.h"
+#include "graphics/renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+
+// Every level aims for this many of the previous level's triangles
+const float lod_reduction = 0.5f;
+
+// The chain stops at a level that keeps more than this many of the previous level's triangles,
+// there is too little left to collapse
+const float min_lod_reduction = 0.8f;
+
+const uint32_t max_lods          = 5;
+const size_t   min_lod_triangles = 64;
+
+// The sum of squared distances to a set of planes, as a symmetric 4x4 matrix
+struct quadric
+{
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+    void addPlane(const glm::dvec3& normal, double distance)
+    {
+        a2 += normal.x * normal.x;
+        ab += normal.x * normal.y;
+        ac += normal.x * normal.z;
+        ad += normal.x * distance;
+        b2 += normal.y * normal.y;
+        bc += normal.y * normal.z;
+        bd += normal.y * distance;
+        c2 += normal.z * normal.z;
+        cd += normal.z * distance;
+        d2 += distance * distance;
+    }
+
+    void add(const quadric& q)
+    {
+        a2 += q.a2, ab += q.ab, ac += q.ac, ad += q.ad, b2 += q.b2;
+        bc += q.bc, bd += q.bd, c2 += q.c2, cd += q.cd, d2 += q.d2;
+    }
+
+    double evaluate(const glm::dvec3& p) const
+    {
+        return a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x
+               + b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y + c2 * p.z * p.z
+               + 2 * cd * p.z + d2;
+    }
+};
+
+struct collapse
+{
+    double   cost;
+    uint32_t from;
+    uint32_t to;
+};
+
+/*
+Everything is done on positions rather than vertices: vertices with the same position (the
+"wedges" of that position, which differ in their texture coordinates) are one point of the surface.
+A position is named by its first vertex.
+*/
+class simplifier
+{
+public:
+    // The quadrics come from the triangles of `indices`, which are what is simplified after
+    simplifier(const std::vector<shiny::graphics::Vertex>& vertices,
+               const std::vector<uint32_t>&                indices);
+
+    // Collapses edges of `indices` until it has at most `target` indices or nothing more can go,
+    // raising `error` to the largest error of the collapses made
+    void simplify(std::vector<uint32_t>& indices, size_t target, float& error);
+
+private:
+    bool     flips(const std::vector<uint32_t>& indices, uint32_t from, uint32_t to) const;
+    uint32_t closestWedge(uint32_t position, uint32_t vertex) const;
+
+    const std::vector<shiny::graphics::Vertex>& m_vertices;
+
+    std::vector<uint32_t> m_position;       // by vertex
+    std::vector<uint32_t> m_wedge_offsets;  // by position, into m_wedges
+    std::vector<uint32_t> m_wedges;
+    std::vector<quadric>  m_quadrics;  // by position
+
+    // Rebuilt every pass
+    std::vector<uint8_t>  m_border;
+    std::vector<uint8_t>  m_touched;
+    std::vector<uint32_t> m_collapsed;         // by position, where it went
+    std::vector<uint32_t> m_triangle_offsets;  // by position, into m_triangles
+    std::vector<uint32_t> m_triangles;
+};
+
+/*
+The quadrics start out with the planes of the triangles around each position. They are carried
+along from there: a position that is collapsed into another one adds its quadric onto that one's.
+*/
+simplifier::simplifier(const std::vector<shiny::graphics::Vertex>& vertices,
+                       const std::vector<uint32_t>&                indices)
+  : m_vertices(vertices)
+{
+    const uint32_t count = (uint32_t)vertices.size();
+
+    std::unordered_map<glm::vec3, uint32_t> positions;
+    positions.reserve(count);
+
+    m_position.resize(count);
+    m_wedge_offsets.assign(count + 1, 0);
+
+    for (uint32_t v = 0; v < count; ++v) {
+        m_position[v] = positions.try_emplace(vertices[v].pos, v).first->second;
+        ++m_wedge_offsets[m_position[v] + 1];
+    }
+    for (uint32_t p = 0; p < count; ++p) {
+        m_wedge_offsets[p + 1] += m_wedge_offsets[p];
+    }
+
+    std::vector<uint32_t> next(m_wedge_offsets.begin(), m_wedge_offsets.end() - 1);
+    m_wedges.resize(count);
+    for (uint32_t v = 0; v < count; ++v) {
+        m_wedges[next[m_position[v]]++] = v;
+    }
+
+    m_quadrics.resize(count);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const uint32_t   p0 = m_position[indices[i]];
+        const uint32_t   p1 = m_position[indices[i + 1]];
+        const uint32_t   p2 = m_position[indices[i + 2]];
+        const glm::dvec3 a(vertices[p0].pos), b(vertices[p1].pos), c(vertices[p2].pos);
+
+        const glm::dvec3 normal = glm::cross(b - a, c - a);
+        const double     length = glm::length(normal);
+        if (length == 0) {
+            continue;
+        }
+
+        quadric q;
+        q.addPlane(normal / length, -glm::dot(normal / length, a));
+        m_quadrics[p0].add(q);
+        m_quadrics[p1].add(q);
+        m_quadrics[p2].add(q);
+    }
+
+    m_border.resize(count);
+    m_touched.resize(count);
+    m_collapsed.resize(count);
+    for (uint32_t p = 0; p < count; ++p) {
+        m_collapsed[p] = p;
+    }
+}
+
+/*
+Every pass considers each edge once, in the direction that costs less, and makes the cheapest
+collapses first. A collapse changes the triangles around the vertex that goes away, so no other
+collapse in the same pass may touch any of their vertices; the next pass picks up from there.
+*/
+void
+simplifier::simplify(std::vector<uint32_t>& indices, size_t target, float& error)
+{
+    const uint32_t count = (uint32_t)m_vertices.size();
+
+    std::vector<uint64_t> edges;
+    std::vector<collapse> candidates;
+    std::vector<uint32_t> simplified;
+
+    while (indices.size() > target) {
+        // Edges as (smaller, larger) position pairs. An edge only one triangle has is on a border.
+        edges.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (size_t k = 0; k < 3; ++k) {
+                const uint32_t a = m_position[indices[i + k]];
+                const uint32_t b = m_position[indices[i + (k + 1) % 3]];
+                edges.push_back((uint64_t)std::min(a, b) << 32 | std::max(a, b));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        std::fill(m_border.begin(), m_border.end(), 0);
+        std::fill(m_touched.begin(), m_touched.end(), 0);
+
+        candidates.clear();
+        for (size_t i = 0; i < edges.size();) {
+            size_t run = 1;
+            while (i + run < edges.size() && edges[i + run] == edges[i]) {
+                ++run;
+            }
+
+            if (run == 1) {
+                m_border[edges[i] >> 32]        = 1;
+                m_border[edges[i] & 0xffffffff] = 1;
+            }
+            i += run;
+        }
+
+        auto removable = [&](uint32_t p) {
+            return !m_border[p] && m_wedge_offsets[p + 1] - m_wedge_offsets[p] == 1;
+        };
+
+        for (size_t i = 0; i < edges.size(); ++i) {
+            if (i > 0 && edges[i] == edges[i - 1]) {
+                continue;
+            }
+
+            const uint32_t a = (uint32_t)(edges[i] >> 32);
+            const uint32_t b = (uint32_t)(edges[i] & 0xffffffff);
+
+            quadric q = m_quadrics[a];
+            q.add(m_quadrics[b]);
+
+            // Rounding can take the costs a little below 0, where -1 means it can't be collapsed
+            const double tob =
+              removable(a) ? std::max(q.evaluate(m_vertices[b].pos), 0.0) : -1.0;
+            const double toa =
+              removable(b) ? std::max(q.evaluate(m_vertices[a].pos), 0.0) : -1.0;
+
+            if (tob >= 0 && (toa < 0 || tob <= toa)) {
+                candidates.push_back({ tob, a, b });
+            } else if (toa >= 0) {
+                candidates.push_back({ toa, b, a });
+            }
+        }
+
+        if (candidates.empty()) {
+            break;
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const collapse& x, const collapse& y) { return x.cost < y.cost; });
+
+        // Which triangles every position is in
+        m_triangle_offsets.assign(count + 1, 0);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            ++m_triangle_offsets[m_position[indices[i]] + 1];
+        }
+        for (uint32_t p = 0; p < count; ++p) {
+            m_triangle_offsets[p + 1] += m_triangle_offsets[p];
+        }
+        std::vector<uint32_t> next(m_triangle_offsets.begin(), m_triangle_offsets.end() - 1);
+        m_triangles.resize(indices.size());
+        for (size_t i = 0; i < indices.size(); ++i) {
+            m_triangles[next[m_position[indices[i]]]++] = (uint32_t)(i / 3);
+        }
+
+        // An interior collapse takes two triangles with it
+        const size_t needed   = (indices.size() - target) / 3;
+        size_t       removed  = 0;
+        uint32_t     accepted = 0;
+
+        for (const collapse& c : candidates) {
+            if (removed >= needed) {
+                break;
+            }
+            if (m_touched[c.from] || m_touched[c.to] || flips(indices, c.from, c.to)) {
+                continue;
+            }
+
+            m_collapsed[c.from] = c.to;
+            m_quadrics[c.to].add(m_quadrics[c.from]);
+            error = std::max(error, (float)std::sqrt(c.cost));
+
+            for (uint32_t t = m_triangle_offsets[c.from]; t < m_triangle_offsets[c.from + 1]; ++t) {
+                const uint32_t triangle = m_triangles[t];
+                for (uint32_t k = 0; k < 3; ++k) {
+                    m_touched[m_position[indices[triangle * 3 + k]]] = 1;
+                }
+            }
+
+            removed += 2;
+            ++accepted;
+        }
+
+        if (accepted == 0) {
+            break;
+        }
+
+        simplified.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            uint32_t corners[3];
+            uint32_t positions[3];
+
+            for (size_t k = 0; k < 3; ++k) {
+                const uint32_t v = indices[i + k];
+                const uint32_t p = m_collapsed[m_position[v]];
+
+                corners[k]   = p == m_position[v] ? v : closestWedge(p, v);
+                positions[k] = p;
+            }
+
+            // The triangles along the collapsed edge
+            if (positions[0] == positions[1] || positions[1] == positions[2]
+                || positions[2] == positions[0]) {
+                continue;
+            }
+            simplified.insert(simplified.end(), corners, corners + 3);
+        }
+        indices.swap(simplified);
+
+        for (const collapse& c : candidates) {
+            m_collapsed[c.from] = c.from;
+        }
+    }
+}
+
+// Whether moving `from` onto `to` turns any of the triangles around `from` over
+bool
+simplifier::flips(const std::vector<uint32_t>& indices, uint32_t from, uint32_t to) const
+{
+    for (uint32_t t = m_triangle_offsets[from]; t < m_triangle_offsets[from + 1]; ++t) {
+        const uint32_t triangle = m_triangles[t];
+
+        glm::vec3 corners[3];
+        glm::vec3 moved[3];
+        bool      shared = false;
+
+        for (uint32_t k = 0; k < 3; ++k) {
+            const uint32_t p = m_position[indices[triangle * 3 + k]];
+
+            shared     = shared || p == to;
+            corners[k] = m_vertices[p].pos;
+            moved[k]   = p == from ? m_vertices[to].pos : corners[k];
+        }
+
+        // Those go away
+        if (shared) {
+            continue;
+        }
+
+        const glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+        const glm::vec3 after  = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+        if (glm::dot(before, after) <= 0.f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The wedge of `position` whose texture coordinates are nearest to those of `vertex`
+uint32_t
+simplifier::closestWedge(uint32_t position, uint32_t vertex) const
+{
+    const glm::vec2 texcoord = m_vertices[vertex].texcoord;
+
+    uint32_t closest  = m_wedges[m_wedge_offsets[position]];
+    float    distance = std::numeric_limits<float>::max();
+
+    for (uint32_t w = m_wedge_offsets[position]; w < m_wedge_offsets[position + 1]; ++w) {
+        const glm::vec2 delta = m_vertices[m_wedges[w]].texcoord - texcoord;
+        const float     d     = glm::dot(delta, delta);
+        if (d < distance) {
+            closest  = m_wedges[w];
+            distance = d;
+        }
+    }
+    return closest;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+/*
+Every level is simplified from the one before, carrying the accumulated quadrics along, so the
+errors only ever grow down the chain. The submeshes share one simplifier: the positions they have in
+common are on the borders of each of them, which are never collapsed away.
+*/
+void
+buildMeshLods(Mesh& mesh)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    // Level 0 of every submesh, or of the mesh as one
+    std::vector<mesh_lod> firsts;
+    if (mesh.submeshes.empty()) {
+        mesh_lod full;
+        full.index_count = (uint32_t)mesh.indices.size();
+        firsts.push_back(full);
+    } else {
+        for (const submesh& part : mesh.submeshes) {
+            mesh_lod first;
+            first.first_index = mesh.lods[part.first_lod].first_index;
+            first.index_count = mesh.lods[part.first_lod].index_count;
+            firsts.push_back(first);
+        }
+    }
+
+    std::vector<uint32_t> all;
+    for (const mesh_lod& first : firsts) {
+        const auto begin = mesh.indices.begin() + first.first_index;
+        all.insert(all.end(), begin, begin + first.index_count);
+    }
+    simplifier simplifier(mesh.vertices, all);
+
+    mesh.lods.clear();
+    for (size_t s = 0; s < firsts.size(); ++s) {
+        const uint32_t firstlod = (uint32_t)mesh.lods.size();
+        mesh.lods.push_back(firsts[s]);
+
+        const auto            begin = mesh.indices.begin() + firsts[s].first_index;
+        std::vector<uint32_t> indices(begin, begin + firsts[s].index_count);
+        float                 error = 0.f;
+
+        while (mesh.lods.size() - firstlod < max_lods
+               && indices.size() / 3 >= min_lod_triangles) {
+            const size_t previous = indices.size();
+            simplifier.simplify(indices, (size_t)(previous / 3 * lod_reduction) * 3, error);
+
+            if (indices.size() > previous * min_lod_reduction) {
+                break;
+            }
+
+            mesh_lod lod;
+            lod.first_index = (uint32_t)mesh.indices.size();
+            lod.index_count = (uint32_t)indices.size();
+            lod.error       = error;
+            mesh.lods.push_back(lod);
+
+            mesh.indices.insert(mesh.indices.end(), indices.begin(), indices.end());
+        }
+
+        if (!mesh.submeshes.empty()) {
+            mesh.submeshes[s].first_lod = firstlod;
+            mesh.submeshes[s].lod_count = (uint32_t)mesh.lods.size() - firstlod;
+        }
+    }
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+namespace shiny::graphics {
+
+struct Mesh;
+
+/*
+One level of detail of a mesh: a range of the mesh's indices, drawn with the same vertices as every
+other level. `error` is how far, in model space, its surface may be from the full mesh's. Dense
+levels are split into meshlets as well, which cover the level's indices in order, see meshlet.h.
+*/
+struct mesh_lod
+{
+    uint32_t first_index   = 0;
+    uint32_t index_count   = 0;
+    float    error         = 0.f;
+    uint32_t first_meshlet = 0;  // in the mesh's meshlets
+    uint32_t meshlet_count = 0;
+};
+
+/*
+Replaces the mesh's levels with a chain built by edge collapse simplification, each level with
+about half the triangles of the one before, appending their indices to the mesh's. Level 0 is the
+mesh as it is. A mesh with submeshes gets a chain for each of them, from their level 0, one after
+the other in the order of the submeshes.
+
+Collapses move a vertex onto a neighbour, so no vertices are added or moved and every level can use
+the one vertex buffer. Which collapse goes next is decided by quadric error metrics. Vertices on
+open borders, or where the texture coordinates are split, aren't collapsed away, so the outline and
+texture seams stay where they are.
+*/
+void buildMeshLods(Mesh& mesh);
+
+}  // namespace shiny::graphics
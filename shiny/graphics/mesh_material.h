@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace shiny::graphics {
+
+/*
+What a model's material library says about one of its surfaces. The diffuse color goes into the
+colors of the vertices using it, and the diffuse texture is what those triangles are drawn with
+instead of whatever texture the mesh is drawn with.
+*/
+struct mesh_material
+{
+    std::string name;
+    glm::vec3   diffuse = glm::vec3(1.f);
+    std::string diffuse_texture;  // none if empty, otherwise relative to the working directory
+};
+
+/*
+The triangles of a mesh that use one material, which are drawn with a single draw per level. Each
+submesh has its own chain of `lod_count` of the mesh's levels starting at `first_lod`, since
+simplifying across the seams between materials would move them.
+*/
+struct submesh
+{
+    uint32_t material  = 0;  // in the mesh's materials
+    uint32_t first_lod = 0;
+    uint32_t lod_count = 0;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,339 @@
+#include "graphics/mesh_optimize.h"
+
+#include "core/profiler.h"
+#include "graphics/renderer.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+// Entries of the post-transform cache we optimize for. Hardware doesn't quite have a FIFO cache of
+// a fixed size any more, but orders that are good for one are good for what it has instead.
+const uint32_t vertex_cache_size = 16;
+
+const uint32_t no_vertex = std::numeric_limits<uint32_t>::max();
+
+// Cache misses of indices[first, first + count) with a cache that starts out empty, per triangle
+std::vector<uint32_t>
+simulateVertexCache(const std::vector<uint32_t>& indices,
+                    uint32_t                     first,
+                    uint32_t                     count,
+                    uint32_t                     vertexcount)
+{
+    // A vertex is in the cache if fewer than its size misses happened since it was last missed
+    std::vector<uint32_t> timestamps(vertexcount, 0);
+    std::vector<uint32_t> misses(count / 3, 0);
+    uint32_t              time = vertex_cache_size + 1;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint32_t v = indices[first + i];
+        if (time - timestamps[v] > vertex_cache_size) {
+            timestamps[v] = time++;
+            ++misses[i / 3];
+        }
+    }
+    return misses;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+/*
+Every step fans out around the current vertex, emitting all of its triangles that are left, and
+then moves on to whichever of the vertices it just touched is still going to be in the cache after
+emitting all of *its* triangles, preferring the oldest such one since it's the first to go. When
+none are, it backtracks through the recently touched vertices that still have triangles, and only
+if all of those are done does it jump to the next vertex by index.
+*/
+void
+optimizeVertexCache(std::vector<uint32_t>& indices,
+                    uint32_t               first,
+                    uint32_t               count,
+                    uint32_t               vertexcount,
+                    std::vector<uint32_t>& boundaries)
+{
+    const uint32_t trianglecount = count / 3;
+    if (trianglecount == 0) {
+        return;
+    }
+
+    // Triangles around every vertex, as offsets into one array
+    std::vector<uint32_t> live(vertexcount, 0);
+    for (uint32_t i = 0; i < count; ++i) {
+        ++live[indices[first + i]];
+    }
+
+    std::vector<uint32_t> offsets(vertexcount + 1, 0);
+    for (uint32_t v = 0; v < vertexcount; ++v) {
+        offsets[v + 1] = offsets[v] + live[v];
+    }
+
+    std::vector<uint32_t> adjacency(count);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (uint32_t i = 0; i < count; ++i) {
+        adjacency[fill[indices[first + i]]++] = i / 3;
+    }
+
+    std::vector<uint32_t> timestamps(vertexcount, 0);
+    std::vector<uint8_t>  emitted(trianglecount, 0);
+    std::vector<uint32_t> deadends;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    output.reserve(count);
+
+    uint32_t time   = vertex_cache_size + 1;
+    uint32_t cursor = 0;
+    uint32_t fan    = indices[first];
+
+    while (fan != no_vertex) {
+        candidates.clear();
+
+        for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; ++a) {
+            const uint32_t t = adjacency[a];
+            if (emitted[t]) {
+                continue;
+            }
+            emitted[t] = 1;
+
+            for (uint32_t j = 0; j < 3; ++j) {
+                const uint32_t v = indices[first + t * 3 + j];
+                output.push_back(v);
+                deadends.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - timestamps[v] > vertex_cache_size) {
+                    timestamps[v] = time++;
+                }
+            }
+        }
+
+        fan = no_vertex;
+
+        uint32_t best = 0;
+        for (uint32_t v : candidates) {
+            if (live[v] == 0) {
+                continue;
+            }
+
+            // Emitting the rest of its triangles misses at most two vertices for each
+            uint32_t priority = 0;
+            if (time - timestamps[v] + 2 * live[v] <= vertex_cache_size) {
+                priority = time - timestamps[v];
+            }
+            if (priority > best || fan == no_vertex) {
+                best = priority;
+                fan  = v;
+            }
+        }
+
+        if (fan != no_vertex) {
+            continue;
+        }
+
+        while (!deadends.empty() && fan == no_vertex) {
+            const uint32_t v = deadends.back();
+            deadends.pop_back();
+            if (live[v] > 0) {
+                fan = v;
+            }
+        }
+
+        while (cursor < vertexcount && fan == no_vertex) {
+            if (live[cursor] > 0) {
+                fan = cursor;
+            }
+            ++cursor;
+        }
+
+        if (fan != no_vertex) {
+            boundaries.push_back((uint32_t)output.size() / 3);
+        }
+    }
+
+    std::copy(output.begin(), output.end(), indices.begin() + first);
+}
+
+/*
+Most of a mesh's overdraw is between its own sides, and drawing the outermost, outward facing
+clusters first puts them in the depth buffer before whatever they cover. How far out a cluster
+faces is the distance of its centroid from the mesh's centroid along its average normal.
+
+The clusters have to be big enough that sorting them doesn't lose what the vertex cache
+optimization gained, since every one starts out with a cold cache: a cluster is only split off
+once its own miss rate, that cold start included, is within `threshold` of the whole range's.
+*/
+void
+optimizeOverdraw(std::vector<uint32_t>&        indices,
+                 uint32_t                      first,
+                 uint32_t                      count,
+                 const std::vector<glm::vec3>& positions,
+                 const std::vector<uint32_t>&  boundaries,
+                 float                         threshold)
+{
+    const uint32_t trianglecount = count / 3;
+    if (trianglecount == 0) {
+        return;
+    }
+
+    const std::vector<uint32_t> misses =
+      simulateVertexCache(indices, first, count, (uint32_t)positions.size());
+
+    uint32_t totalmisses = 0;
+    for (uint32_t m : misses) {
+        totalmisses += m;
+    }
+    const float acmr = (float)totalmisses / (float)trianglecount;
+
+    // Where every cluster starts, and where the last one ends
+    std::vector<uint32_t> clusters;
+    {
+        std::vector<uint8_t> hard(trianglecount + 1, 0);
+        for (uint32_t b : boundaries) {
+            if (b <= trianglecount) {
+                hard[b] = 1;
+            }
+        }
+
+        std::vector<uint32_t> timestamps(positions.size(), 0);
+        uint32_t              time          = vertex_cache_size + 1;
+        uint32_t              clustermisses = 0;
+
+        clusters.push_back(0);
+        for (uint32_t t = 0; t < trianglecount; ++t) {
+            if (t > clusters.back() && hard[t]) {
+                clusters.push_back(t);
+            }
+            if (t == clusters.back()) {
+                // Starting over with a cold cache
+                time += vertex_cache_size + 1;
+                clustermisses = 0;
+            }
+
+            for (uint32_t j = 0; j < 3; ++j) {
+                const uint32_t v = indices[first + t * 3 + j];
+                if (time - timestamps[v] > vertex_cache_size) {
+                    timestamps[v] = time++;
+                    ++clustermisses;
+                }
+            }
+
+            const uint32_t clustertriangles = t + 1 - clusters.back();
+            if (t + 1 < trianglecount
+                && (float)clustermisses <= threshold * acmr * (float)clustertriangles) {
+                clusters.push_back(t + 1);
+            }
+        }
+        clusters.push_back(trianglecount);
+    }
+
+    const uint32_t clustercount = (uint32_t)clusters.size() - 1;
+    if (clustercount < 2) {
+        return;
+    }
+
+    std::vector<glm::vec3> centroids(clustercount, glm::vec3(0.f));
+    std::vector<glm::vec3> normals(clustercount, glm::vec3(0.f));
+    std::vector<float>     areas(clustercount, 0.f);
+    glm::vec3              meshcentroid(0.f);
+    float                  mesharea = 0.f;
+
+    for (uint32_t c = 0; c < clustercount; ++c) {
+        for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+            const glm::vec3& p0 = positions[indices[first + t * 3 + 0]];
+            const glm::vec3& p1 = positions[indices[first + t * 3 + 1]];
+            const glm::vec3& p2 = positions[indices[first + t * 3 + 2]];
+
+            // Twice the area, as long as the normal; the factor cancels out
+            const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const float     area   = glm::length(normal);
+
+            centroids[c] += (p0 + p1 + p2) * (area / 3.f);
+            normals[c] += normal;
+            areas[c] += area;
+        }
+
+        meshcentroid += centroids[c];
+        mesharea += areas[c];
+        if (areas[c] > 0.f) {
+            centroids[c] /= areas[c];
+        }
+    }
+
+    if (mesharea > 0.f) {
+        meshcentroid /= mesharea;
+    }
+
+    std::vector<float> facing(clustercount, 0.f);
+    for (uint32_t c = 0; c < clustercount; ++c) {
+        const float length = glm::length(normals[c]);
+        if (length > 0.f) {
+            facing[c] = glm::dot(centroids[c] - meshcentroid, normals[c] / length);
+        }
+    }
+
+    std::vector<uint32_t> order(clustercount);
+    for (uint32_t c = 0; c < clustercount; ++c) {
+        order[c] = c;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint32_t a, uint32_t b) { return facing[a] > facing[b]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(count);
+    for (uint32_t c : order) {
+        output.insert(output.end(), indices.begin() + first + clusters[c] * 3,
+                      indices.begin() + first + clusters[c + 1] * 3);
+    }
+
+    std::copy(output.begin(), output.end(), indices.begin() + first);
+}
+
+/*
+Every level is optimized on its own, since they are drawn on their own, but they share the vertex
+buffer, so the vertices are ordered by the finest level first and then whatever the coarser ones
+use that it didn't, which is nothing since collapses don't add vertices. Vertices none of them use
+are dropped.
+*/
+void
+optimizeMesh(Mesh& mesh)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const uint32_t vertexcount = (uint32_t)mesh.vertices.size();
+
+    std::vector<glm::vec3> positions(vertexcount);
+    for (uint32_t v = 0; v < vertexcount; ++v) {
+        positions[v] = mesh.vertices[v].pos;
+    }
+
+    std::vector<mesh_lod> levels = mesh.lods;
+    if (levels.empty()) {
+        levels.push_back({ 0, (uint32_t)mesh.indices.size(), 0.f });
+    }
+
+    std::vector<uint32_t> boundaries;
+    for (const mesh_lod& lod : levels) {
+        boundaries.clear();
+        optimizeVertexCache(mesh.indices, lod.first_index, lod.index_count, vertexcount,
+                            boundaries);
+        optimizeOverdraw(mesh.indices, lod.first_index, lod.index_count, positions, boundaries);
+    }
+
+    std::vector<uint32_t> remap(vertexcount, no_vertex);
+    std::vector<Vertex>   vertices;
+    vertices.reserve(vertexcount);
+
+    for (uint32_t& index : mesh.indices) {
+        if (remap[index] == no_vertex) {
+            remap[index] = (uint32_t)vertices.size();
+            vertices.push_back(mesh.vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    mesh.vertices = std::move(vertices);
+}
+
+}  // namespace shiny::graphics
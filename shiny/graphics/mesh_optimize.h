@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace shiny::graphics {
+
+struct Mesh;
+
+/*
+Reorders indices[first, first + count) for the post-transform vertex cache with Tipsify (Sander,
+Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"): triangles
+are emitted in fans around vertices that were used recently, so their other vertices are likely to
+still be cached. The points where it had to jump somewhere else are added to `boundaries`, as
+offsets in triangles from `first`.
+*/
+void optimizeVertexCache(std::vector<uint32_t>& indices,
+                         uint32_t               first,
+                         uint32_t               count,
+                         uint32_t               vertexcount,
+                         std::vector<uint32_t>& boundaries);
+
+/*
+Reorders clusters of a vertex cache optimized range so that the ones facing outwards come first,
+which is where they are likely to hide the rest of the mesh and save its fragments from being
+shaded, whichever side the mesh is seen from. Clusters are split at `boundaries` and wherever else
+the range's cache efficiency doesn't drop by more than `threshold` for it.
+*/
+void optimizeOverdraw(std::vector<uint32_t>&        indices,
+                      uint32_t                      first,
+                      uint32_t                      count,
+                      const std::vector<glm::vec3>& positions,
+                      const std::vector<uint32_t>&  boundaries,
+                      float                         threshold = 1.05f);
+
+/*
+All of the above for every level of the mesh, then the vertices go in the order they are first
+used, so that the vertex fetches mostly move forwards through the vertex buffer.
+*/
+void optimizeMesh(Mesh& mesh);
+
+}  // namespace shiny::graphics
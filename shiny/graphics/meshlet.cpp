@@ -0,0 +1,160 @@
+#include "graphics/meshlet.h"
+
+#include "core/profiler.h"
+#include "graphics/renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Levels with fewer triangles are drawn and culled as a whole
+const uint32_t min_meshlet_lod_triangles = 2048;
+
+// A cone whose normals spread further than this from its axis is never going to be culled
+const float min_cone_spread = 0.1f;
+
+void
+computeBounds(const shiny::graphics::Mesh& mesh, shiny::graphics::meshlet& cluster)
+{
+    using namespace shiny::graphics;
+
+    glm::vec3 boundsmin(std::numeric_limits<float>::max());
+    glm::vec3 boundsmax(-std::numeric_limits<float>::max());
+    glm::vec3 normals(0.f);
+
+    const uint32_t end = cluster.first_index + cluster.index_count;
+
+    for (uint32_t i = cluster.first_index; i < end; i += 3) {
+        const glm::vec3& p0 = mesh.vertices[mesh.indices[i + 0]].pos;
+        const glm::vec3& p1 = mesh.vertices[mesh.indices[i + 1]].pos;
+        const glm::vec3& p2 = mesh.vertices[mesh.indices[i + 2]].pos;
+
+        boundsmin = glm::min(boundsmin, glm::min(p0, glm::min(p1, p2)));
+        boundsmax = glm::max(boundsmax, glm::max(p0, glm::max(p1, p2)));
+
+        // Every triangle counts the same, however large, since the cone has to contain them all
+        const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        const float     length = glm::length(normal);
+        if (length > 0.f) {
+            normals += normal / length;
+        }
+    }
+
+    cluster.center = (boundsmin + boundsmax) * 0.5f;
+    cluster.radius = 0.f;
+    for (uint32_t i = cluster.first_index; i < end; ++i) {
+        const glm::vec3& p = mesh.vertices[mesh.indices[i]].pos;
+        cluster.radius     = std::max(cluster.radius, glm::distance(cluster.center, p));
+    }
+
+    cluster.cone_axis   = glm::vec3(0.f, 0.f, 1.f);
+    cluster.cone_cutoff = 1.f;
+
+    const float normalslength = glm::length(normals);
+    if (normalslength <= 0.f) {
+        return;
+    }
+    cluster.cone_axis = normals / normalslength;
+
+    float mindot = 1.f;
+    for (uint32_t i = cluster.first_index; i < end; i += 3) {
+        const glm::vec3& p0 = mesh.vertices[mesh.indices[i + 0]].pos;
+        const glm::vec3& p1 = mesh.vertices[mesh.indices[i + 1]].pos;
+        const glm::vec3& p2 = mesh.vertices[mesh.indices[i + 2]].pos;
+
+        const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        const float     length = glm::length(normal);
+        if (length > 0.f) {
+            mindot = std::min(mindot, glm::dot(normal / length, cluster.cone_axis));
+        }
+    }
+
+    // The view direction has to be within 90 degrees minus the spread of the axis for every
+    // triangle to face away, and cos(90 - spread) = sin(spread)
+    if (mindot >= min_cone_spread) {
+        cluster.cone_cutoff = std::sqrt(1.f - mindot * mindot);
+    }
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+/*
+Triangles are taken in index order, and a meshlet is closed as soon as the next triangle would
+take it over either limit, so the only vertices one meshlet shares with the next are the ones the
+run crosses over on.
+*/
+void
+buildMeshlets(Mesh& mesh)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    mesh.meshlets.clear();
+
+    // The level's meshlet range has to be kept somewhere
+    if (mesh.lods.empty()) {
+        mesh_lod whole;
+        whole.index_count = (uint32_t)mesh.indices.size();
+        mesh.lods.push_back(whole);
+    }
+
+    // Which meshlet last used every vertex, so counting a meshlet's vertices needs no clearing
+    std::vector<uint32_t> used(mesh.vertices.size(), std::numeric_limits<uint32_t>::max());
+
+    for (mesh_lod& lod : mesh.lods) {
+        lod.first_meshlet = (uint32_t)mesh.meshlets.size();
+        lod.meshlet_count = 0;
+
+        if (lod.index_count / 3 < min_meshlet_lod_triangles) {
+            continue;
+        }
+
+        meshlet  current;
+        uint32_t vertices = 0;
+
+        current.first_index = lod.first_index;
+
+        const uint32_t end = lod.first_index + lod.index_count;
+        for (uint32_t i = lod.first_index; i < end; i += 3) {
+            const uint32_t id = (uint32_t)mesh.meshlets.size();
+
+            uint32_t fresh = 0;
+            for (uint32_t j = 0; j < 3; ++j) {
+                fresh += used[mesh.indices[i + j]] != id ? 1 : 0;
+            }
+
+            // A triangle repeating a vertex counts it twice here, which only closes it early
+            if (vertices + fresh > max_meshlet_vertices
+                || current.index_count / 3 == max_meshlet_triangles) {
+                computeBounds(mesh, current);
+                mesh.meshlets.push_back(current);
+
+                current             = meshlet();
+                current.first_index = i;
+                vertices            = 0;
+            }
+
+            const uint32_t owner = (uint32_t)mesh.meshlets.size();
+            for (uint32_t j = 0; j < 3; ++j) {
+                uint32_t& last = used[mesh.indices[i + j]];
+                if (last != owner) {
+                    last = owner;
+                    ++vertices;
+                }
+            }
+            current.index_count += 3;
+        }
+
+        if (current.index_count > 0) {
+            computeBounds(mesh, current);
+            mesh.meshlets.push_back(current);
+        }
+
+        lod.meshlet_count = (uint32_t)mesh.meshlets.size() - lod.first_meshlet;
+    }
+}
+
+}  // namespace shiny::graphics
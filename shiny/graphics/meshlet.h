@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace shiny::graphics {
+
+struct Mesh;
+
+/*
+A small cluster of a mesh's triangles: a range of its indices, with bounds to cull it by on its
+own. Its triangles all face roughly along `cone_axis`, so once the camera is far enough behind
+them, every one of them is a back face:
+
+    dot(center - camera, cone_axis) >= cone_cutoff * length(center - camera) + radius
+
+`cone_cutoff` is the sine of how far the triangles' normals spread from the axis, and 1 when they
+spread too far for the test to ever pass.
+*/
+struct meshlet
+{
+    glm::vec3 center;  // of a bounding sphere, in model space
+    float     radius      = 0.f;
+    glm::vec3 cone_axis;
+    float     cone_cutoff = 1.f;
+    uint32_t  first_index = 0;  // in the mesh's indices
+    uint32_t  index_count = 0;
+};
+
+// The most vertices and triangles any meshlet has, which is what mesh shaders are usually given
+const uint32_t max_meshlet_vertices  = 64;
+const uint32_t max_meshlet_triangles = 124;
+
+/*
+Splits every level of the mesh that is dense enough to be worth culling in pieces into meshlets,
+replacing the mesh's meshlets. A meshlet is a run of consecutive triangles, so none of the indices
+move, and with cache optimized indices the runs are compact enough to have tight bounds. A mesh
+without levels gets one for all of its indices.
+*/
+void buildMeshlets(Mesh& mesh);
+
+}  // namespace shiny::graphics
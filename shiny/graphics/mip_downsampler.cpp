@@ -0,0 +1,355 @@
+#include "graphics/mip_downsampler.h"
+
+#include "core/mapped_file.h"
+#include "graphics/barrier_batch.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Has to match the tile every group of downsample.comp reduces
+const uint32_t downsample_tile = 64;
+
+// The shader's push constants
+struct downsample_constants
+{
+    int32_t  width  = 0;
+    int32_t  height = 0;
+    int32_t  levels = 0;
+    uint32_t groups = 0;
+};
+
+vk::ImageSubresourceRange
+levelRange(uint32_t level, uint32_t count = 1)
+{
+    return vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, count, 0, 1);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+mip_downsampler::init(vk::Device        device,
+                      memory_allocator& allocator,
+                      layout_cache&     layouts,
+                      view_cache&       views,
+                      pipeline_cache&   pipelines)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+
+    // 0: level 0, 1: the levels below it, 2: the counter
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings = {
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(0)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(1)
+          .setDescriptorCount(max_downsample_levels)
+          .setDescriptorType(vk::DescriptorType::eStorageImage)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(2)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+    };
+
+    auto setlayoutinfo = vk::DescriptorSetLayoutCreateInfo()
+                           .setBindingCount((uint32_t)bindings.size())
+                           .setPBindings(bindings.data());
+
+    m_set_layout = layouts.descriptorSetLayout(setlayoutinfo);
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                       .setOffset(0)
+                       .setSize(sizeof(downsample_constants));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setSetLayoutCount(1)
+                        .setPSetLayouts(&m_set_layout)
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    auto createPipeline = [&](const char* path, vk::ShaderModule& shader) {
+        core::mapped_file code(path);
+
+        auto shaderinfo = vk::ShaderModuleCreateInfo()
+                            .setCodeSize(code.size())
+                            .setPCode((const uint32_t*)code.data());
+
+        shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+        auto pipelineinfo =
+          vk::ComputePipelineCreateInfo()
+            .setStage(vk::PipelineShaderStageCreateInfo()
+                        .setStage(vk::ShaderStageFlagBits::eCompute)
+                        .setModule(shader)
+                        .setPName("main"))
+            .setLayout(m_layout);
+
+        return m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+    };
+
+    m_pipeline      = createPipeline("shaders/downsample_comp.spv", m_shader);
+    m_half_pipeline = createPipeline("shaders/downsample_half_comp.spv", m_half_shader);
+
+    // Samples level 0 right between 2x2 texels, so that filtering averages them
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(vk::Filter::eLinear)
+                         .setMinFilter(vk::Filter::eLinear)
+                         .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                         .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setMinLod(0.f)
+                         .setMaxLod(0.f);
+
+    m_sampler = views.sampler(samplerinfo);
+
+    // Only ever touched by the shader after this, which leaves it at 0 again
+    auto counterinfo = vk::BufferCreateInfo()
+                         .setSize(sizeof(uint32_t))
+                         .setUsage(vk::BufferUsageFlagBits::eStorageBuffer)
+                         .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_counter        = m_device.createBuffer(counterinfo, hostAllocator());
+    m_counter_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_counter),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other);
+    m_device.bindBufferMemory(m_counter, m_counter_memory.memory, m_counter_memory.offset);
+    std::memset(m_counter_memory.mapped, 0, sizeof(uint32_t));
+}
+
+void
+mip_downsampler::destroy()
+{
+    if (!m_pipeline) {
+        return;
+    }
+
+    reclaim(std::numeric_limits<upload_ticket>::max());
+    for (chain& open : m_open) {
+        destroyChain(open);
+    }
+    m_open.clear();
+
+    m_device.destroyBuffer(m_counter, hostAllocator());
+    m_allocator->free(m_counter_memory);
+
+    m_device.destroyPipeline(m_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_shader, hostAllocator());
+    m_device.destroyPipeline(m_half_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_half_shader, hostAllocator());
+    m_pipeline = nullptr;
+}
+
+// Storage images of both formats are required of every device, linear filtering of them too
+bool
+mip_downsampler::supports(vk::Format format, uint32_t miplevels) const
+{
+    return m_pipeline && miplevels > 1 && miplevels <= max_downsample_levels + 1
+           && (format == vk::Format::eR8G8B8A8Unorm || format == vk::Format::eR16G16B16A16Sfloat)
+           && std::find(m_blitted.begin(), m_blitted.end(), format) == m_blitted.end();
+}
+
+/*
+A view per level, and entries past the last level's repeat its view, since every entry of the array
+has to be valid even though they are never written
+*/
+mip_downsampler::chain
+mip_downsampler::createChain(vk::Image  image,
+                             vk::Format format,
+                             uint32_t   width,
+                             uint32_t   height,
+                             uint32_t   miplevels)
+{
+    chain result;
+    result.image     = image;
+    result.width     = width;
+    result.height    = height;
+    result.miplevels = miplevels;
+    result.half      = format == vk::Format::eR16G16B16A16Sfloat;
+
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(image)
+                      .setViewType(vk::ImageViewType::e2D)
+                      .setFormat(format)
+                      .setSubresourceRange(levelRange(0));
+
+    result.source = m_device.createImageView(viewinfo, hostAllocator());
+    for (uint32_t level = 1; level < miplevels; ++level) {
+        viewinfo.setSubresourceRange(levelRange(level));
+        result.levels.push_back(m_device.createImageView(viewinfo, hostAllocator()));
+    }
+
+    result.descriptors.init(m_device,
+                            { { vk::DescriptorType::eCombinedImageSampler, 1 },
+                              { vk::DescriptorType::eStorageImage, max_downsample_levels },
+                              { vk::DescriptorType::eStorageBuffer, 1 } },
+                            1);
+    result.set = result.descriptors.allocate(m_set_layout);
+
+    auto source =
+      vk::DescriptorImageInfo(m_sampler, result.source, vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    std::array<vk::DescriptorImageInfo, max_downsample_levels> levels;
+    for (uint32_t i = 0; i < max_downsample_levels; ++i) {
+        const vk::ImageView view = result.levels[std::min(i, (uint32_t)result.levels.size() - 1)];
+        levels[i] = vk::DescriptorImageInfo(nullptr, view, vk::ImageLayout::eGeneral);
+    }
+
+    auto counter = vk::DescriptorBufferInfo(m_counter, 0, sizeof(uint32_t));
+
+    std::array<vk::WriteDescriptorSet, 3> writes = {
+        vk::WriteDescriptorSet()
+          .setDstSet(result.set)
+          .setDstBinding(0)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+          .setPImageInfo(&source),
+        vk::WriteDescriptorSet()
+          .setDstSet(result.set)
+          .setDstBinding(1)
+          .setDescriptorCount(max_downsample_levels)
+          .setDescriptorType(vk::DescriptorType::eStorageImage)
+          .setPImageInfo(levels.data()),
+        vk::WriteDescriptorSet()
+          .setDstSet(result.set)
+          .setDstBinding(2)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+          .setPBufferInfo(&counter),
+    };
+    m_device.updateDescriptorSets(writes, nullptr);
+
+    return result;
+}
+
+void
+mip_downsampler::destroyChain(chain& chain)
+{
+    for (vk::ImageView view : chain.levels) {
+        m_device.destroyImageView(view, hostAllocator());
+    }
+    m_device.destroyImageView(chain.source, hostAllocator());
+    chain.descriptors.destroy();
+    chain = mip_downsampler::chain();
+}
+
+void
+mip_downsampler::retireChain(chain& chain, deletion_queue& deletions, uint64_t frame)
+{
+    if (!chain) {
+        return;
+    }
+
+    for (vk::ImageView view : chain.levels) {
+        deletions.push(frame, view);
+    }
+    deletions.push(frame, chain.source);
+
+    descriptor_allocator old = chain.descriptors;
+    deletions.pushAction(frame, [old]() mutable { old.destroy(); });
+
+    chain = mip_downsampler::chain();
+}
+
+/*
+The counter is shared by every build, so each one waits for the one before it to have set it back
+to 0, which is a single memory barrier
+*/
+void
+mip_downsampler::record(vk::CommandBuffer command_buffer, const chain& chain)
+{
+    barrier_batch barriers;
+    barriers.memory({ vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite },
+                    { vk::PipelineStageFlagBits::eComputeShader,
+                      vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite });
+    barriers.record(command_buffer);
+
+    const uint32_t groupsx = (chain.width + downsample_tile - 1) / downsample_tile;
+    const uint32_t groupsy = (chain.height + downsample_tile - 1) / downsample_tile;
+
+    downsample_constants constants;
+    constants.width  = (int32_t)chain.width;
+    constants.height = (int32_t)chain.height;
+    constants.levels = (int32_t)chain.miplevels - 1;
+    constants.groups = groupsx * groupsy;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                chain.half ? m_half_pipeline : m_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, 0, chain.set,
+                                      nullptr);
+    command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof(constants), &constants);
+    command_buffer.dispatch(groupsx, groupsy, 1);
+}
+
+/*
+Level 0 goes straight to its final layout, since the shader only samples it, and every other level
+to the general layout for the shader's stores and then on to the final layout as well
+*/
+void
+mip_downsampler::recordUpload(vk::CommandBuffer command_buffer,
+                              vk::Image         image,
+                              vk::Format        format,
+                              uint32_t          width,
+                              uint32_t          height,
+                              uint32_t          miplevels)
+{
+    m_open.push_back(createChain(image, format, width, height, miplevels));
+
+    const access_scope copied  = layoutScope(vk::ImageLayout::eTransferDstOptimal);
+    const access_scope shader  = layoutScope(vk::ImageLayout::eShaderReadOnlyOptimal);
+    const access_scope written = { vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eGeneral };
+
+    barrier_batch barriers;
+    barriers.image(image, levelRange(0), copied, shader);
+    barriers.image(image, levelRange(1, miplevels - 1), copied, written);
+    barriers.record(command_buffer);
+
+    record(command_buffer, m_open.back());
+
+    barriers.clear();
+    barriers.image(image, levelRange(1, miplevels - 1), written, shader);
+    barriers.record(command_buffer);
+}
+
+void
+mip_downsampler::close(upload_ticket ticket)
+{
+    if (m_open.empty()) {
+        return;
+    }
+
+    submitted_chains submitted;
+    submitted.ticket = ticket;
+    submitted.chains.swap(m_open);
+    m_submitted.push_back(std::move(submitted));
+}
+
+void
+mip_downsampler::reclaim(upload_ticket completed)
+{
+    while (!m_submitted.empty() && m_submitted.front().ticket <= completed) {
+        for (chain& done : m_submitted.front().chains) {
+            destroyChain(done);
+        }
+        m_submitted.pop_front();
+    }
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "graphics/deletion_queue.h"
+#include "graphics/descriptor_allocator.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/upload_service.h"
+#include "graphics/view_cache.h"
+
+#include <deque>
+#include <vector>
+
+namespace shiny::graphics {
+
+// The most levels below level 0 a single dispatch builds, all of them for up to 4096x4096 texels
+const uint32_t max_downsample_levels = 12;
+
+/*
+Builds the mip levels of an image out of its level 0 with a single compute dispatch, instead of a
+blit and a barrier for every level. Every group of downsample.comp averages a 64x64 tile of level 0
+down to one texel of level 6 in shared memory, and the last group to finish, which a counter in a
+buffer tells, averages level 6 down to the last level the same way. Levels round down like blits
+do.
+
+The reduction is in shared memory rather than subgroup operations, which need Vulkan 1.1 where the
+instance is 1.0. RGBA8 unorm images are averaged as they are, like linear blits average them, and
+RGBA16 float ones for render targets. Images need VK_IMAGE_USAGE_STORAGE_BIT.
+
+A chain holds the views and the descriptor set of one image, for render targets that are built
+again every frame. upload_service uses it for generateMipmaps, through recordUpload(), with chains
+that only live as long as their submission.
+*/
+class mip_downsampler
+{
+public:
+    struct chain
+    {
+        vk::Image                  image;
+        uint32_t                   width     = 0;
+        uint32_t                   height    = 0;
+        uint32_t                   miplevels = 0;
+        bool                       half      = false;  // RGBA16 float
+        vk::ImageView              source;             // level 0
+        std::vector<vk::ImageView> levels;             // the rest
+        descriptor_allocator       descriptors;
+        vk::DescriptorSet          set;
+
+        explicit operator bool() const { return static_cast<bool>(image); }
+    };
+
+    void init(vk::Device        device,
+              memory_allocator& allocator,
+              layout_cache&     layouts,
+              view_cache&       views,
+              pipeline_cache&   pipelines);
+    // Destroys whatever recordUpload() still has, so only once the uploads are done. Does nothing
+    // if it was never initialized.
+    void destroy();
+
+    // Whether it can build `miplevels` levels of an image in `format`, level 0 included
+    bool supports(vk::Format format, uint32_t miplevels) const;
+
+    // Leaves images in `format` to the blits, for where the storage usage would cost them their
+    // compression, which they are sampled through far more often than they are built
+    void leaveToBlits(vk::Format format) { m_blitted.push_back(format); }
+
+    chain createChain(vk::Image  image,
+                      vk::Format format,
+                      uint32_t   width,
+                      uint32_t   height,
+                      uint32_t   miplevels);
+    void destroyChain(chain& chain);
+    // The frames before `frame` may still be building it
+    void retireChain(chain& chain, deletion_queue& deletions, uint64_t frame);
+
+    // Records the build. Level 0 has to be in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and the rest
+    // in VK_IMAGE_LAYOUT_GENERAL, where they are left, with the writes before visible to compute
+    // shaders. Whatever reads the levels afterwards is up to the caller to wait for.
+    void record(vk::CommandBuffer command_buffer, const chain& chain);
+
+    // generateMipmaps' side of it: every level is in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL and is
+    // left in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, like the blits leave them. The chain is
+    // destroyed once the submission it is recorded into has finished.
+    void recordUpload(vk::CommandBuffer command_buffer,
+                      vk::Image         image,
+                      vk::Format        format,
+                      uint32_t          width,
+                      uint32_t          height,
+                      uint32_t          miplevels);
+
+    // What recordUpload() created since the last close belongs to `ticket`, and is destroyed once
+    // reclaim() is called with a ticket that far
+    void close(upload_ticket ticket);
+    void reclaim(upload_ticket completed);
+
+private:
+    struct submitted_chains
+    {
+        upload_ticket      ticket = 0;
+        std::vector<chain> chains;
+    };
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::DescriptorSetLayout m_set_layout;  // owned by the layout_cache
+    vk::PipelineLayout      m_layout;
+    vk::ShaderModule        m_shader;
+    vk::Pipeline            m_pipeline;
+    vk::ShaderModule        m_half_shader;
+    vk::Pipeline            m_half_pipeline;
+    vk::Sampler             m_sampler;  // owned by the view_cache
+    std::vector<vk::Format> m_blitted;
+
+    // The shader's group counter, host visible only to be zeroed once
+    vk::Buffer m_counter;
+    allocation m_counter_memory;
+
+    std::vector<chain>           m_open;  // recorded since the last close()
+    std::deque<submitted_chains> m_submitted;
+};
+
+}  // namespace shiny::graphics
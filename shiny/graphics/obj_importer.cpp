@@ -0,0 +1,630 @@
+#include "graphics/obj_importer.h"
+
+#include "core/mapped_file.h"
+#include "core/profiler.h"
+#include "graphics/mesh_cache.h"
+#include "graphics/mesh_lod.h"
+#include "graphics/mesh_optimize.h"
+#include "graphics/meshlet.h"
+#include "graphics/renderer.h"
+#include "graphics/vertex_quantize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+
+using namespace shiny::graphics;
+
+// Large enough for parsing one to outweigh running it as a job, small enough that a few hundred
+// megabytes of OBJ keep every thread busy
+const size_t chunk_size = 4 * 1024 * 1024;
+
+/*
+A face's use of a position and a texture coordinate. Negative OBJ indices count back from the
+last one defined before the face, which may be in an earlier chunk, so those are kept relative to
+the start of their chunk until it is known how many came before it.
+*/
+struct obj_corner
+{
+    int64_t position          = 0;
+    int64_t texcoord          = -1;  // none
+    bool    relative_position = false;
+    bool    relative_texcoord = false;
+};
+
+struct obj_chunk
+{
+    const char* begin = nullptr;
+    const char* end   = nullptr;
+
+    std::vector<glm::vec3>  positions;
+    std::vector<glm::vec2>  texcoords;
+    std::vector<obj_corner> corners;  // three per triangle
+    bool                    failed = false;
+
+    // Materials are named by their usemtl lines, offset by one: triangles before the chunk's first
+    // one have 0, whichever material was in use at the end of the chunk before
+    std::vector<std::string> libraries;
+    std::vector<std::string> material_names;
+    std::vector<uint32_t>    triangle_materials;
+    std::vector<uint32_t>    material_triangles;  // how many triangles have each
+    uint32_t                 last_material = 0;
+
+    size_t first_position = 0;  // defined in the chunks before this one
+    size_t first_texcoord = 0;
+
+    // What each of the chunk's materials is overall, and where its next triangle goes once the
+    // triangles are sorted by material
+    std::vector<uint32_t> materials;
+    std::vector<uint32_t> slots;
+
+    // The distinct position, texture coordinate and material triples of the chunk in the order
+    // they are first used, for every corner which of them it is, and what each of them is
+    // numbered overall
+    std::vector<glm::uvec3> keys;
+    std::vector<uint32_t>   local;
+    std::vector<uint32_t>   remap;
+};
+
+bool
+isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+void
+skipSpaces(const char*& p, const char* end)
+{
+    while (p < end && isSpace(*p)) {
+        ++p;
+    }
+}
+
+bool
+parseInt(const char*& p, const char* end, int64_t& out)
+{
+    const bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        ++p;
+    }
+
+    const char* digits = p;
+    int64_t     value  = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        ++p;
+    }
+
+    out = negative ? -value : value;
+    return p != digits;
+}
+
+// The rest of the line without the spaces around it, for names
+std::string
+parseName(const char* p, const char* end)
+{
+    skipSpaces(p, end);
+    while (end > p && isSpace(end[-1])) {
+        --end;
+    }
+    return std::string(p, end);
+}
+
+// Whether the line starts with `keyword` and a space, skipping past them if it does
+bool
+parseKeyword(const char*& p, const char* end, const char* keyword)
+{
+    const size_t length = std::char_traits<char>::length(keyword);
+    if ((size_t)(end - p) <= length || std::char_traits<char>::compare(p, keyword, length) != 0
+        || !isSpace(p[length])) {
+        return false;
+    }
+    p += length + 1;
+    return true;
+}
+
+/*
+strtof needs the text to be terminated, which the end of a mapped file isn't. Up to 19 significant
+digits are gathered exactly and scaled by a power of ten once, which is closer than vertex data
+needs to be.
+*/
+bool
+parseFloat(const char*& p, const char* end, float& out)
+{
+    const bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        ++p;
+    }
+
+    uint64_t    mantissa = 0;
+    int         exponent = 0;
+    int         kept     = 0;
+    const char* digits   = p;
+
+    auto digit = [&](bool fraction) {
+        if (kept < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            kept += mantissa != 0 ? 1 : 0;
+            exponent -= fraction ? 1 : 0;
+        } else {
+            exponent += fraction ? 0 : 1;
+        }
+        ++p;
+    };
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        digit(false);
+    }
+    if (p < end && *p == '.') {
+        ++p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            digit(true);
+        }
+    }
+    if (p == digits || (p == digits + 1 && *digits == '.')) {
+        return false;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int64_t power = 0;
+        ++p;
+        if (!parseInt(p, end, power)) {
+            return false;
+        }
+        exponent += (int)std::max<int64_t>(std::min<int64_t>(power, 400), -400);
+    }
+
+    const double value = (double)mantissa * std::pow(10., exponent);
+    out                = (float)(negative ? -value : value);
+    return true;
+}
+
+// One corner of a face: a position index, then optionally /texcoord and /normal, either of which
+// may be left out
+bool
+parseCorner(const char*& p, const char* end, const obj_chunk& chunk, obj_corner& corner)
+{
+    int64_t position = 0;
+    if (!parseInt(p, end, position) || position == 0) {
+        return false;
+    }
+    corner.relative_position = position < 0;
+    corner.position = position < 0 ? (int64_t)chunk.positions.size() + position : position - 1;
+
+    if (p < end && *p == '/') {
+        ++p;
+        int64_t texcoord = 0;
+        if (p < end && *p != '/') {
+            if (!parseInt(p, end, texcoord) || texcoord == 0) {
+                return false;
+            }
+            corner.relative_texcoord = texcoord < 0;
+            corner.texcoord =
+              texcoord < 0 ? (int64_t)chunk.texcoords.size() + texcoord : texcoord - 1;
+        }
+        if (p < end && *p == '/') {
+            ++p;
+            int64_t normal = 0;
+            parseInt(p, end, normal);
+        }
+    }
+    return true;
+}
+
+void
+parseChunk(obj_chunk& chunk)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const char* p   = chunk.begin;
+    const char* end = chunk.end;
+
+    std::vector<obj_corner> face;
+    uint32_t                material = 0;
+
+    chunk.material_triangles.assign(1, 0);
+
+    while (p < end && !chunk.failed) {
+        skipSpaces(p, end);
+        const char* line = p;
+        while (p < end && *p != '\n') {
+            ++p;
+        }
+        const char* lineend = p;
+        if (p < end) {
+            ++p;
+        }
+
+        const char* q = line;
+        if (lineend - q >= 2 && q[0] == 'v' && isSpace(q[1])) {
+            glm::vec3 position;
+            q += 2;
+            for (int i = 0; i < 3 && !chunk.failed; ++i) {
+                skipSpaces(q, lineend);
+                chunk.failed = !parseFloat(q, lineend, position[i]);
+            }
+            chunk.positions.push_back(position);
+        } else if (lineend - q >= 3 && q[0] == 'v' && q[1] == 't' && isSpace(q[2])) {
+            // A third coordinate, if there is one, is for 3D textures
+            glm::vec2 texcoord;
+            q += 3;
+            for (int i = 0; i < 2 && !chunk.failed; ++i) {
+                skipSpaces(q, lineend);
+                chunk.failed = !parseFloat(q, lineend, texcoord[i]);
+            }
+            chunk.texcoords.push_back(texcoord);
+        } else if (lineend - q >= 2 && q[0] == 'f' && isSpace(q[1])) {
+            face.clear();
+            q += 2;
+            skipSpaces(q, lineend);
+            while (q < lineend && !chunk.failed) {
+                obj_corner corner;
+                chunk.failed = !parseCorner(q, lineend, chunk, corner);
+                face.push_back(corner);
+                skipSpaces(q, lineend);
+            }
+
+            // Fans around the first corner, which is what convex polygons need
+            for (size_t i = 2; i < face.size() && !chunk.failed; ++i) {
+                chunk.corners.push_back(face[0]);
+                chunk.corners.push_back(face[i - 1]);
+                chunk.corners.push_back(face[i]);
+                chunk.triangle_materials.push_back(material);
+                ++chunk.material_triangles[material];
+            }
+        } else if (parseKeyword(q, lineend, "usemtl")) {
+            const std::string name  = parseName(q, lineend);
+            const auto        found = std::find(chunk.material_names.begin(),
+                                         chunk.material_names.end(), name);
+
+            material = (uint32_t)(found - chunk.material_names.begin()) + 1;
+            if (found == chunk.material_names.end()) {
+                chunk.material_names.push_back(name);
+                chunk.material_triangles.push_back(0);
+            }
+        } else if (parseKeyword(q, lineend, "mtllib")) {
+            // Any number of file names, which can't have spaces in them then
+            skipSpaces(q, lineend);
+            while (q < lineend) {
+                const char* name = q;
+                while (q < lineend && !isSpace(*q)) {
+                    ++q;
+                }
+                chunk.libraries.emplace_back(name, q);
+                skipSpaces(q, lineend);
+            }
+        }
+    }
+
+    chunk.last_material = material;
+}
+
+/*
+Adds the materials of a .mtl file to `materials`, or replaces those with the same names. Only
+their names, diffuse colors and diffuse textures are kept, and a missing library leaves the
+materials it would have had white and untextured.
+*/
+void
+readMaterialLibrary(const std::string&                         path,
+                    std::vector<mesh_material>&                materials,
+                    std::unordered_map<std::string, uint32_t>& names)
+{
+    core::mapped_file file;
+    if (!file.open(path)) {
+        return;
+    }
+
+    const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+
+    mesh_material* material = nullptr;
+    for (const char* p = file.begin(); p < file.end();) {
+        skipSpaces(p, file.end());
+        const char* line    = p;
+        const char* lineend = std::find(p, file.end(), '\n');
+        p                   = lineend < file.end() ? lineend + 1 : lineend;
+
+        const char* q = line;
+        if (parseKeyword(q, lineend, "newmtl")) {
+            const std::string name = parseName(q, lineend);
+
+            auto [it, inserted] = names.try_emplace(name, (uint32_t)materials.size());
+            if (inserted) {
+                materials.emplace_back();
+            }
+            material       = &materials[it->second];
+            *material      = mesh_material();
+            material->name = name;
+        } else if (material && parseKeyword(q, lineend, "Kd")) {
+            for (int i = 0; i < 3; ++i) {
+                skipSpaces(q, lineend);
+                if (!parseFloat(q, lineend, material->diffuse[i])) {
+                    material->diffuse = glm::vec3(1.f);
+                    break;
+                }
+            }
+        } else if (material && parseKeyword(q, lineend, "map_Kd")) {
+            // Options like -s come before the file name
+            const std::string value = parseName(q, lineend);
+            const size_t      space = value.find_last_of(" \t");
+            const std::string name  = space == std::string::npos ? value : value.substr(space + 1);
+
+            material->diffuse_texture = (directory / name).string();
+        }
+    }
+}
+
+/*
+Every corner's triple of position, texture coordinate and material, numbered in the order the
+chunk first uses them. The texture coordinate goes in offset by one so that none is 0. The
+material is part of it as its diffuse color goes into the vertex.
+*/
+void
+findChunkVertices(obj_chunk& chunk, size_t positioncount, size_t texcoordcount)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    std::unordered_map<glm::uvec3, uint32_t> numbers;
+    numbers.reserve(chunk.corners.size() / 4);
+    chunk.local.reserve(chunk.corners.size());
+
+    for (size_t c = 0; c < chunk.corners.size(); ++c) {
+        const obj_corner& corner = chunk.corners[c];
+        const bool    hastexcoord = corner.texcoord >= 0 || corner.relative_texcoord;
+        const int64_t position =
+          corner.position + (corner.relative_position ? (int64_t)chunk.first_position : 0);
+        const int64_t texcoord =
+          !hastexcoord
+            ? -1
+            : corner.texcoord + (corner.relative_texcoord ? (int64_t)chunk.first_texcoord : 0);
+
+        if (position < 0 || position >= (int64_t)positioncount
+            || (hastexcoord && (texcoord < 0 || texcoord >= (int64_t)texcoordcount))) {
+            chunk.failed = true;
+            return;
+        }
+
+        const glm::uvec3 key((uint32_t)position, (uint32_t)(texcoord + 1),
+                             chunk.materials[chunk.triangle_materials[c / 3]]);
+
+        auto [it, inserted] = numbers.try_emplace(key, (uint32_t)chunk.keys.size());
+        if (inserted) {
+            chunk.keys.push_back(key);
+        }
+        chunk.local.push_back(it->second);
+    }
+
+    std::vector<obj_corner>().swap(chunk.corners);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+bool
+importObj(const std::string& path, jobs::scheduler& jobs, Mesh& mesh)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    core::mapped_file file;
+    if (!file.open(path)) {
+        return false;
+    }
+
+    // Every chunk but the last ends right after a line break
+    std::vector<obj_chunk> chunks;
+    for (const char* begin = file.begin(); begin < file.end();) {
+        const char* end = begin + std::min(chunk_size, (size_t)(file.end() - begin));
+        end             = std::find(end, file.end(), '\n');
+        end             = end < file.end() ? end + 1 : end;
+
+        obj_chunk chunk;
+        chunk.begin = begin;
+        chunk.end   = end;
+        chunks.push_back(std::move(chunk));
+        begin = end;
+    }
+
+    jobs.parallelFor(0, (uint32_t)chunks.size(), 1, [&](uint32_t first, uint32_t last) {
+        for (uint32_t i = first; i < last; ++i) {
+            parseChunk(chunks[i]);
+        }
+    });
+
+    size_t positioncount = 0;
+    size_t texcoordcount = 0;
+    size_t indexcount    = 0;
+    for (obj_chunk& chunk : chunks) {
+        if (chunk.failed) {
+            return false;
+        }
+        chunk.first_position = positioncount;
+        chunk.first_texcoord = texcoordcount;
+        positioncount += chunk.positions.size();
+        texcoordcount += chunk.texcoords.size();
+        indexcount += chunk.corners.size();
+    }
+
+    // The keys are 32 bits a piece, and the indices are 32 bits as well
+    const size_t limit = std::numeric_limits<uint32_t>::max();
+    if (positioncount > limit || texcoordcount >= limit || indexcount > limit) {
+        return false;
+    }
+
+    // Faces before any usemtl have a white material of their own, with no name
+    std::vector<mesh_material>                materials;
+    std::unordered_map<std::string, uint32_t> names;
+    for (const obj_chunk& chunk : chunks) {
+        for (const std::string& library : chunk.libraries) {
+            const std::filesystem::path directory = std::filesystem::path(path).parent_path();
+            readMaterialLibrary((directory / library).string(), materials, names);
+        }
+    }
+    auto findMaterial = [&](const std::string& name) {
+        auto [it, inserted] = names.try_emplace(name, (uint32_t)materials.size());
+        if (inserted) {
+            materials.emplace_back();
+            materials.back().name = name;
+        }
+        return it->second;
+    };
+
+    uint32_t current = std::numeric_limits<uint32_t>::max();
+    for (obj_chunk& chunk : chunks) {
+        if (chunk.material_triangles[0] > 0 && current == std::numeric_limits<uint32_t>::max()) {
+            current = findMaterial("");
+        }
+        chunk.materials.push_back(current);
+        for (const std::string& name : chunk.material_names) {
+            chunk.materials.push_back(findMaterial(name));
+        }
+        current = chunk.materials[chunk.last_material];
+    }
+
+    // Every material's triangles go one after the other, the chunks' in order
+    std::vector<uint32_t> firsts(materials.size() + 1, 0);
+    for (const obj_chunk& chunk : chunks) {
+        for (size_t l = 0; l < chunk.materials.size(); ++l) {
+            if (chunk.material_triangles[l] > 0) {
+                firsts[chunk.materials[l] + 1] += chunk.material_triangles[l];
+            }
+        }
+    }
+    for (size_t m = 0; m < materials.size(); ++m) {
+        firsts[m + 1] += firsts[m];
+    }
+    std::vector<uint32_t> next(firsts.begin(), firsts.end() - 1);
+    for (obj_chunk& chunk : chunks) {
+        for (size_t l = 0; l < chunk.materials.size(); ++l) {
+            chunk.slots.push_back(chunk.material_triangles[l] > 0 ? next[chunk.materials[l]] : 0);
+            if (chunk.material_triangles[l] > 0) {
+                next[chunk.materials[l]] += chunk.material_triangles[l];
+            }
+        }
+    }
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texcoords;
+    positions.reserve(positioncount);
+    texcoords.reserve(texcoordcount);
+    for (obj_chunk& chunk : chunks) {
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        texcoords.insert(texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+        std::vector<glm::vec3>().swap(chunk.positions);
+        std::vector<glm::vec2>().swap(chunk.texcoords);
+    }
+
+    jobs.parallelFor(0, (uint32_t)chunks.size(), 1, [&](uint32_t first, uint32_t last) {
+        for (uint32_t i = first; i < last; ++i) {
+            findChunkVertices(chunks[i], positioncount, texcoordcount);
+        }
+    });
+
+    // Only a chunk's distinct pairs go through here, a fraction of its corners
+    mesh.vertices.clear();
+    mesh.indices.assign(indexcount, 0);
+
+    std::unordered_map<glm::uvec3, uint32_t> numbers;
+    for (obj_chunk& chunk : chunks) {
+        if (chunk.failed) {
+            return false;
+        }
+
+        chunk.remap.reserve(chunk.keys.size());
+        for (const glm::uvec3& key : chunk.keys) {
+            auto [it, inserted] = numbers.try_emplace(key, (uint32_t)mesh.vertices.size());
+            if (inserted) {
+                const uint32_t texcoord = key.y;
+
+                Vertex vertex   = {};
+                vertex.pos      = positions[key.x];
+                vertex.color    = materials[key.z].diffuse;
+                vertex.texcoord = texcoord > 0 ? glm::vec2(texcoords[texcoord - 1].x,
+                                                           1.0f - texcoords[texcoord - 1].y)
+                                               : glm::vec2(0.f);
+                mesh.vertices.push_back(vertex);
+            }
+            chunk.remap.push_back(it->second);
+        }
+    }
+
+    jobs.parallelFor(0, (uint32_t)chunks.size(), 1, [&](uint32_t first, uint32_t last) {
+        for (uint32_t i = first; i < last; ++i) {
+            obj_chunk& chunk = chunks[i];
+            for (size_t c = 0; c < chunk.local.size(); c += 3) {
+                const uint32_t slot = chunk.slots[chunk.triangle_materials[c / 3]]++;
+                for (size_t k = 0; k < 3; ++k) {
+                    mesh.indices[slot * 3 + k] = chunk.remap[chunk.local[c + k]];
+                }
+            }
+        }
+    });
+
+    // One submesh for every material that is used, unless that is only the unnamed one
+    mesh.materials.clear();
+    mesh.submeshes.clear();
+    mesh.lods.clear();
+
+    for (uint32_t m = 0; m < (uint32_t)materials.size(); ++m) {
+        if (firsts[m + 1] == firsts[m]) {
+            continue;
+        }
+
+        submesh part;
+        part.material  = (uint32_t)mesh.materials.size();
+        part.first_lod = (uint32_t)mesh.lods.size();
+        part.lod_count = 1;
+        mesh.submeshes.push_back(part);
+        mesh.materials.push_back(std::move(materials[m]));
+
+        mesh_lod lod;
+        lod.first_index = firsts[m] * 3;
+        lod.index_count = (firsts[m + 1] - firsts[m]) * 3;
+        mesh.lods.push_back(lod);
+    }
+
+    if (mesh.materials.size() == 1 && mesh.materials[0].name.empty()) {
+        mesh.materials.clear();
+        mesh.submeshes.clear();
+        mesh.lods.clear();
+
+        mesh_lod full;
+        full.index_count = (uint32_t)mesh.indices.size();
+        mesh.lods.push_back(full);
+    }
+
+    return true;
+}
+
+bool
+cookObj(const std::string& path, jobs::scheduler& jobs, Mesh& mesh)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const std::string cachepath  = meshCachePath(path);
+    const uint64_t    sourcehash = meshSourceHash(path);
+
+    if (readMeshCache(cachepath, sourcehash, mesh, &jobs)) {
+        return true;
+    }
+
+    if (!importObj(path, jobs, mesh)) {
+        return false;
+    }
+
+    // Simplifying and reordering take longer than parsing, so their results go in the cache as well
+    buildMeshLods(mesh);
+    optimizeMesh(mesh);
+    buildMeshlets(mesh);
+    mesh.format = chooseVertexFormat(mesh);
+
+    // Not being able to write the cache only costs us the parse next time
+    writeMeshCache(cachepath, sourcehash, mesh);
+
+    return true;
+}
+
+}  // namespace shiny::graphics
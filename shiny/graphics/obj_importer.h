@@ -0,0 +1,41 @@
+#pragma once
+
+#include "jobs/scheduler.h"
+
+#include <string>
+
+namespace shiny::graphics {
+
+struct Mesh;
+
+/*
+Reads the positions, texture coordinates and faces of a Wavefront OBJ file into `mesh`'s vertices
+and indices, with every combination of position and texture coordinate that faces use becoming one
+vertex, in the order they are first used. Polygons are split into fans of triangles, and everything
+but positions, texture coordinates, faces and materials is ignored.
+
+The materials of the mtllib libraries go into `mesh`'s materials, with their diffuse colors in the
+vertices. The triangles are sorted by the material of their usemtl, keeping their order otherwise,
+and the triangles of each become a submesh with a single level. A model without materials gets no
+submeshes, but a level with all of its triangles.
+
+The file is mapped rather than read, and split into chunks at line breaks that are parsed in
+parallel on `jobs`. Indices may point into other chunks, so the vertices are only put together
+once every chunk is parsed: each chunk first finds its own unique combinations, then those are
+numbered in order on the calling thread, and finally every chunk's indices are rewritten to the
+numbers in parallel again.
+
+Returns false if the file can't be read or has faces using positions or texture coordinates it
+doesn't have.
+*/
+bool importObj(const std::string& path, jobs::scheduler& jobs, Mesh& mesh);
+
+/*
+Everything a model goes through before it can be uploaded: importObj, the levels of detail, the
+vertex cache and overdraw ordering, meshlets and the vertex format. The result is written to the
+mesh cache, which is read instead wherever it is up to date, so this is both how models are loaded
+at runtime and how they can be cooked ahead of time.
+*/
+bool cookObj(const std::string& path, jobs::scheduler& jobs, Mesh& mesh);
+
+}  // namespace shiny::graphics
@@ -0,0 +1,531 @@
+#include "graphics/object_picker.h"
+
+#include "core/mapped_file.h"
+#include "core/profiler.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+// Every device can render to both
+const vk::Format pick_id_format    = vk::Format::eR32Uint;
+const vk::Format pick_depth_format = vk::Format::eD16Unorm;
+
+// What pick.vert and pick.frag take, laid out like their push constants
+struct pick_constants
+{
+    glm::mat4 mvp;
+    uint32_t  object = 0;
+};
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+object_picker::init(vk::Device                              device,
+                    memory_allocator&                       allocator,
+                    layout_cache&                           layouts,
+                    pipeline_cache&                         pipelines,
+                    const std::vector<shadow_vertex_input>& inputs,
+                    uint32_t                                frames)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+
+    // The IDs are cleared to 0 for nothing, and are copied out right after the subpass, which the
+    // dependency makes wait for their writes. The depth is only needed while rendering.
+    std::array<vk::AttachmentDescription, 2> attachments = {
+        vk::AttachmentDescription()
+          .setFormat(pick_id_format)
+          .setSamples(vk::SampleCountFlagBits::e1)
+          .setLoadOp(vk::AttachmentLoadOp::eClear)
+          .setStoreOp(vk::AttachmentStoreOp::eStore)
+          .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+          .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+          .setInitialLayout(vk::ImageLayout::eUndefined)
+          .setFinalLayout(vk::ImageLayout::eTransferSrcOptimal),
+        vk::AttachmentDescription()
+          .setFormat(pick_depth_format)
+          .setSamples(vk::SampleCountFlagBits::e1)
+          .setLoadOp(vk::AttachmentLoadOp::eClear)
+          .setStoreOp(vk::AttachmentStoreOp::eDontCare)
+          .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+          .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+          .setInitialLayout(vk::ImageLayout::eUndefined)
+          .setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal),
+    };
+
+    auto colorreference = vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal);
+    auto depthreference =
+      vk::AttachmentReference(1, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    auto subpass = vk::SubpassDescription()
+                     .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+                     .setColorAttachmentCount(1)
+                     .setPColorAttachments(&colorreference)
+                     .setPDepthStencilAttachment(&depthreference);
+
+    auto dependency = vk::SubpassDependency()
+                        .setSrcSubpass(0)
+                        .setDstSubpass(VK_SUBPASS_EXTERNAL)
+                        .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+                        .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+                        .setDstStageMask(vk::PipelineStageFlagBits::eTransfer)
+                        .setDstAccessMask(vk::AccessFlagBits::eTransferRead);
+
+    auto renderpassinfo = vk::RenderPassCreateInfo()
+                            .setAttachmentCount((uint32_t)attachments.size())
+                            .setPAttachments(attachments.data())
+                            .setSubpassCount(1)
+                            .setPSubpasses(&subpass)
+                            .setDependencyCount(1)
+                            .setPDependencies(&dependency);
+
+    m_render_pass = m_device.createRenderPass(renderpassinfo, hostAllocator());
+
+    m_targets.resize(frames);
+    for (target& t : m_targets) {
+        auto imageinfo = vk::ImageCreateInfo()
+                           .setImageType(vk::ImageType::e2D)
+                           .setExtent(vk::Extent3D(pick_region, pick_region, 1))
+                           .setMipLevels(1)
+                           .setArrayLayers(1)
+                           .setFormat(pick_id_format)
+                           .setTiling(vk::ImageTiling::eOptimal)
+                           .setInitialLayout(vk::ImageLayout::eUndefined)
+                           .setUsage(vk::ImageUsageFlagBits::eColorAttachment
+                                     | vk::ImageUsageFlagBits::eTransferSrc)
+                           .setSamples(vk::SampleCountFlagBits::e1)
+                           .setSharingMode(vk::SharingMode::eExclusive);
+
+        t.ids        = m_device.createImage(imageinfo, hostAllocator());
+        t.ids_memory = m_allocator->allocate(m_device.getImageMemoryRequirements(t.ids),
+                                             vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                             memory_allocator::resource_kind::optimal,
+                                             memory_category::render_target);
+        m_device.bindImageMemory(t.ids, t.ids_memory.memory, t.ids_memory.offset);
+
+        imageinfo.setFormat(pick_depth_format)
+          .setUsage(vk::ImageUsageFlagBits::eDepthStencilAttachment);
+
+        t.depth        = m_device.createImage(imageinfo, hostAllocator());
+        t.depth_memory = m_allocator->allocate(m_device.getImageMemoryRequirements(t.depth),
+                                               vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                               memory_allocator::resource_kind::optimal,
+                                               memory_category::render_target);
+        m_device.bindImageMemory(t.depth, t.depth_memory.memory, t.depth_memory.offset);
+
+        auto viewinfo =
+          vk::ImageViewCreateInfo()
+            .setImage(t.ids)
+            .setViewType(vk::ImageViewType::e2D)
+            .setFormat(pick_id_format)
+            .setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1,
+                                                           0, 1));
+        t.ids_view = m_device.createImageView(viewinfo, hostAllocator());
+
+        viewinfo.setImage(t.depth)
+          .setFormat(pick_depth_format)
+          .setSubresourceRange(
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1));
+        t.depth_view = m_device.createImageView(viewinfo, hostAllocator());
+
+        const std::array<vk::ImageView, 2> views = { t.ids_view, t.depth_view };
+
+        auto framebufferinfo = vk::FramebufferCreateInfo()
+                                 .setRenderPass(m_render_pass)
+                                 .setAttachmentCount((uint32_t)views.size())
+                                 .setPAttachments(views.data())
+                                 .setWidth(pick_region)
+                                 .setHeight(pick_region)
+                                 .setLayers(1);
+        t.framebuffer = m_device.createFramebuffer(framebufferinfo, hostAllocator());
+
+        auto bufferinfo = vk::BufferCreateInfo()
+                            .setSize(pick_region * pick_region * sizeof(uint32_t))
+                            .setUsage(vk::BufferUsageFlagBits::eTransferDst)
+                            .setSharingMode(vk::SharingMode::eExclusive);
+        t.readback = m_device.createBuffer(bufferinfo, hostAllocator());
+
+        t.readback_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(t.readback),
+                                                  vk::MemoryPropertyFlagBits::eHostVisible
+                                                    | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                                  memory_allocator::resource_kind::linear,
+                                                  memory_category::staging,
+                                                  vk::MemoryPropertyFlagBits::eHostCached);
+        m_device.bindBufferMemory(t.readback, t.readback_memory.memory, t.readback_memory.offset);
+    }
+
+    // The candidate's whole transform and its ID are push constants, so there are no descriptors
+    auto constants =
+      vk::PushConstantRange()
+        .setStageFlags(vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment)
+        .setOffset(0)
+        .setSize(sizeof(pick_constants));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    const auto createshader = [&](const char* path) {
+        core::mapped_file code(path);
+
+        auto shaderinfo = vk::ShaderModuleCreateInfo()
+                            .setCodeSize(code.size())
+                            .setPCode((const uint32_t*)code.data());
+
+        return m_device.createShaderModule(shaderinfo, hostAllocator());
+    };
+
+    m_vertex_shader   = createshader("shaders/pick_vert.spv");
+    m_fragment_shader = createshader("shaders/pick_frag.spv");
+
+    const std::array<vk::PipelineShaderStageCreateInfo, 2> stages = {
+        vk::PipelineShaderStageCreateInfo()
+          .setStage(vk::ShaderStageFlagBits::eVertex)
+          .setModule(m_vertex_shader)
+          .setPName("main"),
+        vk::PipelineShaderStageCreateInfo()
+          .setStage(vk::ShaderStageFlagBits::eFragment)
+          .setModule(m_fragment_shader)
+          .setPName("main"),
+    };
+
+    auto inputassembly =
+      vk::PipelineInputAssemblyStateCreateInfo().setTopology(vk::PrimitiveTopology::eTriangleList);
+
+    auto viewport = vk::PipelineViewportStateCreateInfo().setViewportCount(1).setScissorCount(1);
+
+    // Both faces, so whatever is double sided can be picked from behind too. The back faces of
+    // closed meshes are behind their front faces anyway.
+    auto rasterizer = vk::PipelineRasterizationStateCreateInfo()
+                        .setPolygonMode(vk::PolygonMode::eFill)
+                        .setCullMode(vk::CullModeFlagBits::eNone)
+                        .setLineWidth(1.f);
+
+    auto multisampling =
+      vk::PipelineMultisampleStateCreateInfo().setRasterizationSamples(vk::SampleCountFlagBits::e1);
+
+    // Reverse-Z, like the renderer's projection
+    auto depthstencil = vk::PipelineDepthStencilStateCreateInfo()
+                          .setDepthTestEnable(true)
+                          .setDepthWriteEnable(true)
+                          .setDepthCompareOp(vk::CompareOp::eGreater);
+
+    // Integer attachments can't be blended
+    auto blendattachment = vk::PipelineColorBlendAttachmentState()
+                             .setBlendEnable(false)
+                             .setColorWriteMask(vk::ColorComponentFlagBits::eR);
+
+    auto blending = vk::PipelineColorBlendStateCreateInfo()
+                      .setAttachmentCount(1)
+                      .setPAttachments(&blendattachment);
+
+    std::array<vk::DynamicState, 2> dynamicstates = { vk::DynamicState::eViewport,
+                                                      vk::DynamicState::eScissor };
+
+    auto dynamic = vk::PipelineDynamicStateCreateInfo()
+                     .setDynamicStateCount((uint32_t)dynamicstates.size())
+                     .setPDynamicStates(dynamicstates.data());
+
+    for (const shadow_vertex_input& input : inputs) {
+        vk::VertexInputAttributeDescription position = input.position;
+        position.setLocation(0);
+
+        auto vertexinput = vk::PipelineVertexInputStateCreateInfo()
+                             .setVertexBindingDescriptionCount(1)
+                             .setPVertexBindingDescriptions(&input.binding)
+                             .setVertexAttributeDescriptionCount(1)
+                             .setPVertexAttributeDescriptions(&position);
+
+        auto pipelineinfo = vk::GraphicsPipelineCreateInfo()
+                              .setStageCount((uint32_t)stages.size())
+                              .setPStages(stages.data())
+                              .setPVertexInputState(&vertexinput)
+                              .setPInputAssemblyState(&inputassembly)
+                              .setPViewportState(&viewport)
+                              .setPRasterizationState(&rasterizer)
+                              .setPMultisampleState(&multisampling)
+                              .setPDepthStencilState(&depthstencil)
+                              .setPColorBlendState(&blending)
+                              .setPDynamicState(&dynamic)
+                              .setLayout(m_layout)
+                              .setRenderPass(m_render_pass)
+                              .setSubpass(0);
+
+        m_pipelines.push_back(
+          m_device.createGraphicsPipeline(pipelines.handle(), pipelineinfo, hostAllocator()));
+    }
+}
+
+void
+object_picker::destroy()
+{
+    for (vk::Pipeline pipeline : m_pipelines) {
+        m_device.destroyPipeline(pipeline, hostAllocator());
+    }
+    m_pipelines.clear();
+    m_device.destroyShaderModule(m_vertex_shader, hostAllocator());
+    m_device.destroyShaderModule(m_fragment_shader, hostAllocator());
+
+    for (target& t : m_targets) {
+        m_device.destroyFramebuffer(t.framebuffer, hostAllocator());
+        m_device.destroyImageView(t.ids_view, hostAllocator());
+        m_device.destroyImageView(t.depth_view, hostAllocator());
+        m_device.destroyImage(t.ids, hostAllocator());
+        m_device.destroyImage(t.depth, hostAllocator());
+        m_allocator->free(t.ids_memory);
+        m_allocator->free(t.depth_memory);
+        m_device.destroyBuffer(t.readback, hostAllocator());
+        m_allocator->free(t.readback_memory);
+    }
+    m_targets.clear();
+    m_candidates.clear();
+
+    m_device.destroyRenderPass(m_render_pass, hostAllocator());
+    m_render_pass = nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requests.clear();
+}
+
+void
+object_picker::request(uint32_t x, uint32_t y, pick_callback deliver)
+{
+    pick_request r;
+    r.x       = x;
+    r.y       = y;
+    r.deliver = std::move(deliver);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requests.push_back(std::move(r));
+}
+
+/*
+The region is moved inside the rendered image where that is smaller than the region would reach,
+so that as much of it as possible is there to find the nearest object in. Cropping the view
+projection to it scales and offsets clip space so that the region covers all of it, which keeps
+the frustum culling and the rasterization exactly what they would be over the whole image.
+*/
+bool
+object_picker::beginFrame(uint32_t         frame,
+                          const glm::mat4& view_projection,
+                          vk::Extent2D     extent,
+                          vk::Extent2D     target)
+{
+    m_frame = frame;
+    m_candidates.clear();
+
+    object_picker::target& t = m_targets[frame];
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_requests.empty() || extent.width == 0 || extent.height == 0) {
+            return false;
+        }
+        t.request = std::move(m_requests.front());
+        m_requests.pop_front();
+    }
+    t.taken    = true;
+    t.recorded = false;
+    t.order    = m_taken++;
+
+    // The position in pixels of the rendered image, which is smaller with dynamic resolution
+    const glm::vec2  scale(target.width > 0 ? (float)extent.width / (float)target.width : 1.f,
+                           target.height > 0 ? (float)extent.height / (float)target.height : 1.f);
+    const glm::vec2  requested((float)t.request.x + 0.5f, (float)t.request.y + 0.5f);
+    const glm::uvec2 size(extent.width, extent.height);
+    const glm::uvec2 position = glm::min(glm::uvec2(requested * scale), size - 1u);
+
+    const glm::uvec2 region(pick_region);
+    const glm::uvec2 half(pick_region / 2);
+    const glm::uvec2 origin =
+      glm::min(glm::max(position, half) - half, glm::max(size, region) - region);
+
+    t.center = position - origin;
+    t.size   = glm::min(size - origin, region);
+
+    // Clip space x and y of the region's center, scaled up by how much larger the image is
+    const glm::vec2 crop = glm::vec2(size) / (float)pick_region;
+    const glm::vec2 center =
+      (glm::vec2(origin) + (float)pick_region * 0.5f) / glm::vec2(size) * 2.f - 1.f;
+
+    glm::mat4 cropping(1.f);
+    cropping[0][0] = crop.x;
+    cropping[1][1] = crop.y;
+    cropping[3][0] = -center.x * crop.x;
+    cropping[3][1] = -center.y * crop.y;
+
+    t.view_projection = cropping * view_projection;
+    m_region_frustum  = extractFrustum(t.view_projection);
+    return true;
+}
+
+void
+object_picker::push(const pick_candidate& candidate)
+{
+    m_candidates.push_back(candidate);
+}
+
+void
+object_picker::record(vk::CommandBuffer command_buffer, uint32_t frame)
+{
+    target& t = m_targets[frame];
+    if (!t.taken || frame != m_frame) {
+        return;
+    }
+
+    SHINY_PROFILE_ZONE("pick");
+
+    const vk::Extent2D extent(pick_region, pick_region);
+
+    auto viewport = vk::Viewport(0.f, 0.f, (float)pick_region, (float)pick_region, 0.f, 1.f);
+    auto scissor  = vk::Rect2D({ 0, 0 }, extent);
+
+    std::array<vk::ClearValue, 2> clears;
+    clears[0].color        = vk::ClearColorValue(std::array<uint32_t, 4>{ 0, 0, 0, 0 });
+    clears[1].depthStencil = vk::ClearDepthStencilValue(0.f, 0);
+
+    auto begininfo = vk::RenderPassBeginInfo()
+                       .setRenderPass(m_render_pass)
+                       .setFramebuffer(t.framebuffer)
+                       .setRenderArea(scissor)
+                       .setClearValueCount((uint32_t)clears.size())
+                       .setPClearValues(clears.data());
+
+    command_buffer.beginRenderPass(begininfo, vk::SubpassContents::eInline);
+    command_buffer.setViewport(0, 1, &viewport);
+    command_buffer.setScissor(0, 1, &scissor);
+
+    // Only what differs from the previous candidate is bound again, like the shadow casters
+    uint32_t      boundinput = ~0u;
+    vk::Buffer    boundvertices;
+    vk::Buffer    boundindices;
+    vk::IndexType boundindextype = vk::IndexType::eUint32;
+
+    for (const pick_candidate& candidate : m_candidates) {
+        if (candidate.input != boundinput) {
+            command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                        m_pipelines[candidate.input]);
+            boundinput = candidate.input;
+        }
+        if (candidate.vertex_buffer != boundvertices) {
+            vk::DeviceSize offset = 0;
+            command_buffer.bindVertexBuffers(0, 1, &candidate.vertex_buffer, &offset);
+            boundvertices = candidate.vertex_buffer;
+        }
+        if (candidate.index_buffer != boundindices || candidate.index_type != boundindextype) {
+            command_buffer.bindIndexBuffer(candidate.index_buffer, 0, candidate.index_type);
+            boundindices   = candidate.index_buffer;
+            boundindextype = candidate.index_type;
+        }
+
+        // 0 is what the image is cleared to, so the IDs are one up from the objects
+        pick_constants constants;
+        constants.mvp    = t.view_projection * candidate.transform;
+        constants.object = candidate.object + 1;
+        command_buffer.pushConstants(
+          m_layout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0,
+          sizeof(constants), &constants);
+        command_buffer.drawIndexed(candidate.index_count, 1, candidate.first_index,
+                                   candidate.vertex_offset, 0);
+    }
+
+    command_buffer.endRenderPass();
+
+    auto region = vk::BufferImageCopy()
+                    .setBufferOffset(0)
+                    .setBufferRowLength(0)
+                    .setBufferImageHeight(0)
+                    .setImageSubresource(
+                      vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+                    .setImageOffset({ 0, 0, 0 })
+                    .setImageExtent({ pick_region, pick_region, 1 });
+
+    command_buffer.copyImageToBuffer(t.ids, vk::ImageLayout::eTransferSrcOptimal, t.readback,
+                                     region);
+
+    // Like frame_readback's, visible to the host once the fence signals
+    auto barrier = vk::BufferMemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                                           vk::AccessFlagBits::eHostRead, VK_QUEUE_FAMILY_IGNORED,
+                                           VK_QUEUE_FAMILY_IGNORED, t.readback, 0, VK_WHOLE_SIZE);
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(),
+                                   nullptr, barrier, nullptr);
+
+    t.recorded = true;
+}
+
+/*
+A request whose frame was never recorded goes back to the front of the queue, for the next frame
+to take. Otherwise the object nearest to the center of the region is picked, out of the part of
+the region that is inside the image, ties going to the first row and column.
+*/
+void
+object_picker::collect(uint32_t frame)
+{
+    target& t = m_targets[frame];
+    if (!t.taken) {
+        return;
+    }
+    t.taken = false;
+
+    if (!t.recorded) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_requests.push_front(std::move(t.request));
+        return;
+    }
+
+    SHINY_PROFILE_ZONE("pick collect");
+
+    const uint32_t* ids = static_cast<const uint32_t*>(t.readback_memory.mapped);
+
+    pick_result result;
+    result.x = t.request.x;
+    result.y = t.request.y;
+
+    uint32_t nearest = ~0u;
+    for (uint32_t y = 0; y < t.size.y; ++y) {
+        for (uint32_t x = 0; x < t.size.x; ++x) {
+            const uint32_t id = ids[y * pick_region + x];
+            if (id == 0) {
+                continue;
+            }
+
+            const int32_t  dx       = (int32_t)x - (int32_t)t.center.x;
+            const int32_t  dy       = (int32_t)y - (int32_t)t.center.y;
+            const uint32_t distance = (uint32_t)(dx * dx + dy * dy);
+            if (distance < nearest) {
+                nearest       = distance;
+                result.object = id - 1;
+                result.offset = std::sqrt((float)distance);
+            }
+        }
+    }
+
+    pick_callback deliver = std::move(t.request.deliver);
+    t.request             = pick_request();
+    deliver(result);
+}
+
+void
+object_picker::collectAll()
+{
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < m_targets.size(); ++i) {
+        order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(),
+              [&](uint32_t a, uint32_t b) { return m_targets[a].order < m_targets[b].order; });
+
+    for (uint32_t frame : order) {
+        collect(frame);
+    }
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "graphics/frustum_culling.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/shadow_cascades.h"
+
+#include <glm/glm.hpp>
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace shiny::graphics {
+
+// What a pick hands back where it hit nothing that can be picked
+const uint32_t pick_none = ~0u;
+
+// Pixels on each side of the square rendered around the position picked at, which is its center.
+// Whatever is nearest to the center within it is what's picked, so thin things needn't be hit
+// exactly.
+const uint32_t pick_region = 15;
+
+struct pick_result
+{
+    uint32_t object = pick_none;  // see pick_candidate
+    uint32_t x      = 0;          // the position it was asked for, in pixels of the presented image
+    uint32_t y      = 0;
+    float    offset = 0.f;  // pixels from there to where the object was hit
+};
+
+using pick_callback = std::function<void(const pick_result& result)>;
+
+// One instance drawn into the region, like a shadow_caster
+struct pick_candidate
+{
+    vk::Buffer    vertex_buffer;
+    vk::Buffer    index_buffer;
+    vk::IndexType index_type    = vk::IndexType::eUint32;
+    uint32_t      index_count   = 0;
+    uint32_t      first_index   = 0;
+    int32_t       vertex_offset = 0;
+    uint32_t      input         = 0;  // which of the vertex inputs given to init()
+    glm::mat4     transform     = glm::mat4(1.f);  // the model matrix, with any dequantize
+    uint32_t      object        = 0;  // whatever the caller tells instances apart by, not pick_none
+};
+
+/*
+Finds what is under a position without testing rays against any geometry on the CPU. The frame a
+request is taken by renders an R32_UINT image of object IDs, pick_region pixels square around the
+position, by drawing the instances whose bounds are in that region, culled against
+regionFrustum(), with their view projection cropped to it. That is the same kind of position only
+pass as the shadow casters', over a couple of hundred pixels.
+
+The image is copied into a host visible buffer at the end of the frame's command buffer, and read
+once the frame's fence has been waited on anyway, frames in flight later, when the callback is
+handed the nearest object to the center. So a pick costs the GPU next to nothing and the CPU no
+waiting at all. Every frame in flight has its own images and buffer, and takes one request at a
+time, the oldest. Requests can come from any thread; the rest is the render thread's.
+*/
+class object_picker
+{
+public:
+    // `inputs` the same position only ones the shadow casters are drawn with, by vertex format
+    void init(vk::Device                              device,
+              memory_allocator&                       allocator,
+              layout_cache&                           layouts,
+              pipeline_cache&                         pipelines,
+              const std::vector<shadow_vertex_input>& inputs,
+              uint32_t                                frames);
+
+    // Drops what hasn't been handed over
+    void destroy();
+
+    // Any thread. `deliver` is called on the render thread, frames in flight later.
+    void request(uint32_t x, uint32_t y, pick_callback deliver);
+
+    // Takes the oldest request for `frame`, if there is one, for a view that renders `extent` and
+    // presents `target`, and drops the last frame's candidates. False if there is nothing to pick.
+    bool beginFrame(uint32_t         frame,
+                    const glm::mat4& view_projection,
+                    vk::Extent2D     extent,
+                    vk::Extent2D     target);
+
+    // What the candidates of the frame beginFrame took a request for are culled against, in world
+    // space, and where those that are in it go
+    const frustum& regionFrustum() const { return m_region_frustum; }
+    void           push(const pick_candidate& candidate);
+
+    // Renders the candidates into `frame`'s image and copies it out, if it took a request. Outside
+    // of a render pass.
+    void record(vk::CommandBuffer command_buffer, uint32_t frame);
+
+    // Hands over what `frame` picked, once its fence has been waited on
+    void collect(uint32_t frame);
+
+    // The same for every frame, oldest first, once the device is idle
+    void collectAll();
+
+private:
+    struct pick_request
+    {
+        uint32_t      x = 0;
+        uint32_t      y = 0;
+        pick_callback deliver;
+    };
+
+    struct target
+    {
+        vk::Image       ids;
+        allocation      ids_memory;
+        vk::ImageView   ids_view;
+        vk::Image       depth;
+        allocation      depth_memory;
+        vk::ImageView   depth_view;
+        vk::Framebuffer framebuffer;
+        vk::Buffer      readback;  // host visible, the IDs as they were rendered
+        allocation      readback_memory;
+
+        pick_request request;
+        bool         taken    = false;  // by beginFrame
+        bool         recorded = false;
+        uint64_t     order    = 0;      // in which the requests were taken
+        glm::mat4    view_projection;   // cropped to the region
+        glm::uvec2   center;            // in the region, where the position is
+        glm::uvec2   size;              // of the region that is inside the rendered image
+    };
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::RenderPass            m_render_pass;
+    vk::PipelineLayout        m_layout;  // owned by the layout_cache
+    vk::ShaderModule          m_vertex_shader;
+    vk::ShaderModule          m_fragment_shader;
+    std::vector<vk::Pipeline> m_pipelines;  // per vertex input
+
+    std::vector<target>         m_targets;  // one per frame in flight
+    std::vector<pick_candidate> m_candidates;
+    frustum                     m_region_frustum = {};
+    uint32_t                    m_frame          = 0;  // beginFrame's
+    uint64_t                    m_taken          = 0;
+
+    std::mutex               m_mutex;
+    std::deque<pick_request> m_requests;
+};
+
+}  // namespace shiny::graphics
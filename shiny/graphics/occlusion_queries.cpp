@@ -0,0 +1,216 @@
+#include "graphics/occlusion_queries.h"
+
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+
+namespace {
+
+// The unit cube's 12 triangles, which occlusion.vert makes out of the vertex index
+const uint32_t box_vertex_count = 36;
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+occlusion_queries::init(vk::Device        device,
+                        memory_allocator& allocator,
+                        layout_cache&     layouts,
+                        uint32_t          frames,
+                        uint32_t          capacity,
+                        bool              conditional)
+{
+    m_device      = device;
+    m_allocator   = &allocator;
+    m_capacity    = capacity;
+    m_conditional = conditional;
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eVertex)
+                       .setOffset(0)
+                       .setSize(sizeof(glm::mat4));
+
+    m_layout = layouts.pipelineLayout(
+      vk::PipelineLayoutCreateInfo().setPushConstantRangeCount(1).setPPushConstantRanges(
+        &constants));
+
+    auto poolinfo =
+      vk::QueryPoolCreateInfo().setQueryType(vk::QueryType::eOcclusion).setQueryCount(capacity);
+
+    m_frames.resize(frames);
+    for (frame_queries& frame : m_frames) {
+        frame.pool = m_device.createQueryPool(poolinfo, hostAllocator());
+        frame.entries.reserve(capacity);
+    }
+    m_boxes.reserve(capacity);
+    m_previous.reserve(capacity);
+    m_passed.reserve(capacity);
+
+    if (!m_conditional) {
+        return;
+    }
+
+    // Only ever touched by the GPU, written by the copies and read by the predicates
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize((vk::DeviceSize)capacity * frames * sizeof(uint32_t))
+                        .setUsage(vk::BufferUsageFlagBits::eConditionalRenderingEXT
+                                  | vk::BufferUsageFlagBits::eTransferDst)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_results        = m_device.createBuffer(bufferinfo, hostAllocator());
+    m_results_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_results),
+                                             vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                             memory_allocator::resource_kind::linear,
+                                             memory_category::other);
+    m_device.bindBufferMemory(m_results, m_results_memory.memory, m_results_memory.offset);
+}
+
+void
+occlusion_queries::destroy()
+{
+    for (frame_queries& frame : m_frames) {
+        m_device.destroyQueryPool(frame.pool, hostAllocator());
+    }
+    m_frames.clear();
+
+    if (m_results) {
+        m_device.destroyBuffer(m_results, hostAllocator());
+        m_allocator->free(m_results_memory);
+        m_results = nullptr;
+    }
+}
+
+/*
+The frame before was submitted right before this one, so its copies are ahead of this frame's
+predicates on the queue. Without conditional rendering only this frame in flight's own queries are
+known to be done.
+*/
+void
+occlusion_queries::beginFrame(uint32_t frame)
+{
+    m_frame = frame;
+
+    const uint32_t       frames   = (uint32_t)m_frames.size();
+    const frame_queries& previous = m_frames[m_conditional ? (frame + frames - 1) % frames : frame];
+
+    m_previous.clear();
+    if (previous.recorded) {
+        m_previous.assign(previous.entries.begin(), previous.entries.end());
+    }
+
+    if (!m_conditional && !m_previous.empty()) {
+        m_passed.resize(m_previous.size());
+        const vk::Result result = m_device.getQueryPoolResults(
+          previous.pool, 0, (uint32_t)m_passed.size(), m_passed.size() * sizeof(uint32_t),
+          m_passed.data(), sizeof(uint32_t), vk::QueryResultFlags());
+        if (result != vk::Result::eSuccess) {
+            m_previous.clear();
+        }
+    }
+
+    std::sort(m_previous.begin(), m_previous.end(),
+              [](const entry& a, const entry& b) { return a.key < b.key; });
+
+    frame_queries& current = m_frames[frame];
+    current.entries.clear();
+    current.recorded = false;
+    m_boxes.clear();
+}
+
+// The submeshes of a mesh are pushed one after the other, and share its box
+void
+occlusion_queries::push(uint64_t key, const glm::mat4& box)
+{
+    std::vector<entry>& entries = m_frames[m_frame].entries;
+    if (m_boxes.size() == m_capacity || (!entries.empty() && entries.back().key == key)) {
+        return;
+    }
+
+    entry e;
+    e.key   = key;
+    e.query = (uint32_t)m_boxes.size();
+    entries.push_back(e);
+    m_boxes.push_back(box);
+}
+
+bool
+occlusion_queries::occluded(uint64_t key) const
+{
+    const entry* e = find(key);
+    return e && m_passed[e->query] == 0;
+}
+
+uint32_t
+occlusion_queries::predicate(uint64_t key) const
+{
+    const uint32_t frames = (uint32_t)m_frames.size();
+    const entry*   e      = find(key);
+    if (!e) {
+        return no_occlusion_predicate;
+    }
+
+    const uint32_t region = (m_frame + frames - 1) % frames * m_capacity;
+    return (region + e->query) * (uint32_t)sizeof(uint32_t);
+}
+
+// Which goes with the boxes being recorded, so this is where the frame's results become wanted
+void
+occlusion_queries::reset(vk::CommandBuffer command_buffer)
+{
+    if (m_boxes.empty()) {
+        return;
+    }
+
+    command_buffer.resetQueryPool(m_frames[m_frame].pool, 0, (uint32_t)m_boxes.size());
+    m_frames[m_frame].recorded = true;
+}
+
+/*
+Neither face is culled, so a box the camera is in still has its far faces drawn. Those may be hidden
+by something behind what the box holds though, so the caller doesn't query boxes that close.
+*/
+void
+occlusion_queries::record(vk::CommandBuffer command_buffer,
+                          vk::Pipeline      pipeline,
+                          const glm::mat4&  view_projection) const
+{
+    const frame_queries& frame = m_frames[m_frame];
+    if (m_boxes.empty()) {
+        return;
+    }
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    for (uint32_t i = 0; i < (uint32_t)m_boxes.size(); ++i) {
+        const glm::mat4 transform = view_projection * m_boxes[i];
+        command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eVertex, 0,
+                                     sizeof(transform), &transform);
+        command_buffer.beginQuery(frame.pool, i, vk::QueryControlFlags());
+        command_buffer.draw(box_vertex_count, 1, 0, 0);
+        command_buffer.endQuery(frame.pool, i);
+    }
+}
+
+// The queries ended with the main pass, which the copy waits for being available after
+void
+occlusion_queries::copy(vk::CommandBuffer command_buffer)
+{
+    if (m_boxes.empty()) {
+        return;
+    }
+
+    command_buffer.copyQueryPoolResults(
+      m_frames[m_frame].pool, 0, (uint32_t)m_boxes.size(), m_results,
+      (vk::DeviceSize)m_frame * m_capacity * sizeof(uint32_t), sizeof(uint32_t),
+      vk::QueryResultFlagBits::eWait);
+}
+
+const occlusion_queries::entry*
+occlusion_queries::find(uint64_t key) const
+{
+    auto it = std::lower_bound(m_previous.begin(), m_previous.end(), key,
+                               [](const entry& e, uint64_t k) { return e.key < k; });
+    return it != m_previous.end() && it->key == key ? &*it : nullptr;
+}
+
+}  // namespace shiny::graphics
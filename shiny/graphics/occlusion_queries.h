@@ -0,0 +1,112 @@
+#pragma once
+
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+// What occlusion_queries::predicate hands back for a box it has no result of
+const uint32_t no_occlusion_predicate = ~0u;
+
+/*
+Hardware occlusion queries on the bounding boxes of whatever is expensive to draw, for frames culled
+on the CPU. The boxes are drawn at the end of the main pass, with neither color nor depth writes, in
+a query each, and what they find is only used by a later frame. A box is told apart from one frame
+to the next by a key of the caller's, so anything that moved is queried as if it was new, and a box
+without a result counts as visible.
+
+With VK_EXT_conditional_rendering the sample counts are copied into a buffer after the main pass,
+and the next frame's draws are predicated on them, so those whose boxes were hidden are skipped by
+the GPU without the CPU ever seeing the counts. Without it they are read back on the CPU once the
+frame's fence has been waited on anyway, frames in flight later, and the caller leaves the hidden
+draws out. Every frame in flight has its own query pool and region of the buffer.
+*/
+class occlusion_queries
+{
+public:
+    // Up to `capacity` boxes a frame, with the results copied for conditional rendering or read
+    // back on the CPU
+    void init(vk::Device        device,
+              memory_allocator& allocator,
+              layout_cache&     layouts,
+              uint32_t          frames,
+              uint32_t          capacity,
+              bool              conditional);
+    void destroy();
+
+    // The boxes' pipeline layout, a push constant of their model view projection only. The vertex
+    // shader makes them out of nothing but the vertex index, see occlusion.vert.
+    vk::PipelineLayout layout() const { return m_layout; }
+
+    // Takes the results of the frame before with conditional rendering, or of the last time
+    // `frame` was recorded without, and drops the boxes of that one. Once the frame's fence has
+    // been waited on.
+    void beginFrame(uint32_t frame);
+
+    // Queries the box that `box` scales and places the unit cube [-1, 1] as, unless there are as
+    // many as there can be or the last box pushed had the same `key`
+    void push(uint64_t key, const glm::mat4& box);
+
+    // Whether the box of `key` was hidden the last time it was read back, without conditional
+    // rendering
+    bool occluded(uint64_t key) const;
+
+    // The offset in buffer() of the frame before's result for `key`, or no_occlusion_predicate.
+    // Only with conditional rendering.
+    uint32_t   predicate(uint64_t key) const;
+    vk::Buffer buffer() const { return m_results; }
+
+    // The boxes pushed since beginFrame
+    uint32_t count() const { return (uint32_t)m_boxes.size(); }
+
+    // Resets the frame's queries, outside of a render pass, before they are recorded
+    void reset(vk::CommandBuffer command_buffer);
+
+    // Draws the boxes with `pipeline`, made with layout(), inside the main pass
+    void record(vk::CommandBuffer command_buffer,
+                vk::Pipeline      pipeline,
+                const glm::mat4&  view_projection) const;
+
+    // Copies the frame's results into buffer() for the next one, outside of a render pass. Only
+    // with conditional rendering.
+    void copy(vk::CommandBuffer command_buffer);
+
+private:
+    struct entry
+    {
+        uint64_t key   = 0;
+        uint32_t query = 0;
+    };
+
+    struct frame_queries
+    {
+        vk::QueryPool      pool;
+        std::vector<entry> entries;           // in the order they were pushed
+        bool               recorded = false;  // reset for the entries, see reset()
+    };
+
+    const entry* find(uint64_t key) const;
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::PipelineLayout m_layout;  // owned by the layout_cache
+
+    std::vector<frame_queries> m_frames;   // one per frame in flight
+    vk::Buffer                 m_results;  // a uint32_t per query, a region per frame
+    allocation                 m_results_memory;
+    uint32_t                   m_capacity    = 0;
+    uint32_t                   m_frame       = 0;  // beginFrame's
+    bool                       m_conditional = false;
+
+    std::vector<glm::mat4> m_boxes;     // this frame's, by query
+    std::vector<entry>     m_previous;  // the results there are, sorted by key
+    std::vector<uint32_t>  m_passed;    // read back, by the previous entries' queries
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,150 @@
+#include "graphics/offscreen_target.h"
+
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+
+namespace shiny::graphics {
+
+void
+offscreen_target::init(vk::Device        device,
+                       memory_allocator& allocator,
+                       vk::Extent2D      extent,
+                       uint32_t          frames)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_extent    = extent;
+
+    auto imageinfo = vk::ImageCreateInfo()
+                       .setImageType(vk::ImageType::e2D)
+                       .setExtent(vk::Extent3D(extent.width, extent.height, 1))
+                       .setMipLevels(1)
+                       .setArrayLayers(1)
+                       .setFormat(format)
+                       .setTiling(vk::ImageTiling::eOptimal)
+                       .setInitialLayout(vk::ImageLayout::eUndefined)
+                       .setUsage(vk::ImageUsageFlagBits::eColorAttachment
+                                 | vk::ImageUsageFlagBits::eTransferSrc
+                                 | vk::ImageUsageFlagBits::eTransferDst
+                                 | vk::ImageUsageFlagBits::eSampled)
+                       .setSamples(vk::SampleCountFlagBits::e1)
+                       .setSharingMode(vk::SharingMode::eExclusive);
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize((vk::DeviceSize)extent.width * extent.height * 4)
+                        .setUsage(vk::BufferUsageFlagBits::eTransferDst)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    // Reading uncached memory is slow, so cached memory is preferred where there is any that is
+    // also coherent, which saves invalidating it
+    const vk::MemoryPropertyFlags coherent =
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+    for (uint32_t i = 0; i < frames; ++i) {
+        vk::Image image = m_device.createImage(imageinfo, hostAllocator());
+        m_image_memory.push_back(m_allocator->allocate(m_device.getImageMemoryRequirements(image),
+                                                       vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                                       memory_allocator::resource_kind::optimal,
+                                                       memory_category::render_target));
+        m_device.bindImageMemory(image, m_image_memory.back().memory,
+                                 m_image_memory.back().offset);
+        m_images.push_back(image);
+
+        readback r;
+        r.buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+
+        const vk::MemoryRequirements requirements = m_device.getBufferMemoryRequirements(r.buffer);
+
+        r.memory = m_allocator->allocate(requirements, coherent,
+                                         memory_allocator::resource_kind::linear,
+                                         memory_category::staging,
+                                         vk::MemoryPropertyFlagBits::eHostCached);
+        m_device.bindBufferMemory(r.buffer, r.memory.memory, r.memory.offset);
+        m_readbacks.push_back(r);
+    }
+}
+
+void
+offscreen_target::destroy()
+{
+    for (size_t i = 0; i < m_images.size(); ++i) {
+        m_device.destroyImage(m_images[i], hostAllocator());
+        m_allocator->free(m_image_memory[i]);
+    }
+    for (readback& r : m_readbacks) {
+        m_device.destroyBuffer(r.buffer, hostAllocator());
+        m_allocator->free(r.memory);
+    }
+    m_images.clear();
+    m_image_memory.clear();
+    m_readbacks.clear();
+}
+
+/*
+The barrier makes the copy visible to the host once the fence signals, which a fence alone doesn't
+do for device writes.
+*/
+void
+offscreen_target::recordReadback(vk::CommandBuffer command_buffer, uint32_t frame, uint64_t number)
+{
+    readback& r = m_readbacks[frame];
+
+    auto region = vk::BufferImageCopy()
+                    .setBufferOffset(0)
+                    .setBufferRowLength(0)
+                    .setBufferImageHeight(0)
+                    .setImageSubresource(
+                      vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+                    .setImageOffset({ 0, 0, 0 })
+                    .setImageExtent({ m_extent.width, m_extent.height, 1 });
+
+    command_buffer.copyImageToBuffer(m_images[frame], vk::ImageLayout::eTransferSrcOptimal,
+                                     r.buffer, region);
+
+    auto barrier = vk::BufferMemoryBarrier(vk::AccessFlagBits::eTransferWrite,
+                                           vk::AccessFlagBits::eHostRead, VK_QUEUE_FAMILY_IGNORED,
+                                           VK_QUEUE_FAMILY_IGNORED, r.buffer, 0, VK_WHOLE_SIZE);
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                   vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(),
+                                   nullptr, barrier, nullptr);
+
+    r.number  = number;
+    r.pending = true;
+}
+
+void
+offscreen_target::collect(uint32_t frame, const offscreen_callback& deliver)
+{
+    readback& r = m_readbacks[frame];
+    if (!r.pending) {
+        return;
+    }
+    r.pending = false;
+
+    offscreen_frame pixels;
+    pixels.pixels = static_cast<const uint8_t*>(r.memory.mapped);
+    pixels.width  = m_extent.width;
+    pixels.height = m_extent.height;
+    pixels.format = format;
+    pixels.number = r.number;
+    deliver(pixels);
+}
+
+void
+offscreen_target::collectAll(const offscreen_callback& deliver)
+{
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < m_readbacks.size(); ++i) {
+        order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return m_readbacks[a].number < m_readbacks[b].number;
+    });
+
+    for (uint32_t frame : order) {
+        collect(frame, deliver);
+    }
+}
+
+}  // namespace shiny::graphics
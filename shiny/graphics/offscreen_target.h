@@ -0,0 +1,75 @@
+#pragma once
+
+#include "graphics/memory_allocator.h"
+
+#include <functional>
+#include <vector>
+
+namespace shiny::graphics {
+
+// The pixels of one frame rendered offscreen. They are only valid for as long as the callback
+// they were handed to runs.
+struct offscreen_frame
+{
+    const uint8_t* pixels = nullptr;  // tightly packed rows, top to bottom, 4 bytes per pixel
+    uint32_t       width  = 0;
+    uint32_t       height = 0;
+    vk::Format     format = vk::Format::eR8G8B8A8Unorm;
+    uint64_t       number = 0;  // of the frame, counting from 0
+};
+
+using offscreen_callback = std::function<void(const offscreen_frame&)>;
+
+/*
+Color images to render into in place of a swap chain's, for rendering without a window or
+VK_KHR_swapchain, and the readback of what was rendered into them.
+
+Every frame in flight has an image and a host visible buffer of its own. The frame's command buffer
+copies the image into the buffer right after rendering it, and the buffer is only read once the
+frame's fence has been waited on anyway, before the image is rendered to again. So reading frame N
+back costs the GPU a copy at the end of it and the CPU a memcpy at most, while frame N + 1 renders.
+
+The render pass has to leave the images in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL and make its color
+writes available to transfers. They can also be transfer destinations, for frames rendered at
+another resolution and blitted to them, and sampled, for video_capture to convert them.
+*/
+class offscreen_target
+{
+public:
+    static const vk::Format format = vk::Format::eR8G8B8A8Unorm;
+
+    void init(vk::Device device, memory_allocator& allocator, vk::Extent2D extent, uint32_t frames);
+    void destroy();
+
+    vk::Extent2D                  extent() const { return m_extent; }
+    const std::vector<vk::Image>& images() const { return m_images; }  // one per frame in flight
+
+    // Copies `frame`'s image, after the render pass, into its buffer
+    void recordReadback(vk::CommandBuffer command_buffer, uint32_t frame, uint64_t number);
+
+    // Hands over whatever was last read back into `frame`'s buffer, whose fence has to have been
+    // waited on, unless it was handed over already
+    void collect(uint32_t frame, const offscreen_callback& deliver);
+
+    // The same for every frame, oldest first, once the device is idle
+    void collectAll(const offscreen_callback& deliver);
+
+private:
+    struct readback
+    {
+        vk::Buffer buffer;
+        allocation memory;
+        uint64_t   number  = 0;
+        bool       pending = false;
+    };
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+    vk::Extent2D      m_extent;
+
+    std::vector<vk::Image>  m_images;
+    std::vector<allocation> m_image_memory;
+    std::vector<readback>   m_readbacks;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,285 @@
+#include "graphics/particle_system.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+// Has to match local_size_x in particles.comp
+const uint32_t particle_group_size = 64;
+
+// The lifetimes particles.comp gives the particles are between 1.5 and 3.5 seconds, so emitting
+// the whole buffer every 2.5 seconds keeps it about full
+const float particle_mean_lifetime = 2.5f;
+
+// Longer frames are simulated as if they weren't, rather than emitting everything at once
+const float max_particle_step = 0.1f;
+
+// What particles.comp does with a dispatch, see particle_system::record
+enum class particle_phase : uint32_t
+{
+    clear,
+    emit,
+    simulate,
+    finish,
+};
+
+// The compute shader's push constants
+struct particle_constants
+{
+    glm::vec3      emitter;
+    float          delta    = 0.f;
+    uint32_t       emit     = 0;
+    particle_phase phase    = particle_phase::clear;
+    uint32_t       current  = 0;  // the half of the alive list the frame starts from
+    uint32_t       capacity = 0;
+    uint32_t       seed     = 0;
+};
+
+// The vertex shader's, with the camera's axes in world space
+struct particle_draw_constants
+{
+    glm::mat4 view_projection;
+    glm::vec4 right;  // w is the particles' size
+    glm::vec4 up;
+};
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+particle_system::init(vk::PhysicalDevice           physical_device,
+                      vk::Device                   device,
+                      memory_allocator&            allocator,
+                      layout_cache&                layouts,
+                      pipeline_cache&              pipelines,
+                      uint32_t                     max_particles,
+                      const std::vector<uint32_t>& queue_families)
+{
+    m_device        = device;
+    m_allocator     = &allocator;
+    m_max_particles = max_particles;
+    m_cleared       = false;
+    m_current       = 0;
+    m_step          = 0;
+    m_emitting      = 0.f;
+
+    // Every region is bound at its own offset, which has to be aligned
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+
+    // The counts are the two halves' and the dead list's, followed by the indirect draw
+    m_alive_offset  = alignUp(max_particles * sizeof(particle), alignment);
+    m_dead_offset   = alignUp(m_alive_offset + 2 * max_particles * sizeof(uint32_t), alignment);
+    m_counts_offset = alignUp(m_dead_offset + max_particles * sizeof(uint32_t), alignment);
+    m_size          = m_counts_offset + 4 * sizeof(uint32_t) + sizeof(vk::DrawIndirectCommand);
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(m_size)
+                        .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                  | vk::BufferUsageFlagBits::eIndirectBuffer)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+    if (queue_families.size() > 1) {
+        bufferinfo.setSharingMode(vk::SharingMode::eConcurrent)
+          .setQueueFamilyIndexCount((uint32_t)queue_families.size())
+          .setPQueueFamilyIndices(queue_families.data());
+    }
+
+    m_buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+    m_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_buffer),
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                     memory_allocator::resource_kind::linear,
+                                     memory_category::other);
+    m_device.bindBufferMemory(m_buffer, m_memory.memory, m_memory.offset);
+
+    // 0: the particles, 1: the alive list, 2: the dead list, 3: the counts and the draw. The vertex
+    // shader only reads the first two.
+    std::array<vk::DescriptorSetLayoutBinding, 4> bindings;
+    for (uint32_t i = 0; i < (uint32_t)bindings.size(); ++i) {
+        bindings[i] = vk::DescriptorSetLayoutBinding()
+                        .setBinding(i)
+                        .setDescriptorCount(1)
+                        .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                        .setStageFlags(vk::ShaderStageFlagBits::eCompute
+                                       | vk::ShaderStageFlagBits::eVertex);
+    }
+
+    auto setlayoutinfo = vk::DescriptorSetLayoutCreateInfo()
+                           .setBindingCount((uint32_t)bindings.size())
+                           .setPBindings(bindings.data());
+
+    vk::DescriptorSetLayout setlayout = layouts.descriptorSetLayout(setlayoutinfo);
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                       .setOffset(0)
+                       .setSize(sizeof(particle_constants));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setSetLayoutCount(1)
+                        .setPSetLayouts(&setlayout)
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    auto drawconstants = vk::PushConstantRange()
+                           .setStageFlags(vk::ShaderStageFlagBits::eVertex)
+                           .setOffset(0)
+                           .setSize(sizeof(particle_draw_constants));
+
+    m_draw_layout = layouts.pipelineLayout(
+      vk::PipelineLayoutCreateInfo(layoutinfo).setPPushConstantRanges(&drawconstants));
+
+    // The regions never move, so the set is written once here
+    m_descriptors.init(m_device, { { vk::DescriptorType::eStorageBuffer, 4 } }, 1);
+    m_set = m_descriptors.allocate(setlayout);
+
+    const std::array<vk::DescriptorBufferInfo, 4> regions = {
+        vk::DescriptorBufferInfo(m_buffer, 0, max_particles * sizeof(particle)),
+        vk::DescriptorBufferInfo(m_buffer, m_alive_offset, 2 * max_particles * sizeof(uint32_t)),
+        vk::DescriptorBufferInfo(m_buffer, m_dead_offset, max_particles * sizeof(uint32_t)),
+        vk::DescriptorBufferInfo(m_buffer, m_counts_offset, m_size - m_counts_offset),
+    };
+    std::array<vk::WriteDescriptorSet, 4> writes;
+    for (uint32_t i = 0; i < (uint32_t)writes.size(); ++i) {
+        writes[i] = vk::WriteDescriptorSet()
+                      .setDstSet(m_set)
+                      .setDstBinding(i)
+                      .setDescriptorCount(1)
+                      .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                      .setPBufferInfo(&regions[i]);
+    }
+    m_device.updateDescriptorSets(writes, nullptr);
+
+    core::mapped_file code("shaders/particles_comp.spv");
+
+    auto shaderinfo = vk::ShaderModuleCreateInfo()
+                        .setCodeSize(code.size())
+                        .setPCode((const uint32_t*)code.data());
+
+    m_shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+    auto pipelineinfo =
+      vk::ComputePipelineCreateInfo()
+        .setStage(vk::PipelineShaderStageCreateInfo()
+                    .setStage(vk::ShaderStageFlagBits::eCompute)
+                    .setModule(m_shader)
+                    .setPName("main"))
+        .setLayout(m_layout);
+
+    m_pipeline = m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+}
+
+void
+particle_system::destroy()
+{
+    m_device.destroyPipeline(m_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_shader, hostAllocator());
+    m_descriptors.destroy();
+
+    m_device.destroyBuffer(m_buffer, hostAllocator());
+    m_allocator->free(m_memory);
+
+    m_buffer = nullptr;
+}
+
+/*
+The phases are dispatches of the same shader, each reading what the one before wrote: the emission
+only as many invocations as particles are due, the simulation one for every particle there could
+be, since how many are alive is only known on the GPU, and the last one a single invocation that
+writes the draw and clears the half the next frame will append to.
+*/
+void
+particle_system::record(vk::CommandBuffer command_buffer, float time)
+{
+    const float delta = m_cleared ? std::clamp(time - m_time, 0.f, max_particle_step) : 0.f;
+    m_time            = time;
+
+    // Whatever doesn't make a whole particle this frame is emitted with the next ones
+    m_emitting += delta * (float)m_max_particles / particle_mean_lifetime;
+    const uint32_t emit = std::min((uint32_t)m_emitting, m_max_particles);
+    m_emitting -= (float)emit;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, 0, m_set,
+                                      nullptr);
+
+    particle_constants constants;
+    constants.emitter  = glm::vec3(0.f);
+    constants.delta    = delta;
+    constants.emit     = emit;
+    constants.current  = m_current;
+    constants.capacity = m_max_particles;
+    constants.seed     = m_step++;
+
+    auto dependency = vk::MemoryBarrier()
+                        .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                        .setDstAccessMask(vk::AccessFlagBits::eShaderRead
+                                          | vk::AccessFlagBits::eShaderWrite);
+
+    // Every dispatch after the first waits for the one before
+    bool first    = true;
+    auto dispatch = [&](particle_phase phase, uint32_t invocations) {
+        if (!first) {
+            command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                           vk::PipelineStageFlagBits::eComputeShader,
+                                           vk::DependencyFlags(), dependency, nullptr, nullptr);
+        }
+        first           = false;
+        constants.phase = phase;
+        command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                     sizeof(constants), &constants);
+        command_buffer.dispatch((invocations + particle_group_size - 1) / particle_group_size, 1,
+                                1);
+    };
+
+    // Every particle starts out dead, so the clear's draw has no instances
+    if (!m_cleared) {
+        dispatch(particle_phase::clear, m_max_particles);
+        m_cleared = true;
+        return;
+    }
+
+    if (emit > 0) {
+        dispatch(particle_phase::emit, emit);
+    }
+    dispatch(particle_phase::simulate, m_max_particles);
+    dispatch(particle_phase::finish, 1);
+
+    m_current = 1 - m_current;
+}
+
+void
+particle_system::draw(vk::CommandBuffer command_buffer,
+                      vk::Pipeline      pipeline,
+                      const glm::mat4&  view,
+                      const glm::mat4&  viewprojection) const
+{
+    // The rows of the view's rotation are the camera's axes
+    particle_draw_constants constants;
+    constants.view_projection = viewprojection;
+    constants.right           = glm::vec4(view[0][0], view[1][0], view[2][0], 0.012f);
+    constants.up              = glm::vec4(view[0][1], view[1][1], view[2][1], 0.f);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_draw_layout, 0, m_set,
+                                      nullptr);
+    command_buffer.pushConstants(m_draw_layout, vk::ShaderStageFlagBits::eVertex, 0,
+                                 sizeof(constants), &constants);
+    command_buffer.drawIndirect(m_buffer, m_counts_offset + 4 * sizeof(uint32_t), 1,
+                                sizeof(vk::DrawIndirectCommand));
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/descriptor_template.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace shiny::graphics {
+
+// One particle, laid out like the shaders' std430 Particle struct
+struct particle
+{
+    glm::vec3 position;
+    float     age = 0.f;  // in seconds, it's dead from its lifetime on
+    glm::vec3 velocity;
+    float     lifetime = 0.f;
+};
+
+static_assert(sizeof(particle) == 32, "particle has to match the shaders' layout");
+
+/*
+A fountain of particles simulated and drawn entirely on the GPU, so however many there are the CPU
+only ever works out how many to emit. Every particle is in one of two lists of indices into the
+particle buffer: the dead list, a stack the emission pops from and the simulation pushes onto, and
+the alive list, which is in two halves. The emission appends to the current half, and the
+simulation moves every particle that's still alive from it into the other one, which compacts the
+list as it goes, so the next frame only looks at particles that are alive. Its count ends up in the
+instance count of the indirect draw, whose first instance is the half's start, so the vertex
+shader finds its particle at gl_InstanceIndex of the alive list.
+
+Nothing is read back, and nothing is per frame in flight: the particles carry on from one frame to
+the next, so every frame's simulation has to be ordered after the previous frame's draw, by the
+render graph on the graphics queue or by the frame timeline on another. The buffer is shared by
+`queue_families` concurrently for the latter, rather than transferred back and forth every frame.
+*/
+class particle_system
+{
+public:
+    void init(vk::PhysicalDevice           physical_device,
+              vk::Device                   device,
+              memory_allocator&            allocator,
+              layout_cache&                layouts,
+              pipeline_cache&              pipelines,
+              uint32_t                     max_particles,
+              const std::vector<uint32_t>& queue_families);
+    void destroy();
+
+    // Records this frame's emission and simulation, outside of a render pass, with `time` the scene
+    // time in seconds. The first one clears the lists instead of simulating. The draw's reads have
+    // to be made visible after it by the render graph.
+    void record(vk::CommandBuffer command_buffer, float time);
+
+    // Draws the alive particles as camera facing quads, with a pipeline made with drawLayout()
+    // and no vertex input, blended additively and not writing depth. Inside a render pass.
+    void draw(vk::CommandBuffer command_buffer,
+              vk::Pipeline      pipeline,
+              const glm::mat4&  view,
+              const glm::mat4&  viewprojection) const;
+
+    vk::PipelineLayout drawLayout() const { return m_draw_layout; }
+    vk::Buffer         buffer() const { return m_buffer; }
+
+private:
+    vk::Device        m_device;
+    memory_allocator* m_allocator     = nullptr;
+    uint32_t          m_max_particles = 0;
+
+    // Device local: the particles, both halves of the alive list, the dead list, and the counts
+    // with the indirect draw, each at an offset of its own
+    vk::Buffer     m_buffer;
+    allocation     m_memory;
+    vk::DeviceSize m_alive_offset  = 0;
+    vk::DeviceSize m_dead_offset   = 0;
+    vk::DeviceSize m_counts_offset = 0;
+    vk::DeviceSize m_size          = 0;
+
+    descriptor_allocator m_descriptors;
+    vk::DescriptorSet    m_set;          // written once, for the compute and vertex shaders alike
+    vk::PipelineLayout   m_layout;       // owned by the layout_cache
+    vk::PipelineLayout   m_draw_layout;  // the same set, with the vertex shader's push constants
+    vk::ShaderModule     m_shader;
+    vk::Pipeline         m_pipeline;
+
+    bool     m_cleared  = false;  // the lists, by the first record()
+    uint32_t m_current  = 0;      // which half of the alive list the next record() starts from
+    uint32_t m_step     = 0;      // seeds the emission's random numbers
+    float    m_time     = 0.f;    // of the last record()
+    float    m_emitting = 0.f;    // what's left over of a particle to emit, carried over
+};
+
+}  // namespace shiny::graphics
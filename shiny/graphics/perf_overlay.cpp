@@ -0,0 +1,216 @@
+#include "graphics/perf_overlay.h"
+
+#include "graphics/debug_draw.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// The graph's bars are this wide, and this high for graph_ms
+const float bar_width    = 2.f;
+const float graph_height = 64.f;
+const float graph_ms     = 50.f;
+
+// Frame times up to these are green, then yellow, then red
+const float good_ms = 1000.f / 60.f;
+const float poor_ms = 1000.f / 30.f;
+
+// Render thread zones looked at a frame, and how many of the longest are shown
+const uint32_t recent_zones = 1024;
+const uint32_t shown_zones  = 8;
+
+// Frames between reports of the heaps, which ask the driver
+const uint32_t heap_interval = 30;
+
+const float margin = 8.f;
+
+// `bytes` as the largest unit it has at least one of
+void
+formatBytes(char* text, size_t size, double bytes)
+{
+    const char* const units[] = { "B", "KB", "MB", "GB" };
+    uint32_t          unit    = 0;
+    while (bytes >= 1024. && unit < 3) {
+        bytes /= 1024.;
+        ++unit;
+    }
+    std::snprintf(text, size, unit == 0 ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+perf_overlay::init(const sprite_atlas& atlas, uint32_t texture)
+{
+    m_atlas   = &atlas;
+    m_texture = texture;
+    m_zones.reserve(recent_zones);
+}
+
+/*
+The zones of the frame are the render thread's that began after the last call, summed by name, so
+that one called for every mesh or light adds up to its share of the frame. Nested zones are counted
+in their parents as well.
+*/
+void
+perf_overlay::recordFrame(int64_t now, uint64_t upload_bytes)
+{
+    if (m_frame_begin != 0) {
+        m_frame_ms[m_next] = (float)((double)(now - m_frame_begin) / 1e6);
+        m_uploads[m_next]  = upload_bytes;
+        m_next             = (m_next + 1) % history_size;
+        m_frames           = m_frames < history_size ? m_frames + 1 : history_size;
+
+        m_zones.clear();
+        core::threadTrack()->snapshot(m_zones, recent_zones);
+
+        m_zone_totals.clear();
+        for (const core::profile_track::zone& zone : m_zones) {
+            if (zone.begin < m_frame_begin || zone.end > now) {
+                continue;
+            }
+
+            const float milliseconds = (float)((double)(zone.end - zone.begin) / 1e6);
+            auto        total        = std::find_if(
+              m_zone_totals.begin(), m_zone_totals.end(),
+              [&](const zone_total& t) { return std::strcmp(t.name, zone.name) == 0; });
+            if (total != m_zone_totals.end()) {
+                total->milliseconds += milliseconds;
+            } else {
+                m_zone_totals.push_back({ zone.name, milliseconds });
+            }
+        }
+
+        std::sort(m_zone_totals.begin(), m_zone_totals.end(),
+                  [](const zone_total& a, const zone_total& b) {
+                      return a.milliseconds > b.milliseconds;
+                  });
+    }
+
+    m_frame_begin = now;
+}
+
+void
+perf_overlay::line(sprite_batch& sprites, const char* text, uint32_t color)
+{
+    const glm::vec2 end = sprites.text(m_pen, text, *m_atlas, m_texture, color, 1);
+    m_right             = std::max(m_right, end.x);
+    m_pen.y += (float)m_atlas->lineAdvance();
+}
+
+void
+perf_overlay::build(sprite_batch&           sprites,
+                    const gpu_profiler&     profiler,
+                    const memory_allocator& allocator,
+                    const overlay_counters& counters)
+{
+    if (m_heaps.empty() || ++m_heaps_age >= heap_interval) {
+        m_heaps     = allocator.report();
+        m_heaps_age = 0;
+    }
+
+    const uint32_t white   = debugColor(1.f, 1.f, 1.f);
+    const uint32_t heading = debugColor(1.f, 0.8f, 0.3f);
+    const uint32_t good    = debugColor(0.3f, 0.9f, 0.3f);
+    const uint32_t fair    = debugColor(0.9f, 0.8f, 0.2f);
+    const uint32_t poor    = debugColor(0.9f, 0.3f, 0.2f);
+
+    m_pen   = glm::vec2(margin * 2.f);
+    m_right = m_pen.x + bar_width * history_size;
+
+    // Oldest frame on the left
+    float    totalms      = 0.f;
+    uint64_t totaluploads = 0;
+    uint64_t peakuploads  = 0;
+    for (uint32_t i = 0; i < m_frames; ++i) {
+        const uint32_t index = (m_next + history_size - m_frames + i) % history_size;
+        const float    ms    = m_frame_ms[index];
+        const float    bar   = std::min(ms / graph_ms, 1.f) * graph_height;
+        const float    x     = m_pen.x + bar_width * (float)(history_size - m_frames + i);
+
+        sprites.sprite(glm::vec2(x, m_pen.y + graph_height - bar),
+                       glm::vec2(x + bar_width, m_pen.y + graph_height), m_atlas->white(),
+                       m_texture, ms <= good_ms ? good : ms <= poor_ms ? fair : poor, 1);
+        totalms += ms;
+        totaluploads += m_uploads[index];
+        peakuploads = std::max(peakuploads, m_uploads[index]);
+    }
+
+    // With a line at a 60 Hz frame
+    const float target = m_pen.y + graph_height * (1.f - good_ms / graph_ms);
+    sprites.sprite(glm::vec2(m_pen.x, target), glm::vec2(m_right, target + 1.f), m_atlas->white(),
+                   m_texture, debugColor(1.f, 1.f, 1.f, 0.4f), 1);
+    m_pen.y += graph_height + margin;
+
+    char        text[96];
+    const float average = m_frames > 0 ? totalms / (float)m_frames : 0.f;
+    std::snprintf(text, sizeof(text), "FRAME %6.2f MS %5.0f FPS", average,
+                  average > 0.f ? 1000.f / average : 0.f);
+    line(sprites, text, white);
+
+    line(sprites, "CPU MS", heading);
+    for (size_t i = 0; i < m_zone_totals.size() && i < shown_zones; ++i) {
+        std::snprintf(text, sizeof(text), "%-20.20s %6.2f", m_zone_totals[i].name,
+                      m_zone_totals[i].milliseconds);
+        line(sprites, text, white);
+    }
+
+    line(sprites, "GPU MS", heading);
+    for (const std::string& pass : profiler.passes()) {
+        gpu_timing timing;
+        if (profiler.timing(pass, timing)) {
+            std::snprintf(text, sizeof(text), "%-20.20s %6.2f", pass.c_str(), timing.average_ms);
+            line(sprites, text, white);
+        }
+    }
+
+    // What the main pass drew after any culling on the GPU, when the pipeline statistics say
+    line(sprites, "DRAWS", heading);
+    std::snprintf(text, sizeof(text), "%-20.20s %6u", "DRAW LIST", counters.draws);
+    line(sprites, text, white);
+    std::snprintf(text, sizeof(text), "%-20.20s %6llu", "TRIANGLES",
+                  (unsigned long long)counters.triangles);
+    line(sprites, text, white);
+    gpu_statistics statistics;
+    if (profiler.statistics("main pass", statistics)) {
+        std::snprintf(text, sizeof(text), "%-20.20s %6llu", "RASTERIZED",
+                      (unsigned long long)statistics.clipping_primitives);
+        line(sprites, text, white);
+    }
+
+    char bytes[32];
+    char peak[32];
+    formatBytes(bytes, sizeof(bytes), m_frames > 0 ? (double)totaluploads / m_frames : 0.);
+    formatBytes(peak, sizeof(peak), (double)peakuploads);
+    std::snprintf(text, sizeof(text), "UPLOADS %s A FRAME, %s PEAK", bytes, peak);
+    line(sprites, text, white);
+
+    if (counters.tracked_allocations) {
+        formatBytes(bytes, sizeof(bytes), (double)counters.allocations.bytes);
+        std::snprintf(text, sizeof(text), "ALLOCATIONS %llu A FRAME, %s",
+                      (unsigned long long)counters.allocations.allocations, bytes);
+        line(sprites, text, counters.allocations.allocations > 0 ? fair : white);
+    }
+
+    line(sprites, "MEMORY", heading);
+    for (size_t i = 0; i < m_heaps.size(); ++i) {
+        const memory_heap_report& heap = m_heaps[i];
+        char                      budget[32];
+        formatBytes(bytes, sizeof(bytes), (double)heap.usage);
+        formatBytes(budget, sizeof(budget), (double)heap.budget);
+        std::snprintf(text, sizeof(text), "HEAP %zu %-6s %s OF %s", i,
+                      heap.device_local ? "DEVICE" : "HOST", bytes, budget);
+        line(sprites, text,
+             heap.usage > heap.budget ? poor : heap.usage * 10 > heap.budget * 9 ? fair : white);
+    }
+
+    // The background, under everything above
+    sprites.sprite(glm::vec2(margin), glm::vec2(m_right + margin, m_pen.y + margin),
+                   m_atlas->white(), m_texture, debugColor(0.f, 0.f, 0.f, 0.6f), 0);
+}
+
+}  // namespace shiny::graphics
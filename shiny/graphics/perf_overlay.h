@@ -0,0 +1,79 @@
+#pragma once
+
+#include "core/alloc_tracker.h"
+#include "core/profiler.h"
+#include "graphics/gpu_profiler.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/sprite_atlas.h"
+#include "graphics/sprite_batch.h"
+
+#include <array>
+#include <vector>
+
+namespace shiny::graphics {
+
+// What the renderer counted of the frame for the overlay
+struct overlay_counters
+{
+    uint32_t draws     = 0;  // in the draw list, before any culling on the GPU
+    uint64_t triangles = 0;  // of those draws
+
+    bool               tracked_allocations = false;
+    core::alloc_counts allocations;  // by the frame before, when they are tracked
+};
+
+/*
+The live numbers of the renderer, laid out in sprites for a sprite_batch: a graph of the last
+frames' times, the CPU zones of the render thread's last frame, the GPU time of every profiled pass,
+the draw list, the uploads and heap allocations a frame and every memory heap's usage against its
+budget.
+
+Frames are recorded whether or not the overlay is built, so the graph is complete as soon as it is
+shown. Only ever on the render thread, whose zones it reads.
+*/
+class perf_overlay
+{
+public:
+    // With the font of `atlas`, whose texture is `texture` of the batch it's built into
+    void init(const sprite_atlas& atlas, uint32_t texture);
+
+    // Ends the frame that began with the last call, at `now` on the profiler's clock, which
+    // submitted `upload_bytes` of uploads
+    void recordFrame(int64_t now, uint64_t upload_bytes);
+
+    // Adds the overlay's sprites, in the top left, on layers 0 and 1
+    void build(sprite_batch&           sprites,
+               const gpu_profiler&     profiler,
+               const memory_allocator& allocator,
+               const overlay_counters& counters);
+
+private:
+    static const uint32_t history_size = 120;
+
+    struct zone_total
+    {
+        const char* name         = nullptr;
+        float       milliseconds = 0.f;
+    };
+
+    void line(sprite_batch& sprites, const char* text, uint32_t color);
+
+    const sprite_atlas* m_atlas   = nullptr;
+    uint32_t            m_texture = 0;
+
+    int64_t                                m_frame_begin = 0;
+    std::array<float, history_size>        m_frame_ms    = {};
+    std::array<uint64_t, history_size>     m_uploads     = {};
+    uint32_t                               m_next        = 0;
+    uint32_t                               m_frames      = 0;  // recorded, up to history_size
+    std::vector<core::profile_track::zone> m_zones;            // reused by recordFrame
+    std::vector<zone_total>                m_zone_totals;      // of the last frame, longest first
+
+    std::vector<memory_heap_report> m_heaps;  // refreshed every so often, not every frame
+    uint32_t                        m_heaps_age = 0;
+
+    glm::vec2 m_pen   = glm::vec2(0.f);
+    float     m_right = 0.f;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,98 @@
+#include "graphics/pipeline_cache.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// Layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE, the part every driver is required to write
+struct pipeline_cache_header
+{
+    uint32_t size;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint8_t  uuid[VK_UUID_SIZE];
+};
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+pipeline_cache::init(vk::PhysicalDevice physical_device,
+                     vk::Device         device,
+                     const std::string& directory)
+{
+    m_device     = device;
+    m_properties = physical_device.getProperties();
+
+    m_path = "pipelines_" + deviceKey(m_properties) + ".cache";
+    if (!directory.empty()) {
+        m_path = directory + "/" + m_path;
+    }
+
+    auto createinfo = vk::PipelineCacheCreateInfo();
+
+    core::mapped_file file;
+    if (file.open(m_path) && isCompatible(file.data(), file.size())) {
+        createinfo.setInitialDataSize(file.size()).setPInitialData(file.data());
+    }
+
+    m_cache = m_device.createPipelineCache(createinfo, hostAllocator());
+}
+
+void
+pipeline_cache::destroy()
+{
+    if (!m_cache) {
+        return;
+    }
+
+    std::vector<uint8_t> data = m_device.getPipelineCacheData(m_cache);
+
+    // Failing to save only means the pipelines get compiled from scratch next time
+    std::ofstream file(m_path, std::ios::binary | std::ios::trunc);
+    if (file.is_open()) {
+        file.write(reinterpret_cast<const char*>(data.data()), (std::streamsize)data.size());
+    }
+
+    m_device.destroyPipelineCache(m_cache, hostAllocator());
+    m_cache = nullptr;
+}
+
+std::string
+pipeline_cache::deviceKey(const vk::PhysicalDeviceProperties& properties)
+{
+    std::ostringstream key;
+    key << std::hex << properties.vendorID << "_" << properties.deviceID << "_"
+        << properties.driverVersion;
+    return key.str();
+}
+
+/*
+Drivers are supposed to reject data they don't recognize on their own, but not all of them do it
+gracefully, so we don't rely on it.
+*/
+bool
+pipeline_cache::isCompatible(const void* data, size_t size) const
+{
+    if (size < sizeof(pipeline_cache_header)) {
+        return false;
+    }
+
+    pipeline_cache_header header;
+    std::memcpy(&header, data, sizeof(header));
+
+    return header.size >= sizeof(pipeline_cache_header)
+           && header.version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+           && header.vendor_id == m_properties.vendorID
+           && header.device_id == m_properties.deviceID
+           && std::memcmp(header.uuid, m_properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,44 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <string>
+
+namespace shiny::graphics {
+
+/*
+A vk::PipelineCache that survives between runs. Compiling pipelines is one of the slowest things
+the driver does, and the cache lets it skip that for every pipeline it has seen before.
+
+The data is only meaningful to the exact device and driver that produced it, so the file name is
+keyed on the vendor ID, device ID and driver version, and the header the driver writes at the start
+of the data is checked against the device before it is handed back. Anything that doesn't match is
+ignored and the cache simply starts out empty.
+*/
+class pipeline_cache
+{
+public:
+    // `directory` is where the cache files live, "" for the working directory
+    void init(vk::PhysicalDevice physical_device, vk::Device device, const std::string& directory);
+
+    // Writes the cache back to disk and destroys it
+    void destroy();
+
+    vk::PipelineCache handle() const { return m_cache; }
+
+    // What the cache files are named after, which changes with the GPU and its driver
+    static std::string deviceKey(const vk::PhysicalDeviceProperties& properties);
+
+private:
+    bool isCompatible(const void* data, size_t size) const;
+
+    vk::Device                   m_device;
+    vk::PhysicalDeviceProperties m_properties;
+    vk::PipelineCache            m_cache;
+    std::string                  m_path;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,1008 @@
+#include "graphics/pipeline_library.h"
+
+#include "core/logger.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+void
+hashValue(uint64_t& hash, uint64_t value)
+{
+    hash ^= value;
+    hash *= 0x100000001b3ull;
+}
+
+// FNV-1a over the size and the bytes, like hashFileContents, but of a file that is already open
+uint64_t
+hashCode(const shiny::core::mapped_file& code)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hashValue(hash, code.size());
+
+    auto bytes = static_cast<const unsigned char*>(code.data());
+    for (size_t i = 0; i < code.size(); ++i) {
+        hashValue(hash, bytes[i]);
+    }
+    return hash;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+pipeline_state::enable(shader_feature feature, bool enabled)
+{
+    const uint32_t bit = 1u << (uint32_t)feature;
+    features           = enabled ? features | bit : features & ~bit;
+}
+
+bool
+pipeline_state::enabled(shader_feature feature) const
+{
+    return (features >> (uint32_t)feature) & 1;
+}
+
+bool
+pipeline_state::operator==(const pipeline_state& other) const
+{
+    return vertex_shader == other.vertex_shader && fragment_shader == other.fragment_shader
+           && vertex_layout == other.vertex_layout && features == other.features
+           && topology == other.topology
+           && polygon_mode == other.polygon_mode && cull_mode == other.cull_mode
+           && front_face == other.front_face && blend == other.blend
+           && color_write == other.color_write && color_attachments == other.color_attachments
+           && depth_test == other.depth_test && depth_write == other.depth_write
+           && depth_compare == other.depth_compare && depth_bounds == other.depth_bounds
+           && layout == other.layout
+           && render_pass == other.render_pass && subpass == other.subpass
+           && samples == other.samples && color_format == other.color_format
+           && depth_format == other.depth_format && view_mask == other.view_mask
+           && shading_rate == other.shading_rate
+           && shading_rate_attachment == other.shading_rate_attachment
+           && descriptor_buffer == other.descriptor_buffer;
+}
+
+// FNV-1a over the fields
+size_t
+pipeline_state_hash::operator()(const pipeline_state& state) const
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hashValue(hash, state.vertex_shader);
+    hashValue(hash, state.fragment_shader);
+    hashValue(hash, state.vertex_layout);
+    hashValue(hash, state.features);
+    hashValue(hash, (uint64_t)state.topology);
+    hashValue(hash, (uint64_t)state.polygon_mode);
+    hashValue(hash, (uint64_t)(uint32_t)state.cull_mode);
+    hashValue(hash, (uint64_t)state.front_face);
+    hashValue(hash, (uint64_t)state.blend);
+    hashValue(hash, (uint64_t)state.depth_test | (uint64_t)state.depth_write << 1
+                      | (uint64_t)state.color_write << 2 | (uint64_t)state.depth_bounds << 3);
+    hashValue(hash, state.color_attachments);
+    hashValue(hash, (uint64_t)state.depth_compare);
+    hashValue(hash, (uint64_t) static_cast<VkPipelineLayout>(state.layout));
+    hashValue(hash, (uint64_t) static_cast<VkRenderPass>(state.render_pass));
+    hashValue(hash, state.subpass);
+    hashValue(hash, (uint64_t)state.samples);
+    hashValue(hash, (uint64_t)state.color_format | (uint64_t)state.depth_format << 32);
+    hashValue(hash, state.view_mask);
+    hashValue(hash, (uint64_t)state.shading_rate | (uint64_t)state.shading_rate_attachment << 1
+                      | (uint64_t)state.descriptor_buffer << 2);
+    return (size_t)hash;
+}
+
+void
+pipeline_library::init(vk::Device      device,
+                       pipeline_cache& cache,
+                       uint32_t        compile_threads,
+                       bool            libraries)
+{
+    m_device   = device;
+    m_cache    = &cache;
+    m_stopping = false;
+#if defined(VK_EXT_graphics_pipeline_library)
+    m_libraries = libraries;
+#else
+    (void)libraries;
+#endif
+
+    for (uint32_t i = 0; i < compile_threads; ++i) {
+        m_threads.emplace_back([this]() { compileLoop(); });
+    }
+}
+
+void
+pipeline_library::destroy()
+{
+    finish();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+
+    for (auto& [state, pipeline] : m_pipelines) {
+        m_device.destroyPipeline(pipeline, hostAllocator());
+    }
+    for (vk::Pipeline pipeline : m_replaced) {
+        m_device.destroyPipeline(pipeline, hostAllocator());
+    }
+    for (pipeline_map& parts : m_parts) {
+        for (auto& [state, part] : parts) {
+            m_device.destroyPipeline(part, hostAllocator());
+        }
+        parts.clear();
+    }
+    for (const shader_module& module : m_modules) {
+        if (module.module) {
+            m_device.destroyShaderModule(module.module, hostAllocator());
+        }
+    }
+
+    m_pipelines.clear();
+    m_replaced.clear();
+    m_modules.clear();
+    m_free_modules.clear();
+    m_module_hashes.clear();
+    m_shader_modules.clear();
+    m_shader_ids.clear();
+    m_vertex_layouts.clear();
+}
+
+/*
+Each path is only ever read once, and each distinct code only ever becomes one module: a file that
+is copied, or compiled to the same code under another name, shares the module of the first one.
+The ids stay per path though, so that reloading one of the files doesn't change what the others
+are drawn with.
+*/
+uint32_t
+pipeline_library::shader(const std::string& path)
+{
+    auto found = m_shader_ids.find(path);
+    if (found != m_shader_ids.end()) {
+        return found->second;
+    }
+
+    core::mapped_file code(path);
+    const uint64_t    hash = hashCode(code);
+
+    uint32_t module = findModule(hash);
+    if (module == no_module) {
+        shader_reflection reflection;
+        if (!reflectShader((const uint32_t*)code.data(), code.size(), reflection)) {
+            throw std::runtime_error("failed to reflect shader " + path + "!");
+        }
+        module = createModule(code, hash, std::move(reflection));
+    }
+
+    const uint32_t id = (uint32_t)m_shader_modules.size();
+    m_shader_modules.push_back(module);
+    m_shader_ids.emplace(path, id);
+    return id;
+}
+
+uint32_t
+pipeline_library::findModule(uint64_t hash)
+{
+    auto found = m_module_hashes.find(hash);
+    if (found == m_module_hashes.end()) {
+        return no_module;
+    }
+    ++m_modules[found->second].references;
+    return found->second;
+}
+
+/*
+Creating a shader module is simple, we only need to specify a pointer to the buffer with the
+bytecode and the length of it. The bytecode pointer is a uint32_t pointer, and the data is a mapped
+view of the file, which always starts at a page boundary, so it is suitably aligned.
+*/
+uint32_t
+pipeline_library::createModule(const core::mapped_file& code,
+                               uint64_t                 hash,
+                               shader_reflection&&      reflection)
+{
+    auto createinfo = vk::ShaderModuleCreateInfo()
+                        .setCodeSize(code.size())
+                        .setPCode((const uint32_t*)code.data());
+
+    shader_module created;
+    if (!(created.module = m_device.createShaderModule(createinfo, hostAllocator()))) {
+        throw std::runtime_error("failed to create shader module!");
+    }
+    created.reflection = std::move(reflection);
+    created.hash       = hash;
+    created.references = 1;
+
+    uint32_t module;
+    if (!m_free_modules.empty()) {
+        module = m_free_modules.back();
+        m_free_modules.pop_back();
+        m_modules[module] = std::move(created);
+    } else {
+        module = (uint32_t)m_modules.size();
+        m_modules.push_back(std::move(created));
+    }
+    m_module_hashes.emplace(hash, module);
+    return module;
+}
+
+// Pipelines don't need their shader modules once they are created, only the compiles do
+void
+pipeline_library::releaseModule(uint32_t module)
+{
+    shader_module& released = m_modules[module];
+    if (--released.references > 0) {
+        return;
+    }
+
+    m_device.destroyShaderModule(released.module, hostAllocator());
+    m_module_hashes.erase(released.hash);
+    released = shader_module();
+    m_free_modules.push_back(module);
+}
+
+std::vector<std::string>
+pipeline_library::shaderPaths() const
+{
+    std::vector<std::string> paths;
+    for (const auto& [path, id] : m_shader_ids) {
+        paths.push_back(path);
+    }
+    return paths;
+}
+
+/*
+The old module can go right away if no other path shares it, as soon as the compiles still using
+it are done. A file that was saved without changing, or changed back to code some other path has,
+doesn't get a module of its own.
+*/
+bool
+pipeline_library::reloadShader(const std::string& path)
+{
+    auto found = m_shader_ids.find(path);
+    if (found == m_shader_ids.end()) {
+        return false;
+    }
+
+    core::mapped_file code;
+    if (!code.open(path) || code.empty()) {
+        return false;
+    }
+
+    const uint32_t id   = found->second;
+    const uint32_t old  = m_shader_modules[id];
+    const uint64_t hash = hashCode(code);
+    if (hash == m_modules[old].hash) {
+        return true;
+    }
+
+    shader_reflection reflection;
+    if (!reflectShader((const uint32_t*)code.data(), code.size(), reflection)) {
+        return false;
+    }
+    if (!(reflection == m_modules[old].reflection)) {
+        core::logWarning() << "Not reloading " << path
+                           << ", its bindings, push constants or inputs changed";
+        return false;
+    }
+
+    uint32_t module = findModule(hash);
+    if (module == no_module) {
+        try {
+            module = createModule(code, hash, std::move(reflection));
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    finish();
+
+    // Libraries are never bound, so they can go right away too
+    destroyParts(pre_rasterization_part,
+                 [&](const pipeline_state& part) { return part.vertex_shader == id; });
+    destroyParts(fragment_shader_part,
+                 [&](const pipeline_state& part) { return part.fragment_shader == id; });
+
+    releaseModule(old);
+    m_shader_modules[id] = module;
+
+    for (const auto& [state, pipeline] : m_pipelines) {
+        if (state.vertex_shader == id || state.fragment_shader == id) {
+            enqueue(state, true);
+        }
+    }
+    return true;
+}
+
+uint32_t
+pipeline_library::vertexLayout(const vk::VertexInputBindingDescription*   bindings,
+                               uint32_t                                   binding_count,
+                               const vk::VertexInputAttributeDescription* attributes,
+                               uint32_t                                   count)
+{
+    for (uint32_t id = 0; id < (uint32_t)m_vertex_layouts.size(); ++id) {
+        const vertex_layout& layout = m_vertex_layouts[id];
+        if (std::equal(layout.bindings.begin(), layout.bindings.end(), bindings,
+                       bindings + binding_count)
+            && std::equal(layout.attributes.begin(), layout.attributes.end(), attributes,
+                          attributes + count)) {
+            return id;
+        }
+    }
+
+    m_vertex_layouts.push_back(
+      { { bindings, bindings + binding_count }, { attributes, attributes + count } });
+    return (uint32_t)m_vertex_layouts.size() - 1;
+}
+
+vk::Pipeline
+pipeline_library::get(const pipeline_state& state)
+{
+    auto found = m_pipelines.find(state);
+    if (found != m_pipelines.end()) {
+        return found->second;
+    }
+
+    warm({ state });
+    return m_pipelines.at(state);
+}
+
+vk::Pipeline
+pipeline_library::request(const pipeline_state& state, vk::Pipeline fallback)
+{
+    auto found = m_pipelines.find(state);
+    if (found != m_pipelines.end()) {
+        return found->second;
+    }
+
+    for (const std::unique_ptr<pending_pipeline>& pending : m_pending) {
+        if (pending->state == state) {
+            return fallback;
+        }
+    }
+
+    // Linked without optimizing for now, and replaced by the optimized link once that's done
+    if (m_libraries && hasParts(state)) {
+        build_info info;
+        build(state, m_vertex_layouts[state.vertex_layout], info);
+
+        vk::Pipeline linked;
+        if (linkLibraries(state, info, false, linked) == vk::Result::eSuccess) {
+            m_pipelines.emplace(state, linked);
+            enqueue(state, true);
+            return linked;
+        }
+    }
+
+    enqueue(state, false);
+    return fallback;
+}
+
+void
+pipeline_library::enqueue(const pipeline_state& state, bool replaces)
+{
+    auto pending      = std::make_unique<pending_pipeline>();
+    pending->state    = state;
+    pending->layout   = m_vertex_layouts[state.vertex_layout];
+    pending->replaces = replaces;
+    build(state, pending->layout, pending->info);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(pending.get());
+        m_pending.push_back(std::move(pending));
+    }
+    m_wake.notify_one();
+}
+
+/*
+The pipeline cache lets the driver skip compiling anything it has compiled before, on this run or
+an earlier one, and handing it every new pipeline at once lets it compile them in parallel.
+*/
+void
+pipeline_library::warm(const std::vector<pipeline_state>& states)
+{
+    std::vector<pipeline_state> missing;
+    for (const pipeline_state& state : states) {
+        if (m_pipelines.find(state) == m_pipelines.end()
+            && std::find(missing.begin(), missing.end(), state) == missing.end()) {
+            missing.push_back(state);
+        }
+    }
+
+    if (missing.empty()) {
+        return;
+    }
+
+    // The create infos point into their build_info, so these can't move once built
+    std::vector<build_info>                     infos(missing.size());
+    std::vector<vk::GraphicsPipelineCreateInfo> createinfos;
+    createinfos.reserve(missing.size());
+
+    for (size_t i = 0; i < missing.size(); ++i) {
+        build(missing[i], m_vertex_layouts[missing[i].vertex_layout], infos[i]);
+        createinfos.push_back(infos[i].pipeline);
+    }
+
+    // One at a time, but their parts are there for the variants after them
+    if (m_libraries) {
+        for (size_t i = 0; i < missing.size(); ++i) {
+            vk::Pipeline linked;
+            if (linkLibraries(missing[i], infos[i], true, linked) != vk::Result::eSuccess) {
+                throw std::runtime_error("failed to link graphics pipeline!");
+            }
+            m_pipelines.emplace(missing[i], linked);
+        }
+        return;
+    }
+
+    std::vector<vk::Pipeline> pipelines =
+      m_device.createGraphicsPipelines(m_cache->handle(), createinfos, hostAllocator());
+
+    for (size_t i = 0; i < missing.size(); ++i) {
+        m_pipelines.emplace(missing[i], pipelines[i]);
+    }
+}
+
+void
+pipeline_library::update()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        pending_pipeline& pending = **it;
+        if (!pending.done) {
+            ++it;
+            continue;
+        }
+
+        // A reloaded shader that doesn't compile leaves the pipeline as it was, so fixing it and
+        // saving again carries on, and an optimized link that fails leaves the quick one
+        if (pending.result != vk::Result::eSuccess && pending.replaces) {
+            core::logWarning() << "Failed to recompile a pipeline, keeping the one there is";
+            it = m_pending.erase(it);
+            continue;
+        }
+        if (pending.result != vk::Result::eSuccess) {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+
+        // warm() or get() may have compiled the same state in the meantime
+        auto [existing, added] = m_pipelines.emplace(pending.state, pending.pipeline);
+        if (!added && pending.replaces) {
+            m_replaced.push_back(existing->second);
+            existing->second = pending.pipeline;
+        } else if (!added) {
+            m_device.destroyPipeline(pending.pipeline, hostAllocator());
+        }
+        it = m_pending.erase(it);
+    }
+}
+
+void
+pipeline_library::finish()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this]() {
+            return std::all_of(m_pending.begin(), m_pending.end(),
+                               [](const std::unique_ptr<pending_pipeline>& p) { return p->done; });
+        });
+    }
+
+    update();
+}
+
+bool
+pipeline_library::compiling()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_pending.empty();
+}
+
+void
+pipeline_library::retireReplaced(deletion_queue& deletions, uint64_t frame)
+{
+    for (vk::Pipeline pipeline : m_replaced) {
+        deletions.push(frame, pipeline);
+    }
+    m_replaced.clear();
+}
+
+// Compiles that are still going reference the render pass too, so they are waited for
+void
+pipeline_library::retire(vk::RenderPass render_pass, deletion_queue& deletions, uint64_t frame)
+{
+    finish();
+    retireReplaced(deletions, frame);
+
+    for (uint32_t part : { pre_rasterization_part, fragment_shader_part, fragment_output_part }) {
+        destroyParts(part, [&](const pipeline_state& p) { return p.render_pass == render_pass; });
+    }
+
+    for (auto it = m_pipelines.begin(); it != m_pipelines.end();) {
+        if (it->first.render_pass == render_pass) {
+            deletions.push(frame, it->second);
+            it = m_pipelines.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void
+pipeline_library::compileLoop()
+{
+    for (;;) {
+        pending_pipeline* pending = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+
+            if (m_queue.empty()) {
+                return;
+            }
+            pending = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        // The layout, render pass and shader modules all outlive the compile: retire() and
+        // destroy() wait for it before anything it uses can go
+        vk::Pipeline pipeline;
+        vk::Result   result;
+        if (m_libraries) {
+            result = linkLibraries(pending->state, pending->info, true, pipeline);
+        } else {
+            result = m_device.createGraphicsPipelines(m_cache->handle(), 1, &pending->info.pipeline,
+                                                      hostAllocator(), &pipeline);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            pending->pipeline = pipeline;
+            pending->result   = result;
+            pending->done     = true;
+        }
+        m_idle.notify_all();
+    }
+}
+
+pipeline_state
+pipeline_library::partState(const pipeline_state& state, uint32_t part)
+{
+    pipeline_state p;
+    p.features          = 0;
+    p.descriptor_buffer = state.descriptor_buffer;
+
+    switch (part) {
+        case vertex_input_part:
+            p.vertex_layout = state.vertex_layout;
+            p.topology      = state.topology;
+            break;
+        case pre_rasterization_part:
+            p.vertex_shader = state.vertex_shader;
+            p.features      = state.features;
+            p.polygon_mode  = state.polygon_mode;
+            p.cull_mode     = state.cull_mode;
+            p.front_face    = state.front_face;
+            p.layout        = state.layout;
+            p.render_pass   = state.render_pass;
+            p.subpass       = state.subpass;
+            p.color_format  = state.color_format;
+            p.depth_format  = state.depth_format;
+            p.view_mask     = state.view_mask;
+            p.shading_rate  = state.shading_rate;
+
+            p.shading_rate_attachment = state.shading_rate_attachment;
+            break;
+        case fragment_shader_part:
+            p.fragment_shader = state.fragment_shader;
+            p.features        = state.features;
+            p.depth_test      = state.depth_test;
+            p.depth_write     = state.depth_write;
+            p.depth_compare   = state.depth_compare;
+            p.depth_bounds    = state.depth_bounds;
+            p.samples         = state.samples;
+            p.layout          = state.layout;
+            p.render_pass     = state.render_pass;
+            p.subpass         = state.subpass;
+            p.color_format    = state.color_format;
+            p.depth_format    = state.depth_format;
+            p.view_mask       = state.view_mask;
+            p.shading_rate    = state.shading_rate;
+
+            p.shading_rate_attachment = state.shading_rate_attachment;
+            break;
+        case fragment_output_part:
+            p.blend             = state.blend;
+            p.color_write       = state.color_write;
+            p.color_attachments = state.color_attachments;
+            p.samples           = state.samples;
+            p.render_pass       = state.render_pass;
+            p.subpass           = state.subpass;
+            p.color_format      = state.color_format;
+            p.depth_format      = state.depth_format;
+            p.view_mask         = state.view_mask;
+            break;
+    }
+    return p;
+}
+
+bool
+pipeline_library::hasParts(const pipeline_state& state)
+{
+    std::lock_guard<std::mutex> lock(m_parts_mutex);
+    for (uint32_t part = 0; part < library_part_count; ++part) {
+        if (m_parts[part].find(partState(state, part)) == m_parts[part].end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Predicate>
+void
+pipeline_library::destroyParts(uint32_t part, Predicate matches)
+{
+    std::lock_guard<std::mutex> lock(m_parts_mutex);
+    for (auto it = m_parts[part].begin(); it != m_parts[part].end();) {
+        if (matches(it->first)) {
+            m_device.destroyPipeline(it->second, hostAllocator());
+            it = m_parts[part].erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/*
+Each part gets just the state its library flag says it takes from the full create info. They keep
+what link time optimization needs, so linking them can still optimize across the stages. Two
+threads may compile the same part at once, in which case the second one is destroyed again.
+*/
+vk::Result
+pipeline_library::createPart(const pipeline_state& state, uint32_t part, const build_info& info)
+{
+#if defined(VK_EXT_graphics_pipeline_library)
+    const pipeline_state key = partState(state, part);
+    {
+        std::lock_guard<std::mutex> lock(m_parts_mutex);
+        if (m_parts[part].find(key) != m_parts[part].end()) {
+            return vk::Result::eSuccess;
+        }
+    }
+
+    static const vk::GraphicsPipelineLibraryFlagBitsEXT flags[library_part_count] = {
+        vk::GraphicsPipelineLibraryFlagBitsEXT::eVertexInputInterface,
+        vk::GraphicsPipelineLibraryFlagBitsEXT::ePreRasterizationShaders,
+        vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentShader,
+        vk::GraphicsPipelineLibraryFlagBitsEXT::eFragmentOutputInterface,
+    };
+    // In front of the attachment formats, for parts without a render pass
+    auto library = vk::GraphicsPipelineLibraryCreateInfoEXT().setFlags(flags[part]);
+    library.pNext = info.pipeline.pNext;
+
+    auto createinfo = vk::GraphicsPipelineCreateInfo().setPNext(&library).setFlags(
+      vk::PipelineCreateFlagBits::eLibraryKHR
+      | vk::PipelineCreateFlagBits::eRetainLinkTimeOptimizationInfoEXT);
+#if defined(VK_EXT_descriptor_buffer)
+    // Every part or none
+    if (state.descriptor_buffer) {
+        createinfo.flags |= vk::PipelineCreateFlagBits::eDescriptorBufferEXT;
+    }
+#endif
+
+    switch (part) {
+        case vertex_input_part:
+            createinfo.setPVertexInputState(&info.vertex_input)
+              .setPInputAssemblyState(&info.input_assembly);
+            break;
+        case pre_rasterization_part:
+            createinfo.setStageCount(1)
+              .setPStages(&info.stages[0])
+              .setPViewportState(&info.viewport)
+              .setPRasterizationState(&info.rasterizer)
+              .setPDynamicState(&info.dynamic)
+              .setLayout(state.layout)
+              .setRenderPass(state.render_pass)
+              .setSubpass(state.subpass);
+            createinfo.flags |= info.pipeline.flags;
+            break;
+        case fragment_shader_part:
+            // The shading rate is state of both this part and the one before, the depth bounds of
+            // this one only
+            createinfo.setStageCount(1)
+              .setPStages(&info.stages[1])
+              .setPMultisampleState(&info.multisampling)
+              .setPDepthStencilState(&info.depth_stencil)
+              .setPDynamicState(state.shading_rate || state.depth_bounds ? &info.dynamic : nullptr)
+              .setLayout(state.layout)
+              .setRenderPass(state.render_pass)
+              .setSubpass(state.subpass);
+            createinfo.flags |= info.pipeline.flags;
+            break;
+        case fragment_output_part:
+            createinfo.setPColorBlendState(&info.blending)
+              .setPMultisampleState(&info.multisampling)
+              .setRenderPass(state.render_pass)
+              .setSubpass(state.subpass);
+            break;
+    }
+
+    vk::Pipeline     pipeline;
+    const vk::Result result = m_device.createGraphicsPipelines(m_cache->handle(), 1, &createinfo,
+                                                               hostAllocator(), &pipeline);
+    if (result != vk::Result::eSuccess) {
+        return result;
+    }
+
+    std::lock_guard<std::mutex> lock(m_parts_mutex);
+    if (!m_parts[part].emplace(key, pipeline).second) {
+        m_device.destroyPipeline(pipeline, hostAllocator());
+    }
+    return vk::Result::eSuccess;
+#else
+    (void)state;
+    (void)part;
+    (void)info;
+    return vk::Result::eErrorFeatureNotPresent;
+#endif
+}
+
+// The parts can't be destroyed while this runs: that only happens once every compile is done
+vk::Result
+pipeline_library::linkLibraries(const pipeline_state& state,
+                                const build_info&     info,
+                                bool                  optimize,
+                                vk::Pipeline&         pipeline)
+{
+#if defined(VK_EXT_graphics_pipeline_library)
+    std::array<vk::Pipeline, library_part_count> parts;
+    for (uint32_t part = 0; part < library_part_count; ++part) {
+        const vk::Result result = createPart(state, part, info);
+        if (result != vk::Result::eSuccess) {
+            return result;
+        }
+
+        std::lock_guard<std::mutex> lock(m_parts_mutex);
+        parts[part] = m_parts[part].at(partState(state, part));
+    }
+
+    auto libraries = vk::PipelineLibraryCreateInfoKHR()
+                       .setLibraryCount((uint32_t)parts.size())
+                       .setPLibraries(parts.data());
+
+    auto createinfo = vk::GraphicsPipelineCreateInfo()
+                        .setPNext(&libraries)
+                        .setFlags(info.pipeline.flags)
+                        .setLayout(state.layout);
+    if (optimize) {
+        createinfo.flags |= vk::PipelineCreateFlagBits::eLinkTimeOptimizationEXT;
+    }
+
+    return m_device.createGraphicsPipelines(m_cache->handle(), 1, &createinfo, hostAllocator(),
+                                            &pipeline);
+#else
+    (void)state;
+    (void)info;
+    (void)optimize;
+    (void)pipeline;
+    return vk::Result::eErrorFeatureNotPresent;
+#endif
+}
+
+void
+pipeline_library::build(const pipeline_state& state,
+                        const vertex_layout&  layout,
+                        build_info&           info) const
+{
+    // Every feature goes to both stages, and each only picks up the constants it declares
+    for (uint32_t i = 0; i < shader_feature_count; ++i) {
+        info.constants[i]        = state.enabled((shader_feature)i) ? VK_TRUE : VK_FALSE;
+        info.constant_entries[i] = vk::SpecializationMapEntry()
+                                     .setConstantID(i)
+                                     .setOffset(i * (uint32_t)sizeof(vk::Bool32))
+                                     .setSize(sizeof(vk::Bool32));
+    }
+    info.specialization = vk::SpecializationInfo()
+                            .setMapEntryCount((uint32_t)info.constant_entries.size())
+                            .setPMapEntries(info.constant_entries.data())
+                            .setDataSize(sizeof(info.constants))
+                            .setPData(info.constants.data());
+
+    info.stages[0] = vk::PipelineShaderStageCreateInfo()
+                       .setStage(vk::ShaderStageFlagBits::eVertex)
+                       .setModule(m_modules[m_shader_modules[state.vertex_shader]].module)
+                       .setPName("main")  // this is the main entry point of the shader
+                       .setPSpecializationInfo(&info.specialization);
+
+    info.stages[1] = vk::PipelineShaderStageCreateInfo()
+                       .setStage(vk::ShaderStageFlagBits::eFragment)
+                       .setModule(m_modules[m_shader_modules[state.fragment_shader]].module)
+                       .setPName("main")
+                       .setPSpecializationInfo(&info.specialization);
+
+    // The VkPipelineVertexInputStateCreateInfo structure describes the format of the vertex data
+    // that will be passed to the vertex shader. It describes this in roughly two ways:
+    //  - Bindings: spacing between data and whether the data is per-vertex or per-instance (see
+    //    instancing)
+    //  - Attribute descriptions: type of the attributes passed to the vertex shader,
+    //    which binding to load them from and at which offset
+    // A layout without attributes is for shaders that fetch their vertices themselves, which have
+    // nothing bound at all.
+    info.vertex_input =
+      vk::PipelineVertexInputStateCreateInfo()
+        .setVertexBindingDescriptionCount(
+          layout.attributes.empty() ? 0 : (uint32_t)layout.bindings.size())
+        .setPVertexBindingDescriptions(layout.bindings.data())
+        .setVertexAttributeDescriptionCount((uint32_t)layout.attributes.size())
+        .setPVertexAttributeDescriptions(layout.attributes.data());
+
+    // The VkPipelineInputAssemblyStateCreateInfo struct describes two things: what kind of geometry
+    // will be drawn from the vertices and if primitive restart should be enabled.
+    info.input_assembly = vk::PipelineInputAssemblyStateCreateInfo()
+                            .setTopology(state.topology)
+                            .setPrimitiveRestartEnable(false);
+
+    // A viewport basically describes the region of the framebuffer that the output will be rendered
+    // to, and scissor rectangles define in which regions pixels will actually be stored. Both
+    // depend on the swap chain extent, so they are dynamic state (see below) and set by
+    // recordDraws instead. That way resizing the window doesn't invalidate the pipeline.
+    info.viewport = vk::PipelineViewportStateCreateInfo().setViewportCount(1).setScissorCount(1);
+
+    // The rasterizer takes the geometry that is shaped by the vertices from the vertex shader and
+    // turns it into fragments to be colored by the fragment shader. It also performs depth testing,
+    // face culling and the scissor test, and it can be configured to output fragments that fill
+    // entire polygons or just the edges (wireframe rendering).
+    // Using any polygon mode other than fill requires enabling the fillModeNonSolid GPU feature.
+    info.rasterizer = vk::PipelineRasterizationStateCreateInfo()
+                        .setDepthClampEnable(false)
+                        .setRasterizerDiscardEnable(false)
+                        .setPolygonMode(state.polygon_mode)
+                        .setLineWidth(1.f)
+                        .setCullMode(state.cull_mode)
+                        .setFrontFace(state.front_face)
+                        .setDepthBiasEnable(false);
+
+    // Multisampling is one of the ways to perform anti-aliasing. Without sample shading, which
+    // would need a GPU feature, the fragment shader still only runs once per pixel and only the
+    // coverage and depth tests are per sample, which is what keeps it cheap.
+    info.multisampling = vk::PipelineMultisampleStateCreateInfo()
+                           .setSampleShadingEnable(false)
+                           .setRasterizationSamples(state.samples);
+
+    // The depthTestEnable field specifies if the depth of new fragments should be compared to the
+    // depth buffer to see if they should be discarded. The depthWriteEnable field specifies if the
+    // new depth of fragments that pass the depth test should actually be written to the depth
+    // buffer. This is useful for drawing transparent objects. They should be compared to the
+    // previously rendered opaque objects, but not cause further away transparent objects to not be
+    // drawn. The depth bounds test discards fragments where the depth already in the attachment,
+    // rather than their own, is outside the bounds, which are set while recording.
+    info.depth_stencil = vk::PipelineDepthStencilStateCreateInfo()
+                           .setDepthTestEnable(state.depth_test)
+                           .setDepthWriteEnable(state.depth_write)
+                           .setDepthCompareOp(state.depth_compare)
+                           .setDepthBoundsTestEnable(state.depth_bounds)
+                           .setMinDepthBounds(0.0f)
+                           .setMaxDepthBounds(1.0f)
+                           .setStencilTestEnable(false);
+
+    // After a fragment shader has returned a color, it needs to be combined with the color that is
+    // already in the framebuffer. This transformation is known as color blending. Depth only
+    // passes write none of it, and their fragment shaders needn't return one.
+    const vk::ColorComponentFlags colorwrites =
+      state.color_write ? vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG
+                            | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA
+                        : vk::ColorComponentFlags();
+
+    vk::PipelineColorBlendAttachmentState& blend = info.blend_attachments[0];
+
+    blend = vk::PipelineColorBlendAttachmentState()
+              .setColorWriteMask(colorwrites)
+              .setBlendEnable(state.blend != blend_mode::opaque)
+              .setColorBlendOp(vk::BlendOp::eAdd)
+              .setAlphaBlendOp(vk::BlendOp::eAdd);
+
+    switch (state.blend) {
+        case blend_mode::opaque:
+            break;
+        case blend_mode::alpha:
+            blend.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+              .setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
+              .setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
+              .setDstAlphaBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha);
+            break;
+        case blend_mode::additive:
+            blend.setSrcColorBlendFactor(vk::BlendFactor::eOne)
+              .setDstColorBlendFactor(vk::BlendFactor::eOne)
+              .setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
+              .setDstAlphaBlendFactor(vk::BlendFactor::eOne);
+            break;
+    }
+
+    // Every attachment of the subpass the same way, the G-buffer's included
+    assert(state.color_attachments <= max_color_attachments);
+    for (uint32_t i = 1; i < state.color_attachments; ++i) {
+        info.blend_attachments[i] = blend;
+    }
+
+    info.blending = vk::PipelineColorBlendStateCreateInfo()
+                      .setLogicOpEnable(false)
+                      .setAttachmentCount(state.color_attachments)
+                      .setPAttachments(info.blend_attachments.data());
+
+    // This will cause the configuration of these values to be ignored and you will be required to
+    // specify the data at drawing time.
+    info.dynamic_states = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    uint32_t dynamiccount = 2;
+#if defined(VK_KHR_fragment_shading_rate)
+    if (state.shading_rate) {
+        info.dynamic_states[dynamiccount++] = vk::DynamicState::eFragmentShadingRateKHR;
+    }
+#endif
+    if (state.depth_bounds) {
+        info.dynamic_states[dynamiccount++] = vk::DynamicState::eDepthBounds;
+    }
+
+    info.dynamic = vk::PipelineDynamicStateCreateInfo()
+                     .setDynamicStateCount(dynamiccount)
+                     .setPDynamicStates(info.dynamic_states.data());
+
+    // It is also possible to use other render passes with this pipeline instead of this specific
+    // instance, but they have to be compatible with it. The requirements for compatibility are
+    // described
+    // https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#renderpass-compatibility
+    info.pipeline = vk::GraphicsPipelineCreateInfo()
+                      .setStageCount((uint32_t)info.stages.size())
+                      .setPStages(info.stages.data())
+                      .setPVertexInputState(&info.vertex_input)
+                      .setPInputAssemblyState(&info.input_assembly)
+                      .setPViewportState(&info.viewport)
+                      .setPRasterizationState(&info.rasterizer)
+                      .setPMultisampleState(&info.multisampling)
+                      .setPColorBlendState(&info.blending)
+                      .setPDepthStencilState(&info.depth_stencil)
+                      .setPDynamicState(&info.dynamic)
+                      .setLayout(state.layout)
+                      .setRenderPass(state.render_pass)
+                      .setSubpass(state.subpass);
+
+    // Without a render pass the attachments' formats are all the pipeline needs to know about them
+#if defined(VK_KHR_dynamic_rendering)
+    if (!state.render_pass) {
+        info.color_format = state.color_format;
+        info.rendering    = vk::PipelineRenderingCreateInfoKHR()
+                           .setColorAttachmentCount(1)
+                           .setPColorAttachmentFormats(&info.color_format)
+                           .setDepthAttachmentFormat(state.depth_format)
+                           .setViewMask(state.view_mask);
+        info.pipeline.setPNext(&info.rendering);
+    }
+#endif
+#if defined(VK_KHR_dynamic_rendering) && defined(VK_KHR_fragment_shading_rate)
+    if (!state.render_pass && state.shading_rate_attachment) {
+        info.pipeline.flags |=
+          vk::PipelineCreateFlagBits::eRenderingFragmentShadingRateAttachmentKHR;
+    }
+#endif
+#if defined(VK_EXT_descriptor_buffer)
+    if (state.descriptor_buffer) {
+        info.pipeline.flags |= vk::PipelineCreateFlagBits::eDescriptorBufferEXT;
+    }
+#endif
+}
+
+}  // namespace shiny::graphics
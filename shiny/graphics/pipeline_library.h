@@ -0,0 +1,333 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include "core/mapped_file.h"
+#include "graphics/deletion_queue.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/shader_reflection.h"
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace shiny::graphics {
+
+enum class blend_mode : uint8_t
+{
+    opaque,    // written as is
+    alpha,     // src * a + dst * (1 - a)
+    additive,  // src + dst
+};
+
+/*
+Permutations of the shaders, which are compiled into the pipeline as specialization constants
+rather than branched on at runtime, so the driver drops the code of whichever are off. Each is a
+bool constant whose constant_id is its number here; shaders that don't declare one aren't affected
+by it.
+*/
+enum class shader_feature : uint32_t
+{
+    texture,       // sample the texture, otherwise the color is white
+    vertex_color,  // multiply by the vertex colors, which materials put their diffuse colors in
+    alpha_test,    // discard fragments less than half opaque
+    texcoords,     // draw the texture coordinates instead, for checking them
+    lighting,      // light the color by the lights of the fragment's cluster, see light_culling
+    shadows,       // and by the directional light, where it isn't shadowed, see shadow_cascades
+    gbuffer,       // write the unlit color and the normal for the deferred lighting instead
+    reflections,   // add what the surface reflects of the nearest probe, see reflection_probes
+};
+
+const uint32_t shader_feature_count = 8;
+
+// Of a subpass, the most is the G-buffer's, see renderer::setDeferredShading
+const uint32_t max_color_attachments = 2;
+
+/*
+Everything a graphics pipeline is built from. Shaders and vertex layouts are ids handed out by the
+pipeline_library, so the whole description is a few dozen bytes that hash and compare quickly.
+
+Viewport and scissor are dynamic state and not part of it, and so are the fragment shading rate of
+pipelines with `shading_rate` and the depth bounds of those with `depth_bounds`, which needs the
+depthBounds feature.
+*/
+struct pipeline_state
+{
+    uint32_t vertex_shader   = 0;  // from pipeline_library::shader
+    uint32_t fragment_shader = 0;
+    uint32_t vertex_layout   = 0;  // from pipeline_library::vertexLayout
+    uint32_t features        = 1u << (uint32_t)shader_feature::texture;  // a bit per feature
+
+    vk::PrimitiveTopology topology          = vk::PrimitiveTopology::eTriangleList;
+    vk::PolygonMode       polygon_mode      = vk::PolygonMode::eFill;
+    vk::CullModeFlags     cull_mode         = vk::CullModeFlagBits::eBack;
+    vk::FrontFace         front_face        = vk::FrontFace::eCounterClockwise;
+    blend_mode            blend             = blend_mode::opaque;
+    bool                  color_write       = true;  // false leaves the color attachment as it is
+    uint32_t              color_attachments = 1;     // of the subpass, all blended the same way
+    bool                  depth_test        = true;
+    bool                  depth_write       = true;
+    vk::CompareOp         depth_compare     = vk::CompareOp::eGreater;  // reverse-Z
+    bool                  depth_bounds      = false;  // dynamic, see vkCmdSetDepthBounds
+
+    vk::PipelineLayout      layout;
+    vk::RenderPass          render_pass;
+    uint32_t                subpass = 0;
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;  // of the subpass's attachments
+
+    // Without a render pass, what is drawn into with VK_KHR_dynamic_rendering instead, and the
+    // views it renders at once, see renderer::setStereo
+    vk::Format color_format = vk::Format::eUndefined;
+    vk::Format depth_format = vk::Format::eUndefined;
+    uint32_t   view_mask    = 0;
+
+    // The fragment shading rate is dynamic state, and without a render pass the rendering may
+    // read rates from an attachment as well, see renderer::setShadingRate
+    bool shading_rate            = false;
+    bool shading_rate_attachment = false;
+
+    // The layout's sets are bound from a descriptor buffer, see descriptor_buffer, which every
+    // part of the pipeline has to be created for
+    bool descriptor_buffer = false;
+
+    void enable(shader_feature feature, bool enabled = true);
+    bool enabled(shader_feature feature) const;
+
+    bool operator==(const pipeline_state& other) const;
+};
+
+struct pipeline_state_hash
+{
+    size_t operator()(const pipeline_state& state) const;
+};
+
+/*
+Every graphics pipeline the renderer uses, compiled once per distinct pipeline_state and shared by
+everything that asks for the same one. A pipeline that isn't there yet is compiled when it is first
+asked for, which stalls whoever asked, so the variants that are known up front should be compiled
+with warm() at load time instead, where they all go to the driver in one call.
+
+Variants that are only needed later can be compiled in the background with request(), which hands
+back a fallback pipeline until the real one is done, so asking for one never stalls the frame.
+That happens on threads of the library's own rather than on the job scheduler: a thread that waits
+on a scheduler counter runs whatever job is queued, and a compile that ends up on the render thread
+while it waits for the recording jobs is exactly the hitch this is meant to avoid.
+
+Compilation goes through the pipeline_cache, which the driver synchronizes internally, so variants
+compiled on an earlier run are quick to compile again whichever thread compiles them. That is also
+how a shader is reloaded: every pipeline using it is compiled again in the background, and the old
+one is handed out until its replacement is done. The library owns the pipelines and shader modules
+it hands out. Everything but the compile threads runs on the render thread.
+
+With VK_EXT_graphics_pipeline_library pipelines are made of four parts instead: the vertex input,
+the vertex shader with the rasterization state, the fragment shader with the depth state, and the
+blending. Each part only depends on its share of the pipeline_state, so variants share them, and
+a variant whose parts have all been compiled already is linked from them on the spot by request(),
+which takes next to no time without link time optimization. The optimized link follows in the
+background and replaces it, the same way a reloaded shader's pipelines are.
+*/
+class pipeline_library
+{
+public:
+    // `libraries` only where the device has VK_EXT_graphics_pipeline_library enabled
+    void init(vk::Device      device,
+              pipeline_cache& cache,
+              uint32_t        compile_threads = 1,
+              bool            libraries       = false);
+
+    // Waits for the background compiles first
+    void destroy();
+
+    // Ids stay the same for the same file or layout
+    uint32_t shader(const std::string& path);
+
+    // What the shader's code declares, for creating the layouts it's used with
+    const shader_reflection& reflection(uint32_t shader) const
+    {
+        return m_modules[m_shader_modules[shader]].reflection;
+    }
+
+    // Distinct shader codes, each with one module however many paths have it
+    size_t moduleCount() const { return m_module_hashes.size(); }
+
+    // Every path shader() has been called with
+    std::vector<std::string> shaderPaths() const;
+
+    /*
+    Replaces the shader's module with the file's current contents and starts recompiling every
+    pipeline that uses it. Returns false, keeping the old module, if `path` isn't a shader of the
+    library or can't be read, or if its interface changed, which the layouts made from its
+    reflection wouldn't match anymore.
+    */
+    bool reloadShader(const std::string& path);
+
+    uint32_t vertexLayout(const vk::VertexInputBindingDescription*   bindings,
+                          uint32_t                                   binding_count,
+                          const vk::VertexInputAttributeDescription* attributes,
+                          uint32_t                                   count);
+
+    // Compiles the pipeline right away if it hasn't been compiled yet
+    vk::Pipeline get(const pipeline_state& state);
+
+    // Returns `fallback` until the pipeline has been compiled, which is started in the background
+    // the first time it is asked for
+    vk::Pipeline request(const pipeline_state& state, vk::Pipeline fallback);
+
+    // Compiles whichever of the states haven't been compiled yet, right away
+    void warm(const std::vector<pipeline_state>& states);
+
+    // Picks up the pipelines that have finished compiling in the background, once per frame
+    void update();
+
+    // Queues up the pipelines that reloaded ones replaced in update(), to be destroyed once
+    // `frame` is done with them
+    void retireReplaced(deletion_queue& deletions, uint64_t frame);
+
+    // Waits for every background compile and picks them all up
+    void finish();
+
+    // Whether anything is still compiling in the background, or hasn't been picked up yet
+    bool compiling();
+
+    // Drops every pipeline built for `render_pass`, e.g. because it is about to be recreated. They
+    // are destroyed once `frame` is done with them. A null render pass drops the dynamic rendering
+    // ones, whose attachment formats may be changing.
+    void retire(vk::RenderPass render_pass, deletion_queue& deletions, uint64_t frame);
+
+    size_t size() const { return m_pipelines.size(); }
+
+private:
+    struct vertex_layout
+    {
+        std::vector<vk::VertexInputBindingDescription>   bindings;
+        std::vector<vk::VertexInputAttributeDescription> attributes;
+    };
+
+    // The create info of one pipeline, along with everything it points to
+    struct build_info
+    {
+        std::array<vk::PipelineShaderStageCreateInfo, 2>                         stages;
+        std::array<vk::SpecializationMapEntry, shader_feature_count>             constant_entries;
+        std::array<vk::Bool32, shader_feature_count>                             constants;
+        vk::SpecializationInfo                                                   specialization;
+        vk::PipelineVertexInputStateCreateInfo                                   vertex_input;
+        vk::PipelineInputAssemblyStateCreateInfo                                 input_assembly;
+        vk::PipelineViewportStateCreateInfo                                      viewport;
+        vk::PipelineRasterizationStateCreateInfo                                 rasterizer;
+        vk::PipelineMultisampleStateCreateInfo                                   multisampling;
+        vk::PipelineDepthStencilStateCreateInfo                                  depth_stencil;
+        std::array<vk::PipelineColorBlendAttachmentState, max_color_attachments> blend_attachments;
+        vk::PipelineColorBlendStateCreateInfo                                    blending;
+        std::array<vk::DynamicState, 4>                                          dynamic_states;
+        vk::PipelineDynamicStateCreateInfo                                       dynamic;
+        vk::Format                                                               color_format;
+#if defined(VK_KHR_dynamic_rendering)
+        // In front of `pipeline` when there is no render pass
+        vk::PipelineRenderingCreateInfoKHR                                       rendering;
+#endif
+        vk::GraphicsPipelineCreateInfo                                           pipeline;
+    };
+
+    // A background compile. The vertex layout is copied, so the build info doesn't point into
+    // m_vertex_layouts while the render thread might add to it.
+    struct pending_pipeline
+    {
+        pipeline_state state;
+        vertex_layout  layout;
+        build_info     info;
+        vk::Pipeline   pipeline;
+        vk::Result     result   = vk::Result::eSuccess;
+        bool           done     = false;  // guarded by m_mutex
+        bool           replaces = false;  // the pipeline that is there, e.g. for a reloaded shader
+    };
+
+    // The parts of a pipeline with graphics pipeline libraries, in the order they're linked
+    enum library_part : uint32_t
+    {
+        vertex_input_part,
+        pre_rasterization_part,
+        fragment_shader_part,
+        fragment_output_part,
+    };
+
+    static const uint32_t library_part_count = 4;
+
+    using pipeline_map = std::unordered_map<pipeline_state, vk::Pipeline, pipeline_state_hash>;
+
+    // The fields of `state` that `part` is built from, with the others left at their defaults
+    static pipeline_state partState(const pipeline_state& state, uint32_t part);
+
+    // Both can run on the compile threads, and only use `info`, not the library's shaders or
+    // layouts. linkLibraries compiles whichever parts are missing first.
+    vk::Result createPart(const pipeline_state& state, uint32_t part, const build_info& info);
+    vk::Result linkLibraries(const pipeline_state& state,
+                             const build_info&     info,
+                             bool                  optimize,
+                             vk::Pipeline&         pipeline);
+    bool       hasParts(const pipeline_state& state);
+
+    // With nothing compiling, e.g. because their shader or render pass is about to go
+    template<typename Predicate>
+    void destroyParts(uint32_t part, Predicate matches);
+
+    // One per distinct SPIR-V code, shared by every shader id whose file has that code, and
+    // destroyed once none has it anymore
+    struct shader_module
+    {
+        vk::ShaderModule  module;
+        shader_reflection reflection;
+        uint64_t          hash       = 0;  // of the code's size and contents
+        uint32_t          references = 0;  // shader ids
+    };
+
+    static const uint32_t no_module = UINT32_MAX;
+
+    // Both take a reference. findModule returns no_module if there is none with the hash, and
+    // createModule throws if the driver can't create it.
+    uint32_t findModule(uint64_t hash);
+    uint32_t createModule(const core::mapped_file& code, uint64_t hash, shader_reflection&& r);
+    void     releaseModule(uint32_t module);
+
+    void enqueue(const pipeline_state& state, bool replaces);
+
+    void build(const pipeline_state& state, const vertex_layout& layout, build_info& info) const;
+    void compileLoop();
+
+    vk::Device      m_device;
+    pipeline_cache* m_cache = nullptr;
+
+    std::vector<std::thread>                       m_threads;
+    std::mutex                                     m_mutex;
+    std::condition_variable                        m_wake;  // something was queued, or stopping
+    std::condition_variable                        m_idle;  // something finished compiling
+    std::deque<pending_pipeline*>                  m_queue;
+    std::vector<std::unique_ptr<pending_pipeline>> m_pending;  // queued or compiling or done
+    bool                                           m_stopping = false;
+
+    std::vector<shader_module>                m_modules;
+    std::vector<uint32_t>                     m_free_modules;
+    std::unordered_map<uint64_t, uint32_t>    m_module_hashes;
+    std::vector<uint32_t>                     m_shader_modules;  // by shader id
+    std::unordered_map<std::string, uint32_t> m_shader_ids;
+    std::vector<vertex_layout>                m_vertex_layouts;
+
+    std::unordered_map<pipeline_state, vk::Pipeline, pipeline_state_hash> m_pipelines;
+    std::vector<vk::Pipeline> m_replaced;  // still in use by frames in flight
+
+    // By partState, with graphics pipeline libraries
+    bool         m_libraries = false;
+    std::mutex   m_parts_mutex;
+    pipeline_map m_parts[library_part_count];  // guarded by m_parts_mutex
+};
+
+}  // namespace shiny::graphics
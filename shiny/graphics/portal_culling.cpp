@@ -0,0 +1,283 @@
+#include "graphics/portal_culling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// How many portals deep the traversal goes, and how many frustums it keeps in all, so that a maze
+// of small cells can't take the frame with it
+const uint32_t max_portal_depth = 16;
+const uint32_t max_portal_views = 4096;
+
+// An eye this close to a portal's plane, about the renderer's near plane, sees through it with the
+// frustum it already had, since the planes through its edges would be all but degenerate
+const float portal_eye_distance = 0.1f;
+
+bool
+contains(const shiny::graphics::aabb& box, const glm::vec3& point)
+{
+    return glm::all(glm::greaterThanEqual(point, box.min))
+           && glm::all(glm::lessThanEqual(point, box.max));
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+portal_graph::cell
+portal_graph::addCell(const aabb& bounds)
+{
+    m_cells.push_back(bounds);
+    m_links.emplace_back();
+    return (cell)m_cells.size() - 1;
+}
+
+// The plane is fitted to the corners with Newell's method, which holds up for slightly uneven ones
+void
+portal_graph::addPortal(cell a, cell b, const glm::vec3* corners, uint32_t count)
+{
+    if (a >= m_cells.size() || b >= m_cells.size() || a == b || count < 3) {
+        throw std::runtime_error("Invalid portal!");
+    }
+
+    glm::vec3 normal(0.f);
+    glm::vec3 center(0.f);
+    for (uint32_t i = 0; i < count; ++i) {
+        const glm::vec3& p = corners[i];
+        const glm::vec3& q = corners[(i + 1) % count];
+        normal += glm::vec3((p.y - q.y) * (p.z + q.z), (p.z - q.z) * (p.x + q.x),
+                            (p.x - q.x) * (p.y + q.y));
+        center += p;
+    }
+    if (glm::length(normal) == 0.f) {
+        throw std::runtime_error("Invalid portal!");
+    }
+    normal = glm::normalize(normal);
+    center /= (float)count;
+
+    portal opening;
+    opening.cells[0]     = a;
+    opening.cells[1]     = b;
+    opening.first_corner = (uint32_t)m_corners.size();
+    opening.corner_count = count;
+    opening.plane        = glm::vec4(normal, -glm::dot(normal, center));
+
+    m_corners.insert(m_corners.end(), corners, corners + count);
+    m_links[a].push_back((uint32_t)m_portals.size());
+    m_links[b].push_back((uint32_t)m_portals.size());
+    m_portals.push_back(opening);
+}
+
+// Cells are few enough, a few dozen to a few hundred a level, that looking at every one is fine
+portal_graph::cell
+portal_graph::find(const glm::vec3& point) const
+{
+    for (cell c = 0; c < (cell)m_cells.size(); ++c) {
+        if (contains(m_cells[c], point)) {
+            return c;
+        }
+    }
+    return no_cell;
+}
+
+void
+portal_graph::traverse(const glm::vec3& eye, const frustum& view)
+{
+    m_eye = eye;
+    m_views.clear();
+    m_planes.clear();
+    m_path.clear();
+    m_cell_views.assign(m_cells.size(), ~0u);
+    m_visible_cells = 0;
+
+    const cell start = find(eye);
+    m_inside         = start != no_cell;
+    if (!m_inside) {
+        return;
+    }
+
+    m_planes.insert(m_planes.end(), std::begin(view.planes), std::end(view.planes));
+    visit(start, 0, (uint32_t)m_planes.size(), 0);
+}
+
+bool
+portal_graph::visible(const glm::vec3& center, float radius) const
+{
+    const cell c = m_inside ? find(center) : no_cell;
+    if (c == no_cell) {
+        return true;
+    }
+
+    for (uint32_t v = m_cell_views[c]; v != ~0u; v = m_views[v].next) {
+        const view& seen   = m_views[v];
+        bool        inside = true;
+        for (uint32_t p = seen.first_plane; p < seen.first_plane + seen.plane_count && inside;
+             ++p) {
+            inside = glm::dot(glm::vec3(m_planes[p]), center) + m_planes[p].w >= -radius;
+        }
+        if (inside) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+The planes of the frustum behind a portal face the clipped portal's center, and the portal's own
+plane, facing away from the eye, keeps out what is in front of the opening. A cell already on the
+way here isn't gone into again, which is what keeps two open doors from going back and forth.
+*/
+void
+portal_graph::visit(cell current, uint32_t first_plane, uint32_t plane_count, uint32_t depth)
+{
+    view seen;
+    seen.first_plane = first_plane;
+    seen.plane_count = plane_count;
+    seen.next        = m_cell_views[current];
+    if (seen.next == ~0u) {
+        ++m_visible_cells;
+    }
+    m_cell_views[current] = (uint32_t)m_views.size();
+    m_views.push_back(seen);
+
+    if (depth == max_portal_depth || m_views.size() >= max_portal_views) {
+        return;
+    }
+
+    m_path.push_back(current);
+    for (uint32_t index : m_links[current]) {
+        const portal& opening = m_portals[index];
+        const cell    other   = opening.cells[0] == current ? opening.cells[1] : opening.cells[0];
+        if (std::find(m_path.begin(), m_path.end(), other) != m_path.end()) {
+            continue;
+        }
+
+        const float distance = glm::dot(glm::vec3(opening.plane), m_eye) + opening.plane.w;
+        if (std::abs(distance) < portal_eye_distance) {
+            visit(other, first_plane, plane_count, depth + 1);
+            continue;
+        }
+
+        clip(opening, first_plane, plane_count);
+        if (m_clipped.size() < 3) {
+            continue;
+        }
+
+        glm::vec3 center(0.f);
+        for (const glm::vec3& corner : m_clipped) {
+            center += corner;
+        }
+        center /= (float)m_clipped.size();
+
+        const uint32_t first = (uint32_t)m_planes.size();
+        for (size_t i = 0; i < m_clipped.size(); ++i) {
+            const glm::vec3 a = m_clipped[i] - m_eye;
+            const glm::vec3 b = m_clipped[(i + 1) % m_clipped.size()] - m_eye;
+
+            glm::vec3   normal = glm::cross(a, b);
+            const float length = glm::length(normal);
+            if (length < 1e-12f) {
+                continue;
+            }
+            normal /= length;
+            if (glm::dot(normal, center - m_eye) < 0.f) {
+                normal = -normal;
+            }
+            m_planes.push_back(glm::vec4(normal, -glm::dot(normal, m_eye)));
+        }
+        m_planes.push_back(distance > 0.f ? -opening.plane : opening.plane);
+
+        visit(other, first, (uint32_t)m_planes.size() - first, depth + 1);
+    }
+    m_path.pop_back();
+}
+
+// Sutherland-Hodgman, one plane after the other
+void
+portal_graph::clip(const portal& opening, uint32_t first_plane, uint32_t plane_count)
+{
+    m_clipped.assign(m_corners.begin() + opening.first_corner,
+                     m_corners.begin() + opening.first_corner + opening.corner_count);
+
+    for (uint32_t p = first_plane; p < first_plane + plane_count && m_clipped.size() >= 3; ++p) {
+        const glm::vec4 plane = m_planes[p];
+
+        m_clip_scratch.clear();
+        for (size_t i = 0; i < m_clipped.size(); ++i) {
+            const glm::vec3& a  = m_clipped[i];
+            const glm::vec3& b  = m_clipped[(i + 1) % m_clipped.size()];
+            const float      da = glm::dot(glm::vec3(plane), a) + plane.w;
+            const float      db = glm::dot(glm::vec3(plane), b) + plane.w;
+
+            if (da >= 0.f) {
+                m_clip_scratch.push_back(a);
+            }
+            if ((da >= 0.f) != (db >= 0.f)) {
+                m_clip_scratch.push_back(a + (b - a) * (da / (da - db)));
+            }
+        }
+        m_clipped.swap(m_clip_scratch);
+    }
+}
+
+portal_graph
+readPortalGraph(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path + "!");
+    }
+
+    portal_graph           graph;
+    std::vector<glm::vec3> corners;
+    std::string            line;
+    for (uint32_t number = 1; std::getline(file, line); ++number) {
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string        kind;
+        std::string        rest;
+        fields >> kind;
+        if (kind == "cell") {
+            aabb bounds;
+            fields >> bounds.min.x >> bounds.min.y >> bounds.min.z >> bounds.max.x >> bounds.max.y
+              >> bounds.max.z;
+            if (fields && !(fields >> rest) && !bounds.empty()) {
+                graph.addCell(bounds);
+                continue;
+            }
+        } else if (kind == "portal") {
+            portal_graph::cell a = portal_graph::no_cell;
+            portal_graph::cell b = portal_graph::no_cell;
+            fields >> a >> b;
+
+            // A corner short of a coordinate makes the whole line invalid
+            corners.clear();
+            glm::vec3 corner;
+            while (fields >> corner.x) {
+                if (!(fields >> corner.y >> corner.z)) {
+                    corners.clear();
+                    break;
+                }
+                corners.push_back(corner);
+            }
+            if (fields.eof() && corners.size() >= 3 && a < graph.cellCount()
+                && b < graph.cellCount() && a != b) {
+                graph.addPortal(a, b, corners.data(), (uint32_t)corners.size());
+                continue;
+            }
+        }
+        throw std::runtime_error("Invalid cell or portal on line " + std::to_string(number)
+                                 + " of " + path + "!");
+    }
+    return graph;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "graphics/bvh.h"
+#include "graphics/frustum_culling.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Cells and portals for scenes made of rooms: the cells are boxes, and the portals the convex
+openings between two of them, doors and windows. What can be seen from the camera's cell is found
+by going through its portals, clipping each to the part of the view that gets through the ones
+before it, and carrying on into the cell behind with a narrower frustum: the planes through the eye
+and the clipped portal's edges. A cell can be reached by more than one way, and keeps every frustum
+it was seen through.
+
+Whatever is in a cell, going by its bounding sphere's center, is only visible through one of the
+cell's frustums, so a room behind a wall is dropped before the frustum culling ever sees it. What
+is in no cell is left to the frustum alone, and so is everything while the camera is outside the
+cells. There is nothing in the way inside a cell, so the cells should hold the walls between them.
+*/
+class portal_graph
+{
+public:
+    using cell = uint32_t;
+
+    static const cell no_cell = ~0u;
+
+    cell addCell(const aabb& bounds);
+
+    // A portal between cells `a` and `b`, with `count` corners in order around it, either way. The
+    // corners are expected to lie in a plane.
+    void addPortal(cell a, cell b, const glm::vec3* corners, uint32_t count);
+
+    bool     empty() const { return m_cells.empty(); }
+    uint32_t cellCount() const { return (uint32_t)m_cells.size(); }
+
+    // The first cell the point is in, or no_cell
+    cell find(const glm::vec3& point) const;
+
+    // Finds the cells visible from `eye` within `view`, for visible() and visibleCells(). Allocates
+    // nothing once it has been through as many frustums and planes before.
+    void traverse(const glm::vec3& eye, const frustum& view);
+
+    // Whether the sphere may be seen, by the last traverse()
+    bool visible(const glm::vec3& center, float radius) const;
+
+    // The cells the last traverse() reached, 0 with the eye outside of them
+    uint32_t visibleCells() const { return m_visible_cells; }
+
+private:
+    struct portal
+    {
+        cell      cells[2];
+        uint32_t  first_corner = 0;  // in m_corners
+        uint32_t  corner_count = 0;
+        glm::vec4 plane;  // through the corners, facing either way
+    };
+
+    // A frustum a cell is seen through, of planes m_planes[first_plane, first_plane + plane_count)
+    struct view
+    {
+        uint32_t first_plane = 0;
+        uint32_t plane_count = 0;
+        uint32_t next        = ~0u;  // the cell's view before it, in m_views
+    };
+
+    void visit(cell current, uint32_t first_plane, uint32_t plane_count, uint32_t depth);
+
+    // Clips the portal's corners to the planes, into m_clipped
+    void clip(const portal& opening, uint32_t first_plane, uint32_t plane_count);
+
+    std::vector<aabb>                  m_cells;
+    std::vector<std::vector<uint32_t>> m_links;  // each cell's portals
+    std::vector<portal>                m_portals;
+    std::vector<glm::vec3>             m_corners;
+
+    glm::vec3              m_eye           = glm::vec3(0.f);
+    bool                   m_inside        = false;  // the eye is in a cell
+    uint32_t               m_visible_cells = 0;
+    std::vector<uint32_t>  m_cell_views;  // the last of each cell's views, ~0u without any
+    std::vector<view>      m_views;
+    std::vector<glm::vec4> m_planes;
+    std::vector<cell>      m_path;  // the cells the current view went through to get here
+    std::vector<glm::vec3> m_clipped;
+    std::vector<glm::vec3> m_clip_scratch;
+};
+
+/*
+Reads cells and portals from a text file with one on each line, blank lines and those starting
+with # aside. "cell MINX MINY MINZ MAXX MAXY MAXZ" adds the next cell, numbered from 0, and
+"portal A B X Y Z X Y Z X Y Z ..." a portal between cells A and B with three corners or more.
+*/
+portal_graph readPortalGraph(const std::string& path);
+
+}  // namespace shiny::graphics
@@ -0,0 +1,492 @@
+#include "graphics/post_process.h"
+
+#include "core/mapped_file.h"
+#include "graphics/barrier_batch.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace {
+
+// Has to match local_size_x and local_size_y in bloom_down.comp, bloom_up.comp and post.comp
+const uint32_t post_group_size = 8;
+
+// Storage images in the core set of formats, sampled with linear filtering and blitted from
+const vk::Format bloom_format  = vk::Format::eR16G16B16A16Sfloat;
+const vk::Format output_format = vk::Format::eR16G16B16A16Sfloat;
+
+// Below half the output, fewer if it gets to a single texel first
+const uint32_t max_bloom_levels = 5;
+
+// The shaders' push constants
+struct down_constants
+{
+    int32_t  width     = 0;
+    int32_t  height    = 0;
+    float    threshold = 0.f;
+    uint32_t prefilter = 0;
+};
+
+struct up_constants
+{
+    int32_t width  = 0;
+    int32_t height = 0;
+};
+
+struct composite_constants
+{
+    int32_t width      = 0;
+    int32_t height     = 0;
+    float   exposure   = 1.f;
+    float   bloom      = 0.f;
+    float   saturation = 1.f;
+    float   contrast   = 1.f;
+    float   vignette   = 0.f;
+};
+
+uint32_t
+groups(uint32_t size)
+{
+    return (size + post_group_size - 1) / post_group_size;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+post_stack::init(vk::Device           device,
+                 memory_allocator&    allocator,
+                 layout_cache&        layouts,
+                 view_cache&          views,
+                 pipeline_cache&      pipelines,
+                 const post_settings& settings,
+                 bool                 any_format,
+                 bool                 half_precision)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_settings  = settings;
+
+    auto binding = [](uint32_t number, vk::DescriptorType type) {
+        return vk::DescriptorSetLayoutBinding()
+          .setBinding(number)
+          .setDescriptorCount(1)
+          .setDescriptorType(type)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    };
+
+    // 0: the level read, or the frame, 1: the level written
+    std::array<vk::DescriptorSetLayoutBinding, 2> levelbindings = {
+        binding(0, vk::DescriptorType::eCombinedImageSampler),
+        binding(1, vk::DescriptorType::eStorageImage),
+    };
+
+    // 0: the frame, 1: the bloom, 2: the output
+    std::array<vk::DescriptorSetLayoutBinding, 3> compositebindings = {
+        binding(0, vk::DescriptorType::eCombinedImageSampler),
+        binding(1, vk::DescriptorType::eCombinedImageSampler),
+        binding(2, vk::DescriptorType::eStorageImage),
+    };
+
+    m_level_set_layout = layouts.descriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo()
+        .setBindingCount((uint32_t)levelbindings.size())
+        .setPBindings(levelbindings.data()));
+    m_composite_set_layout = layouts.descriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo()
+        .setBindingCount((uint32_t)compositebindings.size())
+        .setPBindings(compositebindings.data()));
+
+    auto createLayout = [&](const vk::DescriptorSetLayout& setlayout, uint32_t constantsize) {
+        auto constants = vk::PushConstantRange()
+                           .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                           .setOffset(0)
+                           .setSize(constantsize);
+
+        auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                            .setSetLayoutCount(1)
+                            .setPSetLayouts(&setlayout)
+                            .setPushConstantRangeCount(1)
+                            .setPPushConstantRanges(&constants);
+
+        return layouts.pipelineLayout(layoutinfo);
+    };
+
+    m_down_layout      = createLayout(m_level_set_layout, sizeof(down_constants));
+    m_up_layout        = createLayout(m_level_set_layout, sizeof(up_constants));
+    m_composite_layout = createLayout(m_composite_set_layout, sizeof(composite_constants));
+
+    auto createPipeline = [&](const char*        path,
+                              vk::PipelineLayout layout,
+                              vk::ShaderModule&  shader) {
+        core::mapped_file code(path);
+
+        auto shaderinfo = vk::ShaderModuleCreateInfo()
+                            .setCodeSize(code.size())
+                            .setPCode((const uint32_t*)code.data());
+
+        shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+        auto pipelineinfo =
+          vk::ComputePipelineCreateInfo()
+            .setStage(vk::PipelineShaderStageCreateInfo()
+                        .setStage(vk::ShaderStageFlagBits::eCompute)
+                        .setModule(shader)
+                        .setPName("main"))
+            .setLayout(layout);
+
+        return m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+    };
+
+    m_down_pipeline = createPipeline("shaders/bloom_down_comp.spv", m_down_layout, m_down_shader);
+    m_up_pipeline   = createPipeline("shaders/bloom_up_comp.spv", m_up_layout, m_up_shader);
+    m_composite_pipeline =
+      createPipeline(half_precision ? "shaders/post_fp16_comp.spv" : "shaders/post_comp.spv",
+                     m_composite_layout, m_composite_shader);
+    if (any_format) {
+        m_direct_pipeline = createPipeline(half_precision ? "shaders/post_swap_chain_fp16_comp.spv"
+                                                          : "shaders/post_swap_chain_comp.spv",
+                                           m_composite_layout, m_direct_shader);
+    }
+
+    // The levels and the frame are sampled between their texels, and never off their edges
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(vk::Filter::eLinear)
+                         .setMinFilter(vk::Filter::eLinear)
+                         .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                         .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setMinLod(0.f)
+                         .setMaxLod(0.f);
+
+    m_sampler = views.sampler(samplerinfo);
+}
+
+void
+post_stack::destroy()
+{
+    for (vk::ImageView view : m_bloom_views) {
+        m_device.destroyImageView(view, hostAllocator());
+    }
+    m_bloom_views.clear();
+    m_device.destroyImageView(m_output_view, hostAllocator());
+    m_device.destroyImage(m_output_image, hostAllocator());
+    m_device.destroyImage(m_bloom, hostAllocator());
+    m_allocator->free(m_output_memory);
+    m_allocator->free(m_bloom_memory);
+    m_descriptors.destroy();
+
+    m_device.destroyPipeline(m_down_pipeline, hostAllocator());
+    m_device.destroyPipeline(m_up_pipeline, hostAllocator());
+    m_device.destroyPipeline(m_composite_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_down_shader, hostAllocator());
+    m_device.destroyShaderModule(m_up_shader, hostAllocator());
+    m_device.destroyShaderModule(m_composite_shader, hostAllocator());
+    if (m_direct_pipeline) {
+        m_device.destroyPipeline(m_direct_pipeline, hostAllocator());
+        m_device.destroyShaderModule(m_direct_shader, hostAllocator());
+        m_direct_pipeline = nullptr;
+        m_direct_shader   = nullptr;
+    }
+
+    m_output_view  = nullptr;
+    m_output_image = nullptr;
+    m_bloom        = nullptr;
+}
+
+/*
+The chain is as large as the output, which is all it depends on, but it's rebuilt along with the
+render graph anyway since the sources and targets are. Every set is written here, a level 0 one
+for each source and a composite one for each source and target, so that record() only picks them.
+*/
+void
+post_stack::create(vk::Extent2D                      output,
+                   const std::vector<vk::ImageView>& sources,
+                   vk::ImageLayout                   layout,
+                   const std::vector<vk::ImageView>& targets,
+                   deletion_queue&                   deletions,
+                   uint64_t                          frame)
+{
+    if (!targets.empty() && !m_direct_pipeline) {
+        throw std::runtime_error("Post-processing can't write the targets in their format!");
+    }
+
+    retire(deletions, frame);
+
+    m_output  = output;
+    m_direct  = !targets.empty();
+    m_targets = std::max((uint32_t)targets.size(), 1u);
+
+    m_bloom_extents.clear();
+    vk::Extent2D extent((output.width + 1) / 2, (output.height + 1) / 2);
+    while (m_bloom_extents.size() < max_bloom_levels) {
+        m_bloom_extents.push_back(extent);
+        if (extent.width == 1 && extent.height == 1) {
+            break;
+        }
+        extent = vk::Extent2D(std::max((extent.width + 1) / 2, 1u),
+                              std::max((extent.height + 1) / 2, 1u));
+    }
+    const uint32_t levels = (uint32_t)m_bloom_extents.size();
+
+    auto createImage = [&](vk::Extent2D extent, vk::Format format, uint32_t mips,
+                           vk::ImageUsageFlags usage, allocation& memory) {
+        auto imageinfo = vk::ImageCreateInfo()
+                           .setImageType(vk::ImageType::e2D)
+                           .setExtent(vk::Extent3D(extent.width, extent.height, 1))
+                           .setMipLevels(mips)
+                           .setArrayLayers(1)
+                           .setFormat(format)
+                           .setTiling(vk::ImageTiling::eOptimal)
+                           .setInitialLayout(vk::ImageLayout::eUndefined)
+                           .setUsage(usage)
+                           .setSamples(vk::SampleCountFlagBits::e1)
+                           .setSharingMode(vk::SharingMode::eExclusive);
+
+        vk::Image image = m_device.createImage(imageinfo, hostAllocator());
+        memory          = m_allocator->allocate(m_device.getImageMemoryRequirements(image),
+                                                vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                                memory_allocator::resource_kind::optimal,
+                                                memory_category::render_target);
+        m_device.bindImageMemory(image, memory.memory, memory.offset);
+        return image;
+    };
+
+    auto createView = [&](vk::Image image, vk::Format format, uint32_t mip) {
+        auto viewinfo = vk::ImageViewCreateInfo()
+                          .setImage(image)
+                          .setViewType(vk::ImageViewType::e2D)
+                          .setFormat(format)
+                          .setSubresourceRange(vk::ImageSubresourceRange(
+                            vk::ImageAspectFlagBits::eColor, mip, 1, 0, 1));
+        return m_device.createImageView(viewinfo, hostAllocator());
+    };
+
+    const auto storage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled;
+
+    m_bloom = createImage(m_bloom_extents[0], bloom_format, levels, storage, m_bloom_memory);
+    for (uint32_t mip = 0; mip < levels; ++mip) {
+        m_bloom_views.push_back(createView(m_bloom, bloom_format, mip));
+    }
+    if (!m_direct) {
+        m_output_image = createImage(
+          output, output_format, 1,
+          vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferSrc,
+          m_output_memory);
+        m_output_view = createView(m_output_image, output_format, 0);
+    }
+
+    const uint32_t sources_count = (uint32_t)sources.size();
+    const uint32_t sets = sources_count + 2 * (levels - 1) + sources_count * m_targets;
+    m_descriptors.init(m_device,
+                       { { vk::DescriptorType::eCombinedImageSampler, 2 },
+                         { vk::DescriptorType::eStorageImage, 1 } },
+                       sets);
+
+    // Written by updateDescriptorSets at the end, so every info has to stay where it is until then
+    std::vector<vk::DescriptorImageInfo> infos;
+    infos.reserve(3 * sets);
+    std::vector<vk::WriteDescriptorSet> writes;
+
+    auto write = [&](vk::DescriptorSet set, uint32_t binding, vk::DescriptorType type,
+                     vk::Sampler sampler, vk::ImageView view, vk::ImageLayout viewlayout) {
+        infos.push_back(vk::DescriptorImageInfo(sampler, view, viewlayout));
+        writes.push_back(vk::WriteDescriptorSet()
+                           .setDstSet(set)
+                           .setDstBinding(binding)
+                           .setDescriptorCount(1)
+                           .setDescriptorType(type)
+                           .setPImageInfo(&infos.back()));
+    };
+
+    const auto sampled = vk::DescriptorType::eCombinedImageSampler;
+    const auto general = vk::ImageLayout::eGeneral;
+
+    auto writeLevel = [&](vk::DescriptorSet set, vk::ImageView read, vk::ImageLayout readlayout,
+                          uint32_t written) {
+        write(set, 0, sampled, m_sampler, read, readlayout);
+        write(set, 1, vk::DescriptorType::eStorageImage, nullptr, m_bloom_views[written], general);
+    };
+
+    for (vk::ImageView source : sources) {
+        m_first_sets.push_back(m_descriptors.allocate(m_level_set_layout));
+        writeLevel(m_first_sets.back(), source, layout, 0);
+    }
+    for (uint32_t mip = 0; mip + 1 < levels; ++mip) {
+        m_down_sets.push_back(m_descriptors.allocate(m_level_set_layout));
+        writeLevel(m_down_sets.back(), m_bloom_views[mip], general, mip + 1);
+
+        m_up_sets.push_back(m_descriptors.allocate(m_level_set_layout));
+        writeLevel(m_up_sets.back(), m_bloom_views[mip + 1], general, mip);
+    }
+
+    for (vk::ImageView source : sources) {
+        for (uint32_t target = 0; target < m_targets; ++target) {
+            const vk::DescriptorSet set = m_descriptors.allocate(m_composite_set_layout);
+            m_composite_sets.push_back(set);
+
+            write(set, 0, sampled, m_sampler, source, layout);
+            write(set, 1, sampled, m_sampler, m_bloom_views[0], general);
+            write(set, 2, vk::DescriptorType::eStorageImage, nullptr,
+                  m_direct ? targets[target] : m_output_view, general);
+        }
+    }
+    m_device.updateDescriptorSets(writes, nullptr);
+}
+
+/*
+Whatever was in the chain and the output image is discarded at the start, once the frame before is
+done reading them, so both are taken from undefined every time. The passes after one another only
+need their writes made visible to the next: the images stay in VK_IMAGE_LAYOUT_GENERAL throughout.
+*/
+void
+post_stack::record(vk::CommandBuffer command_buffer,
+                   uint32_t          source,
+                   uint32_t          target,
+                   vk::Image         image)
+{
+    const auto compute = vk::PipelineStageFlagBits::eComputeShader;
+    const auto color   = vk::ImageAspectFlagBits::eColor;
+    const auto levels  = (uint32_t)m_bloom_extents.size();
+
+    barrier_batch barriers;
+    barriers.image(m_bloom, vk::ImageSubresourceRange(color, 0, levels, 0, 1),
+                   access_scope{ compute, {}, vk::ImageLayout::eUndefined },
+                   access_scope{ compute,
+                                 vk::AccessFlagBits::eShaderRead
+                                   | vk::AccessFlagBits::eShaderWrite,
+                                 vk::ImageLayout::eGeneral });
+    if (!m_direct) {
+        barriers.image(m_output_image, vk::ImageSubresourceRange(color, 0, 1, 0, 1),
+                       access_scope{ vk::PipelineStageFlagBits::eTransfer, {},
+                                     vk::ImageLayout::eUndefined },
+                       access_scope{ compute, vk::AccessFlagBits::eShaderWrite,
+                                     vk::ImageLayout::eGeneral });
+    }
+    barriers.record(command_buffer);
+
+    auto written = [&]() {
+        barrier_batch between;
+        between.memory(access_scope{ compute, vk::AccessFlagBits::eShaderWrite },
+                       access_scope{ compute, vk::AccessFlagBits::eShaderRead
+                                                | vk::AccessFlagBits::eShaderWrite });
+        between.record(command_buffer);
+    };
+
+    for (uint32_t mip = 0; mip < levels; ++mip) {
+        const vk::Extent2D extent = m_bloom_extents[mip];
+
+        down_constants down;
+        down.width     = (int32_t)extent.width;
+        down.height    = (int32_t)extent.height;
+        down.threshold = m_settings.bloom_threshold;
+        down.prefilter = mip == 0 ? 1 : 0;
+
+        dispatch(command_buffer, m_down_pipeline, m_down_layout,
+                 mip == 0 ? m_first_sets[source] : m_down_sets[mip - 1], extent, &down,
+                 sizeof(down));
+        written();
+    }
+
+    // The smallest level first, so that every level has all of those below it when it's added
+    for (uint32_t mip = levels - 1; mip-- > 0;) {
+        const vk::Extent2D extent = m_bloom_extents[mip];
+
+        up_constants up;
+        up.width  = (int32_t)extent.width;
+        up.height = (int32_t)extent.height;
+
+        dispatch(command_buffer, m_up_pipeline, m_up_layout, m_up_sets[mip], extent, &up,
+                 sizeof(up));
+        written();
+    }
+
+    composite_constants composite;
+    composite.width      = (int32_t)m_output.width;
+    composite.height     = (int32_t)m_output.height;
+    composite.exposure   = m_settings.exposure;
+    composite.bloom      = m_settings.bloom_intensity / (float)levels;
+    composite.saturation = m_settings.saturation;
+    composite.contrast   = m_settings.contrast;
+    composite.vignette   = std::clamp(m_settings.vignette, 0.f, 1.f);
+
+    const uint32_t set = source * m_targets + (m_direct ? target : 0);
+    dispatch(command_buffer, m_direct ? m_direct_pipeline : m_composite_pipeline,
+             m_composite_layout, m_composite_sets[set], m_output, &composite, sizeof(composite));
+    if (m_direct) {
+        return;
+    }
+
+    // Converted to the target's format by the blit, which is all it does
+    barrier_batch blitted;
+    blitted.memory(access_scope{ compute, vk::AccessFlagBits::eShaderWrite },
+                   access_scope{ vk::PipelineStageFlagBits::eTransfer,
+                                 vk::AccessFlagBits::eTransferRead });
+    blitted.record(command_buffer);
+
+    const vk::Offset3D full((int32_t)m_output.width, (int32_t)m_output.height, 1);
+
+    auto blit = vk::ImageBlit()
+                  .setSrcSubresource(vk::ImageSubresourceLayers(color, 0, 0, 1))
+                  .setSrcOffsets({ vk::Offset3D(0, 0, 0), full })
+                  .setDstSubresource(vk::ImageSubresourceLayers(color, 0, 0, 1))
+                  .setDstOffsets({ vk::Offset3D(0, 0, 0), full });
+    command_buffer.blitImage(m_output_image, vk::ImageLayout::eGeneral, image,
+                             vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eNearest);
+}
+
+void
+post_stack::dispatch(vk::CommandBuffer  command_buffer,
+                     vk::Pipeline       pipeline,
+                     vk::PipelineLayout layout,
+                     vk::DescriptorSet  set,
+                     vk::Extent2D       extent,
+                     const void*        constants,
+                     uint32_t           size)
+{
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0, set, nullptr);
+    command_buffer.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, 0, size, constants);
+    command_buffer.dispatch(groups(extent.width), groups(extent.height), 1);
+}
+
+// The frames in flight may still be post-processing with the old ones
+void
+post_stack::retire(deletion_queue& deletions, uint64_t frame)
+{
+    if (!m_bloom) {
+        return;
+    }
+
+    for (vk::ImageView view : m_bloom_views) {
+        deletions.push(frame, view);
+    }
+    deletions.push(frame, m_bloom);
+    deletions.push(frame, m_bloom_memory);
+    if (m_output_image) {
+        deletions.push(frame, m_output_view);
+        deletions.push(frame, m_output_image);
+        deletions.push(frame, m_output_memory);
+    }
+
+    descriptor_allocator old = m_descriptors;
+    deletions.pushAction(frame, [old]() mutable { old.destroy(); });
+
+    m_bloom_views.clear();
+    m_first_sets.clear();
+    m_down_sets.clear();
+    m_up_sets.clear();
+    m_composite_sets.clear();
+    m_descriptors   = descriptor_allocator();
+    m_bloom         = nullptr;
+    m_bloom_memory  = allocation();
+    m_output_view   = nullptr;
+    m_output_image  = nullptr;
+    m_output_memory = allocation();
+}
+
+}  // namespace shiny::graphics
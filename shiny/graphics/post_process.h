@@ -0,0 +1,131 @@
+#pragma once
+
+#include "graphics/deletion_queue.h"
+#include "graphics/descriptor_allocator.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/view_cache.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+// See post_stack
+struct post_settings
+{
+    bool  enabled         = false;
+    float exposure        = 1.f;   // the frame is scaled by before it is tone mapped
+    float bloom_threshold = 0.8f;  // of the brightest channel, past which a pixel blooms
+    float bloom_intensity = 0.5f;  // of the bloom added to the frame
+    float saturation      = 1.f;   // 0 for grays, 1 as tone mapped
+    float contrast        = 1.f;   // around the middle of the range, as tone mapped at 1
+    float vignette        = 0.3f;  // of the corners darkened away, 0 for none
+};
+
+/*
+The post-processing stack, turning the frame into the output in as few passes as its effects
+allow, all of them compute:
+
+ - the bloom chain, of up to 5 levels from half the output resolution down, each built from the
+   one above it by a 4x4 tent, with the frame's pixels under the threshold left out of level 0,
+ - and then added back up, each level to the one above it, blurred by a 3x3 tent as it's scaled up,
+ - and one pass for everything that is per pixel: exposure, the bloom, the ACES tone curve, the
+   grading and the vignette. It reads the frame and the bloom just once and writes the output
+   once, where separate passes would write and read again every effect's result in between.
+
+A group of the bloom passes reads the texels its filter covers into shared memory once, rather
+than every texel reading all of those it is filtered from.
+
+The output is written straight to the target image where it can be, created with storage usage,
+e.g. the swap chain's images when the surface has that, and otherwise to an image of the stack's
+own that is blitted to the target. Nothing is per frame in flight: the bloom chain and that image
+are only ever used within a frame, and only after what the frame before did with them.
+*/
+class post_stack
+{
+public:
+    // Writing targets takes `any_format`, shaderStorageImageWriteWithoutFormat being enabled, and
+    // `half_precision` composites with post_fp16_comp.spv, which takes shaderFloat16
+    void init(vk::Device           device,
+              memory_allocator&    allocator,
+              layout_cache&        layouts,
+              view_cache&          views,
+              pipeline_cache&      pipelines,
+              const post_settings& settings,
+              bool                 any_format,
+              bool                 half_precision = false);
+    void destroy();
+
+    // Creates the bloom chain for frames in any of `sources`, in `layout`, post-processed to
+    // `output`, retiring the old ones with `frame`. Writes every one of `targets` directly, which
+    // have to be single layer views of images with storage usage, or an image of its own to blit
+    // from if there are none.
+    void create(vk::Extent2D                      output,
+                const std::vector<vk::ImageView>& sources,
+                vk::ImageLayout                   layout,
+                const std::vector<vk::ImageView>& targets,
+                deletion_queue&                   deletions,
+                uint64_t                          frame);
+
+    // Whether create() was given targets
+    bool direct() const { return m_direct; }
+
+    // Records every pass from `source`, which has to be visible to compute shaders. With targets
+    // it writes `target`'s, which has to be in VK_IMAGE_LAYOUT_GENERAL, and otherwise blits to
+    // `image`, in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL and as large as the output. See
+    // render_graph for what comes after.
+    void record(vk::CommandBuffer command_buffer,
+                uint32_t          source,
+                uint32_t          target,
+                vk::Image         image);
+
+private:
+    void retire(deletion_queue& deletions, uint64_t frame);
+    void dispatch(vk::CommandBuffer  command_buffer,
+                  vk::Pipeline       pipeline,
+                  vk::PipelineLayout layout,
+                  vk::DescriptorSet  set,
+                  vk::Extent2D       extent,
+                  const void*        constants,
+                  uint32_t           size);
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+    post_settings     m_settings;
+
+    vk::DescriptorSetLayout m_level_set_layout;  // owned by the layout_cache
+    vk::DescriptorSetLayout m_composite_set_layout;
+    vk::PipelineLayout      m_down_layout;
+    vk::PipelineLayout      m_up_layout;
+    vk::PipelineLayout      m_composite_layout;
+    vk::ShaderModule        m_down_shader;
+    vk::ShaderModule        m_up_shader;
+    vk::ShaderModule        m_composite_shader;
+    vk::ShaderModule        m_direct_shader;
+    vk::Pipeline            m_down_pipeline;
+    vk::Pipeline            m_up_pipeline;
+    vk::Pipeline            m_composite_pipeline;  // writing its own image
+    vk::Pipeline            m_direct_pipeline;     // writing the targets
+    vk::Sampler             m_sampler;             // owned by the view_cache
+
+    vk::Image                  m_bloom;
+    allocation                 m_bloom_memory;
+    std::vector<vk::ImageView> m_bloom_views;  // a level each
+    std::vector<vk::Extent2D>  m_bloom_extents;
+    vk::Image                  m_output_image;  // without targets
+    allocation                 m_output_memory;
+    vk::ImageView              m_output_view;
+
+    descriptor_allocator           m_descriptors;     // a new one with every chain
+    std::vector<vk::DescriptorSet> m_first_sets;      // building level 0 from each source
+    std::vector<vk::DescriptorSet> m_down_sets;       // building level i + 1
+    std::vector<vk::DescriptorSet> m_up_sets;         // adding level i + 1 to level i
+    std::vector<vk::DescriptorSet> m_composite_sets;  // at source * targets + target
+    uint32_t                       m_targets = 1;
+    vk::Extent2D                   m_output;
+    bool                           m_direct = false;
+};
+
+}  // namespace shiny::graphics
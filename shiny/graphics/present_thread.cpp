@@ -0,0 +1,209 @@
+#include "graphics/present_thread.h"
+
+#include "core/cpu_topology.h"
+#include "core/profiler.h"
+
+#include <algorithm>
+
+namespace shiny::graphics {
+
+/*
+Every swap chain gets its own result back, so one that went out of date, like a viewport whose
+window was resized, doesn't keep the others' images off the screen. The call as a whole throws for
+it though, which only matters for the results it leaves.
+*/
+uint32_t
+presentRequest(vk::Queue queue, const present_request& request, bool present_ids)
+{
+    std::array<vk::Result, max_present_swapchains> results;
+    results.fill(vk::Result::eSuccess);
+
+    auto presentinfo = vk::PresentInfoKHR()
+                         .setWaitSemaphoreCount(1)
+                         .setPWaitSemaphores(&request.wait)
+                         .setSwapchainCount(request.count)
+                         .setPSwapchains(request.swapchains.data())
+                         .setPImageIndices(request.images.data())
+                         .setPResults(results.data());
+
+#if defined(VK_KHR_present_wait)
+    // Numbered by the frames, so the latency mode can wait for this one to be on screen
+    std::array<uint64_t, max_present_swapchains> ids;
+    ids.fill(request.id);
+    auto presentids =
+      vk::PresentIdKHR().setSwapchainCount(request.count).setPPresentIds(ids.data());
+    if (present_ids) {
+        presentinfo.setPNext(&presentids);
+    }
+#endif
+
+    try {
+        (void)queue.presentKHR(presentinfo);
+    } catch (const vk::OutOfDateKHRError&) {
+    }
+
+    uint32_t stale = 0;
+    for (uint32_t i = 0; i < request.count; ++i) {
+        if (results[i] == vk::Result::eSuboptimalKHR
+            || results[i] == vk::Result::eErrorOutOfDateKHR) {
+            stale |= 1u << i;
+        }
+    }
+    return stale;
+}
+
+void
+present_thread::start(vk::Queue queue, std::mutex* queue_mutex, bool present_ids)
+{
+    m_queue       = queue;
+    m_queue_mutex = queue_mutex;
+    m_present_ids = present_ids;
+    m_stopping    = false;
+
+    m_thread = std::thread([this]() {
+        core::nameThread("present");
+        core::applyThreadClass(core::thread_class::render);
+        presentLoop();
+    });
+}
+
+void
+present_thread::stop()
+{
+    if (!running()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+void
+present_thread::push(const present_request& request)
+{
+    rethrow();
+
+    const uint64_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) >= capacity) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [&]() {
+            return head - m_tail.load(std::memory_order_acquire) < capacity || m_failure;
+        });
+    }
+
+    m_requests[head % capacity] = request;
+    m_head.store(head + 1, std::memory_order_release);
+
+    // Only so the thread can't miss the wake up between looking at the ring and going to sleep
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_wake.notify_one();
+}
+
+void
+present_thread::drain(uint64_t pending)
+{
+    const uint64_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) <= pending) {
+        return;
+    }
+
+    SHINY_PROFILE_FUNCTION();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&]() {
+        return head - m_tail.load(std::memory_order_acquire) <= pending || m_failure;
+    });
+}
+
+bool
+present_thread::takeStale(vk::SwapchainKHR swapchain)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto                        found = std::find(m_stale.begin(), m_stale.end(), swapchain);
+    if (found == m_stale.end()) {
+        return false;
+    }
+    m_stale.erase(found);
+    return true;
+}
+
+void
+present_thread::rethrow()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_failure) {
+        std::rethrow_exception(m_failure);
+    }
+}
+
+void
+present_thread::presentLoop()
+{
+    for (;;) {
+        const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() {
+                return m_stopping || m_head.load(std::memory_order_acquire) != tail;
+            });
+            if (m_head.load(std::memory_order_acquire) == tail) {
+                return;
+            }
+        }
+
+        // Anything but a swap chain going out of date is the render thread's to handle, the next
+        // time it pushes, and ends the presents
+        try {
+            present(m_requests[tail % capacity]);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_failure = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tail.store(tail + 1, std::memory_order_release);
+            if (m_failure) {
+                m_done.notify_all();
+                return;
+            }
+        }
+        m_done.notify_all();
+    }
+}
+
+void
+present_thread::present(const present_request& request)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    uint32_t stale = 0;
+    if (m_queue_mutex) {
+        std::lock_guard<std::mutex> lock(*m_queue_mutex);
+        stale = presentRequest(m_queue, request, m_present_ids);
+    } else {
+        stale = presentRequest(m_queue, request, m_present_ids);
+    }
+
+    m_presented.store(request.id, std::memory_order_release);
+    if (stale == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (uint32_t i = 0; i < request.count; ++i) {
+        const vk::SwapchainKHR swapchain = request.swapchains[i];
+        const bool known = std::find(m_stale.begin(), m_stale.end(), swapchain) != m_stale.end();
+        if ((stale & (1u << i)) && !known) {
+            m_stale.push_back(swapchain);
+        }
+    }
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,102 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace shiny::graphics {
+
+// The most swap chains one present is for, the window's and its viewports'
+const uint32_t max_present_swapchains = 4;
+
+// One vkQueuePresentKHR, of an image to each of the first `count` swap chains
+struct present_request
+{
+    std::array<vk::SwapchainKHR, max_present_swapchains> swapchains;
+    std::array<uint32_t, max_present_swapchains>         images{};
+    uint32_t                                             count = 0;
+    vk::Semaphore                                        wait;    // signalled once rendered
+    uint64_t                                             id = 0;  // for VK_KHR_present_id, or 0
+};
+
+// Returns a bit for each of the request's swap chains that was found out of date or suboptimal,
+// which only ends the present of that one. Throws whatever else the present did.
+uint32_t presentRequest(vk::Queue queue, const present_request& request, bool present_ids);
+
+/*
+Presents on a thread of its own, so that a driver that blocks in vkQueuePresentKHR until the next
+vertical blank holds up that thread instead of the one recording the next frame. The render thread
+pushes a request into a small ring and moves on; the ring itself takes no lock, its mutex is only
+there for either side to sleep on while there is nothing to do.
+
+Queues are externally synchronized, so a presentation queue that is the graphics queue as well is
+only presented to with the queue's mutex held, which every submission to it has to take too.
+A present that finds a swap chain out of date or suboptimal only flags it for the render thread,
+which recreates it once the presents before are done, see drain().
+*/
+class present_thread
+{
+public:
+    ~present_thread() { stop(); }
+
+    // `queue_mutex` null if nothing else uses the queue. `present_ids` if the requests' ids are
+    // passed on, which needs VK_KHR_present_id.
+    void start(vk::Queue queue, std::mutex* queue_mutex, bool present_ids);
+
+    // Presents what was pushed and then stops
+    void stop();
+
+    bool running() const { return m_thread.joinable(); }
+
+    // Throws whatever the last present threw, other than a swap chain being out of date. Waits
+    // if the ring is full, which it only is with more presents pending than there are frames in
+    // flight.
+    void push(const present_request& request);
+
+    // Until no more than `pending` of the requests pushed are left to present, e.g. none before the
+    // swap chain is recreated. A semaphore a present waits on can't be signalled again before the
+    // present is queued, so a frame in flight has to drain its last one before it submits.
+    void drain(uint64_t pending = 0);
+
+    // Whether a present found `swapchain` in need of recreating since the last call for it
+    bool takeStale(vk::SwapchainKHR swapchain);
+
+    // The id of the last request presented
+    uint64_t presented() const { return m_presented.load(std::memory_order_acquire); }
+
+private:
+    static const uint32_t capacity = 8;
+
+    void presentLoop();
+    void present(const present_request& request);
+    void rethrow();
+
+    vk::Queue   m_queue;
+    std::mutex* m_queue_mutex = nullptr;
+    bool        m_present_ids = false;
+
+    std::array<present_request, capacity> m_requests;
+    std::atomic<uint64_t>                 m_head{ 0 };  // pushed
+    std::atomic<uint64_t>                 m_tail{ 0 };  // presented
+    std::atomic<uint64_t>                 m_presented{ 0 };
+
+    std::thread             m_thread;
+    std::mutex              m_mutex;
+    std::condition_variable m_wake;  // something was pushed, or stopping
+    std::condition_variable m_done;  // something was presented
+    std::exception_ptr      m_failure;
+    bool                    m_stopping = false;
+
+    std::vector<vk::SwapchainKHR> m_stale;  // with the mutex held
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,104 @@
+#include "graphics/quality_tier.h"
+
+#include "core/mapped_file.h"
+
+namespace {
+
+using shiny::graphics::quality_settings;
+using shiny::graphics::quality_tier_count;
+
+const char* const quality_tier_names[quality_tier_count] = { "low", "medium", "high", "ultra" };
+
+// GPU time of each tier relative to high, mostly the pixels they shade and the shadow texels
+const float quality_tier_costs[quality_tier_count] = { 0.4f, 0.65f, 1.f, 1.3f };
+
+// Of the budget, which the predicted times have to fit in
+const float quality_headroom = 0.85f;
+
+// The key renderer::benchmark writes the recommendation under
+const char* const recommendation_key = "\"recommended_quality\": \"";
+
+}  // namespace
+
+namespace shiny::graphics {
+
+quality_settings
+qualitySettings(quality_tier tier)
+{
+    quality_settings settings;
+    switch (tier) {
+        case quality_tier::low:
+            settings.anisotropy        = 1.f;
+            settings.samples           = 1;
+            settings.shadow_resolution = 512;
+            settings.render_scale      = 0.7f;
+            settings.lod_bias          = 1.f;
+            break;
+        case quality_tier::medium:
+            settings.anisotropy        = 4.f;
+            settings.samples           = 2;
+            settings.shadow_resolution = 1024;
+            settings.render_scale      = 0.85f;
+            settings.lod_bias          = 0.5f;
+            break;
+        case quality_tier::high:
+            break;
+        case quality_tier::ultra:
+            settings.shadow_resolution = 4096;
+            settings.lod_bias          = -0.5f;
+            settings.ray_query_shadows = true;
+            break;
+    }
+    return settings;
+}
+
+const char*
+qualityTierName(quality_tier tier)
+{
+    return quality_tier_names[(uint32_t)tier];
+}
+
+bool
+parseQualityTier(const std::string& name, quality_tier& tier)
+{
+    for (uint32_t i = 0; i < quality_tier_count; ++i) {
+        if (name == quality_tier_names[i]) {
+            tier = (quality_tier)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+quality_tier
+recommendQualityTier(quality_tier measured, float gpu_ms, float budget_ms)
+{
+    const float base = gpu_ms / quality_tier_costs[(uint32_t)measured];
+    for (uint32_t i = quality_tier_count; i-- > 1;) {
+        if (base * quality_tier_costs[i] <= budget_ms * quality_headroom) {
+            return (quality_tier)i;
+        }
+    }
+    return quality_tier::low;
+}
+
+// Only the one key is looked for, the rest of the file doesn't need parsing
+bool
+readRecommendedQualityTier(const std::string& benchmark_path, quality_tier& tier)
+{
+    core::mapped_file file;
+    if (!file.openLoose(benchmark_path)) {
+        return false;
+    }
+
+    const std::string text(file.begin(), file.end());
+    const size_t      start = text.find(recommendation_key);
+    if (start == std::string::npos) {
+        return false;
+    }
+    const size_t first = start + std::char_traits<char>::length(recommendation_key);
+    const size_t last  = text.find('"', first);
+    return last != std::string::npos && parseQualityTier(text.substr(first, last - first), tier);
+}
+
+}  // namespace shiny::graphics
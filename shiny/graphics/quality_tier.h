@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace shiny::graphics {
+
+/*
+The settings that trade image quality for GPU time, which the renderer can switch between while it
+runs, see renderer::setQuality. The defaults are the high tier, which is what the renderer has
+always rendered with.
+
+`render_scale` only applies where frames are scaled at all, i.e. with dynamic resolution, where it
+is the largest scale, or temporal upscaling. `lod_bias` moves both the textures' mip levels and the
+meshes' levels of detail, by that many levels, coarser for positive ones. `ray_query_shadows`
+traces the sun's shadows instead of rendering cascades, only where the device has ray queries.
+*/
+struct quality_settings
+{
+    float    anisotropy        = 16.f;  // 1 for none, at most what the device has
+    uint32_t samples           = 0;     // per pixel, 1 for none and 0 for the most the device has
+    uint32_t shadow_resolution = 2048;  // of each cascade
+    float    render_scale      = 1.f;   // of the width and height
+    float    lod_bias          = 0.f;
+    bool     ray_query_shadows = false;
+
+    bool operator==(const quality_settings& other) const
+    {
+        return anisotropy == other.anisotropy && samples == other.samples
+               && shadow_resolution == other.shadow_resolution
+               && render_scale == other.render_scale && lod_bias == other.lod_bias
+               && ray_query_shadows == other.ray_query_shadows;
+    }
+    bool operator!=(const quality_settings& other) const { return !(*this == other); }
+};
+
+enum class quality_tier : uint8_t
+{
+    low,
+    medium,
+    high,
+    ultra,
+};
+
+const uint32_t quality_tier_count = 4;
+
+quality_settings qualitySettings(quality_tier tier);
+
+const char* qualityTierName(quality_tier tier);
+
+// False for anything that isn't one of the names
+bool parseQualityTier(const std::string& name, quality_tier& tier);
+
+/*
+The best tier whose frames should take at most `budget_ms` of GPU time, going by the median GPU
+time of a benchmark rendered at `measured`. The tiers' costs relative to each other are estimates,
+so the prediction only has to fit within most of the budget.
+*/
+quality_tier recommendQualityTier(quality_tier measured, float gpu_ms, float budget_ms);
+
+// The tier a benchmark's results recommend, see renderer::benchmark. False if the file can't be
+// read or has no recommendation.
+bool readRecommendedQualityTier(const std::string& benchmark_path, quality_tier& tier);
+
+}  // namespace shiny::graphics
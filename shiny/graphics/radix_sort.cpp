@@ -0,0 +1,57 @@
+#include "graphics/radix_sort.h"
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+namespace shiny::graphics {
+
+void
+radixSort(std::vector<sort_entry>& entries, std::vector<sort_entry>& scratch)
+{
+    const size_t count = entries.size();
+    if (count < 2) {
+        return;
+    }
+
+    // Every byte's histogram comes out of a single pass over the keys
+    std::array<std::array<uint32_t, 256>, 8> histograms = {};
+    for (const sort_entry& entry : entries) {
+        for (uint32_t byte = 0; byte < 8; ++byte) {
+            ++histograms[byte][(entry.key >> (byte * 8)) & 0xff];
+        }
+    }
+
+    scratch.resize(count);
+
+    std::vector<sort_entry>* source      = &entries;
+    std::vector<sort_entry>* destination = &scratch;
+
+    for (uint32_t byte = 0; byte < 8; ++byte) {
+        std::array<uint32_t, 256>& histogram = histograms[byte];
+
+        // Every key has the same byte here, so the order wouldn't change
+        if (histogram[((*source)[0].key >> (byte * 8)) & 0xff] == count) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t& bucket : histogram) {
+            const uint32_t size = bucket;
+            bucket              = offset;
+            offset += size;
+        }
+
+        for (const sort_entry& entry : *source) {
+            (*destination)[histogram[(entry.key >> (byte * 8)) & 0xff]++] = entry;
+        }
+
+        std::swap(source, destination);
+    }
+
+    if (source != &entries) {
+        entries.swap(scratch);
+    }
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+// A key and whatever it was made for, usually an index into another array
+struct sort_entry
+{
+    uint64_t key   = 0;
+    uint32_t value = 0;
+};
+
+/*
+Sorts the entries by key, least significant byte first, one counting pass per byte. It's stable,
+and passes over bytes that are the same in every key are skipped, so keys that only use a few of
+their bits cost only a few passes. `scratch` is only there to be reused from one sort to the next.
+*/
+void radixSort(std::vector<sort_entry>& entries, std::vector<sort_entry>& scratch);
+
+}  // namespace shiny::graphics
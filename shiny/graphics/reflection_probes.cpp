@@ -0,0 +1,800 @@
+#include "graphics/reflection_probes.h"
+
+#include "core/mapped_file.h"
+#include "graphics/barrier_batch.h"
+#include "graphics/host_allocator.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+using shiny::graphics::reflection_probe_levels;
+using shiny::graphics::reflection_probe_size;
+
+// Filtered and blended by every device, and a store format of every device's storage images
+const vk::Format probe_format = vk::Format::eR16G16B16A16Sfloat;
+
+// Every device can render to it, and at the probes' size its precision is plenty
+const vk::Format probe_depth_format = vk::Format::eD16Unorm;
+
+// Has to match probe.vert's
+const float probe_near_plane = 0.05f;
+
+// How wide, in radians, the lobe of the roughest level is, and which level the surfaces reflect
+const float probe_roughest_lobe    = 0.8f;
+const float probe_reflection_level = 2.f;
+
+// Has to match the workgroup of probe_filter.comp
+const uint32_t probe_filter_group = 8;
+
+// What a face looks along, and which way is up in it, in the order of the cube's layers. With the
+// faces not flipped in y, see faceProjection, this is how cubemaps lay their texels out.
+const glm::vec3 face_directions[6] = { { 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f },
+                                       { 0.f, -1.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f } };
+const glm::vec3 face_ups[6]        = { { 0.f, -1.f, 0.f }, { 0.f, -1.f, 0.f }, { 0.f, 0.f, 1.f },
+                                { 0.f, 0.f, -1.f }, { 0.f, -1.f, 0.f }, { 0.f, -1.f, 0.f } };
+
+// The capture's push constants: the vertex shader's, and then the fragment shader's at an offset
+struct probe_constants
+{
+    glm::mat4 model_view;
+    glm::vec3 sun;  // towards it, in the face's view space
+    uint32_t  texture = 0;
+    glm::vec3 sun_color;
+    float     padding = 0.f;
+};
+
+const uint32_t probe_fragment_offset = offsetof(probe_constants, sun);
+const uint32_t probe_texture_offset  = offsetof(probe_constants, texture);
+
+// 90 degrees across, reverse-Z without a far plane like the camera's, but not flipped in y
+glm::mat4
+faceProjection()
+{
+    glm::mat4 result(0.f);
+    result[0][0] = 1.f;
+    result[1][1] = 1.f;
+    result[2][3] = -1.f;
+    result[3][2] = probe_near_plane;
+    return result;
+}
+
+// The lobe of a level, widening with the square of the level like roughness does
+float
+levelLobe(uint32_t level)
+{
+    const float roughness = (float)level / (float)(reflection_probe_levels - 1);
+    return probe_roughest_lobe * roughness * roughness;
+}
+
+vk::ImageSubresourceRange
+probeRange(uint32_t probe, uint32_t level, uint32_t levels = 1)
+{
+    return vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, levels, probe * 6, 6);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+reflection_probes::init(vk::PhysicalDevice                     physical_device,
+                        vk::Device                             device,
+                        memory_allocator&                      allocator,
+                        layout_cache&                          layouts,
+                        view_cache&                            views,
+                        pipeline_cache&                        pipelines,
+                        const std::vector<probe_vertex_input>& inputs,
+                        vk::DescriptorSetLayout                textures,
+                        const reflection_probe_settings&       settings,
+                        uint32_t                               frames)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_frames    = frames;
+    m_whole     = settings.whole_probes;
+
+    const size_t count = std::min<size_t>(settings.probes.size(), max_reflection_probes);
+    m_probes.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        m_probes[i].settings = settings.probes[i];
+    }
+
+    // A face is all cleared and rendered, and goes straight on to being copied out. The faces
+    // before it may still be being copied, and the depth is shared with the face before.
+    std::array<vk::AttachmentDescription, 2> attachments = {
+        vk::AttachmentDescription()
+          .setFormat(probe_format)
+          .setSamples(vk::SampleCountFlagBits::e1)
+          .setLoadOp(vk::AttachmentLoadOp::eClear)
+          .setStoreOp(vk::AttachmentStoreOp::eStore)
+          .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+          .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+          .setInitialLayout(vk::ImageLayout::eUndefined)
+          .setFinalLayout(vk::ImageLayout::eTransferSrcOptimal),
+        vk::AttachmentDescription()
+          .setFormat(probe_depth_format)
+          .setSamples(vk::SampleCountFlagBits::e1)
+          .setLoadOp(vk::AttachmentLoadOp::eClear)
+          .setStoreOp(vk::AttachmentStoreOp::eDontCare)
+          .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+          .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+          .setInitialLayout(vk::ImageLayout::eUndefined)
+          .setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal),
+    };
+
+    auto colorreference = vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal);
+    auto depthreference =
+      vk::AttachmentReference(1, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    auto subpass = vk::SubpassDescription()
+                     .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+                     .setColorAttachmentCount(1)
+                     .setPColorAttachments(&colorreference)
+                     .setPDepthStencilAttachment(&depthreference);
+
+    std::array<vk::SubpassDependency, 2> dependencies = {
+        vk::SubpassDependency()
+          .setSrcSubpass(VK_SUBPASS_EXTERNAL)
+          .setDstSubpass(0)
+          .setSrcStageMask(vk::PipelineStageFlagBits::eTransfer
+                           | vk::PipelineStageFlagBits::eLateFragmentTests)
+          .setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput
+                           | vk::PipelineStageFlagBits::eEarlyFragmentTests)
+          .setSrcAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+          .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentWrite
+                            | vk::AccessFlagBits::eDepthStencilAttachmentRead
+                            | vk::AccessFlagBits::eDepthStencilAttachmentWrite),
+        vk::SubpassDependency()
+          .setSrcSubpass(0)
+          .setDstSubpass(VK_SUBPASS_EXTERNAL)
+          .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+          .setDstStageMask(vk::PipelineStageFlagBits::eTransfer)
+          .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+          .setDstAccessMask(vk::AccessFlagBits::eTransferRead),
+    };
+
+    auto renderpassinfo = vk::RenderPassCreateInfo()
+                            .setAttachmentCount((uint32_t)attachments.size())
+                            .setPAttachments(attachments.data())
+                            .setSubpassCount(1)
+                            .setPSubpasses(&subpass)
+                            .setDependencyCount((uint32_t)dependencies.size())
+                            .setPDependencies(dependencies.data());
+
+    m_render_pass = m_device.createRenderPass(renderpassinfo, hostAllocator());
+
+    auto createImage = [&](vk::Format format, uint32_t levels, uint32_t layers,
+                           vk::ImageUsageFlags usage, vk::ImageCreateFlags flags,
+                           allocation& memory) {
+        auto imageinfo =
+          vk::ImageCreateInfo()
+            .setFlags(flags)
+            .setImageType(vk::ImageType::e2D)
+            .setExtent(vk::Extent3D(reflection_probe_size, reflection_probe_size, 1))
+            .setMipLevels(levels)
+            .setArrayLayers(layers)
+            .setFormat(format)
+            .setTiling(vk::ImageTiling::eOptimal)
+            .setInitialLayout(vk::ImageLayout::eUndefined)
+            .setUsage(usage)
+            .setSamples(vk::SampleCountFlagBits::e1)
+            .setSharingMode(vk::SharingMode::eExclusive);
+
+        vk::Image image = m_device.createImage(imageinfo, hostAllocator());
+        memory          = m_allocator->allocate(m_device.getImageMemoryRequirements(image),
+                                       vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                       memory_allocator::resource_kind::optimal,
+                                       memory_category::render_target);
+        m_device.bindImageMemory(image, memory.memory, memory.offset);
+        return image;
+    };
+
+    auto createView = [&](vk::Image image, vk::ImageViewType type, vk::Format format,
+                          const vk::ImageSubresourceRange& range) {
+        auto viewinfo = vk::ImageViewCreateInfo()
+                          .setImage(image)
+                          .setViewType(type)
+                          .setFormat(format)
+                          .setSubresourceRange(range);
+        return m_device.createImageView(viewinfo, hostAllocator());
+    };
+
+    m_capture = createImage(probe_format, 1, 6,
+                            vk::ImageUsageFlagBits::eColorAttachment
+                              | vk::ImageUsageFlagBits::eTransferSrc,
+                            vk::ImageCreateFlagBits::eCubeCompatible, m_capture_memory);
+    m_depth   = createImage(probe_depth_format, 1, 1,
+                            vk::ImageUsageFlagBits::eDepthStencilAttachment,
+                            vk::ImageCreateFlags(), m_depth_memory);
+    m_depth_view =
+      createView(m_depth, vk::ImageViewType::e2D, probe_depth_format,
+                 vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1));
+
+    for (uint32_t face = 0; face < 6; ++face) {
+        m_capture_views.push_back(
+          createView(m_capture, vk::ImageViewType::e2D, probe_format,
+                     vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, face, 1)));
+
+        std::array<vk::ImageView, 2> framebufferviews = { m_capture_views.back(), m_depth_view };
+
+        auto framebufferinfo = vk::FramebufferCreateInfo()
+                                 .setRenderPass(m_render_pass)
+                                 .setAttachmentCount((uint32_t)framebufferviews.size())
+                                 .setPAttachments(framebufferviews.data())
+                                 .setWidth(reflection_probe_size)
+                                 .setHeight(reflection_probe_size)
+                                 .setLayers(1);
+        m_framebuffers.push_back(m_device.createFramebuffer(framebufferinfo, hostAllocator()));
+    }
+
+    // At least one probe's worth, so that the view is valid without any
+    const uint32_t layers = std::max<uint32_t>((uint32_t)count, 1) * 6;
+    m_cubes               = createImage(probe_format, reflection_probe_levels, layers,
+                          vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage
+                            | vk::ImageUsageFlagBits::eTransferDst,
+                          vk::ImageCreateFlagBits::eCubeCompatible, m_cubes_memory);
+    m_cubes_view          = createView(m_cubes, vk::ImageViewType::e2DArray, probe_format,
+                              vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0,
+                                                        reflection_probe_levels, 0, layers));
+
+    // Clamped to the face, whose edges the shaders' lookups never reach past
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(vk::Filter::eLinear)
+                         .setMinFilter(vk::Filter::eLinear)
+                         .setMipmapMode(vk::SamplerMipmapMode::eLinear)
+                         .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setMinLod(0.f)
+                         .setMaxLod((float)reflection_probe_levels);
+
+    m_sampler = views.sampler(samplerinfo);
+
+    // Every frame's reflection_probe_view is a region of its own, bound at an aligned offset
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+    m_view_size = (sizeof(reflection_probe_view) + alignment - 1) / alignment * alignment;
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(m_view_size * frames)
+                        .setUsage(vk::BufferUsageFlagBits::eStorageBuffer)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_views        = m_device.createBuffer(bufferinfo, hostAllocator());
+    m_views_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_views),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_views, m_views_memory.memory, m_views_memory.offset);
+
+    // The textures are the only set, everything else is a push constant
+    std::array<vk::PushConstantRange, 2> constants = {
+        vk::PushConstantRange()
+          .setStageFlags(vk::ShaderStageFlagBits::eVertex)
+          .setOffset(0)
+          .setSize(probe_fragment_offset),
+        vk::PushConstantRange()
+          .setStageFlags(vk::ShaderStageFlagBits::eFragment)
+          .setOffset(probe_fragment_offset)
+          .setSize(sizeof(probe_constants) - probe_fragment_offset),
+    };
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setSetLayoutCount(1)
+                        .setPSetLayouts(&textures)
+                        .setPushConstantRangeCount((uint32_t)constants.size())
+                        .setPPushConstantRanges(constants.data());
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    auto createShader = [&](const char* path) {
+        core::mapped_file code(path);
+
+        auto shaderinfo = vk::ShaderModuleCreateInfo()
+                            .setCodeSize(code.size())
+                            .setPCode((const uint32_t*)code.data());
+
+        return m_device.createShaderModule(shaderinfo, hostAllocator());
+    };
+
+    m_vertex_shader   = createShader("shaders/probe_vert.spv");
+    m_fragment_shader = createShader("shaders/probe_frag.spv");
+
+    std::array<vk::PipelineShaderStageCreateInfo, 2> stages = {
+        vk::PipelineShaderStageCreateInfo()
+          .setStage(vk::ShaderStageFlagBits::eVertex)
+          .setModule(m_vertex_shader)
+          .setPName("main"),
+        vk::PipelineShaderStageCreateInfo()
+          .setStage(vk::ShaderStageFlagBits::eFragment)
+          .setModule(m_fragment_shader)
+          .setPName("main"),
+    };
+
+    auto inputassembly =
+      vk::PipelineInputAssemblyStateCreateInfo().setTopology(vk::PrimitiveTopology::eTriangleList);
+
+    // Every face is the same size, so the viewport is too
+    auto viewportarea = vk::Viewport(0.f, 0.f, (float)reflection_probe_size,
+                                     (float)reflection_probe_size, 0.f, 1.f);
+    auto scissor      = vk::Rect2D({ 0, 0 }, { reflection_probe_size, reflection_probe_size });
+    auto viewport     = vk::PipelineViewportStateCreateInfo()
+                      .setViewportCount(1)
+                      .setPViewports(&viewportarea)
+                      .setScissorCount(1)
+                      .setPScissors(&scissor);
+
+    // The faces aren't flipped in y like the camera's projection is, so neither is the winding
+    auto rasterizer = vk::PipelineRasterizationStateCreateInfo()
+                        .setPolygonMode(vk::PolygonMode::eFill)
+                        .setCullMode(vk::CullModeFlagBits::eBack)
+                        .setFrontFace(vk::FrontFace::eClockwise)
+                        .setLineWidth(1.f);
+
+    auto multisampling =
+      vk::PipelineMultisampleStateCreateInfo().setRasterizationSamples(vk::SampleCountFlagBits::e1);
+
+    auto depthstencil = vk::PipelineDepthStencilStateCreateInfo()
+                          .setDepthTestEnable(true)
+                          .setDepthWriteEnable(true)
+                          .setDepthCompareOp(vk::CompareOp::eGreater);
+
+    auto blendattachment =
+      vk::PipelineColorBlendAttachmentState().setColorWriteMask(
+        vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG
+        | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
+
+    auto blending =
+      vk::PipelineColorBlendStateCreateInfo().setAttachmentCount(1).setPAttachments(
+        &blendattachment);
+
+    for (const probe_vertex_input& input : inputs) {
+        auto vertexinput =
+          vk::PipelineVertexInputStateCreateInfo()
+            .setVertexBindingDescriptionCount((uint32_t)input.bindings.size())
+            .setPVertexBindingDescriptions(input.bindings.data())
+            .setVertexAttributeDescriptionCount((uint32_t)input.attributes.size())
+            .setPVertexAttributeDescriptions(input.attributes.data());
+
+        auto pipelineinfo = vk::GraphicsPipelineCreateInfo()
+                              .setStageCount((uint32_t)stages.size())
+                              .setPStages(stages.data())
+                              .setPVertexInputState(&vertexinput)
+                              .setPInputAssemblyState(&inputassembly)
+                              .setPViewportState(&viewport)
+                              .setPRasterizationState(&rasterizer)
+                              .setPMultisampleState(&multisampling)
+                              .setPDepthStencilState(&depthstencil)
+                              .setPColorBlendState(&blending)
+                              .setLayout(m_layout)
+                              .setRenderPass(m_render_pass)
+                              .setSubpass(0);
+
+        m_pipelines.push_back(
+          m_device.createGraphicsPipeline(pipelines.handle(), pipelineinfo, hostAllocator()));
+    }
+
+    // 0: the level above, 1: the level being filtered
+    std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(0)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(1)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eStorageImage)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+    };
+
+    m_filter_set_layout = layouts.descriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo()
+        .setBindingCount((uint32_t)bindings.size())
+        .setPBindings(bindings.data()));
+
+    auto spread = vk::PushConstantRange()
+                    .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                    .setOffset(0)
+                    .setSize(sizeof(float));
+
+    m_filter_layout = layouts.pipelineLayout(vk::PipelineLayoutCreateInfo()
+                                               .setSetLayoutCount(1)
+                                               .setPSetLayouts(&m_filter_set_layout)
+                                               .setPushConstantRangeCount(1)
+                                               .setPPushConstantRanges(&spread));
+
+    m_filter_shader = createShader("shaders/probe_filter_comp.spv");
+
+    auto filterinfo = vk::ComputePipelineCreateInfo()
+                        .setStage(vk::PipelineShaderStageCreateInfo()
+                                    .setStage(vk::ShaderStageFlagBits::eCompute)
+                                    .setModule(m_filter_shader)
+                                    .setPName("main"))
+                        .setLayout(m_filter_layout);
+
+    m_filter_pipeline =
+      m_device.createComputePipeline(pipelines.handle(), filterinfo, hostAllocator());
+
+    // Every level blurs the one above by as much more as its lobe is wider, since blurs add up in
+    // their squares, and by at least a texel of its own
+    for (uint32_t level = 1; level < reflection_probe_levels; ++level) {
+        const float wider = levelLobe(level) * levelLobe(level)
+                            - levelLobe(level - 1) * levelLobe(level - 1);
+        const float texel = 1.5707964f / (float)(reflection_probe_size >> level);
+        m_spreads[level]  = std::max(std::sqrt(wider), texel);
+    }
+
+    // The levels of every probe have sets of their own, written once. Every level but the first
+    // is filtered in the general layout, and read in it by the level below.
+    const uint32_t filtersets = std::max<uint32_t>((uint32_t)count, 1)
+                                * (reflection_probe_levels - 1);
+    m_filter_descriptors.init(m_device,
+                              { { vk::DescriptorType::eCombinedImageSampler, 1 },
+                                { vk::DescriptorType::eStorageImage, 1 } },
+                              filtersets);
+
+    for (uint32_t probe = 0; probe < (uint32_t)count; ++probe) {
+        for (uint32_t level = 1; level < reflection_probe_levels; ++level) {
+            filter_level filter;
+            filter.source = createView(m_cubes, vk::ImageViewType::e2DArray, probe_format,
+                                       probeRange(probe, level - 1));
+            filter.target = createView(m_cubes, vk::ImageViewType::e2DArray, probe_format,
+                                       probeRange(probe, level));
+            filter.set    = m_filter_descriptors.allocate(m_filter_set_layout);
+
+            auto source = vk::DescriptorImageInfo(m_sampler, filter.source,
+                                                  vk::ImageLayout::eGeneral);
+            auto target = vk::DescriptorImageInfo(nullptr, filter.target,
+                                                  vk::ImageLayout::eGeneral);
+
+            std::array<vk::WriteDescriptorSet, 2> writes = {
+                vk::WriteDescriptorSet()
+                  .setDstSet(filter.set)
+                  .setDstBinding(0)
+                  .setDescriptorCount(1)
+                  .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                  .setPImageInfo(&source),
+                vk::WriteDescriptorSet()
+                  .setDstSet(filter.set)
+                  .setDstBinding(1)
+                  .setDescriptorCount(1)
+                  .setDescriptorType(vk::DescriptorType::eStorageImage)
+                  .setPImageInfo(&target),
+            };
+            m_device.updateDescriptorSets(writes, nullptr);
+
+            m_filter_levels.push_back(filter);
+        }
+    }
+}
+
+void
+reflection_probes::destroy()
+{
+    for (vk::Pipeline pipeline : m_pipelines) {
+        m_device.destroyPipeline(pipeline, hostAllocator());
+    }
+    m_pipelines.clear();
+    m_device.destroyShaderModule(m_vertex_shader, hostAllocator());
+    m_device.destroyShaderModule(m_fragment_shader, hostAllocator());
+
+    for (const filter_level& filter : m_filter_levels) {
+        m_device.destroyImageView(filter.source, hostAllocator());
+        m_device.destroyImageView(filter.target, hostAllocator());
+    }
+    m_filter_levels.clear();
+    m_filter_descriptors.destroy();
+    m_device.destroyPipeline(m_filter_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_filter_shader, hostAllocator());
+
+    for (vk::Framebuffer framebuffer : m_framebuffers) {
+        m_device.destroyFramebuffer(framebuffer, hostAllocator());
+    }
+    for (vk::ImageView view : m_capture_views) {
+        m_device.destroyImageView(view, hostAllocator());
+    }
+    m_framebuffers.clear();
+    m_capture_views.clear();
+    m_device.destroyRenderPass(m_render_pass, hostAllocator());
+
+    m_device.destroyImageView(m_depth_view, hostAllocator());
+    m_device.destroyImage(m_depth, hostAllocator());
+    m_allocator->free(m_depth_memory);
+    m_device.destroyImage(m_capture, hostAllocator());
+    m_allocator->free(m_capture_memory);
+    m_device.destroyImageView(m_cubes_view, hostAllocator());
+    m_device.destroyImage(m_cubes, hostAllocator());
+    m_allocator->free(m_cubes_memory);
+
+    m_device.destroyBuffer(m_views, hostAllocator());
+    m_allocator->free(m_views_memory);
+
+    m_cubes       = nullptr;
+    m_cubes_view  = nullptr;
+    m_views       = nullptr;
+    m_cubes_ready = false;
+}
+
+/*
+Probes that were never captured go first, the nearest first. Otherwise every probe is worth as many
+captures as it has gone without, less the further it is from the camera, in its own radii.
+*/
+uint32_t
+reflection_probes::nextProbe(const glm::vec3& eye) const
+{
+    uint32_t best      = ~0u;
+    float    bestscore = -1.f;
+    bool     bestnew   = false;
+    for (uint32_t i = 0; i < (uint32_t)m_probes.size(); ++i) {
+        const probe& p        = m_probes[i];
+        const float  distance = glm::length(p.settings.position - eye);
+
+        float score = 0.f;
+        if (!p.captured) {
+            score = 1.f / (1.f + distance);
+        } else {
+            score = (float)(m_captures - p.updated + 1)
+                    / (1.f + distance / std::max(p.settings.radius, 1e-3f));
+        }
+
+        const bool isnew = !p.captured;
+        if (best == ~0u || (isnew && !bestnew) || (isnew == bestnew && score > bestscore)) {
+            best      = i;
+            bestscore = score;
+            bestnew   = isnew;
+        }
+    }
+    return best;
+}
+
+void
+reflection_probes::beginFrame(uint32_t         frame,
+                              const glm::mat4& view,
+                              const glm::vec3& direction,
+                              const glm::vec3& color)
+{
+    const glm::mat4 inverseview = glm::inverse(view);
+    const glm::vec3 towards     = glm::normalize(direction);
+    m_sun_color                 = color;
+
+    if (m_current == ~0u) {
+        m_current = nextProbe(glm::vec3(inverseview[3]));
+    }
+
+    // The draws' vectors are kept, only emptied
+    uint32_t count = 0;
+    if (m_current != ~0u) {
+        const uint32_t first = m_probes[m_current].next_face;
+        count                = m_whole ? 6 - first : 1;
+    }
+    m_faces.resize(count);
+
+    const glm::mat4 projection = faceProjection();
+    for (uint32_t i = 0; i < count; ++i) {
+        const probe&   p    = m_probes[m_current];
+        const uint32_t face = p.next_face + i;
+
+        face_capture& capture = m_faces[i];
+        capture.face          = face;
+        capture.view = glm::lookAt(p.settings.position, p.settings.position + face_directions[face],
+                                   face_ups[face]);
+        capture.bounds = extractFrustum(projection * capture.view);
+        capture.sun    = glm::normalize(glm::mat3(capture.view) * towards);
+        capture.draws.clear();
+    }
+
+    reflection_probe_view data;
+    data.view_to_world = inverseview;
+    data.count         = (uint32_t)m_probes.size();
+    data.level         = probe_reflection_level;
+    for (uint32_t i = 0; i < (uint32_t)m_probes.size(); ++i) {
+        const reflection_probe& settings = m_probes[i].settings;
+        const float             radius   = m_probes[i].captured ? settings.radius : 0.f;
+        data.spheres[i]                  = glm::vec4(settings.position, radius);
+    }
+
+    std::memcpy(static_cast<char*>(m_views_memory.mapped) + (frame % m_frames) * m_view_size, &data,
+                sizeof(data));
+}
+
+void
+reflection_probes::push(uint32_t face, const probe_draw& draw)
+{
+    m_faces[face].draws.push_back(draw);
+}
+
+/*
+The first record moves the whole image out of the undefined layout, so that the shaders' view of
+it is valid before any probe is captured. Probes that aren't yet are never sampled.
+*/
+void
+reflection_probes::record(vk::CommandBuffer command_buffer, vk::DescriptorSet textures)
+{
+    if (!m_cubes_ready) {
+        barrier_batch barriers;
+        barriers.image(m_cubes,
+                       vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0,
+                                                 VK_REMAINING_MIP_LEVELS, 0,
+                                                 VK_REMAINING_ARRAY_LAYERS),
+                       layoutScope(vk::ImageLayout::eUndefined),
+                       layoutScope(vk::ImageLayout::eShaderReadOnlyOptimal));
+        barriers.record(command_buffer);
+        m_cubes_ready = true;
+    }
+
+    m_rendered = 0;
+    if (m_current == ~0u || m_faces.empty()) {
+        return;
+    }
+
+    for (const face_capture& capture : m_faces) {
+        recordCapture(command_buffer, textures, capture);
+        ++m_rendered;
+    }
+
+    probe& p = m_probes[m_current];
+    p.next_face += (uint32_t)m_faces.size();
+    if (p.next_face < 6) {
+        return;
+    }
+
+    recordFilter(command_buffer, m_current);
+    p.next_face = 0;
+    p.captured  = true;
+    p.updated   = ++m_captures;
+    m_current   = ~0u;
+}
+
+void
+reflection_probes::recordCapture(vk::CommandBuffer   command_buffer,
+                                 vk::DescriptorSet   textures,
+                                 const face_capture& capture)
+{
+    // Whatever nothing was drawn over is the forward clear color, and the depth is reverse-Z
+    std::array<vk::ClearValue, 2> clears;
+    clears[0].color        = vk::ClearColorValue(std::array<float, 4>{ 0.f, 0.f, 0.f, 1.f });
+    clears[1].depthStencil = vk::ClearDepthStencilValue(0.f, 0);
+
+    auto begininfo = vk::RenderPassBeginInfo()
+                       .setRenderPass(m_render_pass)
+                       .setFramebuffer(m_framebuffers[capture.face])
+                       .setRenderArea(vk::Rect2D({ 0, 0 }, { reflection_probe_size,
+                                                             reflection_probe_size }))
+                       .setClearValueCount((uint32_t)clears.size())
+                       .setPClearValues(clears.data());
+
+    command_buffer.beginRenderPass(begininfo, vk::SubpassContents::eInline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_layout, 0, textures,
+                                      nullptr);
+
+    probe_constants constants;
+    constants.sun       = capture.sun;
+    constants.sun_color = m_sun_color;
+    command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eFragment,
+                                 probe_fragment_offset,
+                                 sizeof(probe_constants) - probe_fragment_offset,
+                                 &constants.sun);
+
+    // Only what differs from the previous draw is bound again, like the cascades do
+    uint32_t      boundinput = ~0u;
+    vk::Buffer    boundvertices;
+    vk::Buffer    boundattributes;
+    vk::Buffer    boundindices;
+    vk::IndexType boundindextype = vk::IndexType::eUint32;
+
+    for (const probe_draw& draw : capture.draws) {
+        if (draw.input != boundinput) {
+            command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                        m_pipelines[draw.input]);
+            boundinput = draw.input;
+        }
+        if (draw.vertex_buffer != boundvertices || draw.attribute_buffer != boundattributes) {
+            std::array<vk::Buffer, 2>     buffers = { draw.vertex_buffer, draw.attribute_buffer };
+            std::array<vk::DeviceSize, 2> offsets = { 0, 0 };
+            command_buffer.bindVertexBuffers(0, 2, buffers.data(), offsets.data());
+            boundvertices   = draw.vertex_buffer;
+            boundattributes = draw.attribute_buffer;
+        }
+        if (draw.index_buffer != boundindices || draw.index_type != boundindextype) {
+            command_buffer.bindIndexBuffer(draw.index_buffer, 0, draw.index_type);
+            boundindices   = draw.index_buffer;
+            boundindextype = draw.index_type;
+        }
+
+        const glm::mat4 modelview = capture.view * draw.transform;
+        command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eVertex, 0,
+                                     sizeof(modelview), &modelview);
+        command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eFragment,
+                                     probe_texture_offset, sizeof(draw.texture), &draw.texture);
+        command_buffer.drawIndexed(draw.index_count, 1, draw.first_index, draw.vertex_offset, 0);
+    }
+
+    command_buffer.endRenderPass();
+}
+
+/*
+The captured faces are copied into the probe's first level as they are, and every level below is
+filtered from the one above, in the general layout, which every level stays in until the last one
+is done. The shaders reading the cubes in the frames before are waited for first.
+*/
+void
+reflection_probes::recordFilter(vk::CommandBuffer command_buffer, uint32_t index)
+{
+    const access_scope sampled = layoutScope(vk::ImageLayout::eShaderReadOnlyOptimal);
+    const access_scope copied  = layoutScope(vk::ImageLayout::eTransferDstOptimal);
+    const access_scope read    = { vk::PipelineStageFlagBits::eComputeShader,
+                                vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral };
+    const access_scope written = { vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eGeneral };
+
+    barrier_batch barriers;
+    barriers.image(m_cubes, probeRange(index, 0), sampled, copied);
+    barriers.image(m_cubes, probeRange(index, 1, reflection_probe_levels - 1), sampled, written);
+    barriers.record(command_buffer);
+
+    auto copy = vk::ImageCopy()
+                  .setSrcSubresource(
+                    vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 6))
+                  .setDstSubresource(
+                    vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, index * 6, 6))
+                  .setExtent(vk::Extent3D(reflection_probe_size, reflection_probe_size, 1));
+    command_buffer.copyImage(m_capture, vk::ImageLayout::eTransferSrcOptimal, m_cubes,
+                             vk::ImageLayout::eTransferDstOptimal, copy);
+
+    barriers.clear();
+    barriers.image(m_cubes, probeRange(index, 0), copied, read);
+    barriers.record(command_buffer);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_filter_pipeline);
+    for (uint32_t level = 1; level < reflection_probe_levels; ++level) {
+        const filter_level& filter =
+          m_filter_levels[index * (reflection_probe_levels - 1) + level - 1];
+        const uint32_t size   = reflection_probe_size >> level;
+        const uint32_t groups = (size + probe_filter_group - 1) / probe_filter_group;
+
+        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_filter_layout, 0,
+                                          filter.set, nullptr);
+        command_buffer.pushConstants(m_filter_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                     sizeof(float), &m_spreads[level]);
+        command_buffer.dispatch(groups, groups, 6);
+
+        // The next level reads this one
+        barriers.clear();
+        barriers.memory(written, read);
+        barriers.record(command_buffer);
+    }
+
+    barriers.clear();
+    barriers.image(m_cubes, probeRange(index, 0, reflection_probe_levels), written, sampled);
+    barriers.record(command_buffer);
+}
+
+vk::DescriptorImageInfo
+reflection_probes::cubes() const
+{
+    return vk::DescriptorImageInfo(m_sampler, m_cubes_view,
+                                   vk::ImageLayout::eShaderReadOnlyOptimal);
+}
+
+vk::DescriptorBufferInfo
+reflection_probes::view(uint32_t frame) const
+{
+    return vk::DescriptorBufferInfo(m_views, frame * m_view_size, m_view_size);
+}
+
+uint32_t
+reflection_probes::captured() const
+{
+    return (uint32_t)std::count_if(m_probes.begin(), m_probes.end(),
+                                   [](const probe& p) { return p.captured; });
+}
+
+}  // namespace shiny::graphics
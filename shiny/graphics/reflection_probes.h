@@ -0,0 +1,227 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/frustum_culling.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/view_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+// Has to match maxReflectionProbes in probes.glsl
+const uint32_t max_reflection_probes = 16;
+
+// Texels across a face of a probe at its sharpest level, and the levels it's prefiltered into,
+// each rougher than the one before, down to 4 texels across
+const uint32_t reflection_probe_size   = 128;
+const uint32_t reflection_probe_levels = 6;
+
+// A point the scene is captured from, whose surroundings are reflected by whatever is within
+// `radius` of it
+struct reflection_probe
+{
+    glm::vec3 position = glm::vec3(0.f);
+    float     radius   = 4.f;
+};
+
+// What renderer::setReflectionProbes captures, and how quickly
+struct reflection_probe_settings
+{
+    std::vector<reflection_probe> probes;  // up to max_reflection_probes
+
+    // Captures all six faces of a probe a frame instead of one, which brings whatever moves into
+    // the reflections six times sooner, for six times the cost
+    bool whole_probes = false;
+};
+
+/*
+What the fragment shaders read once per frame to look up the reflections, laid out like the std430
+Probes block of probes.glsl. The spheres are in world space, where the probes were captured.
+*/
+struct reflection_probe_view
+{
+    glm::mat4 view_to_world;
+    uint32_t  count      = 0;
+    float     level      = 0.f;  // of the prefiltered levels, the one the surfaces reflect
+    float     padding[2] = {};
+    glm::vec4 spheres[max_reflection_probes];  // center and radius, 0 until the probe is captured
+};
+
+static_assert(sizeof(reflection_probe_view) == 336,
+              "reflection_probe_view has to match the shaders' layout");
+
+// Where a vertex format's streams are, for the capture's vertex input: the positions and the
+// texture coordinates, at their locations
+struct probe_vertex_input
+{
+    std::array<vk::VertexInputBindingDescription, 2>   bindings;
+    std::array<vk::VertexInputAttributeDescription, 2> attributes;
+};
+
+// One instance drawn into a face of a probe
+struct probe_draw
+{
+    vk::Buffer    vertex_buffer;  // the positions
+    vk::Buffer    attribute_buffer;
+    vk::Buffer    index_buffer;
+    vk::IndexType index_type    = vk::IndexType::eUint32;
+    uint32_t      index_count   = 0;
+    uint32_t      first_index   = 0;
+    int32_t       vertex_offset = 0;
+    uint32_t      input         = 0;  // which of the vertex inputs given to init()
+    uint32_t      texture       = 0;  // slot in the bindless texture array
+    glm::mat4     transform     = glm::mat4(1.f);  // the model matrix, with any dequantize
+};
+
+/*
+Reflections of the scene, captured into cubemaps at a few fixed points and cached there, rather
+than rendered again for every frame. The probes' cubes are the layers of one cube compatible image,
+six per probe, and every level below the first is a rougher reflection than the one above.
+
+A probe's faces are rendered one at a time, into a cube of their own, by a render pass of their
+own: the casters are culled per face by the caller, against faceFrustum(), and drawn with the
+bindless textures and lit by the sun and an ambient term, but without shadows, clustered lights or
+reflections of their own, which at the probes' size hardly show. Only once all six faces are there
+are they copied into the probe's layers and prefiltered by probe_filter.comp, a level at a time,
+each from the one above, so that the surfaces never reflect a cube that is half of one frame and
+half of another.
+
+A frame captures one face, or all six with whole_probes, of the probe most worth updating: probes
+that were never captured come first, nearest to the camera first, and after that the one that has
+gone longest without an update, for its distance. So every probe keeps being brought up to date,
+round robin, and those near the camera more often.
+
+The fragment shaders sample the cubes through a 2D array view, picking the face themselves, see
+probes.glsl, so that cube arrays and imageCubeArray aren't needed. The image is shared by every
+frame in flight and synchronized by record() itself: between records it's in
+VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+*/
+class reflection_probes
+{
+public:
+    // `textures` is the layout of the bindless texture set the captures sample
+    void init(vk::PhysicalDevice                     physical_device,
+              vk::Device                             device,
+              memory_allocator&                      allocator,
+              layout_cache&                          layouts,
+              view_cache&                            views,
+              pipeline_cache&                        pipelines,
+              const std::vector<probe_vertex_input>& inputs,
+              vk::DescriptorSetLayout                textures,
+              const reflection_probe_settings&       settings,
+              uint32_t                               frames);
+    void destroy();
+
+    // Picks the faces the frame captures, for a sun shining along `-direction`, writes the frame's
+    // reflection_probe_view for a camera with `view`, and drops the draws of the last frame
+    void beginFrame(uint32_t         frame,
+                    const glm::mat4& view,
+                    const glm::vec3& direction,
+                    const glm::vec3& color);
+
+    // The faces the frame captures, and what their draws are culled against, in world space
+    uint32_t       faces() const { return (uint32_t)m_faces.size(); }
+    const frustum& faceFrustum(uint32_t face) const { return m_faces[face].bounds; }
+    void           push(uint32_t face, const probe_draw& draw);
+
+    // Captures the frame's faces, and prefilters the probe once they complete it. Outside of a
+    // render pass, with `textures` the frame's bindless set. The cubes are left readable by
+    // fragment shaders.
+    void record(vk::CommandBuffer command_buffer, vk::DescriptorSet textures);
+
+    // For the fragment shaders' descriptors
+    vk::DescriptorImageInfo  cubes() const;
+    vk::DescriptorBufferInfo view(uint32_t frame) const;
+
+    // Probes that have been captured at least once, and faces the last record() rendered
+    uint32_t captured() const;
+    uint32_t rendered() const { return m_rendered; }
+
+private:
+    struct probe
+    {
+        reflection_probe settings;
+        uint32_t         next_face = 0;      // of the capture underway
+        uint64_t         updated   = 0;      // the capture count when it last completed
+        bool             captured  = false;  // at least once
+    };
+
+    struct face_capture
+    {
+        uint32_t                face = 0;
+        glm::mat4               view;
+        frustum                 bounds;
+        glm::vec3               sun;  // towards it, in the face's view space
+        std::vector<probe_draw> draws;
+    };
+
+    // A level of the prefiltering, from the one above of a probe
+    struct filter_level
+    {
+        vk::ImageView     source;  // the level above, its six layers
+        vk::ImageView     target;
+        vk::DescriptorSet set;
+    };
+
+    uint32_t nextProbe(const glm::vec3& eye) const;
+    void     recordCapture(vk::CommandBuffer   command_buffer,
+                           vk::DescriptorSet   textures,
+                           const face_capture& capture);
+    void     recordFilter(vk::CommandBuffer command_buffer, uint32_t index);
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+    uint32_t          m_frames    = 0;
+    bool              m_whole     = false;
+
+    std::vector<probe> m_probes;
+    uint32_t           m_current  = ~0u;  // the probe being captured
+    uint64_t           m_captures = 0;    // completed so far
+    uint32_t           m_rendered = 0;
+
+    std::vector<face_capture> m_faces;  // this frame's
+    glm::vec3                 m_sun_color = glm::vec3(0.f);
+
+    // Every probe's cube, six layers each, and every level in a 2D array view for the shaders
+    vk::Image     m_cubes;
+    allocation    m_cubes_memory;
+    vk::ImageView m_cubes_view;
+    vk::Sampler   m_sampler;  // owned by the view_cache
+    bool          m_cubes_ready = false;  // out of the undefined layout
+
+    // The cube the faces are rendered into, and the depth they share
+    vk::Image                    m_capture;
+    allocation                   m_capture_memory;
+    std::vector<vk::ImageView>   m_capture_views;  // per face
+    vk::Image                    m_depth;
+    allocation                   m_depth_memory;
+    vk::ImageView                m_depth_view;
+    std::vector<vk::Framebuffer> m_framebuffers;  // per face
+    vk::RenderPass               m_render_pass;
+
+    vk::PipelineLayout        m_layout;  // owned by the layout_cache
+    vk::ShaderModule          m_vertex_shader;
+    vk::ShaderModule          m_fragment_shader;
+    std::vector<vk::Pipeline> m_pipelines;  // per vertex input
+
+    vk::DescriptorSetLayout   m_filter_set_layout;  // owned by the layout_cache
+    vk::PipelineLayout        m_filter_layout;
+    vk::ShaderModule          m_filter_shader;
+    vk::Pipeline              m_filter_pipeline;
+    descriptor_allocator      m_filter_descriptors;
+    std::vector<filter_level> m_filter_levels;  // per probe, levels 1 on
+    std::array<float, reflection_probe_levels> m_spreads = {};  // of each level's filter
+
+    vk::Buffer     m_views;  // host visible, a reflection_probe_view per frame
+    allocation     m_views_memory;
+    vk::DeviceSize m_view_size = 0;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,182 @@
+#include "graphics/render_batch.h"
+
+#include "core/logger.h"
+#include "graphics/frame_readback.h"
+#include "graphics/renderer.h"
+#include "jobs/scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// Encodes that may wait for an encoder, per encoder, before the render waits for them
+const uint32_t queued_encodes = 4;
+
+}  // namespace
+
+namespace shiny::graphics {
+
+std::vector<batch_frame>
+readBatchList(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path + "!");
+    }
+
+    std::vector<batch_frame> frames;
+    std::string              line;
+    for (uint32_t number = 1; std::getline(file, line); ++number) {
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        batch_frame        frame;
+        std::string        rest;
+        fields >> frame.output >> frame.position.x >> frame.position.y >> frame.position.z
+          >> frame.target.x >> frame.target.y >> frame.target.z;
+        if (!fields || fields >> rest) {
+            throw std::runtime_error("Invalid frame on line " + std::to_string(number) + " of "
+                                     + path + "!");
+        }
+        frames.push_back(std::move(frame));
+    }
+    return frames;
+}
+
+void
+batch_queue::open(const std::string& list, uint32_t chunk)
+{
+    m_frames = readBatchList(list);
+    m_claims = list + ".claims";
+    m_chunk  = std::max(chunk, 1u);
+    m_next   = 0;
+
+    std::error_code error;
+    std::filesystem::create_directories(m_claims, error);
+    if (error) {
+        throw std::runtime_error("Failed to create " + m_claims + "!");
+    }
+}
+
+/*
+Claims are named after the first frame of their chunk, so every renderer of a list has to claim
+chunks of the same size. Opening with "x" fails if the file exists, on network drives as well,
+which is what makes a claim the renderer's alone.
+*/
+bool
+batch_queue::claim(std::vector<batch_frame>& frames)
+{
+    auto missing = [](const batch_frame& f) { return !std::filesystem::exists(f.output); };
+
+    frames.clear();
+    while (frames.empty() && m_next < m_frames.size()) {
+        const auto        first = m_frames.begin() + m_next;
+        const auto        last  = m_frames.begin() + std::min(m_next + m_chunk, m_frames.size());
+        const std::string claim = m_claims + "/" + std::to_string(m_next);
+        m_next += m_chunk;
+
+        if (std::none_of(first, last, missing)) {
+            continue;
+        }
+
+        std::FILE* file = std::fopen(claim.c_str(), "wx");
+        if (!file) {
+            continue;
+        }
+        std::fclose(file);
+
+        std::copy_if(first, last, std::back_inserter(frames), missing);
+    }
+    return !frames.empty();
+}
+
+/*
+Frames are handed to prepare() and delivered in the same order, so the image a frame goes to is
+found by its number. Delivering copies the pixels, which are only there during the callback, for the
+encoder that writes them. Once too many are waiting, the render helps the encoders catch up. Throws
+if any image couldn't be written.
+*/
+uint64_t
+renderBatch(renderer& r, const batch_settings& settings)
+{
+    batch_queue queue;
+    queue.open(settings.list, settings.chunk);
+
+    const uint32_t  encoders = std::max(settings.encoders, 1u);
+    jobs::scheduler encoding;
+    jobs::counter   encodes;
+    encoding.init(encoders);
+
+    std::vector<batch_frame> chunk;
+    size_t                   next = 0;  // in the chunk
+    std::vector<std::string> outputs;   // by frame number
+    std::atomic<uint32_t>    waiting{ 0 };
+    std::atomic<uint32_t>    failed{ 0 };
+
+    offscreen_settings offscreen;
+    offscreen.width   = settings.width;
+    offscreen.height  = settings.height;
+    offscreen.frames  = std::numeric_limits<uint32_t>::max();
+    offscreen.prepare = [&](uint64_t) {
+        if (next == chunk.size()) {
+            next = 0;
+            if (!queue.claim(chunk)) {
+                return false;
+            }
+            core::logInfo() << "Rendering " << chunk.size() << " frames from " << chunk[0].output;
+        }
+
+        const batch_frame& frame = chunk[next++];
+        r.latchCamera(frame.position, frame.target);
+        outputs.push_back(frame.output);
+        return true;
+    };
+    offscreen.deliver = [&](const offscreen_frame& frame) {
+        if (waiting.load() >= queued_encodes * encoders) {
+            encoding.wait(encodes);
+        }
+
+        auto pixels = std::make_shared<std::vector<uint8_t>>(
+          frame.pixels, frame.pixels + (size_t)frame.width * frame.height * 4);
+
+        offscreen_frame copy = frame;
+        auto encode = [&, path = outputs[frame.number], pixels, copy]() mutable {
+            std::error_code error;
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+            copy.pixels = pixels->data();
+            if (!writeImageFile(path, copy)) {
+                core::logError() << "Failed to save " << path;
+                failed.fetch_add(1);
+            }
+            waiting.fetch_sub(1);
+        };
+        waiting.fetch_add(1);
+        encoding.run(encodes, std::move(encode), core::thread_class::background);
+    };
+
+    r.renderOffscreen(offscreen);
+    encoding.wait(encodes);
+    encoding.shutdown();
+
+    // The last ones are written after the render has stopped logging
+    if (failed > 0) {
+        throw std::runtime_error("Failed to save " + std::to_string(failed.load()) + " of "
+                                 + std::to_string(outputs.size()) + " frames!");
+    }
+    return outputs.size();
+}
+
+}  // namespace shiny::graphics
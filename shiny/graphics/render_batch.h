@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+class renderer;
+
+// One image of a batch, and where the camera looks at it from
+struct batch_frame
+{
+    std::string output;
+    glm::vec3   position = glm::vec3(0.f);
+    glm::vec3   target   = glm::vec3(0.f);
+};
+
+/*
+The frames of a batch list, a text file with one frame a line, e.g.
+
+    thumbs/chair_000.png  4 0 1.5  0 0 0.5
+
+the image to write, the camera's position and its target. Blank lines and lines starting with #
+are left out. Throws if the file can't be read or a line isn't a frame.
+*/
+std::vector<batch_frame> readBatchList(const std::string& path);
+
+/*
+Hands out a batch list's frames in chunks, which any number of renderers can pull from, on one
+machine or on several that share the drive the list is on. A chunk is claimed by creating a file
+for it in LIST.claims, which only one of them can, so no two render the same frames. Frames whose
+image exists already are left out of their chunk, and so are whole chunks, so a batch that stopped
+halfway picks up where it left off once the claims of chunks that weren't finished are deleted.
+*/
+class batch_queue
+{
+public:
+    void open(const std::string& list, uint32_t chunk);
+
+    // The next chunk nobody has claimed yet, false once there is none left
+    bool claim(std::vector<batch_frame>& frames);
+
+    size_t size() const { return m_frames.size(); }
+
+private:
+    std::vector<batch_frame> m_frames;
+    std::string              m_claims;  // the directory
+    uint32_t                 m_chunk = 16;
+    size_t                   m_next  = 0;  // the first frame of the next chunk to try
+};
+
+struct batch_settings
+{
+    std::string list;
+    uint32_t    width    = 1600;
+    uint32_t    height   = 1200;
+    uint32_t    chunk    = 16;  // frames claimed at once
+    uint32_t    encoders = 2;   // threads that write the images
+};
+
+/*
+Renders the frames of `settings.list` it can claim with one offscreen render, so the scene is only
+loaded once however many frames there are, and returns how many it rendered. Run one per GPU,
+with setDevice() telling them apart. Frames are read back frames in flight after they were
+recorded, as in any offscreen render, and their images are written by encoder threads of their
+own, so neither the readback nor the encoding holds up the frames rendering after them. Throws if
+any of the images couldn't be written.
+*/
+uint64_t renderBatch(renderer& r, const batch_settings& settings);
+
+}  // namespace shiny::graphics
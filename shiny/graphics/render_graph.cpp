@@ -0,0 +1,433 @@
+#include "graphics/render_graph.h"
+
+#include "core/profiler.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+
+namespace {
+
+const vk::AccessFlags write_accesses =
+  vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eColorAttachmentWrite
+  | vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eTransferWrite
+  | vk::AccessFlagBits::eHostWrite | vk::AccessFlagBits::eMemoryWrite;
+
+const vk::ImageUsageFlags attachment_usages =
+  vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment
+  | vk::ImageUsageFlagBits::eInputAttachment | vk::ImageUsageFlagBits::eTransientAttachment;
+
+// Whether every bit of `flags` is in `mask`
+template<typename Flags>
+bool
+covers(Flags mask, Flags flags)
+{
+    return (mask & flags) == flags;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+render_graph::init(vk::Device          device,
+                   memory_allocator&   allocator,
+                   const debug_labels& labels,
+                   gpu_profiler&       profiler)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_labels    = &labels;
+    m_profiler  = &profiler;
+}
+
+void
+render_graph::destroy()
+{
+    for (resource& r : m_resources) {
+        if (r.transient && r.image) {
+            m_device.destroyImage(r.image, hostAllocator());
+        }
+    }
+    for (memory_block& block : m_blocks) {
+        m_allocator->free(block.memory);
+    }
+
+    m_resources.clear();
+    m_passes.clear();
+    m_blocks.clear();
+}
+
+void
+render_graph::reset(deletion_queue& deletions, uint64_t frame)
+{
+    for (resource& r : m_resources) {
+        if (r.transient) {
+            deletions.push(frame, r.image);
+        }
+    }
+    for (memory_block& block : m_blocks) {
+        deletions.push(frame, block.memory);
+    }
+
+    m_resources.clear();
+    m_passes.clear();
+    m_blocks.clear();
+    m_transient_size = 0;
+    m_unaliased_size = 0;
+}
+
+render_graph::handle
+render_graph::importImage(const std::string&   name,
+                          vk::Image            image,
+                          vk::ImageAspectFlags aspect,
+                          vk::ImageLayout      layout)
+{
+    resource r;
+    r.name         = name;
+    r.image        = image;
+    r.aspect       = aspect;
+    r.state.layout = layout;
+
+    m_resources.push_back(r);
+    return (handle)m_resources.size() - 1;
+}
+
+render_graph::handle
+render_graph::importBuffer(const std::string& name, vk::Buffer buffer)
+{
+    resource r;
+    r.name   = name;
+    r.buffer = buffer;
+
+    m_resources.push_back(r);
+    return (handle)m_resources.size() - 1;
+}
+
+render_graph::handle
+render_graph::createImage(const std::string&         name,
+                          const vk::ImageCreateInfo& info,
+                          vk::ImageAspectFlags       aspect)
+{
+    resource r;
+    r.name      = name;
+    r.aspect    = aspect;
+    r.transient = true;
+    r.info      = info;
+    r.info.setInitialLayout(vk::ImageLayout::eUndefined);
+
+    if (covers(attachment_usages, info.usage)) {
+        r.info.usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+    }
+
+    m_resources.push_back(r);
+    return (handle)m_resources.size() - 1;
+}
+
+void
+render_graph::output(handle resource)
+{
+    m_resources[resource].output = true;
+}
+
+render_graph::handle
+render_graph::addPass(const std::string& name, record_function record, bool side_effects)
+{
+    pass p;
+    p.name         = name;
+    p.record       = std::move(record);
+    p.side_effects = side_effects;
+
+    m_passes.push_back(std::move(p));
+    return (handle)m_passes.size() - 1;
+}
+
+void
+render_graph::use(handle pass, handle resource, const resource_use& use)
+{
+    m_passes[pass].uses.emplace_back(resource, use);
+}
+
+void
+render_graph::compile()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    cullPasses();
+    createTransients();
+}
+
+/*
+Walks the passes backwards from the outputs: a pass is needed if it has side effects or writes
+something a later needed pass reads, or that is an output, and then whatever it reads is needed from
+the passes before it. A pass that only writes is needed for as long as anything after it uses what
+it wrote, so writes without reads don't end what's needed.
+*/
+void
+render_graph::cullPasses()
+{
+    std::vector<uint8_t> needed(m_resources.size(), 0);
+    for (handle r = 0; r < (handle)m_resources.size(); ++r) {
+        needed[r] = m_resources[r].output;
+    }
+
+    for (auto p = m_passes.rbegin(); p != m_passes.rend(); ++p) {
+        p->culled = !p->side_effects;
+        for (const auto& [r, use] : p->uses) {
+            if ((use.access & write_accesses) && needed[r]) {
+                p->culled = false;
+            }
+        }
+
+        if (p->culled) {
+            continue;
+        }
+
+        for (const auto& [r, use] : p->uses) {
+            if (use.access & ~write_accesses) {
+                needed[r] = 1;
+            }
+        }
+    }
+}
+
+/*
+A transient image lives from the first to the last pass that isn't culled using it. The biggest go
+first, each into the first block of memory that none of its images overlap with in lifetime and
+whose memory types it can use, or into a new block, which grows to fit. Every block is one
+allocation, which its images are all bound to at its start.
+
+Images with transient attachment usage get a block of lazily allocated memory to themselves when
+their memory types include any.
+*/
+void
+render_graph::createTransients()
+{
+    std::vector<handle>                 transients;
+    std::vector<vk::MemoryRequirements> requirements(m_resources.size());
+
+    for (handle r = 0; r < (handle)m_resources.size(); ++r) {
+        resource& image = m_resources[r];
+        if (!image.transient) {
+            continue;
+        }
+
+        bool used = false;
+        for (uint32_t p = 0; p < (uint32_t)m_passes.size(); ++p) {
+            if (m_passes[p].culled) {
+                continue;
+            }
+            for (const auto& use : m_passes[p].uses) {
+                if (use.first == r) {
+                    image.first = used ? image.first : p;
+                    image.last  = p;
+                    used        = true;
+                }
+            }
+        }
+
+        if (used) {
+            vk::ImageCreateInfo info = image.info;
+#if defined(VK_EXT_image_compression_control)
+            vk::ImageCompressionControlEXT compression;
+            if (m_compression) {
+                m_compression->request(info, compression);
+            }
+#endif
+            image.image     = m_device.createImage(info, hostAllocator());
+            requirements[r] = m_device.getImageMemoryRequirements(image.image);
+            image.lazy =
+              (bool)(image.info.usage & vk::ImageUsageFlagBits::eTransientAttachment)
+              && m_allocator->hasMemoryType(requirements[r].memoryTypeBits,
+                                            vk::MemoryPropertyFlagBits::eLazilyAllocated);
+            if (!image.lazy) {
+                m_unaliased_size += requirements[r].size;
+            }
+            transients.push_back(r);
+        }
+    }
+
+    std::stable_sort(transients.begin(), transients.end(), [&](handle a, handle b) {
+        return requirements[a].size > requirements[b].size;
+    });
+
+    for (handle r : transients) {
+        resource&                     image = m_resources[r];
+        const vk::MemoryRequirements& needs = requirements[r];
+
+        uint32_t chosen = (uint32_t)m_blocks.size();
+        for (uint32_t b = 0; b < (uint32_t)m_blocks.size() && chosen == m_blocks.size(); ++b) {
+            if (image.lazy || m_blocks[b].lazy
+                || !(m_blocks[b].requirements.memoryTypeBits & needs.memoryTypeBits)) {
+                continue;
+            }
+
+            bool overlaps = false;
+            for (handle other : m_blocks[b].images) {
+                overlaps |= m_resources[other].first <= image.last
+                            && image.first <= m_resources[other].last;
+            }
+            if (!overlaps) {
+                chosen = b;
+            }
+        }
+
+        if (chosen == m_blocks.size()) {
+            memory_block block;
+            block.requirements = needs;
+            block.lazy         = image.lazy;
+            m_blocks.push_back(block);
+        }
+
+        memory_block& block = m_blocks[chosen];
+        block.requirements.size      = std::max(block.requirements.size, needs.size);
+        block.requirements.alignment = std::max(block.requirements.alignment, needs.alignment);
+        block.requirements.memoryTypeBits &= needs.memoryTypeBits;
+        block.images.push_back(r);
+        image.block = chosen;
+    }
+
+    for (memory_block& block : m_blocks) {
+        const vk::MemoryPropertyFlags properties =
+          block.lazy ? vk::MemoryPropertyFlagBits::eLazilyAllocated
+                     : vk::MemoryPropertyFlagBits::eDeviceLocal;
+
+        block.memory = m_allocator->allocate(block.requirements, properties,
+                                             memory_allocator::resource_kind::optimal,
+                                             memory_category::render_target);
+
+        // What lazily allocated memory is committed to is up to the driver
+        if (!block.lazy) {
+            m_transient_size += block.requirements.size;
+        }
+
+        for (handle r : block.images) {
+            m_device.bindImageMemory(m_resources[r].image, block.memory.memory,
+                                     block.memory.offset);
+        }
+    }
+}
+
+void
+render_graph::execute(vk::CommandBuffer command_buffer)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    for (resource& r : m_resources) {
+        r.touched = false;
+    }
+
+    for (pass& p : m_passes) {
+        if (p.culled) {
+            continue;
+        }
+
+        m_batch.clear();
+        for (const auto& [r, use] : p.uses) {
+            synchronize(m_resources[r], use, m_batch);
+        }
+        m_labels->begin(command_buffer, p.name.c_str());
+        m_batch.record(command_buffer);
+
+        m_profiler->counters(command_buffer, p.name, [&] { p.record(command_buffer); });
+        m_labels->end(command_buffer);
+    }
+}
+
+/*
+Adds what `use` has to wait for to `batch`, and updates the state of `r` to after the pass:
+
+ - a write, or a read that the last write isn't visible to yet, waits for the last write and makes
+   it available and visible,
+ - a write also waits for the reads since the last write, which needs no memory dependency,
+ - and a layout transition waits for both, being a write itself.
+
+A transient image that hasn't been touched yet in this execute() starts out undefined, with a write
+by everything that used its memory since the last image started using it.
+*/
+void
+render_graph::synchronize(resource& r, const resource_use& use, barrier_batch& batch)
+{
+    resource_state& state = r.state;
+
+    if (r.transient && !r.touched) {
+        memory_block& block = m_blocks[r.block];
+
+        state              = resource_state();
+        state.write_stages = block.stages;
+        state.write_access = block.writes;
+        block.stages       = vk::PipelineStageFlags();
+        block.writes       = vk::AccessFlags();
+    }
+    r.touched = true;
+
+    const bool writes     = (bool)(use.access & write_accesses);
+    const bool transition = r.image && use.layout != vk::ImageLayout::eUndefined
+                            && use.layout != state.layout;
+    const bool unseen     = !covers(state.visible_stages, use.stages)
+                            || !covers(state.visible_access, use.access & ~write_accesses);
+    const bool afterwrite = state.write_stages && (writes || transition || unseen);
+    const bool afterread  = state.read_stages && (writes || transition);
+
+    if (afterwrite || afterread || transition) {
+        access_scope src;
+        if (afterwrite) {
+            src.stages |= state.write_stages;
+            src.access = state.write_access;
+        }
+        if (afterread) {
+            src.stages |= state.read_stages;
+        }
+        const access_scope dst = { use.stages, use.access, use.layout };
+
+        if (transition) {
+            src.layout = state.layout;
+            batch.image(r.image,
+                        vk::ImageSubresourceRange(r.aspect, 0, VK_REMAINING_MIP_LEVELS, 0,
+                                                  VK_REMAINING_ARRAY_LAYERS),
+                        src, dst);
+        } else {
+            batch.memory(src, dst);
+        }
+    }
+
+    if (writes || transition) {
+        state.write_stages   = use.stages;
+        state.write_access   = use.access & write_accesses;
+        state.read_stages    = writes ? vk::PipelineStageFlags() : use.stages;
+        state.visible_stages = writes ? vk::PipelineStageFlags() : use.stages;
+        state.visible_access = writes ? vk::AccessFlags() : use.access;
+    } else {
+        state.read_stages |= use.stages;
+        if (afterwrite) {
+            state.visible_stages |= use.stages;
+            state.visible_access |= use.access;
+        }
+    }
+
+    if (use.final_layout != vk::ImageLayout::eUndefined) {
+        state.layout = use.final_layout;
+    } else if (use.layout != vk::ImageLayout::eUndefined) {
+        state.layout = use.layout;
+    }
+
+    if (r.transient) {
+        m_blocks[r.block].stages |= use.stages;
+        m_blocks[r.block].writes |= use.access & write_accesses;
+    }
+}
+
+void
+render_graph::setImage(handle resource, vk::Image image, vk::ImageLayout layout)
+{
+    m_resources[resource].image        = image;
+    m_resources[resource].state        = resource_state();
+    m_resources[resource].state.layout = layout;
+}
+
+vk::Image
+render_graph::image(handle resource) const
+{
+    return m_resources[resource].image;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "graphics/barrier_batch.h"
+#include "graphics/debug_labels.h"
+#include "graphics/deletion_queue.h"
+#include "graphics/gpu_profiler.h"
+#include "graphics/image_compression.h"
+#include "graphics/memory_allocator.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+How a pass uses one of the graph's resources, at `stages` with `access`. Images are in `layout`
+while the pass runs. A pass that doesn't care what an image held before, like a render pass that
+clears it and does its own layout transitions, leaves the layout undefined and says which layout it
+leaves the image in with `final_layout`.
+*/
+struct resource_use
+{
+    vk::PipelineStageFlags stages;
+    vk::AccessFlags        access;
+    vk::ImageLayout        layout       = vk::ImageLayout::eUndefined;
+    vk::ImageLayout        final_layout = vk::ImageLayout::eUndefined;  // `layout` if undefined
+};
+
+/*
+The passes of a frame, in the order they are recorded, and the resources they use. Rather than
+every pass synchronizing with whatever ran before it by hand, passes declare how they use resources
+and the graph works out
+
+ - which passes contribute to its outputs or have side effects, skipping the others,
+ - the barriers in front of every pass, batched into a single vkCmdPipelineBarrier: layout
+   transitions, and dependencies for reads after writes and writes after either,
+ - and for transient images, which only hold anything between the first and last pass using them,
+   memory shared by those whose lifetimes don't overlap.
+
+Transient images that are only ever attachments, never sampled, stored or copied, never leave the
+render pass in which they are written either, so they get transient attachment usage and lazily
+allocated memory where the device has it. On tiled GPUs they then only ever live in tile memory.
+They don't share memory with other images, there is nothing to share.
+
+Barriers that aren't layout transitions are global memory barriers, which cost drivers the same as
+buffer and image barriers, and batch into one.
+
+Imported resources live outside the graph, and their state carries over from one `execute()` to the
+next, so the first pass using one in a frame waits for the last pass that used it in the frame
+before. Transient images lose their contents between frames, the first pass using one only waits
+for the last one using its memory. `setImage()` swaps an imported image along with its state, for
+images like the swap chain's that are synchronized by semaphores instead.
+
+The graph is built and compiled when the swap chain is (re)created and executed every frame, all
+of it into one command buffer of one queue. The passes read whatever else they need from their
+owner at the time they're recorded.
+*/
+class render_graph
+{
+public:
+    using handle          = uint32_t;
+    using record_function = std::function<void(vk::CommandBuffer)>;
+
+    static const handle invalid_handle = ~0u;
+
+    // Every pass is recorded inside a label with its name, and with the profiler's hardware
+    // counters sampled under it
+    void init(vk::Device          device,
+              memory_allocator&   allocator,
+              const debug_labels& labels,
+              gpu_profiler&       profiler);
+
+    // Destroys the transient images right away, only safe once the device is idle
+    void destroy();
+
+    // The transient images ask for what render targets are compressed with, see image_compression
+    void setCompression(const image_compression* compression) { m_compression = compression; }
+
+    // Drops every pass and resource, retiring the transient images with `frame`
+    void reset(deletion_queue& deletions, uint64_t frame);
+
+    // `aspect` is what layout transitions of the image cover, all of its levels and layers are
+    handle importImage(const std::string&   name,
+                       vk::Image            image,
+                       vk::ImageAspectFlags aspect,
+                       vk::ImageLayout      layout);
+    handle importBuffer(const std::string& name, vk::Buffer buffer);
+    handle createImage(const std::string&         name,
+                       const vk::ImageCreateInfo& info,
+                       vk::ImageAspectFlags       aspect);
+
+    // Keeps the passes writing an imported resource, which is used after the graph
+    void output(handle resource);
+
+    handle addPass(const std::string& name, record_function record, bool side_effects = false);
+    void   use(handle pass, handle resource, const resource_use& use);
+
+    // Culls the passes and creates the transient images
+    void compile();
+    void execute(vk::CommandBuffer command_buffer);
+
+    void setImage(handle resource, vk::Image image, vk::ImageLayout layout);
+
+    // Transient images are created by `compile()`, unless nothing that isn't culled uses them
+    vk::Image image(handle resource) const;
+    bool      culled(handle pass) const { return m_passes[pass].culled; }
+
+    // Bytes the transient images take up, and would without aliasing, lazily allocated ones aside
+    vk::DeviceSize transientSize() const { return m_transient_size; }
+    vk::DeviceSize unaliasedSize() const { return m_unaliased_size; }
+
+private:
+    // Since the last write, which is only visible to the stages and accesses of the barriers after
+    // it. A layout transition counts as a write.
+    struct resource_state
+    {
+        vk::ImageLayout        layout = vk::ImageLayout::eUndefined;
+        vk::PipelineStageFlags write_stages;
+        vk::AccessFlags        write_access;
+        vk::PipelineStageFlags read_stages;
+        vk::PipelineStageFlags visible_stages;
+        vk::AccessFlags        visible_access;
+    };
+
+    struct resource
+    {
+        std::string          name;
+        vk::Image            image;
+        vk::Buffer           buffer;
+        vk::ImageAspectFlags aspect;
+        resource_state       state;
+        bool                 output = false;
+
+        bool                transient = false;
+        bool                lazy      = false;  // lazily allocated memory, see createTransients
+        vk::ImageCreateInfo info;
+        uint32_t            block   = 0;
+        uint32_t            first   = 0;  // live passes using it
+        uint32_t            last    = 0;
+        bool                touched = false;  // this execute()
+    };
+
+    struct pass
+    {
+        std::string                                  name;
+        record_function                              record;
+        std::vector<std::pair<handle, resource_use>> uses;
+        bool                                         side_effects = false;
+        bool                                         culled       = false;
+    };
+
+    // Memory shared by transient images, and everything done to it since the last of them started
+    struct memory_block
+    {
+        allocation             memory;
+        vk::MemoryRequirements requirements;
+        std::vector<handle>    images;
+        bool                   lazy = false;
+        vk::PipelineStageFlags stages;
+        vk::AccessFlags        writes;
+    };
+
+    void cullPasses();
+    void createTransients();
+    void synchronize(resource& r, const resource_use& use, barrier_batch& batch);
+
+    vk::Device          m_device;
+    memory_allocator*   m_allocator = nullptr;
+    const debug_labels* m_labels    = nullptr;
+    gpu_profiler*       m_profiler  = nullptr;
+
+    const image_compression* m_compression = nullptr;
+
+    std::vector<resource>     m_resources;
+    std::vector<pass>         m_passes;
+    std::vector<memory_block> m_blocks;
+    barrier_batch             m_batch;  // the one in front of a pass, kept for its memory
+    vk::DeviceSize            m_transient_size = 0;
+    vk::DeviceSize            m_unaliased_size = 0;
+};
+
+}  // namespace shiny::graphics
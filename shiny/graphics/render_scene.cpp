@@ -0,0 +1,409 @@
+#include "graphics/render_scene.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Has to match local_size_x in scene.comp
+const uint32_t scene_group_size = 64;
+
+// The scatter's push constants, see scene.comp
+struct scatter_constants
+{
+    uint32_t update_count = 0;
+    uint32_t previous     = 0;  // whether it keeps the previous transforms
+};
+
+// The expansion's push constants, see scene.comp
+struct expand_constants
+{
+    glm::mat4 view_projection;
+    uint32_t  count          = 0;
+    uint32_t  first_instance = 0;
+    uint32_t  first_cull     = 0;
+    uint32_t  first_draw     = 0;
+};
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+render_scene::init(vk::PhysicalDevice physical_device,
+                   vk::Device         device,
+                   memory_allocator&  allocator,
+                   layout_cache&      layouts,
+                   pipeline_cache&    pipelines,
+                   uint32_t           max_instances,
+                   uint32_t           max_updates,
+                   uint32_t           frames,
+                   bool               update_templates,
+                   bool               previous_transforms)
+{
+    m_device        = device;
+    m_allocator     = &allocator;
+    m_max_instances = max_instances;
+    m_max_updates   = max_updates;
+    m_frames        = frames;
+    m_cleared       = false;
+    m_track         = previous_transforms;
+
+    m_slots.assign(max_instances, scene_instance());
+    m_dirty.assign(max_instances, 0);
+    m_pending.clear();
+    m_pending.reserve(max_instances);
+    m_size = 0;
+    m_updated.clear();
+    m_marks.assign(previous_transforms ? max_instances : 0, 0);
+
+    // Every frame's region is bound at its own offset, which has to be aligned
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+
+    // Settling the last frame's updates takes up to as many again
+    const uint32_t entries = previous_transforms ? 2 * max_updates : max_updates;
+    m_updates_frame_size   = alignUp(entries * sizeof(scene_update), alignment);
+
+    // Cleared with a fill before its first use, and otherwise only touched by the shaders
+    auto instancesinfo = vk::BufferCreateInfo()
+                           .setSize(max_instances * sizeof(scene_instance))
+                           .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                     | vk::BufferUsageFlagBits::eTransferDst)
+                           .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_instances        = m_device.createBuffer(instancesinfo, hostAllocator());
+    m_instances_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_instances),
+                                               vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                               memory_allocator::resource_kind::linear,
+                                               memory_category::other);
+    m_device.bindBufferMemory(m_instances, m_instances_memory.memory, m_instances_memory.offset);
+
+    // Only ever written by the scatter, a slot before it's read
+    if (previous_transforms) {
+        auto previousinfo = vk::BufferCreateInfo()
+                              .setSize(max_instances * sizeof(glm::mat3x4))
+                              .setUsage(vk::BufferUsageFlagBits::eStorageBuffer)
+                              .setSharingMode(vk::SharingMode::eExclusive);
+
+        m_previous        = m_device.createBuffer(previousinfo, hostAllocator());
+        m_previous_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_previous),
+                                                  vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                                  memory_allocator::resource_kind::linear,
+                                                  memory_category::other);
+        m_device.bindBufferMemory(m_previous, m_previous_memory.memory, m_previous_memory.offset);
+    }
+
+    auto updatesinfo = vk::BufferCreateInfo()
+                         .setSize(m_updates_frame_size * frames)
+                         .setUsage(vk::BufferUsageFlagBits::eStorageBuffer)
+                         .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_updates        = m_device.createBuffer(updatesinfo, hostAllocator());
+    m_updates_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_updates),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_updates, m_updates_memory.memory, m_updates_memory.offset);
+
+    // The scatter's 0: the instances, 1: this frame's updates, 2: the previous transforms, which
+    // are the instances again without previous_transforms, and never touched. The expansion's 0:
+    // the instances, 1: the draw buffer's instances, 2: the culling's.
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings;
+    for (uint32_t i = 0; i < (uint32_t)bindings.size(); ++i) {
+        bindings[i] = vk::DescriptorSetLayoutBinding()
+                        .setBinding(i)
+                        .setDescriptorCount(1)
+                        .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+                        .setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    }
+
+    auto scatterlayoutinfo =
+      vk::DescriptorSetLayoutCreateInfo().setBindingCount(3).setPBindings(bindings.data());
+    auto expandlayoutinfo =
+      vk::DescriptorSetLayoutCreateInfo().setBindingCount(3).setPBindings(bindings.data());
+
+    vk::DescriptorSetLayout scatterlayout = layouts.descriptorSetLayout(scatterlayoutinfo);
+    vk::DescriptorSetLayout expandlayout  = layouts.descriptorSetLayout(expandlayoutinfo);
+    m_scatter_writes.init(m_device, scatterlayout, bindings.data(), 3, update_templates);
+    m_expand_writes.init(m_device, expandlayout, bindings.data(), 3, update_templates);
+
+    // The same shader, compiled with SCATTER defined for the scatter
+    createPipeline(layouts, pipelines, scatterlayout, sizeof(scatter_constants),
+                   "shaders/scene_scatter_comp.spv", m_scatter_layout, m_scatter_shader,
+                   m_scatter_pipeline);
+    createPipeline(layouts, pipelines, expandlayout, sizeof(expand_constants),
+                   "shaders/scene_expand_comp.spv", m_expand_layout, m_expand_shader,
+                   m_expand_pipeline);
+
+    // The scatter's regions never move, so its sets are written once here
+    m_descriptors.init(m_device, { { vk::DescriptorType::eStorageBuffer, 6 } }, frames * 2);
+    for (uint32_t i = 0; i < frames; ++i) {
+        m_scatter_sets.push_back(m_descriptors.allocate(scatterlayout));
+        m_expand_sets.push_back(m_descriptors.allocate(expandlayout));
+
+        std::array<descriptor_data, 3> data;
+        data[0].buffer = vk::DescriptorBufferInfo(m_instances, 0, VK_WHOLE_SIZE);
+        data[1].buffer =
+          vk::DescriptorBufferInfo(m_updates, i * m_updates_frame_size, m_updates_frame_size);
+        data[2].buffer =
+          vk::DescriptorBufferInfo(m_track ? m_previous : m_instances, 0, VK_WHOLE_SIZE);
+        m_scatter_writes.update(m_scatter_sets.back(), data.data());
+    }
+}
+
+void
+render_scene::createPipeline(layout_cache&           layouts,
+                             pipeline_cache&         pipelines,
+                             vk::DescriptorSetLayout setlayout,
+                             uint32_t                constants,
+                             const char*             path,
+                             vk::PipelineLayout&     layout,
+                             vk::ShaderModule&       shader,
+                             vk::Pipeline&           pipeline)
+{
+    auto range = vk::PushConstantRange()
+                   .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                   .setOffset(0)
+                   .setSize(constants);
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setSetLayoutCount(1)
+                        .setPSetLayouts(&setlayout)
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&range);
+
+    layout = layouts.pipelineLayout(layoutinfo);
+
+    core::mapped_file code(path);
+
+    auto shaderinfo = vk::ShaderModuleCreateInfo()
+                        .setCodeSize(code.size())
+                        .setPCode((const uint32_t*)code.data());
+
+    shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+    auto pipelineinfo =
+      vk::ComputePipelineCreateInfo()
+        .setStage(vk::PipelineShaderStageCreateInfo()
+                    .setStage(vk::ShaderStageFlagBits::eCompute)
+                    .setModule(shader)
+                    .setPName("main"))
+        .setLayout(layout);
+
+    pipeline = m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+}
+
+void
+render_scene::destroy()
+{
+    m_device.destroyPipeline(m_scatter_pipeline, hostAllocator());
+    m_device.destroyPipeline(m_expand_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_scatter_shader, hostAllocator());
+    m_device.destroyShaderModule(m_expand_shader, hostAllocator());
+    m_descriptors.destroy();
+    m_scatter_sets.clear();
+    m_expand_sets.clear();
+    m_scatter_writes.destroy();
+    m_expand_writes.destroy();
+
+    m_device.destroyBuffer(m_instances, hostAllocator());
+    m_allocator->free(m_instances_memory);
+    m_device.destroyBuffer(m_updates, hostAllocator());
+    m_allocator->free(m_updates_memory);
+    if (m_previous) {
+        m_device.destroyBuffer(m_previous, hostAllocator());
+        m_allocator->free(m_previous_memory);
+    }
+
+    m_instances = nullptr;
+    m_updates   = nullptr;
+    m_previous  = nullptr;
+}
+
+void
+render_scene::set(uint32_t slot, const scene_instance& instance)
+{
+    if (slot >= m_max_instances) {
+        throw std::runtime_error("Render scene is out of slots!");
+    }
+
+    m_slots[slot]      = instance;
+    m_slots[slot].live = 1;
+    m_size             = std::max(m_size, slot + 1);
+    if (!m_dirty[slot]) {
+        m_dirty[slot] = 1;
+        m_pending.push_back(slot);
+    }
+}
+
+void
+render_scene::clear(uint32_t slot)
+{
+    if (slot >= m_size || !m_slots[slot].live) {
+        return;
+    }
+
+    m_slots[slot] = scene_instance();
+    if (!m_dirty[slot]) {
+        m_dirty[slot] = 1;
+        m_pending.push_back(slot);
+    }
+}
+
+/*
+The oldest pending slots go first, and whatever doesn't fit waits for the next frame. The settles
+come after them, and only their slot and flag are written, which is all the scatter reads of them.
+*/
+void
+render_scene::beginFrame(uint32_t frame)
+{
+    m_frame = frame % m_frames;
+
+    const uint32_t updates = std::min((uint32_t)m_pending.size(), m_max_updates);
+
+    // Write-combined, so every update is written in one go and never read back
+    char* data = static_cast<char*>(m_updates_memory.mapped) + m_frame * m_updates_frame_size;
+    for (uint32_t i = 0; i < updates; ++i) {
+        scene_update update;
+        update.slot     = m_pending[i];
+        update.instance = m_slots[update.slot];
+        std::memcpy(data + i * sizeof(update), &update, sizeof(update));
+        m_dirty[update.slot] = 0;
+    }
+    m_frame_updates = updates;
+
+    if (m_track) {
+        for (uint32_t i = 0; i < updates; ++i) {
+            m_marks[m_pending[i]] = 1;
+        }
+        for (uint32_t slot : m_updated) {
+            if (!m_marks[slot]) {
+                const uint32_t settle[2] = { slot, 1 };
+                std::memcpy(data + m_frame_updates * sizeof(scene_update), settle, sizeof(settle));
+                ++m_frame_updates;
+            }
+        }
+        m_updated.assign(m_pending.begin(), m_pending.begin() + updates);
+        for (uint32_t slot : m_updated) {
+            m_marks[slot] = 0;
+        }
+    }
+
+    m_pending.erase(m_pending.begin(), m_pending.begin() + updates);
+}
+
+/*
+The scatter has to wait for the previous frame's expansion to be done reading the instances, and
+the expansion for the scatter to be done writing them, and whatever reads the expanded instances for
+the expansion, hence the barriers. The frame's regions of the draw buffer and the culling were last
+read by the frame that used them before, whose fence has been waited on.
+*/
+void
+render_scene::record(vk::CommandBuffer      command_buffer,
+                     const glm::mat4&       view_projection,
+                     const draw_buffer&     draws,
+                     uint32_t               first_instance,
+                     const gpu_culling&     culling,
+                     uint32_t               first_cull,
+                     uint32_t               first_draw,
+                     vk::PipelineStageFlags readers)
+{
+    if (m_size == 0) {
+        return;
+    }
+
+    auto instances = vk::BufferMemoryBarrier()
+                       .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                       .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                       .setBuffer(m_instances)
+                       .setOffset(0)
+                       .setSize(VK_WHOLE_SIZE);
+
+    // Empty slots are all zeroes, which is what a slot that has never been set has to read as
+    if (!m_cleared) {
+        command_buffer.fillBuffer(m_instances, 0, VK_WHOLE_SIZE, 0);
+        instances.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+          .setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                       vk::PipelineStageFlagBits::eComputeShader,
+                                       vk::DependencyFlags(), nullptr, instances, nullptr);
+        m_cleared = true;
+    }
+
+    if (m_frame_updates > 0) {
+        instances.setSrcAccessMask(vk::AccessFlagBits::eShaderRead)
+          .setDstAccessMask(vk::AccessFlagBits::eShaderWrite);
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                       vk::PipelineStageFlagBits::eComputeShader,
+                                       vk::DependencyFlags(), nullptr, instances, nullptr);
+
+        scatter_constants constants;
+        constants.update_count = m_frame_updates;
+        constants.previous     = m_track ? 1 : 0;
+
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_scatter_pipeline);
+        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_scatter_layout, 0,
+                                          m_scatter_sets[m_frame], nullptr);
+        command_buffer.pushConstants(m_scatter_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                     sizeof(constants), &constants);
+        command_buffer.dispatch((m_frame_updates + scene_group_size - 1) / scene_group_size, 1,
+                                1);
+
+        instances.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+          .setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+        command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                       vk::PipelineStageFlagBits::eComputeShader,
+                                       vk::DependencyFlags(), nullptr, instances, nullptr);
+
+        // Uploaded, and not again unless the slots change again
+        m_frame_updates = 0;
+    }
+
+    // The regions are at a different offset every frame, so the set is written again. It was last
+    // used by this frame the previous time around, which is done.
+    std::array<descriptor_data, 3> data;
+    data[0].buffer = vk::DescriptorBufferInfo(m_instances, 0, VK_WHOLE_SIZE);
+    data[1].buffer =
+      vk::DescriptorBufferInfo(draws.buffer(), draws.instanceOffset(), draws.instanceRange());
+    data[2].buffer = vk::DescriptorBufferInfo(culling.instanceBuffer(), culling.instanceOffset(),
+                                              culling.instanceRange());
+    m_expand_writes.update(m_expand_sets[m_frame], data.data());
+
+    expand_constants constants;
+    constants.view_projection = view_projection;
+    constants.count           = m_size;
+    constants.first_instance  = first_instance;
+    constants.first_cull      = first_cull;
+    constants.first_draw      = first_draw;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_expand_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_expand_layout, 0,
+                                      m_expand_sets[m_frame], nullptr);
+    command_buffer.pushConstants(m_expand_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof(constants), &constants);
+    command_buffer.dispatch((m_size + scene_group_size - 1) / scene_group_size, 1, 1);
+
+    // What the culling and the vertex shaders read of them
+    auto expanded = vk::MemoryBarrier()
+                      .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                      .setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eComputeShader | readers,
+                                   vk::DependencyFlags(), expanded, nullptr, nullptr);
+}
+
+}  // namespace shiny::graphics
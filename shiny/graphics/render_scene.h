@@ -0,0 +1,172 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/descriptor_template.h"
+#include "graphics/draw_buffer.h"
+#include "graphics/gpu_culling.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace shiny::graphics {
+
+// The first three rows of an affine transform, as the columns of a 3x4 matrix, which is how the
+// shaders take them. The last row of the transform is 0, 0, 0, 1, so it is left out.
+inline glm::mat3x4
+affineRows(const glm::mat4& transform)
+{
+    return glm::mat3x4(glm::transpose(transform));
+}
+
+// What the render scene keeps of an instance, laid out like the std430 SceneInstance struct of
+// scene.comp
+struct scene_instance
+{
+    glm::mat3x4 transform     = affineRows(glm::mat4(1.f));  // model to world, see affineRows
+    glm::vec4   sphere        = glm::vec4(0.f);  // world space center and radius
+    uint32_t    texture       = 0;               // index into the bindless texture array
+    uint32_t    vertex_format = 0;
+    uint32_t    batch         = 0;  // its draw, counted from the first one record() is given
+    uint32_t    live          = 0;  // 0 for a slot without an instance
+};
+
+static_assert(sizeof(scene_instance) == 80, "scene_instance has to match the shader's layout");
+
+// A slot's new instance, laid out like the std430 SceneUpdate struct of scene.comp
+struct scene_update
+{
+    uint32_t       slot       = 0;
+    uint32_t       settle     = 0;  // only to catch the previous transform up, see render_scene
+    uint32_t       padding[2] = {};
+    scene_instance instance;
+};
+
+static_assert(sizeof(scene_update) == 96, "scene_update has to match the shader's layout");
+
+/*
+Instances that stay on the GPU from frame to frame, in slots chosen by whoever sets them, so that a
+frame only costs the CPU what changed in it rather than everything there is. A changed slot waits
+until the next beginFrame() copies it into that frame's region of a host visible upload buffer,
+as many of them as fit, and record() then scatters them into the device local instances with a
+compute shader, an invocation each.
+
+The same record() expands every slot into the frame's draw buffer instances and culling inputs,
+ranges of them that have been reserved for it, which the culling shader then treats like any
+others: for the CPU a frame of the whole scene is a handful of draws, one per batch, with none of
+the instances in them. Empty slots come out with bounds the culling always rejects.
+
+A slot's last instance is kept on the CPU as well, so that slots changed again before they were
+uploaded are only uploaded once, and the pending ones survive frames that don't record anything.
+
+Transforms are kept as their first three rows, which takes a quarter off what the scatter and the
+expansion move of them. With previous_transforms, the scatter also keeps every slot's transform of
+the frame before in a buffer of its own, for motion vectors: an update saves the transform it
+replaces first, and the next frame's upload catches the slots that were updated up with a settle
+of their own, unless they are updated again, so that a still slot's two transforms agree.
+*/
+class render_scene
+{
+public:
+    void init(vk::PhysicalDevice physical_device,
+              vk::Device         device,
+              memory_allocator&  allocator,
+              layout_cache&      layouts,
+              pipeline_cache&    pipelines,
+              uint32_t           max_instances,
+              uint32_t           max_updates,  // a frame
+              uint32_t           frames,
+              bool               update_templates    = false,
+              bool               previous_transforms = false);
+    void destroy();
+
+    void set(uint32_t slot, const scene_instance& instance);
+    void clear(uint32_t slot);
+
+    // One more than the highest slot ever set, which is how many record() expands
+    uint32_t size() const { return m_size; }
+    uint32_t pending() const { return (uint32_t)m_pending.size(); }
+
+    // Copies as many of the pending slots as fit into `frame`'s region, once the GPU is done with
+    // it, for the next record()
+    void beginFrame(uint32_t frame);
+
+    // Records the scatter and the expansion, outside of a render pass, into size() instances of
+    // `draws` and `culling` starting at `first_instance` and `first_cull`, and culls pointing at
+    // the draws from `first_draw` on, which are the batches. The draw instances are transformed by
+    // `view_projection` like all others. Both outputs are made visible to the culling and to
+    // `readers` on this queue, which on a compute queue can't include the vertex shader.
+    void record(vk::CommandBuffer      command_buffer,
+                const glm::mat4&       view_projection,
+                const draw_buffer&     draws,
+                uint32_t               first_instance,
+                const gpu_culling&     culling,
+                uint32_t               first_cull,
+                uint32_t               first_draw,
+                vk::PipelineStageFlags readers);
+
+    // Every slot's transform as of the frame before the last record(), like scene_instance's, with
+    // previous_transforms. Written by the scatter, so whatever reads it has to be done before the
+    // next record(), like the expansion is.
+    vk::DescriptorBufferInfo previousTransforms() const
+    {
+        return vk::DescriptorBufferInfo(m_previous, 0, VK_WHOLE_SIZE);
+    }
+
+private:
+    void createPipeline(layout_cache&           layouts,
+                        pipeline_cache&         pipelines,
+                        vk::DescriptorSetLayout setlayout,
+                        uint32_t                constants,
+                        const char*             path,
+                        vk::PipelineLayout&     layout,
+                        vk::ShaderModule&       shader,
+                        vk::Pipeline&           pipeline);
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::Buffer m_instances;  // device local, scene_instance by slot
+    allocation m_instances_memory;
+    uint32_t   m_max_instances = 0;
+    bool       m_cleared       = false;  // the instances have been filled with empty slots
+    bool       m_track         = false;  // previous_transforms
+
+    vk::Buffer m_previous;  // device local, the transforms of the frame before by slot
+    allocation m_previous_memory;
+
+    vk::Buffer     m_updates;  // host visible, the scene_updates of every frame
+    allocation     m_updates_memory;
+    vk::DeviceSize m_updates_frame_size = 0;
+    uint32_t       m_max_updates        = 0;
+    uint32_t       m_frames             = 0;
+
+    descriptor_allocator           m_descriptors;
+    std::vector<vk::DescriptorSet> m_scatter_sets;  // one per frame, written once
+    std::vector<vk::DescriptorSet> m_expand_sets;   // one per frame, rewritten every frame
+    descriptor_template            m_scatter_writes;
+    descriptor_template            m_expand_writes;
+    vk::PipelineLayout             m_scatter_layout;  // owned by the layout_cache
+    vk::PipelineLayout             m_expand_layout;
+    vk::ShaderModule               m_scatter_shader;
+    vk::ShaderModule               m_expand_shader;
+    vk::Pipeline                   m_scatter_pipeline;
+    vk::Pipeline                   m_expand_pipeline;
+
+    std::vector<scene_instance> m_slots;  // the latest of every slot
+    std::vector<uint8_t>        m_dirty;  // by slot, whether it's pending
+    std::vector<uint32_t>       m_pending;
+    uint32_t                    m_size = 0;
+
+    // With previous_transforms, the slots the last upload updated, which this one settles
+    std::vector<uint32_t> m_updated;
+    std::vector<uint8_t>  m_marks;  // by slot, whether this upload updates it
+
+    uint32_t m_frame         = 0;
+    uint32_t m_frame_updates = 0;  // in the frame's region
+};
+
+}  // namespace shiny::graphics
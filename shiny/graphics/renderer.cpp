@@ -54,15 +54,28 @@ only interested in depth values then you can disable the fragment shader stage,
 shadow map generation.
 */
 #include "graphics/renderer.h"
+#include "core/asset_package.h"
+#include "core/logger.h"
+#include "core/profiler.h"
+#include "core/transform_math.h"
+#include "graphics/obj_importer.h"
+#include "graphics/texture_cook.h"
+#include "graphics/vertex_quantize.h"
+#include "jobs/task_graph.h"
+#include "scene/scene_file.h"
 
 #include <algorithm>
 #include <array>
-#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <fstream>
-#include <iostream>
 #include <limits>
+#include <random>
 #include <set>
+#include <thread>
 #include <vector>
 
 #define GLM_FORCE_RADIANS
@@ -70,15 +83,6 @@ shadow map generation.
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-// The header only defines the prototypes of the functions by default. One code file needs to
-// include the header with the STB_IMAGE_IMPLEMENTATION definition to include the function bodies,
-// otherwise we'll get linking errors.
-#define STB_IMAGE_IMPLEMENTATION
-#include <include/stb_image.h>
-
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <include/tiny_obj_loader.h>
-
 #define UNREFERENCED_PARAMETER(P) (P)
 
 namespace {
@@ -86,6 +90,124 @@ namespace {
 const uint32_t WIDTH  = 1600;
 const uint32_t HEIGHT = 1200;
 
+// Enough for a 4k RGBA texture in one go; bigger uploads get a temporary buffer of their own
+const vk::DeviceSize staging_arena_size = 64 * 1024 * 1024;
+const vk::DeviceSize uniform_ring_frame_size = 64 * 1024;
+const uint32_t       max_draws_per_frame     = 16 * 1024;
+const uint32_t       max_instances_per_frame = 128 * 1024;
+const uint32_t       max_culls_per_frame     = 256 * 1024;  // instances and meshlets, on the GPU
+const uint32_t       max_scene_instances     = 64 * 1024;   // see setRenderScene
+const uint32_t       max_scene_updates       = 16 * 1024;   // of them, a frame
+const uint32_t       geometry_pool_vertices  = 1024 * 1024;
+const uint32_t       geometry_pool_indices   = 4 * 1024 * 1024;
+const vk::DeviceSize geometry_position_unit  = 4;  // bytes, see createGeometryPool
+
+// Where the most recent CPU and GPU zones of every run end up, for chrome://tracing
+const char* const profile_trace_path = "shiny.trace.json";
+
+// Where the steps up to the first frame end up, see renderer::reportStartup
+const char* const startup_report_path = "shiny.startup.txt";
+const char* const startup_trace_path  = "shiny.startup.json";
+
+// How often, in seconds, an on demand renderer that is still loading, streaming or compiling
+// something draws a frame to pick it up, see renderer::waitForEvents
+const double on_demand_poll_interval = 0.05;
+
+// How much of the device's VRAM budget streamed textures may take up
+const float texture_budget_share = 0.5f;
+
+// Every this many frames memory is defragmented, with up to this much copied a frame, evacuating
+// the blocks of streamed textures that are at most this full, see renderer::defragmentMemory
+const uint64_t       defragment_interval        = 600;
+const vk::DeviceSize defragment_bytes_per_frame = 8 * 1024 * 1024;
+const float          defragment_block_usage     = 0.5f;
+
+// Descriptor pools are created for this many sets at a time
+const uint32_t descriptor_sets_per_pool = 64;
+
+// Slots in the bindless texture array, unless the device allows fewer
+const uint32_t max_bindless_textures = 16 * 1024;
+
+// Where pull_vert.spv reads the vertices' positions and other attributes from, see
+// renderer::setVertexPulling
+const uint32_t vertex_pull_binding           = 3;
+const uint32_t vertex_attribute_pull_binding = 8;
+
+// Where lighting.glsl reads the frame's lights and their clusters from, see writeDescriptorSet
+const uint32_t light_binding         = 4;
+const uint32_t light_cluster_binding = 5;
+
+// And where shadows.glsl reads the shadow map and the frame's cascades from
+const uint32_t shadow_map_binding  = 6;
+const uint32_t shadow_view_binding = 7;
+
+// And where bindless.frag samples virtual textures' pages and writes which tiles it wanted, see
+// renderer::setVirtualTextures, whose page cache is this many pages across
+const uint32_t virtual_pages_binding    = 9;
+const uint32_t virtual_feedback_binding = 10;
+const uint32_t virtual_page_columns     = 30;
+
+// And where shadows.glsl traces the scene through instead, see renderer::rayQueryShadows
+const uint32_t ray_scene_binding = 11;
+
+// And where probes.glsl samples the reflection probes' cubes and reads the frame's probes from
+const uint32_t probe_cubes_binding = 12;
+const uint32_t probe_view_binding  = 13;
+
+// The directional light's shadows reach this far, in cascades of quality_settings'
+// shadow_resolution texels across
+const float shadow_distance = 20.f;
+
+// Towards the directional light, which is a little warmer than white
+const glm::vec3 sun_direction = glm::normalize(glm::vec3(0.4f, 0.25f, 1.f));
+const glm::vec3 sun_color     = glm::vec3(1.f, 0.95f, 0.85f);
+
+// Whether GPU culling also culls what was hidden in the previous frame, where it's supported
+const bool occlusion_culling = true;
+
+// Single instances with at least this many indices have their boxes queried on CPU culled frames,
+// up to so many a frame, see renderer::setOcclusionQueries
+const uint32_t occlusion_query_indices = 4096;
+const uint32_t max_occlusion_queries   = 1024;
+
+// A level of detail is used once its simplification error covers less than this many pixels, at a
+// LOD bias of 0, see quality_settings
+const float lod_error_pixels = 1.f;
+
+// The projection's near plane. It has no far plane, see reversePerspective, so the far one is
+// only how far the lights' clusters reach, and what draw sort keys quantize distances by.
+const float near_plane = 0.1f;
+const float far_plane  = 100.f;
+
+// The skinned test mesh, see renderer::createSkinnedInstances, is a tentacle of this many joints
+// along z, a ring of vertices every so often
+const uint32_t skinned_joints  = 8;
+const uint32_t skinned_rings   = 25;
+const uint32_t skinned_sides   = 8;
+const float    skinned_height  = 0.8f;
+const float    skinned_radius  = 0.04f;
+const uint32_t skinned_frames  = 16;
+const float    skinned_seconds = 2.5f;
+
+// Vertices of debug lines and triangles a frame, see renderer::setDebugDraw
+const uint32_t max_debug_vertices = 256 * 1024;
+
+// Sprites of the HUD a frame, and the texels to a pixel of its font, see renderer::setHud
+const uint32_t max_hud_sprites = 4096;
+const uint32_t hud_font_scale  = 2;
+
+// The stress scene that run() calibrates with when there's none, see renderer::setCalibration, the
+// frames rendered before measuring and measured at each render scale, and the bytes uploaded at a
+// time, half the staging arena, so that staging them never waits for the copy before
+const uint32_t       calibration_columns       = 48;
+const uint32_t       calibration_layers        = 4;
+const uint32_t       calibration_warmup_frames = 60;
+const uint32_t       calibration_frames        = 120;
+const vk::DeviceSize calibration_upload_size   = staging_arena_size / 2;
+const uint32_t       calibration_uploads       = 8;
+
+const char* const texture_path = "textures/texture.jpg";
+
 using VulkanExtensionName = const char*;
 using VulkanLayerName     = const char*;
 
@@ -107,13 +229,170 @@ const std::vector<shiny::graphics::Vertex> triangle_vertices = {
 
 const std::vector<uint32_t> triangle_indices = { 0, 1, 2, 2, 3, 0, 4, 5, 6, 6, 7, 4 };
 
-const shiny::graphics::Mesh triangle_mesh(triangle_vertices, triangle_indices);
+/*
+Sorting by the key draws everything opaque before anything blended, and opaque draws grouped by
+pipeline, then texture, then mesh, so that consecutive draws share as much state as they can, and
+front to back within those, so the depth test rejects more. Blended draws have to go back to
+front to blend correctly, so for them the distance comes before everything else.
+
+    opaque:  | 0 | pipeline:8 | texture:16 | mesh:14 | distance:24 |
+    blended: | 1 | ~distance:24 | pipeline:8 | texture:16 | mesh:14 |
 
-#ifdef NDEBUG
-constexpr const bool enableValidationLayers = false;
-#else
-constexpr const bool enableValidationLayers = true;
-#endif
+The pass takes the top two bits. Textures and meshes that don't fit their field only sort a little
+worse.
+*/
+static uint64_t
+drawSortKey(shiny::graphics::material surface,
+            uint32_t                  texture,
+            uint32_t                  firstindex,
+            float                     distance)
+{
+    const uint64_t depth    = (uint64_t)(std::clamp(distance / far_plane, 0.f, 1.f) * 0xffffff);
+    const uint64_t pipeline = (uint64_t)surface & 0xff;
+    const uint64_t slot     = texture & 0xffff;
+    const uint64_t mesh     = (firstindex ^ (firstindex >> 14)) & 0x3fff;
+    const uint64_t state    = pipeline << 30 | slot << 14 | mesh;
+
+    if (surface == shiny::graphics::material::alpha_blend) {
+        return 1ull << 62 | (~depth & 0xffffff) << 38 | state;
+    }
+    return state << 24 | depth;
+}
+
+/*
+A perspective projection with reverse-Z and no far plane: depth is 1 at the near plane and falls
+towards 0 at infinity, so the depth test is VK_COMPARE_OP_GREATER and depth is cleared to 0.
+Floating point depth is the most precise near 0, which is where the projection squeezes most of
+the distance into, so a 32 bit float depth buffer is about as precise far away as close by.
+Right handed like glm::perspective, whose y is still to be flipped for Vulkan.
+*/
+static glm::mat4
+reversePerspective(float fovy, float aspect, float near)
+{
+    const float focal = 1.f / std::tan(fovy * 0.5f);
+
+    glm::mat4 result(0.f);
+    result[0][0] = focal / aspect;
+    result[1][1] = focal;
+    result[2][3] = -1.f;
+    result[3][2] = near;
+    return result;
+}
+
+/*
+Writes `"name": { ... }` with the samples' mean, median, 95th and 99th percentiles and extremes,
+the percentiles by nearest rank. All zeros without samples.
+*/
+static void
+writeStatistics(std::ofstream& out, const char* name, std::vector<float> samples)
+{
+    std::sort(samples.begin(), samples.end());
+
+    const size_t count = samples.size();
+    auto percentile    = [&](double p) {
+        return count ? samples[std::min((size_t)(p * (double)(count - 1) + 0.5), count - 1)] : 0.f;
+    };
+
+    double total = 0.;
+    for (float sample : samples) {
+        total += sample;
+    }
+
+    out << "  \"" << name << "\": { ";
+    out << "\"mean\": " << (count ? total / (double)count : 0.) << ", ";
+    out << "\"median\": " << percentile(0.5) << ", ";
+    out << "\"p95\": " << percentile(0.95) << ", ";
+    out << "\"p99\": " << percentile(0.99) << ", ";
+    out << "\"min\": " << (count ? samples.front() : 0.f) << ", ";
+    out << "\"max\": " << (count ? samples.back() : 0.f) << " }";
+}
+
+// 0 without samples
+static float
+median(std::vector<float> samples)
+{
+    if (samples.empty()) {
+        return 0.f;
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+/*
+Writes `"memory": [ ... ]` with every heap's size, budget, usage and allocated bytes, and the bytes
+and allocations of every category used in it.
+*/
+static void
+writeMemoryReport(std::ofstream& out, const std::vector<memory_heap_report>& heaps)
+{
+    out << "  \"memory\": [";
+    for (size_t heap = 0; heap < heaps.size(); ++heap) {
+        const memory_heap_report& report = heaps[heap];
+
+        out << (heap ? ",\n" : "\n") << "    { ";
+        out << "\"heap\": " << heap << ", ";
+        out << "\"device_local\": " << (report.device_local ? "true" : "false") << ", ";
+        out << "\"size\": " << report.size << ", ";
+        out << "\"budget\": " << report.budget << ", ";
+        out << "\"usage\": " << report.usage << ", ";
+        out << "\"allocated\": " << report.allocated << ", ";
+        out << "\"used\": { ";
+        for (size_t category = 0; category < memory_category_count; ++category) {
+            out << (category ? ", " : "") << "\"" << memoryCategoryName((memory_category)category)
+                << "\": { \"bytes\": " << report.used[category]
+                << ", \"allocations\": " << report.allocations[category] << " }";
+        }
+        out << " } }";
+    }
+    out << "\n  ]";
+}
+
+// Writes `"host_memory": [ ... ]` with what the driver allocated through hostAllocator() per scope
+static void
+writeHostMemoryReport(std::ofstream& out, const std::vector<host_scope_report>& scopes)
+{
+    out << "  \"host_memory\": [";
+    for (size_t i = 0; i < scopes.size(); ++i) {
+        const host_scope_report& scope = scopes[i];
+
+        out << (i ? ",\n" : "\n") << "    { ";
+        out << "\"scope\": \"" << scope.scope << "\", ";
+        out << "\"allocations\": " << scope.allocations << ", ";
+        out << "\"live\": " << scope.live_bytes << ", ";
+        out << "\"peak\": " << scope.peak_bytes << " }";
+    }
+    out << "\n  ]";
+}
+
+/*
+Writes `"counters": { ... }` with the hardware counters every render graph pass sampled last, by
+their names and units. Each frame samples one group of them, so a benchmark of more frames than
+there are groups has them all.
+*/
+static void
+writeCounters(std::ofstream& out, const gpu_profiler& profiler)
+{
+    const std::vector<gpu_counter>& counters = profiler.hardwareCounters();
+    const std::vector<std::string>  passes   = profiler.counterPasses();
+
+    out << "  \"counters\": {";
+    for (size_t i = 0; i < passes.size(); ++i) {
+        out << (i ? ",\n" : "\n") << "    \"" << passes[i] << "\": { ";
+
+        bool first = true;
+        for (uint32_t c = 0; c < (uint32_t)counters.size(); ++c) {
+            double value = 0.;
+            if (profiler.counter(passes[i], c, value)) {
+                out << (first ? "" : ", ") << "\"" << counters[c].name
+                    << (counters[c].unit.empty() ? "" : " (" + counters[c].unit + ")")
+                    << "\": " << value;
+                first = false;
+            }
+        }
+        out << " }";
+    }
+    out << "\n  }";
+}
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL
                            debugCallback(VkDebugReportFlagsEXT      flags,
@@ -125,15 +404,36 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL
                                          const char*                msg,
                                          void*                      userData)
 {
-    UNREFERENCED_PARAMETER(flags);
     UNREFERENCED_PARAMETER(objType);
-    UNREFERENCED_PARAMETER(obj);
     UNREFERENCED_PARAMETER(location);
-    UNREFERENCED_PARAMETER(code);
     UNREFERENCED_PARAMETER(layerPrefix);
     UNREFERENCED_PARAMETER(userData);
 
-    std::cerr << "validation layer: " << msg << std::endl;
+    using shiny::core::log_level;
+
+    log_level level = log_level::debug;
+    if (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT) {
+        level = log_level::error;
+    } else if (flags
+               & (VK_DEBUG_REPORT_WARNING_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT)) {
+        level = log_level::warning;
+    } else if (flags & VK_DEBUG_REPORT_INFORMATION_BIT_EXT) {
+        level = log_level::info;
+    }
+    if (!shiny::core::logEnabled(level)) {
+        return VK_FALSE;
+    }
+
+    // This is often the driver's thread, in the middle of a call the frame is waiting for, so the
+    // message is put together on the stack and queued rather than written. The same complaint
+    // about the same object is the same message, whatever else its text says; without a code it's
+    // the text that tells.
+    char           text[shiny::core::log_message_capacity];
+    const int      length = std::snprintf(text, sizeof(text), "validation layer: %s", msg);
+    const uint64_t id =
+      code != 0 ? ((uint64_t)(uint32_t)code * 0x9e3779b97f4a7c15ull) ^ obj : 0;
+    shiny::core::logMessage(level, text, std::min((size_t)std::max(length, 0), sizeof(text) - 1),
+                            id);
 
     return VK_FALSE;
 }
@@ -178,6 +478,8 @@ class QueueFamilyIndices
 {
     int m_graphicsFamily     = -1;
     int m_presentationFamily = -1;
+    int m_transferFamily     = -1;
+    int m_computeFamily      = -1;
 
 public:
     bool isComplete() { return graphicsFamily() >= 0 && presentFamily() >= 0; }
@@ -187,6 +489,17 @@ public:
 
     int  presentFamily() const { return m_presentationFamily; }
     void presentFamily(int i) { m_presentationFamily = i; }
+
+    // Falls back to the graphics family, whose queues can always do transfers as well
+    int transferFamily() const
+    {
+        return m_transferFamily >= 0 ? m_transferFamily : m_graphicsFamily;
+    }
+    void transferFamily(int i) { m_transferFamily = i; }
+
+    // Falls back to the graphics family too, which is all that async compute would overlap with
+    int computeFamily() const { return m_computeFamily >= 0 ? m_computeFamily : m_graphicsFamily; }
+    void computeFamily(int i) { m_computeFamily = i; }
 };
 
 /*
@@ -195,9 +508,20 @@ to uploading textures, requires commands to be submitted to a queue. There are d
 queues that originate from different queue families and each family of queues allows only a subset
 of commands. For example, there could be a queue family that only allows processing of compute
 commands or one that only allows memory transfer related commands.
+
+Uploads prefer a queue family that can do transfers but neither graphics nor compute. On discrete
+cards such a family is backed by the DMA engines, which copy while the rest of the GPU keeps
+rendering. Likewise, compute work prefers a family that can do compute but not graphics, whose
+queues run dispatches in between and alongside the graphics queue's work.
+
+`graphics_only` leaves transfers and compute to the graphics family as well, for device groups: a
+semaphore only waits on one GPU of the group, so handing uploads over from another queue would leave
+the others to race them.
 */
 QueueFamilyIndices
-findQueueFamilies(const vk::PhysicalDevice& device, const vk::SurfaceKHR& surface)
+findQueueFamilies(const vk::PhysicalDevice& device,
+                  const vk::SurfaceKHR&     surface,
+                  bool                      graphics_only = false)
 {
     QueueFamilyIndices indices;
 
@@ -205,19 +529,40 @@ findQueueFamilies(const vk::PhysicalDevice& device, const vk::SurfaceKHR& surfac
 
     for (size_t i = 0; i < families.size(); i++) {
         auto       queuefamily          = families[i];
-        vk::Bool32 presentation_support = device.getSurfaceSupportKHR((uint32_t)i, surface);
+        vk::Bool32 presentation_support =
+          surface ? device.getSurfaceSupportKHR((uint32_t)i, surface) : VK_FALSE;
+
+        if (queuefamily.queueCount == 0) {
+            continue;
+        }
 
-        if (queuefamily.queueCount > 0 && presentation_support) {
+        if (presentation_support && indices.presentFamily() < 0) {
             indices.presentFamily((int)i);
         }
 
-        if (queuefamily.queueCount > 0 && queuefamily.queueFlags & vk::QueueFlagBits::eGraphics) {
+        if (queuefamily.queueFlags & vk::QueueFlagBits::eGraphics && indices.graphicsFamily() < 0) {
             indices.graphicsFamily((int)i);
         }
 
-        if (indices.isComplete()) {
-            break;
+        if (graphics_only) {
+            continue;
+        }
+
+        auto flags = queuefamily.queueFlags;
+        if (flags & vk::QueueFlagBits::eTransfer && !(flags & vk::QueueFlagBits::eGraphics)
+            && !(flags & vk::QueueFlagBits::eCompute)) {
+            indices.transferFamily((int)i);
         }
+
+        if (flags & vk::QueueFlagBits::eCompute && !(flags & vk::QueueFlagBits::eGraphics)
+            && indices.computeFamily() == indices.graphicsFamily()) {
+            indices.computeFamily((int)i);
+        }
+    }
+
+    // Without a surface nothing is presented, and the graphics queue stands in for the present one
+    if (!surface) {
+        indices.presentFamily(indices.graphicsFamily());
     }
 
     return indices;
@@ -274,6 +619,17 @@ checkDeviceExtensionSupport(const vk::PhysicalDevice& device)
     return requiredExtensions.empty();
 }
 
+bool
+hasInstanceExtension(const char* name)
+{
+    for (const vk::ExtensionProperties& extension : vk::enumerateInstanceExtensionProperties()) {
+        if (std::strcmp(extension.extensionName, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /*
 We attempt to select for a device that supports all the features we need to draw something on the
 screen
@@ -285,7 +641,13 @@ isDeviceSuitable(const vk::PhysicalDevice& device, const vk::SurfaceKHR& surface
     bool queueFamilyComplete = findQueueFamilies(device, surface).isComplete();
     bool swapChainAdequate   = false;
 
-    if (extensionsSupported) {
+    // Rendering offscreen needs neither VK_KHR_swapchain nor anything from a surface
+    if (!surface) {
+        extensionsSupported = true;
+        swapChainAdequate   = true;
+    }
+
+    if (extensionsSupported && surface) {
         auto details      = querySwapChainSupport(device, surface);
         swapChainAdequate = !details.formats.empty() && !details.presentModes.empty();
     }
@@ -353,23 +715,20 @@ tearing with significantly less latency issues than standard vertical sync that
 buffering.
 
 Only the VK_PRESENT_MODE_FIFO_KHR mode is guaranteed to be available, so we'll again have to write a
-function that looks for the best mode that is available:
+function that looks for the first of the preferred modes that is available:
 */
 vk::PresentModeKHR
-chooseSwapPresentMode(const std::vector<vk::PresentModeKHR>& availablePresentModes)
+chooseSwapPresentMode(const std::vector<vk::PresentModeKHR>& availablePresentModes,
+                      const std::vector<vk::PresentModeKHR>& preferredPresentModes)
 {
-    vk::PresentModeKHR bestmode = vk::PresentModeKHR::eFifo;
-
-    for (const auto& availablepresentmode : availablePresentModes) {
-        if (availablepresentmode == vk::PresentModeKHR::eMailbox) {
-            return availablepresentmode;
-        }
-        if (availablepresentmode == vk::PresentModeKHR::eImmediate) {
-            bestmode = availablepresentmode;
+    for (vk::PresentModeKHR preferred : preferredPresentModes) {
+        if (std::find(availablePresentModes.begin(), availablePresentModes.end(), preferred)
+            != availablePresentModes.end()) {
+            return preferred;
         }
     }
 
-    return bestmode;
+    return vk::PresentModeKHR::eFifo;
 }
 
 /*
@@ -423,193 +782,310 @@ GLFW needs certain extensions to be present before it can work its windowing mag
 these are known through the glfwGetRequiredInstanceExtensions function
 */
 std::vector<VulkanExtensionName>
-getRequiredExtensions()
+getRequiredExtensions(bool window, bool validation)
 {
     uint32_t             glfwExtensionCount = 0;
-    VulkanExtensionName* glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    VulkanExtensionName* glfwExtensions     = nullptr;
+    if (window) {
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    }
 
     std::vector<VulkanExtensionName> extensions(glfwExtensions,
                                                 glfwExtensions + glfwExtensionCount);
 
-    if (enableValidationLayers) {
+    if (validation) {
         extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
     }
 
+    // Labels for capture tools, in every build that doesn't compile them out
+    if (debug_labels::extension() && hasInstanceExtension(debug_labels::extension())) {
+        extensions.push_back(debug_labels::extension());
+    }
+
+#if defined(VK_KHR_get_physical_device_properties2)
+    // The instance is Vulkan 1.0, so querying the optional device features goes through this
+    // extension, see device_capabilities
+    if (hasInstanceExtension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+        extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
+#endif
+#if defined(VK_KHR_device_group_creation)
+    // Which VK_KHR_device_group needs, and that VK_KHR_buffer_device_address
+    if (hasInstanceExtension(VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME)) {
+        extensions.push_back(VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME);
+    }
+#endif
+
     return extensions;
 }
 
-/*
-Creating a shader module is simple, we only need to specify a pointer to the buffer with the
-bytecode and the length of it. This information is specified in a VkShaderModuleCreateInfo
-structure. The one catch is that the size of the bytecode is specified in bytes, but the bytecode
-pointer is a uint32_t pointer rather than a char pointer. Therefore we will need to cast the pointer
-with reinterpret_cast as shown below. When you perform a cast like this, you also need to ensure
-that the data satisfies the alignment requirements of uint32_t. Lucky for us, the data is stored in
-an std::vector where the default allocator already ensures that the data satisfies the worst case
-alignment requirements.
-*/
-vk::ShaderModule
-createShaderModule(const shiny::graphics::spirvbytecode& code, const vk::Device& device)
+// The most samples `counts` has, up to `requested`, or the most there are for 0
+vk::SampleCountFlagBits
+maxSampleCount(vk::SampleCountFlags counts, uint32_t requested)
 {
-    vk::ShaderModuleCreateInfo create_info;
-    create_info.setCodeSize(code.size());
-    create_info.setPCode((const uint32_t*)code.data());
-
-    return device.createShaderModule(create_info);
+    for (uint32_t samples = 64; samples > 1; samples /= 2) {
+        const auto bit = (vk::SampleCountFlagBits)samples;
+        if ((requested == 0 || samples <= requested) && (bool)(counts & bit)) {
+            return bit;
+        }
+    }
+    return vk::SampleCountFlagBits::e1;
 }
 
-/*
-Now that we have a way of producing SPIR-V shaders, it's time to load them into our program to
-plug them into the graphics pipeline at some point. We'll first write a simple helper function to
-load the binary data from the files.
-*/
-shiny::graphics::spirvbytecode
-readFile(const std::string& filename)
+// The fragment side nearest `size` the device has, a power of 2 up to `max` and 4
+uint32_t
+fragmentSide(uint32_t size, uint32_t max)
 {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    uint32_t side = 1;
+    while (side * 2 <= std::min({ size, max, 4u })) {
+        side *= 2;
+    }
+    return side;
+}
 
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open file for reading!");
+uint64_t
+fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
     }
+    return hash;
+}
 
-    size_t            filesize = (size_t)file.tellg();
-    std::vector<char> buffer(filesize);
+// What the geometry subpass of deferred shading writes, see createDeferredRenderPass. Both are
+// color attachment formats on every device, and the normal is packed into [0, 1].
+const vk::Format gbuffer_color_format  = vk::Format::eR8G8B8A8Unorm;
+const vk::Format gbuffer_normal_format = vk::Format::eA2B10G10R10UnormPack32;
+
+// Whether the depth prepass draws a material's surfaces: whatever is drawn the way it is, opaque
+// and filled, and writes its depth. Alpha tested fragments may be discarded, which only the
+// material's own fragment shader knows.
+bool
+drawnByPrepass(const shiny::graphics::pipeline_state& state)
+{
+    return state.blend == shiny::graphics::blend_mode::opaque && state.depth_test
+           && state.depth_write && state.polygon_mode == vk::PolygonMode::eFill
+           && !state.enabled(shiny::graphics::shader_feature::alpha_test);
+}
 
-    file.seekg(0);
-    file.read(buffer.data(), filesize);
+// Whether a texture cache handle is a virtual texture's bindless slot, see setVirtualTextures
+bool
+isVirtualTexture(uint32_t texture)
+{
+    return (texture & shiny::graphics::virtual_texture_bit) != 0;
+}
 
-    return shiny::graphics::spirvbytecode(buffer);
+// A fully saturated color of hue `h` in [0, 1), for the test lights
+glm::vec3
+hue(float h)
+{
+    const glm::vec3 offsets(0.f, 2.f / 3.f, 1.f / 3.f);
+    return glm::clamp(glm::abs(glm::fract(glm::vec3(h) + offsets) * 6.f - 3.f) - 1.f, 0.f, 1.f);
 }
 
-using MemoryTypeIndex = uint32_t;
+// The components of the test entities, see renderer::createEntities
+struct object_transform
+{
+    glm::mat4 world    = glm::mat4(1.f);
+    glm::mat4 previous = glm::mat4(1.f);  // before the step it last moved in
+    uint64_t  moved    = 0;               // that step, of the simulation's clock
+};
 
-/*
-Graphics cards can offer different types of memory to allocate from. Each type of memory varies in
-terms of allowed operations and performance characteristics. We need to combine the requirements of
-the buffer and our own application requirements to find the right type of memory to use.
-*/
-MemoryTypeIndex
-findMemoryType(const vk::PhysicalDevice& physical_device,
-               // The typeFilter parameter will be used to specify the bit field of memory types
-               // that are suitable.
-               uint32_t                typefilter,
-               vk::MemoryPropertyFlags properties)
+struct object_bounds
+{
+    glm::vec3 center = glm::vec3(0.f);  // in the world
+    float     radius = 0.f;
+};
+
+struct object_mesh
+{
+    const shiny::graphics::Mesh* mesh = nullptr;
+};
+
+struct object_material
 {
-    vk::PhysicalDeviceMemoryProperties memproperties = physical_device.getMemoryProperties();
+    uint32_t texture = 0;  // of the renderer's texture cache
+};
+
+// Test entities spin in one out of this many, and are this large
+const uint32_t spinning_share = 8;
+const float    entity_scale   = 0.08f;
 
-    // The VkPhysicalDeviceMemoryProperties structure has two arrays memoryTypes and memoryHeaps.
-    // Memory heaps are distinct memory resources like dedicated VRAM and swap space in RAM for when
-    // VRAM runs out. The different types of memory exist within these heaps. Right now we'll only
-    // concern ourselves with the type of memory and not the heap it comes from, but you can imagine
-    // that this can affect performance.
+// Turns the entity about z, where it stands
+struct object_spin
+{
+    glm::vec3 position = glm::vec3(0.f);
+    float     speed    = 0.f;  // radians a second
+    float     angle    = 0.f;
+    float     scale    = entity_scale;
+};
 
-    // However, we're not just interested in a memory type that is suitable for the vertex buffer.
-    // We also need to be able to write our vertex data to that memory. The memoryTypes array
-    // consists of VkMemoryType structs that specify the heap and properties of each type of memory.
-    // The properties define special features of the memory, like being able to map it so we can
-    // write to it from the CPU. This property is indicated with
-    // VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, but we also need to use the
-    // VK_MEMORY_PROPERTY_HOST_COHERENT_BIT property. We'll see why when we map the memory.
+// Texels across the stress scene's checker textures, and across every one of their squares
+const uint32_t stress_texture_size = 64;
+const uint32_t stress_square_size  = 8;
 
-    for (uint32_t i = 0; i < memproperties.memoryTypeCount; ++i) {
-        if ((typefilter & (1 << i)) && (memproperties.memoryTypes[i].propertyFlags & properties)) {
-            return i;
+// The stress scene's cube, a unit one around the origin with a color per face
+shiny::graphics::Mesh
+stressCube()
+{
+    using shiny::graphics::Vertex;
+
+    // Every face's normal, the axes across it following on from it in turn
+    const glm::vec3 normals[6] = { { 1, 0, 0 },  { -1, 0, 0 }, { 0, 1, 0 },
+                                   { 0, -1, 0 }, { 0, 0, 1 },  { 0, 0, -1 } };
+
+    std::vector<Vertex>   vertices;
+    std::vector<uint32_t> indices;
+    for (uint32_t f = 0; f < 6; ++f) {
+        const glm::vec3 n     = normals[f];
+        const glm::vec3 u     = glm::vec3(n.z, n.x, n.y);
+        const glm::vec3 v     = glm::cross(n, u);
+        const glm::vec3 color = hue((float)f / 6.f) * 0.5f + 0.5f;
+
+        const uint32_t first = (uint32_t)vertices.size();
+        vertices.push_back({ (n - u - v) * 0.5f, color, { 0.f, 0.f } });
+        vertices.push_back({ (n + u - v) * 0.5f, color, { 1.f, 0.f } });
+        vertices.push_back({ (n + u + v) * 0.5f, color, { 1.f, 1.f } });
+        vertices.push_back({ (n - u + v) * 0.5f, color, { 0.f, 1.f } });
+        for (uint32_t corner : { 0, 1, 2, 2, 3, 0 }) {
+            indices.push_back(first + corner);
         }
     }
-
-    throw std::runtime_error("Unable to find a suitable Memory Type!");
+    return shiny::graphics::Mesh(std::move(vertices), std::move(indices));
 }
 
-}  // namespace
+// A checkerboard of two shades of a hue that `seed` picks, one level of RGBA8
+shiny::graphics::texture_data
+stressTexture(uint32_t seed)
+{
+    const glm::vec3 light = hue(std::fmod((float)seed * 0.618034f, 1.f));
+    const glm::vec3 dark  = light * 0.35f;
 
-namespace shiny::graphics {
+    const auto pack = [](const glm::vec3& color) {
+        const glm::uvec3 c = glm::uvec3(glm::clamp(color, 0.f, 1.f) * 255.f + 0.5f);
+        return c.r | c.g << 8 | c.b << 16 | 0xff000000u;
+    };
 
-/*
-A vertex binding describes at which rate to load data from memory throughout the vertices. It
-specifies the number of bytes between data entries and whether to move to the next data entry after
-each vertex or after each instance.
-*/
-vk::VertexInputBindingDescription
-Vertex::getBindingDescription()
+    shiny::graphics::texture_data data;
+    data.format = vk::Format::eR8G8B8A8Unorm;
+    data.width  = stress_texture_size;
+    data.height = stress_texture_size;
+    data.texels.resize(stress_texture_size * stress_texture_size * sizeof(uint32_t));
+
+    for (uint32_t y = 0; y < stress_texture_size; ++y) {
+        for (uint32_t x = 0; x < stress_texture_size; ++x) {
+            const bool     odd   = ((x / stress_square_size) + (y / stress_square_size)) % 2 != 0;
+            const uint32_t texel = pack(odd ? dark : light);
+            std::memcpy(&data.texels[(y * stress_texture_size + x) * sizeof(uint32_t)], &texel,
+                        sizeof(texel));
+        }
+    }
+
+    shiny::graphics::ktx2_level level;
+    level.size   = data.texels.size();
+    level.width  = stress_texture_size;
+    level.height = stress_texture_size;
+    data.levels.push_back(level);
+    return data;
+}
+
+// Either vertex format's positions and texture coordinates, by vertex_format, for the reflection
+// probes' captures
+std::vector<shiny::graphics::probe_vertex_input>
+probeInputs()
 {
-    return vk::VertexInputBindingDescription()
-      //  The binding parameter specifies the index of the binding in the array of bindings.
-      .setBinding(0)
-      // The stride parameter specifies the number of bytes from one entry to the next
-      .setStride(sizeof(Vertex))
-      // the inputRate parameter can have one of the following values:
-      // - VK_VERTEX_INPUT_RATE_VERTEX: Move to the next data entry after each vertex
-      // - VK_VERTEX_INPUT_RATE_INSTANCE: Move to the next data entry after each instance
-      // We're not going to use instanced rendering, so we'll stick to per-vertex data.
-      .setInputRate(vk::VertexInputRate::eVertex);
+    using shiny::graphics::attribute_binding;
+    using shiny::graphics::packed_vertex;
+    using shiny::graphics::position_binding;
+    using shiny::graphics::Vertex;
+
+    return {
+        { { Vertex::getBindingDescription()[position_binding],
+            Vertex::getBindingDescription()[attribute_binding] },
+          { Vertex::getAttributeDescription()[0], Vertex::getAttributeDescription()[2] } },
+        { { packed_vertex::getBindingDescription()[position_binding],
+            packed_vertex::getBindingDescription()[attribute_binding] },
+          { packed_vertex::getAttributeDescription()[0],
+            packed_vertex::getAttributeDescription()[2] } },
+    };
 }
 
-/*
-As the function prototype indicates, there are going to be two of these structures. An attribute
-description struct describes how to extract a vertex attribute from a chunk of vertex data
-originating from a binding description. We have two attributes, position and color, so we need two
-attribute description structs.
-*/
-std::array<vk::VertexInputAttributeDescription, 3>
-Vertex::getAttributeDescription()
+// Either vertex format's position stream only, by vertex_format, for what draws nothing but depth
+// or IDs: the shadow casters and the pick candidates
+std::vector<shiny::graphics::shadow_vertex_input>
+positionInputs()
 {
+    using shiny::graphics::packed_vertex;
+    using shiny::graphics::position_binding;
+    using shiny::graphics::Vertex;
+
     return {
-        /*Position Description*/
-        vk::VertexInputAttributeDescription()
-          // The binding parameter tells Vulkan from which binding the per-vertex data comes
-          .setBinding(0)
-          // The location parameter references the location directive of the input in the
-          // vertex shader. The input in the vertex shader with location 0 is the position,
-          // which has two 32-bit float components.
-          .setLocation(0)
-          // The format parameter describes the type of data for the attribute. A bit
-          // confusingly, the formats are specified using the same enumeration as color
-          // formats. The following shader types and formats are commonly used together:
-          //  - float: VK_FORMAT_R32_SFLOAT
-          //  - vec2: VK_FORMAT_R32G32_SFLOAT
-          //  - vec3: VK_FORMAT_R32G32B32_SFLOAT
-          //  - vec4: VK_FORMAT_R32G32B32A32_SFLOAT
-          // As you can see, you should use the format where the amount of color channels matches
-          // the number of components in the shader data type. It is allowed to use more channels
-          // than the number of components in the shader, but they will be silently discarded. If
-          // the number of channels is lower than the number of components, then the BGA components
-          // will use default values of (0, 0, 1). The color type (SFLOAT, UINT, SINT) and bit width
-          // should also match the type of the shader input. See the following examples:
-          //  - ivec2: VK_FORMAT_R32G32_SINT, a 2-component vector of 32-bit signed integers
-          //  - uvec4: VK_FORMAT_R32G32B32A32_UINT, a 4-component vector of 32-bit unsigned
-          //  - integers double: VK_FORMAT_R64_SFLOAT, a double-precision (64-bit) float
-          // The format parameter implicitly defines the byte size of attribute data
-          .setFormat(vk::Format::eR32G32B32Sfloat)
-          // The offset parameter specifies the number of bytes since the start of the per-vertex
-          // data to read from.
-          .setOffset(offsetof(Vertex, pos)),
-        /*Color Description*/
-        vk::VertexInputAttributeDescription()
-          .setBinding(0)
-          .setLocation(1)
-          .setFormat(vk::Format::eR32G32B32Sfloat)
-          .setOffset(offsetof(Vertex, color)),
-        /*TexCoord Description*/
-        vk::VertexInputAttributeDescription()
-          .setBinding(0)
-          .setLocation(2)
-          .setFormat(vk::Format::eR32G32Sfloat)
-          .setOffset(offsetof(Vertex, texcoord))
+        { Vertex::getBindingDescription()[position_binding],
+          Vertex::getAttributeDescription()[0] },
+        { packed_vertex::getBindingDescription()[position_binding],
+          packed_vertex::getAttributeDescription()[0] },
     };
 }
 
-}  // namespace shiny::graphics
+// See renderer::initWindow
+void
+redrawWindow(GLFWwindow* window)
+{
+    static_cast<shiny::graphics::renderer*>(glfwGetWindowUserPointer(window))->requestRedraw();
+}
+
+// Whatever may change what `window` should show asks `r` for a frame
+void
+redrawOnInput(GLFWwindow* window, shiny::graphics::renderer* r)
+{
+    glfwSetWindowUserPointer(window, r);
+    glfwSetKeyCallback(window, [](GLFWwindow* w, int, int, int, int) { redrawWindow(w); });
+    glfwSetMouseButtonCallback(window, [](GLFWwindow* w, int, int, int) { redrawWindow(w); });
+    glfwSetCursorPosCallback(window, [](GLFWwindow* w, double, double) { redrawWindow(w); });
+    glfwSetScrollCallback(window, [](GLFWwindow* w, double, double) { redrawWindow(w); });
+    glfwSetFramebufferSizeCallback(window, [](GLFWwindow* w, int, int) { redrawWindow(w); });
+    glfwSetWindowFocusCallback(window, [](GLFWwindow* w, int) { redrawWindow(w); });
+    glfwSetWindowIconifyCallback(window, [](GLFWwindow* w, int) { redrawWindow(w); });
+    glfwSetWindowRefreshCallback(window, redrawWindow);
+    glfwSetWindowCloseCallback(window, redrawWindow);
+}
+
+}  // namespace
 
 namespace shiny::graphics {
 
 void
 renderer::run()
 {
-    initWindow();
+    core::nameThread("main");
+    core::applyThreadClass(core::thread_class::render);
+    core::startLogging();
+    m_jobs.init();
+    m_start_time = core::profileNow();
+    m_startup.begin(m_start_time);
+
+    {
+        const core::startup_scope scope(&m_startup, "stage", "window");
+        initWindow();
+    }
     initVulkan();
+    if (m_calibrating) {
+        calibrate();
+    }
     mainLoop();
     cleanup();
+
+    m_jobs.shutdown();
+
+#if !defined(SHINY_DISABLE_PROFILER)
+    if (!core::exportChromeTrace(profile_trace_path)) {
+        core::logWarning() << "Couldn't write the profile to " << profile_trace_path;
+    }
+#endif
+
+    core::stopLogging();
 }
 
 /*
@@ -633,80 +1109,304 @@ vkWaitForFences and semaphores cannot be. Fences are mainly designed to synchron
 itself with rendering operation, whereas semaphores are used to synchronize operations within or
 across command queues. We want to synchronize the queue operations of draw commands and
 presentation, which makes semaphores the best fit.
+
+Everything it draws comes from `packet`, which simulate() filled, on this thread or the main one.
 */
 void
-renderer::drawFrame()
+renderer::drawFrame(const frame_packet& packet)
 {
-    // Wait for the old fences. When the frames in flight goes above 2, this might not work anymore
-    m_device.waitForFences(m_in_flight_fences[m_current_frame], true,
-                           std::numeric_limits<uint64_t>::max());
-    m_device.resetFences(m_in_flight_fences[m_current_frame]);
+    SHINY_PROFILE_FUNCTION();
 
-    // Acquire image from swapchain.
-    auto next_image_results =
-      m_device.acquireNextImageKHR(m_swapchain, std::numeric_limits<uint64_t>::max(),
-                                   m_image_available_semaphores[m_current_frame], nullptr);
-    auto result = next_image_results.result;
+    trackAllocations();
+    const core::alloc_forbidden_scope forbidden(m_allocation_checks
+                                                && m_frame_number >= allocation_warmup_frames);
 
-    if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR) {
-        recreateSwapChain();
-        return;
+    // Wait for the frame that last used this frame in flight's resources. A frame that never
+    // finishes means the device hung or was lost, which is better reported than waited for forever.
+    {
+        SHINY_PROFILE_ZONE("wait for frame");
+        const int64_t waitstart = core::profileNow();
+        if (m_frame_number >= m_frames_in_flight
+            && !waitForFrame(m_frame_number + 1 - m_frames_in_flight)) {
+            throw std::runtime_error("A frame didn't finish rendering in time!");
+        }
+        m_frame_wait_ns = core::profileNow() - waitstart;
+    }
+
+    // Every frame up to and including the one that last used this fence has finished now, so
+    // whatever they were the last to use can go, this frame in flight's transient memory included
+    if (m_frame_number + 1 >= m_frames_in_flight) {
+        m_deletion_queue.collect(m_frame_number + 1 - m_frames_in_flight);
+    }
+    core::linear_arena& arena = m_frame_arenas[m_current_frame];
+    arena.reset();
+
+    // And what it copied out for screenshots, the recording and picking is there to hand over
+    m_frame_readback.collect(m_current_frame);
+    m_video.collect(m_current_frame);
+    if (m_picking) {
+        m_picker.collect(m_current_frame);
+    }
+
+    // Before anything can give up on the frame, since the next packet only has what changed after
+    // this one
+    applySceneChanges(packet);
+
+    // The render resolution follows the GPU time of the frames, and only changes between them
+    if (m_dynamic_resolution) {
+        float    gpumilliseconds = 0.f;
+        uint64_t gpusamples      = 0;
+        if (m_profiler.latest("frame", gpumilliseconds, gpusamples)
+            && gpusamples != m_resolution_samples) {
+            m_resolution_samples = gpusamples;
+            if (m_resolution.update(gpumilliseconds)) {
+                resizeRendering();
+            }
+        }
+    }
+
+    // Quality settings changed on the main thread, likewise between frames
+    if (packet.quality != m_quality) {
+        applyQuality(packet.quality);
+    }
+
+    // Acquire image from swapchain. A suboptimal swap chain can still be presented to, so that is
+    // only handled after presenting. Out of date means the image wasn't acquired at all and the
+    // semaphore won't be signalled, so we have to bail out before submitting anything. The fence
+    // isn't reset yet, so the next call doesn't wait on it forever.
+    uint32_t imageindex = 0;
+    if (m_offscreen) {
+        // Every frame in flight has its own image, and whatever it last read back into its buffer
+        // is there now
+        imageindex = m_current_frame;
+        m_offscreen_target.collect(m_current_frame, m_offscreen_deliver);
+    } else {
+        // What the present thread found out about the swap chain since the last frame
+        if (m_presenter.takeStale(m_swapchain)) {
+            recreateSwapChain();
+        }
+
+        try {
+            SHINY_PROFILE_ZONE("acquire image");
+            auto next_image_results =
+              m_device.acquireNextImageKHR(m_swapchain, std::numeric_limits<uint64_t>::max(),
+                                           m_image_available_semaphores[m_current_frame], nullptr);
+            imageindex = next_image_results.value;
+        } catch (const vk::OutOfDateKHRError&) {
+            recreateSwapChain();
+            return;
+        }
+        acquireViewports();
+    }
+
+    // With more frames in flight than the swap chain has images to spare, the image may still be
+    // rendered to by an earlier frame than the one whose fence was waited for above
+    if (!waitForFrame(m_image_frames[imageindex])) {
+        throw std::runtime_error("A frame didn't finish rendering in time!");
+    }
+    m_image_frames[imageindex] = m_frame_number + 1;
+
+    if (!m_timeline_semaphores) {
+        m_device.resetFences(m_in_flight_fences[m_current_frame]);
+    }
+
+    // The GPU is done with this frame's region of the uniform ring now, so it can be rewritten,
+    // and so is it with its lights, debug lines and sprites
+    uint32_t uniformoffset = updateUniformBuffer(packet);
+    if (m_debug_draw) {
+        m_debug.beginFrame(m_current_frame);
+    }
+    updateLights(packet);
+    updateSkinning();
+    updateHud(packet);
+
+    // Recycle the staging memory of any uploads that have finished by now, without waiting. What
+    // the frame uploads from here on is submitted along with it.
+    m_uploads.update();
+    m_uploads.beginFrame(m_frame_batch);
+
+    m_upload_timings.clear();
+    m_uploads.takeTimings(m_upload_timings);
+    for (float milliseconds : m_upload_timings) {
+        m_profiler.addSample("uploads", milliseconds);
+    }
+
+    // A new frame's worth of streaming budgets, for everything that streams from here on
+    m_streams.update();
+
+    // Starts reloading whatever changed on disk, and swaps in the meshes that are done
+    if (m_hot_reload) {
+        reloadChangedAssets();
+    }
+
+    // Streams textures in and out for what was seen last frame. The new views are ready by the
+    // time this frame is submitted, and this frame's descriptor set isn't in use anymore.
+    m_textures.update(m_frame_number);
+    if (m_defragment) {
+        defragmentMemory();
     }
 
-    auto imageindex = next_image_results.value;
+    // And virtual textures' tiles for what this frame's feedback asked for the last time around
+    if (m_virtual_texturing) {
+        m_virtual_textures.beginFrame(m_current_frame, m_frame_number);
+    }
+    if (m_descriptor_texture_versions[m_current_frame] != m_textures.version()
+        || m_descriptor_virtual_versions[m_current_frame] != m_virtual_textures.version()) {
+        updateTextureDescriptor(m_current_frame);
+    }
 
     // Queue submission and synchronization is configured through parameters in the VkSubmitInfo
     // structure.
 
-    std::vector<vk::Semaphore> done_semaphores = { m_render_finished_semaphores[m_current_frame] };
-    std::vector<vk::Semaphore> wait_semaphores = { m_image_available_semaphores[m_current_frame] };
-    std::vector<vk::PipelineStageFlags> wait_stages = {
-        vk::PipelineStageFlagBits::eColorAttachmentOutput
-    };
+    core::frame_vector<vk::Semaphore> done_semaphores(
+      { m_render_finished_semaphores[m_current_frame] }, &arena);
+    core::frame_vector<vk::Semaphore> wait_semaphores(
+      { m_image_available_semaphores[m_current_frame] }, &arena);
+    core::frame_vector<vk::PipelineStageFlags> wait_stages(
+      { vk::PipelineStageFlags(vk::PipelineStageFlagBits::eColorAttachmentOutput) }, &arena);
+
+    // Offscreen images are neither acquired nor presented, so there is nothing to wait for or
+    // signal either
+    if (m_offscreen) {
+        done_semaphores.clear();
+        wait_semaphores.clear();
+        wait_stages.clear();
+    }
+
+    // The viewports' images are only blitted to, by the upscale pass
+    for (const viewport& v : m_viewports) {
+        if (v.acquired) {
+            wait_semaphores.push_back(v.image_available[m_current_frame]);
+            wait_stages.push_back(vk::PipelineStageFlagBits::eTransfer);
+        }
+    }
 
     assert(wait_semaphores.size() == wait_stages.size()
            && "wait_semaphores and wait_stages must have same size!");
 
-    auto submitinfo = vk::SubmitInfo()
-                        .setWaitSemaphoreCount((uint32_t)wait_semaphores.size())
-                        // every semaphore here must match a vk::PipelineStageFlags, index for
-                        // index. The masks dictate which stage of the pipeline is mapped to which
-                        // semaphore the application must wait on
-                        .setPWaitSemaphores(wait_semaphores.data())
-                        // Therefore wait_stages must be exactly the same length as wait_semaphores
-                        .setPWaitDstStageMask(wait_stages.data())
-                        // The next two parameters specify which command buffers to actually submit
-                        // for execution. As mentioned earlier, we should submit the command buffer
-                        // that binds the swap chain image we just acquired as color attachment.
-                        .setCommandBufferCount(1)
-                        .setPCommandBuffers(&m_command_buffers[imageindex])
-                        // The signalSemaphoreCount and pSignalSemaphores parameters specify which
-                        // semaphores to signal once the command buffer(s) have finished execution.
-                        // In our case we're using the renderFinishedSemaphore for that purpose.
-                        .setSignalSemaphoreCount(1)
-                        .setPSignalSemaphores(done_semaphores.data());
-
-    m_graphics_queue.submit(submitinfo, m_in_flight_fences[m_current_frame]);
-
-    // TODO: make this a smartptr or something
-    std::vector<vk::SwapchainKHR> swapchains = { m_swapchain };
-
-    auto presentinfo = vk::PresentInfoKHR()
-                         // The first two parameters specify which semaphores to wait on before
-                         // presentation can happen, just like VkSubmitInfo.
-                         .setWaitSemaphoreCount(1)
-                         .setPWaitSemaphores(done_semaphores.data())
-                         .setSwapchainCount((uint32_t)swapchains.size())
-                         .setPSwapchains(swapchains.data())
-                         .setPImageIndices(&imageindex);
-
-    if (auto result = m_presentation_queue.presentKHR(presentinfo);
-        result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR) {
-        recreateSwapChain();
+    // The fence wait above also means nothing from this frame's command pool is in use anymore, so
+    // the whole pool goes back to the initial state in one call. Cached secondary command buffers
+    // are kept, and recorded again only when they have to be.
+    m_device.resetCommandPool(m_command_pools[m_current_frame], vk::CommandPoolResetFlags());
+    if (!m_cached_draws) {
+        for (auto& pool : m_secondary_command_pools[m_current_frame]) {
+            m_device.resetCommandPool(pool, vk::CommandPoolResetFlags());
+        }
+    }
+    if (m_async_compute) {
+        m_device.resetCommandPool(m_compute_command_pools[m_current_frame],
+                                  vk::CommandPoolResetFlags());
+    }
+
+    // The same goes for the descriptor sets allocated for this frame the last time around
+    m_frame_descriptors[m_current_frame].reset();
+
+    // Picks up the material pipelines that finished compiling since the last frame
+    updateMaterialPipelines();
+
+    buildDrawList(packet);
+    writeDrawBuffer();
+
+    // The draws wait for the culling and the particles at the indirect stage, and the Hi-Z pass
+    // for the culling to be done reading the pyramid it's about to overwrite
+    const bool computeasync = m_async_compute && (m_gpu_culled || m_particle_count > 0);
+    if (computeasync) {
+        submitAsyncCompute();
+        wait_semaphores.push_back(m_compute_timeline.semaphore());
+        wait_stages.push_back(vk::PipelineStageFlagBits::eDrawIndirect
+                              | vk::PipelineStageFlagBits::eComputeShader);
+    }
+
+    vk::CommandBuffer commandbuffer = m_command_buffers[m_current_frame];
+    recordDrawCommands(commandbuffer, imageindex, uniformoffset);
+
+    // Every semaphore waited on goes with the stages that wait for it, and once the command buffer
+    // has finished, the render finished semaphore is signalled for presenting. The compute queue's
+    // timeline is waited on at the frame's number, binary semaphores ignore their values. The GPUs
+    // of a device group take turns, each rendering whole frames into its own instances of the
+    // images, while what was uploaded before went to all of them.
+    const uint32_t devices = deviceCount();
+    m_frame_batch.begin(devices > 1 ? 1u << (uint32_t)(m_frame_number % devices) : 0);
+    for (size_t i = 0; i < wait_semaphores.size(); ++i) {
+        const bool compute = computeasync && i + 1 == wait_semaphores.size();
+        m_frame_batch.wait(wait_semaphores[i], wait_stages[i], compute ? m_frame_number + 1 : 0);
+    }
+    m_frame_batch.execute(commandbuffer);
+    for (vk::Semaphore semaphore : done_semaphores) {
+        m_frame_batch.signal(semaphore);
+    }
+
+    // With timeline semaphores the frame's number is signalled instead of a fence
+    if (m_timeline_semaphores) {
+        m_frame_batch.signal(m_frame_timeline.semaphore(), m_frame_number + 1);
+    } else {
+        m_frame_batch.fence(m_in_flight_fences[m_current_frame]);
+    }
+
+    // The uploads' transfer halves first, which the acquire halves in the frame's batch wait on,
+    // then everything the graphics queue runs this frame, in as few calls as the fences allow
+    {
+        SHINY_PROFILE_ZONE("submit");
+        // The frame signals the semaphore its frame in flight's last present waits on
+        m_presenter.drain(m_frames_in_flight - 1);
+        m_uploads.endFrame();
+        m_frame_batch.flush();
+    }
+    m_profiler.submitted(m_current_frame);
+    ++m_frame_number;
+    publishTelemetry();
+
+    // The frame was submitted either way, so move on to the next frame's resources before recreating
+    m_current_frame = (m_current_frame + 1) % m_frames_in_flight;
+
+    if (m_offscreen) {
+        return;
+    }
+
+    // The window's image and the viewports' are presented in one call, which waits for the render
+    // finished semaphore just like VkSubmitInfo would. Numbered by the frames, so the latency
+    // mode can wait for this one to be on screen.
+    present_request request;
+    request.swapchains[0] = m_swapchain;
+    request.images[0]     = imageindex;
+    request.count         = 1;
+    request.wait          = done_semaphores[0];
+    request.id            = m_frame_number;
+    for (const viewport& v : m_viewports) {
+        if (v.acquired) {
+            request.swapchains[request.count] = v.swapchain;
+            request.images[request.count++]   = v.image;
+        }
+    }
+
+    if (m_presenter.running()) {
+        m_presenter.push(request);
+        m_presented = m_frame_number;
+        reportFirstFrame("First frame");
+        reportStartup();
         return;
     }
 
-    m_current_frame = (m_current_frame + 1) % max_frames_in_flight;
+    uint32_t stale = 0;
+    {
+        SHINY_PROFILE_ZONE("present");
+        stale       = presentRequest(m_presentation_queue, request, m_present_wait);
+        m_presented = m_frame_number;
+        reportFirstFrame("First frame");
+        reportStartup();
+    }
+
+    // The viewports' are recreated before they are acquired again, in the order they were
+    // presented in
+    uint32_t presented = 1;
+    for (viewport& v : m_viewports) {
+        if (v.acquired && (stale & (1u << presented++))) {
+            v.stale = true;
+        }
+    }
+    if (stale & 1u) {
+        recreateSwapChain();
+    }
 }
 
 void
@@ -718,6 +1418,18 @@ renderer::initWindow()
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
     m_window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+    for (viewport& v : m_viewports) {
+        v.window = glfwCreateWindow((int)v.settings.width, (int)v.settings.height,
+                                    v.settings.title.c_str(), nullptr, nullptr);
+    }
+
+    // On demand, whatever may change what the windows should show asks for a frame
+    if (m_on_demand) {
+        redrawOnInput(m_window, this);
+        for (viewport& v : m_viewports) {
+            redrawOnInput(v.window, this);
+        }
+    }
 }
 
 /*
@@ -730,37 +1442,53 @@ https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#initializatio
 void
 renderer::createInstance()
 {
-    if (enableValidationLayers && !checkValidationLayerSupport()) {
+    SHINY_PROFILE_FUNCTION();
+
+    if (m_validation && !checkValidationLayerSupport()) {
         throw std::runtime_error("Validation layers requested but unavailable!");
     }
 
+    // Vulkan 1.1 only for ray queries, where the loader has it, see queryCapabilities. A 1.0
+    // loader doesn't have vkEnumerateInstanceVersion and fails creating anything newer.
+    m_instance_version = VK_API_VERSION_1_0;
+    auto enumerateversion =
+      (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+    uint32_t loaderversion = VK_API_VERSION_1_0;
+    if (enumerateversion && enumerateversion(&loaderversion) == VK_SUCCESS
+        && loaderversion >= VK_API_VERSION_1_1) {
+        m_instance_version = VK_API_VERSION_1_1;
+    }
+
     auto appinfo = vk::ApplicationInfo()
                      .setPApplicationName("Hello Triangle")
                      .setApplicationVersion(VK_MAKE_VERSION(1, 0, 0))
                      .setPEngineName("No Engine")
                      .setEngineVersion(VK_MAKE_VERSION(1, 0, 0))
-                     .setApiVersion(VK_API_VERSION_1_0);
+                     .setApiVersion(m_instance_version);
 
     uint32_t             glfwExtensionCount = 0;
     VulkanExtensionName* glfwExtensions     = nullptr;
 
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    if (!m_offscreen) {
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    }
 
     auto createinfo = vk::InstanceCreateInfo()
                         .setPApplicationInfo(&appinfo)
                         .setEnabledExtensionCount(glfwExtensionCount)
                         .setPpEnabledExtensionNames(glfwExtensions);
 
-    if (enableValidationLayers) {
+    if (m_validation) {
         createinfo.setEnabledLayerCount((uint32_t)validationLayers.size());
         createinfo.setPpEnabledLayerNames(validationLayers.data());
     }
 
-    auto extensions = getRequiredExtensions();
+    auto extensions = getRequiredExtensions(!m_offscreen, m_validation);
     createinfo.setEnabledExtensionCount((uint32_t)extensions.size());
     createinfo.setPpEnabledExtensionNames(extensions.data());
 
-    m_instance = vk::createInstance(createinfo);
+    m_instance = vk::createInstance(createinfo, hostAllocator());
+    m_labels.init(m_instance);
 
     // for debugging
     {
@@ -768,7 +1496,7 @@ renderer::createInstance()
           vk::enumerateInstanceExtensionProperties();
 
         for (const auto& extension : extensionProperties) {
-            std::cout << "\t" << extension.extensionName << std::endl;
+            core::logInfo() << "\t" << extension.extensionName;
         }
     }
 }
@@ -776,16 +1504,25 @@ renderer::createInstance()
 void
 renderer::setupDebugCallback()
 {
-    if (!enableValidationLayers)
+    SHINY_PROFILE_FUNCTION();
+
+    if (!m_validation)
         return;
 
     using DebugFlags = vk::DebugReportFlagBitsEXT;
 
-    auto createinfo = vk::DebugReportCallbackCreateInfoEXT()
-                        .setPfnCallback(debugCallback)
-                        .setFlags(DebugFlags::eError | DebugFlags::eWarning);
+    // The layers' information is mostly the loader's chatter, so only the debug level asks for it
+    vk::DebugReportFlagsEXT flags =
+      DebugFlags::eError | DebugFlags::eWarning | DebugFlags::ePerformanceWarning;
+    if (core::logEnabled(core::log_level::debug)) {
+        flags |= DebugFlags::eInformation | DebugFlags::eDebug;
+    }
+
+    auto createinfo =
+      vk::DebugReportCallbackCreateInfoEXT().setPfnCallback(debugCallback).setFlags(flags);
 
-    if (CreateDebugReportCallbackEXT(m_instance, createinfo, m_callback) != vk::Result::eSuccess) {
+    if (CreateDebugReportCallbackEXT(m_instance, createinfo, m_callback, hostAllocator())
+        != vk::Result::eSuccess) {
         throw std::runtime_error("Failed to set up debug callback!");
     }
 }
@@ -799,38 +1536,128 @@ https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#boilerplate-w
 void
 renderer::createSurface()
 {
+    SHINY_PROFILE_FUNCTION();
+
+    // There is no window to present to, and m_surface stays null, which tells the device selection
+    if (m_offscreen) {
+        return;
+    }
+
     VkSurfaceKHR surface;
-    if (glfwCreateWindowSurface(m_instance, m_window, nullptr, &surface) != VK_SUCCESS) {
+    if (glfwCreateWindowSurface(m_instance, m_window, hostAllocatorC(), &surface) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create window surface!");
     }
     m_surface = surface;
+
+    // The device is picked for the window's, and createLogicalDevice makes sure it presents to
+    // the viewports' as well
+    for (viewport& v : m_viewports) {
+        if (glfwCreateWindowSurface(m_instance, v.window, hostAllocatorC(), &surface)
+            != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create a viewport's surface!");
+        }
+        v.surface = surface;
+    }
 }
 
 /*
-A physical device usually represents a single complete implementation of Vulkan (excluding
-instance-level functionality) available to the host, of which there are a finite number.
-
-https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#devsandqueues-physical-device-enumeration
-
-Physical devices don't have deleter functions, since they're not actually allocated out to the user.
+Where the shaders' sources are next to the executable, as they are in development, any .spv that
+is missing or out of date with them is compiled, or copied out of the cache if it has been compiled
+before. That's on the workers, while the instance and the device are being created. Shipping builds
+have no sources, and load the .spv files they come with.
 */
 void
-renderer::pickPhysicalDevice()
+renderer::buildShaders()
 {
+    SHINY_PROFILE_FUNCTION();
+
+    m_shader_compiler.init("shaders/cache");
+    const uint32_t failed = m_shader_compiler.build(m_jobs);
+    if (failed > 0) {
+        core::logWarning() << failed << " shaders failed to compile, the old ones are loaded";
+    }
+}
+
+/*
+A physical device usually represents a single complete implementation of Vulkan (excluding
+instance-level functionality) available to the host, of which there are a finite number.
+
+https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#devsandqueues-physical-device-enumeration
+
+Physical devices don't have deleter functions, since they're not actually allocated out to the user.
+
+Of the suitable devices the one with the highest score is picked, see device_score, unless some of
+them match the preferred device, which the command line or SHINY_DEVICE can name. A preference that
+matches none of them is reported and ignored.
+*/
+void
+renderer::pickPhysicalDevice()
+{
+    SHINY_PROFILE_FUNCTION();
+
     std::vector<vk::PhysicalDevice> physical_devices = m_instance.enumeratePhysicalDevices();
 
     if (physical_devices.empty())
         throw std::runtime_error("Failed to find a GPU with Vulkan support!");
 
-    for (const auto& device : physical_devices) {
-        if (isDeviceSuitable(device, m_surface)) {
+    const device_preference preference =
+      m_device_preference.empty() ? environmentDevicePreference() : m_device_preference;
+
+    device_score best;
+    bool         bestpreferred = false;
+    for (uint32_t i = 0; i < (uint32_t)physical_devices.size(); ++i) {
+        const vk::PhysicalDevice device   = physical_devices[i];
+        const device_score       score    = scoreDevice(device);
+        const bool               suitable = isDeviceSuitable(device, m_surface);
+
+        core::logInfo() << "GPU " << score.properties.deviceName << " ("
+                        << deviceTypeName(score.properties.deviceType) << ", "
+                        << (score.local_heap >> 20) << " MiB): "
+                        << (suitable ? "score " + std::to_string(score.total) : "not suitable");
+
+        if (!suitable) {
+            continue;
+        }
+
+        const bool preferred = !preference.empty() && preference.matches(score.properties, i);
+        if (!m_physical_device || (preferred && !bestpreferred)
+            || (preferred == bestpreferred && score.total > best.total)) {
             m_physical_device = device;
-            break;
+            best              = score;
+            bestpreferred     = preferred;
         }
     }
 
     if (!m_physical_device)
         throw std::runtime_error("Failed to find a suitable GPU!");
+
+    if (!preference.empty() && !bestpreferred) {
+        core::logWarning() << "No suitable GPU matches the preferred device, ignoring it";
+    }
+    m_supported = queryCapabilities(m_instance, m_physical_device, m_instance_version);
+
+    core::logInfo() << "Using GPU " << best.properties.deviceName << " (vendor 0x" << std::hex
+                    << best.properties.vendorID << ", device 0x" << best.properties.deviceID
+                    << std::dec << (bestpreferred ? ", preferred" : "") << ")";
+
+    // Presenting from a group takes every GPU's own swap chain images, frame pacing between them
+    // and VK_KHR_device_group's present modes, none of which an offscreen render needs
+    m_group_devices.clear();
+    if (m_device_group) {
+        std::vector<vk::PhysicalDevice> group = deviceGroup(m_instance, m_physical_device);
+        if (!m_offscreen) {
+            core::logWarning() << "Device groups are only used for offscreen renders";
+        } else if (group.size() < 2 || !m_supported.device_group) {
+            core::logWarning() << "The GPU isn't linked with any other, rendering on it alone";
+        } else {
+            m_group_devices = std::move(group);
+            core::logInfo() << "Rendering alternate frames on the " << m_group_devices.size()
+                            << " GPUs of its device group";
+        }
+    }
+
+    // Before anything the quality settings go into is created
+    loadCalibration();
 }
 
 /*
@@ -845,12 +1672,15 @@ https://www.khronos.org/registry/vulkan/specs/1.0-wsi_extensions/html/vkspec.htm
 void
 renderer::createLogicalDevice()
 {
-    QueueFamilyIndices indices = findQueueFamilies(m_physical_device, m_surface);
+    SHINY_PROFILE_FUNCTION();
+
+    QueueFamilyIndices indices = findQueueFamilies(m_physical_device, m_surface, deviceCount() > 1);
 
     float queuepriority = 1.f;
 
     std::vector<vk::DeviceQueueCreateInfo> queuecreateinfos;
-    std::set<int> uniquefamilies = { indices.graphicsFamily(), indices.presentFamily() };
+    std::set<int> uniquefamilies = { indices.graphicsFamily(), indices.presentFamily(),
+                                     indices.transferFamily(), indices.computeFamily() };
 
     for (int queuefamily : uniquefamilies) {
         queuecreateinfos.emplace_back(vk::DeviceQueueCreateInfo()
@@ -859,24 +1689,514 @@ renderer::createLogicalDevice()
                                         .setPQueuePriorities(&queuepriority));
     }
 
-    auto devicefeatures = vk::PhysicalDeviceFeatures().setSamplerAnisotropy(true);
+    // Everything optional the device has is enabled, except for what the renderer won't use
+    m_capabilities = m_supported;
+
+    // Only asked for by the latency mode, which otherwise waits for the GPU instead of the display
+    m_capabilities.present_wait = m_supported.present_wait && m_pacing.low_latency && !m_offscreen;
+
+    // The draw list is submitted with one indirect multi-draw per run of draws that share their
+    // buffers, which needs multiDrawIndirect, and every draw finds its transform through
+    // firstInstance, which needs drawIndirectFirstInstance. Without them it is drawn directly.
+    // VK_KHR_draw_indirect_count lets the draw count come from a buffer as well, for when the GPU
+    // decides what gets drawn.
+    m_indirect_draws = m_capabilities.multi_draw_indirect;
+
+    // Only needed for the wireframe material, which is drawn filled without it
+    m_wireframe = m_capabilities.fill_mode_non_solid;
+
+    // Both optional, for the profiler's statistics scopes and for counting a main pass whose draws
+    // are recorded in parallel
+    m_pipeline_statistics = m_capabilities.pipeline_statistics;
+    m_inherited_queries   = m_capabilities.inherited_queries;
+
+    // Only for counters that were asked for
+    m_capabilities.performance_query =
+      m_supported.performance_query && !m_counter_selection.empty();
+    if (!m_counter_selection.empty() && !m_supported.performance_query) {
+        core::logWarning() << "Hardware counters are off, the device has no performance queries";
+    }
+
+    // Bindless textures need a partially bound, non-uniformly indexed array that can be as large
+    // as the update-after-bind limits allow, which are far higher than the regular ones. The
+    // arrays that small textures are packed into take the last of them.
+    m_bindless_textures =
+      m_capabilities.descriptor_indexing
+      && m_capabilities.update_after_bind_textures > texture_streamer::max_texture_arrays;
+    m_bindless_texture_count =
+      std::min(max_bindless_textures,
+               m_capabilities.update_after_bind_textures - texture_streamer::max_texture_arrays);
+
+    // Virtual textures' indirection takes the last slots of the bindless array, their pages are
+    // BC1, and the fragment shader asks for their tiles through a storage buffer. Stores from
+    // fragment shaders are only enabled for them.
+    m_virtual_texturing = m_virtual_texturing && m_bindless_textures
+                          && m_bindless_texture_count > 2 * max_virtual_textures
+                          && m_capabilities.fragment_stores
+                          && m_capabilities.core.textureCompressionBC;
+    m_capabilities.fragment_stores = m_virtual_texturing;
+    m_streamed_texture_count =
+      m_bindless_texture_count - (m_virtual_texturing ? max_virtual_textures : 0);
+
+    // The GPUs of a device group take turns at the frames, which can then finish out of order,
+    // while a timeline's values have to be signalled in order. Without timelines there is no
+    // async compute either, whose results would only be on the GPU that computed them anyway.
+    m_capabilities.device_group = !m_group_devices.empty();
+    if (m_capabilities.device_group) {
+        m_capabilities.timeline_semaphores = false;
+    }
+
+    // Lets every queue count its submissions on one semaphore, which the CPU and other queues wait
+    // on reaching a count, instead of a fence and a binary semaphore for every submission
+    m_timeline_semaphores = m_capabilities.timeline_semaphores;
+    m_present_wait        = m_capabilities.present_wait;
+
+    // Both eyes render at once, into a layer each of the attachments, and so do the viewports
+    // along with the camera. Deferred shading lights in the camera's view alone, so multiview
+    // frames are shaded forward.
+    m_stereo = m_stereo_settings.enabled && m_capabilities.multiview;
+    if (m_stereo_settings.enabled && !m_stereo) {
+        core::logWarning() << "Stereo is off, the device doesn't support multiview";
+    }
+    const char* noviewports = nullptr;
+    if (m_offscreen) {
+        noviewports = "there are no windows offscreen";
+    } else if (m_stereo) {
+        noviewports = "they don't go with stereo";
+    } else if (!m_capabilities.multiview) {
+        noviewports = "the device doesn't support multiview";
+    }
+    if (!m_viewports.empty() && noviewports) {
+        core::logWarning() << "The viewports are off, " << noviewports;
+        destroyViewports();
+    }
+
+    const uint32_t presentfamily = (uint32_t)indices.presentFamily();
+    for (const viewport& v : m_viewports) {
+        if (!m_physical_device.getSurfaceSupportKHR(presentfamily, v.surface)) {
+            throw std::runtime_error("Failed to find a queue that presents to the viewports!");
+        }
+    }
+    m_capabilities.multiview = multiview();
+    if (multiview()) {
+        m_deferred_shading = false;
+    }
+
+    // There is then no render pass or framebuffers to rebuild with the swap chain, the main pass
+    // renders into the image views as they are. Deferred shading needs the render pass's
+    // subpasses, which is how the G-buffer is read where it was written.
+    m_dynamic_rendering = m_capabilities.dynamic_rendering && !m_deferred_shading;
+
+    // The lights are lit a volume at a time in the lighting subpass, which only takes the depth
+    // bounds test to keep each to the pixels whose depth is within its sphere's. Without it they
+    // are lit by their clusters, as the blended materials are either way.
+    const char* nolightvolumes = nullptr;
+    if (!m_deferred_shading) {
+        nolightvolumes = "they need deferred shading";
+    } else if (!m_supported.depth_bounds) {
+        nolightvolumes = "the device doesn't support depth bounds";
+    }
+    if (m_light_volumes && nolightvolumes) {
+        core::logWarning() << "Light volumes are off, " << nolightvolumes;
+    }
+    m_light_volumes             = m_light_volumes && !nolightvolumes;
+    m_capabilities.depth_bounds = m_light_volumes;
+
+    // The materials' descriptors are written into a buffer and bound by offset, which takes the
+    // buffers they point at having device addresses. Deferred shading allocates its G-buffer's set
+    // every frame, and a device group's GPUs would each need the buffers' addresses on their own.
+    const char* nodescriptorbuffers = nullptr;
+    if (!m_supported.descriptor_buffer) {
+        nodescriptorbuffers = "the device doesn't support them";
+    } else if (m_deferred_shading) {
+        nodescriptorbuffers = "they don't go with deferred shading";
+    } else if (m_capabilities.device_group) {
+        nodescriptorbuffers = "they don't go with device groups";
+    }
+    if (m_descriptor_buffers && nodescriptorbuffers) {
+        core::logWarning() << "Descriptor buffers are off, " << nodescriptorbuffers;
+    }
+    m_descriptor_buffers             = m_descriptor_buffers && !nodescriptorbuffers;
+    m_capabilities.descriptor_buffer = m_descriptor_buffers;
+
+    // The sun's shadows are traced through the scene instead of rendered into cascades, only by
+    // the quality tiers that ask for it, see rayQueryShadows. The structure's descriptor isn't
+    // written into descriptor buffers, there's no tracing variant of the virtual texturing shader,
+    // and every GPU of a group would have to build the structures of its own.
+    const char* noraytracing = nullptr;
+    if (!m_supported.ray_query) {
+        noraytracing = "the device doesn't support ray queries";
+    } else if (!shadowsEnabled()) {
+        noraytracing = "there are no shadows";
+    } else if (m_descriptor_buffers) {
+        noraytracing = "they don't go with descriptor buffers";
+    } else if (m_virtual_texturing) {
+        noraytracing = "they don't go with virtual textures";
+    } else if (m_capabilities.device_group) {
+        noraytracing = "they don't go with device groups";
+    }
+    if (m_quality.ray_query_shadows && noraytracing) {
+        core::logWarning() << "Ray query shadows are off, " << noraytracing;
+    }
+    m_ray_query              = !noraytracing;
+    m_capabilities.ray_query = m_ray_query;
+    if (m_ray_query) {
+        m_ray_formats[(size_t)vertex_format::full] = acceleration_structures::buildsFrom(
+          m_physical_device, vk::Format::eR32G32B32Sfloat);
+        m_ray_formats[(size_t)vertex_format::packed] = acceleration_structures::buildsFrom(
+          m_physical_device, vk::Format::eR16G16B16A16Unorm);
+    }
+
+    // The probes' captures sample the materials' textures through the bindless set, whose layout
+    // is their pipelines' only set. Their cubes aren't written into descriptor buffers, and
+    // multiview frames aren't lit.
+    const char* noreflections = nullptr;
+    if (!m_bindless_textures) {
+        noreflections = "they need bindless textures";
+    } else if (m_descriptor_buffers) {
+        noreflections = "they don't go with descriptor buffers";
+    } else if (multiview()) {
+        noreflections = "they don't go with multiview";
+    }
+    if (!m_probe_settings.probes.empty() && noreflections) {
+        core::logWarning() << "Reflection probes are off, " << noreflections;
+    }
+    m_reflections = !m_probe_settings.probes.empty() && !noreflections;
+
+    // Every draw is shaded at its material's rate, and within that as coarsely as the rates image
+    // says, which is only ever attached to the dynamic rendering main pass
+    m_variable_rate = m_shading_rate_settings.enabled && m_capabilities.fragment_shading_rate;
+    if (m_shading_rate_settings.enabled && !m_variable_rate) {
+        core::logWarning() << "Variable rate shading is off, the device doesn't support it";
+    }
+    const char* noadaptive = nullptr;
+    if (!m_dynamic_rendering) {
+        noadaptive = "it needs dynamic rendering";
+    } else if (multiview()) {
+        noadaptive = "it doesn't go with multiview";
+    } else if (!m_capabilities.attachment_shading_rate
+               || !shading_rate_image::supported(m_physical_device)) {
+        noadaptive = "the device can't attach shading rates";
+    }
+    m_adaptive_shading = m_variable_rate && m_shading_rate_settings.adaptive && !noadaptive;
+    if (m_variable_rate && m_shading_rate_settings.adaptive && noadaptive) {
+        core::logWarning() << "Adaptive shading rates are off, " << noadaptive;
+    }
+    m_capabilities.fragment_shading_rate   = m_variable_rate;
+    m_capabilities.attachment_shading_rate = m_adaptive_shading;
+    for (vk::Extent2D& rate : m_shading_rate_settings.materials) {
+        rate = m_variable_rate
+                 ? vk::Extent2D(fragmentSide(rate.width, m_capabilities.max_fragment_size.width),
+                                fragmentSide(rate.height, m_capabilities.max_fragment_size.height))
+                 : vk::Extent2D(1, 1);
+    }
+
+    // The boxes are queried in one view, and a device group's GPUs would each have their own
+    // results. Without conditional rendering the results are read back instead.
+    m_occlusion_queries = m_occlusion_settings && !multiview() && !m_capabilities.device_group;
+    if (m_occlusion_settings && !m_occlusion_queries) {
+        core::logWarning() << "Occlusion queries are off, "
+                           << (multiview() ? "they don't go with multiview"
+                                           : "they don't go with device groups");
+    }
+    m_conditional_rendering = m_occlusion_queries && m_capabilities.conditional_rendering;
+    m_capabilities.conditional_rendering = m_conditional_rendering;
+
+    // The terrain writes depth after the materials, which the lighting subpass can't, and its
+    // rings are placed around a single eye
+    const bool terrain = !m_terrain_path.empty();
+    m_terrain_active   = terrain && !m_deferred_shading && !multiview()
+                       && clipmap_terrain::supported(m_physical_device);
+    if (terrain && !m_terrain_active) {
+        core::logWarning() << "The terrain is off, "
+                           << (m_deferred_shading ? "it doesn't go with deferred shading"
+                               : multiview()      ? "it doesn't go with multiview"
+                                                  : "the device can't sample its heights");
+    }
+
+    // The grass is scattered over the terrain's heights
+    const bool vegetation = m_vegetation_settings.density > 0.f;
+    m_vegetation_active   = vegetation && m_terrain_active;
+    if (vegetation && !m_vegetation_active) {
+        core::logWarning() << "The vegetation is off, there's no terrain for it to grow on";
+    }
+
+    // The impostors are drawn after the materials like the terrain, facing a single eye, and a
+    // baking frame draws nothing else
+    const bool impostors = !m_impostor_path.empty();
+    m_impostors_active   = impostors && !m_deferred_shading && !multiview() && !m_impostor_baking;
+    if (impostors && !m_impostors_active) {
+        core::logWarning() << "The impostors are off, "
+                           << (m_deferred_shading ? "they don't go with deferred shading"
+                               : multiview()      ? "they don't go with multiview"
+                                                  : "they are being baked");
+    }
+
+    // Post-processing works on the frame of a single view, and baking keeps the views as they
+    // are drawn. Writing the swap chain images takes leaving their format out of the shader.
+    m_post_processing = m_post_settings.enabled && !multiview() && !m_impostor_baking;
+    if (m_post_settings.enabled && !m_post_processing) {
+        core::logWarning() << "Post-processing is off, "
+                           << (multiview() ? "it doesn't go with multiview"
+                                           : "it doesn't go with baking impostors");
+    }
+    m_capabilities.storage_no_format = m_post_processing && m_capabilities.storage_no_format;
+
+    // The materials' fragment shaders and the post-processing's composite have variants that
+    // shade colors in half precision, which mobile GPUs do at twice the rate, wherever the device
+    // supports it. The tracing and virtual texturing shaders have none.
+    m_half_precision              = m_half_precision && m_capabilities.shader_float16;
+    m_capabilities.shader_float16 = m_half_precision;
+
+    // Render targets are left to the driver's lossless compression unless they ask for fixed-rate,
+    // which the swap chain takes an extension of its own for. Image compression control stays on
+    // either way, for telling what would cost an image its compression, see image_compression.
+    if (m_compression_mode == framebuffer_compression::fixed_rate
+        && !m_capabilities.image_compression_control) {
+        core::logWarning()
+          << "Fixed-rate compression is off, the device doesn't support image compression control";
+        m_compression_mode = framebuffer_compression::lossless;
+    }
+    m_capabilities.swapchain_compression_control =
+      m_capabilities.swapchain_compression_control
+      && m_compression_mode == framebuffer_compression::fixed_rate;
+
+    std::vector<VulkanExtensionName> extensions;
+    if (!m_offscreen) {
+        extensions = deviceExtensions;
+    }
+    const device_feature_chain chain(m_capabilities, extensions);
 
     auto createinfo = vk::DeviceCreateInfo()
                         .setQueueCreateInfoCount((uint32_t)queuecreateinfos.size())
                         .setPQueueCreateInfos(queuecreateinfos.data())
-                        .setPEnabledFeatures(&devicefeatures)
-                        .setEnabledExtensionCount((uint32_t)deviceExtensions.size())
-                        .setPpEnabledExtensionNames(deviceExtensions.data());
+                        .setPEnabledFeatures(chain.features())
+                        .setEnabledExtensionCount((uint32_t)chain.extensions().size())
+                        .setPpEnabledExtensionNames(chain.extensions().data())
+                        .setPNext(chain.next());
 
-    if (enableValidationLayers) {
+    if (m_validation) {
         createinfo.setEnabledLayerCount((uint32_t)validationLayers.size());
         createinfo.setPpEnabledLayerNames(validationLayers.data());
     }
 
-    m_device = m_physical_device.createDevice(createinfo);
+#if defined(VK_KHR_device_group)
+    auto groupinfo = vk::DeviceGroupDeviceCreateInfoKHR()
+                       .setPhysicalDeviceCount((uint32_t)m_group_devices.size())
+                       .setPPhysicalDevices(m_group_devices.data())
+                       .setPNext(chain.next());
+    if (m_capabilities.device_group) {
+        createinfo.setPNext(&groupinfo);
+    }
+#endif
+
+    m_device = m_physical_device.createDevice(createinfo, hostAllocator());
+
+#if defined(VK_KHR_draw_indirect_count)
+    // Extension commands aren't exported by the loader, same as the debug report callbacks
+    if (m_capabilities.draw_indirect_count) {
+        m_draw_indexed_indirect_count = (PFN_vkCmdDrawIndexedIndirectCountKHR)m_device.getProcAddr(
+          "vkCmdDrawIndexedIndirectCountKHR");
+    }
+#endif
+#if defined(VK_KHR_present_wait)
+    if (m_present_wait) {
+        m_wait_for_present = (PFN_vkWaitForPresentKHR)m_device.getProcAddr("vkWaitForPresentKHR");
+    }
+#endif
+#if defined(VK_KHR_dynamic_rendering)
+    if (m_dynamic_rendering) {
+        m_begin_rendering =
+          (PFN_vkCmdBeginRenderingKHR)m_device.getProcAddr("vkCmdBeginRenderingKHR");
+        m_end_rendering = (PFN_vkCmdEndRenderingKHR)m_device.getProcAddr("vkCmdEndRenderingKHR");
+    }
+#endif
+#if defined(VK_KHR_fragment_shading_rate)
+    if (m_variable_rate) {
+        m_set_fragment_shading_rate = (PFN_vkCmdSetFragmentShadingRateKHR)m_device.getProcAddr(
+          "vkCmdSetFragmentShadingRateKHR");
+    }
+#endif
+#if defined(VK_EXT_conditional_rendering)
+    if (m_conditional_rendering) {
+        m_begin_conditional_rendering = (PFN_vkCmdBeginConditionalRenderingEXT)m_device.getProcAddr(
+          "vkCmdBeginConditionalRenderingEXT");
+        m_end_conditional_rendering   = (PFN_vkCmdEndConditionalRenderingEXT)m_device.getProcAddr(
+          "vkCmdEndConditionalRenderingEXT");
+    }
+#endif
 
     m_graphics_queue     = m_device.getQueue(indices.graphicsFamily(), 0);
     m_presentation_queue = m_device.getQueue(indices.presentFamily(), 0);
+    m_transfer_queue     = m_device.getQueue(indices.transferFamily(), 0);
+    m_compute_queue      = m_device.getQueue(indices.computeFamily(), 0);
+
+    m_frame_batch.setQueue(m_graphics_queue);
+    m_compute_batch.setQueue(m_compute_queue);
+
+    m_allocator.init(m_physical_device, m_device, deviceCount());
+    if (m_allocator.resizableBar()) {
+        core::logInfo()
+          << "Resizable BAR: meshes and per-frame buffers are written straight to VRAM";
+    }
+#if defined(VK_KHR_buffer_device_address) && defined(VK_KHR_device_group)
+    // Acceleration structures are built from buffers' addresses too, and are found by theirs
+    if (m_descriptor_buffers || m_ray_query) {
+        m_allocator.enableDeviceAddresses();
+    }
+#endif
+#if defined(VK_EXT_memory_budget)
+    // Tells how much VRAM is really left, counting other processes and the driver's own, which is
+    // what the texture streamer keeps to
+    if (m_capabilities.memory_budget) {
+        m_allocator.enableBudgetQueries(
+          (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)m_instance.getProcAddr(
+            "vkGetPhysicalDeviceMemoryProperties2KHR"));
+    }
+#endif
+    m_pipeline_cache.init(m_physical_device, m_device, "");
+    m_layouts.init(m_device);
+    m_views.init(m_device);
+    m_pipelines.init(m_device, m_pipeline_cache, 1, m_capabilities.graphics_pipeline_library);
+    m_deletion_queue.init(m_device, m_allocator);
+    m_graph.init(m_device, m_allocator, m_labels, m_profiler);
+    m_compression.init(m_instance, m_physical_device, m_capabilities, m_compression_mode);
+    m_graph.setCompression(&m_compression);
+    m_staging.init(m_device, m_allocator, staging_arena_size);
+    m_uploads.init(m_physical_device, m_device, m_staging, indices.transferFamily(),
+                   m_transfer_queue, indices.graphicsFamily(), m_graphics_queue,
+                   m_timeline_semaphores);
+
+    // Uploaded textures' mip levels are built in one dispatch where the graphics queue can, since
+    // that's where the upload service makes them
+    if (m_physical_device.getQueueFamilyProperties()[indices.graphicsFamily()].queueFlags
+        & vk::QueueFlagBits::eCompute) {
+        m_downsampler.init(m_device, m_allocator, m_layouts, m_views, m_pipeline_cache);
+        m_uploads.setDownsampler(&m_downsampler);
+        for (const vk::Format format :
+             { vk::Format::eR8G8B8A8Unorm, vk::Format::eR16G16B16A16Sfloat }) {
+            if (!m_compression.keepsCompression(format,
+                                                vk::ImageUsageFlagBits::eTransferDst
+                                                  | vk::ImageUsageFlagBits::eSampled,
+                                                vk::ImageUsageFlagBits::eStorage)) {
+                m_downsampler.leaveToBlits(format);
+            }
+        }
+    }
+    m_profiler.init(m_physical_device, m_device, indices.graphicsFamily(), m_frames_in_flight,
+                    m_pipeline_statistics);
+    if (m_capabilities.performance_query
+        && !m_profiler.enableCounters(m_instance, m_physical_device, indices.graphicsFamily(),
+                                      m_counter_selection)) {
+        core::logWarning() << "Hardware counters are off, none of those selected can be sampled";
+    }
+
+#if defined(VK_KHR_draw_indirect_count)
+    // The culling shader runs on the graphics queue, right before the draws that use its output.
+    // Decided here since the render pass and depth buffer depend on it, see createDrawBuffer.
+    auto queuefamilies = m_physical_device.getQueueFamilyProperties();
+    m_gpu_culling =
+      m_capabilities.draw_indirect_count
+      && (bool)(queuefamilies[indices.graphicsFamily()].queueFlags & vk::QueueFlagBits::eCompute);
+#endif
+
+    // Or on a compute queue of its own, which needs the timeline semaphores to order it against
+    // the graphics queue's frames. The particles go there as well.
+    m_async_compute = (m_gpu_culling || m_particle_count > 0) && m_timeline_semaphores
+                      && indices.computeFamily() != indices.graphicsFamily();
+
+    // The pyramid is built by sampling the depth buffer, of one view, and so are the motion vectors
+    const bool depthsampled =
+      (bool)(m_physical_device.getFormatProperties(findDepthFormat()).optimalTilingFeatures
+             & vk::FormatFeatureFlagBits::eSampledImage);
+    m_occlusion_culling = occlusion_culling && m_gpu_culling && !multiview() && depthsampled;
+    // Baking keeps the views' alpha, which the resolve doesn't, and blends no view with the last
+    m_temporal_aa =
+      m_temporal_settings.enabled && !multiview() && depthsampled && !m_impostor_baking;
+    if (m_temporal_settings.enabled && !m_temporal_aa) {
+        core::logWarning() << "Temporal upscaling is off, "
+                           << (multiview()          ? "it doesn't go with multiview"
+                               : m_impostor_baking ? "it doesn't go with baking impostors"
+                                                   : "the depth format can't be sampled");
+    }
+
+    // The color and depth attachments have the same number of samples, which the depth buffer
+    // has to be sampled with too for the pyramid, or occlusion culling goes
+    const vk::PhysicalDeviceLimits limits = m_physical_device.getProperties().limits;
+    const vk::SampleCountFlags     attachmentcounts =
+      limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+    // The G-buffer has a sample per pixel, which is all the lighting subpass reads, and the
+    // temporal resolve anti-aliases instead
+    m_samples = m_deferred_shading || m_temporal_aa
+                  ? vk::SampleCountFlagBits::e1
+                  : maxSampleCount(attachmentcounts, m_quality.samples);
+    if (m_occlusion_culling && m_samples != vk::SampleCountFlagBits::e1) {
+        const vk::SampleCountFlagBits sampled = maxSampleCount(
+          attachmentcounts & limits.sampledImageDepthSampleCounts, m_quality.samples);
+        if (sampled == vk::SampleCountFlagBits::e1) {
+            m_occlusion_culling = false;
+        } else {
+            m_samples = sampled;
+        }
+    }
+
+    if (m_occlusion_culling) {
+        m_hiz.init(m_device, m_allocator, m_layouts, m_views, m_pipeline_cache, cullingFamilies(),
+                   m_samples);
+    }
+    if (m_temporal_aa) {
+        m_temporal.init(m_device, m_allocator, m_layouts, m_views, m_pipeline_cache,
+                        m_temporal_settings);
+    }
+    if (m_post_processing) {
+        m_post.init(m_device, m_allocator, m_layouts, m_views, m_pipeline_cache, m_post_settings,
+                    m_capabilities.storage_no_format, m_half_precision);
+    }
+    if (m_adaptive_shading) {
+        const vk::Extent2D mintexel = m_capabilities.min_shading_rate_texel;
+        const vk::Extent2D maxtexel = m_capabilities.max_shading_rate_texel;
+        m_shading_rates.init(m_device, m_allocator, m_layouts, m_views, m_pipeline_cache,
+                             vk::Extent2D(std::clamp(16u, mintexel.width, maxtexel.width),
+                                          std::clamp(16u, mintexel.height, maxtexel.height)),
+                             m_capabilities.max_fragment_size);
+    }
+    if (m_occlusion_queries) {
+        m_occlusion.init(m_device, m_allocator, m_layouts, m_frames_in_flight,
+                         max_occlusion_queries, m_conditional_rendering);
+    }
+
+    std::vector<uint32_t> families = { indices.graphicsFamily() };
+    if (indices.transferFamily() != indices.graphicsFamily()) {
+        families.push_back(indices.transferFamily());
+    }
+    createGeometryPool(families);
+
+    m_io.init();
+    m_streams.init(m_io, m_jobs, m_streaming_budget);
+    m_texture_loader.init(m_physical_device, m_device, m_allocator, m_staging, m_uploads, m_jobs,
+                          m_io, m_streams);
+
+    const vk::DeviceSize texturebudget =
+      (vk::DeviceSize)(m_allocator.deviceLocalBudget().budget * texture_budget_share);
+    m_textures.init(m_device, m_allocator, m_staging, m_uploads, m_texture_loader, m_views,
+                    m_streams, m_deletion_queue, texturebudget);
+    if (m_virtual_texturing) {
+        m_virtual_textures.init(m_physical_device, m_device, m_allocator, m_views, m_streams,
+                                m_deletion_queue, virtual_page_columns, m_streamed_texture_count,
+                                m_frames_in_flight);
+    }
+    if (m_terrain_active) {
+        m_terrain.init(m_device, m_allocator, m_layouts, m_views, m_streams, m_terrain_path,
+                       m_frames_in_flight);
+    }
+    if (m_vegetation_active) {
+        m_vegetation.init(m_physical_device, m_device, m_allocator, m_layouts, m_pipeline_cache,
+                          m_terrain, m_vegetation_settings);
+    }
+    if (m_impostors_active) {
+        m_impostors.init(m_device, m_allocator, m_layouts, m_views, m_impostor_path,
+                         m_frames_in_flight);
+    }
 }
 
 /*
@@ -891,11 +2211,115 @@ https://www.khronos.org/registry/vulkan/specs/1.0-wsi_extensions/html/vkspec.htm
 void
 renderer::createSwapChain()
 {
+    SHINY_PROFILE_FUNCTION();
+
+    // The offscreen images stand in for the swap chain's, one per frame in flight
+    if (m_offscreen) {
+        m_offscreen_target.init(m_device, m_allocator, m_swapchain_extent, m_frames_in_flight);
+        m_swapchain_images       = m_offscreen_target.images();
+        m_swapchain_image_format = offscreen_target::format;
+        m_dynamic_resolution = m_resolution.enabled() && supportsScaling(offscreen_target::format);
+        m_scene_target       = m_dynamic_resolution || multiview() || m_temporal_aa
+                               || m_adaptive_shading || m_post_processing;
+        m_post_direct        = false;
+        m_video_convert      = m_video_settings.nv12;
+        if (m_stereo && !supportsScaling(offscreen_target::format)) {
+            throw std::runtime_error("Stereo frames can't be blitted to the offscreen images!");
+        }
+        if (m_temporal_aa && !supportsScaling(offscreen_target::format)) {
+            throw std::runtime_error("Resolved frames can't be blitted to the offscreen images!");
+        }
+        if (m_adaptive_shading && !supportsScaling(offscreen_target::format)) {
+            throw std::runtime_error("Shaded frames can't be blitted to the offscreen images!");
+        }
+        if (m_post_processing && !supportsScaling(offscreen_target::format)) {
+            throw std::runtime_error("Post-processed frames can't be blitted to the offscreen "
+                                     "images!");
+        }
+        m_image_frames.assign(m_swapchain_images.size(), 0);
+        return;
+    }
+
     SwapChainSupportDetails support = querySwapChainSupport(m_physical_device, m_surface);
 
     vk::SurfaceFormatKHR surfaceformat = chooseSwapSurfaceFormat(support.formats);
-    vk::PresentModeKHR   presentmode   = chooseSwapPresentMode(support.presentModes);
-    vk::Extent2D         extent        = chooseSwapExtent(support.capabilities);
+    vk::PresentModeKHR   presentmode =
+      chooseSwapPresentMode(support.presentModes, m_pacing.present_modes);
+    vk::Extent2D extent = chooseSwapExtent(support.capabilities);
+
+    // Scaled, multiview and resolved frames are blitted to the swap chain images
+    const bool blit =
+      supportsScaling(surfaceformat.format)
+      && (bool)(support.capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferDst);
+    m_dynamic_resolution = m_resolution.enabled() && blit;
+    m_scene_target       = m_dynamic_resolution || multiview() || m_temporal_aa
+                     || m_adaptive_shading || m_post_processing;
+
+    // Post-processing writes the swap chain images itself where they can be storage images, and
+    // takes the blit's place for the resolved and shaded frames that it reads. Unless that costs
+    // the images their compression and there is a blit to fall back on, which is cheaper then.
+    m_post_direct =
+      m_post_processing && m_capabilities.storage_no_format
+      && (bool)(support.capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eStorage)
+      && (bool)(m_physical_device.getFormatProperties(surfaceformat.format).optimalTilingFeatures
+                & vk::FormatFeatureFlagBits::eStorageImage)
+      && (!blit
+          || m_compression.keepsCompression(surfaceformat.format,
+                                            vk::ImageUsageFlagBits::eColorAttachment,
+                                            vk::ImageUsageFlagBits::eStorage));
+    if (multiview() && !blit) {
+        throw std::runtime_error("Multiview frames can't be blitted to the swap chain images!");
+    }
+    if (m_temporal_aa && !blit && !m_post_direct) {
+        throw std::runtime_error("Resolved frames can't be blitted to the swap chain images!");
+    }
+    if (m_adaptive_shading && !blit && !m_post_direct) {
+        throw std::runtime_error("Shaded frames can't be blitted to the swap chain images!");
+    }
+    if (m_post_processing && !blit && !m_post_direct) {
+        throw std::runtime_error("Post-processed frames can't reach the swap chain images!");
+    }
+
+    // The splash frame is cleared with a transfer command, before there is a render pass
+    m_splash_frame =
+      m_fast_start
+      && (bool)(support.capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferDst);
+
+    vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eColorAttachment;
+    if ((m_scene_target && !m_post_direct) || m_splash_frame) {
+        usage |= vk::ImageUsageFlagBits::eTransferDst;
+    }
+    if (m_post_direct) {
+        usage |= vk::ImageUsageFlagBits::eStorage;
+    }
+
+    // Screenshots copy the images into buffers as they are
+    if (m_screenshots
+        && !((bool)(support.capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc)
+             && readbackSupported(surfaceformat.format))) {
+        core::logWarning() << "Screenshots are off, the swap chain images can't be copied from";
+        m_screenshots = false;
+    }
+    if (m_screenshots) {
+        usage |= vk::ImageUsageFlagBits::eTransferSrc;
+    }
+
+    // Recorded frames are converted where the images can be sampled, and copied otherwise
+    if (m_video_settings.sink) {
+        const vk::ImageUsageFlags supported = support.capabilities.supportedUsageFlags;
+
+        m_video_convert =
+          m_video_settings.nv12 && (bool)(supported & vk::ImageUsageFlagBits::eSampled);
+        if (m_video_convert) {
+            usage |= vk::ImageUsageFlagBits::eSampled;
+        } else if ((bool)(supported & vk::ImageUsageFlagBits::eTransferSrc)
+                   && readbackSupported(surfaceformat.format)) {
+            usage |= vk::ImageUsageFlagBits::eTransferSrc;
+        } else {
+            core::logWarning() << "Not recording, the swap chain images can't be copied from";
+            m_video_settings.sink.reset();
+        }
+    }
 
     uint32_t imagecount = support.capabilities.minImageCount + 1;
     if (support.capabilities.maxImageCount > 0 && imagecount > support.capabilities.maxImageCount) {
@@ -909,9 +2333,9 @@ renderer::createSwapChain()
                         .setImageColorSpace(surfaceformat.colorSpace)
                         .setImageExtent(extent)
                         .setImageArrayLayers(1)
-                        .setImageUsage(vk::ImageUsageFlagBits::eColorAttachment);
+                        .setImageUsage(usage);
 
-    QueueFamilyIndices indices = findQueueFamilies(m_physical_device, m_surface);
+    QueueFamilyIndices indices = findQueueFamilies(m_physical_device, m_surface, deviceCount() > 1);
 
     if (indices.graphicsFamily() != indices.presentFamily()) {
         std::array<uint32_t, 2> queuefamilyindices = { (uint32_t)indices.graphicsFamily(),
@@ -927,21 +2351,23 @@ renderer::createSwapChain()
       .setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque)
       .setPresentMode(presentmode)
       .setClipped(true)
-      .setOldSwapchain(nullptr);
+      // When recreating, handing over the old swap chain lets the implementation reuse its
+      // resources and keep presenting the images that are already queued. It is retired either
+      // way, but still has to be destroyed by us (see recreateSwapChain).
+      .setOldSwapchain(m_swapchain);
+
+#if defined(VK_EXT_image_compression_control)
+    vk::ImageCompressionControlEXT compression;
+    m_compression.request(createinfo, surfaceformat.format, compression);
+#endif
 
     // m_swapchain.reset(m_device->createSwapchainKHR(createinfo));
 
-    m_swapchain = m_device.createSwapchainKHR(createinfo);
-
-    {
-        // auto images = m_device->getSwapchainImagesKHR(m_swapchain.get());
-        auto images = m_device.getSwapchainImagesKHR(m_swapchain);
-        m_swapchain_images.reserve(images.size());
+    m_swapchain = m_device.createSwapchainKHR(createinfo, hostAllocator());
 
-        for (const auto& image : images) {
-            m_swapchain_images.emplace_back(image);
-        }
-    }
+    // auto images = m_device->getSwapchainImagesKHR(m_swapchain.get());
+    m_swapchain_images = m_device.getSwapchainImagesKHR(m_swapchain);
+    m_image_frames.assign(m_swapchain_images.size(), 0);
 
     m_swapchain_image_format = surfaceformat.format;
     m_swapchain_extent       = extent;
@@ -962,11 +2388,13 @@ https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#re
 void
 renderer::createImageViews()
 {
+    SHINY_PROFILE_FUNCTION();
+
     m_swapchain_image_views.reserve(m_swapchain_images.size());
 
     for (const vk::Image& image : m_swapchain_images) {
         m_swapchain_image_views.emplace_back(
-          createImageView(image, m_swapchain_image_format, vk::ImageAspectFlagBits::eColor));
+          createImageView(image, m_swapchain_image_format, vk::ImageAspectFlagBits::eColor, 1));
     }
 }
 
@@ -975,16 +2403,34 @@ Before we can finish creating the pipeline, we need to tell Vulkan about the fra
 that will be used while rendering. We need to specify how many color and depth buffers there will
 be, how many samples to use for each of them and how their contents should be handled throughout the
 rendering operations. All of this information is wrapped in a render pass object.
+
+Multisampled, the subpass draws into a multisampled color attachment and resolves it into the
+target through pResolveAttachments at its end. The color samples are never stored, and the depth
+ones only for the Hi-Z pyramid, so on tiled GPUs the samples never leave tile memory, only the
+resolved pixels are written out, and there is no resolve pass of its own. The attachments are then 0: color, 1: depth, 2: the target.
+
+With dynamic rendering there is no render pass, beginRendering describes the same attachments.
 */
 void
 renderer::createRenderPass()
 {
+    SHINY_PROFILE_FUNCTION();
+
+    if (m_dynamic_rendering) {
+        return;
+    }
+    if (m_deferred_shading) {
+        createDeferredRenderPass();
+        return;
+    }
+
+    const bool multisampled = m_samples != vk::SampleCountFlagBits::e1;
+
     auto colorattachment =
       vk::AttachmentDescription()
         // The format of the color attachment should match the format of the swap chain images.
         .setFormat(m_swapchain_image_format)
-        // we're not doing anything with multisampling
-        .setSamples(vk::SampleCountFlagBits::e1)
+        .setSamples(m_samples)
         // The loadOp determines what to do with the data in the attachment before rendering
         .setLoadOp(vk::AttachmentLoadOp::eClear)
         // The storeOp determines what to do with the data in the attachment after
@@ -993,8 +2439,9 @@ renderer::createRenderPass()
         // We don't care what the initial memory layout of the VkImage is
         .setInitialLayout(vk::ImageLayout::eUndefined)
         // We wnat the final layout of the VkImage to be something that can be presented in the swap
-        // chain
-        .setFinalLayout(vk::ImageLayout::ePresentSrcKHR);
+        // chain, or copied from when it's read back or scaled up to the swap chain image
+        .setFinalLayout(m_offscreen || m_scene_target ? vk::ImageLayout::eTransferSrcOptimal
+                                                            : vk::ImageLayout::ePresentSrcKHR);
 
     // A single render pass can consist of multiple subpasses. Subpasses are subsequent rendering
     // operations that depend on the contents of framebuffers in previous passes, for example a
@@ -1018,12 +2465,15 @@ renderer::createRenderPass()
      * the depth data (storeOp), because it will not be used after drawing has finished. This may
      * allow the hardware to perform additional optimizations. Just like the color buffer, we don't
      * care about the previous depth contents, so we can use VK_IMAGE_LAYOUT_UNDEFINED as
-     * initialLayout.*/
+     * initialLayout.
+     * Unless it's occlusion culled or resolved: then the Hi-Z pyramid or the motion vectors are
+     * made from the depth afterwards.*/
     auto depthattachment = vk::AttachmentDescription()
                              .setFormat(findDepthFormat())
-                             .setSamples(vk::SampleCountFlagBits::e1)
+                             .setSamples(m_samples)
                              .setLoadOp(vk::AttachmentLoadOp::eClear)
-                             .setStoreOp(vk::AttachmentStoreOp::eDontCare)
+                             .setStoreOp(sampledDepth() ? vk::AttachmentStoreOp::eStore
+                                                        : vk::AttachmentStoreOp::eDontCare)
                              .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
                              .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
                              .setInitialLayout(vk::ImageLayout::eUndefined)
@@ -1032,6 +2482,21 @@ renderer::createRenderPass()
     auto depthattachmentref = vk::AttachmentReference().setAttachment(1).setLayout(
       vk::ImageLayout::eDepthStencilAttachmentOptimal);
 
+    // The color samples are only needed until they are resolved, and the target is written by the
+    // resolve alone, so it isn't loaded
+    std::vector<vk::AttachmentDescription> attachments = { colorattachment, depthattachment };
+    auto resolveattachmentref = vk::AttachmentReference().setAttachment(2).setLayout(
+      vk::ImageLayout::eColorAttachmentOptimal);
+    if (multisampled) {
+        auto resolveattachment = colorattachment;
+        resolveattachment.setSamples(vk::SampleCountFlagBits::e1)
+          .setLoadOp(vk::AttachmentLoadOp::eDontCare);
+        attachments[0]
+          .setStoreOp(vk::AttachmentStoreOp::eDontCare)
+          .setFinalLayout(vk::ImageLayout::eColorAttachmentOptimal);
+        attachments.push_back(resolveattachment);
+    }
+
     auto subpass = vk::SubpassDescription()
                      // Vulkan may also support compute subpasses in the future, so we have to be
                      // explicit about this being a graphics subpass.
@@ -1047,6 +2512,7 @@ renderer::createRenderPass()
                      // pPreserveAttachments: Attachments that are not used by this subpass, but for
                      // which the data must be preserved
                      .setPColorAttachments(&colorattachmentref)
+                     .setPResolveAttachments(multisampled ? &resolveattachmentref : nullptr)
                      .setPDepthStencilAttachment(&depthattachmentref);
 
     // Remember that the subpasses in a render pass automatically take care of image layout
@@ -1088,17 +2554,175 @@ renderer::createRenderPass()
         .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentRead
                           | vk::AccessFlagBits::eColorAttachmentWrite);
 
-    std::array<vk::AttachmentDescription, 2> attachments = { colorattachment, depthattachment };
+    // Offscreen images are read back by a copy after the render pass, and scaled frames blitted to
+    // the swap chain image, which the first dependency has to wait for as well by the time the
+    // image comes around again
+    std::vector<vk::SubpassDependency> dependencies = { subpassdependency };
+    if (m_offscreen || m_scene_target) {
+        dependencies[0].srcStageMask |= vk::PipelineStageFlagBits::eTransfer;
+        dependencies.push_back(vk::SubpassDependency()
+                                 .setSrcSubpass(0)
+                                 .setDstSubpass(VK_SUBPASS_EXTERNAL)
+                                 .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+                                 .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+                                 .setDstStageMask(vk::PipelineStageFlagBits::eTransfer)
+                                 .setDstAccessMask(vk::AccessFlagBits::eTransferRead));
+    }
 
     auto renderpasscreateinfo = vk::RenderPassCreateInfo()
                                   .setAttachmentCount(static_cast<uint32_t>(attachments.size()))
                                   .setPAttachments(attachments.data())
                                   .setSubpassCount(1)
                                   .setPSubpasses(&subpass)
-                                  .setDependencyCount(1)
-                                  .setPDependencies(&subpassdependency);
+                                  .setDependencyCount((uint32_t)dependencies.size())
+                                  .setPDependencies(dependencies.data());
+
+    // With multiview the subpass renders every view, a layer each, and tells the implementation
+    // that they see mostly the same, so it may render them together
+#if defined(VK_KHR_multiview)
+    const uint32_t viewmask  = viewMask();
+    auto           multiview = vk::RenderPassMultiviewCreateInfoKHR()
+                                 .setSubpassCount(1)
+                                 .setPViewMasks(&viewmask)
+                                 .setCorrelationMaskCount(1)
+                                 .setPCorrelationMasks(&viewmask);
+    if (viewmask != 0) {
+        renderpasscreateinfo.setPNext(&multiview);
+    }
+#endif
+
+    if (!(m_render_pass = m_device.createRenderPass(renderpasscreateinfo, hostAllocator()))) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+}
+
+/*
+The render pass of deferred shading, with two subpasses. The geometry subpass draws the materials
+into the G-buffer, their unlit color and view space normal, and the depth buffer. The lighting
+subpass reads all three back as input attachments, which only ever see the pixel being shaded, and
+lights every pixel with a single triangle into the target, before the blended materials are drawn
+forward on top of that, tested against the depths they can't write anymore.
+
+Both G-buffer attachments are cleared, never stored and only ever read by the lighting subpass, and
+the dependency between the two subpasses is by region, so on tiled GPUs the G-buffer never leaves
+tile memory and its images are lazily allocated transient attachments, see createRenderGraph. The
+attachments are 0: the target, 1: depth, 2: the G-buffer's color, 3: its normal.
+*/
+void
+renderer::createDeferredRenderPass()
+{
+    // Every pixel is written by the lighting, so what the target had is never loaded
+    auto targetattachment =
+      vk::AttachmentDescription()
+        .setFormat(m_swapchain_image_format)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setLoadOp(vk::AttachmentLoadOp::eDontCare)
+        .setStoreOp(vk::AttachmentStoreOp::eStore)
+        .setInitialLayout(vk::ImageLayout::eUndefined)
+        .setFinalLayout(m_offscreen || m_scene_target ? vk::ImageLayout::eTransferSrcOptimal
+                                                            : vk::ImageLayout::ePresentSrcKHR);
+
+    // Still only stored for the Hi-Z pyramid and the motion vectors
+    auto depthattachment = vk::AttachmentDescription()
+                             .setFormat(findDepthFormat())
+                             .setSamples(vk::SampleCountFlagBits::e1)
+                             .setLoadOp(vk::AttachmentLoadOp::eClear)
+                             .setStoreOp(sampledDepth() ? vk::AttachmentStoreOp::eStore
+                                                        : vk::AttachmentStoreOp::eDontCare)
+                             .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+                             .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+                             .setInitialLayout(vk::ImageLayout::eUndefined)
+                             .setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    auto gbufferattachment = vk::AttachmentDescription()
+                               .setFormat(gbuffer_color_format)
+                               .setSamples(vk::SampleCountFlagBits::e1)
+                               .setLoadOp(vk::AttachmentLoadOp::eClear)
+                               .setStoreOp(vk::AttachmentStoreOp::eDontCare)
+                               .setInitialLayout(vk::ImageLayout::eUndefined)
+                               .setFinalLayout(vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    const std::array<vk::AttachmentDescription, 4> attachments = {
+        targetattachment, depthattachment, gbufferattachment,
+        vk::AttachmentDescription(gbufferattachment).setFormat(gbuffer_normal_format)
+    };
+
+    const std::array<vk::AttachmentReference, 2> gbufferrefs = {
+        vk::AttachmentReference(2, vk::ImageLayout::eColorAttachmentOptimal),
+        vk::AttachmentReference(3, vk::ImageLayout::eColorAttachmentOptimal),
+    };
+    const vk::AttachmentReference depthref(1, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    // In the order of deferred.frag's input_attachment_index. The depth buffer is read-only in
+    // the lighting subpass, which lets it be an input attachment and the depth attachment at once.
+    const std::array<vk::AttachmentReference, 3> inputrefs = {
+        vk::AttachmentReference(2, vk::ImageLayout::eShaderReadOnlyOptimal),
+        vk::AttachmentReference(3, vk::ImageLayout::eShaderReadOnlyOptimal),
+        vk::AttachmentReference(1, vk::ImageLayout::eDepthStencilReadOnlyOptimal),
+    };
+    const vk::AttachmentReference targetref(0, vk::ImageLayout::eColorAttachmentOptimal);
+    const vk::AttachmentReference readonlydepthref(1,
+                                                   vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+
+    std::array<vk::SubpassDescription, 2> subpasses;
+    subpasses[geometry_subpass] = vk::SubpassDescription()
+                                    .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+                                    .setColorAttachmentCount((uint32_t)gbufferrefs.size())
+                                    .setPColorAttachments(gbufferrefs.data())
+                                    .setPDepthStencilAttachment(&depthref);
+    subpasses[lighting_subpass] = vk::SubpassDescription()
+                                    .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+                                    .setInputAttachmentCount((uint32_t)inputrefs.size())
+                                    .setPInputAttachments(inputrefs.data())
+                                    .setColorAttachmentCount(1)
+                                    .setPColorAttachments(&targetref)
+                                    .setPDepthStencilAttachment(&readonlydepthref);
+
+    // The target is first written by the lighting subpass, once the presentation engine is done
+    // with it, like the other render pass's. The lighting reads what the geometry subpass wrote at
+    // the same pixel only, so the dependency between them is by region.
+    std::vector<vk::SubpassDependency> dependencies = {
+        vk::SubpassDependency()
+          .setSrcSubpass(VK_SUBPASS_EXTERNAL)
+          .setDstSubpass(lighting_subpass)
+          .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+          .setSrcAccessMask(vk::AccessFlags())
+          .setDstStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+          .setDstAccessMask(vk::AccessFlagBits::eColorAttachmentRead
+                            | vk::AccessFlagBits::eColorAttachmentWrite),
+        vk::SubpassDependency()
+          .setSrcSubpass(geometry_subpass)
+          .setDstSubpass(lighting_subpass)
+          .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput
+                           | vk::PipelineStageFlagBits::eLateFragmentTests)
+          .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite
+                            | vk::AccessFlagBits::eDepthStencilAttachmentWrite)
+          .setDstStageMask(vk::PipelineStageFlagBits::eFragmentShader
+                           | vk::PipelineStageFlagBits::eEarlyFragmentTests)
+          .setDstAccessMask(vk::AccessFlagBits::eInputAttachmentRead
+                            | vk::AccessFlagBits::eDepthStencilAttachmentRead)
+          .setDependencyFlags(vk::DependencyFlagBits::eByRegion),
+    };
+    if (m_offscreen || m_scene_target) {
+        dependencies[0].srcStageMask |= vk::PipelineStageFlagBits::eTransfer;
+        dependencies.push_back(vk::SubpassDependency()
+                                 .setSrcSubpass(lighting_subpass)
+                                 .setDstSubpass(VK_SUBPASS_EXTERNAL)
+                                 .setSrcStageMask(vk::PipelineStageFlagBits::eColorAttachmentOutput)
+                                 .setSrcAccessMask(vk::AccessFlagBits::eColorAttachmentWrite)
+                                 .setDstStageMask(vk::PipelineStageFlagBits::eTransfer)
+                                 .setDstAccessMask(vk::AccessFlagBits::eTransferRead));
+    }
+
+    auto renderpasscreateinfo = vk::RenderPassCreateInfo()
+                                  .setAttachmentCount((uint32_t)attachments.size())
+                                  .setPAttachments(attachments.data())
+                                  .setSubpassCount((uint32_t)subpasses.size())
+                                  .setPSubpasses(subpasses.data())
+                                  .setDependencyCount((uint32_t)dependencies.size())
+                                  .setPDependencies(dependencies.data());
 
-    if (!(m_render_pass = m_device.createRenderPass(renderpasscreateinfo))) {
+    if (!(m_render_pass = m_device.createRenderPass(renderpasscreateinfo, hostAllocator()))) {
         throw std::runtime_error("failed to create render pass!");
     }
 }
@@ -1132,179 +2756,7 @@ https://vulkan-tutorial.com/Drawing_a_triangle/Graphics_pipeline_basics/Fixed_fu
 void
 renderer::createGraphicsPipeline()
 {
-    auto vertshadercode = readFile("shaders/vert.spv");
-    auto fragshadercode = readFile("shaders/frag.spv");
-
-    m_vertex_shader_module   = createShaderModule(vertshadercode, m_device);
-    m_fragment_shader_module = createShaderModule(fragshadercode, m_device);
-
-    auto vertex_stagecreateinfo =
-      vk::PipelineShaderStageCreateInfo()
-        .setStage(vk::ShaderStageFlagBits::eVertex)
-        .setModule(m_vertex_shader_module)
-        .setPName("main");  // this is the main entry point of the shader
-
-    auto fragment_stagecreateinfo =
-      vk::PipelineShaderStageCreateInfo()
-        .setStage(vk::ShaderStageFlagBits::eFragment)
-        .setModule(m_fragment_shader_module)
-        .setPName("main");  // this is the main entry point of the shader
-
-    auto shaderstages =
-      std::array<vk::PipelineShaderStageCreateInfo, 2>{ vertex_stagecreateinfo,
-                                                        fragment_stagecreateinfo };
-
-    // vertex input
-    // The VkPipelineVertexInputStateCreateInfo structure describes the format of the vertex data
-    // that will be passed to the vertex shader. It describes this in roughly two ways:
-    //  - Bindings: spacing between data and whether the data is per-vertex or per-instance (see
-    //    instancing)
-    //  - Attribute descriptions: type of the attributes passed to the vertex shader,
-    //    which binding to load them from and at which offset
-    auto bindingdescription    = Vertex::getBindingDescription();
-    auto attributedescriptions = Vertex::getAttributeDescription();
-
-    auto vertexinputinfo =
-      vk::PipelineVertexInputStateCreateInfo()
-        .setVertexBindingDescriptionCount(1)
-        .setPVertexBindingDescriptions(&bindingdescription)
-        .setVertexAttributeDescriptionCount((uint32_t)attributedescriptions.size())
-        .setPVertexAttributeDescriptions(attributedescriptions.data());
-
-    // The VkPipelineInputAssemblyStateCreateInfo struct describes two things: what kind of geometry
-    // will be drawn from the vertices and if primitive restart should be enabled.
-    auto inputassembly = vk::PipelineInputAssemblyStateCreateInfo()
-                           .setTopology(vk::PrimitiveTopology::eTriangleList)
-                           .setPrimitiveRestartEnable(false);
-
-    // A viewport basically describes the region of the framebuffer that the output will be rendered
-    // to. This will almost always be (0, 0) to (width, height)
-    auto viewport = vk::Viewport()
-                      .setX(0.f)
-                      .setY(0.f)
-                      .setWidth((float)m_swapchain_extent.width)
-                      .setHeight((float)m_swapchain_extent.height)
-                      .setMinDepth(0.f)
-                      .setMaxDepth(1.f);
-
-    // While viewports define the transformation from the image to the framebuffer, scissor
-    // rectangles define in which regions pixels will actually be stored. Any pixels outside the
-    // scissor rectangles will be discarded by the rasterizer. They function like a filter rather
-    // than a transformation.
-    auto scissor = vk::Rect2D{ vk::Offset2D{ 0, 0 }, m_swapchain_extent };
-
-    // Now this viewport and scissor rectangle need to be combined into a viewport state using the
-    // VkPipelineViewportStateCreateInfo struct. It is possible to use multiple viewports and
-    // scissor rectangles on some graphics cards, so its members reference an array of them. Using
-    // multiple requires enabling a GPU feature (see logical device creation).
-    auto viewportstate = vk::PipelineViewportStateCreateInfo()
-                           .setViewportCount(1)
-                           .setPViewports(&viewport)
-                           .setScissorCount(1)
-                           .setPScissors(&scissor);
-
-    // rasterisation
-    // The rasterizer takes the geometry that is shaped by the vertices from the vertex shader and
-    // turns it into fragments to be colored by the fragment shader. It also performs depth testing,
-    // face culling and the scissor test, and it can be configured to output fragments that fill
-    // entire polygons or just the edges (wireframe rendering). All this is configured using the
-    // VkPipelineRasterizationStateCreateInfo structure.
-    auto rasterizer =
-      vk::PipelineRasterizationStateCreateInfo()
-        // If depthClampEnable is set to VK_TRUE, then fragments that are beyond the near and far
-        // planes are clamped to them as opposed to discarding them. This is useful in some special
-        // cases like shadow maps. Using this requires enabling a GPU feature.
-        .setDepthClampEnable(false)
-        // If rasterizerDiscardEnable is set to VK_TRUE, then geometry never passes through the
-        // rasterizer stage. This basically disables any output to the framebuffer.
-        .setRasterizerDiscardEnable(false)
-        // The polygonMode determines how fragments are generated for geometry. The following modes
-        // are available:
-        //    VK_POLYGON_MODE_FILL: fill the area of the polygon with fragments
-        //    VK_POLYGON_MODE_LINE: polygon edges are drawn as lines
-        //    VK_POLYGON_MODE_POINT: polygon vertices are drawn as points
-        // Using any mode other than fill requires enabling a GPU feature.
-        .setPolygonMode(vk::PolygonMode::eFill)
-        // The lineWidth member is straightforward, it describes the thickness of lines in terms of
-        // number of fragments. The maximum line width that is supported depends on the hardware and
-        // any line thicker than 1.0f requires you to enable the wideLines GPU feature.
-        .setLineWidth(1.f)
-        // The cullMode variable determines the type of face culling to use. You can disable
-        // culling, cull the front faces, cull the back faces or both.
-        .setCullMode(vk::CullModeFlagBits::eBack)
-        // The frontFace variable specifies the vertex order for faces to be considered front-facing
-        // and can be clockwise or counterclockwise.
-        .setFrontFace(vk::FrontFace::eCounterClockwise)
-        // The rasterizer can alter the depth values by adding a constant value or biasing them
-        // based on a fragment's slope. This is sometimes used for shadow mapping, but we won't be
-        // using it.
-        .setDepthBiasEnable(false);
-
-    // The VkPipelineMultisampleStateCreateInfo struct configures multisampling, which is one of the
-    // ways to perform anti-aliasing. It works by combining the fragment shader results of multiple
-    // polygons that rasterize to the same pixel. This mainly occurs along edges, which is also
-    // where the most noticeable aliasing artifacts occur. Because it doesn't need to run the
-    // fragment shader multiple times if only one polygon maps to a pixel, it is significantly less
-    // expensive than simply rendering to a higher resolution and then downscaling. Enabling it
-    // requires enabling a GPU feature (We don't).
-    auto multisampling = vk::PipelineMultisampleStateCreateInfo()
-                           .setSampleShadingEnable(false)
-                           .setRasterizationSamples(vk::SampleCountFlagBits::e1);
-
-    /*The depth attachment is ready to be used now, but depth testing still needs to be enabled in
-     * the graphics pipeline. It is configured through the VkPipelineDepthStencilStateCreateInfo
-     * struct:
-     * The depthTestEnable field specifies if the depth of new fragments should be compared to the
-     * depth buffer to see if they should be discarded. The depthWriteEnable field specifies if the
-     * new depth of fragments that pass the depth test should actually be written to the depth
-     * buffer. This is useful for drawing transparent objects. They should be compared to the
-     * previously rendered opaque objects, but not cause further away transparent objects to not be
-     * drawn.*/
-    auto depthstencil = vk::PipelineDepthStencilStateCreateInfo()
-                          .setDepthTestEnable(true)
-                          .setDepthWriteEnable(true)
-                          .setDepthCompareOp(vk::CompareOp::eLess)
-                          .setDepthBoundsTestEnable(false)
-                          .setMinDepthBounds(0.0f)  // optional for now
-                          .setMaxDepthBounds(1.0f)  // optional for now
-                          .setStencilTestEnable(false)
-                          .setFront(vk::StencilOpState())  // optional for now
-                          .setBack(vk::StencilOpState());  // optional for now
-
-    // After a fragment shader has returned a color, it needs to be combined with the color that is
-    // already in the framebuffer. This transformation is known as color blending and there are two
-    // ways to do it:
-    //  - Mix the old and new value to produce a final color
-    //  - Combine the old and new value using a bitwise operation
-
-    // Contains configuration per attached framebuffer
-    auto colorblendattachment =
-      vk::PipelineColorBlendAttachmentState()
-        .setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG
-                           | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA)
-        .setBlendEnable(false);
-
-    // VkPipelineColorBlendStateCreateInfo references the array of structures for all of the
-    // framebuffers and allows you to set blend constants that you can use as blend factors in the
-    // aforementioned calculations.
-    // If you want to use the second method of blending (bitwise combination), then you should set
-    // logicOpEnable to VK_TRUE. The bitwise operation can then be specified in the logicOp field.
-    // Note that this will automatically disable the first method, as if you had set blendEnable to
-    // VK_FALSE for every attached framebuffer! The colorWriteMask will also be used in this mode to
-    // determine which channels in the framebuffer will actually be affected. It is also possible to
-    // disable both modes, as we've done here, in which case the fragment colors will be written to
-    // the framebuffer unmodified.
-    auto colorblending = vk::PipelineColorBlendStateCreateInfo()
-                           .setLogicOpEnable(false)
-                           .setAttachmentCount(1)
-                           .setPAttachments(&colorblendattachment);
-
-    // A limited amount of the state that we've specified in the previous structs can actually be
-    // changed without recreating the pipeline. Examples are the size of the viewport, line width
-    // and blend constants. If you want to do that, then you'll have to fill in a
-    // VkPipelineDynamicStateCreateInfo
-    // This will cause the configuration of these values to be ignored and you will be required to
-    // specify the data at drawing time.
+    SHINY_PROFILE_FUNCTION();
 
     // You can use uniform values in shaders, which are globals similar to dynamic state variables
     // that can be changed at drawing time to alter the behavior of your shaders without having to
@@ -1312,91 +2764,539 @@ renderer::createGraphicsPipeline()
     // or to create texture samplers in the fragment shader.
     // These uniform values need to be specified during pipeline creation by creating a
     // VkPipelineLayout object.
-    auto pipelinelayout =
-      vk::PipelineLayoutCreateInfo().setSetLayoutCount(1).setPSetLayouts(&m_descriptor_set_layout);
-
-    m_pipeline_layout = m_device.createPipelineLayout(pipelinelayout);
-
-    auto pipelinecreateinfo =
-      vk::GraphicsPipelineCreateInfo()
-        .setStageCount(2)
-        .setPStages(shaderstages.data())
-        .setPVertexInputState(&vertexinputinfo)
-        .setPInputAssemblyState(&inputassembly)
-        .setPViewportState(&viewportstate)
-        .setPRasterizationState(&rasterizer)
-        .setPMultisampleState(&multisampling)
-        .setPColorBlendState(&colorblending)
-        .setPDepthStencilState(&depthstencil)
-        .setLayout(m_pipeline_layout)
-        // And finally we have the reference to the render pass. It is also possible to use other
-        // render passes with this pipeline instead of this specific instance, but they have to be
-        // compatible with renderPass. The requirements for compatibility are described
-        // https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#renderpass-compatibility
-        .setRenderPass(m_render_pass)
-        // The index of the sub pass where this graphics pipeline will be used.
-        .setSubpass(0);
+    // Per-draw data like the model transform isn't recorded into the command buffer at all, it is
+    // read from the draw buffer (see writeDrawBuffer), so all there is to declare is the set.
+    // Bindless textures are in a set of their own, see createDescriptorSetLayout
+    std::vector<vk::DescriptorSetLayout> setlayouts = { m_descriptor_set_layout };
+    if (m_bindless_textures) {
+        setlayouts.push_back(m_descriptor_buffers ? m_buffer_texture_layout : m_texture_set_layout);
+    }
 
-    // We pass a nullptr into the argument that requests for a vk::PipelineCache, since we don't
-    // need one
-    m_graphics_pipeline = m_device.createGraphicsPipeline(nullptr, pipelinecreateinfo);
-}
+    // None of the shaders has push constants as it is, but if one gets some they are declared
+    const std::vector<vk::PushConstantRange>& constants = m_graphics_reflection.push_constants;
+
+    auto pipelinelayout = vk::PipelineLayoutCreateInfo()
+                            .setSetLayoutCount((uint32_t)setlayouts.size())
+                            .setPSetLayouts(setlayouts.data())
+                            .setPushConstantRangeCount((uint32_t)constants.size())
+                            .setPPushConstantRanges(constants.data());
+
+    // Shared with every other pipeline with the same sets, and not affected by swapchain rebuilds
+    m_pipeline_layout = m_layouts.pipelineLayout(pipelinelayout);
+
+    // The lighting subpass's set 0 is the materials' set, so it stays bound for the blended
+    // materials drawn after it, and its set 1 the G-buffer
+    if (m_deferred_shading) {
+        const std::array<vk::DescriptorSetLayout, 2> lightingsets = { m_descriptor_set_layout,
+                                                                      m_gbuffer_set_layout };
+        m_lighting_layout = m_layouts.pipelineLayout(
+          vk::PipelineLayoutCreateInfo(pipelinelayout)
+            .setSetLayoutCount((uint32_t)lightingsets.size())
+            .setPSetLayouts(lightingsets.data()));
+    }
 
-/*
-The attachments specified during render pass creation are bound by wrapping them into a
-VkFramebuffer object. A framebuffer object references all of the VkImageView objects that represent
-the attachments. In our case that will be only a single one: the color attachment. However, the
-image that we have to use for the attachment depends on which image the swap chain returns when we
-retrieve one for presentation. That means that we have to create a framebuffer for all of the images
-in the swap chain and use the one that corresponds to the retrieved image at drawing time.
+    // Multiview's read each view's view projection by the view index
+    const char* vertexpath = m_vertex_pulling ? "shaders/pull_vert.spv" : "shaders/vert.spv";
+    if (multiview()) {
+        vertexpath =
+          m_vertex_pulling ? "shaders/pull_multiview_vert.spv" : "shaders/multiview_vert.spv";
+    }
 
-https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#VkFramebuffer
-*/
-void
-renderer::createFramebuffers()
-{
-    m_swapchain_framebuffers.reserve(m_swapchain_image_views.size());
+    pipeline_state opaque;
+    opaque.vertex_shader = m_pipelines.shader(vertexpath);
+    const char* fragmentshader = rayQueryShadows()  ? "shaders/ray_query_frag.spv"
+                                 : m_half_precision ? "shaders/frag_fp16.spv"
+                                                    : "shaders/frag.spv";
+    if (m_bindless_textures) {
+        fragmentshader = m_virtual_texturing ? "shaders/bindless_vt_frag.spv"
+                         : rayQueryShadows() ? "shaders/bindless_ray_query_frag.spv"
+                         : m_half_precision  ? "shaders/bindless_fp16_frag.spv"
+                                             : "shaders/bindless_frag.spv";
+    }
+    opaque.fragment_shader = m_pipelines.shader(fragmentshader);
+
+    // Only the attributes the vertex shader reads, and it mustn't read any the format lacks
+    const shader_reflection& vertexshader = m_pipelines.reflection(opaque.vertex_shader);
+
+    // A shader pulling its vertices reads none, and without the bindings' strides either both
+    // formats get the same empty layout, and so the same pipelines
+    const uint32_t bindingcount          = m_vertex_pulling ? 0 : 2;
+    auto           bindingdescriptions   = Vertex::getBindingDescription();
+    auto           fullattributes        = Vertex::getAttributeDescription();
+    auto           attributedescriptions = matchVertexInputs(vertexshader, fullattributes.data(),
+                                                             (uint32_t)fullattributes.size());
+
+    opaque.vertex_layout = m_pipelines.vertexLayout(bindingdescriptions.data(), bindingcount,
+                                                    attributedescriptions.data(),
+                                                    (uint32_t)attributedescriptions.size());
+    opaque.features      = m_shader_features;
+    opaque.layout        = m_pipeline_layout;
+    opaque.render_pass   = m_render_pass;
+    opaque.samples       = m_samples;
+    if (m_dynamic_rendering) {
+        opaque.color_format = m_swapchain_image_format;
+        opaque.depth_format = findDepthFormat();
+        opaque.view_mask    = viewMask();
+    }
+    opaque.enable(shader_feature::lighting, lightingEnabled());
+    opaque.enable(shader_feature::shadows, shadowsEnabled());
+    opaque.enable(shader_feature::reflections, m_reflections);
+
+    // Every pipeline of the main pass takes its fragment size from the command buffer, see
+    // setDrawShadingRate
+    opaque.shading_rate            = m_variable_rate;
+    opaque.shading_rate_attachment = m_adaptive_shading;
+
+    // Blended surfaces are still tested against the opaque ones, but don't hide each other
+    pipeline_state alphablend = opaque;
+    alphablend.blend          = blend_mode::alpha;
+    alphablend.depth_write    = false;
+
+    pipeline_state doublesided = opaque;
+    doublesided.cull_mode      = vk::CullModeFlagBits::eNone;
+
+    pipeline_state wireframe = opaque;
+    wireframe.polygon_mode   = vk::PolygonMode::eLine;
+    wireframe.cull_mode      = vk::CullModeFlagBits::eNone;
+
+    auto& fullstates = m_material_states[(size_t)vertex_format::full];
+
+    fullstates[(size_t)material::opaque]       = opaque;
+    fullstates[(size_t)material::alpha_blend]  = alphablend;
+    fullstates[(size_t)material::double_sided] = doublesided;
+    fullstates[(size_t)material::wireframe]    = m_wireframe ? wireframe : opaque;
+
+    // Packed meshes only differ in how their vertices are read
+    auto packedbindings   = packed_vertex::getBindingDescription();
+    auto packedformat     = packed_vertex::getAttributeDescription();
+    auto packedattributes = matchVertexInputs(vertexshader, packedformat.data(),
+                                              (uint32_t)packedformat.size());
+    auto packedlayout     = m_pipelines.vertexLayout(packedbindings.data(), bindingcount,
+                                                     packedattributes.data(),
+                                                     (uint32_t)packedattributes.size());
+
+    auto& packedstates = m_material_states[(size_t)vertex_format::packed];
+    for (size_t i = 0; i < packedstates.size(); ++i) {
+        packedstates[i]               = fullstates[i];
+        packedstates[i].vertex_layout = packedlayout;
+    }
 
-    for (auto const& view : m_swapchain_image_views) {
-        std::array<vk::ImageView, 2> attachments = { view, m_depth_image_view };
+    // Only the materials' pipelines read the descriptor buffer, and the overdraw view's and the
+    // prepass's made from them. Everything else built from `opaque` has sets of its own.
+    for (auto& states : m_material_states) {
+        for (pipeline_state& state : states) {
+            state.descriptor_buffer = m_descriptor_buffers;
+        }
+    }
 
-        auto framebufferinfo = vk::FramebufferCreateInfo()
-                                 .setRenderPass(m_render_pass)
-                                 // The attachmentCount and pAttachments parameters specify the
-                                 // VkImageView objects that should be bound to the respective
-                                 // attachment descriptions in the render pass pAttachment array.
-                                 .setAttachmentCount(static_cast<uint32_t>(attachments.size()))
-                                 .setPAttachments(attachments.data())
-                                 .setWidth(m_swapchain_extent.width)
-                                 .setHeight(m_swapchain_extent.height)
-                                 // layers refers to the number of layers in image arrays. Our swap
-                                 // chain images are single images, so the number of layers is 1.
-                                 .setLayers(1);
+    // With deferred shading whatever isn't blended goes into the G-buffer unlit, its color and
+    // normal, and the lighting subpass lights it. Blended surfaces are lit forward after that.
+    if (m_deferred_shading) {
+        for (auto& states : m_material_states) {
+            for (pipeline_state& state : states) {
+                if (state.blend != blend_mode::opaque) {
+                    state.subpass = lighting_subpass;
+                    continue;
+                }
+                state.subpass           = geometry_subpass;
+                state.color_attachments = 2;
+                state.enable(shader_feature::gbuffer);
+                state.enable(shader_feature::lighting, false);
+                state.enable(shader_feature::shadows, false);
+                state.enable(shader_feature::reflections, false);
+            }
+        }
 
-        auto framebuffer = m_device.createFramebuffer(framebufferinfo);
-        if (!framebuffer) {
-            throw std::runtime_error("failed to create framebuffer!");
+        m_lighting_state                 = pipeline_state();
+        m_lighting_state.vertex_shader   = m_pipelines.shader("shaders/deferred_vert.spv");
+        m_lighting_state.fragment_shader =
+          m_pipelines.shader(rayQueryShadows() ? "shaders/deferred_ray_query_frag.spv"
+                                               : "shaders/deferred_frag.spv");
+        m_lighting_state.vertex_layout   = m_pipelines.vertexLayout(nullptr, 0, nullptr, 0);
+        m_lighting_state.features        = 0;
+        m_lighting_state.cull_mode       = vk::CullModeFlagBits::eNone;
+        m_lighting_state.depth_test      = false;
+        m_lighting_state.depth_write     = false;
+        m_lighting_state.layout          = m_lighting_layout;
+        m_lighting_state.render_pass     = m_render_pass;
+        m_lighting_state.subpass         = lighting_subpass;
+        m_lighting_state.enable(shader_feature::lighting, !m_light_volumes);
+        m_lighting_state.enable(shader_feature::shadows, shadowsEnabled());
+        m_lighting_state.enable(shader_feature::reflections, m_reflections);
+
+        // Each light's triangle is kept to its sphere by the scissor and the depth bounds, and
+        // adds its light onto the rest
+        if (m_light_volumes) {
+            m_light_volume_state = m_lighting_state;
+            m_light_volume_state.vertex_shader =
+              m_pipelines.shader("shaders/light_volume_vert.spv");
+            m_light_volume_state.fragment_shader =
+              m_pipelines.shader("shaders/light_volume_frag.spv");
+            m_light_volume_state.features        = 0;
+            m_light_volume_state.blend           = blend_mode::additive;
+            m_light_volume_state.depth_bounds    = true;
         }
-        m_swapchain_framebuffers.emplace_back(framebuffer);
     }
-}
 
-/*
-Commands in Vulkan, like drawing operations and memory transfers, are not executed directly using
-function calls. You have to record all of the operations you want to perform in command buffer
-objects. The advantage of this is that all of the hard work of setting up the drawing commands can
-be done in advance and in multiple threads. After that, you just have to tell Vulkan to execute the
-commands in the main loop.
+    // Tested against everything but hiding nothing, and lit by nothing but themselves. With
+    // deferred shading in the lighting subpass, whose depth is read only.
+    if (m_particle_count > 0) {
+        m_particle_state                 = opaque;
+        m_particle_state.vertex_shader   = m_pipelines.shader("shaders/particle_vert.spv");
+        m_particle_state.fragment_shader = m_pipelines.shader("shaders/particle_frag.spv");
+        m_particle_state.vertex_layout   = m_pipelines.vertexLayout(nullptr, 0, nullptr, 0);
+        m_particle_state.features        = 0;
+        m_particle_state.cull_mode       = vk::CullModeFlagBits::eNone;
+        m_particle_state.blend           = blend_mode::additive;
+        m_particle_state.depth_write     = false;
+        m_particle_state.layout          = m_particles.drawLayout();
+        m_particle_state.subpass         = m_deferred_shading ? lighting_subpass : geometry_subpass;
+    }
 
-We have to create a command pool before we can create command buffers. Command pools manage the
-memory that is used to store the buffers and command buffers are allocated from them.
+    // Tested and written like the opaque materials, with a vertex input of its own. Never with
+    // deferred shading, so always in the geometry subpass.
+    if (m_terrain_active) {
+        const auto     terrainbindings   = m_terrain.bindings();
+        const auto     terrainattributes = m_terrain.attributes();
+        const uint32_t terrainlayout     = m_pipelines.vertexLayout(
+          terrainbindings.data(), (uint32_t)terrainbindings.size(), terrainattributes.data(),
+          (uint32_t)terrainattributes.size());
+
+        m_terrain_state                 = opaque;
+        m_terrain_state.vertex_shader   = m_pipelines.shader("shaders/terrain_vert.spv");
+        m_terrain_state.fragment_shader = m_pipelines.shader("shaders/terrain_frag.spv");
+        m_terrain_state.vertex_layout   = terrainlayout;
+        m_terrain_state.features        = 0;
+        m_terrain_state.cull_mode       = vk::CullModeFlagBits::eNone;
+        m_terrain_state.layout          = m_terrain.layout();
+        m_terrain_state.subpass         = geometry_subpass;
+    }
 
-https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#VkCommandPool
-*/
-void
-renderer::createCommandPool()
+    // And so is the grass, both sides of its blades, and with no vertex input either
+    if (m_vegetation_active) {
+        m_vegetation_state                 = opaque;
+        m_vegetation_state.vertex_shader   = m_pipelines.shader("shaders/vegetation_vert.spv");
+        m_vegetation_state.fragment_shader = m_pipelines.shader("shaders/vegetation_frag.spv");
+        m_vegetation_state.vertex_layout   = m_pipelines.vertexLayout(nullptr, 0, nullptr, 0);
+        m_vegetation_state.features        = 0;
+        m_vegetation_state.cull_mode       = vk::CullModeFlagBits::eNone;
+        m_vegetation_state.layout          = m_vegetation.drawLayout();
+        m_vegetation_state.subpass         = geometry_subpass;
+    }
+
+    // And so are the impostors, whose quads face the camera either way round
+    if (m_impostors_active) {
+        const auto     impostorbindings   = m_impostors.bindings();
+        const auto     impostorattributes = m_impostors.attributes();
+        const uint32_t impostorlayout     = m_pipelines.vertexLayout(
+          impostorbindings.data(), (uint32_t)impostorbindings.size(), impostorattributes.data(),
+          (uint32_t)impostorattributes.size());
+
+        m_impostor_state                 = opaque;
+        m_impostor_state.vertex_shader   = m_pipelines.shader("shaders/impostor_vert.spv");
+        m_impostor_state.fragment_shader = m_pipelines.shader("shaders/impostor_frag.spv");
+        m_impostor_state.vertex_layout   = impostorlayout;
+        m_impostor_state.features        = 0;
+        m_impostor_state.cull_mode       = vk::CullModeFlagBits::eNone;
+        m_impostor_state.layout          = m_impostors.layout();
+        m_impostor_state.subpass         = geometry_subpass;
+    }
+
+    // The occlusion queries' boxes are tested against the depth of everything, but change nothing
+    if (m_occlusion_queries) {
+        m_occlusion_state                 = opaque;
+        m_occlusion_state.vertex_shader   = m_pipelines.shader("shaders/occlusion_vert.spv");
+        m_occlusion_state.fragment_shader = m_pipelines.shader("shaders/depth_frag.spv");
+        m_occlusion_state.vertex_layout   = m_pipelines.vertexLayout(nullptr, 0, nullptr, 0);
+        m_occlusion_state.features        = 0;
+        m_occlusion_state.cull_mode       = vk::CullModeFlagBits::eNone;
+        m_occlusion_state.color_write     = false;
+        m_occlusion_state.depth_write     = false;
+        m_occlusion_state.layout          = m_occlusion.layout();
+        m_occlusion_state.subpass = m_deferred_shading ? lighting_subpass : geometry_subpass;
+    }
+
+    // The same, but blended by their alpha, and in lines as well as triangles
+    if (m_debug_draw) {
+        const auto     debugbinding    = debug_vertex::getBindingDescription();
+        const auto     debugattributes = debug_vertex::getAttributeDescription();
+        const uint32_t debuglayout     = m_pipelines.vertexLayout(
+          &debugbinding, 1, debugattributes.data(), (uint32_t)debugattributes.size());
+
+        m_debug_triangle_state                 = opaque;
+        m_debug_triangle_state.vertex_shader   = m_pipelines.shader("shaders/debug_vert.spv");
+        m_debug_triangle_state.fragment_shader = m_pipelines.shader("shaders/debug_frag.spv");
+        m_debug_triangle_state.vertex_layout   = debuglayout;
+        m_debug_triangle_state.features        = 0;
+        m_debug_triangle_state.cull_mode       = vk::CullModeFlagBits::eNone;
+        m_debug_triangle_state.blend           = blend_mode::alpha;
+        m_debug_triangle_state.depth_write     = false;
+        m_debug_triangle_state.layout          = m_debug.layout();
+        m_debug_triangle_state.subpass = m_deferred_shading ? lighting_subpass : geometry_subpass;
+
+        m_debug_line_state          = m_debug_triangle_state;
+        m_debug_line_state.topology = vk::PrimitiveTopology::eLineList;
+    }
+
+    // And the HUD over all of it, without the depth test
+    if (m_hud) {
+        const auto     hudbinding    = sprite_vertex::getBindingDescription();
+        const auto     hudattributes = sprite_vertex::getAttributeDescription();
+        const uint32_t hudlayout     = m_pipelines.vertexLayout(
+          &hudbinding, 1, hudattributes.data(), (uint32_t)hudattributes.size());
+        const char* const hudfragment = m_hud_sprites.bindless() ? "shaders/ui_bindless_frag.spv"
+                                                                 : "shaders/ui_frag.spv";
+
+        m_hud_state                 = opaque;
+        m_hud_state.vertex_shader   = m_pipelines.shader("shaders/ui_vert.spv");
+        m_hud_state.fragment_shader = m_pipelines.shader(hudfragment);
+        m_hud_state.vertex_layout   = hudlayout;
+        m_hud_state.features        = 0;
+        m_hud_state.cull_mode       = vk::CullModeFlagBits::eNone;
+        m_hud_state.blend           = blend_mode::alpha;
+        m_hud_state.depth_test      = false;
+        m_hud_state.depth_write     = false;
+        m_hud_state.layout          = m_hud_sprites.layout();
+        m_hud_state.subpass         = m_deferred_shading ? lighting_subpass : geometry_subpass;
+    }
+
+    // Only the opaque pipelines are compiled right away, since they are every other material's
+    // fallback for their vertex format. The rest compile in the background while loading carries
+    // on, see updateMaterialPipelines.
+    // Every material keeps its geometry and depth state, which decide what gets shaded
+    const uint32_t overdrawshader = m_pipelines.shader("shaders/overdraw_frag.spv");
+    for (size_t format = 0; format < m_material_states.size(); ++format) {
+        for (size_t i = 0; i < m_material_states[format].size(); ++i) {
+            m_overdraw_states[format][i]                 = m_material_states[format][i];
+            m_overdraw_states[format][i].fragment_shader = overdrawshader;
+            m_overdraw_states[format][i].blend           = blend_mode::additive;
+        }
+    }
+
+    // The depth prepass keeps the materials' rasterization as well, but reads only the positions
+    // and shades nothing. Shaders pulling their vertices read them all either way.
+    const uint32_t prepassvertex =
+      m_vertex_pulling ? opaque.vertex_shader
+                       : m_pipelines.shader(multiview() ? "shaders/depth_multiview_vert.spv"
+                                                        : "shaders/depth_vert.spv");
+    const uint32_t prepassfragment = m_pipelines.shader("shaders/depth_frag.spv");
+
+    // The position is the first attribute of both formats
+    const uint32_t positioninputs = m_vertex_pulling ? 0 : 1;
+
+    const std::array<uint32_t, (size_t)vertex_format::count> positionlayouts = {
+        m_pipelines.vertexLayout(&bindingdescriptions[position_binding], positioninputs,
+                                 fullattributes.data(), positioninputs),
+        m_pipelines.vertexLayout(&packedbindings[position_binding], positioninputs,
+                                 packedformat.data(), positioninputs),
+    };
+    for (size_t format = 0; format < m_material_states.size(); ++format) {
+        for (size_t i = 0; i < m_material_states[format].size(); ++i) {
+            pipeline_state& prepass = m_prepass_states[format][i];
+            prepass                 = m_material_states[format][i];
+            prepass.vertex_shader   = prepassvertex;
+            prepass.fragment_shader = prepassfragment;
+            prepass.vertex_layout   = positionlayouts[format];
+            prepass.features        = 0;
+            prepass.color_write     = false;
+        }
+    }
+
+    std::vector<pipeline_state> warm = { fullstates[(size_t)material::opaque],
+                                         packedstates[(size_t)material::opaque] };
+    if (m_deferred_shading) {
+        warm.push_back(m_lighting_state);
+    }
+    if (m_light_volumes) {
+        warm.push_back(m_light_volume_state);
+    }
+    if (m_particle_count > 0) {
+        warm.push_back(m_particle_state);
+    }
+    if (m_terrain_active) {
+        warm.push_back(m_terrain_state);
+    }
+    if (m_vegetation_active) {
+        warm.push_back(m_vegetation_state);
+    }
+    if (m_impostors_active) {
+        warm.push_back(m_impostor_state);
+    }
+    if (m_occlusion_queries) {
+        warm.push_back(m_occlusion_state);
+    }
+    if (m_hud) {
+        warm.push_back(m_hud_state);
+    }
+    if (m_debug_draw) {
+        warm.push_back(m_debug_triangle_state);
+        warm.push_back(m_debug_line_state);
+    }
+    m_pipelines.warm(warm);
+    m_graphics_pipeline = m_pipelines.get(fullstates[(size_t)material::opaque]);
+    updateMaterialPipelines();
+}
+
+/*
+Materials whose pipeline is still being compiled are drawn with the opaque one in the meantime,
+which looks off for a few frames at most instead of stalling one of them for the whole compile.
+
+With the depth prepass, the materials it draws are drawn again with an equal depth test and no
+depth writes, which only passes for the fragments of whatever the prepass left in front. Their
+fallback has to be the opaque one's with the same depth state, since one that writes its depth
+with a less test would pass nowhere at all.
+*/
+void
+renderer::updateMaterialPipelines()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_pipelines.update();
+    m_pipelines.retireReplaced(m_deletion_queue, m_frame_number);
+
+    // Compiled by createGraphicsPipeline, so this only picks up a reloaded shader's
+    if (m_deferred_shading) {
+        m_lighting_pipeline = m_pipelines.get(m_lighting_state);
+    }
+    if (m_light_volumes) {
+        m_light_volume_pipeline = m_pipelines.get(m_light_volume_state);
+    }
+    if (m_particle_count > 0) {
+        m_particle_pipeline = m_pipelines.get(m_particle_state);
+    }
+    if (m_terrain_active) {
+        m_terrain_pipeline = m_pipelines.get(m_terrain_state);
+    }
+    if (m_vegetation_active) {
+        m_vegetation_pipeline = m_pipelines.get(m_vegetation_state);
+    }
+    if (m_impostors_active) {
+        m_impostor_pipeline = m_pipelines.get(m_impostor_state);
+    }
+    if (m_occlusion_queries) {
+        m_occlusion_pipeline = m_pipelines.get(m_occlusion_state);
+    }
+    if (m_hud) {
+        m_hud_pipeline = m_pipelines.get(m_hud_state);
+    }
+    if (m_debug_draw) {
+        m_debug_triangle_pipeline = m_pipelines.get(m_debug_triangle_state);
+        m_debug_line_pipeline     = m_pipelines.get(m_debug_line_state);
+    }
+
+    for (size_t format = 0; format < m_material_states.size(); ++format) {
+        const auto& states =
+          m_overdraw_view ? m_overdraw_states[format] : m_material_states[format];
+
+        auto prepassed = [&](size_t i) {
+            return m_depth_prepass && drawnByPrepass(m_material_states[format][i]);
+        };
+        auto shaded = [&](size_t i) {
+            pipeline_state state = states[i];
+            if (prepassed(i)) {
+                state.depth_compare = vk::CompareOp::eEqual;
+                state.depth_write   = false;
+            }
+            return state;
+        };
+
+        const size_t       opaque   = (size_t)material::opaque;
+        const vk::Pipeline fallback = m_pipelines.get(shaded(opaque));
+        const vk::Pipeline prepassfallback =
+          prepassed(opaque) ? m_pipelines.get(m_prepass_states[format][opaque]) : vk::Pipeline();
+
+        for (size_t i = 0; i < states.size(); ++i) {
+            const vk::Pipeline pipeline = m_pipelines.request(shaded(i), fallback);
+            const vk::Pipeline prepass =
+              prepassed(i) ? m_pipelines.request(m_prepass_states[format][i], prepassfallback)
+                           : vk::Pipeline();
+
+            // A replaced pipeline is destroyed once the frames in flight are done with it, which
+            // the cached command buffers still using it would outlive
+            if (pipeline != m_material_pipelines[format][i]
+                || prepass != m_prepass_pipelines[format][i]) {
+                m_material_pipelines[format][i] = pipeline;
+                m_prepass_pipelines[format][i]  = prepass;
+                invalidateCachedDraws();
+            }
+        }
+    }
+}
+
+/*
+The attachments specified during render pass creation are bound by wrapping them into a
+VkFramebuffer object. A framebuffer object references all of the VkImageView objects that represent
+the attachments. In our case that will be only a single one: the color attachment. However, the
+image that we have to use for the attachment depends on which image the swap chain returns when we
+retrieve one for presentation. That means that we have to create a framebuffer for all of the images
+in the swap chain and use the one that corresponds to the retrieved image at drawing time.
+
+https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#VkFramebuffer
+*/
+void
+renderer::createFramebuffers()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    // Nothing to wrap the image views in without a render pass
+    if (m_dynamic_rendering) {
+        return;
+    }
+
+    m_swapchain_framebuffers.reserve(m_swapchain_image_views.size());
+
+    for (auto const& view : m_swapchain_image_views) {
+        // In the same order as the render pass's attachments. Scaled and stereo frames are
+        // rendered into the scene image, the same for all of them.
+        const vk::ImageView        target      = m_scene_target ? m_scene_image_view : view;
+        std::vector<vk::ImageView> attachments = { target, m_depth_image_view };
+        if (m_samples != vk::SampleCountFlagBits::e1) {
+            attachments = { m_color_image_view, m_depth_image_view, target };
+        }
+        if (m_deferred_shading) {
+            attachments = { target, m_depth_image_view, m_gbuffer_color_view,
+                            m_gbuffer_normal_view };
+        }
+
+        auto framebufferinfo = vk::FramebufferCreateInfo()
+                                 .setRenderPass(m_render_pass)
+                                 // The attachmentCount and pAttachments parameters specify the
+                                 // VkImageView objects that should be bound to the respective
+                                 // attachment descriptions in the render pass pAttachment array.
+                                 .setAttachmentCount(static_cast<uint32_t>(attachments.size()))
+                                 .setPAttachments(attachments.data())
+                                 .setWidth(m_render_extent.width)
+                                 .setHeight(m_render_extent.height)
+                                 // layers refers to the number of layers in image arrays. Our swap
+                                 // chain images are single images, so the number of layers is 1.
+                                 .setLayers(1);
+
+        auto framebuffer = m_device.createFramebuffer(framebufferinfo, hostAllocator());
+        if (!framebuffer) {
+            throw std::runtime_error("failed to create framebuffer!");
+        }
+        m_swapchain_framebuffers.emplace_back(framebuffer);
+    }
+}
+
+/*
+Commands in Vulkan, like drawing operations and memory transfers, are not executed directly using
+function calls. You have to record all of the operations you want to perform in command buffer
+objects. The advantage of this is that all of the hard work of setting up the drawing commands can
+be done in advance and in multiple threads. After that, you just have to tell Vulkan to execute the
+commands in the main loop.
+
+We have to create a command pool before we can create command buffers. Command pools manage the
+memory that is used to store the buffers and command buffers are allocated from them.
+
+https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#VkCommandPool
+*/
+void
+renderer::createCommandPool()
 {
-    auto indices = findQueueFamilies(m_physical_device, m_surface);
+    SHINY_PROFILE_FUNCTION();
+
+    auto indices = findQueueFamilies(m_physical_device, m_surface, deviceCount() > 1);
 
     auto commandpoolinfo =
       vk::CommandPoolCreateInfo()
@@ -1404,9 +3304,43 @@ renderer::createCommandPool()
         // graphics and presentation queues we retrieved. Each command pool can only allocate
         // command buffers that are submitted on a single type of queue. We're going to record
         // commands for drawing, which is why we've chosen the graphics queue family.
-        .setQueueFamilyIndex(indices.graphicsFamily());
+        .setQueueFamilyIndex(indices.graphicsFamily())
+        // Everything allocated from a frame's pool is rerecorded every frame, which is what the
+        // transient flag tells the driver. Resetting the whole pool at once is cheaper than
+        // resetting its command buffers one by one, so they don't need eResetCommandBuffer.
+        .setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+
+    m_command_pools.reserve(m_frames_in_flight);
+    for (uint32_t i = 0; i < m_frames_in_flight; ++i) {
+        m_command_pools.push_back(m_device.createCommandPool(commandpoolinfo, hostAllocator()));
+    }
+
+    // The async culling is recorded on its own, for the compute queue
+    if (m_async_compute) {
+        commandpoolinfo.setQueueFamilyIndex(indices.computeFamily());
+        for (uint32_t i = 0; i < m_frames_in_flight; ++i) {
+            m_compute_command_pools.push_back(
+              m_device.createCommandPool(commandpoolinfo, hostAllocator()));
+        }
+        m_compute_timeline.init(m_device);
+    }
+
+    // Command pools are externally synchronized, so every recording thread of every frame gets its
+    // own one for its secondary command buffer. Cached ones outlive the frame, and are only reset
+    // one at a time when they're recorded again, see recordParallelDraws.
+    const uint32_t threads = std::min(m_jobs.threadCount(), max_recording_threads);
 
-    m_command_pool = m_device.createCommandPool(commandpoolinfo);
+    commandpoolinfo.setQueueFamilyIndex(indices.graphicsFamily());
+    if (m_cached_draws) {
+        commandpoolinfo.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+    }
+
+    m_secondary_command_pools.resize(m_frames_in_flight);
+    for (auto& pools : m_secondary_command_pools) {
+        for (uint32_t i = 0; i < threads; ++i) {
+            pools.push_back(m_device.createCommandPool(commandpoolinfo, hostAllocator()));
+        }
+    }
 }
 
 /*
@@ -1445,9 +3379,10 @@ https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#Vk
 void
 renderer::createCommandBuffers()
 {
+    SHINY_PROFILE_FUNCTION();
+
     auto allocinfo =
       vk::CommandBufferAllocateInfo()
-        .setCommandPool(m_command_pool)
         // The level parameter specifies if the allocated command buffers are primary or secondary
         // command buffers.
         //  - VK_COMMAND_BUFFER_LEVEL_PRIMARY: Can be submitted to a queue for execution, but cannot
@@ -1457,1162 +3392,7731 @@ renderer::createCommandBuffers()
         // We won't make use of the secondary command buffer functionality here, but you can imagine
         // that it's helpful to reuse common operations from primary command buffers.
         .setLevel(vk::CommandBufferLevel::ePrimary)
-        .setCommandBufferCount((uint32_t)m_swapchain_framebuffers.size());
-
-    m_command_buffers = m_device.allocateCommandBuffers(allocinfo);
-
-    // We begin recording a command buffer by calling vkBeginCommandBuffer with a small
-    // VkCommandBufferBeginInfo structure as argument that specifies some details about the usage of
-    // this specific command buffer.whereupon which we can use vkCmd*-named calls to record draw
-    // commands/dispatch compute commands
-
-    for (size_t i = 0; i < m_command_buffers.size(); ++i) {
-        auto const& command_buffer = m_command_buffers[i];
-        auto        begininfo =
-          vk::CommandBufferBeginInfo()
-            // The flags parameter specifies how we're going to use the command buffer. The
-            // following values are available:
-            //  - VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT: The command buffer will be rerecorded
-            //    right after executing it once.
-            //  - VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT:
-            //    This is a secondary command buffer that will be entirely within a single render
-            //    pass.
-            //  - VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT: The command buffer can be
-            //    resubmitted while it is also already pending execution.
-            // We have used the last flag because we may already be scheduling the drawing commands
-            // for the next frame while the last frame is not finished yet.
-            .setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse);
-
-        recordCommandBuffer(command_buffer, begininfo, [=]() {
-            auto const& framebuffer = m_swapchain_framebuffers[i];
-            auto        renderarea  = vk::Rect2D({ 0, 0 }, m_swapchain_extent);
-
-            /*The range of depths in the depth buffer is 0.0 to 1.0 in Vulkan, where 1.0 lies at the
-             * far view plane and 0.0 at the near view plane. The initial value at each point in the
-             * depth buffer should be the furthest possible depth, which is 1.0.*/
-            std::array<vk::ClearValue, 2> clearValues = {};
-            clearValues[0].setColor(
-              vk::ClearColorValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 1.0f }));
-            clearValues[1].setDepthStencil(vk::ClearDepthStencilValue(1.0f, 0));
-
-            auto renderpassinfo =
-              vk::RenderPassBeginInfo()
-                // The first parameters are the render pass itself and the attachments to bind. We
-                // created a framebuffer for each swap chain image that specifies it as color
-                // attachment.
-                .setRenderPass(m_render_pass)
-                .setFramebuffer(framebuffer)
-                // The render area defines where shader loads and stores will take place. The pixels
-                // outside this region will have undefined values. It should match the size of the
-                // attachments for best performance.
-                .setRenderArea(renderarea)
-                // The last two parameters define the clear values to use for
-                // VK_ATTACHMENT_LOAD_OP_CLEAR, which we used as load operation for the color
-                // attachment. I've defined the clear color to simply be black with 100% opacity.
-                .setClearValueCount(static_cast<uint32_t>(clearValues.size()))
-                .setPClearValues(clearValues.data());
-
-            // The render pass can now begin. All of the functions that record commands can be
-            // recognized by their vkCmd prefix. They all return void, so there will be no error
-            // handling until we've finished recording.
-            // The first parameter for every command is always the command buffer to record the
-            // command to. The second parameter specifies the details of the render pass we've just
-            // provided. The final parameter controls how the drawing commands within the render
-            // pass will be provided. It can have one of two values:
-            //  - VK_SUBPASS_CONTENTS_INLINE: The render pass commands will be embedded in the
-            //    primary command buffer itself and no secondary command buffers will be executed.
-            //  - VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS: The render pass commands will be
-            //    executed from secondary command buffers.
-            // We will not be using secondary command buffers, so we'll go with the first option.
-            recordCommandBufferRenderPass(
-              command_buffer, renderpassinfo, vk::SubpassContents::eInline, [=]() {
-                  // The second parameter specifies if the pipeline object is a graphics or compute
-                  // pipeline. We've now told Vulkan which operations to execute in the graphics
-                  // pipeline and which attachment to use in the fragment shader, so all that
-                  // remains is telling it to draw the triangle:
-                  command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
-                                              m_graphics_pipeline);
-
-                  std::vector<vk::Buffer>     vertexbuffers = { m_vertex_buffer };
-                  std::vector<vk::DeviceSize> offsets       = { 0 };
-
-                  command_buffer.bindVertexBuffers(0, 1, vertexbuffers.data(), offsets.data());
-                  command_buffer.bindIndexBuffer(m_index_buffer, 0, vk::IndexType::eUint32);
-
-                  // Unlike vertex and index buffers, descriptor sets are not unique to graphics
-                  // pipelines. Therefore we need to specify if we want to bind descriptor sets to
-                  // the graphics or compute pipeline. The first parameter is the layout that the
-                  // descriptors are based on. The next three parameters specify the index of the
-                  // first descriptor set, the number of sets to bind, and the array of sets to
-                  // bind. We'll get back to this in a moment. The last two parameters specify an
-                  // array of offsets that are used for dynamic descriptors. We'll look at these in
-                  // a future chapter.
-                  command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
-                                                    m_pipeline_layout, 0, 1, &m_descriptor_set, 0,
-                                                    nullptr);
-
-                  // The actual vkCmdDraw function is a bit anticlimactic, but it's so simple
-                  // because of all the information we specified in advance. It has the following
-                  // parameters, aside from the command buffer:
-                  // - vertexCount: Even though we don't have a vertex buffer, we technically still
-                  // have
-                  // 3
-                  //   vertices to draw.
-                  // - instanceCount: Used for instanced rendering, use 1 if you're not
-                  //   doing that.
-                  // - firstVertex: Used as an offset into the vertex buffer, defines the lowest
-                  //   value of gl_VertexIndex.
-                  // - firstInstance: Used as an offset for instanced rendering,
-                  //   defines the lowest value of gl_InstanceIndex.
-                  // command_buffer.draw((uint32_t)triangle_vertices.size(), 1, 0, 0);
-
-                  // A call to this function is very similar to vkCmdDraw. The first two parameters
-                  // specify the number of indices and the number of instances. We're not using
-                  // instancing, so just specify 1 instance. The number of indices represents the
-                  // number of vertices that will be passed to the vertex buffer. The next parameter
-                  // specifies an offset into the index buffer, using a value of 1 would cause the
-                  // graphics card to start reading at the second index. The second to last
-                  // parameter specifies an offset to add to the indices in the index buffer. The
-                  // final parameter specifies an offset for instancing, which we're not using.
-                  command_buffer.drawIndexed((uint32_t)triangle_indices.size(), 1, 0, 0, 0);
-              });
-        });
+        // One per frame in flight, from that frame's pool. Each is rerecorded for whichever swap
+        // chain image its frame acquires, after the frame's fence has signalled.
+        .setCommandBufferCount(1);
+
+    m_command_buffers.reserve(m_frames_in_flight);
+    for (auto& pool : m_command_pools) {
+        allocinfo.setCommandPool(pool);
+        m_command_buffers.push_back(m_device.allocateCommandBuffers(allocinfo).front());
     }
-}
 
-/*
-Semaphores are a synchronization primitive that can be used to insert a dependency between batches
-submitted to queues. Semaphores have two states - signaled and unsignaled. The state of a semaphore
-can be signaled after execution of a batch of commands is completed. A batch can wait for a
-semaphore to become signaled before it begins execution, and the semaphore is also unsignaled before
-the batch begins execution.
+    for (auto& pool : m_compute_command_pools) {
+        allocinfo.setCommandPool(pool);
+        m_compute_command_buffers.push_back(m_device.allocateCommandBuffers(allocinfo).front());
+    }
 
-As with most objects in Vulkan, semaphores are an interface to internal data which is typically
-opaque to applications. This internal data is referred to as a semaphores payload.
+    // The particles' and debug lines' secondary, for when the main pass executes the draws' ones,
+    // see recordParallelDraws. Reset along with the frame's primary.
+    if (lateDraws()) {
+        allocinfo.setLevel(vk::CommandBufferLevel::eSecondary);
+        for (auto& pool : m_command_pools) {
+            allocinfo.setCommandPool(pool);
+            m_late_command_buffers.push_back(
+              m_device.allocateCommandBuffers(allocinfo).front());
+        }
+    }
 
-However, in order to enable communication with agents outside of the current device, it is necessary
-to be able to export that payload to a commonly understood format, and subsequently import from that
-format as well.
+    // And two secondary command buffers per recording thread, for recordParallelDraws: its slice's
+    // draws, which go in the first half, and its slice's depth prepass, which go in the second
+    allocinfo.setLevel(vk::CommandBufferLevel::eSecondary).setCommandBufferCount(2);
+
+    m_secondary_command_buffers.resize(m_frames_in_flight);
+    for (uint32_t frame = 0; frame < m_frames_in_flight; ++frame) {
+        const auto& pools       = m_secondary_command_pools[frame];
+        auto&       secondaries = m_secondary_command_buffers[frame];
+        secondaries.resize(pools.size() * 2);
+
+        for (size_t i = 0; i < pools.size(); ++i) {
+            allocinfo.setCommandPool(pools[i]);
+            auto buffers                  = m_device.allocateCommandBuffers(allocinfo);
+            secondaries[i]                = buffers[0];
+            secondaries[pools.size() + i] = buffers[1];
+        }
+    }
 
-The internal data of a semaphore may include a reference to any resources and pending work
-associated with signal or unsignal operations performed on that semaphore object. Mechanisms to
-import and export that internal data to and from semaphores are provided below. These mechanisms
-indirectly enable applications to share semaphore state between two or more semaphores and other
-synchronization primitives across process and API boundaries.
+    // None of them has been recorded yet
+    m_secondary_signatures.assign(m_frames_in_flight,
+                                  std::vector<uint64_t>(m_secondary_command_buffers[0].size(), 0));
 
-Semaphores are fundamentally a GPU-GPU synchronisation object
+    // The buffers are recorded every frame by recordDrawCommands
+}
 
-https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#synchronization-semaphores
+/*
+Records and submits the frame's culling and particles to the compute queue, where they overlap
+with the previous frame's graphics work. Against the Hi-Z pyramid the culling has to wait for that
+frame after all, since the pyramid is built at its end, and the particles have to wait for it to
+have drawn them, so those only overlap with the submission of the frame before. The culling's
+output is released to the graphics family, see gpu_culling::acquire, while the particles are
+shared by both.
 */
 void
-renderer::createSemaphores()
+renderer::submitAsyncCompute()
 {
-    for (uint32_t i = 0; i < max_frames_in_flight; ++i) {
-        m_image_available_semaphores.push_back(m_device.createSemaphore(vk::SemaphoreCreateInfo()));
-        m_render_finished_semaphores.push_back(m_device.createSemaphore(vk::SemaphoreCreateInfo()));
+    SHINY_PROFILE_FUNCTION();
+
+    // The compute pool of this frame was reset along with its graphics pool in drawFrame
+    vk::CommandBuffer commandbuffer = m_compute_command_buffers[m_current_frame];
+    commandbuffer.begin(
+      vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    if (m_gpu_culled) {
+        // The graphics queue waits for this before its indirect draws, vertex shaders included
+        // Model matrices with multiview, like the draw list's
+        if (m_scene_resident) {
+            const glm::mat4 transform = multiview() ? glm::mat4(1.f) : m_draw_view_projection;
+            m_render_scene.record(commandbuffer, transform, m_draws, m_scene_first_instance,
+                                  m_culling, m_scene_first_cull, m_scene_first_draw,
+                                  vk::PipelineStageFlags());
+        }
+        m_culling.record(commandbuffer, m_cull_frustum, m_camera_position, m_draws,
+                         m_occlusion_culling ? &m_hiz : nullptr, m_previous_view_projection);
     }
-}
+    if (m_particle_count > 0) {
+        m_particles.record(commandbuffer, m_scene_time);
+    }
+    commandbuffer.end();
 
-/*
-To perform CPU-GPU synchronization, Vulkan offers a second type of synchronization primitive called
-fences. Fences are similar to semaphores in the sense that they can be signaled and waited for, but
-this time we actually wait for them in our own code.
+    // Waits for the previous frame, whose pyramid or particles it reads
+    const bool previous = m_occlusion_culling || m_particle_count > 0;
 
-https://www.khronos.org/registry/vulkan/specs/1.0-wsi_extensions/html/vkspec.html#synchronization-fences
-*/
-void
-renderer::createFences()
-{
-    for (uint32_t i = 0; i < max_frames_in_flight; ++i) {
-        auto fenceinfo = vk::FenceCreateInfo()
-                           // we create this fence already signalled, which it isn't by default
-                           .setFlags(vk::FenceCreateFlagBits::eSignaled);
-        m_in_flight_fences.push_back(m_device.createFence(fenceinfo));
+    m_compute_batch.begin();
+    if (previous && m_frame_number > 0) {
+        m_compute_batch.wait(m_frame_timeline.semaphore(),
+                             vk::PipelineStageFlagBits::eComputeShader, m_frame_number);
     }
+    m_compute_batch.execute(commandbuffer);
+    m_compute_batch.signal(m_compute_timeline.semaphore(), m_frame_number + 1);
+
+    SHINY_PROFILE_ZONE("submit");
+    m_compute_batch.flush();
 }
 
 /*
-Buffers in Vulkan are regions of memory used for storing arbitrary data that can be read by the
-graphics card. They can be used to store vertex data, which we'll do in this chapter, but they can
-also be used for many other purposes that we'll explore in future chapters. Unlike the Vulkan
-objects we've been dealing with so far, buffers do not automatically allocate memory for themselves.
-The work from the previous chapters has shown that the Vulkan API puts the programmer in control of
-almost everything and memory management is one of those things.
-
-https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkCreateBuffer
+Records everything needed to draw one frame into `command_buffer`, targeting the framebuffer of swap
+chain image `imageindex`, with the frame's uniforms at `uniformoffset` in the uniform ring. Since
+this runs every frame, per-draw data like the model transform can simply be pushed as constants.
 */
 void
-renderer::createVertexBuffer()
+renderer::recordDrawCommands(vk::CommandBuffer command_buffer,
+                             uint32_t          imageindex,
+                             uint32_t          uniformoffset)
 {
-    vk::DeviceSize size =
-      sizeof(decltype(triangle_vertices)::value_type) * triangle_vertices.size();
-
-    // vk::Buffer       stagingbuffer;
-    // vk::DeviceMemory stagingbuffermemory;
-
-    auto [stagingbuffer, stagingbuffermemory] = createBuffer(
-      size, vk::BufferUsageFlagBits::eTransferSrc,
-      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-    // Now we copy the triangle vertex data into the buffer
-    // You can now simply memcpy the vertex data to the mapped memory and unmap it again using
-    // vkUnmapMemory. Unfortunately the driver may not immediately copy the data into the buffer
-    // memory, for example because of caching. It is also possible that writes to the buffer are not
-    // visible in the mapped memory yet. There are two ways to deal with that problem:
-    //  - Use a memory heap that is host coherent, indicated with
-    //  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    //  - Call vkFlushMappedMemoryRanges to after writing to the mapped memory, and call
-    //  vkInvalidateMappedMemoryRanges before reading from the mapped memory
-    // We went for the first approach, which ensures that the mapped memory always matches the
-    // contents of the allocated memory. Do keep in mind that this may lead to slightly worse
-    // performance than explicit flushing, but we'll see why that doesn't matter in the next
-    // chapter.
-    // {
-    //     void* data = m_device.mapMemory(stagingbuffermemory, 0, size);
-    //     std::memcpy(data, triangle_vertices.data(), size);
-    //     m_device.unmapMemory(stagingbuffermemory);
-    // }
+    SHINY_PROFILE_FUNCTION();
 
-    withMappedMemory(stagingbuffermemory, 0, size,
-                     [=](void* data) { std::memcpy(data, triangle_vertices.data(), size); });
-
-    // The vertexBuffer is now allocated from a memory type that is device local, which generally
-    // means that we're not able to use vkMapMemory. However, we can copy data from the
-    // stagingBuffer to the vertexBuffer (using copyBuffer()). We have to indicate that we intend to
-    // do that by specifying the transfer source flag for the stagingBuffer and the transfer
-    // destination flag for the vertexBuffer, along with the vertex buffer usage flag.
-    std::tie(m_vertex_buffer, m_vertex_buffer_memory) = createBuffer(
-      size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eVertexBuffer,
-      vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-    copyBuffer(stagingbuffer, &m_vertex_buffer, size);
-
-    m_device.destroyBuffer(stagingbuffer);
-    m_device.freeMemory(stagingbuffermemory);
+    // We begin recording a command buffer by calling vkBeginCommandBuffer with a small
+    // VkCommandBufferBeginInfo structure as argument that specifies some details about the usage of
+    // this specific command buffer.whereupon which we can use vkCmd*-named calls to record draw
+    // commands/dispatch compute commands
+    auto begininfo =
+      vk::CommandBufferBeginInfo()
+        // The flags parameter specifies how we're going to use the command buffer. The
+        // following values are available:
+        //  - VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT: The command buffer will be rerecorded
+        //    right after executing it once.
+        //  - VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT:
+        //    This is a secondary command buffer that will be entirely within a single render
+        //    pass.
+        //  - VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT: The command buffer can be
+        //    resubmitted while it is also already pending execution.
+        // Every frame in flight has its own command buffer that is rerecorded once its fence
+        // has signalled, so it is never resubmitted while still pending.
+        .setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+
+    // The passes are recorded by the render graph, and read the frame's image and uniforms back
+    m_recording_image    = imageindex;
+    m_recording_uniforms = uniformoffset;
+    m_graph.setImage(m_graph_target, m_swapchain_images[imageindex], vk::ImageLayout::eUndefined);
+
+    recordCommandBuffer(command_buffer, begininfo, [=]() {
+        // This frame's fence was waited on in drawFrame, so the last timings of its queries are in
+        m_profiler.beginFrame(command_buffer, m_current_frame);
+        const uint32_t framescope = m_profiler.begin(command_buffer, "frame");
+
+        m_graph.execute(command_buffer);
+
+        m_profiler.end(command_buffer, framescope);
+    });
 
-    // All that remains now is binding the vertex buffer during rendering operations.
+    m_previous_view_projection = m_view_projection;
 }
 
 /*
-We do exactly the same thing we did for createVertexBuffer and do it for indices instead
+The culling pass of the render graph. Culled asynchronously, only its output's ownership is
+acquired here, see submitAsyncCompute.
 */
 void
-renderer::createIndexBuffer()
+renderer::recordCulling(vk::CommandBuffer command_buffer)
 {
-    vk::DeviceSize size = sizeof(decltype(triangle_indices)::value_type) * triangle_indices.size();
-
-    // vk::Buffer       stagingbuffer;
-    // vk::DeviceMemory stagingbuffermemory;
+    if (!m_gpu_culled) {
+        return;
+    }
 
-    auto [stagingbuffer, stagingbuffermemory] = createBuffer(
-      size, vk::BufferUsageFlagBits::eTransferSrc,
-      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    if (m_async_compute) {
+        m_culling.acquire(command_buffer);
+        return;
+    }
 
-    // {
-    //     void* data = m_device.mapMemory(stagingbuffermemory, 0, size);
-    //     std::memcpy(data, triangle_indices.data(), size);
-    //     m_device.unmapMemory(stagingbuffermemory);
-    // }
+    m_profiler.scope(command_buffer, "culling", [=]() {
+        m_profiler.statistics(command_buffer, "culling", [=]() {
+            if (m_scene_resident) {
+                const glm::mat4 transform = multiview() ? glm::mat4(1.f) : m_draw_view_projection;
+                m_render_scene.record(command_buffer, transform, m_draws, m_scene_first_instance,
+                                      m_culling, m_scene_first_cull, m_scene_first_draw,
+                                      vk::PipelineStageFlagBits::eVertexShader);
+            }
+            m_culling.record(command_buffer, m_cull_frustum, m_camera_position, m_draws,
+                             m_occlusion_culling ? &m_hiz : nullptr, m_previous_view_projection);
+        });
+    });
+}
 
-    withMappedMemory(stagingbuffermemory, 0, size,
-                     [=](void* data) { std::memcpy(data, triangle_indices.data(), size); });
+// The particles pass of the render graph, unless they were simulated on the compute queue
+void
+renderer::recordParticles(vk::CommandBuffer command_buffer)
+{
+    if (m_async_compute) {
+        return;
+    }
 
-    std::tie(m_index_buffer, m_index_buffer_memory) = createBuffer(
-      size, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eIndexBuffer,
-      vk::MemoryPropertyFlagBits::eDeviceLocal);
+    m_profiler.scope(command_buffer, "particles", [=]() {
+        m_profiler.statistics(command_buffer, "particles",
+                              [=]() { m_particles.record(command_buffer, m_scene_time); });
+    });
+}
 
-    copyBuffer(stagingbuffer, &m_index_buffer, size);
+// Inside the main pass, after everything else, so the particles and debug lines are tested
+// against all of it. The HUD goes over the lot.
+void
+renderer::recordLateDraws(vk::CommandBuffer command_buffer) const
+{
+    if (!lateDraws()) {
+        return;
+    }
 
-    m_device.destroyBuffer(stagingbuffer);
-    m_device.freeMemory(stagingbuffermemory);
+    // May be the start of a secondary command buffer, which inherits no state
+    auto viewport = vk::Viewport(0.f, 0.f, (float)m_render_extent.width,
+                                 (float)m_render_extent.height, 0.f, 1.f);
+    auto scissor  = vk::Rect2D({ 0, 0 }, m_render_extent);
+    command_buffer.setViewport(0, 1, &viewport);
+    command_buffer.setScissor(0, 1, &scissor);
+
+    // The terrain is shaded like the opaque materials. It's drawn before the boxes, which write
+    // nothing, so they are queried against its depth as well as the materials'.
+    if (m_terrain_active) {
+        if (m_variable_rate) {
+            const auto opaque = m_shading_rate_settings.materials[(size_t)material::opaque];
+            setDrawShadingRate(command_buffer, opaque, true);
+        }
+        m_terrain.draw(command_buffer, m_terrain_pipeline, m_draw_view_projection, sun_direction,
+                       sun_color);
+    }
+    if (m_vegetation_active) {
+        m_vegetation.draw(command_buffer, m_vegetation_pipeline, m_draw_view_projection,
+                          sun_direction, sun_color, m_scene_time);
+    }
+    if (m_impostors_active && m_impostors.count() > 0) {
+        if (m_variable_rate) {
+            const auto opaque = m_shading_rate_settings.materials[(size_t)material::opaque];
+            setDrawShadingRate(command_buffer, opaque, true);
+        }
+        m_impostors.draw(command_buffer, m_impostor_pipeline, m_draw_view_projection,
+                         m_camera_position);
+    }
+    if (m_occlusion_queries) {
+        m_occlusion.record(command_buffer, m_occlusion_pipeline, m_draw_view_projection);
+    }
 
-    // All that remains now is binding the index buffer during rendering operations.
+    // Particles are shaded like the blended surfaces, the debug draws and HUD at every pixel, which
+    // have to stay legible
+    if (m_particle_count > 0) {
+        if (m_variable_rate) {
+            const auto blended = m_shading_rate_settings.materials[(size_t)material::alpha_blend];
+            setDrawShadingRate(command_buffer, blended, true);
+        }
+        m_particles.draw(command_buffer, m_particle_pipeline, m_view, m_draw_view_projection);
+    }
+    if (m_variable_rate && (m_debug_draw || m_hud)) {
+        setDrawShadingRate(command_buffer, vk::Extent2D(1, 1), false);
+    }
+    if (m_debug_draw) {
+        m_debug.draw(command_buffer, m_debug_line_pipeline, m_debug_triangle_pipeline,
+                     m_draw_view_projection);
+    }
+    if (m_hud) {
+        m_hud_sprites.draw(command_buffer, m_hud_pipeline,
+                           m_bindless_textures ? m_texture_sets[m_current_frame] : nullptr,
+                           m_render_extent);
+    }
 }
 
-/*
-Much like vertex and index buffers, we have a buffer for uniform values
-*/
+// The draws until endPredicatedDraw are skipped where the occlusion result at `offset` is 0
 void
-renderer::createUniformBuffer()
+renderer::beginPredicatedDraw(vk::CommandBuffer command_buffer, uint32_t offset) const
 {
-    vk::DeviceSize buffersize = sizeof(uniformbufferobject);
-
-    std::tie(m_uniform_buffer, m_uniform_buffer_memory) = createBuffer(
-      buffersize, vk::BufferUsageFlagBits::eUniformBuffer,
-      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+#if defined(VK_EXT_conditional_rendering)
+    auto begininfo =
+      vk::ConditionalRenderingBeginInfoEXT().setBuffer(m_occlusion.buffer()).setOffset(offset);
+    m_begin_conditional_rendering(
+      static_cast<VkCommandBuffer>(command_buffer),
+      reinterpret_cast<const VkConditionalRenderingBeginInfoEXT*>(&begininfo));
+#else
+    (void)command_buffer;
+    (void)offset;
+#endif
 }
 
-/*
-Descriptor sets can't be created directly, they must be allocated from a pool like command buffers.
-The equivalent for descriptor sets is unsurprisingly called a descriptor pool.
-*/
 void
-renderer::createDescriptorPool()
+renderer::endPredicatedDraw(vk::CommandBuffer command_buffer) const
 {
-    std::array<vk::DescriptorPoolSize, 2> poolsizes = {};
-    // We only have a single descriptor right now with the uniform buffer type.
-    poolsizes[0].setType(vk::DescriptorType::eUniformBuffer).setDescriptorCount(1);
-    poolsizes[1].setType(vk::DescriptorType::eCombinedImageSampler).setDescriptorCount(1);
-
-    auto poolinfo = vk::DescriptorPoolCreateInfo()
-                      .setPoolSizeCount(static_cast<uint32_t>(poolsizes.size()))
-                      .setPPoolSizes(poolsizes.data())
-                      .setMaxSets(1);
-
-    if (!(m_descriptor_pool = m_device.createDescriptorPool(poolinfo))) {
-        throw std::runtime_error("failed to create descriptor pool!");
-    }
+#if defined(VK_EXT_conditional_rendering)
+    m_end_conditional_rendering(static_cast<VkCommandBuffer>(command_buffer));
+#else
+    (void)command_buffer;
+#endif
 }
 
 /*
-It appears that descriptor sets are the results, being specified via descriptor set layouts and
-allocated from a descriptor pool
-
-You don't need to explicitly clean up descriptor sets, because they will be automatically freed when
-the descriptor pool is destroyed
+Sets the fragment size of the draws that follow to `rate`. With `adaptive` the rates image can make
+it coarser still, where the device can combine the two, or override it where it can't. Until the
+first frame at this resolution has written the rates they are kept out of it.
 */
 void
-renderer::createDescriptorSet()
+renderer::setDrawShadingRate(vk::CommandBuffer command_buffer,
+                             vk::Extent2D      rate,
+                             bool              adaptive) const
 {
-    std::vector<vk::DescriptorSetLayout> layouts = { m_descriptor_set_layout };
-
-    auto allocinfo = vk::DescriptorSetAllocateInfo()
-                       .setDescriptorPool(m_descriptor_pool)
-                       .setDescriptorSetCount((uint32_t)layouts.size())
-                       .setPSetLayouts(layouts.data());
-
-    // NOTE: This returns a vector, not a single set
-    // NOTE: This call of allocateDescriptorSets causes an error message of a failure to allocate.
-    // Have to keep an eye on this to see if it goes away once the tutorial is done.
-    m_descriptor_set = m_device.allocateDescriptorSets(allocinfo).front();
+#if defined(VK_KHR_fragment_shading_rate)
+    vk::FragmentShadingRateCombinerOpKHR attachment = vk::FragmentShadingRateCombinerOpKHR::eKeep;
+    if (adaptive && m_adaptive_shading && m_shading_rates.valid()) {
+        attachment = m_capabilities.shading_rate_combiners
+                       ? vk::FragmentShadingRateCombinerOpKHR::eMax
+                       : vk::FragmentShadingRateCombinerOpKHR::eReplace;
+    }
 
-    // The descriptor set has been allocated now, but the descriptors within still need to be
+    // The first combines the pipeline's rate with the primitives', which there are none of
+    const std::array<vk::FragmentShadingRateCombinerOpKHR, 2> combiners = {
+        vk::FragmentShadingRateCombinerOpKHR::eKeep, attachment
+    };
+    m_set_fragment_shading_rate(
+      static_cast<VkCommandBuffer>(command_buffer), reinterpret_cast<const VkExtent2D*>(&rate),
+      reinterpret_cast<const VkFragmentShadingRateCombinerOpKHR*>(combiners.data()));
+#else
+    (void)command_buffer;
+    (void)rate;
+    (void)adaptive;
+#endif
+}
+
+// The skinning pass of the render graph, of the jobs updateSkinning pushed
+void
+renderer::recordSkinning(vk::CommandBuffer command_buffer)
+{
+    m_profiler.scope(command_buffer, "skinning", [=]() { m_skinning.record(command_buffer); });
+}
+
+// The light culling pass of the render graph, which bins the lights pushed in updateLights
+void
+renderer::recordLightCulling(vk::CommandBuffer command_buffer)
+{
+    m_profiler.scope(command_buffer, "lights", [=]() { m_lighting.record(command_buffer); });
+}
+
+// The shadow pass of the render graph, rendering whichever cascades changed
+void
+renderer::recordShadows(vk::CommandBuffer command_buffer)
+{
+    m_profiler.scope(command_buffer, "shadows", [=]() { m_cascades.record(command_buffer); });
+}
+
+// Or with ray query shadows, building the scene they are traced through
+void
+renderer::recordAccelerationStructures(vk::CommandBuffer command_buffer)
+{
+    m_profiler.scope(command_buffer, "acceleration structures", [=]() {
+        m_acceleration.record(command_buffer, m_deletion_queue, m_frame_number);
+    });
+}
+
+// The reflection probes' pass of the render graph, capturing the frame's faces
+void
+renderer::recordReflectionProbes(vk::CommandBuffer command_buffer)
+{
+    m_profiler.scope(command_buffer, "reflection probes", [=]() {
+        m_probes.record(command_buffer, m_texture_sets[m_current_frame]);
+    });
+}
+
+/*
+The main pass of the render graph, drawing the draw list into the framebuffer of the swap chain
+image being recorded for
+*/
+void
+renderer::recordMainPass(vk::CommandBuffer command_buffer)
+{
+    const uint32_t imageindex    = m_recording_image;
+    const uint32_t uniformoffset = m_recording_uniforms;
+
+    // Queries can only be reset outside of a render pass
+    if (m_occlusion_queries) {
+        m_occlusion.reset(command_buffer);
+    }
+
+    auto const& framebuffer = m_swapchain_framebuffers[imageindex];
+    auto        renderarea  = vk::Rect2D({ 0, 0 }, m_render_extent);
+
+    /*The range of depths in the depth buffer is 0.0 to 1.0 in Vulkan. With reverse-Z, 1.0 lies
+     * at the near view plane and 0.0 infinitely far away. The initial value at each point in the
+     * depth buffer should be the furthest possible depth, which is 0.0.*/
+    std::array<vk::ClearValue, 4> clearValues = {};
+    // Baked views are cut out by their alpha, see setImpostorBaking
+    const float clearalpha = m_impostor_baking ? 0.0f : 1.0f;
+    clearValues[0].setColor(
+      vk::ClearColorValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, clearalpha }));
+    clearValues[1].setDepthStencil(vk::ClearDepthStencilValue(0.0f, 0));
+
+    // And the G-buffer's, which is only read where something was drawn
+    const uint32_t clearcount = m_deferred_shading ? 4 : 2;
+    clearValues[2].setColor(vk::ClearColorValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 0.0f }));
+    clearValues[3].setColor(vk::ClearColorValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 0.0f }));
+
+    auto renderpassinfo =
+      vk::RenderPassBeginInfo()
+        // The first parameters are the render pass itself and the attachments to bind. We
+        // created a framebuffer for each swap chain image that specifies it as color
+        // attachment.
+        .setRenderPass(m_render_pass)
+        .setFramebuffer(framebuffer)
+        // The render area defines where shader loads and stores will take place. The pixels
+        // outside this region will have undefined values. It should match the size of the
+        // attachments for best performance.
+        .setRenderArea(renderarea)
+        // The last two parameters define the clear values to use for
+        // VK_ATTACHMENT_LOAD_OP_CLEAR, which we used as load operation for the color
+        // attachment. I've defined the clear color to simply be black with 100% opacity.
+        .setClearValueCount(clearcount)
+        .setPClearValues(clearValues.data());
+
+    // The render pass can now begin. All of the functions that record commands can be
+    // recognized by their vkCmd prefix. They all return void, so there will be no error
+    // handling until we've finished recording.
+    // The first parameter for every command is always the command buffer to record the
+    // command to. The second parameter specifies the details of the render pass we've just
+    // provided. The final parameter controls how the drawing commands within the render
+    // pass will be provided. It can have one of two values:
+    //  - VK_SUBPASS_CONTENTS_INLINE: The render pass commands will be embedded in the
+    //    primary command buffer itself and no secondary command buffers will be executed.
+    //  - VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS: The render pass commands will be
+    //    executed from secondary command buffers.
+    // We use secondary command buffers once the draw list is long enough to be worth
+    // splitting up between threads, see recordParallelDraws, or whenever they are cached.
+    // A GPU culled frame is a single draw, so there is nothing to split up.
+    const bool parallel =
+      !m_gpu_culled
+      && (m_draw_list.size() >= parallel_recording_threshold
+          || (m_cached_draws && !m_draw_list.empty()));
+
+    // The depth prepass goes first, in the same render pass, since it draws into the same depth
+    // buffer the materials are drawn with
+    auto draws = [=]() {
+        if (parallel) {
+            recordParallelDraws(command_buffer, imageindex, uniformoffset);
+            return;
+        }
+        if (m_depth_prepass) {
+            recordDraws(command_buffer, uniformoffset, 0, (uint32_t)m_draw_list.size(), true);
+        }
+        recordDraws(command_buffer, uniformoffset, 0, (uint32_t)m_draw_list.size());
+        if (!m_deferred_shading) {
+            recordLateDraws(command_buffer);
+        }
+    };
+
+    auto mainpass = [=]() {
+        if (m_dynamic_rendering) {
+            beginRendering(command_buffer, parallel);
+            draws();
+            endRendering(command_buffer);
+            return;
+        }
+
+        // The draws are all the G-buffer's with deferred shading, and the lighting subpass is
+        // always recorded inline, whatever the geometry subpass was
+        recordCommandBufferRenderPass(
+          command_buffer, renderpassinfo,
+          parallel ? vk::SubpassContents::eSecondaryCommandBuffers : vk::SubpassContents::eInline,
+          [=]() {
+              draws();
+              if (m_deferred_shading) {
+                  command_buffer.nextSubpass(vk::SubpassContents::eInline);
+                  recordLighting(command_buffer, uniformoffset);
+              }
+          });
+    };
+
+    // Timed and counted from outside, since the render pass's commands may be in secondary
+    // command buffers, which can only be executed in a statistics scope with inheritedQueries
+    m_profiler.scope(command_buffer, "main pass", [=]() {
+        if (!parallel || m_inherited_queries) {
+            m_profiler.statistics(command_buffer, "main pass", mainpass);
+        } else {
+            mainpass();
+        }
+    });
+}
+
+/*
+The lighting subpass of deferred shading: a triangle over the whole framebuffer lights the G-buffer,
+with light volumes another for each light, and then the draws of the blended materials go on top.
+The G-buffer's set is allocated for the frame, since its views go with the render targets and a
+frame in flight still has the old ones.
+*/
+void
+renderer::recordLighting(vk::CommandBuffer command_buffer, uint32_t uniformoffset)
+{
+    const vk::DescriptorSet gbufferset =
+      m_frame_descriptors[m_current_frame].allocate(m_gbuffer_set_layout);
+
+    const std::array<vk::DescriptorImageInfo, 3> inputs = {
+        vk::DescriptorImageInfo({}, m_gbuffer_color_view, vk::ImageLayout::eShaderReadOnlyOptimal),
+        vk::DescriptorImageInfo({}, m_gbuffer_normal_view, vk::ImageLayout::eShaderReadOnlyOptimal),
+        vk::DescriptorImageInfo({}, m_depth_image_view,
+                                vk::ImageLayout::eDepthStencilReadOnlyOptimal),
+    };
+    std::array<vk::WriteDescriptorSet, 3> writes;
+    for (uint32_t i = 0; i < (uint32_t)writes.size(); ++i) {
+        writes[i] = vk::WriteDescriptorSet()
+                      .setDstSet(gbufferset)
+                      .setDstBinding(i)
+                      .setDescriptorCount(1)
+                      .setDescriptorType(vk::DescriptorType::eInputAttachment)
+                      .setPImageInfo(&inputs[i]);
+    }
+    m_device.updateDescriptorSets(writes, nullptr);
+
+    auto viewport = vk::Viewport(0.f, 0.f, (float)m_render_extent.width,
+                                 (float)m_render_extent.height, 0.f, 1.f);
+    auto scissor  = vk::Rect2D({ 0, 0 }, m_render_extent);
+    command_buffer.setViewport(0, 1, &viewport);
+    command_buffer.setScissor(0, 1, &scissor);
+
+    // Set 0 is the materials' own, with the same dynamic offsets
+    const std::array<uint32_t, 2> dynamicoffsets = { uniformoffset, m_draws.instanceOffset() };
+    const std::array<vk::DescriptorSet, 2> sets  = { m_descriptor_sets[m_current_frame],
+                                                    gbufferset };
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_lighting_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_lighting_layout, 0,
+                                      (uint32_t)sets.size(), sets.data(),
+                                      (uint32_t)dynamicoffsets.size(), dynamicoffsets.data());
+    command_buffer.draw(3, 1, 0, 0);
+
+    // The volumes' layout is the same, so the sets stay bound. The instance is the light's index.
+    if (m_light_volumes) {
+        const std::vector<light_volume>& volumes = m_lighting.volumes();
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_light_volume_pipeline);
+        for (uint32_t i = 0; i < (uint32_t)volumes.size(); ++i) {
+            const light_volume& volume = volumes[i];
+            if (volume.scissor.extent.width == 0 || volume.scissor.extent.height == 0) {
+                continue;
+            }
+            command_buffer.setScissor(0, 1, &volume.scissor);
+            command_buffer.setDepthBounds(volume.min_depth, volume.max_depth);
+            command_buffer.draw(3, 1, 0, i);
+        }
+        command_buffer.setScissor(0, 1, &scissor);
+    }
+
+    recordDraws(command_buffer, uniformoffset, 0, (uint32_t)m_draw_list.size(), false,
+                lighting_subpass);
+    recordLateDraws(command_buffer);
+}
+
+/*
+The render pass's attachments, loads, stores and layout transitions, with VK_KHR_dynamic_rendering
+instead. The multisampled color attachment is resolved into the target by the end of rendering the
+same way, with pResolveImageView, and the render graph sees the same uses of them either way.
+
+Rendering starts by transitioning the attachments out of whatever they held, right where the render
+pass's dependency on the acquire semaphore's stage was, and ends by moving the image rendered into
+to the layout the next pass or the presentation engine wants. The depth buffer and the multisampled
+color attachment stay in their attachment layouts, as they did with the render pass.
+*/
+void
+renderer::beginRendering(vk::CommandBuffer command_buffer, bool secondaries)
+{
+#if defined(VK_KHR_dynamic_rendering)
+    const bool      multisampled = m_samples != vk::SampleCountFlagBits::e1;
+    const vk::Image target =
+      m_scene_target ? m_scene_image : m_swapchain_images[m_recording_image];
+    const vk::ImageView targetview =
+      m_scene_target ? m_scene_image_view : m_swapchain_image_views[m_recording_image];
+
+    vk::ImageAspectFlags depthaspect = vk::ImageAspectFlagBits::eDepth;
+    if (hasStencilComponent(m_depth_format)) {
+        depthaspect |= vk::ImageAspectFlagBits::eStencil;
+    }
+
+    const auto         color      = vk::ImageAspectFlagBits::eColor;
+    const access_scope undefined  = { vk::PipelineStageFlagBits::eColorAttachmentOutput, {} };
+    const access_scope colorwrite = layoutScope(vk::ImageLayout::eColorAttachmentOptimal);
+
+    // Every eye's layer
+    const uint32_t layers = viewCount();
+
+    barrier_batch barriers;
+    barriers.image(target, vk::ImageSubresourceRange(color, 0, 1, 0, layers), undefined,
+                   colorwrite);
+    if (multisampled) {
+        barriers.image(m_color_image, vk::ImageSubresourceRange(color, 0, 1, 0, layers), undefined,
+                       colorwrite);
+    }
+    barriers.image(m_depth_image, vk::ImageSubresourceRange(depthaspect, 0, 1, 0, layers),
+                   { vk::PipelineStageFlagBits::eEarlyFragmentTests
+                       | vk::PipelineStageFlagBits::eLateFragmentTests,
+                     {} },
+                   layoutScope(vk::ImageLayout::eDepthStencilAttachmentOptimal));
+    barriers.record(command_buffer);
+
+    // The same clear values as the render pass's
+    auto colorattachment =
+      vk::RenderingAttachmentInfoKHR()
+        .setImageView(targetview)
+        .setImageLayout(vk::ImageLayout::eColorAttachmentOptimal)
+        .setLoadOp(vk::AttachmentLoadOp::eClear)
+        .setStoreOp(vk::AttachmentStoreOp::eStore)
+        .setClearValue(vk::ClearColorValue(
+          std::array<float, 4>{ 0.0f, 0.0f, 0.0f, m_impostor_baking ? 0.0f : 1.0f }));
+    if (multisampled) {
+        colorattachment.setImageView(m_color_image_view)
+          .setStoreOp(vk::AttachmentStoreOp::eDontCare)
+          .setResolveMode(vk::ResolveModeFlagBits::eAverage)
+          .setResolveImageView(targetview)
+          .setResolveImageLayout(vk::ImageLayout::eColorAttachmentOptimal);
+    }
+
+    auto depthattachment = vk::RenderingAttachmentInfoKHR()
+                             .setImageView(m_depth_image_view)
+                             .setImageLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal)
+                             .setLoadOp(vk::AttachmentLoadOp::eClear)
+                             .setStoreOp(sampledDepth() ? vk::AttachmentStoreOp::eStore
+                                                        : vk::AttachmentStoreOp::eDontCare)
+                             .setClearValue(vk::ClearDepthStencilValue(0.0f, 0));
+
+    auto renderinginfo = vk::RenderingInfoKHR()
+                           .setRenderArea(vk::Rect2D({ 0, 0 }, m_render_extent))
+                           .setLayerCount(1)
+                           .setViewMask(viewMask())
+                           .setColorAttachmentCount(1)
+                           .setPColorAttachments(&colorattachment)
+                           .setPDepthAttachment(&depthattachment);
+    if (secondaries) {
+        renderinginfo.setFlags(vk::RenderingFlagBitsKHR::eContentsSecondaryCommandBuffers);
+    }
+
+#if defined(VK_KHR_fragment_shading_rate)
+    // Attached whenever the pipelines were made for it, though only combined with their rates once
+    // they have been written, see setDrawShadingRate
+    auto rateattachment =
+      vk::RenderingFragmentShadingRateAttachmentInfoKHR()
+        .setImageView(m_shading_rates.view())
+        .setImageLayout(vk::ImageLayout::eFragmentShadingRateAttachmentOptimalKHR)
+        .setShadingRateAttachmentTexelSize(m_shading_rates.texelSize());
+    if (m_adaptive_shading) {
+        renderinginfo.setPNext(&rateattachment);
+    }
+#endif
+
+    m_begin_rendering(static_cast<VkCommandBuffer>(command_buffer),
+                      reinterpret_cast<const VkRenderingInfoKHR*>(&renderinginfo));
+#else
+    (void)command_buffer;
+    (void)secondaries;
+#endif
+}
+
+void
+renderer::endRendering(vk::CommandBuffer command_buffer)
+{
+#if defined(VK_KHR_dynamic_rendering)
+    m_end_rendering(static_cast<VkCommandBuffer>(command_buffer));
+
+    // Copied from or blitted to the swap chain image after this, or presented straight away
+    const vk::Image target =
+      m_scene_target ? m_scene_image : m_swapchain_images[m_recording_image];
+    const vk::ImageLayout finallayout = m_offscreen || m_scene_target
+                                          ? vk::ImageLayout::eTransferSrcOptimal
+                                          : vk::ImageLayout::ePresentSrcKHR;
+
+    barrier_batch barriers;
+    barriers.transition(
+      target, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, viewCount()),
+      vk::ImageLayout::eColorAttachmentOptimal, finallayout);
+    barriers.record(command_buffer);
+#else
+    (void)command_buffer;
+#endif
+}
+
+/*
+Scales the scene image up to the swap chain image being recorded for, filtering linearly. The blit
+is the last thing to touch the target, so it's transitioned to its final layout right after. In
+stereo each eye's layer goes to its half of the target, the left eye's to the left.
+
+With viewports the first layer is the target's, and every other one goes to the image acquired for
+its viewport, if there was one. Those images are only ever blitted to, so whatever was in them is
+discarded, once the transfer stage is done waiting for their semaphores.
+
+Resolved frames are blitted from the layer of the history the temporal pass just wrote, which is as
+large as the target already, so the blit only converts it to the target's format.
+*/
+void
+renderer::recordUpscale(vk::CommandBuffer command_buffer)
+{
+    const vk::Image target = m_swapchain_images[m_recording_image];
+    const auto      color  = vk::ImageAspectFlagBits::eColor;
+    const uint32_t  views  = m_stereo ? 2 : 1;  // in the target
+
+    const vk::Offset3D source((int32_t)m_render_extent.width, (int32_t)m_render_extent.height, 1);
+
+    const vk::ImageSubresourceRange range(color, 0, 1, 0, 1);
+    barrier_batch                   acquired;
+    for (const viewport& v : m_viewports) {
+        if (v.acquired) {
+            acquired.image(v.images[v.image], range,
+                           access_scope{ vk::PipelineStageFlagBits::eTransfer, {},
+                                         vk::ImageLayout::eUndefined },
+                           layoutScope(vk::ImageLayout::eTransferDstOptimal));
+        }
+    }
+    acquired.record(command_buffer);
+
+    for (size_t i = 0; i < m_viewports.size(); ++i) {
+        const viewport& v = m_viewports[i];
+        if (!v.acquired) {
+            continue;
+        }
+
+        auto blit =
+          vk::ImageBlit()
+            .setSrcSubresource(vk::ImageSubresourceLayers(color, 0, (uint32_t)i + 1, 1))
+            .setSrcOffsets({ vk::Offset3D(0, 0, 0), source })
+            .setDstSubresource(vk::ImageSubresourceLayers(color, 0, 0, 1))
+            .setDstOffsets({ vk::Offset3D(0, 0, 0),
+                             vk::Offset3D((int32_t)v.extent.width, (int32_t)v.extent.height, 1) });
+        command_buffer.blitImage(m_scene_image, vk::ImageLayout::eTransferSrcOptimal,
+                                 v.images[v.image], vk::ImageLayout::eTransferDstOptimal, blit,
+                                 vk::Filter::eLinear);
+    }
+
+    const vk::Offset3D full((int32_t)m_swapchain_extent.width,
+                            (int32_t)m_swapchain_extent.height, 1);
+
+    if (m_temporal_aa) {
+        auto blit = vk::ImageBlit()
+                      .setSrcSubresource(
+                        vk::ImageSubresourceLayers(color, 0, m_temporal.outputLayer(), 1))
+                      .setSrcOffsets({ vk::Offset3D(0, 0, 0), full })
+                      .setDstSubresource(vk::ImageSubresourceLayers(color, 0, 0, 1))
+                      .setDstOffsets({ vk::Offset3D(0, 0, 0), full });
+        command_buffer.blitImage(m_temporal.historyImage(), vk::ImageLayout::eGeneral, target,
+                                 vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eNearest);
+    } else {
+        std::array<vk::ImageBlit, 2> blits;
+        for (uint32_t view = 0; view < views; ++view) {
+            const int32_t left  = (int32_t)(m_swapchain_extent.width * view / views);
+            const int32_t right = (int32_t)(m_swapchain_extent.width * (view + 1) / views);
+
+            blits[view]
+              .setSrcSubresource(vk::ImageSubresourceLayers(color, 0, view, 1))
+              .setSrcOffsets({ vk::Offset3D(0, 0, 0), source })
+              .setDstSubresource(vk::ImageSubresourceLayers(color, 0, 0, 1))
+              .setDstOffsets({ vk::Offset3D(left, 0, 0), vk::Offset3D(right, full.y, 1) });
+        }
+        command_buffer.blitImage(m_scene_image, vk::ImageLayout::eTransferSrcOptimal, target,
+                                 vk::ImageLayout::eTransferDstOptimal, views, blits.data(),
+                                 vk::Filter::eLinear);
+    }
+
+    const vk::ImageLayout finallayout =
+      m_offscreen ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+
+    barrier_batch barriers;
+    barriers.transition(target, range, vk::ImageLayout::eTransferDstOptimal, finallayout);
+    for (const viewport& v : m_viewports) {
+        if (v.acquired) {
+            barriers.transition(v.images[v.image], range, vk::ImageLayout::eTransferDstOptimal,
+                                vk::ImageLayout::ePresentSrcKHR);
+        }
+    }
+    barriers.record(command_buffer);
+}
+
+/*
+The post pass of the render graph, which writes the swap chain image being recorded for, as a
+storage image or by a blit from the post stack's own, and then transitions it to its final layout
+like the upscale pass does.
+*/
+void
+renderer::recordPost(vk::CommandBuffer command_buffer)
+{
+    const vk::Image target = m_swapchain_images[m_recording_image];
+    const uint32_t  source = m_temporal_aa ? m_temporal.outputLayer() : 0;
+
+    m_post.record(command_buffer, source, m_recording_image, target);
+
+    const vk::ImageLayout finallayout =
+      m_offscreen ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+
+    const vk::ImageLayout written =
+      m_post_direct ? vk::ImageLayout::eGeneral : vk::ImageLayout::eTransferDstOptimal;
+
+    barrier_batch barriers;
+    barriers.transition(target,
+                        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1),
+                        written, finallayout);
+    barriers.record(command_buffer);
+}
+
+// The temporal pass of the render graph, with how the camera moved since the frame before
+void
+renderer::recordTemporal(vk::CommandBuffer command_buffer)
+{
+    m_temporal.record(command_buffer, m_temporal_frame);
+}
+
+// The shading rate pass of the render graph, for the next frame's main pass
+void
+renderer::recordShadingRates(vk::CommandBuffer command_buffer)
+{
+    m_shading_rates.record(command_buffer, m_shading_rate_settings.quality);
+}
+
+/*
+Records the draw list items [first, first + count) into `command_buffer`, which is either the
+frame's primary command buffer inside the render pass, or a secondary one continuing it. Nothing is
+inherited by secondary command buffers besides the render pass, so this binds and sets everything
+the draws need.
+
+For the depth prepass it records those of the items that have a prepass pipeline with that one
+instead, binding only the position stream. Their draw parameters are the same either way, so the
+multi-draws read the same commands out of the draw buffer, or out of the culling's.
+
+With deferred shading only the items whose pipelines are for `subpass` are recorded.
+*/
+void
+renderer::recordDraws(vk::CommandBuffer command_buffer,
+                      uint32_t          uniformoffset,
+                      uint32_t          first,
+                      uint32_t          count,
+                      bool              prepass,
+                      uint32_t          subpass) const
+{
+    // The viewport and scissor are dynamic state, so they have to be set before the first draw.
+    // They cover the whole image rendered to, the swap chain's unless the frame is scaled.
+    auto viewport = vk::Viewport()
+                      .setX(0.f)
+                      .setY(0.f)
+                      .setWidth((float)m_render_extent.width)
+                      .setHeight((float)m_render_extent.height)
+                      .setMinDepth(0.f)
+                      .setMaxDepth(1.f);
+
+    auto scissor = vk::Rect2D({ 0, 0 }, m_render_extent);
+
+    command_buffer.setViewport(0, 1, &viewport);
+    command_buffer.setScissor(0, 1, &scissor);
+
+    // Unlike vertex and index buffers, descriptor sets are not unique to graphics pipelines.
+    // Therefore we need to specify if we want to bind descriptor sets to the graphics or compute
+    // pipeline. The first parameter is the layout that the descriptors are based on. The next three
+    // parameters specify the index of the first descriptor set, the number of sets to bind, and the
+    // array of sets to bind. The last two parameters specify an array of offsets that are used for
+    // dynamic descriptors, which is how the uniform buffer descriptor picks this frame's region of
+    // the uniform ring. They go in binding order, so the draw instances' comes second.
+    // With descriptor buffers both sets are the frame's copies in the buffer, which point at the
+    // frame's regions themselves.
+    if (m_descriptor_buffers) {
+        assert(uniformoffset == m_uniforms.frameOffset(m_current_frame));
+        m_descriptor_buffer.bind(command_buffer, vk::PipelineBindPoint::eGraphics,
+                                 m_pipeline_layout, m_current_frame, m_bindless_textures ? 2 : 1);
+    } else {
+        std::array<uint32_t, 2> dynamicoffsets = { uniformoffset, m_draws.instanceOffset() };
+
+        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_pipeline_layout, 0,
+                                          1, &m_descriptor_sets[m_current_frame],
+                                          (uint32_t)dynamicoffsets.size(),
+                                          dynamicoffsets.data());
+
+        // Every texture is in this one set, so switching textures between draws needs no binds
+        if (m_bindless_textures) {
+            command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_pipeline_layout,
+                                              1, 1, &m_texture_sets[m_current_frame], 0, nullptr);
+        }
+    }
+
+    // Everything else comes from the draw list, which is rebuilt every frame. The buffers are only
+    // rebound when they differ from the previous draw's, and so is the pipeline. Every material's
+    // pipeline has the same layout, so the descriptor sets stay bound across pipeline changes.
+    vk::Pipeline  boundpipeline;
+    vk::Buffer    boundvertices;
+    vk::Buffer    boundindices;
+    vk::IndexType boundindextype = vk::IndexType::eUint32;
+    vk::Extent2D  boundrate      = vk::Extent2D(0, 0);
+
+    const uint32_t end = first + count;
+
+    auto pipelineof = [prepass](const draw_item& item) {
+        return prepass ? item.prepass_pipeline : item.pipeline;
+    };
+
+    for (uint32_t i = first; i < end;) {
+        const draw_item&   item     = m_draw_list[i];
+        const vk::Pipeline pipeline = pipelineof(item);
+
+        if (!pipeline || item.subpass != subpass) {
+            ++i;
+            continue;
+        }
+
+        // The second parameter specifies if the pipeline object is a graphics or compute pipeline
+        if (pipeline != boundpipeline) {
+            command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+            boundpipeline = pipeline;
+        }
+
+        // The fragment size is dynamic state, which every pipeline has with variable rate shading
+        if (m_variable_rate && item.shading_rate != boundrate) {
+            setDrawShadingRate(command_buffer, item.shading_rate, true);
+            boundrate = item.shading_rate;
+        }
+
+        // Nothing is read through the vertex input when the shader pulls the vertices. Both
+        // streams come from the geometry pool, so they only ever change together.
+        if (!m_vertex_pulling && item.vertex_buffer != boundvertices) {
+            const std::array<vk::Buffer, 2>     streams = { item.vertex_buffer,
+                                                            item.attribute_buffer };
+            const std::array<vk::DeviceSize, 2> offsets = { 0, 0 };
+            command_buffer.bindVertexBuffers(position_binding, prepass ? 1 : 2, streams.data(),
+                                             offsets.data());
+            boundvertices = item.vertex_buffer;
+        }
+
+        // Both index types share the buffer, so it's rebound whenever the type changes
+        if (item.index_buffer != boundindices || item.index_type != boundindextype) {
+            command_buffer.bindIndexBuffer(item.index_buffer, 0, item.index_type);
+            boundindices   = item.index_buffer;
+            boundindextype = item.index_type;
+        }
+
+        // Skipped by the GPU when its box was hidden the frame before, so it's a draw of its own
+        const bool predicated = item.occlusion_predicate != no_occlusion_predicate;
+        if (predicated) {
+            beginPredicatedDraw(command_buffer, item.occlusion_predicate);
+        }
+
+        // The actual vkCmdDraw function is a bit anticlimactic, but it's so simple
+        // because of all the information we specified in advance. It has the following
+        // parameters, aside from the command buffer:
+        // - vertexCount: Even though we don't have a vertex buffer, we technically still
+        //   have 3 vertices to draw.
+        // - instanceCount: Used for instanced rendering, use 1 if you're not
+        //   doing that.
+        // - firstVertex: Used as an offset into the vertex buffer, defines the lowest
+        //   value of gl_VertexIndex.
+        // - firstInstance: Used as an offset for instanced rendering,
+        //   defines the lowest value of gl_InstanceIndex.
+        // command_buffer.draw((uint32_t)triangle_vertices.size(), 1, 0, 0);
+
+        // A call to this function is very similar to vkCmdDraw. The first two parameters
+        // specify the number of indices and the number of instances. The number of indices
+        // represents the number of vertices that will be passed to the vertex buffer. The next
+        // parameter specifies an offset into the index buffer, using a value of 1 would cause the
+        // graphics card to start reading at the second index. The second to last
+        // parameter specifies an offset to add to the indices in the index buffer. The
+        // final parameter specifies an offset for instancing, which we use to point the shader
+        // at the draw's first transform in the draw buffer. writeDrawBuffer writes them in draw
+        // list order, so that is where the item's transforms start in m_draw_transforms too.
+        if (!m_indirect_draws) {
+            command_buffer.drawIndexed(item.index_count, item.instance_count, item.first_index,
+                                       item.vertex_offset, item.first_transform);
+            if (predicated) {
+                endPredicatedDraw(command_buffer);
+            }
+            ++i;
+            continue;
+        }
+
+        // Otherwise the parameters are already in the draw buffer, and every run of draws that
+        // use the same buffers and pipeline goes out as a single multi-draw
+        uint32_t run = 1;
+        while (!predicated && i + run < end
+               && m_draw_list[i + run].occlusion_predicate == no_occlusion_predicate
+               && m_draw_list[i + run].vertex_buffer == item.vertex_buffer
+               && m_draw_list[i + run].index_buffer == item.index_buffer
+               && m_draw_list[i + run].index_type == item.index_type
+               && m_draw_list[i + run].shading_rate == item.shading_rate
+               && pipelineof(m_draw_list[i + run]) == pipeline) {
+            ++run;
+        }
+
+        const uint32_t stride  = sizeof(vk::DrawIndexedIndirectCommand);
+        bool           counted = false;
+
+#if defined(VK_KHR_draw_indirect_count)
+        // When the frame has been culled on the GPU, the draws and their count are wherever the
+        // culling shader put them. There is at most one per instance or meshlet.
+        if (m_gpu_culled) {
+            m_draw_indexed_indirect_count(static_cast<VkCommandBuffer>(command_buffer),
+                                          static_cast<VkBuffer>(m_culling.buffer()),
+                                          m_culling.commandOffset(),
+                                          static_cast<VkBuffer>(m_culling.buffer()),
+                                          m_culling.countOffset(), m_culling.count(), stride);
+            counted = true;
+        } else if (m_draw_indexed_indirect_count && run == m_draws.count()) {
+            // Otherwise, when a single run covers the whole frame the count can come from the
+            // draw buffer
+            m_draw_indexed_indirect_count(static_cast<VkCommandBuffer>(command_buffer),
+                                          static_cast<VkBuffer>(m_draws.buffer()),
+                                          m_draws.commandOffset(i),
+                                          static_cast<VkBuffer>(m_draws.buffer()),
+                                          m_draws.countOffset(), m_draws.capacity(), stride);
+            counted = true;
+        }
+#endif
+
+        if (!counted) {
+            command_buffer.drawIndexedIndirect(m_draws.buffer(), m_draws.commandOffset(i), run,
+                                               stride);
+        }
+        if (predicated) {
+            endPredicatedDraw(command_buffer);
+        }
+
+        i += run;
+    }
+}
+
+/*
+Splits the draw list into one slice per recording thread and records the slices in parallel on the
+job scheduler. Every slice is recorded into a secondary command buffer from its own command pool,
+since pools can't be used from more than one thread at a time, and the primary command buffer then
+only executes them in order.
+
+With setCachedDraws a draw list below parallel_recording_threshold is a single slice, and a slice
+whose signature is the same as the last time its frame in flight recorded it isn't recorded at all.
+Those buffers don't name the framebuffer, so they go with any swap chain image.
+
+With the depth prepass every thread records its slice's prepass into a second buffer, and those of
+every slice are executed before any of the draws.
+*/
+void
+renderer::recordParallelDraws(vk::CommandBuffer primary,
+                              uint32_t          imageindex,
+                              uint32_t          uniformoffset)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    auto inheritance = vk::CommandBufferInheritanceInfo();
+    if (!m_dynamic_rendering) {
+        inheritance.setRenderPass(m_render_pass).setSubpass(geometry_subpass);
+        if (!m_cached_draws) {
+            inheritance.setFramebuffer(m_swapchain_framebuffers[imageindex]);
+        }
+    }
+
+    // Without a render pass the secondaries only know what they draw into by its formats
+#if defined(VK_KHR_dynamic_rendering)
+    auto rendering = vk::CommandBufferInheritanceRenderingInfoKHR()
+                       .setViewMask(viewMask())
+                       .setColorAttachmentCount(1)
+                       .setPColorAttachmentFormats(&m_swapchain_image_format)
+                       .setDepthAttachmentFormat(m_depth_format)
+                       .setRasterizationSamples(m_samples);
+    if (m_dynamic_rendering) {
+        inheritance.setPNext(&rendering);
+    }
+#endif
+    if (m_inherited_queries) {
+        inheritance.setPipelineStatistics(m_profiler.statisticsFlags());
+    }
+
+    // Only a frame in flight's own submissions execute its cached buffers, after its fence
+    auto begininfo = vk::CommandBufferBeginInfo()
+                       .setFlags(m_cached_draws
+                                   ? vk::CommandBufferUsageFlagBits::eRenderPassContinue
+                                   : vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+                                       | vk::CommandBufferUsageFlagBits::eRenderPassContinue)
+                       .setPInheritanceInfo(&inheritance);
+
+    const auto& secondaries = m_secondary_command_buffers[m_current_frame];
+    auto&       signatures  = m_secondary_signatures[m_current_frame];
+
+    // The draws' buffers, then the prepass's
+    const uint32_t threads = (uint32_t)secondaries.size() / 2;
+    const uint32_t total   = (uint32_t)m_draw_list.size();
+    const uint32_t slices  = total >= parallel_recording_threshold ? threads : 1;
+    const uint32_t per     = (total + slices - 1) / slices;
+
+    auto record = [&](uint32_t slice, bool prepass) {
+        uint32_t          first  = std::min(total, slice * per);
+        uint32_t          count  = std::min(total - first, per);
+        uint32_t          index  = prepass ? threads + slice : slice;
+        vk::CommandBuffer buffer = secondaries[index];
+
+        if (m_cached_draws) {
+            const uint64_t signature = drawSliceSignature(uniformoffset, first, count, prepass);
+            if (signature == signatures[index]) {
+                return;
+            }
+            signatures[index] = signature;
+        }
+
+        recordCommandBuffer(buffer, begininfo,
+                            [&]() { recordDraws(buffer, uniformoffset, first, count, prepass); });
+    };
+
+    // The calling thread records slices as well while it waits
+    m_jobs.parallelFor(0, slices, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t slice = begin; slice < end; ++slice) {
+            if (m_depth_prepass) {
+                record(slice, true);
+            }
+            record(slice, false);
+        }
+    });
+
+    if (m_depth_prepass) {
+        primary.executeCommands(slices, secondaries.data() + threads);
+    }
+    primary.executeCommands(slices, secondaries.data());
+
+    // With deferred shading they're drawn in the lighting subpass instead. Their draw is the same
+    // every frame, but what it reads may not be, so it's recorded every time.
+    if (lateDraws() && !m_deferred_shading) {
+        vk::CommandBuffer buffer = m_late_command_buffers[m_current_frame];
+        begininfo.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+                           | vk::CommandBufferUsageFlagBits::eRenderPassContinue);
+        recordCommandBuffer(buffer, begininfo, [&]() { recordLateDraws(buffer); });
+        primary.executeCommands(buffer);
+    }
+}
+
+/*
+Everything a slice of the draw list records that can change from frame to frame: what the items
+bind, what they draw unless the parameters are in the draw buffer, and what the whole slice binds
+and draws into. Pipelines and render passes are destroyed and their handles may come back as new
+ones, so those changing goes through invalidateCachedDraws instead.
+*/
+uint64_t
+renderer::drawSliceSignature(uint32_t uniformoffset,
+                             uint32_t first,
+                             uint32_t count,
+                             bool     prepass) const
+{
+    const uint32_t instanceoffset = m_draws.instanceOffset();
+    const uint32_t draws          = m_draws.count();
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash          = fnv1a(hash, &prepass, sizeof(prepass));
+    hash          = fnv1a(hash, &first, sizeof(first));
+    hash          = fnv1a(hash, &count, sizeof(count));
+    hash          = fnv1a(hash, &draws, sizeof(draws));
+    hash          = fnv1a(hash, &uniformoffset, sizeof(uniformoffset));
+    hash          = fnv1a(hash, &instanceoffset, sizeof(instanceoffset));
+    hash          = fnv1a(hash, &m_render_extent, sizeof(m_render_extent));
+
+    for (uint32_t i = first; i < first + count; ++i) {
+        const draw_item&   item     = m_draw_list[i];
+        const vk::Pipeline pipeline = prepass ? item.prepass_pipeline : item.pipeline;
+        hash                        = fnv1a(hash, &pipeline, sizeof(pipeline));
+        hash                        = fnv1a(hash, &item.vertex_buffer, sizeof(item.vertex_buffer));
+        hash                        = fnv1a(hash, &item.index_buffer, sizeof(item.index_buffer));
+        hash                        = fnv1a(hash, &item.index_type, sizeof(item.index_type));
+        hash                        = fnv1a(hash, &item.occlusion_predicate,
+                                            sizeof(item.occlusion_predicate));
+
+        if (!m_indirect_draws) {
+            hash = fnv1a(hash, &item.index_count, sizeof(item.index_count));
+            hash = fnv1a(hash, &item.instance_count, sizeof(item.instance_count));
+            hash = fnv1a(hash, &item.first_index, sizeof(item.first_index));
+            hash = fnv1a(hash, &item.vertex_offset, sizeof(item.vertex_offset));
+            hash = fnv1a(hash, &item.first_transform, sizeof(item.first_transform));
+        }
+    }
+
+    // 0 is what a buffer that has to be recorded again has
+    return hash != 0 ? hash : 1;
+}
+
+// Every cached secondary command buffer is recorded again the next time its frame in flight draws
+void
+renderer::invalidateCachedDraws()
+{
+    for (std::vector<uint64_t>& signatures : m_secondary_signatures) {
+        std::fill(signatures.begin(), signatures.end(), 0);
+    }
+}
+
+/*
+Semaphores are a synchronization primitive that can be used to insert a dependency between batches
+submitted to queues. Semaphores have two states - signaled and unsignaled. The state of a semaphore
+can be signaled after execution of a batch of commands is completed. A batch can wait for a
+semaphore to become signaled before it begins execution, and the semaphore is also unsignaled before
+the batch begins execution.
+
+As with most objects in Vulkan, semaphores are an interface to internal data which is typically
+opaque to applications. This internal data is referred to as a semaphores payload.
+
+However, in order to enable communication with agents outside of the current device, it is necessary
+to be able to export that payload to a commonly understood format, and subsequently import from that
+format as well.
+
+The internal data of a semaphore may include a reference to any resources and pending work
+associated with signal or unsignal operations performed on that semaphore object. Mechanisms to
+import and export that internal data to and from semaphores are provided below. These mechanisms
+indirectly enable applications to share semaphore state between two or more semaphores and other
+synchronization primitives across process and API boundaries.
+
+Semaphores are fundamentally a GPU-GPU synchronisation object
+
+https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#synchronization-semaphores
+*/
+void
+renderer::createSemaphores()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    for (uint32_t i = 0; i < m_frames_in_flight; ++i) {
+        m_image_available_semaphores.push_back(
+          m_device.createSemaphore(vk::SemaphoreCreateInfo(), hostAllocator()));
+        m_render_finished_semaphores.push_back(
+          m_device.createSemaphore(vk::SemaphoreCreateInfo(), hostAllocator()));
+    }
+}
+
+/*
+To perform CPU-GPU synchronization, Vulkan offers a second type of synchronization primitive called
+fences. Fences are similar to semaphores in the sense that they can be signaled and waited for, but
+this time we actually wait for them in our own code.
+
+https://www.khronos.org/registry/vulkan/specs/1.0-wsi_extensions/html/vkspec.html#synchronization-fences
+
+With timeline semaphores one of them counts the frames that have finished instead.
+*/
+void
+renderer::createFences()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    if (m_timeline_semaphores) {
+        m_frame_timeline.init(m_device);
+        return;
+    }
+
+    for (uint32_t i = 0; i < m_frames_in_flight; ++i) {
+        auto fenceinfo = vk::FenceCreateInfo()
+                           // we create this fence already signalled, which it isn't by default
+                           .setFlags(vk::FenceCreateFlagBits::eSignaled);
+        m_in_flight_fences.push_back(m_device.createFence(fenceinfo, hostAllocator()));
+    }
+}
+
+/*
+The fast start's first frame: one of the swap chain images cleared to the clear color and presented
+as soon as there is a swap chain to present to, while the pipelines, textures and meshes are still
+being created and uploaded. Drawing anything would need most of them, so it takes a transfer clear
+and the first frame's semaphores, which are unsignalled again by the time that frame uses them.
+
+The clear is over almost as soon as it is submitted, so it is waited for right away and nothing it
+used has to outlive this. A swap chain that can't be cleared, or is out of date already, just goes
+without the splash frame.
+*/
+void
+renderer::presentSplashFrame()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    if (!m_splash_frame) {
+        return;
+    }
+
+    vk::Semaphore acquired = m_image_available_semaphores[0];
+    vk::Semaphore cleared  = m_render_finished_semaphores[0];
+
+    uint32_t imageindex = 0;
+    try {
+        imageindex = m_device
+                       .acquireNextImageKHR(m_swapchain, std::numeric_limits<uint64_t>::max(),
+                                            acquired, nullptr)
+                       .value;
+    } catch (const vk::OutOfDateKHRError&) {
+        return;
+    }
+    vk::Image image = m_swapchain_images[imageindex];
+
+    vk::CommandBuffer commandbuffer =
+      m_device
+        .allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+                                  .setCommandPool(m_command_pools[0])
+                                  .setLevel(vk::CommandBufferLevel::ePrimary)
+                                  .setCommandBufferCount(1))
+        .front();
+    commandbuffer.begin(
+      vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+    auto range = vk::ImageSubresourceRange()
+                   .setAspectMask(vk::ImageAspectFlagBits::eColor)
+                   .setLevelCount(1)
+                   .setLayerCount(1);
+    auto barrier = vk::ImageMemoryBarrier()
+                     .setOldLayout(vk::ImageLayout::eUndefined)
+                     .setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+                     .setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+                     .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                     .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                     .setImage(image)
+                     .setSubresourceRange(range);
+    commandbuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                  vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(),
+                                  nullptr, nullptr, barrier);
+
+    commandbuffer.clearColorImage(image, vk::ImageLayout::eTransferDstOptimal,
+                                  vk::ClearColorValue(std::array<float, 4>{ 0.f, 0.f, 0.f, 1.f }),
+                                  range);
+
+    barrier.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+      .setNewLayout(vk::ImageLayout::ePresentSrcKHR)
+      .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+      .setDstAccessMask(vk::AccessFlags());
+    commandbuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                  vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(),
+                                  nullptr, nullptr, barrier);
+    commandbuffer.end();
+
+    vk::Fence done = m_device.createFence(vk::FenceCreateInfo(), hostAllocator());
+
+    // The layout transition waits for the image to be acquired, so the clear does as well
+    const vk::PipelineStageFlags waitstage = vk::PipelineStageFlagBits::eTransfer;
+    m_graphics_queue.submit(vk::SubmitInfo()
+                              .setWaitSemaphoreCount(1)
+                              .setPWaitSemaphores(&acquired)
+                              .setPWaitDstStageMask(&waitstage)
+                              .setCommandBufferCount(1)
+                              .setPCommandBuffers(&commandbuffer)
+                              .setSignalSemaphoreCount(1)
+                              .setPSignalSemaphores(&cleared),
+                            done);
+
+    try {
+        m_presentation_queue.presentKHR(vk::PresentInfoKHR()
+                                          .setWaitSemaphoreCount(1)
+                                          .setPWaitSemaphores(&cleared)
+                                          .setSwapchainCount(1)
+                                          .setPSwapchains(&m_swapchain)
+                                          .setPImageIndices(&imageindex));
+        reportFirstFrame("Splash frame");
+    } catch (const vk::OutOfDateKHRError&) {
+        // The first frame finds out as well, and recreates the swap chain
+    }
+
+    if (m_device.waitForFences(done, true, m_pacing.frame_timeout_ns) != vk::Result::eSuccess) {
+        throw std::runtime_error("The splash frame didn't finish rendering in time!");
+    }
+    m_device.destroyFence(done, hostAllocator());
+    m_device.freeCommandBuffers(m_command_pools[0], commandbuffer);
+}
+
+// Time to first frame counts from run() or benchmark(), so creating the window is part of it
+void
+renderer::reportFirstFrame(const char* what)
+{
+    if (m_first_frame) {
+        return;
+    }
+    m_first_frame = true;
+
+    core::logInfo() << what << " presented after "
+                    << (double)(core::profileNow() - m_start_time) / 1e6 << " ms";
+}
+
+/*
+Writes the startup report, see startup_report, once the first frame of the scene is presented. Not
+at the splash frame, which goes ahead of most of initVulkan's steps, and only the first time.
+*/
+void
+renderer::reportStartup()
+{
+    if (!m_startup.recording()) {
+        return;
+    }
+
+    if (m_startup.write(core::profileNow(), startup_report_path, startup_trace_path)) {
+        core::logInfo() << "Startup report written to " << startup_report_path << " and "
+                        << startup_trace_path;
+    } else {
+        core::logWarning() << "Couldn't write the startup report to " << startup_report_path
+                           << " and " << startup_trace_path;
+    }
+}
+
+/*
+The queue families using the draw buffer and the Hi-Z pyramid: the graphics family, and the compute
+family when culling asynchronously. Both are written on one queue and read on the other every
+frame, so they are shared concurrently rather than transferred back and forth.
+*/
+std::vector<uint32_t>
+renderer::cullingFamilies()
+{
+    const bool            group    = deviceCount() > 1;
+    auto                  indices  = findQueueFamilies(m_physical_device, m_surface, group);
+    std::vector<uint32_t> families = { (uint32_t)indices.graphicsFamily() };
+    if (m_async_compute) {
+        families.push_back(indices.computeFamily());
+    }
+    return families;
+}
+
+/*
+Buffers in Vulkan are regions of memory used for storing arbitrary data that can be read by the
+graphics card. They can be used to store vertex data, which we'll do in this chapter, but they can
+also be used for many other purposes that we'll explore in future chapters. Unlike the Vulkan
+objects we've been dealing with so far, buffers do not automatically allocate memory for themselves.
+The work from the previous chapters has shown that the Vulkan API puts the programmer in control of
+almost everything and memory management is one of those things.
+
+Rather than a vertex and index buffer per mesh, there is one of each for all meshes, and every mesh
+takes a range of them. Binding them once covers every draw, which is what lets consecutive draws be
+merged into a single indirect draw.
+
+https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkCreateBuffer
+*/
+void
+renderer::createGeometryPool(const std::vector<uint32_t>& queue_families)
+{
+    // The buffers are allocated from a memory type that is device local, which unless all of VRAM
+    // is host visible means that we're not able to use vkMapMemory. However, we can copy data from
+    // the staging arena to them, so the pool adds the transfer destination flag to the vertex and
+    // index buffer usage.
+    // Its units are 16 bit indices, and 4 bytes of position along with 8 of the other attributes,
+    // of which full vertices take three and packed ones two. Either format's attributes are
+    // padded to match, which only costs memory: the positions, which are all the shadow passes
+    // read, are as tightly packed as they were interleaved.
+    const vk::DeviceSize positionunit  = geometry_position_unit;
+    const vk::DeviceSize attributeunit = 8;
+    static_assert(sizeof(vertex_position) / 4 == sizeof(vertex_attributes) / 8,
+                  "Vertex streams have to take the same units");
+    static_assert(sizeof(packed_position) / 4 == sizeof(packed_attributes) / 8,
+                  "Vertex streams have to take the same units");
+
+    m_geometry.init(m_device, m_allocator, queue_families, positionunit, attributeunit,
+                    geometry_pool_vertices * (uint32_t)(sizeof(vertex_position) / positionunit),
+                    geometry_pool_indices * 2, m_ray_query);
+}
+
+/*
+Copies the mesh's vertices and indices into a range of the geometry pool and remembers it in
+`mesh.geometry`. The range is only read once the upload batch has been submitted.
+*/
+void
+renderer::uploadMesh(upload_batch& uploads, Mesh& mesh)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const bool packed = mesh.format == vertex_format::packed;
+
+    // Most meshes have few enough vertices for 16 bit indices, which take half the memory and
+    // bandwidth. The mesh keeps its 32 bit ones, they are only narrowed on the way to the GPU.
+    const bool shortindices = mesh.vertices.size() <= std::numeric_limits<uint16_t>::max() + 1u;
+
+    mesh.geometry = m_geometry.allocate(
+      (uint32_t)mesh.vertices.size(), (uint32_t)mesh.indices.size(),
+      packed ? sizeof(packed_position) : sizeof(vertex_position),
+      packed ? sizeof(packed_attributes) : sizeof(vertex_attributes),
+      shortindices ? vk::IndexType::eUint16 : vk::IndexType::eUint32);
+
+    if (!mesh.geometry) {
+        throw std::runtime_error("Geometry pool is out of space!");
+    }
+
+    mesh.radius     = 0.f;
+    mesh.bounds_min = mesh.vertices.empty() ? glm::vec3(0.f) : mesh.vertices[0].pos;
+    mesh.bounds_max = mesh.bounds_min;
+    for (const Vertex& vertex : mesh.vertices) {
+        mesh.radius     = std::max(mesh.radius, glm::length(vertex.pos));
+        mesh.bounds_min = glm::min(mesh.bounds_min, vertex.pos);
+        mesh.bounds_max = glm::max(mesh.bounds_max, vertex.pos);
+    }
+
+    // Now we copy the vertex data into the staging arena
+    // You can now simply memcpy the vertex data to the mapped memory and unmap it again using
+    // vkUnmapMemory. Unfortunately the driver may not immediately copy the data into the buffer
+    // memory, for example because of caching. It is also possible that writes to the buffer are not
+    // visible in the mapped memory yet. There are two ways to deal with that problem:
+    //  - Use a memory heap that is host coherent, indicated with
+    //  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+    //  - Call vkFlushMappedMemoryRanges to after writing to the mapped memory, and call
+    //  vkInvalidateMappedMemoryRanges before reading from the mapped memory
+    // We went for the first approach, which ensures that the mapped memory always matches the
+    // contents of the allocated memory. Do keep in mind that this may lead to slightly worse
+    // performance than explicit flushing, but we'll see why that doesn't matter in the next
+    // chapter.
+    // Instead of creating a staging buffer per upload, the data is bump-allocated out of the
+    // renderer's persistently mapped staging arena.
+    // Packed vertices are relative to the bounds, so only now can they be packed. Either way
+    // they're split into the pool's two streams.
+    std::vector<vertex_position>   fullpositions;
+    std::vector<vertex_attributes> fullattributes;
+    std::vector<packed_position>   packedpositions;
+    std::vector<packed_attributes> packedattributes;
+    const void*                    positiondata;
+    const void*                    attributedata;
+    vk::DeviceSize                 positionbytes;
+    vk::DeviceSize                 attributebytes;
+    if (packed) {
+        packVertices(mesh, packedpositions, packedattributes);
+        mesh.dequantize = dequantizeTransform(mesh);
+
+        positiondata   = packedpositions.data();
+        attributedata  = packedattributes.data();
+        positionbytes  = sizeof(packed_position) * packedpositions.size();
+        attributebytes = sizeof(packed_attributes) * packedattributes.size();
+    } else {
+        fullpositions.reserve(mesh.vertices.size());
+        fullattributes.reserve(mesh.vertices.size());
+        for (const Vertex& vertex : mesh.vertices) {
+            fullpositions.push_back({ vertex.pos });
+            fullattributes.push_back({ vertex.color, vertex.texcoord });
+        }
+
+        positiondata   = fullpositions.data();
+        attributedata  = fullattributes.data();
+        positionbytes  = sizeof(vertex_position) * fullpositions.size();
+        attributebytes = sizeof(vertex_attributes) * fullattributes.size();
+    }
+    std::vector<uint16_t> shorts;
+    const void*           indexdata  = mesh.indices.data();
+    vk::DeviceSize        indexbytes = sizeof(uint32_t) * mesh.indices.size();
+    if (shortindices) {
+        shorts.assign(mesh.indices.begin(), mesh.indices.end());
+        indexdata  = shorts.data();
+        indexbytes = sizeof(uint16_t) * shorts.size();
+    }
+
+    // On integrated GPUs and with resizable BAR the pool is mapped, and staging would only be a
+    // second copy of the mesh
+    if (m_geometry.direct()) {
+        m_geometry.write(mesh.geometry, positiondata, positionbytes, attributedata,
+                         attributebytes, indexdata, indexbytes);
+        return;
+    }
+
+    staging_region positions  = stage(uploads, positiondata, positionbytes);
+    staging_region attributes = stage(uploads, attributedata, attributebytes);
+    staging_region indices    = stage(uploads, indexdata, indexbytes);
+    m_geometry.upload(uploads, mesh.geometry, positions, attributes, indices);
+
+    // All that remains now is binding the pool's buffers during rendering operations. The staging
+    // arena has its own copy of the mesh, so the host's can go before the upload has even been
+    // submitted.
+}
+
+Mesh
+Mesh::drawable() const
+{
+    Mesh copy;
+    copy.lods       = lods;
+    copy.meshlets   = meshlets;
+    copy.materials  = materials;
+    copy.submeshes  = submeshes;
+    copy.textures   = textures;
+    copy.geometry   = geometry;
+    copy.radius     = radius;
+    copy.bounds_min = bounds_min;
+    copy.bounds_max = bounds_max;
+    copy.format     = format;
+    copy.dequantize = dequantize;
+    return copy;
+}
+
+/*
+Builds the skinned test mesh, a tapering tentacle standing on its root with a joint every so often
+along it, whose clip sways it back and forth in a wave going up. Every vertex is weighted between
+the two joints around its ring. The instances are copies of it in a spiral around the scene, each
+with a range of the geometry pool of its own for the skinning to write to, and bounds that take in
+wherever it bends to.
+*/
+void
+renderer::createSkinnedInstances(upload_batch& uploads)
+{
+    if (m_skinned_count == 0) {
+        return;
+    }
+
+    SHINY_PROFILE_FUNCTION();
+    const core::startup_scope startup(&m_startup, "asset", "skinned instances");
+
+    const float bone = skinned_height / (float)skinned_joints;
+
+    std::vector<Vertex>         vertices;
+    std::vector<skinned_source> sources;
+    for (uint32_t r = 0; r < skinned_rings; ++r) {
+        const float along  = (float)r / (float)(skinned_rings - 1);
+        const float z      = skinned_height * along;
+        const float radius = skinned_radius * (1.f - 0.6f * along);
+
+        const float    position = z / bone;
+        const uint32_t joint    = std::min((uint32_t)position, skinned_joints - 1);
+        const uint32_t next     = std::min(joint + 1, skinned_joints - 1);
+        const uint8_t  weight   = (uint8_t)std::lround(
+          std::clamp(position - (float)joint, 0.f, 1.f) * (next != joint ? 255.f : 0.f));
+
+        for (uint32_t side = 0; side < skinned_sides; ++side) {
+            const float angle = 6.2831853f * (float)side / (float)skinned_sides;
+
+            Vertex vertex;
+            vertex.pos      = glm::vec3(radius * std::cos(angle), radius * std::sin(angle), z);
+            vertex.color    = glm::mix(glm::vec3(0.9f, 0.4f, 0.3f), glm::vec3(1.f, 0.8f, 0.4f),
+                                       along);
+            vertex.texcoord = glm::vec2((float)side / (float)skinned_sides, along);
+            vertices.push_back(vertex);
+
+            skinned_source source;
+            source.position        = vertex.pos;
+            source.skin.joints[0]  = (uint8_t)joint;
+            source.skin.joints[1]  = (uint8_t)next;
+            source.skin.weights[0] = (uint8_t)(255 - weight);
+            source.skin.weights[1] = weight;
+            sources.push_back(source);
+        }
+    }
+
+    // Counterclockwise from outside
+    std::vector<uint32_t> indices;
+    for (uint32_t r = 0; r + 1 < skinned_rings; ++r) {
+        for (uint32_t side = 0; side < skinned_sides; ++side) {
+            const uint32_t a = r * skinned_sides + side;
+            const uint32_t b = r * skinned_sides + (side + 1) % skinned_sides;
+            const uint32_t c = a + skinned_sides;
+            const uint32_t d = b + skinned_sides;
+            indices.insert(indices.end(), { a, b, d, a, d, c });
+        }
+    }
+
+    // A chain of joints, each bone's length above its parent, swaying around both horizontal axes
+    // a little later the further up it is
+    m_skeleton.parents.clear();
+    m_skeleton.inverse_bind.clear();
+    for (uint32_t j = 0; j < skinned_joints; ++j) {
+        m_skeleton.parents.push_back(j == 0 ? ~0u : j - 1);
+        m_skeleton.inverse_bind.push_back(
+          glm::translate(glm::mat4(1.f), glm::vec3(0.f, 0.f, -bone * (float)j)));
+    }
+
+    // And a second clip of it curling up around one of them, which every instance blends into
+    // the swaying by a weight of its own
+    animation_clip sway;
+    animation_clip curl;
+    for (animation_clip* clip : { &sway, &curl }) {
+        clip->duration    = skinned_seconds;
+        clip->frame_count = skinned_frames;
+    }
+    for (uint32_t frame = 0; frame < skinned_frames; ++frame) {
+        for (uint32_t j = 0; j < skinned_joints; ++j) {
+            const float phase = 6.2831853f * (float)frame / (float)skinned_frames - 0.6f * (float)j;
+
+            joint_pose pose;
+            pose.translation = glm::vec3(0.f, 0.f, j == 0 ? 0.f : bone);
+            pose.rotation    = glm::angleAxis(0.25f * std::sin(phase), glm::vec3(1.f, 0.f, 0.f))
+                            * glm::angleAxis(0.15f * std::cos(phase), glm::vec3(0.f, 1.f, 0.f));
+            sway.poses.push_back(pose);
+
+            pose.rotation = glm::angleAxis(0.2f + 0.2f * std::sin(phase), glm::vec3(1.f, 0.f, 0.f));
+            curl.poses.push_back(pose);
+        }
+    }
+    m_animator.init(m_skeleton);
+    const uint32_t swayclip = m_animator.addClip(compressClip(sway, skinned_joints));
+    const uint32_t curlclip = m_animator.addClip(compressClip(curl, skinned_joints));
+
+    m_skin_source = m_skinning.allocate((uint32_t)sources.size());
+    m_skinning.upload(uploads, m_skin_source,
+                      stage(uploads, sources.data(), sizeof(skinned_source) * sources.size()));
+
+    // Spread out by the golden angle, further out the more there are
+    const float reach = skinned_height + skinned_radius;
+    m_skinned_meshes.clear();
+    m_skinned_transforms.clear();
+    for (uint32_t i = 0; i < m_skinned_count; ++i) {
+        Mesh mesh(std::vector<Vertex>(vertices), std::vector<uint32_t>(indices));
+        uploadMesh(uploads, mesh);
+        if (!m_keep_mesh_data) {
+            mesh.releaseHostData();
+        }
+        mesh.radius     = reach;
+        mesh.bounds_min = glm::vec3(-reach);
+        mesh.bounds_max = glm::vec3(reach);
+        m_skinned_meshes.push_back(std::move(mesh));
+
+        const float angle  = 2.3999632f * (float)i;
+        const float radius = 1.f + 0.15f * std::sqrt((float)i);
+        m_skinned_transforms.push_back(glm::translate(
+          glm::mat4(1.f), glm::vec3(radius * std::cos(angle), radius * std::sin(angle), -0.5f)));
+
+        animated_character character;
+        character.clip     = swayclip;
+        character.blend    = curlclip;
+        character.weight   = (float)(i % 4) / 4.f;
+        character.offset   = 0.37f * (float)i;
+        character.position = glm::vec3(m_skinned_transforms.back()[3]);
+        m_animator.add(character);
+    }
+}
+
+/*
+The test entities are small copies of the test mesh in a disc below the scene, spread out by the
+golden angle like the skinned instances, with every so often one that spins. Their bounds are left
+for the first updateEntities() to work out, since every transform is new to it.
+*/
+void
+renderer::createEntities()
+{
+    // Which loading a model would have made
+    if (m_mesh_node == scene::scene_graph::invalid_handle) {
+        m_mesh_node = m_scene.create();
+    }
+
+    for (uint32_t i = 0; i < m_entity_count; ++i) {
+        const float     angle  = 2.3999632f * (float)i;
+        const float     radius = 1.5f + 0.1f * std::sqrt((float)i);
+        const glm::vec3 position(radius * std::cos(angle), radius * std::sin(angle), -1.f);
+
+        object_transform transform;
+        transform.world =
+          glm::scale(glm::translate(glm::mat4(1.f), position), glm::vec3(entity_scale));
+        transform.previous = transform.world;
+
+        const scene::entity e =
+          m_entities.create(transform, object_bounds(), object_mesh{ &m_mesh },
+                            object_material{ m_texture });
+        if (i % spinning_share == 0) {
+            object_spin spin;
+            spin.position = position;
+            spin.speed    = glm::radians(45.f) * (float)(1 + i % 3);
+            m_entities.add(e, spin);
+        }
+    }
+}
+
+/*
+The stress scene's cubes stand in a grid centred below the origin, layer under layer, as entities
+like the ones above, so they take the same way through the entity world and, if it's enabled, the
+render scene. There are only ever as many as the instance buffers have room for next to everything
+else. Their textures are generated rather than read, and go through the texture cache under made up
+paths, as many as there are bindless slots left for; the random choices come from a fixed seed, so
+every run draws the same scene.
+*/
+void
+renderer::createStressScene(upload_batch& uploads)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const uint64_t requested = (uint64_t)m_stress.columns * m_stress.rows * m_stress.layers;
+    if (requested == 0) {
+        return;
+    }
+    const core::startup_scope startup(&m_startup, "asset", "stress scene");
+
+    const uint32_t capacity =
+      m_render_scene_enabled ? max_scene_instances : max_instances_per_frame;
+    const uint32_t taken = 1 + m_skinned_count + m_entity_count;
+    const uint32_t count =
+      taken < capacity ? (uint32_t)std::min<uint64_t>(requested, capacity - taken) : 0;
+    if (count < requested) {
+        core::logWarning() << "stress scene: only room for " << count << " of " << requested
+                           << " cubes";
+    }
+
+    m_stress_mesh = stressCube();
+    uploadMesh(uploads, m_stress_mesh);
+    if (!m_keep_mesh_data) {
+        m_stress_mesh.releaseHostData();
+    }
+
+    for (uint32_t i = 0; i < m_stress.textures; ++i) {
+        texture_data         data    = stressTexture(i);
+        const texture_handle texture = acquireTexture(
+          uploads, "stress/checker " + std::to_string(i), &data);
+        if (texture == resource_cache<texture_streamer::handle>::invalid_handle) {
+            break;
+        }
+        m_stress_textures.push_back(texture);
+    }
+
+    if (m_mesh_node == scene::scene_graph::invalid_handle) {
+        m_mesh_node = m_scene.create();
+    }
+
+    const float     spacing = m_stress.spacing;
+    const float     size    = spacing * 0.5f;
+    const glm::vec3 corner(-0.5f * spacing * (float)(m_stress.columns - 1),
+                           -0.5f * spacing * (float)(m_stress.rows - 1),
+                           -1.5f);
+
+    std::mt19937                          random(1234);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint32_t  column = i % m_stress.columns;
+        const uint32_t  row    = i / m_stress.columns % m_stress.rows;
+        const uint32_t  layer  = i / m_stress.columns / m_stress.rows;
+        const glm::vec3 position =
+          corner + glm::vec3((float)column, (float)row, -(float)layer) * spacing;
+
+        object_transform transform;
+        transform.world    = glm::scale(glm::translate(glm::mat4(1.f), position), glm::vec3(size));
+        transform.previous = transform.world;
+
+        const texture_handle texture =
+          m_stress_textures.empty()
+            ? m_texture
+            : m_stress_textures[random() % (uint32_t)m_stress_textures.size()];
+
+        const scene::entity e =
+          m_entities.create(transform, object_bounds(), object_mesh{ &m_stress_mesh },
+                            object_material{ texture });
+        if (m_calibration_scene) {
+            m_calibration_entities.push_back(e);
+        }
+        if (unit(random) < m_stress.moving) {
+            object_spin spin;
+            spin.position = position;
+            spin.speed    = glm::radians(30.f + 60.f * unit(random));
+            spin.scale    = size;
+            m_entities.add(e, spin);
+        }
+    }
+
+    // The lights and the camera path cover the grid's width, but never so far that the camera
+    // ends up behind the far plane. A grid that is only there for calibrating leaves them where the
+    // rest of the scene has them.
+    if (m_calibration_scene) {
+        return;
+    }
+    const float width = spacing * (float)std::max(m_stress.columns, m_stress.rows);
+    m_scene_center    = glm::vec3(0.f, 0.f, corner.z + spacing);
+    m_scene_extent    = glm::clamp(0.25f * width, 1.f, 0.2f * far_plane);
+}
+
+/*
+The instances that don't spin come first in the file, so they go into the entity world as a few
+arrays per chunk, copied straight out of the mapping without an entity's worth of bookkeeping at a
+time. The spinning ones at the end are added one by one like the test entities, with their spin
+taking up where their transform left off. Like the stress scene, there are only ever as many as
+the instance buffers have room for, and their bounds are left for the first updateEntities().
+*/
+void
+renderer::loadScene(upload_batch& uploads)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    if (m_scene_path.empty()) {
+        return;
+    }
+    const core::startup_scope startup(&m_startup, "asset", "scene " + m_scene_path);
+
+    scene::scene_file file;
+    if (!file.open(m_scene_path)) {
+        core::logWarning() << "Scene is off, " << m_scene_path << " isn't a scene file";
+        return;
+    }
+    const scene::scene_file_header& header = file.header();
+
+    std::vector<const Mesh*> meshes(header.meshes, &m_mesh);
+    uint32_t                 missing = 0;
+    for (uint32_t i = 0; i < header.meshes; ++i) {
+        const std::string name = file.meshName(i);
+        if (name == "stress cube" && !m_stress_mesh.geometry) {
+            m_stress_mesh = stressCube();
+            uploadMesh(uploads, m_stress_mesh);
+            if (!m_keep_mesh_data) {
+                m_stress_mesh.releaseHostData();
+            }
+        }
+        const Mesh* mesh = namedMesh(name);
+        if (mesh) {
+            meshes[i] = mesh;
+        } else {
+            ++missing;
+        }
+    }
+    if (missing > 0) {
+        core::logWarning() << "scene: " << missing << " of its meshes aren't there, the test mesh "
+                           << "is drawn instead";
+    }
+
+    // The stress scene's textures are made up, so they can be made again
+    const std::string           checker = "stress/checker ";
+    std::vector<texture_handle> textures(header.textures, m_texture);
+    for (uint32_t i = 0; i < header.textures; ++i) {
+        const std::string name    = file.textureName(i);
+        texture_handle    texture = m_texture_cache.find(name);
+        if (texture == resource_cache<texture_streamer::handle>::invalid_handle) {
+            if (name.compare(0, checker.size(), checker) == 0) {
+                texture_data data =
+                  stressTexture((uint32_t)std::strtoul(name.c_str() + checker.size(), nullptr, 10));
+                texture = acquireTexture(uploads, name, &data);
+            } else {
+                texture = acquireTextureAsync(name);
+            }
+        }
+        if (texture != resource_cache<texture_streamer::handle>::invalid_handle) {
+            textures[i] = texture;
+        }
+    }
+
+    const uint32_t capacity =
+      m_render_scene_enabled ? max_scene_instances : max_instances_per_frame;
+    const uint32_t taken = 1 + m_skinned_count + m_entities.size();
+    const uint32_t count = taken < capacity ? std::min(header.instances, capacity - taken) : 0;
+    if (count < header.instances) {
+        core::logWarning() << "scene: only room for " << count << " of " << header.instances
+                           << " instances";
+    }
+    const uint32_t still = header.instances - header.spinning;
+
+    if (m_mesh_node == scene::scene_graph::invalid_handle) {
+        m_mesh_node = m_scene.create();
+    }
+
+    const glm::mat4* worlds         = file.transforms();
+    const uint32_t*  meshindices    = file.meshIndices();
+    const uint32_t*  textureindices = file.textureIndices();
+    m_entities.createMany<object_transform, object_bounds, object_mesh, object_material>(
+      std::min(count, still),
+      [&](scene::chunk_view& chunk, uint32_t row, uint32_t first, uint32_t rows) {
+          object_transform* transforms = chunk.write<object_transform>() + row;
+          object_bounds*    bounds     = chunk.write<object_bounds>() + row;
+          object_mesh*      drawn      = chunk.write<object_mesh>() + row;
+          object_material*  materials  = chunk.write<object_material>() + row;
+          for (uint32_t i = 0; i < rows; ++i) {
+              transforms[i].world    = worlds[first + i];
+              transforms[i].previous = worlds[first + i];
+              transforms[i].moved    = 0;
+              bounds[i]              = object_bounds();
+              drawn[i].mesh          = meshes[meshindices[first + i]];
+              materials[i].texture   = textures[textureindices[first + i]];
+          }
+      });
+
+    const float* spins = file.spins();
+    for (uint32_t i = still; i < count; ++i) {
+        object_transform transform;
+        transform.world    = worlds[i];
+        transform.previous = worlds[i];
+
+        object_spin spin;
+        spin.position = glm::vec3(worlds[i][3]);
+        spin.speed    = spins[i - still];
+        spin.angle    = std::atan2(worlds[i][0].y, worlds[i][0].x);
+        spin.scale    = glm::length(glm::vec3(worlds[i][0]));
+
+        m_entities.create(transform, object_bounds(), object_mesh{ meshes[meshindices[i]] },
+                          object_material{ textures[textureindices[i]] }, spin);
+    }
+
+    // The lights and the camera path cover the instances' positions, like the stress scene's grid
+    if (count == 0) {
+        return;
+    }
+    glm::vec3 lower(std::numeric_limits<float>::max());
+    glm::vec3 upper(-std::numeric_limits<float>::max());
+    for (uint32_t i = 0; i < count; ++i) {
+        lower = glm::min(lower, glm::vec3(worlds[i][3]));
+        upper = glm::max(upper, glm::vec3(worlds[i][3]));
+    }
+    const glm::vec3 size = upper - lower;
+    m_scene_center       = 0.5f * (lower + upper);
+    m_scene_extent       = glm::clamp(0.25f * std::max(size.x, size.y), 1.f, 0.2f * far_plane);
+}
+
+/*
+Meshes and textures are numbered in the order they are first come across, and entities whose mesh
+the renderer can't name, which a session set up the same way wouldn't have, are left out.
+*/
+bool
+renderer::saveScene(const std::string& path)
+{
+    const uint32_t unnamed = std::numeric_limits<uint32_t>::max();
+
+    std::vector<std::string>                  meshnames;
+    std::vector<std::string>                  texturenames;
+    std::unordered_map<const Mesh*, uint32_t> meshes;
+    std::unordered_map<uint32_t, uint32_t>    textures;
+    std::vector<scene::scene_file_instance>   instances;
+    instances.reserve(m_entities.size());
+
+    const auto save = [&](scene::chunk_view& chunk) {
+        const object_transform* transforms = chunk.read<object_transform>();
+        const object_mesh*      drawn      = chunk.read<object_mesh>();
+        const object_material*  materials  = chunk.read<object_material>();
+        const object_spin* spins = chunk.has<object_spin>() ? chunk.read<object_spin>() : nullptr;
+        for (uint32_t row = 0; row < chunk.size(); ++row) {
+            auto mesh = meshes.find(drawn[row].mesh);
+            if (mesh == meshes.end()) {
+                const std::string name  = meshName(drawn[row].mesh);
+                const uint32_t    index = name.empty() ? unnamed : (uint32_t)meshnames.size();
+                mesh                    = meshes.emplace(drawn[row].mesh, index).first;
+                if (!name.empty()) {
+                    meshnames.push_back(name);
+                }
+            }
+            if (mesh->second == unnamed) {
+                continue;
+            }
+
+            const auto texture =
+              textures.emplace(materials[row].texture, (uint32_t)texturenames.size());
+            if (texture.second) {
+                texturenames.push_back(m_texture_cache.path(materials[row].texture));
+            }
+
+            scene::scene_file_instance instance;
+            instance.world   = transforms[row].world;
+            instance.mesh    = mesh->second;
+            instance.texture = texture.first->second;
+            instance.spin    = spins ? spins[row].speed : 0.f;
+            instances.push_back(instance);
+        }
+    };
+    m_entities.forEach<object_transform, object_mesh, object_material>(save);
+
+    return scene::writeSceneFile(path, meshnames, texturenames, instances);
+}
+
+/*
+The subjects are every mesh of the scene with every texture it is drawn with: the test mesh, and
+the stress cube with each of its checkers. Their order only depends on the scene's options, which
+is what lets an atlas cooked with the same options be drawn with them.
+*/
+void
+renderer::createImpostors(upload_batch& uploads)
+{
+    if (!m_impostors_active && !m_impostor_baking) {
+        return;
+    }
+    const core::startup_scope startup(&m_startup, "asset", "impostors");
+
+    m_impostor_subjects.clear();
+    if (m_mesh.geometry) {
+        m_impostor_subjects.push_back({ &m_mesh, m_texture_cache.get(m_texture) });
+    }
+    if (m_stress_mesh.geometry) {
+        if (m_stress_textures.empty()) {
+            m_impostor_subjects.push_back({ &m_stress_mesh, m_texture_cache.get(m_texture) });
+        }
+        for (texture_handle texture : m_stress_textures) {
+            m_impostor_subjects.push_back({ &m_stress_mesh, m_texture_cache.get(texture) });
+        }
+    }
+    if (m_impostor_subjects.size() > max_impostor_layers) {
+        m_impostor_subjects.resize(max_impostor_layers);
+    }
+
+    if (m_impostors_active) {
+        if (m_impostors.layers() != m_impostor_subjects.size()) {
+            throw std::runtime_error(m_impostor_path + " has impostors of "
+                                     + std::to_string(m_impostors.layers()) + " meshes, not "
+                                     + std::to_string(m_impostor_subjects.size()) + "!");
+        }
+        m_impostors.upload(uploads,
+                           stage(uploads, m_impostors.texelData(), m_impostors.texelSize()));
+    }
+}
+
+/*
+The entities' systems, on the jobs: the spinning ones turn every step, and then whatever moved in
+any of them gets its bounds worked out again, which is nothing at all for those that stood still.
+*/
+void
+renderer::updateEntities(uint32_t steps)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const float step = (float)m_clock.step();
+    for (uint32_t i = 0; i < steps; ++i) {
+        const uint64_t moved = m_clock.steps() - steps + i + 1;
+        const auto     spin  = [=](scene::chunk_view& chunk) {
+            object_spin*      spins      = chunk.write<object_spin>();
+            object_transform* transforms = chunk.write<object_transform>();
+            for (uint32_t row = 0; row < chunk.size(); ++row) {
+                object_spin&      turning   = spins[row];
+                object_transform& transform = transforms[row];
+
+                turning.angle = std::fmod(turning.angle + turning.speed * step, 6.2831853f);
+
+                glm::mat4 world = glm::translate(glm::mat4(1.f), turning.position);
+                world           = glm::rotate(world, turning.angle, glm::vec3(0.f, 0.f, 1.f));
+
+                transform.previous = transform.world;
+                transform.world    = glm::scale(world, glm::vec3(turning.scale));
+                transform.moved    = moved;
+            }
+        };
+        m_entities.parallelForEach<object_spin, object_transform>(m_jobs, spin);
+    }
+
+    // The same sphere drawMesh() bounds a draw of the mesh with
+    const uint32_t since = m_extracted_version;
+    m_entities.parallelForEachChanged<object_transform, object_mesh, object_bounds>(
+      m_jobs, since, [since](scene::chunk_view& chunk) {
+          const object_transform* transforms = chunk.read<object_transform>();
+          const object_mesh*      meshes     = chunk.read<object_mesh>();
+          for (uint32_t row = 0; row < chunk.size(); ++row) {
+              if (!chunk.changed<object_transform>(row, since)) {
+                  continue;
+              }
+
+              const glm::mat4& world  = transforms[row].world;
+              const Mesh&      mesh   = *meshes[row].mesh;
+              const glm::vec3  center = (mesh.bounds_min + mesh.bounds_max) * 0.5f;
+              const float      scale  = std::max({ glm::length(glm::vec3(world[0])),
+                                                   glm::length(glm::vec3(world[1])),
+                                                   glm::length(glm::vec3(world[2])) });
+
+              object_bounds& bounds = chunk.write<object_bounds>(row);
+              bounds.center         = glm::vec3(world * glm::vec4(center, 1.f));
+              bounds.radius         = glm::length(mesh.bounds_max - center) * scale;
+          }
+      });
+}
+
+/*
+Brings the entities' draws up to date with whatever of their transforms, meshes and materials
+changed since the last time, which for a mostly still scene is hardly any of them, and adds them
+all to the packet. Those that moved in the latest step are drawn between it and the one before.
+With a render scene only those that changed go in the packet, see extractSceneChanges.
+*/
+void
+renderer::extractEntities(frame_packet& packet, float alpha)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const uint32_t since = m_extracted_version;
+    m_entity_draws.resize(m_entities.indexCount());
+
+    // With a render scene, every entity whose slot is sent again, once
+    const auto markchanged = [&](uint32_t index) {
+        entity_draw& draw = m_entity_draws[index];
+        if (m_render_scene_enabled && !draw.changed) {
+            draw.changed = true;
+            m_changed_entities.push_back(index);
+        }
+    };
+
+    m_destroyed_entities.clear();
+    m_entities.destroyedSince(since, m_destroyed_entities);
+    for (scene::entity e : m_destroyed_entities) {
+        m_entity_draws[e.index].drawn = false;
+        markchanged(e.index);
+    }
+
+    // A chunk where more than one of them changed is seen more than once, but every row is only
+    // copied if it did change, which comes out the same
+    const auto extract = [&](scene::chunk_view& chunk) {
+        const object_transform* transforms = chunk.read<object_transform>();
+        const object_mesh*      meshes     = chunk.read<object_mesh>();
+        const object_material*  materials  = chunk.read<object_material>();
+        for (uint32_t row = 0; row < chunk.size(); ++row) {
+            if (!chunk.changed<object_transform>(row, since)
+                && !chunk.changed<object_mesh>(row, since)
+                && !chunk.changed<object_material>(row, since)) {
+                continue;
+            }
+
+            const uint32_t index = chunk.entityAt(row).index;
+            entity_draw&   draw  = m_entity_draws[index];
+            draw.draw     = { meshes[row].mesh, materials[row].texture, transforms[row].world,
+                              index };
+            draw.previous = transforms[row].previous;
+            draw.moved    = transforms[row].moved;
+            draw.drawn    = true;
+            markchanged(index);
+        }
+    };
+    m_entities.forEachChanged<object_transform, object_mesh, object_material>(since, extract);
+    m_entities.forEachChanged<object_mesh, object_transform, object_material>(since, extract);
+    m_entities.forEachChanged<object_material, object_transform, object_mesh>(since, extract);
+    m_extracted_version = m_entities.advanceVersion();
+
+    if (m_render_scene_enabled) {
+        extractSceneChanges(packet, alpha);
+        return;
+    }
+
+    const uint64_t latest = m_clock.steps();
+    for (const entity_draw& draw : m_entity_draws) {
+        if (!draw.drawn) {
+            continue;
+        }
+        packet.draws.push_back(draw.draw);
+        if (draw.moved == latest) {
+            packet.draws.back().transform =
+              scene::interpolateTransform(draw.previous, draw.draw.transform, alpha);
+        }
+    }
+}
+
+/*
+A render scene slot, one per entity index, is only sent when its entity changed, with one
+exception: whatever moved in the latest step is drawn between it and the step before, which is
+somewhere else every frame. Those are sent every frame until a step goes by without them moving,
+and then once more where they ended up.
+*/
+void
+renderer::extractSceneChanges(frame_packet& packet, float alpha)
+{
+    packet.scene_changes.clear();
+
+    const uint64_t latest = m_clock.steps();
+    const auto     send   = [&](uint32_t index, const entity_draw& draw, bool interpolated) {
+        scene_change change;
+        change.slot = index;
+        change.draw = draw.draw;
+        change.live = draw.drawn;
+        if (interpolated) {
+            change.draw.transform =
+              scene::interpolateTransform(draw.previous, draw.draw.transform, alpha);
+        }
+        packet.scene_changes.push_back(change);
+    };
+
+    for (uint32_t index : m_changed_entities) {
+        entity_draw& draw = m_entity_draws[index];
+        draw.changed      = false;
+        if (draw.moving) {
+            continue;
+        }
+        if (draw.drawn && draw.moved == latest) {
+            draw.moving = true;
+            m_moving_entities.push_back(index);
+            continue;
+        }
+        send(index, draw, false);
+    }
+    m_changed_entities.clear();
+
+    for (size_t i = 0; i < m_moving_entities.size();) {
+        const uint32_t index  = m_moving_entities[i];
+        entity_draw&   draw   = m_entity_draws[index];
+        const bool     moving = draw.drawn && draw.moved == latest;
+
+        send(index, draw, moving);
+        if (moving) {
+            ++i;
+            continue;
+        }
+        draw.moving          = false;
+        m_moving_entities[i] = m_moving_entities.back();
+        m_moving_entities.pop_back();
+    }
+}
+
+/*
+Takes the packet's changes into the copy of the slots that frames not drawn from the GPU draw, and
+into the render scene, which only uploads what changed. Every packet's changes have to be taken,
+whether its frame ends up drawn or not, since the next packet only has what changed after it.
+*/
+void
+renderer::applySceneChanges(const frame_packet& packet)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    for (const scene_change& change : packet.scene_changes) {
+        if (change.slot >= m_scene_draws.size()) {
+            m_scene_draws.resize(change.slot + 1);
+        }
+        m_scene_draws[change.slot] = change.live ? change.draw : draw_request();
+
+        // Without culling on the GPU there is no render scene, only the copy
+        if (!m_gpu_culling) {
+            continue;
+        }
+        if (!change.live || !change.draw.mesh->geometry) {
+            m_render_scene.clear(change.slot);
+            continue;
+        }
+
+        // The same transform and bounds addDrawItem() gives a draw of the mesh
+        const Mesh&      mesh      = *change.draw.mesh;
+        const glm::mat4& transform = change.draw.transform;
+        const glm::vec3  center    = (mesh.bounds_min + mesh.bounds_max) * 0.5f;
+        const float      scale     = std::max({ glm::length(glm::vec3(transform[0])),
+                                                glm::length(glm::vec3(transform[1])),
+                                                glm::length(glm::vec3(transform[2])) });
+
+        scene_instance instance;
+        instance.transform = affineRows(
+          mesh.format == vertex_format::packed ? transform * mesh.dequantize : transform);
+        instance.sphere        = glm::vec4(glm::vec3(transform * glm::vec4(center, 1.f)),
+                                    glm::length(mesh.bounds_max - center) * scale);
+        instance.texture       = m_texture_cache.get(change.draw.texture);
+        instance.vertex_format = (uint32_t)mesh.format;
+        instance.batch         = sceneBatch(mesh);
+        m_render_scene.set(change.slot, instance);
+    }
+}
+
+// The render scene's draw of `mesh`, which there are only as many of as there are different meshes
+uint32_t
+renderer::sceneBatch(const Mesh& mesh)
+{
+    const auto found = std::find(m_scene_batches.begin(), m_scene_batches.end(), &mesh);
+    if (found != m_scene_batches.end()) {
+        return (uint32_t)(found - m_scene_batches.begin());
+    }
+
+    m_scene_batches.push_back(&mesh);
+    return (uint32_t)m_scene_batches.size() - 1;
+}
+
+/*
+A draw per batch of the render scene, without any instances: the culling shader gives every one
+that passes a command of its own, copied from its batch's. A batch draws the whole mesh at its most
+detailed level, opaque, and with the texture of the instance rather than its submeshes'.
+*/
+void
+renderer::addSceneBatches()
+{
+    m_scene_first_draw = (uint32_t)m_draw_list.size();
+
+    for (const Mesh* mesh : m_scene_batches) {
+        mesh_lod whole;
+        whole.index_count = mesh->geometry.index_count;
+
+        const mesh_lod& lod =
+          mesh->submeshes.empty() && !mesh->lods.empty() ? mesh->lods[0] : whole;
+        const size_t format  = (size_t)mesh->format;
+        const size_t surface = (size_t)material::opaque;
+
+        draw_item item;
+        item.vertex_buffer    = m_geometry.positionBuffer();
+        item.attribute_buffer = m_geometry.attributeBuffer();
+        item.index_buffer     = m_geometry.indexBuffer();
+        item.index_type       = mesh->geometry.index_type;
+        item.index_count      = lod.index_count;
+        item.first_index      = mesh->geometry.first_index + lod.first_index;
+        item.vertex_offset    = (int32_t)mesh->geometry.vertex_offset;
+        item.first_transform  = (uint32_t)m_draw_transforms.size();
+        item.instance_count   = 0;
+        item.format           = mesh->format;
+        item.pipeline         = m_material_pipelines[format][surface];
+        item.prepass_pipeline = m_prepass_pipelines[format][surface];
+        item.subpass          = m_material_states[format][surface].subpass;
+        item.shading_rate     = m_shading_rate_settings.materials[surface];
+        m_draw_list.push_back(item);
+    }
+}
+
+// The copy of the render scene's slots, drawn like any other draws
+void
+renderer::drawSceneDraws()
+{
+    for (const draw_request& draw : m_scene_draws) {
+        if (draw.mesh) {
+            m_draw_object = draw.object;
+            drawMesh(*draw.mesh, m_texture_cache.get(draw.texture), draw.transform);
+        }
+    }
+    m_draw_object = pick_none;
+}
+
+/*
+Much like vertex and index buffers, we have a buffer for uniform values. It is written every frame
+while earlier frames may still be reading it, so it is a ring with a region per frame in flight.
+*/
+void
+renderer::createUniformBuffer()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_uniforms.init(m_physical_device, m_device, m_allocator, uniform_ring_frame_size,
+                    m_frames_in_flight);
+}
+
+void
+renderer::createDrawBuffer()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_draws.init(m_physical_device, m_device, m_allocator, max_draws_per_frame,
+                 max_instances_per_frame, m_frames_in_flight, cullingFamilies());
+
+    if (m_gpu_culling) {
+        auto families = cullingFamilies();
+        m_culling.init(m_physical_device, m_device, m_allocator, m_layouts, m_pipeline_cache,
+                       max_culls_per_frame, m_frames_in_flight, m_occlusion_culling,
+                       families.back(), families.front(),
+                       m_capabilities.descriptor_update_template);
+
+        // A slot per entity index, expanded into the draw buffer and culled like the rest
+        if (m_render_scene_enabled) {
+            m_render_scene.init(m_physical_device, m_device, m_allocator, m_layouts,
+                                m_pipeline_cache, max_scene_instances, max_scene_updates,
+                                m_frames_in_flight, m_capabilities.descriptor_update_template);
+        }
+    }
+
+    // Every frame's lights are pushed whole, so there's room for exactly as many as there are
+    if (lightingEnabled()) {
+        m_lighting.init(m_physical_device, m_device, m_allocator, m_layouts, m_pipeline_cache,
+                        std::max(m_light_count, 1u), m_frames_in_flight,
+                        m_capabilities.descriptor_update_template);
+        if (m_light_volumes) {
+            m_lighting.enableVolumes();
+        }
+    }
+
+    // The sources are copied in like the geometry pool's vertices, by the same queues
+    if (m_skinned_count > 0) {
+        const bool            group    = deviceCount() > 1;
+        auto                  indices  = findQueueFamilies(m_physical_device, m_surface, group);
+        std::vector<uint32_t> families = { indices.graphicsFamily() };
+        if (indices.transferFamily() != indices.graphicsFamily()) {
+            families.push_back(indices.transferFamily());
+        }
+        m_skinning.init(m_physical_device, m_device, m_allocator, m_layouts, m_pipeline_cache,
+                        m_geometry.positionBuffer(), skinned_rings * skinned_sides,
+                        m_skinned_count * skinned_joints, m_frames_in_flight, families,
+                        m_capabilities.descriptor_update_template);
+    }
+
+    // Before the pipelines as well, which are made with its layout
+    if (m_debug_draw) {
+        m_debug.init(m_device, m_allocator, m_layouts, max_debug_vertices, m_frames_in_flight);
+    }
+
+    // Shared by both queues when they're simulated on the compute queue
+    if (m_particle_count > 0) {
+        m_particles.init(m_physical_device, m_device, m_allocator, m_layouts, m_pipeline_cache,
+                         m_particle_count, cullingFamilies());
+    }
+
+    // The casters are drawn with either vertex format's position stream only, by vertex_format
+    if (shadowsEnabled()) {
+        m_cascades.init(m_physical_device, m_device, m_allocator, m_layouts, m_views,
+                        m_pipeline_cache, positionInputs(), m_frames_in_flight,
+                        m_quality.shadow_resolution);
+    }
+
+    // Built from the geometry pool's own buffers, as many instances as the draw buffer has
+    if (m_ray_query) {
+        m_acceleration.init(m_physical_device, m_device, m_allocator, m_geometry.positionBuffer(),
+                            m_geometry.indexBuffer(), m_frames_in_flight,
+                            max_instances_per_frame);
+    }
+
+    // The captures are drawn with either vertex format's positions and texture coordinates, by
+    // vertex_format, and the bindless textures' layout
+    if (m_reflections) {
+        m_probes.init(m_physical_device, m_device, m_allocator, m_layouts, m_views,
+                      m_pipeline_cache, probeInputs(), m_texture_set_layout, m_probe_settings,
+                      m_frames_in_flight);
+    }
+}
+
+/*
+Descriptor sets can't be created directly, they must be allocated from a pool like command buffers.
+The equivalent for descriptor sets is unsurprisingly called a descriptor pool.
+*/
+void
+renderer::createDescriptorPool()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    // What one set of each layout needs, as reflected. The allocators size their pools for many
+    // such sets and start another pool whenever one runs out, so this is no limit on how many sets
+    // there are.
+    const std::vector<vk::DescriptorPoolSize>& setsizes = m_descriptor_set_sizes;
+
+    m_descriptors.init(m_device, setsizes, descriptor_sets_per_pool);
+
+    // Along with the G-buffer's set of deferred shading, which every frame allocates for itself,
+    // see recordLighting
+    std::vector<vk::DescriptorPoolSize> framesizes = setsizes;
+    if (m_deferred_shading) {
+        framesizes.push_back({ vk::DescriptorType::eInputAttachment, 3 });
+    }
+
+    m_frame_descriptors.resize(m_frames_in_flight);
+    for (descriptor_allocator& allocator : m_frame_descriptors) {
+        allocator.init(m_device, framesizes, descriptor_sets_per_pool);
+    }
+
+#if defined(VK_EXT_descriptor_indexing)
+    // Sets with an update-after-bind layout have to come from a pool created for them
+    if (m_bindless_textures) {
+        m_texture_descriptors.init(m_device,
+                                   { { vk::DescriptorType::eCombinedImageSampler,
+                                       m_bindless_texture_count
+                                         + texture_streamer::max_texture_arrays } },
+                                   m_frames_in_flight,
+                                   vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT);
+    }
+#endif
+}
+
+/*
+It appears that descriptor sets are the results, being specified via descriptor set layouts and
+allocated from a descriptor pool
+
+You don't need to explicitly clean up descriptor sets, because they will be automatically freed when
+the descriptor pool is destroyed
+*/
+void
+renderer::createDescriptorSet()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    // Every frame in flight gets its own set with the same layout. The buffers are shared and
+    // picked apart by the dynamic offsets, only the texture views can differ between them.
+    m_descriptor_sets.clear();
+    m_texture_sets.clear();
+
+    // With descriptor buffers set 0 is in the buffer alone, the texture sets are the HUD's
+    for (uint32_t i = 0; i < m_frames_in_flight; ++i) {
+        if (!m_descriptor_buffers) {
+            m_descriptor_sets.push_back(m_descriptors.allocate(m_descriptor_set_layout));
+        }
+
+        if (m_bindless_textures) {
+            m_texture_sets.push_back(m_texture_descriptors.allocate(m_texture_set_layout));
+        }
+    }
+
+    // Nothing is in the texture arrays yet, so every frame fills in all of them before it is
+    // first recorded
+    m_descriptor_texture_versions.assign(m_frames_in_flight, 0);
+    m_descriptor_virtual_versions.assign(m_frames_in_flight, 0);
+
+    // The descriptor set has been allocated now, but the descriptors within still need to be
     // configured. Descriptors that refer to buffers, like our uniform buffer descriptor, are
     // configured with a VkDescriptorBufferInfo struct. This structure specifies the buffer and the
-    // region within it that contains the data for the descriptor:
-    auto bufferinfo = vk::DescriptorBufferInfo()
-                        .setBuffer(m_uniform_buffer)
-                        .setOffset(0)
-                        // If you're overwriting the whole buffer, like we are in this case, then it
-                        // is is also possible to use the VK_WHOLE_SIZE value for the range.
-                        .setRange(sizeof(uniformbufferobject));
+    // region within it that contains the data for the descriptor. They all go into the data the
+    // descriptor template writes the sets from, at their binding's slot:
+    m_descriptor_data.assign(m_descriptor_template.size(), descriptor_data());
+
+    m_descriptor_data[m_descriptor_template.slot(0)].buffer =
+      vk::DescriptorBufferInfo()
+        .setBuffer(m_uniforms.buffer())
+        // The dynamic offset given when binding the set is added to this one
+        .setOffset(0)
+        // The range is what one draw sees from the dynamic offset onwards, not the whole ring.
+        .setRange(sizeof(uniformbufferobject));
+
+    // The final step is to bind the actual image and sampler resources to the descriptor in the
+    // descriptor set.
+    m_descriptor_data[m_descriptor_template.slot(1)].image =
+      vk::DescriptorImageInfo()
+        .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
+        .setImageView(m_textures.view(m_texture_cache.get(m_texture)))
+        .setSampler(m_texture_sampler);
+
+    // The draw instances are another dynamic range, of a storage buffer this time since there are
+    // far more of them than a uniform buffer range is guaranteed to hold
+    m_descriptor_data[m_descriptor_template.slot(2)].buffer =
+      vk::DescriptorBufferInfo(m_draws.buffer(), 0, m_draws.instanceRange());
+
+    // The whole of both vertex streams, which meshes of both formats share, well within the
+    // storage buffer range every device supports. Descriptor buffers need their sizes spelled out.
+    if (m_vertex_pulling) {
+        m_descriptor_data[m_descriptor_template.slot(vertex_pull_binding)].buffer =
+          vk::DescriptorBufferInfo(m_geometry.positionBuffer(), 0,
+                                   m_descriptor_buffers ? m_geometry.positionBytes()
+                                                        : VK_WHOLE_SIZE);
+        m_descriptor_data[m_descriptor_template.slot(vertex_attribute_pull_binding)].buffer =
+          vk::DescriptorBufferInfo(m_geometry.attributeBuffer(), 0,
+                                   m_descriptor_buffers ? m_geometry.attributeBytes()
+                                                        : VK_WHOLE_SIZE);
+    }
+
+    // The types and bindings are the template's, from the layout, so every set is one call
+    for (uint32_t frame = 0; frame < m_frames_in_flight; ++frame) {
+        writeDescriptorSet(frame);
+    }
+    invalidateCachedDraws();
+}
+
+/*
+Writes a frame's set from m_descriptor_data, with the frame's own regions of the lights, clusters,
+cascades and probes, which are bound as they are rather than with dynamic offsets. Without
+lighting, shadows or reflections the shaders never read them, but the bindings are there either
+way, so they point at the draw buffer and the texture instead. With descriptor buffers the same goes
+for the frame's uniforms and instances, and the frame's copy of set 0 in the buffer is written
+instead.
+*/
+void
+renderer::writeDescriptorSet(uint32_t frame)
+{
+    descriptor_data& lights = m_descriptor_data[m_descriptor_template.slot(light_binding)];
+    descriptor_data& clusters =
+      m_descriptor_data[m_descriptor_template.slot(light_cluster_binding)];
+    if (lightingEnabled()) {
+        lights.buffer   = m_lighting.lights(frame);
+        clusters.buffer = m_lighting.clusters(frame);
+    } else {
+        lights.buffer   = vk::DescriptorBufferInfo(m_draws.buffer(), 0, m_draws.instanceRange());
+        clusters.buffer = lights.buffer;
+    }
+
+    descriptor_data& shadowmap = m_descriptor_data[m_descriptor_template.slot(shadow_map_binding)];
+    descriptor_data& cascades  = m_descriptor_data[m_descriptor_template.slot(shadow_view_binding)];
+    if (shadowsEnabled()) {
+        shadowmap.image = m_cascades.map();
+        cascades.buffer = m_cascades.view(frame);
+    } else {
+        shadowmap.image = m_descriptor_data[m_descriptor_template.slot(1)].image;
+        cascades.buffer = lights.buffer;
+    }
+
+    descriptor_data& cubes  = m_descriptor_data[m_descriptor_template.slot(probe_cubes_binding)];
+    descriptor_data& probes = m_descriptor_data[m_descriptor_template.slot(probe_view_binding)];
+    if (m_reflections) {
+        cubes.image   = m_probes.cubes();
+        probes.buffer = m_probes.view(frame);
+    } else {
+        cubes.image   = m_descriptor_data[m_descriptor_template.slot(1)].image;
+        probes.buffer = lights.buffer;
+    }
+
+#if defined(VK_KHR_acceleration_structure)
+    // Every frame traces its own top level, which stays the same structure as it's rebuilt
+    if (m_ray_query) {
+        m_descriptor_data[m_descriptor_template.slot(ray_scene_binding)].acceleration_structure =
+          m_acceleration.topLevel(frame);
+    }
+#endif
+
+    // Only declared by the virtual texturing shader, whose feedback every frame has its own of
+    if (m_virtual_texturing) {
+        m_descriptor_data[m_descriptor_template.slot(virtual_pages_binding)].image =
+          m_virtual_textures.pages();
+        m_descriptor_data[m_descriptor_template.slot(virtual_feedback_binding)].buffer =
+          m_virtual_textures.feedback(frame);
+    }
+
+    if (m_descriptor_buffers) {
+        m_descriptor_data[m_descriptor_template.slot(0)].buffer.setOffset(
+          m_uniforms.frameOffset(frame));
+        m_descriptor_data[m_descriptor_template.slot(2)].buffer = m_draws.instances(frame);
+        m_descriptor_buffer.update(frame, 0, m_descriptor_template, m_descriptor_data.data());
+        return;
+    }
+
+    m_descriptor_template.update(m_descriptor_sets[frame], m_descriptor_data.data());
+}
+
+/*
+Points a frame's sets at the textures' current views. Only called once that frame's fence has
+signalled, since a descriptor can't be updated while a submitted command buffer still uses it, not
+even an update-after-bind one. Only the slots of textures that got a new view since the frame's
+last update are written, and removed textures' slots are left alone, which partially bound arrays
+allow as long as no draw uses them.
+*/
+void
+renderer::updateTextureDescriptor(uint32_t frame)
+{
+    const uint64_t synced = m_descriptor_texture_versions[frame];
+
+    // Every write points into this, so it mustn't reallocate. Both only last the frame, which
+    // this is only called for once its arena has been reset.
+    core::linear_arena&                         arena = m_frame_arenas[frame];
+    core::frame_vector<vk::DescriptorImageInfo> imageinfos(&arena);
+    core::frame_vector<vk::WriteDescriptorSet>  writes(&arena);
+    imageinfos.reserve(m_textures.size() + m_textures.arrayCount() + m_virtual_textures.size());
+
+    auto write = [&](vk::DescriptorSet set, uint32_t binding, uint32_t element, vk::ImageView view,
+                     vk::ImageLayout layout) {
+        imageinfos.push_back(vk::DescriptorImageInfo()
+                               .setImageLayout(layout)
+                               .setImageView(view)
+                               .setSampler(m_texture_sampler));
+
+        writes.push_back(vk::WriteDescriptorSet()
+                           .setDstSet(set)
+                           .setDstBinding(binding)
+                           .setDstArrayElement(element)
+                           .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                           .setDescriptorCount(1)
+                           .setPImageInfo(&imageinfos.back()));
+
+        // The draws' copy, the set stays the HUD's
+        if (m_descriptor_buffers) {
+            m_descriptor_buffer.writeImage(frame, 1, binding, element, imageinfos.back());
+        }
+    };
+
+    // The rest of set 0 is as createDescriptorSet left it, so it's written again as it was
+    m_descriptor_data[m_descriptor_template.slot(1)].image.setImageView(
+      m_textures.view(m_texture_cache.get(m_texture)));
+    writeDescriptorSet(frame);
+
+    if (m_bindless_textures) {
+        for (texture_streamer::handle texture = 0; texture < m_textures.size(); ++texture) {
+            if (m_textures.view(texture) && m_textures.viewVersion(texture) > synced) {
+                write(m_texture_sets[frame], 0, texture, m_textures.view(texture),
+                      vk::ImageLayout::eShaderReadOnlyOptimal);
+            }
+        }
+
+        // Packed textures have their layer's view in their slot as well, for whatever indexes
+        // them by handle, e.g. sprites and the render scene, and only draws go by their array
+        for (uint32_t array = 0; array < m_textures.arrayCount(); ++array) {
+            if (m_textures.arrayVersion(array) > synced) {
+                write(m_texture_sets[frame], 1, array, m_textures.arrayView(array),
+                      vk::ImageLayout::eShaderReadOnlyOptimal);
+            }
+        }
+    }
+
+    // There are few enough virtual textures that all of them are written whenever one changes.
+    // Their indirection is only ever in the general layout, see virtual_texture_cache.
+    if (m_virtual_texturing
+        && m_descriptor_virtual_versions[frame] != m_virtual_textures.version()) {
+        for (virtual_texture_cache::handle texture = 0; texture < m_virtual_textures.size();
+             ++texture) {
+            if (m_virtual_textures.indirection(texture)) {
+                write(m_texture_sets[frame], 0, m_virtual_textures.slot(texture),
+                      m_virtual_textures.indirection(texture), vk::ImageLayout::eGeneral);
+            }
+        }
+    }
+
+    if (!writes.empty()) {
+        m_device.updateDescriptorSets((uint32_t)writes.size(), writes.data(), 0, nullptr);
+    }
+    m_descriptor_texture_versions[frame] = m_textures.version();
+    m_descriptor_virtual_versions[frame] = m_virtual_textures.version();
+
+    // Writing set 0 invalidates the command buffers it's bound in, unlike the update-after-bind
+    // texture array
+    if (frame < m_secondary_signatures.size()) {
+        std::fill(m_secondary_signatures[frame].begin(), m_secondary_signatures[frame].end(), 0);
+    }
+}
+
+/*
+The geometry has been colored using per-vertex colors so far, which is a rather limited approach. In
+this part of the tutorial we're going to implement texture mapping to make the geometry look more
+interesting. This will also allow us to load and draw basic 3D models in a future chapter.
+
+Adding a texture to our application will involve the following steps:
+
+  - Create an image object backed by device memory
+  - Fill it with pixels from an image file
+  - Create an image sampler
+  - Add a combined image sampler descriptor to sample colors from the texture
+
+We've already worked with image objects before, but those were automatically created by the swap
+chain extension. This time we'll have to create one by ourselves. Creating an image and filling it
+with data is similar to vertex buffer creation. We'll start by creating a staging resource and
+filling it with pixel data and then we copy this to the final image object that we'll use for
+rendering. Although it is possible to create a staging image for this purpose, Vulkan also allows
+you to copy pixels from a VkBuffer to an image and the API for this is actually faster on some
+hardware. We'll first create this buffer and fill it with pixel values, and then we'll create an
+image to copy the pixels to. Creating an image is not very different from creating buffers. It
+involves querying the memory requirements, allocating device memory and binding it, just like we've
+seen before.
+
+However, there is something extra that we'll have to take care of when working with images. Images
+can have different layouts that affect how the pixels are organized in memory. Due to the way
+graphics hardware works, simply storing the pixels row by row may not lead to the best performance,
+for example. When performing any operation on images, you must make sure that they have the layout
+that is optimal for use in that operation. We've actually already seen some of these layouts when we
+specified the render pass:
+
+  - VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: Optimal for presentation
+  - VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL: Optimal as attachment for writing colors from the
+fragment shader
+  - VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: Optimal as source in a transfer operation,
+like vkCmdCopyImageToBuffer
+  - VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: Optimal as destination in a
+transfer operation, like vkCmdCopyBufferToImage
+  - VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: Optimal
+for sampling from a shader
+
+One of the most common ways to transition the layout of an image is a pipeline barrier. Pipeline
+barriers are primarily used for synchronizing access to resources, like making sure that an image
+was written to before it is read, but they can also be used to transition layouts. In this chapter
+we'll see how pipeline barriers are used for this purpose. Barriers can additionally be used to
+transfer queue family ownership when using VK_SHARING_MODE_EXCLUSIVE.
+
+The texture loader does all of this for any number of textures at once, decoding them in parallel on
+the job scheduler straight into the staging arena, and prefers pre-compressed KTX2 versions of them
+whose texels can be uploaded as they are.
+*/
+void
+renderer::createTextureImage(upload_batch& uploads, texture_data* preloaded)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_texture = acquireTexture(uploads, texture_path, preloaded);
+
+    if (m_texture == resource_cache<texture_streamer::handle>::invalid_handle) {
+        throw std::runtime_error("Failed to load image!");
+    }
+}
+
+renderer::texture_handle
+renderer::acquireTexture(upload_batch&      uploads,
+                         const std::string& path,
+                         texture_data*      preloaded)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    return m_texture_cache.acquire(path, [&](const std::string& file,
+                                             texture_streamer::handle& texture) {
+        const core::startup_scope scope(&m_startup, "asset", "texture " + file);
+        texture = preloaded ? m_textures.add(uploads, std::move(*preloaded))
+                            : m_textures.add(uploads, file);
+        if (texture == texture_streamer::invalid_handle) {
+            return false;
+        }
+        watchAsset(file);
+
+        // The handle is the texture's slot in the bindless array, so it has to fit
+        if (m_bindless_textures && texture >= m_streamed_texture_count) {
+            m_textures.remove(texture, m_frame_number);
+            return false;
+        }
+        return true;
+    });
+}
+
+renderer::texture_handle
+renderer::acquireTextureAsync(const std::string& path)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    return m_texture_cache.acquire(path, [&](const std::string& file,
+                                             texture_streamer::handle& texture) {
+        // Whatever has been cooked into a virtual texture is drawn as one, see setVirtualTextures
+        if (m_virtual_texturing) {
+            const virtual_texture_cache::handle cooked =
+              m_virtual_textures.add(virtualTexturePath(file));
+            if (cooked != virtual_texture_cache::invalid_handle) {
+                texture = virtual_texture_bit | m_virtual_textures.slot(cooked);
+                return true;
+            }
+        }
+
+        texture = m_textures.addAsync(file);
+
+        if (m_bindless_textures && texture >= m_streamed_texture_count) {
+            m_textures.remove(texture, m_frame_number);
+            return false;
+        }
+        watchAsset(file);
+        return true;
+    });
+}
+
+renderer::mesh_handle
+renderer::acquireMesh(upload_batch& uploads, const std::string& path)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    return m_mesh_cache.acquire(path, [&](const std::string& file, Mesh& mesh) {
+        const core::startup_scope scope(&m_startup, "asset", "mesh " + file);
+        mesh = loadObj(file);
+        if (mesh.indices.empty()) {
+            return false;
+        }
+        watchAsset(file);
+        uploadMesh(uploads, mesh);
+        if (!m_keep_mesh_data) {
+            mesh.releaseHostData();
+        }
+
+        // A material whose texture can't be loaded, or hasn't been yet, is drawn with the mesh's
+        // texture instead. They are read in the background, so the mesh doesn't wait for them.
+        for (const mesh_material& material : mesh.materials) {
+            mesh.textures.push_back(material.diffuse_texture.empty()
+                                      ? resource_cache<texture_streamer::handle>::invalid_handle
+                                      : acquireTextureAsync(material.diffuse_texture));
+        }
+        return true;
+    });
+}
+
+// Frames in flight may still be drawing with the resources, so they are only freed afterwards
+void
+renderer::releaseTexture(texture_handle texture)
+{
+    m_texture_cache.release(texture, [&](texture_streamer::handle& streamed) {
+        if (isVirtualTexture(streamed)) {
+            m_virtual_textures.remove(m_virtual_textures.fromSlot(streamed & ~virtual_texture_bit),
+                                      m_frame_number);
+        } else {
+            m_textures.remove(streamed, m_frame_number);
+        }
+    });
+}
+
+/*
+Draws are written every frame, so they can go by a packed texture's array and layer, which change
+whenever it is read again. Draws of many small textures that share an array then sample the same
+descriptor, which non-uniform indexing makes cheaper the fewer different ones a subgroup has.
+*/
+uint32_t
+renderer::bindlessIndex(uint32_t texture) const
+{
+    if (!m_bindless_textures || isVirtualTexture(texture)) {
+        return texture;
+    }
+    return m_textures.shaderIndex(texture);
+}
+
+void
+renderer::releaseMesh(mesh_handle mesh)
+{
+    m_mesh_cache.release(mesh, [&](Mesh& released) { retireMesh(released); });
+}
+
+void
+renderer::retireMesh(Mesh& mesh)
+{
+    for (texture_handle texture : mesh.textures) {
+        if (texture != resource_cache<texture_streamer::handle>::invalid_handle) {
+            releaseTexture(texture);
+        }
+    }
+
+    geometry_range range = mesh.geometry;
+    m_deletion_queue.pushAction(m_frame_number, [this, range]() {
+        forgetRayGeometry(range);
+        m_geometry.free(range);
+    });
+}
+
+// The mesh's bottom level structures, before another mesh can take its vertices
+void
+renderer::forgetRayGeometry(const geometry_range& range)
+{
+    if (m_ray_query) {
+        m_acceleration.forget((vk::DeviceSize)range.vertex_offset * range.vertex_units
+                              * geometry_position_unit);
+    }
+}
+
+void
+renderer::watchAsset(const std::string& path)
+{
+    if (m_hot_reload) {
+        m_watcher.watch(path);
+    }
+}
+
+/*
+Hot reloading, without ever waiting for the GPU or anything else on the disk:
+
+ - A shader gets a new module, and the pipelines using it are compiled again in the background,
+   through the pipeline cache, while the old ones are drawn with. updateMaterialPipelines picks up
+   the new ones and queues the old ones for deletion.
+ - A texture is read on the I/O queue and decoded in a job like any streamed one, and the streamer
+   swaps it in at its next update, retiring the old image through the deletion queue.
+ - A mesh is cooked again on a job, which imports it anew since its source no longer matches the
+   mesh cache, and swapReloadedMeshes uploads it at a later frame.
+
+Files that aren't any of those, or no longer are, are ignored.
+*/
+void
+renderer::reloadChangedAssets()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    for (const std::string& path : m_watcher.changed()) {
+        if (m_pipelines.reloadShader(path)) {
+            core::logInfo() << "Reloading " << path;
+            continue;
+        }
+
+        // The .spv files it goes into are watched as well, and reloaded once they're written
+        if (m_shader_sources.count(path)) {
+            core::logInfo() << "Compiling " << path;
+            m_jobs.run(m_shader_compiles, [this, path]() { m_shader_compiler.rebuild(path); },
+                       core::thread_class::background);
+            continue;
+        }
+
+        const texture_handle texture = m_texture_cache.find(path);
+        if (texture != resource_cache<texture_streamer::handle>::invalid_handle
+            && !isVirtualTexture(m_texture_cache.get(texture))) {
+            core::logInfo() << "Reloading " << path;
+            m_textures.reload(m_texture_cache.get(texture), path);
+            continue;
+        }
+
+        const mesh_handle mesh = m_mesh_cache.find(path);
+        if (mesh != resource_cache<Mesh>::invalid_handle) {
+            core::logInfo() << "Reloading " << path;
+            auto cook = [this, mesh, path]() {
+                reloaded_mesh reloaded;
+                reloaded.mesh = mesh;
+                reloaded.path = path;
+
+                // Jobs must not throw
+                try {
+                    reloaded.ok = cookObj(path, m_jobs, reloaded.result);
+                } catch (const std::exception&) {
+                    reloaded.ok = false;
+                }
+
+                std::lock_guard<std::mutex> lock(m_reloaded_mutex);
+                m_reloaded_meshes.push_back(std::move(reloaded));
+            };
+            m_jobs.run(m_mesh_reloads, std::move(cook), core::thread_class::background);
+        }
+    }
+
+    swapReloadedMeshes();
+}
+
+/*
+The new geometry is uploaded into a range of its own and the mesh swapped for it in the cache, so
+its handle stays the same for everyone using it. The old range is only freed once the frames in
+flight are done drawing from it, and the upload is visible to the graphics queue before this frame
+is submitted.
+*/
+void
+renderer::swapReloadedMeshes()
+{
+    std::vector<reloaded_mesh> reloaded;
+    {
+        std::lock_guard<std::mutex> lock(m_reloaded_mutex);
+        reloaded.swap(m_reloaded_meshes);
+    }
+    if (reloaded.empty()) {
+        return;
+    }
+
+    upload_batch batch = m_uploads.begin();
+
+    for (reloaded_mesh& r : reloaded) {
+        // Released in the meantime, which leaves the handle stale even if its slot has been reused
+        // or the file acquired again since
+        if (!m_mesh_cache.valid(r.mesh)) {
+            continue;
+        }
+        if (!r.ok || r.result.indices.empty()) {
+            core::logWarning() << "Failed to reload " << r.path << ", keeping the old one";
+            continue;
+        }
+
+        Mesh& fresh = r.result;
+        try {
+            uploadMesh(batch, fresh);
+        } catch (const std::runtime_error& e) {
+            core::logWarning() << "Failed to reload " << r.path << ": " << e.what();
+            continue;
+        }
+        if (!m_keep_mesh_data) {
+            fresh.releaseHostData();
+        }
+        for (const mesh_material& material : fresh.materials) {
+            fresh.textures.push_back(material.diffuse_texture.empty()
+                                       ? resource_cache<texture_streamer::handle>::invalid_handle
+                                       : acquireTextureAsync(material.diffuse_texture));
+        }
+
+        // The textures are acquired before the old ones are released, so those that both use
+        // aren't read again
+        Mesh& mesh = m_mesh_cache.get(r.mesh);
+        retireMesh(mesh);
+        mesh = std::move(fresh);
+
+        if (r.mesh == m_model) {
+            m_mesh = mesh.drawable();
+        }
+    }
+
+    batch.submit();
+}
+
+/*
+Defragmenting doesn't wait for the GPU either. Every defragment_interval frames the sparsest blocks
+of streamed textures are marked for evacuation and the geometry pool is to be compacted, and from
+then on every frame moves up to defragment_bytes_per_frame of either, textures first, until nothing
+more moves. A moved texture gets a new view, which the descriptors pick up through the streamer's
+version like any streamed one. A moved mesh gets its new range right away, which this frame already
+draws from, since the copies are submitted before it is. The old images and ranges go through the
+deletion queue, and the evacuated blocks back to the driver with the last of them.
+*/
+void
+renderer::defragmentMemory()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    if (m_frame_number >= m_next_defragment) {
+        m_next_defragment = m_frame_number + defragment_interval;
+        m_compacting      = true;
+        m_allocator.beginDefragmentation(memory_allocator::resource_kind::optimal,
+                                         memory_category::texture, defragment_block_usage);
+    }
+    if (!m_allocator.defragmenting() && !m_compacting) {
+        return;
+    }
+
+    upload_batch   batch = m_uploads.begin();
+    vk::DeviceSize moved = 0;
+
+    if (m_allocator.defragmenting()) {
+        moved = m_textures.relocate(batch, m_frame_number, defragment_bytes_per_frame);
+        if (moved == 0) {
+            m_allocator.endDefragmentation();
+        }
+    }
+
+    if (m_compacting && moved < defragment_bytes_per_frame) {
+        m_compacting = compactGeometry(batch, defragment_bytes_per_frame - moved) > 0;
+    }
+
+    batch.submit();
+}
+
+/*
+The meshes furthest into the pool go first, since they are what keeps its free space from coming
+together at its end. Only the cached meshes move: skinned ones are written anew every frame anyway,
+and m_mesh is a copy of a cached one, which is kept in step.
+*/
+vk::DeviceSize
+renderer::compactGeometry(upload_batch& uploads, vk::DeviceSize budget)
+{
+    const Mesh* model =
+      m_model != resource_cache<Mesh>::invalid_handle ? &m_mesh_cache.get(m_model) : nullptr;
+
+    m_compacted_meshes.clear();
+    m_mesh_cache.forEach([&](mesh_handle, Mesh& mesh) {
+        if (mesh.geometry) {
+            m_compacted_meshes.push_back(&mesh);
+        }
+    });
+
+    auto end = [](const Mesh* mesh) {
+        return (mesh->geometry.vertex_offset + mesh->geometry.vertex_count)
+               * mesh->geometry.vertex_units;
+    };
+    std::sort(m_compacted_meshes.begin(), m_compacted_meshes.end(),
+              [&](const Mesh* a, const Mesh* b) { return end(a) > end(b); });
+
+    vk::DeviceSize moved = 0;
+    for (Mesh* mesh : m_compacted_meshes) {
+        const vk::DeviceSize size = m_geometry.bytes(mesh->geometry);
+        if (moved > 0 && moved + size > budget) {
+            break;
+        }
+
+        const geometry_range target = m_geometry.relocate(mesh->geometry);
+        if (!target) {
+            continue;
+        }
+
+        const geometry_range old = mesh->geometry;
+        m_geometry.move(uploads, old, target);
+        m_deletion_queue.pushAction(m_frame_number, [this, old, target]() {
+            forgetRayGeometry(old);
+            m_geometry.freeMoved(old, target);
+        });
+
+        mesh->geometry = target;
+        if (mesh == model) {
+            m_mesh.geometry = target;
+        }
+        moved += size;
+    }
+
+    return moved;
+}
+
+void
+renderer::createTextureSampler()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const vk::PhysicalDeviceLimits limits = m_physical_device.getProperties().limits;
+    const float anisotropy = std::clamp(m_quality.anisotropy, 1.f, limits.maxSamplerAnisotropy);
+    const float lodbias =
+      std::clamp(m_quality.lod_bias, -limits.maxSamplerLodBias, limits.maxSamplerLodBias);
+
+    // Samplers are configured through a VkSamplerCreateInfo structure, which specifies all filters
+    // and transformations that it should apply.
+    vk::SamplerCreateInfo samplerInfo;
+    // The magFilter and minFilter fields specify how to interpolate texels that are magnified or
+    // minified. Magnification concerns the oversampling problem describes above, and minification
+    // concerns undersampling. The choices are VK_FILTER_NEAREST and VK_FILTER_LINEAR, corresponding
+    // to the modes demonstrated in the images above.
+    samplerInfo.setMagFilter(vk::Filter::eLinear)
+      .setMinFilter(vk::Filter::eLinear)
+      /*The addressing mode can be specified per axis using the addressMode fields. The available
+      values are listed below. Most of these are demonstrated in the image above. Note that the axes
+      are called U, V and W instead of X, Y and Z. This is a convention for texture space
+      coordinates.
+      ===VK_SAMPLER_ADDRESS_MODE_REPEAT: Repeat the texture when going beyond the image dimensions.
+      ===VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT: Like repeat, but inverts the coordinates to mirror
+      the image when going beyond the dimensions. VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE: Take the
+      color of the edge closest to the coordinate beyond the image dimensions.
+      ===VK_SAMPLER_ADDRESS_MODE_MIRROR_CLAMP_TO_EDGE: Like clamp to edge, but instead uses the edge
+      opposite to the closest edge.
+      ===VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER: Return a solid color when sampling
+      beyond the dimensions of the image.
+      It doesn't really matter which addressing mode we use here,
+      because we're not going to sample outside of the image in this tutorial. However, the repeat
+      mode is probably the most common mode, because it can be used to tile textures like floors and
+      walls.*/
+      .setAddressModeU(vk::SamplerAddressMode::eRepeat)
+      .setAddressModeV(vk::SamplerAddressMode::eRepeat)
+      .setAddressModeW(vk::SamplerAddressMode::eRepeat)
+      /*These two fields specify if anisotropic filtering should be used. There is no reason not to
+         use this unless performance is a concern. The maxAnisotropy field limits the amount of
+         texel samples that can be used to calculate the final color. A lower value results in
+         better performance, but lower quality results. There is no graphics hardware available
+         today that will use more than 16 samples, because the difference is negligible beyond that
+         point.*/
+      // Side note by Jason: currently we only check if the physicaldevice is capable of anisotropy
+      // in the isDeviceSuitable() function. At some point we might be better off storing the
+      // physicalDeviceFeatures as a member value or scoping it here to set anisotropy settings
+      // correctly based on available features.
+      // Both from the quality settings, within what the device allows
+      .setAnisotropyEnable(anisotropy > 1.f)
+      .setMaxAnisotropy(anisotropy)
+      /*The borderColor field specifies which color is returned when sampling beyond the image with
+         clamp to border addressing mode. It is possible to return black, white or transparent in
+         either float or int formats. You cannot specify an arbitrary color.*/
+      .setBorderColor(vk::BorderColor::eFloatOpaqueBlack)
+      /*The unnormalizedCoordinates field specifies which coordinate system you want to use to
+        address texels in an image. If this field is VK_TRUE, then you can simply use coordinates
+        within the [0, texWidth) and [0, texHeight) range. If it is VK_FALSE, then the texels are
+        addressed using the [0, 1) range on all axes. Real-world applications almost always use
+        normalized coordinates, because then it's possible to use textures of varying resolutions
+        with the exact same coordinates.*/
+      .setUnnormalizedCoordinates(false)
+      .setCompareEnable(false)
+      .setCompareOp(vk::CompareOp::eAlways)
+      /*Mipmapping picks the level (or with linear mipmap mode, blends the two levels) whose texels
+        are closest in size to the pixel being shaded. minLod and maxLod clamp the level of detail,
+        so maxLod has to reach the last level of the texture for all of them to be used. Streamed
+        textures change how many levels they have, so it isn't clamped at all.*/
+      .setMipmapMode(vk::SamplerMipmapMode::eLinear)
+      .setMipLodBias(lodbias)
+      .setMinLod(0.f)
+      .setMaxLod(VK_LOD_CLAMP_NONE);
+
+    m_texture_sampler = m_views.sampler(samplerInfo);
+}
+
+/*
+The frame's passes and what they use, rebuilt along with the swap chain or whenever the render
+resolution changes, since the depth buffer and the multisampled color attachment, the transient
+images, are the size of it:
+
+ - culling writes the culled draws, testing against the Hi-Z pyramid of the frame before,
+ - the main pass draws them into the target with the depth buffer,
+ - hi-z rebuilds the pyramid from the depth buffer, for the next frame,
+ - with dynamic resolution, the main pass draws into the scene image instead, which upscale blits
+   to the target,
+ - and offscreen, the target is read back.
+
+The target is the swap chain or offscreen image the frame renders to. The render pass does its
+layout transitions, or beginRendering and endRendering do with dynamic rendering, and it's
+synchronized with the semaphores otherwise, so it's only in the graph to keep the passes writing it.
+*/
+void
+renderer::createRenderGraph()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_graph.reset(m_deletion_queue, m_frame_number);
+
+    // Each eye gets half of the target in stereo. The viewports render at the window's resolution
+    // too, and are scaled to theirs.
+    vk::Extent2D extent = m_swapchain_extent;
+    if (m_stereo) {
+        extent.width = std::max(extent.width / 2, 1u);
+    }
+    m_render_extent = m_dynamic_resolution || m_temporal_aa ? m_resolution.extent(extent) : extent;
+
+    const vk::Format     depthformat = findDepthFormat();
+    vk::ImageAspectFlags depthaspect = vk::ImageAspectFlagBits::eDepth;
+    if (hasStencilComponent(depthformat)) {
+        depthaspect |= vk::ImageAspectFlagBits::eStencil;
+    }
+    m_depth_format = depthformat;
+
+    // Sampled as well when the Hi-Z pyramid or the motion vectors are made from it. Otherwise
+    // it's never stored by the render pass, and the graph makes it a lazily allocated transient
+    // attachment where it can. The lighting subpass of deferred shading reads it as an input
+    // attachment, which doesn't take it out of the render pass either.
+    vk::ImageUsageFlags usage =
+      sampledDepth()
+        ? vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled
+        : vk::ImageUsageFlags(vk::ImageUsageFlagBits::eDepthStencilAttachment);
+    if (m_deferred_shading) {
+        usage |= vk::ImageUsageFlagBits::eInputAttachment;
+    }
+
+    auto depthinfo =
+      vk::ImageCreateInfo()
+        .setImageType(vk::ImageType::e2D)
+        .setExtent(vk::Extent3D(m_render_extent.width, m_render_extent.height, 1))
+        .setMipLevels(1)
+        .setArrayLayers(viewCount())
+        .setFormat(depthformat)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setUsage(usage)
+        .setSamples(m_samples)
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    const render_graph::handle depth = m_graph.createImage("depth", depthinfo, depthaspect);
+
+    // Only ever an attachment, resolved into the target within the render pass
+    render_graph::handle color = render_graph::invalid_handle;
+    if (m_samples != vk::SampleCountFlagBits::e1) {
+        auto colorinfo = vk::ImageCreateInfo(depthinfo)
+                           .setFormat(m_swapchain_image_format)
+                           .setUsage(vk::ImageUsageFlagBits::eColorAttachment);
+        color = m_graph.createImage("color", colorinfo, vk::ImageAspectFlagBits::eColor);
+    }
+
+    // Written and read within the render pass alone, so lazily allocated transient attachments too
+    render_graph::handle gbuffercolor  = render_graph::invalid_handle;
+    render_graph::handle gbuffernormal = render_graph::invalid_handle;
+    if (m_deferred_shading) {
+        auto gbufferinfo = vk::ImageCreateInfo(depthinfo)
+                             .setFormat(gbuffer_color_format)
+                             .setUsage(vk::ImageUsageFlagBits::eColorAttachment
+                                       | vk::ImageUsageFlagBits::eInputAttachment);
+        gbuffercolor =
+          m_graph.createImage("g-buffer color", gbufferinfo, vk::ImageAspectFlagBits::eColor);
+        gbuffernormal = m_graph.createImage("g-buffer normal",
+                                            gbufferinfo.setFormat(gbuffer_normal_format),
+                                            vk::ImageAspectFlagBits::eColor);
+    }
+
+    // The frame at the render resolution, or the eyes' views, rendered to instead of the target.
+    // The temporal pass samples it instead of it being blitted, and the shading rate and post
+    // passes too.
+    render_graph::handle scene = render_graph::invalid_handle;
+    if (m_scene_target) {
+        auto sceneinfo = vk::ImageCreateInfo(depthinfo)
+                           .setFormat(m_swapchain_image_format)
+                           .setUsage(vk::ImageUsageFlagBits::eColorAttachment
+                                     | vk::ImageUsageFlagBits::eTransferSrc)
+                           .setSamples(vk::SampleCountFlagBits::e1);
+        if (m_temporal_aa || m_adaptive_shading || m_post_processing) {
+            sceneinfo.usage |= vk::ImageUsageFlagBits::eSampled;
+        }
+        scene = m_graph.createImage("scene", sceneinfo, vk::ImageAspectFlagBits::eColor);
+    }
+
+    // Both are the temporal upscaler's, and kept from one frame to the next, see below
+    render_graph::handle motion  = render_graph::invalid_handle;
+    render_graph::handle history = render_graph::invalid_handle;
+    if (m_temporal_aa) {
+        motion  = m_graph.importImage("motion vectors", vk::Image(),
+                                      vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined);
+        history = m_graph.importImage("history", vk::Image(), vk::ImageAspectFlagBits::eColor,
+                                      vk::ImageLayout::eUndefined);
+    }
+
+    // Written after the main pass for the next frame's, which nothing this frame reads
+    render_graph::handle rates = render_graph::invalid_handle;
+    if (m_adaptive_shading) {
+        rates = m_graph.importImage("shading rates", vk::Image(), vk::ImageAspectFlagBits::eColor,
+                                    vk::ImageLayout::eUndefined);
+        m_graph.output(rates);
+    }
+
+    // Where the frame ends up, presented or read back
+    const vk::ImageLayout finallayout =
+      m_offscreen ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR;
+
+    m_graph_target = m_graph.importImage("target", vk::Image(), vk::ImageAspectFlagBits::eColor,
+                                         vk::ImageLayout::eUndefined);
+    m_graph.output(m_graph_target);
+
+    // The pyramid is created once the depth buffer is, see below
+    render_graph::handle culled    = render_graph::invalid_handle;
+    render_graph::handle pyramid   = render_graph::invalid_handle;
+    render_graph::handle clusters  = render_graph::invalid_handle;
+    render_graph::handle shadowmap = render_graph::invalid_handle;
+    render_graph::handle particles = render_graph::invalid_handle;
+    render_graph::handle skinned   = render_graph::invalid_handle;
+    render_graph::handle pages     = render_graph::invalid_handle;
+    render_graph::handle feedback  = render_graph::invalid_handle;
+    render_graph::handle occlusion = render_graph::invalid_handle;
+    render_graph::handle heights   = render_graph::invalid_handle;
+    render_graph::handle grass     = render_graph::invalid_handle;
+    if (m_gpu_culling) {
+        culled = m_graph.importBuffer("culled draws", m_culling.buffer());
+    }
+    // The cache takes the pages out of undefined itself, and they stay general from then on
+    if (m_virtual_texturing) {
+        pages    = m_graph.importImage("virtual pages", m_virtual_textures.pagesImage(),
+                                       vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eGeneral);
+        feedback = m_graph.importBuffer("virtual feedback", m_virtual_textures.feedbackBuffer());
+    }
+    // The terrain takes its heights out of undefined the same way
+    if (m_terrain_active) {
+        heights = m_graph.importImage("terrain heights", m_terrain.image(),
+                                      vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eGeneral);
+    }
+    if (m_vegetation_active) {
+        grass = m_graph.importBuffer("vegetation", m_vegetation.buffer());
+    }
+    if (m_particle_count > 0) {
+        particles = m_graph.importBuffer("particles", m_particles.buffer());
+    }
+    if (m_skinned_count > 0) {
+        skinned = m_graph.importBuffer("skinned positions", m_geometry.positionBuffer());
+    }
+    // Read by the next frame's predicates, after the copy this frame's main pass is done before
+    if (m_conditional_rendering) {
+        occlusion = m_graph.importBuffer("occlusion results", m_occlusion.buffer());
+        m_graph.output(occlusion);
+    }
+    if (lightingEnabled()) {
+        clusters = m_graph.importBuffer("light clusters", m_lighting.clusterBuffer());
+    }
+    // Imported undefined, which loses whatever the cached cascades had. Traced shadows don't read
+    // it at all.
+    if (shadowsEnabled() && !rayQueryShadows()) {
+        m_cascades.invalidate();
+        shadowmap = m_graph.importImage("shadow map", m_cascades.image(),
+                                        vk::ImageAspectFlagBits::eDepth,
+                                        vk::ImageLayout::eUndefined);
+    }
+    if (m_occlusion_culling) {
+        pyramid = m_graph.importImage("hi-z", vk::Image(), vk::ImageAspectFlagBits::eColor,
+                                      vk::ImageLayout::eGeneral);
+        m_graph.output(pyramid);
+    }
+
+    if (m_gpu_culling) {
+        const render_graph::handle pass = m_graph.addPass(
+          "culling", [this](vk::CommandBuffer command_buffer) { recordCulling(command_buffer); });
+
+        // The count is cleared with a fill and then bumped by the shader
+        m_graph.use(
+          pass, culled,
+          { vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+            vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderRead
+              | vk::AccessFlagBits::eShaderWrite });
+        if (m_occlusion_culling) {
+            m_graph.use(pass, pyramid,
+                        { vk::PipelineStageFlagBits::eComputeShader,
+                          vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral });
+        }
+    }
+
+    if (lightingEnabled()) {
+        const render_graph::handle pass =
+          m_graph.addPass("lights", [this](vk::CommandBuffer command_buffer) {
+              recordLightCulling(command_buffer);
+          });
+
+        m_graph.use(pass, clusters,
+                    { vk::PipelineStageFlagBits::eComputeShader,
+                      vk::AccessFlagBits::eShaderWrite });
+    }
+
+    // On the compute queue the pass records nothing, the frame's submission waits for the
+    // particles instead
+    if (particles != render_graph::invalid_handle) {
+        const render_graph::handle pass =
+          m_graph.addPass("particles", [this](vk::CommandBuffer command_buffer) {
+              recordParticles(command_buffer);
+          });
+
+        m_graph.use(pass, particles,
+                    { vk::PipelineStageFlagBits::eComputeShader,
+                      vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite });
+    }
+
+    // Only the skinned instances' ranges are written, after the previous frame has drawn them
+    if (skinned != render_graph::invalid_handle) {
+        const render_graph::handle pass =
+          m_graph.addPass("skinning", [this](vk::CommandBuffer command_buffer) {
+              recordSkinning(command_buffer);
+          });
+
+        m_graph.use(pass, skinned,
+                    { vk::PipelineStageFlagBits::eComputeShader,
+                      vk::AccessFlagBits::eShaderWrite });
+    }
+
+    // Read by the vertex input, or by the vertex shader when the vertices are pulled
+    const resource_use skinnedread = {
+        vk::PipelineStageFlagBits::eVertexInput | vk::PipelineStageFlagBits::eVertexShader,
+        vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eShaderRead
+    };
+
+    // Writes nothing the graph tracks, the barrier at its end makes the top level visible to the
+    // fragment shaders itself
+    if (rayQueryShadows()) {
+        m_graph.addPass(
+          "acceleration structures",
+          [this](vk::CommandBuffer command_buffer) {
+              recordAccelerationStructures(command_buffer);
+          },
+          true);
+    }
+
+    // The cascades that aren't rendered again keep their depths, so the image isn't discarded
+    if (shadowsEnabled() && !rayQueryShadows()) {
+        const render_graph::handle pass =
+          m_graph.addPass("shadows", [this](vk::CommandBuffer command_buffer) {
+              recordShadows(command_buffer);
+          });
+
+        if (skinned != render_graph::invalid_handle) {
+            m_graph.use(pass, skinned, skinnedread);
+        }
+
+        m_graph.use(pass, shadowmap,
+                    { vk::PipelineStageFlagBits::eEarlyFragmentTests
+                        | vk::PipelineStageFlagBits::eLateFragmentTests,
+                      vk::AccessFlagBits::eDepthStencilAttachmentRead
+                        | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+                      vk::ImageLayout::eDepthStencilAttachmentOptimal });
+    }
+
+    // The probes synchronize their own images and read nothing else the graph tracks but the
+    // skinned positions
+    if (m_reflections) {
+        const render_graph::handle pass = m_graph.addPass(
+          "reflection probes",
+          [this](vk::CommandBuffer command_buffer) { recordReflectionProbes(command_buffer); },
+          true);
+
+        if (skinned != render_graph::invalid_handle) {
+            m_graph.use(pass, skinned, skinnedread);
+        }
+    }
+
+    // The tiles and indirection beginFrame staged, once the frames before are done sampling them.
+    // The pages' barriers are memory barriers, which cover the indirection images as well.
+    if (pages != render_graph::invalid_handle) {
+        const render_graph::handle pass =
+          m_graph.addPass("virtual textures", [this](vk::CommandBuffer command_buffer) {
+              m_virtual_textures.record(command_buffer);
+          });
+
+        m_graph.use(pass, pages,
+                    { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite,
+                      vk::ImageLayout::eGeneral });
+    }
+
+    // The tiles the terrain's update staged, once the frames before are done fetching its heights
+    if (heights != render_graph::invalid_handle) {
+        const render_graph::handle pass =
+          m_graph.addPass("terrain", [this](vk::CommandBuffer command_buffer) {
+              m_terrain.record(command_buffer);
+          });
+
+        m_graph.use(pass, heights,
+                    { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite,
+                      vk::ImageLayout::eGeneral });
+    }
+
+    // Scattered over the heights the terrain pass copied, once the frame before has drawn it. The
+    // draw is reset by an update and then appended to by the shader.
+    if (grass != render_graph::invalid_handle) {
+        const render_graph::handle pass =
+          m_graph.addPass("vegetation", [this](vk::CommandBuffer command_buffer) {
+              m_profiler.scope(command_buffer, "vegetation", [=]() {
+                  m_vegetation.record(command_buffer, m_view_projection, m_camera_position);
+              });
+          });
+
+        m_graph.use(pass, heights,
+                    { vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead,
+                      vk::ImageLayout::eGeneral });
+        m_graph.use(
+          pass, grass,
+          { vk::PipelineStageFlagBits::eTransfer | vk::PipelineStageFlagBits::eComputeShader,
+            vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderRead
+              | vk::AccessFlagBits::eShaderWrite });
+    }
+
+    {
+        const render_graph::handle pass =
+          m_graph.addPass("main pass", [this](vk::CommandBuffer command_buffer) {
+              recordMainPass(command_buffer);
+          });
+
+        if (m_gpu_culling) {
+            m_graph.use(pass, culled,
+                        { vk::PipelineStageFlagBits::eDrawIndirect,
+                          vk::AccessFlagBits::eIndirectCommandRead });
+        }
+        if (clusters != render_graph::invalid_handle) {
+            m_graph.use(pass, clusters,
+                        { vk::PipelineStageFlagBits::eFragmentShader,
+                          vk::AccessFlagBits::eShaderRead });
+        }
+        if (skinned != render_graph::invalid_handle) {
+            m_graph.use(pass, skinned, skinnedread);
+        }
+        if (particles != render_graph::invalid_handle) {
+            m_graph.use(pass, particles,
+                        { vk::PipelineStageFlagBits::eDrawIndirect
+                            | vk::PipelineStageFlagBits::eVertexShader,
+                          vk::AccessFlagBits::eIndirectCommandRead
+                            | vk::AccessFlagBits::eShaderRead });
+        }
+        if (shadowmap != render_graph::invalid_handle) {
+            m_graph.use(pass, shadowmap,
+                        { vk::PipelineStageFlagBits::eFragmentShader,
+                          vk::AccessFlagBits::eShaderRead,
+                          vk::ImageLayout::eShaderReadOnlyOptimal });
+        }
+        if (pages != render_graph::invalid_handle) {
+            m_graph.use(pass, pages,
+                        { vk::PipelineStageFlagBits::eFragmentShader,
+                          vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral });
+            m_graph.use(pass, feedback,
+                        { vk::PipelineStageFlagBits::eFragmentShader,
+                          vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite });
+        }
+        if (occlusion != render_graph::invalid_handle) {
+            m_graph.use(pass, occlusion,
+                        { vk::PipelineStageFlagBits::eConditionalRenderingEXT,
+                          vk::AccessFlagBits::eConditionalRenderingReadEXT });
+        }
+        if (heights != render_graph::invalid_handle) {
+            m_graph.use(pass, heights,
+                        { vk::PipelineStageFlagBits::eVertexShader,
+                          vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral });
+        }
+        if (grass != render_graph::invalid_handle) {
+            m_graph.use(pass, grass,
+                        { vk::PipelineStageFlagBits::eDrawIndirect
+                            | vk::PipelineStageFlagBits::eVertexShader,
+                          vk::AccessFlagBits::eIndirectCommandRead
+                            | vk::AccessFlagBits::eShaderRead });
+        }
+
+        // All of them are cleared or resolved into by the render pass, which transitions them from
+        // whatever they were in
+        if (color != render_graph::invalid_handle) {
+            m_graph.use(pass, color,
+                        { vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                          vk::AccessFlagBits::eColorAttachmentWrite, vk::ImageLayout::eUndefined,
+                          vk::ImageLayout::eColorAttachmentOptimal });
+        }
+        for (render_graph::handle gbuffer : { gbuffercolor, gbuffernormal }) {
+            if (gbuffer != render_graph::invalid_handle) {
+                m_graph.use(pass, gbuffer,
+                            { vk::PipelineStageFlagBits::eColorAttachmentOutput
+                                | vk::PipelineStageFlagBits::eFragmentShader,
+                              vk::AccessFlagBits::eColorAttachmentWrite
+                                | vk::AccessFlagBits::eInputAttachmentRead,
+                              vk::ImageLayout::eUndefined,
+                              vk::ImageLayout::eShaderReadOnlyOptimal });
+            }
+        }
+        m_graph.use(pass, depth,
+                    { vk::PipelineStageFlagBits::eEarlyFragmentTests
+                        | vk::PipelineStageFlagBits::eLateFragmentTests,
+                      vk::AccessFlagBits::eDepthStencilAttachmentRead
+                        | vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+                      vk::ImageLayout::eUndefined,
+                      vk::ImageLayout::eDepthStencilAttachmentOptimal });
+        if (rates != render_graph::invalid_handle) {
+            m_graph.use(pass, rates,
+                        { vk::PipelineStageFlagBits::eFragmentShadingRateAttachmentKHR,
+                          vk::AccessFlagBits::eFragmentShadingRateAttachmentReadKHR,
+                          vk::ImageLayout::eFragmentShadingRateAttachmentOptimalKHR });
+        }
+        if (scene != render_graph::invalid_handle) {
+            m_graph.use(pass, scene,
+                        { vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                          vk::AccessFlagBits::eColorAttachmentWrite, vk::ImageLayout::eUndefined,
+                          vk::ImageLayout::eTransferSrcOptimal });
+        } else {
+            m_graph.use(pass, m_graph_target,
+                        { vk::PipelineStageFlagBits::eColorAttachmentOutput,
+                          vk::AccessFlagBits::eColorAttachmentWrite, vk::ImageLayout::eUndefined,
+                          finallayout });
+        }
+    }
+
+    // The queries the main pass ended go to the predicates of the frame after
+    if (occlusion != render_graph::invalid_handle) {
+        const render_graph::handle pass =
+          m_graph.addPass("occlusion queries", [this](vk::CommandBuffer command_buffer) {
+              m_occlusion.copy(command_buffer);
+          });
+
+        m_graph.use(pass, occlusion,
+                    { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite });
+    }
+
+    // Renders into images of its own, and only in frames that took a pick request, reading the
+    // positions like the main pass does
+    if (m_picking) {
+        const render_graph::handle pass = m_graph.addPass(
+          "pick",
+          [this](vk::CommandBuffer command_buffer) {
+              m_picker.record(command_buffer, m_current_frame);
+          },
+          true);
+
+        if (skinned != render_graph::invalid_handle) {
+            m_graph.use(pass, skinned, skinnedread);
+        }
+    }
+
+    // Records nothing, it's only there for the barrier that makes the tile IDs visible to
+    // beginFrame once the frame's fence has signalled
+    if (feedback != render_graph::invalid_handle) {
+        const render_graph::handle pass =
+          m_graph.addPass("virtual feedback", [](vk::CommandBuffer) {}, true);
+
+        m_graph.use(pass, feedback,
+                    { vk::PipelineStageFlagBits::eHost, vk::AccessFlagBits::eHostRead });
+    }
+
+    // The history is read and written both, one layer each
+    if (m_temporal_aa) {
+        const render_graph::handle pass =
+          m_graph.addPass("temporal", [this](vk::CommandBuffer command_buffer) {
+              m_profiler.scope(command_buffer, "temporal",
+                               [=]() { recordTemporal(command_buffer); });
+          });
+
+        m_graph.use(pass, scene,
+                    { vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead,
+                      vk::ImageLayout::eShaderReadOnlyOptimal });
+        m_graph.use(pass, depth,
+                    { vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead,
+                      vk::ImageLayout::eShaderReadOnlyOptimal });
+        for (render_graph::handle image : { motion, history }) {
+            m_graph.use(pass, image,
+                        { vk::PipelineStageFlagBits::eComputeShader,
+                          vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+                          vk::ImageLayout::eGeneral });
+        }
+    }
+
+    // From the frame and its motion vectors, once both are done being written
+    if (m_adaptive_shading) {
+        const render_graph::handle pass =
+          m_graph.addPass("shading rate", [this](vk::CommandBuffer command_buffer) {
+              m_profiler.scope(command_buffer, "shading rate",
+                               [=]() { recordShadingRates(command_buffer); });
+          });
+
+        m_graph.use(pass, scene,
+                    { vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead,
+                      vk::ImageLayout::eShaderReadOnlyOptimal });
+        if (m_temporal_aa) {
+            m_graph.use(pass, motion,
+                        { vk::PipelineStageFlagBits::eComputeShader,
+                          vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral });
+        }
+        m_graph.use(pass, rates,
+                    { vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite,
+                      vk::ImageLayout::eGeneral });
+    }
+
+    // Transitions the target to its final layout itself, right after the blit
+    if (scene != render_graph::invalid_handle && !m_post_processing) {
+        const render_graph::handle pass =
+          m_graph.addPass("upscale", [this](vk::CommandBuffer command_buffer) {
+              m_profiler.scope(command_buffer, "upscale",
+                               [=]() { recordUpscale(command_buffer); });
+          });
+
+        if (m_temporal_aa) {
+            m_graph.use(pass, history,
+                        { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead,
+                          vk::ImageLayout::eGeneral });
+        } else {
+            m_graph.use(pass, scene,
+                        { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead,
+                          vk::ImageLayout::eTransferSrcOptimal });
+        }
+        m_graph.use(pass, m_graph_target,
+                    { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite,
+                      vk::ImageLayout::eTransferDstOptimal, finallayout });
+    }
+
+    // Instead of the upscale pass, and like it transitions the target to its final layout itself.
+    // The bloom chain is the post stack's own and only ever used within the pass.
+    if (m_post_processing) {
+        const render_graph::handle pass =
+          m_graph.addPass("post", [this](vk::CommandBuffer command_buffer) {
+              m_profiler.scope(command_buffer, "post", [=]() { recordPost(command_buffer); });
+          });
+
+        if (m_temporal_aa) {
+            m_graph.use(pass, history,
+                        { vk::PipelineStageFlagBits::eComputeShader,
+                          vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral });
+        } else {
+            m_graph.use(pass, scene,
+                        { vk::PipelineStageFlagBits::eComputeShader,
+                          vk::AccessFlagBits::eShaderRead,
+                          vk::ImageLayout::eShaderReadOnlyOptimal });
+        }
+        if (m_post_direct) {
+            m_graph.use(pass, m_graph_target,
+                        { vk::PipelineStageFlagBits::eComputeShader,
+                          vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eGeneral,
+                          finallayout });
+        } else {
+            m_graph.use(pass, m_graph_target,
+                        { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite,
+                          vk::ImageLayout::eTransferDstOptimal, finallayout });
+        }
+    }
+
+    // Also after frames that weren't GPU culled, so the pyramid is never more than a frame old
+    if (m_occlusion_culling) {
+        const render_graph::handle pass =
+          m_graph.addPass("hi-z", [this](vk::CommandBuffer command_buffer) {
+              m_profiler.scope(command_buffer, "hi-z", [=]() {
+                  m_profiler.statistics(command_buffer, "hi-z",
+                                        [=]() { m_hiz.record(command_buffer); });
+              });
+          });
+
+        m_graph.use(pass, depth,
+                    { vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead,
+                      vk::ImageLayout::eShaderReadOnlyOptimal });
+        m_graph.use(pass, pyramid,
+                    { vk::PipelineStageFlagBits::eComputeShader,
+                      vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+                      vk::ImageLayout::eGeneral });
+    }
+
+    if (m_offscreen) {
+        const render_graph::handle pass = m_graph.addPass(
+          "readback",
+          [this](vk::CommandBuffer command_buffer) {
+              m_offscreen_target.recordReadback(command_buffer, m_current_frame, m_frame_number);
+          },
+          true);
+
+        m_graph.use(pass, m_graph_target,
+                    { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead,
+                      vk::ImageLayout::eTransferSrcOptimal });
+    }
+
+    // Copies the frame out whenever a screenshot was asked for, and otherwise only costs the two
+    // layout transitions around it. A target that is presented is moved back by the pass itself.
+    if (m_screenshots) {
+        const render_graph::handle pass = m_graph.addPass(
+          "screenshot",
+          [this](vk::CommandBuffer command_buffer) {
+              const vk::Image target = m_graph.image(m_graph_target);
+              m_frame_readback.record(command_buffer, m_current_frame, target, m_swapchain_extent,
+                                      m_swapchain_image_format, m_frame_number);
+              if (!m_offscreen) {
+                  barrier_batch barriers;
+                  barriers.transition(
+                    target, vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1),
+                    vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::ePresentSrcKHR);
+                  barriers.record(command_buffer);
+              }
+          },
+          true);
+
+        m_graph.use(pass, m_graph_target,
+                    { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead,
+                      vk::ImageLayout::eTransferSrcOptimal, finallayout });
+    }
+
+    // Records every frame, and moves the target back to its final layout itself, like the
+    // screenshot pass
+    if (m_video_settings.sink) {
+        const vk::ImageLayout videolayout = m_video_convert
+                                              ? vk::ImageLayout::eShaderReadOnlyOptimal
+                                              : vk::ImageLayout::eTransferSrcOptimal;
+
+        const render_graph::handle pass = m_graph.addPass(
+          "video",
+          [this, videolayout, finallayout](vk::CommandBuffer command_buffer) {
+              m_profiler.scope(command_buffer, "video", [=]() {
+                  const vk::Image target = m_graph.image(m_graph_target);
+                  m_video.record(command_buffer, m_current_frame, target,
+                                 m_swapchain_image_views[m_recording_image], m_swapchain_extent,
+                                 m_swapchain_image_format, m_frame_number);
+                  if (videolayout != finallayout) {
+                      barrier_batch barriers;
+                      barriers.transition(
+                        target,
+                        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1),
+                        videolayout, finallayout);
+                      barriers.record(command_buffer);
+                  }
+              });
+          },
+          true);
+
+        if (m_video_convert) {
+            m_graph.use(pass, m_graph_target,
+                        { vk::PipelineStageFlagBits::eComputeShader,
+                          vk::AccessFlagBits::eShaderRead, videolayout, finallayout });
+        } else {
+            m_graph.use(pass, m_graph_target,
+                        { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead,
+                          videolayout, finallayout });
+        }
+    }
+
+    m_graph.compile();
+
+    m_depth_image = m_graph.image(depth);
+    m_depth_image_view = createImageView(m_depth_image, depthformat,
+                                         vk::ImageAspectFlagBits::eDepth, 1, viewCount());
+    if (color != render_graph::invalid_handle) {
+        m_color_image      = m_graph.image(color);
+        m_color_image_view = createImageView(m_color_image, m_swapchain_image_format,
+                                             vk::ImageAspectFlagBits::eColor, 1, viewCount());
+    }
+    if (m_deferred_shading) {
+        m_gbuffer_color       = m_graph.image(gbuffercolor);
+        m_gbuffer_color_view  = createImageView(m_gbuffer_color, gbuffer_color_format,
+                                                vk::ImageAspectFlagBits::eColor, 1);
+        m_gbuffer_normal      = m_graph.image(gbuffernormal);
+        m_gbuffer_normal_view = createImageView(m_gbuffer_normal, gbuffer_normal_format,
+                                                vk::ImageAspectFlagBits::eColor, 1);
+    }
+    if (scene != render_graph::invalid_handle) {
+        m_scene_image      = m_graph.image(scene);
+        m_scene_image_view = createImageView(m_scene_image, m_swapchain_image_format,
+                                             vk::ImageAspectFlagBits::eColor, 1, viewCount());
+    }
+
+    // Submitted on its own since this also runs when the swap chain is recreated. Nothing has to
+    // wait for it, the graphics queue executes it before the next frame.
+    if (m_occlusion_culling) {
+        upload_batch uploads = m_uploads.begin();
+        m_hiz.create(uploads, m_render_extent, m_depth_image_view, m_deletion_queue,
+                     m_frame_number);
+        uploads.submit();
+
+        m_graph.setImage(pyramid, m_hiz.image(), vk::ImageLayout::eGeneral);
+    }
+
+    // Their first use takes them out of undefined, starting the history over
+    if (m_temporal_aa) {
+        m_temporal.create(m_render_extent, m_swapchain_extent, m_scene_image_view,
+                          m_depth_image_view, m_deletion_queue, m_frame_number);
+
+        m_graph.setImage(motion, m_temporal.motionImage(), vk::ImageLayout::eUndefined);
+        m_graph.setImage(history, m_temporal.historyImage(), vk::ImageLayout::eUndefined);
+    }
+
+    // From whichever layer of the history was resolved last, or from the scene image
+    if (m_post_processing) {
+        std::vector<vk::ImageView> sources = { m_scene_image_view };
+        vk::ImageLayout            layout  = vk::ImageLayout::eShaderReadOnlyOptimal;
+        if (m_temporal_aa) {
+            sources = { m_temporal.historyView(0), m_temporal.historyView(1) };
+            layout  = vk::ImageLayout::eGeneral;
+        }
+        m_post.create(m_swapchain_extent, sources, layout,
+                      m_post_direct ? m_swapchain_image_views : std::vector<vk::ImageView>(),
+                      m_deletion_queue, m_frame_number);
+    }
+    if (m_adaptive_shading) {
+        m_shading_rates.create(m_render_extent, m_scene_image_view,
+                               m_temporal_aa ? m_temporal.motionView() : vk::ImageView(),
+                               m_deletion_queue, m_frame_number);
+
+        m_graph.setImage(rates, m_shading_rates.image(), vk::ImageLayout::eUndefined);
+    }
+}
+
+
+// Simulates and draws a frame on the calling thread
+void
+renderer::drawFrame()
+{
+    simulate(m_packet);
+    drawFrame(m_packet);
+}
+
+/*
+Everything about the frame that doesn't need the GPU: the clock, the scene graph, the camera, where
+the lights are and what is drawn. With a render thread this runs on the main thread while the frame
+before is recorded, so it reads nothing the render thread writes, and writes only the packet and
+the simulation's own state.
+
+The scene is simulated in the fixed steps of m_clock, however many of them the real time since the
+last frame makes, and drawn between its last two states. What only depends on the time, the camera
+path and the lights, is placed at the present's time instead, which is the same as interpolating.
+*/
+void
+renderer::simulate(frame_packet& packet)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    // Replays too, since the captured packets don't have any
+    packet.quality = m_requested_quality;
+
+    // A replay's packets are the captured ones, and nothing is simulated at all
+    if (m_replay.isOpen()) {
+        replayFrame(packet);
+        return;
+    }
+
+    // Benchmarks see the same frames however fast they run, a step each, and a paused animation
+    // none at all, however long it was paused for
+    const int64_t now     = core::profileNow();
+    double        elapsed = m_simulated_at != 0 ? (double)(now - m_simulated_at) / 1e9 : 0.0;
+    if (m_benchmarking) {
+        elapsed = m_clock.step();
+    } else if (!m_animating) {
+        elapsed = 0.0;
+    }
+    m_simulated_at = m_animating ? now : 0;
+
+    // The model transform is per draw, so it goes in the draw buffer instead of the UBO
+    const uint32_t steps = m_clock.advance(elapsed);
+    for (uint32_t i = 0; i < steps; ++i) {
+        m_mesh_angle = std::fmod(m_mesh_angle + (float)m_clock.step() * glm::radians(90.f),
+                                 6.2831853f);
+        m_scene.setRotation(m_mesh_node, glm::angleAxis(m_mesh_angle, glm::vec3(0.f, 0.f, 1.f)));
+        m_scene.update(&m_jobs);
+    }
+    updateEntities(steps);
+
+    const float alpha = m_clock.alpha();
+    const float time  = (float)m_clock.interpolatedTime();
+
+    packet.time            = time;
+    packet.camera_position = m_scene_center + glm::vec3(2.f, 2.f, 2.f) * m_scene_extent;
+    packet.camera_target   = m_scene_center;
+
+    // Circles the origin, getting closer and further away, so that the levels of detail, culling
+    // and texture streaming all get something to do. A stress scene widens the circle to fit.
+    if (m_benchmarking) {
+        const float angle      = time * glm::radians(20.f);
+        const float radius     = (2.8f + 1.5f * std::sin(time * 0.5f)) * m_scene_extent;
+        packet.camera_position = m_scene_center + glm::vec3(radius * std::cos(angle),
+                                                            radius * std::sin(angle),
+                                                            2.f * m_scene_extent);
+    }
+    latchedCamera(packet.camera_position, packet.camera_target);
+
+    packet.draws.clear();
+    packet.draws.push_back({ &m_mesh, m_texture, m_scene.interpolatedWorld(m_mesh_node, alpha) });
+    for (size_t i = 0; i < m_skinned_meshes.size(); ++i) {
+        packet.draws.push_back({ &m_skinned_meshes[i], m_texture, m_skinned_transforms[i] });
+    }
+    extractEntities(packet, alpha);
+
+    // The lights circle the mesh at different heights, radii and speeds, spread out by the golden
+    // ratio so that no two follow each other, and every fourth one is a spot light shining down
+    packet.lights.clear();
+    const float golden = 0.618034f;
+    for (uint32_t i = 0; i < m_light_count; ++i) {
+        const float sequence = std::fmod(i * golden, 1.f);
+        const float other    = std::fmod(i * golden * golden, 1.f);
+
+        const float radius = (0.3f + 1.7f * sequence) * m_scene_extent;
+        const float angle  = 6.2831853f * other + time * (0.2f + 0.6f * sequence);
+
+        light source;
+        source.position =
+          m_scene_center + glm::vec3(radius * std::cos(angle), radius * std::sin(angle),
+                                     (0.1f + 0.6f * other) * m_scene_extent);
+        source.range = (0.4f + 0.4f * other) * m_scene_extent;
+        source.color = hue(sequence) * 2.f;
+        if (i % 4 == 3) {
+            source.direction  = glm::vec3(0.f, 0.f, -1.f);
+            source.spot_outer = std::cos(glm::radians(40.f));
+            source.spot_inner = std::cos(glm::radians(30.f));
+        }
+        packet.lights.push_back(source);
+    }
+
+    packet.hud = m_hud_visible;
+
+    if (m_capture.isOpen()) {
+        captureFrame(packet);
+    }
+}
+
+// Once everything is initialized, so whatever the replay first draws has been loaded like it had
+// been when it was captured
+void
+renderer::openCaptures()
+{
+    if (!m_capture_path.empty()) {
+        m_capture.open(m_capture_path);
+    }
+    if (!m_replay_path.empty()) {
+        m_replay.open(m_replay_path);
+    }
+}
+
+void
+renderer::captureFrame(const frame_packet& packet)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    captured_frame& frame = m_captured;
+    frame.time            = packet.time;
+    frame.camera_position = packet.camera_position;
+    frame.camera_target   = packet.camera_target;
+    frame.hud             = packet.hud;
+    frame.meshes.clear();
+    frame.textures.clear();
+
+    const auto capture = [&](const draw_request& draw) {
+        captured_draw captured;
+        captured.mesh      = captureMesh(draw.mesh);
+        captured.texture   = captureTexture(draw.texture);
+        captured.transform = draw.transform;
+        return captured;
+    };
+
+    frame.draws.clear();
+    for (const draw_request& draw : packet.draws) {
+        frame.draws.push_back(capture(draw));
+    }
+
+    frame.changes.clear();
+    for (const scene_change& change : packet.scene_changes) {
+        captured_change captured;
+        captured.slot = change.slot;
+        captured.live = change.live;
+        if (change.live) {
+            captured.draw = capture(change.draw);
+        }
+        frame.changes.push_back(captured);
+    }
+
+    frame.lights.assign(packet.lights.begin(), packet.lights.end());
+    m_capture.write(frame);
+}
+
+/*
+Draws the next captured frame, or the last one again once there are no more, without its scene
+changes since those have been made already. Meshes that the renderer has no name for, or no longer
+has, aren't drawn, and draws with textures that couldn't be loaded get the default one.
+*/
+bool
+renderer::replayFrame(frame_packet& packet)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    captured_frame& frame = m_captured;
+    const bool      read  = !m_replay_done && m_replay.read(frame);
+    if (read) {
+        for (const captured_name& mesh : frame.meshes) {
+            if (mesh.id >= m_replay_meshes.size()) {
+                m_replay_meshes.resize((size_t)mesh.id + 1, nullptr);
+            }
+            m_replay_meshes[mesh.id] = namedMesh(mesh.name);
+        }
+
+        // The captured session had these loaded by now, this one may not have
+        for (const captured_name& texture : frame.textures) {
+            texture_handle handle = m_texture_cache.find(texture.name);
+            if (handle == resource_cache<texture_streamer::handle>::invalid_handle) {
+                handle = acquireTextureAsync(texture.name);
+            }
+            m_replay_textures[texture.id] = handle;
+        }
+    } else {
+        m_replay_done = true;
+        frame.changes.clear();
+    }
+
+    const auto replay = [&](const captured_draw& captured, draw_request& draw) {
+        draw.mesh =
+          captured.mesh < m_replay_meshes.size() ? m_replay_meshes[captured.mesh] : nullptr;
+        auto found     = m_replay_textures.find(captured.texture);
+        draw.texture   = found != m_replay_textures.end() ? found->second : m_texture;
+        draw.transform = captured.transform;
+        if (draw.texture == resource_cache<texture_streamer::handle>::invalid_handle) {
+            draw.texture = m_texture;
+        }
+        return draw.mesh != nullptr;
+    };
+
+    packet.time            = frame.time;
+    packet.camera_position = frame.camera_position;
+    packet.camera_target   = frame.camera_target;
+    packet.hud             = frame.hud;
+
+    packet.draws.clear();
+    for (const captured_draw& captured : frame.draws) {
+        draw_request draw;
+        if (replay(captured, draw)) {
+            packet.draws.push_back(draw);
+        }
+    }
+
+    // A slot whose mesh isn't there is emptied instead
+    packet.scene_changes.clear();
+    for (const captured_change& captured : frame.changes) {
+        scene_change change;
+        change.slot        = captured.slot;
+        change.live        = captured.live && replay(captured.draw, change.draw);
+        change.draw.object = captured.slot;
+        packet.scene_changes.push_back(change);
+    }
+
+    packet.lights.assign(frame.lights.begin(), frame.lights.end());
+    return read;
+}
+
+// Ids are handed out in the order meshes are first drawn in. One without a name is still given
+// one, with an empty name, so it's only looked up once.
+uint32_t
+renderer::captureMesh(const Mesh* mesh)
+{
+    if (!mesh) {
+        return capture_none;
+    }
+
+    auto found = m_capture_meshes.find(mesh);
+    if (found != m_capture_meshes.end()) {
+        return found->second;
+    }
+
+    const uint32_t id = (uint32_t)m_capture_meshes.size();
+    m_capture_meshes.emplace(mesh, id);
+    m_captured.meshes.push_back({ id, meshName(mesh) });
+    return id;
+}
+
+// Textures keep their handles as ids, named by their path the first time they are drawn
+uint32_t
+renderer::captureTexture(texture_handle texture)
+{
+    if (texture == resource_cache<texture_streamer::handle>::invalid_handle) {
+        return capture_none;
+    }
+    if (m_capture_textures.insert(texture).second) {
+        m_captured.textures.push_back({ texture, m_texture_cache.path(texture) });
+    }
+    return texture;
+}
+
+/*
+The meshes the renderer makes itself, which are the same ones again in a session set up the same
+way. Every entity of setEntities draws m_mesh too.
+*/
+std::string
+renderer::meshName(const Mesh* mesh) const
+{
+    if (mesh == &m_mesh) {
+        return "mesh";
+    }
+    if (mesh == &m_stress_mesh) {
+        return "stress cube";
+    }
+    for (size_t i = 0; i < m_skinned_meshes.size(); ++i) {
+        if (mesh == &m_skinned_meshes[i]) {
+            return "skinned " + std::to_string(i);
+        }
+    }
+    return std::string();
+}
+
+const Mesh*
+renderer::namedMesh(const std::string& name) const
+{
+    if (name == "mesh") {
+        return &m_mesh;
+    }
+    if (name == "stress cube") {
+        return m_stress_mesh.geometry ? &m_stress_mesh : nullptr;
+    }
+    for (size_t i = 0; i < m_skinned_meshes.size(); ++i) {
+        if (name == "skinned " + std::to_string(i)) {
+            return &m_skinned_meshes[i];
+        }
+    }
+    return nullptr;
+}
+
+/*
+This is practically the core loop. Here we update and load the uniform variables per frame.
+
+The tutorial mentioned something about push variables that are more efficient at sending small
+amounts memory to the GPU, instead of using an expensive buffer operation
+
+https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkCmdPushConstants
+*/
+uint32_t
+renderer::updateUniformBuffer(const frame_packet& packet)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_scene_time      = packet.time;
+    m_camera_position = packet.camera_position;
+
+    // Everything the frame culls and draws with comes after this, so they all agree on the camera
+    glm::vec3 target = packet.camera_target;
+    latchedCamera(m_camera_position, target);
+
+    // Each eye sees half of the target in stereo
+    const float fovy   = glm::radians(45.0f);
+    const float aspect =
+      m_swapchain_extent.width / (float)(m_swapchain_extent.height * (m_stereo ? 2 : 1));
+
+    glm::mat4 view = glm::lookAt(m_camera_position, target, glm::vec3(0.f, 0.f, 1.f));
+    glm::mat4 proj = reversePerspective(fovy, aspect, near_plane);
+
+    // GLM was originally designed for OpenGL, where the Y coordinate of the clip coordinates is
+    // inverted. The easiest way to compensate for that is to flip the sign on the scaling factor of
+    // the Y axis in the projection matrix. If you don't do this, then the image will be rendered
+    // upside down.
+    proj[1][1] *= -1;
+
+    // A baking frame looks at its mesh from its view, whose projection is flipped already
+    if (m_impostor_baking && m_impostor_mesh < m_impostor_subjects.size()) {
+        const float radius = std::max(m_impostor_subjects[m_impostor_mesh].mesh->radius, 1e-3f);
+        view               = impostorView(m_impostor_view, radius);
+        proj               = impostorProjection(radius);
+        m_camera_position  = impostorDirection(m_impostor_view) * (2.f * radius);
+    }
+    m_projection_scale = -proj[1][1];
+
+    // Multiplying the matrices together once here saves every vertex from doing it again
+    m_view            = view;
+    m_projection      = proj;
+    m_view_projection = proj * view;
+
+    m_draw_view_projection = m_view_projection;
+    m_cull_frustum         = extractFrustum(m_view_projection);
+
+    // Only what is drawn is jittered, in clip space so it moves the same fraction of a pixel at
+    // any depth. Culling, picking and the motion vectors go by the camera as it is.
+    if (m_temporal_aa) {
+        const glm::vec2 jitter = m_temporal.jitter(m_frame_number);
+        const glm::vec2 offset = jitter * 2.f
+                                 / glm::vec2((float)m_render_extent.width,
+                                             (float)m_render_extent.height);
+
+        m_temporal_frame.jitter = jitter;
+        m_temporal_frame.reset  = m_history_reset.exchange(false);
+        m_temporal_frame.reprojection =
+          m_previous_view_projection * glm::inverse(m_view_projection);
+
+        m_draw_view_projection =
+          glm::translate(glm::mat4(1.f), glm::vec3(offset, 0.f)) * m_view_projection;
+    }
+
+    uniformbufferobject ubo;
+    ubo.viewproj = m_draw_view_projection;
+    if (m_stereo) {
+        stereoViews(fovy, aspect, ubo.views);
+    } else if (!m_viewports.empty()) {
+        viewportViews(fovy, ubo.views);
+    }
+
+    // The ring is persistently mapped, so this is just a memcpy into the current frame's region
+    m_uniforms.beginFrame(m_current_frame);
+    return m_uniforms.push(ubo);
+}
+
+/*
+The eyes look the same way as the camera, half their separation to either side of it, so their
+views are the camera's moved along its x axis and their projections its own. Both of their frustums
+fit into one with the same field of view from as far behind the camera as puts its sides through
+the outer eye on either side, which the frame culls against.
+*/
+void
+renderer::stereoViews(float fovy, float aspect, glm::mat4 (&views)[4])
+{
+    const float     offset = m_stereo_settings.eye_separation * 0.5f;
+    const glm::mat4 left   = glm::translate(glm::mat4(1.f), glm::vec3(offset, 0.f, 0.f));
+    const glm::mat4 right  = glm::translate(glm::mat4(1.f), glm::vec3(-offset, 0.f, 0.f));
+    views[0]               = m_projection * left * m_view;
+    views[1]               = m_projection * right * m_view;
+
+    const float back = offset / (aspect * std::tan(fovy * 0.5f));
+    glm::mat4   proj = reversePerspective(fovy, aspect, near_plane + back);
+    proj[1][1] *= -1;
+
+    const glm::mat4 behind = glm::translate(glm::mat4(1.f), glm::vec3(0.f, 0.f, -back));
+    m_cull_frustum         = extractFrustum(proj * behind * m_view);
+}
+
+/*
+The camera is the first view and every viewport the one after its number, seen with the same field
+of view at its window's aspect ratio. Their layers are as large as the window's target, and the
+blits stretch them to the viewports' images. Since the viewports may look anywhere, there is no
+frustum that holds all of them, and the one the frame culls against holds everything.
+*/
+void
+renderer::viewportViews(float fovy, glm::mat4 (&views)[4])
+{
+    views[0] = m_view_projection;
+
+    std::lock_guard<std::mutex> lock(m_camera_mutex);
+    for (size_t i = 0; i < m_viewports.size(); ++i) {
+        const viewport& v      = m_viewports[i];
+        const float     aspect = v.extent.width / (float)std::max(v.extent.height, 1u);
+
+        glm::mat4 proj = reversePerspective(fovy, aspect, near_plane);
+        proj[1][1] *= -1;
+        views[i + 1] = proj * glm::lookAt(v.settings.camera_position, v.settings.camera_target,
+                                          glm::vec3(0.f, 0.f, 1.f));
+    }
+
+    for (glm::vec4& plane : m_cull_frustum.planes) {
+        plane = glm::vec4(0.f, 0.f, 0.f, 1.f);
+    }
+}
+
+// Deferred shading lights the G-buffer with the same clusters, and the reflections are added where
+// the lighting is done. Multiview frames aren't lit, the clusters are the camera's.
+bool
+renderer::lightingEnabled() const
+{
+    if (multiview()) {
+        return false;
+    }
+    return m_light_count > 0
+           || (m_shader_features & (1u << (uint32_t)shader_feature::lighting)) != 0
+           || shadowsEnabled() || m_deferred_shading || m_reflections;
+}
+
+// The shadows are looked up where the lighting is done, so they turn it on as well
+bool
+renderer::shadowsEnabled() const
+{
+    if (multiview()) {
+        return false;
+    }
+    return m_shadows || (m_shader_features & (1u << (uint32_t)shader_feature::shadows)) != 0;
+}
+
+// Whatever is drawn after the materials, see recordLateDraws
+bool
+renderer::lateDraws() const
+{
+    return m_particle_count > 0 || m_debug_draw || m_hud || m_occlusion_queries
+           || m_terrain_active || m_vegetation_active || m_impostors_active;
+}
+
+// Pushes the packet's lights, see setLights and simulate
+void
+renderer::updateLights(const frame_packet& packet)
+{
+    if (!lightingEnabled()) {
+        return;
+    }
+
+    SHINY_PROFILE_FUNCTION();
+
+    m_lighting.beginFrame(m_current_frame, m_view, m_projection, m_render_extent, near_plane,
+                          far_plane);
+
+    // Before the draw list, whose casters are culled against the cascades
+    if (shadowsEnabled()) {
+        m_cascades.beginFrame(m_current_frame, m_view, m_projection, near_plane, shadow_distance,
+                              sun_direction, sun_color);
+    }
+
+    // And the probes' faces
+    if (m_reflections) {
+        m_probes.beginFrame(m_current_frame, m_view, sun_direction, sun_color);
+    }
+
+    for (const light& source : packet.lights) {
+        m_lighting.push(source);
+
+        if (m_debug_draw) {
+            m_debug.sphere(source.position, source.range,
+                           debugColor(source.color.r, source.color.g, source.color.b, 0.5f));
+        }
+    }
+}
+
+/*
+Samples every skinned instance's palette straight into this frame's region, in batches on the jobs,
+each instance a little further into the clip than the one before, and pushes its job. Not until the
+instances have been uploaded, the skinning would be overwritten by the upload otherwise.
+*/
+void
+renderer::updateSkinning()
+{
+    if (m_skinned_meshes.empty() || !m_uploads.isComplete(m_scene_ticket)) {
+        return;
+    }
+
+    SHINY_PROFILE_FUNCTION();
+
+    m_skinning.beginFrame(m_current_frame);
+
+    // Those further away only every few frames. The rest keep the positions they were last
+    // skinned to, which only they write.
+    const std::vector<uint32_t>& due   = m_animator.schedule(m_frame_number, m_camera_position);
+    const uint32_t               count = (uint32_t)due.size();
+
+    uint32_t         first   = 0;
+    glm::mat4* const palette = m_skinning.palettes(count * skinned_joints, first);
+    m_animator.sample(m_jobs, m_scene_time, palette);
+
+    const uint32_t vertexcount = skinned_rings * skinned_sides;
+    for (uint32_t i = 0; i < count; ++i) {
+        m_skinning.push({ m_skin_source, vertexcount, first + i * skinned_joints,
+                          m_skinned_meshes[due[i]].geometry.vertex_offset });
+    }
+
+    // What the cascades cached has moved
+    if (shadowsEnabled() && count > 0) {
+        m_cascades.invalidate();
+    }
+}
+
+// Before the pipelines, which are made with its layout
+void
+renderer::createHud()
+{
+    if (!m_hud) {
+        return;
+    }
+
+    m_hud_sprites.init(m_device, m_allocator, m_layouts, max_hud_sprites, m_frames_in_flight,
+                       m_bindless_textures ? m_texture_set_layout : vk::DescriptorSetLayout());
+}
+
+// The font goes into an atlas of its own, one more texture of the streamer which never has more
+// than its one level, so it stays resident
+void
+renderer::createHudAtlas(upload_batch& uploads)
+{
+    if (!m_hud) {
+        return;
+    }
+
+    m_hud_atlas.init(256, 256);
+    if (!m_hud_atlas.addFont(hud_font_scale)) {
+        throw std::runtime_error("The HUD's font doesn't fit its atlas!");
+    }
+
+    const texture_streamer::handle texture = m_textures.add(uploads, m_hud_atlas.textureData());
+    m_hud_texture = m_hud_sprites.addTexture(texture, m_textures.view(texture), m_texture_sampler);
+    m_overlay.init(m_hud_atlas, m_hud_texture);
+}
+
+/*
+The perf_overlay, rebuilt every frame it is shown. Frames are recorded into it either way.
+Not until the atlas has been uploaded with everything else loaded at startup.
+*/
+void
+renderer::updateHud(const frame_packet& packet)
+{
+    if (!m_hud) {
+        return;
+    }
+
+    m_hud_sprites.beginFrame(m_current_frame);
+    m_overlay.recordFrame(core::profileNow(), m_uploads.takeSubmittedBytes());
+    if (!packet.hud || !m_uploads.isComplete(m_scene_ticket)) {
+        return;
+    }
+
+    // Still last frame's draw list, which is the one the profilers have the numbers of by now
+    overlay_counters counters;
+    counters.draws = (uint32_t)m_draw_list.size();
+    if (m_allocation_tracking) {
+        counters.tracked_allocations = true;
+        counters.allocations         = m_frame_allocations;
+    }
+    for (const draw_item& item : m_draw_list) {
+        counters.triangles += (uint64_t)(item.index_count / 3) * item.instance_count;
+    }
+
+    m_overlay.build(m_hud_sprites, m_profiler, m_allocator, counters);
+    m_hud_sprites.finish();
+}
+
+/*
+What the telemetry stream has besides the zones, once a frame while a client is connected: the time
+since the frame before was submitted, the GPU time of the last frame that was measured, and the
+device memory allocated, all of which are already at hand.
+*/
+void
+renderer::publishTelemetry()
+{
+    const int64_t now      = core::profileNow();
+    const int64_t previous = m_telemetry_at;
+    m_telemetry_at         = now;
+    if (!m_telemetry.connected() || previous == 0) {
+        return;
+    }
+
+    m_telemetry.publish("frame ms", (double)(now - previous) * 1e-6, now);
+
+    float    gpu     = 0.f;
+    uint64_t samples = 0;
+    if (m_profiler.latest("frame", gpu, samples)) {
+        m_telemetry.publish("gpu ms", gpu, now);
+    }
+
+    vk::DeviceSize allocated = 0;
+    for (const memory_heap_report& heap : m_allocator.report()) {
+        if (heap.device_local) {
+            allocated += heap.allocated;
+        }
+    }
+    m_telemetry.publish("device memory MiB", (double)allocated / (1024. * 1024.), now);
+}
+
+// F3 shows and hides the overlay, on the frame the key goes down
+void
+renderer::toggleHud()
+{
+    if (!m_hud) {
+        return;
+    }
+
+    const bool pressed = glfwGetKey(m_window, GLFW_KEY_F3) == GLFW_PRESS;
+    if (pressed && !m_hud_key) {
+        m_hud_visible = !m_hud_visible;
+    }
+    m_hud_key = pressed;
+}
+
+// Space pauses and resumes the animation on demand, on the frame the key goes down
+void
+renderer::animationKey()
+{
+    if (!m_on_demand) {
+        return;
+    }
+
+    const bool pressed = glfwGetKey(m_window, GLFW_KEY_SPACE) == GLFW_PRESS;
+    if (pressed && !m_animation_key) {
+        m_animating = !m_animating;
+    }
+    m_animation_key = pressed;
+}
+
+// F12 saves a screenshot, on the frame the key goes down
+void
+renderer::screenshotKey()
+{
+    if (!m_screenshots) {
+        return;
+    }
+
+    const bool pressed = glfwGetKey(m_window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (pressed && !m_screenshot_key) {
+        saveScreenshot("screenshot " + std::to_string(m_screenshot_count++) + ".png");
+    }
+    m_screenshot_key = pressed;
+}
+
+// F4 switches to the next quality tier, on the frame the key goes down, from ultra back to low
+void
+renderer::qualityKey()
+{
+    const bool pressed = glfwGetKey(m_window, GLFW_KEY_F4) == GLFW_PRESS;
+    if (pressed && !m_quality_key) {
+        setQualityTier((quality_tier)(((uint32_t)m_quality_tier + 1) % quality_tier_count));
+        core::logInfo() << "Quality " << qualityTierName(m_quality_tier);
+    }
+    m_quality_key = pressed;
+}
+
+// The cursor is in screen coordinates, which are only the framebuffer's pixels without scaling
+void
+renderer::pickButton()
+{
+    if (!m_picking) {
+        return;
+    }
+
+    const bool pressed = glfwGetMouseButton(m_window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    if (pressed && !m_pick_button) {
+        double x = 0.0;
+        double y = 0.0;
+        int    windowwidth, windowheight, width, height;
+        glfwGetCursorPos(m_window, &x, &y);
+        glfwGetWindowSize(m_window, &windowwidth, &windowheight);
+        glfwGetFramebufferSize(m_window, &width, &height);
+
+        if (x >= 0.0 && y >= 0.0 && x < windowwidth && y < windowheight) {
+            requestPick((uint32_t)(x * width / windowwidth), (uint32_t)(y * height / windowheight),
+                        [](const pick_result& result) {
+                            if (result.object == pick_none) {
+                                core::logInfo() << "Picked nothing at " << result.x << ", "
+                                                << result.y;
+                            } else {
+                                core::logInfo() << "Picked entity " << result.object << " at "
+                                                << result.x << ", " << result.y;
+                            }
+                        });
+        }
+    }
+    m_pick_button = pressed;
+}
+
+bool
+renderer::requestPick(uint32_t x, uint32_t y, pick_callback deliver)
+{
+    if (!m_picking) {
+        return false;
+    }
+    m_picker.request(x, y, std::move(deliver));
+    if (m_on_demand) {
+        requestRedraw();
+    }
+    return true;
+}
+
+void
+renderer::latchCamera(const glm::vec3& position, const glm::vec3& target)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_camera_mutex);
+        m_camera_latched   = true;
+        m_latched_position = position;
+        m_latched_target   = target;
+    }
+    if (m_on_demand) {
+        requestRedraw();
+    }
+}
+
+void
+renderer::releaseCamera()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_camera_mutex);
+        m_camera_latched = false;
+    }
+    if (m_on_demand) {
+        requestRedraw();
+    }
+}
+
+bool
+renderer::loading()
+{
+    return !m_uploads.idle() || m_textures.reading() || m_virtual_textures.reading()
+           || m_terrain.reading() || m_pipelines.compiling();
+}
+
+uint32_t
+renderer::addViewport(const viewport_settings& settings)
+{
+    if (m_viewports.size() == max_viewports) {
+        throw std::runtime_error("There can't be more than " + std::to_string(max_viewports)
+                                 + " viewports!");
+    }
+
+    viewport v;
+    v.settings = settings;
+    v.extent   = vk::Extent2D(settings.width, settings.height);
+    m_viewports.push_back(std::move(v));
+    return (uint32_t)m_viewports.size() - 1;
+}
+
+void
+renderer::setViewportCamera(uint32_t number, const glm::vec3& position, const glm::vec3& target)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_camera_mutex);
+        if (number < m_viewports.size()) {
+            m_viewports[number].settings.camera_position = position;
+            m_viewports[number].settings.camera_target   = target;
+        }
+    }
+    if (m_on_demand) {
+        requestRedraw();
+    }
+}
+
+// Both simulate() and updateUniformBuffer() take it, the latter for the latest there is by the
+// time the frame is recorded, the former for captures
+bool
+renderer::latchedCamera(glm::vec3& position, glm::vec3& target)
+{
+    if (m_benchmarking || m_replay.isOpen()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_camera_mutex);
+    if (!m_camera_latched) {
+        return false;
+    }
+    position = m_latched_position;
+    target   = m_latched_target;
+    return true;
+}
+
+bool
+renderer::requestScreenshot(offscreen_callback deliver)
+{
+    if (!m_screenshots) {
+        return false;
+    }
+    m_frame_readback.request(std::move(deliver));
+    if (m_on_demand) {
+        requestRedraw();
+    }
+    return true;
+}
+
+/*
+The pixels are only there while the callback runs, which is on the render thread, so it copies
+them for the job that encodes them and leaves the rest of the work to it.
+*/
+bool
+renderer::saveScreenshot(const std::string& path)
+{
+    return requestScreenshot([this, path](const offscreen_frame& frame) {
+        auto pixels = std::make_shared<std::vector<uint8_t>>(
+          frame.pixels, frame.pixels + (size_t)frame.width * frame.height * 4);
+
+        offscreen_frame copy = frame;
+        auto save = [path, pixels, copy]() mutable {
+            copy.pixels = pixels->data();
+            if (writeImageFile(path, copy)) {
+                core::logInfo() << "Saved " << path;
+            } else {
+                core::logError() << "Failed to save " << path;
+            }
+        };
+        m_jobs.run(m_screenshot_saves, std::move(save), core::thread_class::background);
+    });
+}
+
+/*
+Counts what the last frame allocated, on any thread from the start of its drawFrame() to the start
+of this one, and fails if any of that was on a thread that wasn't allowed to. The frame only just
+ended, so the exception points right at it.
+*/
+void
+renderer::trackAllocations()
+{
+    if (!m_allocation_tracking) {
+        return;
+    }
+
+    const core::alloc_counts total = core::allocTotals();
+    m_frame_allocations            = total - m_allocations_at_frame;
+    m_allocations_at_frame         = total;
+
+    const core::alloc_violation violation = core::takeAllocViolations();
+    if (violation.count > 0) {
+        throw std::runtime_error("Frame " + std::to_string(m_frame_number) + " allocated "
+                                 + std::to_string(violation.count)
+                                 + " times while drawing, the first time "
+                                 + std::to_string(violation.bytes) + " bytes in "
+                                 + (violation.subsystem ? violation.subsystem : "no profile zone"));
+    }
+}
+
+// Every profile zone that allocated, the most often first, once the renderer is done
+void
+renderer::reportAllocations()
+{
+    if (!m_allocation_tracking) {
+        return;
+    }
+
+    std::vector<core::alloc_subsystem> subsystems;
+    core::allocSubsystems(subsystems);
+    std::sort(subsystems.begin(), subsystems.end(),
+              [](const core::alloc_subsystem& a, const core::alloc_subsystem& b) {
+                  return a.counts.allocations > b.counts.allocations;
+              });
+
+    core::logInfo() << "Allocations by profile zone:";
+    for (const core::alloc_subsystem& subsystem : subsystems) {
+        core::logInfo() << "\t" << (subsystem.name ? subsystem.name : "(none)") << ": "
+                        << subsystem.counts.allocations << " allocations, "
+                        << subsystem.counts.bytes << " bytes";
+    }
+}
+
+/*
+Collects everything the packet asks to draw. For now that is only the test geometry, but nothing
+about the recording depends on how many items there are. Whatever is outside the view is culled
+once everything has been added.
+*/
+void
+renderer::buildDrawList(const frame_packet& packet)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_draw_list.clear();
+    m_draw_transforms.clear();
+    m_draw_objects.clear();
+    m_draw_bounds.clear();
+    m_meshlet_culls.clear();
+    m_occluders.clear();
+
+    // The fence has been waited on, so whatever this frame in flight queried last is there
+    if (m_occlusion_queries) {
+        m_occlusion.beginFrame(m_current_frame);
+    }
+    if (rayQueryShadows()) {
+        m_acceleration.beginFrame(m_current_frame);
+    }
+
+    // Until the uploads of what is loaded at startup are done there is nothing to draw but the
+    // clear color
+    if (!m_uploads.isComplete(m_scene_ticket)) {
+        m_gpu_culled     = false;
+        m_scene_resident = false;
+        return;
+    }
+    if (m_scene_ticket != 0 && !m_scene_visible) {
+        m_scene_visible = true;
+        core::logInfo() << "Scene visible after "
+                        << (double)(core::profileNow() - m_start_time) / 1e6 << " ms";
+    }
+
+    // A baking frame draws its mesh alone, at the origin, see setImpostorBaking
+    if (m_impostor_baking) {
+        m_gpu_culled     = false;
+        m_scene_resident = false;
+        m_portals_active = false;
+        drawImpostorSubject();
+        return;
+    }
+
+    // The cells seen from the camera's decide what drawMesh adds at all, before any culling
+    m_portals_active = !m_portals.empty() && !multiview();
+    if (m_portals_active) {
+        m_portals.traverse(m_camera_position, m_cull_frustum);
+    }
+
+    // The terrain's rings go around the camera, and stream its heights in as they move
+    if (m_terrain_active) {
+        m_terrain.update(m_current_frame, m_camera_position, m_cull_frustum);
+    }
+    if (m_impostors_active) {
+        m_impostors.beginFrame(m_current_frame, m_cull_frustum);
+    }
+
+    for (const draw_request& request : packet.draws) {
+        m_draw_object = request.object;
+        drawMesh(*request.mesh, m_texture_cache.get(request.texture), request.transform);
+    }
+    m_draw_object = pick_none;
+
+    // The render scene's instances are on the GPU already, so only its batches are added. The
+    // casters are picked out of the draw list though, so with shadows they are drawn from the copy.
+    const bool resident =
+      m_render_scene_enabled && m_gpu_culling && !shadowsEnabled() && !m_portals_active;
+    if (m_render_scene_enabled && !resident) {
+        drawSceneDraws();
+    }
+
+    // While everything is still in the list, also what the camera doesn't see
+    if (rayQueryShadows()) {
+        collectRayInstances();
+    } else if (shadowsEnabled()) {
+        collectShadowCasters();
+    }
+    if (m_reflections) {
+        collectProbeDraws();
+    }
+    if (m_picking
+        && m_picker.beginFrame(m_current_frame, m_view_projection, m_render_extent,
+                               m_swapchain_extent)) {
+        collectPickCandidates(resident);
+    }
+
+    if (resident) {
+        addSceneBatches();
+    }
+
+    // Draws that all share their buffers and pipeline go out as one indirect draw, so they can be
+    // culled on the GPU and nothing about them has to be recorded per instance
+    m_gpu_culled =
+      m_gpu_culling && !m_draw_list.empty()
+      && std::all_of(m_draw_list.begin(), m_draw_list.end(), [&](const draw_item& item) {
+             return item.vertex_buffer == m_draw_list.front().vertex_buffer
+                    && item.index_buffer == m_draw_list.front().index_buffer
+                    && item.index_type == m_draw_list.front().index_type
+                    && item.pipeline == m_draw_list.front().pipeline;
+         });
+
+    // Drawn on the CPU after all, the batches make way for the instances they would have drawn
+    m_scene_resident = resident && m_gpu_culled;
+    if (resident && !m_gpu_culled) {
+        m_draw_list.resize(m_scene_first_draw);
+        drawSceneDraws();
+    }
+
+    // A GPU culled frame is drawn by one indirect draw, in whatever order the shader puts them
+    if (!m_gpu_culled) {
+        cullDrawList();
+        if (m_occlusion_queries) {
+            queryOcclusion();
+        }
+        sortDrawList();
+    }
+
+    // The textures are mapped across the whole mesh, and the streamer keeps the largest request
+    for (const draw_request& request : packet.draws) {
+        const float size = screenSize(*request.mesh, request.transform);
+        m_textures.request(m_texture_cache.get(request.texture), size);
+        for (texture_handle texture : request.mesh->textures) {
+            if (texture != resource_cache<texture_streamer::handle>::invalid_handle
+                && !isVirtualTexture(m_texture_cache.get(texture))) {
+                m_textures.request(m_texture_cache.get(texture), size);
+            }
+        }
+    }
+}
+
+// The latched subject, where updateUniformBuffer put the camera for its view, casting shadows on
+// itself if there are any
+void
+renderer::drawImpostorSubject()
+{
+    if (m_impostor_mesh >= m_impostor_subjects.size()) {
+        return;
+    }
+
+    const impostor_subject& subject = m_impostor_subjects[m_impostor_mesh];
+    const glm::mat4         origin(1.f);
+    drawMesh(*subject.mesh, subject.texture, origin);
+
+    if (rayQueryShadows()) {
+        collectRayInstances();
+    } else if (shadowsEnabled()) {
+        collectShadowCasters();
+    }
+    if (m_reflections) {
+        collectProbeDraws();
+    }
+    cullDrawList();
+    sortDrawList();
+
+    const float size = screenSize(*subject.mesh, origin);
+    m_textures.request(subject.texture, size);
+    for (texture_handle texture : subject.mesh->textures) {
+        if (texture != resource_cache<texture_streamer::handle>::invalid_handle
+            && !isVirtualTexture(m_texture_cache.get(texture))) {
+            m_textures.request(m_texture_cache.get(texture), size);
+        }
+    }
+}
+
+/*
+Culls the draw list's instances against every cascade, and adds those in it to the cascade's
+casters. The levels of detail are those picked for the camera.
+*/
+void
+renderer::collectShadowCasters()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    for (uint32_t cascade = 0; cascade < shadow_cascade_count; ++cascade) {
+        m_draw_bounds.cull(m_cascades.cascadeFrustum(cascade), m_shadow_visible);
+
+        for (const draw_item& item : m_draw_list) {
+            shadow_caster caster;
+            caster.vertex_buffer = item.vertex_buffer;
+            caster.index_buffer  = item.index_buffer;
+            caster.index_type    = item.index_type;
+            caster.index_count   = item.index_count;
+            caster.first_index   = item.first_index;
+            caster.vertex_offset = item.vertex_offset;
+            caster.input         = (uint32_t)item.format;
+
+            for (uint32_t i = 0; i < item.instance_count; ++i) {
+                const uint32_t instance = item.first_transform + i;
+                if (m_shadow_visible[instance]) {
+                    caster.transform = m_draw_transforms[instance];
+                    m_cascades.push(cascade, caster);
+                }
+            }
+        }
+    }
+}
+
+/*
+Culls the draw list's instances against every face the reflection probes capture this frame, and
+adds those in it to the face's draws. The levels of detail are those picked for the camera.
+*/
+void
+renderer::collectProbeDraws()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    for (uint32_t face = 0; face < m_probes.faces(); ++face) {
+        m_draw_bounds.cull(m_probes.faceFrustum(face), m_probe_visible);
+
+        for (const draw_item& item : m_draw_list) {
+            probe_draw draw;
+            draw.vertex_buffer    = item.vertex_buffer;
+            draw.attribute_buffer = item.attribute_buffer;
+            draw.index_buffer     = item.index_buffer;
+            draw.index_type       = item.index_type;
+            draw.index_count      = item.index_count;
+            draw.first_index      = item.first_index;
+            draw.vertex_offset    = item.vertex_offset;
+            draw.input            = (uint32_t)item.format;
+            draw.texture          = bindlessIndex(item.texture);
+
+            for (uint32_t i = 0; i < item.instance_count; ++i) {
+                const uint32_t instance = item.first_transform + i;
+                if (m_probe_visible[instance]) {
+                    draw.transform = m_draw_transforms[instance];
+                    m_probes.push(face, draw);
+                }
+            }
+        }
+    }
+}
+
+/*
+Pushes every instance in the draw list into the frame's acceleration structures, whatever the
+camera sees, since anything may shadow what it does. The levels of detail are those picked for the
+camera. Items that don't draw from the geometry pool, or whose vertices can't be built from, cast
+no shadows.
+*/
+void
+renderer::collectRayInstances()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    for (const draw_item& item : m_draw_list) {
+        if (item.vertex_buffer != m_geometry.positionBuffer() || item.vertex_count == 0
+            || !m_ray_formats[(size_t)item.format]) {
+            continue;
+        }
+
+        const bool   packed = item.format == vertex_format::packed;
+        ray_geometry geometry;
+        geometry.vertex_offset = item.vertex_offset;
+        geometry.vertex_count  = item.vertex_count;
+        geometry.first_index   = item.first_index;
+        geometry.index_count   = item.index_count;
+        geometry.index_type    = item.index_type;
+        geometry.vertex_format =
+          packed ? vk::Format::eR16G16B16A16Unorm : vk::Format::eR32G32B32Sfloat;
+        geometry.vertex_stride = packed ? sizeof(packed_position) : sizeof(vertex_position);
+
+        const uint32_t id = m_acceleration.geometry(geometry);
+        if (id == ~0u) {
+            continue;
+        }
+        for (uint32_t i = 0; i < item.instance_count; ++i) {
+            m_acceleration.push(id, m_draw_transforms[item.first_transform + i]);
+        }
+    }
+}
+
+/*
+Culls the draw list's instances against the pick region, and makes those in it candidates, with
+the levels of detail picked for the camera. When the render scene's instances are drawn from the
+GPU, its slots aren't in the draw list, so they are culled on their own and drawn whole like its
+batches are.
+*/
+void
+renderer::collectPickCandidates(bool scene)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const frustum& region = m_picker.regionFrustum();
+    m_draw_bounds.cull(region, m_pick_visible);
+
+    for (const draw_item& item : m_draw_list) {
+        pick_candidate candidate;
+        candidate.vertex_buffer = item.vertex_buffer;
+        candidate.index_buffer  = item.index_buffer;
+        candidate.index_type    = item.index_type;
+        candidate.index_count   = item.index_count;
+        candidate.first_index   = item.first_index;
+        candidate.vertex_offset = item.vertex_offset;
+        candidate.input         = (uint32_t)item.format;
+
+        for (uint32_t i = 0; i < item.instance_count; ++i) {
+            const uint32_t instance = item.first_transform + i;
+            if (m_pick_visible[instance] && m_draw_objects[instance] != pick_none) {
+                candidate.transform = m_draw_transforms[instance];
+                candidate.object    = m_draw_objects[instance];
+                m_picker.push(candidate);
+            }
+        }
+    }
+
+    if (!scene) {
+        return;
+    }
+
+    // The same spheres addDrawItem bounds the instances with
+    m_pick_bounds.clear();
+    for (const draw_request& draw : m_scene_draws) {
+        // An empty slot keeps its place, and is skipped below
+        if (!draw.mesh) {
+            m_pick_bounds.push(glm::vec3(0.f), 0.f);
+            continue;
+        }
+
+        const glm::vec3 center = (draw.mesh->bounds_min + draw.mesh->bounds_max) * 0.5f;
+        const float     scale  = std::max({ glm::length(glm::vec3(draw.transform[0])),
+                                            glm::length(glm::vec3(draw.transform[1])),
+                                            glm::length(glm::vec3(draw.transform[2])) });
+        m_pick_bounds.push(glm::vec3(draw.transform * glm::vec4(center, 1.f)),
+                           glm::length(draw.mesh->bounds_max - center) * scale);
+    }
+    m_pick_bounds.cull(region, m_pick_visible);
+
+    for (uint32_t slot = 0; slot < (uint32_t)m_scene_draws.size(); ++slot) {
+        const draw_request& draw = m_scene_draws[slot];
+        if (!draw.mesh || !m_pick_visible[slot]) {
+            continue;
+        }
+
+        const Mesh& mesh = *draw.mesh;
+
+        mesh_lod whole;
+        whole.index_count = mesh.geometry.index_count;
+
+        const mesh_lod& lod = mesh.submeshes.empty() && !mesh.lods.empty() ? mesh.lods[0] : whole;
+
+        pick_candidate candidate;
+        candidate.vertex_buffer = m_geometry.positionBuffer();
+        candidate.index_buffer  = m_geometry.indexBuffer();
+        candidate.index_type    = mesh.geometry.index_type;
+        candidate.index_count   = lod.index_count;
+        candidate.first_index   = mesh.geometry.first_index + lod.first_index;
+        candidate.vertex_offset = (int32_t)mesh.geometry.vertex_offset;
+        candidate.input         = (uint32_t)mesh.format;
+        candidate.transform     = mesh.format == vertex_format::packed
+                                    ? draw.transform * mesh.dequantize
+                                    : draw.transform;
+        candidate.object        = slot;
+        m_picker.push(candidate);
+    }
+}
+
+/*
+Projects the mesh's bounding sphere. This is only meant to pick mip levels, so the sphere is treated
+as if it was facing the camera head on.
+*/
+float
+renderer::screenSize(const Mesh& mesh, const glm::mat4& transform) const
+{
+    const float scale  = std::max({ glm::length(glm::vec3(transform[0])),
+                                    glm::length(glm::vec3(transform[1])),
+                                    glm::length(glm::vec3(transform[2])) });
+    const float radius = mesh.radius * scale;
+
+    // With a perspective projection w is the distance along the view direction
+    const float distance = (m_view_projection * transform * glm::vec4(0.f, 0.f, 0.f, 1.f)).w;
+    if (distance <= radius) {
+        return std::numeric_limits<float>::max();
+    }
+
+    return radius * m_projection_scale * m_render_extent.height / distance;
+}
+
+/*
+The coarsest of the submesh's levels whose simplification error, projected the same way as the
+bounding sphere is for screenSize, stays below lod_error_pixels. Counted from the submesh's first.
+Each level of LOD bias doubles the error allowed, the same as it does the texels' footprint.
+*/
+uint32_t
+renderer::selectLod(const Mesh& mesh, const submesh& part, const glm::mat4& transform) const
+{
+    if (mesh.radius <= 0.f) {
+        return 0;
+    }
+
+    // screenSize is the sphere's diameter, so this is how many pixels a unit of model space covers
+    const float pixels = screenSize(mesh, transform) / (2.f * mesh.radius);
+    const float allowed = lod_error_pixels * std::exp2(m_quality.lod_bias);
+
+    uint32_t lod = 0;
+    while (lod + 1 < part.lod_count
+           && mesh.lods[part.first_lod + lod + 1].error * pixels <= allowed) {
+        ++lod;
+    }
+    return lod;
+}
+
+/*
+Instancing: every copy of the mesh is drawn by the same command, and the vertex shader tells them
+apart by gl_InstanceIndex, which picks each copy's transform out of the draw buffer. Thousands of
+identical props therefore cost a single draw, or one per level of detail they are seen at.
+
+A mesh with materials is drawn a submesh at a time, each with its material's texture where it has
+one, so it costs a draw per material and level. The draw list is sorted by texture, which keeps
+those of the same material together.
+*/
+void
+renderer::drawMesh(const Mesh&      mesh,
+                   uint32_t         texture,
+                   const glm::mat4* transforms,
+                   uint32_t         count,
+                   material         surface)
+{
+    if (!mesh.geometry || count == 0) {
+        return;
+    }
+
+    // Instances go by the cell their bounding sphere's center is in, with the same sphere as
+    // addDrawItem's culling
+    if (m_portals_active) {
+        const glm::vec3 center = (mesh.bounds_min + mesh.bounds_max) * 0.5f;
+        const float     radius = glm::length(mesh.bounds_max - center);
+
+        m_portal_transforms.clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            const glm::mat4& transform = transforms[i];
+            const float      scale     = std::max({ glm::length(glm::vec3(transform[0])),
+                                                    glm::length(glm::vec3(transform[1])),
+                                                    glm::length(glm::vec3(transform[2])) });
+            if (m_portals.visible(glm::vec3(transform * glm::vec4(center, 1.f)), radius * scale)) {
+                m_portal_transforms.push_back(transform);
+            }
+        }
+        if (m_portal_transforms.empty()) {
+            return;
+        }
+        transforms = m_portal_transforms.data();
+        count      = (uint32_t)m_portal_transforms.size();
+    }
+
+    if (m_debug_draw) {
+        const uint32_t color = surface == material::opaque ? debugColor(0.2f, 1.f, 0.3f, 0.6f)
+                                                           : debugColor(1.f, 0.8f, 0.2f, 0.6f);
+        for (uint32_t i = 0; i < count; ++i) {
+            m_debug.box(mesh.bounds_min, mesh.bounds_max, transforms[i], color);
+        }
+    }
+
+    // Instances too small on screen to be worth the mesh's triangles are impostors instead, as
+    // long as the frame has room for them
+    if (m_impostors_active && surface == material::opaque) {
+        const auto subject =
+          std::find_if(m_impostor_subjects.begin(), m_impostor_subjects.end(),
+                       [&](const impostor_subject& s) {
+                           return s.mesh == &mesh && s.texture == texture;
+                       });
+        if (subject != m_impostor_subjects.end()) {
+            const uint32_t layer = (uint32_t)(subject - m_impostor_subjects.begin());
+
+            m_impostor_kept.clear();
+            for (uint32_t i = 0; i < count; ++i) {
+                if (screenSize(mesh, transforms[i]) >= m_impostor_pixels
+                    || !m_impostors.add(transforms[i], mesh.radius, layer)) {
+                    m_impostor_kept.push_back(transforms[i]);
+                }
+            }
+            if (m_impostor_kept.empty()) {
+                return;
+            }
+            transforms = m_impostor_kept.data();
+            count      = (uint32_t)m_impostor_kept.size();
+        }
+    }
+
+    // Without submeshes the mesh is a single one, of all of its levels
+    submesh all;
+    all.lod_count = (uint32_t)mesh.lods.size();
+
+    const size_t partcount = std::max<size_t>(mesh.submeshes.size(), 1);
+    for (size_t s = 0; s < partcount; ++s) {
+        const submesh& part = mesh.submeshes.empty() ? all : mesh.submeshes[s];
+
+        uint32_t parttexture = texture;
+        if (part.material < mesh.textures.size()
+            && mesh.textures[part.material]
+                 != resource_cache<texture_streamer::handle>::invalid_handle) {
+            const texture_streamer::handle streamed =
+              m_texture_cache.get(mesh.textures[part.material]);
+            if (isVirtualTexture(streamed)) {
+                if (m_virtual_textures.ready(
+                      m_virtual_textures.fromSlot(streamed & ~virtual_texture_bit))) {
+                    parttexture = streamed;
+                }
+            } else if (m_textures.view(streamed)) {
+                parttexture = streamed;
+            }
+        }
+
+        if (part.lod_count <= 1) {
+            mesh_lod whole;
+            whole.index_count = mesh.geometry.index_count;
+
+            addDrawItem(mesh, part.lod_count == 0 ? whole : mesh.lods[part.first_lod], parttexture,
+                        transforms, count, surface);
+            continue;
+        }
+
+        m_lod_transforms.resize(std::max(m_lod_transforms.size(), (size_t)part.lod_count));
+        for (std::vector<glm::mat4>& lodtransforms : m_lod_transforms) {
+            lodtransforms.clear();
+        }
+
+        for (uint32_t i = 0; i < count; ++i) {
+            m_lod_transforms[selectLod(mesh, part, transforms[i])].push_back(transforms[i]);
+        }
+
+        for (uint32_t lod = 0; lod < part.lod_count; ++lod) {
+            const std::vector<glm::mat4>& lodtransforms = m_lod_transforms[lod];
+            if (!lodtransforms.empty()) {
+                addDrawItem(mesh, mesh.lods[part.first_lod + lod], parttexture,
+                            lodtransforms.data(), (uint32_t)lodtransforms.size(), surface);
+            }
+        }
+    }
+}
+
+void
+renderer::addDrawItem(const Mesh&      mesh,
+                      const mesh_lod&  lod,
+                      uint32_t         texture,
+                      const glm::mat4* transforms,
+                      uint32_t         count,
+                      material         surface)
+{
+    draw_item item;
+    item.vertex_buffer    = m_geometry.positionBuffer();
+    item.attribute_buffer = m_geometry.attributeBuffer();
+    item.index_buffer     = m_geometry.indexBuffer();
+    item.index_type       = mesh.geometry.index_type;
+    item.index_count      = lod.index_count;
+    item.first_index      = mesh.geometry.first_index + lod.first_index;
+    item.vertex_offset    = (int32_t)mesh.geometry.vertex_offset;
+    item.first_transform  = (uint32_t)m_draw_transforms.size();
+    item.instance_count   = count;
+    item.texture          = texture;
+    item.format           = mesh.format;
+    item.pipeline         = m_material_pipelines[(size_t)mesh.format][(size_t)surface];
+    item.prepass_pipeline = m_prepass_pipelines[(size_t)mesh.format][(size_t)surface];
+    item.subpass          = m_material_states[(size_t)mesh.format][(size_t)surface].subpass;
+    item.shading_rate     = m_shading_rate_settings.materials[(size_t)surface];
+
+    // The skinned meshes' positions are written again every frame, see updateSkinning
+    const bool skinned = !m_skinned_meshes.empty() && &mesh >= m_skinned_meshes.data()
+                         && &mesh < m_skinned_meshes.data() + m_skinned_meshes.size();
+    item.vertex_count = skinned ? 0 : mesh.geometry.vertex_count;
+
+    // With a perspective projection w is the distance along the view direction. Instances are
+    // sorted as a whole, by the first one.
+    const glm::vec3 center   = (mesh.bounds_min + mesh.bounds_max) * 0.5f;
+    const float     distance = (m_view_projection * transforms[0] * glm::vec4(center, 1.f)).w;
+
+    item.sort_key = drawSortKey(surface, texture, item.first_index, distance);
+    m_draw_list.push_back(item);
+
+    // Packed positions are taken back to model space as part of the transform. The bounds below
+    // are the model space ones, so they go with the model matrices as they are.
+    if (mesh.format == vertex_format::packed) {
+        for (uint32_t i = 0; i < count; ++i) {
+            m_draw_transforms.push_back(transforms[i] * mesh.dequantize);
+        }
+    } else {
+        m_draw_transforms.insert(m_draw_transforms.end(), transforms, transforms + count);
+    }
+    if (m_picking) {
+        m_draw_objects.insert(m_draw_objects.end(), count, m_draw_object);
+    }
+
+    // The box's bounding sphere is only a little looser, and spheres stay spheres under any
+    // transform, scaled by its largest scale factor
+    const float radius = glm::length(mesh.bounds_max - center);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const glm::mat4& transform = transforms[i];
+        const float      scale     = std::max({ glm::length(glm::vec3(transform[0])),
+                                                glm::length(glm::vec3(transform[1])),
+                                                glm::length(glm::vec3(transform[2])) });
+
+        m_draw_bounds.push(glm::vec3(transform * glm::vec4(center, 1.f)), radius * scale);
+    }
+
+    // Where it's told apart by what it draws and where, as one box for all of its submeshes
+    if (m_occlusion_queries && count == 1 && lod.index_count >= occlusion_query_indices) {
+        const glm::mat4&      transform = transforms[0];
+        const geometry_range& geometry  = mesh.geometry;
+        const glm::vec3       extent    = (mesh.bounds_max - mesh.bounds_min) * 0.5f;
+
+        uint64_t key = 0xcbf29ce484222325ull;
+        key          = fnv1a(key, &geometry.first_index, sizeof(geometry.first_index));
+        key          = fnv1a(key, &geometry.vertex_offset, sizeof(geometry.vertex_offset));
+        key          = fnv1a(key, &transform, sizeof(transform));
+
+        occluder box;
+        box.key    = key;
+        box.box    = glm::scale(glm::translate(transform, center), extent);
+        box.center = glm::vec3(transform * glm::vec4(center, 1.f));
+        box.radius = radius
+                     * std::max({ glm::length(glm::vec3(transform[0])),
+                                  glm::length(glm::vec3(transform[1])),
+                                  glm::length(glm::vec3(transform[2])) });
+
+        m_draw_list.back().occluder = (uint32_t)m_occluders.size();
+        m_occluders.push_back(box);
+    }
+
+    // A cone that faces away from the camera may not from another view
+    if (m_gpu_culling && lod.meshlet_count > 0) {
+        const bool backfaces =
+          (bool)(m_material_states[(size_t)mesh.format][(size_t)surface].cull_mode
+                 & vk::CullModeFlagBits::eBack);
+        addMeshletCulls(mesh, lod, m_draw_list.back(), transforms, backfaces && !multiview());
+    }
+}
+
+/*
+Meshlets are culled on their own only on the GPU, where each one that passes gets a draw of its own
+without the CPU having to look at them. The bounds go to world space the same way the instances'
+do. Cones only stay cones under uniform scaling, and only mean anything when back faces are
+culled, so otherwise the meshlets are culled by their spheres alone.
+*/
+void
+renderer::addMeshletCulls(const Mesh&      mesh,
+                          const mesh_lod&  lod,
+                          draw_item&       item,
+                          const glm::mat4* transforms,
+                          bool             backfaces)
+{
+    item.first_meshlet_cull = (uint32_t)m_meshlet_culls.size();
+    item.meshlet_cull_count = item.instance_count * lod.meshlet_count;
+
+    const uint32_t draw = (uint32_t)m_draw_list.size() - 1;
+
+    for (uint32_t i = 0; i < item.instance_count; ++i) {
+        const glm::mat4& transform = transforms[i];
+        const glm::vec3  scales(glm::length(glm::vec3(transform[0])),
+                                glm::length(glm::vec3(transform[1])),
+                                glm::length(glm::vec3(transform[2])));
+        const float      scale = std::max({ scales.x, scales.y, scales.z });
+        const bool       cones =
+          backfaces && std::min({ scales.x, scales.y, scales.z }) >= scale * 0.999f;
+
+        for (uint32_t m = lod.first_meshlet; m < lod.first_meshlet + lod.meshlet_count; ++m) {
+            const meshlet& cluster = mesh.meshlets[m];
+
+            cull_instance cull;
+            cull.sphere      = glm::vec4(glm::vec3(transform * glm::vec4(cluster.center, 1.f)),
+                                         cluster.radius * scale);
+            cull.draw        = draw;
+            cull.instance    = item.first_transform + i;
+            cull.first_index = mesh.geometry.first_index + cluster.first_index;
+            cull.index_count = cluster.index_count;
+
+            if (cones && cluster.cone_cutoff < 1.f) {
+                const glm::vec3 axis = glm::normalize(glm::mat3(transform) * cluster.cone_axis);
+                cull.cone            = glm::vec4(axis, cluster.cone_cutoff);
+            }
+
+            m_meshlet_culls.push_back(cull);
+        }
+    }
+}
+
+/*
+Tests every instance in the draw list against the view frustum in one batch, then drops the ones
+outside from their items and the items that have none left. Instances only ever move towards the
+front, so it's all done in place.
+*/
+void
+renderer::cullDrawList()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_draw_bounds.cull(m_cull_frustum, m_draw_visible);
+
+    uint32_t kept      = 0;
+    uint32_t instances = 0;
+
+    for (const draw_item& original : m_draw_list) {
+        draw_item item       = original;
+        item.first_transform = instances;
+
+        for (uint32_t i = 0; i < original.instance_count; ++i) {
+            const uint32_t instance = original.first_transform + i;
+            if (m_draw_visible[instance]) {
+                m_draw_transforms[instances++] = m_draw_transforms[instance];
+            }
+        }
+
+        item.instance_count = instances - item.first_transform;
+        if (item.instance_count > 0) {
+            m_draw_list[kept++] = item;
+        }
+    }
+
+    m_draw_list.resize(kept);
+    m_draw_transforms.resize(instances);
+}
+
+/*
+Queries the boxes of the items in view that have them, and has the previous results of those
+boxes decide whether the items are drawn: with conditional rendering by a predicate on the GPU,
+otherwise by being left out of the list here. A hidden item's box is queried all the same, which
+is how it comes back. Boxes the camera is in or about to be in are neither queried nor trusted,
+since their near faces are clipped by the near plane.
+*/
+void
+renderer::queryOcclusion()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    uint32_t kept = 0;
+    for (const draw_item& original : m_draw_list) {
+        draw_item item = original;
+        if (item.occluder != ~0u) {
+            const occluder& box = m_occluders[item.occluder];
+            if (glm::length(box.center - m_camera_position) > box.radius + 2.f * near_plane) {
+                m_occlusion.push(box.key, box.box);
+                if (m_conditional_rendering) {
+                    item.occlusion_predicate = m_occlusion.predicate(box.key);
+                } else if (m_occlusion.occluded(box.key)) {
+                    continue;
+                }
+            }
+        }
+        m_draw_list[kept++] = item;
+    }
+
+    // Their transforms stay behind, sortDrawList only copies those of what is left
+    m_draw_list.resize(kept);
+}
+
+/*
+Orders the draw list by the items' sort keys, see drawSortKey. recordDraws only binds what differs
+from the previous draw, and draws runs of items with the same pipeline and buffers in one go, so
+this is what keeps the binds and draw calls down. The transforms are moved along with their items
+so that every item's transforms still start where the previous item's end.
+*/
+void
+renderer::sortDrawList()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_draw_keys.clear();
+    for (uint32_t i = 0; i < (uint32_t)m_draw_list.size(); ++i) {
+        sort_entry entry;
+        entry.key   = m_draw_list[i].sort_key;
+        entry.value = i;
+        m_draw_keys.push_back(entry);
+    }
+
+    radixSort(m_draw_keys, m_draw_keys_scratch);
+
+    m_sorted_draw_list.clear();
+    m_sorted_draw_transforms.clear();
+
+    for (const sort_entry& entry : m_draw_keys) {
+        draw_item item = m_draw_list[entry.value];
+
+        const glm::mat4* transforms = m_draw_transforms.data() + item.first_transform;
+        item.first_transform        = (uint32_t)m_sorted_draw_transforms.size();
+
+        m_sorted_draw_transforms.insert(m_sorted_draw_transforms.end(), transforms,
+                                        transforms + item.instance_count);
+        m_sorted_draw_list.push_back(item);
+    }
+
+    m_draw_list.swap(m_sorted_draw_list);
+    m_draw_transforms.swap(m_sorted_draw_transforms);
+}
+
+/*
+Writes one VkDrawIndexedIndirectCommand per draw list item and one transform per instance into this
+frame's region of the draw buffer. Item i ends up as draw i, which recordDraws relies on.
+*/
+void
+renderer::writeDrawBuffer()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_draws.beginFrame(m_current_frame);
+
+    // The whole transform is combined on the CPU, once per instance, so the vertex shader only
+    // does a single matrix-vector product. The model matrices aren't needed after this frame.
+    // With multiview they are drawn as they are, the vertex shader has each view's projection.
+    if (!multiview()) {
+        core::multiplyTransforms(m_draw_view_projection, m_draw_transforms.data(),
+                                 m_draw_transforms.data(), (uint32_t)m_draw_transforms.size());
+    }
+
+    for (const draw_item& item : m_draw_list) {
+        auto command = vk::DrawIndexedIndirectCommand()
+                         .setIndexCount(item.index_count)
+                         .setInstanceCount(item.instance_count)
+                         .setFirstIndex(item.first_index)
+                         .setVertexOffset(item.vertex_offset);
+
+        m_draws.push(command, m_draw_transforms.data() + item.first_transform,
+                     bindlessIndex(item.texture), (uint32_t)item.format);
+    }
+
+    // The render scene's instances are written by its expansion, after everyone else's
+    if (m_scene_resident) {
+        m_scene_first_instance = m_draws.reserveInstances(m_render_scene.size());
+    }
+
+    m_draws.finish();
+
+    // Culling on the GPU needs every instance's bounds, in the same order as the instances
+    if (m_gpu_culled) {
+        m_culling.beginFrame(m_current_frame);
+
+        for (uint32_t draw = 0; draw < (uint32_t)m_draw_list.size(); ++draw) {
+            const draw_item& item = m_draw_list[draw];
+
+            if (item.meshlet_cull_count > 0) {
+                for (uint32_t i = 0; i < item.meshlet_cull_count; ++i) {
+                    m_culling.push(m_meshlet_culls[item.first_meshlet_cull + i]);
+                }
+                continue;
+            }
+
+            for (uint32_t i = 0; i < item.instance_count; ++i) {
+                cull_instance cull;
+                cull.sphere   = m_draw_bounds.sphere(item.first_transform + i);
+                cull.draw     = draw;
+                cull.instance = item.first_transform + i;
+                m_culling.push(cull);
+            }
+        }
+
+        if (m_scene_resident) {
+            m_scene_first_cull = m_culling.reserve(m_render_scene.size());
+            m_render_scene.beginFrame(m_current_frame);
+        }
+    }
+}
+
+/*
+We need to provide details about every descriptor binding used in the shaders for pipeline creation,
+just like we had to do for every vertex attribute and its location index. Those details are read
+out of the shaders' code rather than written out here a second time, so the two can't disagree.
+
+The sets are shared by every shader the materials and the overdraw view are drawn with, so they get
+every binding any of them declares. That includes the texture that frag.spv reads, which
+createDescriptorSet writes whether or not the bindless shader is the one in use, with vertex
+pulling the geometry pool's vertex streams that pull_vert.spv reads, and with ray queries the top
+level acceleration structure that the shadows are traced through.
+*/
+void
+renderer::createDescriptorSetLayout()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const char* shaders[] = { "shaders/vert.spv", "shaders/frag.spv",
+                              "shaders/overdraw_frag.spv" };
+
+    m_graphics_reflection = shader_reflection();
+    for (const char* path : shaders) {
+        mergeReflection(m_graphics_reflection, m_pipelines.reflection(m_pipelines.shader(path)));
+    }
+    if (m_bindless_textures) {
+        const char* const bindless = m_virtual_texturing ? "shaders/bindless_vt_frag.spv"
+                                                         : "shaders/bindless_frag.spv";
+        mergeReflection(m_graphics_reflection,
+                        m_pipelines.reflection(m_pipelines.shader(bindless)));
+    }
+    if (m_vertex_pulling) {
+        mergeReflection(m_graphics_reflection,
+                        m_pipelines.reflection(m_pipelines.shader("shaders/pull_vert.spv")));
+    }
+    // The scene that shadows are traced through, whether the quality traces them or not yet
+    if (m_ray_query) {
+        mergeReflection(m_graphics_reflection,
+                        m_pipelines.reflection(m_pipelines.shader("shaders/ray_query_frag.spv")));
+    }
+
+    // Every frame in flight binds its own region of the uniform ring and of the draw buffer, with
+    // the dynamic offsets, which the shaders can't tell apart from plain buffers. The vertices are
+    // the same for every frame, so theirs is a plain one, and every frame's set points at its own
+    // lights, probes and virtual texture feedback instead. Descriptor buffers have no dynamic
+    // offsets, every frame's copy points at the frame's regions instead.
+    std::vector<vk::DescriptorSetLayoutBinding> bindings =
+      reflectedSetBindings(m_graphics_reflection, 0);
+    for (vk::DescriptorSetLayoutBinding& binding : bindings) {
+        if (m_descriptor_buffers || binding.binding == vertex_pull_binding
+            || binding.binding == vertex_attribute_pull_binding || binding.binding == light_binding
+            || binding.binding == light_cluster_binding || binding.binding == shadow_view_binding
+            || binding.binding == probe_view_binding
+            || binding.binding == virtual_feedback_binding) {
+            continue;
+        }
+        if (binding.descriptorType == vk::DescriptorType::eUniformBuffer) {
+            binding.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+        } else if (binding.descriptorType == vk::DescriptorType::eStorageBuffer) {
+            binding.descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+        }
+    }
+
+    m_descriptor_set_sizes.clear();
+    for (const vk::DescriptorSetLayoutBinding& binding : bindings) {
+        auto found = std::find_if(m_descriptor_set_sizes.begin(), m_descriptor_set_sizes.end(),
+                                  [&](const vk::DescriptorPoolSize& size) {
+                                      return size.type == binding.descriptorType;
+                                  });
+        if (found != m_descriptor_set_sizes.end()) {
+            found->descriptorCount += binding.descriptorCount;
+        } else {
+            m_descriptor_set_sizes.push_back({ binding.descriptorType, binding.descriptorCount });
+        }
+    }
+
+    auto layoutinfo = vk::DescriptorSetLayoutCreateInfo()
+                        .setBindingCount(static_cast<uint32_t>(bindings.size()))
+                        .setPBindings(bindings.data());
+#if defined(VK_EXT_descriptor_buffer)
+    if (m_descriptor_buffers) {
+        layoutinfo.setFlags(vk::DescriptorSetLayoutCreateFlagBits::eDescriptorBufferEXT);
+    }
+#endif
+
+    // The data is written into the descriptor buffer by the template's entries, not by an update
+    // template, which only writes sets
+    m_descriptor_set_layout = m_layouts.descriptorSetLayout(layoutinfo);
+    m_descriptor_template.init(m_device, m_descriptor_set_layout, bindings.data(),
+                               (uint32_t)bindings.size(),
+                               m_capabilities.descriptor_update_template && !m_descriptor_buffers);
+
+    // Deferred shading's G-buffer, the color, the normal and the depth, see deferred.frag
+    if (m_deferred_shading) {
+        std::array<vk::DescriptorSetLayoutBinding, 3> inputs;
+        for (uint32_t i = 0; i < (uint32_t)inputs.size(); ++i) {
+            inputs[i] = vk::DescriptorSetLayoutBinding()
+                          .setBinding(i)
+                          .setDescriptorCount(1)
+                          .setDescriptorType(vk::DescriptorType::eInputAttachment)
+                          .setStageFlags(vk::ShaderStageFlagBits::eFragment);
+        }
+
+        m_gbuffer_set_layout = m_layouts.descriptorSetLayout(
+          vk::DescriptorSetLayoutCreateInfo()
+            .setBindingCount((uint32_t)inputs.size())
+            .setPBindings(inputs.data()));
+    }
+
+#if defined(VK_EXT_descriptor_indexing)
+    // Dynamic buffers aren't allowed in update-after-bind layouts, so the texture array gets a set
+    // of its own. Slots are only written once a texture is in them, which partially bound allows.
+    // The shader declares it without a size, which is the device's limit. The same goes for the
+    // arrays that small textures are packed into, of which the shader declares as many as there
+    // can be.
+    if (m_bindless_textures) {
+        std::vector<vk::DescriptorSetLayoutBinding> texturebindings =
+          reflectedSetBindings(m_graphics_reflection, 1);
+        std::vector<vk::DescriptorBindingFlagsEXT> texturesflags(texturebindings.size());
+
+        for (size_t i = 0; i < texturebindings.size(); ++i) {
+            if (texturebindings[i].descriptorCount == 0) {
+                texturebindings[i].descriptorCount = m_bindless_texture_count;
+            }
+            texturesflags[i] = vk::DescriptorBindingFlagBitsEXT::ePartiallyBound
+                               | vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind;
+        }
+
+        auto bindingflags = vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT()
+                              .setBindingCount((uint32_t)texturesflags.size())
+                              .setPBindingFlags(texturesflags.data());
+
+        auto texturelayoutinfo =
+          vk::DescriptorSetLayoutCreateInfo()
+            .setPNext(&bindingflags)
+            .setFlags(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT)
+            .setBindingCount((uint32_t)texturebindings.size())
+            .setPBindings(texturebindings.data());
+
+        m_texture_set_layout = m_layouts.descriptorSetLayout(texturelayoutinfo);
+
+#if defined(VK_EXT_descriptor_buffer)
+        // Nothing in a descriptor buffer is bound but the buffer, so none of the flags apply
+        if (m_descriptor_buffers) {
+            m_buffer_texture_layout = m_layouts.descriptorSetLayout(
+              vk::DescriptorSetLayoutCreateInfo()
+                .setFlags(vk::DescriptorSetLayoutCreateFlagBits::eDescriptorBufferEXT)
+                .setBindingCount((uint32_t)texturebindings.size())
+                .setPBindings(texturebindings.data()));
+        }
+#endif
+    }
+#endif
+
+#if defined(VK_EXT_descriptor_buffer)
+    // A copy of either layout per frame in flight. Where that's more than a binding can reach,
+    // the layouts are made again for sets.
+    if (m_descriptor_buffers) {
+        std::vector<vk::DescriptorSetLayout> bufferlayouts = { m_descriptor_set_layout };
+        if (m_bindless_textures) {
+            bufferlayouts.push_back(m_buffer_texture_layout);
+        }
+        if (!m_descriptor_buffer.init(m_device, m_allocator,
+                                      m_capabilities.descriptor_buffer_properties, bufferlayouts,
+                                      m_frames_in_flight)) {
+            core::logWarning() << "Descriptor buffers are off, the textures don't fit into one";
+            m_descriptor_buffers = false;
+            createDescriptorSetLayout();
+        }
+    }
+#endif
+}
+
+void
+renderer::loadModels(upload_batch& uploads)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_model = acquireMesh(uploads, "models/chalet.obj");
+
+    if (m_model == resource_cache<Mesh>::invalid_handle) {
+        throw std::runtime_error("Failed to load model!");
+    }
+    m_mesh      = m_mesh_cache.get(m_model).drawable();
+    m_mesh_node = m_scene.create();
+}
+
+/*
+Models are imported in parallel on the job scheduler and then simplified, reordered and clustered,
+which all goes into the mesh cache, so that only the first start after a model changes does any of
+it. Cooking the models ahead of time with --cook saves even that.
+*/
+Mesh
+renderer::loadObj(std::string objpath)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    Mesh mesh;
+    if (!cookObj(objpath, m_jobs, mesh)) {
+        throw std::runtime_error("failed to load Obj!");
+    }
+    return mesh;
+}
+
+/*
+This is a helper function to create a buffer, allocate some memory for it, and bind them together
+*/
+std::pair<vk::Buffer, allocation>
+renderer::createBuffer(vk::DeviceSize          size,
+                       vk::BufferUsageFlags    usage,
+                       vk::MemoryPropertyFlags properties,
+                       memory_category         category)
+{
+    auto bufferinfo =
+      vk::BufferCreateInfo()
+        // The first field of the struct is size, which specifies the size of the buffer in bytes.
+        .setSize(size)
+        // The second field is usage, which indicates for which purposes the data in the buffer is
+        // going to be used. It is possible to specify multiple purposes using a bitwise or. Our use
+        // case will be a vertex buffer
+        .setUsage(usage)
+        // Just like the images in the swap chain, buffers can also be owned by a specific queue
+        // family or be shared between multiple at the same time. The buffer will only be used from
+        // the graphics queue, so we can stick to exclusive access.
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    auto buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+
+    // The buffer has been created, but it doesn't actually have any memory assigned to it yet. The
+    // first step of allocating memory for the buffer is to query its memory requirements using the
+    // aptly named vkGetBufferMemoryRequirements function.
+    vk::MemoryRequirements memrequirements = m_device.getBufferMemoryRequirements(buffer);
+
+    // The VkMemoryRequirements struct has three fields:
+    //  - size: The size of the required amount of memory in bytes, may differ from bufferInfo.size.
+    //  - alignment: The offset in bytes where the buffer begins in the allocated region of memory,
+    // depends on bufferInfo.usage and bufferInfo.flags.
+    //  - memoryTypeBits: Bit field of the memory types that are suitable for the buffer.
 
-    // The final step is to bind the actual image and sampler resources to the descriptor in the
-    // descriptor set.
-    auto imageinfo = vk::DescriptorImageInfo()
-                       .setImageLayout(vk::ImageLayout::eShaderReadOnlyOptimal)
-                       .setImageView(m_texture_image_view)
-                       .setSampler(m_texture_sampler);
-
-    // The configuration of descriptors is updated using the vkUpdateDescriptorSets function, which
-    // takes an array of VkWriteDescriptorSet structs as parameter.
-    std::array<vk::WriteDescriptorSet, 2> descriptorWrites = {};
-    descriptorWrites[0]
-      // The first two fields specify the descriptor set to update and the binding
-      .setDstSet(m_descriptor_set)
-      //  We gave our uniform buffer binding index 0
-      .setDstBinding(0)
-      // Remember that descriptors can be arrays, so we also need to specify the first index in
-      // the array that we want to update. We're not using an array, so the index is simply 0
-      .setDstArrayElement(0)
-      // We need to specify the type of descriptor again. It's possible to update multiple
-      // descriptors at once in an array, starting at index dstArrayElement
-      .setDescriptorType(vk::DescriptorType::eUniformBuffer)
-      // The descriptorCount field specifies how many array elements you want to update.
-      .setDescriptorCount(1)
-      // The last field references an array with $descriptorCount structs that actually configure
-      // the descriptors. It depends on the type of descriptor which one of the three you actually
-      // need to use.
-      .setPBufferInfo(&bufferinfo);
-    descriptorWrites[1]
-      .setDstSet(m_descriptor_set)
-      .setDstBinding(1)
-      .setDstArrayElement(0)
-      .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-      .setDescriptorCount(1)
-      .setPImageInfo(&imageinfo);
-
-    // The 0 is for the number of copies, and nullptr is for a vk::CopyDescriptorSet
-    m_device.updateDescriptorSets(static_cast<uint32_t>(descriptorWrites.size()),
-                                  descriptorWrites.data(), 0, nullptr);
-    // m_device.updateDescriptorSets(descriptorWrites[1], nullptr);
+    // Rather than calling vkAllocateMemory for every buffer, we ask the allocator for a range inside
+    // one of its blocks. It picks the memory type for us and honours the alignment.
+    allocation buffermemory = m_allocator.allocate(
+      memrequirements, properties, memory_allocator::resource_kind::linear, category);
+
+    // The first three parameters are self-explanatory and the fourth parameter is the offset within
+    // the region of memory. The allocator already made sure the offset is divisible by
+    // memRequirements.alignment.
+    m_device.bindBufferMemory(buffer, buffermemory.memory, buffermemory.offset);
+
+    return { buffer, buffermemory };
+}
+
+void
+renderer::destroyBuffer(vk::Buffer& buffer, allocation& memory)
+{
+    m_device.destroyBuffer(buffer, hostAllocator());
+    m_allocator.free(memory);
+    buffer = nullptr;
 }
 
 /*
-The geometry has been colored using per-vertex colors so far, which is a rather limited approach. In
-this part of the tutorial we're going to implement texture mapping to make the geometry look more
-interesting. This will also allow us to load and draw basic 3D models in a future chapter.
+Copies `size` bytes into the staging arena and returns where they ended up, so the caller can record
+a transfer from it. If the ring is full we submit what the batch has so far, wait for the outstanding
+uploads to finish and try again.
+*/
+staging_region
+renderer::stage(upload_batch&  uploads,
+                const void*    data,
+                vk::DeviceSize size,
+                vk::DeviceSize alignment)
+{
+    staging_region region = m_staging.allocate(size, alignment);
 
-Adding a texture to our application will involve the following steps:
+    if (!region) {
+        uploads.submit();
+        m_uploads.waitIdle();
+        region = m_staging.allocate(size, alignment);
+    }
 
-  - Create an image object backed by device memory
-  - Fill it with pixels from an image file
-  - Create an image sampler
-  - Add a combined image sampler descriptor to sample colors from the texture
+    if (!region) {
+        throw std::runtime_error("Failed to allocate staging memory!");
+    }
+
+    std::memcpy(region.data, data, (size_t)size);
+    return region;
+}
+
+std::pair<vk::Image, allocation>
+renderer::createImage(uint32_t                width,
+                      uint32_t                height,
+                      uint32_t                miplevels,
+                      vk::Format              format,
+                      vk::ImageTiling         tiling,
+                      vk::ImageUsageFlags     usage,
+                      vk::MemoryPropertyFlags properties,
+                      memory_category         category)
+
+{
+    auto imageinfo =
+      vk::ImageCreateInfo()
+        // The image type, specified in the imageType field, tells Vulkan with what kind of
+        // coordinate system the texels in the image are going to be addressed. It is possible to
+        // create 1D, 2D and 3D images. One dimensional images can be used to store an array of data
+        // or gradient, two dimensional images are mainly used for textures, and three dimensional
+        // images can be used to store voxel volumes, for example.
+        .setImageType(vk::ImageType::e2D)
+        //  The extent field specifies the dimensions of the image, basically how many texels there
+        //  are on each axis. That's why depth must be 1 instead of 0
+        .setExtent(vk::Extent3D(width, height, 1))
+        // Every level is half the size of the previous one, down to 1x1 at most
+        .setMipLevels(miplevels)
+        .setArrayLayers(1)
+        // Vulkan supports many possible image formats, but we should use the same format for the
+        // texels as the pixels in the buffer, otherwise the copy operation will fail.
+        .setFormat(format)
+        // The tiling field can have one of two values:
+        //     VK_IMAGE_TILING_LINEAR: Texels are laid out in row-major order like our pixels array
+        //     VK_IMAGE_TILING_OPTIMAL: Texels are laid out in an implementation defined order for
+        //     optimal access
+        // Unlike the layout of an image, the tiling mode cannot be changed at a later time. If you
+        // want to be able to directly access texels in the memory of the image, then you must use
+        // VK_IMAGE_TILING_LINEAR. We will be using a staging buffer instead of a staging image, so
+        // this won't be necessary. We will be using VK_IMAGE_TILING_OPTIMAL for efficient access
+        // from the shader.
+        .setTiling(tiling)
+        .setInitialLayout(vk::ImageLayout::eUndefined)
+        // The usage field has the same semantics as the one during buffer creation. The image is
+        // going to be used as destination for the buffer copy, so it should be set up as a transfer
+        // destination. We also want to be able to access the image from the shader to color our
+        // mesh, so the usage should include VK_IMAGE_USAGE_SAMPLED_BIT.
+        .setUsage(usage)
+        // The samples flag is related to multisampling. This is only relevant for images that will
+        // be used as attachments, so stick to one sample. There are some optional flags for images
+        // that are related to sparse images. Sparse images are images where only certain regions
+        // are actually backed by memory. If you were using a 3D texture for a voxel terrain, for
+        // example, then you could use this to avoid allocating memory to store large volumes of
+        // "air" values. We won't be using it in this tutorial, so leave it to its default value of
+        // 0.
+        .setSamples(vk::SampleCountFlagBits::e1)
+        // The image will only be used by one queue family: the one that supports graphics (and
+        // therefore also) transfer operations.
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    vk::Image image = m_device.createImage(imageinfo, hostAllocator());
+
+    vk::MemoryRequirements memrequirements = m_device.getImageMemoryRequirements(image);
+
+    allocation memory = m_allocator.allocate(memrequirements, properties,
+                                             tiling == vk::ImageTiling::eOptimal
+                                               ? memory_allocator::resource_kind::optimal
+                                               : memory_allocator::resource_kind::linear,
+                                             category);
+
+    m_device.bindImageMemory(image, memory.memory, memory.offset);
+
+    return { image, memory };
+}
+
+void
+renderer::destroyImage(vk::Image& image, allocation& memory)
+{
+    m_device.destroyImage(image, hostAllocator());
+    m_allocator.free(memory);
+    image = nullptr;
+}
+
+/*
+Records the copy into `uploads`. Nothing is submitted here, the image has to be transitioned to
+VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL in the same batch first.
+*/
+void
+renderer::copyBufferToImage(upload_batch&         uploads,
+                            const staging_region& src,
+                            vk::Image             image,
+                            uint32_t              width,
+                            uint32_t              height,
+                            uint32_t              miplevel)
+{
+    if (!src || !image)
+        return;
+
+    // Just like with buffer copies, you need to specify which part of the buffer is going to be
+    // copied to which part of the image. The batch fills in the vk::BufferImageCopy for us:
+    // https://www.khronos.org/registry/vulkan/specs/1.1-extensions/man/html/VkBufferImageCopy.html
+    uploads.copyBufferToImage(src, image, width, height, miplevel);
+}
+
+/*
+Memory transfer operations are executed using command buffers, just like drawing commands. Rather
+than allocating a temporary command buffer per copy, copies are recorded into an upload batch, which
+puts all of them into one command buffer from the upload service's transient command pool when it
+is submitted.
+*/
+void
+renderer::copyBuffer(upload_batch&          uploads,
+                     const staging_region&  src,
+                     vk::Buffer             dst,
+                     vk::AccessFlags        dstaccess,
+                     vk::PipelineStageFlags dststage)
+{
+    if (!src || !dst)
+        return;
+
+    uploads.copyBuffer(src, dst, 0, dstaccess, dststage);
+}
+
+/*
+Layout transitions are pipeline barriers too, so they are recorded into the batch alongside the
+copies. The batch works out the access masks and pipeline stages from the two layouts with
+`layoutScope()` and merges the barriers of all resources that can transition at the same time into
+one vkCmdPipelineBarrier.
+
+https://www.khronos.org/registry/vulkan/specs/1.1-extensions/man/html/VkImageMemoryBarrier.html
+*/
+void
+renderer::transitionImageLayout(upload_batch&   uploads,
+                                vk::Image       image,
+                                vk::Format      format,
+                                vk::ImageLayout oldLayout,
+                                vk::ImageLayout newLayout,
+                                uint32_t        miplevels)
+{
+    if (!image) {
+        return;
+    }
+
+    // Depth images transition their depth (and stencil) aspect, everything else is color
+    const bool depth = newLayout == vk::ImageLayout::eDepthStencilAttachmentOptimal
+                       || newLayout == vk::ImageLayout::eDepthStencilReadOnlyOptimal
+                       || oldLayout == vk::ImageLayout::eDepthStencilAttachmentOptimal
+                       || oldLayout == vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+
+    vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor;
+    if (depth) {
+        aspect = vk::ImageAspectFlagBits::eDepth;
+        if (hasStencilComponent(format)) {
+            aspect |= vk::ImageAspectFlagBits::eStencil;
+        }
+    }
+
+    uploads.transitionImageLayout(image, aspect, oldLayout, newLayout, miplevels);
+}
+
+vk::ImageView
+renderer::createImageView(vk::Image               image,
+                          vk::Format              format,
+                          vk::ImageAspectFlagBits aspectflags,
+                          uint32_t                miplevels,
+                          uint32_t                layers)
+{
+    auto createinfo = vk::ImageViewCreateInfo()
+                        .setImage(image)
+                        .setViewType(layers > 1 ? vk::ImageViewType::e2DArray
+                                                : vk::ImageViewType::e2D)
+                        .setFormat(format)
+                        .setComponents(vk::ComponentMapping()
+                                         .setR(vk::ComponentSwizzle::eIdentity)
+                                         .setG(vk::ComponentSwizzle::eIdentity)
+                                         .setB(vk::ComponentSwizzle::eIdentity)
+                                         .setA(vk::ComponentSwizzle::eIdentity))
+                        .setSubresourceRange(vk::ImageSubresourceRange()
+                                               .setAspectMask(aspectflags)
+                                               .setBaseMipLevel(0)
+                                               .setLevelCount(miplevels)
+                                               .setBaseArrayLayer(0)
+                                               .setLayerCount(layers));
+
+    return m_views.imageView(createinfo);
+}
+
+/* This function allows us to define our own list of prioritized formats, and will return the first
+ * successful find based on the list of candidates. */
+vk::Format
+renderer::findSupportedFormat(const std::vector<vk::Format>& candidates,
+                              vk::ImageTiling                tiling,
+                              vk::FormatFeatureFlags         features) const
+{
+    for (vk::Format format : candidates) {
+        vk::FormatProperties properties = m_physical_device.getFormatProperties(format);
+
+        if (tiling == vk::ImageTiling::eLinear
+            && (properties.linearTilingFeatures & features) == features) {
+            return format;
+        } else if (tiling == vk::ImageTiling::eOptimal
+                   && (properties.optimalTilingFeatures & features) == features) {
+            return format;
+        }
+    }
+
+    throw std::runtime_error("failed to find supported format!");
+}
+
+/*
+The application we have now successfully draws a triangle, but there are some circumstances that
+it isn't handling properly yet. It is possible for the window surface to change such that the swap
+chain is no longer compatible with it. One of the reasons that could cause this to happen is the
+size of the window changing. We have to catch these events and recreate the swap chain.
+
+Only the images and what is sized after them have to go. The viewport and scissor are dynamic state,
+so the render pass and the pipeline stay as they are unless the new swap chain picked a different
+surface format, which the render pass's color attachment depends on.
+
+Nothing waits for the GPU here. The frames in flight may still be rendering to or presenting the
+old images, so the old swap chain and everything built on it goes to the deletion queue instead.
+Presentation isn't covered by the frame fences, so this relies on the presentation engine being done
+with an image by the time a frame `m_frames_in_flight` later has finished rendering, which is as
+good as it gets without VK_EXT_swapchain_maintenance1.
+*/
+void
+renderer::recreateSwapChain()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    // Nothing may be left to present to the old swap chain, and whatever the present thread
+    // found out about it doesn't matter anymore
+    m_presenter.drain();
+    m_presenter.takeStale(m_swapchain);
+
+    const vk::Format oldformat  = m_swapchain_image_format;
+    const bool       oldscene   = m_scene_target;
+    const uint64_t   frame      = m_frame_number;
+
+    retireRenderTargets(frame);
+
+    for (const vk::Image& image : m_swapchain_images) {
+        m_views.retireViews(image, m_deletion_queue, frame);
+    }
+    m_swapchain_image_views.clear();
+
+    // createSwapChain passes the current handle on as oldSwapchain, so it is only queued up here
+    m_deletion_queue.push(frame, m_swapchain);
+    createSwapChain();
+    createImageViews();
+
+    // Whether frames can be scaled depends on the format too
+    if (m_swapchain_image_format != oldformat || m_scene_target != oldscene) {
+        m_pipelines.retire(m_render_pass, m_deletion_queue, frame);
+        if (m_render_pass) {
+            m_deletion_queue.push(frame, m_render_pass);
+        }
+
+        createRenderPass();
+        createGraphicsPipeline();
+    }
+
+    createRenderGraph();
+    createFramebuffers();
+}
+
+// What is sized after the render resolution, i.e. rebuilt by createRenderGraph and
+// createFramebuffers. The images themselves are retired by the render graph.
+void
+renderer::retireRenderTargets(uint64_t frame)
+{
+    // The cached draws' viewports, and maybe the render pass they continue, are about to change
+    invalidateCachedDraws();
+
+    m_views.retireViews(m_depth_image, m_deletion_queue, frame);
+    if (m_color_image_view) {
+        m_views.retireViews(m_color_image, m_deletion_queue, frame);
+        m_color_image_view = nullptr;
+        m_color_image      = nullptr;
+    }
+    if (m_scene_image_view) {
+        m_views.retireViews(m_scene_image, m_deletion_queue, frame);
+        m_scene_image_view = nullptr;
+        m_scene_image      = nullptr;
+    }
+    if (m_gbuffer_color_view) {
+        m_views.retireViews(m_gbuffer_color, m_deletion_queue, frame);
+        m_views.retireViews(m_gbuffer_normal, m_deletion_queue, frame);
+        m_gbuffer_color_view  = nullptr;
+        m_gbuffer_normal_view = nullptr;
+        m_gbuffer_color       = nullptr;
+        m_gbuffer_normal      = nullptr;
+    }
+
+    for (auto& framebuffer : m_swapchain_framebuffers) {
+        m_deletion_queue.push(frame, framebuffer);
+    }
+    m_swapchain_framebuffers.clear();
+}
+
+/*
+A new render resolution only needs the render targets rebuilt, and like recreateSwapChain this
+doesn't wait for the GPU either. The pipelines stay, the viewport and scissor being dynamic state.
+*/
+void
+renderer::resizeRendering()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    retireRenderTargets(m_frame_number);
+    createRenderGraph();
+    createFramebuffers();
+}
+
+/*
+Rebuilds only what the changed settings go into, between frames and without waiting for the GPU,
+the same as recreateSwapChain: the texture sampler and every frame's descriptors for the
+anisotropy and LOD bias, the shadow map for its resolution, the render targets for the render
+scale, and the render pass and pipelines as well for the sample count, and for tracing shadows or
+not, which also takes the render graph's shadow pass.
+
+The Hi-Z pyramid is built for the depth buffer's sample count, so with occlusion culling the count
+stays. The render scale only applies where frames are scaled at all.
+*/
+void
+renderer::applyQuality(const quality_settings& quality)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const uint64_t frame       = m_frame_number;
+    bool           targets     = false;
+    bool           pipelines   = false;
+    bool           descriptors = false;
+
+    if (quality.anisotropy != m_quality.anisotropy || quality.lod_bias != m_quality.lod_bias) {
+        m_quality.anisotropy = quality.anisotropy;
+        m_quality.lod_bias   = quality.lod_bias;
+
+        // The old sampler stays in the view cache for the frames still using it
+        createTextureSampler();
+        m_descriptor_data[m_descriptor_template.slot(1)].image.setSampler(m_texture_sampler);
+        descriptors = true;
+    }
+
+    if (quality.samples != m_quality.samples && !m_deferred_shading && !m_temporal_aa) {
+        const vk::PhysicalDeviceLimits limits = m_physical_device.getProperties().limits;
+        const vk::SampleCountFlagBits  samples =
+          maxSampleCount(limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts,
+                         quality.samples);
+        if (m_occlusion_culling && samples != m_samples) {
+            core::logWarning() << "Changing the sample count is off, "
+                               << "the occlusion culling pyramid is built for the current one";
+        } else if (samples != m_samples) {
+            m_samples = samples;
+            pipelines = true;
+            targets   = true;
+        }
+    }
+
+    if (quality.shadow_resolution != m_quality.shadow_resolution && shadowsEnabled()) {
+        m_cascades.resize(quality.shadow_resolution, m_deletion_queue, frame);
+        descriptors = true;
+        targets     = true;
+    }
+
+    // The cascades kept from before tracing are stale by the time they're rendered again
+    if (quality.ray_query_shadows != m_quality.ray_query_shadows && m_ray_query) {
+        m_cascades.invalidate();
+        pipelines = true;
+        targets   = true;
+    }
+
+    if (quality.render_scale != m_quality.render_scale
+        && (m_dynamic_resolution || m_temporal_aa)) {
+        resolution_settings scaling = m_resolution.settings();
+        scaling.max_scale           = quality.render_scale;
+        scaling.min_scale           = std::min(scaling.min_scale, quality.render_scale);
+        m_resolution.init(scaling);
+        targets = true;
+    }
+
+    m_quality = quality;
+
+    // Every frame writes all of its descriptors again on its next turn
+    if (descriptors) {
+        std::fill(m_descriptor_texture_versions.begin(), m_descriptor_texture_versions.end(), 0);
+        std::fill(m_descriptor_virtual_versions.begin(), m_descriptor_virtual_versions.end(), 0);
+    }
+
+    if (!targets) {
+        return;
+    }
+
+    retireRenderTargets(frame);
+    if (pipelines) {
+        m_pipelines.retire(m_render_pass, m_deletion_queue, frame);
+        if (m_render_pass) {
+            m_deletion_queue.push(frame, m_render_pass);
+        }
+
+        createRenderPass();
+        createGraphicsPipeline();
+    }
+
+    createRenderGraph();
+    createFramebuffers();
+}
+
+/*
+Only used at shutdown, after the device has gone idle; refer to renderer::recreateSwapChain()
+*/
+void
+renderer::cleanupSwapChain()
+{
+    m_views.releaseViews(m_depth_image);
+    if (m_color_image_view) {
+        m_views.releaseViews(m_color_image);
+        m_color_image_view = nullptr;
+    }
+    if (m_scene_image_view) {
+        m_views.releaseViews(m_scene_image);
+        m_scene_image_view = nullptr;
+    }
+    if (m_gbuffer_color_view) {
+        m_views.releaseViews(m_gbuffer_color);
+        m_views.releaseViews(m_gbuffer_normal);
+        m_gbuffer_color_view  = nullptr;
+        m_gbuffer_normal_view = nullptr;
+    }
+    m_graph.destroy();
+
+    for (auto& framebuffer : m_swapchain_framebuffers) {
+        m_device.destroyFramebuffer(framebuffer, hostAllocator());
+    }
+    m_swapchain_framebuffers.clear();
+
+    for (const vk::Image& image : m_swapchain_images) {
+        m_views.releaseViews(image);
+    }
+    m_swapchain_image_views.clear();
+
+    if (m_offscreen) {
+        m_offscreen_target.destroy();
+        m_swapchain_images.clear();
+        return;
+    }
 
-We've already worked with image objects before, but those were automatically created by the swap
-chain extension. This time we'll have to create one by ourselves. Creating an image and filling it
-with data is similar to vertex buffer creation. We'll start by creating a staging resource and
-filling it with pixel data and then we copy this to the final image object that we'll use for
-rendering. Although it is possible to create a staging image for this purpose, Vulkan also allows
-you to copy pixels from a VkBuffer to an image and the API for this is actually faster on some
-hardware. We'll first create this buffer and fill it with pixel values, and then we'll create an
-image to copy the pixels to. Creating an image is not very different from creating buffers. It
-involves querying the memory requirements, allocating device memory and binding it, just like we've
-seen before.
+    m_device.destroySwapchainKHR(m_swapchain, hostAllocator());
+}
 
-However, there is something extra that we'll have to take care of when working with images. Images
-can have different layouts that affect how the pixels are organized in memory. Due to the way
-graphics hardware works, simply storing the pixels row by row may not lead to the best performance,
-for example. When performing any operation on images, you must make sure that they have the layout
-that is optimal for use in that operation. We've actually already seen some of these layouts when we
-specified the render pass:
+// Each viewport acquires its images for the frames in flight's semaphores of its own
+void
+renderer::createViewports()
+{
+    SHINY_PROFILE_FUNCTION();
 
-  - VK_IMAGE_LAYOUT_PRESENT_SRC_KHR: Optimal for presentation
-  - VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL: Optimal as attachment for writing colors from the
-fragment shader
-  - VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL: Optimal as source in a transfer operation,
-like vkCmdCopyImageToBuffer
-  - VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL: Optimal as destination in a
-transfer operation, like vkCmdCopyBufferToImage
-  - VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL: Optimal
-for sampling from a shader
+    for (viewport& v : m_viewports) {
+        for (uint32_t i = 0; i < m_frames_in_flight; ++i) {
+            v.image_available.push_back(
+              m_device.createSemaphore(vk::SemaphoreCreateInfo(), hostAllocator()));
+        }
+        createViewportSwapChain(v);
+    }
+}
 
-One of the most common ways to transition the layout of an image is a pipeline barrier. Pipeline
-barriers are primarily used for synchronizing access to resources, like making sure that an image
-was written to before it is read, but they can also be used to transition layouts. In this chapter
-we'll see how pipeline barriers are used for this purpose. Barriers can additionally be used to
-transfer queue family ownership when using VK_SHARING_MODE_EXCLUSIVE.
+/*
+Like createSwapChain, for a viewport, whose images are only ever blitted to. The old swap chain is
+handed over and retired the same way. A minimized window has no extent and then no swap chain
+either, until acquireViewports finds it has one again.
 */
 void
-renderer::createTextureImage()
+renderer::createViewportSwapChain(viewport& v)
 {
-    int      width, height, channels;
-    stbi_uc* pixels = stbi_load("textures/texture.jpg", &width, &height, &channels, STBI_rgb_alpha);
+    const vk::SwapchainKHR old = v.swapchain;
+    v.swapchain                = nullptr;
+    v.images.clear();
+    if (old) {
+        m_deletion_queue.push(m_frame_number, old);
+    }
 
-    if (!pixels) {
-        throw std::runtime_error("Failed to load image!");
+    const SwapChainSupportDetails support = querySwapChainSupport(m_physical_device, v.surface);
+
+    const vk::SurfaceCapabilitiesKHR& capabilities = support.capabilities;
+    vk::Extent2D                      extent       = capabilities.currentExtent;
+    if (extent.width == std::numeric_limits<uint32_t>::max()) {
+        extent = vk::Extent2D(std::clamp(v.settings.width, capabilities.minImageExtent.width,
+                                         capabilities.maxImageExtent.width),
+                              std::clamp(v.settings.height, capabilities.minImageExtent.height,
+                                         capabilities.maxImageExtent.height));
+    }
+    if (extent.width == 0 || extent.height == 0) {
+        return;
     }
 
-    vk::DeviceSize imagedim = width * height * 4;  // we load RGBA
+    const vk::SurfaceFormatKHR surfaceformat = chooseSwapSurfaceFormat(support.formats);
+    if (!supportsScaling(surfaceformat.format)
+        || !(bool)(capabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferDst)) {
+        throw std::runtime_error("Frames can't be blitted to a viewport's swap chain images!");
+    }
+
+    uint32_t imagecount = capabilities.minImageCount + 1;
+    if (capabilities.maxImageCount > 0 && imagecount > capabilities.maxImageCount) {
+        imagecount = capabilities.maxImageCount;
+    }
 
-    auto [stagingbuffer, stagingbuffermemory] = createBuffer(
-      imagedim, vk::BufferUsageFlagBits::eTransferSrc,
-      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    auto createinfo =
+      vk::SwapchainCreateInfoKHR()
+        .setSurface(v.surface)
+        .setMinImageCount(imagecount)
+        .setImageFormat(surfaceformat.format)
+        .setImageColorSpace(surfaceformat.colorSpace)
+        .setImageExtent(extent)
+        .setImageArrayLayers(1)
+        .setImageUsage(vk::ImageUsageFlagBits::eTransferDst)
+        .setPreTransform(capabilities.currentTransform)
+        .setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque)
+        .setPresentMode(chooseSwapPresentMode(support.presentModes, m_pacing.present_modes))
+        .setClipped(true)
+        .setOldSwapchain(old);
+
+    // The queues are the window's
+    QueueFamilyIndices indices = findQueueFamilies(m_physical_device, m_surface, deviceCount() > 1);
+    std::array<uint32_t, 2> queuefamilyindices = { (uint32_t)indices.graphicsFamily(),
+                                                   (uint32_t)indices.presentFamily() };
+    if (indices.graphicsFamily() != indices.presentFamily()) {
+        createinfo.setImageSharingMode(vk::SharingMode::eConcurrent)
+          .setQueueFamilyIndexCount(2)
+          .setPQueueFamilyIndices(queuefamilyindices.data());
+    }
 
-    // NOTE: We might have to manipulate the bitmap because it stores things as BGRA for big-endian
-    // systems.
+    v.swapchain = m_device.createSwapchainKHR(createinfo, hostAllocator());
+    v.images    = m_device.getSwapchainImagesKHR(v.swapchain);
+    v.image_frames.assign(v.images.size(), 0);
+    v.extent = extent;
+}
 
-    withMappedMemory(stagingbuffermemory, 0, imagedim,
-                     [=](void* data) { std::memcpy(data, pixels, (size_t)imagedim); });
+/*
+Acquires an image of every viewport whose window is open for the frame being drawn, after the
+window's. A swap chain that a present found out of date or suboptimal is recreated first, and one
+that is out of date now only for the next frame. The frame goes ahead without the viewports that
+have no image, which just keep showing what they did.
+*/
+void
+renderer::acquireViewports()
+{
+    for (size_t i = 0; i < m_viewports.size(); ++i) {
+        viewport& v = m_viewports[i];
+        v.acquired  = false;
+        if (m_viewports_closed[i].load(std::memory_order_acquire)) {
+            continue;
+        }
 
-    stbi_image_free(pixels);
+        if (m_presenter.takeStale(v.swapchain) || v.stale || !v.swapchain) {
+            m_presenter.drain();
+            createViewportSwapChain(v);
+            v.stale = false;
+            if (!v.swapchain) {
+                continue;
+            }
+        }
 
-    std::tie(m_texture_image, m_texture_image_memory) =
-      createImage(width, height, vk::Format::eR8G8B8A8Unorm, vk::ImageTiling::eOptimal,
-                  vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
-                  vk::MemoryPropertyFlagBits::eDeviceLocal);
-    // Transition the texture image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-    transitionImageLayout(m_texture_image, vk::Format::eR8G8B8A8Unorm, vk::ImageLayout::eUndefined,
-                          vk::ImageLayout::eTransferDstOptimal);
-    // Execute the buffer to image copy operation
-    copyBufferToImage(stagingbuffer, m_texture_image, width, height);
-    // To be able to start sampling from the texture image in the shader, we need one last
-    // transition to prepare it for shader access
-    transitionImageLayout(m_texture_image, vk::Format::eR8G8B8A8Unorm,
-                          vk::ImageLayout::eTransferDstOptimal,
-                          vk::ImageLayout::eShaderReadOnlyOptimal);
+        try {
+            v.image = m_device
+                        .acquireNextImageKHR(v.swapchain, std::numeric_limits<uint64_t>::max(),
+                                             v.image_available[m_current_frame], nullptr)
+                        .value;
+        } catch (const vk::OutOfDateKHRError&) {
+            v.stale = true;
+            continue;
+        }
 
-    m_device.destroyBuffer(stagingbuffer, nullptr);
-    m_device.freeMemory(stagingbuffermemory, nullptr);
+        if (!waitForFrame(v.image_frames[v.image])) {
+            throw std::runtime_error("A frame didn't finish rendering in time!");
+        }
+        v.image_frames[v.image] = m_frame_number + 1;
+        v.acquired              = true;
+    }
 }
 
+// Main thread: hides the viewports whose windows were asked to close, which aren't drawn to from
+// then on. Only the window's closing ends the main loop.
 void
-renderer::createTextureImageView()
+renderer::closeViewports()
 {
-    m_texture_image_view =
-      createImageView(m_texture_image, vk::Format::eR8G8B8A8Unorm, vk::ImageAspectFlagBits::eColor);
+    for (size_t i = 0; i < m_viewports.size(); ++i) {
+        if (!m_viewports_closed[i].load(std::memory_order_relaxed)
+            && glfwWindowShouldClose(m_viewports[i].window)) {
+            glfwHideWindow(m_viewports[i].window);
+            m_viewports_closed[i].store(true, std::memory_order_release);
+        }
+    }
 }
 
+// At shutdown, once the device is idle, or when createLogicalDevice turns them off before they
+// have a swap chain
 void
-renderer::createTextureSampler()
+renderer::destroyViewports()
 {
-    // Samplers are configured through a VkSamplerCreateInfo structure, which specifies all filters
-    // and transformations that it should apply.
-    vk::SamplerCreateInfo samplerInfo;
-    // The magFilter and minFilter fields specify how to interpolate texels that are magnified or
-    // minified. Magnification concerns the oversampling problem describes above, and minification
-    // concerns undersampling. The choices are VK_FILTER_NEAREST and VK_FILTER_LINEAR, corresponding
-    // to the modes demonstrated in the images above.
-    samplerInfo.setMagFilter(vk::Filter::eLinear)
-      .setMinFilter(vk::Filter::eLinear)
-      /*The addressing mode can be specified per axis using the addressMode fields. The available
-      values are listed below. Most of these are demonstrated in the image above. Note that the axes
-      are called U, V and W instead of X, Y and Z. This is a convention for texture space
-      coordinates.
-      ===VK_SAMPLER_ADDRESS_MODE_REPEAT: Repeat the texture when going beyond the image dimensions.
-      ===VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT: Like repeat, but inverts the coordinates to mirror
-      the image when going beyond the dimensions. VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE: Take the
-      color of the edge closest to the coordinate beyond the image dimensions.
-      ===VK_SAMPLER_ADDRESS_MODE_MIRROR_CLAMP_TO_EDGE: Like clamp to edge, but instead uses the edge
-      opposite to the closest edge.
-      ===VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER: Return a solid color when sampling
-      beyond the dimensions of the image.
-      It doesn't really matter which addressing mode we use here,
-      because we're not going to sample outside of the image in this tutorial. However, the repeat
-      mode is probably the most common mode, because it can be used to tile textures like floors and
-      walls.*/
-      .setAddressModeU(vk::SamplerAddressMode::eRepeat)
-      .setAddressModeV(vk::SamplerAddressMode::eRepeat)
-      .setAddressModeW(vk::SamplerAddressMode::eRepeat)
-      /*These two fields specify if anisotropic filtering should be used. There is no reason not to
-         use this unless performance is a concern. The maxAnisotropy field limits the amount of
-         texel samples that can be used to calculate the final color. A lower value results in
-         better performance, but lower quality results. There is no graphics hardware available
-         today that will use more than 16 samples, because the difference is negligible beyond that
-         point.*/
-      // Side note by Jason: currently we only check if the physicaldevice is capable of anisotropy
-      // in the isDeviceSuitable() function. At some point we might be better off storing the
-      // physicalDeviceFeatures as a member value or scoping it here to set anisotropy settings
-      // correctly based on available features.
-      .setAnisotropyEnable(true)
-      .setMaxAnisotropy(16.0)
-      /*The borderColor field specifies which color is returned when sampling beyond the image with
-         clamp to border addressing mode. It is possible to return black, white or transparent in
-         either float or int formats. You cannot specify an arbitrary color.*/
-      .setBorderColor(vk::BorderColor::eFloatOpaqueBlack)
-      /*The unnormalizedCoordinates field specifies which coordinate system you want to use to
-        address texels in an image. If this field is VK_TRUE, then you can simply use coordinates
-        within the [0, texWidth) and [0, texHeight) range. If it is VK_FALSE, then the texels are
-        addressed using the [0, 1) range on all axes. Real-world applications almost always use
-        normalized coordinates, because then it's possible to use textures of varying resolutions
-        with the exact same coordinates.*/
-      .setUnnormalizedCoordinates(false)
-      .setCompareEnable(false)
-      .setCompareOp(vk::CompareOp::eAlways)
-      .setMipmapMode(vk::SamplerMipmapMode::eLinear);
-
-    if (!(m_texture_sampler = m_device.createSampler(samplerInfo))) {
-        throw std::runtime_error("failed to create tetxture sampler!");
+    for (viewport& v : m_viewports) {
+        for (vk::Semaphore semaphore : v.image_available) {
+            m_device.destroySemaphore(semaphore, hostAllocator());
+        }
+        if (v.swapchain) {
+            m_device.destroySwapchainKHR(v.swapchain, hostAllocator());
+        }
+        if (v.surface) {
+            m_instance.destroySurfaceKHR(v.surface, hostAllocator());
+        }
+        if (v.window) {
+            glfwDestroyWindow(v.window);
+        }
     }
+    m_viewports.clear();
 }
 
+/*
+The steps of initialization and what each needs done before it, run as a task_graph. Most of them
+go through the allocator, the layout and pipeline caches or the upload service, none of which are
+thread safe, so they stay on this thread in an order the dependencies allow. What only needs the
+device, its own members or the view cache, which is, like decoding the texture or creating pools,
+samplers and synchronization objects, runs on the job scheduler meanwhile, so the texture is
+decoded while the swap chain, render pass and pipelines are created instead of after them.
+
+How long it took is printed either way, and setParallelInit(false) runs the steps one after the
+other, in the order they are added here, for comparison. How long each step took, and on which
+thread, goes into the startup report, see reportStartup.
+*/
 void
-renderer::createDepthResources()
+renderer::initVulkan()
 {
-    vk::Format depthFormat = findDepthFormat();
+    SHINY_PROFILE_FUNCTION();
 
-    std::tie(m_depth_image, m_depth_image_memory) = createImage(
-      m_swapchain_extent.width, m_swapchain_extent.height, depthFormat, vk::ImageTiling::eOptimal,
-      vk::ImageUsageFlagBits::eDepthStencilAttachment, vk::MemoryPropertyFlagBits::eDeviceLocal);
-    m_depth_image_view =
-      createImageView(m_depth_image, depthFormat, vk::ImageAspectFlagBits::eDepth);
+    const int64_t start = core::profileNow();
 
-    transitionImageLayout(m_depth_image, depthFormat, vk::ImageLayout::eUndefined,
-                          vk::ImageLayout::eDepthStencilAttachmentOptimal);
-}
+    // Before the instance, which is the first thing the driver allocates for
+    if (m_host_allocator || m_allocation_tracking) {
+        installHostAllocator();
+    }
+
+    // Counted from here on
+    if (m_allocation_tracking) {
+        core::enableAllocTracking(true);
+        m_allocations_at_frame = core::allocTotals();
+    }
+
+    // Packaged assets are decompressed in parallel from here on
+    core::setPackageJobs(&m_jobs);
+
+    texture_data texturedata;
+    bool         textureread = false;
+
+    using handle     = jobs::task_graph::handle;
+    const bool async = true;  // on the job scheduler
+
+    jobs::task_graph init;
+    init.setReport(&m_startup);
+
+    const handle instance = init.add("instance", [this]() { createInstance(); });
+    const handle callback = init.add("debug callback", [this]() { setupDebugCallback(); },
+                                     { instance });
+    const handle surface  = init.add("surface", [this]() { createSurface(); }, { instance });
+    const handle physical =
+      init.add("physical device", [this]() { pickPhysicalDevice(); }, { surface });
+
+    // Every shader is loaded once the device is there, so that's as long as the .spv files have
+    // to be brought up to date in
+    const handle shaders = init.add("shaders", [this]() { buildShaders(); }, {}, async);
+    const handle device  = init.add("device", [this]() { createLogicalDevice(); },
+                                    { physical, callback, shaders });
+
+    // The texture loader is set up with the device
+    const handle readtexture = init.add(
+      "read texture",
+      [&]() { textureread = m_texture_loader.read(texture_path, texturedata); }, { device },
+      async);
+
+    const handle swapchain = init.add("swap chain", [this]() { createSwapChain(); }, { device });
+    init.add("viewports", [this]() { createViewports(); }, { device });
+    const handle views = init.add("image views", [this]() { createImageViews(); }, { swapchain });
+    const handle renderpass = init.add("render pass", [this]() { createRenderPass(); }, { views });
+    const handle setlayout =
+      init.add("set layouts", [this]() { createDescriptorSetLayout(); }, { device });
+
+    // Before the render graph, which imports the culling's output, and the pipelines, which
+    // include the particles', debug lines' and HUD's with their layouts. After the set layouts,
+    // whose bindless textures the reflection probes' pipelines are made with.
+    const handle drawbuffer =
+      init.add("draw buffer", [this]() { createDrawBuffer(); }, { device, setlayout });
+    const handle hud        = init.add("hud", [this]() { createHud(); }, { device, setlayout });
+    init.add("pipelines", [this]() { createGraphicsPipeline(); },
+             { renderpass, setlayout, drawbuffer, hud });
+    const handle pools =
+      init.add("command pools", [this]() { createCommandPool(); }, { device }, async);
+    const handle graph =
+      init.add("render graph", [this]() { createRenderGraph(); }, { drawbuffer, renderpass });
+    init.add("framebuffers", [this]() { createFramebuffers(); }, { graph, renderpass, views });
+
+    const handle sampler =
+      init.add("sampler", [this]() { createTextureSampler(); }, { device }, async);
+    const handle uploads = init.add(
+      "uploads",
+      [&]() {
+          // Every upload below goes into this one batch and is submitted at the end of the step.
+          // Nothing waits on it: the uploads are made visible to the graphics queue before
+          // anything submitted to it later, so the first frame can go ahead.
+          upload_batch batch = m_uploads.begin();
+          createTextureImage(batch, textureread ? &texturedata : nullptr);
+          // loadModels(batch);
+          {
+              const core::startup_scope scope(&m_startup, "asset", "test mesh");
+              m_mesh = Mesh(std::vector<Vertex>(triangle_vertices),
+                            std::vector<uint32_t>(triangle_indices));
+              uploadMesh(batch, m_mesh);
+              if (!m_keep_mesh_data) {
+                  m_mesh.releaseHostData();
+              }
+          }
+          createSkinnedInstances(batch);
+          createEntities();
+          createStressScene(batch);
+          loadScene(batch);
+          createImpostors(batch);
+          {
+              const core::startup_scope scope(&m_startup, "asset", "hud atlas");
+              createHudAtlas(batch);
+          }
+          if (m_terrain_active) {
+              const core::startup_scope scope(&m_startup, "asset", "terrain");
+              m_terrain.upload(batch, stage(batch, m_terrain.meshData(), m_terrain.meshSize()));
+          }
+          const upload_ticket ticket = batch.submit();
+          if (m_fast_start) {
+              m_scene_ticket = ticket;
+          }
+      },
+      { readtexture, drawbuffer, hud, sampler });
+
+    const handle uniforms =
+      init.add("uniform buffer", [this]() { createUniformBuffer(); }, { device });
+    const handle descriptorpool =
+      init.add("descriptor pools", [this]() { createDescriptorPool(); }, { setlayout }, async);
+    init.add("descriptor sets", [this]() { createDescriptorSet(); },
+             { descriptorpool, setlayout, uniforms, uploads, sampler, drawbuffer });
+    init.add("command buffers", [this]() { createCommandBuffers(); }, { pools });
+    const handle semaphores =
+      init.add("semaphores", [this]() { createSemaphores(); }, { device }, async);
+    init.add("fences", [this]() { createFences(); }, { device }, async);
+
+    // Added last, but it only needs the swap chain, and the steps on this thread run in the order
+    // they become ready, so it goes ahead of the pipelines and uploads if they aren't yet
+    if (m_fast_start && !m_offscreen) {
+        init.add("splash frame", [this]() { presentSplashFrame(); },
+                 { swapchain, pools, semaphores });
+    }
+
+    init.run(m_jobs, m_parallel_init);
+
+    const core::startup_scope rest(&m_startup, "stage", "watchers and captures");
+
+    // Every shader was created by now, and the textures and meshes added themselves as they were
+    // acquired
+    if (m_hot_reload) {
+        for (const std::string& path : m_pipelines.shaderPaths()) {
+            m_watcher.watch(path);
+        }
+        for (const std::string& path : m_shader_compiler.sources()) {
+            m_watcher.watch(path);
+            m_shader_sources.insert(path);
+        }
+        m_watcher.start();
+    }
+
+    if (m_telemetry_port != 0) {
+        if (m_telemetry.start(m_telemetry_port)) {
+            core::logInfo() << "Telemetry on port " << m_telemetry_port;
+        } else {
+            core::logWarning() << "Telemetry is off, port " << m_telemetry_port
+                               << " can't be listened on";
+        }
+    }
+
+    openCaptures();
+    m_frame_readback.init(m_device, m_allocator, m_frames_in_flight);
+    m_video.init(m_device, m_allocator, m_layouts, m_views, m_pipeline_cache, m_frames_in_flight,
+                 m_video_settings, m_video_convert);
+    if (m_picking) {
+        m_picker.init(m_device, m_allocator, m_layouts, m_pipeline_cache, positionInputs(),
+                      m_frames_in_flight);
+    }
 
+    core::logInfo() << "Initialized in " << (double)(core::profileNow() - start) / 1e6 << " ms"
+                    << (m_parallel_init ? "" : ", one step at a time");
+}
 
 /*
-This is practically the core loop. Here we update and load the uniform variables per frame.
+Sets up everything like run() does, but then renders for a fixed number of frames or seconds,
+giving up early if the window is closed.
+*/
+void
+renderer::benchmark(const benchmark_settings& settings)
+{
+    core::nameThread("main");
+    core::applyThreadClass(core::thread_class::render);
+    core::startLogging();
+    m_jobs.init();
+    m_benchmarking = true;
+    m_start_time   = core::profileNow();
+    m_startup.begin(m_start_time);
 
-The tutorial mentioned something about push variables that are more efficient at sending small
-amounts memory to the GPU, instead of using an expensive buffer operation
+    {
+        const core::startup_scope scope(&m_startup, "stage", "window");
+        initWindow();
+    }
+    initVulkan();
+    benchmarkLoop(settings);
+    cleanup();
 
-https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkCmdPushConstants
+    m_jobs.shutdown();
+    m_benchmarking = false;
+    core::stopLogging();
+}
+
+/*
+Three things are measured per frame: the CPU time of drawFrame() without its wait for the frame's
+fence, which is what the CPU actually spends on a frame, the time from one frame to the next, which
+is what presenting limits it to, and the GPU time of the frame's command buffer. The GPU times come
+in a couple of frames late, so the last few of them are missed.
 */
 void
-renderer::updateUniformBuffer()
+renderer::benchmarkLoop(const benchmark_settings& settings)
 {
-    static auto start_t = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0;
+         i < settings.warmup_frames && !glfwWindowShouldClose(m_window) && !m_replay_done;
+         ++i) {
+        waitForLatency();
+        glfwPollEvents();
+        drawFrame();
+    }
 
-    auto current_t = std::chrono::high_resolution_clock::now();
+    std::vector<float> cpu;
+    std::vector<float> frame;
+    std::vector<float> gpu;
+    std::vector<float> allocations;  // only while tracking them
+
+    // Or growing them would be counted as the frames' allocations
+    if (settings.seconds <= 0.f) {
+        cpu.reserve(settings.frames);
+        frame.reserve(settings.frames);
+        gpu.reserve(settings.frames);
+        allocations.reserve(settings.frames);
+    }
 
-    float time =
-      std::chrono::duration<float, std::chrono::seconds::period>(current_t - start_t).count();
+    uint64_t gpusamples = 0;
+    float    gpumilliseconds;
+    m_profiler.latest("frame", gpumilliseconds, gpusamples);
 
-    uniformbufferobject ubo;
-    ubo.model = glm::rotate(glm::mat4(1.f), time * glm::radians(90.f), glm::vec3(0.f, 0.f, 1.f));
-    ubo.view =
-      glm::lookAt(glm::vec3(2.f, 2.f, 2.f), glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, 0.f, 1.f));
-    ubo.proj =
-      glm::perspective(glm::radians(45.0f),
-                       m_swapchain_extent.width / (float)m_swapchain_extent.height, 0.1f, 100.0f);
+    const int64_t start    = core::profileNow();
+    const int64_t duration = (int64_t)((double)settings.seconds * 1e9);
+    int64_t       previous = start;
 
-    // GLM was originally designed for OpenGL, where the Y coordinate of the clip coordinates is
-    // inverted. The easiest way to compensate for that is to flip the sign on the scaling factor of
-    // the Y axis in the projection matrix. If you don't do this, then the image will be rendered
-    // upside down.
-    ubo.proj[1][1] *= -1;
+    // A replay ends with its last frame, whatever the settings
+    while (!glfwWindowShouldClose(m_window) && !m_replay_done) {
+        const int64_t elapsed = previous - start;
+        if (settings.seconds > 0.f ? elapsed >= duration : frame.size() >= settings.frames) {
+            break;
+        }
+
+        waitForLatency();
+        glfwPollEvents();
+
+        const int64_t framestart = core::profileNow();
+        drawFrame();
+        const int64_t frameend = core::profileNow();
+
+        cpu.push_back((float)((double)(frameend - framestart - m_frame_wait_ns) * 1e-6));
+        frame.push_back((float)((double)(frameend - previous) * 1e-6));
+        previous = frameend;
+        if (m_allocation_tracking) {
+            allocations.push_back((float)m_frame_allocations.allocations);
+        }
+
+        uint64_t count = 0;
+        if (m_profiler.latest("frame", gpumilliseconds, count) && count != gpusamples) {
+            gpu.push_back(gpumilliseconds);
+            gpusamples = count;
+        }
+    }
+
+    m_device.waitIdle();
 
-    // {
-    //     void* data = m_device.mapMemory(m_uniform_buffer_memory, 0, sizeof(ubo));
-    //     std::memcpy(data, &ubo, sizeof(ubo));
-    //     m_device.unmapMemory(m_uniform_buffer_memory);
-    // }
+    const double seconds = (double)(previous - start) * 1e-9;
 
-    withMappedMemory(m_uniform_buffer_memory, 0, sizeof(ubo),
-                     [=](void* data) { std::memcpy(data, &ubo, sizeof(ubo)); });
+    std::ofstream out(settings.output, std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Failed to write the benchmark results to " + settings.output);
+    }
+
+    const vk::PhysicalDeviceProperties properties = m_physical_device.getProperties();
+
+    out << "{\n";
+    out << "  \"device\": \"" << &properties.deviceName[0] << "\",\n";
+    out << "  \"transform_simd\": \"" << core::simdName(core::transformSimd()) << "\",\n";
+    if (!m_replay_path.empty()) {
+        out << "  \"replay\": \"" << m_replay_path << "\",\n";
+    }
+    out << "  \"width\": " << m_swapchain_extent.width << ",\n";
+    out << "  \"height\": " << m_swapchain_extent.height << ",\n";
+    out << "  \"frames\": " << frame.size() << ",\n";
+    out << "  \"seconds\": " << seconds << ",\n";
+    out << "  \"fps\": " << (seconds > 0. ? (double)frame.size() / seconds : 0.) << ",\n";
+    out << "  \"quality\": \"" << qualityTierName(m_quality_tier) << "\",\n";
+    // The best tier for the frame budget going by this tier's GPU time, see --quality auto
+    if (!gpu.empty()) {
+        const quality_tier recommended =
+          recommendQualityTier(m_quality_tier, median(gpu), m_resolution.settings().budget_ms);
+        out << "  \"recommended_quality\": \"" << qualityTierName(recommended) << "\",\n";
+    }
+    writeStatistics(out, "cpu_ms", cpu);
+    out << ",\n";
+    writeStatistics(out, "frame_ms", frame);
+    out << ",\n";
+    writeStatistics(out, "gpu_ms", gpu);
+    out << ",\n";
+    if (m_allocation_tracking) {
+        writeStatistics(out, "allocations", allocations);
+        out << ",\n";
+    }
+    writeMemoryReport(out, m_allocator.report());
+    if (hostAllocator()) {
+        out << ",\n";
+        writeHostMemoryReport(out, hostAllocatorReport());
+    }
+    if (m_profiler.countersSupported()) {
+        out << ",\n";
+        writeCounters(out, m_profiler);
+    }
+    out << "\n}\n";
 }
 
 /*
-We need to provide details about every descriptor binding used in the shaders for pipeline creation,
-just like we had to do for every vertex attribute and its location index.
+Takes the defaults that were calibrated for this GPU and driver, or if there are none, makes sure
+there's a stress scene for run() to calibrate with once everything is set up, see calibrate. Runs
+as soon as the GPU is picked, before anything the quality settings go into is created.
 */
 void
-renderer::createDescriptorSetLayout()
+renderer::loadCalibration()
 {
-    auto ubolayoutbinding =
-      vk::DescriptorSetLayoutBinding()
-        // The first two fields specify the `binding` used in the shader and
-        // the type of descriptor, which is a uniform buffer object.
-        .setBinding(0)
-        // It is possible for the shader variable to represent an array of uniform buffer objects,
-        // and descriptorCount specifies the number of values in the array. This could be used to
-        // specify a transformation for each of the bones in a skeleton for skeletal animation, for
-        // example.
-        .setDescriptorCount(1)
-        .setDescriptorType(vk::DescriptorType::eUniformBuffer)
-        // We also need to specify in which shader stages the descriptor is going to be referenced.
-        // The stageFlags field can be a combination of VkShaderStageFlagBits values or the value
-        // VK_SHADER_STAGE_ALL_GRAPHICS. In our case, we're only referencing the descriptor from the
-        // vertex shader.
-        .setStageFlags(vk::ShaderStageFlagBits::eVertex);
-
-    auto samplerlayoutbinding = vk::DescriptorSetLayoutBinding()
-                                  .setBinding(1)
-                                  .setDescriptorCount(1)
-                                  .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
-                                  .setPImmutableSamplers(nullptr)
-                                  .setStageFlags(vk::ShaderStageFlagBits::eFragment);
-
-    std::array<vk::DescriptorSetLayoutBinding, 2> bindings = { ubolayoutbinding,
-                                                               samplerlayoutbinding };
+    // Captures and replays are of the scene as it's set up, without the frames calibrating
+    m_calibrating = false;
+    if (m_calibration_path.empty() || m_offscreen || m_benchmarking || !m_replay_path.empty()
+        || !m_capture_path.empty()) {
+        return;
+    }
 
-    auto layoutinfo = vk::DescriptorSetLayoutCreateInfo()
-                        .setBindingCount(static_cast<uint32_t>(bindings.size()))
-                        .setPBindings(bindings.data());
+    calibration_result result;
+    const std::string  device = pipeline_cache::deviceKey(m_physical_device.getProperties());
+    if (!m_recalibrate && readCalibration(m_calibration_path, result) && result.device == device) {
+        applyCalibration(result);
+        return;
+    }
+
+    // An atlas is cooked for the scene's meshes, which a stress scene of its own would add to
+    if (m_impostors_active || m_impostor_baking) {
+        core::logWarning() << "Calibration is off, it doesn't go with impostors";
+        return;
+    }
 
-    if (!(m_descriptor_set_layout = m_device.createDescriptorSetLayout(layoutinfo))) {
-        throw std::runtime_error("failed to create descriptor set layout1");
+    core::logInfo() << "Calibrating for this GPU and driver into " << m_calibration_path;
+    m_calibrating = true;
+    if ((uint64_t)m_stress.columns * m_stress.rows * m_stress.layers == 0) {
+        m_stress.columns    = calibration_columns;
+        m_stress.rows       = calibration_columns;
+        m_stress.layers     = calibration_layers;
+        m_calibration_scene = true;
     }
 }
 
+// Before init the settings are simply what it starts with, afterwards the next frame applies them
 void
-renderer::loadModels()
+renderer::applyCalibration(const calibration_result& result)
 {
-    m_mesh = loadObj("models/chalet.obj");
+    if (!m_quality_chosen) {
+        m_quality_tier = result.tier;
+        setQuality(calibratedQuality(result));
+        m_quality_chosen = false;
+    }
+
+    streaming_budget budget = m_streaming_budget;
+    budget.upload_bytes     = result.upload_bytes;
+    if (m_device) {
+        setStreamingBudget(budget);
+    } else {
+        m_streaming_budget = budget;
+    }
 }
 
-Mesh
-renderer::loadObj(std::string objpath) const
+/*
+Measures the GPU on the stress scene, with everything else as run() set it up, and picks the
+defaults from that, see chooseCalibratedSettings. The frames are rendered at the high tier and full
+scale first, and where frames can be scaled again at half the scale, which tells how much of the
+main pass goes with the pixels, its time being about V + P s^2 at scale s. Dynamic resolution holds
+still meanwhile. The pipeline statistics of the main pass then say how many fragments and triangles
+that was; without them the fragments are taken to be the render target's pixels, and the vertex
+throughput isn't measured at all.
+*/
+void
+renderer::calibrate()
 {
-    tinyobj::attrib_t                attrib;
-    std::vector<tinyobj::shape_t>    shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string                      err;
+    SHINY_PROFILE_FUNCTION();
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, objpath.c_str())) {
-        throw std::runtime_error("failed to load Obj!");
+    if (!m_profiler.supported()) {
+        core::logWarning() << "Calibration is off, the GPU can't time its frames";
+        removeCalibrationScene();
+        return;
+    }
+
+    // Without dynamic resolution the scale stays at the largest, which the targets are resized to
+    const quality_settings    requested = m_requested_quality;
+    const resolution_settings scaling   = m_resolution.settings();
+    resolution_settings       fixed     = scaling;
+    fixed.dynamic                       = false;
+    m_resolution.init(fixed);
+    resizeRendering();
+
+    calibration_result result;
+    result.device = pipeline_cache::deviceKey(m_physical_device.getProperties());
+
+    quality_settings high = qualitySettings(quality_tier::high);
+    setQuality(high);
+
+    float          passms = 0.f;
+    gpu_statistics statistics;
+    bool           measured = measureCalibrationFrames(result.frame_ms, passms, statistics);
+    const double   pixels =
+      (double)m_render_extent.width * m_render_extent.height * (uint32_t)m_samples;
+
+    if (measured && (m_dynamic_resolution || m_temporal_aa)) {
+        float          halfframems = 0.f;
+        float          halfpassms  = 0.f;
+        gpu_statistics halfstatistics;
+        high.render_scale = 0.5f;
+        setQuality(high);
+        measured = measureCalibrationFrames(halfframems, halfpassms, halfstatistics);
+        result.pixel_ms = std::max(passms - halfpassms, 0.f) / 0.75f;
     }
-    Mesh objMesh;
-    for (const auto& shape : shapes) {
-        for (const auto& index : shape.mesh.indices) {
-            Vertex vertex = {};
 
-            vertex.pos = { attrib.vertices[3 * index.vertex_index + 0],
-                           attrib.vertices[3 * index.vertex_index + 1],
-                           attrib.vertices[3 * index.vertex_index + 2] };
+    if (measured) {
+        const bool   counted   = m_profiler.statisticsSupported();
+        const double fragments = counted ? (double)statistics.fragment_invocations : pixels;
+        const float  pixelms   = result.pixel_ms > 0.f ? result.pixel_ms : passms;
+        const float  vertexms  = result.pixel_ms > 0.f ? passms - result.pixel_ms : passms;
+        result.fill_rate       = pixelms > 0.f ? fragments / pixelms * 1e3 : 0.;
+        result.vertex_rate =
+          counted && vertexms > 0.f ? (double)statistics.input_primitives / vertexms * 1e3 : 0.;
+        result.upload_rate = measureUploads();
+    }
 
-            vertex.texcoord = { attrib.texcoords[2 * index.texcoord_index + 0],
-                                1.0f - attrib.texcoords[2 * index.texcoord_index + 1] };
+    // Back to what run() was set up with, which the calibrated settings then replace. The scale
+    // is still the largest, which is what the targets are at.
+    resolution_settings restored = m_resolution.settings();
+    restored.dynamic             = scaling.dynamic;
+    m_resolution.init(restored);
+    setQuality(requested);
 
-            vertex.color = { 1.0f, 1.0f, 1.0f };
+    if (!measured) {
+        core::logWarning() << "Calibration stopped, the window was closed";
+        removeCalibrationScene();
+        return;
+    }
 
-            objMesh.vertices.push_back(vertex);
-            objMesh.indices.push_back(objMesh.indices.size());
-        }
+    chooseCalibratedSettings(result, scaling.budget_ms);
+    if (!writeCalibration(m_calibration_path, result)) {
+        core::logWarning() << "Couldn't write the calibration to " << m_calibration_path;
     }
-    return objMesh;
+    core::logInfo() << "Calibrated " << result.fill_rate * 1e-9 << " Gpixels/s, "
+                    << result.vertex_rate * 1e-6 << " Mtriangles/s, "
+                    << result.upload_rate / (1024. * 1024.) << " MiB/s of uploads: quality "
+                    << qualityTierName(result.tier) << ", render scale " << result.render_scale
+                    << ", " << (result.upload_bytes >> 20) << " MiB of uploads a frame";
+
+    applyCalibration(result);
+    removeCalibrationScene();
 }
 
 /*
-This is a helper function to create a buffer, allocate some memory for it, and bind them together
+The median GPU times of the frames and of their main pass, after warming up for whatever the
+settings changed, and the main pass's statistics in the last of them. False if the window was
+closed first.
 */
-std::pair<vk::Buffer, vk::DeviceMemory>
-renderer::createBuffer(vk::DeviceSize          size,
-                       vk::BufferUsageFlags    usage,
-                       vk::MemoryPropertyFlags properties) const
+bool
+renderer::measureCalibrationFrames(float& frame_ms, float& pass_ms, gpu_statistics& statistics)
 {
-    auto bufferinfo =
-      vk::BufferCreateInfo()
-        // The first field of the struct is size, which specifies the size of the buffer in bytes.
-        .setSize(size)
-        // The second field is usage, which indicates for which purposes the data in the buffer is
-        // going to be used. It is possible to specify multiple purposes using a bitwise or. Our use
-        // case will be a vertex buffer
-        .setUsage(usage)
-        // Just like the images in the swap chain, buffers can also be owned by a specific queue
-        // family or be shared between multiple at the same time. The buffer will only be used from
-        // the graphics queue, so we can stick to exclusive access.
-        .setSharingMode(vk::SharingMode::eExclusive);
-
-    auto buffer = m_device.createBuffer(bufferinfo);
+    std::vector<float> frames;
+    std::vector<float> passes;
+    frames.reserve(calibration_frames);
+    passes.reserve(calibration_frames);
+
+    uint64_t framesamples = 0;
+    uint64_t passsamples  = 0;
+    for (uint32_t i = 0; i < calibration_warmup_frames + calibration_frames; ++i) {
+        if (glfwWindowShouldClose(m_window)) {
+            return false;
+        }
 
-    // The buffer has been created, but it doesn't actually have any memory assigned to it yet. The
-    // first step of allocating memory for the buffer is to query its memory requirements using the
-    // aptly named vkGetBufferMemoryRequirements function.
-    vk::MemoryRequirements memrequirements = m_device.getBufferMemoryRequirements(buffer);
+        waitForLatency();
+        glfwPollEvents();
+        drawFrame();
 
-    // The VkMemoryRequirements struct has three fields:
-    //  - size: The size of the required amount of memory in bytes, may differ from bufferInfo.size.
-    //  - alignment: The offset in bytes where the buffer begins in the allocated region of memory,
-    // depends on bufferInfo.usage and bufferInfo.flags.
-    //  - memoryTypeBits: Bit field of the memory types that are suitable for the buffer.
+        const bool measuring = i >= calibration_warmup_frames;
+        float      ms        = 0.f;
+        uint64_t   count     = 0;
+        if (m_profiler.latest("frame", ms, count) && count != framesamples) {
+            framesamples = count;
+            if (measuring) {
+                frames.push_back(ms);
+            }
+        }
+        if (m_profiler.latest("main pass", ms, count) && count != passsamples) {
+            passsamples = count;
+            if (measuring) {
+                passes.push_back(ms);
+            }
+        }
+    }
 
-    auto memallocinfo = vk::MemoryAllocateInfo()
-                          .setAllocationSize(memrequirements.size)
-                          .setMemoryTypeIndex(findMemoryType(
-                            m_physical_device, memrequirements.memoryTypeBits, properties));
+    frame_ms = median(frames);
+    pass_ms  = median(passes);
+    m_profiler.statistics("main pass", statistics);
+    return true;
+}
 
-    auto buffermemory = m_device.allocateMemory(memallocinfo);
+/*
+Copies to a buffer on the GPU the way streaming does, through the staging arena and the upload
+service, a copy at a time. What that takes from staging to done is what streaming can count on.
+Bytes a second.
+*/
+double
+renderer::measureUploads()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    auto [buffer, memory] =
+      createBuffer(calibration_upload_size, vk::BufferUsageFlagBits::eTransferDst,
+                   vk::MemoryPropertyFlagBits::eDeviceLocal, memory_category::other);
+    const std::vector<uint8_t> data((size_t)calibration_upload_size, 0x5a);
+
+    m_uploads.waitIdle();
+    const int64_t start = core::profileNow();
+    for (uint32_t i = 0; i < calibration_uploads; ++i) {
+        upload_batch batch = m_uploads.begin();
+        batch.copyBuffer(stage(batch, data.data(), calibration_upload_size), buffer, 0,
+                         vk::AccessFlagBits::eTransferRead, vk::PipelineStageFlagBits::eTransfer);
+        m_uploads.wait(batch.submit());
+    }
+    const int64_t end = core::profileNow();
 
-    // The first three parameters are self-explanatory and the fourth parameter is the offset within
-    // the region of memory. Since this memory is allocated specifically for this the vertex buffer,
-    // the offset is simply 0. If the offset is non-zero, then it is required to be divisible by
-    // memRequirements.alignment.
-    m_device.bindBufferMemory(buffer, buffermemory, 0);
+    // The graphics queue may still have to take it over in the next frame
+    m_deletion_queue.push(m_frame_number, buffer);
+    m_deletion_queue.push(m_frame_number, memory);
 
-    return { buffer, buffermemory };
+    const double seconds = (double)(end - start) * 1e-9;
+    return seconds > 0. ? (double)(calibration_upload_size * calibration_uploads) / seconds : 0.;
 }
 
-std::pair<vk::Image, vk::DeviceMemory>
-renderer::createImage(uint32_t                width,
-                      uint32_t                height,
-                      vk::Format              format,
-                      vk::ImageTiling         tiling,
-                      vk::ImageUsageFlags     usage,
-                      vk::MemoryPropertyFlags properties) const
-
+// The stress scene's cubes if they were only there for calibrating, which the next frame drops
+void
+renderer::removeCalibrationScene()
 {
-    auto imageinfo =
-      vk::ImageCreateInfo()
-        // The image type, specified in the imageType field, tells Vulkan with what kind of
-        // coordinate system the texels in the image are going to be addressed. It is possible to
-        // create 1D, 2D and 3D images. One dimensional images can be used to store an array of data
-        // or gradient, two dimensional images are mainly used for textures, and three dimensional
-        // images can be used to store voxel volumes, for example.
-        .setImageType(vk::ImageType::e2D)
-        //  The extent field specifies the dimensions of the image, basically how many texels there
-        //  are on each axis. That's why depth must be 1 instead of 0
-        .setExtent(vk::Extent3D(width, height, 1))
-        .setMipLevels(1)
-        .setArrayLayers(1)
-        // Vulkan supports many possible image formats, but we should use the same format for the
-        // texels as the pixels in the buffer, otherwise the copy operation will fail.
-        .setFormat(format)
-        // The tiling field can have one of two values:
-        //     VK_IMAGE_TILING_LINEAR: Texels are laid out in row-major order like our pixels array
-        //     VK_IMAGE_TILING_OPTIMAL: Texels are laid out in an implementation defined order for
-        //     optimal access
-        // Unlike the layout of an image, the tiling mode cannot be changed at a later time. If you
-        // want to be able to directly access texels in the memory of the image, then you must use
-        // VK_IMAGE_TILING_LINEAR. We will be using a staging buffer instead of a staging image, so
-        // this won't be necessary. We will be using VK_IMAGE_TILING_OPTIMAL for efficient access
-        // from the shader.
-        .setTiling(tiling)
-        .setInitialLayout(vk::ImageLayout::eUndefined)
-        // The usage field has the same semantics as the one during buffer creation. The image is
-        // going to be used as destination for the buffer copy, so it should be set up as a transfer
-        // destination. We also want to be able to access the image from the shader to color our
-        // mesh, so the usage should include VK_IMAGE_USAGE_SAMPLED_BIT.
-        .setUsage(usage)
-        // The samples flag is related to multisampling. This is only relevant for images that will
-        // be used as attachments, so stick to one sample. There are some optional flags for images
-        // that are related to sparse images. Sparse images are images where only certain regions
-        // are actually backed by memory. If you were using a 3D texture for a voxel terrain, for
-        // example, then you could use this to avoid allocating memory to store large volumes of
-        // "air" values. We won't be using it in this tutorial, so leave it to its default value of
-        // 0.
-        .setSamples(vk::SampleCountFlagBits::e1)
-        // The image will only be used by one queue family: the one that supports graphics (and
-        // therefore also) transfer operations.
-        .setSharingMode(vk::SharingMode::eExclusive);
-
-    vk::Image image = m_device.createImage(imageinfo);
+    for (scene::entity e : m_calibration_entities) {
+        m_entities.destroy(e);
+    }
+    m_calibration_entities.clear();
+    m_calibration_scene = false;
+    m_calibrating       = false;
+}
 
-    vk::MemoryRequirements memrequirements = m_device.getImageMemoryRequirements(image);
+/*
+The same as run() without a window: the frames are rendered into offscreen images, and their pixels
+are handed to `settings.deliver` as soon as they are back on the host, which is by the time the
+frame after next starts. The last ones are collected once the device has finished them.
+*/
+void
+renderer::renderOffscreen(const offscreen_settings& settings)
+{
+    core::nameThread("main");
+    core::applyThreadClass(core::thread_class::render);
+    core::startLogging();
+    m_jobs.init();
 
-    auto allocinfo = vk::MemoryAllocateInfo()
-                       .setAllocationSize(memrequirements.size)
-                       .setMemoryTypeIndex(findMemoryType(
-                         m_physical_device, memrequirements.memoryTypeBits, properties));
+    m_offscreen         = true;
+    m_offscreen_deliver = settings.deliver ? settings.deliver : [](const offscreen_frame&) {};
+    m_swapchain_extent  = vk::Extent2D(settings.width, settings.height);
 
-    vk::DeviceMemory memory = m_device.allocateMemory(allocinfo);
+    initVulkan();
+    for (uint32_t i = 0; i < settings.frames && !m_replay_done; ++i) {
+        if (settings.prepare && !settings.prepare(i)) {
+            break;
+        }
+        drawFrame();
+    }
 
-    m_device.bindImageMemory(image, memory, 0);
+    m_device.waitIdle();
+    m_offscreen_target.collectAll(m_offscreen_deliver);
+    cleanup();
 
-    return { image, memory };
+    m_jobs.shutdown();
+    m_offscreen = false;
+    core::stopLogging();
 }
 
 void
-renderer::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) const
+renderer::mainLoop()
 {
-    if (!buffer || !image)
+    if (m_present_thread) {
+        startPresenting();
+    }
+
+    if (!m_render_thread) {
+        while (!glfwWindowShouldClose(m_window)) {
+            SHINY_PROFILE_ZONE("frame");
+            if (waitWhileMinimized()) {
+                continue;
+            }
+            limitFrameRate();
+            waitForLatency();
+            waitForEvents();
+            closeViewports();
+            toggleHud();
+            animationKey();
+            screenshotKey();
+            qualityKey();
+            pickButton();
+            drawFrame();
+            settle();
+        }
+
+        m_presenter.stop();
+        m_device.waitIdle();
         return;
+    }
 
-    // Just like with buffer copies, you need to specify which part of the buffer is going to be
-    // copied to which part of the image. This happens through vk::BufferImageCopy structs:
-    // https://www.khronos.org/registry/vulkan/specs/1.1-extensions/man/html/VkBufferImageCopy.html
-    executeSingleTimeCommands([=](vk::CommandBuffer commandBuffer) {
-        vk::BufferImageCopy region;
-        // bufferOffset is the offset in bytes from the start of the buffer object where the image
-        // data is copied from or to.
-        region
-          .setBufferOffset(0)
-          // bufferRowLength and bufferImageHeight specify the data in buffer memory as a subregion
-          // of a larger two- or three-dimensional image, and control the addressing calculations of
-          // data in buffer memory. If either of these values is zero, that aspect of the buffer
-          // memory is considered to be tightly packed according to the imageExtent.
-          .setBufferImageHeight(0)
-          .setBufferRowLength(0)
-
-          // imageSubresource is a VkImageSubresourceLayers used to specify the specific image
-          // subresources of the image used for the source or destination image data.
-          .imageSubresource
-          // aspectMask is a combination of VkImageAspectFlagBits, selecting the color, depth and/or
-          // stencil aspects to be copied.
-          .setAspectMask(vk::ImageAspectFlagBits::eColor)
-          // mipLevel is the mipmap level to copy from.
-          .setMipLevel(0)
-          // baseArrayLayer and layerCount are the starting layer and number of layers to copy.
-          .setBaseArrayLayer(0)
-          .setLayerCount(1);
-        // imageOffset selects the initial x, y, z offsets in texels of the sub-region of the source
-        // or destination image data.
-        region.setImageOffset({ 0, 0, 0 });
-        // imageExtent is the size in texels of the image to copy in width, height and depth.
-        region.setImageExtent({ width, height, 1 });
-
-        commandBuffer.copyBufferToImage(buffer, image, vk::ImageLayout::eTransferDstOptimal,
-                                        region);
+    // Events have to be polled on the main thread, which simulates the frames as well. Whatever
+    // the render thread throws is thrown again here, once it has stopped.
+    std::exception_ptr failure;
+    std::thread        render([&]() {
+        core::nameThread("render");
+        core::applyThreadClass(core::thread_class::render);
+        try {
+            renderLoop();
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        m_packets.close();
     });
+
+    while (!glfwWindowShouldClose(m_window) && !m_packets.closed()) {
+        SHINY_PROFILE_ZONE("frame");
+        if (waitWhileMinimized()) {
+            continue;
+        }
+        limitFrameRate();
+        waitForEvents();
+        closeViewports();
+        toggleHud();
+        animationKey();
+        screenshotKey();
+        qualityKey();
+        pickButton();
+        simulate(m_packets.write());
+        m_packets.publish();
+    }
+
+    m_packets.close();
+    render.join();
+    m_presenter.stop();
+    m_device.waitIdle();
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+// The render thread's half of mainLoop, until the packets run out. The latency wait is here, it's
+// the render thread's frames that it waits on.
+void
+renderer::renderLoop()
+{
+    while (const frame_packet* packet = m_packets.read()) {
+        waitForLatency();
+        drawFrame(*packet);
+        settle();
+        m_packets.release();
+    }
 }
 
 /*
-Memory transfer operations are executed using command buffers, just like drawing commands. Therefore
-we must first allocate a temporary command buffer. You may wish to create a separate command pool
-for these kinds of short-lived buffers, because the implementation may be able to apply memory
-allocation optimizations. You should use the VK_COMMAND_POOL_CREATE_TRANSIENT_BIT flag during
-command pool generation in that case.
+Queues are externally synchronized, so any of the graphics, compute and transfer queues that is the
+presentation queue as well is only submitted to with m_queue_mutex held from here on. The splash
+frame is presented before, on the main thread.
 */
 void
-renderer::copyBuffer(vk::Buffer src, vk::Buffer* dst, vk::DeviceSize size) const
+renderer::startPresenting()
 {
-    if (!src || !dst)
-        return;
+    const vk::Queue queue  = m_presentation_queue;
+    const bool      shared = queue == m_graphics_queue || queue == m_compute_queue
+                        || queue == m_transfer_queue;
+    if (m_frame_batch.queue() == queue) {
+        m_frame_batch.setLock(&m_queue_mutex);
+    }
+    if (m_compute_batch.queue() == queue) {
+        m_compute_batch.setLock(&m_queue_mutex);
+    }
+    m_uploads.setQueueLock(queue, &m_queue_mutex);
 
-    executeSingleTimeCommands([=](vk::CommandBuffer& commandbuf) {
-        auto copyregion = vk::BufferCopy().setSize(size);
-        commandbuf.copyBuffer(src, *dst, 1, &copyregion);
-    });
+    m_presenter.start(queue, shared ? &m_queue_mutex : nullptr, m_present_wait);
 }
 
+/*
+Holds the main loop to pacing_settings::max_fps, or background_fps while the window isn't focused,
+whichever applies and is lower. Before input is sampled, so the frame shows the latest there is.
+*/
 void
-renderer::transitionImageLayout(vk::Image       image,
-                                vk::Format      format,
-                                vk::ImageLayout oldLayout,
-                                vk::ImageLayout newLayout) const
+renderer::limitFrameRate()
 {
-    if (!image) {
+    float fps = m_pacing.max_fps;
+    if (m_pacing.background_fps > 0.f && !glfwGetWindowAttrib(m_window, GLFW_FOCUSED)) {
+        fps = fps > 0.f ? std::min(fps, m_pacing.background_fps) : m_pacing.background_fps;
+    }
+    if (fps <= 0.f) {
         return;
     }
 
-    // Begin lambda function
-    executeSingleTimeCommands([=](vk::CommandBuffer commandBuffer) {
-        // ImageMemoryBarrier struct with constructor argument descriptions in order of appearance.
-        // For in depth descriptions of the purposes of each one, go to this web address:
-        // https://www.khronos.org/registry/vulkan/specs/1.1-extensions/man/html/VkImageMemoryBarrier.html
-        // 1) srcAccessMask is a bitmask of VkAccessFlagBits specifying a source access mask.
-        // 2) dstAccessMask is a bitmask of VkAccessFlagBits specifying a destination access mask.
-        // 3) oldLayout is the old layout in an image layout transition.
-        // 4) newLayout is the new layout in an image layout transition.
-        // 5) srcQueueFamilyIndex is the source queue family for a queue family ownership transfer.
-        // 6) dstQueueFamilyIndex is the destination queue family for a queue family ownership
-        //    transfer.
-        // 7) image is a handle to the image affected by this barrier.
-        // 8) subresourceRange describes the image subresource range within image that is affected
-        //    by this barrier.
-        vk::ImageMemoryBarrier barrier(
-          vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferRead,
-          vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal, 0, 0, image);
-        // Initial Barrier settings
-        barrier.setOldLayout(oldLayout)
-          .setNewLayout(newLayout)
-          .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
-          .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
-          .setImage(image);
-        // subresourceRange stuff, very similar to the Buffer to Image stuff
-        if (newLayout == vk::ImageLayout::eDepthStencilAttachmentOptimal) {
-            barrier.subresourceRange.setAspectMask(vk::ImageAspectFlagBits::eDepth);
-            if (hasStencilComponent(format)) {
-                barrier.subresourceRange.aspectMask |= vk::ImageAspectFlagBits::eStencil;
-            }
-        } else {
-            barrier.subresourceRange.setAspectMask(vk::ImageAspectFlagBits::eColor);
-        }
-        barrier.subresourceRange.setBaseMipLevel(0)
-          .setLevelCount(1)
-          .setBaseArrayLayer(0)
-          .setLayerCount(1);
-
-        vk::PipelineStageFlags sourceStage;
-        vk::PipelineStageFlags destStage;
-
-        // We perform layout checks in order to derive which transition we are making.
-        // For now, we are only considering two transitions:
-        // e.g.          oldLayout -> newLayout
-        // 1)            Undefined -> transfer destination
-        // 2) Transfer destination -> shader reading
-        // Later on, we can expand these condition checks, though I'm not sure how to make this more
-        // sophisticated. - <Jason>
-        /*The depth buffer will be read from to perform depth tests to see if a fragment is visible,
-         * and will be written to when a new fragment is drawn. The reading happens in the
-         * VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT stage and the writing in the
-         * VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT. You should pick the earliest pipeline stage
-         * that matches the specified operations, so that it is ready for usage as depth attachment
-         * when it needs to be.*/
-        if (oldLayout == vk::ImageLayout::eUndefined
-            && newLayout == vk::ImageLayout::eTransferDstOptimal) {
-            barrier.setSrcAccessMask(vk::AccessFlagBits());
-            barrier.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
-            sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
-            destStage   = vk::PipelineStageFlagBits::eTransfer;
-        } else if (oldLayout == vk::ImageLayout::eTransferDstOptimal
-                   && newLayout == vk::ImageLayout::eShaderReadOnlyOptimal) {
-            barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
-            barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-            sourceStage = vk::PipelineStageFlagBits::eTransfer;
-            destStage   = vk::PipelineStageFlagBits::eFragmentShader;
-        } else if (oldLayout == vk::ImageLayout::eUndefined
-                   && newLayout == vk::ImageLayout::eDepthStencilAttachmentOptimal) {
-            barrier.setSrcAccessMask(vk::AccessFlagBits());
-            barrier.setDstAccessMask(vk::AccessFlagBits::eDepthStencilAttachmentRead
-                                     | vk::AccessFlagBits::eDepthStencilAttachmentWrite);
-            sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
-            destStage   = vk::PipelineStageFlagBits::eEarlyFragmentTests;
-        } else {
-            throw std::invalid_argument("Unsupported layout transition!");
-        }
-
-        commandBuffer.pipelineBarrier(sourceStage, destStage, vk::DependencyFlagBits::eByRegion,
-                                      (uint32_t)0, nullptr, (uint32_t)0, nullptr, 1, &barrier);
-    });
+    SHINY_PROFILE_FUNCTION();
+    m_frame_limiter.wait(fps);
 }
 
-vk::ImageView
-renderer::createImageView(vk::Image               image,
-                          vk::Format              format,
-                          vk::ImageAspectFlagBits aspectflags) const
+// A minimized window's framebuffer is empty, which there can be no swap chain for, so instead of
+// drawing and recreating it the main loop sleeps until the window has a size again
+bool
+renderer::waitWhileMinimized()
 {
-    auto createinfo = vk::ImageViewCreateInfo()
-                        .setImage(image)
-                        .setViewType(vk::ImageViewType::e2D)
-                        .setFormat(format)
-                        .setComponents(vk::ComponentMapping()
-                                         .setR(vk::ComponentSwizzle::eIdentity)
-                                         .setG(vk::ComponentSwizzle::eIdentity)
-                                         .setB(vk::ComponentSwizzle::eIdentity)
-                                         .setA(vk::ComponentSwizzle::eIdentity))
-                        .setSubresourceRange(vk::ImageSubresourceRange()
-                                               .setAspectMask(aspectflags)
-                                               .setBaseMipLevel(0)
-                                               .setLevelCount(1)
-                                               .setBaseArrayLayer(0)
-                                               .setLayerCount(1));
-
-    vk::ImageView imageView = m_device.createImageView(createinfo, nullptr);
-    if (!imageView) {
-        throw std::runtime_error("failed to create texture image view!");
+    int width  = 0;
+    int height = 0;
+    glfwGetFramebufferSize(m_window, &width, &height);
+    if (width > 0 && height > 0 && !glfwGetWindowAttrib(m_window, GLFW_ICONIFIED)) {
+        return false;
     }
 
-    return imageView;
+    SHINY_PROFILE_FUNCTION();
+    glfwWaitEvents();
+    return true;
 }
 
-/* This function allows us to define our own list of prioritized formats, and will return the first
- * successful find based on the list of candidates. */
-vk::Format
-renderer::findSupportedFormat(const std::vector<vk::Format>& candidates,
-                              vk::ImageTiling                tiling,
-                              vk::FormatFeatureFlagBits      features) const
+/*
+Polls the window's events, and on demand waits for the next frame to be due first: one was asked
+for by input or requestRedraw(), as many again as there are frames in flight follow it, for what
+they read back, copy out or stream in to be picked up, and while the render thread is busy with
+something on its way, one every on_demand_poll_interval. A running animation draws every frame.
+*/
+void
+renderer::waitForEvents()
 {
-    for (vk::Format format : candidates) {
-        vk::FormatProperties properties = m_physical_device.getFormatProperties(format);
+    glfwPollEvents();
+    if (!m_on_demand || m_animating || m_replay.isOpen()) {
+        return;
+    }
 
-        if (tiling == vk::ImageTiling::eLinear
-            && (properties.linearTilingFeatures & features) == features) {
-            return format;
-        } else if (tiling == vk::ImageTiling::eOptimal
-                   && (properties.optimalTilingFeatures & features) == features) {
-            return format;
+    SHINY_PROFILE_FUNCTION();
+
+    while (!m_redraw.exchange(false)) {
+        if (m_owed_frames > 0) {
+            --m_owed_frames;
+            return;
+        }
+        if (m_busy) {
+            glfwWaitEventsTimeout(on_demand_poll_interval);
+            return;
         }
+        glfwWaitEvents();
     }
-
-    throw std::runtime_error("failed to find supported format!");
+    m_owed_frames = m_frames_in_flight;
 }
 
 /*
-The application we have now successfully draws a triangle, but there are some circumstances that
-it isn't handling properly yet. It is possible for the window surface to change such that the swap
-chain is no longer compatible with it. One of the reasons that could cause this to happen is the
-size of the window changing. We have to catch these events and recreate the swap chain.
+After every frame, on the render thread if there is one. Whatever the frame streamed in or compiled
+can make the next ones ask for more, a finer mip level or a virtual texture's tiles, so it asks for
+a frame right away, and so does finishing everything that was on its way. Hot reloading watches the
+files for as long as it runs, so it only ever polls.
 */
 void
-renderer::recreateSwapChain()
+renderer::settle()
 {
-    m_device.waitIdle();
+    if (!m_on_demand) {
+        return;
+    }
 
-    cleanupSwapChain();
+    const bool busy = m_hot_reload || !m_uploads.idle() || m_textures.reading()
+                      || m_virtual_textures.reading() || m_terrain.reading()
+                      || m_pipelines.compiling();
+    const settle_marks marks(m_textures.version(), m_virtual_textures.version(),
+                             m_virtual_textures.residentPages(), m_pipelines.size(),
+                             m_scene_visible);
 
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
-    createGraphicsPipeline();
-    createDepthResources();
-    createFramebuffers();
-    createCommandBuffers();
+    if (marks != m_settled || (m_busy && !busy)) {
+        m_settled = marks;
+        requestRedraw();
+    }
+    m_busy = busy;
+}
+
+void
+renderer::requestRedraw()
+{
+    m_redraw = true;
+    glfwPostEmptyEvent();
 }
 
 /*
-refer to renderer::recreateSwapChain()
+Input is sampled right after this, so the less of the frames before it are still queued, the sooner
+what it does is on screen. Waiting for the last present means nothing is queued at all, at the cost
+of the CPU and GPU no longer overlapping. Without VK_KHR_present_wait the last frame's fence is the
+closest there is.
 */
 void
-renderer::cleanupSwapChain()
+renderer::waitForLatency()
 {
-    m_device.destroyImageView(m_depth_image_view);
-    m_device.destroyImage(m_depth_image);
-    m_device.freeMemory(m_depth_image_memory);
+    if (!m_pacing.low_latency || m_frame_number == 0) {
+        return;
+    }
 
-    for (auto& framebuffer : m_swapchain_framebuffers) {
-        m_device.destroyFramebuffer(framebuffer);
+    SHINY_PROFILE_FUNCTION();
+
+    // The present thread has to have queued the last present to be waited for
+    m_presenter.drain();
+
+#if defined(VK_KHR_present_wait)
+    if (m_present_wait && m_presented > 0) {
+        // A minimized window may not present at all, which the timeout gets it past
+        m_wait_for_present(static_cast<VkDevice>(m_device),
+                           static_cast<VkSwapchainKHR>(m_swapchain), m_presented,
+                           m_pacing.frame_timeout_ns);
+        return;
     }
+#endif
+
+    waitForFrame(m_frame_number);
+}
 
-    for (auto& imageview : m_swapchain_image_views) {
-        m_device.destroyImageView(imageview);
+/*
+Frame `frame`, counting from 1 like m_frame_number, is done once the frame timeline reaches it. The
+fences are per frame in flight instead, so frame `frame`'s is the one it was submitted with, which
+may have been reused by a later frame since. Waiting for that one is waiting for longer than needed,
+but not wrong, and it can't have been reset for a frame that isn't submitted yet: that only happens
+to the fence of the frame waited for at the start of drawFrame, which is complete by then.
+*/
+bool
+renderer::waitForFrame(uint64_t frame)
+{
+    if (frame <= m_completed_frame) {
+        return true;
     }
 
-    m_device.freeCommandBuffers(m_command_pool, (uint32_t)m_command_buffers.size(),
-                                m_command_buffers.data());
+    if (m_timeline_semaphores) {
+        if (!m_frame_timeline.wait(frame, m_pacing.frame_timeout_ns)) {
+            return false;
+        }
+    } else {
+        const vk::Fence fence = m_in_flight_fences[(frame - 1) % m_frames_in_flight];
+        if (m_device.waitForFences(fence, true, m_pacing.frame_timeout_ns)
+            == vk::Result::eTimeout) {
+            return false;
+        }
+    }
 
-    m_device.destroyPipeline(m_graphics_pipeline);
-    m_device.destroyPipelineLayout(m_pipeline_layout);
-    m_device.destroyRenderPass(m_render_pass);
+    m_completed_frame = frame;
+    return true;
+}
 
-    m_device.destroySwapchainKHR(m_swapchain);
+void
+renderer::setStreamingBudget(const streaming_budget& budget)
+{
+    m_streaming_budget = budget;
+    m_streams.setBudget(budget);
 }
 
 void
-renderer::initVulkan()
+renderer::setPacing(const pacing_settings& settings)
 {
-    createInstance();
-    setupDebugCallback();
-    createSurface();
-    pickPhysicalDevice();
-    createLogicalDevice();
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
-    createDescriptorSetLayout();
-    createGraphicsPipeline();
-    createCommandPool();
-    createDepthResources();
-    createFramebuffers();
-    createTextureImage();
-    createTextureImageView();
-    createTextureSampler();
-    // loadModels();
-    createVertexBuffer();
-    createIndexBuffer();
-    createUniformBuffer();
-    createDescriptorPool();
-    createDescriptorSet();
-    createCommandBuffers();
-    createSemaphores();
-    createFences();
+    m_pacing = settings;
+
+    // Not with std::min, which would need max_frames_in_flight to be defined somewhere
+    m_frames_in_flight = std::max(settings.frames_in_flight, 1u);
+    if (m_frames_in_flight > max_frames_in_flight) {
+        m_frames_in_flight = max_frames_in_flight;
+    }
+    m_pacing.frames_in_flight = m_frames_in_flight;
 }
 
 void
-renderer::mainLoop()
+renderer::setDevice(const std::string& device)
 {
-    while (!glfwWindowShouldClose(m_window)) {
-        glfwPollEvents();
-        updateUniformBuffer();
-        drawFrame();
+    m_device_preference = parseDevicePreference(device);
+}
+
+void
+renderer::setResolution(const resolution_settings& settings)
+{
+    m_resolution.init(settings);
+
+    // The largest scale is the quality's render scale, both ways
+    m_quality.render_scale           = m_resolution.settings().max_scale;
+    m_requested_quality.render_scale = m_resolution.settings().max_scale;
+}
+
+/*
+Before init the settings are simply what the renderer starts with. Afterwards they go to the render
+thread with the next frame packet, which applies them between frames, see applyQuality.
+*/
+void
+renderer::setQuality(const quality_settings& settings)
+{
+    m_requested_quality = settings;
+    if (m_device) {
+        return;
     }
 
-    m_device.waitIdle();
+    m_quality_chosen            = true;
+    m_quality                   = settings;
+    resolution_settings scaling = m_resolution.settings();
+    scaling.max_scale           = settings.render_scale;
+    scaling.min_scale           = std::min(scaling.min_scale, settings.render_scale);
+    m_resolution.init(scaling);
+}
+
+void
+renderer::setQualityTier(quality_tier tier)
+{
+    m_quality_tier = tier;
+    setQuality(qualitySettings(tier));
+}
+
+void
+renderer::setCalibration(const std::string& path, bool recalibrate)
+{
+    m_calibration_path = path;
+    m_recalibrate      = recalibrate;
 }
 
 void
 renderer::cleanup()
 {
+    m_capture.close();
+    m_replay.close();
+
+    // The device is idle, so the last screenshots are there to hand over, and they are written out
+    // before the jobs shut down
+    m_frame_readback.collectAll();
+    m_jobs.wait(m_screenshot_saves);
+    m_frame_readback.destroy();
+    m_video.collectAll();
+    m_video.destroy();
+    if (m_picking) {
+        m_picker.collectAll();
+        m_picker.destroy();
+    }
+
     /*for (size_t i = 0; i < max_frames_in_flight; ++i) {
-        m_device.destroySemaphore(m_render_finished_semaphores[i], nullptr);
-        m_device.destroySemaphore(m_image_available_semaphores[i], nullptr);
-        m_device.destroyFence(m_in_flight_fences[i], nullptr);
+        m_device.destroySemaphore(m_render_finished_semaphores[i], hostAllocator());
+        m_device.destroySemaphore(m_image_available_semaphores[i], hostAllocator());
+        m_device.destroyFence(m_in_flight_fences[i], hostAllocator());
     }*/
 
     for (auto& fence : m_in_flight_fences) {
-        m_device.destroyFence(fence);
+        m_device.destroyFence(fence, hostAllocator());
     }
+    m_frame_timeline.destroy();
+    m_compute_timeline.destroy();
 
     for (auto& semaphore : m_image_available_semaphores) {
-        m_device.destroySemaphore(semaphore);
+        m_device.destroySemaphore(semaphore, hostAllocator());
     }
 
     for (auto& semaphore : m_render_finished_semaphores) {
-        m_device.destroySemaphore(semaphore);
+        m_device.destroySemaphore(semaphore, hostAllocator());
     }
 
+    // The device is idle, so nothing has to wait for its frame anymore
+    m_deletion_queue.destroy();
+
     cleanupSwapChain();
+    destroyViewports();
 
-    m_device.destroyDescriptorPool(m_descriptor_pool);
-    m_device.destroyDescriptorSetLayout(m_descriptor_set_layout);
+    m_pipelines.destroy();
+    m_device.destroyRenderPass(m_render_pass, hostAllocator());
+
+    m_descriptors.destroy();
+    m_texture_descriptors.destroy();
+    for (descriptor_allocator& allocator : m_frame_descriptors) {
+        allocator.destroy();
+    }
+    m_descriptor_template.destroy();
+    m_descriptor_buffer.destroy();
+    m_layouts.destroy();
+
+    m_uniforms.destroy();
+    m_draws.destroy();
+    if (lightingEnabled()) {
+        m_lighting.destroy();
+    }
+    if (shadowsEnabled()) {
+        m_cascades.destroy();
+    }
+    if (m_ray_query) {
+        m_acceleration.destroy();
+    }
+    if (m_reflections) {
+        m_probes.destroy();
+    }
+    if (m_particle_count > 0) {
+        m_particles.destroy();
+    }
+    if (m_hud) {
+        m_hud_sprites.destroy();
+    }
+    if (m_debug_draw) {
+        m_debug.destroy();
+    }
+    if (m_skinned_count > 0) {
+        m_skinning.destroy();
+    }
+    if (m_gpu_culling) {
+        if (m_render_scene_enabled) {
+            m_render_scene.destroy();
+        }
+        m_culling.destroy();
+    }
+    if (m_occlusion_culling) {
+        m_hiz.destroy();
+    }
+    if (m_temporal_aa) {
+        m_temporal.destroy();
+    }
+    if (m_post_processing) {
+        m_post.destroy();
+    }
+    if (m_adaptive_shading) {
+        m_shading_rates.destroy();
+    }
+    if (m_occlusion_queries) {
+        m_occlusion.destroy();
+    }
+    m_geometry.destroy();
+
+    // delete image and texture views and samplers. Textures still being read are dropped, the ones
+    // being decoded are waited for, since they hand themselves over to the streamer.
+    m_watcher.stop();
+    m_telemetry.stop();
+    m_jobs.wait(m_mesh_reloads);
+    m_jobs.wait(m_shader_compiles);
+    m_shader_compiler.destroy();
+    m_streams.shutdown();
+    m_io.shutdown();
+    m_texture_loader.waitAsync();
+    m_textures.destroy();
+    if (m_virtual_texturing) {
+        m_virtual_textures.destroy();
+    }
+    if (m_vegetation_active) {
+        m_vegetation.destroy();
+    }
+    if (m_terrain_active) {
+        m_terrain.destroy();
+    }
+    if (m_impostors_active) {
+        m_impostors.destroy();
+    }
+    m_views.destroy();
 
-    m_device.destroyBuffer(m_uniform_buffer);
-    m_device.freeMemory(m_uniform_buffer_memory);
+    // command buffers are implicitly deleted when their command pool is deleted
+    for (auto& pool : m_command_pools) {
+        m_device.destroyCommandPool(pool, hostAllocator());
+    }
+    for (auto& pools : m_secondary_command_pools) {
+        for (auto& pool : pools) {
+            m_device.destroyCommandPool(pool, hostAllocator());
+        }
+    }
+    for (auto& pool : m_compute_command_pools) {
+        m_device.destroyCommandPool(pool, hostAllocator());
+    }
 
-    m_device.destroyBuffer(m_index_buffer);
-    m_device.freeMemory(m_index_buffer_memory);
 
-    m_device.destroyBuffer(m_vertex_buffer);
-    m_device.freeMemory(m_vertex_buffer_memory);
+    m_pipeline_cache.destroy();
 
-    // delete image and texture views and samplers
-    m_device.destroySampler(m_texture_sampler);
-    m_device.destroyImageView(m_texture_image_view);
-    m_device.destroyImage(m_texture_image);
-    m_device.freeMemory(m_texture_image_memory);
+    m_profiler.destroy();
+    m_uploads.destroy();
+    m_downsampler.destroy();
+    m_staging.destroy();
 
-    // command buffers are implicitly deleted when their command pool is deleted
-    m_device.destroyCommandPool(m_command_pool);
+    // Everything should have been freed by now, so whatever is still used was leaked
+    const std::vector<memory_heap_report> heaps = m_allocator.report();
+    for (size_t heap = 0; heap < heaps.size(); ++heap) {
+        for (size_t category = 0; category < memory_category_count; ++category) {
+            if (heaps[heap].allocations[category] > 0) {
+                core::logWarning() << "Leaked " << heaps[heap].allocations[category] << " "
+                                   << memoryCategoryName((memory_category)category)
+                                   << " allocations (" << heaps[heap].used[category]
+                                   << " bytes) in heap " << heap;
+            }
+        }
+    }
 
-    m_device.destroyShaderModule(m_vertex_shader_module);
-    m_device.destroyShaderModule(m_fragment_shader_module);
+    m_allocator.destroy();
 
-    m_device.destroy();
+    m_device.destroy(hostAllocator());
 
-    if (enableValidationLayers) {
-        DestroyDebugReportCallbackEXT(m_instance, m_callback);
+    if (m_validation) {
+        DestroyDebugReportCallbackEXT(m_instance, m_callback, hostAllocator());
     }
 
     // vk::surfaceKHR objects do not have a destroy()
     // https://github.com/KhronosGroup/Vulkan-Hpp/issues/204
-    m_instance.destroySurfaceKHR(m_surface);
-    m_instance.destroy();
+    if (m_surface) {
+        m_instance.destroySurfaceKHR(m_surface, hostAllocator());
+    }
+    m_instance.destroy(hostAllocator());
+
+    if (m_window) {
+        glfwDestroyWindow(m_window);
+        glfwTerminate();
+        m_window = nullptr;
+    }
+
+    // The scheduler shuts down next
+    core::setPackageJobs(nullptr);
 
-    glfwDestroyWindow(m_window);
-    glfwTerminate();
+    reportAllocations();
 }
 
 }  // namespace shiny::graphics
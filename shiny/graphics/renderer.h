@@ -6,10 +6,146 @@
 #include <vulkan/vulkan.hpp>
 
 #include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "core/file_watcher.h"
+#include "core/alloc_tracker.h"
+#include "core/fixed_timestep.h"
+#include "core/frame_limiter.h"
+#include "core/linear_arena.h"
+#include "core/io_queue.h"
+#include "core/startup_report.h"
+#include "core/telemetry.h"
+#include "graphics/acceleration_structures.h"
+#include "graphics/animation.h"
+#include "graphics/calibration.h"
+#include "graphics/debug_draw.h"
+#include "graphics/debug_labels.h"
+#include "graphics/deletion_queue.h"
+#include "graphics/descriptor_allocator.h"
+#include "graphics/descriptor_buffer.h"
+#include "graphics/descriptor_template.h"
+#include "graphics/device_capabilities.h"
+#include "graphics/device_selection.h"
+#include "graphics/draw_buffer.h"
+#include "graphics/frame_capture.h"
+#include "graphics/frame_readback.h"
+#include "graphics/frustum_culling.h"
+#include "graphics/geometry_pool.h"
+#include "graphics/gpu_culling.h"
+#include "graphics/gpu_profiler.h"
+#include "graphics/gpu_skinning.h"
+#include "graphics/hiz_pyramid.h"
+#include "graphics/host_allocator.h"
+#include "graphics/image_compression.h"
+#include "graphics/impostor.h"
+#include "graphics/layout_cache.h"
+#include "graphics/light_culling.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/mesh_lod.h"
+#include "graphics/mesh_material.h"
+#include "graphics/meshlet.h"
+#include "graphics/mip_downsampler.h"
+#include "graphics/object_picker.h"
+#include "graphics/occlusion_queries.h"
+#include "graphics/offscreen_target.h"
+#include "graphics/particle_system.h"
+#include "graphics/perf_overlay.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/pipeline_library.h"
+#include "graphics/portal_culling.h"
+#include "graphics/post_process.h"
+#include "graphics/present_thread.h"
+#include "graphics/quality_tier.h"
+#include "graphics/radix_sort.h"
+#include "graphics/reflection_probes.h"
+#include "graphics/render_graph.h"
+#include "graphics/render_scene.h"
+#include "graphics/resolution_scaler.h"
+#include "graphics/resource_cache.h"
+#include "graphics/shader_compiler.h"
+#include "graphics/shader_reflection.h"
+#include "graphics/shading_rate_image.h"
+#include "graphics/shadow_cascades.h"
+#include "graphics/stream_scheduler.h"
+#include "graphics/sprite_atlas.h"
+#include "graphics/sprite_batch.h"
+#include "graphics/staging_arena.h"
+#include "graphics/submit_batch.h"
+#include "graphics/temporal_upscaler.h"
+#include "graphics/terrain.h"
+#include "graphics/texture_loader.h"
+#include "graphics/texture_streamer.h"
+#include "graphics/timeline_semaphore.h"
+#include "graphics/uniform_ring.h"
+#include "graphics/upload_service.h"
+#include "graphics/vegetation.h"
+#include "graphics/vertex_layout.h"
+#include "graphics/video_capture.h"
+#include "graphics/view_cache.h"
+#include "graphics/virtual_texture.h"
+#include "jobs/packet_exchange.h"
+#include "jobs/scheduler.h"
+#include "scene/entity_world.h"
+#include "scene/scene_graph.h"
 
 namespace shiny::graphics {
 
-using spirvbytecode = std::vector<char>;
+/*
+The geometry pool keeps the vertices in two streams, see geometry_pool, bound to these bindings:
+the positions, which is all the shadow maps' passes read, and everything else.
+*/
+const uint32_t position_binding  = 0;
+const uint32_t attribute_binding = 1;
+
+/*
+The subpasses of the render pass with deferred shading, see renderer::createDeferredRenderPass: the
+G-buffer's, which is the only one without it, and then the one lighting it and drawing whatever
+can't go in the G-buffer on top.
+*/
+const uint32_t geometry_subpass = 0;
+const uint32_t lighting_subpass = 1;
+
+/*
+What the streams hold of a Vertex: the position stream its `pos` alone, and the attribute stream
+the rest, padded to as many of the pool's units as the position takes, see
+renderer::createGeometryPool.
+*/
+struct vertex_position
+{
+    glm::vec3 pos;
+};
+
+struct vertex_attributes
+{
+    glm::vec3 color;
+    glm::vec2 texcoord;
+    float     padding = 0.f;
+};
+
+template<>
+constexpr auto vertex_fields<vertex_position> = std::array {
+    SHINY_VERTEX_FIELD(vertex_position, pos, 0),
+};
+
+template<>
+constexpr auto vertex_fields<vertex_attributes> = std::array {
+    SHINY_VERTEX_FIELD(vertex_attributes, color, 1),
+    SHINY_VERTEX_FIELD(vertex_attributes, texcoord, 2),
+};
 
 struct Vertex
 {
@@ -17,22 +153,120 @@ struct Vertex
     glm::vec3 color;
     glm::vec2 texcoord;
 
-    static vk::VertexInputBindingDescription                  getBindingDescription();
-    static std::array<vk::VertexInputAttributeDescription, 3> getAttributeDescription();
+    // A binding per stream of the geometry pool, position_binding and attribute_binding
+    using streams = vertex_streams<vertex_position, vertex_attributes>;
+
+    static constexpr auto getBindingDescription() { return streams::bindings(); }
+    static constexpr auto getAttributeDescription() { return streams::attributes(); }
+
+    bool operator==(const Vertex& other) const;
+};
+
+// What duplicate vertices are found by, all of it
+template<>
+constexpr auto vertex_fields<Vertex> = std::array {
+    SHINY_VERTEX_FIELD(Vertex, pos, 0),
+    SHINY_VERTEX_FIELD(Vertex, color, 1),
+    SHINY_VERTEX_FIELD(Vertex, texcoord, 2),
+};
+
+inline bool
+Vertex::operator==(const Vertex& other) const
+{
+    return vertexEqual(*this, other);
+}
+
+/*
+A Vertex in two thirds of the size, of which the position stream takes a packed_position and the
+attribute stream packed_attributes. The position is 16 bit normalized within the mesh's bounds,
+which the vertex input turns into [0, 1] and the mesh's `dequantize` matrix, folded into every
+instance's transform, takes back to model space. Colors are 8 bit normalized and texcoords half
+floats, which the vertex input converts to floats as well, so both layouts use the same vertex
+shader.
+*/
+struct packed_position
+{
+    uint16_t pos[4];  // the last is padding, 3 component 16 bit formats are rarely supported
+};
+
+struct packed_attributes
+{
+    uint8_t  color[4];
+    uint16_t texcoord[2];
+    uint32_t padding[2] = {};  // like vertex_attributes'
+};
+
+// The same locations as Vertex's, in formats the vertex input converts to floats on the way in, so
+// the shader can't tell the difference apart from the positions being in [0, 1]
+template<>
+constexpr auto vertex_fields<packed_position> = std::array {
+    SHINY_VERTEX_FIELD_AS(packed_position, pos, 0, vk::Format::eR16G16B16A16Unorm),
+};
+
+template<>
+constexpr auto vertex_fields<packed_attributes> = std::array {
+    SHINY_VERTEX_FIELD_AS(packed_attributes, color, 1, vk::Format::eR8G8B8A8Unorm),
+    SHINY_VERTEX_FIELD_AS(packed_attributes, texcoord, 2, vk::Format::eR16G16Sfloat),
+};
+
+struct packed_vertex
+{
+    using streams = vertex_streams<packed_position, packed_attributes>;
+
+    static constexpr auto getBindingDescription() { return streams::bindings(); }
+    static constexpr auto getAttributeDescription() { return streams::attributes(); }
 };
 
+enum class vertex_format : uint8_t
+{
+    full,    // Vertex
+    packed,  // packed_vertex
+    count,
+};
+
+/*
+The vertices and indices are only needed on the host until the mesh is in the geometry pool, and
+are dropped then unless the renderer is told to keep them, see renderer::setKeepMeshData. What is
+drawn with, the levels, meshlets, bounds and pool range, stays either way.
+
+Meshes can be large, so they are moved rather than copied. drawable() is the copy there is, of
+everything but the vertices and indices.
+*/
 struct Mesh
 {
-    Mesh() {}
-    Mesh(std::vector<Vertex> verticesIn, std::vector<uint32_t> indicesIn)
+    Mesh() = default;
+    Mesh(std::vector<Vertex>&& verticesIn, std::vector<uint32_t>&& indicesIn)
+      : vertices(std::move(verticesIn))
+      , indices(std::move(indicesIn))
+    {}
+
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    Mesh(Mesh&&)                 = default;
+    Mesh& operator=(Mesh&&) = default;
+
+    Mesh drawable() const;
+
+    // Frees the vertices and indices, not just clears them
+    void releaseHostData()
     {
-        vertices = verticesIn;
-        indices  = indicesIn;
+        std::vector<Vertex>().swap(vertices);
+        std::vector<uint32_t>().swap(indices);
     }
-    std::vector<Vertex>   vertices;
-    std::vector<uint32_t> indices;
-    vk::Buffer            vertex_buffer;
-    vk::DeviceMemory      vertex_buffer_memory;
+
+    std::vector<Vertex>        vertices;
+    std::vector<uint32_t>      indices;    // every level's, one after the other
+    std::vector<mesh_lod>      lods;       // finest first; none means the indices are one level
+    std::vector<meshlet>       meshlets;   // every level's, see mesh_lod
+    std::vector<mesh_material> materials;
+    std::vector<submesh>       submeshes;  // by material; none means the lods are one submesh
+    std::vector<uint32_t>      textures;   // renderer's texture_handle by material, not cached
+    geometry_range             geometry;   // where the mesh lives in the renderer's geometry pool
+    float                      radius     = 0.f;                  // of a sphere around the origin
+    glm::vec3                  bounds_min = glm::vec3(0.f);       // axis aligned, in model space
+    glm::vec3                  bounds_max = glm::vec3(0.f);
+    vertex_format              format     = vertex_format::full;  // see chooseVertexFormat
+    glm::mat4                  dequantize = glm::mat4(1.f);       // packed positions to model space
 };
 
 /*
@@ -42,14 +276,157 @@ UniformBufferObject to a VkBuffer.
 */
 struct uniformbufferobject
 {
-    glm::mat4 model;
-    glm::mat4 view;
-    glm::mat4 proj;
+    glm::mat4 viewproj;  // proj * view
+    glm::mat4 views[4];  // with multiview, each eye's or viewport's proj * view, see setStereo
+};
+
+/*
+One indexed draw of the frame. The draw list is rebuilt every frame and recordDrawCommands records a
+drawIndexed for each item, so what gets drawn can change from frame to frame.
+
+An item draws `instance_count` copies of the same mesh, one per model matrix starting at
+`first_transform` in the renderer's m_draw_transforms.
+*/
+struct draw_item
+{
+    vk::Buffer    vertex_buffer;  // the positions
+    vk::Buffer    attribute_buffer;
+    vk::Buffer    index_buffer;
+    vk::IndexType index_type      = vk::IndexType::eUint32;  // the mesh's, see uploadMesh
+    uint32_t      index_count     = 0;
+    uint32_t      first_index     = 0;
+    int32_t       vertex_offset   = 0;
+    uint32_t      first_transform = 0;
+    uint32_t      instance_count  = 1;
+    uint32_t      vertex_count    = 0;  // the mesh's, 0 where they move every frame, see skinning
+    uint32_t      texture         = 0;  // slot in the bindless texture array
+    vertex_format format          = vertex_format::full;
+    vk::Pipeline  pipeline;             // the material's, see renderer::drawMesh
+    vk::Pipeline  prepass_pipeline;     // null unless the depth prepass draws it as well
+    uint32_t      subpass         = 0;  // the pipeline's, see geometry_subpass
+    uint64_t      sort_key        = 0;  // see drawSortKey in renderer.cpp
+
+    // The material's fragment size, see renderer::setShadingRate
+    vk::Extent2D shading_rate = vk::Extent2D(1, 1);
+
+    // The item's box in the renderer's m_occluders, ~0u without one, and the offset of the query
+    // result the draw is predicated on, see renderer::setOcclusionQueries
+    uint32_t occluder            = ~0u;
+    uint32_t occlusion_predicate = no_occlusion_predicate;
+
+    // The item's meshlets for every instance in m_meshlet_culls, culled instead of the
+    // instances themselves when the frame is culled on the GPU
+    uint32_t first_meshlet_cull = 0;
+    uint32_t meshlet_cull_count = 0;
+};
+
+// The surfaces there are pipelines for, all compiled when the pipelines are created
+enum class material : uint8_t
+{
+    opaque,
+    alpha_blend,
+    double_sided,  // no back face culling
+    wireframe,     // polygon edges only, the same as opaque without fillModeNonSolid
+    count,
+};
+
+// Fewer fragments shaded than there are pixels, where it doesn't show, see renderer::setShadingRate
+struct shading_rate_settings
+{
+    bool enabled = false;
+
+    // The fragment size each material is shaded at, in pixels, clamped to the ones the device
+    // has. Blended surfaces hide coarser shading best.
+    std::array<vk::Extent2D, (size_t)material::count> materials = {
+        vk::Extent2D(1, 1), vk::Extent2D(2, 2), vk::Extent2D(1, 1), vk::Extent2D(1, 1)
+    };
+
+    // Coarser still where the frame before was flat or moved quickly, see shading_rate_image
+    bool  adaptive = true;
+    float quality  = 0.5f;  // 1 shades every pixel there, 0 as coarsely as the frame allows
+};
+
+// What renderer::benchmark() renders for, and where it writes its results
+struct benchmark_settings
+{
+    uint32_t    frames        = 1000;  // measured frames, unless `seconds` is set
+    float       seconds       = 0.f;   // how long to measure for instead, if not 0
+    uint32_t    warmup_frames = 60;    // rendered before measuring, for pipelines and caches
+    std::string output        = "benchmark.json";
+};
+
+// How frames are paced against the display, which trades throughput for input latency
+struct pacing_settings
+{
+    // The first of these that the surface supports, or FIFO, which every surface does
+    std::vector<vk::PresentModeKHR> present_modes = { vk::PresentModeKHR::eMailbox,
+                                                      vk::PresentModeKHR::eImmediate };
+
+    // Up to renderer::max_frames_in_flight. More lets the CPU run further ahead of the GPU, which
+    // is the latency between sampling input and seeing its effects.
+    uint32_t frames_in_flight = 2;
+
+    // Waits for the last frame to be presented before sampling input for the next, or with
+    // VK_KHR_present_wait unavailable, for it to have rendered
+    bool low_latency = false;
+
+    // How long a frame may take on the GPU before it is taken to have hung
+    uint64_t frame_timeout_ns = 10'000'000'000;
+
+    // Frames a second that run() is held to, see core::frame_limiter, or 0 for as many as the
+    // present mode allows. While the window isn't focused it's held to background_fps instead, if
+    // that is lower and not 0, and while it's minimized nothing is drawn at all.
+    float max_fps        = 0.f;
+    float background_fps = 0.f;
+};
+
+// What renderer::renderOffscreen() renders, and where the pixels go
+struct offscreen_settings
+{
+    uint32_t           width  = 1600;
+    uint32_t           height = 1200;
+    uint32_t           frames = 1;
+    offscreen_callback deliver;  // once for every frame, in order
+
+    // Before every frame, with its number, e.g. to latch its camera. False ends the render before
+    // the frame, so that `frames` is only as many as there are at most.
+    std::function<bool(uint64_t frame)> prepare;
+};
+
+// Both eyes of a headset, rendered in a single pass, see renderer::setStereo
+struct stereo_settings
+{
+    bool  enabled        = false;
+    float eye_separation = 0.064f;  // between the eyes' centers, in scene units
+};
+
+// A window of its own that shows the scene from another camera, see renderer::addViewport
+struct viewport_settings
+{
+    std::string title           = "Viewport";
+    uint32_t    width           = 640;
+    uint32_t    height          = 480;
+    glm::vec3   camera_position = glm::vec3(4.f, 0.f, 2.f);  // until setViewportCamera()
+    glm::vec3   camera_target   = glm::vec3(0.f);
+};
+
+// A columns x rows x layers grid of cubes that renderer::setStressScene() adds, for scaling tests
+struct stress_scene_settings
+{
+    uint32_t columns  = 0;
+    uint32_t rows     = 0;
+    uint32_t layers   = 0;
+    float    spacing  = 0.3f;    // between the cubes' centers
+    float    moving   = 0.125f;  // the share of them that spins
+    uint32_t textures = 16;      // distinct checker textures, if there are bindless slots for them
 };
 
 class renderer
 {
 public:
+    static const uint32_t max_frames_in_flight = 4;
+    static const uint32_t max_viewports        = max_present_swapchains - 1;
+
     explicit renderer() {}
 
     ~renderer() {}
@@ -57,82 +434,826 @@ public:
     void run();
     void drawFrame();
 
+    // Renders the same scene with the same camera path every time, frame by frame rather than by
+    // the clock, and writes the frame time statistics and what memory was used by the end to
+    // `settings.output` as JSON
+    void benchmark(const benchmark_settings& settings);
+
+    // Renders `settings.frames` frames without a window, surface or swap chain, reading each one
+    // back to the host, e.g. on servers without a display
+    void renderOffscreen(const offscreen_settings& settings);
+
+    // GPU time of a pass ("frame", "culling", "lights", "shadows", "reflection probes",
+    // "main pass", "hi-z", "temporal", "shading rate", "upscale", "post" or "uploads") over the
+    // last few hundred frames it ran in. False until it has run at least once.
+    bool gpuTiming(const std::string& pass, gpu_timing& timing) const
+    {
+        return m_profiler.timing(pass, timing);
+    }
+
+    // What the pipeline did in a pass ("culling", "main pass" or "hi-z") in a recent frame. False
+    // without pipelineStatisticsQuery, or for a main pass recorded in parallel without
+    // inheritedQueries.
+    bool gpuStatistics(const std::string& pass, gpu_statistics& statistics) const
+    {
+        return m_profiler.statistics(pass, statistics);
+    }
+
+    // The hardware counters setHardwareCounters() picked, and the value of the one at `index` in
+    // a render graph pass in a recent frame. False for a counter that pass hasn't sampled yet.
+    const std::vector<gpu_counter>& gpuCounters() const { return m_profiler.hardwareCounters(); }
+    bool gpuCounter(const std::string& pass, uint32_t index, double& value) const
+    {
+        return m_profiler.counter(pass, index, value);
+    }
+
+    // Samples the hardware counters whose name or category contains one of `selection`, e.g.
+    // "hit rate", "alu", "bandwidth" or "occupancy", in every render graph pass, where the device
+    // has VK_KHR_performance_query. Benchmarks write them to their output. Only before run(),
+    // benchmark() or renderOffscreen().
+    void setHardwareCounters(std::vector<std::string> selection)
+    {
+        m_counter_selection = std::move(selection);
+    }
+
+    // Only before run(), benchmark() or renderOffscreen(), which size everything by the frames in
+    // flight
+    void setPacing(const pacing_settings& settings);
+
+    // Up to `samples` samples per pixel, as many as the device has for both color and depth
+    // attachments. 0 takes the most it has, 1 turns multisampling off. Only before run(),
+    // benchmark() or renderOffscreen(), see setQuality for changing it later.
+    void setMultisampling(uint32_t samples)
+    {
+        m_quality.samples           = samples;
+        m_requested_quality.samples = samples;
+        m_quality_chosen            = true;
+    }
+
+    /*
+    The anisotropy, multisampling, shadow resolution, render scale and LOD bias, see
+    quality_settings. Before run(), benchmark() or renderOffscreen() everything is created with
+    them, after setResolution, whose largest scale this overrides. While run() runs, from the main
+    thread, they're applied between frames, rebuilding only what they affect and without waiting
+    for the GPU. F4 cycles through the tiers.
+    */
+    void setQuality(const quality_settings& settings);
+    void setQualityTier(quality_tier tier);
+
+    /*
+    Starts run() with the defaults that calibrating this GPU and driver picked, which are kept in
+    `path`: the quality tier, the render scale and the streaming upload budget. When there are
+    none, because the file is missing or was written for another GPU or driver (see
+    pipeline_cache::deviceKey), or `recalibrate` is set, run() first renders the stress scene for
+    a few seconds to measure the fill rate, vertex throughput and upload bandwidth, and picks them
+    from that. Quality set with setQuality or setMultisampling beforehand wins over the calibrated
+    one. "" for neither, which is the default. Only before run().
+    */
+    void setCalibration(const std::string& path, bool recalibrate);
+
+    // Renders with a D16_UNORM depth buffer, which halves the main pass's depth bandwidth, where
+    // the device has one. The depth is reverse-Z with no far plane, whose precision only pays off
+    // in floating point, so this is for scenes that stay close to the camera. Only before run(),
+    // benchmark() or renderOffscreen().
+    void setDepth16(bool enabled) { m_depth16 = enabled; }
+
+    // Renders at a fraction of the swap chain's resolution that follows the GPU frame time, scaled
+    // up to the swap chain image, if its format can be blitted. With temporal upscaling and
+    // without `dynamic`, frames are rendered at `max_scale` throughout. Only before run(),
+    // benchmark() or renderOffscreen().
+    void setResolution(const resolution_settings& settings);
+
+    // Jitters every frame's projection within its pixels and resolves the frames into a history at
+    // the swap chain's resolution, with motion vectors from the depth buffer, see
+    // temporal_upscaler, which anti-aliases them and upscales those rendered at a fraction of it.
+    // Takes the place of multisampling, and there is none in multiview frames. The HUD is resolved
+    // along with the rest of the frame. Only before run(), benchmark() or renderOffscreen().
+    void setTemporal(const temporal_settings& settings) { m_temporal_settings = settings; }
+
+    // Turns the frame into the swap chain image with post_stack, bloom, tone mapping, grading and
+    // a vignette in compute passes, writing the image directly if the surface lets it be a
+    // storage image and blitting to it otherwise. Takes the place of the upscale pass, and there
+    // is none in multiview frames or while baking impostors. The HUD is post-processed along with
+    // the rest of the frame. Only before run(), benchmark() or renderOffscreen().
+    void setPostProcessing(const post_settings& settings) { m_post_settings = settings; }
+
+    // How the render targets and the swap chain are compressed, see image_compression. Lossless
+    // by default, as the driver does it, with nothing that would cost them their compression
+    // added only for a faster path. Fixed-rate needs VK_EXT_image_compression_control. Only
+    // before run(), benchmark() or renderOffscreen().
+    void setFramebufferCompression(framebuffer_compression mode) { m_compression_mode = mode; }
+
+    // Any thread, while running: the next frame's resolve starts the history over, e.g. once the
+    // camera cuts to somewhere else
+    void resetHistory() { m_history_reset = true; }
+
+    // Shades every draw at its material's fragment size with VK_KHR_fragment_shading_rate, and
+    // with dynamic rendering coarser still wherever the frame before was flat or moved quickly,
+    // by a shading rate image made from it, see shading_rate_image. Where the device can't
+    // combine the two, the image's rates take over from the materials'. The adaptive rates are
+    // made from the frame in the scene image, which is blitted to the target for them, and there
+    // are none in multiview frames. The HUD and debug draws are always shaded per pixel. Only
+    // before run(), benchmark() or renderOffscreen().
+    void setShadingRate(const shading_rate_settings& settings)
+    {
+        m_shading_rate_settings = settings;
+    }
+
+    // Turns the validation layers and their debug callback on or off, which by default they only
+    // are in builds without NDEBUG. Only before run(), benchmark() or renderOffscreen().
+    void setValidation(bool enabled) { m_validation = enabled; }
+
+    // Runs the steps of initialization one after the other instead of overlapping those that don't
+    // depend on each other, to compare startup times
+    void setParallelInit(bool parallel) { m_parallel_init = parallel; }
+
+    // Presents a cleared frame as soon as the swap chain exists, instead of the first drawn one
+    // once everything is loaded, and leaves out what was loaded until its uploads have finished
+    // instead of having the first frames wait on them. Only before run() or benchmark().
+    void setFastStart(bool enabled) { m_fast_start = enabled; }
+
+    // Uses the GPU with this vendor ID, name or position, see device_preference, over SHINY_DEVICE
+    // and the one that scores best. Only before run(), benchmark() or renderOffscreen().
+    void setDevice(const std::string& device);
+
+    // Renders on every GPU of the chosen one's device group, if it's linked with others, taking
+    // turns at whole frames. Only for renderOffscreen(), and only before it.
+    void setDeviceGroup(bool enabled) { m_device_group = enabled; }
+
+    // Renders a view for each eye, side by side in the target, in one pass with VK_KHR_multiview:
+    // every draw is recorded and submitted once, and the GPU runs its vertices for both eyes.
+    // Culled against a frustum holding both eyes'. Frames are drawn unlit, and there is no
+    // occlusion culling or deferred shading, since all of them work in a single view.
+    // Only before run(), benchmark() or renderOffscreen().
+    void setStereo(const stereo_settings& settings) { m_stereo_settings = settings; }
+
+    /*
+    Opens another window with a swap chain of its own, which shows the same scene from a camera
+    of its own, as an editor's viewports do, and returns its number. The viewports are views of
+    the main pass like stereo's eyes, a layer each of its attachments at the window's resolution,
+    and each is blitted to its swap chain's image, so one command buffer renders all of them and
+    one vkQueuePresentKHR presents all of them. They share everything else with the window: the
+    device, the resources, the caches and the pipelines. Neither is culled, since the viewports
+    may look anywhere, and as in stereo the frames are unlit, without occlusion culling or
+    deferred shading. Closing a viewport's window only hides it. Up to max_viewports, not along
+    with stereo, and only before run() or benchmark().
+    */
+    uint32_t addViewport(const viewport_settings& settings);
+
+    // Any thread, while running: the camera of viewport `number`, from the next frame on
+    void setViewportCamera(uint32_t number, const glm::vec3& position, const glm::vec3& target);
+
+    // The viewports that are shown, which may be fewer than were added if multiview isn't there
+    uint32_t viewportCount() const { return (uint32_t)m_viewports.size(); }
+
+    // The GPUs the device renders on, more than 1 for a device group
+    uint32_t deviceCount() const
+    {
+        return m_group_devices.empty() ? 1 : (uint32_t)m_group_devices.size();
+    }
+
+    // The optional features and extensions the device was created with, once it has been
+    const device_capabilities& capabilities() const { return m_capabilities; }
+
+    // What every memory heap's budget is and how much of it is allocated and used, by category
+    std::vector<memory_heap_report> memoryReport() const { return m_allocator.report(); }
+
+    // Draws every material additively with a constant color instead, so that how bright a pixel
+    // is shows how many fragments were shaded for it
+    void showOverdraw(bool enabled) { m_overdraw_view = enabled; }
+
+    // Draws the depth of every opaque material first, with nothing but the positions, and then
+    // shades only the fragments whose depth is the one that was drawn, so each pixel is shaded
+    // once however many surfaces cover it. Worth it where the fragment shaders are expensive and
+    // the depth complexity high, and a pass over the vertices more otherwise, which is why it can
+    // be turned on and off at any time to compare the two; the first time costs a stall while its
+    // pipelines are compiled.
+    void setDepthPrepass(bool enabled) { m_depth_prepass = enabled; }
+
+    // Queries the bounding boxes of single instances with 4096 indices or more, see renderer.cpp,
+    // at the end of the main pass, and leaves out those whose boxes were hidden: on the GPU, with
+    // VK_EXT_conditional_rendering, by the frame before's queries, or on the CPU by those it read
+    // back frames in flight later. Only frames culled on the CPU, and none in multiview or across
+    // a device group. Only before run(), benchmark() or renderOffscreen().
+    void setOcclusionQueries(bool enabled) { m_occlusion_settings = enabled; }
+
+    // Draws only what is in the cells seen from the camera's, through their portals, and what is
+    // in no cell at all, see portal_graph. What a hidden cell would cast a shadow with is left out
+    // too. Gates nothing with multiview, whose views see through the portals differently, and a
+    // render scene is drawn from its copy instead of on the GPU. Only before run(), benchmark() or
+    // renderOffscreen().
+    void setPortals(portal_graph portals) { m_portals = std::move(portals); }
+
+    // Keeps the vertices and indices of every mesh on the host after they have been uploaded, for
+    // whatever needs them besides drawing, like picking or physics. Only before run(), benchmark()
+    // or renderOffscreen().
+    void setKeepMeshData(bool keep) { m_keep_mesh_data = keep; }
+
+    // Watches the files of every shader, texture and mesh in use and reloads whichever change,
+    // see reloadChangedAssets. Only before run(), benchmark() or renderOffscreen().
+    void setHotReload(bool enabled) { m_hot_reload = enabled; }
+
+    // Streams the profiler's zones, the frame times and memory use to whoever connects to `port`,
+    // see core::telemetry_server, 0 for not listening at all. Only before run(), benchmark() or
+    // renderOffscreen().
+    void setTelemetry(uint16_t port) { m_telemetry_port = port; }
+
+    // Defragments the streamed textures' memory and compacts the geometry pool every so often, a
+    // few megabytes of copies a frame, see defragmentMemory. Only before run(), benchmark() or
+    // renderOffscreen().
+    void setDefragmentation(bool enabled) { m_defragment = enabled; }
+
+    // Draws textures that have been cooked into virtual textures (see cookVirtualTexture) as
+    // such, with only the tiles that are seen in VRAM. Needs bindless textures, BC1 and stores
+    // from fragment shaders, and is off without them. Only before run(), benchmark() or
+    // renderOffscreen().
+    void setVirtualTextures(bool enabled) { m_virtual_texturing = enabled; }
+
+    // What streamed textures, their hot reloads and virtual texture tiles may read, decode and
+    // upload in a frame between them, see stream_scheduler. Before running or while it does.
+    void setStreamingBudget(const streaming_budget& budget);
+
+    // Draws with pull.vert, which reads the vertices out of the geometry pool by gl_VertexIndex
+    // rather than through the vertex input, so the pipelines of both vertex formats are the same.
+    // Only before run(), benchmark() or renderOffscreen().
+    void setVertexPulling(bool enabled) { m_vertex_pulling = enabled; }
+
+    // On by default: the materials and the post-processing shade their colors in half precision
+    // where the device has shaderFloat16, see the _fp16 variants in shader_compiler.cpp. Positions
+    // and texture coordinates stay in single precision. Only before run(), benchmark() or
+    // renderOffscreen().
+    void setHalfPrecision(bool enabled) { m_half_precision = enabled; }
+
+    // Writes the materials' descriptors into a buffer with VK_EXT_descriptor_buffer, and binds
+    // them by offset instead of as sets, see descriptor_buffer. Off without the extension, with
+    // deferred shading, whose G-buffer is allocated a set every frame, and with device groups.
+    // Only before run(), benchmark() or renderOffscreen().
+    void setDescriptorBuffers(bool enabled) { m_descriptor_buffers = enabled; }
+
+    // Keeps the secondary command buffers the draw list is recorded into from one frame to the
+    // next, and only records a slice of it again once what it draws, a pipeline, the descriptor
+    // sets or the swap chain changed, so a static scene costs no recording at all. Only before
+    // run(), benchmark() or renderOffscreen().
+    void setCachedDraws(bool enabled) { m_cached_draws = enabled; }
+
+    // The shader permutation every material is drawn with, as pipeline_state::features bits. Only
+    // before run(), benchmark() or renderOffscreen().
+    void setShaderFeatures(uint32_t features) { m_shader_features = features; }
+
+    // Lights the scene with `count` point and spot lights circling the mesh, culled into clusters
+    // on the GPU every frame, which turns the lighting shader feature on as well. Only before
+    // run(), benchmark() or renderOffscreen().
+    void setLights(uint32_t count) { m_light_count = count; }
+
+    // Shadows the scene from a directional light with cascaded shadow maps, which turns the
+    // lighting and shadows shader features on. Only before run(), benchmark() or renderOffscreen().
+    void setShadows(bool enabled) { m_shadows = enabled; }
+
+    // Shades the scene deferred instead: the materials only write their color and normal into the
+    // G-buffer, and a second subpass of the same render pass lights every pixel once from there,
+    // however many lights and surfaces there are. The G-buffer is only ever read at the pixel
+    // being lit, so on tiled GPUs it stays in tile memory and is never written out. Blended
+    // materials are still lit forward, on top. Needs a render pass, so it goes without dynamic
+    // rendering and multisampling, and turns the lighting shader feature on. Only before run(),
+    // benchmark() or renderOffscreen().
+    void setDeferredShading(bool enabled) { m_deferred_shading = enabled; }
+
+    // Lights the deferred lights one at a time instead of by their clusters, each by a fullscreen
+    // triangle scissored to its sphere on the screen and depth bounded to its depths, so that only
+    // the pixels it may reach are shaded for it. Needs deferred shading and the depthBounds
+    // feature. Only before run(), benchmark() or renderOffscreen().
+    void setLightVolumes(bool enabled) { m_light_volumes = enabled; }
+
+    // Reflects the scene in every lit surface from cubemaps captured at the given probes, a face
+    // a frame, see reflection_probes, which turns the lighting shader feature on as well. Needs
+    // bindless textures, which the captures sample, and not with multiview or descriptor buffers.
+    // Only before run(), benchmark() or renderOffscreen().
+    void setReflectionProbes(const reflection_probe_settings& settings)
+    {
+        m_probe_settings = settings;
+    }
+
+    // Adds a fountain of up to `count` particles, emitted, simulated and drawn entirely on the
+    // GPU, on the compute queue where there is one. Only before run(), benchmark() or
+    // renderOffscreen().
+    void setParticles(uint32_t count) { m_particle_count = count; }
+
+    // Draws the terrain cooked into `path` (see cookTerrain) as a geometry clipmap around the
+    // camera, whose heights stream in as it moves, see clipmap_terrain. It casts no shadows. Not
+    // with deferred shading, whose lighting subpass has read only depth, or multiview, whose views
+    // would each want rings of their own. Only before run(), benchmark() or renderOffscreen().
+    void setTerrain(std::string path) { m_terrain_path = std::move(path); }
+
+    // Grows grass on the terrain around the camera, scattered afresh every frame by a compute
+    // shader, see vegetation_scatter. It casts no shadows. Only with a terrain, and only before
+    // run(), benchmark() or renderOffscreen().
+    void setVegetation(const vegetation_settings& settings) { m_vegetation_settings = settings; }
+
+    // Draws the instances of the scene's meshes that are less than `pixels` across on screen, as
+    // screenSize has it, as impostors out of the atlas cooked into `path` (see cookImpostors)
+    // instead, see impostor_billboards. They cast no shadows and can't be picked, and the
+    // instances the render scene keeps on the GPU stay meshes. Not with deferred shading or
+    // multiview, like the terrain. Only before run(), benchmark() or renderOffscreen().
+    void setImpostors(std::string path, float pixels)
+    {
+        m_impostor_path   = std::move(path);
+        m_impostor_pixels = pixels;
+    }
+
+    // While baking, frames draw nothing but the mesh and view given by latchImpostorView, with
+    // the camera of that view and a clear color of zero alpha, for cookImpostors. The meshes are
+    // the scene's own, so the scene options should be the same as where the atlas is drawn.
+    // Turns animation off. Only before renderOffscreen().
+    void setImpostorBaking(bool enabled)
+    {
+        m_impostor_baking = enabled;
+        m_animating       = m_animating && !enabled;
+    }
+
+    // Once initialized: the meshes impostors are drawn for, in the order of the atlas's layers
+    uint32_t impostorMeshes() const { return (uint32_t)m_impostor_subjects.size(); }
+    void     latchImpostorView(uint32_t mesh, uint32_t view)
+    {
+        m_impostor_mesh = mesh;
+        m_impostor_view = view;
+    }
+
+    // Adds `count` animated instances of a skinned test mesh around the scene, each looping a blend
+    // of two compressed clips with an offset. Their poses are sampled on the job scheduler, less
+    // often the further they are, and the meshes skinned on the GPU. Only before run(),
+    // benchmark() or renderOffscreen().
+    void setSkinnedInstances(uint32_t count) { m_skinned_count = count; }
+
+    // Adds `count` entities of the test mesh below the scene, some of them spinning, as
+    // components of an entity_world that the simulation updates on the job scheduler. Only
+    // before run(), benchmark() or renderOffscreen().
+    void setEntities(uint32_t count) { m_entity_count = count; }
+
+    // Adds a procedural grid of cubes below the scene, entities like those of setEntities with
+    // textures picked at random from a set of generated ones and a share of them spinning. The
+    // camera path and the test lights are spread out to cover it. Same seed every run, so
+    // measurements compare. Only before run(), benchmark() or renderOffscreen().
+    void setStressScene(const stress_scene_settings& settings) { m_stress = settings; }
+
+    // Writes every frame packet that simulate() makes to `path`, see capture_writer: the clock,
+    // the camera, the draws, the scene changes and the lights, with the textures by the paths
+    // they were loaded from as of the frame they are first drawn in. Only before run(),
+    // benchmark() or renderOffscreen().
+    void setCapture(const std::string& path) { m_capture_path = path; }
+
+    // Draws the frames captured in `path` instead of simulating any, so runs with different builds
+    // or settings draw exactly the same frames. The renderer has to be set up like it was for the
+    // capture, with the same model, entities and stress scene, for the meshes to be there;
+    // textures that weren't loaded yet are loaded when the frames first draw them. benchmark()
+    // and renderOffscreen() stop after the last frame, run() keeps drawing it.
+    void setReplay(const std::string& path) { m_replay_path = path; }
+
+    /*
+    Adds the entities of the scene cooked into `path` (see scene_file and saveScene) on top of
+    whatever the other scene options add, straight out of the mapped file, a chunk at a time. Its
+    meshes are ones the renderer makes itself, by name like in captures, and the test mesh stands
+    in for the ones that aren't there, but for the stress scene's cube, which is made for it.
+    Textures are loaded by their paths, or generated again for the stress scene's. The camera path
+    and the test lights are spread out to cover it. Only before run(), benchmark() or
+    renderOffscreen().
+    */
+    void setScene(const std::string& path) { m_scene_path = path; }
+
+    // Once initialized: writes every entity with a mesh to `path`, as a scene file for setScene.
+    // False if it can't be written.
+    bool saveScene(const std::string& path);
+
+    // Lets frames be copied out of the swap chain images for requestScreenshot(), which they have
+    // to be transfer sources for, and saves one to "screenshot N.png" when F12 goes down. Only
+    // before run(), benchmark() or renderOffscreen().
+    void setScreenshots(bool enabled) { m_screenshots = enabled; }
+
+    // Any thread, while running. `deliver` gets the next frame that is recorded once its fence has
+    // signalled, on the render thread, see frame_readback. False if screenshots are off.
+    bool requestScreenshot(offscreen_callback deliver);
+
+    // The next frame that is recorded, written to `path` by a job, as whatever FreeImage takes its
+    // extension to mean. False if screenshots are off.
+    bool saveScreenshot(const std::string& path);
+
+    // Records every frame into `settings.sink`, see video_capture, converted to NV12 where the
+    // swap chain images can be sampled and copied as they are where they can only be copied from.
+    // Only before run(), benchmark() or renderOffscreen().
+    void setVideoCapture(const video_settings& settings) { m_video_settings = settings; }
+
+    // Lets requestPick() find the entity under a position, see object_picker, and logs the one
+    // under the cursor whenever the left mouse button goes down. Only before run(), benchmark() or
+    // renderOffscreen().
+    void setPicking(bool enabled) { m_picking = enabled; }
+
+    // Any thread, while running. `deliver` gets the index of the entity drawn nearest to (x, y), in
+    // pixels of the presented image, in the next frame that is recorded, once its fence has
+    // signalled, on the render thread. False if picking is off.
+    bool requestPick(uint32_t x, uint32_t y, pick_callback deliver);
+
+    // Any thread, while running. Frames look from `position` at `target` instead of where the
+    // simulation puts the camera, until releaseCamera(). The render thread reads it as late as it
+    // can, once the frame's fence and swap chain image have been waited for, so input that moves
+    // the camera skips the frame that is queued up in the packet with a render thread. Captures
+    // record it, while benchmarks and replays ignore it, so they draw the same frames every time.
+    void latchCamera(const glm::vec3& position, const glm::vec3& target);
+    void releaseCamera();
+
+    // Whether anything is still being uploaded, streamed in or compiled, on the render thread
+    // between frames, e.g. from renderOffscreen's prepare
+    bool loading();
+
+    // Keeps the entities in a render_scene on the GPU instead, which simulate() only sends what
+    // changed and the culling shader expands into draws, so a still scene costs the CPU nothing
+    // per entity. Frames that aren't culled on the GPU, or have shadows, draw them on the CPU
+    // from a copy. Only before run(), benchmark() or renderOffscreen().
+    void setRenderScene(bool enabled) { m_render_scene_enabled = enabled; }
+
+    // Draws the bounds of every instance in the draw list and the range of every light over the
+    // scene, in lines that aren't lit or culled. Only before run(), benchmark() or
+    // renderOffscreen().
+    void setDebugDraw(bool enabled) { m_debug_draw = enabled; }
+
+    // Shows the performance overlay of perf_overlay in the top left, over everything else, which
+    // F3 hides and shows again while running. Only before run(), benchmark() or renderOffscreen().
+    void setHud(bool enabled) { m_hud = enabled; }
+
+    // Simulates every frame on the main thread while a render thread of its own records and
+    // submits the one before, from a frame packet. Only run() does, benchmark() and
+    // renderOffscreen() simulate and draw every frame in turn. Only before run().
+    void setRenderThread(bool enabled) { m_render_thread = enabled; }
+
+    // Presents from a thread of its own, see present_thread, so a driver that blocks in
+    // vkQueuePresentKHR until the next vertical blank doesn't hold up recording the next frame.
+    // The image is still acquired while the frame is recorded. Only run() does, only before it.
+    void setPresentThread(bool enabled) { m_present_thread = enabled; }
+
+    // For tools: only draws a frame when there is something new to show, i.e. the window got
+    // input, requestRedraw() was called or something finished loading or streaming in, and sleeps
+    // in glfwWaitEvents() in between, so a still window takes next to no CPU or GPU time. The
+    // animation starts out paused, and Space pauses and resumes it; while it runs, every frame is
+    // drawn like without. Only before run().
+    void setOnDemand(bool enabled)
+    {
+        m_on_demand = enabled;
+        m_animating = !enabled;
+    }
+
+    // Any thread, while running. Wakes the main thread, which draws a frame on demand right away.
+    void requestRedraw();
+
+    // The driver's host allocations come from the pools and arenas of host_allocator.h, rather
+    // than its own heap. Off leaves them to the driver, only before anything is run.
+    void setHostAllocator(bool enabled) { m_host_allocator = enabled; }
+
+    // Counts every heap allocation, the driver's through allocation callbacks included, a frame
+    // for the overlay and the benchmark results and per profile zone for a summary at the end
+    void setAllocationTracking(bool enabled) { m_allocation_tracking = enabled; }
+
+    // Tracks allocations, and fails drawFrame() on the frame after any allocation on its thread
+    // once allocation_warmup_frames have been drawn, since steady frames mustn't allocate at all
+    void setAllocationChecks(bool enabled)
+    {
+        m_allocation_checks   = enabled;
+        m_allocation_tracking = m_allocation_tracking || enabled;
+    }
+
 private:
+    // A mesh the simulation wants drawn, with its texture, and the index of the entity it's for,
+    // which is what picking it hands back
+    struct draw_request
+    {
+        const Mesh*                                      mesh = nullptr;
+        resource_cache<texture_streamer::handle>::handle texture;
+        glm::mat4                                        transform = glm::mat4(1.f);
+        uint32_t                                         object    = pick_none;
+    };
+
+    // A render scene slot's new draw, or that it has none any more, see setRenderScene
+    struct scene_change
+    {
+        uint32_t     slot = 0;
+        draw_request draw;
+        bool         live = false;
+    };
+
+    /*
+    Everything simulate() decided about a frame, which is all drawFrame() knows of it: the clock,
+    the camera, what is drawn where and the lights. Packets are reused, so their lists keep their
+    capacity from frame to frame.
+    */
+    struct frame_packet
+    {
+        float                     time            = 0.f;  // seconds, what the scene is animated by
+        glm::vec3                 camera_position = glm::vec3(0.f);
+        glm::vec3                 camera_target   = glm::vec3(0.f);
+        std::vector<draw_request> draws;
+        std::vector<scene_change> scene_changes;  // since the packet before
+        std::vector<light>        lights;
+        bool                      hud = false;  // shown, see toggleHud
+        quality_settings          quality;      // see setQuality
+    };
+
     void initWindow();
     void initVulkan();
     void mainLoop();
+    void renderLoop();
+    void startPresenting();
+    void simulate(frame_packet& packet);
+    void drawFrame(const frame_packet& packet);
+    void benchmarkLoop(const benchmark_settings& settings);
+    void waitForLatency();
+    void limitFrameRate();
+    bool waitWhileMinimized();
+    void waitForEvents();
+    void settle();
+    bool waitForFrame(uint64_t frame);  // false if it didn't finish in time
     void cleanup();
 
     void createInstance();
     void setupDebugCallback();
     void createSurface();
+    void buildShaders();
     void pickPhysicalDevice();
     void createLogicalDevice();
     void createSwapChain();
     void createImageViews();
     void createRenderPass();
+    void createDeferredRenderPass();
     void createGraphicsPipeline();
+    void updateMaterialPipelines();
     void createFramebuffers();
     void createCommandPool();
     void createCommandBuffers();
+    void recordDrawCommands(vk::CommandBuffer command_buffer,
+                            uint32_t          imageindex,
+                            uint32_t          uniformoffset);
+    void recordCulling(vk::CommandBuffer command_buffer);
+    void recordLightCulling(vk::CommandBuffer command_buffer);
+    void recordShadows(vk::CommandBuffer command_buffer);
+    void recordAccelerationStructures(vk::CommandBuffer command_buffer);
+    void recordReflectionProbes(vk::CommandBuffer command_buffer);
+    void recordMainPass(vk::CommandBuffer command_buffer);
+    void beginRendering(vk::CommandBuffer command_buffer, bool secondaries);
+    void endRendering(vk::CommandBuffer command_buffer);
+    void recordTemporal(vk::CommandBuffer command_buffer);
+    void recordShadingRates(vk::CommandBuffer command_buffer);
+    void recordUpscale(vk::CommandBuffer command_buffer);
+    void recordPost(vk::CommandBuffer command_buffer);
+    void recordLighting(vk::CommandBuffer command_buffer, uint32_t uniformoffset);
+    void recordParticles(vk::CommandBuffer command_buffer);
+    void recordLateDraws(vk::CommandBuffer command_buffer) const;
+
+    // The fragment size of the draws after it, and whether the rate image may coarsen it
+    void setDrawShadingRate(vk::CommandBuffer command_buffer,
+                            vk::Extent2D      rate,
+                            bool              adaptive) const;
+
+    // Draws until endPredicatedDraw only where the query result at `offset` isn't 0
+    void beginPredicatedDraw(vk::CommandBuffer command_buffer, uint32_t offset) const;
+    void endPredicatedDraw(vk::CommandBuffer command_buffer) const;
+
+    void recordSkinning(vk::CommandBuffer command_buffer);
+    void recordDraws(vk::CommandBuffer command_buffer,
+                     uint32_t          uniformoffset,
+                     uint32_t          first,
+                     uint32_t          count,
+                     bool              prepass = false,
+                     uint32_t          subpass = geometry_subpass) const;
+    void recordParallelDraws(vk::CommandBuffer primary,
+                             uint32_t          imageindex,
+                             uint32_t          uniformoffset);
+    uint64_t drawSliceSignature(uint32_t uniformoffset,
+                                uint32_t first,
+                                uint32_t count,
+                                bool     prepass) const;
+    void     invalidateCachedDraws();
     void createSemaphores();
     void createFences();
+    void presentSplashFrame();
+    void reportFirstFrame(const char* what);
+    void reportStartup();
 
-    void createVertexBuffer();
-    void createIndexBuffer();
+    void createGeometryPool(const std::vector<uint32_t>& queue_families);
+    std::vector<uint32_t> cullingFamilies();
+    void                  submitAsyncCompute();
+    void uploadMesh(upload_batch& uploads, Mesh& mesh);
+    void createSkinnedInstances(upload_batch& uploads);
+    void createEntities();
+    void createStressScene(upload_batch& uploads);
+    void loadScene(upload_batch& uploads);
+    void createImpostors(upload_batch& uploads);
+    void updateEntities(uint32_t steps);
+    void extractEntities(frame_packet& packet, float alpha);
+    void extractSceneChanges(frame_packet& packet, float alpha);
+    void applySceneChanges(const frame_packet& packet);
+    uint32_t sceneBatch(const Mesh& mesh);
+    void     addSceneBatches();
+    void     drawSceneDraws();
+    void updateSkinning();
+    void createHud();
+    void createHudAtlas(upload_batch& uploads);
+    void updateHud(const frame_packet& packet);
+    void publishTelemetry();
+    bool latchedCamera(glm::vec3& position, glm::vec3& target);  // false if there is none
+    void toggleHud();
+    void animationKey();
+    void screenshotKey();
+    void qualityKey();
+    void pickButton();
+    void trackAllocations();
+    void reportAllocations();
     void createUniformBuffer();
+    void createDrawBuffer();
 
-    void updateUniformBuffer();
+    // Returns the dynamic offset of this frame's uniforms
+    uint32_t updateUniformBuffer(const frame_packet& packet);
+    void     stereoViews(float fovy, float aspect, glm::mat4 (&views)[4]);
+    void     viewportViews(float fovy, glm::mat4 (&views)[4]);
+    void     updateLights(const frame_packet& packet);
+    bool     lightingEnabled() const;
+    bool     shadowsEnabled() const;
+    bool     rayQueryShadows() const { return m_ray_query && m_quality.ray_query_shadows; }
+    bool     lateDraws() const;
+    uint32_t viewCount() const { return m_stereo ? 2 : 1 + (uint32_t)m_viewports.size(); }
+    bool     multiview() const { return viewCount() > 1; }
+    uint32_t viewMask() const { return multiview() ? (1u << viewCount()) - 1 : 0; }
+    bool     sampledDepth() const { return m_occlusion_culling || m_temporal_aa; }
+    void     buildDrawList(const frame_packet& packet);
+    void     drawImpostorSubject();
+    void     collectShadowCasters();
+    void     collectRayInstances();
+    void     collectProbeDraws();
+    void     collectPickCandidates(bool scene);
+    void     cullDrawList();
+    void     queryOcclusion();
+    void     sortDrawList();
+    void     writeDrawBuffer();
+
+    // Adds `count` instances of the mesh to the draw list, one per transform. Every instance picks
+    // its own level of detail, and the instances of every level make up one draw.
+    void drawMesh(const Mesh&      mesh,
+                  uint32_t         texture,
+                  const glm::mat4* transforms,
+                  uint32_t         count,
+                  material         surface = material::opaque);
+    void drawMesh(const Mesh&      mesh,
+                  uint32_t         texture,
+                  const glm::mat4& transform,
+                  material         surface = material::opaque)
+    {
+        drawMesh(mesh, texture, &transform, 1, surface);
+    }
+
+    void addDrawItem(const Mesh&      mesh,
+                     const mesh_lod&  lod,
+                     uint32_t         texture,
+                     const glm::mat4* transforms,
+                     uint32_t         count,
+                     material         surface);
+    void addMeshletCulls(const Mesh&      mesh,
+                         const mesh_lod&  lod,
+                         draw_item&       item,
+                         const glm::mat4* transforms,
+                         bool             backfaces);
+
+    // Roughly how many pixels across the mesh is on screen, for picking texture resolutions and
+    // levels of detail
+    float    screenSize(const Mesh& mesh, const glm::mat4& transform) const;
+    uint32_t selectLod(const Mesh& mesh, const submesh& part, const glm::mat4& transform) const;
     void createDescriptorPool();
     void createDescriptorSet();
+    void writeDescriptorSet(uint32_t frame);
+    void updateTextureDescriptor(uint32_t frame);
 
-    void createTextureImage();
-    void createTextureImageView();
+    // With the texture already read, unless `preloaded` is null
+    void createTextureImage(upload_batch& uploads, texture_data* preloaded);
     void createTextureSampler();
 
-    void createDepthResources();
+    // Everything loaded from a file goes through the resource caches, so files that are used more
+    // than once are still only loaded and uploaded once
+    using texture_handle = resource_cache<texture_streamer::handle>::handle;
+    using mesh_handle    = resource_cache<Mesh>::handle;
+
+    texture_handle acquireTexture(upload_batch&      uploads,
+                                  const std::string& path,
+                                  texture_data*      preloaded = nullptr);
+    // Reads the texture on the I/O queue rather than here, see texture_streamer::addAsync
+    texture_handle acquireTextureAsync(const std::string& path);
+    mesh_handle    acquireMesh(upload_batch& uploads, const std::string& path);
+    void           releaseTexture(texture_handle texture);
+    void           releaseMesh(mesh_handle mesh);
+
+    // What the bindless fragment shader indexes with for a streamed or virtual texture's slot,
+    // which for packed textures is their array and layer, see texture_streamer::shaderIndex
+    uint32_t bindlessIndex(uint32_t texture) const;
+    void           retireMesh(Mesh& mesh);
+    void           forgetRayGeometry(const geometry_range& range);
+
+    // Hot reloading, with the paths the resources were acquired with
+    void watchAsset(const std::string& path);
+    void reloadChangedAssets();
+    void swapReloadedMeshes();
+
+    // Frame packets to and from a capture, see setCapture and setReplay
+    void        openCaptures();
+    void        captureFrame(const frame_packet& packet);
+    bool        replayFrame(frame_packet& packet);
+    uint32_t    captureMesh(const Mesh* mesh);
+    uint32_t    captureTexture(texture_handle texture);
+    std::string meshName(const Mesh* mesh) const;
+    const Mesh* namedMesh(const std::string& name) const;
+
+    void           defragmentMemory();
+    vk::DeviceSize compactGeometry(upload_batch& uploads, vk::DeviceSize budget);
+
+    void createRenderGraph();
 
     void createDescriptorSetLayout();
 
     // Load functions
     // Implementing some specific ones for now
-    void loadModels();  // Might eventually want to change this to accept a vector of strings
-                        // to load more than one file. This will be called from elsewhere.
-    Mesh loadObj(std::string objpath) const;
-
-    // helper functions
-    std::pair<vk::Buffer, vk::DeviceMemory> createBuffer(vk::DeviceSize          size,
-                                                         vk::BufferUsageFlags    usage,
-                                                         vk::MemoryPropertyFlags properties) const;
-    void copyBuffer(vk::Buffer srcbuffer, vk::Buffer* dstbuffer, vk::DeviceSize size) const;
-
-    std::pair<vk::Image, vk::DeviceMemory> createImage(uint32_t                width,
-                                                       uint32_t                height,
-                                                       vk::Format              format,
-                                                       vk::ImageTiling         tiling,
-                                                       vk::ImageUsageFlags     usage,
-                                                       vk::MemoryPropertyFlags properties) const;
-
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) const;
-
-    void transitionImageLayout(vk::Image       image,
+    void loadModels(upload_batch& uploads);  // Might eventually want to change this to accept a
+                                             // vector of strings to load more than one file. This
+                                             // will be called from elsewhere.
+    Mesh loadObj(std::string objpath);
+
+    /*
+    Threads. Everything here is the render thread's unless it says otherwise, with these
+    exceptions for loading on workers:
+
+     - createBuffer, createImage, createImageView and their destroy functions can be called from
+       any thread, since the memory allocator takes a lock and the Vulkan calls need none. Only
+       destroying something the GPU may still use has to wait for the deletion queue, which is
+       the render thread's.
+     - Staging memory is allocated on the render thread, see staging_arena, but can be written
+       anywhere. An upload_batch only collects commands and can be recorded on any thread, but
+       it has to be submitted on the render thread, since that's the only one recording into the
+       upload service's command pools. A worker gets there without blocking by co_awaiting the
+       service's next(), see jobs::task and texture_loader::loadAsync.
+     - A descriptor allocator belongs to one thread, see descriptor_allocator.
+     - The job scheduler, the I/O queue, the stream scheduler's reads and decodes,
+       requestRedraw(), and texture_loader::read, readAsync and create can be used from anywhere.
+    */
+    std::pair<vk::Buffer, allocation> createBuffer(vk::DeviceSize          size,
+                                                   vk::BufferUsageFlags    usage,
+                                                   vk::MemoryPropertyFlags properties,
+                                                   memory_category         category);
+    void                              destroyBuffer(vk::Buffer& buffer, allocation& memory);
+    staging_region                    stage(upload_batch&  uploads,
+                                            const void*    data,
+                                            vk::DeviceSize size,
+                                            vk::DeviceSize alignment = 16);
+    void                              copyBuffer(upload_batch&          uploads,
+                                                 const staging_region&  src,
+                                                 vk::Buffer             dstbuffer,
+                                                 vk::AccessFlags        dstaccess,
+                                                 vk::PipelineStageFlags dststage);
+
+    std::pair<vk::Image, allocation> createImage(uint32_t                width,
+                                                 uint32_t                height,
+                                                 uint32_t                miplevels,
+                                                 vk::Format              format,
+                                                 vk::ImageTiling         tiling,
+                                                 vk::ImageUsageFlags     usage,
+                                                 vk::MemoryPropertyFlags properties,
+                                                 memory_category         category);
+    void                             destroyImage(vk::Image& image, allocation& memory);
+
+    void copyBufferToImage(upload_batch&         uploads,
+                           const staging_region& src,
+                           vk::Image             image,
+                           uint32_t              width,
+                           uint32_t              height,
+                           uint32_t              miplevel);
+
+    void transitionImageLayout(upload_batch&   uploads,
+                               vk::Image       image,
                                vk::Format      format,
                                vk::ImageLayout oldLayout,
-                               vk::ImageLayout newLayout) const;
+                               vk::ImageLayout newLayout,
+                               uint32_t        miplevels);
 
     vk::ImageView createImageView(vk::Image               image,
                                   vk::Format              format,
-                                  vk::ImageAspectFlagBits aspectflags) const;
+                                  vk::ImageAspectFlagBits aspectflags,
+                                  uint32_t                miplevels,
+                                  uint32_t                layers = 1);
 
     /* Find Format Helper Functions: Put them here due to their need for device reference */
     vk::Format findSupportedFormat(const std::vector<vk::Format>& candidates,
                                    vk::ImageTiling                tiling,
-                                   vk::FormatFeatureFlagBits      features) const;
+                                   vk::FormatFeatureFlags         features) const;
     vk::Format findDepthFormat() const
     {
-        return findSupportedFormat(
-          { vk::Format::eD32Sfloat, vk::Format::eD32SfloatS8Uint, vk::Format::eD24UnormS8Uint },
-          vk::ImageTiling::eOptimal, vk::FormatFeatureFlagBits::eDepthStencilAttachment);
+        std::vector<vk::Format> candidates = { vk::Format::eD32Sfloat,
+                                               vk::Format::eD32SfloatS8Uint,
+                                               vk::Format::eD24UnormS8Uint };
+        if (m_depth16) {
+            candidates.insert(candidates.begin(), vk::Format::eD16Unorm);
+        }
+        return findSupportedFormat(candidates, vk::ImageTiling::eOptimal,
+                                   vk::FormatFeatureFlagBits::eDepthStencilAttachment);
     }
 
     bool hasStencilComponent(vk::Format format) const
@@ -140,39 +1261,112 @@ private:
         return format == vk::Format::eD32SfloatS8Uint || format == vk::Format::eD24UnormS8Uint;
     }
 
-    /* Template function for use within unique SingleTimeCommand functions.
-     * It acts as a wrapper for BeginSingleTimeCommand and EndSingleTimeCommand. */
-    template<typename Func>
-    void executeSingleTimeCommands(Func func) const;
+    // Whether images of the format can be blitted to and from with linear filtering
+    bool supportsScaling(vk::Format format) const
+    {
+        const vk::FormatFeatureFlags needed =
+          vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst
+          | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+        return (m_physical_device.getFormatProperties(format).optimalTilingFeatures & needed)
+               == needed;
+    }
 
     /*
-    This function requires a closure with a signature of void(void*)
+    This function requires a closure with a signature of void(void*). Host visible allocations are
+    persistently mapped by the memory allocator, so this no longer maps and unmaps anything.
     */
     template<typename Func>
-    void withMappedMemory(vk::DeviceMemory memory,
-                          vk::DeviceSize   offset,
-                          vk::DeviceSize   size,
-                          Func             action)
+    void withMappedMemory(const allocation& memory,
+                          vk::DeviceSize    offset,
+                          vk::DeviceSize    size,
+                          Func              action)
     {
-        void* data = m_device.mapMemory(memory, offset, size);
-        action(data);
-        m_device.unmapMemory(memory);
+        (void)size;
+        assert(memory.mapped && "withMappedMemory requires host visible memory!");
+        action(static_cast<char*>(memory.mapped) + offset);
     }
 
     void recreateSwapChain();
+    void retireRenderTargets(uint64_t frame);
+    void resizeRendering();
+    void applyQuality(const quality_settings& quality);
+
+    // See setCalibration
+    void   loadCalibration();
+    void   applyCalibration(const calibration_result& result);
+    void   calibrate();
+    bool   measureCalibrationFrames(float& frame_ms, float& pass_ms, gpu_statistics& statistics);
+    double measureUploads();
+    void   removeCalibrationScene();
     void cleanupSwapChain();
 
+    // See addViewport and m_viewports
+    struct viewport;
+    void createViewports();
+    void createViewportSwapChain(viewport& v);
+    void acquireViewports();
+    void closeViewports();
+    void destroyViewports();
+
     GLFWwindow* m_window = nullptr;
 
+    // Runs for as long as the renderer does; used for loading and recording
+    jobs::scheduler m_jobs;
+    bool            m_parallel_init = true;  // see initVulkan
+    bool            m_fast_start    = false;  // see presentSplashFrame
+    bool            m_splash_frame  = false;  // the swap chain images can be cleared for it
+    bool            m_first_frame   = false;  // time to first frame was printed
+    int64_t         m_start_time    = 0;      // profileNow() when run() or benchmark() started
+
+    // The steps up to the first frame, and the assets they load, see reportStartup
+    core::startup_report m_startup;
+
     // can't use UniqueDebugReportCallbackEXT because of
     // https://github.com/KhronosGroup/Vulkan-Hpp/issues/212
 
     vk::Instance               m_instance;
+    uint32_t                   m_instance_version = VK_API_VERSION_1_0;  // see createInstance
     vk::DebugReportCallbackEXT m_callback;
+    debug_labels               m_labels;
+
+    // The validation layers, unless setValidation() says otherwise
+#ifdef NDEBUG
+    bool m_validation = false;
+#else
+    bool m_validation = true;
+#endif
     vk::SurfaceKHR             m_surface;
     vk::PhysicalDevice         m_physical_device;
+    device_preference          m_device_preference;  // empty for SHINY_DEVICE
     vk::Device                 m_device;
 
+    // With setDeviceGroup(), the GPUs of the group, in the order of their device index. Empty
+    // without, or when there is only the one.
+    bool                            m_device_group = false;
+    std::vector<vk::PhysicalDevice> m_group_devices;
+
+    // What the physical device supports, and of that what the device was created with
+    device_capabilities m_supported;
+    device_capabilities m_capabilities;
+
+    // Every buffer and image is sub-allocated from large device memory blocks owned by the allocator
+    memory_allocator m_allocator;
+
+    // All uploads get their staging memory from here, and are batched and submitted by m_uploads
+    staging_arena  m_staging;
+    upload_service m_uploads;
+
+    // Builds the uploaded textures' mip levels for m_uploads, if the graphics queue does compute
+    mip_downsampler m_downsampler;
+
+    // For the render graph's images, the swap chain and whatever else asks, see
+    // setFramebufferCompression
+    image_compression       m_compression;
+    framebuffer_compression m_compression_mode = framebuffer_compression::lossless;
+
+    // Whatever a frame in flight might still be using goes here instead of being destroyed
+    deletion_queue m_deletion_queue;
+
     // swapchain things
     // TODO: Find a way to turn this back into a UniqueSwapchainKHR
     vk::SwapchainKHR             m_swapchain;
@@ -180,90 +1374,646 @@ private:
     std::vector<vk::ImageView>   m_swapchain_image_views;
     vk::Format                   m_swapchain_image_format;
     vk::Extent2D                 m_swapchain_extent;
-    std::vector<vk::Framebuffer> m_swapchain_framebuffers;
+    std::vector<vk::Framebuffer> m_swapchain_framebuffers;  // none with dynamic rendering
+
+    // The main pass begins rendering into the image views themselves, see beginRendering
+    bool m_dynamic_rendering = false;
+#if defined(VK_KHR_dynamic_rendering)
+    PFN_vkCmdBeginRenderingKHR m_begin_rendering = nullptr;
+    PFN_vkCmdEndRenderingKHR   m_end_rendering   = nullptr;
+#endif
+
+    // Every mesh's vertices and indices, so all draws share one vertex and index buffer binding
+    geometry_pool    m_geometry;
+
+    // One region per frame in flight, bound with a dynamic offset
+    uniform_ring     m_uniforms;
+
+    // The draw list's parameters and transforms, rewritten every frame by writeDrawBuffer
+    draw_buffer      m_draws;
+    bool             m_indirect_draws = false;  // multiDrawIndirect and drawIndirectFirstInstance
+    bool             m_wireframe      = false;  // fillModeNonSolid
+#if defined(VK_KHR_draw_indirect_count)
+    PFN_vkCmdDrawIndexedIndirectCountKHR m_draw_indexed_indirect_count = nullptr;
+#endif
+
+    // Culls the draw list on the GPU when it's a single run of draws and the device can take the
+    // draw count from a buffer, see buildDrawList
+    gpu_culling m_culling;
+    bool        m_gpu_culling = false;  // supported
+    bool        m_gpu_culled  = false;  // this frame
+
+    // GPU culling also culls against the depth the previous frame ended up with, when the depth
+    // format can be sampled. The pyramid is rebuilt after every frame's render pass.
+    hiz_pyramid m_hiz;
+    bool        m_occlusion_culling = false;
+
+    // The cells and portals, traversed by buildDrawList every frame it gates drawMesh with them
+    portal_graph           m_portals;
+    std::vector<glm::mat4> m_portal_transforms;  // drawMesh's, of the instances in view
+    bool                   m_portals_active = false;
+
+    // The boxes of the draw items whose occlusion is queried, pushed by addDrawItem. Keyed by the
+    // mesh and its transform, so a box is only matched with ones where the same mesh was.
+    struct occluder
+    {
+        uint64_t  key = 0;
+        glm::mat4 box;     // the unit cube to world space
+        glm::vec3 center;  // of its bounding sphere
+        float     radius = 0.f;
+    };
+
+    // Occlusion queries on CPU culled frames, see setOcclusionQueries
+    occlusion_queries     m_occlusion;
+    std::vector<occluder> m_occluders;
+    pipeline_state        m_occlusion_state;
+    vk::Pipeline          m_occlusion_pipeline;
+    bool                  m_occlusion_settings    = false;
+    bool                  m_occlusion_queries     = false;  // enabled and supported
+    bool                  m_conditional_rendering = false;  // skipping draws on the GPU
+#if defined(VK_EXT_conditional_rendering)
+    PFN_vkCmdBeginConditionalRenderingEXT m_begin_conditional_rendering = nullptr;
+    PFN_vkCmdEndConditionalRenderingEXT   m_end_conditional_rendering   = nullptr;
+#endif
+
+    // The lights of the frame and the clusters they're binned into, only with lightingEnabled()
+    light_culling m_lighting;
+    uint32_t      m_light_count = 0;  // see setLights
 
-    vk::Buffer       m_vertex_buffer;
-    vk::DeviceMemory m_vertex_buffer_memory;
+    // Only with a particle count, see setParticles. Drawn after everything else of the main pass,
+    // in a secondary command buffer of each frame's own when the draws are in secondaries too.
+    particle_system                m_particles;
+    uint32_t                       m_particle_count = 0;
+    pipeline_state                 m_particle_state;
+    vk::Pipeline                   m_particle_pipeline;
 
-    vk::Buffer       m_index_buffer;
-    vk::DeviceMemory m_index_buffer_memory;
+    // Only with setTerrain. Drawn first of what comes after the materials, so the occlusion
+    // queries' boxes are tested against it too.
+    clipmap_terrain m_terrain;
+    std::string     m_terrain_path;
+    bool            m_terrain_active = false;  // set and supported
+    pipeline_state  m_terrain_state;
+    vk::Pipeline    m_terrain_pipeline;
 
-    vk::Buffer       m_uniform_buffer;
-    vk::DeviceMemory m_uniform_buffer_memory;
+    // Only with setVegetation and the terrain, scattered after the terrain's heights are updated
+    // and drawn after the terrain
+    vegetation_scatter  m_vegetation;
+    vegetation_settings m_vegetation_settings;
+    bool                m_vegetation_active = false;
+    pipeline_state      m_vegetation_state;
+    vk::Pipeline        m_vegetation_pipeline;
 
-    vk::Image        m_texture_image;
-    vk::ImageView    m_texture_image_view;
-    vk::DeviceMemory m_texture_image_memory;
-    vk::Sampler      m_texture_sampler;
+    // Only with setImpostors, drawn after the terrain. A subject is a mesh of the scene with the
+    // texture slot it is drawn with, which has the layer of its index in the atlas.
+    struct impostor_subject
+    {
+        const Mesh* mesh    = nullptr;
+        uint32_t    texture = 0;
+    };
+
+    impostor_billboards           m_impostors;
+    std::string                   m_impostor_path;
+    float                         m_impostor_pixels  = 0.f;
+    bool                          m_impostors_active = false;  // set and not baking
+    pipeline_state                m_impostor_state;
+    vk::Pipeline                  m_impostor_pipeline;
+    std::vector<impostor_subject> m_impostor_subjects;
+    std::vector<glm::mat4>        m_impostor_kept;  // drawMesh's, of the instances left meshes
+    bool                          m_impostor_baking = false;  // see setImpostorBaking
+    uint32_t                      m_impostor_mesh   = 0;
+    uint32_t                      m_impostor_view   = 0;
+
+    // Only with setDebugDraw. Drawn after the particles, in the same secondary command buffers.
+    debug_draw                     m_debug;
+    bool                           m_debug_draw = false;
+    pipeline_state                 m_debug_line_state;
+    pipeline_state                 m_debug_triangle_state;
+    vk::Pipeline                   m_debug_line_pipeline;
+    vk::Pipeline                   m_debug_triangle_pipeline;
+    std::vector<vk::CommandBuffer> m_late_command_buffers;  // from m_command_pools
+
+    // Only with setHud. Drawn last of the late draws, in render resolution pixels.
+    sprite_batch   m_hud_sprites;
+    sprite_atlas   m_hud_atlas;
+    perf_overlay   m_overlay;
+    bool           m_hud         = false;
+    bool           m_hud_visible = true;  // see toggleHud
+    bool           m_hud_key     = false;
+    uint32_t       m_hud_texture = 0;  // of m_hud_atlas, from m_hud_sprites.addTexture
+    pipeline_state m_hud_state;
+    vk::Pipeline   m_hud_pipeline;
+
+    // Only with skinned instances, see setSkinnedInstances. They all share the test mesh's bind
+    // pose, skeleton and clips, but each has a copy of the mesh of its own in the geometry pool,
+    // which the skinning writes the positions of, and a character of m_animator.
+    gpu_skinning           m_skinning;
+    uint32_t               m_skinned_count = 0;
+    skeleton               m_skeleton;
+    animator               m_animator;
+    uint32_t               m_skin_source = 0;  // from m_skinning
+    std::vector<Mesh>      m_skinned_meshes;
+    std::vector<glm::mat4> m_skinned_transforms;
+
+    // The directional light's shadow maps, only with shadowsEnabled()
+    shadow_cascades      m_cascades;
+    std::vector<uint8_t> m_shadow_visible;  // m_draw_bounds' culling against a cascade
+    bool                 m_shadows = false;
+
+    // Or the scene as acceleration structures that the fragment shaders trace the sun's shadows
+    // through instead, where the device has ray queries and the quality asks for them, see
+    // rayQueryShadows. Only the vertex formats they can be built from are traced.
+    bool                                           m_ray_query = false;
+    acceleration_structures                        m_acceleration;
+    std::array<bool, (size_t)vertex_format::count> m_ray_formats{};
+
+    // The reflection probes' cached cubes, only with m_reflections
+    reflection_probe_settings m_probe_settings;
+    bool                      m_reflections = false;
+    reflection_probes         m_probes;
+    std::vector<uint8_t>      m_probe_visible;  // m_draw_bounds' culling against a face
+
+    // And runs on a compute queue of its own, where there is a compute family without graphics,
+    // alongside the tail of the previous frame's graphics work. So do the particles. Every frame's
+    // compute work signals its number on the compute timeline, which the frame's graphics
+    // submission waits for.
+    bool                           m_async_compute = false;
+    std::vector<vk::CommandPool>   m_compute_command_pools;  // one per frame in flight
+    std::vector<vk::CommandBuffer> m_compute_command_buffers;
+    timeline_semaphore             m_compute_timeline;
+
+    // Timestamps around the passes of every frame, and the upload service's, and pipeline
+    // statistics where the device has them
+    gpu_profiler m_profiler;
+    bool         m_pipeline_statistics = false;  // pipelineStatisticsQuery
+    bool         m_inherited_queries   = false;  // statistics across secondary command buffers
+
+    // Of the hardware counters to sample, none unless asked for, since that holds the device's
+    // profiling lock
+    std::vector<std::string> m_counter_selection;
+
+    // Animation goes by the frame number instead of the clock, and the camera moves
+    bool    m_benchmarking  = false;
+    int64_t m_frame_wait_ns = 0;  // how long the last frame waited for its fence
+
+    // Rendering into m_offscreen_target's images, which stand in for the swap chain's
+    bool               m_offscreen = false;
+    offscreen_target   m_offscreen_target;
+    offscreen_callback m_offscreen_deliver;
+
+    // Reads asset files for streaming, so that no other thread waits on the disk for them
+    core::io_queue m_io;
+
+    // Starts the reads, decodes and uploads of whatever streams within the frame's budgets
+    streaming_budget m_streaming_budget;
+    stream_scheduler m_streams;
+
+    // Decodes and uploads textures, using the job scheduler
+    texture_loader   m_texture_loader;
+
+    // Keeps only as many of each texture's mip levels in VRAM as it is seen at
+    texture_streamer m_textures;
+
+    // Textures too large for that, in the last max_virtual_textures slots of the bindless array.
+    // Their m_texture_cache handles are that slot with virtual_texture_bit set.
+    bool                  m_virtual_texturing = false;  // see setVirtualTextures
+    virtual_texture_cache m_virtual_textures;
+
+    // Reference counted, keyed by path and by contents
+    resource_cache<texture_streamer::handle> m_texture_cache;
+    resource_cache<Mesh>                     m_mesh_cache;
+
+    texture_handle m_texture = resource_cache<texture_streamer::handle>::invalid_handle;
+    vk::Sampler    m_texture_sampler;  // from m_views
+
+    // The frame's passes, see createRenderGraph. The depth image and the multisampled color image
+    // are its transient images.
+    render_graph         m_graph;
+    render_graph::handle m_graph_target       = render_graph::invalid_handle;
+    uint32_t             m_recording_image    = 0;  // of the frame being recorded, for the passes
+    uint32_t             m_recording_uniforms = 0;
+    vk::Image            m_depth_image;
+    vk::ImageView        m_depth_image_view;
+    vk::Format           m_depth_format = vk::Format::eUndefined;
+    bool                 m_depth16      = false;  // preferring D16_UNORM, see setDepth16
+    vk::Image            m_color_image;  // only multisampled
+    vk::ImageView        m_color_image_view;
+    vk::Image            m_gbuffer_color;  // only with deferred shading
+    vk::ImageView        m_gbuffer_color_view;
+    vk::Image            m_gbuffer_normal;
+    vk::ImageView        m_gbuffer_normal_view;
+
+    // The resolution the main pass renders at, the swap chain's unless it's scaled, and of each
+    // eye in stereo. Scaled and stereo frames are rendered into the scene image, one of the
+    // graph's transient images with a layer per eye, and blitted to the target by the upscale
+    // pass.
+    resolution_scaler m_resolution;
+    bool              m_dynamic_resolution = false;  // enabled and supported
+    uint64_t          m_resolution_samples = 0;      // frame timings seen so far
+    vk::Extent2D      m_render_extent;
+    bool              m_scene_target = false;  // rendered into the scene image
+    vk::Image         m_scene_image;
+    vk::ImageView     m_scene_image_view;
 
-    vk::Image        m_depth_image;
-    vk::ImageView    m_depth_image_view;
-    vk::DeviceMemory m_depth_image_memory;
+    // Every frame in the scene image, jittered, and resolved into the history by the temporal
+    // pass, which the upscale pass blits to the target instead, see setTemporal
+    temporal_settings m_temporal_settings;
+    temporal_upscaler m_temporal;
+    bool              m_temporal_aa = false;  // enabled and supported
+    temporal_frame    m_temporal_frame;       // of the frame being recorded
+    std::atomic<bool> m_history_reset{ false };
 
-    vk::ShaderModule m_vertex_shader_module;
-    vk::ShaderModule m_fragment_shader_module;
+    // Reads the scene image, or the history, and writes the target instead of the upscale pass,
+    // see setPostProcessing
+    post_settings m_post_settings;
+    post_stack    m_post;
+    bool          m_post_processing = false;  // enabled and supported
+    bool          m_post_direct     = false;  // writing the swap chain images as storage images
 
-    vk::DescriptorPool      m_descriptor_pool;
-    vk::DescriptorSetLayout m_descriptor_set_layout;
-    vk::DescriptorSet       m_descriptor_set;
+    // The draws' fragment sizes are dynamic state of every main pass pipeline, and the rate
+    // image is made after the main pass for the next frame's, see setShadingRate
+    shading_rate_settings m_shading_rate_settings;
+    shading_rate_image    m_shading_rates;
+    bool                  m_variable_rate    = false;  // enabled and supported
+    bool                  m_adaptive_shading = false;  // with the rate image
+#if defined(VK_KHR_fragment_shading_rate)
+    PFN_vkCmdSetFragmentShadingRateKHR m_set_fragment_shading_rate = nullptr;
+#endif
 
-    vk::RenderPass     m_render_pass;
-    vk::PipelineLayout m_pipeline_layout;  // used to define shader uniform value layouts
-    vk::Pipeline       m_graphics_pipeline;
+    // Whether the main pass renders both eyes, a layer each of its attachments, see setStereo
+    stereo_settings m_stereo_settings;
+    bool            m_stereo = false;  // enabled and supported
 
-    vk::CommandPool                m_command_pool;
+    // A window, surface and swap chain each, and views 1 and up of the main pass, see addViewport.
+    // Sized before run(), or emptied by createLogicalDevice if they can't be shown, and never
+    // after, so the render thread can go through them while the main thread closes their windows.
+    struct viewport
+    {
+        viewport_settings          settings;  // its camera with m_camera_mutex held
+        GLFWwindow*                window = nullptr;
+        vk::SurfaceKHR             surface;
+        vk::SwapchainKHR           swapchain;  // null while its window is minimized
+        std::vector<vk::Image>     images;
+        std::vector<uint64_t>      image_frames;     // like m_image_frames
+        vk::Extent2D               extent;           // the settings' until there is a swap chain
+        std::vector<vk::Semaphore> image_available;  // one per frame in flight
+        uint32_t                   image    = 0;     // acquired for the frame being drawn
+        bool                       acquired = false;
+        bool                       stale    = false;  // recreated before it's acquired again
+    };
+    std::vector<viewport>                        m_viewports;
+    std::array<std::atomic<bool>, max_viewports> m_viewports_closed{};
+
+    // Of the main pass's color and depth attachments, resolved into the target by the render pass
+    vk::SampleCountFlagBits m_samples = vk::SampleCountFlagBits::e1;
+
+    // What the renderer was last built with, on the thread drawing, and what the main thread asked
+    // for, which the frame packets carry over, see applyQuality
+    quality_settings m_quality;
+    quality_settings m_requested_quality;
+    quality_tier     m_quality_tier   = quality_tier::high;  // the last one asked for
+    bool             m_quality_key    = false;
+    bool             m_quality_chosen = false;  // before init, over the calibrated one
+
+    // Where the calibration is kept, see setCalibration, whether run() has to calibrate first, and
+    // the stress scene's cubes if they're only there for that
+    std::string                m_calibration_path;
+    bool                       m_recalibrate       = false;
+    bool                       m_calibrating       = false;
+    bool                       m_calibration_scene = false;
+    std::vector<scene::entity> m_calibration_entities;
+
+    // Long-lived sets, and sets that are only valid for the frame they were allocated in
+    descriptor_allocator                m_descriptors;
+    std::vector<descriptor_allocator>   m_frame_descriptors;  // one per frame in flight
+    vk::DescriptorSetLayout             m_descriptor_set_layout;
+    std::vector<vk::DescriptorPoolSize> m_descriptor_set_sizes;  // what one set of it needs
+
+    // Every shader the graphics pipelines are made of, merged, which the layouts are created from
+    shader_reflection m_graphics_reflection;
+
+    // With VK_EXT_descriptor_indexing every texture is in one array in set 1, indexed by its
+    // texture_streamer handle, and draws pick theirs per instance. Without it binding 1 of set 0
+    // is all there is, and all draws use m_texture.
+    bool                           m_bindless_textures      = false;
+    uint32_t                       m_bindless_texture_count = 0;
+    uint32_t                       m_streamed_texture_count = 0;  // below the virtual textures
+    descriptor_allocator           m_texture_descriptors;
+    vk::DescriptorSetLayout        m_texture_set_layout;
+    std::vector<vk::DescriptorSet> m_texture_sets;  // one per frame in flight
+
+    // One per frame in flight, so a texture can get a new view without waiting for the other frames
+    std::vector<vk::DescriptorSet> m_descriptor_sets;
+    std::vector<uint64_t>          m_descriptor_texture_versions;  // m_textures.version() in each
+    std::vector<uint64_t>          m_descriptor_virtual_versions;  // m_virtual_textures.version()
+
+    // Writes the whole of one of them in one call, from what is in the data
+    descriptor_template          m_descriptor_template;
+    std::vector<descriptor_data> m_descriptor_data;
+
+    // Or instead of m_descriptor_sets and the texture sets the draws bind, set 0 and the textures
+    // in a buffer, whose texture layout is the bindless one without update-after-bind. The texture
+    // sets are still there for the HUD.
+    bool                    m_descriptor_buffers = false;  // see setDescriptorBuffers
+    descriptor_buffer       m_descriptor_buffer;
+    vk::DescriptorSetLayout m_buffer_texture_layout;
+
+    // Saved to disk at shutdown so pipelines compile faster on the next run
+    pipeline_cache m_pipeline_cache;
+
+    // Owns every descriptor set layout and pipeline layout below
+    layout_cache m_layouts;
+
+    // Owns every sampler, and the views of textures and render targets
+    view_cache m_views;
+
+    // Every pipeline variant, deduplicated by pipeline_state
+    pipeline_library m_pipelines;
+
+    vk::RenderPass     m_render_pass;        // null with dynamic rendering
+    vk::PipelineLayout m_pipeline_layout;    // from m_layouts, defines the shader uniform layouts
+    vk::Pipeline       m_graphics_pipeline;  // the opaque material's, from m_pipelines
+
+    // By vertex format, then material
+    template<typename T>
+    using material_table = std::array<std::array<T, (size_t)material::count>,
+                                      (size_t)vertex_format::count>;
+
+    material_table<pipeline_state> m_material_states;
+    material_table<pipeline_state> m_overdraw_states;  // the same, counting fragments instead
+    material_table<vk::Pipeline>   m_material_pipelines;
+    bool                           m_overdraw_view = false;
+
+    // The depth prepass's, only for the materials it draws, see setDepthPrepass
+    material_table<pipeline_state> m_prepass_states;
+    material_table<vk::Pipeline>   m_prepass_pipelines;
+    bool                           m_depth_prepass = false;
+
+    // The lighting subpass's, see setDeferredShading. Its own layout adds a set with the G-buffer's
+    // input attachments, allocated every frame from the frame's descriptors since the attachments
+    // are rebuilt with the render targets.
+    bool                    m_deferred_shading = false;
+    vk::DescriptorSetLayout m_gbuffer_set_layout;
+    vk::PipelineLayout      m_lighting_layout;  // from m_layouts
+    pipeline_state          m_lighting_state;
+    vk::Pipeline            m_lighting_pipeline;
+
+    // Added onto the lighting subpass's light a light at a time, see setLightVolumes
+    bool           m_light_volumes = false;
+    pipeline_state m_light_volume_state;
+    vk::Pipeline   m_light_volume_pipeline;
+
+    // One transient pool per frame in flight, reset as a whole before the frame is recorded
+    std::vector<vk::CommandPool>   m_command_pools;
     std::vector<vk::CommandBuffer> m_command_buffers;
+    std::vector<draw_item>         m_draw_list;
+    std::vector<glm::mat4>         m_draw_transforms;  // model matrices of m_draw_list's instances
+    sphere_list                    m_draw_bounds;      // world space, one per m_draw_transforms
+    std::vector<uint8_t>           m_draw_visible;     // m_draw_bounds' culling results
+    std::vector<cull_instance>     m_meshlet_culls;    // see draw_item::first_meshlet_cull
+
+    // sortDrawList's and drawMesh's, only kept around for their memory
+    std::vector<std::vector<glm::mat4>> m_lod_transforms;  // by level
+    std::vector<sort_entry>             m_draw_keys;
+    std::vector<sort_entry>             m_draw_keys_scratch;
+    std::vector<draw_item>              m_sorted_draw_list;
+    std::vector<glm::mat4>              m_sorted_draw_transforms;
+
+    // [frame in flight][recording thread], used once the draw list reaches
+    // parallel_recording_threshold. Every thread's pool has two buffers, the slice's draws first
+    // and then its depth prepass after those of every thread.
+    std::vector<std::vector<vk::CommandPool>>   m_secondary_command_pools;
+    std::vector<std::vector<vk::CommandBuffer>> m_secondary_command_buffers;
+
+    // With setCachedDraws, what each secondary command buffer was last recorded with, see
+    // drawSliceSignature. 0 until it has been, or once what it recorded has gone stale.
+    std::vector<std::vector<uint64_t>> m_secondary_signatures;
+    bool                               m_cached_draws = false;
+
+    // Below this many draws a thread costs more than recording the draws inline does
+    static const uint32_t parallel_recording_threshold = 1024;
+    static const uint32_t max_recording_threads        = 8;
 
     std::vector<vk::Semaphore> m_image_available_semaphores;
     std::vector<vk::Semaphore> m_render_finished_semaphores;
 
-    static const uint32_t  max_frames_in_flight = 2;
-    uint32_t               m_current_frame      = 0;
-    std::vector<vk::Fence> m_in_flight_fences;
+    uint32_t               m_frames_in_flight = 2;
+    uint32_t               m_current_frame    = 0;
+    uint64_t               m_frame_number     = 0;  // frames submitted so far
+    std::vector<vk::Fence> m_in_flight_fences;  // none with timeline semaphores
+    std::vector<uint64_t>  m_image_frames;      // the frame last rendering to every image
+
+    // What a frame in flight only needs while it's being recorded and submitted, reset once its
+    // fence has signalled
+    std::array<core::linear_arena, max_frames_in_flight> m_frame_arenas;
+    std::vector<float>                                   m_upload_timings;  // reused every frame
+
+    // Signalled to every frame's number as it finishes, instead of the fences
+    bool               m_timeline_semaphores = false;
+    timeline_semaphore m_frame_timeline;
+    uint64_t           m_completed_frame     = 0;  // known to have finished
+
+    pacing_settings     m_pacing;
+    core::frame_limiter m_frame_limiter;
+    bool                m_present_wait = false;  // VK_KHR_present_id and VK_KHR_present_wait
+    uint64_t            m_presented    = 0;      // present id of the last frame presented
+#if defined(VK_KHR_present_wait)
+    PFN_vkWaitForPresentKHR m_wait_for_present = nullptr;
+#endif
 
     vk::Queue m_graphics_queue;
     vk::Queue m_presentation_queue;
+    vk::Queue m_transfer_queue;  // same as m_graphics_queue if there is no transfer-only family
+    vk::Queue m_compute_queue;   // same as m_graphics_queue if there is no compute-only family
 
-    // Temporary model loading stuff for testing. Eventually these will become a cache of meshes and
-    // assets stored elsewhere.
-    Mesh m_mesh;
-};
+    // What a frame submits to the graphics queue, the uploads recorded during it included, and to
+    // the compute queue, see submit_batch
+    submit_batch m_frame_batch;
+    submit_batch m_compute_batch;
 
-/*
-The signature for Func must satisfy void(vk::CommandBuffer)
-*/
-template<typename Func>
-void
-renderer::executeSingleTimeCommands(Func func) const
-{
-    auto allocinfo = vk::CommandBufferAllocateInfo()
-                       .setLevel(vk::CommandBufferLevel::ePrimary)
-                       .setCommandPool(m_command_pool)
-                       .setCommandBufferCount(1);
+    // See setPresentThread. While it runs, whatever submits to the presentation queue holds
+    // m_queue_mutex, if anything else does at all.
+    bool           m_present_thread = false;
+    present_thread m_presenter;
+    std::mutex     m_queue_mutex;
 
-    vk::CommandBuffer commandbuffer = m_device.allocateCommandBuffers(allocinfo).front();
+    // Temporary model loading stuff for testing. Models loaded from files are owned by
+    // m_mesh_cache, and m_mesh is a copy of whichever one is drawn.
+    mesh_handle m_model = resource_cache<Mesh>::invalid_handle;
 
-    auto begininfo = vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+    // Where everything is. m_mesh is drawn with the world matrix of m_mesh_node.
+    scene::scene_graph         m_scene;
+    scene::scene_graph::handle m_mesh_node = scene::scene_graph::invalid_handle;
 
-    commandbuffer.begin(begininfo);
+    // Every other scene object, see setEntities. What simulate() last extracted of them is kept
+    // by entity index, and only brought up to date for what changed after m_extracted_version.
+    struct entity_draw
+    {
+        draw_request draw;
+        glm::mat4    previous = glm::mat4(1.f);  // draw's transform before the step it moved in
+        uint64_t     moved    = 0;               // that step
+        bool         drawn    = false;           // an entity of that index is alive
+        bool         changed  = false;           // in m_changed_entities
+        bool         moving   = false;           // in m_moving_entities
+    };
 
-    func(commandbuffer);
+    uint32_t                   m_entity_count = 0;
+    scene::entity_world        m_entities;
+    std::vector<entity_draw>   m_entity_draws;
+    std::vector<scene::entity> m_destroyed_entities;  // reused by extractEntities
+    uint32_t                   m_extracted_version = 0;
 
-    commandbuffer.end();
+    // The stress scene's, see setStressScene, and how far the lights and the camera path reach
+    // around its center, 1 without one
+    stress_scene_settings       m_stress;
+    Mesh                        m_stress_mesh;
+    std::vector<texture_handle> m_stress_textures;
+    glm::vec3                   m_scene_center = glm::vec3(0.f);
+    float                       m_scene_extent = 1.f;
 
-    auto submitinfo = vk::SubmitInfo().setCommandBufferCount(1).setPCommandBuffers(&commandbuffer);
+    // The capture that simulate() writes its packets to, with the ids it gave the meshes and the
+    // textures it has named, and the one its packets are read from instead, with what its ids stand
+    // for here. m_replay_done once the last frame has been read.
+    std::string                                  m_capture_path;
+    capture_writer                               m_capture;
+    captured_frame                               m_captured;
+    std::unordered_map<const Mesh*, uint32_t>    m_capture_meshes;
+    std::unordered_set<texture_handle>           m_capture_textures;
+    std::string                                  m_replay_path;
+    std::string                                  m_scene_path;  // see setScene
+    capture_reader                               m_replay;
+    std::vector<const Mesh*>                     m_replay_meshes;
+    std::unordered_map<uint32_t, texture_handle> m_replay_textures;
+    bool                                         m_replay_done = false;
 
-    m_graphics_queue.submit(submitinfo, nullptr);
-    // Unlike the draw commands, there are no events we need to wait on this time. We just want to
-    // execute the transfer on the buffers immediately. There are again two possible ways to wait on
-    // this transfer to complete. We could use a fence and wait with vkWaitForFences, or simply wait
-    // for the transfer queue to become idle with vkQueueWaitIdle. A fence would allow you to
-    // schedule multiple transfers simultaneously and wait for all of them complete, instead of
-    // executing one at a time. That may give the driver more opportunities to optimize.
-    m_graphics_queue.waitIdle();
+    // See setScreenshots, off if the swap chain images can't be copied from after all.
+    // m_screenshot_saves are the jobs writing them out.
+    std::atomic<bool> m_screenshots{ false };
+    frame_readback    m_frame_readback;
+    bool              m_screenshot_key   = false;
+    uint32_t          m_screenshot_count = 0;
+    jobs::counter     m_screenshot_saves;
 
-    m_device.freeCommandBuffers(m_command_pool, 1, &commandbuffer);
-}
+    // See setVideoCapture, without a sink if the swap chain images can't be recorded after all
+    video_settings m_video_settings;
+    video_capture  m_video;
+    bool           m_video_convert = false;  // to NV12, the images are sampled
+
+    // See setPicking. Every instance added to the draw list gets m_draw_object, which is only
+    // kept in m_draw_objects until the draw list is culled.
+    bool                  m_picking = false;
+    object_picker         m_picker;
+    bool                  m_pick_button = false;
+    uint32_t              m_draw_object = pick_none;
+    std::vector<uint32_t> m_draw_objects;  // one per m_draw_transforms
+    sphere_list           m_pick_bounds;   // of the render scene's slots
+    std::vector<uint8_t>  m_pick_visible;
+
+    // With a render scene, the entities whose slots are sent again this frame, and those that are
+    // sent every frame until they stop moving, since they're drawn between two steps
+    bool                  m_render_scene_enabled = false;
+    std::vector<uint32_t> m_changed_entities;
+    std::vector<uint32_t> m_moving_entities;
+
+    // The render scene's slots, by entity index, as drawFrame() last got them, the meshes in it by
+    // batch, and where this frame's batches and instances went if they're drawn from the GPU
+    render_scene              m_render_scene;
+    std::vector<draw_request> m_scene_draws;  // a null mesh for an empty slot
+    std::vector<const Mesh*>  m_scene_batches;
+    bool                      m_scene_resident       = false;
+    uint32_t                  m_scene_first_draw     = 0;
+    uint32_t                  m_scene_first_instance = 0;
+    uint32_t                  m_scene_first_cull     = 0;
+
+    // With fast start m_mesh and m_texture are only drawn once this upload has finished
+    upload_ticket m_scene_ticket  = 0;
+    bool          m_scene_visible = false;  // its uploads were seen to be done
+
+    bool m_keep_mesh_data = false;  // see setKeepMeshData
+    bool m_vertex_pulling = false;  // see setVertexPulling
+    bool m_half_precision = true;   // see setHalfPrecision
+
+    uint32_t m_shader_features = pipeline_state().features;  // see setShaderFeatures
+
+    // A mesh cooked again on a job because its file changed, to be swapped in at a frame boundary
+    struct reloaded_mesh
+    {
+        mesh_handle mesh = resource_cache<Mesh>::invalid_handle;
+        std::string path;
+        Mesh        result;
+        bool        ok = false;
+    };
+
+    bool                       m_hot_reload = false;  // see setHotReload
+    core::file_watcher         m_watcher;
+    jobs::counter              m_mesh_reloads;
+    std::mutex                 m_reloaded_mutex;
+    std::vector<reloaded_mesh> m_reloaded_meshes;  // guarded by m_reloaded_mutex
+
+    // Brings shaders/*.spv up to date with their sources, at startup and as they change
+    shader_compiler                 m_shader_compiler;
+    std::unordered_set<std::string> m_shader_sources;  // GLSL and includes, being watched
+    jobs::counter                   m_shader_compiles;
+
+    uint16_t               m_telemetry_port = 0;  // see setTelemetry
+    core::telemetry_server m_telemetry;
+    int64_t                m_telemetry_at = 0;  // the last frame's submit
+
+    bool               m_defragment      = false;  // see setDefragmentation
+    bool               m_compacting      = false;  // the geometry pool moved meshes last frame
+    uint64_t           m_next_defragment = 0;      // the frame the next pass starts at
+    std::vector<Mesh*> m_compacted_meshes;         // reused by compactGeometry
+
+    // With a render thread, the exchange between it and the simulation, and otherwise the packet
+    // drawFrame() simulates into
+    bool                                m_render_thread = false;  // see setRenderThread
+    jobs::packet_exchange<frame_packet> m_packets;
+    frame_packet                        m_packet;
+
+    // See latchCamera
+    std::mutex m_camera_mutex;
+    bool       m_camera_latched   = false;
+    glm::vec3  m_latched_position = glm::vec3(0.f);
+    glm::vec3  m_latched_target   = glm::vec3(0.f);
+
+    // See setOnDemand. m_redraw is set by the window's callbacks and requestRedraw(), for the
+    // first frame too, and m_busy and m_settled by settle() on the render thread, after every
+    // frame; the rest is the main thread's.
+    using settle_marks = std::tuple<uint64_t, uint64_t, uint32_t, size_t, bool>;
+
+    bool              m_on_demand     = false;
+    bool              m_animating     = true;
+    bool              m_animation_key = false;
+    std::atomic<bool> m_redraw{ true };
+    std::atomic<bool> m_busy{ false };      // something is still loading, streaming or compiling
+    settle_marks      m_settled;            // what had streamed in by the last frame
+    uint32_t          m_owed_frames   = 0;  // frames still to draw after the last one asked for
+
+    // Allocations are only checked for after this many frames, by when caches, pools and the
+    // frame arenas have grown as large as they get
+    static const uint32_t allocation_warmup_frames = 120;
+
+    bool               m_allocation_tracking = false;  // see setAllocationTracking
+    bool               m_allocation_checks   = false;  // see setAllocationChecks
+    bool               m_host_allocator      = true;   // see setHostAllocator
+    core::alloc_counts m_frame_allocations;            // of the last frame
+    core::alloc_counts m_allocations_at_frame;         // allocated before this one
+
+    // The simulation's own, see simulate
+    core::fixed_timestep m_clock;
+    int64_t              m_simulated_at = 0;    // when the clock was last advanced
+    float                m_mesh_angle   = 0.f;  // radians, of m_mesh_node around z
+
+    Mesh      m_mesh;
+    glm::mat4 m_view                     = glm::mat4(1.f);
+    glm::mat4 m_projection               = glm::mat4(1.f);
+    glm::mat4 m_view_projection          = glm::mat4(1.f);
+    glm::mat4 m_draw_view_projection     = glm::mat4(1.f);  // jittered, see setTemporal
+    glm::mat4 m_previous_view_projection = glm::mat4(1.f);  // the frame before's, see m_hiz
+    frustum   m_cull_frustum             = {};  // holds all the views, see updateUniformBuffer
+    glm::vec3 m_camera_position          = glm::vec3(0.f);
+    float     m_projection_scale         = 1.f;  // 1 / tan(fovy / 2), how far it magnifies
+    float     m_scene_time               = 0.f;  // seconds, what the scene is animated by
+};
 
 template<typename Func>
 void
@@ -287,3 +2037,19 @@ recordCommandBufferRenderPass(vk::CommandBuffer              buffer,
 }
 
 }  // namespace shiny::graphics
+
+/*
+Lets Vertex be the key of an unordered_map, hashed by the same fields it is compared by
+*/
+namespace std {
+
+template<>
+struct hash<shiny::graphics::Vertex>
+{
+    size_t operator()(const shiny::graphics::Vertex& vertex) const
+    {
+        return shiny::graphics::vertexHash(vertex);
+    }
+};
+
+}  // namespace std
@@ -0,0 +1,75 @@
+#include "graphics/resolution_scaler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Scales are multiples of this
+const float scale_step = 0.05f;
+
+// Of the budget, which scaling up aims for
+const float headroom = 0.9f;
+
+// How much of every new frame time goes into the smoothed one
+const float smoothing = 0.1f;
+
+// Frame times taken after a change before the next one, also long enough for the frames in flight
+// at the old scale to have been measured
+const uint32_t settle_frames = 30;
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+resolution_scaler::init(const resolution_settings& settings)
+{
+    m_settings           = settings;
+    m_settings.min_scale = std::clamp(settings.min_scale, scale_step, 1.f);
+    m_settings.max_scale = std::clamp(settings.max_scale, m_settings.min_scale, 1.f);
+    m_scale              = m_settings.max_scale;
+    m_smoothed           = 0.f;
+    m_samples            = 0;
+}
+
+bool
+resolution_scaler::update(float frame_ms)
+{
+    if (!m_settings.dynamic || frame_ms <= 0.f) {
+        return false;
+    }
+
+    m_smoothed = m_samples == 0 ? frame_ms : m_smoothed + (frame_ms - m_smoothed) * smoothing;
+    if (++m_samples < settle_frames) {
+        return false;
+    }
+
+    const bool  over   = m_smoothed > m_settings.budget_ms;
+    const float target = over ? m_settings.budget_ms : m_settings.budget_ms * headroom;
+    if (!over && m_smoothed > target) {
+        return false;
+    }
+
+    // The last step that fits, with some slack for the steps not being exact in floats
+    float scale = m_scale * std::sqrt(target / m_smoothed);
+    scale       = std::floor(scale / scale_step + 1e-3f) * scale_step;
+    scale       = std::clamp(scale, m_settings.min_scale, m_settings.max_scale);
+
+    if (std::abs(scale - m_scale) < scale_step * 0.5f) {
+        return false;
+    }
+
+    m_scale   = scale;
+    m_samples = 0;
+    return true;
+}
+
+vk::Extent2D
+resolution_scaler::extent(vk::Extent2D full) const
+{
+    return vk::Extent2D(std::max((uint32_t)((float)full.width * m_scale + 0.5f), 1u),
+                        std::max((uint32_t)((float)full.height * m_scale + 0.5f), 1u));
+}
+
+}  // namespace shiny::graphics
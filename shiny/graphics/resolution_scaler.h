@@ -0,0 +1,54 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+
+namespace shiny::graphics {
+
+// Which fraction of the swap chain's resolution frames are rendered at, see resolution_scaler
+struct resolution_settings
+{
+    bool  dynamic   = false;
+    float min_scale = 0.5f;  // of the width and height
+    float max_scale = 1.f;
+    float budget_ms = 1000.f / 60.f;  // GPU time a frame should take
+};
+
+/*
+Picks the render resolution from the GPU time of the frames, so that they stay within the budget.
+The time a frame takes is mostly the pixels it shades, which go with the square of the scale, so
+the scale that would have fit the budget is the current one times the square root of how far off
+the frame was. The frame times are smoothed first, since a single frame says little.
+
+Every change reallocates the render targets, so the scale only moves in steps of a twentieth,
+heads for a little under the budget when going up so it doesn't flip back right away, and holds
+still for a while afterwards, which also keeps the frames in flight at the old scale out of the
+measurements.
+*/
+class resolution_scaler
+{
+public:
+    void init(const resolution_settings& settings);
+
+    // Takes the GPU time of a frame, true when the scale changed
+    bool update(float frame_ms);
+
+    bool                       enabled() const { return m_settings.dynamic; }
+    const resolution_settings& settings() const { return m_settings; }
+    float                      scale() const { return m_scale; }
+
+    // `full` scaled, at least 1x1
+    vk::Extent2D extent(vk::Extent2D full) const;
+
+private:
+    resolution_settings m_settings;
+    float               m_scale    = 1.f;
+    float               m_smoothed = 0.f;
+    uint32_t            m_samples  = 0;  // since the scale last changed
+};
+
+}  // namespace shiny::graphics
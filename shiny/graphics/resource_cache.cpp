@@ -0,0 +1,58 @@
+#include "graphics/resource_cache.h"
+
+#include "core/mapped_file.h"
+
+#include <filesystem>
+
+namespace {
+
+uint64_t
+fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+/*
+Symbolic links and relative paths are resolved as well where the file exists. Paths that don't
+exist are still made lexically normal, so they at least fail to load under one key.
+*/
+std::string
+normalizeResourcePath(const std::string& path)
+{
+    std::error_code       error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+
+    if (error) {
+        return std::filesystem::path(path).lexically_normal().generic_string();
+    }
+    return canonical.generic_string();
+}
+
+uint64_t
+hashFileContents(const std::string& path)
+{
+    core::mapped_file file;
+    if (!file.open(path)) {
+        return 0;
+    }
+
+    const uint64_t size = file.size();
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash          = fnv1a(hash, &size, sizeof(size));
+    hash          = fnv1a(hash, file.data(), file.size());
+
+    // 0 means "unreadable"
+    return hash ? hash : 1;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "core/handle_pool.h"
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace shiny::graphics {
+
+// The same file is the same key however it was spelled, e.g. "textures/../textures/a.png"
+std::string normalizeResourcePath(const std::string& path);
+
+// Hash of a file's size and contents, 0 if it can't be read
+uint64_t hashFileContents(const std::string& path);
+
+/*
+Reference counted resources, loaded once per file. Resources are found by their normalized path
+first, and only on a miss by the hash of their file's contents, so a file that is referred to by
+several paths, or copied under another name, still only gets decoded, staged and uploaded once.
+
+Handles are core::handle_pool's, so they stay 32 bits and index dense arrays, one per field, and
+once the last reference is released the handle goes stale: valid() is false for it from then on,
+even after its slot has been handed out again for something else, and get() asserts as much.
+*/
+template<typename Resource>
+class resource_cache
+{
+public:
+    using handle = core::handle_pool::handle;
+
+    static const handle invalid_handle = core::handle_pool::invalid_handle;
+
+    // Takes a reference to whatever was loaded from `path` or from a file with the same contents.
+    // If there is nothing yet, `load(path, resource)` is called to load it, and returns false if
+    // it couldn't, in which case nothing is cached and invalid_handle is returned.
+    template<typename Load>
+    handle acquire(const std::string& path, Load load);
+
+    // Drops a reference, calling `destroy(resource)` when it was the last one
+    template<typename Destroy>
+    void release(handle resource, Destroy destroy);
+
+    // What `path` has been acquired as, or invalid_handle, without taking a reference
+    handle find(const std::string& path) const;
+
+    // Whether the handle still refers to what it was acquired for
+    bool valid(handle resource) const { return m_handles.alive(resource); }
+
+    Resource&       get(handle resource) { return m_resources[slot(resource)]; }
+    const Resource& get(handle resource) const { return m_resources[slot(resource)]; }
+    uint32_t        references(handle resource) const { return m_references[slot(resource)]; }
+
+    // The first normalized path it was acquired with
+    const std::string& path(handle resource) const { return m_paths[slot(resource)].front(); }
+
+    // Calls `visit(handle, resource)` for every resource that is referenced
+    template<typename Visit>
+    void forEach(Visit visit)
+    {
+        m_handles.forEach([&](handle resource) { visit(resource, m_resources[slot(resource)]); });
+    }
+
+private:
+    uint32_t slot(handle resource) const
+    {
+        assert(valid(resource) && "stale resource handle!");
+        return core::handle_pool::index(resource);
+    }
+
+    handle reference(handle resource, const std::string& path);
+
+    core::handle_pool m_handles;
+
+    // By slot
+    std::vector<Resource>                 m_resources;
+    std::vector<std::vector<std::string>> m_paths;  // every normalized path it was acquired with
+    std::vector<uint64_t>                 m_content_hashes;
+    std::vector<uint32_t>                 m_references;
+
+    std::unordered_map<std::string, handle> m_by_path;
+    std::unordered_map<uint64_t, handle>    m_by_content;
+};
+
+template<typename Resource>
+template<typename Load>
+typename resource_cache<Resource>::handle
+resource_cache<Resource>::acquire(const std::string& path, Load load)
+{
+    const std::string normalized = normalizeResourcePath(path);
+
+    auto bypath = m_by_path.find(normalized);
+    if (bypath != m_by_path.end()) {
+        ++m_references[slot(bypath->second)];
+        return bypath->second;
+    }
+
+    // Reading the whole file only happens for paths that haven't been seen before, and the load
+    // that would follow reads it anyway
+    const uint64_t hash = hashFileContents(normalized);
+
+    auto bycontent = hash ? m_by_content.find(hash) : m_by_content.end();
+    if (bycontent != m_by_content.end()) {
+        return reference(bycontent->second, normalized);
+    }
+
+    Resource loaded{};
+    if (!load(normalized, loaded)) {
+        return invalid_handle;
+    }
+
+    const handle   resource = m_handles.allocate();
+    const uint32_t i        = core::handle_pool::index(resource);
+    if (i >= m_resources.size()) {
+        m_resources.resize(i + 1);
+        m_paths.resize(i + 1);
+        m_content_hashes.resize(i + 1);
+        m_references.resize(i + 1);
+    }
+    m_resources[i]      = std::move(loaded);
+    m_content_hashes[i] = hash;
+
+    if (hash) {
+        m_by_content[hash] = resource;
+    }
+    return reference(resource, normalized);
+}
+
+template<typename Resource>
+template<typename Destroy>
+void
+resource_cache<Resource>::release(handle resource, Destroy destroy)
+{
+    const uint32_t i = slot(resource);
+    if (--m_references[i] > 0) {
+        return;
+    }
+
+    destroy(m_resources[i]);
+
+    for (const std::string& path : m_paths[i]) {
+        m_by_path.erase(path);
+    }
+    if (m_content_hashes[i]) {
+        m_by_content.erase(m_content_hashes[i]);
+    }
+
+    m_resources[i] = Resource();
+    m_paths[i].clear();
+    m_content_hashes[i] = 0;
+    m_handles.free(resource);
+}
+
+template<typename Resource>
+typename resource_cache<Resource>::handle
+resource_cache<Resource>::find(const std::string& path) const
+{
+    auto found = m_by_path.find(normalizeResourcePath(path));
+    return found != m_by_path.end() ? found->second : invalid_handle;
+}
+
+template<typename Resource>
+typename resource_cache<Resource>::handle
+resource_cache<Resource>::reference(handle resource, const std::string& path)
+{
+    const uint32_t i = slot(resource);
+    m_paths[i].push_back(path);
+    ++m_references[i];
+
+    m_by_path[path] = resource;
+    return resource;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,474 @@
+#include "graphics/shader_compiler.h"
+
+#include "core/logger.h"
+#include "core/mapped_file.h"
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#if defined(SHINY_SHADER_COMPILER)
+#include <glslang/Include/glslang_c_interface.h>
+#include <glslang/Public/resource_limits_c.h>
+#endif
+
+namespace shiny::graphics {
+
+struct shader_variant
+{
+    const char* output;
+    const char* source;
+    const char* define;  // null for none
+    bool        spirv_1_4 = false;  // for Vulkan 1.1, which ray queries take
+};
+
+struct shader_sources
+{
+    std::vector<std::string> paths;
+    std::vector<std::string> texts;
+};
+
+}  // namespace shiny::graphics
+
+namespace {
+
+using shiny::graphics::shader_sources;
+using shiny::graphics::shader_variant;
+
+// Goes into every hash, so that changing how shaders are compiled doesn't use old code
+const uint32_t shader_cache_version = 1;
+
+// The same as the pre-build step in shiny.vcxproj
+const shader_variant shader_variants[] = {
+    { "shaders/vert.spv", "shaders/shader.vert", nullptr },
+    { "shaders/multiview_vert.spv", "shaders/shader.vert", "MULTIVIEW" },
+    { "shaders/pull_vert.spv", "shaders/pull.vert", nullptr },
+    { "shaders/pull_multiview_vert.spv", "shaders/pull.vert", "MULTIVIEW" },
+    { "shaders/frag.spv", "shaders/shader.frag", nullptr },
+    { "shaders/frag_fp16.spv", "shaders/shader.frag", "HALF_PRECISION" },
+    { "shaders/ray_query_frag.spv", "shaders/shader.frag", "RAY_QUERY_SHADOWS", true },
+    { "shaders/bindless_frag.spv", "shaders/bindless.frag", nullptr },
+    { "shaders/bindless_fp16_frag.spv", "shaders/bindless.frag", "HALF_PRECISION" },
+    { "shaders/bindless_vt_frag.spv", "shaders/bindless.frag", "VIRTUAL_TEXTURES" },
+    { "shaders/bindless_ray_query_frag.spv", "shaders/bindless.frag", "RAY_QUERY_SHADOWS", true },
+    { "shaders/overdraw_frag.spv", "shaders/overdraw.frag", nullptr },
+    { "shaders/cull_comp.spv", "shaders/cull.comp", nullptr },
+    { "shaders/cull_occlusion_comp.spv", "shaders/cull.comp", "OCCLUSION_CULLING" },
+    { "shaders/scene_scatter_comp.spv", "shaders/scene.comp", "SCATTER" },
+    { "shaders/scene_expand_comp.spv", "shaders/scene.comp", nullptr },
+    { "shaders/lights_comp.spv", "shaders/lights.comp", nullptr },
+    { "shaders/shadow_vert.spv", "shaders/shadow.vert", nullptr },
+    { "shaders/probe_vert.spv", "shaders/probe.vert", nullptr },
+    { "shaders/probe_frag.spv", "shaders/probe.frag", nullptr },
+    { "shaders/probe_filter_comp.spv", "shaders/probe_filter.comp", nullptr },
+    { "shaders/depth_vert.spv", "shaders/depth.vert", nullptr },
+    { "shaders/depth_multiview_vert.spv", "shaders/depth.vert", "MULTIVIEW" },
+    { "shaders/depth_frag.spv", "shaders/depth.frag", nullptr },
+    { "shaders/deferred_vert.spv", "shaders/deferred.vert", nullptr },
+    { "shaders/deferred_frag.spv", "shaders/deferred.frag", nullptr },
+    { "shaders/deferred_ray_query_frag.spv", "shaders/deferred.frag", "RAY_QUERY_SHADOWS", true },
+    { "shaders/light_volume_vert.spv", "shaders/deferred.vert", "LIGHT_VOLUME" },
+    { "shaders/light_volume_frag.spv", "shaders/light_volume.frag", nullptr },
+    { "shaders/particles_comp.spv", "shaders/particles.comp", nullptr },
+    { "shaders/particle_vert.spv", "shaders/particle.vert", nullptr },
+    { "shaders/particle_frag.spv", "shaders/particle.frag", nullptr },
+    { "shaders/skin_comp.spv", "shaders/skin.comp", nullptr },
+    { "shaders/debug_vert.spv", "shaders/debug.vert", nullptr },
+    { "shaders/debug_frag.spv", "shaders/debug.frag", nullptr },
+    { "shaders/ui_vert.spv", "shaders/ui.vert", nullptr },
+    { "shaders/ui_frag.spv", "shaders/ui.frag", nullptr },
+    { "shaders/ui_bindless_frag.spv", "shaders/ui_bindless.frag", nullptr },
+    { "shaders/downsample_comp.spv", "shaders/downsample.comp", nullptr },
+    { "shaders/downsample_half_comp.spv", "shaders/downsample.comp", "HALF" },
+    { "shaders/hiz_comp.spv", "shaders/hiz.comp", nullptr },
+    { "shaders/hiz_ms_comp.spv", "shaders/hiz.comp", "MULTISAMPLED" },
+    { "shaders/nv12_comp.spv", "shaders/nv12.comp", nullptr },
+    { "shaders/pick_vert.spv", "shaders/pick.vert", nullptr },
+    { "shaders/pick_frag.spv", "shaders/pick.frag", nullptr },
+    { "shaders/motion_comp.spv", "shaders/motion.comp", nullptr },
+    { "shaders/taa_comp.spv", "shaders/taa.comp", nullptr },
+    { "shaders/shading_rate_comp.spv", "shaders/shading_rate.comp", nullptr },
+    { "shaders/occlusion_vert.spv", "shaders/occlusion.vert", nullptr },
+    { "shaders/terrain_vert.spv", "shaders/terrain.vert", nullptr },
+    { "shaders/terrain_frag.spv", "shaders/terrain.frag", nullptr },
+    { "shaders/impostor_vert.spv", "shaders/impostor.vert", nullptr },
+    { "shaders/impostor_frag.spv", "shaders/impostor.frag", nullptr },
+    { "shaders/vegetation_comp.spv", "shaders/vegetation.comp", nullptr },
+    { "shaders/vegetation_vert.spv", "shaders/vegetation.vert", nullptr },
+    { "shaders/vegetation_frag.spv", "shaders/vegetation.frag", nullptr },
+    { "shaders/bloom_down_comp.spv", "shaders/bloom_down.comp", nullptr },
+    { "shaders/bloom_up_comp.spv", "shaders/bloom_up.comp", nullptr },
+    { "shaders/post_comp.spv", "shaders/post.comp", nullptr },
+    { "shaders/post_swap_chain_comp.spv", "shaders/post.comp", "SWAP_CHAIN" },
+    { "shaders/post_fp16_comp.spv", "shaders/post.comp", "HALF_PRECISION" },
+    { "shaders/post_swap_chain_fp16_comp.spv", "shaders/post.comp", "SWAP_CHAIN_HALF_PRECISION" },
+};
+
+const uint32_t shader_variant_count = sizeof(shader_variants) / sizeof(shader_variants[0]);
+
+uint64_t
+fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t
+fnv1a(uint64_t hash, const std::string& string)
+{
+    // With the length, so that the strings can't run into each other
+    const uint64_t length = string.size();
+    hash                  = fnv1a(hash, &length, sizeof(length));
+    return fnv1a(hash, string.data(), string.size());
+}
+
+bool
+readText(const std::string& path, std::string& text)
+{
+    shiny::core::mapped_file file;
+    if (!file.openLoose(path)) {
+        return false;
+    }
+    text.assign(file.begin(), file.end());
+    return true;
+}
+
+// The name in an `#include "name"` line, the only kind of include the shaders use
+bool
+includedName(const std::string& line, std::string& name)
+{
+    size_t at = line.find_first_not_of(" \t");
+    if (at == std::string::npos || line.compare(at, 8, "#include") != 0) {
+        return false;
+    }
+    const size_t open  = line.find('"', at + 8);
+    const size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+    if (close == std::string::npos) {
+        return false;
+    }
+    name = line.substr(open + 1, close - open - 1);
+    return true;
+}
+
+/*
+Includes are looked for next to the file that includes them, as glslangValidator does. A file that
+is included more than once is only read once, and a file missing doesn't fail the others: that's
+for the compiler to report.
+*/
+bool
+readSources(const std::string& path, shader_sources& sources)
+{
+    if (std::find(sources.paths.begin(), sources.paths.end(), path) != sources.paths.end()) {
+        return true;
+    }
+
+    std::string text;
+    if (!readText(path, text)) {
+        return false;
+    }
+    sources.paths.push_back(path);
+    sources.texts.push_back(text);
+
+    const std::string  directory = std::filesystem::path(path).parent_path().generic_string();
+    std::istringstream lines(text);
+    std::string        line;
+    std::string        name;
+    while (std::getline(lines, line)) {
+        if (includedName(line, name)) {
+            readSources(directory.empty() ? name : directory + "/" + name, sources);
+        }
+    }
+    return true;
+}
+
+uint64_t
+hashSources(const shader_variant& shader, const shader_sources& sources)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash          = fnv1a(hash, &shader_cache_version, sizeof(shader_cache_version));
+    hash          = fnv1a(hash, std::filesystem::path(shader.source).extension().string());
+    hash          = fnv1a(hash, shader.define ? shader.define : "");
+    hash          = fnv1a(hash, &shader.spirv_1_4, sizeof(shader.spirv_1_4));
+    for (size_t i = 0; i < sources.paths.size(); ++i) {
+        hash = fnv1a(hash, std::filesystem::path(sources.paths[i]).filename().string());
+        hash = fnv1a(hash, sources.texts[i]);
+    }
+    return hash;
+}
+
+// Through a temporary file, so that nothing ever reads half of one
+bool
+writeFile(const std::string& path, const void* data, size_t size)
+{
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write(static_cast<const char*>(data), (std::streamsize)size);
+        if (!file) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    return !error;
+}
+
+#if defined(SHINY_SHADER_COMPILER)
+glslang_stage_t
+shaderStage(const std::string& source)
+{
+    const std::string extension = std::filesystem::path(source).extension().string();
+    if (extension == ".vert") {
+        return GLSLANG_STAGE_VERTEX;
+    }
+    if (extension == ".frag") {
+        return GLSLANG_STAGE_FRAGMENT;
+    }
+    return GLSLANG_STAGE_COMPUTE;
+}
+
+// Includes come out of the files that were read for the hash, so what is compiled is exactly what
+// was hashed even if the files change in the meantime
+glsl_include_result_t*
+includeLocal(void* context, const char* name, const char*, size_t)
+{
+    const auto& sources = *static_cast<const shader_sources*>(context);
+    for (size_t i = 1; i < sources.paths.size(); ++i) {
+        if (std::filesystem::path(sources.paths[i]).filename() == name) {
+            auto result           = new glsl_include_result_t;
+            result->header_name   = sources.paths[i].c_str();
+            result->header_data   = sources.texts[i].data();
+            result->header_length = sources.texts[i].size();
+            return result;
+        }
+    }
+    return nullptr;
+}
+
+int
+freeInclude(void*, glsl_include_result_t* result)
+{
+    delete result;
+    return 0;
+}
+#endif
+
+}  // namespace
+
+namespace shiny::graphics {
+
+bool
+shader_compiler::available()
+{
+#if defined(SHINY_SHADER_COMPILER)
+    return true;
+#else
+    return false;
+#endif
+}
+
+void
+shader_compiler::init(const std::string& cache_directory)
+{
+    m_directory = cache_directory;
+#if defined(SHINY_SHADER_COMPILER)
+    if (!m_initialized) {
+        glslang_initialize_process();
+    }
+#endif
+    m_initialized = true;
+}
+
+void
+shader_compiler::destroy()
+{
+#if defined(SHINY_SHADER_COMPILER)
+    if (m_initialized) {
+        glslang_finalize_process();
+    }
+#endif
+    m_initialized = false;
+}
+
+uint32_t
+shader_compiler::build(jobs::scheduler& jobs)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    std::atomic<uint32_t> failed{ 0 };
+    jobs.parallelFor(0, shader_variant_count, 1, [&](uint32_t first, uint32_t last) {
+        for (uint32_t i = first; i < last; ++i) {
+            if (!update(shader_variants[i])) {
+                ++failed;
+            }
+        }
+    });
+    return failed;
+}
+
+bool
+shader_compiler::rebuild(const std::string& source)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    bool found = false;
+    for (const shader_variant& shader : shader_variants) {
+        shader_sources sources;
+        readSources(shader.source, sources);
+        if (std::find(sources.paths.begin(), sources.paths.end(), source) != sources.paths.end()) {
+            update(shader);
+            found = true;
+        }
+    }
+    return found;
+}
+
+std::vector<std::string>
+shader_compiler::sources() const
+{
+    std::vector<std::string> paths;
+    for (const shader_variant& shader : shader_variants) {
+        shader_sources sources;
+        readSources(shader.source, sources);
+        for (const std::string& path : sources.paths) {
+            if (std::find(paths.begin(), paths.end(), path) == paths.end()) {
+                paths.push_back(path);
+            }
+        }
+    }
+    return paths;
+}
+
+/*
+A shader without its source on disk has nothing to be brought up to date with, which isn't a
+failure: its .spv is loaded as it is, or fails to load if there is none.
+*/
+bool
+shader_compiler::update(const shader_variant& shader) const
+{
+    shader_sources sources;
+    if (!readSources(shader.source, sources)) {
+        return true;
+    }
+
+    std::ostringstream cachepath;
+    if (!m_directory.empty()) {
+        cachepath << m_directory << "/";
+    }
+    cachepath << std::hex << std::setw(16) << std::setfill('0') << hashSources(shader, sources)
+              << ".spv";
+
+    std::string code;
+    if (!readText(cachepath.str(), code) || code.empty()) {
+        // Left as it is
+        if (!available()) {
+            return true;
+        }
+
+        std::vector<uint32_t> words;
+        if (!compile(shader, sources, words)) {
+            return false;
+        }
+        code.assign(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint32_t));
+
+        // Failing to cache it only means it gets compiled again next time
+        std::error_code error;
+        if (!m_directory.empty()) {
+            std::filesystem::create_directories(m_directory, error);
+        }
+        writeFile(cachepath.str(), code.data(), code.size());
+    }
+
+    std::string current;
+    if (readText(shader.output, current) && current == code) {
+        return true;
+    }
+    if (!writeFile(shader.output, code.data(), code.size())) {
+        core::logWarning() << "Failed to write " << shader.output;
+        return false;
+    }
+    core::logInfo() << "Updated " << shader.output;
+    return true;
+}
+
+bool
+shader_compiler::compile(const shader_variant&  shader,
+                         const shader_sources&  sources,
+                         std::vector<uint32_t>& code) const
+{
+#if defined(SHINY_SHADER_COMPILER)
+    SHINY_PROFILE_FUNCTION();
+
+    const glslang_target_client_version_t client =
+      shader.spirv_1_4 ? GLSLANG_TARGET_VULKAN_1_1 : GLSLANG_TARGET_VULKAN_1_0;
+    const glslang_target_language_version_t spirv =
+      shader.spirv_1_4 ? GLSLANG_TARGET_SPV_1_4 : GLSLANG_TARGET_SPV_1_0;
+
+    glslang_input_t input               = {};
+    input.language                      = GLSLANG_SOURCE_GLSL;
+    input.stage                         = shaderStage(shader.source);
+    input.client                        = GLSLANG_CLIENT_VULKAN;
+    input.client_version                = client;
+    input.target_language               = GLSLANG_TARGET_SPV;
+    input.target_language_version       = spirv;
+    input.code                          = sources.texts[0].c_str();
+    input.default_version               = 100;
+    input.default_profile               = GLSLANG_NO_PROFILE;
+    input.messages                      = GLSLANG_MSG_DEFAULT_BIT;
+    input.resource                      = glslang_default_resource();
+    input.callbacks.include_local       = includeLocal;
+    input.callbacks.free_include_result = freeInclude;
+    input.callbacks_ctx                 = const_cast<shader_sources*>(&sources);
+
+    const std::string preamble =
+      shader.define ? std::string("#define ") + shader.define + "\n" : std::string();
+
+    glslang_shader_t* compiled = glslang_shader_create(&input);
+    glslang_shader_set_preamble(compiled, preamble.c_str());
+
+    bool ok = glslang_shader_preprocess(compiled, &input) && glslang_shader_parse(compiled, &input);
+    if (!ok) {
+        core::logWarning() << "Failed to compile " << shader.output << " from " << shader.source
+                           << ":\n"
+                           << glslang_shader_get_info_log(compiled);
+        glslang_shader_delete(compiled);
+        return false;
+    }
+
+    glslang_program_t* program = glslang_program_create();
+    glslang_program_add_shader(program, compiled);
+    ok = glslang_program_link(program, GLSLANG_MSG_SPV_RULES_BIT | GLSLANG_MSG_VULKAN_RULES_BIT);
+    if (ok) {
+        glslang_program_SPIRV_generate(program, input.stage);
+        code.resize(glslang_program_SPIRV_get_size(program));
+        glslang_program_SPIRV_get(program, code.data());
+        core::logInfo() << "Compiled " << shader.output;
+    } else {
+        core::logWarning() << "Failed to link " << shader.output << ":\n"
+                           << glslang_program_get_info_log(program);
+    }
+
+    glslang_program_delete(program);
+    glslang_shader_delete(compiled);
+    return ok && !code.empty();
+#else
+    (void)shader;
+    (void)sources;
+    (void)code;
+    return false;
+#endif
+}
+
+}  // namespace shiny::graphics
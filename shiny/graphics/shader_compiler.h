@@ -0,0 +1,68 @@
+#pragma once
+
+#include "jobs/scheduler.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+// A .spv, and what it is compiled from
+struct shader_variant;
+
+// The files a .spv is compiled from, its source first and then every file it includes
+struct shader_sources;
+
+/*
+Keeps the SPIR-V in shaders/ up to date with the GLSL it is compiled from, so that the .spv files
+don't have to be compiled by hand whenever a shader or an include changes.
+
+Every .spv the renderer loads is listed with the source, stage and defines it is compiled from,
+the same as the project's pre-build step. Its code is cached in `cache_directory` under a hash of
+everything that goes into it: the source, every file it includes, the stage and the defines. A
+shader whose hash is in the cache is only copied over the .spv, if that differs, and one whose
+hash isn't is compiled and added to the cache, so the same code is never compiled twice, whether
+it is changed back and forth or another permutation of it is the same as before.
+
+Compiling needs glslang, which is only built in with SHINY_SHADER_COMPILER defined. Without it
+only the cache is used: a .spv that isn't cached is left as it is, and shipping builds, which have
+no sources next to them, load the .spv files as they are.
+*/
+class shader_compiler
+{
+public:
+    // Whether glslang is built in
+    static bool available();
+
+    // `cache_directory` is created when the first shader is compiled
+    void init(const std::string& cache_directory);
+    void destroy();
+
+    // Brings every .spv whose source is on disk up to date, in parallel on `jobs`. Returns how
+    // many of them couldn't be, which keep their old code, or stay missing.
+    uint32_t build(jobs::scheduler& jobs);
+
+    // Brings every .spv that `source` goes into, as a shader or an include, up to date. Returns
+    // false if `source` isn't any of their sources. Any thread.
+    bool rebuild(const std::string& source);
+
+    // Every shader and include file that goes into a .spv, for watching
+    std::vector<std::string> sources() const;
+
+private:
+    bool update(const shader_variant& shader) const;
+    bool compile(const shader_variant&  shader,
+                 const shader_sources&  sources,
+                 std::vector<uint32_t>& code) const;
+
+    std::string m_directory;
+    bool        m_initialized = false;
+
+    // Rebuilds of the same .spv from different threads, for a source and an include saved
+    // together
+    mutable std::mutex m_mutex;
+};
+
+}  // namespace shiny::graphics
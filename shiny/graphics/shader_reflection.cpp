@@ -0,0 +1,673 @@
+#include "graphics/shader_reflection.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+namespace {
+
+using namespace shiny::graphics;
+
+const uint32_t spirv_magic = 0x07230203;
+
+// The few opcodes, decorations and storage classes that say anything about the interface
+enum : uint32_t
+{
+    op_entry_point        = 15,
+    op_type_bool          = 20,
+    op_type_int           = 21,
+    op_type_float         = 22,
+    op_type_vector        = 23,
+    op_type_matrix        = 24,
+    op_type_image         = 25,
+    op_type_sampler       = 26,
+    op_type_sampled_image = 27,
+    op_type_array         = 28,
+    op_type_runtime_array = 29,
+    op_type_struct        = 30,
+    op_type_pointer       = 32,
+    op_constant           = 43,
+    op_variable           = 59,
+    op_decorate           = 71,
+    op_member_decorate    = 72,
+
+    op_type_acceleration_structure = 5341,  // SPV_KHR_ray_query
+};
+
+enum : uint32_t
+{
+    decoration_block          = 2,
+    decoration_buffer_block   = 3,
+    decoration_array_stride   = 6,
+    decoration_matrix_stride  = 7,
+    decoration_builtin        = 11,
+    decoration_location       = 30,
+    decoration_binding        = 33,
+    decoration_descriptor_set = 34,
+    decoration_offset         = 35,
+};
+
+enum : uint32_t
+{
+    storage_uniform_constant = 0,
+    storage_input            = 1,
+    storage_uniform          = 2,
+    storage_push_constant    = 9,
+    storage_storage_buffer   = 12,
+};
+
+const uint32_t dim_buffer       = 5;
+const uint32_t dim_subpass_data = 6;
+
+// Whatever a result id was declared as, with the operands after the result id
+struct spirv_id
+{
+    uint32_t        opcode   = 0;
+    const uint32_t* operands = nullptr;
+    uint32_t        count    = 0;
+    uint32_t        type     = 0;  // the result type of constants and variables
+
+    uint32_t set          = 0;
+    uint32_t binding      = 0;
+    uint32_t location     = 0;
+    uint32_t array_stride = 0;
+    bool     has_binding  = false;
+    bool     has_location = false;
+    bool     block        = false;
+    bool     buffer_block = false;
+    bool     builtin      = false;
+
+    std::vector<uint32_t> member_offsets;
+    std::vector<uint32_t> member_matrix_strides;
+    bool                  member_builtin = false;
+};
+
+class spirv_module
+{
+public:
+    explicit spirv_module(const std::vector<spirv_id>& ids)
+      : m_ids(ids)
+    {}
+
+    const spirv_id& id(uint32_t i) const
+    {
+        if (i >= m_ids.size()) {
+            throw std::runtime_error("SPIR-V id out of range!");
+        }
+        return m_ids[i];
+    }
+
+    // An operand, checked against the instruction's length
+    uint32_t operand(const spirv_id& declared, uint32_t i) const
+    {
+        if (i >= declared.count) {
+            throw std::runtime_error("SPIR-V instruction too short!");
+        }
+        return declared.operands[i];
+    }
+
+    uint32_t arrayLength(const spirv_id& array) const
+    {
+        const spirv_id& length = id(operand(array, 1));
+        return length.opcode == op_constant ? operand(length, 0) : 1;
+    }
+
+    // In bytes, with the strides and offsets of the block's layout
+    uint32_t size(uint32_t type, uint32_t matrix_stride = 0, uint32_t depth = 0) const
+    {
+        if (depth > 64) {
+            throw std::runtime_error("SPIR-V types nested too deeply!");
+        }
+
+        const spirv_id& t = id(type);
+        switch (t.opcode) {
+        case op_type_bool:
+            return 4;
+        case op_type_int:
+        case op_type_float:
+            return operand(t, 0) / 8;
+        case op_type_vector:
+            return operand(t, 1) * size(operand(t, 0), 0, depth + 1);
+        case op_type_matrix:
+            return operand(t, 1)
+                   * (matrix_stride ? matrix_stride : size(operand(t, 0), 0, depth + 1));
+        case op_type_array: {
+            const uint32_t stride =
+              t.array_stride ? t.array_stride : size(operand(t, 0), 0, depth + 1);
+            return arrayLength(t) * stride;
+        }
+        case op_type_struct: {
+            uint32_t end = 0;
+            for (uint32_t i = 0; i < t.count; ++i) {
+                const uint32_t offset = i < t.member_offsets.size() ? t.member_offsets[i] : 0;
+                const uint32_t stride =
+                  i < t.member_matrix_strides.size() ? t.member_matrix_strides[i] : 0;
+                end = std::max(end, offset + size(t.operands[i], stride, depth + 1));
+            }
+            return end;
+        }
+        default:
+            return 0;  // runtime arrays, which push constants can't have
+        }
+    }
+
+    // The value kind of a scalar or vector type and its component count
+    vk::Format format(uint32_t type) const
+    {
+        const spirv_id& t          = id(type);
+        uint32_t        components = 1;
+        const spirv_id* scalar     = &t;
+        if (t.opcode == op_type_vector) {
+            components = operand(t, 1);
+            scalar     = &id(operand(t, 0));
+        }
+        if (components < 1 || components > 4) {
+            return vk::Format::eUndefined;
+        }
+
+        static const vk::Format float32[] = { vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat,
+                                              vk::Format::eR32G32B32Sfloat,
+                                              vk::Format::eR32G32B32A32Sfloat };
+        static const vk::Format sint32[]  = { vk::Format::eR32Sint, vk::Format::eR32G32Sint,
+                                             vk::Format::eR32G32B32Sint,
+                                             vk::Format::eR32G32B32A32Sint };
+        static const vk::Format uint32[]  = { vk::Format::eR32Uint, vk::Format::eR32G32Uint,
+                                             vk::Format::eR32G32B32Uint,
+                                             vk::Format::eR32G32B32A32Uint };
+        static const vk::Format float64[] = { vk::Format::eR64Sfloat, vk::Format::eR64G64Sfloat,
+                                              vk::Format::eR64G64B64Sfloat,
+                                              vk::Format::eR64G64B64A64Sfloat };
+        static const vk::Format sint64[]  = { vk::Format::eR64Sint, vk::Format::eR64G64Sint,
+                                             vk::Format::eR64G64B64Sint,
+                                             vk::Format::eR64G64B64A64Sint };
+        static const vk::Format uint64[]  = { vk::Format::eR64Uint, vk::Format::eR64G64Uint,
+                                             vk::Format::eR64G64B64Uint,
+                                             vk::Format::eR64G64B64A64Uint };
+
+        if (scalar->opcode == op_type_float) {
+            const bool wide = operand(*scalar, 0) == 64;
+            return (wide ? float64 : float32)[components - 1];
+        }
+        if (scalar->opcode == op_type_int) {
+            const bool wide = operand(*scalar, 0) == 64;
+            const bool sign = operand(*scalar, 1) != 0;
+            return (sign ? (wide ? sint64 : sint32) : (wide ? uint64 : uint32))[components - 1];
+        }
+        return vk::Format::eUndefined;
+    }
+
+    // One location per vector, so matrices and arrays take several
+    uint32_t addInputs(uint32_t                      type,
+                       uint32_t                      location,
+                       std::vector<reflected_input>& out,
+                       uint32_t                      depth = 0) const
+    {
+        if (depth > 64) {
+            throw std::runtime_error("SPIR-V types nested too deeply!");
+        }
+
+        const spirv_id& t = id(type);
+        if (t.opcode == op_type_matrix || t.opcode == op_type_array) {
+            const uint32_t length = t.opcode == op_type_matrix ? operand(t, 1) : arrayLength(t);
+            uint32_t       used   = 0;
+            for (uint32_t i = 0; i < length; ++i) {
+                used += addInputs(operand(t, 0), location + used, out, depth + 1);
+            }
+            return used;
+        }
+
+        reflected_input input;
+        input.location = location;
+        input.format   = format(type);
+        out.push_back(input);
+        return 1;
+    }
+
+    // False for variables that aren't descriptors
+    bool descriptor(uint32_t type, uint32_t storage, vk::DescriptorType& out, uint32_t& count) const
+    {
+        count = 1;
+
+        const spirv_id* t = &id(type);
+        for (uint32_t depth = 0; t->opcode == op_type_array || t->opcode == op_type_runtime_array;
+             ++depth) {
+            if (depth > 64) {
+                throw std::runtime_error("SPIR-V types nested too deeply!");
+            }
+            count = t->opcode == op_type_array ? count * arrayLength(*t) : 0;
+            t     = &id(operand(*t, 0));
+        }
+
+        switch (t->opcode) {
+        case op_type_struct:
+            if (storage == storage_storage_buffer || t->buffer_block) {
+                out = vk::DescriptorType::eStorageBuffer;
+                return true;
+            }
+            if (storage == storage_uniform && t->block) {
+                out = vk::DescriptorType::eUniformBuffer;
+                return true;
+            }
+            return false;
+        case op_type_sampled_image:
+            out = vk::DescriptorType::eCombinedImageSampler;
+            return true;
+        case op_type_sampler:
+            out = vk::DescriptorType::eSampler;
+            return true;
+        case op_type_image: {
+            const uint32_t dim     = operand(*t, 1);
+            const uint32_t sampled = operand(*t, 5);
+            if (dim == dim_buffer) {
+                out = sampled == 2 ? vk::DescriptorType::eStorageTexelBuffer
+                                   : vk::DescriptorType::eUniformTexelBuffer;
+            } else if (dim == dim_subpass_data) {
+                out = vk::DescriptorType::eInputAttachment;
+            } else {
+                out = sampled == 2 ? vk::DescriptorType::eStorageImage
+                                   : vk::DescriptorType::eSampledImage;
+            }
+            return true;
+        }
+#if defined(VK_KHR_acceleration_structure)
+        case op_type_acceleration_structure:
+            out = vk::DescriptorType::eAccelerationStructureKHR;
+            return true;
+#endif
+        default:
+            return false;
+        }
+    }
+
+private:
+    const std::vector<spirv_id>& m_ids;
+};
+
+vk::ShaderStageFlags
+executionStage(uint32_t model)
+{
+    switch (model) {
+    case 0:
+        return vk::ShaderStageFlagBits::eVertex;
+    case 1:
+        return vk::ShaderStageFlagBits::eTessellationControl;
+    case 2:
+        return vk::ShaderStageFlagBits::eTessellationEvaluation;
+    case 3:
+        return vk::ShaderStageFlagBits::eGeometry;
+    case 4:
+        return vk::ShaderStageFlagBits::eFragment;
+    case 5:
+        return vk::ShaderStageFlagBits::eCompute;
+    default:
+        return {};
+    }
+}
+
+enum class numeric
+{
+    floating,
+    signed_integer,
+    unsigned_integer,
+};
+
+// Normalized and scaled formats are read as floats, only the integer ones aren't
+numeric
+numericType(vk::Format format)
+{
+    switch (format) {
+    case vk::Format::eR8Sint:
+    case vk::Format::eR8G8Sint:
+    case vk::Format::eR8G8B8Sint:
+    case vk::Format::eR8G8B8A8Sint:
+    case vk::Format::eA2B10G10R10SintPack32:
+    case vk::Format::eR16Sint:
+    case vk::Format::eR16G16Sint:
+    case vk::Format::eR16G16B16Sint:
+    case vk::Format::eR16G16B16A16Sint:
+    case vk::Format::eR32Sint:
+    case vk::Format::eR32G32Sint:
+    case vk::Format::eR32G32B32Sint:
+    case vk::Format::eR32G32B32A32Sint:
+    case vk::Format::eR64Sint:
+    case vk::Format::eR64G64Sint:
+    case vk::Format::eR64G64B64Sint:
+    case vk::Format::eR64G64B64A64Sint:
+        return numeric::signed_integer;
+    case vk::Format::eR8Uint:
+    case vk::Format::eR8G8Uint:
+    case vk::Format::eR8G8B8Uint:
+    case vk::Format::eR8G8B8A8Uint:
+    case vk::Format::eA2B10G10R10UintPack32:
+    case vk::Format::eR16Uint:
+    case vk::Format::eR16G16Uint:
+    case vk::Format::eR16G16B16Uint:
+    case vk::Format::eR16G16B16A16Uint:
+    case vk::Format::eR32Uint:
+    case vk::Format::eR32G32Uint:
+    case vk::Format::eR32G32B32Uint:
+    case vk::Format::eR32G32B32A32Uint:
+    case vk::Format::eR64Uint:
+    case vk::Format::eR64G64Uint:
+    case vk::Format::eR64G64B64Uint:
+    case vk::Format::eR64G64B64A64Uint:
+        return numeric::unsigned_integer;
+    default:
+        return numeric::floating;
+    }
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+bool
+reflected_binding::operator==(const reflected_binding& other) const
+{
+    return set == other.set && binding == other.binding && type == other.type
+           && count == other.count && stages == other.stages;
+}
+
+bool
+reflected_input::operator==(const reflected_input& other) const
+{
+    return location == other.location && format == other.format;
+}
+
+bool
+shader_reflection::operator==(const shader_reflection& other) const
+{
+    return stages == other.stages && bindings == other.bindings
+           && push_constants == other.push_constants && inputs == other.inputs;
+}
+
+/*
+Two passes: the first records what every id was declared as and how it's decorated, which may come
+in any order relative to each other, and the second looks at the variables with all of that known.
+The structure of the code isn't validated beyond what's needed to not read out of bounds, the
+driver does that when the module is created.
+*/
+bool
+reflectShader(const uint32_t* code, size_t size, shader_reflection& out)
+{
+    out = shader_reflection();
+
+    const size_t words = size / 4;
+    if (words < 5 || code[0] != spirv_magic) {
+        return false;
+    }
+
+    const uint32_t bound = code[3];
+    if (bound > words) {
+        return false;  // every id takes a word to declare, so the bound can't be larger
+    }
+
+    std::vector<spirv_id> ids(bound);
+    std::vector<uint32_t> variables;
+    bool                  entry = false;
+
+    try {
+        auto at = [&](uint32_t i) -> spirv_id& {
+            if (i >= bound) {
+                throw std::runtime_error("SPIR-V id out of range!");
+            }
+            return ids[i];
+        };
+
+        for (size_t i = 5; i < words;) {
+            const uint32_t length = code[i] >> 16;
+            const uint32_t opcode = code[i] & 0xffff;
+            if (length == 0 || i + length > words) {
+                return false;
+            }
+            const uint32_t* op = code + i;
+            i += length;
+
+            switch (opcode) {
+            case op_entry_point:
+                // Only one per module is supported, as glslang compiles them
+                if (!entry && length >= 2) {
+                    out.stages = executionStage(op[1]);
+                    entry      = true;
+                }
+                break;
+            case op_type_bool:
+            case op_type_int:
+            case op_type_float:
+            case op_type_vector:
+            case op_type_matrix:
+            case op_type_image:
+            case op_type_sampler:
+            case op_type_sampled_image:
+            case op_type_array:
+            case op_type_runtime_array:
+            case op_type_struct:
+            case op_type_pointer:
+            case op_type_acceleration_structure:
+                if (length >= 2) {
+                    spirv_id& declared = at(op[1]);
+                    declared.opcode    = opcode;
+                    declared.operands  = op + 2;
+                    declared.count     = length - 2;
+                }
+                break;
+            case op_constant:
+            case op_variable:
+                if (length >= 3) {
+                    spirv_id& declared = at(op[2]);
+                    declared.opcode    = opcode;
+                    declared.type      = op[1];
+                    declared.operands  = op + 3;
+                    declared.count     = length - 3;
+                    if (opcode == op_variable) {
+                        variables.push_back(op[2]);
+                    }
+                }
+                break;
+            case op_decorate:
+                if (length >= 3) {
+                    spirv_id&      target  = at(op[1]);
+                    const uint32_t literal = length >= 4 ? op[3] : 0;
+                    switch (op[2]) {
+                    case decoration_block:
+                        target.block = true;
+                        break;
+                    case decoration_buffer_block:
+                        target.buffer_block = true;
+                        break;
+                    case decoration_array_stride:
+                        target.array_stride = literal;
+                        break;
+                    case decoration_builtin:
+                        target.builtin = true;
+                        break;
+                    case decoration_location:
+                        target.location     = literal;
+                        target.has_location = true;
+                        break;
+                    case decoration_binding:
+                        target.binding     = literal;
+                        target.has_binding = true;
+                        break;
+                    case decoration_descriptor_set:
+                        target.set = literal;
+                        break;
+                    }
+                }
+                break;
+            case op_member_decorate:
+                if (length >= 4) {
+                    spirv_id&      target  = at(op[1]);
+                    const uint32_t member  = op[2];
+                    const uint32_t literal = length >= 5 ? op[4] : 0;
+                    if (member >= bound) {
+                        return false;
+                    }
+                    if (op[3] == decoration_offset) {
+                        target.member_offsets.resize(
+                          std::max<size_t>(target.member_offsets.size(), member + 1));
+                        target.member_offsets[member] = literal;
+                    } else if (op[3] == decoration_matrix_stride) {
+                        target.member_matrix_strides.resize(
+                          std::max<size_t>(target.member_matrix_strides.size(), member + 1));
+                        target.member_matrix_strides[member] = literal;
+                    } else if (op[3] == decoration_builtin) {
+                        target.member_builtin = true;
+                    }
+                }
+                break;
+            }
+        }
+        if (!entry) {
+            return false;
+        }
+
+        const spirv_module spirv(ids);
+
+        for (uint32_t v : variables) {
+            const spirv_id& variable = spirv.id(v);
+            const spirv_id& pointer  = spirv.id(variable.type);
+            if (pointer.opcode != op_type_pointer) {
+                return false;
+            }
+            const uint32_t storage = spirv.operand(pointer, 0);
+            const uint32_t type    = spirv.operand(pointer, 1);
+
+            if (storage == storage_push_constant) {
+                const spirv_id& block = spirv.id(type);
+
+                uint32_t offset = 0;
+                if (!block.member_offsets.empty()) {
+                    offset = *std::min_element(block.member_offsets.begin(),
+                                               block.member_offsets.end());
+                }
+                const uint32_t end = spirv.size(type);
+
+                // Ranges are in multiples of 4 bytes
+                out.push_constants.push_back(vk::PushConstantRange()
+                                               .setStageFlags(out.stages)
+                                               .setOffset(offset & ~3u)
+                                               .setSize(((end + 3) & ~3u) - (offset & ~3u)));
+            } else if (storage == storage_uniform_constant || storage == storage_uniform
+                       || storage == storage_storage_buffer) {
+                reflected_binding binding;
+                if (!variable.has_binding
+                    || !spirv.descriptor(type, storage, binding.type, binding.count)) {
+                    continue;
+                }
+                binding.set     = variable.set;
+                binding.binding = variable.binding;
+                binding.stages  = out.stages;
+                out.bindings.push_back(binding);
+            } else if (storage == storage_input && out.stages == vk::ShaderStageFlagBits::eVertex
+                       && variable.has_location && !variable.builtin) {
+                const spirv_id& pointee = spirv.id(type);
+                if (!pointee.member_builtin) {
+                    spirv.addInputs(type, variable.location, out.inputs);
+                }
+            }
+        }
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+
+    std::sort(out.bindings.begin(), out.bindings.end(),
+              [](const reflected_binding& a, const reflected_binding& b) {
+                  return std::tie(a.set, a.binding) < std::tie(b.set, b.binding);
+              });
+    std::sort(out.inputs.begin(), out.inputs.end(),
+              [](const reflected_input& a, const reflected_input& b) {
+                  return a.location < b.location;
+              });
+    return true;
+}
+
+void
+mergeReflection(shader_reflection& into, const shader_reflection& other)
+{
+    into.stages |= other.stages;
+
+    for (const reflected_binding& binding : other.bindings) {
+        auto found = std::find_if(into.bindings.begin(), into.bindings.end(),
+                                  [&](const reflected_binding& b) {
+                                      return b.set == binding.set && b.binding == binding.binding;
+                                  });
+        if (found == into.bindings.end()) {
+            into.bindings.push_back(binding);
+            continue;
+        }
+        if (found->type != binding.type || found->count != binding.count) {
+            throw std::runtime_error("shaders disagree about descriptor set "
+                                     + std::to_string(binding.set) + " binding "
+                                     + std::to_string(binding.binding) + "!");
+        }
+        found->stages |= binding.stages;
+    }
+    std::sort(into.bindings.begin(), into.bindings.end(),
+              [](const reflected_binding& a, const reflected_binding& b) {
+                  return std::tie(a.set, a.binding) < std::tie(b.set, b.binding);
+              });
+
+    // Stages may share a range, but no stage may be in two
+    for (const vk::PushConstantRange& range : other.push_constants) {
+        auto found = std::find_if(into.push_constants.begin(), into.push_constants.end(),
+                                  [&](const vk::PushConstantRange& r) {
+                                      return r.offset == range.offset && r.size == range.size;
+                                  });
+        if (found != into.push_constants.end()) {
+            found->stageFlags |= range.stageFlags;
+        } else {
+            into.push_constants.push_back(range);
+        }
+    }
+
+    if (into.inputs.empty()) {
+        into.inputs = other.inputs;
+    }
+}
+
+std::vector<vk::DescriptorSetLayoutBinding>
+reflectedSetBindings(const shader_reflection& reflection, uint32_t set)
+{
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;
+    for (const reflected_binding& binding : reflection.bindings) {
+        if (binding.set == set) {
+            bindings.push_back(vk::DescriptorSetLayoutBinding()
+                                 .setBinding(binding.binding)
+                                 .setDescriptorType(binding.type)
+                                 .setDescriptorCount(binding.count)
+                                 .setStageFlags(binding.stages));
+        }
+    }
+    return bindings;
+}
+
+std::vector<vk::VertexInputAttributeDescription>
+matchVertexInputs(const shader_reflection&                   vertex,
+                  const vk::VertexInputAttributeDescription* attributes,
+                  uint32_t                                   count)
+{
+    std::vector<vk::VertexInputAttributeDescription> used;
+    for (const reflected_input& input : vertex.inputs) {
+        const vk::VertexInputAttributeDescription* found =
+          std::find_if(attributes, attributes + count,
+                       [&](const vk::VertexInputAttributeDescription& attribute) {
+                           return attribute.location == input.location;
+                       });
+        if (found == attributes + count) {
+            throw std::runtime_error("vertex shader reads location "
+                                     + std::to_string(input.location)
+                                     + ", which the vertex format doesn't have!");
+        }
+        if (numericType(found->format) != numericType(input.format)) {
+            throw std::runtime_error("vertex shader reads location "
+                                     + std::to_string(input.location)
+                                     + " as a different type than the vertex format stores!");
+        }
+        used.push_back(*found);
+    }
+    return used;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,79 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+struct reflected_binding
+{
+    uint32_t             set     = 0;
+    uint32_t             binding = 0;
+    vk::DescriptorType   type    = vk::DescriptorType::eUniformBuffer;
+    uint32_t             count   = 1;  // 0 for a runtime array, whose size is up to the layout
+    vk::ShaderStageFlags stages;
+
+    bool operator==(const reflected_binding& other) const;
+};
+
+struct reflected_input
+{
+    uint32_t   location = 0;
+    vk::Format format   = vk::Format::eUndefined;  // the 32 or 64 bit format of the shader's type
+
+    bool operator==(const reflected_input& other) const;
+};
+
+/*
+The interface of one or more shaders, as far as the layouts they are used with are concerned.
+Whether a buffer is bound with a dynamic offset, and how large a runtime array is, can't be told
+from the code, so those are left to whoever creates the layouts.
+*/
+struct shader_reflection
+{
+    vk::ShaderStageFlags               stages;
+    std::vector<reflected_binding>     bindings;        // by set, then binding
+    std::vector<vk::PushConstantRange> push_constants;  // one per block, at most one per stage
+    std::vector<reflected_input>       inputs;          // of the vertex shader only, by location
+
+    bool operator==(const shader_reflection& other) const;
+};
+
+/*
+Reads the descriptor bindings, push constant block and, for a vertex shader, the vertex inputs out
+of SPIR-V code, from the decorations every variable of those kinds must have. Returns false if the
+code isn't SPIR-V or has no entry point.
+
+Only the instructions declaring types, variables and decorations are looked at, so variables the
+shader declares but never uses are part of its interface too.
+*/
+bool reflectShader(const uint32_t* code, size_t size, shader_reflection& out);
+
+/*
+Adds another shader's interface, for the layouts of pipelines made of several shaders or of several
+pipelines sharing one layout. Throws if the two disagree about what a binding is.
+*/
+void mergeReflection(shader_reflection& into, const shader_reflection& other);
+
+std::vector<vk::DescriptorSetLayoutBinding> reflectedSetBindings(
+  const shader_reflection& reflection,
+  uint32_t                 set);
+
+/*
+Picks the attributes of a vertex format that a vertex shader reads, by location. The format's own
+table still says where its members are and what they are stored as, which the shader can't know;
+what it checks is that the shader reads nothing the format doesn't have, and that floats are read
+as floats and integers as integers. Throws otherwise.
+*/
+std::vector<vk::VertexInputAttributeDescription> matchVertexInputs(
+  const shader_reflection&                   vertex,
+  const vk::VertexInputAttributeDescription* attributes,
+  uint32_t                                   count);
+
+}  // namespace shiny::graphics
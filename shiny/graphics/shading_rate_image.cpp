@@ -0,0 +1,283 @@
+#include "graphics/shading_rate_image.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+namespace {
+
+// What the attachment's texels hold. Every device with attachmentFragmentShadingRate can attach it,
+// but not every one can store to it, see supported().
+const vk::Format rate_format = vk::Format::eR8Uint;
+
+// The contrast, the standard deviation of a tile's lightness over its mean, below which it is
+// shaded at 2x2 at quality 0. Less of it is coarsened the higher the quality.
+const float max_contrast = 0.25f;
+
+// Pixels a frame a tile has to move to be shaded coarser at quality 0, and more the higher it is
+const float min_motion = 2.f;
+
+// The shader's push constants
+struct rate_constants
+{
+    int32_t  width        = 0;
+    int32_t  height       = 0;
+    int32_t  texel_width  = 0;
+    int32_t  texel_height = 0;
+    float    threshold    = 0.f;
+    float    motion       = 0.f;
+    uint32_t max_rate     = 0;
+    uint32_t use_motion   = 0;
+};
+
+uint32_t
+log2(uint32_t size)
+{
+    uint32_t result = 0;
+    while (size > 1) {
+        size >>= 1;
+        ++result;
+    }
+    return result;
+}
+
+uint32_t
+texels(uint32_t size, uint32_t texel)
+{
+    return (size + texel - 1) / texel;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+bool
+shading_rate_image::supported(vk::PhysicalDevice device)
+{
+    const vk::FormatFeatureFlags needed =
+      vk::FormatFeatureFlagBits::eStorageImage
+      | vk::FormatFeatureFlagBits::eFragmentShadingRateAttachmentKHR;
+    return (device.getFormatProperties(rate_format).optimalTilingFeatures & needed) == needed;
+}
+
+void
+shading_rate_image::init(vk::Device        device,
+                         memory_allocator& allocator,
+                         layout_cache&     layouts,
+                         view_cache&       views,
+                         pipeline_cache&   pipelines,
+                         vk::Extent2D      texel,
+                         vk::Extent2D      max_fragment)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_texel     = texel;
+
+    // Square rates only, up to 4x4, which is as coarse as the attachment's encoding goes
+    m_max_rate = std::min(log2(std::min(max_fragment.width, max_fragment.height)), 2u);
+
+    auto binding = [](uint32_t number, vk::DescriptorType type) {
+        return vk::DescriptorSetLayoutBinding()
+          .setBinding(number)
+          .setDescriptorCount(1)
+          .setDescriptorType(type)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    };
+
+    // 0: the frame, 1: the motion vectors, or the frame again without them, 2: the rates
+    std::array<vk::DescriptorSetLayoutBinding, 3> bindings = {
+        binding(0, vk::DescriptorType::eCombinedImageSampler),
+        binding(1, vk::DescriptorType::eCombinedImageSampler),
+        binding(2, vk::DescriptorType::eStorageImage),
+    };
+
+    m_set_layout = layouts.descriptorSetLayout(vk::DescriptorSetLayoutCreateInfo()
+                                                 .setBindingCount((uint32_t)bindings.size())
+                                                 .setPBindings(bindings.data()));
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                       .setOffset(0)
+                       .setSize(sizeof(rate_constants));
+
+    m_layout = layouts.pipelineLayout(vk::PipelineLayoutCreateInfo()
+                                        .setSetLayoutCount(1)
+                                        .setPSetLayouts(&m_set_layout)
+                                        .setPushConstantRangeCount(1)
+                                        .setPPushConstantRanges(&constants));
+
+    core::mapped_file code("shaders/shading_rate_comp.spv");
+
+    auto shaderinfo = vk::ShaderModuleCreateInfo()
+                        .setCodeSize(code.size())
+                        .setPCode((const uint32_t*)code.data());
+
+    m_shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+    auto pipelineinfo = vk::ComputePipelineCreateInfo()
+                          .setStage(vk::PipelineShaderStageCreateInfo()
+                                      .setStage(vk::ShaderStageFlagBits::eCompute)
+                                      .setModule(m_shader)
+                                      .setPName("main"))
+                          .setLayout(m_layout);
+
+    m_pipeline = m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+
+    // Only ever read texel by texel
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(vk::Filter::eNearest)
+                         .setMinFilter(vk::Filter::eNearest)
+                         .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                         .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setMinLod(0.f)
+                         .setMaxLod(0.f);
+
+    m_sampler = views.sampler(samplerinfo);
+}
+
+void
+shading_rate_image::destroy()
+{
+    m_device.destroyImageView(m_view, hostAllocator());
+    m_device.destroyImage(m_image, hostAllocator());
+    m_allocator->free(m_memory);
+    m_descriptors.destroy();
+
+    m_device.destroyPipeline(m_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_shader, hostAllocator());
+
+    m_view  = nullptr;
+    m_image = nullptr;
+}
+
+/*
+The rates are only valid for the resolution they were made at, so none are used until the first
+frame at the new one has written them
+*/
+void
+shading_rate_image::create(vk::Extent2D    extent,
+                           vk::ImageView   color,
+                           vk::ImageView   motion,
+                           deletion_queue& deletions,
+                           uint64_t        frame)
+{
+    retire(deletions, frame);
+
+    m_extent = extent;
+    m_motion = (bool)motion;
+    m_valid  = false;
+
+    auto imageinfo =
+      vk::ImageCreateInfo()
+        .setImageType(vk::ImageType::e2D)
+        .setExtent(vk::Extent3D(texels(extent.width, m_texel.width),
+                                texels(extent.height, m_texel.height), 1))
+        .setMipLevels(1)
+        .setArrayLayers(1)
+        .setFormat(rate_format)
+        .setTiling(vk::ImageTiling::eOptimal)
+        .setInitialLayout(vk::ImageLayout::eUndefined)
+        .setUsage(vk::ImageUsageFlagBits::eStorage
+                  | vk::ImageUsageFlagBits::eFragmentShadingRateAttachmentKHR)
+        .setSamples(vk::SampleCountFlagBits::e1)
+        .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_image  = m_device.createImage(imageinfo, hostAllocator());
+    m_memory = m_allocator->allocate(m_device.getImageMemoryRequirements(m_image),
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                     memory_allocator::resource_kind::optimal,
+                                     memory_category::render_target);
+    m_device.bindImageMemory(m_image, m_memory.memory, m_memory.offset);
+
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(m_image)
+                      .setViewType(vk::ImageViewType::e2D)
+                      .setFormat(rate_format)
+                      .setSubresourceRange(
+                        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+    m_view = m_device.createImageView(viewinfo, hostAllocator());
+
+    m_descriptors.init(m_device,
+                       { { vk::DescriptorType::eCombinedImageSampler, 2 },
+                         { vk::DescriptorType::eStorageImage, 1 } },
+                       1);
+    m_set = m_descriptors.allocate(m_set_layout);
+
+    auto colorinfo =
+      vk::DescriptorImageInfo(m_sampler, color, vk::ImageLayout::eShaderReadOnlyOptimal);
+    auto motioninfo =
+      m_motion ? vk::DescriptorImageInfo(m_sampler, motion, vk::ImageLayout::eGeneral) : colorinfo;
+    auto rateinfo = vk::DescriptorImageInfo(nullptr, m_view, vk::ImageLayout::eGeneral);
+
+    auto write = [&](uint32_t binding, vk::DescriptorType type,
+                     const vk::DescriptorImageInfo& info) {
+        return vk::WriteDescriptorSet()
+          .setDstSet(m_set)
+          .setDstBinding(binding)
+          .setDescriptorCount(1)
+          .setDescriptorType(type)
+          .setPImageInfo(&info);
+    };
+
+    const std::array<vk::WriteDescriptorSet, 3> writes = {
+        write(0, vk::DescriptorType::eCombinedImageSampler, colorinfo),
+        write(1, vk::DescriptorType::eCombinedImageSampler, motioninfo),
+        write(2, vk::DescriptorType::eStorageImage, rateinfo),
+    };
+    m_device.updateDescriptorSets(writes, nullptr);
+}
+
+// At quality 1 neither test ever passes, so every tile is shaded at 1x1
+void
+shading_rate_image::record(vk::CommandBuffer command_buffer, float quality)
+{
+    const float q = std::clamp(quality, 0.f, 1.f);
+
+    rate_constants constants;
+    constants.width        = (int32_t)m_extent.width;
+    constants.height       = (int32_t)m_extent.height;
+    constants.texel_width  = (int32_t)m_texel.width;
+    constants.texel_height = (int32_t)m_texel.height;
+    constants.threshold    = max_contrast * (1.f - q);
+    constants.motion       = q < 1.f ? min_motion / (1.f - q) : std::numeric_limits<float>::max();
+    constants.max_rate     = m_max_rate;
+    constants.use_motion   = m_motion ? 1 : 0;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, 0, m_set,
+                                      nullptr);
+    command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants),
+                                 &constants);
+    command_buffer.dispatch(texels(m_extent.width, m_texel.width),
+                            texels(m_extent.height, m_texel.height), 1);
+
+    m_valid = true;
+}
+
+// The frames in flight may still be rendering with the old rates
+void
+shading_rate_image::retire(deletion_queue& deletions, uint64_t frame)
+{
+    if (!m_image) {
+        return;
+    }
+
+    deletions.push(frame, m_view);
+    deletions.push(frame, m_image);
+    deletions.push(frame, m_memory);
+
+    descriptor_allocator old = m_descriptors;
+    deletions.pushAction(frame, [old]() mutable { old.destroy(); });
+
+    m_descriptors = descriptor_allocator();
+    m_view        = nullptr;
+    m_image       = nullptr;
+    m_memory      = allocation();
+}
+
+}  // namespace shiny::graphics
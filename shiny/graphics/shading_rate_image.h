@@ -0,0 +1,90 @@
+#pragma once
+
+#include "graphics/deletion_queue.h"
+#include "graphics/descriptor_allocator.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/view_cache.h"
+
+#include <cstdint>
+
+namespace shiny::graphics {
+
+/*
+A fragment shading rate attachment made from the frame just rendered, for the frame after it: each
+texel covers a tile of the framebuffer and says how coarsely its fragments are shaded. Tiles whose
+luminance hardly varies get 2x2 fragments, those that vary even less 4x4 where the device has them,
+and tiles that moved quickly since the frame before, by the temporal upscaler's motion vectors, one
+step coarser on top of that, since whatever detail they had is smeared by the motion anyway.
+
+One compute pass, recorded after the frame's color, and its motion vectors if there are any, are
+done being written. Every workgroup reduces a tile to its mean and variance in shared memory. The
+frame is only one frame behind, so what was uncovered since is shaded at whatever rate was there.
+*/
+class shading_rate_image
+{
+public:
+    // Whether the device can both store to and attach the image's format, on top of having
+    // attachmentFragmentShadingRate
+    static bool supported(vk::PhysicalDevice device);
+
+    // `texel` is the tile size, a power of 2 from 8 to 32 within the device's limits, and
+    // `max_fragment` the coarsest rate in pixels, of which only squares are used
+    void init(vk::Device        device,
+              memory_allocator& allocator,
+              layout_cache&     layouts,
+              view_cache&       views,
+              pipeline_cache&   pipelines,
+              vk::Extent2D      texel,
+              vk::Extent2D      max_fragment);
+    void destroy();
+
+    // Creates the rates for frames of `extent` rendered into `color`, with `motion` as the motion
+    // vectors or null without them, retiring the old ones with `frame`
+    void create(vk::Extent2D    extent,
+                vk::ImageView   color,
+                vk::ImageView   motion,
+                deletion_queue& deletions,
+                uint64_t        frame);
+
+    // Records the pass. `quality` goes from 0, as coarse as the frame allows, to 1, which shades
+    // every pixel. The color and motion vectors have to be in
+    // VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and VK_IMAGE_LAYOUT_GENERAL, visible to compute
+    // shaders, as does whatever used the rates before have to be done, see render_graph.
+    void record(vk::CommandBuffer command_buffer, float quality);
+
+    // Whether the rates have been written since they were created, i.e. are worth rendering with
+    bool valid() const { return m_valid; }
+
+    // In VK_IMAGE_LAYOUT_GENERAL when written, and attached in
+    // VK_IMAGE_LAYOUT_FRAGMENT_SHADING_RATE_ATTACHMENT_OPTIMAL_KHR. Undefined once created.
+    vk::Image     image() const { return m_image; }
+    vk::ImageView view() const { return m_view; }
+    vk::Extent2D  texelSize() const { return m_texel; }
+
+private:
+    void retire(deletion_queue& deletions, uint64_t frame);
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::DescriptorSetLayout m_set_layout;  // owned by the layout_cache
+    vk::PipelineLayout      m_layout;
+    vk::ShaderModule        m_shader;
+    vk::Pipeline            m_pipeline;
+    vk::Sampler             m_sampler;  // owned by the view_cache
+
+    vk::Image            m_image;
+    allocation           m_memory;
+    vk::ImageView        m_view;
+    descriptor_allocator m_descriptors;  // a new one with every image
+    vk::DescriptorSet    m_set;
+    vk::Extent2D         m_extent;  // of the frame
+    vk::Extent2D         m_texel;
+    uint32_t             m_max_rate = 1;  // log2 of the coarsest fragment's side
+    bool                 m_motion   = false;
+    bool                 m_valid    = false;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,531 @@
+#include "graphics/shadow_cascades.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Every device can sample and render to it, and over the depth range of a cascade it's well
+// below a millimetre
+const vk::Format shadow_format = vk::Format::eD16Unorm;
+
+// How far the cascades reach back towards the light beyond their spheres, for casters in between
+const float shadow_caster_distance = 20.f;
+
+// Between spacing the cascades' ranges evenly, 0, and logarithmically, 1
+const float shadow_split_blend = 0.75f;
+
+// In units of the depth format, and of the slope of the triangle's depth
+const float shadow_depth_bias       = 1.25f;
+const float shadow_depth_bias_slope = 1.75f;
+
+uint64_t
+fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Right handed and looking down -z, to Vulkan's depth range of 0 to 1
+glm::mat4
+orthographic(float left, float right, float bottom, float top, float nearplane, float farplane)
+{
+    glm::mat4 result(1.f);
+    result[0][0] = 2.f / (right - left);
+    result[1][1] = 2.f / (top - bottom);
+    result[2][2] = -1.f / (farplane - nearplane);
+    result[3][0] = -(right + left) / (right - left);
+    result[3][1] = -(top + bottom) / (top - bottom);
+    result[3][2] = -nearplane / (farplane - nearplane);
+    return result;
+}
+
+// Looking along `forward` from the origin
+glm::mat4
+lightRotation(const glm::vec3& forward)
+{
+    const glm::vec3 up    = std::abs(forward.z) < 0.99f ? glm::vec3(0.f, 0.f, 1.f)
+                                                        : glm::vec3(0.f, 1.f, 0.f);
+    const glm::vec3 side  = glm::normalize(glm::cross(forward, up));
+    const glm::vec3 above = glm::cross(side, forward);
+
+    glm::mat4 result(1.f);
+    for (int i = 0; i < 3; ++i) {
+        result[i][0] = side[i];
+        result[i][1] = above[i];
+        result[i][2] = -forward[i];
+    }
+    return result;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+shadow_cascades::init(vk::PhysicalDevice                      physical_device,
+                      vk::Device                              device,
+                      memory_allocator&                       allocator,
+                      layout_cache&                           layouts,
+                      view_cache&                             views,
+                      pipeline_cache&                         pipelines,
+                      const std::vector<shadow_vertex_input>& inputs,
+                      uint32_t                                frames,
+                      uint32_t                                resolution)
+{
+    m_device     = device;
+    m_allocator = &allocator;
+    m_frames    = frames;
+
+    // The layers are cleared and stored on their own, and stay in the layout the render graph
+    // put the whole image in, so the ones that aren't rendered keep what they had
+    auto attachment = vk::AttachmentDescription()
+                        .setFormat(shadow_format)
+                        .setSamples(vk::SampleCountFlagBits::e1)
+                        .setLoadOp(vk::AttachmentLoadOp::eClear)
+                        .setStoreOp(vk::AttachmentStoreOp::eStore)
+                        .setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+                        .setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+                        .setInitialLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal)
+                        .setFinalLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    auto depthreference =
+      vk::AttachmentReference(0, vk::ImageLayout::eDepthStencilAttachmentOptimal);
+
+    auto subpass = vk::SubpassDescription()
+                     .setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+                     .setPDepthStencilAttachment(&depthreference);
+
+    auto renderpassinfo = vk::RenderPassCreateInfo()
+                            .setAttachmentCount(1)
+                            .setPAttachments(&attachment)
+                            .setSubpassCount(1)
+                            .setPSubpasses(&subpass);
+
+    m_render_pass = m_device.createRenderPass(renderpassinfo, hostAllocator());
+
+    createMap(resolution);
+
+    // Depth comparisons, filtered where the device can, so every lookup is already a 2x2 PCF.
+    // Outside of the cascade is lit.
+    const bool linear = (bool)(physical_device.getFormatProperties(shadow_format)
+                                 .optimalTilingFeatures
+                               & vk::FormatFeatureFlagBits::eSampledImageFilterLinear);
+    const vk::Filter filter = linear ? vk::Filter::eLinear : vk::Filter::eNearest;
+
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(filter)
+                         .setMinFilter(filter)
+                         .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                         .setAddressModeU(vk::SamplerAddressMode::eClampToBorder)
+                         .setAddressModeV(vk::SamplerAddressMode::eClampToBorder)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setBorderColor(vk::BorderColor::eFloatOpaqueWhite)
+                         .setCompareEnable(true)
+                         .setCompareOp(vk::CompareOp::eLessOrEqual)
+                         .setMinLod(0.f)
+                         .setMaxLod(0.f);
+
+    m_sampler = views.sampler(samplerinfo);
+
+    // Every frame's shadow_view is a region of its own, bound at an aligned offset
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+    m_view_size = (sizeof(shadow_view) + alignment - 1) / alignment * alignment;
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(m_view_size * frames)
+                        .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                  | allocator.addressUsage())
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_views        = m_device.createBuffer(bufferinfo, hostAllocator());
+    m_views_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_views),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_views, m_views_memory.memory, m_views_memory.offset);
+
+    // The caster's whole transform is a push constant, so the pipelines need no descriptors
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eVertex)
+                       .setOffset(0)
+                       .setSize(sizeof(glm::mat4));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    core::mapped_file code("shaders/shadow_vert.spv");
+
+    auto shaderinfo = vk::ShaderModuleCreateInfo()
+                        .setCodeSize(code.size())
+                        .setPCode((const uint32_t*)code.data());
+
+    m_shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+    // Only the vertex shader, without a fragment shader the depth is all that's written
+    auto stage = vk::PipelineShaderStageCreateInfo()
+                   .setStage(vk::ShaderStageFlagBits::eVertex)
+                   .setModule(m_shader)
+                   .setPName("main");
+
+    auto inputassembly =
+      vk::PipelineInputAssemblyStateCreateInfo().setTopology(vk::PrimitiveTopology::eTriangleList);
+
+    auto viewport = vk::PipelineViewportStateCreateInfo().setViewportCount(1).setScissorCount(1);
+
+    // Both faces cast, so meshes that aren't closed do too
+    auto rasterizer = vk::PipelineRasterizationStateCreateInfo()
+                        .setPolygonMode(vk::PolygonMode::eFill)
+                        .setCullMode(vk::CullModeFlagBits::eNone)
+                        .setLineWidth(1.f)
+                        .setDepthBiasEnable(true)
+                        .setDepthBiasConstantFactor(shadow_depth_bias)
+                        .setDepthBiasSlopeFactor(shadow_depth_bias_slope);
+
+    auto multisampling =
+      vk::PipelineMultisampleStateCreateInfo().setRasterizationSamples(vk::SampleCountFlagBits::e1);
+
+    auto depthstencil = vk::PipelineDepthStencilStateCreateInfo()
+                          .setDepthTestEnable(true)
+                          .setDepthWriteEnable(true)
+                          .setDepthCompareOp(vk::CompareOp::eLessOrEqual);
+
+    auto blending = vk::PipelineColorBlendStateCreateInfo();
+
+    std::array<vk::DynamicState, 2> dynamicstates = { vk::DynamicState::eViewport,
+                                                      vk::DynamicState::eScissor };
+
+    auto dynamic = vk::PipelineDynamicStateCreateInfo()
+                     .setDynamicStateCount((uint32_t)dynamicstates.size())
+                     .setPDynamicStates(dynamicstates.data());
+
+    for (const shadow_vertex_input& input : inputs) {
+        vk::VertexInputAttributeDescription position = input.position;
+        position.setLocation(0);
+
+        auto vertexinput = vk::PipelineVertexInputStateCreateInfo()
+                             .setVertexBindingDescriptionCount(1)
+                             .setPVertexBindingDescriptions(&input.binding)
+                             .setVertexAttributeDescriptionCount(1)
+                             .setPVertexAttributeDescriptions(&position);
+
+        auto pipelineinfo = vk::GraphicsPipelineCreateInfo()
+                              .setStageCount(1)
+                              .setPStages(&stage)
+                              .setPVertexInputState(&vertexinput)
+                              .setPInputAssemblyState(&inputassembly)
+                              .setPViewportState(&viewport)
+                              .setPRasterizationState(&rasterizer)
+                              .setPMultisampleState(&multisampling)
+                              .setPDepthStencilState(&depthstencil)
+                              .setPColorBlendState(&blending)
+                              .setPDynamicState(&dynamic)
+                              .setLayout(m_layout)
+                              .setRenderPass(m_render_pass)
+                              .setSubpass(0);
+
+        m_pipelines.push_back(
+          m_device.createGraphicsPipeline(pipelines.handle(), pipelineinfo, hostAllocator()));
+    }
+
+    invalidate();
+}
+
+
+/*
+The render pass and the pipelines stay, the viewport being dynamic state, and so do the frames'
+shadow_views. Frames in flight may still render to or sample the old map, so it goes to the
+deletion queue, and every cascade is rendered again into the new one.
+*/
+void
+shadow_cascades::resize(uint32_t resolution, deletion_queue& deletions, uint64_t frame)
+{
+    for (vk::Framebuffer framebuffer : m_framebuffers) {
+        deletions.push(frame, framebuffer);
+    }
+    for (vk::ImageView view : m_layer_views) {
+        deletions.push(frame, view);
+    }
+    m_framebuffers.clear();
+    m_layer_views.clear();
+
+    deletions.push(frame, m_view);
+    deletions.push(frame, m_image);
+    deletions.push(frame, m_memory);
+
+    createMap(resolution);
+    invalidate();
+}
+
+void
+shadow_cascades::createMap(uint32_t resolution)
+{
+    m_resolution = resolution;
+
+    auto imageinfo = vk::ImageCreateInfo()
+                       .setImageType(vk::ImageType::e2D)
+                       .setExtent(vk::Extent3D(resolution, resolution, 1))
+                       .setMipLevels(1)
+                       .setArrayLayers(shadow_cascade_count)
+                       .setFormat(shadow_format)
+                       .setTiling(vk::ImageTiling::eOptimal)
+                       .setInitialLayout(vk::ImageLayout::eUndefined)
+                       .setUsage(vk::ImageUsageFlagBits::eDepthStencilAttachment
+                                 | vk::ImageUsageFlagBits::eSampled)
+                       .setSamples(vk::SampleCountFlagBits::e1)
+                       .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_image  = m_device.createImage(imageinfo, hostAllocator());
+    m_memory = m_allocator->allocate(m_device.getImageMemoryRequirements(m_image),
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                     memory_allocator::resource_kind::optimal,
+                                     memory_category::render_target);
+    m_device.bindImageMemory(m_image, m_memory.memory, m_memory.offset);
+
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(m_image)
+                      .setViewType(vk::ImageViewType::e2DArray)
+                      .setFormat(shadow_format)
+                      .setSubresourceRange(vk::ImageSubresourceRange(
+                        vk::ImageAspectFlagBits::eDepth, 0, 1, 0, shadow_cascade_count));
+
+    m_view = m_device.createImageView(viewinfo, hostAllocator());
+
+    for (uint32_t i = 0; i < shadow_cascade_count; ++i) {
+        viewinfo.setViewType(vk::ImageViewType::e2D)
+          .setSubresourceRange(
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eDepth, 0, 1, i, 1));
+        m_layer_views.push_back(m_device.createImageView(viewinfo, hostAllocator()));
+
+        auto framebufferinfo = vk::FramebufferCreateInfo()
+                                 .setRenderPass(m_render_pass)
+                                 .setAttachmentCount(1)
+                                 .setPAttachments(&m_layer_views.back())
+                                 .setWidth(resolution)
+                                 .setHeight(resolution)
+                                 .setLayers(1);
+        m_framebuffers.push_back(m_device.createFramebuffer(framebufferinfo, hostAllocator()));
+    }
+}
+
+void
+shadow_cascades::destroy()
+{
+    for (vk::Pipeline pipeline : m_pipelines) {
+        m_device.destroyPipeline(pipeline, hostAllocator());
+    }
+    m_pipelines.clear();
+    m_device.destroyShaderModule(m_shader, hostAllocator());
+
+    for (vk::Framebuffer framebuffer : m_framebuffers) {
+        m_device.destroyFramebuffer(framebuffer, hostAllocator());
+    }
+    for (vk::ImageView view : m_layer_views) {
+        m_device.destroyImageView(view, hostAllocator());
+    }
+    m_framebuffers.clear();
+    m_layer_views.clear();
+
+    m_device.destroyRenderPass(m_render_pass, hostAllocator());
+    m_device.destroyImageView(m_view, hostAllocator());
+    m_device.destroyImage(m_image, hostAllocator());
+    m_allocator->free(m_memory);
+
+    m_device.destroyBuffer(m_views, hostAllocator());
+    m_allocator->free(m_views_memory);
+
+    m_image = nullptr;
+    m_view  = nullptr;
+    m_views = nullptr;
+}
+
+/*
+The cascades' ranges are a blend of even and logarithmic spacing. Each one's bounding sphere is
+found in view space, where it only depends on the projection, and is rounded up a little so that
+it doesn't change from float noise either.
+*/
+void
+shadow_cascades::beginFrame(uint32_t         frame,
+                            const glm::mat4& view,
+                            const glm::mat4& projection,
+                            float            nearplane,
+                            float            distance,
+                            const glm::vec3& direction,
+                            const glm::vec3& color)
+{
+    const glm::mat4 inverseview = glm::inverse(view);
+    const glm::mat4 rotation    = lightRotation(-glm::normalize(direction));
+
+    // How far the frustum spreads out per unit of depth. The projection may be flipped in y.
+    const float tanx = 1.f / std::abs(projection[0][0]);
+    const float tany = 1.f / std::abs(projection[1][1]);
+
+    // Clip space to the shadow map's texture coordinates, with the depth as it is
+    const glm::mat4 texcoords(0.5f, 0.f, 0.f, 0.f, 0.f, 0.5f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.5f,
+                              0.5f, 0.f, 1.f);
+
+    shadow_view data;
+    data.direction     = glm::normalize(glm::mat3(view) * direction);
+    data.color         = color;
+    data.view_to_world = inverseview;
+
+    float start = nearplane;
+    for (uint32_t i = 0; i < shadow_cascade_count; ++i) {
+        const float fraction    = (float)(i + 1) / (float)shadow_cascade_count;
+        const float logarithmic = nearplane * std::pow(distance / nearplane, fraction);
+        const float even        = nearplane + (distance - nearplane) * fraction;
+        const float end         = shadow_split_blend * logarithmic
+                          + (1.f - shadow_split_blend) * even;
+
+        // The sphere through all eight corners has its center on the view axis, unless that
+        // would be beyond the far end, where it's through the far ones only
+        const float spread     = tanx * tanx + tany * tany;
+        const float farspread  = end * end * spread;
+        const float nearspread = start * start * spread;
+        const float center     = std::min((start + end) * (1.f + spread) * 0.5f, end);
+        float       radius     = std::sqrt(std::max((end - center) * (end - center) + farspread,
+                                              (center - start) * (center - start) + nearspread));
+        radius                 = std::ceil(radius * 16.f) / 16.f;
+
+        // Snapped to whole texels across the light's view, see the class
+        const float texel = 2.f * radius / (float)m_resolution;
+        glm::vec3   light = glm::vec3(rotation * inverseview * glm::vec4(0.f, 0.f, -center, 1.f));
+        light.x           = std::floor(light.x / texel) * texel;
+        light.y           = std::floor(light.y / texel) * texel;
+
+        const glm::mat4 ortho =
+          orthographic(light.x - radius, light.x + radius, light.y - radius, light.y + radius,
+                       -light.z - radius - shadow_caster_distance, -light.z + radius);
+
+        m_view_projections[i] = ortho * rotation;
+        m_frustums[i]         = extractFrustum(m_view_projections[i]);
+        m_casters[i].clear();
+
+        data.cascades[i]    = texcoords * m_view_projections[i] * inverseview;
+        data.splits[i]      = end;
+        data.texel_sizes[i] = texel;
+
+        start = end;
+    }
+
+    std::memcpy(static_cast<char*>(m_views_memory.mapped) + (frame % m_frames) * m_view_size, &data,
+                sizeof(data));
+}
+
+void
+shadow_cascades::push(uint32_t cascade, const shadow_caster& caster)
+{
+    m_casters[cascade].push_back(caster);
+}
+
+/*
+Everything a cascade's contents depend on. Casters come in the same order as long as the scene
+doesn't change, which is all this has to notice.
+*/
+uint64_t
+shadow_cascades::signature(uint32_t cascade) const
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash          = fnv1a(hash, &m_view_projections[cascade], sizeof(glm::mat4));
+    for (const shadow_caster& caster : m_casters[cascade]) {
+        hash = fnv1a(hash, &caster.vertex_buffer, sizeof(caster.vertex_buffer));
+        hash = fnv1a(hash, &caster.index_buffer, sizeof(caster.index_buffer));
+        hash = fnv1a(hash, &caster.index_type, sizeof(caster.index_type));
+        hash = fnv1a(hash, &caster.index_count, sizeof(caster.index_count));
+        hash = fnv1a(hash, &caster.first_index, sizeof(caster.first_index));
+        hash = fnv1a(hash, &caster.vertex_offset, sizeof(caster.vertex_offset));
+        hash = fnv1a(hash, &caster.input, sizeof(caster.input));
+        hash = fnv1a(hash, &caster.transform, sizeof(caster.transform));
+    }
+    return std::max<uint64_t>(hash, 1);
+}
+
+void
+shadow_cascades::record(vk::CommandBuffer command_buffer)
+{
+    auto viewport = vk::Viewport(0.f, 0.f, (float)m_resolution, (float)m_resolution, 0.f, 1.f);
+    auto scissor  = vk::Rect2D({ 0, 0 }, { m_resolution, m_resolution });
+
+    vk::ClearValue clear;
+    clear.depthStencil = vk::ClearDepthStencilValue(1.f, 0);
+
+    m_rendered = 0;
+    for (uint32_t i = 0; i < shadow_cascade_count; ++i) {
+        const uint64_t current = signature(i);
+        if (i >= shadow_cached_cascades && current == m_signatures[i]) {
+            continue;
+        }
+        m_signatures[i] = current;
+        ++m_rendered;
+
+        auto begininfo = vk::RenderPassBeginInfo()
+                           .setRenderPass(m_render_pass)
+                           .setFramebuffer(m_framebuffers[i])
+                           .setRenderArea(scissor)
+                           .setClearValueCount(1)
+                           .setPClearValues(&clear);
+
+        command_buffer.beginRenderPass(begininfo, vk::SubpassContents::eInline);
+        command_buffer.setViewport(0, 1, &viewport);
+        command_buffer.setScissor(0, 1, &scissor);
+
+        // Only what differs from the previous caster is bound again, like recordDraws does
+        uint32_t      boundinput = ~0u;
+        vk::Buffer    boundvertices;
+        vk::Buffer    boundindices;
+        vk::IndexType boundindextype = vk::IndexType::eUint32;
+
+        for (const shadow_caster& caster : m_casters[i]) {
+            if (caster.input != boundinput) {
+                command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                            m_pipelines[caster.input]);
+                boundinput = caster.input;
+            }
+            if (caster.vertex_buffer != boundvertices) {
+                vk::DeviceSize offset = 0;
+                command_buffer.bindVertexBuffers(0, 1, &caster.vertex_buffer, &offset);
+                boundvertices = caster.vertex_buffer;
+            }
+            if (caster.index_buffer != boundindices || caster.index_type != boundindextype) {
+                command_buffer.bindIndexBuffer(caster.index_buffer, 0, caster.index_type);
+                boundindices   = caster.index_buffer;
+                boundindextype = caster.index_type;
+            }
+
+            const glm::mat4 mvp = m_view_projections[i] * caster.transform;
+            command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eVertex, 0,
+                                         sizeof(mvp), &mvp);
+            command_buffer.drawIndexed(caster.index_count, 1, caster.first_index,
+                                       caster.vertex_offset, 0);
+        }
+
+        command_buffer.endRenderPass();
+    }
+}
+
+vk::DescriptorImageInfo
+shadow_cascades::map() const
+{
+    return vk::DescriptorImageInfo(m_sampler, m_view, vk::ImageLayout::eShaderReadOnlyOptimal);
+}
+
+vk::DescriptorBufferInfo
+shadow_cascades::view(uint32_t frame) const
+{
+    return vk::DescriptorBufferInfo(m_views, frame * m_view_size, m_view_size);
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "graphics/deletion_queue.h"
+#include "graphics/frustum_culling.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/view_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <vector>
+
+namespace shiny::graphics {
+
+// Has to match shadowCascadeCount in shadows.glsl
+const uint32_t shadow_cascade_count = 4;
+
+// Cascades from this one on are only rendered again when what they'd render changed
+const uint32_t shadow_cached_cascades = 2;
+
+/*
+What the fragment shaders read once per frame to look up the shadows, laid out like the std430
+Shadows block of shadows.glsl. Everything is in view space, where the lighting is done.
+*/
+struct shadow_view
+{
+    glm::mat4 cascades[shadow_cascade_count];  // view space to the layer's texcoords and depth
+    glm::vec4 splits;                          // the view space distance each cascade ends at
+    glm::vec4 texel_sizes;                     // of each cascade, in world units
+    glm::vec3 direction;                       // towards the light
+    float     padding0 = 0.f;
+    glm::vec3 color;
+    float     padding1 = 0.f;
+    glm::mat4 view_to_world;  // for tracing shadows through the scene, which is in world space
+};
+
+static_assert(sizeof(shadow_view) == 384, "shadow_view has to match the shaders' layout");
+
+// Where a vertex format's positions are, for the position only vertex input of the casters
+struct shadow_vertex_input
+{
+    vk::VertexInputBindingDescription   binding;
+    vk::VertexInputAttributeDescription position;  // its location is ignored
+};
+
+// One instance drawn into a cascade
+struct shadow_caster
+{
+    vk::Buffer    vertex_buffer;
+    vk::Buffer    index_buffer;
+    vk::IndexType index_type    = vk::IndexType::eUint32;
+    uint32_t      index_count   = 0;
+    uint32_t      first_index   = 0;
+    int32_t       vertex_offset = 0;
+    uint32_t      input         = 0;  // which of the vertex inputs given to init()
+    glm::mat4     transform     = glm::mat4(1.f);  // the model matrix, with any dequantize
+};
+
+/*
+Cascaded shadow maps for a directional light. The view frustum up to the shadow distance is split
+into cascades, each covering a range of depths that grows the further away it is, and each gets a
+layer of the shadow map to itself, rendered from the light's direction with an orthographic
+projection around the range's bounding sphere.
+
+The sphere only depends on the projection, and its center is snapped to whole texels of the
+cascade, so cascades neither change size nor crawl across the texels as the camera turns and
+moves, which keeps the shadows' edges from shimmering. It also means a cascade's projection only
+changes once the camera has moved by a texel, which is what lets the far cascades be cached: from
+shadow_cached_cascades on, a cascade is only rendered again once its projection or any of its
+casters differ from the last time it was, so as long as the light and whatever is far away stay
+put they cost nothing.
+
+The casters are culled per cascade by the caller, against cascadeFrustum(), which reaches back
+towards the light so that whatever is in between casts into it too. They're drawn with a depth
+only pipeline per vertex format reading nothing but the positions, and with a depth bias against
+shadow acne, which shadows.glsl also offsets the surfaces along their normals for.
+
+The shadow map is shared by every frame in flight, so its passes have to be ordered by the render
+graph. Between them it's in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, while they're recorded in
+VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, with the layers that aren't rendered kept.
+*/
+class shadow_cascades
+{
+public:
+    void init(vk::PhysicalDevice                      physical_device,
+              vk::Device                              device,
+              memory_allocator&                       allocator,
+              layout_cache&                           layouts,
+              view_cache&                             views,
+              pipeline_cache&                         pipelines,
+              const std::vector<shadow_vertex_input>& inputs,
+              uint32_t                                frames,
+              uint32_t                                resolution);
+    void destroy();
+
+    // A shadow map of `resolution` instead, retiring the old one with `frame`. Its descriptors
+    // have to be written again, and the render graph has to import image() again.
+    void resize(uint32_t resolution, deletion_queue& deletions, uint64_t frame);
+
+    uint32_t resolution() const { return m_resolution; }
+
+    // Fits the cascades to the view frustum from `nearplane` to `distance`, for a light shining
+    // along `-direction`, and drops the casters of the last frame
+    void beginFrame(uint32_t         frame,
+                    const glm::mat4& view,
+                    const glm::mat4& projection,
+                    float            nearplane,
+                    float            distance,
+                    const glm::vec3& direction,
+                    const glm::vec3& color);
+
+    // What the casters of a cascade are culled against, in world space
+    const frustum& cascadeFrustum(uint32_t cascade) const { return m_frustums[cascade]; }
+    void           push(uint32_t cascade, const shadow_caster& caster);
+
+    // Renders the cascades that have to be. Outside of a render pass, with the shadow map in
+    // VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL.
+    void record(vk::CommandBuffer command_buffer);
+
+    // Renders every cascade the next time, e.g. once whatever was in the shadow map is lost
+    void invalidate() { m_signatures.fill(0); }
+
+    // Cascades the last record() rendered
+    uint32_t rendered() const { return m_rendered; }
+
+    // For the fragment shaders' descriptors
+    vk::DescriptorImageInfo  map() const;
+    vk::DescriptorBufferInfo view(uint32_t frame) const;
+
+    vk::Image image() const { return m_image; }
+
+private:
+    void     createMap(uint32_t resolution);
+    uint64_t signature(uint32_t cascade) const;
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator  = nullptr;
+    uint32_t          m_resolution = 0;
+    uint32_t          m_frames     = 0;
+
+    vk::Image                    m_image;  // a layer per cascade
+    allocation                   m_memory;
+    vk::ImageView                m_view;  // every layer, for sampling
+    std::vector<vk::ImageView>   m_layer_views;
+    std::vector<vk::Framebuffer> m_framebuffers;  // per layer
+    vk::Sampler                  m_sampler;  // owned by the view_cache
+    vk::RenderPass               m_render_pass;
+
+    vk::PipelineLayout        m_layout;  // owned by the layout_cache
+    vk::ShaderModule          m_shader;
+    std::vector<vk::Pipeline> m_pipelines;  // per vertex input
+
+    vk::Buffer     m_views;  // host visible, a shadow_view per frame
+    allocation     m_views_memory;
+    vk::DeviceSize m_view_size = 0;
+
+    std::array<glm::mat4, shadow_cascade_count>                  m_view_projections;
+    std::array<frustum, shadow_cascade_count>                    m_frustums;
+    std::array<std::vector<shadow_caster>, shadow_cascade_count> m_casters;
+    std::array<uint64_t, shadow_cascade_count>                   m_signatures = {};  // 0 for none
+    uint32_t                                                     m_rendered   = 0;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,201 @@
+#include "graphics/sprite_atlas.h"
+
+#include <cstring>
+
+namespace {
+
+// The built in font, a row of 5 bits a byte from the top, the leftmost pixel the highest bit
+const uint32_t font_width  = 5;
+const uint32_t font_height = 7;
+
+const uint8_t font_glyphs[64][font_height] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // ' '
+    { 0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04 },  // '!'
+    { 0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '"'
+    { 0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a },  // '#'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '$'
+    { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 },  // '%'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '&'
+    { 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 },  // "'"
+    { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 },  // '('
+    { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 },  // ')'
+    { 0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00 },  // '*'
+    { 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 },  // '+'
+    { 0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08 },  // ','
+    { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 },  // '-'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c },  // '.'
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },  // '/'
+    { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e },  // '0'
+    { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e },  // '1'
+    { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f },  // '2'
+    { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e },  // '3'
+    { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 },  // '4'
+    { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e },  // '5'
+    { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e },  // '6'
+    { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },  // '7'
+    { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e },  // '8'
+    { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c },  // '9'
+    { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 },  // ':'
+    { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x04, 0x08 },  // ';'
+    { 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 },  // '<'
+    { 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 },  // '='
+    { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 },  // '>'
+    { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 },  // '?'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '@'
+    { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 },  // 'A'
+    { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e },  // 'B'
+    { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e },  // 'C'
+    { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c },  // 'D'
+    { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f },  // 'E'
+    { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 },  // 'F'
+    { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f },  // 'G'
+    { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 },  // 'H'
+    { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e },  // 'I'
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c },  // 'J'
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },  // 'K'
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f },  // 'L'
+    { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 },  // 'M'
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },  // 'N'
+    { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e },  // 'O'
+    { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 },  // 'P'
+    { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d },  // 'Q'
+    { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 },  // 'R'
+    { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e },  // 'S'
+    { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },  // 'T'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e },  // 'U'
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 },  // 'V'
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a },  // 'W'
+    { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 },  // 'X'
+    { 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04 },  // 'Y'
+    { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f },  // 'Z'
+    { 0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e },  // '['
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '\\'
+    { 0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e },  // ']'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '^'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f },  // '_'
+};
+
+const uint32_t white_texel = 0xffffffff;
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+sprite_atlas::init(uint32_t width, uint32_t height)
+{
+    m_width  = width;
+    m_height = height;
+    m_texels.assign((size_t)width * height, 0);
+    m_shelves.clear();
+    m_bottom = 0;
+    m_glyphs.fill(atlas_region());
+
+    // A little more than the texel, so filtering stays inside of it wherever it's sampled
+    const std::array<uint32_t, 4> white = { white_texel, white_texel, white_texel, white_texel };
+    add(2, 2, white.data(), m_white);
+    const glm::vec2 center = (m_white.uv_min + m_white.uv_max) * 0.5f;
+    m_white.uv_min         = center;
+    m_white.uv_max         = center;
+}
+
+bool
+sprite_atlas::add(uint32_t width, uint32_t height, const uint32_t* texels, atlas_region& region)
+{
+    const uint32_t paddedwidth  = width + 2;
+    const uint32_t paddedheight = height + 2;
+    if (paddedwidth > m_width) {
+        return false;
+    }
+
+    shelf* target = nullptr;
+    for (shelf& s : m_shelves) {
+        if (s.height >= paddedheight && m_width - s.used >= paddedwidth) {
+            target = &s;
+            break;
+        }
+    }
+    if (!target) {
+        if (m_height - m_bottom < paddedheight) {
+            return false;
+        }
+        m_shelves.push_back({ m_bottom, paddedheight, 0 });
+        m_bottom += paddedheight;
+        target = &m_shelves.back();
+    }
+
+    const uint32_t x = target->used + 1;
+    const uint32_t y = target->y + 1;
+    target->used += paddedwidth;
+
+    for (uint32_t row = 0; row < height; ++row) {
+        std::memcpy(&m_texels[(size_t)(y + row) * m_width + x], texels + (size_t)row * width,
+                    width * sizeof(uint32_t));
+    }
+
+    region.width  = width;
+    region.height = height;
+    region.uv_min = glm::vec2((float)x / (float)m_width, (float)y / (float)m_height);
+    region.uv_max =
+      glm::vec2((float)(x + width) / (float)m_width, (float)(y + height) / (float)m_height);
+    return true;
+}
+
+bool
+sprite_atlas::addFont(uint32_t scale)
+{
+    const uint32_t width  = font_width * scale;
+    const uint32_t height = font_height * scale;
+
+    std::vector<uint32_t> texels(width * height);
+    for (uint32_t i = 0; i < (uint32_t)m_glyphs.size(); ++i) {
+        for (uint32_t y = 0; y < height; ++y) {
+            const uint8_t row = font_glyphs[i][y / scale];
+            for (uint32_t x = 0; x < width; ++x) {
+                const bool set        = (row >> (font_width - 1 - x / scale)) & 1;
+                texels[y * width + x] = set ? white_texel : 0;
+            }
+        }
+        if (!add(width, height, texels.data(), m_glyphs[i])) {
+            return false;
+        }
+    }
+
+    m_glyph_advance = width + scale;
+    m_line_advance  = height + 2 * scale;
+    return true;
+}
+
+const atlas_region&
+sprite_atlas::glyph(char character) const
+{
+    if (character >= 'a' && character <= 'z') {
+        character = (char)(character - 'a' + 'A');
+    }
+    if (character < ' ' || character > '_') {
+        character = ' ';
+    }
+    return m_glyphs[character - ' '];
+}
+
+texture_data
+sprite_atlas::textureData()
+{
+    texture_data data;
+    data.format = vk::Format::eR8G8B8A8Unorm;
+    data.width  = m_width;
+    data.height = m_height;
+    data.texels.resize(m_texels.size() * sizeof(uint32_t));
+    std::memcpy(data.texels.data(), m_texels.data(), data.texels.size());
+
+    ktx2_level level;
+    level.size   = data.texels.size();
+    level.width  = m_width;
+    level.height = m_height;
+    data.levels.push_back(level);
+
+    std::vector<uint32_t>().swap(m_texels);
+    return data;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "graphics/texture_loader.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+// Where an image ended up in the atlas, in texels and in texture coordinates
+struct atlas_region
+{
+    uint32_t  width  = 0;
+    uint32_t  height = 0;
+    glm::vec2 uv_min = glm::vec2(0.f);
+    glm::vec2 uv_max = glm::vec2(0.f);
+};
+
+/*
+Packs small images, glyphs and icons, into one RGBA texture, so that everything drawn with them can
+share a texture and so a draw. Images go into shelves: rows as tall as the tallest image in them,
+each new image into the first shelf it fits, or a new one below the others. That wastes some of the
+atlas for images of very different heights, little for glyphs which are all the same, and is never
+repacked, so regions don't move once they're added.
+
+Every region has a texel of padding around it, so filtering never reaches into its neighbours.
+The first region is a white texel, for solid rectangles drawn with the same texture.
+
+The atlas only lives on the CPU: textureData() hands it to the texture_streamer once it's complete.
+*/
+class sprite_atlas
+{
+public:
+    void init(uint32_t width, uint32_t height);
+
+    // Copies a `width` by `height` image of RGBA8 texels into the atlas, false if it's full
+    bool add(uint32_t width, uint32_t height, const uint32_t* texels, atlas_region& region);
+
+    /*
+    Rasterizes the built in font, 5 by 7 pixels a glyph, `scale` texels to a pixel so that text
+    drawn at that size is as sharp as filtering allows. Lowercase letters are drawn as uppercase
+    ones, and what else the font lacks as blanks. The glyphs are white, text is tinted by its color.
+    */
+    bool addFont(uint32_t scale);
+
+    // The region of `character`, of the font added last
+    const atlas_region& glyph(char character) const;
+    const atlas_region& white() const { return m_white; }
+
+    // Space to leave between glyphs, and lines, of the font
+    uint32_t glyphAdvance() const { return m_glyph_advance; }
+    uint32_t lineAdvance() const { return m_line_advance; }
+
+    // A single level of RGBA8 texels, moved out of the atlas
+    texture_data textureData();
+
+private:
+    // A row of the atlas, with room on its right
+    struct shelf
+    {
+        uint32_t y      = 0;
+        uint32_t height = 0;
+        uint32_t used   = 0;
+    };
+
+    uint32_t              m_width  = 0;
+    uint32_t              m_height = 0;
+    std::vector<uint32_t> m_texels;
+    std::vector<shelf>    m_shelves;
+    uint32_t              m_bottom = 0;  // of the lowest shelf
+
+    atlas_region                 m_white;
+    std::array<atlas_region, 64> m_glyphs;  // from ' ' to '_'
+    uint32_t                     m_glyph_advance = 0;
+    uint32_t                     m_line_advance  = 0;
+};
+
+}  // namespace shiny::graphics
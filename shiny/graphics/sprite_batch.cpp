@@ -0,0 +1,261 @@
+#include "graphics/sprite_batch.h"
+
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+// What the vertex shader takes pixels to normalized device coordinates with
+struct sprite_constants
+{
+    glm::vec2 scale;  // two over the extent
+};
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+sprite_batch::init(vk::Device              device,
+                   memory_allocator&       allocator,
+                   layout_cache&           layouts,
+                   uint32_t                max_sprites,
+                   uint32_t                frames,
+                   vk::DescriptorSetLayout bindless_layout)
+{
+    // The quads' indices are 16 bit
+    if (max_sprites * 4 > std::numeric_limits<uint16_t>::max() + 1u) {
+        throw std::runtime_error("Too many sprites for 16 bit indices!");
+    }
+
+    m_device      = device;
+    m_allocator   = &allocator;
+    m_max_sprites = max_sprites;
+    m_frames      = frames;
+    m_bindless    = (bool)bindless_layout;
+
+    const auto hostvisible =
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+    // Rewritten every frame, so straight into VRAM where the host can map all of it
+    auto vertexinfo = vk::BufferCreateInfo()
+                        .setSize(sizeof(sprite_vertex) * 4 * max_sprites * frames)
+                        .setUsage(vk::BufferUsageFlagBits::eVertexBuffer)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_vertices        = m_device.createBuffer(vertexinfo, hostAllocator());
+    m_vertices_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_vertices), hostvisible,
+      memory_allocator::resource_kind::linear, memory_category::vertex,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_vertices, m_vertices_memory.memory, m_vertices_memory.offset);
+
+    // Small and only written here, so it isn't worth staging
+    auto indexinfo = vk::BufferCreateInfo()
+                       .setSize(sizeof(uint16_t) * 6 * max_sprites)
+                       .setUsage(vk::BufferUsageFlagBits::eIndexBuffer)
+                       .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_indices        = m_device.createBuffer(indexinfo, hostAllocator());
+    m_indices_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_indices),
+                                             hostvisible, memory_allocator::resource_kind::linear,
+                                             memory_category::index);
+    m_device.bindBufferMemory(m_indices, m_indices_memory.memory, m_indices_memory.offset);
+
+    // Corners go top left, top right, bottom right, bottom left
+    uint16_t* indices = static_cast<uint16_t*>(m_indices_memory.mapped);
+    for (uint32_t i = 0; i < max_sprites; ++i) {
+        const uint16_t first   = (uint16_t)(i * 4);
+        const uint16_t quad[6] = { first, (uint16_t)(first + 1), (uint16_t)(first + 2),
+                                   first, (uint16_t)(first + 2), (uint16_t)(first + 3) };
+        std::copy(quad, quad + 6, indices + i * 6);
+    }
+
+    // Without the texture array, every texture has a set of its own
+    m_set_layout = bindless_layout;
+    if (!m_bindless) {
+        auto binding = vk::DescriptorSetLayoutBinding()
+                         .setBinding(0)
+                         .setDescriptorCount(1)
+                         .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                         .setStageFlags(vk::ShaderStageFlagBits::eFragment);
+
+        m_set_layout = layouts.descriptorSetLayout(
+          vk::DescriptorSetLayoutCreateInfo().setBindingCount(1).setPBindings(&binding));
+        m_descriptors.init(m_device, { { vk::DescriptorType::eCombinedImageSampler, 1 } }, 16);
+    }
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eVertex)
+                       .setOffset(0)
+                       .setSize(sizeof(sprite_constants));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setSetLayoutCount(1)
+                        .setPSetLayouts(&m_set_layout)
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    m_sprites.reserve(max_sprites);
+}
+
+void
+sprite_batch::destroy()
+{
+    if (!m_bindless) {
+        m_descriptors.destroy();
+        m_sets.clear();
+    }
+
+    m_device.destroyBuffer(m_vertices, hostAllocator());
+    m_allocator->free(m_vertices_memory);
+    m_device.destroyBuffer(m_indices, hostAllocator());
+    m_allocator->free(m_indices_memory);
+
+    m_vertices = nullptr;
+    m_indices  = nullptr;
+}
+
+uint32_t
+sprite_batch::addTexture(uint32_t slot, vk::ImageView view, vk::Sampler sampler)
+{
+    if (m_bindless) {
+        return slot;
+    }
+
+    const auto imageinfo =
+      vk::DescriptorImageInfo(sampler, view, vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    m_sets.push_back(m_descriptors.allocate(m_set_layout));
+    m_device.updateDescriptorSets(vk::WriteDescriptorSet()
+                                    .setDstSet(m_sets.back())
+                                    .setDstBinding(0)
+                                    .setDescriptorCount(1)
+                                    .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                                    .setPImageInfo(&imageinfo),
+                                  nullptr);
+    return (uint32_t)m_sets.size() - 1;
+}
+
+void
+sprite_batch::beginFrame(uint32_t frame)
+{
+    m_frame = frame % m_frames;
+    m_sprites.clear();
+}
+
+// Whatever doesn't fit in a frame is dropped, like the debug_draw's
+void
+sprite_batch::sprite(const glm::vec2&    min,
+                     const glm::vec2&    max,
+                     const atlas_region& region,
+                     uint32_t            texture,
+                     uint32_t            color,
+                     uint32_t            layer)
+{
+    if (m_sprites.size() >= m_max_sprites) {
+        return;
+    }
+
+    queued_sprite s;
+    s.min     = min;
+    s.max     = max;
+    s.uv_min  = region.uv_min;
+    s.uv_max  = region.uv_max;
+    s.color   = color;
+    s.texture = texture;
+    s.key     = (uint64_t)(layer & 0xffff) << 48 | (uint64_t)(texture & 0xffff) << 32
+            | (uint64_t)m_sprites.size();
+    m_sprites.push_back(s);
+}
+
+glm::vec2
+sprite_batch::text(const glm::vec2&    position,
+                   const std::string&  text,
+                   const sprite_atlas& atlas,
+                   uint32_t            texture,
+                   uint32_t            color,
+                   uint32_t            layer)
+{
+    glm::vec2 pen = position;
+    for (char character : text) {
+        const atlas_region& glyph = atlas.glyph(character);
+        if (character != ' ') {
+            sprite(pen, pen + glm::vec2((float)glyph.width, (float)glyph.height), glyph, texture,
+                   color, layer);
+        }
+        pen.x += (float)atlas.glyphAdvance();
+    }
+    return pen;
+}
+
+// Sorted once everything's in, so the draws only have to find where the textures change
+void
+sprite_batch::finish()
+{
+    std::sort(m_sprites.begin(), m_sprites.end(),
+              [](const queued_sprite& a, const queued_sprite& b) { return a.key < b.key; });
+
+    sprite_vertex* vertices = static_cast<sprite_vertex*>(m_vertices_memory.mapped)
+                              + (size_t)4 * m_max_sprites * m_frame;
+    for (const queued_sprite& s : m_sprites) {
+        *vertices++ = { s.min, s.uv_min, s.color, s.texture };
+        *vertices++ = { glm::vec2(s.max.x, s.min.y), glm::vec2(s.uv_max.x, s.uv_min.y), s.color,
+                        s.texture };
+        *vertices++ = { s.max, s.uv_max, s.color, s.texture };
+        *vertices++ = { glm::vec2(s.min.x, s.max.y), glm::vec2(s.uv_min.x, s.uv_max.y), s.color,
+                        s.texture };
+    }
+}
+
+void
+sprite_batch::draw(vk::CommandBuffer command_buffer,
+                   vk::Pipeline      pipeline,
+                   vk::DescriptorSet bindless_set,
+                   vk::Extent2D      extent) const
+{
+    if (m_sprites.empty()) {
+        return;
+    }
+
+    sprite_constants constants;
+    constants.scale = glm::vec2(2.f / (float)extent.width, 2.f / (float)extent.height);
+
+    const vk::DeviceSize region = sizeof(sprite_vertex) * 4 * m_max_sprites * m_frame;
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    command_buffer.bindVertexBuffers(0, m_vertices, region);
+    command_buffer.bindIndexBuffer(m_indices, 0, vk::IndexType::eUint16);
+    command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(constants),
+                                 &constants);
+
+    // The fragment shader finds every sprite's texture itself
+    if (m_bindless) {
+        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_layout, 0,
+                                          bindless_set, nullptr);
+        command_buffer.drawIndexed((uint32_t)m_sprites.size() * 6, 1, 0, 0, 0);
+        return;
+    }
+
+    // Otherwise a draw per run of the same texture, which sorting made as long as they can be
+    const uint32_t count = (uint32_t)m_sprites.size();
+    for (uint32_t first = 0; first < count;) {
+        const uint32_t texture = m_sprites[first].texture;
+        uint32_t       end     = first + 1;
+        while (end < count && m_sprites[end].texture == texture) {
+            ++end;
+        }
+
+        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_layout, 0,
+                                          m_sets[texture], nullptr);
+        command_buffer.drawIndexed((end - first) * 6, 1, first * 6, 0, 0);
+        first = end;
+    }
+}
+
+}  // namespace shiny::graphics
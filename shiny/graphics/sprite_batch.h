@@ -0,0 +1,145 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/sprite_atlas.h"
+#include "graphics/vertex_layout.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+// A corner of a sprite, in pixels from the top left of what it's drawn into
+struct sprite_vertex
+{
+    glm::vec2 position;
+    glm::vec2 uv;
+    uint32_t  color   = 0;  // RGBA8, red in the lowest byte
+    uint32_t  texture = 0;  // from sprite_batch::addTexture
+
+    static constexpr vk::VertexInputBindingDescription getBindingDescription();
+    static constexpr auto                              getAttributeDescription();
+};
+
+template<>
+constexpr auto vertex_fields<sprite_vertex> = std::array {
+    SHINY_VERTEX_FIELD(sprite_vertex, position, 0),
+    SHINY_VERTEX_FIELD(sprite_vertex, uv, 1),
+    SHINY_VERTEX_FIELD_AS(sprite_vertex, color, 2, vk::Format::eR8G8B8A8Unorm),
+    SHINY_VERTEX_FIELD(sprite_vertex, texture, 3),
+};
+
+constexpr vk::VertexInputBindingDescription
+sprite_vertex::getBindingDescription()
+{
+    return vertex_streams<sprite_vertex>::bindings()[0];
+}
+
+constexpr auto
+sprite_vertex::getAttributeDescription()
+{
+    return vertex_streams<sprite_vertex>::attributes();
+}
+
+static_assert(sizeof(sprite_vertex) == 24, "sprite_vertex has to match its vertex layout");
+
+/*
+Screen space quads, text and icons from sprite_atlas regions, for the HUD and overlays. Sprites are
+collected over the frame, and finish() sorts them by layer, then texture, then the order they came
+in, and writes their quads straight into the frame's region of a persistently mapped vertex buffer,
+one per frame in flight, which they're drawn from with a quad index buffer written once. Within a
+layer only sprites of the same texture keep their order, which is what lets them share a draw.
+
+With bindless textures a sprite's texture is its slot in the renderer's texture array, which the
+fragment shader indexes, so a whole frame of sprites is a single draw whatever textures it uses.
+Without, each texture has a set of the batch's own and every run of sprites with the same one is a
+draw. Either way nothing is allocated once the batch has seen its largest frame.
+*/
+class sprite_batch
+{
+public:
+    // `bindless_layout` is the set layout of the renderer's texture array, null without one
+    void init(vk::Device              device,
+              memory_allocator&       allocator,
+              layout_cache&           layouts,
+              uint32_t                max_sprites,
+              uint32_t                frames,
+              vk::DescriptorSetLayout bindless_layout);
+    void destroy();
+
+    // What sprites of the texture in `slot` of the texture array are drawn with. Without the array
+    // that's a set of the batch's own, which `view` and `sampler` are written to, for good.
+    uint32_t addTexture(uint32_t slot, vk::ImageView view, vk::Sampler sampler);
+
+    // Drops the last frame's sprites, once the GPU is done with `frame`'s region
+    void beginFrame(uint32_t frame);
+
+    void sprite(const glm::vec2&    min,
+                const glm::vec2&    max,
+                const atlas_region& region,
+                uint32_t            texture,
+                uint32_t            color,
+                uint32_t            layer = 0);
+
+    // With the font of `atlas`, one line from `position` at its top left. Returns where the next
+    // character would go.
+    glm::vec2 text(const glm::vec2&    position,
+                   const std::string&  text,
+                   const sprite_atlas& atlas,
+                   uint32_t            texture,
+                   uint32_t            color,
+                   uint32_t            layer = 0);
+
+    // Sorts the frame's sprites and writes their quads, once they have all been added
+    void finish();
+
+    // Draws the frame's sprites into `extent`, with a pipeline made with layout() and the vertex
+    // layout of sprite_vertex, blended and with no depth test. `bindless_set` is this frame's
+    // texture array. Inside a render pass, after finish().
+    void draw(vk::CommandBuffer command_buffer,
+              vk::Pipeline      pipeline,
+              vk::DescriptorSet bindless_set,
+              vk::Extent2D      extent) const;
+
+    vk::PipelineLayout layout() const { return m_layout; }
+    bool               bindless() const { return m_bindless; }
+    bool               empty() const { return m_sprites.empty(); }
+
+private:
+    struct queued_sprite
+    {
+        glm::vec2 min;
+        glm::vec2 max;
+        glm::vec2 uv_min;
+        glm::vec2 uv_max;
+        uint32_t  color   = 0;
+        uint32_t  texture = 0;
+        uint64_t  key     = 0;  // layer, texture, order
+    };
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator   = nullptr;
+    uint32_t          m_max_sprites = 0;
+    uint32_t          m_frames      = 0;
+    bool              m_bindless    = false;
+
+    vk::Buffer m_vertices;  // host visible, every frame's region of quads
+    allocation m_vertices_memory;
+    vk::Buffer m_indices;  // six for every quad, written once
+    allocation m_indices_memory;
+
+    descriptor_allocator           m_descriptors;
+    vk::DescriptorSetLayout        m_set_layout;  // without bindless, owned by the layout_cache
+    std::vector<vk::DescriptorSet> m_sets;        // a texture each, without bindless
+    vk::PipelineLayout             m_layout;      // owned by the layout_cache
+
+    uint32_t                   m_frame = 0;
+    std::vector<queued_sprite> m_sprites;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,145 @@
+#include "graphics/staging_arena.h"
+
+#include "core/startup_report.h"
+#include "graphics/host_allocator.h"
+
+namespace {
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+staging_arena::init(vk::Device device, memory_allocator& allocator, vk::DeviceSize capacity)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_capacity  = capacity;
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(capacity)
+                        .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+    m_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_buffer),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::staging);
+    m_device.bindBufferMemory(m_buffer, m_memory.memory, m_memory.offset);
+}
+
+void
+staging_arena::destroy()
+{
+    for (auto& big : m_oversized) {
+        m_device.destroyBuffer(big.buffer, hostAllocator());
+        m_allocator->free(big.memory);
+    }
+    m_oversized.clear();
+    m_segments.clear();
+
+    m_device.destroyBuffer(m_buffer, hostAllocator());
+    m_allocator->free(m_memory);
+}
+
+staging_region
+staging_arena::allocate(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    staging_region region;
+
+    if (size > m_capacity) {
+        oversize big;
+        auto     bufferinfo = vk::BufferCreateInfo()
+                            .setSize(size)
+                            .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+                            .setSharingMode(vk::SharingMode::eExclusive);
+
+        big.buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+        big.memory = m_allocator->allocate(
+          m_device.getBufferMemoryRequirements(big.buffer),
+          vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+          memory_allocator::resource_kind::linear, memory_category::staging);
+        m_device.bindBufferMemory(big.buffer, big.memory.memory, big.memory.offset);
+
+        region.buffer = big.buffer;
+        region.size   = size;
+        region.data   = big.memory.mapped;
+
+        m_oversized.push_back(big);
+        core::threadIo().uploaded += size;
+        return region;
+    }
+
+    vk::DeviceSize offset = alignUp(m_head, alignment);
+    vk::DeviceSize cost   = (offset - m_head) + size;
+
+    // Not enough room before the end of the buffer, so wrap around and waste the tail end. The
+    // wasted bytes are charged to this allocation so they come back when it is reclaimed.
+    if (offset + size > m_capacity) {
+        offset = 0;
+        cost   = (m_capacity - m_head) + size;
+    }
+
+    if (m_used + cost > m_capacity) {
+        return region;
+    }
+
+    m_head = offset + size;
+    m_used += cost;
+    m_open_bytes += cost;
+
+    region.buffer = m_buffer;
+    region.offset = offset;
+    region.size   = size;
+    region.data   = static_cast<char*>(m_memory.mapped) + offset;
+
+    core::threadIo().uploaded += size;
+    return region;
+}
+
+void
+staging_arena::close(uint64_t submission)
+{
+    if (m_open_bytes > 0) {
+        m_segments.push_back({ submission, m_open_bytes });
+        m_open_bytes = 0;
+    }
+
+    for (auto& big : m_oversized) {
+        if (!big.closed) {
+            big.submission = submission;
+            big.closed     = true;
+        }
+    }
+}
+
+void
+staging_arena::reclaim(uint64_t completed_submission)
+{
+    while (!m_segments.empty() && m_segments.front().submission <= completed_submission) {
+        m_used -= m_segments.front().bytes;
+        m_segments.pop_front();
+    }
+
+    while (!m_oversized.empty() && m_oversized.front().closed
+           && m_oversized.front().submission <= completed_submission) {
+        m_device.destroyBuffer(m_oversized.front().buffer, hostAllocator());
+        m_allocator->free(m_oversized.front().memory);
+        m_oversized.pop_front();
+    }
+
+    // Once everything is back we can start from the front again, which keeps large uploads from
+    // having to wrap.
+    if (m_used == 0) {
+        m_head = 0;
+    }
+}
+
+}  // namespace shiny::graphics
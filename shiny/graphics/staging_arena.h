@@ -0,0 +1,82 @@
+#pragma once
+
+#include "graphics/memory_allocator.h"
+
+#include <deque>
+
+namespace shiny::graphics {
+
+/*
+A slice of the staging arena. `data` is already mapped; write the upload into it and use
+`buffer`/`offset` as the source of the transfer command.
+*/
+struct staging_region
+{
+    vk::Buffer     buffer;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size   = 0;
+    void*          data   = nullptr;
+
+    explicit operator bool() const { return static_cast<bool>(buffer); }
+};
+
+/*
+One big host visible buffer that every upload bump-allocates its staging memory from, used as a
+ring. Instead of creating, allocating, mapping and freeing a staging buffer per upload, the space is
+simply handed back once the GPU is done reading it.
+
+The arena doesn't know about fences itself. Callers number their submissions with a monotonically
+increasing id, `close()` everything allocated so far under the id of the submission that reads it,
+and later `reclaim()` with the id of the latest submission known to be complete.
+
+Since `close()` takes everything allocated so far, only the thread that submits, the render
+thread, allocates. Workers can still fill staging memory in parallel, in slices allocated for them
+up front the way texture_loader::load does, as long as they are done before the submission.
+*/
+class staging_arena
+{
+public:
+    void init(vk::Device device, memory_allocator& allocator, vk::DeviceSize capacity);
+    void destroy();
+
+    // Returns an empty region when the ring doesn't have enough free space right now. What it
+    // does return counts as uploaded in the thread's io_counters, see startup_report.h.
+    staging_region allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+
+    void close(uint64_t submission);
+    void reclaim(uint64_t completed_submission);
+
+    vk::DeviceSize capacity() const { return m_capacity; }
+    vk::DeviceSize used() const { return m_used; }
+
+private:
+    struct segment
+    {
+        uint64_t       submission = 0;
+        vk::DeviceSize bytes      = 0;
+    };
+
+    // uploads bigger than the whole ring get their own buffer that lives as long as its segment
+    struct oversize
+    {
+        uint64_t   submission = 0;
+        bool       closed     = false;
+        vk::Buffer buffer;
+        allocation memory;
+    };
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::Buffer     m_buffer;
+    allocation     m_memory;
+    vk::DeviceSize m_capacity   = 0;
+    vk::DeviceSize m_head       = 0;
+    vk::DeviceSize m_used       = 0;
+    vk::DeviceSize m_open_bytes = 0;
+
+    std::deque<segment>  m_segments;
+    std::deque<oversize> m_oversized;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,293 @@
+#include "graphics/stream_scheduler.h"
+
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+// How much every read or decode weighs in the averages of their cost
+const double average_weight = 0.125;
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+stream_scheduler::init(core::io_queue& io, jobs::scheduler& jobs, const streaming_budget& budget)
+{
+    m_io      = &io;
+    m_jobs    = &jobs;
+    m_budget  = budget;
+    m_running = true;
+}
+
+void
+stream_scheduler::shutdown()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+    m_reads.clear();
+    m_decodes.clear();
+}
+
+void
+stream_scheduler::setBudget(const streaming_budget& budget)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_budget = budget;
+}
+
+stream_scheduler::ticket
+stream_scheduler::read(std::vector<std::string> paths,
+                       uint64_t                 bytes,
+                       float                    importance,
+                       core::io_queue::callback done)
+{
+    queued_read r;
+    r.paths      = std::move(paths);
+    r.bytes      = bytes;
+    r.importance = importance;
+    r.done       = std::move(done);
+    return enqueue(std::move(r));
+}
+
+stream_scheduler::ticket
+stream_scheduler::read(std::string              path,
+                       uint64_t                 offset,
+                       size_t                   size,
+                       float                    importance,
+                       core::io_queue::callback done)
+{
+    queued_read r;
+    r.paths.push_back(std::move(path));
+    r.offset     = offset;
+    r.size       = size;
+    r.bytes      = size;
+    r.importance = importance;
+    r.done       = std::move(done);
+    return enqueue(std::move(r));
+}
+
+stream_scheduler::ticket
+stream_scheduler::enqueue(queued_read r)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    r.id = m_next++;
+    if (!m_running) {
+        return r.id;
+    }
+
+    const ticket id    = r.id;
+    auto         ahead = [&](const queued_read& q) { return q.importance >= r.importance; };
+    if (readFits(r) && std::none_of(m_reads.begin(), m_reads.end(), ahead)) {
+        startRead(std::move(r));
+    } else {
+        m_reads.push_back(std::move(r));
+    }
+    return id;
+}
+
+void
+stream_scheduler::setImportance(ticket request, float importance)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (queued_read& r : m_reads) {
+        if (r.id == request) {
+            r.importance = importance;
+            return;
+        }
+    }
+
+    for (started_read& s : m_started) {
+        if (s.id == request) {
+            if (importance > s.importance) {
+                m_io->setPriority(s.io, core::io_priority::high);
+                s.importance = importance;
+            }
+            return;
+        }
+    }
+}
+
+bool
+stream_scheduler::cancel(ticket request)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_reads.size(); ++i) {
+        if (m_reads[i].id == request) {
+            m_reads.erase(m_reads.begin() + i);
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < m_started.size(); ++i) {
+        if (m_started[i].id == request) {
+            if (!m_io->cancel(m_started[i].io)) {
+                return false;
+            }
+            m_started.erase(m_started.begin() + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+stream_scheduler::decode(jobs::counter& group, float importance, std::function<void()> job)
+{
+    queued_decode d;
+    d.group      = &group;
+    d.importance = importance;
+    d.job        = std::move(job);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_running) {
+        return;
+    }
+
+    auto ahead = [&](const queued_decode& q) { return q.importance >= importance; };
+    if (decodeFits() && std::none_of(m_decodes.begin(), m_decodes.end(), ahead)) {
+        startDecode(std::move(d));
+    } else {
+        m_decodes.push_back(std::move(d));
+    }
+}
+
+bool
+stream_scheduler::upload(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_upload_bytes > 0 && m_budget.upload_bytes > 0
+        && m_upload_bytes + bytes > m_budget.upload_bytes) {
+        return false;
+    }
+
+    m_upload_bytes += bytes;
+    return true;
+}
+
+void
+stream_scheduler::update()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_read_bytes    = 0;
+    m_reads_begun   = 0;
+    m_decode_ms     = 0.0;
+    m_decodes_begun = 0;
+    m_upload_bytes  = 0;
+
+    // Most important first, and in the order they were queued among the equally important
+    auto important = [](const auto& a, const auto& b) { return a.importance > b.importance; };
+
+    std::stable_sort(m_reads.begin(), m_reads.end(), important);
+    size_t next = 0;
+    while (next < m_reads.size() && readFits(m_reads[next])) {
+        startRead(std::move(m_reads[next++]));
+    }
+    m_reads.erase(m_reads.begin(), m_reads.begin() + next);
+
+    std::stable_sort(m_decodes.begin(), m_decodes.end(), important);
+    next = 0;
+    while (next < m_decodes.size() && decodeFits()) {
+        startDecode(std::move(m_decodes[next++]));
+    }
+    m_decodes.erase(m_decodes.begin(), m_decodes.begin() + next);
+}
+
+size_t
+stream_scheduler::queued() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_reads.size() + m_decodes.size();
+}
+
+// A budget of 0 has no limit
+bool
+stream_scheduler::readFits(const queued_read& r) const
+{
+    return m_reads_begun == 0 || m_budget.io_bytes == 0
+           || m_read_bytes + readBytes(r) <= m_budget.io_bytes;
+}
+
+uint64_t
+stream_scheduler::readBytes(const queued_read& r) const
+{
+    return r.bytes > 0 ? r.bytes : (uint64_t)m_file_bytes;
+}
+
+/*
+The callback may run before read() has even returned, but it has to take the mutex first, which
+is held until the read is among the started ones.
+*/
+void
+stream_scheduler::startRead(queued_read r)
+{
+    m_read_bytes += readBytes(r);
+    ++m_reads_begun;
+
+    const ticket             id    = r.id;
+    const bool               whole = r.size == 0;
+    core::io_queue::callback done  = std::move(r.done);
+    auto finish = [this, id, whole, done](core::mapped_file&& file, size_t which) {
+        finished(id, whole && file.isOpen() ? file.size() : 0);
+        done(std::move(file), which);
+    };
+
+    started_read s;
+    s.id         = id;
+    s.importance = r.importance;
+    if (whole) {
+        s.io = m_io->read(std::move(r.paths), core::io_priority::normal, std::move(finish));
+    } else {
+        s.io = m_io->read(std::move(r.paths.front()), r.offset, r.size, core::io_priority::normal,
+                          std::move(finish));
+    }
+    m_started.push_back(s);
+}
+
+// Whole files that were read count towards their average, the ranges' size was known up front
+void
+stream_scheduler::finished(ticket id, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_started.size(); ++i) {
+        if (m_started[i].id == id) {
+            m_started.erase(m_started.begin() + i);
+            break;
+        }
+    }
+
+    if (bytes > 0) {
+        m_file_bytes += ((double)bytes - m_file_bytes) * average_weight;
+    }
+}
+
+bool
+stream_scheduler::decodeFits() const
+{
+    return m_decodes_begun == 0 || m_budget.decode_ms <= 0.f
+           || m_decode_ms + m_decode_avg <= m_budget.decode_ms;
+}
+
+void
+stream_scheduler::startDecode(queued_decode d)
+{
+    m_decode_ms += m_decode_avg;
+    ++m_decodes_begun;
+
+    auto timed = [this, job = std::move(d.job)]() {
+        const int64_t start = core::profileNow();
+        job();
+        const double milliseconds = (double)(core::profileNow() - start) * 1e-6;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_decode_avg += (milliseconds - m_decode_avg) * average_weight;
+    };
+    m_jobs->run(*d.group, std::move(timed), core::thread_class::background);
+}
+
+}  // namespace shiny::graphics
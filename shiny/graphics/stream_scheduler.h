@@ -0,0 +1,148 @@
+#pragma once
+
+#include "core/io_queue.h"
+#include "jobs/scheduler.h"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+// How much of each a frame's streaming may start, whoever it is for
+struct streaming_budget
+{
+    uint64_t io_bytes     = 32 * 1024 * 1024;  // read from disk, by the reads started
+    float    decode_ms    = 4.f;               // of worker time, by the decodes started
+    uint64_t upload_bytes = 16 * 1024 * 1024;  // staged for uploads
+};
+
+/*
+Where everything that streams, textures, their hot reloads and virtual texture tiles, queues its
+reads and decodes instead of starting them right away, so that together they stay within one
+streaming_budget a frame instead of each within its own. Whatever is queued starts most important
+first, importance being whatever the streamer makes of how large it is on screen, and a frame's
+first read, decode and upload always fits, so nothing is ever too large to stream at all.
+
+A read or decode only waits here if the frame's budget is spent or something more important is
+waiting already, otherwise it starts at once. update() starts what the next frame's budget has room
+for. A decode's cost is only known once it's done, so until then a decode is taken to cost as much
+as they have been on average.
+
+Reads can be cancelled until they start on the I/O queue, e.g. when what they are for leaves the
+view first. After that their callback runs regardless, and it's up to the streamer to drop it.
+*/
+class stream_scheduler
+{
+public:
+    using ticket = uint64_t;
+
+    static const ticket invalid_ticket = 0;
+
+    void init(core::io_queue& io, jobs::scheduler& jobs, const streaming_budget& budget);
+
+    // Drops whatever is still queued here without running it, along with any decode asked for
+    // after. Before the I/O queue shuts down.
+    void shutdown();
+
+    void                    setBudget(const streaming_budget& budget);
+    const streaming_budget& budget() const { return m_budget; }
+
+    // io_queue::read, queued. `bytes` is how much it reads, 0 if that isn't known, in which case
+    // it counts as much as whole files have been on average.
+    ticket read(std::vector<std::string> paths,
+                uint64_t                 bytes,
+                float                    importance,
+                core::io_queue::callback done);
+    ticket read(std::string              path,
+                uint64_t                 offset,
+                size_t                   size,
+                float                    importance,
+                core::io_queue::callback done);
+
+    // Until the read starts. One that is already queued on the I/O queue and becomes more
+    // important moves to the front of it instead.
+    void setImportance(ticket request, float importance);
+
+    // False if the read has already started, in which case its callback runs anyway
+    bool cancel(ticket request);
+
+    // Any thread, e.g. the I/O thread a read finished on: runs `job` on a worker, counted against
+    // `group`, once the budget has room for it
+    void decode(jobs::counter& group, float importance, std::function<void()> job);
+
+    // Render thread: takes `bytes` of the frame's upload budget, or returns false if it doesn't
+    // have that much left
+    bool upload(uint64_t bytes);
+
+    // Once a frame, before anything streams: starts the frame's budgets over, and whatever is
+    // queued that they have room for
+    void update();
+
+    // Reads and decodes queued here, not counting the ones that have started
+    size_t queued() const;
+
+private:
+    struct queued_read
+    {
+        ticket                   id = invalid_ticket;
+        std::vector<std::string> paths;
+        uint64_t                 offset     = 0;
+        size_t                   size       = 0;  // of a range, 0 for whole files
+        uint64_t                 bytes      = 0;  // counted against the budget, 0 for the average
+        float                    importance = 0.f;
+        core::io_queue::callback done;
+    };
+
+    struct queued_decode
+    {
+        jobs::counter*        group      = nullptr;
+        float                 importance = 0.f;
+        std::function<void()> job;
+    };
+
+    // On the I/O queue, until their callback runs
+    struct started_read
+    {
+        ticket                 id         = invalid_ticket;
+        core::io_queue::ticket io         = core::io_queue::invalid_ticket;
+        float                  importance = 0.f;
+    };
+
+    ticket enqueue(queued_read r);
+
+    // With the mutex held
+    bool     readFits(const queued_read& r) const;
+    uint64_t readBytes(const queued_read& r) const;
+    void     startRead(queued_read r);
+    bool     decodeFits() const;
+    void     startDecode(queued_decode d);
+
+    void finished(ticket id, size_t bytes);
+
+    core::io_queue*  m_io   = nullptr;
+    jobs::scheduler* m_jobs = nullptr;
+    streaming_budget m_budget;
+    bool             m_running = false;
+
+    mutable std::mutex         m_mutex;
+    std::vector<queued_read>   m_reads;  // in the order they were made
+    std::vector<queued_decode> m_decodes;
+    std::vector<started_read>  m_started;
+    ticket                     m_next = 1;
+
+    // Spent in this frame
+    uint64_t m_read_bytes    = 0;
+    uint32_t m_reads_begun   = 0;
+    double   m_decode_ms     = 0.0;
+    uint32_t m_decodes_begun = 0;
+    uint64_t m_upload_bytes  = 0;
+
+    // Running averages, of whole files read and of decodes
+    double m_file_bytes = 1024.0 * 1024.0;
+    double m_decode_avg = 1.0;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,168 @@
+#include "graphics/submit_batch.h"
+
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace shiny::graphics {
+
+void
+submit_batch::begin(uint32_t device_mask)
+{
+    submission s;
+    s.device_mask   = device_mask;
+    s.first_wait    = (uint32_t)m_wait_semaphores.size();
+    s.first_command = (uint32_t)m_commands.size();
+    s.first_signal  = (uint32_t)m_signal_semaphores.size();
+    m_submissions.push_back(s);
+}
+
+void
+submit_batch::wait(vk::Semaphore semaphore, vk::PipelineStageFlags stages, uint64_t value)
+{
+    assert(!m_submissions.empty() && "wait() needs a begin() first!");
+
+    m_wait_semaphores.push_back(semaphore);
+    m_wait_stages.push_back(stages);
+    m_wait_values.push_back(value);
+
+    submission& s = m_submissions.back();
+    ++s.wait_count;
+    s.timeline |= value != 0;
+}
+
+void
+submit_batch::execute(vk::CommandBuffer commands)
+{
+    assert(!m_submissions.empty() && "execute() needs a begin() first!");
+
+    m_commands.push_back(commands);
+    ++m_submissions.back().command_count;
+}
+
+void
+submit_batch::signal(vk::Semaphore semaphore, uint64_t value)
+{
+    assert(!m_submissions.empty() && "signal() needs a begin() first!");
+
+    m_signal_semaphores.push_back(semaphore);
+    m_signal_values.push_back(value);
+
+    submission& s = m_submissions.back();
+    ++s.signal_count;
+    s.timeline |= value != 0;
+}
+
+void
+submit_batch::fence(vk::Fence fence)
+{
+    assert(!m_submissions.empty() && "fence() needs a begin() first!");
+
+    m_submissions.back().fence = fence;
+}
+
+/*
+The infos are only built here, once nothing is going to be added anymore, since they point into
+the arrays that adding grows. Submissions without a timeline value don't get the timeline info,
+which is only valid with VK_KHR_timeline_semaphore enabled, and the same goes for the device group
+info of submissions that run on every GPU. Semaphores are waited for and signalled by the first GPU
+a submission runs on.
+*/
+uint32_t
+submit_batch::flush()
+{
+    if (m_submissions.empty()) {
+        return 0;
+    }
+
+    SHINY_PROFILE_FUNCTION();
+
+    m_infos.resize(m_submissions.size());
+    m_timeline_infos.resize(m_submissions.size());
+#if defined(VK_KHR_device_group)
+    m_group_infos.resize(m_submissions.size());
+    m_wait_devices.resize(m_wait_semaphores.size());
+    m_command_masks.resize(m_commands.size());
+    m_signal_devices.resize(m_signal_semaphores.size());
+#endif
+
+    for (size_t i = 0; i < m_submissions.size(); ++i) {
+        const submission& s = m_submissions[i];
+
+        m_infos[i] = vk::SubmitInfo()
+                       .setWaitSemaphoreCount(s.wait_count)
+                       .setPWaitSemaphores(m_wait_semaphores.data() + s.first_wait)
+                       .setPWaitDstStageMask(m_wait_stages.data() + s.first_wait)
+                       .setCommandBufferCount(s.command_count)
+                       .setPCommandBuffers(m_commands.data() + s.first_command)
+                       .setSignalSemaphoreCount(s.signal_count)
+                       .setPSignalSemaphores(m_signal_semaphores.data() + s.first_signal);
+
+        if (s.timeline) {
+            m_timeline_infos[i] = vk::TimelineSemaphoreSubmitInfoKHR()
+                                    .setWaitSemaphoreValueCount(s.wait_count)
+                                    .setPWaitSemaphoreValues(m_wait_values.data() + s.first_wait)
+                                    .setSignalSemaphoreValueCount(s.signal_count)
+                                    .setPSignalSemaphoreValues(m_signal_values.data()
+                                                               + s.first_signal);
+            m_infos[i].setPNext(&m_timeline_infos[i]);
+        }
+
+#if defined(VK_KHR_device_group)
+        if (s.device_mask != 0) {
+            uint32_t first = 0;
+            while (!(s.device_mask & (1u << first))) {
+                ++first;
+            }
+
+            uint32_t* waits   = m_wait_devices.data() + s.first_wait;
+            uint32_t* masks   = m_command_masks.data() + s.first_command;
+            uint32_t* signals = m_signal_devices.data() + s.first_signal;
+            std::fill(waits, waits + s.wait_count, first);
+            std::fill(masks, masks + s.command_count, s.device_mask);
+            std::fill(signals, signals + s.signal_count, first);
+
+            m_group_infos[i] = vk::DeviceGroupSubmitInfoKHR()
+                                 .setWaitSemaphoreCount(s.wait_count)
+                                 .setPWaitSemaphoreDeviceIndices(waits)
+                                 .setCommandBufferCount(s.command_count)
+                                 .setPCommandBufferDeviceMasks(masks)
+                                 .setSignalSemaphoreCount(s.signal_count)
+                                 .setPSignalSemaphoreDeviceIndices(signals)
+                                 .setPNext(m_infos[i].pNext);
+            m_infos[i].setPNext(&m_group_infos[i]);
+        }
+#endif
+    }
+
+    std::unique_lock<std::mutex> lock;
+    if (m_lock) {
+        lock = std::unique_lock<std::mutex>(*m_lock);
+    }
+
+    uint32_t calls = 0;
+    size_t   first = 0;
+    for (size_t i = 0; i < m_submissions.size(); ++i) {
+        if (!m_submissions[i].fence && i + 1 < m_submissions.size()) {
+            continue;
+        }
+
+        m_queue.submit(vk::ArrayProxy<const vk::SubmitInfo>((uint32_t)(i + 1 - first),
+                                                            m_infos.data() + first),
+                       m_submissions[i].fence);
+        first = i + 1;
+        ++calls;
+    }
+
+    m_submissions.clear();
+    m_wait_semaphores.clear();
+    m_wait_stages.clear();
+    m_wait_values.clear();
+    m_commands.clear();
+    m_signal_semaphores.clear();
+    m_signal_values.clear();
+    return calls;
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,95 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Collects what a frame submits to one queue, and submits it in as few vkQueueSubmit calls as it can,
+each of which costs the driver a lot however little it submits. One call takes any number of
+VkSubmitInfo, which start in order as if they had been submitted one after another, but only one
+fence, which signals once all of them are done. So flush() makes a call for every submission that
+was given a fence, ending with it, and one for whatever comes after the last. With timeline
+semaphores there are no fences but the frame's, and a queue's frame is a single call.
+
+Binary semaphores have to have their signal submitted before a wait on them is, so a batch that
+waits on what another queue's batch signals is flushed after it.
+
+With a device group, a submission runs on every GPU of the group unless begin() is given a mask of
+the ones it runs on, which then wait for and signal its semaphores as well.
+
+Like barrier_batch, it keeps its memory from one flush to the next.
+*/
+class submit_batch
+{
+public:
+    explicit submit_batch(vk::Queue queue = nullptr)
+      : m_queue(queue)
+    {}
+
+    vk::Queue queue() const { return m_queue; }
+    void      setQueue(vk::Queue queue) { m_queue = queue; }
+
+    // Held around the submits, if the queue is used from another thread as well, see
+    // present_thread. Null for none.
+    void setLock(std::mutex* mutex) { m_lock = mutex; }
+
+    // Starts the next submission, which the calls after it until the next begin() add to.
+    // `value` is only for timeline semaphores, binary ones ignore it. `device_mask` 0 is every GPU.
+    void begin(uint32_t device_mask = 0);
+    void wait(vk::Semaphore semaphore, vk::PipelineStageFlags stages, uint64_t value = 0);
+    void execute(vk::CommandBuffer commands);
+    void signal(vk::Semaphore semaphore, uint64_t value = 0);
+
+    // Signalled once the submission and every one before it is done, which ends the call it is in
+    void fence(vk::Fence fence);
+
+    // Submits everything since the last flush, and returns how many calls that took
+    uint32_t flush();
+
+    bool empty() const { return m_submissions.empty(); }
+
+private:
+    struct submission
+    {
+        uint32_t  first_wait    = 0;
+        uint32_t  wait_count    = 0;
+        uint32_t  first_command = 0;
+        uint32_t  command_count = 0;
+        uint32_t  first_signal  = 0;
+        uint32_t  signal_count  = 0;
+        bool      timeline      = false;  // has a value for any of its semaphores
+        uint32_t  device_mask   = 0;
+        vk::Fence fence;
+    };
+
+    vk::Queue   m_queue;
+    std::mutex* m_lock = nullptr;
+
+    std::vector<submission>             m_submissions;
+    std::vector<vk::Semaphore>          m_wait_semaphores;
+    std::vector<vk::PipelineStageFlags> m_wait_stages;
+    std::vector<uint64_t>               m_wait_values;
+    std::vector<vk::CommandBuffer>      m_commands;
+    std::vector<vk::Semaphore>          m_signal_semaphores;
+    std::vector<uint64_t>               m_signal_values;
+
+    // What flush() passes on, pointing into the above
+    std::vector<vk::SubmitInfo>                     m_infos;
+    std::vector<vk::TimelineSemaphoreSubmitInfoKHR> m_timeline_infos;
+#if defined(VK_KHR_device_group)
+    std::vector<vk::DeviceGroupSubmitInfoKHR> m_group_infos;
+    std::vector<uint32_t>                     m_wait_devices;  // indices, by semaphore
+    std::vector<uint32_t>                     m_command_masks;
+    std::vector<uint32_t>                     m_signal_devices;
+#endif
+};
+
+}  // namespace shiny::graphics
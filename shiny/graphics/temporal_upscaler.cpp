@@ -0,0 +1,428 @@
+#include "graphics/temporal_upscaler.h"
+
+#include "core/mapped_file.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Has to match local_size_x and local_size_y in motion.comp and taa.comp
+const uint32_t temporal_group_size = 8;
+
+// Both of them, storage images in the core set of formats and sampled with linear filtering
+const vk::Format motion_format  = vk::Format::eR16G16B16A16Sfloat;
+const vk::Format history_format = vk::Format::eR16G16B16A16Sfloat;
+
+// Jitter phases at the output resolution, more of them the more it is scaled up
+const float base_phases = 8.f;
+
+// The shaders' push constants
+struct motion_constants
+{
+    glm::mat4 reprojection;
+    glm::vec2 jitter;
+    int32_t   width  = 0;
+    int32_t   height = 0;
+};
+
+struct resolve_constants
+{
+    glm::vec2 jitter;
+    int32_t   render_width  = 0;
+    int32_t   render_height = 0;
+    int32_t   width         = 0;
+    int32_t   height        = 0;
+    float     feedback      = 0.f;
+    uint32_t  reset         = 0;
+};
+
+// The radical inverse of `index` in `base`, which spreads consecutive indices over [0, 1)
+float
+halton(uint32_t index, uint32_t base)
+{
+    float result   = 0.f;
+    float fraction = 1.f;
+    while (index > 0) {
+        fraction /= (float)base;
+        result += fraction * (float)(index % base);
+        index /= base;
+    }
+    return result;
+}
+
+uint32_t
+groups(uint32_t size)
+{
+    return (size + temporal_group_size - 1) / temporal_group_size;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+temporal_upscaler::init(vk::Device               device,
+                        memory_allocator&        allocator,
+                        layout_cache&            layouts,
+                        view_cache&              views,
+                        pipeline_cache&          pipelines,
+                        const temporal_settings& settings)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_settings  = settings;
+
+    auto binding = [](uint32_t number, vk::DescriptorType type) {
+        return vk::DescriptorSetLayoutBinding()
+          .setBinding(number)
+          .setDescriptorCount(1)
+          .setDescriptorType(type)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute);
+    };
+
+    // 0: the depth buffer, 1: the motion vectors
+    std::array<vk::DescriptorSetLayoutBinding, 2> motionbindings = {
+        binding(0, vk::DescriptorType::eCombinedImageSampler),
+        binding(1, vk::DescriptorType::eStorageImage),
+    };
+
+    // 0: the frame, 1: the motion vectors, 2: the history's layer before, 3: the one written
+    std::array<vk::DescriptorSetLayoutBinding, 4> resolvebindings = {
+        binding(0, vk::DescriptorType::eCombinedImageSampler),
+        binding(1, vk::DescriptorType::eCombinedImageSampler),
+        binding(2, vk::DescriptorType::eCombinedImageSampler),
+        binding(3, vk::DescriptorType::eStorageImage),
+    };
+
+    m_motion_set_layout = layouts.descriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo()
+        .setBindingCount((uint32_t)motionbindings.size())
+        .setPBindings(motionbindings.data()));
+    m_resolve_set_layout = layouts.descriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo()
+        .setBindingCount((uint32_t)resolvebindings.size())
+        .setPBindings(resolvebindings.data()));
+
+    auto createLayout = [&](const vk::DescriptorSetLayout& setlayout, uint32_t constantsize) {
+        auto constants = vk::PushConstantRange()
+                           .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                           .setOffset(0)
+                           .setSize(constantsize);
+
+        auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                            .setSetLayoutCount(1)
+                            .setPSetLayouts(&setlayout)
+                            .setPushConstantRangeCount(1)
+                            .setPPushConstantRanges(&constants);
+
+        return layouts.pipelineLayout(layoutinfo);
+    };
+
+    m_motion_layout  = createLayout(m_motion_set_layout, sizeof(motion_constants));
+    m_resolve_layout = createLayout(m_resolve_set_layout, sizeof(resolve_constants));
+
+    auto createPipeline = [&](const char*        path,
+                              vk::PipelineLayout layout,
+                              vk::ShaderModule&  shader) {
+        core::mapped_file code(path);
+
+        auto shaderinfo = vk::ShaderModuleCreateInfo()
+                            .setCodeSize(code.size())
+                            .setPCode((const uint32_t*)code.data());
+
+        shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+        auto pipelineinfo =
+          vk::ComputePipelineCreateInfo()
+            .setStage(vk::PipelineShaderStageCreateInfo()
+                        .setStage(vk::ShaderStageFlagBits::eCompute)
+                        .setModule(shader)
+                        .setPName("main"))
+            .setLayout(layout);
+
+        return m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+    };
+
+    m_motion_pipeline = createPipeline("shaders/motion_comp.spv", m_motion_layout, m_motion_shader);
+    if (!m_settings.upscaler) {
+        m_resolve_pipeline =
+          createPipeline("shaders/taa_comp.spv", m_resolve_layout, m_resolve_shader);
+    }
+
+    // The history and the frame are sampled between their texels, and never off their edges
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(vk::Filter::eLinear)
+                         .setMinFilter(vk::Filter::eLinear)
+                         .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                         .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setMinLod(0.f)
+                         .setMaxLod(0.f);
+
+    m_sampler = views.sampler(samplerinfo);
+}
+
+void
+temporal_upscaler::destroy()
+{
+    for (vk::ImageView& view : m_history_views) {
+        m_device.destroyImageView(view, hostAllocator());
+        view = nullptr;
+    }
+    m_device.destroyImageView(m_motion_view, hostAllocator());
+    m_device.destroyImage(m_history, hostAllocator());
+    m_device.destroyImage(m_motion, hostAllocator());
+    m_allocator->free(m_history_memory);
+    m_allocator->free(m_motion_memory);
+    m_descriptors.destroy();
+
+    m_device.destroyPipeline(m_motion_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_motion_shader, hostAllocator());
+    if (m_resolve_pipeline) {
+        m_device.destroyPipeline(m_resolve_pipeline, hostAllocator());
+        m_device.destroyShaderModule(m_resolve_shader, hostAllocator());
+        m_resolve_pipeline = nullptr;
+        m_resolve_shader   = nullptr;
+    }
+
+    m_motion_view = nullptr;
+    m_motion      = nullptr;
+    m_history     = nullptr;
+}
+
+/*
+The motion vectors are at the render resolution and the history at the output's, so only the
+history survives the render resolution changing, but neither is worth keeping: pixels at another
+resolution are jittered over other positions, and a swap chain that was recreated may well show
+something else entirely.
+
+Both images are created undefined, and their first use takes both layers of the history to the
+general layout, where they stay.
+*/
+void
+temporal_upscaler::create(vk::Extent2D    render,
+                          vk::Extent2D    output,
+                          vk::ImageView   color,
+                          vk::ImageView   depth,
+                          deletion_queue& deletions,
+                          uint64_t        frame)
+{
+    retire(deletions, frame);
+
+    m_render = render;
+    m_output = output;
+    m_color  = color;
+    m_depth  = depth;
+    m_layer  = 0;
+    m_reset  = true;
+
+    const float scale = (float)output.width / (float)std::max(render.width, 1u);
+    m_phases          = (uint32_t)std::ceil(base_phases * std::max(scale * scale, 1.f));
+
+    auto createImage = [&](vk::Extent2D extent, vk::Format format, uint32_t layers,
+                           vk::ImageUsageFlags usage, allocation& memory) {
+        auto imageinfo = vk::ImageCreateInfo()
+                           .setImageType(vk::ImageType::e2D)
+                           .setExtent(vk::Extent3D(extent.width, extent.height, 1))
+                           .setMipLevels(1)
+                           .setArrayLayers(layers)
+                           .setFormat(format)
+                           .setTiling(vk::ImageTiling::eOptimal)
+                           .setInitialLayout(vk::ImageLayout::eUndefined)
+                           .setUsage(usage)
+                           .setSamples(vk::SampleCountFlagBits::e1)
+                           .setSharingMode(vk::SharingMode::eExclusive);
+
+        vk::Image image = m_device.createImage(imageinfo, hostAllocator());
+        memory          = m_allocator->allocate(m_device.getImageMemoryRequirements(image),
+                                                vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                                memory_allocator::resource_kind::optimal,
+                                                memory_category::render_target);
+        m_device.bindImageMemory(image, memory.memory, memory.offset);
+        return image;
+    };
+
+    auto createView = [&](vk::Image image, vk::Format format, uint32_t layer) {
+        auto viewinfo = vk::ImageViewCreateInfo()
+                          .setImage(image)
+                          .setViewType(vk::ImageViewType::e2D)
+                          .setFormat(format)
+                          .setSubresourceRange(vk::ImageSubresourceRange(
+                            vk::ImageAspectFlagBits::eColor, 0, 1, layer, 1));
+        return m_device.createImageView(viewinfo, hostAllocator());
+    };
+
+    const auto storage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled;
+
+    // The history is blitted to the target, which converts it to the target's format
+    m_motion  = createImage(render, motion_format, 1, storage, m_motion_memory);
+    m_history = createImage(output, history_format, 2,
+                            storage | vk::ImageUsageFlagBits::eTransferSrc, m_history_memory);
+
+    m_motion_view = createView(m_motion, motion_format, 0);
+    for (uint32_t layer = 0; layer < 2; ++layer) {
+        m_history_views[layer] = createView(m_history, history_format, layer);
+    }
+
+    m_descriptors.init(m_device,
+                       { { vk::DescriptorType::eCombinedImageSampler, 3 },
+                         { vk::DescriptorType::eStorageImage, 1 } },
+                       3);
+
+    m_motion_set = m_descriptors.allocate(m_motion_set_layout);
+
+    auto depthinfo  = vk::DescriptorImageInfo(m_sampler, depth,
+                                              vk::ImageLayout::eShaderReadOnlyOptimal);
+    auto motioninfo = vk::DescriptorImageInfo(m_sampler, m_motion_view, vk::ImageLayout::eGeneral);
+    auto colorinfo  = vk::DescriptorImageInfo(m_sampler, color,
+                                              vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    auto write = [](vk::DescriptorSet set, uint32_t binding, vk::DescriptorType type,
+                    const vk::DescriptorImageInfo& info) {
+        return vk::WriteDescriptorSet()
+          .setDstSet(set)
+          .setDstBinding(binding)
+          .setDescriptorCount(1)
+          .setDescriptorType(type)
+          .setPImageInfo(&info);
+    };
+
+    std::vector<vk::WriteDescriptorSet> writes = {
+        write(m_motion_set, 0, vk::DescriptorType::eCombinedImageSampler, depthinfo),
+        write(m_motion_set, 1, vk::DescriptorType::eStorageImage, motioninfo),
+    };
+
+    // Each layer's set reads the other one
+    std::array<vk::DescriptorImageInfo, 2> previous;
+    std::array<vk::DescriptorImageInfo, 2> written;
+    for (uint32_t layer = 0; layer < 2; ++layer) {
+        m_resolve_sets[layer] = m_descriptors.allocate(m_resolve_set_layout);
+
+        previous[layer] = vk::DescriptorImageInfo(m_sampler, m_history_views[1 - layer],
+                                                  vk::ImageLayout::eGeneral);
+        written[layer]  = vk::DescriptorImageInfo(nullptr, m_history_views[layer],
+                                                  vk::ImageLayout::eGeneral);
+
+        const vk::DescriptorSet set = m_resolve_sets[layer];
+        writes.push_back(write(set, 0, vk::DescriptorType::eCombinedImageSampler, colorinfo));
+        writes.push_back(write(set, 1, vk::DescriptorType::eCombinedImageSampler, motioninfo));
+        writes.push_back(
+          write(set, 2, vk::DescriptorType::eCombinedImageSampler, previous[layer]));
+        writes.push_back(write(set, 3, vk::DescriptorType::eStorageImage, written[layer]));
+    }
+    m_device.updateDescriptorSets(writes, nullptr);
+}
+
+glm::vec2
+temporal_upscaler::jitter(uint64_t number) const
+{
+    const uint32_t index = (uint32_t)(number % m_phases) + 1;
+    return glm::vec2(halton(index, 2) - 0.5f, halton(index, 3) - 0.5f);
+}
+
+/*
+The resolve reads the motion vectors of texels around the ones it's at, so there's a barrier
+between the passes. Everything else, the blit reading the layer that was written included, is up
+to the render graph.
+*/
+void
+temporal_upscaler::record(vk::CommandBuffer command_buffer, const temporal_frame& frame)
+{
+    const bool reset = m_reset || frame.reset;
+    m_layer          = 1 - m_layer;
+    m_reset          = false;
+
+    motion_constants motion;
+    motion.reprojection = frame.reprojection;
+    motion.jitter       = frame.jitter;
+    motion.width        = (int32_t)m_render.width;
+    motion.height       = (int32_t)m_render.height;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_motion_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_motion_layout, 0,
+                                      m_motion_set, nullptr);
+    command_buffer.pushConstants(m_motion_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof(motion), &motion);
+    command_buffer.dispatch(groups(m_render.width), groups(m_render.height), 1);
+
+    auto written = vk::ImageMemoryBarrier()
+                     .setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+                     .setDstAccessMask(vk::AccessFlagBits::eShaderRead)
+                     .setOldLayout(vk::ImageLayout::eGeneral)
+                     .setNewLayout(vk::ImageLayout::eGeneral)
+                     .setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                     .setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+                     .setImage(m_motion)
+                     .setSubresourceRange(
+                       vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::PipelineStageFlagBits::eComputeShader,
+                                   vk::DependencyFlags(), nullptr, nullptr, written);
+
+    if (m_settings.upscaler) {
+        upscale_inputs inputs;
+        inputs.color         = m_color;
+        inputs.depth         = m_depth;
+        inputs.motion        = m_motion_view;
+        inputs.output        = m_history;
+        inputs.output_view   = m_history_views[m_layer];
+        inputs.render_extent = m_render;
+        inputs.output_extent = m_output;
+        inputs.jitter        = frame.jitter;
+        inputs.reset         = reset;
+        m_settings.upscaler(command_buffer, inputs);
+        return;
+    }
+
+    resolve_constants resolve;
+    resolve.jitter        = frame.jitter;
+    resolve.render_width  = (int32_t)m_render.width;
+    resolve.render_height = (int32_t)m_render.height;
+    resolve.width         = (int32_t)m_output.width;
+    resolve.height        = (int32_t)m_output.height;
+    resolve.feedback      = std::clamp(m_settings.feedback, 0.f, 1.f);
+    resolve.reset         = reset ? 1 : 0;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_resolve_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_resolve_layout, 0,
+                                      m_resolve_sets[m_layer], nullptr);
+    command_buffer.pushConstants(m_resolve_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof(resolve), &resolve);
+    command_buffer.dispatch(groups(m_output.width), groups(m_output.height), 1);
+}
+
+// The frames in flight may still be resolving into the old ones
+void
+temporal_upscaler::retire(deletion_queue& deletions, uint64_t frame)
+{
+    if (!m_history) {
+        return;
+    }
+
+    for (vk::ImageView& view : m_history_views) {
+        deletions.push(frame, view);
+        view = nullptr;
+    }
+    deletions.push(frame, m_motion_view);
+    deletions.push(frame, m_motion);
+    deletions.push(frame, m_motion_memory);
+    deletions.push(frame, m_history);
+    deletions.push(frame, m_history_memory);
+
+    descriptor_allocator old = m_descriptors;
+    deletions.pushAction(frame, [old]() mutable { old.destroy(); });
+
+    m_descriptors    = descriptor_allocator();
+    m_motion_view    = nullptr;
+    m_motion         = nullptr;
+    m_motion_memory  = allocation();
+    m_history        = nullptr;
+    m_history_memory = allocation();
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "graphics/deletion_queue.h"
+#include "graphics/descriptor_allocator.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/view_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+namespace shiny::graphics {
+
+/*
+What a temporal upscaler works from, for one frame. All of the images are single sampled, the
+render resolution ones are in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and the rest in
+VK_IMAGE_LAYOUT_GENERAL, with whatever wrote them visible to compute shaders.
+*/
+struct upscale_inputs
+{
+    vk::ImageView color;   // the frame, at the render resolution
+    vk::ImageView depth;   // its depth, reversed: 1 at the near plane, 0 infinitely far
+    vk::ImageView motion;  // .xy: where every pixel was the frame before, minus where it is, in UV
+    vk::Image     output;  // at the output resolution, R16G16B16A16_SFLOAT with storage usage
+    vk::ImageView output_view;
+    vk::Extent2D  render_extent;
+    vk::Extent2D  output_extent;
+    glm::vec2     jitter = glm::vec2(0.f);  // the frame's, in render pixels
+    bool          reset  = false;           // nothing before this frame is of any use
+};
+
+// Records a vendor's upscaler, e.g. one of the FSR 2 class, into the frame's command buffer
+using upscale_function = std::function<void(vk::CommandBuffer, const upscale_inputs&)>;
+
+// See temporal_upscaler
+struct temporal_settings
+{
+    bool  enabled  = false;
+    float feedback = 0.9f;  // of the history kept every frame, where none of it is rejected
+
+    // Takes over from the built-in resolve, if set
+    upscale_function upscaler;
+};
+
+// How the camera moved, for one frame's resolve
+struct temporal_frame
+{
+    glm::mat4 reprojection = glm::mat4(1.f);  // this frame's clip space to the frame before's
+    glm::vec2 jitter       = glm::vec2(0.f);  // in render pixels
+    bool      reset        = false;
+};
+
+/*
+Temporal anti-aliasing, and upscaling along with it: every frame is rendered with its pixels a
+little off their centers, somewhere else each frame, and the resolve puts them together in a
+history at the output resolution, which has more detail than any one frame had if the frames are
+rendered at a lower resolution than that, as well as smoother edges.
+
+Two compute passes, recorded after the main pass:
+
+ - motion vectors, from the depth buffer and how the camera moved since the frame before. Each
+   pixel takes the nearest depth around it, so edges move with what is in front. Anything that moves
+   in the scene by itself, rather than with the camera, has none of its own.
+ - the resolve, which looks up where every output pixel was in the history, clamps what it finds to
+   the colors around it in the frame, so that what was uncovered or changed isn't smeared, and
+   blends in the frame's nearest pixel by how close it is.
+
+The history has two layers, which the resolve takes turns writing, reading the other. Another
+upscaler can take the resolve's place, with the same motion vectors and output, see
+temporal_settings::upscaler.
+*/
+class temporal_upscaler
+{
+public:
+    void init(vk::Device               device,
+              memory_allocator&        allocator,
+              layout_cache&            layouts,
+              view_cache&              views,
+              pipeline_cache&          pipelines,
+              const temporal_settings& settings);
+    void destroy();
+
+    // Creates the motion vectors and history for frames of `render` rendered into `color` and
+    // `depth`, and resolved to `output`, retiring the old ones with `frame`. The history starts
+    // over.
+    void create(vk::Extent2D    render,
+                vk::Extent2D    output,
+                vk::ImageView   color,
+                vk::ImageView   depth,
+                deletion_queue& deletions,
+                uint64_t        frame);
+
+    // Where frame `number` is rendered within its pixels, in render pixels from their centers: a
+    // Halton sequence with more phases the more pixels each rendered one is scaled up to
+    glm::vec2 jitter(uint64_t number) const;
+
+    // Records both passes. The color and depth have to be in
+    // VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL and visible to compute shaders, as do whatever read
+    // the output and motion before have to be done, see render_graph.
+    void record(vk::CommandBuffer command_buffer, const temporal_frame& frame);
+
+    // Undefined once created, and in VK_IMAGE_LAYOUT_GENERAL from their first use on, see
+    // render_graph. The output layer is the one the last record() wrote.
+    vk::Image     motionImage() const { return m_motion; }
+    vk::ImageView motionView() const { return m_motion_view; }
+    vk::Image     historyImage() const { return m_history; }
+    vk::ImageView historyView(uint32_t layer) const { return m_history_views[layer]; }
+    uint32_t      outputLayer() const { return m_layer; }
+
+private:
+    void retire(deletion_queue& deletions, uint64_t frame);
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+    temporal_settings m_settings;
+
+    vk::DescriptorSetLayout m_motion_set_layout;  // owned by the layout_cache
+    vk::DescriptorSetLayout m_resolve_set_layout;
+    vk::PipelineLayout      m_motion_layout;
+    vk::PipelineLayout      m_resolve_layout;
+    vk::ShaderModule        m_motion_shader;
+    vk::ShaderModule        m_resolve_shader;
+    vk::Pipeline            m_motion_pipeline;
+    vk::Pipeline            m_resolve_pipeline;
+    vk::Sampler             m_sampler;  // owned by the view_cache
+
+    vk::Image                        m_motion;
+    allocation                       m_motion_memory;
+    vk::ImageView                    m_motion_view;
+    vk::Image                        m_history;
+    allocation                       m_history_memory;
+    std::array<vk::ImageView, 2>     m_history_views;  // a layer each
+    descriptor_allocator             m_descriptors;    // a new one with every history
+    vk::DescriptorSet                m_motion_set;
+    std::array<vk::DescriptorSet, 2> m_resolve_sets;  // writing the layer of their index
+    vk::ImageView                    m_color;
+    vk::ImageView                    m_depth;
+    vk::Extent2D                     m_render;
+    vk::Extent2D                     m_output;
+    uint32_t                         m_phases = 8;
+    uint32_t                         m_layer  = 0;
+    bool                             m_reset  = true;
+};
+
+}  // namespace shiny::graphics
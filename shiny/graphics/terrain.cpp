@@ -0,0 +1,757 @@
+#include "graphics/terrain.h"
+
+#include "core/profiler.h"
+#include "graphics/barrier_batch.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+using shiny::graphics::terrain_tile_size;
+using shiny::graphics::terrain_window_tiles;
+
+// Quads across a tile of a ring, which has four of them and a strip between the middle two along
+// either side, so a level is 4 * 64 + 1 quads across. Has to match terrain.vert.
+const int32_t ring_tile_quads = 64;
+
+// Texels across a layer of the heights
+const uint32_t window_texels = terrain_window_tiles * terrain_tile_size;
+
+// Tile reads on the I/O queue at once, and tiles uploaded a frame, which together bound how far
+// the heights lag behind the camera
+const uint32_t max_terrain_reads   = 64;
+const uint32_t max_terrain_uploads = 32;
+
+// A level's tiles and strips, and its trim
+const uint32_t max_level_instances = 18;
+
+// Along with the mirroring in instance::info
+const uint32_t no_coarser_layer = 0xff;
+
+// terrain.vert's and terrain.frag's push constants
+struct terrain_constants
+{
+    glm::mat4 view_projection;
+    glm::vec4 map;  // the origin's x and y, texel spacing, height scale
+    glm::vec3 sun_direction;
+    float     size = 0.f;  // texels across the heightmap
+    glm::vec3 sun_color;
+    float     unused = 0.f;
+};
+
+bool
+isPowerOfTwo(uint32_t value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+// Rounded towards negative infinity, unlike /, for tiles on the far side of the origin
+int32_t
+floorDiv(int32_t value, int32_t divisor)
+{
+    return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+// The least positive remainder
+int32_t
+wrap(int32_t value, int32_t divisor)
+{
+    return ((value % divisor) + divisor) % divisor;
+}
+
+// Tiles along a side of a level
+uint32_t
+tilesAlong(uint32_t size, uint32_t level)
+{
+    return std::max((size >> level) / terrain_tile_size, 1u);
+}
+
+// Whether any of the box is on the inside of every plane, by its corner furthest along the normal
+bool
+intersects(const shiny::graphics::frustum& view, const glm::vec3& low, const glm::vec3& high)
+{
+    for (const glm::vec4& plane : view.planes) {
+        const glm::vec3 corner(plane.x >= 0.f ? high.x : low.x, plane.y >= 0.f ? high.y : low.y,
+                               plane.z >= 0.f ? high.z : low.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+vk::ImageSubresourceRange
+layerRange(uint32_t layers)
+{
+    return vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, layers);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+uint32_t
+terrainLevels(uint32_t size)
+{
+    uint32_t levels = 1;
+    while ((size >> (levels - 1)) > terrain_tile_size) {
+        ++levels;
+    }
+    return levels;
+}
+
+// Fetched in the vertex shader, which filters the texels itself, so linear filtering isn't needed
+bool
+clipmap_terrain::supported(vk::PhysicalDevice physical_device)
+{
+    const vk::FormatProperties properties =
+      physical_device.getFormatProperties(vk::Format::eR16Unorm);
+    return (bool)(properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage);
+}
+
+void
+clipmap_terrain::init(vk::Device         device,
+                      memory_allocator&  allocator,
+                      layout_cache&      layouts,
+                      view_cache&        views,
+                      stream_scheduler&  streams,
+                      const std::string& path,
+                      uint32_t           frames)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_device      = device;
+    m_allocator   = &allocator;
+    m_streams     = &streams;
+    m_path        = path;
+    m_frames      = frames;
+    m_initialized = false;
+
+    core::mapped_file file;
+    if (!file.read(path, 0, sizeof(terrain_header))) {
+        throw std::runtime_error("Failed to read " + path + "!");
+    }
+    std::memcpy(&m_header, file.data(), sizeof(m_header));
+
+    const bool valid = std::memcmp(m_header.magic, terrain_header().magic, 4) == 0
+                       && isPowerOfTwo(m_header.size) && m_header.size >= terrain_tile_size
+                       && m_header.size <= max_terrain_size
+                       && m_header.levels == terrainLevels(m_header.size)
+                       && m_header.tile_size == terrain_tile_size && m_header.spacing > 0.f
+                       && m_header.height > 0.f;
+    if (!valid) {
+        throw std::runtime_error(path + " isn't a terrain!");
+    }
+
+    uint32_t tiles = 0;
+    m_first_tile.clear();
+    for (uint32_t l = 0; l < m_header.levels; ++l) {
+        m_first_tile.push_back(tiles);
+        tiles += tilesAlong(m_header.size, l) * tilesAlong(m_header.size, l);
+    }
+    m_origin = glm::vec2(-0.5f * (float)m_header.size * m_header.spacing);
+    m_levels.assign(m_header.levels, level());
+
+    // A layer for every level, which is never sampled but fetched from
+    auto imageinfo = vk::ImageCreateInfo()
+                       .setImageType(vk::ImageType::e2D)
+                       .setExtent(vk::Extent3D(window_texels, window_texels, 1))
+                       .setMipLevels(1)
+                       .setArrayLayers(m_header.levels)
+                       .setFormat(vk::Format::eR16Unorm)
+                       .setTiling(vk::ImageTiling::eOptimal)
+                       .setInitialLayout(vk::ImageLayout::eUndefined)
+                       .setUsage(vk::ImageUsageFlagBits::eSampled
+                                 | vk::ImageUsageFlagBits::eTransferDst)
+                       .setSamples(vk::SampleCountFlagBits::e1)
+                       .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_heights        = m_device.createImage(imageinfo, hostAllocator());
+    m_heights_memory = m_allocator->allocate(m_device.getImageMemoryRequirements(m_heights),
+                                             vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                             memory_allocator::resource_kind::optimal,
+                                             memory_category::other);
+    m_device.bindImageMemory(m_heights, m_heights_memory.memory, m_heights_memory.offset);
+
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(m_heights)
+                      .setViewType(vk::ImageViewType::e2DArray)
+                      .setFormat(vk::Format::eR16Unorm)
+                      .setSubresourceRange(layerRange(m_header.levels));
+
+    m_heights_view = m_device.createImageView(viewinfo, hostAllocator());
+
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(vk::Filter::eNearest)
+                         .setMinFilter(vk::Filter::eNearest)
+                         .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                         .setAddressModeU(vk::SamplerAddressMode::eRepeat)
+                         .setAddressModeV(vk::SamplerAddressMode::eRepeat)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setMinLod(0.f)
+                         .setMaxLod(0.f);
+
+    m_sampler = views.sampler(samplerinfo);
+
+    auto binding = vk::DescriptorSetLayoutBinding()
+                     .setBinding(0)
+                     .setDescriptorCount(1)
+                     .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                     .setStageFlags(vk::ShaderStageFlagBits::eVertex);
+
+    vk::DescriptorSetLayout setlayout = layouts.descriptorSetLayout(
+      vk::DescriptorSetLayoutCreateInfo().setBindingCount(1).setPBindings(&binding));
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eVertex
+                                      | vk::ShaderStageFlagBits::eFragment)
+                       .setOffset(0)
+                       .setSize(sizeof(terrain_constants));
+
+    m_layout = layouts.pipelineLayout(vk::PipelineLayoutCreateInfo()
+                                        .setSetLayoutCount(1)
+                                        .setPSetLayouts(&setlayout)
+                                        .setPushConstantRangeCount(1)
+                                        .setPPushConstantRanges(&constants));
+
+    // The heights never move, so the set is written once here
+    m_descriptors.init(m_device, { { vk::DescriptorType::eCombinedImageSampler, 1 } }, 1);
+    m_set = m_descriptors.allocate(setlayout);
+
+    const vk::DescriptorImageInfo heights(m_sampler, m_heights_view, vk::ImageLayout::eGeneral);
+    m_device.updateDescriptorSets(vk::WriteDescriptorSet()
+                                    .setDstSet(m_set)
+                                    .setDstBinding(0)
+                                    .setDescriptorCount(1)
+                                    .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+                                    .setPImageInfo(&heights),
+                                  nullptr);
+
+    createMeshes();
+
+    auto meshinfo = vk::BufferCreateInfo()
+                      .setSize(m_mesh_data.size())
+                      .setUsage(vk::BufferUsageFlagBits::eVertexBuffer
+                                | vk::BufferUsageFlagBits::eIndexBuffer
+                                | vk::BufferUsageFlagBits::eTransferDst)
+                      .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_mesh_buffer = m_device.createBuffer(meshinfo, hostAllocator());
+    m_mesh_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_mesh_buffer),
+                                          vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                          memory_allocator::resource_kind::linear,
+                                          memory_category::other);
+    m_device.bindBufferMemory(m_mesh_buffer, m_mesh_memory.memory, m_mesh_memory.offset);
+
+    // Written every frame, and read once by the vertex input
+    m_instances_frame_size = max_terrain_levels * max_level_instances * sizeof(instance);
+
+    auto instanceinfo = vk::BufferCreateInfo()
+                          .setSize(m_instances_frame_size * frames)
+                          .setUsage(vk::BufferUsageFlagBits::eVertexBuffer)
+                          .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_instances        = m_device.createBuffer(instanceinfo, hostAllocator());
+    m_instances_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_instances),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::other,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_instances, m_instances_memory.memory, m_instances_memory.offset);
+
+    m_staging_frame_size = max_terrain_uploads * (vk::DeviceSize)terrain_tile_bytes;
+
+    auto staginginfo = vk::BufferCreateInfo()
+                         .setSize(m_staging_frame_size * frames)
+                         .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+                         .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_staging        = m_device.createBuffer(staginginfo, hostAllocator());
+    m_staging_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_staging),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::staging);
+    m_device.bindBufferMemory(m_staging, m_staging_memory.memory, m_staging_memory.offset);
+
+    for (std::vector<instance>& placed : m_placed) {
+        placed.reserve(max_terrain_levels * max_level_instances);
+    }
+    m_copies.reserve(max_terrain_uploads);
+}
+
+void
+clipmap_terrain::destroy()
+{
+    m_arrivals.clear();
+    m_deferred.clear();
+    m_copies.clear();
+    m_levels.clear();
+    m_reading  = 0;
+    m_drawable = false;
+
+    m_descriptors.destroy();
+
+    m_device.destroyImageView(m_heights_view, hostAllocator());
+    m_device.destroyImage(m_heights, hostAllocator());
+    m_allocator->free(m_heights_memory);
+
+    m_device.destroyBuffer(m_mesh_buffer, hostAllocator());
+    m_allocator->free(m_mesh_memory);
+    m_device.destroyBuffer(m_instances, hostAllocator());
+    m_allocator->free(m_instances_memory);
+    m_device.destroyBuffer(m_staging, hostAllocator());
+    m_allocator->free(m_staging_memory);
+
+    m_heights     = nullptr;
+    m_mesh_buffer = nullptr;
+    m_instances   = nullptr;
+    m_staging     = nullptr;
+}
+
+/*
+In quads of the level they are drawn at, the tiles from their lowest corner, the strips and the
+cross from the level's snapped position, where the strips between the middle tiles start, and the
+trim from the center of the hole in the level outside it, which it lines the low sides of until it
+is mirrored.
+*/
+void
+clipmap_terrain::createMeshes()
+{
+    const int32_t t = ring_tile_quads;
+
+    m_vertices.clear();
+    m_indices.clear();
+
+    addGrid(mesh_kind::tile, glm::ivec2(0), glm::ivec2(t));
+
+    addGrid(mesh_kind::filler, glm::ivec2(0, -2 * t), glm::ivec2(1, -t));
+    addGrid(mesh_kind::filler, glm::ivec2(0, t + 1), glm::ivec2(1, 2 * t + 1));
+    addGrid(mesh_kind::filler, glm::ivec2(-2 * t, 0), glm::ivec2(-t, 1));
+    addGrid(mesh_kind::filler, glm::ivec2(t + 1, 0), glm::ivec2(2 * t + 1, 1));
+
+    addGrid(mesh_kind::cross, glm::ivec2(0, -2 * t), glm::ivec2(1, 2 * t + 1));
+    addGrid(mesh_kind::cross, glm::ivec2(-2 * t, 0), glm::ivec2(0, 1));
+    addGrid(mesh_kind::cross, glm::ivec2(1, 0), glm::ivec2(2 * t + 1, 1));
+
+    addGrid(mesh_kind::trim, glm::ivec2(-2 * t - 1), glm::ivec2(2 * t + 1, -2 * t));
+    addGrid(mesh_kind::trim, glm::ivec2(-2 * t - 1, -2 * t), glm::ivec2(-2 * t, 2 * t + 1));
+
+    const size_t vertexbytes = m_vertices.size() * sizeof(glm::i16vec2);
+    m_index_offset           = vertexbytes;
+    m_mesh_data.resize(vertexbytes + m_indices.size() * sizeof(uint16_t));
+    std::memcpy(m_mesh_data.data(), m_vertices.data(), vertexbytes);
+    std::memcpy(m_mesh_data.data() + vertexbytes, m_indices.data(),
+                m_indices.size() * sizeof(uint16_t));
+}
+
+// Appended to the mesh of `kind`, which the calls for one kind have to be in a row for
+void
+clipmap_terrain::addGrid(mesh_kind kind, glm::ivec2 low, glm::ivec2 high)
+{
+    mesh_range& mesh = m_meshes[(size_t)kind];
+    if (mesh.index_count == 0) {
+        mesh.first_index   = (uint32_t)m_indices.size();
+        mesh.vertex_offset = (int32_t)m_vertices.size();
+    }
+
+    const uint32_t first  = (uint32_t)m_vertices.size() - (uint32_t)mesh.vertex_offset;
+    const uint32_t across = (uint32_t)(high.x - low.x) + 1;
+    for (int32_t y = low.y; y <= high.y; ++y) {
+        for (int32_t x = low.x; x <= high.x; ++x) {
+            m_vertices.push_back(glm::i16vec2((int16_t)x, (int16_t)y));
+        }
+    }
+
+    for (uint32_t y = 0; y < (uint32_t)(high.y - low.y); ++y) {
+        for (uint32_t x = 0; x + 1 < across; ++x) {
+            const uint16_t a = (uint16_t)(first + y * across + x);
+            const uint16_t b = (uint16_t)(a + 1);
+            const uint16_t c = (uint16_t)(a + across);
+            const uint16_t d = (uint16_t)(c + 1);
+            m_indices.insert(m_indices.end(), { a, b, d, a, d, c });
+        }
+    }
+    mesh.index_count = (uint32_t)m_indices.size() - mesh.first_index;
+}
+
+void
+clipmap_terrain::upload(upload_batch& uploads, const staging_region& mesh) const
+{
+    uploads.copyBuffer(mesh, m_mesh_buffer, 0,
+                       vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead,
+                       vk::PipelineStageFlagBits::eVertexInput);
+}
+
+std::array<vk::VertexInputBindingDescription, 2>
+clipmap_terrain::bindings() const
+{
+    return { vk::VertexInputBindingDescription(0, sizeof(glm::i16vec2),
+                                               vk::VertexInputRate::eVertex),
+             vk::VertexInputBindingDescription(1, sizeof(instance),
+                                               vk::VertexInputRate::eInstance) };
+}
+
+std::array<vk::VertexInputAttributeDescription, 4>
+clipmap_terrain::attributes() const
+{
+    return { vk::VertexInputAttributeDescription(0, 0, vk::Format::eR16G16Sint, 0),
+             vk::VertexInputAttributeDescription(1, 1, vk::Format::eR32G32B32Sfloat,
+                                                 offsetof(instance, offset)),
+             vk::VertexInputAttributeDescription(2, 1, vk::Format::eR32Uint,
+                                                 offsetof(instance, info)),
+             vk::VertexInputAttributeDescription(3, 1, vk::Format::eR32G32Sfloat,
+                                                 offsetof(instance, center)) };
+}
+
+/*
+Level l is snapped to every 2^l texels, so it is always either on or a quad past the snapped
+position of the level outside it, whose hole it fills but for a one quad wide L along the two sides
+it isn't on. The hole's center is where the level's heights are blended away from, so the blend
+is all the way through at the hole's edge.
+*/
+void
+clipmap_terrain::update(uint32_t frame, const glm::vec3& eye, const frustum& view)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_frame = frame % m_frames;
+    m_copies.clear();
+
+    const uint32_t levels = m_header.levels;
+    const float    size   = (float)m_header.size;
+    const int32_t  t      = ring_tile_quads;
+
+    // In texels of level 0, not so far away from the heightmap that the snapping overflows
+    const glm::vec2 texel = glm::clamp((glm::vec2(eye) - m_origin) / m_header.spacing,
+                                       glm::vec2(-size), glm::vec2(2.f * size));
+
+    std::array<glm::ivec2, max_terrain_levels> snapped;
+    for (uint32_t l = 0; l < levels; ++l) {
+        const glm::ivec2 position = glm::ivec2(glm::floor(texel / (float)(1u << l)));
+        snapped[l]                = position * (int32_t)(1u << l);
+
+        // The window is centered on the level's position, in tiles of the level
+        const int32_t half = (int32_t)terrain_window_tiles / 2;
+        place(l, glm::ivec2(floorDiv(position.x, (int32_t)terrain_tile_size) - half,
+                            floorDiv(position.y, (int32_t)terrain_tile_size) - half));
+    }
+
+    startReads();
+    stageArrivals();
+
+    for (std::vector<instance>& placed : m_placed) {
+        placed.clear();
+    }
+    m_drawable = completeLevel(levels - 1) != max_terrain_levels;
+    if (!m_drawable) {
+        return;
+    }
+
+    for (uint32_t l = 0; l < levels; ++l) {
+        const float     scale  = (float)(1u << l);
+        const glm::vec2 p      = glm::vec2(snapped[l]);
+        const glm::vec2 base   = p - 2.f * (float)t * scale;
+        const uint32_t  coarse = l + 1 < levels ? completeLevel(l + 1) : no_coarser_layer;
+        const uint32_t  info   = completeLevel(l) | coarse << 8;
+        const glm::vec2 center = l + 1 < levels ? glm::vec2(snapped[l + 1]) + scale : p;
+
+        for (int32_t y = 0; y < 4; ++y) {
+            for (int32_t x = 0; x < 4; ++x) {
+                if (l > 0 && (x == 1 || x == 2) && (y == 1 || y == 2)) {
+                    continue;
+                }
+                const glm::vec2 low =
+                  base + glm::vec2(x * t + (x >= 2), y * t + (y >= 2)) * scale;
+                addInstance(mesh_kind::tile, view, low, scale, low, low + (float)t * scale, info,
+                            center);
+            }
+        }
+
+        const glm::vec2 reach = glm::vec2((float)(2 * t + 1) * scale);
+        addInstance(l == 0 ? mesh_kind::cross : mesh_kind::filler, view, p, scale,
+                    p - 2.f * (float)t * scale, p + reach, info, center);
+
+        // On the high side along an axis where the level is on the outer one's position
+        if (l + 1 < levels) {
+            const uint32_t mirror = (snapped[l].x == snapped[l + 1].x ? 1u << 16 : 0u)
+                                    | (snapped[l].y == snapped[l + 1].y ? 1u << 17 : 0u);
+            addInstance(mesh_kind::trim, view, center, scale, center - reach, center + reach,
+                        info | mirror, center);
+        }
+    }
+
+    char* data = static_cast<char*>(m_instances_memory.mapped) + m_frame * m_instances_frame_size;
+    uint32_t first = 0;
+    for (size_t kind = 0; kind < m_placed.size(); ++kind) {
+        m_first_instance[kind] = first;
+        std::memcpy(data + first * sizeof(instance), m_placed[kind].data(),
+                    m_placed[kind].size() * sizeof(instance));
+        first += (uint32_t)m_placed[kind].size();
+    }
+}
+
+void
+clipmap_terrain::addInstance(mesh_kind      kind,
+                             const frustum& view,
+                             glm::vec2      offset,
+                             float          scale,
+                             glm::vec2      low,
+                             glm::vec2      high,
+                             uint32_t       info,
+                             glm::vec2      center)
+{
+    const float size = (float)m_header.size;
+    if (high.x < 0.f || high.y < 0.f || low.x > size || low.y > size) {
+        return;
+    }
+
+    const glm::vec3 worldlow(m_origin + low * m_header.spacing, 0.f);
+    const glm::vec3 worldhigh(m_origin + high * m_header.spacing, m_header.height);
+    if (!intersects(view, worldlow, worldhigh)) {
+        return;
+    }
+
+    instance placed;
+    placed.offset = offset;
+    placed.scale  = scale;
+    placed.info   = info;
+    placed.center = center;
+    m_placed[(size_t)kind].push_back(placed);
+}
+
+// A tile that comes back into a place it was taken from before it arrived is read again, and
+// whichever of the reads arrives first is uploaded
+void
+clipmap_terrain::place(uint32_t l, glm::ivec2 first)
+{
+    level& lvl = m_levels[l];
+    if (lvl.placed && lvl.first == first) {
+        return;
+    }
+    lvl.placed = true;
+    lvl.first  = first;
+
+    const int32_t  window = (int32_t)terrain_window_tiles;
+    const uint32_t across = tilesAlong(m_header.size, l);
+    for (int32_t sy = 0; sy < window; ++sy) {
+        for (int32_t sx = 0; sx < window; ++sx) {
+            slot&            s    = lvl.slots[sy * window + sx];
+            const glm::ivec2 tile = first + glm::ivec2(wrap(sx - first.x, window),
+                                                       wrap(sy - first.y, window));
+            if (s.tile == tile && s.state != slot_state::missing) {
+                continue;
+            }
+
+            if (s.state == slot_state::loading && m_streams->cancel(s.read)) {
+                --m_reading;
+            } else if (s.state == slot_state::resident) {
+                --lvl.resident;
+            }
+
+            s.tile  = tile;
+            s.state = slot_state::missing;
+            s.read  = stream_scheduler::invalid_ticket;
+
+            const bool outside = tile.x < 0 || tile.y < 0 || tile.x >= (int32_t)across
+                                 || tile.y >= (int32_t)across;
+            if (outside) {
+                s.state = slot_state::resident;
+                ++lvl.resident;
+            }
+        }
+    }
+}
+
+// Coarser levels first, which everything falls back on
+void
+clipmap_terrain::startReads()
+{
+    const uint32_t levels = m_header.levels;
+    for (uint32_t l = levels; l-- > 0 && m_reading < max_terrain_reads;) {
+        const uint32_t across = tilesAlong(m_header.size, l);
+        for (slot& s : m_levels[l].slots) {
+            if (s.state != slot_state::missing) {
+                continue;
+            }
+            if (m_reading >= max_terrain_reads) {
+                break;
+            }
+
+            const glm::ivec2 tile = s.tile;
+            const uint64_t   offset =
+              sizeof(terrain_header)
+              + (uint64_t)(m_first_tile[l] + tile.y * across + tile.x) * terrain_tile_bytes;
+            auto read = [this, l, tile](core::mapped_file&& file, size_t) {
+                arrival a;
+                a.level = l;
+                a.tile  = tile;
+                a.data  = std::move(file);
+
+                std::lock_guard<std::mutex> lock(m_arrivals_mutex);
+                m_arrivals.push_back(std::move(a));
+            };
+
+            s.state = slot_state::loading;
+            s.read  = m_streams->read(m_path, offset, terrain_tile_bytes, (float)(levels - l),
+                                      std::move(read));
+            ++m_reading;
+        }
+    }
+}
+
+// A tile that can't be read is left as whatever its place had in it, rather than read again
+void
+clipmap_terrain::stageArrivals()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_arrivals_mutex);
+        for (arrival& a : m_arrivals) {
+            m_deferred.push_back(std::move(a));
+        }
+        m_arrivals.clear();
+    }
+
+    const vk::DeviceSize stagingoffset = m_frame * m_staging_frame_size;
+    char* staging = static_cast<char*>(m_staging_memory.mapped) + stagingoffset;
+
+    const int32_t window  = (int32_t)terrain_window_tiles;
+    uint32_t      uploads = 0;
+    size_t        kept    = 0;
+    for (size_t i = 0; i < m_deferred.size(); ++i) {
+        arrival& a   = m_deferred[i];
+        level&   lvl = m_levels[a.level];
+        slot&    s   = lvl.slots[wrap(a.tile.y, window) * window + wrap(a.tile.x, window)];
+
+        // Its place has moved on to another tile, or was filled by another read of the same one
+        if (s.tile != a.tile || s.state != slot_state::loading) {
+            --m_reading;
+            continue;
+        }
+        if (a.data.size() != terrain_tile_bytes) {
+            s.state = slot_state::resident;
+            ++lvl.resident;
+            --m_reading;
+            continue;
+        }
+
+        if (uploads == max_terrain_uploads || !m_streams->upload(terrain_tile_bytes)) {
+            m_deferred[kept++] = std::move(a);
+            continue;
+        }
+        --m_reading;
+
+        const vk::DeviceSize offset = uploads * (vk::DeviceSize)terrain_tile_bytes;
+        std::memcpy(staging + offset, a.data.data(), terrain_tile_bytes);
+        ++uploads;
+
+        const int32_t place = (int32_t)terrain_tile_size;
+        m_copies.push_back(
+          vk::BufferImageCopy()
+            .setBufferOffset(stagingoffset + offset)
+            .setImageSubresource(
+              vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, a.level, 1))
+            .setImageOffset(vk::Offset3D(wrap(a.tile.x, window) * place,
+                                         wrap(a.tile.y, window) * place, 0))
+            .setImageExtent(vk::Extent3D(terrain_tile_size, terrain_tile_size, 1)));
+
+        s.state = slot_state::resident;
+        ++lvl.resident;
+    }
+    m_deferred.erase(m_deferred.begin() + kept, m_deferred.end());
+}
+
+uint32_t
+clipmap_terrain::completeLevel(uint32_t l) const
+{
+    for (; l < m_header.levels; ++l) {
+        if (m_levels[l].resident == terrain_window_tiles * terrain_window_tiles) {
+            return l;
+        }
+    }
+    return max_terrain_levels;
+}
+
+/*
+The heights are cleared the first time, so that the texels past the heightmap's edges, which the
+filtering weighs by nothing, are never undefined. Everything else about the copies is synchronized
+by the render graph, see the class.
+*/
+void
+clipmap_terrain::record(vk::CommandBuffer command_buffer)
+{
+    if (m_initialized && m_copies.empty()) {
+        return;
+    }
+
+    const access_scope copied = { vk::PipelineStageFlagBits::eTransfer,
+                                  vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eGeneral };
+
+    if (!m_initialized) {
+        barrier_batch transition;
+        transition.image(m_heights, layerRange(m_header.levels), access_scope(), copied);
+        transition.record(command_buffer);
+
+        const vk::ClearColorValue zero(std::array<float, 4>{ 0.f, 0.f, 0.f, 0.f });
+        const vk::ImageSubresourceRange range = layerRange(m_header.levels);
+        command_buffer.clearColorImage(m_heights, vk::ImageLayout::eGeneral, &zero, 1, &range);
+
+        barrier_batch cleared;
+        cleared.memory(copied, copied);
+        cleared.record(command_buffer);
+        m_initialized = true;
+    }
+
+    if (!m_copies.empty()) {
+        command_buffer.copyBufferToImage(m_staging, m_heights, vk::ImageLayout::eGeneral,
+                                         (uint32_t)m_copies.size(), m_copies.data());
+    }
+}
+
+void
+clipmap_terrain::draw(vk::CommandBuffer command_buffer,
+                      vk::Pipeline      pipeline,
+                      const glm::mat4&  view_projection,
+                      const glm::vec3&  sun_direction,
+                      const glm::vec3&  sun_color) const
+{
+    if (!m_drawable) {
+        return;
+    }
+
+    terrain_constants constants;
+    constants.view_projection = view_projection;
+    constants.map             = glm::vec4(m_origin, m_header.spacing, m_header.height);
+    constants.sun_direction   = sun_direction;
+    constants.size            = (float)m_header.size;
+    constants.sun_color       = sun_color;
+
+    const vk::Buffer     buffers[] = { m_mesh_buffer, m_instances };
+    const vk::DeviceSize offsets[] = { 0, m_frame * m_instances_frame_size };
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_layout, 0, m_set,
+                                      nullptr);
+    command_buffer.pushConstants(m_layout,
+                                 vk::ShaderStageFlagBits::eVertex
+                                   | vk::ShaderStageFlagBits::eFragment,
+                                 0, sizeof(constants), &constants);
+    command_buffer.bindVertexBuffers(0, 2, buffers, offsets);
+    command_buffer.bindIndexBuffer(m_mesh_buffer, m_index_offset, vk::IndexType::eUint16);
+
+    for (size_t kind = 0; kind < m_placed.size(); ++kind) {
+        const mesh_range& mesh = m_meshes[kind];
+        if (!m_placed[kind].empty()) {
+            command_buffer.drawIndexed(mesh.index_count, (uint32_t)m_placed[kind].size(),
+                                       mesh.first_index, mesh.vertex_offset,
+                                       m_first_instance[kind]);
+        }
+    }
+}
+
+}  // namespace shiny::graphics
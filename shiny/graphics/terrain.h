@@ -0,0 +1,267 @@
+#pragma once
+
+#include "core/mapped_file.h"
+#include "graphics/descriptor_allocator.h"
+#include "graphics/frustum_culling.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/staging_arena.h"
+#include "graphics/stream_scheduler.h"
+#include "graphics/upload_service.h"
+#include "graphics/view_cache.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+// Texels across a tile of a terrain's heights, each a 16 bit UNORM height
+const uint32_t terrain_tile_size  = 64;
+const uint32_t terrain_tile_bytes = terrain_tile_size * terrain_tile_size * sizeof(uint16_t);
+
+// Tiles across the part of a level that is resident, which is twice what the level's rings reach
+const uint32_t terrain_window_tiles = 8;
+
+// Levels of detail, each twice as coarse as the one before, and the widest heightmap with no more
+const uint32_t max_terrain_levels = 16;
+const uint32_t max_terrain_size   = terrain_tile_size << (max_terrain_levels - 1);
+
+/*
+The header of a terrain file, as cookTerrain writes them. The tiles follow it, all
+terrain_tile_bytes in size, level by level from level 0 on and row by row within a level. A level's
+texels are every other one of the level before, not filtered, so that the heights where two levels
+meet are the same in both.
+*/
+struct terrain_header
+{
+    char     magic[4]  = { 'S', 'T', 'H', '1' };
+    uint32_t size      = 0;  // texels along either side, a power of two from terrain_tile_size
+    uint32_t levels    = 0;  // see terrainLevels
+    uint32_t tile_size = terrain_tile_size;
+    float    spacing   = 1.f;  // between two texels of level 0, in world units
+    float    height    = 1.f;  // of the highest a texel can be
+};
+
+// Down to the first level that is a single tile
+uint32_t terrainLevels(uint32_t size);
+
+/*
+A heightmap terrain drawn as a geometry clipmap: a square of grid around the camera for every
+level, each level a ring twice as coarse as the one inside it, and all of them snapped to their own
+grid so that the vertices never swim. Every ring is made of the same few meshes, a tile of 64 by 64
+quads, the one quad wide strips between the tiles and the L shaped trim that makes up for a level
+being on either side of the one outside it, drawn instanced with an instance per placement.
+The vertex shader displaces them by the height texture, and blends every level's heights into those
+of the next one towards its edge, so its vertices meet the coarser level's edges exactly.
+
+The heights are a 2D array, a layer for every level and terrain_window_tiles tiles across, which
+each level addresses toroidally: the tile x, y of a level is in layer level at x and y modulo the
+window, so as the camera moves only the tiles that came into the window are read, on the stream
+scheduler with the coarser levels before the finer ones, and uploaded within its budget. Until all
+of a level's window is in, the level is drawn with the heights of the finest coarser one that is,
+and until the coarsest is, nothing is. A read that is still waiting when its tile has left the
+window again is cancelled.
+
+The height array is in VK_IMAGE_LAYOUT_GENERAL for good, since its tiles are written while the rest
+of it is read. record() doesn't wait for the frames before it to be done reading it, that is left to
+the render graph, which has it as an imported image.
+*/
+class clipmap_terrain
+{
+public:
+    // Whether the device can sample the heights
+    static bool supported(vk::PhysicalDevice physical_device);
+
+    // Reads the header of the terrain file at `path`, which is centered on the world's origin.
+    // Throws if it isn't one.
+    void init(vk::Device         device,
+              memory_allocator&  allocator,
+              layout_cache&      layouts,
+              view_cache&        views,
+              stream_scheduler&  streams,
+              const std::string& path,
+              uint32_t           frames);
+    // Only safe once the device is idle and the I/O queue is done reading
+    void destroy();
+
+    // The grid meshes, which never change, for upload(): vertices followed by indices
+    const void*    meshData() const { return m_mesh_data.data(); }
+    vk::DeviceSize meshSize() const { return m_mesh_data.size(); }
+    void           upload(upload_batch& uploads, const staging_region& mesh) const;
+
+    // The draw's pipeline layout and vertex input: a grid position per vertex in binding 0, and
+    // where a mesh goes per instance in binding 1
+    vk::PipelineLayout                                 layout() const { return m_layout; }
+    std::array<vk::VertexInputBindingDescription, 2>   bindings() const;
+    std::array<vk::VertexInputAttributeDescription, 4> attributes() const;
+
+    // Places the rings around `eye`, keeps the ones that are at least partly in `view` for draw(),
+    // reads the tiles that came into a level's window, and stages what has been read. Once the
+    // frame's fence has been waited on.
+    void update(uint32_t frame, const glm::vec3& eye, const frustum& view);
+
+    // Copies whatever update staged, outside of a render pass
+    void record(vk::CommandBuffer command_buffer);
+
+    // Draws the rings with `pipeline`, made with layout() and the vertex input above, inside the
+    // main pass. Nothing until the coarsest level is in.
+    void draw(vk::CommandBuffer command_buffer,
+              vk::Pipeline      pipeline,
+              const glm::mat4&  view_projection,
+              const glm::vec3&  sun_direction,
+              const glm::vec3&  sun_color) const;
+
+    vk::Image image() const { return m_heights; }
+
+    // For other shaders fetching the heights as terrain.glsl does: the image and its sampler, the
+    // origin's x and y with the texel spacing and height scale, and texels across the heightmap
+    vk::ImageView heightsView() const { return m_heights_view; }
+    vk::Sampler   heightsSampler() const { return m_sampler; }
+    glm::vec4     map() const { return glm::vec4(m_origin, m_header.spacing, m_header.height); }
+    float         size() const { return (float)m_header.size; }
+
+    // The layer with the finest heights around the camera as of the last update, the first level
+    // whose window is all in, or max_terrain_levels while none is
+    uint32_t finestLayer() const
+    {
+        return m_levels.empty() ? max_terrain_levels : completeLevel(0);
+    }
+
+    // Whether tiles are still being read, or waiting for staging memory
+    bool reading() const { return m_reading > 0 || !m_deferred.empty(); }
+
+private:
+    enum class mesh_kind : uint32_t
+    {
+        tile,
+        filler,  // the strips between a ring's tiles
+        cross,   // the strips through the finest level, which has no hole
+        trim,
+        count,
+    };
+
+    // Laid out like terrain.vert's instance attributes
+    struct instance
+    {
+        glm::vec2 offset;       // in texels of level 0
+        float     scale = 1.f;  // texels a quad
+        uint32_t  info  = 0;    // layer, coarser layer << 8, mirrored along x << 16 and y << 17
+        glm::vec2 center;       // of the level, which its heights are blended towards the edge of
+    };
+
+    struct mesh_range
+    {
+        uint32_t first_index   = 0;
+        uint32_t index_count   = 0;
+        int32_t  vertex_offset = 0;
+    };
+
+    enum class slot_state : uint8_t
+    {
+        missing,
+        loading,
+        resident,  // or outside of the heightmap, where nothing is ever sampled
+    };
+
+    // What's in a place of a level's window, tile x modulo the window across and y down
+    struct slot
+    {
+        glm::ivec2               tile  = glm::ivec2(0);
+        slot_state               state = slot_state::missing;
+        stream_scheduler::ticket read  = stream_scheduler::invalid_ticket;
+    };
+
+    struct level
+    {
+        glm::ivec2 first    = glm::ivec2(0);  // the window's lowest tile
+        bool       placed   = false;          // the window has been, at least once
+        uint32_t   resident = 0;              // slots
+        std::array<slot, terrain_window_tiles * terrain_window_tiles> slots;
+    };
+
+    // A tile read on the I/O queue, handed over from its thread
+    struct arrival
+    {
+        uint32_t          level = 0;
+        glm::ivec2        tile  = glm::ivec2(0);
+        core::mapped_file data;
+    };
+
+    void createMeshes();
+    void addGrid(mesh_kind kind, glm::ivec2 low, glm::ivec2 high);
+    // Unless the texels from `low` to `high` are outside of the heightmap or `view`
+    void addInstance(mesh_kind      kind,
+                     const frustum& view,
+                     glm::vec2      offset,
+                     float          scale,
+                     glm::vec2      low,
+                     glm::vec2      high,
+                     uint32_t       info,
+                     glm::vec2      center);
+    void place(uint32_t l, glm::ivec2 first);
+    void startReads();
+    void stageArrivals();
+
+    // The finest level from `l` on whose window is all in, or max_terrain_levels
+    uint32_t completeLevel(uint32_t l) const;
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+    stream_scheduler* m_streams   = nullptr;
+
+    std::string           m_path;
+    terrain_header        m_header;
+    std::vector<uint32_t> m_first_tile;               // by level
+    glm::vec2             m_origin = glm::vec2(0.f);  // of texel 0, 0 of level 0
+
+    descriptor_allocator m_descriptors;
+    vk::DescriptorSet    m_set;     // written once, the heights for the vertex shader
+    vk::PipelineLayout   m_layout;  // owned by the layout_cache
+
+    vk::Image     m_heights;
+    allocation    m_heights_memory;
+    vk::ImageView m_heights_view;
+    vk::Sampler   m_sampler;  // owned by the view_cache
+    bool          m_initialized = false;  // the heights are cleared and in VK_IMAGE_LAYOUT_GENERAL
+
+    // Device local: every grid mesh's vertices, then their indices
+    std::array<mesh_range, (size_t)mesh_kind::count> m_meshes;
+    std::vector<glm::i16vec2>                        m_vertices;
+    std::vector<uint16_t>                            m_indices;
+    std::vector<char>                                m_mesh_data;  // both of them, for upload()
+    vk::Buffer                                       m_mesh_buffer;
+    allocation                                       m_mesh_memory;
+    vk::DeviceSize                                   m_index_offset = 0;
+
+    // Host visible, every frame's instances and staged tiles
+    vk::Buffer     m_instances;
+    allocation     m_instances_memory;
+    vk::DeviceSize m_instances_frame_size = 0;
+    vk::Buffer     m_staging;
+    allocation     m_staging_memory;
+    vk::DeviceSize m_staging_frame_size = 0;
+
+    std::vector<level> m_levels;
+
+    std::mutex           m_arrivals_mutex;
+    std::vector<arrival> m_arrivals;  // read since the last update
+    std::vector<arrival> m_deferred;  // didn't get upload budget the last time
+    uint32_t             m_reading = 0;
+
+    // What update placed and staged for draw() and record()
+    std::array<std::vector<instance>, (size_t)mesh_kind::count> m_placed;
+    std::array<uint32_t, (size_t)mesh_kind::count>              m_first_instance = {};
+    std::vector<vk::BufferImageCopy>                            m_copies;
+    bool                                                        m_drawable = false;
+
+    uint32_t m_frames = 0;
+    uint32_t m_frame  = 0;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,482 @@
+#include "graphics/texture_cook.h"
+
+#include "core/mapped_file.h"
+#include "core/profiler.h"
+#include "graphics/ktx2_file.h"
+#include "graphics/terrain.h"
+#include "graphics/virtual_texture.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+
+// The header only defines the prototypes of the functions by default. One code file needs to
+// include the header with the STB_IMAGE_IMPLEMENTATION definition to include the function bodies,
+// otherwise we'll get linking errors.
+#define STB_IMAGE_IMPLEMENTATION
+#include <include/stb_image.h>
+
+namespace {
+
+const char* const cooked_texture_suffix  = ".bc1.ktx2";
+const char* const virtual_texture_suffix = ".bc1.vt";
+const char* const terrain_suffix         = ".sth";
+
+const size_t bc1_block_size = 8;
+
+uint16_t
+to565(const glm::vec3& color)
+{
+    const glm::vec3 c = glm::clamp(color, 0.f, 255.f);
+    return (uint16_t)((uint32_t)std::lround(c.r * 31.f / 255.f) << 11
+                      | (uint32_t)std::lround(c.g * 63.f / 255.f) << 5
+                      | (uint32_t)std::lround(c.b * 31.f / 255.f));
+}
+
+glm::vec3
+from565(uint16_t color)
+{
+    return glm::vec3((float)(color >> 11) * 255.f / 31.f, (float)(color >> 5 & 63) * 255.f / 63.f,
+                     (float)(color & 31) * 255.f / 31.f);
+}
+
+/*
+The endpoints are the ends of the texels' spread along their principal axis, found with a few
+rounds of power iteration on their covariance, and pulled in by a sixteenth of the line so that
+the texels near them sit between palette entries rather than past them. Every texel then takes
+whichever of the four palette colors is nearest.
+*/
+void
+compressBlock(const glm::vec3 (&texels)[16], uint8_t* out)
+{
+    glm::vec3 mean(0.f);
+    for (const glm::vec3& texel : texels) {
+        mean += texel;
+    }
+    mean /= 16.f;
+
+    glm::mat3 covariance(0.f);
+    for (const glm::vec3& texel : texels) {
+        const glm::vec3 d = texel - mean;
+        covariance += glm::outerProduct(d, d);
+    }
+
+    glm::vec3 axis(1.f);
+    for (int i = 0; i < 4; ++i) {
+        axis = covariance * axis;
+        const float length = glm::length(axis);
+        if (length < 1e-6f) {
+            break;
+        }
+        axis /= length;
+    }
+
+    float low = 0.f, high = 0.f;
+    for (const glm::vec3& texel : texels) {
+        const float t = glm::dot(texel - mean, axis);
+        low           = std::min(low, t);
+        high          = std::max(high, t);
+    }
+    const float inset = (high - low) / 16.f;
+
+    uint16_t c0 = to565(mean + axis * (high - inset));
+    uint16_t c1 = to565(mean + axis * (low + inset));
+
+    // c0 > c1 is what picks the four color mode, with the two in between
+    if (c0 < c1) {
+        std::swap(c0, c1);
+    }
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        const glm::vec3 palette[4] = { from565(c0), from565(c1),
+                                       (2.f * from565(c0) + from565(c1)) / 3.f,
+                                       (from565(c0) + 2.f * from565(c1)) / 3.f };
+
+        for (uint32_t i = 0; i < 16; ++i) {
+            uint32_t nearest  = 0;
+            float    distance = std::numeric_limits<float>::max();
+            for (uint32_t p = 0; p < 4; ++p) {
+                const glm::vec3 delta = texels[i] - palette[p];
+                const float     d     = glm::dot(delta, delta);
+                if (d < distance) {
+                    nearest  = p;
+                    distance = d;
+                }
+            }
+            indices |= nearest << (i * 2);
+        }
+    }
+
+    out[0] = (uint8_t)c0;
+    out[1] = (uint8_t)(c0 >> 8);
+    out[2] = (uint8_t)c1;
+    out[3] = (uint8_t)(c1 >> 8);
+    out[4] = (uint8_t)indices;
+    out[5] = (uint8_t)(indices >> 8);
+    out[6] = (uint8_t)(indices >> 16);
+    out[7] = (uint8_t)(indices >> 24);
+}
+
+// A 565 color's channels widened to 8 bits, with the top bits repeated in the bits below
+glm::uvec3
+expand565(uint16_t color)
+{
+    const uint32_t r = color >> 11, g = color >> 5 & 63, b = color & 31;
+    return glm::uvec3(r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2);
+}
+
+// The four colors a block's texels pick from, with the order of the endpoints picking the mode
+void
+blockPalette(const uint8_t* block, glm::uvec3 (&palette)[4])
+{
+    const uint16_t c0 = (uint16_t)(block[0] | block[1] << 8);
+    const uint16_t c1 = (uint16_t)(block[2] | block[3] << 8);
+
+    palette[0] = expand565(c0);
+    palette[1] = expand565(c1);
+    if (c0 > c1) {
+        palette[2] = (2u * palette[0] + palette[1] + 1u) / 3u;
+        palette[3] = (palette[0] + 2u * palette[1] + 1u) / 3u;
+    } else {
+        palette[2] = (palette[0] + palette[1] + 1u) / 2u;
+        palette[3] = glm::uvec3(0u);  // transparent black, which is black without alpha
+    }
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+std::vector<uint8_t>
+downsample(const uint8_t* pixels, uint32_t width, uint32_t height)
+{
+    const uint32_t nextwidth  = std::max(width / 2, 1u);
+    const uint32_t nextheight = std::max(height / 2, 1u);
+
+    std::vector<uint8_t> next((size_t)nextwidth * nextheight * 4);
+
+    for (uint32_t y = 0; y < nextheight; ++y) {
+        const uint32_t y0 = std::min(y * 2, height - 1);
+        const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+
+        for (uint32_t x = 0; x < nextwidth; ++x) {
+            const uint32_t x0 = std::min(x * 2, width - 1);
+            const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+
+            for (uint32_t c = 0; c < 4; ++c) {
+                uint32_t sum = pixels[((size_t)y0 * width + x0) * 4 + c]
+                               + pixels[((size_t)y0 * width + x1) * 4 + c]
+                               + pixels[((size_t)y1 * width + x0) * 4 + c]
+                               + pixels[((size_t)y1 * width + x1) * 4 + c];
+                next[((size_t)y * nextwidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+            }
+        }
+    }
+
+    return next;
+}
+
+std::vector<uint8_t>
+compressBc1(const uint8_t* pixels, uint32_t width, uint32_t height, jobs::scheduler& jobs)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const uint32_t blockswide = (width + 3) / 4;
+    const uint32_t blockshigh = (height + 3) / 4;
+
+    std::vector<uint8_t> blocks((size_t)blockswide * blockshigh * bc1_block_size);
+
+    jobs.parallelFor(0, blockshigh, 16, [&](uint32_t first, uint32_t last) {
+        glm::vec3 texels[16];
+        for (uint32_t by = first; by < last; ++by) {
+            for (uint32_t bx = 0; bx < blockswide; ++bx) {
+                for (uint32_t i = 0; i < 16; ++i) {
+                    const uint32_t x     = std::min(bx * 4 + i % 4, width - 1);
+                    const uint32_t y     = std::min(by * 4 + i / 4, height - 1);
+                    const uint8_t* texel = pixels + ((size_t)y * width + x) * 4;
+                    texels[i]            = glm::vec3(texel[0], texel[1], texel[2]);
+                }
+                compressBlock(texels,
+                              blocks.data() + ((size_t)by * blockswide + bx) * bc1_block_size);
+            }
+        }
+    });
+
+    return blocks;
+}
+
+std::vector<uint8_t>
+decompressBc1(const uint8_t*   blocks,
+              uint32_t         width,
+              uint32_t         height,
+              bool             rgb565,
+              jobs::scheduler& jobs)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const uint32_t blockswide = (width + 3) / 4;
+    const uint32_t blockshigh = (height + 3) / 4;
+    const size_t   texelsize  = rgb565 ? 2 : 4;
+
+    std::vector<uint8_t> pixels((size_t)width * height * texelsize);
+
+    jobs.parallelFor(0, blockshigh, 16, [&](uint32_t first, uint32_t last) {
+        glm::uvec3 palette[4];
+        for (uint32_t by = first; by < last; ++by) {
+            for (uint32_t bx = 0; bx < blockswide; ++bx) {
+                const uint8_t* block = blocks + ((size_t)by * blockswide + bx) * bc1_block_size;
+                blockPalette(block, palette);
+
+                const uint32_t indices =
+                  (uint32_t)(block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24);
+
+                // Texels past the edges of sizes that aren't a multiple of 4 are left out
+                for (uint32_t i = 0; i < 16; ++i) {
+                    const uint32_t x = bx * 4 + i % 4;
+                    const uint32_t y = by * 4 + i / 4;
+                    if (x >= width || y >= height) {
+                        continue;
+                    }
+
+                    const glm::uvec3& color = palette[indices >> (i * 2) & 3];
+                    uint8_t*          texel = pixels.data() + ((size_t)y * width + x) * texelsize;
+                    if (rgb565) {
+                        const uint16_t packed = to565(glm::vec3(color));
+                        texel[0]              = (uint8_t)packed;
+                        texel[1]              = (uint8_t)(packed >> 8);
+                    } else {
+                        texel[0] = (uint8_t)color.r;
+                        texel[1] = (uint8_t)color.g;
+                        texel[2] = (uint8_t)color.b;
+                        texel[3] = 255;
+                    }
+                }
+            }
+        }
+    });
+
+    return pixels;
+}
+
+std::string
+cookedTexturePath(const std::string& sourcepath)
+{
+    return std::filesystem::path(sourcepath).replace_extension().string() + cooked_texture_suffix;
+}
+
+bool
+cookTexture(const std::string& path, jobs::scheduler& jobs)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    core::mapped_file source;
+    if (!source.open(path)) {
+        return false;
+    }
+
+    int      width, height, channels;
+    stbi_uc* pixels =
+      stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(source.data()), (int)source.size(),
+                            &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels) {
+        return false;
+    }
+
+    const size_t texels = (size_t)width * height;
+    bool         opaque = true;
+    for (size_t i = 0; i < texels && opaque; ++i) {
+        opaque = pixels[i * 4 + 3] == 255;
+    }
+    if (!opaque) {
+        stbi_image_free(pixels);
+        return false;
+    }
+
+    // The same chain texture_loader makes for sources, down to 1x1
+    std::vector<std::vector<uint8_t>> levels;
+    std::vector<uint8_t>              level;
+    const uint8_t*                    previous = pixels;
+    uint32_t                          w        = (uint32_t)width;
+    uint32_t                          h        = (uint32_t)height;
+
+    while (true) {
+        levels.push_back(compressBc1(previous, w, h, jobs));
+        if (w == 1 && h == 1) {
+            break;
+        }
+        level    = downsample(previous, w, h);
+        previous = level.data();
+        w        = std::max(w / 2, 1u);
+        h        = std::max(h / 2, 1u);
+    }
+    stbi_image_free(pixels);
+
+    return writeKtx2(cookedTexturePath(path), vk::Format::eBc1RgbUnormBlock, (uint32_t)width,
+                     (uint32_t)height, levels);
+}
+
+std::string
+virtualTexturePath(const std::string& sourcepath)
+{
+    return std::filesystem::path(sourcepath).replace_extension().string() + virtual_texture_suffix;
+}
+
+bool
+cookVirtualTexture(const std::string& path, jobs::scheduler& jobs)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    core::mapped_file source;
+    if (!source.open(path)) {
+        return false;
+    }
+
+    int      width, height, channels;
+    stbi_uc* pixels =
+      stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(source.data()), (int)source.size(),
+                            &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels) {
+        return false;
+    }
+
+    auto fits = [](int size) {
+        return size >= (int)virtual_tile_size && size <= (int)max_virtual_texture_size
+               && (size & (size - 1)) == 0;
+    };
+
+    const size_t texels = (size_t)width * height;
+    bool         usable = fits(width) && fits(height);
+    for (size_t i = 0; i < texels && usable; ++i) {
+        usable = pixels[i * 4 + 3] == 255;
+    }
+    if (!usable) {
+        stbi_image_free(pixels);
+        return false;
+    }
+
+    virtual_texture_header header;
+    header.width  = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.levels = virtualTextureLevels(header.width, header.height);
+
+    std::ofstream file(virtualTexturePath(path), std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Every tile with its border, wrapping around the level, which also repeats a level that is
+    // smaller than a tile
+    auto wrap = [](int64_t texel, uint32_t size) {
+        return (uint32_t)(((texel % size) + size) % size);
+    };
+
+    std::vector<uint8_t> tile((size_t)virtual_tile_span * virtual_tile_span * 4);
+    std::vector<uint8_t> level;
+    const uint8_t*       current = pixels;
+    uint32_t             w       = header.width;
+    uint32_t             h       = header.height;
+
+    for (uint32_t l = 0; l < header.levels; ++l) {
+        const uint32_t across = std::max(w / virtual_tile_size, 1u);
+        const uint32_t down   = std::max(h / virtual_tile_size, 1u);
+
+        for (uint32_t ty = 0; ty < down; ++ty) {
+            for (uint32_t tx = 0; tx < across; ++tx) {
+                for (uint32_t y = 0; y < virtual_tile_span; ++y) {
+                    const uint32_t sy =
+                      wrap((int64_t)ty * virtual_tile_size + y - virtual_tile_border, h);
+                    for (uint32_t x = 0; x < virtual_tile_span; ++x) {
+                        const uint32_t sx =
+                          wrap((int64_t)tx * virtual_tile_size + x - virtual_tile_border, w);
+                        std::memcpy(&tile[((size_t)y * virtual_tile_span + x) * 4],
+                                    current + ((size_t)sy * w + sx) * 4, 4);
+                    }
+                }
+
+                const std::vector<uint8_t> blocks =
+                  compressBc1(tile.data(), virtual_tile_span, virtual_tile_span, jobs);
+                file.write(reinterpret_cast<const char*>(blocks.data()),
+                           (std::streamsize)blocks.size());
+            }
+        }
+
+        if (l + 1 < header.levels) {
+            level   = downsample(current, w, h);
+            current = level.data();
+            w       = std::max(w / 2, 1u);
+            h       = std::max(h / 2, 1u);
+        }
+    }
+    stbi_image_free(pixels);
+
+    return static_cast<bool>(file);
+}
+
+std::string
+terrainPath(const std::string& sourcepath)
+{
+    return std::filesystem::path(sourcepath).replace_extension().string() + terrain_suffix;
+}
+
+// 8 bit heightmaps are widened by stb, so they cover the same range
+bool
+cookTerrain(const std::string& path, float spacing, float height)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    core::mapped_file source;
+    if (!source.open(path)) {
+        return false;
+    }
+
+    int      width, rows, channels;
+    stbi_us* heights =
+      stbi_load_16_from_memory(reinterpret_cast<const stbi_uc*>(source.data()),
+                               (int)source.size(), &width, &rows, &channels, STBI_grey);
+    if (!heights) {
+        return false;
+    }
+
+    const uint32_t size = (uint32_t)width;
+    if (width != rows || size < terrain_tile_size || size > max_terrain_size
+        || (size & (size - 1)) != 0) {
+        stbi_image_free(heights);
+        return false;
+    }
+
+    terrain_header header;
+    header.size    = size;
+    header.levels  = terrainLevels(size);
+    header.spacing = spacing;
+    header.height  = height;
+
+    std::ofstream file(terrainPath(path), std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Every 2^l-th texel of level 0, so the levels agree wherever their texels coincide
+    std::vector<uint16_t> tile((size_t)terrain_tile_size * terrain_tile_size);
+    for (uint32_t l = 0; l < header.levels; ++l) {
+        const uint32_t across = (size >> l) / terrain_tile_size;
+        for (uint32_t ty = 0; ty < across; ++ty) {
+            for (uint32_t tx = 0; tx < across; ++tx) {
+                for (uint32_t y = 0; y < terrain_tile_size; ++y) {
+                    const size_t row = (size_t)((ty * terrain_tile_size + y) << l) * size;
+                    for (uint32_t x = 0; x < terrain_tile_size; ++x) {
+                        tile[(size_t)y * terrain_tile_size + x] =
+                          heights[row + ((tx * terrain_tile_size + x) << l)];
+                    }
+                }
+                file.write(reinterpret_cast<const char*>(tile.data()), terrain_tile_bytes);
+            }
+        }
+    }
+    stbi_image_free(heights);
+
+    return static_cast<bool>(file);
+}
+
+}  // namespace shiny::graphics
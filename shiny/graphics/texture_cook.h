@@ -0,0 +1,77 @@
+#pragma once
+
+#include "jobs/scheduler.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Halves an RGBA8 image in both directions (down to 1) by averaging 2x2 blocks of texels. Used for the
+mip chain of formats the device can't blit with linear filtering, and for cooked textures. The last
+row or column of an odd sized image is folded into its neighbours' block, just like a blit rounding
+the size down.
+*/
+std::vector<uint8_t> downsample(const uint8_t* pixels, uint32_t width, uint32_t height);
+
+/*
+Compresses an RGBA8 image to BC1 without alpha, 8 bytes for every 4x4 block of texels, with the
+rows of blocks split up on `jobs`. Blocks along the right and bottom edges of sizes that aren't a
+multiple of 4 repeat their last texels.
+*/
+std::vector<uint8_t>
+compressBc1(const uint8_t* pixels, uint32_t width, uint32_t height, jobs::scheduler& jobs);
+
+/*
+Decompresses BC1 blocks without alpha back into a `width` by `height` image, with the rows of
+blocks split up on `jobs`, for devices that can't sample BC1. Texels are RGBA8, or packed 16 bit
+R5G6B5 if `rgb565`, which the endpoints already are, so that only the interpolated colors lose
+anything and the image takes half the memory.
+*/
+std::vector<uint8_t> decompressBc1(const uint8_t*   blocks,
+                                   uint32_t         width,
+                                   uint32_t         height,
+                                   bool             rgb565,
+                                   jobs::scheduler& jobs);
+
+// The cooked version of a texture, which texture_loader prefers to the source when it is there
+std::string cookedTexturePath(const std::string& sourcepath);
+
+/*
+Decodes a texture, builds its whole mip chain and compresses every level, written to
+cookedTexturePath as a KTX2 file, so the renderer neither decodes nor generates anything for it.
+
+Returns false if the texture can't be read or written, or has texels that aren't opaque, which
+BC1 would lose.
+*/
+bool cookTexture(const std::string& path, jobs::scheduler& jobs);
+
+// The virtual texture version of a texture, which materials are drawn with instead of the texture
+// when the renderer has virtual textures
+std::string virtualTexturePath(const std::string& sourcepath);
+
+/*
+Splits a texture into the tiles of a virtual texture (see virtual_texture.h) level by level, and
+compresses every tile to BC1, written to virtualTexturePath.
+
+Returns false if the texture can't be read or written, has texels that aren't opaque, or isn't a
+power of two from virtual_tile_size to max_virtual_texture_size along both sides.
+*/
+bool cookVirtualTexture(const std::string& path, jobs::scheduler& jobs);
+
+// The terrain version of a heightmap, which the renderer draws with setTerrain
+std::string terrainPath(const std::string& sourcepath);
+
+/*
+Splits a grayscale heightmap into the tiles of a terrain (see terrain.h) level by level, from 16
+bits a texel if it has them, written to terrainPath. Its texels are `spacing` apart in world units,
+and the brightest is `height` high.
+
+Returns false if the heightmap can't be read or written, or isn't square and a power of two from
+terrain_tile_size to max_terrain_size along its sides.
+*/
+bool cookTerrain(const std::string& path, float spacing, float height);
+
+}  // namespace shiny::graphics
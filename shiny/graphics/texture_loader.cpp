@@ -0,0 +1,696 @@
+#include "graphics/texture_loader.h"
+
+#include "core/profiler.h"
+#include "graphics/host_allocator.h"
+#include "graphics/texture_cook.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+// The implementation is in texture_cook.cpp, which the cooker builds as well
+#include <include/stb_image.h>
+
+namespace {
+
+// Pre-compressed versions of a texture sit next to it, e.g. textures/texture.bc7.ktx2. The name is
+// only a convention, the format comes from the file; earlier ones are preferred.
+const char* const compressed_texture_suffixes[] = { ".bc7.ktx2", ".astc.ktx2", ".etc2.ktx2",
+                                                    ".bc1.ktx2" };
+
+// Copies out of the staging arena have to start at a multiple of the texel (or block) size
+const vk::DeviceSize level_alignment = 16;
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+// The most loadAsync() copies of a texture at once. Levels larger than that go in bands of rows.
+const size_t upload_band_bytes = 4 * 1024 * 1024;
+
+// Rows of texels in one block of `format`, 1 if it isn't block compressed
+uint32_t
+blockHeight(vk::Format format)
+{
+    switch (format) {
+    case vk::Format::eAstc5x5UnormBlock:
+    case vk::Format::eAstc5x5SrgbBlock:
+    case vk::Format::eAstc6x5UnormBlock:
+    case vk::Format::eAstc6x5SrgbBlock:
+    case vk::Format::eAstc8x5UnormBlock:
+    case vk::Format::eAstc8x5SrgbBlock:
+    case vk::Format::eAstc10x5UnormBlock:
+    case vk::Format::eAstc10x5SrgbBlock:
+        return 5;
+    case vk::Format::eAstc6x6UnormBlock:
+    case vk::Format::eAstc6x6SrgbBlock:
+    case vk::Format::eAstc8x6UnormBlock:
+    case vk::Format::eAstc8x6SrgbBlock:
+    case vk::Format::eAstc10x6UnormBlock:
+    case vk::Format::eAstc10x6SrgbBlock:
+        return 6;
+    case vk::Format::eAstc8x8UnormBlock:
+    case vk::Format::eAstc8x8SrgbBlock:
+    case vk::Format::eAstc10x8UnormBlock:
+    case vk::Format::eAstc10x8SrgbBlock:
+        return 8;
+    case vk::Format::eAstc10x10UnormBlock:
+    case vk::Format::eAstc10x10SrgbBlock:
+    case vk::Format::eAstc12x10UnormBlock:
+    case vk::Format::eAstc12x10SrgbBlock:
+        return 10;
+    case vk::Format::eAstc12x12UnormBlock:
+    case vk::Format::eAstc12x12SrgbBlock:
+        return 12;
+    default:
+        break;
+    }
+
+    // BCn, ETC2, EAC and the ASTC formats left are all 4 high, and numbered one after another
+    const bool fourhigh =
+      format >= vk::Format::eBc1RgbUnormBlock && format <= vk::Format::eAstc5x4SrgbBlock;
+    return fourhigh ? 4 : 1;
+}
+
+// Rows of one mip level that loadAsync() copies in one go
+struct texture_band
+{
+    uint32_t level    = 0;
+    uint32_t firstrow = 0;
+    uint32_t rows     = 0;
+    size_t   offset   = 0;  // into the level's texels
+    size_t   size     = 0;
+};
+
+// Every level of `data` in bands of whole rows of blocks, no larger than upload_band_bytes unless
+// a single row of blocks is
+std::vector<texture_band>
+textureBands(const shiny::graphics::texture_data& data)
+{
+    const uint32_t blockrows = blockHeight(data.format);
+
+    std::vector<texture_band> bands;
+    for (uint32_t i = 0; i < (uint32_t)data.levels.size(); ++i) {
+        const shiny::graphics::ktx2_level& level = data.levels[i];
+
+        const uint32_t blocks    = (level.height + blockrows - 1) / blockrows;
+        const size_t   blocksize = level.size / blocks;  // of a row of blocks
+        const uint32_t perband   = (uint32_t)std::max<size_t>(upload_band_bytes / blocksize, 1);
+
+        for (uint32_t first = 0; first < blocks; first += perband) {
+            const uint32_t count = std::min(perband, blocks - first);
+
+            texture_band band;
+            band.level    = i;
+            band.firstrow = first * blockrows;
+            band.rows     = std::min(count * blockrows, level.height - band.firstrow);
+            band.offset   = first * blocksize;
+            band.size     = count * blocksize;
+            bands.push_back(band);
+        }
+    }
+    return bands;
+}
+
+// The KTX2 versions of a texture first, then the texture itself
+std::vector<std::string>
+readPaths(const std::string& path)
+{
+    const std::string stem = std::filesystem::path(path).replace_extension().string();
+
+    std::vector<std::string> paths;
+    for (const char* suffix : compressed_texture_suffixes) {
+        paths.push_back(stem + suffix);
+    }
+    paths.push_back(path);
+    return paths;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+texture_loader::init(vk::PhysicalDevice physical_device,
+                     vk::Device         device,
+                     memory_allocator&  allocator,
+                     staging_arena&     staging,
+                     upload_service&    uploads,
+                     jobs::scheduler&   jobs,
+                     core::io_queue&    io,
+                     stream_scheduler&  streams)
+{
+    m_physical_device = physical_device;
+    m_device          = device;
+    m_allocator       = &allocator;
+    m_staging         = &staging;
+    m_uploads         = &uploads;
+    m_jobs            = &jobs;
+    m_io              = &io;
+    m_streams         = &streams;
+
+    // vkCmdBlitImage needs the format to support linear filtering for the levels to be averaged
+    const vk::FormatFeatureFlags blit = vk::FormatFeatureFlagBits::eBlitSrc
+                                        | vk::FormatFeatureFlagBits::eBlitDst
+                                        | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+    vk::FormatProperties properties =
+      m_physical_device.getFormatProperties(vk::Format::eR8G8B8A8Unorm);
+    m_rgba_blit = (properties.optimalTilingFeatures & blit) == blit;
+
+    // Like renderer::findSupportedFormat, the first of the candidates that can be sampled. Mobile
+    // GPUs mostly have ETC2 and ASTC without BC, and every GPU has R5G6B5, the BC1 endpoints' own
+    // format, at a quarter of the size of the blocks where RGBA8 would be an eighth.
+    if (!canSample(vk::Format::eBc1RgbUnormBlock)) {
+        for (vk::Format format : { vk::Format::eR5G6B5UnormPack16, vk::Format::eR8G8B8A8Unorm }) {
+            if (canSample(format)) {
+                m_bc1_target = format;
+                break;
+            }
+        }
+    }
+}
+
+std::vector<texture>
+texture_loader::load(upload_batch& uploads, const std::vector<std::string>& paths)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const uint32_t count = (uint32_t)paths.size();
+
+    std::vector<request> requests(count);
+    std::vector<texture> textures(count);
+
+    m_jobs->parallelFor(0, count, 1, [&](uint32_t first, uint32_t last) {
+        for (uint32_t i = first; i < last; ++i) {
+            requests[i].path = paths[i];
+            inspect(requests[i], true);
+        }
+    });
+
+    // Textures go through in waves of as many as fit into the staging arena at once
+    uint32_t next = 0;
+    while (next < count) {
+        uint32_t end = next;
+        for (; end < count; ++end) {
+            request& r = requests[end];
+            if (r.failed) {
+                continue;
+            }
+
+            r.staging = m_staging->allocate(r.size, level_alignment);
+            if (!r.staging) {
+                break;
+            }
+        }
+
+        // Not even the first one fits, so make room by waiting for everything recorded so far
+        if (end == next) {
+            uploads.submit();
+            m_uploads->waitIdle();
+
+            requests[next].staging = m_staging->allocate(requests[next].size, level_alignment);
+            if (!requests[next].staging) {
+                throw std::runtime_error("Failed to allocate staging memory!");
+            }
+            end = next + 1;
+        }
+
+        m_jobs->parallelFor(next, end, 1, [&](uint32_t first, uint32_t last) {
+            for (uint32_t i = first; i < last; ++i) {
+                if (!requests[i].failed) {
+                    fill(requests[i]);
+                }
+            }
+        });
+
+        for (uint32_t i = next; i < end; ++i) {
+            if (!requests[i].failed) {
+                textures[i] = record(uploads, requests[i]);
+            }
+        }
+
+        next = end;
+    }
+
+    return textures;
+}
+
+bool
+texture_loader::read(const std::string& path, texture_data& data) const
+{
+    SHINY_PROFILE_FUNCTION();
+
+    request r;
+    r.path = path;
+    inspect(r, false);
+
+    return decode(r, data);
+}
+
+stream_scheduler::ticket
+texture_loader::readAsync(const std::string& path, float importance, read_callback done)
+{
+    auto decoded = [this, path, importance, done](core::mapped_file&& file, size_t which) {
+        // Jobs are copied around, which the file can't be
+        auto read = std::make_shared<core::mapped_file>(std::move(file));
+
+        m_streams->decode(m_async, importance, [this, path, done, read, which]() {
+            SHINY_PROFILE_ZONE("decode texture");
+
+            texture_data data;
+            const bool   ok = decodeRead(path, std::move(*read), which, data);
+            done(ok, data);
+        });
+    };
+
+    return m_streams->read(readPaths(path), 0, importance, std::move(decoded));
+}
+
+// `path` is taken by value, the caller's string may be long gone once the coroutine resumes
+jobs::task<texture>
+texture_loader::loadAsync(std::string path, core::io_priority priority)
+{
+    core::io_queue::read_result read = co_await m_io->reading(readPaths(path), priority);
+
+    co_await jobs::schedule(*m_jobs, m_async, core::thread_class::background);
+
+    texture_data data;
+    {
+        SHINY_PROFILE_ZONE("decode texture");
+        if (!decodeRead(path, std::move(read.file), read.which, data)) {
+            co_return texture();
+        }
+    }
+
+    const std::vector<texture_band> bands     = textureBands(data);
+    const uint32_t                  miplevels = (uint32_t)data.levels.size();
+
+    auto toolarge = [&](const texture_band& band) { return band.size > m_staging->capacity(); };
+    if (bands.empty() || std::any_of(bands.begin(), bands.end(), toolarge)) {
+        co_return texture();
+    }
+
+    // A frame's batch takes as many bands as the upload budget and the staging arena have room
+    // for, and the last one makes the image ready. The budget always has room for the first upload
+    // of a frame, so even with others streaming every frame takes at least the next band, unless
+    // the arena is full.
+    texture       image;
+    upload_ticket ticket = 0;
+    size_t        next   = 0;
+    while (next < bands.size()) {
+        co_await m_uploads->next();
+        if (!image) {
+            image = create(data.format, data.width, data.height, miplevels);
+        }
+
+        upload_batch uploads = m_uploads->begin();
+        for (; next < bands.size(); ++next) {
+            const texture_band& band = bands[next];
+            if (!m_streams->upload(band.size)) {
+                break;
+            }
+
+            staging_region staging = m_staging->allocate(band.size, level_alignment);
+            if (!staging) {
+                break;
+            }
+
+            if (next == 0) {
+                uploads.transitionImageLayout(image.image, vk::ImageAspectFlagBits::eColor,
+                                              vk::ImageLayout::eUndefined,
+                                              vk::ImageLayout::eTransferDstOptimal, miplevels);
+            }
+
+            std::memcpy(staging.data, data.levelData(band.level) + band.offset, band.size);
+            uploads.copyBufferToImage(staging, image.image, data.levels[band.level].width,
+                                      band.rows, band.level, band.firstrow,
+                                      next + 1 < bands.size());
+        }
+
+        if (next == bands.size()) {
+            uploads.transitionImageLayout(image.image, vk::ImageAspectFlagBits::eColor,
+                                          vk::ImageLayout::eTransferDstOptimal,
+                                          vk::ImageLayout::eShaderReadOnlyOptimal, miplevels);
+        }
+        ticket = uploads.submit();
+    }
+
+    co_await m_uploads->complete(ticket);
+    co_return image;
+}
+
+// `which` is the index of `file` in the paths readAsync() asked for
+bool
+texture_loader::decodeRead(const std::string& path,
+                           core::mapped_file  file,
+                           size_t             which,
+                           texture_data&      data) const
+{
+    const size_t ktx2count = std::size(compressed_texture_suffixes);
+
+    request r;
+    r.path = path;
+
+    ktx2_texture compressed;
+    if (which < ktx2count && readKtx2(std::move(file), compressed)
+        && (canSample(compressed.format) || canTranscode(compressed.format))) {
+        inspectCompressed(r, std::move(compressed));
+    } else if (which == ktx2count) {
+        r.source = std::move(file);
+        inspectSource(r, false);
+    } else if (which < ktx2count) {
+        inspect(r, false);
+    } else {
+        r.failed = true;
+    }
+
+    return decode(r, data);
+}
+
+void
+texture_loader::waitAsync()
+{
+    m_jobs->wait(m_async);
+}
+
+/*
+What read() has left to do after inspect(): compressed texels stay where they are, anything else
+is decoded onto the heap.
+*/
+bool
+texture_loader::decode(request& r, texture_data& data) const
+{
+    if (r.failed) {
+        return false;
+    }
+
+    if (r.compressed.format != vk::Format::eUndefined && !r.transcode) {
+        data.compressed = std::move(r.compressed);
+        data.levels     = data.compressed.levels;
+    } else {
+        // Decoded the same way as into staging memory, only into the heap
+        data.texels.resize((size_t)r.size);
+        r.staging.data = data.texels.data();
+        fill(r);
+
+        if (r.failed) {
+            return false;
+        }
+        data.levels = r.levels;
+    }
+
+    data.format = r.format;
+    data.width  = r.width;
+    data.height = r.height;
+    return true;
+}
+
+texture
+texture_loader::create(vk::Format          format,
+                       uint32_t            width,
+                       uint32_t            height,
+                       uint32_t            miplevels,
+                       vk::ImageUsageFlags usage,
+                       uint32_t            layers)
+{
+    texture result;
+    result.format    = format;
+    result.width     = width;
+    result.height    = height;
+    result.miplevels = miplevels;
+    result.layers    = layers;
+
+    auto imageinfo = vk::ImageCreateInfo()
+                       .setImageType(vk::ImageType::e2D)
+                       .setExtent(vk::Extent3D(width, height, 1))
+                       .setMipLevels(miplevels)
+                       .setArrayLayers(layers)
+                       .setFormat(format)
+                       .setTiling(vk::ImageTiling::eOptimal)
+                       .setInitialLayout(vk::ImageLayout::eUndefined)
+                       .setUsage(usage)
+                       .setSamples(vk::SampleCountFlagBits::e1)
+                       .setSharingMode(vk::SharingMode::eExclusive);
+
+    result.image  = m_device.createImage(imageinfo, hostAllocator());
+    result.memory = m_allocator->allocate(m_device.getImageMemoryRequirements(result.image),
+                                          vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                          memory_allocator::resource_kind::optimal,
+                                          memory_category::texture);
+    m_device.bindImageMemory(result.image, result.memory.memory, result.memory.offset);
+
+    return result;
+}
+
+void
+texture_loader::destroy(texture& texture)
+{
+    if (!texture) {
+        return;
+    }
+
+    m_device.destroyImage(texture.image, hostAllocator());
+    m_allocator->free(texture.memory);
+    texture.image = nullptr;
+}
+
+// Querying format properties needs no synchronization, so this is fine to call from the workers
+bool
+texture_loader::canSample(vk::Format format) const
+{
+    const vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eSampledImage
+                                          | vk::FormatFeatureFlagBits::eSampledImageFilterLinear
+                                          | vk::FormatFeatureFlagBits::eTransferDst;
+
+    vk::FormatProperties properties = m_physical_device.getFormatProperties(format);
+    return (properties.optimalTilingFeatures & needed) == needed;
+}
+
+// Whether a KTX2 file in `format` that can't be sampled is transcoded on load instead
+bool
+texture_loader::canTranscode(vk::Format format) const
+{
+    return format == vk::Format::eBc1RgbUnormBlock && m_bc1_target != vk::Format::eUndefined;
+}
+
+/*
+Decides where a texture's texels come from and how big its staging memory has to be. Only headers
+are read here: KTX2 files are mapped, and the source image is mapped and asked for its size. When
+the texture is `staged` by load(), a KTX2 file in a compressed package isn't even decompressed
+beyond its header, its levels are decompressed into the staging memory later.
+*/
+void
+texture_loader::inspect(request& r, bool staged) const
+{
+    const std::string stem = std::filesystem::path(r.path).replace_extension().string();
+
+    // Any version the device samples as it is beats transcoding one
+    ktx2_texture transcoded;
+    for (const char* suffix : compressed_texture_suffixes) {
+        ktx2_texture compressed;
+        const bool   found = staged ? readKtx2Header(stem + suffix, compressed)
+                                    : readKtx2(stem + suffix, compressed);
+        if (!found) {
+            continue;
+        }
+
+        if (canSample(compressed.format)) {
+            inspectCompressed(r, std::move(compressed));
+            return;
+        }
+        if (canTranscode(compressed.format) && transcoded.format == vk::Format::eUndefined) {
+            transcoded = std::move(compressed);
+        }
+    }
+
+    if (transcoded.format != vk::Format::eUndefined) {
+        inspectCompressed(r, std::move(transcoded));
+        return;
+    }
+
+    if (!r.source.open(r.path)) {
+        r.failed = true;
+        return;
+    }
+    inspectSource(r, staged);
+}
+
+/*
+Compressed images can't be blitted into, so they only have the levels that come in the file. A
+transcoded texture has the same levels, only as large as they are in the format it goes to.
+*/
+void
+texture_loader::inspectCompressed(request& r, ktx2_texture compressed) const
+{
+    r.transcode = !canSample(compressed.format);
+    r.format    = r.transcode ? m_bc1_target : compressed.format;
+    r.width     = compressed.width;
+    r.height    = compressed.height;
+    r.miplevels = (uint32_t)compressed.levels.size();
+    r.levels    = compressed.levels;
+
+    const size_t texelsize = r.format == vk::Format::eR5G6B5UnormPack16 ? 2 : 4;
+    for (ktx2_level& level : r.levels) {
+        if (r.transcode) {
+            level.size = (size_t)level.width * level.height * texelsize;
+        }
+        level.offset = (size_t)alignUp(r.size, level_alignment);
+        r.size       = level.offset + level.size;
+    }
+
+    r.compressed = std::move(compressed);
+}
+
+// For a source image that is already open. Only the first level of a staged one is staged when the
+// rest can be made from it on the GPU.
+void
+texture_loader::inspectSource(request& r, bool staged) const
+{
+    int width, height, channels;
+    if (!stbi_info_from_memory(reinterpret_cast<const stbi_uc*>(r.source.data()),
+                               (int)r.source.size(), &width, &height, &channels)) {
+        r.failed = true;
+        return;
+    }
+
+    // The full chain goes down to 1x1, halving the larger side every level
+    r.format    = vk::Format::eR8G8B8A8Unorm;
+    r.width     = (uint32_t)width;
+    r.height    = (uint32_t)height;
+    r.miplevels = (uint32_t)std::floor(std::log2(std::max(r.width, r.height))) + 1;
+    r.blit      = staged && (m_rgba_blit || m_uploads->downsamples(r.format, r.miplevels));
+    r.levels.resize(r.blit ? 1 : r.miplevels);
+
+    for (uint32_t i = 0; i < (uint32_t)r.levels.size(); ++i) {
+        ktx2_level& level = r.levels[i];
+        level.width       = std::max(r.width >> i, 1u);
+        level.height      = std::max(r.height >> i, 1u);
+        level.size        = (size_t)level.width * level.height * 4;  // we load RGBA
+        level.offset      = (size_t)alignUp(r.size, level_alignment);
+        r.size            = level.offset + level.size;
+    }
+}
+
+/*
+Writes a texture's levels into its staging memory. The memory may well be write-combined, so it is
+only ever written to; the CPU mip levels are made from copies on the heap instead of being read
+back out of it.
+*/
+void
+texture_loader::fill(request& r) const
+{
+    SHINY_PROFILE_FUNCTION();
+
+    char* staging = static_cast<char*>(r.staging.data);
+
+    // Levels still in a package are decompressed straight into the staging memory, a block per
+    // job
+    if (r.compressed.format != vk::Format::eUndefined && r.transcode) {
+        const bool rgb565 = r.format == vk::Format::eR5G6B5UnormPack16;
+
+        std::vector<char> blocks;
+        for (size_t i = 0; i < r.levels.size(); ++i) {
+            const size_t needed = (size_t)((r.levels[i].width + 3) / 4)
+                                  * ((r.levels[i].height + 3) / 4) * 8;  // bytes of BC1 blocks
+
+            blocks.resize(r.compressed.levels[i].size);
+            if (blocks.size() < needed || !r.compressed.copyLevel(i, blocks.data(), m_jobs)) {
+                r.failed = true;
+                return;
+            }
+
+            const std::vector<uint8_t> texels =
+              decompressBc1(reinterpret_cast<const uint8_t*>(blocks.data()), r.levels[i].width,
+                            r.levels[i].height, rgb565, *m_jobs);
+            std::memcpy(staging + r.levels[i].offset, texels.data(), r.levels[i].size);
+        }
+        return;
+    }
+
+    if (r.compressed.format != vk::Format::eUndefined) {
+        for (size_t i = 0; i < r.levels.size(); ++i) {
+            if (!r.compressed.copyLevel(i, staging + r.levels[i].offset, m_jobs)) {
+                r.failed = true;
+                return;
+            }
+        }
+        return;
+    }
+
+    int      width, height, channels;
+    stbi_uc* pixels =
+      stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(r.source.data()),
+                            (int)r.source.size(), &width, &height, &channels, STBI_rgb_alpha);
+
+    if (!pixels || (uint32_t)width != r.width || (uint32_t)height != r.height) {
+        stbi_image_free(pixels);
+        r.failed = true;
+        return;
+    }
+
+    // NOTE: We might have to manipulate the bitmap because it stores things as BGRA for big-endian
+    // systems.
+    std::memcpy(staging + r.levels[0].offset, pixels, r.levels[0].size);
+
+    std::vector<uint8_t> level;
+    const uint8_t*       previous = pixels;
+
+    for (size_t i = 1; i < r.levels.size(); ++i) {
+        level    = downsample(previous, r.levels[i - 1].width, r.levels[i - 1].height);
+        previous = level.data();
+        std::memcpy(staging + r.levels[i].offset, level.data(), r.levels[i].size);
+    }
+
+    stbi_image_free(pixels);
+}
+
+/*
+Creates the image and records its upload. The transitions cover every mip level, and either the
+blits or the last transition leave all of them ready for shader access.
+*/
+texture
+texture_loader::record(upload_batch& uploads, const request& r)
+{
+    // The blitted mip levels are read from each other, so the image is a transfer source as well,
+    // or stored to when a compute shader builds them instead
+    vk::ImageUsageFlags usage =
+      vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+    if (r.blit && m_uploads->downsamples(r.format, r.miplevels)) {
+        usage |= vk::ImageUsageFlagBits::eStorage;
+    } else if (r.blit) {
+        usage |= vk::ImageUsageFlagBits::eTransferSrc;
+    }
+
+    texture result = create(r.format, r.width, r.height, r.miplevels, usage);
+
+    uploads.transitionImageLayout(result.image, vk::ImageAspectFlagBits::eColor,
+                                  vk::ImageLayout::eUndefined,
+                                  vk::ImageLayout::eTransferDstOptimal, r.miplevels);
+
+    for (uint32_t i = 0; i < (uint32_t)r.levels.size(); ++i) {
+        staging_region level = r.staging;
+        level.offset         = r.staging.offset + r.levels[i].offset;
+        level.size           = r.levels[i].size;
+        level.data           = static_cast<char*>(r.staging.data) + r.levels[i].offset;
+
+        uploads.copyBufferToImage(level, result.image, r.levels[i].width, r.levels[i].height, i);
+    }
+
+    if (r.blit && r.miplevels > 1) {
+        uploads.generateMipmaps(result.image, r.width, r.height, r.miplevels, r.format);
+    } else {
+        uploads.transitionImageLayout(result.image, vk::ImageAspectFlagBits::eColor,
+                                      vk::ImageLayout::eTransferDstOptimal,
+                                      vk::ImageLayout::eShaderReadOnlyOptimal, r.miplevels);
+    }
+
+    return result;
+}
+
+}  // namespace shiny::graphics
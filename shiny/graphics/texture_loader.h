@@ -0,0 +1,186 @@
+#pragma once
+
+#include "core/io_queue.h"
+#include "graphics/ktx2_file.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/stream_scheduler.h"
+#include "graphics/upload_service.h"
+#include "jobs/scheduler.h"
+#include "jobs/task.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+A sampled 2D image with its mip levels. Once the batch it was loaded with has been submitted it is
+in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+*/
+struct texture
+{
+    vk::Image  image;
+    allocation memory;
+    vk::Format format    = vk::Format::eUndefined;
+    uint32_t   width     = 0;
+    uint32_t   height    = 0;
+    uint32_t   miplevels = 0;
+    uint32_t   layers    = 1;
+
+    explicit operator bool() const { return static_cast<bool>(image); }
+};
+
+/*
+Every mip level of a texture, kept on the CPU so any range of levels can be uploaded again later.
+KTX2 texels stay in the mapped file; decoded ones are on the heap, mip levels included.
+*/
+struct texture_data
+{
+    ktx2_texture            compressed;
+    std::vector<uint8_t>    texels;
+    vk::Format              format = vk::Format::eUndefined;
+    uint32_t                width  = 0;
+    uint32_t                height = 0;
+    std::vector<ktx2_level> levels;  // offsets are into `compressed.file` or `texels`
+
+    const char* levelData(size_t level) const
+    {
+        return compressed.format != vk::Format::eUndefined
+                 ? compressed.levelData(level)
+                 : reinterpret_cast<const char*>(texels.data()) + levels[level].offset;
+    }
+};
+
+/*
+Loads many textures at once, with everything that doesn't need the staging arena or the batch done
+on the job scheduler:
+
+ 1. Every texture looks for a pre-compressed KTX2 version next to it whose format the device can
+    sample, or else a BC1 one to transcode, and otherwise reads the size of its source image
+    (workers).
+ 2. Staging memory for all the levels that come from the CPU is allocated (calling thread, since the
+    arena isn't thread safe).
+ 3. The texels are decoded, or for KTX2 copied (decompressed, if in a package), into that staging
+    memory, together with the CPU-side mip levels for formats the device can't blit (workers).
+    BC1 levels the device can't sample are transcoded on the way, every level of the file into
+    the smallest format that it can, so the one cooked texture serves desktop and mobile GPUs.
+ 4. The images are created and their copies recorded into the batch (calling thread).
+
+When the staging arena runs full, the batch is submitted, and loading waits for the uploads and
+carries on with the remaining textures.
+*/
+class texture_loader
+{
+public:
+    void init(vk::PhysicalDevice physical_device,
+              vk::Device         device,
+              memory_allocator&  allocator,
+              staging_arena&     staging,
+              upload_service&    uploads,
+              jobs::scheduler&   jobs,
+              core::io_queue&    io,
+              stream_scheduler&  streams);
+
+    // Textures that couldn't be loaded come back empty, in the same position as their path
+    std::vector<texture> load(upload_batch& uploads, const std::vector<std::string>& paths);
+    void                 destroy(texture& texture);
+
+    // Reads a texture the same way `load` does, but into `data` instead of an image, and always
+    // with its whole mip chain. Runs on the calling thread.
+    bool read(const std::string& path, texture_data& data) const;
+
+    // Called on a worker when a texture read by readAsync() is done, with false if it couldn't be
+    using read_callback = std::function<void(bool read, texture_data& data)>;
+
+    /*
+    read() without waiting on the disk anywhere but on the I/O queue, which reads the first of the
+    texture's KTX2 versions and its source image that exists. It is decoded in a job once it's
+    read, and in the rare case that the KTX2 file turns out to be unusable the other files are
+    fallen back to on the worker. Both the read and the decode are queued on the stream scheduler,
+    at `importance`, to go within its budgets.
+
+    The ticket can change the read's importance or cancel it until it starts; after that, `done`
+    runs regardless.
+    */
+    stream_scheduler::ticket readAsync(const std::string& path,
+                                       float              importance,
+                                       read_callback      done);
+
+    /*
+    load() for coroutines, see jobs::task, one texture at a time and without blocking any thread:
+
+        texture image = co_await loader.loadAsync("textures/chalet.jpg");
+
+    It suspends while the I/O queue reads the file, is decoded on a worker like readAsync(), and
+    resumes in the upload service's next update() to record its upload. A large texture goes in
+    bands of rows, over as many frames as the stream scheduler's upload budget takes, and in any
+    frame the staging arena is full it waits for the next one. Then it resumes once more in the
+    update() after the last band is uploaded, since only then is the image ready. So
+    whatever comes after the co_await runs on the render thread, and can use the image right away.
+    Comes back empty if the texture couldn't be loaded.
+    */
+    jobs::task<texture> loadAsync(std::string       path,
+                                  core::io_priority priority = core::io_priority::normal);
+
+    // Waits for the jobs of readAsync() and loadAsync() to finish. The I/O queue has to have been
+    // shut down before, so that no more are started.
+    void waitAsync();
+
+    // An image without any contents yet, in VK_IMAGE_LAYOUT_UNDEFINED, of `layers` layers
+    texture create(vk::Format          format,
+                   uint32_t            width,
+                   uint32_t            height,
+                   uint32_t            miplevels,
+                   vk::ImageUsageFlags usage  = vk::ImageUsageFlagBits::eTransferDst
+                                                | vk::ImageUsageFlagBits::eSampled,
+                   uint32_t            layers = 1);
+
+private:
+    struct request
+    {
+        std::string       path;
+        ktx2_texture      compressed;  // only opened if its format is used
+        core::mapped_file source;
+
+        vk::Format              format    = vk::Format::eUndefined;
+        uint32_t                width     = 0;
+        uint32_t                height    = 0;
+        uint32_t                miplevels = 0;
+        bool                    blit      = false;  // levels after the first are made on the GPU
+        bool                    transcode = false;  // `compressed` is BC1, decoded to `format`
+        std::vector<ktx2_level> levels;             // the staged ones, offsets are into `staging`
+        vk::DeviceSize          size   = 0;
+        staging_region          staging;
+        bool                    failed = false;
+    };
+
+    bool    canSample(vk::Format format) const;
+    bool    canTranscode(vk::Format format) const;
+    void    inspect(request& request, bool staged) const;
+    void    inspectCompressed(request& request, ktx2_texture compressed) const;
+    void    inspectSource(request& request, bool staged) const;
+    void    fill(request& request) const;
+    bool    decode(request& request, texture_data& data) const;
+    bool    decodeRead(const std::string& path,
+                       core::mapped_file  file,
+                       size_t             which,
+                       texture_data&      data) const;
+    texture record(upload_batch& uploads, const request& request);
+
+    vk::PhysicalDevice m_physical_device;
+    vk::Device         m_device;
+    memory_allocator*  m_allocator = nullptr;
+    staging_arena*     m_staging   = nullptr;
+    upload_service*    m_uploads   = nullptr;
+    jobs::scheduler*   m_jobs      = nullptr;
+    core::io_queue*    m_io        = nullptr;
+    stream_scheduler*  m_streams   = nullptr;
+
+    jobs::counter m_async;  // readAsync's decoding
+
+    bool       m_rgba_blit  = false;  // whether RGBA8 levels can be blitted with linear filtering
+    vk::Format m_bc1_target = vk::Format::eUndefined;  // BC1 is transcoded to, if not sampled
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,665 @@
+#include "graphics/texture_streamer.h"
+
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Levels no larger than this along either side make up the mip tail, which is always resident
+const uint32_t tail_size = 64;
+
+// A texture that hasn't been asked for in this many frames is only kept sharp while there is room,
+// and one that is still waiting to be read isn't read at all
+const uint64_t request_timeout = 120;
+
+// Hot reloads go ahead of anything else that is read, whoever asks to see what
+const float reload_importance = std::numeric_limits<float>::max();
+
+// Copies out of the staging arena have to start at a multiple of the texel (or block) size
+const vk::DeviceSize level_alignment = 16;
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+texture_streamer::init(vk::Device        device,
+                       memory_allocator& allocator,
+                       staging_arena&    staging,
+                       upload_service&   uploads,
+                       texture_loader&   loader,
+                       view_cache&       views,
+                       stream_scheduler& streams,
+                       deletion_queue&   deletions,
+                       vk::DeviceSize    budget)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_staging   = &staging;
+    m_uploads   = &uploads;
+    m_loader    = &loader;
+    m_views     = &views;
+    m_streams   = &streams;
+    m_deletions = &deletions;
+    m_budget    = budget;
+}
+
+void
+texture_streamer::destroy()
+{
+    for (entry& e : m_entries) {
+        m_views->releaseViews(e.image.image);
+        m_loader->destroy(e.image);
+    }
+    for (texture_array& a : m_arrays) {
+        m_views->releaseViews(a.image.image);
+        m_loader->destroy(a.image);
+    }
+    m_entries.clear();
+    m_free.clear();
+    m_arrays.clear();
+    m_arrivals.clear();
+    m_deferred.clear();
+    m_resident = 0;
+}
+
+texture_streamer::handle
+texture_streamer::add(upload_batch& uploads, const std::string& path)
+{
+    texture_data data;
+    if (!m_loader->read(path, data)) {
+        return invalid_handle;
+    }
+    return add(uploads, std::move(data));
+}
+
+texture_streamer::handle
+texture_streamer::add(upload_batch& uploads, texture_data data)
+{
+    entry e;
+    prepare(e, std::move(data));
+    e.last_requested = m_frame;
+
+    // Nothing has been drawn with the texture yet, so it's fine for this to wait
+    if (!upload(uploads, e, m_frame)) {
+        uploads.submit();
+        m_uploads->waitIdle();
+
+        if (!upload(uploads, e, m_frame)) {
+            throw std::runtime_error("Failed to allocate staging memory!");
+        }
+    }
+
+    return place(std::move(e));
+}
+
+/*
+The callback runs on a worker, so the texture is only handed over there and taken in by update().
+If the texture has been removed by then, even if its handle has been reused since, its `read` no
+longer matches and it is dropped.
+*/
+texture_streamer::handle
+texture_streamer::addAsync(const std::string& path, float importance)
+{
+    entry e;
+    e.pending        = true;
+    e.last_requested = m_frame;
+
+    const handle texture = place(std::move(e));
+    startRead(texture, path, importance);
+    return texture;
+}
+
+/*
+The texture is read again like addAsync() reads it, and swapped for the new one in an update().
+Meanwhile the old one is drawn, and streamed, as before.
+*/
+void
+texture_streamer::reload(handle texture, const std::string& path)
+{
+    entry& e = m_entries[texture];
+    if (e.pending || e.reloading) {
+        m_streams->cancel(e.ticket);
+    }
+    e.reloading = !e.pending;
+
+    // Someone is looking at it, or it wouldn't have been touched
+    startRead(texture, path, reload_importance);
+}
+
+void
+texture_streamer::remove(handle texture, uint64_t frame)
+{
+    if (m_entries[texture].pending || m_entries[texture].reloading) {
+        m_streams->cancel(m_entries[texture].ticket);
+    }
+    retire(m_entries[texture], frame);
+    m_entries[texture] = entry();
+    m_free.push_back(texture);
+}
+
+void
+texture_streamer::request(handle texture, float pixels)
+{
+    entry& e         = m_entries[texture];
+    e.last_requested = m_frame;
+
+    // It's on screen without its texels, so it goes ahead of whatever is less so, and is read
+    // again if it was cancelled
+    if (e.pending) {
+        if (e.cancelled) {
+            startRead(texture, e.path, pixels);
+        } else if (pixels > e.importance) {
+            m_streams->setImportance(e.ticket, pixels);
+            e.importance = pixels;
+        }
+        return;
+    }
+
+    e.wanted = std::min(e.wanted, levelFor(e, pixels));
+}
+
+/*
+Evictions go first, so whatever they free up can be streamed into in the same frame. The textures
+that are sharper than they need to be lose a level first, then the ones nobody has asked for the
+longest. Textures that want to be sharper are served the most recently requested first.
+*/
+void
+texture_streamer::update(uint64_t frame)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_frame = frame;
+
+    cancelUnwanted(frame);
+
+    // Images waiting in the deletion queue are still in the device's usage, but are as good as gone
+    const memory_budget  device = m_allocator->deviceLocalBudget();
+    const vk::DeviceSize usage = device.usage - std::min(device.usage, m_retiring);
+
+    vk::DeviceSize limit =
+      std::min(m_budget, m_resident + (device.budget > usage ? device.budget - usage : 0));
+    if (usage > device.budget) {
+        limit = std::min(limit, m_resident - std::min(m_resident, usage - device.budget));
+    }
+
+    auto desired = [&](const entry& e) {
+        return frame - e.last_requested > request_timeout ? e.tail : e.wanted;
+    };
+
+    upload_batch uploads = m_uploads->begin();
+
+    adopt(uploads, frame);
+
+    while (m_resident > limit) {
+        entry* victim       = nullptr;
+        int    victimexcess = 0;
+
+        for (entry& e : m_entries) {
+            if (e.pending || e.array != no_array || e.base >= e.tail) {
+                continue;
+            }
+
+            const int excess = (int)desired(e) - (int)e.base;
+            if (!victim || excess > victimexcess
+                || (excess == victimexcess && e.last_requested < victim->last_requested)) {
+                victim       = &e;
+                victimexcess = excess;
+            }
+        }
+
+        if (!victim || !rebuild(uploads, *victim, victim->base + 1, frame)) {
+            break;
+        }
+    }
+
+    std::vector<entry*> wanting;
+    for (entry& e : m_entries) {
+        if (desired(e) < e.base) {
+            wanting.push_back(&e);
+        }
+    }
+
+    std::sort(wanting.begin(), wanting.end(), [&](const entry* a, const entry* b) {
+        if (a->last_requested != b->last_requested) {
+            return a->last_requested > b->last_requested;
+        }
+        return a->base - desired(*a) > b->base - desired(*b);
+    });
+
+    // Evictions don't take from the upload budget, they only re-upload levels that are smaller
+    // than the ones they replace
+    for (entry* e : wanting) {
+        const vk::DeviceSize size = stagingSize(*e, e->base - 1);
+
+        // The staged size is close enough to the new image's for deciding if it fits
+        if (m_resident - e->image.memory.size + size > limit) {
+            continue;
+        }
+
+        if (!m_streams->upload(size) || !rebuild(uploads, *e, e->base - 1, frame)) {
+            break;
+        }
+    }
+
+    for (entry& e : m_entries) {
+        e.wanted = e.tail;
+    }
+
+    uploads.submit();
+}
+
+bool
+texture_streamer::reading() const
+{
+    auto inflight = [](const entry& e) { return (e.pending && !e.cancelled) || e.reloading; };
+    return !m_deferred.empty() || std::any_of(m_entries.begin(), m_entries.end(), inflight);
+}
+
+/*
+The CPU side has every level, so re-uploading one is as good as copying it from the old image, and
+needs neither a source usage on every texture nor the old image's ownership on the transfer queue.
+The arrays of packed textures stay where they are, they are few and would take all their layers.
+*/
+vk::DeviceSize
+texture_streamer::relocate(upload_batch& uploads, uint64_t frame, vk::DeviceSize budget)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    vk::DeviceSize moved = 0;
+    for (entry& e : m_entries) {
+        if (e.pending || !e.image || !m_allocator->evacuating(e.image.memory)) {
+            continue;
+        }
+
+        const vk::DeviceSize size = stagingSize(e, e.base);
+        if (moved > 0 && moved + size > budget) {
+            break;
+        }
+        if (!rebuild(uploads, e, e.base, frame)) {
+            break;
+        }
+        moved += size;
+    }
+
+    return moved;
+}
+
+void
+texture_streamer::startRead(handle texture, const std::string& path, float importance)
+{
+    entry& e     = m_entries[texture];
+    e.read       = ++m_reads;
+    e.importance = importance;
+    e.cancelled  = false;
+    e.path       = path;
+
+    const uint64_t read = e.read;
+    e.ticket =
+      m_loader->readAsync(path, importance, [this, texture, read](bool ok, texture_data& data) {
+          arrival a;
+          a.texture = texture;
+          a.read    = read;
+          a.ok      = ok;
+          a.data    = std::move(data);
+
+          std::lock_guard<std::mutex> lock(m_arrivals_mutex);
+          m_arrivals.push_back(std::move(a));
+      });
+}
+
+// What nobody has asked to see for a while isn't worth its share of the budgets, as long as it
+// hasn't started reading yet. Reloads have their old image to show, so they always go ahead.
+void
+texture_streamer::cancelUnwanted(uint64_t frame)
+{
+    for (entry& e : m_entries) {
+        if (e.pending && !e.cancelled && frame - e.last_requested > request_timeout
+            && m_streams->cancel(e.ticket)) {
+            e.cancelled = true;
+            e.ticket    = stream_scheduler::invalid_ticket;
+        }
+    }
+}
+
+// Reused handles go first, so the bindless array stays as small as it can
+texture_streamer::handle
+texture_streamer::place(entry e)
+{
+    if (!m_free.empty()) {
+        const handle texture = m_free.back();
+        m_free.pop_back();
+
+        m_entries[texture] = std::move(e);
+        return texture;
+    }
+
+    m_entries.push_back(std::move(e));
+    return (handle)(m_entries.size() - 1);
+}
+
+void
+texture_streamer::prepare(entry& e, texture_data data) const
+{
+    e.data = std::move(data);
+
+    const uint32_t last = (uint32_t)e.data.levels.size() - 1;
+    while (e.tail < last
+           && std::max(e.data.levels[e.tail].width, e.data.levels[e.tail].height) > tail_size) {
+        ++e.tail;
+    }
+    e.wanted = e.tail;
+}
+
+/*
+Takes in what addAsync() has read since the last update, recording the uploads of the mip tails.
+A tail that doesn't fit into the staging arena is left for the next update, since unlike add()
+this mustn't wait for the GPU.
+*/
+void
+texture_streamer::adopt(upload_batch& uploads, uint64_t frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_arrivals_mutex);
+        for (arrival& a : m_arrivals) {
+            m_deferred.push_back(std::move(a));
+        }
+        m_arrivals.clear();
+    }
+
+    std::vector<arrival> arrived;
+    arrived.swap(m_deferred);
+
+    for (arrival& a : arrived) {
+        entry& e = m_entries[a.texture];
+        if (e.read != a.read || (!e.pending && !e.reloading)) {
+            continue;
+        }
+
+        // A reload that can't be read keeps the texture as it was
+        if (!a.ok) {
+            e.pending   = false;
+            e.reloading = false;
+            e.ticket    = stream_scheduler::invalid_ticket;
+            continue;
+        }
+
+        // Built on the side, so a reloaded texture keeps its old image until the new one is there
+        entry fresh;
+        prepare(fresh, std::move(a.data));
+        const uint32_t base = packable(fresh.data) ? 0 : fresh.tail;
+        if (!m_streams->upload(stagingSize(fresh, base)) || !upload(uploads, fresh, frame)) {
+            a.data = std::move(fresh.data);
+            m_deferred.push_back(std::move(a));
+            continue;
+        }
+
+        fresh.last_requested = e.last_requested;
+        retire(e, frame);
+        e = std::move(fresh);
+    }
+}
+
+uint32_t
+texture_streamer::shaderIndex(handle texture) const
+{
+    const entry& e = m_entries[texture];
+    if (e.array == no_array) {
+        return texture;
+    }
+    return packed_texture_bit | (e.array * array_texture_layers + e.layer);
+}
+
+uint32_t
+texture_streamer::levelFor(const entry& e, float pixels) const
+{
+    const float size = (float)std::max(e.data.width, e.data.height);
+    if (pixels >= size) {
+        return 0;
+    }
+    if (pixels <= 1.f) {
+        return e.tail;
+    }
+
+    return std::min((uint32_t)std::floor(std::log2(size / pixels)), e.tail);
+}
+
+vk::DeviceSize
+texture_streamer::stagingSize(const entry& e, uint32_t base) const
+{
+    vk::DeviceSize size = 0;
+    for (size_t i = base; i < e.data.levels.size(); ++i) {
+        size = alignUp(size, level_alignment) + e.data.levels[i].size;
+    }
+    return size;
+}
+
+// An array of the texture's format, size and levels that has a layer to spare
+uint32_t
+texture_streamer::arrayFor(const texture_data& data) const
+{
+    for (uint32_t i = 0; i < (uint32_t)m_arrays.size(); ++i) {
+        const texture& image = m_arrays[i].image;
+        if (image.format == data.format && image.width == data.width
+            && image.height == data.height && image.miplevels == data.levels.size()
+            && !m_arrays[i].free.empty()) {
+            return i;
+        }
+    }
+    return no_array;
+}
+
+bool
+texture_streamer::packable(const texture_data& data) const
+{
+    return std::max(data.width, data.height) <= array_texture_size
+           && (arrayFor(data) != no_array || m_arrays.size() < max_texture_arrays);
+}
+
+// A texture's first image, or a reloaded one's new image: a layer if it's small enough, and its
+// mip tail otherwise
+bool
+texture_streamer::upload(upload_batch& uploads, entry& e, uint64_t frame)
+{
+    return packable(e.data) ? pack(uploads, e, frame) : rebuild(uploads, e, e.tail, frame);
+}
+
+/*
+Copies every level of the texture into a free layer of an array, creating the array if there is
+none with a layer to spare, and retires whatever image the texture had before. The array's other
+layers can be in use meanwhile, and the free one was last used by frames that have finished.
+*/
+bool
+texture_streamer::pack(upload_batch& uploads, entry& e, uint64_t frame)
+{
+    staging_region staging = m_staging->allocate(stagingSize(e, 0), level_alignment);
+    if (!staging) {
+        return false;
+    }
+
+    const uint32_t miplevels = (uint32_t)e.data.levels.size();
+
+    uint32_t array = arrayFor(e.data);
+    if (array == no_array) {
+        texture_array created;
+        created.image =
+          m_loader->create(e.data.format, e.data.width, e.data.height, miplevels,
+                           vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+                           array_texture_layers);
+
+        const vk::ImageSubresourceRange layers(vk::ImageAspectFlagBits::eColor, 0, miplevels, 0,
+                                               array_texture_layers);
+
+        auto arrayinfo = vk::ImageViewCreateInfo()
+                           .setImage(created.image.image)
+                           .setViewType(vk::ImageViewType::e2DArray)
+                           .setFormat(e.data.format)
+                           .setSubresourceRange(layers);
+
+        created.view    = m_views->imageView(arrayinfo);
+        created.version = ++m_version;
+
+        // Backwards, so that the first layers are taken first
+        for (uint32_t layer = array_texture_layers; layer-- > 0;) {
+            created.free.push_back(layer);
+        }
+
+        m_resident += created.image.memory.size;
+        array = (uint32_t)m_arrays.size();
+        m_arrays.push_back(std::move(created));
+    }
+
+    texture_array& a     = m_arrays[array];
+    const uint32_t layer = a.free.back();
+    a.free.pop_back();
+
+    // Whatever the layer held before is of no use anymore
+    uploads.transitionImageLayout(a.image.image, vk::ImageAspectFlagBits::eColor,
+                                  vk::ImageLayout::eUndefined,
+                                  vk::ImageLayout::eTransferDstOptimal, miplevels, layer);
+    copyLevels(uploads, e, 0, staging, a.image.image, layer);
+    uploads.transitionImageLayout(a.image.image, vk::ImageAspectFlagBits::eColor,
+                                  vk::ImageLayout::eTransferDstOptimal,
+                                  vk::ImageLayout::eShaderReadOnlyOptimal, miplevels, layer);
+
+    // The view cache hands out the same view again whenever the layer is reused
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(a.image.image)
+                      .setViewType(vk::ImageViewType::e2D)
+                      .setFormat(e.data.format)
+                      .setSubresourceRange(vk::ImageSubresourceRange(
+                        vk::ImageAspectFlagBits::eColor, 0, miplevels, layer, 1));
+
+    vk::ImageView view = m_views->imageView(viewinfo);
+
+    retire(e, frame);
+
+    e.array   = array;
+    e.layer   = layer;
+    e.view    = view;
+    e.base    = 0;
+    e.version = ++m_version;
+
+    return true;
+}
+
+/*
+Gives the texture a new image with levels `base` onwards, copied from the CPU side, and retires the
+old one.
+*/
+bool
+texture_streamer::rebuild(upload_batch& uploads, entry& e, uint32_t base, uint64_t frame)
+{
+    staging_region staging = m_staging->allocate(stagingSize(e, base), level_alignment);
+    if (!staging) {
+        return false;
+    }
+
+    const uint32_t miplevels = (uint32_t)e.data.levels.size() - base;
+
+    texture image = m_loader->create(e.data.format, e.data.levels[base].width,
+                                     e.data.levels[base].height, miplevels);
+
+    uploads.transitionImageLayout(image.image, vk::ImageAspectFlagBits::eColor,
+                                  vk::ImageLayout::eUndefined,
+                                  vk::ImageLayout::eTransferDstOptimal, miplevels);
+    copyLevels(uploads, e, base, staging, image.image, 0);
+    uploads.transitionImageLayout(image.image, vk::ImageAspectFlagBits::eColor,
+                                  vk::ImageLayout::eTransferDstOptimal,
+                                  vk::ImageLayout::eShaderReadOnlyOptimal, miplevels);
+
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(image.image)
+                      .setViewType(vk::ImageViewType::e2D)
+                      .setFormat(e.data.format)
+                      .setSubresourceRange(vk::ImageSubresourceRange(
+                        vk::ImageAspectFlagBits::eColor, 0, miplevels, 0, 1));
+
+    vk::ImageView view = m_views->imageView(viewinfo);
+
+    retire(e, frame);
+    m_resident += image.memory.size;
+
+    e.image   = image;
+    e.view    = view;
+    e.base    = base;
+    e.version = ++m_version;
+
+    return true;
+}
+
+// Copies the levels from `base` on into `image`'s levels from 0 on, out of `staging`
+void
+texture_streamer::copyLevels(upload_batch&         uploads,
+                             const entry&          e,
+                             uint32_t              base,
+                             const staging_region& staging,
+                             vk::Image             image,
+                             uint32_t              layer)
+{
+    vk::DeviceSize offset = 0;
+    for (uint32_t i = 0; i < (uint32_t)e.data.levels.size() - base; ++i) {
+        const ktx2_level& level = e.data.levels[base + i];
+        offset                  = alignUp(offset, level_alignment);
+
+        staging_region region = staging;
+        region.offset         = staging.offset + offset;
+        region.size           = level.size;
+        region.data           = static_cast<char*>(staging.data) + offset;
+
+        std::memcpy(region.data, e.data.levelData(base + i), level.size);
+        uploads.copyBufferToImage(region, image, level.width, level.height, i, 0, false, layer);
+
+        offset += level.size;
+    }
+}
+
+// The image is still bound in the descriptor sets of the frames in flight, so it is only queued up.
+// So is a packed texture's layer, whose view stays in the view cache for the next one in it.
+void
+texture_streamer::retire(entry& e, uint64_t frame)
+{
+    if (e.array != no_array) {
+        const uint32_t array = e.array;
+        const uint32_t layer = e.layer;
+        m_deletions->pushAction(frame,
+                                [this, array, layer]() { m_arrays[array].free.push_back(layer); });
+
+        e.array = no_array;
+        e.view  = nullptr;
+        return;
+    }
+
+    if (!e.image) {
+        return;
+    }
+
+    texture              old  = e.image;
+    const vk::DeviceSize size = old.memory.size;
+
+    m_resident -= size;
+    m_retiring += size;
+
+    m_views->retireViews(old.image, *m_deletions, frame);
+    m_deletions->pushAction(frame, [this, old, size]() mutable {
+        m_loader->destroy(old);
+        m_retiring -= size;
+    });
+
+    e.image = texture();
+    e.view  = nullptr;
+}
+
+}  // namespace shiny::graphics
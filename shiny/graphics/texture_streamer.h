@@ -0,0 +1,232 @@
+#pragma once
+
+#include "graphics/deletion_queue.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/stream_scheduler.h"
+#include "graphics/texture_loader.h"
+#include "graphics/upload_service.h"
+#include "graphics/view_cache.h"
+
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Keeps textures in VRAM at the resolution they are actually seen at, instead of all of them at full
+resolution all the time.
+
+A texture's texels stay on the CPU, and its image only holds the levels from `base` down to the
+last one. Level 0 of the image is then level `base` of the texture, which samples exactly like the
+full texture with its finer levels clamped away, so nothing about the UVs or the sampler changes.
+The mip tail (every level no larger than `tail_size`) is uploaded when the texture is added and
+stays resident for good, so there is always something to sample.
+
+Every frame the renderer asks for the level each texture needs from how large it is on screen, and
+`update()` moves textures towards that: finer levels are streamed in one level at a time and within
+the stream scheduler's upload budget, and while VRAM use is over the budget the textures asked for
+least recently give up their finest level first. Either way the texture gets a new image, copied
+from the CPU side, and the old one goes to the deletion queue for the frames still using it.
+
+None of this waits for the GPU: the uploads are submitted before the frame that first uses the new
+image, and whenever the staging arena is full the remaining work is simply left for a later frame.
+Descriptors that refer to `view()` have to be rewritten whenever `version()` changes.
+
+Textures added with addAsync() never wait for the disk either: they are read on the I/O queue and
+decoded in a job, both queued on the stream scheduler by how large they are asked to be on screen,
+and picked up by the first update() after that, until which their view is null. A read that
+nobody asks for anymore before it starts is cancelled, and started again once someone does.
+
+Small textures, no larger than `array_texture_size` along either side, aren't worth an image, an
+allocation and a descriptor of their own, and most of their texels are in the mip tail anyway. They
+are packed into the layers of shared 2D array images instead, one for every format, size and
+number of levels, `array_texture_layers` layers each, and are always resident at full resolution.
+A layer is taken when the texture is (re)read and handed back once the frames using it are done.
+view() is a 2D view of the layer, so they can be sampled like any other texture, and
+shaderIndex() names the array and the layer for a bindless array of the arrayView()s, whose one
+descriptor then serves every texture in the array.
+*/
+class texture_streamer
+{
+public:
+    using handle = uint32_t;
+
+    static const handle invalid_handle = std::numeric_limits<handle>::max();
+
+    // See shaderIndex(), which sets this on the indices of packed textures. Must match
+    // bindless.frag, as must the two limits.
+    static const uint32_t packed_texture_bit   = 0x40000000;
+    static const uint32_t array_texture_size   = 256;
+    static const uint32_t array_texture_layers = 64;
+    static const uint32_t max_texture_arrays   = 64;  // past which textures get their own images
+
+    void init(vk::Device        device,
+              memory_allocator& allocator,
+              staging_arena&    staging,
+              upload_service&   uploads,
+              texture_loader&   loader,
+              view_cache&       views,
+              stream_scheduler& streams,
+              deletion_queue&   deletions,
+              vk::DeviceSize    budget);
+    // Only safe once the device is idle and the loader's asynchronous reads are done
+    void destroy();
+
+    // Reads the texture and records the upload of its mip tail. Returns invalid_handle if the
+    // texture can't be read.
+    handle add(upload_batch& uploads, const std::string& path);
+
+    // The same for a texture that texture_loader::read() has already read, e.g. on another thread
+    handle add(upload_batch& uploads, texture_data data);
+
+    // Without reading anything on the calling thread. The handle is valid right away, and the
+    // texture becomes resident in an update() once it has been read; one that can't be read never
+    // does, but has to be removed all the same. `importance` is the pixels it is expected to
+    // cover, until request() says otherwise.
+    handle addAsync(const std::string& path, float importance = 0.f);
+
+    // Reads the texture again, e.g. because its file changed, and replaces it once it has been
+    // read, without the old one going away before then
+    void reload(handle texture, const std::string& path);
+
+    // The texture's image is freed once `frame` has finished, and its handle may be reused by `add`
+    void remove(handle texture, uint64_t frame);
+
+    // Asks for the texture to be sharp enough to cover `pixels` pixels across on screen. Requests
+    // from the same frame keep the largest.
+    void request(handle texture, float pixels);
+
+    // Streams and evicts, then submits the uploads. `frame` is the number of the frame about to be
+    // recorded; images replaced here are freed once it has finished.
+    void update(uint64_t frame);
+
+    // Gives the textures whose images are in blocks that the allocator is evacuating, see
+    // memory_allocator::beginDefragmentation, new images in other blocks, copied from the CPU side
+    // like streamed levels, until `budget` bytes have been staged. Returns how many were, which is
+    // 0 once there is nothing left to move or no staging memory for it.
+    vk::DeviceSize relocate(upload_batch& uploads, uint64_t frame, vk::DeviceSize budget);
+
+    // Null while an asynchronously added texture hasn't been read yet
+    vk::ImageView view(handle texture) const { return m_entries[texture].view; }
+    uint64_t      version() const { return m_version; }
+
+    // The version() at which the texture last got a new view, so descriptors that were written
+    // at a later version don't need rewriting for it
+    uint64_t viewVersion(handle texture) const { return m_entries[texture].version; }
+
+    // Every handle is below this, removed ones (whose view is null) included
+    uint32_t size() const { return (uint32_t)m_entries.size(); }
+
+    // The texture's own index for a bindless array of views, or packed_texture_bit set on its
+    // array times array_texture_layers plus its layer, if it has been packed. Only valid until
+    // viewVersion() changes, unlike the handle.
+    uint32_t shaderIndex(handle texture) const;
+
+    // Arrays are never freed, only their layers, so every index below arrayCount() stays valid
+    uint32_t      arrayCount() const { return (uint32_t)m_arrays.size(); }
+    vk::ImageView arrayView(uint32_t array) const { return m_arrays[array].view; }
+
+    // The version() at which the array was created
+    uint64_t arrayVersion(uint32_t array) const { return m_arrays[array].version; }
+
+    // The most VRAM the textures may take up, on top of which the device's own budget is respected
+    void           setBudget(vk::DeviceSize budget) { m_budget = budget; }
+    vk::DeviceSize residentBytes() const { return m_resident; }
+
+    // Whether any texture is still being read by addAsync or reload, or waiting for staging memory.
+    // Reads that were cancelled don't count.
+    bool reading() const;
+
+private:
+    static const uint32_t no_array = std::numeric_limits<uint32_t>::max();
+
+    struct entry
+    {
+        texture_data  data;
+        texture       image;
+        vk::ImageView view;
+        uint32_t      base           = 0;         // the finest resident level
+        uint32_t      tail           = 0;         // the finest level that is always resident
+        uint32_t      wanted         = 0;         // the finest level asked for since last update
+        uint64_t      last_requested = 0;         // the frame of the last request
+        uint64_t      version        = 0;         // m_version when `view` was set
+        uint32_t      array          = no_array;  // that `view` is a layer of, if packed
+        uint32_t      layer          = 0;
+
+        // Of addAsync and reload, while the texture is still being read
+        bool                     pending    = false;
+        bool                     reloading  = false;  // has its old image meanwhile
+        uint64_t                 read       = 0;      // which of m_reads it is waiting for
+        stream_scheduler::ticket ticket     = stream_scheduler::invalid_ticket;
+        float                    importance = 0.f;    // of the read
+        bool                     cancelled  = false;  // before the read started, see update
+        std::string              path;                // to start it again
+    };
+
+    // A texture that has been read by addAsync or reload, handed over from the worker that decoded
+    // it
+    struct arrival
+    {
+        handle       texture = invalid_handle;
+        uint64_t     read    = 0;
+        bool         ok      = false;
+        texture_data data;
+    };
+
+    // A 2D array image that packed textures of the same format, size and levels share
+    struct texture_array
+    {
+        texture               image;
+        vk::ImageView         view;
+        std::vector<uint32_t> free;         // layers without a texture, taken from the back
+        uint64_t              version = 0;  // m_version when it was created
+    };
+
+    uint32_t       levelFor(const entry& e, float pixels) const;
+    vk::DeviceSize stagingSize(const entry& e, uint32_t base) const;
+    handle         place(entry e);
+    void           startRead(handle texture, const std::string& path, float importance);
+    void           cancelUnwanted(uint64_t frame);
+    void           prepare(entry& e, texture_data data) const;
+    void           adopt(upload_batch& uploads, uint64_t frame);
+    uint32_t       arrayFor(const texture_data& data) const;
+    bool           packable(const texture_data& data) const;
+    bool           pack(upload_batch& uploads, entry& e, uint64_t frame);
+    bool           upload(upload_batch& uploads, entry& e, uint64_t frame);
+    bool           rebuild(upload_batch& uploads, entry& e, uint32_t base, uint64_t frame);
+    void           copyLevels(upload_batch&         uploads,
+                              const entry&          e,
+                              uint32_t              base,
+                              const staging_region& staging,
+                              vk::Image             image,
+                              uint32_t              layer);
+    void           retire(entry& e, uint64_t frame);
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+    staging_arena*    m_staging   = nullptr;
+    upload_service*   m_uploads   = nullptr;
+    texture_loader*   m_loader    = nullptr;
+    view_cache*       m_views     = nullptr;
+    stream_scheduler* m_streams   = nullptr;
+    deletion_queue*   m_deletions = nullptr;
+
+    std::vector<entry>         m_entries;
+    std::vector<handle>        m_free;  // removed entries, which have no image
+    std::vector<texture_array> m_arrays;
+
+    std::mutex           m_arrivals_mutex;
+    std::vector<arrival> m_arrivals;  // decoded since the last update
+    std::vector<arrival> m_deferred;  // didn't fit into the staging arena the last time
+    uint64_t             m_reads = 0;
+
+    vk::DeviceSize m_budget   = 0;
+    vk::DeviceSize m_resident = 0;  // of the current images
+    vk::DeviceSize m_retiring = 0;  // of replaced images that are still in the deletion queue
+    uint64_t       m_version  = 0;
+    uint64_t       m_frame    = 0;  // of the last update, stamped on the requests since
+};
+
+}  // namespace shiny::graphics
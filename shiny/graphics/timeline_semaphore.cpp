@@ -0,0 +1,66 @@
+#include "graphics/timeline_semaphore.h"
+
+#include "graphics/host_allocator.h"
+
+#include <stdexcept>
+
+namespace shiny::graphics {
+
+void
+timeline_semaphore::init(vk::Device device)
+{
+    m_device = device;
+
+#if defined(VK_KHR_timeline_semaphore)
+    // Extension commands aren't exported by the loader
+    m_wait_semaphores = (PFN_vkWaitSemaphoresKHR)m_device.getProcAddr("vkWaitSemaphoresKHR");
+    m_get_counter_value =
+      (PFN_vkGetSemaphoreCounterValueKHR)m_device.getProcAddr("vkGetSemaphoreCounterValueKHR");
+
+    auto typeinfo =
+      vk::SemaphoreTypeCreateInfoKHR().setSemaphoreType(vk::SemaphoreTypeKHR::eTimeline);
+    m_semaphore =
+      m_device.createSemaphore(vk::SemaphoreCreateInfo().setPNext(&typeinfo), hostAllocator());
+#else
+    throw std::runtime_error("Timeline semaphores aren't supported by these Vulkan headers!");
+#endif
+}
+
+void
+timeline_semaphore::destroy()
+{
+    if (m_semaphore) {
+        m_device.destroySemaphore(m_semaphore, hostAllocator());
+        m_semaphore = nullptr;
+    }
+}
+
+uint64_t
+timeline_semaphore::value() const
+{
+    uint64_t value = 0;
+#if defined(VK_KHR_timeline_semaphore)
+    m_get_counter_value(static_cast<VkDevice>(m_device), static_cast<VkSemaphore>(m_semaphore),
+                        &value);
+#endif
+    return value;
+}
+
+bool
+timeline_semaphore::wait(uint64_t value, uint64_t timeout) const
+{
+#if defined(VK_KHR_timeline_semaphore)
+    auto waitinfo = vk::SemaphoreWaitInfoKHR()
+                      .setSemaphoreCount(1)
+                      .setPSemaphores(&m_semaphore)
+                      .setPValues(&value);
+
+    return m_wait_semaphores(static_cast<VkDevice>(m_device),
+                             reinterpret_cast<const VkSemaphoreWaitInfoKHR*>(&waitinfo), timeout)
+           == VK_SUCCESS;
+#else
+    return false;
+#endif
+}
+
+}  // namespace shiny::graphics
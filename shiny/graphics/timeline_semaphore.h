@@ -0,0 +1,45 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+
+namespace shiny::graphics {
+
+/*
+A VK_KHR_timeline_semaphore: a counter on the device that submissions signal to ever increasing
+values, and that other submissions and the host can wait on reaching a value. One of them stands in
+for a fence and a binary semaphore per submission, since waiting for value N also waits for
+everything signalled before it, and nothing ever has to be reset or recycled.
+
+The extension's feature has to be enabled on the device, and its commands are looked up through the
+device in `init()`.
+*/
+class timeline_semaphore
+{
+public:
+    void init(vk::Device device);
+    void destroy();
+
+    vk::Semaphore semaphore() const { return m_semaphore; }
+
+    // The latest value signalled on the device
+    uint64_t value() const;
+
+    // False if the value wasn't reached within `timeout` nanoseconds
+    bool wait(uint64_t value, uint64_t timeout = UINT64_MAX) const;
+
+private:
+    vk::Device    m_device;
+    vk::Semaphore m_semaphore;
+
+#if defined(VK_KHR_timeline_semaphore)
+    PFN_vkWaitSemaphoresKHR           m_wait_semaphores   = nullptr;
+    PFN_vkGetSemaphoreCounterValueKHR m_get_counter_value = nullptr;
+#endif
+};
+
+}  // namespace shiny::graphics
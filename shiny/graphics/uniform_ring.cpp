@@ -0,0 +1,80 @@
+#include "graphics/uniform_ring.h"
+
+#include "graphics/host_allocator.h"
+
+#include <stdexcept>
+
+namespace {
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+uniform_ring::init(vk::PhysicalDevice physical_device,
+                   vk::Device         device,
+                   memory_allocator&  allocator,
+                   vk::DeviceSize     bytes_per_frame,
+                   uint32_t           frames)
+{
+    m_device     = device;
+    m_allocator  = &allocator;
+    m_alignment  = physical_device.getProperties().limits.minUniformBufferOffsetAlignment;
+    m_frame_size = alignUp(bytes_per_frame, m_alignment);
+    m_frames     = frames;
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(m_frame_size * frames)
+                        .setUsage(vk::BufferUsageFlagBits::eUniformBuffer
+                                  | allocator.addressUsage())
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    // Rewritten every frame, so straight into VRAM where the host can map all of it
+    m_buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+    m_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_buffer),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::uniform,
+      m_allocator->dynamicPreference());
+    m_device.bindBufferMemory(m_buffer, m_memory.memory, m_memory.offset);
+}
+
+void
+uniform_ring::destroy()
+{
+    m_device.destroyBuffer(m_buffer, hostAllocator());
+    m_allocator->free(m_memory);
+    m_buffer = nullptr;
+}
+
+void
+uniform_ring::beginFrame(uint32_t frame)
+{
+    m_frame = frame % m_frames;
+    m_head  = 0;
+}
+
+uint32_t
+uniform_ring::push(const void* data, vk::DeviceSize size)
+{
+    vk::DeviceSize offset = alignUp(m_head, m_alignment);
+
+    if (offset + size > m_frame_size) {
+        throw std::runtime_error("Uniform ring is out of space for this frame!");
+    }
+
+    m_head = offset + size;
+
+    vk::DeviceSize absolute = m_frame * m_frame_size + offset;
+    std::memcpy(static_cast<char*>(m_memory.mapped) + absolute, data, (size_t)size);
+
+    return (uint32_t)absolute;
+}
+
+}  // namespace shiny::graphics
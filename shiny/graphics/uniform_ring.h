@@ -0,0 +1,61 @@
+#pragma once
+
+#include "graphics/memory_allocator.h"
+
+#include <cstring>
+
+namespace shiny::graphics {
+
+/*
+A persistently mapped uniform buffer split into one region per frame in flight. Every frame bump
+allocates its uniform data out of its own region and binds it with a dynamic uniform buffer offset,
+so writing uniforms is a plain memcpy and never touches memory that an earlier frame still in flight
+is reading.
+
+Offsets are aligned to minUniformBufferOffsetAlignment, as required for dynamic offsets. The region
+of a frame may only be reused once that frame's fence has been waited on, so `beginFrame()` has to
+come after the wait.
+*/
+class uniform_ring
+{
+public:
+    void init(vk::PhysicalDevice physical_device,
+              vk::Device         device,
+              memory_allocator&  allocator,
+              vk::DeviceSize     bytes_per_frame,
+              uint32_t           frames);
+    void destroy();
+
+    // Starts allocating from the beginning of `frame`'s region again
+    void beginFrame(uint32_t frame);
+
+    // Copies `size` bytes into the current frame's region and returns the dynamic offset to bind
+    uint32_t push(const void* data, vk::DeviceSize size);
+
+    template<typename T>
+    uint32_t push(const T& value)
+    {
+        return push(&value, sizeof(T));
+    }
+
+    vk::Buffer     buffer() const { return m_buffer; }
+    vk::DeviceSize alignment() const { return m_alignment; }
+
+    // Where `frame`'s region starts, which is what the first push of the frame returns
+    vk::DeviceSize frameOffset(uint32_t frame) const { return (frame % m_frames) * m_frame_size; }
+
+private:
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::Buffer     m_buffer;
+    allocation     m_memory;
+    vk::DeviceSize m_alignment  = 0;
+    vk::DeviceSize m_frame_size = 0;
+    uint32_t       m_frames     = 0;
+
+    uint32_t       m_frame = 0;
+    vk::DeviceSize m_head  = 0;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,959 @@
+#include "graphics/upload_service.h"
+
+#include "core/profiler.h"
+#include "graphics/barrier_batch.h"
+#include "graphics/host_allocator.h"
+#include "graphics/mip_downsampler.h"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+using shiny::graphics::access_scope;
+using shiny::graphics::barrier_batch;
+using shiny::graphics::layoutScope;
+using shiny::graphics::upload_command;
+
+vk::ImageSubresourceRange
+subresourceRange(vk::ImageAspectFlags aspect,
+                 uint32_t             baselevel,
+                 uint32_t             levels,
+                 uint32_t             layer = 0)
+{
+    return vk::ImageSubresourceRange()
+      .setAspectMask(aspect)
+      .setBaseMipLevel(baselevel)
+      .setLevelCount(levels)
+      .setBaseArrayLayer(layer)
+      .setLayerCount(1);
+}
+
+/*
+Generates the mip chain of an image whose levels are all in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL and
+whose level 0 holds the image. Every level is blitted from the previous one, which first becomes a
+transfer source. Once a level has been read it is done and moves on to
+VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, and the last level does so after it has been written.
+That takes one barrier per level.
+
+A blit can scale, and VK_FILTER_LINEAR averages the 2x2 source texels of every destination texel.
+Levels whose size is odd simply round down, with a floor of 1.
+
+https://www.khronos.org/registry/vulkan/specs/1.1-extensions/man/html/vkCmdBlitImage.html
+*/
+void
+recordMipmaps(vk::CommandBuffer commandbuffer, const upload_command& command)
+{
+    const auto         color  = vk::ImageAspectFlagBits::eColor;
+    const access_scope dst    = layoutScope(vk::ImageLayout::eTransferDstOptimal);
+    const access_scope src    = layoutScope(vk::ImageLayout::eTransferSrcOptimal);
+    const access_scope shader = layoutScope(vk::ImageLayout::eShaderReadOnlyOptimal);
+
+    int32_t width  = (int32_t)command.width;
+    int32_t height = (int32_t)command.height;
+
+    barrier_batch barriers;
+
+    for (uint32_t level = 1; level < command.miplevels; ++level) {
+        barriers.image(command.image, subresourceRange(color, level - 1, 1), dst, src);
+        barriers.record(commandbuffer);
+        barriers.clear();
+
+        const int32_t nextwidth  = std::max(width / 2, 1);
+        const int32_t nextheight = std::max(height / 2, 1);
+
+        auto blit = vk::ImageBlit()
+                      .setSrcSubresource(vk::ImageSubresourceLayers(color, level - 1, 0, 1))
+                      .setSrcOffsets({ vk::Offset3D(0, 0, 0), vk::Offset3D(width, height, 1) })
+                      .setDstSubresource(vk::ImageSubresourceLayers(color, level, 0, 1))
+                      .setDstOffsets(
+                        { vk::Offset3D(0, 0, 0), vk::Offset3D(nextwidth, nextheight, 1) });
+        commandbuffer.blitImage(command.image, vk::ImageLayout::eTransferSrcOptimal, command.image,
+                                vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eLinear);
+
+        // Waits for the same blit as the next level becoming a source, so they're one barrier
+        barriers.image(command.image, subresourceRange(color, level - 1, 1), src, shader);
+
+        width  = nextwidth;
+        height = nextheight;
+    }
+
+    barriers.image(command.image, subresourceRange(color, command.miplevels - 1, 1), dst, shader);
+    barriers.record(commandbuffer);
+}
+
+/*
+Orders the commands of one queue into phases of one vkCmdPipelineBarrier followed by a run of
+copies. A barrier only has to come after the previous barrier and the last copy of its own
+resource, and a copy only after the last barrier of its resource, so everything is placed in the
+earliest phase that satisfies that. Barriers that end up in the same phase are merged into one call.
+*/
+class barrier_schedule
+{
+public:
+    // An ownership transfer with families, a memory dependency without
+    void barrier(vk::Buffer          buffer,
+                 const access_scope& src,
+                 const access_scope& dst,
+                 uint32_t            srcfamily = VK_QUEUE_FAMILY_IGNORED,
+                 uint32_t            dstfamily = VK_QUEUE_FAMILY_IGNORED)
+    {
+        barrier_batch& barriers = placeBarrier(m_buffers[buffer]).barriers;
+        if (srcfamily == dstfamily) {
+            barriers.memory(src, dst);
+        } else {
+            barriers.buffer(buffer, src, dst, srcfamily, dstfamily);
+        }
+    }
+
+    void barrier(vk::Image                        image,
+                 const vk::ImageSubresourceRange& range,
+                 const access_scope&              src,
+                 const access_scope&              dst,
+                 uint32_t                         srcfamily = VK_QUEUE_FAMILY_IGNORED,
+                 uint32_t                         dstfamily = VK_QUEUE_FAMILY_IGNORED)
+    {
+        placeBarrier(m_images[image]).barriers.image(image, range, src, dst, srcfamily, dstfamily);
+    }
+
+    void copy(const upload_command& command)
+    {
+        const bool buffer = command.type == upload_command::kind::buffer_copy
+                            || command.type == upload_command::kind::buffer_move;
+        usage&     u      = buffer ? m_buffers[command.buffer] : m_images[command.image];
+        u.lastcopy = std::max({ u.lastbarrier, u.lastcopy, 0 });
+        at(u.lastcopy).copies.push_back(&command);
+    }
+
+    bool empty() const { return m_phases.empty(); }
+
+    void record(vk::CommandBuffer commandbuffer, mip_downsampler* downsampler) const
+    {
+        for (const auto& p : m_phases) {
+            p.barriers.record(commandbuffer);
+
+            for (const upload_command* command : p.copies) {
+                if (command->type == upload_command::kind::mip_generation && downsampler
+                    && downsampler->supports(command->format, command->miplevels)) {
+                    downsampler->recordUpload(commandbuffer, command->image, command->format,
+                                              command->width, command->height,
+                                              command->miplevels);
+                } else if (command->type == upload_command::kind::mip_generation) {
+                    recordMipmaps(commandbuffer, *command);
+                } else if (command->type == upload_command::kind::buffer_copy
+                           || command->type == upload_command::kind::buffer_move) {
+                    auto region = vk::BufferCopy()
+                                    .setSrcOffset(command->src.offset)
+                                    .setDstOffset(command->offset)
+                                    .setSize(command->src.size);
+                    commandbuffer.copyBuffer(command->src.buffer, command->buffer, region);
+                } else {
+                    // bufferRowLength and bufferImageHeight of 0 mean the pixels are tightly
+                    // packed according to imageExtent
+                    auto region = vk::BufferImageCopy()
+                                    .setBufferOffset(command->src.offset)
+                                    .setBufferRowLength(0)
+                                    .setBufferImageHeight(0)
+                                    .setImageSubresource(vk::ImageSubresourceLayers(
+                                      vk::ImageAspectFlagBits::eColor, command->miplevel,
+                                      command->layer, 1))
+                                    .setImageOffset({ 0, (int32_t)command->firstrow, 0 })
+                                    .setImageExtent({ command->width, command->height, 1 });
+                    commandbuffer.copyBufferToImage(command->src.buffer, command->image,
+                                                    vk::ImageLayout::eTransferDstOptimal, region);
+                }
+            }
+        }
+    }
+
+private:
+    struct phase
+    {
+        barrier_batch                      barriers;
+        std::vector<const upload_command*> copies;
+    };
+
+    struct usage
+    {
+        int lastbarrier = -1;
+        int lastcopy    = -1;
+    };
+
+    phase& placeBarrier(usage& u)
+    {
+        u.lastbarrier = std::max(u.lastbarrier, u.lastcopy) + 1;
+        return at(u.lastbarrier);
+    }
+
+    phase& at(int index)
+    {
+        if ((size_t)index >= m_phases.size()) {
+            m_phases.resize(index + 1);
+        }
+        return m_phases[index];
+    }
+
+    std::vector<phase>          m_phases;
+    std::map<vk::Buffer, usage> m_buffers;
+    std::map<vk::Image, usage>  m_images;
+};
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+upload_service::init(vk::PhysicalDevice physical_device,
+                     vk::Device         device,
+                     staging_arena&     staging,
+                     uint32_t           transfer_family,
+                     vk::Queue          transfer_queue,
+                     uint32_t           graphics_family,
+                     vk::Queue          graphics_queue,
+                     bool               timeline_semaphores)
+{
+    m_device          = device;
+    m_staging         = &staging;
+    m_transfer_family = transfer_family;
+    m_graphics_family = graphics_family;
+    m_transfer_queue  = transfer_queue;
+    m_graphics_queue  = graphics_queue;
+    m_timeline        = timeline_semaphores;
+
+    m_transfer_batch.setQueue(m_transfer_queue);
+    m_graphics_batch.setQueue(m_graphics_queue);
+
+    if (m_timeline) {
+        m_transfer_timeline.init(m_device);
+        if (dedicatedTransferQueue()) {
+            m_graphics_timeline.init(m_device);
+        }
+    }
+
+    // Upload command buffers are recorded once, submitted once and freed, which is exactly what
+    // VK_COMMAND_POOL_CREATE_TRANSIENT_BIT is meant for.
+    m_transfer_pool = m_device.createCommandPool(
+      vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient, m_transfer_family),
+      hostAllocator());
+
+    if (dedicatedTransferQueue()) {
+        m_graphics_pool = m_device.createCommandPool(
+          vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eTransient, m_graphics_family),
+          hostAllocator());
+    }
+
+    const uint32_t validbits =
+      physical_device.getQueueFamilyProperties()[m_graphics_family].timestampValidBits;
+    if (validbits > 0) {
+        m_timestamp_period = physical_device.getProperties().limits.timestampPeriod;
+        m_timestamp_mask   = validbits >= 64 ? ~0ull : (1ull << validbits) - 1;
+        m_timestamps       = m_device.createQueryPool(vk::QueryPoolCreateInfo()
+                                                  .setQueryType(vk::QueryType::eTimestamp)
+                                                  .setQueryCount(timestamp_slots * 2),
+                                                hostAllocator());
+    }
+}
+
+void
+upload_service::destroy()
+{
+    waitIdle();
+
+    for (auto& fence : m_free_fences) {
+        m_device.destroyFence(fence, hostAllocator());
+    }
+    for (auto& semaphore : m_free_semaphores) {
+        m_device.destroySemaphore(semaphore, hostAllocator());
+    }
+    m_free_fences.clear();
+    m_free_semaphores.clear();
+
+    m_transfer_timeline.destroy();
+    m_graphics_timeline.destroy();
+
+    m_device.destroyCommandPool(m_transfer_pool, hostAllocator());
+    if (m_graphics_pool) {
+        m_device.destroyCommandPool(m_graphics_pool, hostAllocator());
+    }
+    if (m_timestamps) {
+        m_device.destroyQueryPool(m_timestamps, hostAllocator());
+    }
+}
+
+upload_batch::upload_batch(upload_batch&& other) noexcept
+  : m_service(other.m_service)
+  , m_commands(std::move(other.m_commands))
+{
+    other.m_service = nullptr;
+    other.m_commands.clear();
+}
+
+upload_batch::~upload_batch()
+{
+    if (m_service && !m_commands.empty()) {
+        submit();
+    }
+}
+
+void
+upload_batch::copyBuffer(const staging_region&  src,
+                         vk::Buffer             dst,
+                         vk::DeviceSize         dstoffset,
+                         vk::AccessFlags        dstaccess,
+                         vk::PipelineStageFlags dststage,
+                         bool                   concurrent,
+                         bool                   more)
+{
+    upload_command command;
+    command.type       = upload_command::kind::buffer_copy;
+    command.src        = src;
+    command.buffer     = dst;
+    command.offset     = dstoffset;
+    command.dstaccess  = dstaccess;
+    command.dststage   = dststage;
+    command.concurrent = concurrent;
+    command.more       = more;
+    m_commands.push_back(command);
+}
+
+void
+upload_batch::moveBuffer(vk::Buffer             buffer,
+                         vk::DeviceSize         srcoffset,
+                         vk::DeviceSize         dstoffset,
+                         vk::DeviceSize         size,
+                         vk::AccessFlags        dstaccess,
+                         vk::PipelineStageFlags dststage,
+                         bool                   concurrent)
+{
+    upload_command command;
+    command.type       = upload_command::kind::buffer_move;
+    command.src        = { buffer, srcoffset, size, nullptr };
+    command.buffer     = buffer;
+    command.offset     = dstoffset;
+    command.dstaccess  = dstaccess;
+    command.dststage   = dststage;
+    command.concurrent = concurrent;
+    m_commands.push_back(command);
+}
+
+void
+upload_batch::copyBufferToImage(const staging_region& src,
+                                vk::Image             image,
+                                uint32_t              width,
+                                uint32_t              height,
+                                uint32_t              miplevel,
+                                uint32_t              firstrow,
+                                bool                  more,
+                                uint32_t              layer)
+{
+    upload_command command;
+    command.type     = upload_command::kind::image_copy;
+    command.src      = src;
+    command.image    = image;
+    command.width    = width;
+    command.height   = height;
+    command.miplevel = miplevel;
+    command.firstrow = firstrow;
+    command.more     = more;
+    command.layer    = layer;
+    m_commands.push_back(command);
+}
+
+void
+upload_batch::transitionImageLayout(vk::Image            image,
+                                    vk::ImageAspectFlags aspect,
+                                    vk::ImageLayout      oldlayout,
+                                    vk::ImageLayout      newlayout,
+                                    uint32_t             miplevels,
+                                    uint32_t             layer)
+{
+    upload_command command;
+    command.type      = upload_command::kind::image_transition;
+    command.image     = image;
+    command.aspect    = aspect;
+    command.oldlayout = oldlayout;
+    command.newlayout = newlayout;
+    command.miplevels = miplevels;
+    command.layer     = layer;
+    m_commands.push_back(command);
+}
+
+void
+upload_batch::generateMipmaps(vk::Image  image,
+                              uint32_t   width,
+                              uint32_t   height,
+                              uint32_t   miplevels,
+                              vk::Format format)
+{
+    if (miplevels <= 1) {
+        return;
+    }
+
+    upload_command command;
+    command.type      = upload_command::kind::mip_generation;
+    command.image     = image;
+    command.width     = width;
+    command.height    = height;
+    command.miplevels = miplevels;
+    command.format    = format;
+    m_commands.push_back(command);
+}
+
+upload_ticket
+upload_batch::submit()
+{
+    upload_ticket ticket = m_service->submit(m_commands);
+    m_commands.clear();
+    return ticket;
+}
+
+/*
+Splits a batch between the two queues. Everything up to the last copy of a resource happens on the
+transfer queue. With a dedicated transfer queue the first transition after that doubles as the
+queue family ownership transfer: it is recorded once as a release on the transfer queue and once as
+an acquire on the graphics queue, with the same layouts both times. Buffers always get a release and
+an acquire after their last copy. Any transitions left over, and transitions of images that weren't
+copied at all, are recorded for the graphics queue. So are mip generations, since blits need a
+graphics queue; their image changes owner right before. A resource whose last copy has `more` to
+come gets none of that until the batch with the copy that doesn't. Each layer of an image is a
+resource of its own here, so a layer can be uploaded while the graphics queue samples the others.
+
+Without a dedicated transfer queue both halves are the same queue, so everything simply goes into
+the one command buffer.
+
+https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#synchronization-queue-transfers
+*/
+upload_ticket
+upload_service::submit(const std::vector<upload_command>& commands)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    if (commands.empty()) {
+        return m_submitted;
+    }
+
+    const bool dedicated = dedicatedTransferQueue();
+
+    // A release only has to finish before the semaphore signal, and an acquire is already ordered
+    // after the transfer by the semaphore wait, so neither has anything to wait on within its queue
+    const vk::PipelineStageFlags releasestage = vk::PipelineStageFlagBits::eBottomOfPipe;
+    const vk::PipelineStageFlags acquirestage = vk::PipelineStageFlagBits::eTopOfPipe;
+
+    struct buffer_target
+    {
+        vk::AccessFlags        access;
+        vk::PipelineStageFlags stage;
+        bool                   concurrent = false;
+        bool                   more       = false;  // as of its last copy
+    };
+
+    using image_layer = std::pair<vk::Image, uint32_t>;
+
+    std::map<vk::Buffer, buffer_target> buffers;
+    std::map<image_layer, size_t>       lastimagecopy;
+    std::map<image_layer, uint32_t>     imagelevels;
+    std::set<image_layer>               unfinished;  // whose last copy has more to come
+
+    for (size_t i = 0; i < commands.size(); ++i) {
+        const auto& command = commands[i];
+        if (command.type != upload_command::kind::image_transition
+            && command.type != upload_command::kind::mip_generation) {
+            m_submitted_bytes += command.src.size;
+        }
+
+        if (command.type == upload_command::kind::buffer_copy
+            || command.type == upload_command::kind::buffer_move) {
+            buffers[command.buffer].access |= command.dstaccess;
+            buffers[command.buffer].stage |= command.dststage;
+            buffers[command.buffer].concurrent |= command.concurrent;
+            buffers[command.buffer].more = command.more;
+            continue;
+        }
+
+        const image_layer layer(command.image, command.layer);
+        if (command.type == upload_command::kind::image_copy) {
+            lastimagecopy[layer] = i;
+            if (command.more) {
+                unfinished.insert(layer);
+            } else {
+                unfinished.erase(layer);
+            }
+        }
+        imagelevels[layer] =
+          std::max({ imagelevels[layer], command.miplevel + 1, command.miplevels });
+    }
+
+    barrier_schedule      transfer;
+    barrier_schedule      graphics;
+    std::set<image_layer> released;
+    std::set<vk::Buffer>  moved;
+
+    const access_scope copies = { vk::PipelineStageFlagBits::eTransfer,
+                                  vk::AccessFlagBits::eTransferWrite };
+
+    // Both halves move the image between the layouts of `src` and `dst`
+    auto transferOwnership = [&](vk::Image image, const vk::ImageSubresourceRange& range,
+                                 const access_scope& src, const access_scope& dst) {
+        transfer.barrier(image, range, src, { releasestage, vk::AccessFlags(), dst.layout },
+                         m_transfer_family, m_graphics_family);
+        graphics.barrier(image, range, { acquirestage, vk::AccessFlags(), src.layout }, dst,
+                         m_transfer_family, m_graphics_family);
+
+        released.insert(image_layer(image, range.baseArrayLayer));
+    };
+
+    // Hands a copied layer over as it is, in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+    auto releaseCopied = [&](const image_layer& layer) {
+        const access_scope copied = layoutScope(vk::ImageLayout::eTransferDstOptimal);
+        transferOwnership(layer.first,
+                          subresourceRange(vk::ImageAspectFlagBits::eColor, 0, imagelevels[layer],
+                                           layer.second),
+                          copied, copied);
+    };
+
+    for (size_t i = 0; i < commands.size(); ++i) {
+        const auto&       command = commands[i];
+        const image_layer layer(command.image, command.layer);
+
+        auto copied = lastimagecopy.find(layer);
+
+        if (command.type == upload_command::kind::mip_generation) {
+            if (!dedicated) {
+                transfer.copy(command);
+                continue;
+            }
+            if (copied != lastimagecopy.end() && !released.count(layer)) {
+                releaseCopied(layer);
+            }
+            graphics.copy(command);
+            continue;
+        }
+
+        // What a move reads may have been copied in by an earlier submission on the same queue,
+        // or earlier in this one, so the first of a buffer's moves waits for those copies
+        if (command.type == upload_command::kind::buffer_move
+            && moved.insert(command.buffer).second) {
+            transfer.barrier(command.buffer, copies,
+                             { vk::PipelineStageFlagBits::eTransfer,
+                               vk::AccessFlagBits::eTransferRead });
+        }
+
+        if (command.type != upload_command::kind::image_transition) {
+            transfer.copy(command);
+            continue;
+        }
+
+        const access_scope              src   = layoutScope(command.oldlayout);
+        const access_scope              dst   = layoutScope(command.newlayout);
+        const vk::ImageSubresourceRange range =
+          subresourceRange(command.aspect, 0, command.miplevels, command.layer);
+
+        bool aftercopies = copied == lastimagecopy.end() || i > copied->second;
+
+        if (!dedicated || !aftercopies) {
+            transfer.barrier(command.image, range, src, dst);
+        } else if (copied != lastimagecopy.end() && !released.count(layer)) {
+            transferOwnership(command.image, range, src, dst);
+        } else {
+            graphics.barrier(command.image, range, src, dst);
+        }
+    }
+
+    // Copied images that were never transitioned afterwards still have to change owner, unless
+    // a later batch copies more into them. The barriers after the last copy then make the earlier
+    // submissions' copies available too, since they come after those on the same queue.
+    if (dedicated) {
+        for (const auto& [layer, index] : lastimagecopy) {
+            if (!released.count(layer) && !unfinished.count(layer)) {
+                releaseCopied(layer);
+            }
+        }
+    }
+
+    for (const auto& [buffer, target] : buffers) {
+        const access_scope reads = { target.stage, target.access };
+        if (target.more) {
+            continue;
+        }
+        if (!dedicated) {
+            transfer.barrier(buffer, copies, reads);
+            continue;
+        }
+
+        // Nothing to transfer for a concurrent buffer. The semaphore wait already makes the copies
+        // visible to the graphics queue, the barrier there only holds back the stages reading it.
+        if (target.concurrent) {
+            graphics.barrier(buffer, { acquirestage, vk::AccessFlags() }, reads);
+            continue;
+        }
+
+        transfer.barrier(buffer, copies, { releasestage, vk::AccessFlags() }, m_transfer_family,
+                         m_graphics_family);
+        graphics.barrier(buffer, { acquirestage, vk::AccessFlags() }, reads, m_transfer_family,
+                         m_graphics_family);
+    }
+
+    submission s;
+    s.ticket = ++m_submitted;
+    if (!m_timeline) {
+        s.fence = getFence();
+    }
+
+    // The tickets in flight are consecutive, so with fewer of them than slots every one's distinct
+    const bool     timed = m_timestamps && m_in_flight.size() < timestamp_slots;
+    const uint32_t query = (uint32_t)(s.ticket % timestamp_slots) * 2;
+
+    auto record = [&](vk::CommandPool pool, barrier_schedule& schedule, bool graphicsfamily) {
+        vk::CommandBuffer commands = beginCommands(pool);
+        const bool        timing   = timed && graphicsfamily;
+        if (timing) {
+            commands.resetQueryPool(m_timestamps, query, 2);
+            commands.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, m_timestamps, query);
+        }
+        schedule.record(commands, m_downsampler);
+        if (timing) {
+            commands.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_timestamps,
+                                    query + 1);
+            s.timed = true;
+        }
+        commands.end();
+        return commands;
+    };
+
+    if (!transfer.empty()) {
+        s.transfer_commands = record(m_transfer_pool, transfer, !dedicated);
+    }
+
+    if (!graphics.empty()) {
+        s.graphics_commands = record(m_graphics_pool, graphics, true);
+    }
+
+    if (m_timeline) {
+        submitTimeline(s);
+    } else if (s.transfer_commands && s.graphics_commands) {
+        s.semaphore = getSemaphore();
+
+        submit_batch& transfer = batch(m_transfer_queue);
+        transfer.begin();
+        transfer.execute(s.transfer_commands);
+        transfer.signal(s.semaphore);
+
+        submit_batch& graphics = batch(m_graphics_queue);
+        graphics.begin();
+        graphics.wait(s.semaphore, vk::PipelineStageFlagBits::eAllCommands);
+        graphics.execute(s.graphics_commands);
+        graphics.fence(s.fence);
+    } else if (s.transfer_commands) {
+        submit_batch& transfer = batch(m_transfer_queue);
+        transfer.begin();
+        transfer.execute(s.transfer_commands);
+        transfer.fence(s.fence);
+    } else {
+        submit_batch& graphics = batch(m_graphics_queue);
+        graphics.begin();
+        graphics.execute(s.graphics_commands);
+        graphics.fence(s.fence);
+    }
+
+    if (!m_frame_batch) {
+        flush();
+    }
+
+    m_staging->close(s.ticket);
+    if (m_downsampler) {
+        m_downsampler->close(s.ticket);
+    }
+    m_in_flight.push_back(s);
+
+    return s.ticket;
+}
+
+/*
+Tickets only ever increase, so they are the values too. Either half may be missing, and the acquire
+half only waits on the transfer timeline if there is a transfer half to wait for.
+*/
+void
+upload_service::submitTimeline(const submission& s)
+{
+    const vk::Semaphore transfersemaphore = m_transfer_timeline.semaphore();
+    const vk::Semaphore graphicssemaphore = m_graphics_timeline.semaphore();
+
+    if (s.transfer_commands) {
+        submit_batch& transfer = batch(m_transfer_queue);
+        transfer.begin();
+        transfer.execute(s.transfer_commands);
+        transfer.signal(transfersemaphore, s.ticket);
+    }
+
+    if (s.graphics_commands) {
+        submit_batch& graphics = batch(m_graphics_queue);
+        graphics.begin();
+        if (s.transfer_commands) {
+            graphics.wait(transfersemaphore, vk::PipelineStageFlagBits::eAllCommands, s.ticket);
+        }
+        graphics.execute(s.graphics_commands);
+        graphics.signal(graphicssemaphore, s.ticket);
+    }
+}
+
+void
+upload_service::setQueueLock(vk::Queue queue, std::mutex* mutex)
+{
+    if (m_transfer_queue == queue) {
+        m_transfer_batch.setLock(mutex);
+    }
+    if (m_graphics_queue == queue) {
+        m_graphics_batch.setLock(mutex);
+    }
+}
+
+// Without a dedicated transfer queue both halves go to the graphics queue, so into the same batch
+submit_batch&
+upload_service::batch(vk::Queue queue)
+{
+    if (queue != m_graphics_queue) {
+        return m_transfer_batch;
+    }
+    return m_frame_batch ? *m_frame_batch : m_graphics_batch;
+}
+
+// The transfer halves first, since the acquire halves wait on their semaphores
+void
+upload_service::flush()
+{
+    m_transfer_batch.flush();
+    if (m_frame_batch) {
+        m_frame_batch->flush();
+    } else {
+        m_graphics_batch.flush();
+    }
+}
+
+void
+upload_service::beginFrame(submit_batch& graphics)
+{
+    m_frame_batch = &graphics;
+}
+
+void
+upload_service::endFrame()
+{
+    m_transfer_batch.flush();
+    m_frame_batch = nullptr;
+}
+
+// An acquire half only starts once its transfer half is done, so it is the one that finishes last
+bool
+upload_service::finished(const submission& s) const
+{
+    if (!m_timeline) {
+        return m_device.getFenceStatus(s.fence) == vk::Result::eSuccess;
+    }
+    return s.graphics_commands ? m_graphics_timeline.value() >= s.ticket
+                               : m_transfer_timeline.value() >= s.ticket;
+}
+
+void
+upload_service::waitFor(const submission& s) const
+{
+    if (!m_timeline) {
+        m_device.waitForFences(s.fence, true, std::numeric_limits<uint64_t>::max());
+    } else if (s.graphics_commands) {
+        m_graphics_timeline.wait(s.ticket);
+    } else {
+        m_transfer_timeline.wait(s.ticket);
+    }
+}
+
+void
+upload_service::takeTimings(std::vector<float>& milliseconds)
+{
+    milliseconds.insert(milliseconds.end(), m_timings.begin(), m_timings.end());
+    m_timings.clear();
+}
+
+vk::DeviceSize
+upload_service::takeSubmittedBytes()
+{
+    const vk::DeviceSize bytes = m_submitted_bytes;
+    m_submitted_bytes          = 0;
+    return bytes;
+}
+
+bool
+upload_service::downsamples(vk::Format format, uint32_t miplevels) const
+{
+    return m_downsampler && m_downsampler->supports(format, miplevels);
+}
+
+bool
+upload_service::isComplete(upload_ticket ticket)
+{
+    if (ticket > m_completed) {
+        update();
+    }
+    return ticket <= m_completed;
+}
+
+void
+upload_service::wait(upload_ticket ticket)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    // What a frame has only queued so far would never finish
+    flush();
+
+    while (!m_in_flight.empty() && m_in_flight.front().ticket <= ticket) {
+        waitFor(m_in_flight.front());
+        retire(m_in_flight.front());
+        m_in_flight.pop_front();
+    }
+
+    m_staging->reclaim(m_completed);
+    if (m_downsampler) {
+        m_downsampler->reclaim(m_completed);
+    }
+}
+
+void
+upload_service::update()
+{
+    SHINY_PROFILE_FUNCTION();
+
+    while (!m_in_flight.empty() && finished(m_in_flight.front())) {
+        retire(m_in_flight.front());
+        m_in_flight.pop_front();
+    }
+
+    m_staging->reclaim(m_completed);
+    if (m_downsampler) {
+        m_downsampler->reclaim(m_completed);
+    }
+
+    resumeWaiting();
+}
+
+bool
+upload_service::idle() const
+{
+    std::lock_guard<std::mutex> lock(m_waiting_mutex);
+    return m_in_flight.empty() && m_waiting.empty();
+}
+
+void
+upload_service::update_awaiter::await_suspend(std::coroutine_handle<> coroutine)
+{
+    std::lock_guard<std::mutex> lock(m_service.m_waiting_mutex);
+    m_service.m_waiting.push_back({ m_ticket, coroutine });
+}
+
+/*
+What is resumed can wait on next() again, which is for the update() after this one, and submit,
+which can call update() in turn, so the coroutines to resume are taken out of the list first.
+*/
+void
+upload_service::resumeWaiting()
+{
+    std::vector<waiting> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_waiting_mutex);
+        if (m_waiting.empty()) {
+            return;
+        }
+
+        ready.swap(m_resuming);
+        auto complete = [this](const waiting& w) { return w.ticket <= m_completed; };
+        auto pending  = std::stable_partition(m_waiting.begin(), m_waiting.end(), complete);
+        ready.assign(m_waiting.begin(), pending);
+        m_waiting.erase(m_waiting.begin(), pending);
+    }
+
+    SHINY_PROFILE_FUNCTION();
+    for (const waiting& w : ready) {
+        w.coroutine.resume();
+    }
+
+    ready.clear();
+    std::lock_guard<std::mutex> lock(m_waiting_mutex);
+    m_resuming.swap(ready);
+}
+
+vk::CommandBuffer
+upload_service::beginCommands(vk::CommandPool pool)
+{
+    auto allocinfo = vk::CommandBufferAllocateInfo()
+                       .setLevel(vk::CommandBufferLevel::ePrimary)
+                       .setCommandPool(pool)
+                       .setCommandBufferCount(1);
+
+    vk::CommandBuffer commandbuffer = m_device.allocateCommandBuffers(allocinfo).front();
+    commandbuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    return commandbuffer;
+}
+
+vk::Fence
+upload_service::getFence()
+{
+    if (m_free_fences.empty()) {
+        return m_device.createFence(vk::FenceCreateInfo(), hostAllocator());
+    }
+
+    vk::Fence fence = m_free_fences.back();
+    m_free_fences.pop_back();
+    return fence;
+}
+
+vk::Semaphore
+upload_service::getSemaphore()
+{
+    if (m_free_semaphores.empty()) {
+        return m_device.createSemaphore(vk::SemaphoreCreateInfo(), hostAllocator());
+    }
+
+    vk::Semaphore semaphore = m_free_semaphores.back();
+    m_free_semaphores.pop_back();
+    return semaphore;
+}
+
+void
+upload_service::retire(submission& done)
+{
+    // The submission has finished, so the results are there
+    if (done.timed) {
+        uint64_t       ticks[2] = {};
+        const uint32_t query    = (uint32_t)(done.ticket % timestamp_slots) * 2;
+        if (m_device.getQueryPoolResults(m_timestamps, query, 2, sizeof(ticks), ticks,
+                                         sizeof(uint64_t), vk::QueryResultFlagBits::e64)
+            == vk::Result::eSuccess) {
+            const uint64_t elapsed = ((ticks[1] & m_timestamp_mask) - (ticks[0] & m_timestamp_mask))
+                                     & m_timestamp_mask;
+            m_timings.push_back((float)((double)elapsed * m_timestamp_period * 1e-6));
+        }
+    }
+
+    if (done.transfer_commands) {
+        m_device.freeCommandBuffers(m_transfer_pool, done.transfer_commands);
+    }
+    if (done.graphics_commands) {
+        m_device.freeCommandBuffers(m_graphics_pool, done.graphics_commands);
+    }
+
+    if (done.fence) {
+        m_device.resetFences(done.fence);
+        m_free_fences.push_back(done.fence);
+    }
+
+    // The fence is signalled by the graphics submission that waited on the semaphore, so the
+    // semaphore is unsignalled again and can be reused.
+    if (done.semaphore) {
+        m_free_semaphores.push_back(done.semaphore);
+    }
+
+    m_completed = done.ticket;
+}
+
+}  // namespace shiny::graphics
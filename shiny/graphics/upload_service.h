@@ -0,0 +1,333 @@
+#pragma once
+
+#include "graphics/staging_arena.h"
+#include "graphics/submit_batch.h"
+#include "graphics/timeline_semaphore.h"
+
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Identifies one submission of the upload service. Tickets increase monotonically, so a ticket is
+complete once every submission up to and including it has finished on the GPU. 0 is never handed
+out and is always complete.
+*/
+using upload_ticket = uint64_t;
+
+class mip_downsampler;
+class upload_service;
+
+/*
+One recorded call on an upload_batch. Which fields are meaningful depends on `type`.
+*/
+struct upload_command
+{
+    enum class kind
+    {
+        buffer_copy,
+        buffer_move,  // `src` is a range of `buffer` itself
+        image_copy,
+        image_transition,
+        mip_generation,
+    };
+
+    kind           type = kind::buffer_copy;
+    staging_region src;
+
+    vk::Buffer             buffer;
+    vk::DeviceSize         offset = 0;
+    vk::AccessFlags        dstaccess;
+    vk::PipelineStageFlags dststage;
+    bool                   concurrent = false;
+    bool                   more       = false;  // of a copy: more of the resource follow later
+
+    vk::Image            image;
+    uint32_t             width     = 0;
+    uint32_t             height    = 0;
+    uint32_t             miplevel  = 0;  // the level an image copy writes
+    uint32_t             firstrow  = 0;  // and the first of the `height` rows it writes there
+    uint32_t             miplevels = 1;  // how many levels a transition or mip generation covers
+    uint32_t             layer     = 0;  // the array layer a copy or transition is of
+    vk::ImageAspectFlags aspect;
+    vk::Format           format    = vk::Format::eUndefined;  // of a mip generation's image
+    vk::ImageLayout      oldlayout = vk::ImageLayout::eUndefined;
+    vk::ImageLayout      newlayout = vk::ImageLayout::eUndefined;
+};
+
+/*
+A recording scope for uploads. Copies and layout transitions are only collected here; `submit()`
+(or the destructor, if it wasn't called) turns all of them into a single submission with a single
+fence. Barriers are merged on the way: every barrier is hoisted to just after the last copy that
+touches the same resource, so e.g. the transitions of all textures in a batch end up in two
+vkCmdPipelineBarrier calls no matter how many textures there are.
+
+Staging memory is handed back per submission, so only keep one batch open at a time. A batch can be
+submitted and then used for more recording, which is what to do when the staging arena runs full.
+*/
+class upload_batch
+{
+public:
+    upload_batch(upload_batch&& other) noexcept;
+    upload_batch(const upload_batch&) = delete;
+    upload_batch& operator=(const upload_batch&) = delete;
+    upload_batch& operator=(upload_batch&&) = delete;
+    ~upload_batch();
+
+    // `dstaccess`/`dststage` describe how the graphics queue is going to use the buffer afterwards.
+    // Buffers created with VK_SHARING_MODE_CONCURRENT have no owner to transfer, which is what lets
+    // them be written while the graphics queue is reading other parts of them; set `concurrent`
+    // for those. `more` if this isn't the buffer's last copy, see copyBufferToImage.
+    void copyBuffer(const staging_region&  src,
+                    vk::Buffer             dst,
+                    vk::DeviceSize         dstoffset,
+                    vk::AccessFlags        dstaccess,
+                    vk::PipelineStageFlags dststage,
+                    bool                   concurrent = false,
+                    bool                   more       = false);
+
+    // Copies `size` bytes at `srcoffset` of a buffer to `dstoffset` of the same buffer, for moving
+    // what's in it. The ranges mustn't overlap, and the buffer needs VK_BUFFER_USAGE_TRANSFER_SRC
+    // on top. Copies into the source range that were submitted before are waited for.
+    void moveBuffer(vk::Buffer             buffer,
+                    vk::DeviceSize         srcoffset,
+                    vk::DeviceSize         dstoffset,
+                    vk::DeviceSize         size,
+                    vk::AccessFlags        dstaccess,
+                    vk::PipelineStageFlags dststage,
+                    bool                   concurrent = false);
+
+    // Copies into one mip level of a color image, which must be in
+    // VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL by then. `width` is the level's own, and `height` the
+    // rows from `firstrow` on that `src` holds, which for block compressed formats start and end
+    // on a block boundary, or the level's end.
+    //
+    // A large upload can be split into such bands over several batches, most usefully a frame
+    // apart, with `more` set on all but the last copy. Until then the image stays on the transfer
+    // queue, with no release or barrier for the graphics queue, so the batch with the last copy
+    // is the one to transition it for use and the only one whose ticket says it's ready. A batch
+    // must not transition or generate the mips of an image after a copy with `more`.
+    //
+    // Of an array image, the copy only writes `layer`, which is a resource of its own for all of
+    // the above, so the graphics queue can go on sampling the other layers meanwhile.
+    void copyBufferToImage(const staging_region& src,
+                           vk::Image             image,
+                           uint32_t              width,
+                           uint32_t              height,
+                           uint32_t              miplevel = 0,
+                           uint32_t              firstrow = 0,
+                           bool                  more     = false,
+                           uint32_t              layer    = 0);
+
+    // Transitions the first `miplevels` levels of the image's `layer`, from and to the usual
+    // accesses of the two layouts as `layoutScope()` has them
+    void transitionImageLayout(vk::Image            image,
+                               vk::ImageAspectFlags aspect,
+                               vk::ImageLayout      oldlayout,
+                               vk::ImageLayout      newlayout,
+                               uint32_t             miplevels = 1,
+                               uint32_t             layer     = 0);
+
+    // Fills levels 1 to `miplevels - 1` of a color image by blitting each level down from the one
+    // before it, starting from level 0 as copied in this batch. Every level has to be in
+    // VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL beforehand and is left in
+    // VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. Blits need a graphics queue, so with a dedicated
+    // transfer queue this runs in the graphics half of the submission. The image's format has to
+    // support linear filtering in blits, unless the service's downsampler takes `format` (see
+    // upload_service::downsamples), which builds all the levels in one dispatch instead.
+    void generateMipmaps(vk::Image  image,
+                         uint32_t   width,
+                         uint32_t   height,
+                         uint32_t   miplevels,
+                         vk::Format format = vk::Format::eUndefined);
+
+    // Returns the last submitted ticket if nothing was recorded
+    upload_ticket submit();
+
+    bool empty() const { return m_commands.empty(); }
+
+private:
+    friend class upload_service;
+
+    explicit upload_batch(upload_service& service)
+      : m_service(&service)
+    {}
+
+    upload_service*             m_service = nullptr;
+    std::vector<upload_command> m_commands;
+};
+
+/*
+Submits upload batches, preferably on a transfer-only queue so they run alongside rendering instead
+of in front of it. The CPU only ever waits when it calls `wait()` on a ticket, and `update()` just
+polls, recycling the staging memory of whatever has finished.
+
+Resources are normally created with VK_SHARING_MODE_EXCLUSIVE, so when the transfer queue is from a
+different family than the graphics queue every such destination is released by the transfer queue
+and acquired again by the graphics queue. The acquire half (together with any transition a transfer
+queue can't do, e.g. into a depth attachment layout) is submitted to the graphics queue by the
+service itself, waiting on a semaphore from the transfer half. Anything submitted to the graphics
+queue afterwards can therefore use the resources without further synchronization.
+
+With timeline semaphores each queue has one that its halves signal to their ticket, which the
+acquire half waits on and the CPU polls and waits on, instead of a fence and a semaphore for every
+submission.
+
+Submissions are also timed, for the profiler, but only the half on the graphics family: transfer
+queues can neither reset queries nor are they required to support timestamps at all.
+*/
+class upload_service
+{
+public:
+    void init(vk::PhysicalDevice physical_device,
+              vk::Device         device,
+              staging_arena&     staging,
+              uint32_t           transfer_family,
+              vk::Queue          transfer_queue,
+              uint32_t           graphics_family,
+              vk::Queue          graphics_queue,
+              bool               timeline_semaphores);
+    void destroy();
+
+    upload_batch begin() { return upload_batch(*this); }
+
+    bool isComplete(upload_ticket ticket);
+    void wait(upload_ticket ticket);
+    void waitIdle() { wait(m_submitted); }
+
+    // Non-blocking; retires finished submissions and hands their staging memory back
+    void update();
+
+    // Whether every submission has been retired by update(), and no coroutine waits on one
+    bool idle() const;
+
+    class update_awaiter
+    {
+    public:
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> coroutine);
+        void await_resume() const noexcept {}
+
+    private:
+        friend class upload_service;
+
+        update_awaiter(upload_service& service, upload_ticket ticket)
+          : m_service(service)
+          , m_ticket(ticket)
+        {}
+
+        upload_service& m_service;
+        upload_ticket   m_ticket;
+    };
+
+    // For coroutines on any thread, see jobs::task: co_await next() resumes them in the next
+    // update(), on the thread that calls it and is the only one to record and submit batches, and
+    // co_await complete(ticket) in the first update() after the ticket is complete. Whatever waits
+    // on them has to be done before destroy().
+    update_awaiter next() { return update_awaiter(*this, 0); }
+    update_awaiter complete(upload_ticket ticket) { return update_awaiter(*this, ticket); }
+
+    // Until endFrame(), submissions are only queued, to go with the frame's: on the graphics queue
+    // into `graphics`, the frame's batch, and on a dedicated transfer queue into the service's
+    // own, which endFrame() flushes, before the frame's batch is, since the acquire halves in it
+    // wait on the transfer halves. Waiting for a ticket flushes whatever was queued until then.
+    void beginFrame(submit_batch& graphics);
+    void endFrame();
+
+    // Held around submitting to `queue`, while another thread uses it as well
+    void setQueueLock(vk::Queue queue, std::mutex* mutex);
+
+    // Appends the GPU time, in milliseconds, of every timed submission retired since the last call
+    void takeTimings(std::vector<float>& milliseconds);
+
+    // What the buffer and image copies submitted since the last call copied, in bytes
+    vk::DeviceSize takeSubmittedBytes();
+
+    bool dedicatedTransferQueue() const { return m_transfer_family != m_graphics_family; }
+
+    // Mip generations it supports are dispatched on it instead of blitted, which needs the
+    // graphics family to do compute. Set before anything is submitted, and destroyed after.
+    void setDownsampler(mip_downsampler* downsampler) { m_downsampler = downsampler; }
+
+    // Whether generateMipmaps of an image like that is dispatched, which then needs
+    // VK_IMAGE_USAGE_STORAGE_BIT instead of VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+    bool downsamples(vk::Format format, uint32_t miplevels) const;
+
+private:
+    friend class upload_batch;
+
+    struct submission
+    {
+        upload_ticket     ticket = 0;
+        vk::CommandBuffer transfer_commands;
+        vk::CommandBuffer graphics_commands;
+        vk::Semaphore     semaphore;  // neither of these with timeline semaphores
+        vk::Fence         fence;
+        bool              timed = false;  // queries ticket % timestamp_slots, times two
+    };
+
+    // Only as many submissions in flight as there are slots are timed
+    static const uint32_t timestamp_slots = 16;
+
+    upload_ticket     submit(const std::vector<upload_command>& commands);
+    void              submitTimeline(const submission& s);
+    submit_batch&     batch(vk::Queue queue);
+    void              flush();
+    bool              finished(const submission& s) const;
+    void              waitFor(const submission& s) const;
+    vk::CommandBuffer beginCommands(vk::CommandPool pool);
+    vk::Fence         getFence();
+    vk::Semaphore     getSemaphore();
+    void              retire(submission& done);
+    void              resumeWaiting();
+
+    vk::Device       m_device;
+    staging_arena*   m_staging     = nullptr;
+    mip_downsampler* m_downsampler = nullptr;
+
+    uint32_t        m_transfer_family = 0;
+    uint32_t        m_graphics_family = 0;
+    vk::Queue       m_transfer_queue;
+    vk::Queue       m_graphics_queue;
+    vk::CommandPool m_transfer_pool;
+    vk::CommandPool m_graphics_pool;
+
+    // Outside of a frame, everything is flushed right after it is submitted
+    submit_batch  m_transfer_batch;
+    submit_batch  m_graphics_batch;
+    submit_batch* m_frame_batch = nullptr;  // see beginFrame
+
+    std::deque<submission>     m_in_flight;
+    std::vector<vk::Fence>     m_free_fences;
+    std::vector<vk::Semaphore> m_free_semaphores;
+
+    // Signalled to the ticket by every submission's half on that queue
+    bool               m_timeline = false;
+    timeline_semaphore m_transfer_timeline;
+    timeline_semaphore m_graphics_timeline;  // only with a dedicated transfer queue
+
+    upload_ticket  m_submitted       = 0;
+    upload_ticket  m_completed       = 0;
+
+    // Coroutines waiting for update() and the ticket they wait on, see next()
+    struct waiting
+    {
+        upload_ticket           ticket = 0;
+        std::coroutine_handle<> coroutine;
+    };
+
+    mutable std::mutex   m_waiting_mutex;
+    std::vector<waiting> m_waiting;
+    std::vector<waiting> m_resuming;  // reused by resumeWaiting
+    vk::DeviceSize m_submitted_bytes = 0;  // since takeSubmittedBytes
+
+    vk::QueryPool      m_timestamps;  // none without timestamps on the graphics family
+    float              m_timestamp_period = 1.f;
+    uint64_t           m_timestamp_mask   = 0;
+    std::vector<float> m_timings;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,296 @@
+#include "graphics/vegetation.h"
+
+#include "core/mapped_file.h"
+#include "graphics/barrier_batch.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+// Has to match local_size_x and patchTexels in vegetation.comp
+const uint32_t vegetation_group_size    = 64;
+const float    vegetation_patch_texels  = 16.f;
+const uint32_t max_vegetation_instances = 262144;
+
+// Candidates a patch at most, whatever the density and spacing
+const uint32_t max_vegetation_candidates = 64 * vegetation_group_size;
+
+// Texels of level 0 from the camera out to where the finest level starts blending into the next
+// one, see terrain.vert, which the range stays within
+const float max_vegetation_range_texels = 112.f;
+
+// Three blades of a tuft, each of a quad and a tip, see vegetation.vert
+const uint32_t vegetation_vertices = 27;
+
+// One tuft, laid out like the shaders' std430 Instance struct
+struct vegetation_instance
+{
+    glm::vec4 placement;  // the base, and the height
+    glm::vec4 info;       // the yaw, tint and lean
+};
+
+// vegetation.comp's push constants
+struct vegetation_constants
+{
+    glm::mat4  view_projection;
+    glm::vec4  map;  // the terrain's origin's x and y, texel spacing, height scale
+    glm::vec4  eye;  // w is the range
+    glm::ivec2 first;           // the first patch, in patches from texel 0, 0 of level 0
+    uint32_t   across     = 0;  // patches along either side of the dispatch
+    uint32_t   layer      = 0;
+    float      size       = 0.f;  // texels across the heightmap
+    uint32_t   candidates = 0;    // a patch
+    uint32_t   seed       = 0;
+    uint32_t   capacity   = 0;
+};
+
+static_assert(sizeof(vegetation_constants) <= 128, "has to fit the guaranteed push constants");
+
+// vegetation.vert's
+struct vegetation_draw_constants
+{
+    glm::mat4 view_projection;
+    glm::vec4 sun_direction;  // w is the time
+    glm::vec4 sun_color;
+};
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+void
+vegetation_scatter::init(vk::PhysicalDevice         physical_device,
+                         vk::Device                 device,
+                         memory_allocator&          allocator,
+                         layout_cache&              layouts,
+                         pipeline_cache&            pipelines,
+                         const clipmap_terrain&     terrain,
+                         const vegetation_settings& settings)
+{
+    m_device    = device;
+    m_allocator = &allocator;
+    m_terrain   = &terrain;
+    m_settings  = settings;
+
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+    m_instances_offset = alignUp(sizeof(vk::DrawIndirectCommand), alignment);
+
+    const vk::DeviceSize instancessize = max_vegetation_instances * sizeof(vegetation_instance);
+
+    auto bufferinfo = vk::BufferCreateInfo()
+                        .setSize(m_instances_offset + instancessize)
+                        .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                  | vk::BufferUsageFlagBits::eIndirectBuffer
+                                  | vk::BufferUsageFlagBits::eTransferDst)
+                        .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+    m_memory = m_allocator->allocate(m_device.getBufferMemoryRequirements(m_buffer),
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                     memory_allocator::resource_kind::linear,
+                                     memory_category::other);
+    m_device.bindBufferMemory(m_buffer, m_memory.memory, m_memory.offset);
+
+    // 0: the terrain's heights, 1: the draw, 2: the instances, which the vertex shader reads
+    const std::array<vk::DescriptorSetLayoutBinding, 3> bindings = {
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(0)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(1)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+        vk::DescriptorSetLayoutBinding()
+          .setBinding(2)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+          .setStageFlags(vk::ShaderStageFlagBits::eCompute | vk::ShaderStageFlagBits::eVertex),
+    };
+
+    vk::DescriptorSetLayout setlayout =
+      layouts.descriptorSetLayout(vk::DescriptorSetLayoutCreateInfo()
+                                    .setBindingCount((uint32_t)bindings.size())
+                                    .setPBindings(bindings.data()));
+
+    auto constants = vk::PushConstantRange()
+                       .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                       .setOffset(0)
+                       .setSize(sizeof(vegetation_constants));
+
+    auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                        .setSetLayoutCount(1)
+                        .setPSetLayouts(&setlayout)
+                        .setPushConstantRangeCount(1)
+                        .setPPushConstantRanges(&constants);
+
+    m_layout = layouts.pipelineLayout(layoutinfo);
+
+    auto drawconstants = vk::PushConstantRange()
+                           .setStageFlags(vk::ShaderStageFlagBits::eVertex)
+                           .setOffset(0)
+                           .setSize(sizeof(vegetation_draw_constants));
+
+    m_draw_layout = layouts.pipelineLayout(
+      vk::PipelineLayoutCreateInfo(layoutinfo).setPPushConstantRanges(&drawconstants));
+
+    // Neither the heights nor the regions ever move, so the set is written once here
+    m_descriptors.init(m_device,
+                       { { vk::DescriptorType::eCombinedImageSampler, 1 },
+                         { vk::DescriptorType::eStorageBuffer, 2 } },
+                       1);
+    m_set = m_descriptors.allocate(setlayout);
+
+    const vk::DescriptorImageInfo heights(terrain.heightsSampler(), terrain.heightsView(),
+                                          vk::ImageLayout::eGeneral);
+    const vk::DescriptorBufferInfo drawregion(m_buffer, 0, sizeof(vk::DrawIndirectCommand));
+    const vk::DescriptorBufferInfo instances(m_buffer, m_instances_offset, instancessize);
+
+    const std::array<vk::WriteDescriptorSet, 3> writes = {
+        vk::WriteDescriptorSet()
+          .setDstSet(m_set)
+          .setDstBinding(0)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+          .setPImageInfo(&heights),
+        vk::WriteDescriptorSet()
+          .setDstSet(m_set)
+          .setDstBinding(1)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+          .setPBufferInfo(&drawregion),
+        vk::WriteDescriptorSet()
+          .setDstSet(m_set)
+          .setDstBinding(2)
+          .setDescriptorCount(1)
+          .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+          .setPBufferInfo(&instances),
+    };
+    m_device.updateDescriptorSets(writes, nullptr);
+
+    core::mapped_file code("shaders/vegetation_comp.spv");
+
+    auto shaderinfo = vk::ShaderModuleCreateInfo()
+                        .setCodeSize(code.size())
+                        .setPCode((const uint32_t*)code.data());
+
+    m_shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+    auto pipelineinfo =
+      vk::ComputePipelineCreateInfo()
+        .setStage(vk::PipelineShaderStageCreateInfo()
+                    .setStage(vk::ShaderStageFlagBits::eCompute)
+                    .setModule(m_shader)
+                    .setPName("main"))
+        .setLayout(m_layout);
+
+    m_pipeline = m_device.createComputePipeline(pipelines.handle(), pipelineinfo, hostAllocator());
+}
+
+void
+vegetation_scatter::destroy()
+{
+    m_device.destroyPipeline(m_pipeline, hostAllocator());
+    m_device.destroyShaderModule(m_shader, hostAllocator());
+    m_descriptors.destroy();
+
+    m_device.destroyBuffer(m_buffer, hostAllocator());
+    m_allocator->free(m_memory);
+
+    m_buffer  = nullptr;
+    m_terrain = nullptr;
+}
+
+/*
+The draw is reset with no instances by an update, which the shader's appends wait for, and the
+dispatch covers the square of patches that the range reaches into. The candidates a patch are as
+many as the density gives its area in the world, so the grass looks the same whatever the
+terrain's spacing.
+*/
+void
+vegetation_scatter::record(vk::CommandBuffer command_buffer,
+                           const glm::mat4&  view_projection,
+                           const glm::vec3&  eye)
+{
+    const vk::DrawIndirectCommand empty(vegetation_vertices, 0, 0, 0);
+    command_buffer.updateBuffer(m_buffer, 0, sizeof(empty), &empty);
+
+    const uint32_t layer = m_terrain->finestLayer();
+    if (layer == max_terrain_levels) {
+        return;
+    }
+
+    barrier_batch reset;
+    reset.memory({ vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite },
+                 { vk::PipelineStageFlagBits::eComputeShader,
+                   vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite });
+    reset.record(command_buffer);
+
+    const glm::vec4 map     = m_terrain->map();
+    const float     spacing = map.z;
+    const float     range   = std::min(m_settings.range, max_vegetation_range_texels * spacing);
+
+    // The patches the range reaches into, from the camera's in texels of level 0
+    const glm::vec2  texel  = (glm::vec2(eye) - glm::vec2(map)) / spacing;
+    const float      reach  = range / spacing;
+    const glm::ivec2 low    = glm::ivec2(glm::floor((texel - reach) / vegetation_patch_texels));
+    const glm::ivec2 high   = glm::ivec2(glm::floor((texel + reach) / vegetation_patch_texels));
+    const uint32_t   across = (uint32_t)std::max(high.x - low.x, high.y - low.y) + 1;
+
+    const float patcharea = vegetation_patch_texels * spacing * vegetation_patch_texels * spacing;
+
+    vegetation_constants constants;
+    constants.view_projection = view_projection;
+    constants.map             = map;
+    constants.eye             = glm::vec4(eye, range);
+    constants.first           = low;
+    constants.across          = across;
+    constants.layer           = layer;
+    constants.size            = m_terrain->size();
+    constants.candidates      = (uint32_t)std::min(m_settings.density * patcharea,
+                                                   (float)max_vegetation_candidates);
+    constants.seed            = m_settings.seed;
+    constants.capacity        = max_vegetation_instances;
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, 0, m_set,
+                                      nullptr);
+    command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                 sizeof(constants), &constants);
+    command_buffer.dispatch(across * across, 1, 1);
+}
+
+void
+vegetation_scatter::draw(vk::CommandBuffer command_buffer,
+                         vk::Pipeline      pipeline,
+                         const glm::mat4&  view_projection,
+                         const glm::vec3&  sun_direction,
+                         const glm::vec3&  sun_color,
+                         float             time) const
+{
+    vegetation_draw_constants constants;
+    constants.view_projection = view_projection;
+    constants.sun_direction   = glm::vec4(sun_direction, time);
+    constants.sun_color       = glm::vec4(sun_color, 0.f);
+
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, m_draw_layout, 0, m_set,
+                                      nullptr);
+    command_buffer.pushConstants(m_draw_layout, vk::ShaderStageFlagBits::eVertex, 0,
+                                 sizeof(constants), &constants);
+    command_buffer.drawIndirect(m_buffer, 0, 1, sizeof(vk::DrawIndirectCommand));
+}
+
+}  // namespace shiny::graphics
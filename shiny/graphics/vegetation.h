@@ -0,0 +1,88 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/terrain.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace shiny::graphics {
+
+// How the grass is scattered over the terrain, see renderer::setVegetation
+struct vegetation_settings
+{
+    float    density = 0.f;   // tufts a square world unit where it's the densest, none if 0
+    float    range   = 60.f;  // world units from the camera it thins out to nothing by
+    uint32_t seed    = 0;     // picks which of the terrain's texels get tufts
+};
+
+/*
+Grass scattered over the terrain by a compute shader every frame, so none of its instances are ever
+stored, read or sent by the CPU. The terrain around the camera is cut into patches of 16 by 16
+texels of level 0, and every patch within range gets a workgroup, which has it pick the same
+candidate positions every frame, from a hash of the patch and the seed. Each candidate keeps its
+tuft as likely as the terrain is to be grass there, going by the slope and height as terrain.frag
+shades it, and less likely towards the range, so the grass fades rather than ends. What's left is
+culled against the view and appended to the instances, whose count is the instance count of the
+indirect draw.
+
+The heights are fetched from the terrain's finest level that is all in around the camera. The
+range is kept within the finest level's ring, which is where those are the heights that are drawn.
+Like the particles, nothing is per frame in flight: the render graph orders every frame's scatter
+after the draw of the one before.
+*/
+class vegetation_scatter
+{
+public:
+    void init(vk::PhysicalDevice         physical_device,
+              vk::Device                 device,
+              memory_allocator&          allocator,
+              layout_cache&              layouts,
+              pipeline_cache&            pipelines,
+              const clipmap_terrain&     terrain,
+              const vegetation_settings& settings);
+    void destroy();
+
+    // Records the scatter around `eye`, culled against `view_projection`, outside of a render pass.
+    // None while none of the terrain's levels is all in. The draw's reads have to be made visible
+    // after it by the render graph.
+    void record(vk::CommandBuffer command_buffer,
+                const glm::mat4&  view_projection,
+                const glm::vec3&  eye);
+
+    // Draws the tufts with a pipeline made with drawLayout() and no vertex input, with `time` the
+    // scene time in seconds that the wind sways them by. Inside the main pass.
+    void draw(vk::CommandBuffer command_buffer,
+              vk::Pipeline      pipeline,
+              const glm::mat4&  view_projection,
+              const glm::vec3&  sun_direction,
+              const glm::vec3&  sun_color,
+              float             time) const;
+
+    vk::PipelineLayout drawLayout() const { return m_draw_layout; }
+    vk::Buffer         buffer() const { return m_buffer; }
+
+private:
+    vk::Device             m_device;
+    memory_allocator*      m_allocator = nullptr;
+    const clipmap_terrain* m_terrain   = nullptr;
+    vegetation_settings    m_settings;
+
+    // Device local: the indirect draw, then the instances at an offset of their own
+    vk::Buffer     m_buffer;
+    allocation     m_memory;
+    vk::DeviceSize m_instances_offset = 0;
+
+    descriptor_allocator m_descriptors;
+    vk::DescriptorSet    m_set;          // written once, for the compute and vertex shaders alike
+    vk::PipelineLayout   m_layout;       // owned by the layout_cache
+    vk::PipelineLayout   m_draw_layout;  // the same set, with the draw's push constants
+    vk::ShaderModule     m_shader;
+    vk::Pipeline         m_pipeline;
+};
+
+}  // namespace shiny::graphics
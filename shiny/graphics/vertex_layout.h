@@ -0,0 +1,194 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace shiny::graphics {
+
+/*
+Vertex layouts from the fields of the structs the vertices are in, declared once next to them:
+
+    template<>
+    constexpr auto vertex_fields<debug_vertex> = std::array {
+        SHINY_VERTEX_FIELD(debug_vertex, position, 0),
+        SHINY_VERTEX_FIELD_AS(debug_vertex, color, 1, vk::Format::eR8G8B8A8Unorm),
+    };
+
+vertex_streams then makes the binding and attribute descriptions of one or more such structs, a
+binding each, and vertexEqual and vertexHash compare and hash vertices field by field for finding
+duplicates. All of it is constexpr, and a declared format that doesn't take as many bytes as its
+field fails to compile, so a layout can't drift away from its struct.
+*/
+struct vertex_field
+{
+    uint32_t   location = 0;  // of the vertex shader's input
+    vk::Format format   = vk::Format::eUndefined;
+    uint32_t   offset   = 0;
+    uint32_t   size     = 0;
+};
+
+// The format a field of type T is read in unless it is declared with one, undefined for those
+// that have to be
+template<typename T>
+constexpr vk::Format vertex_format_of = vk::Format::eUndefined;
+template<>
+constexpr vk::Format vertex_format_of<float> = vk::Format::eR32Sfloat;
+template<>
+constexpr vk::Format vertex_format_of<glm::vec2> = vk::Format::eR32G32Sfloat;
+template<>
+constexpr vk::Format vertex_format_of<glm::vec3> = vk::Format::eR32G32B32Sfloat;
+template<>
+constexpr vk::Format vertex_format_of<glm::vec4> = vk::Format::eR32G32B32A32Sfloat;
+template<>
+constexpr vk::Format vertex_format_of<uint32_t> = vk::Format::eR32Uint;
+
+// Bytes of a vertex attribute in `format`, of the formats vertex structs use, 0 for the others
+constexpr uint32_t
+vertexFormatSize(vk::Format format)
+{
+    switch (format) {
+    case vk::Format::eR32Sfloat:
+    case vk::Format::eR32Uint:
+    case vk::Format::eR8G8B8A8Unorm:
+    case vk::Format::eR8G8B8A8Uint:
+    case vk::Format::eR16G16Sfloat:
+    case vk::Format::eR16G16Unorm:
+        return 4;
+    case vk::Format::eR32G32Sfloat:
+    case vk::Format::eR16G16B16A16Unorm:
+    case vk::Format::eR16G16B16A16Snorm:
+    case vk::Format::eR16G16B16A16Sfloat:
+        return 8;
+    case vk::Format::eR32G32B32Sfloat:
+        return 12;
+    case vk::Format::eR32G32B32A32Sfloat:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+// The field `member` of the vertex struct `type`, read by the shader input at `location`
+#define SHINY_VERTEX_FIELD(type, member, location)                                                \
+    shiny::graphics::vertex_field                                                                 \
+    {                                                                                             \
+        location, shiny::graphics::vertex_format_of<decltype(type::member)>,                     \
+          (uint32_t)offsetof(type, member), (uint32_t)sizeof(type::member)                        \
+    }
+
+// The same in a format of its own, e.g. a normalized one
+#define SHINY_VERTEX_FIELD_AS(type, member, location, format)                                     \
+    shiny::graphics::vertex_field                                                                 \
+    {                                                                                             \
+        location, format, (uint32_t)offsetof(type, member), (uint32_t)sizeof(type::member)       \
+    }
+
+// Specialized for every struct vertices are in, with its fields as SHINY_VERTEX_FIELDs
+template<typename T>
+constexpr auto vertex_fields = std::array<vertex_field, 0> {};
+
+template<typename T>
+constexpr bool
+validVertexFields()
+{
+    for (const vertex_field& field : vertex_fields<T>) {
+        if (vertexFormatSize(field.format) != field.size
+            || field.offset + field.size > sizeof(T)) {
+            return false;
+        }
+    }
+    return !vertex_fields<T>.empty();
+}
+
+/*
+The vertex input of vertices split into streams, one struct of them each, bound to the streams'
+positions in the list and stepping per vertex.
+*/
+template<typename... Streams>
+struct vertex_streams
+{
+    static_assert((validVertexFields<Streams>() && ...),
+                  "Vertex fields have to be declared, in formats as large as they are");
+
+    static constexpr uint32_t binding_count   = sizeof...(Streams);
+    static constexpr uint32_t attribute_count = (uint32_t)(vertex_fields<Streams>.size() + ...);
+
+    static constexpr std::array<vk::VertexInputBindingDescription, binding_count> bindings()
+    {
+        uint32_t binding = 0;
+        return { vk::VertexInputBindingDescription(binding++, (uint32_t)sizeof(Streams),
+                                                   vk::VertexInputRate::eVertex)... };
+    }
+
+    static constexpr std::array<vk::VertexInputAttributeDescription, attribute_count> attributes()
+    {
+        std::array<vk::VertexInputAttributeDescription, attribute_count> result {};
+
+        uint32_t next    = 0;
+        uint32_t binding = 0;
+        auto     add     = [&](const auto& fields) {
+            for (const vertex_field& field : fields) {
+                result[next++] = vk::VertexInputAttributeDescription(field.location, binding,
+                                                                     field.format, field.offset);
+            }
+            ++binding;
+        };
+        (add(vertex_fields<Streams>), ...);
+
+        return result;
+    }
+};
+
+// Whether the vertices' fields have the same bytes, padding aside, so -0 isn't 0 and a NaN is
+// equal to itself, which is what finding duplicates wants
+template<typename T>
+bool
+vertexEqual(const T& a, const T& b)
+{
+    const char* x = reinterpret_cast<const char*>(&a);
+    const char* y = reinterpret_cast<const char*>(&b);
+    for (const vertex_field& field : vertex_fields<T>) {
+        if (std::memcmp(x + field.offset, y + field.offset, field.size) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// FNV-1a of the same bytes vertexEqual compares
+template<typename T>
+size_t
+vertexHash(const T& vertex)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&vertex);
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const vertex_field& field : vertex_fields<T>) {
+        for (uint32_t i = 0; i < field.size; ++i) {
+            hash ^= bytes[field.offset + i];
+            hash *= 0x100000001b3ull;
+        }
+    }
+    return (size_t)hash;
+}
+
+// For unordered containers of vertices
+struct vertex_hash
+{
+    template<typename T>
+    size_t operator()(const T& vertex) const
+    {
+        return vertexHash(vertex);
+    }
+};
+
+}  // namespace shiny::graphics
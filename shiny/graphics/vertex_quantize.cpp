@@ -0,0 +1,95 @@
+#include "graphics/vertex_quantize.h"
+
+#include "core/profiler.h"
+#include "graphics/renderer.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// How far a packed position may end up from the original, in model units
+const float max_position_error = 0.0005f;
+
+const float max_packed_texcoord = 1.f;
+
+const float unorm16_max = 65535.f;
+
+}  // namespace
+
+namespace shiny::graphics {
+
+vertex_format
+chooseVertexFormat(const Mesh& mesh)
+{
+    if (mesh.vertices.empty()) {
+        return vertex_format::full;
+    }
+
+    glm::vec3 boundsmin = mesh.vertices[0].pos;
+    glm::vec3 boundsmax = boundsmin;
+
+    for (const Vertex& vertex : mesh.vertices) {
+        boundsmin = glm::min(boundsmin, vertex.pos);
+        boundsmax = glm::max(boundsmax, vertex.pos);
+
+        if (glm::any(glm::greaterThan(glm::abs(vertex.texcoord), glm::vec2(max_packed_texcoord)))
+            || glm::any(glm::lessThan(vertex.color, glm::vec3(0.f)))
+            || glm::any(glm::greaterThan(vertex.color, glm::vec3(1.f)))) {
+            return vertex_format::full;
+        }
+    }
+
+    // Rounding to the nearest step is off by half a step at most
+    const glm::vec3 extent = boundsmax - boundsmin;
+    const float     error  = std::max({ extent.x, extent.y, extent.z }) / unorm16_max * 0.5f;
+
+    return error <= max_position_error ? vertex_format::packed : vertex_format::full;
+}
+
+void
+packVertices(const Mesh&                     mesh,
+             std::vector<packed_position>&   positions,
+             std::vector<packed_attributes>& attributes)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    const glm::vec3 extent = mesh.bounds_max - mesh.bounds_min;
+
+    // A flat mesh packs its flat axis to 0, which the dequantization scales back to nothing
+    const glm::vec3 scale(extent.x > 0.f ? 1.f / extent.x : 0.f,
+                          extent.y > 0.f ? 1.f / extent.y : 0.f,
+                          extent.z > 0.f ? 1.f / extent.z : 0.f);
+
+    positions.resize(mesh.vertices.size());
+    attributes.resize(mesh.vertices.size());
+
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+        const Vertex&      vertex   = mesh.vertices[i];
+        packed_position&   position = positions[i];
+        packed_attributes& out      = attributes[i];
+
+        const glm::vec3 normalized = glm::clamp((vertex.pos - mesh.bounds_min) * scale, 0.f, 1.f);
+        for (int c = 0; c < 3; ++c) {
+            position.pos[c] = (uint16_t)std::lround(normalized[c] * unorm16_max);
+            out.color[c]    = (uint8_t)std::lround(glm::clamp(vertex.color[c], 0.f, 1.f) * 255.f);
+        }
+        position.pos[3] = 0;
+        out.color[3]    = 255;
+
+        out.texcoord[0] = glm::packHalf1x16(vertex.texcoord.x);
+        out.texcoord[1] = glm::packHalf1x16(vertex.texcoord.y);
+    }
+}
+
+glm::mat4
+dequantizeTransform(const Mesh& mesh)
+{
+    return glm::scale(glm::translate(glm::mat4(1.f), mesh.bounds_min),
+                      mesh.bounds_max - mesh.bounds_min);
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace shiny::graphics {
+
+struct Mesh;
+struct packed_position;
+struct packed_attributes;
+enum class vertex_format : uint8_t;
+
+/*
+Packed vertices whenever they are close enough to the mesh's own: positions that end up at most
+half a millimetre from where they were, with model units in metres, texcoords in [-1, 1], where
+half floats are at most 1/4096 off, and colors that fit in [0, 1].
+*/
+vertex_format chooseVertexFormat(const Mesh& mesh);
+
+// Packs the mesh's vertices into either stream, with positions relative to its bounds, which have
+// to be up to date
+void packVertices(const Mesh&                     mesh,
+                  std::vector<packed_position>&   positions,
+                  std::vector<packed_attributes>& attributes);
+
+// Takes packed positions, which come out of the vertex input in [0, 1], back to the mesh's model
+// space
+glm::mat4 dequantizeTransform(const Mesh& mesh);
+
+}  // namespace shiny::graphics
@@ -0,0 +1,519 @@
+#include "graphics/video_capture.h"
+
+#include "core/cpu_topology.h"
+#include "core/logger.h"
+#include "core/mapped_file.h"
+#include "core/profiler.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace {
+
+using shiny::graphics::video_format;
+
+// Has to match local_size_x and local_size_y in nv12.comp, where every invocation converts 4x2
+// pixels
+const uint32_t nv12_group_size = 8;
+
+// The shader's push constants
+struct nv12_constants
+{
+    int32_t  width         = 0;
+    int32_t  height        = 0;
+    uint32_t chroma_offset = 0;  // in words
+    uint32_t srgb          = 0;
+};
+
+bool
+srgbFormat(vk::Format format)
+{
+    return format == vk::Format::eR8G8B8A8Srgb || format == vk::Format::eB8G8R8A8Srgb;
+}
+
+const char*
+rawFormatName(video_format format, vk::Format source)
+{
+    if (format == video_format::nv12) {
+        return "nv12";
+    }
+    return source == vk::Format::eB8G8R8A8Unorm || source == vk::Format::eB8G8R8A8Srgb ? "bgra"
+                                                                                        : "rgba";
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+raw_video_sink::~raw_video_sink()
+{
+    end();
+}
+
+void
+raw_video_sink::begin(uint32_t, uint32_t, video_format)
+{
+    m_current = m_segments == 0 ? m_path : m_path + "." + std::to_string(m_segments);
+    m_hinted  = false;
+    ++m_segments;
+
+    m_file = std::fopen(m_current.c_str(), "wb");
+    if (!m_file) {
+        throw std::runtime_error("failed to open " + m_current + " for the recording!");
+    }
+}
+
+void
+raw_video_sink::frame(const video_frame& frame)
+{
+    // Only the first frame says what the channel order is
+    if (!m_hinted) {
+        m_hinted = true;
+        core::logInfo() << "Recording to " << m_current << ", which ffmpeg reads with -f rawvideo"
+                        << " -pix_fmt " << rawFormatName(frame.format, frame.source) << " -s "
+                        << frame.width << "x" << frame.height;
+    }
+
+    // Row by row, the planes' strides can be wider than the frame
+    const uint32_t planes = frame.format == video_format::nv12 ? 2 : 1;
+    for (uint32_t plane = 0; plane < planes; ++plane) {
+        const size_t   row  = frame.format == video_format::nv12 ? frame.width : frame.width * 4;
+        const uint32_t rows = plane == 0 ? frame.height : frame.height / 2;
+        if (frame.strides[plane] == row) {
+            std::fwrite(frame.planes[plane], 1, row * rows, m_file);
+            continue;
+        }
+        for (uint32_t y = 0; y < rows; ++y) {
+            std::fwrite(frame.planes[plane] + (size_t)y * frame.strides[plane], 1, row, m_file);
+        }
+    }
+}
+
+void
+raw_video_sink::end()
+{
+    if (m_file) {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+void
+video_capture::init(vk::Device            device,
+                    memory_allocator&     allocator,
+                    layout_cache&         layouts,
+                    view_cache&           views,
+                    pipeline_cache&       pipelines,
+                    uint32_t              frames,
+                    const video_settings& settings,
+                    bool                  convert)
+{
+    if (!settings.sink) {
+        return;
+    }
+
+    m_device    = device;
+    m_allocator = &allocator;
+    m_sink      = settings.sink;
+    m_buffers.resize(settings.buffers > 0 ? std::max(settings.buffers, frames) : frames + 2);
+    m_queue.reserve(m_buffers.size());
+    m_next     = 0;
+    m_recorded = 0;
+    m_dropped  = 0;
+    m_stopping = false;
+
+    if (convert) {
+        // 0: the frame, 1: the buffer it is converted into
+        std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+            vk::DescriptorSetLayoutBinding()
+              .setBinding(0)
+              .setDescriptorCount(1)
+              .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+              .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+            vk::DescriptorSetLayoutBinding()
+              .setBinding(1)
+              .setDescriptorCount(1)
+              .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+              .setStageFlags(vk::ShaderStageFlagBits::eCompute),
+        };
+
+        auto setlayoutinfo = vk::DescriptorSetLayoutCreateInfo()
+                               .setBindingCount((uint32_t)bindings.size())
+                               .setPBindings(bindings.data());
+
+        m_set_layout = layouts.descriptorSetLayout(setlayoutinfo);
+
+        auto constants = vk::PushConstantRange()
+                           .setStageFlags(vk::ShaderStageFlagBits::eCompute)
+                           .setOffset(0)
+                           .setSize(sizeof(nv12_constants));
+
+        auto layoutinfo = vk::PipelineLayoutCreateInfo()
+                            .setSetLayoutCount(1)
+                            .setPSetLayouts(&m_set_layout)
+                            .setPushConstantRangeCount(1)
+                            .setPPushConstantRanges(&constants);
+
+        m_layout = layouts.pipelineLayout(layoutinfo);
+
+        core::mapped_file code("shaders/nv12_comp.spv");
+
+        auto shaderinfo = vk::ShaderModuleCreateInfo()
+                            .setCodeSize(code.size())
+                            .setPCode((const uint32_t*)code.data());
+
+        m_shader = m_device.createShaderModule(shaderinfo, hostAllocator());
+
+        auto pipelineinfo =
+          vk::ComputePipelineCreateInfo()
+            .setStage(vk::PipelineShaderStageCreateInfo()
+                        .setStage(vk::ShaderStageFlagBits::eCompute)
+                        .setModule(m_shader)
+                        .setPName("main"))
+            .setLayout(m_layout);
+
+        m_pipeline = m_device.createComputePipeline(pipelines.handle(), pipelineinfo,
+                                                    hostAllocator());
+
+        // Every texel is fetched exactly
+        auto samplerinfo = vk::SamplerCreateInfo()
+                             .setMagFilter(vk::Filter::eNearest)
+                             .setMinFilter(vk::Filter::eNearest)
+                             .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                             .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                             .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                             .setAddressModeW(vk::SamplerAddressMode::eClampToEdge);
+
+        m_sampler = views.sampler(samplerinfo);
+
+        m_descriptors.init(m_device,
+                           { { vk::DescriptorType::eCombinedImageSampler, 1 },
+                             { vk::DescriptorType::eStorageBuffer, 1 } },
+                           (uint32_t)m_buffers.size());
+        for (buffer& b : m_buffers) {
+            b.set = m_descriptors.allocate(m_set_layout);
+        }
+    }
+
+    m_thread = std::thread([this]() {
+        core::nameThread("video");
+        core::applyThreadClass(core::thread_class::background);
+        sinkLoop();
+    });
+}
+
+void
+video_capture::destroy()
+{
+    if (!m_sink) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+
+    if (m_recorded > 0 || m_dropped > 0) {
+        core::logInfo() << "Recorded " << m_recorded << " frames, " << m_dropped
+                        << " dropped because the sink fell behind";
+    }
+
+    for (buffer& b : m_buffers) {
+        if (b.buffer) {
+            m_device.destroyBuffer(b.buffer, hostAllocator());
+            m_allocator->free(b.memory);
+        }
+    }
+    m_buffers.clear();
+    m_queue.clear();
+
+    if (m_pipeline) {
+        m_descriptors.destroy();
+        m_device.destroyPipeline(m_pipeline, hostAllocator());
+        m_device.destroyShaderModule(m_shader, hostAllocator());
+        m_pipeline = nullptr;
+        m_shader   = nullptr;
+    }
+    m_sink.reset();
+}
+
+/*
+A buffer is free once the sink is done with it, which is after the fence of the frame that recorded
+it, so it can be replaced if it is too small, and its descriptor set updated, right away.
+*/
+void
+video_capture::record(vk::CommandBuffer command_buffer,
+                      uint32_t          frame,
+                      vk::Image         image,
+                      vk::ImageView     view,
+                      vk::Extent2D      extent,
+                      vk::Format        format,
+                      uint64_t          number)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    if (!m_sink || extent.width < 4 || extent.height < 2) {
+        return;
+    }
+
+    buffer* b = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (uint32_t i = 0; i < m_buffers.size() && !b; ++i) {
+            const uint32_t index = (m_next + i) % (uint32_t)m_buffers.size();
+            if (m_buffers[index].state == buffer_state::free) {
+                b      = &m_buffers[index];
+                m_next = index + 1;
+            }
+        }
+        if (m_stopping) {
+            return;
+        }
+        if (!b) {
+            ++m_dropped;
+            return;
+        }
+        b->state = buffer_state::recorded;
+    }
+
+    video_frame& pixels = b->pixels;
+    pixels.source       = format;
+    pixels.number       = number;
+
+    vk::DeviceSize size = 0;
+    if (converting()) {
+        pixels.format     = video_format::nv12;
+        pixels.width      = extent.width & ~3u;
+        pixels.height     = extent.height & ~1u;
+        pixels.strides[0] = pixels.width;
+        pixels.strides[1] = pixels.width;
+        size              = (vk::DeviceSize)pixels.width * pixels.height * 3 / 2;
+    } else {
+        pixels.format     = video_format::rgba;
+        pixels.width      = extent.width;
+        pixels.height     = extent.height;
+        pixels.strides[0] = pixels.width * 4;
+        pixels.strides[1] = 0;
+        size              = (vk::DeviceSize)pixels.width * pixels.height * 4;
+    }
+
+    if (b->size < size) {
+        if (b->buffer) {
+            m_device.destroyBuffer(b->buffer, hostAllocator());
+            m_allocator->free(b->memory);
+        }
+
+        auto bufferinfo = vk::BufferCreateInfo()
+                            .setSize(size)
+                            .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                      | vk::BufferUsageFlagBits::eTransferDst)
+                            .setSharingMode(vk::SharingMode::eExclusive);
+        b->buffer = m_device.createBuffer(bufferinfo, hostAllocator());
+
+        const vk::MemoryRequirements requirements = m_device.getBufferMemoryRequirements(b->buffer);
+
+        b->memory = m_allocator->allocate(requirements,
+                                          vk::MemoryPropertyFlagBits::eHostVisible
+                                            | vk::MemoryPropertyFlagBits::eHostCoherent,
+                                          memory_allocator::resource_kind::linear,
+                                          memory_category::staging,
+                                          vk::MemoryPropertyFlagBits::eHostCached);
+        m_device.bindBufferMemory(b->buffer, b->memory.memory, b->memory.offset);
+        b->size = size;
+    }
+
+    const uint8_t* mapped = static_cast<const uint8_t*>(b->memory.mapped);
+    pixels.planes[0]      = mapped;
+    pixels.planes[1]      = converting() ? mapped + (size_t)pixels.width * pixels.height : nullptr;
+
+    vk::PipelineStageFlags written;
+    vk::AccessFlags        writes;
+    if (converting()) {
+        auto source =
+          vk::DescriptorImageInfo(m_sampler, view, vk::ImageLayout::eShaderReadOnlyOptimal);
+        auto planes = vk::DescriptorBufferInfo(b->buffer, 0, size);
+
+        std::array<vk::WriteDescriptorSet, 2> descriptorwrites = {
+            vk::WriteDescriptorSet()
+              .setDstSet(b->set)
+              .setDstBinding(0)
+              .setDescriptorCount(1)
+              .setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+              .setPImageInfo(&source),
+            vk::WriteDescriptorSet()
+              .setDstSet(b->set)
+              .setDstBinding(1)
+              .setDescriptorCount(1)
+              .setDescriptorType(vk::DescriptorType::eStorageBuffer)
+              .setPBufferInfo(&planes),
+        };
+        m_device.updateDescriptorSets(descriptorwrites, nullptr);
+
+        nv12_constants constants;
+        constants.width         = (int32_t)pixels.width;
+        constants.height        = (int32_t)pixels.height;
+        constants.chroma_offset = pixels.width * pixels.height / 4;
+        constants.srgb          = srgbFormat(format) ? 1 : 0;
+
+        command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, m_pipeline);
+        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, m_layout, 0, b->set,
+                                          nullptr);
+        command_buffer.pushConstants(m_layout, vk::ShaderStageFlagBits::eCompute, 0,
+                                     sizeof(constants), &constants);
+
+        const uint32_t blockswide = pixels.width / 4;
+        const uint32_t blockshigh = pixels.height / 2;
+        command_buffer.dispatch((blockswide + nv12_group_size - 1) / nv12_group_size,
+                                (blockshigh + nv12_group_size - 1) / nv12_group_size, 1);
+
+        written = vk::PipelineStageFlagBits::eComputeShader;
+        writes  = vk::AccessFlagBits::eShaderWrite;
+    } else {
+        auto region = vk::BufferImageCopy()
+                        .setBufferOffset(0)
+                        .setBufferRowLength(0)
+                        .setBufferImageHeight(0)
+                        .setImageSubresource(
+                          vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+                        .setImageOffset({ 0, 0, 0 })
+                        .setImageExtent({ extent.width, extent.height, 1 });
+
+        command_buffer.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, b->buffer,
+                                         region);
+
+        written = vk::PipelineStageFlagBits::eTransfer;
+        writes  = vk::AccessFlagBits::eTransferWrite;
+    }
+
+    // Visible to the sink once the fence signals
+    auto barrier = vk::BufferMemoryBarrier(writes, vk::AccessFlagBits::eHostRead,
+                                           VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
+                                           b->buffer, 0, VK_WHOLE_SIZE);
+    command_buffer.pipelineBarrier(written, vk::PipelineStageFlagBits::eHost,
+                                   vk::DependencyFlags(), nullptr, barrier, nullptr);
+
+    b->frame = frame;
+    ++m_recorded;
+}
+
+void
+video_capture::collect(uint32_t frame)
+{
+    if (!m_sink) {
+        return;
+    }
+
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (uint32_t i = 0; i < m_buffers.size(); ++i) {
+            buffer& b = m_buffers[i];
+            if (b.state == buffer_state::recorded && b.frame == frame) {
+                b.state = buffer_state::queued;
+                m_queue.push_back(i);
+                queued = true;
+            }
+        }
+    }
+    if (queued) {
+        m_wake.notify_one();
+    }
+}
+
+void
+video_capture::collectAll()
+{
+    if (!m_sink) {
+        return;
+    }
+
+    std::vector<uint32_t> recorded;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (uint32_t i = 0; i < m_buffers.size(); ++i) {
+            if (m_buffers[i].state == buffer_state::recorded) {
+                recorded.push_back(i);
+            }
+        }
+        std::sort(recorded.begin(), recorded.end(), [&](uint32_t a, uint32_t b) {
+            return m_buffers[a].pixels.number < m_buffers[b].pixels.number;
+        });
+        for (uint32_t i : recorded) {
+            m_buffers[i].state = buffer_state::queued;
+            m_queue.push_back(i);
+        }
+    }
+    m_wake.notify_one();
+}
+
+/*
+The sink's thread, which hands it the queued buffers one at a time, outside the mutex. Only the
+buffer's state and the queue are shared, its pixels aren't touched by anything else until it's free
+again. Whatever is queued when it's stopped is still handed over.
+*/
+void
+video_capture::sinkLoop()
+{
+    bool         begun  = false;
+    uint32_t     width  = 0;
+    uint32_t     height = 0;
+    video_format format = video_format::rgba;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wake.wait(lock, [&]() { return m_stopping || !m_queue.empty(); });
+        if (m_queue.empty()) {
+            break;
+        }
+
+        const uint32_t index = m_queue.front();
+        m_queue.erase(m_queue.begin());
+        buffer& b = m_buffers[index];
+        lock.unlock();
+
+        const video_frame& pixels = b.pixels;
+        try {
+            if (begun
+                && (pixels.width != width || pixels.height != height || pixels.format != format)) {
+                m_sink->end();
+                begun = false;
+            }
+            if (!begun) {
+                m_sink->begin(pixels.width, pixels.height, pixels.format);
+                begun  = true;
+                width  = pixels.width;
+                height = pixels.height;
+                format = pixels.format;
+            }
+            m_sink->frame(pixels);
+        } catch (const std::exception& e) {
+            // Nothing is recorded from here on, but the frames keep going
+            core::logError() << "The recording failed: " << e.what();
+            lock.lock();
+            b.state    = buffer_state::free;
+            m_stopping = true;
+            m_queue.clear();
+            for (buffer& other : m_buffers) {
+                if (other.state == buffer_state::queued) {
+                    other.state = buffer_state::free;
+                }
+            }
+            break;
+        }
+
+        lock.lock();
+        b.state = buffer_state::free;
+    }
+    lock.unlock();
+
+    if (begun) {
+        m_sink->end();
+    }
+}
+
+}  // namespace shiny::graphics
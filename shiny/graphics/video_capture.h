@@ -0,0 +1,178 @@
+#pragma once
+
+#include "graphics/descriptor_allocator.h"
+#include "graphics/layout_cache.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/pipeline_cache.h"
+#include "graphics/view_cache.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace shiny::graphics {
+
+enum class video_format : uint8_t
+{
+    rgba,  // 4 bytes a pixel, in the channel order of video_frame::source
+    nv12,  // a plane of luma, then one of interleaved Cb and Cr at half the resolution
+};
+
+// A frame of a recording, which is only valid for as long as video_sink::frame() runs
+struct video_frame
+{
+    video_format   format     = video_format::rgba;
+    const uint8_t* planes[2]  = {};                          // only the first for rgba
+    uint32_t       strides[2] = {};                          // bytes from one row to the next
+    uint32_t       width      = 0;
+    uint32_t       height     = 0;
+    vk::Format     source     = vk::Format::eR8G8B8A8Unorm;  // of the image it came from
+    uint64_t       number     = 0;                           // of the frame, counting from 0
+};
+
+/*
+Where a recording goes, e.g. an encoder. Everything is called on video_capture's thread, in the
+order the frames were rendered in, and may take as long as a frame does before frames are dropped.
+A recording is cut into segments of one size each: a frame of another size than the last, after
+the window was resized, ends the segment and begins another.
+*/
+class video_sink
+{
+public:
+    virtual ~video_sink() = default;
+
+    virtual void begin(uint32_t width, uint32_t height, video_format format) = 0;
+    virtual void frame(const video_frame& frame)                            = 0;
+    virtual void end()                                                       = 0;
+};
+
+// Writes the frames as they are, one after another, which ffmpeg reads as -f rawvideo. Every
+// segment after the first goes to a file of its own, with its number appended to the path.
+class raw_video_sink : public video_sink
+{
+public:
+    explicit raw_video_sink(const std::string& path)
+      : m_path(path)
+    {}
+    ~raw_video_sink() override;
+
+    // Throws if the file can't be written
+    void begin(uint32_t width, uint32_t height, video_format format) override;
+    void frame(const video_frame& frame) override;
+    void end() override;
+
+private:
+    std::string m_path;
+    std::string m_current;  // the segment's
+    std::FILE*  m_file     = nullptr;
+    uint32_t    m_segments = 0;
+    bool        m_hinted   = false;  // how to read it was logged
+};
+
+// What renderer::setVideoCapture() records and into what
+struct video_settings
+{
+    std::shared_ptr<video_sink> sink;
+    bool                        nv12    = true;  // where the frames can be sampled, see below
+    uint32_t                    buffers = 0;     // 0 for two more than there are frames in flight
+};
+
+/*
+Records every frame while running, without waiting for the GPU: the frame's command buffer copies
+or converts the image it presents into the next free one of a few host visible buffers, and once
+the frame's fence has been waited on anyway, the buffer is queued for the sink, which takes it on a
+thread of its own and makes it free again. When the sink falls so far behind that no buffer is free,
+frames are dropped rather than waited for, and counted.
+
+Converted to NV12 by a compute shader, a frame is 1.5 bytes a pixel instead of 4, which is all the
+GPU writes to host memory and the sink reads, and what most encoders take anyway. That needs the
+image to be sampled, in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, and its width and height are
+rounded down to multiples of 4 and 2, so at most 3 columns and a row are cut off. Otherwise the
+image is copied as it is, from VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL.
+*/
+class video_capture
+{
+public:
+    // `convert` if the images can be converted to NV12, otherwise they're copied
+    void init(vk::Device            device,
+              memory_allocator&     allocator,
+              layout_cache&         layouts,
+              view_cache&           views,
+              pipeline_cache&       pipelines,
+              uint32_t              frames,
+              const video_settings& settings,
+              bool                  convert);
+
+    // Hands the sink everything that was queued for it and ends the recording
+    void destroy();
+
+    bool active() const { return m_sink != nullptr; }
+    bool converting() const { return (bool)m_pipeline; }
+
+    // Records the conversion or copy of `image`, whose `view` is only sampled if converting
+    void record(vk::CommandBuffer command_buffer,
+                uint32_t          frame,
+                vk::Image         image,
+                vk::ImageView     view,
+                vk::Extent2D      extent,
+                vk::Format        format,
+                uint64_t          number);
+
+    // Queues what the frame recorded for the sink, once its fence has been waited on
+    void collect(uint32_t frame);
+
+    // The same for every frame, oldest first, once the device is idle
+    void collectAll();
+
+    uint64_t recorded() const { return m_recorded; }
+    uint64_t dropped() const { return m_dropped; }
+
+private:
+    enum class buffer_state : uint8_t
+    {
+        free,
+        recorded,  // by a frame whose fence hasn't been waited on yet
+        queued,    // for or in the sink
+    };
+
+    struct buffer
+    {
+        vk::Buffer        buffer;
+        allocation        memory;
+        vk::DeviceSize    size = 0;
+        vk::DescriptorSet set;
+        buffer_state      state = buffer_state::free;  // guarded by m_mutex
+        uint32_t          frame = 0;                   // in flight that recorded it
+        video_frame       pixels;
+    };
+
+    void sinkLoop();
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+
+    vk::DescriptorSetLayout m_set_layout;  // owned by the layout_cache
+    vk::PipelineLayout      m_layout;
+    vk::ShaderModule        m_shader;
+    vk::Pipeline            m_pipeline;
+    vk::Sampler             m_sampler;  // owned by the view_cache
+    descriptor_allocator    m_descriptors;
+
+    std::shared_ptr<video_sink> m_sink;
+    std::vector<buffer>         m_buffers;
+    uint32_t                    m_next     = 0;  // the buffer to look for a free one from
+    uint64_t                    m_recorded = 0;
+    uint64_t                    m_dropped  = 0;
+
+    std::thread             m_thread;
+    std::mutex              m_mutex;
+    std::condition_variable m_wake;
+    std::vector<uint32_t>   m_queue;  // in the order the frames were rendered in
+    bool                    m_stopping = false;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,143 @@
+#include "graphics/view_cache.h"
+
+#include "graphics/host_allocator.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace shiny::graphics {
+
+void
+view_cache::init(vk::Device device)
+{
+    m_device = device;
+}
+
+void
+view_cache::destroy()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto& [image, views] : m_views) {
+        for (const view& v : views) {
+            m_device.destroyImageView(v.handle, hostAllocator());
+        }
+    }
+    for (auto& [description, sampler] : m_samplers) {
+        m_device.destroySampler(sampler, hostAllocator());
+    }
+
+    m_views.clear();
+    m_samplers.clear();
+}
+
+/*
+Every field goes into the key, floats by their bits, so samplers that only differ in ways that
+don't matter for the rest of their state (say the border color without clamp to border) are still
+created twice. That's rare enough not to canonicalize.
+*/
+vk::Sampler
+view_cache::sampler(const vk::SamplerCreateInfo& info)
+{
+    auto bits = [](float value) {
+        uint32_t word;
+        std::memcpy(&word, &value, sizeof(word));
+        return (uint64_t)word;
+    };
+
+    key description;
+    description.words = { (uint64_t)(uint32_t)info.flags, (uint64_t)info.magFilter,
+                          (uint64_t)info.minFilter,       (uint64_t)info.mipmapMode,
+                          (uint64_t)info.addressModeU,    (uint64_t)info.addressModeV,
+                          (uint64_t)info.addressModeW,    bits(info.mipLodBias),
+                          info.anisotropyEnable,          bits(info.maxAnisotropy),
+                          info.compareEnable,             (uint64_t)info.compareOp,
+                          bits(info.minLod),              bits(info.maxLod),
+                          (uint64_t)info.borderColor,     info.unnormalizedCoordinates };
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_samplers.find(description);
+    if (found != m_samplers.end()) {
+        return found->second;
+    }
+
+    vk::Sampler sampler;
+    if (!(sampler = m_device.createSampler(info, hostAllocator()))) {
+        throw std::runtime_error("failed to create sampler!");
+    }
+
+    m_samplers.emplace(std::move(description), sampler);
+    return sampler;
+}
+
+// An image rarely has more than a handful of views, so they are searched in order
+vk::ImageView
+view_cache::imageView(const vk::ImageViewCreateInfo& info)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<view>& views = m_views[static_cast<VkImage>(info.image)];
+    for (const view& v : views) {
+        if (v.flags == info.flags && v.type == info.viewType && v.format == info.format
+            && v.components == info.components && v.range == info.subresourceRange) {
+            return v.handle;
+        }
+    }
+
+    vk::ImageView handle;
+    if (!(handle = m_device.createImageView(info, hostAllocator()))) {
+        throw std::runtime_error("failed to create image view!");
+    }
+
+    views.push_back(
+      { info.flags, info.viewType, info.format, info.components, info.subresourceRange, handle });
+    return handle;
+}
+
+void
+view_cache::releaseViews(vk::Image image)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_views.find(static_cast<VkImage>(image));
+    if (found == m_views.end()) {
+        return;
+    }
+
+    for (const view& v : found->second) {
+        m_device.destroyImageView(v.handle, hostAllocator());
+    }
+    m_views.erase(found);
+}
+
+// The views leave the cache right away, so a new image with the same handle starts out with none
+void
+view_cache::retireViews(vk::Image image, deletion_queue& deletions, uint64_t frame)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_views.find(static_cast<VkImage>(image));
+    if (found == m_views.end()) {
+        return;
+    }
+
+    for (const view& v : found->second) {
+        deletions.push(frame, v.handle);
+    }
+    m_views.erase(found);
+}
+
+// FNV-1a over the words, as in layout_cache
+size_t
+view_cache::key_hash::operator()(const key& k) const
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint64_t word : k.words) {
+        hash ^= word;
+        hash *= 0x100000001b3ull;
+    }
+    return (size_t)hash;
+}
+
+}  // namespace shiny::graphics
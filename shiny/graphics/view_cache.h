@@ -0,0 +1,78 @@
+#pragma once
+
+#include "graphics/deletion_queue.h"
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace shiny::graphics {
+
+/*
+Samplers and image views, created once per distinct description, like layout_cache does for
+layouts. Samplers are few but every texture and material asks for one, and devices only allow
+maxSamplerAllocationCount of them (as few as 4000), so two create infos with the same state get the
+same sampler back. Image views are kept by image, keyed on their type, format, swizzle, aspect,
+level range and layer range, so asking for the same view of an image twice doesn't create it twice.
+
+The cache owns everything it hands out. Samplers stay until destroy(), views until their image's
+views are released or retired, which has to happen before the image itself is destroyed, since a
+new image may get the old one's handle. Nothing in the create infos' pNext chains is compared, so
+those are created without the cache.
+
+Unlike layout_cache it is thread safe: samplers are created on the job scheduler during
+initialization.
+*/
+class view_cache
+{
+public:
+    void init(vk::Device device);
+    // Only safe once the device is idle
+    void destroy();
+
+    vk::Sampler   sampler(const vk::SamplerCreateInfo& info);
+    vk::ImageView imageView(const vk::ImageViewCreateInfo& info);
+
+    // Destroys the image's views, which nothing may be using any more
+    void releaseViews(vk::Image image);
+    // Destroys them once `frame` has finished, for images that are retired along with them
+    void retireViews(vk::Image image, deletion_queue& deletions, uint64_t frame);
+
+private:
+    // A flattened sampler description, compared word by word
+    struct key
+    {
+        std::vector<uint64_t> words;
+
+        bool operator==(const key& other) const { return words == other.words; }
+    };
+
+    struct key_hash
+    {
+        size_t operator()(const key& k) const;
+    };
+
+    struct view
+    {
+        vk::ImageViewCreateFlags  flags;
+        vk::ImageViewType         type;
+        vk::Format                format;
+        vk::ComponentMapping      components;
+        vk::ImageSubresourceRange range;
+        vk::ImageView             handle;
+    };
+
+    vk::Device m_device;
+
+    std::mutex                                     m_mutex;
+    std::unordered_map<key, vk::Sampler, key_hash> m_samplers;
+    std::unordered_map<VkImage, std::vector<view>> m_views;  // by image
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,729 @@
+#include "graphics/virtual_texture.h"
+
+#include "core/profiler.h"
+#include "graphics/barrier_batch.h"
+#include "graphics/host_allocator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+using shiny::graphics::virtual_tile_size;
+
+// Tile reads on the I/O queue at once, and tiles uploaded a frame, which together bound how far
+// the pages lag behind what is on screen
+const uint32_t max_tile_reads   = 64;
+const uint32_t max_tile_uploads = 32;
+
+// A tile read that hasn't started after this many frames without being asked for is cancelled.
+// Only some pixels ask in a frame, so a tile can go unasked for a few frames while still in view.
+const uint64_t tile_read_timeout = 30;
+
+// Tile IDs a frame's feedback has room for, past which the shader only counts them
+const uint32_t feedback_capacity = 16 * 1024;
+
+// Each entry of the indirection is an RGBA8 texel
+const vk::DeviceSize table_entry_size = 4;
+
+// Copies out of the staging buffer have to start at a multiple of the block size
+const vk::DeviceSize staging_alignment = 16;
+
+vk::DeviceSize
+alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return alignment ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+// A level's tiles along a side that's `size` texels long at level 0
+uint32_t
+tilesAlong(uint32_t size, uint32_t level)
+{
+    return std::max((size >> level) / virtual_tile_size, 1u);
+}
+
+// Every level's tiles
+uint32_t
+tileCount(uint32_t width, uint32_t height, uint32_t levels)
+{
+    uint32_t count = 0;
+    for (uint32_t level = 0; level < levels; ++level) {
+        count += tilesAlong(width, level) * tilesAlong(height, level);
+    }
+    return count;
+}
+
+bool
+isPowerOfTwo(uint32_t value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+vk::ImageSubresourceRange
+levelRange(uint32_t levels)
+{
+    return vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1);
+}
+
+}  // namespace
+
+namespace shiny::graphics {
+
+uint32_t
+virtualTextureLevels(uint32_t width, uint32_t height)
+{
+    uint32_t levels = 1;
+    while ((std::max(width, height) >> (levels - 1)) > virtual_tile_size) {
+        ++levels;
+    }
+    return levels;
+}
+
+void
+virtual_texture_cache::init(vk::PhysicalDevice physical_device,
+                            vk::Device         device,
+                            memory_allocator&  allocator,
+                            view_cache&        views,
+                            stream_scheduler&  streams,
+                            deletion_queue&    deletions,
+                            uint32_t           columns,
+                            uint32_t           first_slot,
+                            uint32_t           frames)
+{
+    m_device      = device;
+    m_allocator   = &allocator;
+    m_streams     = &streams;
+    m_deletions   = &deletions;
+    m_columns     = columns;
+    m_first_slot  = first_slot;
+    m_frames      = frames;
+    m_initialized = false;
+
+    // Handed out from page 0 on
+    const uint32_t pagecount = columns * columns;
+    m_page_table.assign(pagecount, page());
+    m_free_pages.clear();
+    for (uint32_t p = pagecount; p-- > 0;) {
+        m_free_pages.push_back(p);
+    }
+    m_resident = 0;
+
+    const uint32_t extent = columns * virtual_tile_span;
+
+    // Not in the texture category, whose blocks the defragmentation expects the streamer to move
+    auto imageinfo = vk::ImageCreateInfo()
+                       .setImageType(vk::ImageType::e2D)
+                       .setExtent(vk::Extent3D(extent, extent, 1))
+                       .setMipLevels(1)
+                       .setArrayLayers(1)
+                       .setFormat(vk::Format::eBc1RgbUnormBlock)
+                       .setTiling(vk::ImageTiling::eOptimal)
+                       .setInitialLayout(vk::ImageLayout::eUndefined)
+                       .setUsage(vk::ImageUsageFlagBits::eSampled
+                                 | vk::ImageUsageFlagBits::eTransferDst)
+                       .setSamples(vk::SampleCountFlagBits::e1)
+                       .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_pages        = m_device.createImage(imageinfo, hostAllocator());
+    m_pages_memory = m_allocator->allocate(m_device.getImageMemoryRequirements(m_pages),
+                                           vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                           memory_allocator::resource_kind::optimal,
+                                           memory_category::other);
+    m_device.bindImageMemory(m_pages, m_pages_memory.memory, m_pages_memory.offset);
+
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(m_pages)
+                      .setViewType(vk::ImageViewType::e2D)
+                      .setFormat(vk::Format::eBc1RgbUnormBlock)
+                      .setSubresourceRange(levelRange(1));
+
+    m_pages_view = m_device.createImageView(viewinfo, hostAllocator());
+
+    // Bilinear within a page, which its border keeps from bleeding into the neighbouring ones
+    auto samplerinfo = vk::SamplerCreateInfo()
+                         .setMagFilter(vk::Filter::eLinear)
+                         .setMinFilter(vk::Filter::eLinear)
+                         .setMipmapMode(vk::SamplerMipmapMode::eNearest)
+                         .setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+                         .setAddressModeW(vk::SamplerAddressMode::eClampToEdge)
+                         .setMinLod(0.f)
+                         .setMaxLod(0.f);
+
+    m_sampler = views.sampler(samplerinfo);
+
+    // Every frame's feedback is bound at its own offset, which has to be aligned. It is read back
+    // by the CPU, so cached memory is preferred.
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>(
+      physical_device.getProperties().limits.minStorageBufferOffsetAlignment, 16);
+
+    m_feedback_frame_size =
+      alignUp(sizeof(virtual_feedback_header) + feedback_capacity * sizeof(uint32_t), alignment);
+
+    auto feedbackinfo = vk::BufferCreateInfo()
+                          .setSize(m_feedback_frame_size * frames)
+                          .setUsage(vk::BufferUsageFlagBits::eStorageBuffer
+                                    | allocator.addressUsage())
+                          .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_feedback        = m_device.createBuffer(feedbackinfo, hostAllocator());
+    m_feedback_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_feedback),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::staging,
+      vk::MemoryPropertyFlagBits::eHostCached);
+    m_device.bindBufferMemory(m_feedback, m_feedback_memory.memory, m_feedback_memory.offset);
+
+    // No frame has asked for anything yet
+    std::memset(m_feedback_memory.mapped, 0, (size_t)(m_feedback_frame_size * frames));
+
+    // A frame's tiles, then the whole indirection of every virtual texture there can be, so an
+    // indirection that changed is always staged in the same frame as the pages it points at
+    const uint32_t       maxlevels = virtualTextureLevels(max_virtual_texture_size,
+                                                          max_virtual_texture_size);
+    const vk::DeviceSize maxtable  = alignUp(
+      tileCount(max_virtual_texture_size, max_virtual_texture_size, maxlevels) * table_entry_size,
+      staging_alignment);
+
+    m_staging_frame_size =
+      alignUp(max_tile_uploads * virtual_tile_bytes + max_virtual_textures * maxtable, 16);
+
+    auto staginginfo = vk::BufferCreateInfo()
+                         .setSize(m_staging_frame_size * frames)
+                         .setUsage(vk::BufferUsageFlagBits::eTransferSrc)
+                         .setSharingMode(vk::SharingMode::eExclusive);
+
+    m_staging        = m_device.createBuffer(staginginfo, hostAllocator());
+    m_staging_memory = m_allocator->allocate(
+      m_device.getBufferMemoryRequirements(m_staging),
+      vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+      memory_allocator::resource_kind::linear, memory_category::staging);
+    m_device.bindBufferMemory(m_staging, m_staging_memory.memory, m_staging_memory.offset);
+}
+
+void
+virtual_texture_cache::destroy()
+{
+    for (entry& e : m_entries) {
+        if (e.image) {
+            m_device.destroyImageView(e.view, hostAllocator());
+            m_device.destroyImage(e.image, hostAllocator());
+            m_allocator->free(e.memory);
+        }
+    }
+    m_entries.clear();
+    m_free.clear();
+    m_arrivals.clear();
+    m_deferred.clear();
+    m_tile_reads.clear();
+    m_page_copies.clear();
+    m_tables.clear();
+    m_table_copies.clear();
+    m_reading  = 0;
+    m_resident = 0;
+
+    m_device.destroyImageView(m_pages_view, hostAllocator());
+    m_device.destroyImage(m_pages, hostAllocator());
+    m_allocator->free(m_pages_memory);
+
+    m_device.destroyBuffer(m_feedback, hostAllocator());
+    m_allocator->free(m_feedback_memory);
+    m_device.destroyBuffer(m_staging, hostAllocator());
+    m_allocator->free(m_staging_memory);
+
+    m_pages    = nullptr;
+    m_feedback = nullptr;
+    m_staging  = nullptr;
+}
+
+// Only the header is read on the calling thread, a few bytes, every tile is read on the I/O queue
+virtual_texture_cache::handle
+virtual_texture_cache::add(const std::string& path)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    core::mapped_file file;
+    if (!file.read(path, 0, sizeof(virtual_texture_header))) {
+        return invalid_handle;
+    }
+
+    virtual_texture_header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    const bool valid = std::memcmp(header.magic, virtual_texture_header().magic, 4) == 0
+                       && isPowerOfTwo(header.width) && isPowerOfTwo(header.height)
+                       && std::min(header.width, header.height) >= virtual_tile_size
+                       && std::max(header.width, header.height) <= max_virtual_texture_size
+                       && header.levels == virtualTextureLevels(header.width, header.height)
+                       && header.tile_bytes == virtual_tile_bytes;
+    if (!valid || (m_free.empty() && m_entries.size() >= max_virtual_textures)) {
+        return invalid_handle;
+    }
+
+    handle texture = (handle)m_entries.size();
+    if (!m_free.empty()) {
+        texture = m_free.back();
+        m_free.pop_back();
+    } else {
+        m_entries.emplace_back();
+    }
+
+    entry& e = m_entries[texture];
+    e.path   = path;
+    e.header = header;
+
+    uint32_t tiles = 0;
+    for (uint32_t level = 0; level < header.levels; ++level) {
+        e.first_tile.push_back(tiles);
+        tiles += tilesAlong(header.width, level) * tilesAlong(header.height, level);
+    }
+    e.states.assign(tiles, tile_state::missing);
+    e.pages.assign(tiles, 0);
+    e.asked.assign(tiles, std::numeric_limits<uint64_t>::max());
+
+    // A texel for every tile of level 0, and a level for every level of them, which are exactly
+    // the indirection's mips since both sides are powers of two
+    auto imageinfo = vk::ImageCreateInfo()
+                       .setImageType(vk::ImageType::e2D)
+                       .setExtent(vk::Extent3D(tilesAlong(header.width, 0),
+                                               tilesAlong(header.height, 0), 1))
+                       .setMipLevels(header.levels)
+                       .setArrayLayers(1)
+                       .setFormat(vk::Format::eR8G8B8A8Unorm)
+                       .setTiling(vk::ImageTiling::eOptimal)
+                       .setInitialLayout(vk::ImageLayout::eUndefined)
+                       .setUsage(vk::ImageUsageFlagBits::eSampled
+                                 | vk::ImageUsageFlagBits::eTransferDst)
+                       .setSamples(vk::SampleCountFlagBits::e1)
+                       .setSharingMode(vk::SharingMode::eExclusive);
+
+    e.image  = m_device.createImage(imageinfo, hostAllocator());
+    e.memory = m_allocator->allocate(m_device.getImageMemoryRequirements(e.image),
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal,
+                                     memory_allocator::resource_kind::optimal,
+                                     memory_category::other);
+    m_device.bindImageMemory(e.image, e.memory.memory, e.memory.offset);
+
+    auto viewinfo = vk::ImageViewCreateInfo()
+                      .setImage(e.image)
+                      .setViewType(vk::ImageViewType::e2D)
+                      .setFormat(vk::Format::eR8G8B8A8Unorm)
+                      .setSubresourceRange(levelRange(header.levels));
+
+    e.view  = m_device.createImageView(viewinfo, hostAllocator());
+    e.dirty = true;
+    e.added = m_number;
+
+    // The coarsest level is what everything falls back on, so it's read right away and stays
+    const uint32_t coarsest = e.first_tile[header.levels - 1];
+    e.coarse_missing        = tiles - coarsest;
+    for (uint32_t tile = coarsest; tile < tiles; ++tile) {
+        startRead(texture, tile);
+    }
+
+    ++m_version;
+    return texture;
+}
+
+// Reads still on the I/O queue are dropped when they arrive, by their generation
+void
+virtual_texture_cache::remove(handle texture, uint64_t frame)
+{
+    entry& e = m_entries[texture];
+    for (uint32_t tile = 0; tile < (uint32_t)e.states.size(); ++tile) {
+        if (e.states[tile] == tile_state::resident) {
+            m_page_table[e.pages[tile]] = page();
+            m_free_pages.push_back(e.pages[tile]);
+            --m_resident;
+        }
+    }
+
+    m_deletions->push(frame, e.view);
+    m_deletions->push(frame, e.image);
+    m_deletions->push(frame, e.memory);
+
+    const uint32_t generation = e.generation + 1;
+    e                         = entry();
+    e.generation              = generation;
+
+    m_free.push_back(texture);
+    ++m_version;
+}
+
+// Every frame in flight updates its descriptors when it begins, so after that many frames all of
+// them have the indirection
+bool
+virtual_texture_cache::ready(handle texture) const
+{
+    const entry& e = m_entries[texture];
+    return e.view && e.covered && m_number >= e.added + m_frames;
+}
+
+vk::DescriptorImageInfo
+virtual_texture_cache::pages() const
+{
+    return vk::DescriptorImageInfo(m_sampler, m_pages_view, vk::ImageLayout::eGeneral);
+}
+
+vk::DescriptorBufferInfo
+virtual_texture_cache::feedback(uint32_t frame) const
+{
+    return vk::DescriptorBufferInfo(m_feedback, frame * m_feedback_frame_size,
+                                    m_feedback_frame_size);
+}
+
+void
+virtual_texture_cache::beginFrame(uint32_t frame, uint64_t number)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    m_frame  = frame % m_frames;
+    m_number = number;
+    m_page_copies.clear();
+    m_tables.clear();
+    m_table_copies.clear();
+
+    // What the shader asked for, as vt << 28 | level << 24 | y << 12 | x
+    char* feedback = static_cast<char*>(m_feedback_memory.mapped) + m_frame * m_feedback_frame_size;
+
+    virtual_feedback_header asked;
+    std::memcpy(&asked, feedback, sizeof(asked));
+
+    const uint32_t* ids   = reinterpret_cast<const uint32_t*>(feedback + sizeof(asked));
+    const uint32_t  count = std::min(asked.count, asked.capacity);
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint32_t id = ids[i];
+        ask(id >> 28, (id >> 24) & 0xf, id & 0xfff, (id >> 12) & 0xfff);
+    }
+
+    // Coarser levels first, so whatever is missing soon gets something at least close to it
+    std::stable_sort(m_wanted.begin(), m_wanted.end(),
+                     [](const wanted_tile& a, const wanted_tile& b) { return a.level > b.level; });
+    for (const wanted_tile& wanted : m_wanted) {
+        if (m_reading >= max_tile_reads) {
+            break;
+        }
+        startRead(wanted.texture, wanted.tile, wanted.pixels);
+    }
+    m_wanted.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(m_arrivals_mutex);
+        for (arrival& a : m_arrivals) {
+            forgetRead(a);
+            m_deferred.push_back(std::move(a));
+        }
+        m_arrivals.clear();
+    }
+    cancelUnwanted();
+
+    const vk::DeviceSize stagingoffset = m_frame * m_staging_frame_size;
+    char* staging = static_cast<char*>(m_staging_memory.mapped) + stagingoffset;
+
+    uint32_t uploads = 0;
+    size_t   kept    = 0;
+    for (size_t i = 0; i < m_deferred.size(); ++i) {
+        arrival& a = m_deferred[i];
+
+        if (a.texture >= m_entries.size() || m_entries[a.texture].generation != a.generation) {
+            --m_reading;
+            continue;
+        }
+        entry& e = m_entries[a.texture];
+        if (a.data.size() != virtual_tile_bytes) {
+            e.states[a.tile] = tile_state::failed;
+            --m_reading;
+            continue;
+        }
+
+        const uint32_t p = uploads < max_tile_uploads && m_streams->upload(virtual_tile_bytes)
+                             ? takePage(a.texture, a.tile)
+                             : ~0u;
+        if (p == ~0u) {
+            m_deferred[kept++] = std::move(a);
+            continue;
+        }
+        --m_reading;
+
+        const vk::DeviceSize offset = uploads * (vk::DeviceSize)virtual_tile_bytes;
+        std::memcpy(staging + offset, a.data.data(), virtual_tile_bytes);
+        ++uploads;
+
+        m_page_copies.push_back(
+          vk::BufferImageCopy()
+            .setBufferOffset(stagingoffset + offset)
+            .setImageSubresource(
+              vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+            .setImageOffset(vk::Offset3D((int32_t)((p % m_columns) * virtual_tile_span),
+                                         (int32_t)((p / m_columns) * virtual_tile_span), 0))
+            .setImageExtent(vk::Extent3D(virtual_tile_span, virtual_tile_span, 1)));
+
+        e.states[a.tile] = tile_state::resident;
+        e.pages[a.tile]  = (uint16_t)p;
+        e.dirty          = true;
+        if (a.tile >= e.first_tile[e.header.levels - 1]) {
+            --e.coarse_missing;
+        }
+    }
+    m_deferred.erase(m_deferred.begin() + kept, m_deferred.end());
+
+    // After the tiles, which may have taken pages from any of them
+    vk::DeviceSize offset = max_tile_uploads * (vk::DeviceSize)virtual_tile_bytes;
+    for (entry& e : m_entries) {
+        if (e.view && e.dirty) {
+            stageTable(e, staging, offset);
+        }
+    }
+
+    // And what this frame's shader needs to know to sample and ask
+    virtual_feedback_header next;
+    for (handle texture = 0; texture < (handle)m_entries.size(); ++texture) {
+        const entry& e = m_entries[texture];
+        if (e.view) {
+            next.textures[texture] =
+              glm::uvec4(e.header.width, e.header.height, e.header.levels, 0);
+        }
+    }
+    next.first_slot = m_first_slot;
+    next.frame      = (uint32_t)number;
+    next.capacity   = feedback_capacity;
+    std::memcpy(feedback, &next, sizeof(next));
+}
+
+// Along with every coarser tile that covers it, which are what is sampled until it's in
+void
+virtual_texture_cache::ask(handle texture, uint32_t level, uint32_t x, uint32_t y)
+{
+    if (texture >= m_entries.size() || !m_entries[texture].view) {
+        return;
+    }
+    entry& e = m_entries[texture];
+
+    for (uint32_t l = level; l < e.header.levels; ++l) {
+        const uint32_t across = tilesAlong(e.header.width, l);
+        const uint32_t down   = tilesAlong(e.header.height, l);
+        const uint32_t tx     = x >> (l - level);
+        const uint32_t ty     = y >> (l - level);
+        if (tx >= across || ty >= down) {
+            return;
+        }
+
+        // Then so were its ancestors
+        const uint32_t tile = e.first_tile[l] + ty * across + tx;
+        if (e.asked[tile] == m_number) {
+            return;
+        }
+        e.asked[tile] = m_number;
+
+        if (e.states[tile] == tile_state::resident) {
+            m_page_table[e.pages[tile]].used = m_number;
+        } else if (e.states[tile] == tile_state::missing) {
+            m_wanted.push_back({ texture, tile, l, (float)(virtual_tile_size << (l - level)) });
+        }
+    }
+}
+
+void
+virtual_texture_cache::startRead(handle texture, uint32_t tile, float pixels)
+{
+    entry&         e          = m_entries[texture];
+    const uint32_t generation = e.generation;
+    e.states[tile]            = tile_state::loading;
+    ++m_reading;
+
+    const uint64_t offset = sizeof(virtual_texture_header) + (uint64_t)tile * virtual_tile_bytes;
+    auto           read   = [this, texture, generation, tile](core::mapped_file&& file, size_t) {
+        arrival a;
+        a.texture    = texture;
+        a.generation = generation;
+        a.tile       = tile;
+        a.data       = std::move(file);
+
+        std::lock_guard<std::mutex> lock(m_arrivals_mutex);
+        m_arrivals.push_back(std::move(a));
+    };
+
+    tile_read r;
+    r.texture    = texture;
+    r.generation = generation;
+    r.tile       = tile;
+    r.ticket     = m_streams->read(e.path, offset, virtual_tile_bytes, pixels, std::move(read));
+    m_tile_reads.push_back(r);
+}
+
+// Tiles that were cancelled are missing again, and read once they are asked for again
+void
+virtual_texture_cache::cancelUnwanted()
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < m_tile_reads.size(); ++i) {
+        const tile_read& r       = m_tile_reads[i];
+        entry&           e       = m_entries[r.texture];
+        const bool       removed = e.generation != r.generation;
+        if ((removed || m_number - e.asked[r.tile] > tile_read_timeout)
+            && m_streams->cancel(r.ticket)) {
+            if (!removed) {
+                e.states[r.tile] = tile_state::missing;
+            }
+            --m_reading;
+            continue;
+        }
+        m_tile_reads[kept++] = r;
+    }
+    m_tile_reads.erase(m_tile_reads.begin() + kept, m_tile_reads.end());
+}
+
+void
+virtual_texture_cache::forgetRead(const arrival& a)
+{
+    for (size_t i = 0; i < m_tile_reads.size(); ++i) {
+        const tile_read& r = m_tile_reads[i];
+        if (r.texture == a.texture && r.generation == a.generation && r.tile == a.tile) {
+            m_tile_reads.erase(m_tile_reads.begin() + i);
+            return;
+        }
+    }
+}
+
+/*
+A free page, or else the least recently used one that nothing asked for in this frame and that
+isn't of a coarsest level. Its tile goes back to missing, and its texture's indirection is staged
+again in this frame, to point at the tile's ancestor instead before the page is overwritten.
+Returns ~0u if every page is in use.
+*/
+uint32_t
+virtual_texture_cache::takePage(handle texture, uint32_t tile)
+{
+    uint32_t p = ~0u;
+    if (!m_free_pages.empty()) {
+        p = m_free_pages.back();
+        m_free_pages.pop_back();
+    } else {
+        uint64_t oldest = m_number;
+        for (uint32_t i = 0; i < (uint32_t)m_page_table.size(); ++i) {
+            const page&  candidate = m_page_table[i];
+            const entry& owner     = m_entries[candidate.texture];
+            if (candidate.used < oldest
+                && candidate.tile < owner.first_tile[owner.header.levels - 1]) {
+                oldest = candidate.used;
+                p      = i;
+            }
+        }
+        if (p == ~0u) {
+            return p;
+        }
+
+        entry& owner                       = m_entries[m_page_table[p].texture];
+        owner.states[m_page_table[p].tile] = tile_state::missing;
+        owner.dirty                        = true;
+        --m_resident;
+    }
+
+    m_page_table[p] = { texture, tile, m_number };
+    ++m_resident;
+    return p;
+}
+
+/*
+From the coarsest level down, a resident tile's entry is its page and level, while a missing one
+takes its parent's. Each is an RGBA8 texel of page x, page y, level and 255 for valid, which the
+shader unpacks from UNORM.
+*/
+void
+virtual_texture_cache::stageTable(entry& e, char* staging, vk::DeviceSize& offset)
+{
+    const uint32_t levels = e.header.levels;
+    m_table.assign(e.states.size(), 0);
+
+    for (uint32_t level = levels; level-- > 0;) {
+        const uint32_t across = tilesAlong(e.header.width, level);
+        const uint32_t down   = tilesAlong(e.header.height, level);
+        const uint32_t first  = e.first_tile[level];
+
+        for (uint32_t y = 0; y < down; ++y) {
+            for (uint32_t x = 0; x < across; ++x) {
+                const uint32_t tile = first + y * across + x;
+                if (e.states[tile] == tile_state::resident) {
+                    const uint32_t p = e.pages[tile];
+                    m_table[tile]    = (p % m_columns) | (p / m_columns) << 8 | level << 16
+                                    | 255u << 24;
+                } else if (level + 1 < levels) {
+                    const uint32_t parentacross = tilesAlong(e.header.width, level + 1);
+                    m_table[tile] = m_table[e.first_tile[level + 1] + (y / 2) * parentacross
+                                            + std::min(x / 2, parentacross - 1)];
+                }
+            }
+        }
+    }
+
+    const vk::DeviceSize size = m_table.size() * table_entry_size;
+    assert(offset + size <= m_staging_frame_size && "Virtual texture staging is too small!");
+    std::memcpy(staging + offset, m_table.data(), (size_t)size);
+
+    staged_table staged;
+    staged.image      = e.image;
+    staged.levels     = levels;
+    staged.first_copy = (uint32_t)m_table_copies.size();
+    staged.transition = !e.written;
+    m_tables.push_back(staged);
+
+    for (uint32_t level = 0; level < levels; ++level) {
+        m_table_copies.push_back(
+          vk::BufferImageCopy()
+            .setBufferOffset(m_frame * m_staging_frame_size + offset
+                             + e.first_tile[level] * table_entry_size)
+            .setImageSubresource(
+              vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1))
+            .setImageExtent(vk::Extent3D(tilesAlong(e.header.width, level),
+                                         tilesAlong(e.header.height, level), 1)));
+    }
+
+    offset += alignUp(size, staging_alignment);
+    e.written = true;
+    e.dirty   = false;
+    e.covered = e.coarse_missing == 0;
+}
+
+/*
+Images that haven't been written before are moved out of undefined first, without waiting for
+anything. Everything else about the copies is synchronized by the render graph, see the class.
+*/
+void
+virtual_texture_cache::record(vk::CommandBuffer command_buffer)
+{
+    if (m_initialized && m_page_copies.empty() && m_tables.empty()) {
+        return;
+    }
+
+    const access_scope copied = { vk::PipelineStageFlagBits::eTransfer,
+                                  vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eGeneral };
+
+    barrier_batch barriers;
+    if (!m_initialized) {
+        barriers.image(m_pages, levelRange(1), access_scope(), copied);
+        m_initialized = true;
+    }
+    for (const staged_table& table : m_tables) {
+        if (table.transition) {
+            barriers.image(table.image, levelRange(table.levels), access_scope(), copied);
+        }
+    }
+    barriers.record(command_buffer);
+
+    if (!m_page_copies.empty()) {
+        command_buffer.copyBufferToImage(m_staging, m_pages, vk::ImageLayout::eGeneral,
+                                         (uint32_t)m_page_copies.size(), m_page_copies.data());
+    }
+    for (const staged_table& table : m_tables) {
+        command_buffer.copyBufferToImage(m_staging, table.image, vk::ImageLayout::eGeneral,
+                                         table.levels, m_table_copies.data() + table.first_copy);
+    }
+
+    m_page_copies.clear();
+    m_tables.clear();
+    m_table_copies.clear();
+}
+
+}  // namespace shiny::graphics
@@ -0,0 +1,277 @@
+#pragma once
+
+#include "core/io_queue.h"
+#include "graphics/deletion_queue.h"
+#include "graphics/memory_allocator.h"
+#include "graphics/stream_scheduler.h"
+#include "graphics/view_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace shiny::graphics {
+
+// Texels across a tile of a virtual texture, and how many more it has on every side, so that
+// filtering never reaches past its page
+const uint32_t virtual_tile_size   = 128;
+const uint32_t virtual_tile_border = 4;
+const uint32_t virtual_tile_span   = virtual_tile_size + 2 * virtual_tile_border;
+
+// A tile's BC1 blocks, 8 bytes for every 4x4 texels
+const uint32_t virtual_tile_bytes = (virtual_tile_span / 4) * (virtual_tile_span / 4) * 8;
+
+// The largest virtual textures, whose whole indirection every frame has staging memory for, and
+// how many of them there can be at once, which the shader's tile IDs have 4 bits for
+const uint32_t max_virtual_texture_size = 16384;
+const uint32_t max_virtual_textures     = 16;
+
+// Set on a draw's texture index when it is the bindless slot of a virtual texture's indirection
+// instead of a texture, see bindless.frag
+const uint32_t virtual_texture_bit = 1u << 31;
+
+/*
+The header of a virtual texture file, as cookVirtualTexture writes them. The tiles follow it, all
+virtual_tile_bytes in size, level by level from level 0 on and row by row within a level. Every
+tile has virtual_tile_border texels of its neighbours on every side, wrapping around the texture,
+and a level smaller than a tile repeats within it.
+*/
+struct virtual_texture_header
+{
+    char     magic[4]   = { 'S', 'V', 'T', '1' };
+    uint32_t width      = 0;  // powers of two, from virtual_tile_size to max_virtual_texture_size
+    uint32_t height     = 0;
+    uint32_t levels     = 0;  // see virtualTextureLevels
+    uint32_t tile_bytes = virtual_tile_bytes;
+};
+
+// Down to the first level that fits into a single tile
+uint32_t virtualTextureLevels(uint32_t width, uint32_t height);
+
+// Laid out like the std430 VirtualFeedback buffer of bindless.frag, whose tile IDs follow it
+struct virtual_feedback_header
+{
+    glm::uvec4 textures[max_virtual_textures] = {};  // width, height and levels by texture
+    uint32_t   first_slot = 0;  // of the first virtual texture's indirection in the bindless array
+    uint32_t   frame      = 0;  // which pixel of every 8x8 asks for its tile
+    uint32_t   capacity   = 0;  // tile IDs that fit
+    uint32_t   count      = 0;  // tile IDs written, which the shader counts past the capacity
+};
+
+/*
+Virtual textures, for textures far too large to be resident whole, like terrain or scanned assets:
+only the tiles that are actually seen, at the level they are seen at, are in VRAM, in the pages of
+one physical texture that all virtual textures share. Pages have borders, so bilinear filtering
+stays within them, but no levels of their own.
+
+The fragment shader finds a tile's page in the texture's indirection, an image with a texel for
+every tile and a level for every level of tiles, which sits in the bindless texture array. A tile
+that isn't resident has the page of its closest resident ancestor instead, which the shader
+samples at that ancestor's scale, so once the coarsest level is in, which is never evicted, there
+is always something to sample.
+
+While it samples, the shader also writes the ID of every tile it wanted into the feedback buffer,
+for one pixel out of every 8x8 and a different one every frame, which is how the requests get to
+the CPU without a pass of their own. beginFrame() reads a frame's feedback back once its fence has
+signalled: resident tiles count as used, the others are read from their file through the stream
+scheduler, coarser levels first, and uploaded into the least recently used pages once they have
+arrived, within its upload budget. A read that nobody has asked for in a while by the time it would
+start, because the view moved on, is cancelled. record() copies the tiles out of the frame's
+staging region, along with the indirection of every texture whose tiles changed.
+
+The pages and the indirection are in VK_IMAGE_LAYOUT_GENERAL for good, since they are written while
+the rest of them is sampled. record() doesn't wait for the frames before it to be done sampling
+them, that is left to the render graph, which has the pages as an imported image: its barriers
+are global memory barriers, so they cover the indirection as well.
+*/
+class virtual_texture_cache
+{
+public:
+    using handle = uint32_t;
+
+    static const handle invalid_handle = std::numeric_limits<handle>::max();
+
+    // `columns` pages in both directions, so at most 30 for the 4096 texels every device can have.
+    // The indirection of handle `h` goes into slot `first_slot + h` of the bindless array.
+    void init(vk::PhysicalDevice physical_device,
+              vk::Device         device,
+              memory_allocator&  allocator,
+              view_cache&        views,
+              stream_scheduler&  streams,
+              deletion_queue&    deletions,
+              uint32_t           columns,
+              uint32_t           first_slot,
+              uint32_t           frames);
+    // Only safe once the device is idle and the I/O queue is done reading
+    void destroy();
+
+    // Reads the header of a virtual texture file and asks for its coarsest level. Returns
+    // invalid_handle if it isn't one or there are max_virtual_textures already.
+    handle add(const std::string& path);
+
+    // Its pages are free for other tiles right away, its indirection once `frame` has finished
+    void remove(handle texture, uint64_t frame);
+
+    // Once its coarsest level is resident and every frame's descriptors have its indirection,
+    // before which draws can't use it
+    bool ready(handle texture) const;
+
+    // Takes the tiles `frame` asked for the last time around, whose fence has signalled, reads
+    // what's missing and stages what has been read. `number` is the frame about to be recorded.
+    void beginFrame(uint32_t frame, uint64_t number);
+
+    // Copies whatever beginFrame staged, outside of a render pass
+    void record(vk::CommandBuffer command_buffer);
+
+    // Sampled with a sampler of its own
+    vk::Image               pagesImage() const { return m_pages; }
+    vk::DescriptorImageInfo pages() const;
+
+    vk::Buffer               feedbackBuffer() const { return m_feedback; }
+    vk::DescriptorBufferInfo feedback(uint32_t frame) const;
+
+    // The bindless slot of a texture's indirection and the view to put there. Views are only
+    // created and destroyed by add() and remove(), which change version().
+    uint32_t      slot(handle texture) const { return m_first_slot + texture; }
+    handle        fromSlot(uint32_t slot) const { return slot - m_first_slot; }
+    vk::ImageView indirection(handle texture) const { return m_entries[texture].view; }
+    uint64_t      version() const { return m_version; }
+
+    // Every handle is below this, removed ones (whose view is null) included
+    uint32_t size() const { return (uint32_t)m_entries.size(); }
+
+    uint32_t residentPages() const { return m_resident; }
+
+    // Whether tiles are still being read, or waiting for a page or staging memory
+    bool reading() const { return m_reading > 0 || !m_deferred.empty(); }
+
+private:
+    enum class tile_state : uint8_t
+    {
+        missing,
+        loading,
+        resident,
+        failed,  // couldn't be read, and isn't asked for again
+    };
+
+    struct entry
+    {
+        std::string             path;
+        virtual_texture_header  header;
+        std::vector<uint32_t>   first_tile;  // by level
+        std::vector<tile_state> states;      // by tile
+        std::vector<uint16_t>   pages;       // by resident tile
+        std::vector<uint64_t>   asked;       // by tile, the frame it was last asked for in
+        uint32_t                coarse_missing = 0;  // tiles of the coarsest level not resident
+
+        vk::Image     image;  // the indirection
+        allocation    memory;
+        vk::ImageView view;
+        bool          written = false;  // staged at least once, so no longer undefined
+        bool          dirty   = false;  // its tiles changed since it was last staged
+        bool          covered = false;  // when last staged, with all of the coarsest level
+
+        uint64_t added      = 0;  // the frame
+        uint32_t generation = 0;  // bumped on removal, for reads that arrive afterwards
+    };
+
+    struct page
+    {
+        handle   texture = invalid_handle;
+        uint32_t tile    = 0;
+        uint64_t used    = 0;  // the frame it was last asked for in
+    };
+
+    // A tile read on the I/O queue, handed over from its thread
+    struct arrival
+    {
+        handle            texture    = invalid_handle;
+        uint32_t          generation = 0;
+        uint32_t          tile       = 0;
+        core::mapped_file data;
+    };
+
+    struct wanted_tile
+    {
+        handle   texture = invalid_handle;
+        uint32_t tile    = 0;
+        uint32_t level   = 0;
+        float    pixels  = 0.f;  // across on screen, more for the ancestors of what was asked for
+    };
+
+    // Until it arrives, or is cancelled
+    struct tile_read
+    {
+        handle                   texture    = invalid_handle;
+        uint32_t                 generation = 0;
+        uint32_t                 tile       = 0;
+        stream_scheduler::ticket ticket     = stream_scheduler::invalid_ticket;
+    };
+
+    // An indirection that record() copies into, with its copies in m_table_copies
+    struct staged_table
+    {
+        vk::Image image;
+        uint32_t  levels     = 0;
+        uint32_t  first_copy = 0;
+        bool      transition = false;  // out of undefined first
+    };
+
+    void     ask(handle texture, uint32_t level, uint32_t x, uint32_t y);
+    void     startRead(handle texture, uint32_t tile, float pixels);
+    void     cancelUnwanted();
+    void     forgetRead(const arrival& a);
+    uint32_t takePage(handle texture, uint32_t tile);
+    void     stageTable(entry& e, char* staging, vk::DeviceSize& offset);
+
+    vk::Device        m_device;
+    memory_allocator* m_allocator = nullptr;
+    stream_scheduler* m_streams   = nullptr;
+    deletion_queue*   m_deletions = nullptr;
+
+    vk::Image     m_pages;
+    allocation    m_pages_memory;
+    vk::ImageView m_pages_view;
+    vk::Sampler   m_sampler;  // owned by the view_cache
+    uint32_t      m_columns     = 0;
+    bool          m_initialized = false;  // the pages are in VK_IMAGE_LAYOUT_GENERAL
+
+    vk::Buffer     m_feedback;  // host visible, every frame's header and tile IDs
+    allocation     m_feedback_memory;
+    vk::DeviceSize m_feedback_frame_size = 0;
+
+    vk::Buffer     m_staging;  // host visible, every frame's tiles and indirection
+    allocation     m_staging_memory;
+    vk::DeviceSize m_staging_frame_size = 0;
+
+    std::vector<entry>    m_entries;
+    std::vector<handle>   m_free;
+    std::vector<page>     m_page_table;
+    std::vector<uint32_t> m_free_pages;
+    std::vector<uint32_t> m_table;  // the entries of the indirection being staged, by tile
+    uint32_t              m_resident = 0;
+
+    std::mutex             m_arrivals_mutex;
+    std::vector<arrival>   m_arrivals;  // read since the last beginFrame
+    std::vector<arrival>   m_deferred;  // didn't get a page or staging memory the last time
+    uint32_t               m_reading = 0;
+    std::vector<tile_read> m_tile_reads;  // that haven't arrived yet
+
+    std::vector<wanted_tile> m_wanted;  // of the current beginFrame
+
+    // What beginFrame staged for record()
+    std::vector<vk::BufferImageCopy> m_page_copies;
+    std::vector<staged_table>        m_tables;
+    std::vector<vk::BufferImageCopy> m_table_copies;  // every level of every table, in order
+
+    uint32_t m_first_slot = 0;
+    uint32_t m_frames     = 0;
+    uint32_t m_frame      = 0;
+    uint64_t m_number     = 0;
+    uint64_t m_version    = 0;
+};
+
+}  // namespace shiny::graphics
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <mutex>
+
+namespace shiny::jobs {
+
+/*
+Hands packets, e.g. everything a frame draws, from one producer thread to one consumer thread
+through two slots, so the producer fills the next packet while the consumer still works on the
+last. The producer can get at most one packet ahead: write() waits while the packet it published
+last hasn't been taken by the consumer yet, so no packet is ever skipped. Packets are reused rather
+than copied or reallocated, so whatever they hold keeps its capacity from one round to the next.
+*/
+template<typename T>
+class packet_exchange
+{
+public:
+    // The slot to fill next, the one the consumer isn't reading, once it has taken the last
+    // packet. It still holds whatever was in it before.
+    T& write()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() { return m_closed || m_ready < 0; });
+        m_writing = m_reading == 0 ? 1 : 0;
+        return m_slots[m_writing];
+    }
+
+    // Hands the slot write() returned to the consumer
+    void publish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_ready = m_writing;
+        }
+        m_changed.notify_all();
+    }
+
+    // The oldest packet that hasn't been read yet, waiting for one to be published, or null once
+    // the exchange is closed and there are none left
+    T* read()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() { return m_closed || m_ready >= 0; });
+        if (m_ready < 0) {
+            return nullptr;
+        }
+
+        m_reading = m_ready;
+        m_ready   = -1;
+        return &m_slots[m_reading];
+    }
+
+    // Done with what read() returned
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_reading = -1;
+        }
+        m_changed.notify_all();
+    }
+
+    // Wakes both sides for good: read() returns null once it runs out, and write() doesn't wait
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_changed.notify_all();
+    }
+
+    bool closed()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_closed;
+    }
+
+private:
+    std::array<T, 2>        m_slots;
+    std::mutex              m_mutex;
+    std::condition_variable m_changed;
+    int                     m_ready   = -1;  // published and not read yet
+    int                     m_reading = -1;
+    int                     m_writing = 0;
+    bool                    m_closed  = false;
+};
+
+}  // namespace shiny::jobs
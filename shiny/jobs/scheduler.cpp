@@ -0,0 +1,219 @@
+#include "jobs/scheduler.h"
+
+#include "core/profiler.h"
+
+#include <cassert>
+#include <string>
+
+namespace {
+
+// Which scheduler the current thread is a worker of, and its queue there
+thread_local const shiny::jobs::scheduler* t_scheduler = nullptr;
+thread_local uint32_t                      t_queue     = 0;
+
+// The queues every thread outside the pool shares, one for each class of job
+const uint32_t shared_queues = shiny::core::thread_class_count;
+
+}  // namespace
+
+namespace shiny::jobs {
+
+void
+scheduler::init(uint32_t workers)
+{
+    assert(!m_running && "scheduler is already running!");
+
+    if (workers == 0) {
+        workers = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+
+    // Either class needs a worker of its own, or it could wait on the other forever
+    const core::cpu_topology& topology = core::cpuTopology();
+    m_background_workers               = 0;
+    if (topology.hybrid() && workers >= 2) {
+        const size_t cores   = topology.performance.size() + topology.efficiency.size();
+        const size_t share   = (workers * topology.efficiency.size() + cores / 2) / cores;
+        m_background_workers = std::clamp((uint32_t)share, 1u, workers - 1);
+    }
+
+    m_queues.clear();
+    for (uint32_t i = 0; i < workers + shared_queues; ++i) {
+        m_queues.push_back(std::make_unique<queue>());
+        if (i == (uint32_t)core::thread_class::background
+            || i >= workers + shared_queues - m_background_workers) {
+            m_queues.back()->kind = core::thread_class::background;
+        }
+    }
+
+    m_running = true;
+
+    m_threads.reserve(workers);
+    for (uint32_t i = shared_queues; i < workers + shared_queues; ++i) {
+        m_threads.emplace_back([this, i]() { workerLoop(i); });
+    }
+}
+
+void
+scheduler::shutdown()
+{
+    if (!m_running) {
+        return;
+    }
+
+    assert(m_queued[0] == 0 && m_queued[1] == 0 && "jobs were still queued at shutdown!");
+
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_running = false;
+    }
+    for (std::condition_variable& wake : m_wake) {
+        wake.notify_all();
+    }
+
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+    m_queues.clear();
+}
+
+/*
+A job goes into the queue of the worker that runs it if it's of the worker's class, and otherwise
+into the shared queue of its class.
+*/
+void
+scheduler::run(counter& group, std::function<void()> job_action, core::thread_class kind)
+{
+    group.m_pending.fetch_add(1, std::memory_order_relaxed);
+
+    const uint32_t own    = currentQueue();
+    queue&         target = *m_queues[m_queues[own]->kind == kind ? own : (uint32_t)kind];
+    {
+        std::lock_guard<std::mutex> lock(target.mutex);
+        target.jobs.push_back({ std::move(job_action), &group });
+    }
+
+    const size_t runs = runner(kind);
+    m_queued[runs].fetch_add(1, std::memory_order_release);
+
+    // Taking the lock orders this against a worker that is just about to go to sleep, so the
+    // notification can't get lost in between its check and its wait
+    { std::lock_guard<std::mutex> lock(m_sleep_mutex); }
+    m_wake[runs].notify_one();
+}
+
+void
+scheduler::wait(counter& group)
+{
+    const uint32_t self = currentQueue();
+
+    while (!group.done()) {
+        if (!tryRunOne(self)) {
+            // The remaining jobs of the group are running on other threads
+            std::this_thread::yield();
+        }
+    }
+}
+
+uint32_t
+scheduler::currentQueue() const
+{
+    return t_scheduler == this ? t_queue : 0;
+}
+
+bool
+scheduler::tryRunOne(uint32_t self)
+{
+    job next;
+    if (!pop(self, next)) {
+        return false;
+    }
+
+    next.action();
+    next.group->m_pending.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+/*
+Takes the newest job of our own queue, otherwise steals the oldest one of the next queue that has
+any, starting after our own so thieves don't all go for the same victim. Only the queues of the
+classes our class runs are looked at, render ones before background ones.
+*/
+bool
+scheduler::pop(uint32_t self, job& out)
+{
+    const size_t mine = runner(m_queues[self]->kind);
+    if (m_queued[mine].load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+
+    if (take(*m_queues[self], true, out)) {
+        return true;
+    }
+
+    const uint32_t count = (uint32_t)m_queues.size();
+    for (core::thread_class kind : { core::thread_class::render, core::thread_class::background }) {
+        if (runner(kind) != mine) {
+            continue;
+        }
+        for (uint32_t i = 1; i < count; ++i) {
+            queue& victim = *m_queues[(self + i) % count];
+            if (victim.kind == kind && take(victim, false, out)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool
+scheduler::take(queue& from, bool newest, job& out)
+{
+    std::lock_guard<std::mutex> lock(from.mutex);
+    if (from.jobs.empty()) {
+        return false;
+    }
+
+    if (newest) {
+        out = std::move(from.jobs.back());
+        from.jobs.pop_back();
+    } else {
+        out = std::move(from.jobs.front());
+        from.jobs.pop_front();
+    }
+    m_queued[runner(from.kind)].fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+void
+scheduler::workerLoop(uint32_t self)
+{
+    t_scheduler = this;
+    t_queue     = self;
+
+    const core::thread_class kind = m_queues[self]->kind;
+    const size_t             mine = runner(kind);
+
+    const bool background = kind == core::thread_class::background;
+    core::nameThread((background ? "background worker " : "worker ")
+                     + std::to_string(self - shared_queues + 1));
+    core::applyThreadClass(kind);
+
+    while (true) {
+        if (tryRunOne(self)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_wake[mine].wait(lock, [&]() { return !m_running || m_queued[mine].load() > 0; });
+
+        if (!m_running) {
+            break;
+        }
+    }
+
+    t_scheduler = nullptr;
+}
+
+}  // namespace shiny::jobs
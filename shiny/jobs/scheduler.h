@@ -0,0 +1,139 @@
+#pragma once
+
+#include "core/cpu_topology.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace shiny::jobs {
+
+/*
+Counts the jobs that were run against it and haven't finished yet. Whoever submits a group of jobs
+owns the counter and waits on it; jobs can in turn submit and wait on their own children, which is
+how work is split up recursively.
+*/
+class counter
+{
+public:
+    counter() = default;
+    counter(const counter&) = delete;
+    counter& operator=(const counter&) = delete;
+
+    bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class scheduler;
+
+    std::atomic<uint32_t> m_pending{ 0 };
+};
+
+/*
+A work-stealing job scheduler. Every worker thread has its own deque: it pushes and pops its own
+jobs at the back, which keeps recently split work hot in its cache, and when it runs dry it steals
+the oldest job from the front of someone else's. Threads outside the pool (usually the main thread)
+submit into a shared queue that every worker steals from as well.
+
+There are no fibers. A thread that waits on a counter keeps running other queued jobs until the
+counter reaches zero instead of blocking, so waiting inside a job doesn't tie up a worker and
+nesting is safe. Jobs must not throw.
+
+Jobs come in the classes of core::thread_class. On a hybrid CPU the workers are split the same way
+as its cores, each pinned to its kind, and a worker only runs jobs of its own class: a decode never
+holds up a render worker, and a render job never lands on a slow core, although background jobs
+can take longer to get through. Elsewhere every worker runs both, background jobs only once there
+are no render jobs left that it can get at.
+*/
+class scheduler
+{
+public:
+    scheduler() = default;
+    scheduler(const scheduler&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+    ~scheduler() { shutdown(); }
+
+    // 0 starts one worker less than there are hardware threads, since the thread calling wait()
+    // takes part as well. On a hybrid CPU they are shared out between the kinds of cores in
+    // proportion to how many there are of each.
+    void init(uint32_t workers = 0);
+
+    // Every submitted job must have been waited on already
+    void shutdown();
+
+    void run(counter&              group,
+             std::function<void()> job,
+             core::thread_class    kind = core::thread_class::render);
+    void wait(counter& group);
+
+    /*
+    Calls `body(first, last)` for consecutive sub-ranges of [begin, end) of at most `grain`
+    elements each, in parallel, and returns once all of them are done.
+    */
+    template<typename Func>
+    void parallelFor(uint32_t begin, uint32_t end, uint32_t grain, Func&& body)
+    {
+        grain = std::max(grain, 1u);
+
+        counter group;
+        for (uint32_t first = begin; first < end; first += std::min(grain, end - first)) {
+            uint32_t last = first + std::min(grain, end - first);
+            run(group, [&body, first, last]() { body(first, last); });
+        }
+        wait(group);
+    }
+
+    // Including the thread that calls wait()
+    uint32_t threadCount() const { return (uint32_t)m_threads.size() + 1; }
+
+    // Workers that only run background jobs, 0 unless the CPU is hybrid
+    uint32_t backgroundWorkers() const { return m_background_workers; }
+
+private:
+    struct job
+    {
+        std::function<void()> action;
+        counter*              group = nullptr;
+    };
+
+    struct queue
+    {
+        std::mutex         mutex;
+        std::deque<job>    jobs;
+        core::thread_class kind = core::thread_class::render;
+    };
+
+    // The class of the workers that run jobs of `kind`
+    size_t runner(core::thread_class kind) const
+    {
+        return kind == core::thread_class::background && m_background_workers > 0
+                 ? (size_t)core::thread_class::background
+                 : (size_t)core::thread_class::render;
+    }
+
+    uint32_t currentQueue() const;
+    bool     tryRunOne(uint32_t self);
+    bool     pop(uint32_t self, job& out);
+    bool     take(queue& from, bool newest, job& out);
+    void     workerLoop(uint32_t self);
+
+    // [0] and [1] are shared by every thread outside the pool, for render and background jobs,
+    // [2..] belong to the workers, the render ones first
+    std::vector<std::unique_ptr<queue>> m_queues;
+    std::vector<std::thread>            m_threads;
+    uint32_t                            m_background_workers = 0;
+
+    // By runner(), for the workers of each class to sleep on and wake up to
+    std::mutex                                                     m_sleep_mutex;
+    std::array<std::condition_variable, core::thread_class_count> m_wake;
+    std::array<std::atomic<uint32_t>, core::thread_class_count>   m_queued{};
+    std::atomic<bool>                                              m_running{ false };
+};
+
+}  // namespace shiny::jobs
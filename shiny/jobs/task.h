@@ -0,0 +1,217 @@
+#pragma once
+
+#include "jobs/scheduler.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace shiny::jobs {
+
+template<typename T>
+class task;
+
+namespace detail {
+
+// What every task's promise has, whatever it returns: whoever co_awaits the task is resumed once
+// it's done, right on the thread that finished it
+struct task_promise_base
+{
+    struct final_awaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> done) noexcept
+        {
+            std::coroutine_handle<> continuation = done.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter       final_suspend() noexcept { return {}; }
+    void                unhandled_exception() { failure = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr      failure;
+};
+
+template<typename T>
+struct task_promise : task_promise_base
+{
+    task<T> get_return_object();
+    void    return_value(T value) { result.emplace(std::move(value)); }
+
+    T take()
+    {
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+        return std::move(*result);
+    }
+
+    std::optional<T> result;
+};
+
+template<>
+struct task_promise<void> : task_promise_base
+{
+    task<void> get_return_object();
+    void       return_void() {}
+
+    void take()
+    {
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+};
+
+}  // namespace detail
+
+/*
+A coroutine that only starts once it's co_awaited, and returns a T, or throws whatever its body
+did, to whoever co_awaited it. Where it runs depends on what it co_awaits in turn: every awaiter
+that hands work to another thread, like schedule() below, io_queue::reading() or
+upload_service::next(), resumes it on that thread, so a chain of them reads like a function that
+hops from the I/O threads to a worker to the render thread without blocking any of them.
+
+A task is moved, never copied, and destroys its frame with it, so it has to outlive being awaited.
+spawn() starts one that nothing awaits.
+*/
+template<typename T>
+class task
+{
+public:
+    using promise_type = detail::task_promise<T>;
+
+    task() = default;
+    task(task&& other) noexcept
+      : m_coroutine(std::exchange(other.m_coroutine, nullptr))
+    {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    task& operator=(task&& other) noexcept
+    {
+        if (this != &other) {
+            destroy();
+            m_coroutine = std::exchange(other.m_coroutine, nullptr);
+        }
+        return *this;
+    }
+    ~task() { destroy(); }
+
+    bool await_ready() const noexcept { return !m_coroutine || m_coroutine.done(); }
+
+    // Starts the task on the awaiting thread, which carries on with it right away
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_coroutine.promise().continuation = awaiting;
+        return m_coroutine;
+    }
+
+    T await_resume() { return m_coroutine.promise().take(); }
+
+private:
+    friend promise_type;
+
+    explicit task(std::coroutine_handle<promise_type> coroutine)
+      : m_coroutine(coroutine)
+    {}
+
+    void destroy()
+    {
+        if (m_coroutine) {
+            m_coroutine.destroy();
+            m_coroutine = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> m_coroutine;
+};
+
+namespace detail {
+
+template<typename T>
+task<T>
+task_promise<T>::get_return_object()
+{
+    return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void>
+task_promise<void>::get_return_object()
+{
+    return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+// Runs to the end without anyone awaiting it, and frees itself then
+struct detached
+{
+    struct promise_type
+    {
+        detached           get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void               return_void() noexcept {}
+        [[noreturn]] void  unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+}  // namespace detail
+
+/*
+Starts `work` on the calling thread, which it runs on until it first suspends, and calls `done`
+with its result wherever it finishes. Like jobs, neither must throw.
+*/
+template<typename T, typename Done>
+detail::detached
+spawn(task<T> work, Done done)
+{
+    if constexpr (std::is_void_v<T>) {
+        co_await work;
+        done();
+    } else {
+        done(co_await work);
+    }
+}
+
+inline detail::detached
+spawn(task<void> work)
+{
+    co_await work;
+}
+
+/*
+co_await schedule(jobs, group) resumes the coroutine as a job on one of the scheduler's workers,
+counted against `group` until it suspends again or finishes, so waiting on the group waits out its
+CPU work the same way as any other job's. `kind` is the class of job it resumes as.
+*/
+class schedule
+{
+public:
+    schedule(scheduler& jobs, counter& group, core::thread_class kind = core::thread_class::render)
+      : m_jobs(jobs)
+      , m_group(group)
+      , m_kind(kind)
+    {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> coroutine)
+    {
+        m_jobs.run(m_group, [coroutine]() { coroutine.resume(); }, m_kind);
+    }
+    void await_resume() const noexcept {}
+
+private:
+    scheduler&         m_jobs;
+    counter&           m_group;
+    core::thread_class m_kind;
+};
+
+}  // namespace shiny::jobs
@@ -0,0 +1,146 @@
+#include "jobs/task_graph.h"
+
+#include "core/profiler.h"
+
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <utility>
+
+namespace shiny::jobs {
+
+task_graph::handle
+task_graph::add(const char*                   name,
+                std::function<void()>         work,
+                std::initializer_list<handle> after,
+                bool                          worker)
+{
+    const handle added = (handle)m_tasks.size();
+
+    task t;
+    t.name   = name;
+    t.work   = std::move(work);
+    t.worker = worker;
+    for (handle dependency : after) {
+        assert(dependency < added && "steps can only depend on steps added before them!");
+        m_tasks[dependency].dependents.push_back(added);
+        ++t.dependencies;
+    }
+
+    m_tasks.push_back(std::move(t));
+    return added;
+}
+
+/*
+Whichever thread finishes a step hands its dependents on: worker steps go straight to the
+scheduler, the others to the calling thread, which sleeps until there is one for it or everything
+is done. It doesn't run jobs while it waits, since a long one would hold up its own steps.
+*/
+void
+task_graph::run(scheduler& jobs, bool parallel)
+{
+    SHINY_PROFILE_FUNCTION();
+
+    if (!parallel) {
+        for (handle h = 0; h < (handle)m_tasks.size(); ++h) {
+            runTask(h);
+        }
+        return;
+    }
+
+    std::mutex              mutex;
+    std::condition_variable changed;
+    std::deque<handle>      ready;  // for the calling thread
+    std::vector<uint32_t>   waiting(m_tasks.size());
+    std::vector<bool>       skipped(m_tasks.size(), false);
+    size_t                  finished = 0;
+    std::exception_ptr      error;
+    counter                 group;
+
+    std::function<void(handle)> execute;
+
+    // Both with the mutex held
+    auto start = [&](handle h) {
+        if (m_tasks[h].worker) {
+            jobs.run(group, [&execute, h]() { execute(h); });
+        } else {
+            ready.push_back(h);
+            changed.notify_all();
+        }
+    };
+    std::function<void(handle, bool)> complete = [&](handle h, bool ran) {
+        ++finished;
+        for (handle dependent : m_tasks[h].dependents) {
+            skipped[dependent] = skipped[dependent] || !ran;
+            if (--waiting[dependent] > 0) {
+                continue;
+            }
+            if (skipped[dependent]) {
+                complete(dependent, false);
+            } else {
+                start(dependent);
+            }
+        }
+        changed.notify_all();
+    };
+
+    execute = [&](handle h) {
+        bool ran = true;
+        try {
+            runTask(h);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            ran = false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        complete(h, ran);
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (handle h = 0; h < (handle)m_tasks.size(); ++h) {
+            waiting[h] = m_tasks[h].dependencies;
+        }
+        for (handle h = 0; h < (handle)m_tasks.size(); ++h) {
+            if (waiting[h] == 0) {
+                start(h);
+            }
+        }
+    }
+
+    while (true) {
+        handle next = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return !ready.empty() || finished == m_tasks.size(); });
+            if (ready.empty()) {
+                break;
+            }
+            next = ready.front();
+            ready.pop_front();
+        }
+        execute(next);
+    }
+
+    // The last jobs may still be on their way out of execute()
+    jobs.wait(group);
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void
+task_graph::runTask(handle h)
+{
+    const core::startup_scope scope(m_report, "stage", m_tasks[h].name);
+    m_tasks[h].work();
+}
+
+}  // namespace shiny::jobs
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "core/startup_report.h"
+#include "jobs/scheduler.h"
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+namespace shiny::jobs {
+
+/*
+Steps that depend on each other, each run as soon as everything it depends on is done, for work
+like initialization that is a long list of steps of which only some need each other.
+
+Steps that touch anything that isn't thread safe run on the thread calling run(), one at a time,
+in the order they became ready. The others are jobs on the scheduler and run alongside them, so
+for example decoding an asset overlaps with creating whatever doesn't need it.
+
+Steps may throw: whatever depends on a step that threw is skipped, and once the steps that were
+already running are done run() rethrows the first exception.
+*/
+class task_graph
+{
+public:
+    using handle = uint32_t;
+
+    // `after` are steps added before, so the order of adding is always one they can run in.
+    // `name` isn't copied.
+    handle add(const char*                   name,
+               std::function<void()>         work,
+               std::initializer_list<handle> after  = {},
+               bool                          worker = false);
+
+    // Every step in the order they were added, on the calling thread, unless `parallel`
+    void run(scheduler& jobs, bool parallel = true);
+
+    // Records every step run() runs into `report`, as a "stage" named after it
+    void setReport(core::startup_report* report) { m_report = report; }
+
+private:
+    struct task
+    {
+        const char*           name = nullptr;
+        std::function<void()> work;
+        std::vector<handle>   dependents;
+        uint32_t              dependencies = 0;
+        bool                  worker       = false;
+    };
+
+    void runTask(handle h);
+
+    std::vector<task>     m_tasks;
+    core::startup_report* m_report = nullptr;
+};
+
+}  // namespace shiny::jobs
@@ -1,26 +1,714 @@
 #define GLFW_INCLUDE_VULKAN
-#include <FreeImage.h>
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
+#include <core/asset_package.h>
+#include <core/cpu_topology.h>
+#include <core/logger.h>
+#include <core/telemetry.h>
+#include <core/transform_math.h>
+#include <graphics/frame_readback.h>
+#include <graphics/impostor_cook.h>
+#include <graphics/obj_importer.h>
+#include <graphics/render_batch.h>
 #include <graphics/renderer.h>
+#include <graphics/texture_cook.h>
 //#include <renderer.h>
 //#include <vk/instance.h>
 //#include <window.h>
 
+namespace {
+
+const char* const usage =
+  "usage: shiny [--benchmark [--frames N | --seconds T] [--warmup N] [--output FILE]]\n"
+  "             [--offscreen IMAGE [--frames N] [--width W] [--height H] [--device-group]]\n"
+  "             [--batch LIST [--batch-chunk N] [--encoders N] [--width W] [--height H]]\n"
+  "             [--present-mode fifo|fifo-relaxed|mailbox|immediate] [--frames-in-flight N]\n"
+  "             [--low-latency] [--max-fps N] [--background-fps N] [--msaa N] [--overdraw]\n"
+  "             [--dynamic-resolution BUDGET_MS [--min-scale S]] [--temporal [--render-scale S]]\n"
+  "             [--stereo [--eye-separation M]] [--viewports N] [--depth16]\n"
+  "             [--post [--exposure E] [--bloom I] [--bloom-threshold T] [--vignette V]]\n"
+  "             [--shading-rate [--shading-quality Q] [--no-adaptive-shading]]\n"
+  "             [--device NAME|VENDOR_ID|#N] [--validation | --no-validation] [--serial-init]\n"
+  "             [--fast-start] [--package FILE ...] [--hot-reload] [--vertex-pulling]\n"
+  "             [--cached-draws] [--lights N] [--shadows] [--depth-prepass] [--deferred]\n"
+  "             [--light-volumes] [--reflection-probes N [--whole-probes]] [--no-half-precision]\n"
+  "             [--fixed-rate-compression] [--particles N] [--skinned N] [--entities N]\n"
+  "             [--debug-draw] [--hud] [--render-thread] [--present-thread]\n"
+  "             [--occlusion-queries] [--cells FILE]\n"
+  "             [--terrain FILE [--vegetation DENSITY [--vegetation-range R]\n"
+  "              [--vegetation-seed N]]] [--impostors FILE [--impostor-pixels P]]\n"
+  "             [--track-allocations | --check-allocations] [--descriptor-buffers]\n"
+  "             [--no-host-allocator] [--render-scene] [--defragment] [--virtual-textures]\n"
+  "             [--transform-simd scalar|sse2|avx2|neon]\n"
+  "             [--performance-cpus LIST] [--efficiency-cpus LIST] [--no-affinity]\n"
+  "             [--stress-scene COLUMNSxROWSxLAYERS [--stress-moving SHARE]\n"
+  "              [--stress-textures N] [--stress-spacing S]]\n"
+  "             [--capture FILE | --replay FILE] [--scene FILE]\n"
+  "             [--log-level debug|info|warning|error]\n"
+  "             [--screenshots] [--record FILE [--record-rgba]] [--picking] [--on-demand]\n"
+  "             [--shader-features texture,vertex-color,alpha-test,texcoords,lighting,shadows]\n"
+  "             [--counters TERM,TERM,...] [--telemetry PORT]\n"
+  "             [--quality low|medium|high|ultra|auto]\n"
+  "             [--calibration FILE | --no-calibration] [--recalibrate]\n"
+  "       shiny --cook MODEL [--cook MODEL ...]\n"
+  "       shiny --cook-virtual TEXTURE [--cook-virtual TEXTURE ...]\n"
+  "       shiny --cook-terrain HEIGHTMAP [--terrain-spacing S] [--terrain-height H]\n"
+  "       shiny --cook-impostors FILE [scene options]\n"
+  "       shiny --cook-scene FILE [scene options]\n"
+  "       shiny --telemetry-record HOST:PORT TRACE [--seconds T]";
+
+// The value after option `i`, moving past it
+std::string
+optionValue(int argc, char** argv, int& i)
+{
+    if (i + 1 >= argc) {
+        throw std::runtime_error(std::string("Missing value for ") + argv[i] + "\n" + usage);
+    }
+    return argv[++i];
+}
+
+double
+numberValue(int argc, char** argv, int& i)
+{
+    const std::string option = argv[i];
+    const std::string value  = optionValue(argc, argv, i);
+    try {
+        const double number = std::stod(value);
+        if (number >= 0.) {
+            return number;
+        }
+    } catch (const std::logic_error&) {
+    }
+    throw std::runtime_error("Invalid value for " + option + ": " + value + "\n" + usage);
+}
+
+vk::PresentModeKHR
+presentModeValue(int argc, char** argv, int& i)
+{
+    const std::string value = optionValue(argc, argv, i);
+    if (value == "fifo") {
+        return vk::PresentModeKHR::eFifo;
+    } else if (value == "fifo-relaxed") {
+        return vk::PresentModeKHR::eFifoRelaxed;
+    } else if (value == "mailbox") {
+        return vk::PresentModeKHR::eMailbox;
+    } else if (value == "immediate") {
+        return vk::PresentModeKHR::eImmediate;
+    }
+    throw std::runtime_error("Invalid value for --present-mode: " + value + "\n" + usage);
+}
+
+shiny::core::log_level
+logLevelValue(int argc, char** argv, int& i)
+{
+    using shiny::core::log_level;
+
+    const std::string value = optionValue(argc, argv, i);
+    if (value == "debug") {
+        return log_level::debug;
+    } else if (value == "info") {
+        return log_level::info;
+    } else if (value == "warning") {
+        return log_level::warning;
+    } else if (value == "error") {
+        return log_level::error;
+    }
+    throw std::runtime_error("Invalid value for --log-level: " + value + "\n" + usage);
+}
+
+shiny::core::simd_level
+simdValue(int argc, char** argv, int& i)
+{
+    using shiny::core::simd_level;
+
+    const std::string value = optionValue(argc, argv, i);
+    for (simd_level level :
+         { simd_level::scalar, simd_level::sse2, simd_level::avx2, simd_level::neon }) {
+        if (value == shiny::core::simdName(level)) {
+            return level;
+        }
+    }
+    throw std::runtime_error("Invalid value for --transform-simd: " + value + "\n" + usage);
+}
+
+// The logical processors of --performance-cpus and --efficiency-cpus, e.g. "0-7,16"
+std::vector<uint32_t>
+cpusValue(int argc, char** argv, int& i)
+{
+    const std::string     option = argv[i];
+    const std::string     value  = optionValue(argc, argv, i);
+    std::vector<uint32_t> cpus;
+    if (!shiny::core::parseCpuList(value, cpus)) {
+        throw std::runtime_error("Invalid value for " + option + ": " + value + "\n" + usage);
+    }
+    return cpus;
+}
+
+// The grid of --stress-scene, e.g. "64x64x4"
+void
+gridValue(int argc, char** argv, int& i, shiny::graphics::stress_scene_settings& stress)
+{
+    const std::string option = argv[i];
+    const std::string value  = optionValue(argc, argv, i);
+
+    uint32_t* const sizes[3] = { &stress.columns, &stress.rows, &stress.layers };
+
+    size_t start = 0;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        const size_t end = axis < 2 ? value.find('x', start) : value.size();
+        if (end == std::string::npos || end == start
+            || value.find_first_not_of("0123456789", start) < end) {
+            throw std::runtime_error("Invalid value for " + option + ": " + value + "\n" + usage);
+        }
+        *sizes[axis] = (uint32_t)std::stoul(value.substr(start, end - start));
+        start        = end + 1;
+    }
+}
+
+// A comma separated list, e.g. "hit rate,alu"
+std::vector<std::string>
+listValue(int argc, char** argv, int& i)
+{
+    const std::string value = optionValue(argc, argv, i);
+
+    std::vector<std::string> items;
+    size_t                   start = 0;
+    while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        if (end > start) {
+            items.push_back(value.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+// A comma separated list of shader features, e.g. "texture,vertex-color"
+uint32_t
+shaderFeaturesValue(int argc, char** argv, int& i)
+{
+    using shiny::graphics::shader_feature;
+
+    const std::string value = optionValue(argc, argv, i);
+
+    shiny::graphics::pipeline_state state;
+    state.features = 0;
+
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        const std::string name = value.substr(start, end - start);
+        if (name == "texture") {
+            state.enable(shader_feature::texture);
+        } else if (name == "vertex-color") {
+            state.enable(shader_feature::vertex_color);
+        } else if (name == "alpha-test") {
+            state.enable(shader_feature::alpha_test);
+        } else if (name == "texcoords") {
+            state.enable(shader_feature::texcoords);
+        } else if (name == "lighting") {
+            state.enable(shader_feature::lighting);
+        } else if (name == "shadows") {
+            state.enable(shader_feature::shadows);
+        } else if (!name.empty()) {
+            throw std::runtime_error("Unknown shader feature " + name + "\n" + usage);
+        }
+        start = end + 1;
+    }
+    return state.features;
+}
+
+/*
+Imports every model and writes its mesh cache, without creating a window or a device, so that the
+renderer only has to read the caches
+*/
+void
+cookModels(const std::vector<std::string>& paths)
+{
+    shiny::jobs::scheduler jobs;
+    jobs.init();
+
+    for (const std::string& path : paths) {
+        shiny::graphics::Mesh mesh;
+        if (!shiny::graphics::cookObj(path, jobs, mesh)) {
+            throw std::runtime_error("Failed to cook " + path);
+        }
+        std::cout << "Cooked " << path << ": " << mesh.vertices.size() << " vertices, "
+                  << mesh.indices.size() / 3 << " triangles" << std::endl;
+    }
+
+    jobs.shutdown();
+}
+
+// Tiles every texture into the virtual texture file --virtual-textures draws it from
+void
+cookVirtualTextures(const std::vector<std::string>& paths)
+{
+    shiny::jobs::scheduler jobs;
+    jobs.init();
+
+    for (const std::string& path : paths) {
+        if (!shiny::graphics::cookVirtualTexture(path, jobs)) {
+            throw std::runtime_error("Failed to cook " + path);
+        }
+        std::cout << "Cooked " << shiny::graphics::virtualTexturePath(path) << std::endl;
+    }
+
+    jobs.shutdown();
+}
+
+// Tiles every heightmap into the terrain file --terrain draws
+void
+cookTerrains(const std::vector<std::string>& paths, float spacing, float height)
+{
+    for (const std::string& path : paths) {
+        if (!shiny::graphics::cookTerrain(path, spacing, height)) {
+            throw std::runtime_error("Failed to cook " + path);
+        }
+        std::cout << "Cooked " << shiny::graphics::terrainPath(path) << std::endl;
+    }
+}
+
+}  // namespace
+
 int
-main()
+main(int argc, char** argv)
 {
     shiny::graphics::renderer renderer;
 
     try {
+        bool                                   benchmark = false;
+        bool                                   frames    = false;  // given on the command line
+        shiny::graphics::benchmark_settings    settings;
+        shiny::graphics::offscreen_settings    offscreen;
+        shiny::graphics::batch_settings        batch;
+        shiny::graphics::pacing_settings       pacing;
+        shiny::graphics::resolution_settings   resolution;
+        shiny::graphics::temporal_settings     temporal;
+        shiny::graphics::post_settings         post;
+        shiny::graphics::shading_rate_settings shading;
+        shiny::graphics::stereo_settings       stereo;
+        uint32_t                               viewports = 0;
+        shiny::graphics::stress_scene_settings stress;
+        shiny::graphics::vegetation_settings   vegetation;
+        shiny::graphics::video_settings        video;
+        std::string                            image;
+        std::vector<std::string>               cook;
+        std::vector<std::string>               cookvirtual;
+        std::vector<std::string>               cookterrain;
+        float                                  terrainspacing = 1.f;
+        float                                  terrainheight  = 100.f;
+        std::string                            impostors;
+        std::string                            cookimpostors;
+        std::string                            cookscene;
+        float                                  impostorpixels = 32.f;
+        uint32_t                               reflectionprobes = 0;
+        bool                                   wholeprobes      = false;
+        std::string                            telemetryhost;
+        uint16_t                               telemetryport = 0;
+        std::string                            telemetrytrace;
+        std::string                            quality;
+        std::string                            calibration = "calibration.json";
+        bool                                   recalibrate = false;
+
+        // --msaa over the quality tier's sample count
+        std::optional<uint32_t> msaa;
+
+        // Instead of the one detected
+        std::optional<shiny::core::cpu_topology> topology;
+
+        for (int i = 1; i < argc; ++i) {
+            const std::string option = argv[i];
+            if (option == "--benchmark") {
+                benchmark = true;
+            } else if (option == "--frames") {
+                settings.frames = (uint32_t)numberValue(argc, argv, i);
+                frames          = true;
+            } else if (option == "--seconds") {
+                settings.seconds = (float)numberValue(argc, argv, i);
+            } else if (option == "--warmup") {
+                settings.warmup_frames = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--output") {
+                settings.output = optionValue(argc, argv, i);
+            } else if (option == "--offscreen") {
+                image = optionValue(argc, argv, i);
+            } else if (option == "--batch") {
+                batch.list = optionValue(argc, argv, i);
+            } else if (option == "--batch-chunk") {
+                // The same for every renderer of a list
+                batch.chunk = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--encoders") {
+                batch.encoders = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--width") {
+                offscreen.width = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--height") {
+                offscreen.height = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--overdraw") {
+                renderer.showOverdraw(true);
+            } else if (option == "--present-mode") {
+                // Falls back to FIFO, which every surface supports
+                pacing.present_modes = { presentModeValue(argc, argv, i) };
+            } else if (option == "--frames-in-flight") {
+                pacing.frames_in_flight = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--max-fps") {
+                pacing.max_fps = (float)numberValue(argc, argv, i);
+            } else if (option == "--background-fps") {
+                pacing.background_fps = (float)numberValue(argc, argv, i);
+            } else if (option == "--low-latency") {
+                pacing.low_latency = true;
+            } else if (option == "--dynamic-resolution") {
+                resolution.dynamic   = true;
+                resolution.budget_ms = (float)numberValue(argc, argv, i);
+            } else if (option == "--min-scale") {
+                resolution.min_scale = (float)numberValue(argc, argv, i);
+            } else if (option == "--temporal") {
+                temporal.enabled = true;
+            } else if (option == "--render-scale") {
+                // Throughout with --temporal, where dynamic resolution starts otherwise
+                resolution.max_scale = (float)numberValue(argc, argv, i);
+            } else if (option == "--post") {
+                post.enabled = true;
+            } else if (option == "--exposure") {
+                post.exposure = (float)numberValue(argc, argv, i);
+            } else if (option == "--bloom") {
+                post.bloom_intensity = (float)numberValue(argc, argv, i);
+            } else if (option == "--bloom-threshold") {
+                post.bloom_threshold = (float)numberValue(argc, argv, i);
+            } else if (option == "--vignette") {
+                post.vignette = (float)numberValue(argc, argv, i);
+            } else if (option == "--shading-rate") {
+                shading.enabled = true;
+            } else if (option == "--shading-quality") {
+                shading.quality = (float)numberValue(argc, argv, i);
+            } else if (option == "--no-adaptive-shading") {
+                // The materials' rates alone
+                shading.adaptive = false;
+            } else if (option == "--validation") {
+                renderer.setValidation(true);
+            } else if (option == "--no-validation") {
+                // For profiling builds that have them on by default
+                renderer.setValidation(false);
+            } else if (option == "--serial-init") {
+                renderer.setParallelInit(false);
+            } else if (option == "--cook") {
+                cook.push_back(optionValue(argc, argv, i));
+            } else if (option == "--cook-virtual") {
+                cookvirtual.push_back(optionValue(argc, argv, i));
+            } else if (option == "--cook-terrain") {
+                cookterrain.push_back(optionValue(argc, argv, i));
+            } else if (option == "--terrain-spacing") {
+                terrainspacing = (float)numberValue(argc, argv, i);
+            } else if (option == "--terrain-height") {
+                terrainheight = (float)numberValue(argc, argv, i);
+            } else if (option == "--package") {
+                // Before anything is loaded, which is only once the options are all read
+                const std::string package = optionValue(argc, argv, i);
+                if (!shiny::core::mountPackage(package)) {
+                    throw std::runtime_error("Failed to mount package " + package);
+                }
+            } else if (option == "--fast-start") {
+                renderer.setFastStart(true);
+            } else if (option == "--telemetry") {
+                renderer.setTelemetry((uint16_t)numberValue(argc, argv, i));
+            } else if (option == "--telemetry-record") {
+                // Of a renderer started with --telemetry, for as long as --seconds or it runs
+                const std::string address = optionValue(argc, argv, i);
+                const size_t      colon   = address.rfind(':');
+                if (colon == std::string::npos || colon == 0) {
+                    throw std::runtime_error("Invalid value for --telemetry-record: " + address
+                                             + "\n" + usage);
+                }
+                telemetryhost  = address.substr(0, colon);
+                telemetryport  = (uint16_t)std::stoul(address.substr(colon + 1));
+                telemetrytrace = optionValue(argc, argv, i);
+            } else if (option == "--hot-reload") {
+                renderer.setHotReload(true);
+            } else if (option == "--vertex-pulling") {
+                renderer.setVertexPulling(true);
+            } else if (option == "--no-half-precision") {
+                renderer.setHalfPrecision(false);
+            } else if (option == "--fixed-rate-compression") {
+                renderer.setFramebufferCompression(
+                  shiny::graphics::framebuffer_compression::fixed_rate);
+            } else if (option == "--descriptor-buffers") {
+                renderer.setDescriptorBuffers(true);
+            } else if (option == "--cached-draws") {
+                renderer.setCachedDraws(true);
+            } else if (option == "--lights") {
+                renderer.setLights((uint32_t)numberValue(argc, argv, i));
+            } else if (option == "--shadows") {
+                renderer.setShadows(true);
+            } else if (option == "--depth-prepass") {
+                renderer.setDepthPrepass(true);
+            } else if (option == "--deferred") {
+                renderer.setDeferredShading(true);
+            } else if (option == "--light-volumes") {
+                renderer.setLightVolumes(true);
+            } else if (option == "--reflection-probes") {
+                reflectionprobes = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--whole-probes") {
+                wholeprobes = true;
+            } else if (option == "--occlusion-queries") {
+                renderer.setOcclusionQueries(true);
+            } else if (option == "--cells") {
+                renderer.setPortals(shiny::graphics::readPortalGraph(optionValue(argc, argv, i)));
+            } else if (option == "--terrain") {
+                renderer.setTerrain(optionValue(argc, argv, i));
+            } else if (option == "--vegetation") {
+                // Tufts a square world unit where the terrain is flat and low
+                vegetation.density = (float)numberValue(argc, argv, i);
+            } else if (option == "--vegetation-range") {
+                vegetation.range = (float)numberValue(argc, argv, i);
+            } else if (option == "--vegetation-seed") {
+                vegetation.seed = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--impostors") {
+                impostors = optionValue(argc, argv, i);
+            } else if (option == "--impostor-pixels") {
+                // Instances less than this many pixels across on screen are drawn as impostors
+                impostorpixels = (float)numberValue(argc, argv, i);
+            } else if (option == "--cook-impostors") {
+                // Of the scene the rest of the options set up, which drawing them should match
+                cookimpostors = optionValue(argc, argv, i);
+            } else if (option == "--particles") {
+                renderer.setParticles((uint32_t)numberValue(argc, argv, i));
+            } else if (option == "--skinned") {
+                renderer.setSkinnedInstances((uint32_t)numberValue(argc, argv, i));
+            } else if (option == "--entities") {
+                renderer.setEntities((uint32_t)numberValue(argc, argv, i));
+            } else if (option == "--stress-scene") {
+                gridValue(argc, argv, i, stress);
+            } else if (option == "--stress-moving") {
+                stress.moving = (float)numberValue(argc, argv, i);
+            } else if (option == "--stress-textures") {
+                stress.textures = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--stress-spacing") {
+                stress.spacing = (float)numberValue(argc, argv, i);
+            } else if (option == "--capture") {
+                renderer.setCapture(optionValue(argc, argv, i));
+            } else if (option == "--replay") {
+                // With the same scene options it was captured with
+                renderer.setReplay(optionValue(argc, argv, i));
+            } else if (option == "--scene") {
+                renderer.setScene(optionValue(argc, argv, i));
+            } else if (option == "--cook-scene") {
+                // Of the entities the rest of the options set up
+                cookscene = optionValue(argc, argv, i);
+            } else if (option == "--screenshots") {
+                renderer.setScreenshots(true);
+            } else if (option == "--record") {
+                video.sink =
+                  std::make_shared<shiny::graphics::raw_video_sink>(optionValue(argc, argv, i));
+            } else if (option == "--record-rgba") {
+                video.nv12 = false;
+            } else if (option == "--picking") {
+                renderer.setPicking(true);
+            } else if (option == "--render-scene") {
+                renderer.setRenderScene(true);
+            } else if (option == "--defragment") {
+                renderer.setDefragmentation(true);
+            } else if (option == "--virtual-textures") {
+                renderer.setVirtualTextures(true);
+            } else if (option == "--transform-simd") {
+                // Falls back to the best the CPU has
+                shiny::core::setTransformSimd(simdValue(argc, argv, i));
+            } else if (option == "--performance-cpus") {
+                topology              = topology.value_or(shiny::core::cpuTopology());
+                topology->performance = cpusValue(argc, argv, i);
+            } else if (option == "--efficiency-cpus") {
+                topology             = topology.value_or(shiny::core::cpuTopology());
+                topology->efficiency = cpusValue(argc, argv, i);
+            } else if (option == "--no-affinity") {
+                // Every thread runs wherever, as on a CPU whose cores are all alike
+                topology = shiny::core::cpu_topology();
+            } else if (option == "--stereo") {
+                stereo.enabled = true;
+            } else if (option == "--eye-separation") {
+                stereo.eye_separation = (float)numberValue(argc, argv, i);
+            } else if (option == "--viewports") {
+                // Windows of their own that look at the scene from the front, the side and above
+                viewports = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--debug-draw") {
+                renderer.setDebugDraw(true);
+            } else if (option == "--hud") {
+                renderer.setHud(true);
+            } else if (option == "--render-thread") {
+                renderer.setRenderThread(true);
+            } else if (option == "--present-thread") {
+                renderer.setPresentThread(true);
+            } else if (option == "--on-demand") {
+                renderer.setOnDemand(true);
+            } else if (option == "--no-host-allocator") {
+                // Leaves the driver's host allocations to the driver
+                renderer.setHostAllocator(false);
+            } else if (option == "--track-allocations") {
+                renderer.setAllocationTracking(true);
+            } else if (option == "--check-allocations") {
+                // Fails on a steady frame that allocates at all
+                renderer.setAllocationChecks(true);
+            } else if (option == "--shader-features") {
+                // Only those given, so an empty list draws plain white
+                renderer.setShaderFeatures(shaderFeaturesValue(argc, argv, i));
+            } else if (option == "--counters") {
+                // Those whose name or category contains one of them, ignoring case
+                renderer.setHardwareCounters(listValue(argc, argv, i));
+            } else if (option == "--log-level") {
+                // Validation messages included, and debug asks the layers for all of theirs
+                shiny::core::setLogLevel(logLevelValue(argc, argv, i));
+            } else if (option == "--device") {
+                renderer.setDevice(optionValue(argc, argv, i));
+            } else if (option == "--device-group") {
+                // Only for --offscreen, on GPUs that are linked
+                renderer.setDeviceGroup(true);
+            } else if (option == "--msaa") {
+                // 1 for none, 0 for the most the device supports
+                msaa = (uint32_t)numberValue(argc, argv, i);
+            } else if (option == "--quality") {
+                // auto for what the last benchmark's --output recommends
+                quality = optionValue(argc, argv, i);
+            } else if (option == "--calibration") {
+                calibration = optionValue(argc, argv, i);
+            } else if (option == "--no-calibration") {
+                calibration.clear();
+            } else if (option == "--recalibrate") {
+                // Even if the GPU and driver are the ones calibrated for
+                recalibrate = true;
+            } else if (option == "--depth16") {
+                renderer.setDepth16(true);
+            } else {
+                throw std::runtime_error("Unknown option " + option + "\n" + usage);
+            }
+        }
+
+        if (!cook.empty() || !cookvirtual.empty() || !cookterrain.empty()) {
+            cookModels(cook);
+            cookVirtualTextures(cookvirtual);
+            cookTerrains(cookterrain, terrainspacing, terrainheight);
+            return EXIT_SUCCESS;
+        }
+
+        if (!telemetrytrace.empty()) {
+            if (!shiny::core::recordTelemetry(telemetryhost, telemetryport, telemetrytrace,
+                                              settings.seconds)) {
+                throw std::runtime_error("Failed to record telemetry from " + telemetryhost);
+            }
+            std::cout << "Recorded " << telemetrytrace << std::endl;
+            return EXIT_SUCCESS;
+        }
+
+        if (topology) {
+            shiny::core::setCpuTopology(*topology);
+        }
+
+        renderer.setPacing(pacing);
+        renderer.setResolution(resolution);
+        if (!quality.empty()) {
+            shiny::graphics::quality_tier tier = shiny::graphics::quality_tier::high;
+            if (quality == "auto") {
+                if (!shiny::graphics::readRecommendedQualityTier(settings.output, tier)) {
+                    shiny::core::logInfo() << "No recommended quality in " << settings.output
+                                           << ", run --benchmark first";
+                }
+            } else if (!shiny::graphics::parseQualityTier(quality, tier)) {
+                throw std::runtime_error("Invalid value for --quality: " + quality + "\n" + usage);
+            }
+            renderer.setQualityTier(tier);
+        }
+        if (msaa) {
+            renderer.setMultisampling(*msaa);
+        }
+        renderer.setTemporal(temporal);
+        renderer.setPostProcessing(post);
+        renderer.setShadingRate(shading);
+        renderer.setStereo(stereo);
+
+        const glm::vec3 viewpoints[] = { glm::vec3(4.f, 0.f, 1.f), glm::vec3(0.f, 4.f, 1.f),
+                                         glm::vec3(1.f, 0.f, 5.f) };
+        for (uint32_t v = 0; v < viewports; ++v) {
+            shiny::graphics::viewport_settings viewport;
+            viewport.title           = "Viewport " + std::to_string(v + 1);
+            viewport.camera_position = viewpoints[v % 3];
+            renderer.addViewport(viewport);
+        }
+        renderer.setStressScene(stress);
+        renderer.setVegetation(vegetation);
+        renderer.setVideoCapture(video);
+        if (!impostors.empty()) {
+            renderer.setImpostors(impostors, impostorpixels);
+        }
+        if (reflectionprobes > 0) {
+            // On a ring around the scene, a little above the ground, each reaching its neighbours
+            shiny::graphics::reflection_probe_settings probes;
+            probes.whole_probes = wholeprobes;
+            for (uint32_t p = 0; p < reflectionprobes; ++p) {
+                const float angle = 6.2831853f * (float)p / (float)reflectionprobes;
+                shiny::graphics::reflection_probe probe;
+                probe.position = glm::vec3(4.f * std::cos(angle), 4.f * std::sin(angle), 1.f);
+                probe.radius   = 4.f;
+                probes.probes.push_back(probe);
+            }
+            renderer.setReflectionProbes(probes);
+        }
+
         // while (shiny::renderer::singleton().glfw_window().close_window() == false) {
         //    shiny::renderer::singleton().glfw_window().poll_events();
         //}
-        renderer.run();
+        if (!cookimpostors.empty()) {
+            shiny::graphics::cookImpostors(renderer, cookimpostors);
+            std::cout << "Cooked " << cookimpostors << std::endl;
+        } else if (!cookscene.empty()) {
+            // Once the first frame is ready to go the scene is all there, so none is rendered
+            bool                                saved = false;
+            shiny::graphics::offscreen_settings cooking;
+            cooking.prepare = [&](uint64_t) {
+                saved = renderer.saveScene(cookscene);
+                return false;
+            };
+            renderer.renderOffscreen(cooking);
+            if (!saved) {
+                throw std::runtime_error("Failed to save " + cookscene);
+            }
+            std::cout << "Cooked " << cookscene << std::endl;
+        } else if (benchmark) {
+            renderer.benchmark(settings);
+        } else if (!batch.list.empty()) {
+            batch.width  = offscreen.width;
+            batch.height = offscreen.height;
+            const uint64_t rendered = shiny::graphics::renderBatch(renderer, batch);
+            std::cout << "Rendered " << rendered << " frames of " << batch.list << std::endl;
+        } else if (!image.empty()) {
+            // Only the last frame is kept, so animation and streaming have had time to settle
+            offscreen.frames  = frames ? std::max(settings.frames, 1u) : 1;
+            offscreen.deliver = [&](const shiny::graphics::offscreen_frame& frame) {
+                if (frame.number + 1 == offscreen.frames) {
+                    if (!shiny::graphics::writeImageFile(image, frame)) {
+                        throw std::runtime_error("Failed to save " + image);
+                    }
+                }
+            };
+            renderer.renderOffscreen(offscreen);
+        } else {
+            // Calibrates first if this GPU and driver haven't been yet
+            renderer.setCalibration(calibration, recalibrate);
+            renderer.run();
+        }
     } catch (const std::runtime_error& e) {
+        // After whatever was logged before it
+        shiny::core::stopLogging();
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
     }
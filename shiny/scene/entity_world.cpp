@@ -0,0 +1,373 @@
+#include "scene/entity_world.h"
+
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+
+// Large enough for a few hundred entities of most archetypes, small enough that a sparse one
+// doesn't waste much
+const size_t chunk_size = 16 * 1024;
+
+struct component_type
+{
+    size_t size      = 0;
+    size_t alignment = 0;
+};
+
+struct component_registry
+{
+    std::mutex                  mutex;
+    std::vector<component_type> types;
+};
+
+component_registry&
+registry()
+{
+    static component_registry r;
+    return r;
+}
+
+component_type
+typeOf(uint32_t id)
+{
+    component_registry&         r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return r.types[id];
+}
+
+size_t
+alignUp(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+}  // namespace
+
+namespace shiny::scene {
+
+uint32_t
+registerComponent(size_t size, size_t alignment)
+{
+    component_registry&         r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (r.types.size() >= max_component_types) {
+        throw std::runtime_error("Too many component types, at most 64 are supported!");
+    }
+    r.types.push_back({ size, alignment });
+    return (uint32_t)r.types.size() - 1;
+}
+
+/*
+A chunk's arrays are laid out one after the other, each aligned for its type, for as many entities
+as fit. Fitting as many as the sum of the row sizes says and then taking one away until the
+alignment padding fits as well is at most a few tries.
+*/
+uint32_t
+entity_world::archetypeOf(component_mask mask)
+{
+    const auto found = m_archetype_index.find(mask);
+    if (found != m_archetype_index.end()) {
+        return found->second;
+    }
+
+    entity_archetype archetype;
+    archetype.mask = mask;
+    archetype.slots.fill(entity_archetype::no_slot);
+
+    std::vector<component_type> types;
+    size_t                      rowsize = sizeof(entity);
+    for (uint32_t id = 0; id < max_component_types; ++id) {
+        if (mask & (component_mask(1) << id)) {
+            archetype.slots[id] = (uint8_t)archetype.components.size();
+            archetype.components.push_back(id);
+            types.push_back(typeOf(id));
+            archetype.sizes.push_back(types.back().size);
+            rowsize += types.back().size + sizeof(uint32_t);
+        }
+    }
+
+    for (uint32_t capacity = (uint32_t)(chunk_size / rowsize); capacity > 0; --capacity) {
+        archetype.offsets.clear();
+        archetype.version_offsets.clear();
+
+        size_t offset = 0;
+        for (const component_type& type : types) {
+            offset = alignUp(offset, type.alignment);
+            archetype.offsets.push_back(offset);
+            offset += type.size * capacity;
+        }
+        for (size_t i = 0; i < types.size(); ++i) {
+            offset = alignUp(offset, alignof(uint32_t));
+            archetype.version_offsets.push_back(offset);
+            offset += sizeof(uint32_t) * capacity;
+        }
+        offset                  = alignUp(offset, alignof(entity));
+        archetype.entity_offset = offset;
+        offset += sizeof(entity) * capacity;
+
+        if (offset <= chunk_size) {
+            archetype.capacity = capacity;
+            break;
+        }
+    }
+    if (archetype.capacity == 0) {
+        throw std::runtime_error("An entity's components don't fit in a chunk!");
+    }
+
+    m_archetypes.push_back(std::move(archetype));
+    m_archetype_index[mask] = (uint32_t)m_archetypes.size() - 1;
+    return (uint32_t)m_archetypes.size() - 1;
+}
+
+// At the end of the archetype's last chunk, with every component counting as changed. The
+// components themselves are left for the caller to fill in.
+void
+entity_world::insert(entity e, uint32_t archetypeindex)
+{
+    entity_archetype& archetype = m_archetypes[archetypeindex];
+    if (archetype.chunks.empty() || archetype.chunks.back().count == archetype.capacity) {
+        entity_chunk chunk;
+        chunk.memory = std::make_unique<std::byte[]>(chunk_size);
+        chunk.versions.assign(archetype.components.size(), 0);
+        archetype.chunks.push_back(std::move(chunk));
+    }
+
+    entity_chunk&  chunk = archetype.chunks.back();
+    const uint32_t row   = chunk.count++;
+
+    archetype.entities(chunk)[row] = e;
+    for (uint32_t slot = 0; slot < archetype.components.size(); ++slot) {
+        archetype.versions(chunk, slot)[row] = m_version;
+        chunk.versions[slot]                 = m_version;
+    }
+
+    record& r   = m_records[e.index];
+    r.archetype = archetypeindex;
+    r.chunk     = (uint32_t)archetype.chunks.size() - 1;
+    r.row       = row;
+}
+
+/*
+As many new entities as fit in the archetype's last chunk, up to `wanted`, or in a new one if it is
+full, like insert() does one at a time. Returns how many, and where the first of them is.
+*/
+uint32_t
+entity_world::appendRows(uint32_t archetypeindex, uint32_t wanted, entity_chunk*& chunk,
+                         uint32_t& row)
+{
+    entity_archetype& archetype = m_archetypes[archetypeindex];
+    if (archetype.chunks.empty() || archetype.chunks.back().count == archetype.capacity) {
+        entity_chunk created;
+        created.memory = std::make_unique<std::byte[]>(chunk_size);
+        created.versions.assign(archetype.components.size(), 0);
+        archetype.chunks.push_back(std::move(created));
+    }
+
+    chunk                     = &archetype.chunks.back();
+    row                       = chunk->count;
+    const uint32_t rows       = std::min(wanted, archetype.capacity - row);
+    const uint32_t chunkindex = (uint32_t)archetype.chunks.size() - 1;
+
+    entity* entities = archetype.entities(*chunk);
+    for (uint32_t i = 0; i < rows; ++i) {
+        entity created;
+        if (!m_free.empty()) {
+            created.index = m_free.back();
+            m_free.pop_back();
+        } else {
+            created.index = (uint32_t)m_records.size();
+            m_records.emplace_back();
+        }
+
+        record& r          = m_records[created.index];
+        r.alive            = true;
+        r.archetype        = archetypeindex;
+        r.chunk            = chunkindex;
+        r.row              = row + i;
+        created.generation = r.generation;
+        entities[row + i]  = created;
+    }
+
+    for (uint32_t slot = 0; slot < archetype.components.size(); ++slot) {
+        uint32_t* versions = archetype.versions(*chunk, slot);
+        std::fill(versions + row, versions + row + rows, m_version);
+        chunk->versions[slot] = m_version;
+    }
+
+    chunk->count += rows;
+    m_alive += rows;
+    return rows;
+}
+
+// Moves the archetype's last entity into the place, which keeps the chunks full but for the last
+void
+entity_world::erase(const record& place)
+{
+    entity_archetype& archetype = m_archetypes[place.archetype];
+    entity_chunk&     chunk     = archetype.chunks[place.chunk];
+    entity_chunk&     last      = archetype.chunks.back();
+    const uint32_t    lastrow   = last.count - 1;
+
+    if (&chunk != &last || place.row != lastrow) {
+        for (uint32_t slot = 0; slot < archetype.components.size(); ++slot) {
+            const size_t size = archetype.sizes[slot];
+            std::memcpy(archetype.column(chunk, slot) + size * place.row,
+                        archetype.column(last, slot) + size * lastrow, size);
+
+            // It's a different entity in that row now, which is as good as a change
+            archetype.versions(chunk, slot)[place.row] = m_version;
+            chunk.versions[slot]                       = m_version;
+        }
+
+        const entity moved                   = archetype.entities(last)[lastrow];
+        archetype.entities(chunk)[place.row] = moved;
+        m_records[moved.index].chunk         = place.chunk;
+        m_records[moved.index].row           = place.row;
+    }
+
+    if (--last.count == 0) {
+        archetype.chunks.pop_back();
+    }
+}
+
+entity
+entity_world::createEntity(component_mask mask)
+{
+    entity created;
+    if (!m_free.empty()) {
+        created.index = m_free.back();
+        m_free.pop_back();
+    } else {
+        created.index = (uint32_t)m_records.size();
+        m_records.emplace_back();
+    }
+
+    record& r          = m_records[created.index];
+    r.alive            = true;
+    created.generation = r.generation;
+
+    insert(created, archetypeOf(mask));
+    ++m_alive;
+    return created;
+}
+
+void
+entity_world::destroy(entity e)
+{
+    if (!alive(e)) {
+        return;
+    }
+
+    record& r = m_records[e.index];
+    erase(r);
+    r.alive = false;
+    ++r.generation;
+    m_free.push_back(e.index);
+    m_destroyed.push_back({ e, m_version });
+    --m_alive;
+}
+
+bool
+entity_world::alive(entity e) const
+{
+    return e.index < m_records.size() && m_records[e.index].alive
+           && m_records[e.index].generation == e.generation;
+}
+
+component_mask
+entity_world::maskOf(entity e) const
+{
+    if (!alive(e)) {
+        throw std::runtime_error("Entity isn't alive!");
+    }
+    return m_archetypes[m_records[e.index].archetype].mask;
+}
+
+// The components both archetypes have are copied over, and count as changed like the new ones
+void
+entity_world::changeArchetype(entity e, component_mask mask)
+{
+    const record before = m_records[e.index];
+    if (m_archetypes[before.archetype].mask == mask) {
+        return;
+    }
+
+    const uint32_t target = archetypeOf(mask);
+    insert(e, target);
+
+    // Looking up the target may have added an archetype, so none are held on to before it
+    const entity_archetype& from      = m_archetypes[before.archetype];
+    entity_archetype&       to        = m_archetypes[target];
+    const record&           after     = m_records[e.index];
+    entity_chunk&           fromchunk = m_archetypes[before.archetype].chunks[before.chunk];
+    entity_chunk&           tochunk   = to.chunks[after.chunk];
+    for (uint32_t slot = 0; slot < to.components.size(); ++slot) {
+        const uint32_t id = to.components[slot];
+        if (from.slots[id] != entity_archetype::no_slot) {
+            const size_t size = to.sizes[slot];
+            std::memcpy(to.column(tochunk, slot) + size * after.row,
+                        from.column(fromchunk, from.slots[id]) + size * before.row, size);
+        }
+    }
+
+    erase(before);
+}
+
+const void*
+entity_world::component(entity e, uint32_t id) const
+{
+    if (!alive(e)) {
+        throw std::runtime_error("Entity isn't alive!");
+    }
+
+    const record&           r         = m_records[e.index];
+    const entity_archetype& archetype = m_archetypes[r.archetype];
+    const uint8_t           slot      = archetype.slots[id];
+    if (slot == entity_archetype::no_slot) {
+        throw std::runtime_error("Entity doesn't have that component!");
+    }
+
+    entity_chunk& chunk = const_cast<entity_chunk&>(archetype.chunks[r.chunk]);
+    return archetype.column(chunk, slot) + archetype.sizes[slot] * r.row;
+}
+
+void*
+entity_world::writeComponent(entity e, uint32_t id)
+{
+    const void*             memory    = component(e, id);
+    const record&           r         = m_records[e.index];
+    const entity_archetype& archetype = m_archetypes[r.archetype];
+    entity_chunk&           chunk     = m_archetypes[r.archetype].chunks[r.chunk];
+
+    const uint32_t slot = archetype.slots[id];
+
+    archetype.versions(chunk, slot)[r.row] = m_version;
+    chunk.versions[slot]                   = m_version;
+    return const_cast<void*>(memory);
+}
+
+uint32_t
+entity_world::advanceVersion()
+{
+    // Only what the consumer hasn't seen yet, which is everything since the last advance
+    m_destroyed.erase(std::remove_if(m_destroyed.begin(), m_destroyed.end(),
+                                     [&](const destroyed_entity& d) {
+                                         return d.version < m_version;
+                                     }),
+                      m_destroyed.end());
+    return m_version++;
+}
+
+void
+entity_world::destroyedSince(uint32_t since, std::vector<entity>& destroyed) const
+{
+    for (const destroyed_entity& d : m_destroyed) {
+        if (d.version > since) {
+            destroyed.push_back(d.e);
+        }
+    }
+}
+
+}  // namespace shiny::scene
@@ -0,0 +1,398 @@
+#pragma once
+
+#include "jobs/scheduler.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace shiny::scene {
+
+// An entity's index, and which of the entities that had that index it is, so that the handles of
+// destroyed entities don't refer to whatever reused their index
+struct entity
+{
+    uint32_t index      = std::numeric_limits<uint32_t>::max();
+    uint32_t generation = 0;
+
+    bool operator==(const entity& other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const entity& other) const { return !(*this == other); }
+};
+
+// One bit per component type, of the components an archetype has
+using component_mask = uint64_t;
+
+const uint32_t max_component_types = 64;
+
+// The next component type's id, which componentId() asks for once per type, so that every type
+// has the same id everywhere in the program
+uint32_t registerComponent(size_t size, size_t alignment);
+
+/*
+Components are plain data, copied around with memcpy whenever an entity changes archetype or the
+one after it in its chunk is destroyed, so any trivially copyable type will do.
+*/
+template<typename T>
+uint32_t
+componentId()
+{
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>,
+                  "components have to be trivially copyable");
+    static_assert(alignof(T) <= 16, "components can be aligned to 16 bytes at most");
+
+    static const uint32_t id = registerComponent(sizeof(T), alignof(T));
+    return id;
+}
+
+template<typename... Components>
+component_mask
+componentMask()
+{
+    return ((component_mask(1) << componentId<Components>()) | ... | component_mask(0));
+}
+
+/*
+A block of the entities of one archetype, with every component in an array of its own, followed by
+an array of the version every row of it was last changed at, and an array of the entities. The
+chunk also keeps the latest of every component's versions, so a query for changes can skip all of
+it at once.
+*/
+struct entity_chunk
+{
+    std::unique_ptr<std::byte[]> memory;
+    uint32_t                     count = 0;
+    std::vector<uint32_t>        versions;  // by component slot
+};
+
+// Every entity with exactly the same set of components, in chunks that are full but for the last
+struct entity_archetype
+{
+    static constexpr uint8_t no_slot = 0xff;
+
+    component_mask                           mask = 0;
+    std::vector<uint32_t>                    components;  // ids, ascending, by slot
+    std::vector<size_t>                      sizes;       // by slot
+    std::array<uint8_t, max_component_types> slots;       // by id, or no_slot
+    std::vector<size_t>                      offsets;     // of every slot's array in a chunk
+    std::vector<size_t>                      version_offsets;
+    size_t                                   entity_offset = 0;
+    uint32_t                                 capacity      = 0;  // entities a chunk fits
+    std::vector<entity_chunk>                chunks;
+
+    std::byte* column(entity_chunk& chunk, uint32_t slot) const
+    {
+        return chunk.memory.get() + offsets[slot];
+    }
+    uint32_t* versions(entity_chunk& chunk, uint32_t slot) const
+    {
+        return (uint32_t*)(chunk.memory.get() + version_offsets[slot]);
+    }
+    entity* entities(entity_chunk& chunk) const
+    {
+        return (entity*)(chunk.memory.get() + entity_offset);
+    }
+};
+
+// The part of a query's results that is one chunk, whose components are arrays of size() each
+class chunk_view
+{
+public:
+    chunk_view(entity_archetype& archetype, entity_chunk& chunk, uint32_t version)
+      : m_archetype(&archetype)
+      , m_chunk(&chunk)
+      , m_version(version)
+    {}
+
+    uint32_t size() const { return m_chunk->count; }
+    entity   entityAt(uint32_t row) const { return m_archetype->entities(*m_chunk)[row]; }
+
+    template<typename T>
+    bool has() const
+    {
+        return m_archetype->slots[componentId<T>()] != entity_archetype::no_slot;
+    }
+
+    template<typename T>
+    const T* read() const
+    {
+        return (const T*)m_archetype->column(*m_chunk, slot<T>());
+    }
+
+    // Marks every row's T as changed
+    template<typename T>
+    T* write()
+    {
+        const uint32_t s        = slot<T>();
+        uint32_t*      versions = m_archetype->versions(*m_chunk, s);
+        for (uint32_t row = 0; row < m_chunk->count; ++row) {
+            versions[row] = m_version;
+        }
+        m_chunk->versions[s] = m_version;
+        return (T*)m_archetype->column(*m_chunk, s);
+    }
+
+    // Marks only `row`'s
+    template<typename T>
+    T& write(uint32_t row)
+    {
+        const uint32_t s = slot<T>();
+
+        m_archetype->versions(*m_chunk, s)[row] = m_version;
+        m_chunk->versions[s]                    = m_version;
+        return ((T*)m_archetype->column(*m_chunk, s))[row];
+    }
+
+    // Whether `row`'s T was written, or the entity got it, after `since`
+    template<typename T>
+    bool changed(uint32_t row, uint32_t since) const
+    {
+        return m_archetype->versions(*m_chunk, slot<T>())[row] > since;
+    }
+
+private:
+    template<typename T>
+    uint32_t slot() const
+    {
+        return m_archetype->slots[componentId<T>()];
+    }
+
+    entity_archetype* m_archetype;
+    entity_chunk*     m_chunk;
+    uint32_t          m_version;
+};
+
+/*
+Entities and their components, stored by archetype: all entities with the same set of components
+share chunks of a fixed size in which every component is an array of its own, so a system that
+looks at a few components of many entities goes through contiguous memory and nothing else.
+Adding or removing a component moves the entity to another archetype, and destroying one moves the
+last entity of its archetype into its place.
+
+Every write to a component is stamped with version(), and advanceVersion() starts a newer one, so
+whatever copies the components elsewhere, like the renderer, can ask for only what changed after
+the version it last copied at, skipping whole chunks that didn't. What entities were destroyed
+since is kept for one version, which is enough for a single consumer that advances the version
+whenever it has caught up.
+
+Structural changes, anything but writing components, mustn't happen while a query runs. Queries on
+their own can run on many threads, as long as no two write the same component of the same chunk,
+which parallelForEach() never does.
+*/
+class entity_world
+{
+public:
+    template<typename... Components>
+    entity create(const Components&... components)
+    {
+        const entity created = createEntity(componentMask<Components...>());
+        (set(created, components), ...);
+        return created;
+    }
+
+    /*
+    Creates `count` entities with Components at once, for loading many, a chunk at a time: calls
+    `fill(chunk_view&, row, first, rows)` for every chunk the entities went into, whose `rows` rows
+    from `row` on are the entities `first` to `first + rows` of them, for it to write all of their
+    components, as arrays. Whatever it doesn't write is left uninitialized.
+    */
+    template<typename... Components, typename Func>
+    void createMany(uint32_t count, Func&& fill)
+    {
+        const uint32_t archetype = archetypeOf(componentMask<Components...>());
+        for (uint32_t first = 0; first < count;) {
+            entity_chunk*  chunk = nullptr;
+            uint32_t       row   = 0;
+            const uint32_t rows  = appendRows(archetype, count - first, chunk, row);
+
+            chunk_view view(m_archetypes[archetype], *chunk, m_version);
+            fill(view, row, first, rows);
+            first += rows;
+        }
+    }
+
+    void destroy(entity e);
+    bool alive(entity e) const;
+
+    template<typename T>
+    void add(entity e, const T& component)
+    {
+        changeArchetype(e, maskOf(e) | componentMask<T>());
+        set(e, component);
+    }
+
+    template<typename T>
+    void remove(entity e)
+    {
+        changeArchetype(e, maskOf(e) & ~componentMask<T>());
+    }
+
+    template<typename T>
+    bool has(entity e) const
+    {
+        return (maskOf(e) & componentMask<T>()) != 0;
+    }
+
+    template<typename T>
+    const T& get(entity e) const
+    {
+        return *(const T*)component(e, componentId<T>());
+    }
+
+    // Marks the component changed
+    template<typename T>
+    T& write(entity e)
+    {
+        return *(T*)writeComponent(e, componentId<T>());
+    }
+
+    template<typename T>
+    void set(entity e, const T& value)
+    {
+        write<T>(e) = value;
+    }
+
+    // Calls `body(chunk_view&)` for every chunk of entities that have all of Components
+    template<typename... Components, typename Func>
+    void forEach(Func&& body)
+    {
+        forEachChunk(componentMask<Components...>(), 0, 0, body);
+    }
+
+    // The same, but only for the chunks with any entity whose Changed changed after `since`
+    template<typename Changed, typename... Components, typename Func>
+    void forEachChanged(uint32_t since, Func&& body)
+    {
+        forEachChunk(componentMask<Changed, Components...>(), componentId<Changed>(), since, body);
+    }
+
+    // forEach(), with the chunks split up between the scheduler's threads
+    template<typename... Components, typename Func>
+    void parallelForEach(jobs::scheduler& scheduler, Func&& body)
+    {
+        parallelForEachChunk(scheduler, componentMask<Components...>(), 0, 0, body);
+    }
+
+    template<typename Changed, typename... Components, typename Func>
+    void parallelForEachChanged(jobs::scheduler& scheduler, uint32_t since, Func&& body)
+    {
+        parallelForEachChunk(scheduler, componentMask<Changed, Components...>(),
+                             componentId<Changed>(), since, body);
+    }
+
+    // What writes are stamped with now. Starts at 1, so that everything is newer than 0.
+    uint32_t version() const { return m_version; }
+
+    // Returns the version writes were stamped with until now, everything after is newer
+    uint32_t advanceVersion();
+
+    // Appends the entities that were destroyed after `since`, if that is at most a version ago
+    void destroyedSince(uint32_t since, std::vector<entity>& destroyed) const;
+
+    uint32_t size() const { return m_alive; }
+
+    // One more than the largest index an entity has ever had, for arrays by entity index
+    uint32_t indexCount() const { return (uint32_t)m_records.size(); }
+
+private:
+    struct record
+    {
+        uint32_t archetype  = 0;
+        uint32_t chunk      = 0;
+        uint32_t row        = 0;
+        uint32_t generation = 0;
+        bool     alive      = false;
+    };
+
+    struct destroyed_entity
+    {
+        entity   e;
+        uint32_t version = 0;
+    };
+
+    using chunk_ref = std::pair<entity_archetype*, entity_chunk*>;
+
+    entity         createEntity(component_mask mask);
+    component_mask maskOf(entity e) const;
+    void           changeArchetype(entity e, component_mask mask);
+    const void*    component(entity e, uint32_t id) const;
+    void*          writeComponent(entity e, uint32_t id);
+
+    uint32_t archetypeOf(component_mask mask);
+    void     insert(entity e, uint32_t archetype);
+    uint32_t appendRows(uint32_t archetype, uint32_t wanted, entity_chunk*& chunk, uint32_t& row);
+    void     erase(const record& place);
+
+    bool changedSince(const entity_archetype& archetype,
+                      const entity_chunk&     chunk,
+                      uint32_t                changed,
+                      uint32_t                since) const
+    {
+        return since == 0 || chunk.versions[archetype.slots[changed]] > since;
+    }
+
+    template<typename Func>
+    void forEachChunk(component_mask mask, uint32_t changed, uint32_t since, Func& body)
+    {
+        for (entity_archetype& archetype : m_archetypes) {
+            if ((archetype.mask & mask) != mask) {
+                continue;
+            }
+            for (entity_chunk& chunk : archetype.chunks) {
+                if (chunk.count > 0 && changedSince(archetype, chunk, changed, since)) {
+                    chunk_view view(archetype, chunk, m_version);
+                    body(view);
+                }
+            }
+        }
+    }
+
+    template<typename Func>
+    void parallelForEachChunk(jobs::scheduler& scheduler,
+                              component_mask   mask,
+                              uint32_t         changed,
+                              uint32_t         since,
+                              Func&            body)
+    {
+        // Kept from query to query, so that steady frames don't allocate for it
+        std::vector<chunk_ref>& chunks = m_query_chunks;
+        chunks.clear();
+        for (entity_archetype& archetype : m_archetypes) {
+            if ((archetype.mask & mask) != mask) {
+                continue;
+            }
+            for (entity_chunk& chunk : archetype.chunks) {
+                if (chunk.count > 0 && changedSince(archetype, chunk, changed, since)) {
+                    chunks.emplace_back(&archetype, &chunk);
+                }
+            }
+        }
+
+        scheduler.parallelFor(0, (uint32_t)chunks.size(), 1, [&](uint32_t first, uint32_t last) {
+            for (uint32_t i = first; i < last; ++i) {
+                chunk_view view(*chunks[i].first, *chunks[i].second, m_version);
+                body(view);
+            }
+        });
+    }
+
+    std::vector<entity_archetype>                m_archetypes;
+    std::unordered_map<component_mask, uint32_t> m_archetype_index;  // by mask
+    std::vector<record>                          m_records;          // by entity index
+    std::vector<uint32_t>                        m_free;
+    std::vector<destroyed_entity>                m_destroyed;
+    std::vector<chunk_ref>                       m_query_chunks;  // see parallelForEachChunk
+    uint32_t                                     m_alive   = 0;
+    uint32_t                                     m_version = 1;
+};
+
+}  // namespace shiny::scene
@@ -0,0 +1,199 @@
+#include "scene/scene_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+using shiny::scene::scene_file_range;
+
+const uint64_t scene_file_alignment = 16;
+
+uint64_t
+alignUp(uint64_t offset)
+{
+    return (offset + scene_file_alignment - 1) & ~(scene_file_alignment - 1);
+}
+
+// Lays the arrays out one after the other, as they are appended, and writes them out at the end
+class scene_file_builder
+{
+public:
+    explicit scene_file_builder(uint64_t start)
+      : m_data((size_t)alignUp(start), 0)
+    {}
+
+    template<typename T>
+    scene_file_range append(const std::vector<T>& elements)
+    {
+        scene_file_range range;
+        range.offset = m_data.size();
+        range.size   = elements.size() * sizeof(T);
+        m_data.resize((size_t)alignUp(range.offset + range.size), 0);
+        if (range.size) {
+            std::memcpy(m_data.data() + range.offset, elements.data(), (size_t)range.size);
+        }
+        return range;
+    }
+
+    std::vector<char>& data() { return m_data; }
+
+private:
+    std::vector<char> m_data;
+};
+
+}  // namespace
+
+namespace shiny::scene {
+
+/*
+The names go into one block, which the mesh and texture tables point into, and the instances are
+sorted with the spinning ones last, and otherwise by mesh and texture, so that the entities that
+draw the same are next to each other in their chunks too.
+*/
+bool
+writeSceneFile(const std::string&                      path,
+               const std::vector<std::string>&         meshes,
+               const std::vector<std::string>&         textures,
+               const std::vector<scene_file_instance>& instances)
+{
+    std::vector<scene_file_instance> sorted = instances;
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const scene_file_instance& a, const scene_file_instance& b) {
+                         const bool aspins = a.spin != 0.f;
+                         const bool bspins = b.spin != 0.f;
+                         if (aspins != bspins) {
+                             return bspins;
+                         }
+                         return a.mesh != b.mesh ? a.mesh < b.mesh : a.texture < b.texture;
+                     });
+
+    std::vector<glm::mat4> transforms;
+    std::vector<uint32_t>  meshindices;
+    std::vector<uint32_t>  textureindices;
+    std::vector<float>     spins;
+    transforms.reserve(sorted.size());
+    meshindices.reserve(sorted.size());
+    textureindices.reserve(sorted.size());
+    for (const scene_file_instance& instance : sorted) {
+        transforms.push_back(instance.world);
+        meshindices.push_back(instance.mesh);
+        textureindices.push_back(instance.texture);
+        if (instance.spin != 0.f) {
+            spins.push_back(instance.spin);
+        }
+    }
+
+    std::vector<char>     names;
+    std::vector<uint32_t> meshnames;
+    std::vector<uint32_t> texturenames;
+    for (const std::string& name : meshes) {
+        meshnames.push_back((uint32_t)names.size());
+        names.insert(names.end(), name.c_str(), name.c_str() + name.size() + 1);
+    }
+    for (const std::string& name : textures) {
+        texturenames.push_back((uint32_t)names.size());
+        names.insert(names.end(), name.c_str(), name.c_str() + name.size() + 1);
+    }
+
+    scene_file_header header;
+    header.instances = (uint32_t)sorted.size();
+    header.spinning  = (uint32_t)spins.size();
+    header.meshes    = (uint32_t)meshes.size();
+    header.textures  = (uint32_t)textures.size();
+
+    scene_file_builder builder(sizeof(header));
+    header.transforms      = builder.append(transforms);
+    header.mesh_indices    = builder.append(meshindices);
+    header.texture_indices = builder.append(textureindices);
+    header.spins           = builder.append(spins);
+    header.mesh_names      = builder.append(meshnames);
+    header.texture_names   = builder.append(texturenames);
+    header.names           = builder.append(names);
+    std::memcpy(builder.data().data(), &header, sizeof(header));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    file.write(builder.data().data(), (std::streamsize)builder.data().size());
+    return (bool)file;
+}
+
+bool
+scene_file::open(const std::string& path)
+{
+    close();
+    if (!m_file.open(path) || m_file.size() < sizeof(scene_file_header)) {
+        return false;
+    }
+    std::memcpy(&m_header, m_file.data(), sizeof(m_header));
+
+    const scene_file_header& h = m_header;
+
+    bool valid = std::memcmp(h.magic, scene_file_header().magic, 4) == 0;
+    valid      = valid && h.spinning <= h.instances;
+    valid      = valid && fits(h.transforms, h.instances, sizeof(glm::mat4));
+    valid      = valid && fits(h.mesh_indices, h.instances, sizeof(uint32_t));
+    valid      = valid && fits(h.texture_indices, h.instances, sizeof(uint32_t));
+    valid      = valid && fits(h.spins, h.spinning, sizeof(float));
+    valid      = valid && fits(h.mesh_names, h.meshes, sizeof(uint32_t));
+    valid      = valid && fits(h.texture_names, h.textures, sizeof(uint32_t));
+    valid      = valid && fits(h.names, h.names.size, 1);
+    valid = valid && (h.names.size == 0 || m_file.data()[h.names.offset + h.names.size - 1] == 0);
+    if (!valid) {
+        close();
+        return false;
+    }
+
+    // Every name starts within the block, which ends in a 0, so none of them runs past it, and
+    // every index is of a name
+    const uint32_t* meshnames    = array<uint32_t>(h.mesh_names);
+    const uint32_t* texturenames = array<uint32_t>(h.texture_names);
+    for (uint32_t i = 0; i < h.meshes; ++i) {
+        valid = valid && meshnames[i] < h.names.size;
+    }
+    for (uint32_t i = 0; i < h.textures; ++i) {
+        valid = valid && texturenames[i] < h.names.size;
+    }
+    const uint32_t* meshindices    = meshIndices();
+    const uint32_t* textureindices = textureIndices();
+    for (uint32_t i = 0; i < h.instances && valid; ++i) {
+        valid = meshindices[i] < h.meshes && textureindices[i] < h.textures;
+    }
+    if (!valid) {
+        close();
+    }
+    return valid;
+}
+
+void
+scene_file::close()
+{
+    m_file.close();
+    m_header = scene_file_header();
+}
+
+const char*
+scene_file::meshName(uint32_t mesh) const
+{
+    return array<char>(m_header.names) + array<uint32_t>(m_header.mesh_names)[mesh];
+}
+
+const char*
+scene_file::textureName(uint32_t texture) const
+{
+    return array<char>(m_header.names) + array<uint32_t>(m_header.texture_names)[texture];
+}
+
+// The range has to hold `count` elements, start aligned for them and end within the file
+bool
+scene_file::fits(const scene_file_range& range, uint64_t count, size_t element) const
+{
+    return range.size == count * element && range.offset % scene_file_alignment == 0
+           && range.offset >= sizeof(scene_file_header) && range.offset <= m_file.size()
+           && range.size <= m_file.size() - range.offset;
+}
+
+}  // namespace shiny::scene
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "core/mapped_file.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace shiny::scene {
+
+// Where one of a scene file's arrays is, in bytes from the start of the file
+struct scene_file_range
+{
+    uint64_t offset = 0;
+    uint64_t size   = 0;
+};
+
+/*
+The header of a cooked scene, as writeSceneFile writes them. Everything else is an array that the
+header points to by its offset in the file, never by address, so the file is used right where it is
+mapped: nothing is parsed or fixed up on loading, only checked to be in the file. Every array
+starts 16 byte aligned. The instances are sorted so that those that spin come last, which lets the
+ones before go into the entity world in one go, a chunk at a time, see entity_world::createMany.
+
+Meshes and textures are referred to by index into tables of names, which are offsets into a block
+of the names themselves, each followed by a 0. What a mesh name means is up to whoever loads the
+file, see renderer::setScene.
+*/
+struct scene_file_header
+{
+    char     magic[4]  = { 'S', 'S', 'C', '1' };
+    uint32_t instances = 0;
+    uint32_t spinning  = 0;  // of them, the last ones
+    uint32_t meshes    = 0;
+    uint32_t textures  = 0;
+    uint32_t reserved  = 0;  // so the ranges don't start after padding
+
+    scene_file_range transforms;       // glm::mat4, every instance's in the world
+    scene_file_range mesh_indices;     // uint32_t, every instance's of the meshes
+    scene_file_range texture_indices;  // uint32_t, every instance's of the textures
+    scene_file_range spins;            // float, every spinning instance's radians a second
+    scene_file_range mesh_names;       // uint32_t, every mesh's name's offset in `names`
+    scene_file_range texture_names;    // uint32_t, the same for every texture
+    scene_file_range names;
+};
+
+// What goes into a scene file, in any order
+struct scene_file_instance
+{
+    glm::mat4 world   = glm::mat4(1.f);
+    uint32_t  mesh    = 0;    // index into the mesh names
+    uint32_t  texture = 0;    // and the texture names
+    float     spin    = 0.f;  // radians a second, 0 for none
+};
+
+bool writeSceneFile(const std::string&                      path,
+                    const std::vector<std::string>&         meshes,
+                    const std::vector<std::string>&         textures,
+                    const std::vector<scene_file_instance>& instances);
+
+/*
+A cooked scene, mapped. The arrays point straight into the mapping, so they're only valid while the
+file stays open.
+*/
+class scene_file
+{
+public:
+    // False if the file can't be mapped, isn't a scene or any of its arrays or names don't fit in
+    // it
+    bool open(const std::string& path);
+    void close();
+
+    const scene_file_header& header() const { return m_header; }
+
+    const glm::mat4* transforms() const { return array<glm::mat4>(m_header.transforms); }
+    const uint32_t*  meshIndices() const { return array<uint32_t>(m_header.mesh_indices); }
+    const uint32_t*  textureIndices() const { return array<uint32_t>(m_header.texture_indices); }
+
+    // Of the last header().spinning instances
+    const float* spins() const { return array<float>(m_header.spins); }
+
+    const char* meshName(uint32_t mesh) const;
+    const char* textureName(uint32_t texture) const;
+
+private:
+    template<typename T>
+    const T* array(const scene_file_range& range) const
+    {
+        return reinterpret_cast<const T*>(m_file.data() + range.offset);
+    }
+
+    bool fits(const scene_file_range& range, uint64_t count, size_t element) const;
+
+    core::mapped_file m_file;
+    scene_file_header m_header;
+};
+
+}  // namespace shiny::scene
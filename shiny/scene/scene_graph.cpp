@@ -0,0 +1,292 @@
+#include "scene/scene_graph.h"
+
+#include "core/transform_math.h"
+
+#include <algorithm>
+
+namespace {
+
+// Depths with fewer nodes than twice this are updated on the calling thread, splitting them up
+// would cost more than it saves
+const uint32_t update_grain = 1024;
+
+// The same as core::no_transform_parent, which applyParents() skips
+const uint32_t no_parent = std::numeric_limits<uint32_t>::max();
+
+// What m_dirty has set: a node that moved, and one that hasn't been updated yet at all
+const uint8_t dirty_moved   = 1;
+const uint8_t dirty_created = 2;
+
+template<typename T>
+void
+reorder(std::vector<T>& values, const std::vector<uint32_t>& order)
+{
+    std::vector<T> sorted;
+    sorted.reserve(order.size());
+    for (uint32_t index : order) {
+        sorted.push_back(values[index]);
+    }
+    values = std::move(sorted);
+}
+
+}  // namespace
+
+namespace shiny::scene {
+
+/*
+The rotations are taken from the upper 3x3 once each column is divided by its scale, which is only
+a rotation without shear or mirroring. The same transform on both sides, most of them in a scene
+that isn't all moving, skips all of that.
+*/
+glm::mat4
+interpolateTransform(const glm::mat4& from, const glm::mat4& to, float t)
+{
+    if (from == to) {
+        return to;
+    }
+
+    const glm::vec3 fromscale(glm::length(glm::vec3(from[0])), glm::length(glm::vec3(from[1])),
+                              glm::length(glm::vec3(from[2])));
+    const glm::vec3 toscale(glm::length(glm::vec3(to[0])), glm::length(glm::vec3(to[1])),
+                            glm::length(glm::vec3(to[2])));
+
+    const glm::quat fromrotation = glm::quat_cast(glm::mat3(
+      glm::vec3(from[0]) / fromscale.x, glm::vec3(from[1]) / fromscale.y,
+      glm::vec3(from[2]) / fromscale.z));
+    const glm::quat torotation = glm::quat_cast(glm::mat3(
+      glm::vec3(to[0]) / toscale.x, glm::vec3(to[1]) / toscale.y, glm::vec3(to[2]) / toscale.z));
+
+    const glm::mat3 rotation = glm::mat3_cast(glm::slerp(fromrotation, torotation, t));
+    const glm::vec3 scale    = glm::mix(fromscale, toscale, t);
+
+    glm::mat4 result;
+    result[0] = glm::vec4(rotation[0] * scale.x, 0.f);
+    result[1] = glm::vec4(rotation[1] * scale.y, 0.f);
+    result[2] = glm::vec4(rotation[2] * scale.z, 0.f);
+    result[3] = glm::mix(from[3], to[3], t);
+    return result;
+}
+
+/*
+The node goes at the end, which keeps parents before children but not the depths together, so the
+arrays are sorted again in the next update.
+*/
+scene_graph::handle
+scene_graph::create(handle parent)
+{
+    const uint32_t index = (uint32_t)m_handle.size();
+
+    handle node;
+    if (!m_free.empty()) {
+        node = m_free.back();
+        m_free.pop_back();
+        m_index[node] = index;
+    } else {
+        node = (handle)m_index.size();
+        m_index.push_back(index);
+    }
+
+    m_position.push_back(glm::vec3(0.f));
+    m_rotation.push_back(glm::quat(1.f, 0.f, 0.f, 0.f));
+    m_scale.push_back(glm::vec3(1.f));
+    m_parent.push_back(parent == invalid_handle ? no_parent : m_index[parent]);
+    m_world.push_back(glm::mat4(1.f));
+    m_previous_world.push_back(glm::mat4(1.f));
+    m_dirty.push_back(dirty_moved | dirty_created);
+    m_moved.push_back(0);
+    m_alive.push_back(1);
+    m_handle.push_back(node);
+
+    m_sorted = false;
+    return node;
+}
+
+// Stays in the arrays until the next update, which also finds everything below it
+void
+scene_graph::destroy(handle node)
+{
+    m_alive[m_index[node]] = 0;
+    m_sorted               = false;
+}
+
+void
+scene_graph::setParent(handle node, handle parent)
+{
+    const uint32_t index = m_index[node];
+
+    m_parent[index] = parent == invalid_handle ? no_parent : m_index[parent];
+    m_dirty[index] |= dirty_moved;
+    m_sorted        = false;
+}
+
+void
+scene_graph::setPosition(handle node, const glm::vec3& position)
+{
+    const uint32_t index = m_index[node];
+
+    m_position[index] = position;
+    m_dirty[index] |= dirty_moved;
+}
+
+void
+scene_graph::setRotation(handle node, const glm::quat& rotation)
+{
+    const uint32_t index = m_index[node];
+
+    m_rotation[index] = rotation;
+    m_dirty[index] |= dirty_moved;
+}
+
+void
+scene_graph::setScale(handle node, const glm::vec3& scale)
+{
+    const uint32_t index = m_index[node];
+
+    m_scale[index] = scale;
+    m_dirty[index] |= dirty_moved;
+}
+
+void
+scene_graph::update(jobs::scheduler* scheduler)
+{
+    if (!m_sorted) {
+        sort();
+    }
+
+    for (size_t depth = 0; depth + 1 < m_depths.size(); ++depth) {
+        const uint32_t first = m_depths[depth];
+        const uint32_t last  = m_depths[depth + 1];
+
+        if (scheduler && last - first >= 2 * update_grain) {
+            scheduler->parallelFor(first, last, update_grain, [this](uint32_t begin, uint32_t end) {
+                updateRange(begin, end);
+            });
+        } else {
+            updateRange(first, last);
+        }
+    }
+}
+
+/*
+A counting sort by depth, which is stable, so nodes of the same depth keep their order. Destroyed
+nodes, and everything below them, are dropped on the way.
+*/
+void
+scene_graph::sort()
+{
+    const uint32_t count   = (uint32_t)m_handle.size();
+    const uint32_t unknown = std::numeric_limits<uint32_t>::max();
+
+    // Parents may come after their children after reparenting, so depths are found by walking up
+    // to the nearest node whose depth is known already
+    std::vector<uint32_t> depths(count, unknown);
+    std::vector<uint32_t> chain;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t index = i;
+        while (index != no_parent && depths[index] == unknown) {
+            chain.push_back(index);
+            index = m_parent[index];
+        }
+
+        uint32_t depth = index == no_parent ? 0 : depths[index] + 1;
+        bool     alive = index == no_parent || m_alive[index];
+
+        while (!chain.empty()) {
+            index = chain.back();
+            chain.pop_back();
+
+            alive          = alive && m_alive[index];
+            m_alive[index] = alive;
+            depths[index]  = depth++;
+        }
+    }
+
+    std::vector<uint32_t> starts;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (m_alive[i]) {
+            if (depths[i] + 1 >= starts.size()) {
+                starts.resize(depths[i] + 2, 0);
+            }
+            ++starts[depths[i] + 1];
+        }
+    }
+    for (size_t depth = 1; depth < starts.size(); ++depth) {
+        starts[depth] += starts[depth - 1];
+    }
+    m_depths = starts;
+
+    // order[new index] = old index
+    std::vector<uint32_t> order(starts.empty() ? 0 : starts.back());
+    std::vector<uint32_t> remap(count, no_parent);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (m_alive[i]) {
+            remap[i]             = starts[depths[i]]++;
+            order[remap[i]]      = i;
+            m_index[m_handle[i]] = remap[i];
+        } else {
+            m_index[m_handle[i]] = invalid_handle;
+            m_free.push_back(m_handle[i]);
+        }
+    }
+
+    for (uint32_t& parent : m_parent) {
+        parent = parent == no_parent ? no_parent : remap[parent];
+    }
+
+    reorder(m_position, order);
+    reorder(m_rotation, order);
+    reorder(m_scale, order);
+    reorder(m_parent, order);
+    reorder(m_world, order);
+    reorder(m_previous_world, order);
+    reorder(m_dirty, order);
+    reorder(m_moved, order);
+    reorder(m_alive, order);
+    reorder(m_handle, order);
+
+    m_sorted = true;
+}
+
+/*
+The parents are a depth up, so their m_moved is already this update's, and their world matrices
+aren't in the range. Every run of nodes that moved has its local matrices composed and put under
+their parents by the batched kernels, several at a time, straight into the world matrices. What
+didn't move was where it is before the update as well.
+*/
+void
+scene_graph::updateRange(uint32_t first, uint32_t last)
+{
+    for (uint32_t i = first; i < last; ++i) {
+        const uint32_t parent = m_parent[i];
+
+        m_moved[i]          = m_dirty[i] != 0 || (parent != no_parent && m_moved[parent]);
+        m_previous_world[i] = m_world[i];
+    }
+
+    for (uint32_t i = first; i < last;) {
+        if (!m_moved[i]) {
+            ++i;
+            continue;
+        }
+
+        uint32_t end = i + 1;
+        while (end < last && m_moved[end]) {
+            ++end;
+        }
+
+        core::composeTransforms(&m_position[i], &m_rotation[i], &m_scale[i], &m_world[i], end - i);
+        core::applyParents(m_world.data(), &m_parent[i], &m_world[i], end - i);
+        i = end;
+    }
+
+    for (uint32_t i = first; i < last; ++i) {
+        if (m_dirty[i] & dirty_created) {
+            m_previous_world[i] = m_world[i];
+        }
+        m_dirty[i] = 0;
+    }
+}
+
+}  // namespace shiny::scene
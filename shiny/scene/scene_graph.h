@@ -0,0 +1,93 @@
+#pragma once
+
+#include "jobs/scheduler.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace shiny::scene {
+
+// Translation and scale mixed, rotation slerped, between two transforms without shear or mirroring
+glm::mat4 interpolateTransform(const glm::mat4& from, const glm::mat4& to, float t);
+
+/*
+Transform hierarchy, stored as structure of arrays: every property of every node sits in its own
+array, and the arrays are sorted by depth, so parents always come before their children and all
+nodes of one depth are next to each other. Updating the world matrices is then one pass over the
+arrays, where every depth can be split up between threads since its nodes only read the depth
+before.
+
+Nodes are referred to by handles, since reparenting, creating and destroying them moves the others
+around. Those structural changes only take effect (and re-sort the arrays) in the next update.
+Moving a node marks it dirty, and the update only recomputes the dirty nodes and everything below
+them.
+
+Every update also keeps the world matrices from before it, so that a simulation that updates the
+graph in fixed steps can be drawn between its last two states by interpolatedWorld().
+*/
+class scene_graph
+{
+public:
+    using handle = uint32_t;
+
+    static const handle invalid_handle = std::numeric_limits<handle>::max();
+
+    handle create(handle parent = invalid_handle);
+
+    // Destroys the node and everything below it
+    void destroy(handle node);
+    void setParent(handle node, handle parent);
+
+    void setPosition(handle node, const glm::vec3& position);
+    void setRotation(handle node, const glm::quat& rotation);
+    void setScale(handle node, const glm::vec3& scale);
+
+    const glm::vec3& position(handle node) const { return m_position[m_index[node]]; }
+    const glm::quat& rotation(handle node) const { return m_rotation[m_index[node]]; }
+    const glm::vec3& scale(handle node) const { return m_scale[m_index[node]]; }
+
+    // As of the last update
+    const glm::mat4& world(handle node) const { return m_world[m_index[node]]; }
+    bool             moved(handle node) const { return m_moved[m_index[node]] != 0; }
+
+    // Between the world matrix before the last update, at 0, and the one after it, at 1. A node
+    // the last update was the first of is where that update put it.
+    glm::mat4 interpolatedWorld(handle node, float alpha) const
+    {
+        const uint32_t index = m_index[node];
+        return interpolateTransform(m_previous_world[index], m_world[index], alpha);
+    }
+
+    uint32_t size() const { return (uint32_t)m_handle.size(); }
+
+    // Recomputes the world matrices of whatever moved since the last update. With a scheduler,
+    // large enough depths are split up between its threads.
+    void update(jobs::scheduler* scheduler = nullptr);
+
+private:
+    void sort();
+    void updateRange(uint32_t first, uint32_t last);
+
+    // By index, in depth order
+    std::vector<glm::vec3> m_position;
+    std::vector<glm::quat> m_rotation;
+    std::vector<glm::vec3> m_scale;
+    std::vector<uint32_t>  m_parent;  // index, or invalid_handle for roots
+    std::vector<glm::mat4> m_world;
+    std::vector<glm::mat4> m_previous_world;  // before the last update
+    std::vector<uint8_t>   m_dirty;           // moved or created since the last update
+    std::vector<uint8_t>   m_moved;   // recomputed by the last update
+    std::vector<uint8_t>   m_alive;
+    std::vector<handle>    m_handle;
+
+    std::vector<uint32_t> m_index;  // by handle
+    std::vector<handle>   m_free;
+    std::vector<uint32_t> m_depths;  // where every depth starts, and where the last one ends
+    bool                  m_sorted = true;
+};
+
+}  // namespace shiny::scene
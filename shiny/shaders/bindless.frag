@@ -0,0 +1,152 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_GOOGLE_include_directive : require
+#ifdef RAY_QUERY_SHADOWS
+#extension GL_EXT_ray_query : require
+#endif
+
+#include "lighting.glsl"
+#include "shadows.glsl"
+#include "probes.glsl"
+
+// Every texture the renderer has, see m_texture_sets. Draws with different textures can end up in
+// the same multi-draw, so the index isn't uniform and has to be marked as such.
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+// The arrays small textures are packed into, see texture_streamer. A texture index with
+// packedTextureBit set is an array times arrayTextureLayers plus a layer. Must match
+// max_texture_arrays, array_texture_layers and packed_texture_bit.
+const uint packedTextureBit = 0x40000000u;
+const uint arrayTextureLayers = 64u;
+
+layout(set = 1, binding = 1) uniform sampler2DArray textureArrays[64];
+
+// The same permutations as shader.frag's
+layout(constant_id = 0) const bool useTexture = true;
+layout(constant_id = 1) const bool useVertexColor = false;
+layout(constant_id = 2) const bool alphaTest = false;
+layout(constant_id = 3) const bool showTexCoords = false;
+layout(constant_id = 4) const bool useLighting = false;
+layout(constant_id = 5) const bool useShadows = false;
+layout(constant_id = 6) const bool writeGBuffer = false;
+layout(constant_id = 7) const bool useReflections = false;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTextureIndex;
+
+layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec4 outNormal;  // only with writeGBuffer
+
+#ifdef VIRTUAL_TEXTURES
+// Virtual textures, see virtual_texture.h, compiled into bindless_vt_frag.spv. A texture index
+// with virtual_texture_bit set is the slot of a virtual texture's indirection in `textures`, whose
+// texels are the page of every tile, or of its closest resident ancestor, and that one's level.
+const uint virtualTextureBit = 0x80000000u;
+const float tileSize = 128.0;  // virtual_tile_size
+const float tileBorder = 4.0;  // virtual_tile_border
+
+layout(binding = 9) uniform sampler2D virtualPages;
+
+// See virtual_feedback_header in virtual_texture.h
+layout(std430, binding = 10) buffer VirtualFeedback {
+  uvec4 textures[16];  // width, height and levels
+  uint firstSlot;
+  uint frame;
+  uint capacity;
+  uint count;
+  uint tiles[];
+} feedback;
+
+vec4 sampleVirtual(uint slot, vec2 uv) {
+  uint vt = slot - feedback.firstSlot;
+  uvec4 info = feedback.textures[vt];
+  vec2 size = vec2(info.xy);
+
+  // The level a sampler would have picked, along the axis that shrinks the most
+  vec2 dx = dFdx(uv) * size;
+  vec2 dy = dFdy(uv) * size;
+  float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+  int level = int(clamp(floor(lod), 0.0, float(info.z - 1u)));
+
+  vec2 wrapped = fract(uv);
+  ivec2 tiles = textureSize(textures[nonuniformEXT(slot)], level);
+  ivec2 tile = min(ivec2(wrapped * vec2(tiles)), tiles - 1);
+
+  // One pixel out of every 8x8 asks for its tile, a different one every frame
+  uvec2 pixel = uvec2(gl_FragCoord.xy) & 7u;
+  if (pixel.x + pixel.y * 8u == feedback.frame % 64u) {
+    uint index = atomicAdd(feedback.count, 1u);
+    if (index < feedback.capacity) {
+      feedback.tiles[index] = vt << 28 | uint(level) << 24 | uint(tile.y) << 12 | uint(tile.x);
+    }
+  }
+
+  // The indirection is UNORM, so its bytes come back scaled
+  uvec4 entry = uvec4(texelFetch(textures[nonuniformEXT(slot)], tile, level) * 255.0 + 0.5);
+  if (entry.a == 0u) {
+    return vec4(1.0);
+  }
+
+  // Within the tile of the level the page is of, which may be an ancestor of the one asked for
+  vec2 texels = wrapped * max(size / float(1u << entry.z), vec2(1.0));
+  vec2 within = mod(texels, tileSize);
+  vec2 physical = vec2(entry.xy) * (tileSize + 2.0 * tileBorder) + tileBorder + within;
+  return textureLod(virtualPages, physical / vec2(textureSize(virtualPages, 0)), 0.0);
+}
+#endif
+
+vec4 sampleTexture() {
+#ifdef VIRTUAL_TEXTURES
+  if ((fragTextureIndex & virtualTextureBit) != 0u) {
+    return sampleVirtual(fragTextureIndex & ~virtualTextureBit, fragTexCoord);
+  }
+#endif
+  if ((fragTextureIndex & packedTextureBit) != 0u) {
+    uint packed = fragTextureIndex & ~packedTextureBit;
+    uint array = packed / arrayTextureLayers;
+    vec3 uvw = vec3(fragTexCoord, float(packed % arrayTextureLayers));
+    return texture(textureArrays[nonuniformEXT(array)], uvw);
+  }
+  return texture(textures[nonuniformEXT(fragTextureIndex)], fragTexCoord);
+}
+
+void main() {
+    if (showTexCoords) {
+        outColor = vec4(fragTexCoord, 0.0, 1.0);
+        return;
+    }
+
+    // The color is shaded in half precision in the HALF_PRECISION variant, see precision.glsl
+    half4 color = half4(useTexture ? sampleTexture() : vec4(1.0));
+    if (useVertexColor) {
+        color.rgb *= half3(fragColor);
+    }
+    if (writeGBuffer) {
+        // Lit by deferred.frag instead, from the normal packed into [0, 1]
+        vec3 normal = flatNormal(viewPosition());
+        if (alphaTest && color.a < 0.5) {
+            discard;
+        }
+        outColor = vec4(vec3(color.rgb), 1.0);
+        outNormal = vec4(normal * 0.5 + 0.5, 1.0);
+        return;
+    }
+    if (useLighting) {
+        vec3 position = viewPosition();
+        vec3 normal = flatNormal(position);
+        vec3 light = clusteredLighting(position, normal);
+        if (useShadows) {
+            light += sunLighting(position, normal);
+        }
+        color.rgb *= half3(light);
+        if (useReflections) {
+            color.rgb += half3(probeReflection(position, normal));
+        }
+    }
+    if (alphaTest && color.a < 0.5) {
+        discard;
+    }
+    outColor = vec4(color);
+}
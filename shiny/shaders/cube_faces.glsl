@@ -0,0 +1,38 @@
+// Where directions land on the faces of a cube, and back, in the order and orientation Vulkan
+// lays a cubemap's layers out, see "Cube Map Face Selection" in the spec. For the shaders that
+// sample or write cubes through 2D array views, one layer per face.
+
+// The face `direction` points at, and the coordinates on it, as (u, v, face)
+vec3 cubeFaceCoord(vec3 direction) {
+  vec3 a = abs(direction);
+  float face;
+  float major;
+  vec2 st;
+  if (a.x >= a.y && a.x >= a.z) {
+    face = direction.x > 0.0 ? 0.0 : 1.0;
+    major = a.x;
+    st = vec2(direction.x > 0.0 ? -direction.z : direction.z, -direction.y);
+  } else if (a.y >= a.z) {
+    face = direction.y > 0.0 ? 2.0 : 3.0;
+    major = a.y;
+    st = vec2(direction.x, direction.y > 0.0 ? direction.z : -direction.z);
+  } else {
+    face = direction.z > 0.0 ? 4.0 : 5.0;
+    major = a.z;
+    st = vec2(direction.z > 0.0 ? direction.x : -direction.x, -direction.y);
+  }
+  return vec3((st / major + 1.0) * 0.5, face);
+}
+
+// The direction through `uv` on `face`, not normalized
+vec3 cubeDirection(uint face, vec2 uv) {
+  vec2 st = uv * 2.0 - 1.0;
+  switch (face) {
+    case 0u: return vec3(1.0, -st.y, -st.x);
+    case 1u: return vec3(-1.0, -st.y, st.x);
+    case 2u: return vec3(st.x, 1.0, st.y);
+    case 3u: return vec3(st.x, -1.0, -st.y);
+    case 4u: return vec3(st.x, -st.y, 1.0);
+    default: return vec3(-st.x, -st.y, -1.0);
+  }
+}
@@ -0,0 +1,22 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The lines and triangles of debug_draw, in world space already
+
+layout(push_constant) uniform Constants {
+    mat4 viewProjection;
+} constants;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec4 inColor;
+
+layout(location = 0) out vec4 fragColor;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+    fragColor = inColor;
+    gl_Position = constants.viewProjection * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,50 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+#ifdef RAY_QUERY_SHADOWS
+#extension GL_EXT_ray_query : require
+#endif
+
+#include "lighting.glsl"
+#include "shadows.glsl"
+#include "probes.glsl"
+
+// Lights what the geometry subpass left in the G-buffer, once per pixel. The attachments are read
+// where they are, at this fragment, which is what lets a tiled GPU keep them in tile memory. See
+// renderer::setDeferredShading.
+
+// The same permutations as shader.frag's. Without the lighting the lights are drawn as volumes of
+// their own after this, see light_volume.frag.
+layout(constant_id = 4) const bool useLighting = false;
+layout(constant_id = 5) const bool useShadows = false;
+layout(constant_id = 7) const bool useReflections = false;
+
+// The subpass's input attachments, in set 1 of the lighting pipeline, see m_gbuffer_set_layout
+layout(input_attachment_index = 0, set = 1, binding = 0) uniform subpassInput gbufferColor;
+layout(input_attachment_index = 1, set = 1, binding = 1) uniform subpassInput gbufferNormal;
+layout(input_attachment_index = 2, set = 1, binding = 2) uniform subpassInput gbufferDepth;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    // Nothing was drawn there, which the forward clear color stands for
+    float depth = subpassLoad(gbufferDepth).r;
+    if (depth == 0.0) {
+        outColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    vec3 color = subpassLoad(gbufferColor).rgb;
+    vec3 normal = normalize(subpassLoad(gbufferNormal).xyz * 2.0 - 1.0);
+    vec3 position = viewPosition(depth);
+
+    vec3 light = useLighting ? clusteredLighting(position, normal) : ambientLight;
+    if (useShadows) {
+        light += sunLighting(position, normal);
+    }
+    color *= light;
+    if (useReflections) {
+        color += probeReflection(position, normal);
+    }
+    outColor = vec4(color, 1.0);
+}
@@ -0,0 +1,22 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The lighting subpass's, see renderer::setDeferredShading: a single triangle covering the whole
+// framebuffer, from nothing but the vertex index, so there is nothing to bind. With LIGHT_VOLUME
+// it's drawn once per light, which light_volume.frag gets the index of from the instance's.
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+#ifdef LIGHT_VOLUME
+layout(location = 0) flat out uint lightIndex;
+#endif
+
+void main() {
+    vec2 corner = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+#ifdef LIGHT_VOLUME
+    lightIndex = gl_InstanceIndex;
+#endif
+}
@@ -0,0 +1,7 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The depth prepass writes depth only, with color writes off, so there is nothing to shade
+
+void main() {
+}
@@ -0,0 +1,45 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : enable
+#endif
+
+// The depth prepass's shader.vert, reading nothing but the positions, see
+// renderer::setDepthPrepass. The materials are drawn afterwards with an equal depth test, so the
+// position has to come out exactly the way shader.vert's does, which invariant guarantees for the
+// same expression of the same inputs.
+
+#ifdef MULTIVIEW
+// The eyes' or viewports' views, see shader.vert
+layout(binding = 0) uniform UniformBufferObject {
+  mat4 viewproj;
+  mat4 views[4];
+} ubo;
+#endif
+
+// One per instance, see draw_instance in draw_buffer.h
+struct Instance {
+  mat4 mvp;
+  uint textureIndex;
+};
+
+layout(std430, binding = 2) readonly buffer DrawInstances {
+  Instance instances[];
+} draws;
+
+layout(location = 0) in vec3 inPosition;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+invariant gl_Position;
+
+void main() {
+#ifdef MULTIVIEW
+    vec4 world = draws.instances[gl_InstanceIndex].mvp * vec4(inPosition, 1.0);
+    gl_Position = ubo.views[gl_ViewIndex] * world;
+#else
+    gl_Position = draws.instances[gl_InstanceIndex].mvp * vec4(inPosition, 1.0);
+#endif
+}
@@ -0,0 +1,21 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The view of the mesh as it was cooked, see impostor.vert, alpha tested like the materials
+
+layout(binding = 0) uniform sampler2D atlas;
+
+layout(location = 0) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec4 color = texture(atlas, fragTexCoord);
+    if (color.a < 0.5) {
+        discard;
+    }
+
+    // The views were cooked over transparent black, which the coarser levels average the edges
+    // with, so the color is as if it was premultiplied
+    outColor = vec4(color.rgb / color.a, 1.0);
+}
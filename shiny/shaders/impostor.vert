@@ -0,0 +1,73 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// A quad across an instance's bounding sphere for the view of the mesh whose direction is nearest
+// to the camera's, square to it and showing it, see impostor.h. The views are an octahedral map of
+// the directions around the mesh, see impostorDirection, which this has to match.
+
+// See impostor_constants in impostor.cpp
+layout(push_constant) uniform Constants {
+    mat4 viewProjection;
+    vec4 eye;    // w is the views across a layer
+    vec4 atlas;  // layers across and down the atlas, texels across a view
+} constants;
+
+layout(location = 0) in vec4 inModel0;
+layout(location = 1) in vec4 inModel1;
+layout(location = 2) in vec4 inModel2;
+layout(location = 3) in vec4 inModel3;
+layout(location = 4) in float inRadius;
+layout(location = 5) in uint inLayer;
+
+layout(location = 0) out vec2 fragTexCoord;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+// Two triangles
+const vec2 corners[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+                               vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+vec2 signNotZero(vec2 v) {
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// The lower half of the octahedron is folded out over the square's corners
+vec2 octahedral(vec3 direction) {
+    vec3 d = direction / (abs(direction.x) + abs(direction.y) + abs(direction.z));
+    return d.z >= 0.0 ? d.xy : (1.0 - abs(d.yx)) * signNotZero(d.xy);
+}
+
+vec3 fromOctahedral(vec2 p) {
+    vec3 d = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    if (d.z < 0.0) {
+        d.xy = (1.0 - abs(p.yx)) * signNotZero(p);
+    }
+    return normalize(d);
+}
+
+void main() {
+    mat4 model = mat4(inModel0, inModel1, inModel2, inModel3);
+    vec3 eye = (inverse(model) * vec4(constants.eye.xyz, 1.0)).xyz;
+    float views = constants.eye.w;
+
+    vec2 view = round((octahedral(eye) * 0.5 + 0.5) * (views - 1.0));
+    vec3 direction = fromOctahedral(view / (views - 1.0) * 2.0 - 1.0);
+
+    // The same axes as the view's camera, glm::lookAt's with impostorView's up
+    vec3 forward = -direction;
+    vec3 up = abs(direction.z) > 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+    vec3 side = normalize(cross(forward, up));
+    up = cross(side, forward);
+
+    vec2 corner = corners[gl_VertexIndex];
+    vec3 position = (corner.x * side + corner.y * up) * inRadius;
+    gl_Position = constants.viewProjection * model * vec4(position, 1.0);
+
+    // Rows go down from the top of the view, and stop half a texel short of its edges
+    vec2 inside = corner * vec2(0.5, -0.5) * (1.0 - 1.0 / constants.atlas.z) + 0.5;
+    uint across = uint(constants.atlas.x);
+    vec2 layer = vec2(inLayer % across, inLayer / across);
+    fragTexCoord = (layer * views + view + inside) / (constants.atlas.xy * views);
+}
@@ -0,0 +1,29 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "lighting.glsl"
+
+// One light of the deferred lighting, added onto what deferred.frag lit with the ambient light and
+// the sun, see renderer::setLightVolumes. It's drawn scissored to the light's sphere on the screen,
+// and the depth bounds test has already dropped the pixels in front of it and behind it, background
+// included, so what's left is mostly what the light reaches.
+
+// The same attachments as deferred.frag's
+layout(input_attachment_index = 0, set = 1, binding = 0) uniform subpassInput gbufferColor;
+layout(input_attachment_index = 1, set = 1, binding = 1) uniform subpassInput gbufferNormal;
+layout(input_attachment_index = 2, set = 1, binding = 2) uniform subpassInput gbufferDepth;
+
+layout(location = 0) flat in uint lightIndex;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec3 color = subpassLoad(gbufferColor).rgb;
+    vec3 normal = normalize(subpassLoad(gbufferNormal).xyz * 2.0 - 1.0);
+    vec3 position = viewPosition(subpassLoad(gbufferDepth).r);
+
+    // Blended additively, so the alpha is left as it is
+    vec3 light = vec3(pointLight(lights.lights[lightIndex], position, normal));
+    outColor = vec4(color * light, 0.0);
+}
@@ -0,0 +1,96 @@
+// Clustered forward lighting, see light_culling.h, for the fragment shaders to include. The
+// lights and clusters are in set 0 with the rest, and the same as lights.comp reads and writes.
+
+#include "precision.glsl"
+
+const uint clusterTilesX = 16;
+const uint clusterTilesY = 9;
+const uint clusterSlices = 24;
+const uint clusterCount = clusterTilesX * clusterTilesY * clusterSlices;
+const uint maxLightsPerCluster = 128;
+
+// What every surface gets without any light reaching it
+const vec3 ambientLight = vec3(0.05);
+
+struct Light {
+  vec3 position;
+  float range;
+  vec3 color;
+  float spotOuter;
+  vec3 direction;
+  float spotInner;
+};
+
+layout(std430, binding = 4) readonly buffer Lights {
+  mat4 inverseProjection;
+  vec2 extent;
+  float nearPlane;
+  float farPlane;
+  uint count;
+  Light lights[];
+} lights;
+
+layout(std430, binding = 5) readonly buffer Clusters {
+  uint counts[clusterCount];
+  uint indices[];
+} clusters;
+
+// The view space position at the fragment's pixel and `depth`
+vec3 viewPosition(float depth) {
+  vec4 view = lights.inverseProjection
+              * vec4(gl_FragCoord.xy / lights.extent * 2.0 - 1.0, depth, 1.0);
+  return view.xyz / view.w;
+}
+
+// The fragment's view space position, from its depth
+vec3 viewPosition() {
+  return viewPosition(gl_FragCoord.z);
+}
+
+// The vertices have no normals, so the surface's comes from how the view space position changes
+// across the screen, which is flat per triangle. It has to be called where derivatives are, i.e.
+// before any discard.
+vec3 flatNormal(vec3 position) {
+  vec3 normal = normalize(cross(dFdx(position), dFdy(position)));
+  return dot(normal, position) > 0.0 ? -normal : normal;
+}
+
+// The light reaching a surface at `position` from one light, nothing beyond its range. The
+// distances and the cone's cosines, which a half would band, are worked out in full precision.
+half3 pointLight(Light light, vec3 position, vec3 normal) {
+  vec3 toLight = light.position - position;
+  float distance = length(toLight);
+  if (distance >= light.range) {
+    return half3(0.0);
+  }
+  vec3 direction = toLight / distance;
+
+  // Inverse square, windowed to reach zero at the range
+  half falloff = half(distance / light.range);
+  falloff = clamp(half(1.0) - falloff * falloff * falloff * falloff, half(0.0), half(1.0));
+  half attenuation = falloff * falloff * half(1.0 / (distance * distance + 1.0));
+  if (light.spotOuter > -1.0) {
+    attenuation *= half(smoothstep(light.spotOuter, light.spotInner,
+                                   dot(-direction, light.direction)));
+  }
+
+  return half3(light.color) * half(max(dot(normal, direction), 0.0)) * attenuation;
+}
+
+// The light reaching the fragment, from the lights of its cluster only, and the ambient light
+vec3 clusteredLighting(vec3 position, vec3 normal) {
+  // The same tiles and exponential slices as lights.comp's
+  uvec2 tile = min(uvec2(gl_FragCoord.xy / lights.extent * vec2(clusterTilesX, clusterTilesY)),
+                   uvec2(clusterTilesX - 1, clusterTilesY - 1));
+  float slice = log(-position.z / lights.nearPlane) / log(lights.farPlane / lights.nearPlane);
+  uint z = uint(clamp(slice * float(clusterSlices), 0.0, float(clusterSlices - 1)));
+  uint cluster = (z * clusterTilesY + tile.y) * clusterTilesX + tile.x;
+
+  half3 result = half3(ambientLight);
+  uint count = clusters.counts[cluster];
+  for (uint i = 0; i < count; ++i) {
+    Light light = lights.lights[clusters.indices[cluster * maxLightsPerCluster + i]];
+    result += pointLight(light, position, normal);
+  }
+  return vec3(result);
+}
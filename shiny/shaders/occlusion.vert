@@ -0,0 +1,29 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The unit cube [-1, 1] of an occlusion query, made out of the vertex index alone, see
+// occlusion_queries.h. Neither face is culled, so the winding doesn't matter.
+
+layout(push_constant) uniform Constants {
+    mat4 modelViewProjection;  // of the box
+} constants;
+
+// Two triangles a face, of corners whose bits 0, 1 and 2 say whether they are at +x, +y and +z
+const uint indices[36] = uint[36](
+    0, 1, 3, 0, 3, 2,  // -z
+    4, 5, 7, 4, 7, 6,  // +z
+    0, 1, 5, 0, 5, 4,  // -y
+    2, 3, 7, 2, 7, 6,  // +y
+    0, 2, 6, 0, 6, 4,  // -x
+    1, 3, 7, 1, 7, 5   // +x
+);
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+    uint corner = indices[gl_VertexIndex];
+    vec3 position = vec3(corner & 1u, (corner >> 1) & 1u, (corner >> 2) & 1u) * 2.0 - 1.0;
+    gl_Position = constants.modelViewProjection * vec4(position, 1.0);
+}
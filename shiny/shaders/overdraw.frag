@@ -0,0 +1,11 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Drawn with additive blending in place of every material, so the color of a pixel counts the
+// fragments that were shaded for it: red saturates after 8 of them, green after 16, blue after 32.
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = vec4(1.0 / 8.0, 1.0 / 16.0, 1.0 / 32.0, 1.0);
+}
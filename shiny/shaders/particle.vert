@@ -0,0 +1,53 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// A camera facing quad per alive particle, see particle_system.h. The draw's firstInstance is the
+// start of the alive list's half, so gl_InstanceIndex is the particle's place in the list, and
+// there are no vertices to bind.
+
+struct Particle {
+    vec3 position;
+    float age;
+    vec3 velocity;
+    float lifetime;
+};
+
+layout(std430, binding = 0) readonly buffer Particles {
+    Particle particles[];
+} particles;
+
+layout(std430, binding = 1) readonly buffer Alive {
+    uint indices[];
+} alive;
+
+// See particle_draw_constants in particle_system.cpp
+layout(push_constant) uniform Constants {
+    mat4 viewProjection;
+    vec4 right;  // w is the size
+    vec4 up;
+} constants;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragCorner;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+// Two triangles
+const vec2 corners[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+                               vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0));
+
+void main() {
+    Particle particle = particles.particles[alive.indices[gl_InstanceIndex]];
+    vec2 corner = corners[gl_VertexIndex];
+
+    // From white hot to a dim red as it ages, fading out at the end
+    float age = particle.age / particle.lifetime;
+    fragColor = mix(vec3(1.0, 0.9, 0.6), vec3(0.6, 0.1, 0.02), age) * (1.0 - age) * 0.5;
+    fragCorner = corner;
+
+    float size = constants.right.w;
+    vec3 offset = (corner.x * constants.right.xyz + corner.y * constants.up.xyz) * size;
+    gl_Position = constants.viewProjection * vec4(particle.position + offset, 1.0);
+}
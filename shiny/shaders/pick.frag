@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Writes the candidate's ID into the object_picker's R32_UINT image, one up from its object so
+// that 0, which the image is cleared to, is nothing
+
+layout(push_constant) uniform Candidate {
+    mat4 mvp;
+    uint object;
+} candidate;
+
+layout(location = 0) out uint outObject;
+
+void main() {
+    outObject = candidate.object;
+}
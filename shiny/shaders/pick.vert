@@ -0,0 +1,20 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The positions of the pick candidates, see object_picker. Packed positions come out of the vertex
+// input in [0, 1], and their dequantize is part of the transform, like in shadow.vert.
+
+layout(push_constant) uniform Candidate {
+    mat4 mvp;     // the region's view projection times the candidate's model matrix
+    uint object;  // written by pick.frag
+} candidate;
+
+layout(location = 0) in vec3 inPosition;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+    gl_Position = candidate.mvp * vec4(inPosition, 1.0);
+}
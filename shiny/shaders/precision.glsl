@@ -0,0 +1,22 @@
+// Half precision types for the variants built with HALF_PRECISION, see
+// renderer::setHalfPrecision, and plain floats for the rest, so a shader is written once for both.
+// Only for colors and light, which stay well within a half's range, never for positions or texture
+// coordinates. Has to be included before anything that isn't a preprocessor directive.
+
+#ifndef PRECISION_GLSL
+#define PRECISION_GLSL
+
+#ifdef HALF_PRECISION
+#extension GL_EXT_shader_explicit_arithmetic_types_float16 : require
+#define half float16_t
+#define half2 f16vec2
+#define half3 f16vec3
+#define half4 f16vec4
+#else
+#define half float
+#define half2 vec2
+#define half3 vec3
+#define half4 vec4
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+// A face of a reflection probe, see reflection_probes.h: the bindless textures, lit by the sun
+// and the ambient light only, without shadows.
+
+// The renderer's bindless textures, the same as bindless.frag's, but the only set
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+
+const uint packedTextureBit = 0x40000000u;
+const uint arrayTextureLayers = 64u;
+layout(set = 0, binding = 1) uniform sampler2DArray textureArrays[64];
+
+// Virtual textures aren't sampled, their feedback would be for the camera, so they're white
+const uint virtualTextureBit = 0x80000000u;
+
+// After the vertex shader's, see probe_constants
+layout(push_constant) uniform Face {
+    layout(offset = 64) vec3 sun;  // towards it, in the face's view space
+    uint textureIndex;
+    vec3 sunColor;
+} face;
+
+// lighting.glsl's
+const vec3 ambientLight = vec3(0.05);
+
+layout(location = 0) in vec3 fragPosition;
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+vec4 sampleTexture() {
+    uint index = face.textureIndex;
+    if ((index & virtualTextureBit) != 0u) {
+        return vec4(1.0);
+    }
+    if ((index & packedTextureBit) != 0u) {
+        uint packed = index & ~packedTextureBit;
+        vec3 uvw = vec3(fragTexCoord, float(packed % arrayTextureLayers));
+        return texture(textureArrays[nonuniformEXT(packed / arrayTextureLayers)], uvw);
+    }
+    return texture(textures[nonuniformEXT(index)], fragTexCoord);
+}
+
+void main() {
+    // Flat per triangle, like flatNormal in lighting.glsl, before any discard
+    vec3 normal = normalize(cross(dFdx(fragPosition), dFdy(fragPosition)));
+    normal = dot(normal, fragPosition) > 0.0 ? -normal : normal;
+
+    vec4 color = sampleTexture();
+    if (color.a < 0.5) {
+        discard;
+    }
+
+    vec3 light = ambientLight + face.sunColor * max(dot(normal, face.sun), 0.0);
+    outColor = vec4(color.rgb * light, 1.0);
+}
@@ -0,0 +1,31 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// A face of a reflection probe, see reflection_probes.h. Packed positions come out of the vertex
+// input in [0, 1], and their dequantize is part of the transform, like in shader.vert.
+
+layout(push_constant) uniform Draw {
+    mat4 modelView;  // the face's view times the model matrix
+} draw;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragPosition;  // in the face's view space
+layout(location = 1) out vec2 fragTexCoord;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+// Must match probe_near_plane in reflection_probes.cpp
+const float nearPlane = 0.05;
+
+void main() {
+    vec4 position = draw.modelView * vec4(inPosition, 1.0);
+    fragPosition = position.xyz;
+    fragTexCoord = inTexCoord;
+
+    // 90 degrees across, reverse-Z without a far plane, see faceProjection
+    gl_Position = vec4(position.x, position.y, nearPlane, -position.z);
+}
@@ -0,0 +1,62 @@
+// Reflections of the scene from the cached reflection probes, see reflection_probes.h, for the
+// fragment shaders to include after lighting.glsl. The positions and normals they take are in view
+// space, like the lights, and the probes are in world space, where they were captured.
+
+#include "cube_faces.glsl"
+
+const uint maxReflectionProbes = 16;  // max_reflection_probes
+
+// Six layers per probe, one per face, and rougher reflections down the levels
+layout(binding = 12) uniform sampler2DArray probeCubes;
+
+// See reflection_probe_view
+layout(std430, binding = 13) readonly buffer Probes {
+  mat4 viewToWorld;
+  uint count;
+  float level;  // the one the surfaces reflect
+  vec4 spheres[maxReflectionProbes];  // center and radius, 0 until the probe is captured
+} probes;
+
+// What the surface reflects of the probe it's deepest into, or nothing outside of every probe.
+// The reflected ray is traced to the probe's sphere, as if the surroundings were on it, which
+// keeps the reflections from sliding along with the camera, and the surfaces reflect as much as a
+// dielectric's Fresnel term says, there being no materials to tell otherwise. The reflection
+// fades out towards the edge of the sphere, so probes don't pop in and out.
+vec3 probeReflection(vec3 position, vec3 normal) {
+  vec3 world = (probes.viewToWorld * vec4(position, 1.0)).xyz;
+
+  uint best = maxReflectionProbes;
+  float nearest = 1.0;
+  for (uint i = 0; i < probes.count; ++i) {
+    vec4 sphere = probes.spheres[i];
+    if (sphere.w <= 0.0) {
+      continue;
+    }
+    float depth = length(world - sphere.xyz) / sphere.w;
+    if (depth < nearest) {
+      best = i;
+      nearest = depth;
+    }
+  }
+  if (best == maxReflectionProbes) {
+    return vec3(0.0);
+  }
+
+  vec3 view = normalize(position);
+  vec3 direction = mat3(probes.viewToWorld) * reflect(view, normal);
+
+  // From within the sphere the ray always leaves it, at the far root
+  vec4 sphere = probes.spheres[best];
+  vec3 offset = world - sphere.xyz;
+  float b = dot(offset, direction);
+  float c = dot(offset, offset) - sphere.w * sphere.w;
+  float t = -b + sqrt(max(b * b - c, 0.0));
+  vec3 coord = cubeFaceCoord(offset + direction * t);
+
+  vec3 reflected = textureLod(probeCubes, vec3(coord.xy, float(best * 6u) + coord.z),
+                              probes.level).rgb;
+
+  float cosine = clamp(dot(-view, normal), 0.0, 1.0);
+  float fresnel = 0.04 + 0.96 * pow(1.0 - cosine, 5.0);
+  return reflected * fresnel * clamp((1.0 - nearest) * 4.0, 0.0, 1.0);
+}
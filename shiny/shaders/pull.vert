@@ -0,0 +1,87 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : enable
+#endif
+
+// shader.vert with the vertices read out of the geometry pool instead of the vertex input, see
+// renderer::setVertexPulling. Pipelines without vertex attributes don't depend on the vertex
+// layout, so meshes of either format are drawn with the same ones.
+
+// The eyes' or viewports' views with MULTIVIEW, as in shader.vert
+layout(binding = 0) uniform UniformBufferObject {
+  mat4 viewproj;
+  mat4 views[4];
+} ubo;
+
+// One per instance, see draw_instance in draw_buffer.h, which says how its mesh's vertices are laid
+// out as well. With MULTIVIEW its matrix is the model matrix.
+struct Instance {
+  mat4 mvp;
+  uint textureIndex;
+  uint vertexFormat;
+};
+
+layout(std430, binding = 2) readonly buffer DrawInstances {
+  Instance instances[];
+} draws;
+
+// The geometry pool's two whole vertex streams. gl_VertexIndex already has the draw's vertexOffset
+// added, which counts whole vertices of the mesh's own strides.
+layout(std430, binding = 3) readonly buffer Positions {
+  uint words[];
+} positions;
+
+layout(std430, binding = 8) readonly buffer Attributes {
+  uint words[];
+} attributes;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTextureIndex;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+// The depth prepass draws with this shader as well, see renderer::setDepthPrepass
+invariant gl_Position;
+
+// vertex_format::packed, see packed_vertex: 16 bit normalized positions and a padding component, 8
+// bit normalized colors and half float texcoords and two words of padding, the same way the vertex
+// input would read them
+const uint packedFormat = 1;
+
+void main() {
+    Instance instance = draws.instances[gl_InstanceIndex];
+
+    vec3 position;
+    vec3 color;
+    vec2 texcoord;
+    uint index = uint(gl_VertexIndex);
+    if (instance.vertexFormat == packedFormat) {
+        position = vec3(unpackUnorm2x16(positions.words[index * 2]),
+                        unpackUnorm2x16(positions.words[index * 2 + 1]).x);
+        color = unpackUnorm4x8(attributes.words[index * 4]).rgb;
+        texcoord = unpackHalf2x16(attributes.words[index * 4 + 1]);
+    } else {
+        // Vertex: three floats of position, and three of color, two of texcoord and one of
+        // padding, see vertex_attributes
+        uint base = index * 3;
+        position = uintBitsToFloat(uvec3(positions.words[base], positions.words[base + 1],
+                                         positions.words[base + 2]));
+        base = index * 6;
+        color = uintBitsToFloat(uvec3(attributes.words[base], attributes.words[base + 1],
+                                      attributes.words[base + 2]));
+        texcoord = uintBitsToFloat(uvec2(attributes.words[base + 3], attributes.words[base + 4]));
+    }
+
+#ifdef MULTIVIEW
+    gl_Position = ubo.views[gl_ViewIndex] * (instance.mvp * vec4(position, 1.0));
+#else
+    gl_Position = instance.mvp * vec4(position, 1.0);
+#endif
+    fragColor = color;
+    fragTexCoord = texcoord;
+    fragTextureIndex = instance.textureIndex;
+}
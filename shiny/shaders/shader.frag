@@ -1,20 +1,68 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+#ifdef RAY_QUERY_SHADOWS
+#extension GL_EXT_ray_query : require
+#endif
+
+#include "lighting.glsl"
+#include "shadows.glsl"
+#include "probes.glsl"
 
 layout(binding = 1) uniform sampler2D texSampler;
 
+// Permutations, see shader_feature in pipeline_library.h. The pipeline sets them, and the driver
+// compiles out whatever they turn off.
+layout(constant_id = 0) const bool useTexture = true;
+layout(constant_id = 1) const bool useVertexColor = false;
+layout(constant_id = 2) const bool alphaTest = false;
+layout(constant_id = 3) const bool showTexCoords = false;
+layout(constant_id = 4) const bool useLighting = false;
+layout(constant_id = 5) const bool useShadows = false;
+layout(constant_id = 6) const bool writeGBuffer = false;
+layout(constant_id = 7) const bool useReflections = false;
+
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 
 layout(location = 0) out vec4 outColor;
+layout(location = 1) out vec4 outNormal;  // only with writeGBuffer
 
 void main() {
-	//Just UV color interp checking
-    //outColor = vec4(fragTexCoord, 0.0, 1.0);
-	
-	//Just the texture image
-	outColor = texture(texSampler, fragTexCoord);
+    if (showTexCoords) {
+        outColor = vec4(fragTexCoord, 0.0, 1.0);
+        return;
+    }
 
-	//Both texture image and UV color
-	//outColor = vec4(fragColor * texture(texSampler, fragTexCoord).rgb, 1.0);
+    // The color is shaded in half precision in the HALF_PRECISION variant, see precision.glsl
+    half4 color = half4(useTexture ? texture(texSampler, fragTexCoord) : vec4(1.0));
+    if (useVertexColor) {
+        color.rgb *= half3(fragColor);
+    }
+    if (writeGBuffer) {
+        // Lit by deferred.frag instead, from the normal packed into [0, 1]
+        vec3 normal = flatNormal(viewPosition());
+        if (alphaTest && color.a < 0.5) {
+            discard;
+        }
+        outColor = vec4(vec3(color.rgb), 1.0);
+        outNormal = vec4(normal * 0.5 + 0.5, 1.0);
+        return;
+    }
+    if (useLighting) {
+        vec3 position = viewPosition();
+        vec3 normal = flatNormal(position);
+        vec3 light = clusteredLighting(position, normal);
+        if (useShadows) {
+            light += sunLighting(position, normal);
+        }
+        color.rgb *= half3(light);
+        if (useReflections) {
+            color.rgb += half3(probeReflection(position, normal));
+        }
+    }
+    if (alphaTest && color.a < 0.5) {
+        discard;
+    }
+    outColor = vec4(color);
 }
@@ -1,28 +1,55 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : enable
+#endif
 
 // Note that the order of the uniform, in and out declarations doesn't matter. 
 // The binding directive is similar to the location directive for attributes. 
 
+// Both matrices are multiplied together on the CPU, see updateUniformBuffer and writeDrawBuffer.
+// Built with MULTIVIEW for stereo and viewports, where each eye's or viewport's view projection is
+// applied here instead, see renderer::setStereo and renderer::addViewport.
 layout(binding = 0) uniform UniformBufferObject {
-  mat4 model;
-  mat4 view;
-  mat4 proj;
+  mat4 viewproj;
+  mat4 views[4];
 } ubo;
 
+// One per instance, see draw_instance in draw_buffer.h. The firstInstance of every draw points at
+// the first of its own, so gl_InstanceIndex picks out the current instance's. With MULTIVIEW the
+// matrix is the model matrix alone.
+struct Instance {
+  mat4 mvp;
+  uint textureIndex;
+};
+
+layout(std430, binding = 2) readonly buffer DrawInstances {
+  Instance instances[];
+} draws;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTextureIndex;
 
 out gl_PerVertex {
     vec4 gl_Position;
 };
 
+// Exactly the same as depth.vert's, for the equal depth test after the depth prepass
+invariant gl_Position;
+
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+#ifdef MULTIVIEW
+    vec4 world = draws.instances[gl_InstanceIndex].mvp * vec4(inPosition, 1.0);
+    gl_Position = ubo.views[gl_ViewIndex] * world;
+#else
+    gl_Position = draws.instances[gl_InstanceIndex].mvp * vec4(inPosition, 1.0);
+#endif
     fragColor = inColor;
 	fragTexCoord = inTexCoord;
+    fragTextureIndex = draws.instances[gl_InstanceIndex].textureIndex;
 }
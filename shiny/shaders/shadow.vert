@@ -0,0 +1,19 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Only the depth of the shadow casters, see shadow_cascades. Packed positions come out of the
+// vertex input in [0, 1], and their dequantize is part of the transform, like in shader.vert.
+
+layout(push_constant) uniform Caster {
+    mat4 mvp;  // the cascade's view projection times the caster's model matrix
+} caster;
+
+layout(location = 0) in vec3 inPosition;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+    gl_Position = caster.mvp * vec4(inPosition, 1.0);
+}
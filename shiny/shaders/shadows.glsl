@@ -0,0 +1,79 @@
+// The directional light's cascaded shadow maps, see shadow_cascades.h, for the fragment shaders to
+// include after lighting.glsl. Everything here is in view space, like the lights. With
+// RAY_QUERY_SHADOWS the shadows are traced through the scene instead, see
+// acceleration_structures.h, which takes GL_EXT_ray_query in the including shader.
+
+const uint shadowCascadeCount = 4;
+
+#ifdef RAY_QUERY_SHADOWS
+layout(binding = 11) uniform accelerationStructureEXT shadowScene;
+#else
+// Every cascade is a layer, compared against with the hardware's 2x2 filtering where it has it
+layout(binding = 6) uniform sampler2DArrayShadow shadowMap;
+#endif
+
+layout(std430, binding = 7) readonly buffer Shadows {
+  mat4 cascades[shadowCascadeCount];  // view space to the layer's texture coordinates and depth
+  vec4 splits;      // the view space distance each cascade ends at
+  vec4 texelSizes;  // of each cascade's texels, in world units
+  vec3 direction;   // towards the light
+  vec3 color;
+  mat4 viewToWorld;
+} shadows;
+
+#ifdef RAY_QUERY_SHADOWS
+// Whether anything is between the position and the sun, as far as the scene goes. The ray starts a
+// little off the surface, which keeps it from hitting the triangle it starts on, and any hit will
+// do.
+float shadowFactor(vec3 position, vec3 normal) {
+  vec3 origin = (shadows.viewToWorld * vec4(position + normal * 0.01, 1.0)).xyz;
+  vec3 direction = mat3(shadows.viewToWorld) * shadows.direction;
+
+  rayQueryEXT query;
+  rayQueryInitializeEXT(query, shadowScene,
+                        gl_RayFlagsTerminateOnFirstHitEXT | gl_RayFlagsOpaqueEXT, 0xff, origin,
+                        0.001, direction, 1000.0);
+  while (rayQueryProceedEXT(query)) {
+  }
+  return rayQueryGetIntersectionTypeEXT(query, true) == gl_RayQueryCommittedIntersectionNoneEXT
+           ? 1.0
+           : 0.0;
+}
+#else
+// How much of the light gets to the position, 0 where it's in shadow. The position is pushed out
+// along the normal by a texel or so first, which keeps surfaces from shadowing themselves.
+float shadowFactor(vec3 position, vec3 normal) {
+  float distance = -position.z;
+  if (distance >= shadows.splits[shadowCascadeCount - 1]) {
+    return 1.0;
+  }
+
+  uint cascade = 0;
+  while (distance >= shadows.splits[cascade]) {
+    ++cascade;
+  }
+
+  vec3 offset = position + normal * shadows.texelSizes[cascade] * 1.5;
+  vec4 coord = shadows.cascades[cascade] * vec4(offset, 1.0);
+
+  // Four taps half a texel apart, each filtered, cover a 3x3 texel footprint
+  vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+  float lit = 0.0;
+  for (int y = 0; y < 2; ++y) {
+    for (int x = 0; x < 2; ++x) {
+      vec2 uv = coord.xy + (vec2(x, y) - 0.5) * texel;
+      lit += texture(shadowMap, vec4(uv, float(cascade), coord.z));
+    }
+  }
+  return lit * 0.25;
+}
+#endif
+
+// The directional light reaching the fragment
+vec3 sunLighting(vec3 position, vec3 normal) {
+  float diffuse = dot(normal, shadows.direction);
+  if (diffuse <= 0.0) {
+    return vec3(0.0);
+  }
+  return shadows.color * diffuse * shadowFactor(position, normal);
+}
@@ -0,0 +1,35 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Shaded by its slope and height alone, grass on the flat, rock on the steep and snow up high, lit
+// by the sun with the normal of the triangle, see terrain.vert
+
+layout(push_constant) uniform Constants {
+    mat4 viewProjection;
+    vec4 map;  // the origin's x and y, texel spacing, height scale
+    vec3 sunDirection;
+    float size;
+    vec3 sunColor;
+} constants;
+
+layout(location = 0) in vec3 fragPosition;
+
+layout(location = 0) out vec4 outColor;
+
+const vec3 grass = vec3(0.18, 0.32, 0.09);
+const vec3 rock = vec3(0.34, 0.31, 0.28);
+const vec3 snow = vec3(0.9, 0.92, 0.95);
+
+void main() {
+    vec3 normal = normalize(cross(dFdx(fragPosition), dFdy(fragPosition)));
+    if (normal.z < 0.0) {
+        normal = -normal;
+    }
+
+    float altitude = fragPosition.z / constants.map.w;
+    vec3 color = mix(rock, grass, smoothstep(0.75, 0.9, normal.z));
+    color = mix(color, snow, smoothstep(0.65, 0.8, altitude) * smoothstep(0.6, 0.75, normal.z));
+
+    vec3 light = constants.sunColor * max(dot(normal, constants.sunDirection), 0.0) + vec3(0.15);
+    outColor = vec4(color * light, 1.0);
+}
@@ -0,0 +1,22 @@
+// The terrain's heights, see clipmap_terrain in terrain.h, for the shaders to include. Every texel
+// of a level is in its layer at its coordinates modulo the window.
+
+layout(binding = 0) uniform sampler2DArray heights;
+
+// Has to match terrain_window_tiles * terrain_tile_size
+const int windowTexels = 512;
+
+float terrainTexel(uint layer, ivec2 coordinate) {
+    return texelFetch(heights, ivec3(coordinate & (windowTexels - 1), layer), 0).r;
+}
+
+// Bilinear between the layer's texels, at `position` in texels of level 0
+float terrainHeight(uint layer, vec2 position) {
+    vec2 coordinate = position / float(1u << layer);
+    ivec2 low = ivec2(floor(coordinate));
+    vec2 f = coordinate - vec2(low);
+    return mix(mix(terrainTexel(layer, low), terrainTexel(layer, low + ivec2(1, 0)), f.x),
+               mix(terrainTexel(layer, low + ivec2(0, 1)), terrainTexel(layer, low + ivec2(1, 1)),
+                   f.x),
+               f.y);
+}
@@ -0,0 +1,58 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+// The clipmap's grid meshes, displaced by the heights of their level, see clipmap_terrain in
+// terrain.h
+
+#include "terrain.glsl"
+
+// See terrain_constants in terrain.cpp
+layout(push_constant) uniform Constants {
+    mat4 viewProjection;
+    vec4 map;  // the origin's x and y, texel spacing, height scale
+    vec3 sunDirection;
+    float size;  // texels across the heightmap
+    vec3 sunColor;
+} constants;
+
+layout(location = 0) in ivec2 inGrid;       // in quads of the level
+layout(location = 1) in vec3 inPlacement;   // offset in texels of level 0, and texels a quad
+layout(location = 2) in uint inInfo;        // layer, coarser layer << 8, mirrored << 16 and 17
+layout(location = 3) in vec2 inCenter;      // of the level, in texels of level 0
+
+layout(location = 0) out vec3 fragPosition;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+// Has to match ring_tile_quads
+const float ringTileQuads = 64.0;
+
+// Quads of the level over which its heights go over into the coarser level's, up to its edge
+const float blendQuads = 16.0;
+
+void main() {
+    uint layer = inInfo & 0xffu;
+    uint coarser = (inInfo >> 8) & 0xffu;
+    vec2 mirror = vec2((inInfo & 0x10000u) != 0u ? -1.0 : 1.0,
+                       (inInfo & 0x20000u) != 0u ? -1.0 : 1.0);
+    float scale = inPlacement.z;
+    vec2 position = inPlacement.xy + vec2(inGrid) * mirror * scale;
+
+    // Past its edges the heightmap is folded onto them
+    vec2 folded = clamp(position, vec2(0.0), vec2(constants.size - 1.0));
+    float h = terrainHeight(layer, folded);
+    if (coarser != 0xffu) {
+        vec2 distance = abs(position - inCenter) / scale;
+        float edge = 2.0 * ringTileQuads + 1.0;
+        float blend = clamp((max(distance.x, distance.y) - (edge - blendQuads)) / blendQuads,
+                            0.0, 1.0);
+        h = mix(h, terrainHeight(coarser, folded), blend);
+    }
+
+    vec3 world = vec3(constants.map.xy + folded * constants.map.z, h * constants.map.w);
+    fragPosition = world;
+    gl_Position = constants.viewProjection * vec4(world, 1.0);
+}
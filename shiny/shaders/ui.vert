@@ -0,0 +1,29 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The quads of sprite_batch, in pixels from the top left
+
+// See sprite_constants in sprite_batch.cpp
+layout(push_constant) uniform Constants {
+    vec2 scale;
+} constants;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inTexCoord;
+layout(location = 2) in vec4 inColor;
+layout(location = 3) in uint inTexture;
+
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) out vec4 fragColor;
+layout(location = 2) flat out uint fragTexture;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+void main() {
+    fragTexCoord = inTexCoord;
+    fragColor = inColor;
+    fragTexture = inTexture;
+    gl_Position = vec4(inPosition * constants.scale - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,61 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// A tuft of three grass blades for every instance vegetation.comp scattered, see vegetation.h.
+// There are no vertices to bind, each blade is made out of gl_VertexIndex.
+
+struct Instance {
+    vec4 placement;  // the base, and the height
+    vec4 info;       // the yaw, tint and lean
+};
+
+layout(std430, binding = 2) readonly buffer Instances {
+    Instance instances[];
+} instances;
+
+// See vegetation_draw_constants in vegetation.cpp
+layout(push_constant) uniform Constants {
+    mat4 viewProjection;
+    vec4 sunDirection;  // w is the scene time in seconds
+    vec4 sunColor;
+} constants;
+
+layout(location = 0) out vec3 fragColor;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+// A blade is a quad and a tip, three triangles, so a tuft is vegetation_vertices in
+// vegetation.cpp. Its corners go across from -1 to 1 and up from 0 to 1.
+const int bladeVertices = 9;
+const int corners[9] = int[](0, 1, 2, 2, 1, 3, 2, 3, 4);
+const vec2 shape[5] = vec2[](vec2(-1.0, 0.0), vec2(1.0, 0.0), vec2(-0.6, 0.5), vec2(0.6, 0.5),
+                             vec2(0.0, 1.0));
+
+const vec3 root = vec3(0.08, 0.16, 0.04);
+const vec3 tip = vec3(0.3, 0.45, 0.12);
+
+void main() {
+    Instance instance = instances.instances[gl_InstanceIndex];
+    int blade = gl_VertexIndex / bladeVertices;
+    vec2 corner = shape[corners[gl_VertexIndex % bladeVertices]];
+
+    float height = instance.placement.w;
+    float yaw = instance.info.x + float(blade) * 2.0943951;
+    vec2 across = vec2(cos(yaw), sin(yaw));
+    vec2 facing = vec2(-across.y, across.x);
+
+    // Bent over more towards the tip, and swayed by a wind that rolls over the terrain
+    float time = constants.sunDirection.w;
+    float sway = 0.15 * sin(1.7 * time + dot(instance.placement.xy, vec2(0.37, 0.21)));
+    float bend = (instance.info.z + sway) * corner.y * corner.y;
+
+    vec3 position = instance.placement.xyz
+                    + vec3((across * corner.x * 0.05 + facing * bend) * height, corner.y * height);
+
+    // Lit as if facing straight up, like the flat terrain it grows on
+    vec3 light = constants.sunColor.rgb * max(constants.sunDirection.z, 0.0) + vec3(0.15);
+    fragColor = mix(root, tip * instance.info.y, corner.y) * light;
+    gl_Position = constants.viewProjection * vec4(position, 1.0);
+}